@@ -28,11 +28,16 @@
 #include <memory>
 #include <string>
 #include <stdexcept>
+#include <type_traits>
 
 #include <aipstack/misc/Function.h>
 #include <aipstack/structure/index/AvlTreeIndex.h>
 #include <aipstack/structure/index/MruListIndex.h>
+#include <aipstack/structure/index/HashTableIndex.h>
+#include <aipstack/structure/index/BTreeIndex.h>
 #include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/structure/minimum/ArrayHeap.h>
+#include <aipstack/structure/HierarchicalTimerWheel.h>
 #include <aipstack/platform/PlatformFacade.h>
 #include <aipstack/platform/HostedPlatformImpl.h>
 #include <aipstack/event_loop/EventLoop.h>
@@ -52,6 +57,7 @@
 
 #include "tap_iface.h"
 #include "example_app.h"
+#include "http_server_app.h"
 
 namespace aipstack_example {
 
@@ -65,9 +71,22 @@ constexpr AIpStack::Ip4Addr DeviceGatewayAddr = AIpStack::Ip4Addr(192, 168, 64,
 constexpr AIpStack::MacAddr DeviceMacAddr =
     AIpStack::MacAddr(0x8e, 0x86, 0x90, 0x97, 0x65, 0xd5);
 
+#if defined(__linux__)
+// Whether to attach to an existing network interface using an AF_PACKET socket
+// (PacketDeviceLinux) instead of creating a TAP interface.
+constexpr bool DeviceUsePacketSocket = false;
+#endif
+
 // Index data structure to use for various things.
 using IndexService = AIpStack::AvlTreeIndexService; // AVL tree
 //using IndexService = AIpStack::MruListIndexService; // Linked list
+//using IndexService = AIpStack::HashTableIndexService<64>; // Hash table
+//using IndexService = AIpStack::BTreeIndexService<2048>; // B+tree
+
+// The services below are configured individually. Alternatively, a preset from
+// aipstack/ip/IpStackPresets.h (e.g. AIpStack::ServerProfile) can be passed as the
+// first option of IpStackService, IpTcpProtoService, IpUdpProtoService and
+// EthIpIfaceService, followed by any overrides.
 
 // IP layer (IpStack) configuration
 using MyIpStackService = AIpStack::IpStackService<
@@ -110,6 +129,8 @@ using MyEthIpIfaceService = AIpStack::EthIpIfaceService<
     AIpStack::EthIpIfaceOptions::HeaderBeforeEth::Is<0>,
     AIpStack::EthIpIfaceOptions::TimersStructureService::Is<
         AIpStack::LinkedHeapService
+        //AIpStack::ArrayHeapService<64>
+        //AIpStack::HierarchicalTimerWheelService<24> // ~17ms ticks with ns time
     >
 >;
 
@@ -123,6 +144,11 @@ using MyExampleAppService = AIpStackExamples::ExampleAppService<
     // use defaults
 >;
 
+// HTTP server configuration.
+using MyHttpServerAppService = AIpStackExamples::HttpServerAppService<
+    // use defaults
+>;
+
 // CONFIGURATION - END
 
 
@@ -139,7 +165,14 @@ class IpStackArg : public MyIpStackService::template Compose<
 using MyIpStack = AIpStack::IpStack<IpStackArg>;
 
 // Instantiate the TapIface.
-using MyTapIface = AIpStackExamples::TapIface<IpStackArg, MyEthIpIfaceService>;
+#if defined(__linux__)
+using MyDevice = std::conditional_t<DeviceUsePacketSocket,
+    AIpStack::PacketDeviceLinux, AIpStack::TapDevice>;
+#else
+using MyDevice = AIpStack::TapDevice;
+#endif
+using MyTapIface = AIpStackExamples::TapIface<
+    IpStackArg, MyEthIpIfaceService, MyDevice>;
 
 // Instantiate the IpDhcpClient.
 class DhcpClientArg : public MyDhcpClientService::template Compose<
@@ -150,6 +183,10 @@ using MyDhcpClient = AIpStack::IpDhcpClient<DhcpClientArg>;
 class MyExampleAppArg : public MyExampleAppService::template Compose<IpStackArg> {};
 using MyExampleApp = AIpStackExamples::ExampleApp<MyExampleAppArg>;
 
+// Instantiate the HTTP server.
+class MyHttpServerAppArg : public MyHttpServerAppService::template Compose<IpStackArg> {};
+using MyHttpServerApp = AIpStackExamples::HttpServerApp<MyHttpServerAppArg>;
+
 // Callback function for printing DHCP client events
 static void dhcpClientCallback (
     std::unique_ptr<MyDhcpClient> const &dhcp, AIpStack::IpDhcpClientEvent event_type)
@@ -192,6 +229,18 @@ int main (int argc, char *argv[])
 
     std::string device_id = (argc > 1) ? argv[1] : "";
     
+    // Load any further arguments as files to be served by the HTTP server.
+    AIpStackExamples::HttpFileCache http_cache;
+    for (int i = 2; i < argc; i++) {
+        try {
+            http_cache.loadFile(argv[i]);
+        }
+        catch (std::runtime_error const &ex) {
+            std::fprintf(stderr, "Error loading file: %s\n", ex.what());
+            return 1;
+        }
+    }
+    
     // Construct the SignalCollector.
     AIpStack::SignalCollector signal_collector(AIpStack::SignalType::ExitSignals);
 
@@ -249,6 +298,9 @@ int main (int argc, char *argv[])
     // Construct the example application.
     auto example_app = std::make_unique<MyExampleApp>(&*stack);
     
+    // Construct the HTTP server.
+    auto http_server_app = std::make_unique<MyHttpServerApp>(&*stack, &http_cache);
+    
     std::fprintf(stderr, "Initialized, entering event loop.\n");
     
     // Run the event loop.
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <stdexcept>
+
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/HostedPlatformImpl.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/event_loop/SignalWatcher.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/udp/IpUdpProto.h>
+#include <aipstack/eth/EthIpIface.h>
+#include <aipstack/eth/MacAddr.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/utils/IpAddrFormat.h>
+#include <aipstack/utils/IntFormat.h>
+
+#include "tap_iface.h"
+#include "load_gen_app.h"
+
+namespace aipstack_load_gen {
+
+// CONFIGURATION
+
+// Address configuration (static, so that load can be generated right away).
+constexpr AIpStack::Ip4Addr DeviceIpAddr = AIpStack::Ip4Addr(192, 168, 64, 11);
+constexpr std::uint8_t DevicePrefixLength = 24;
+constexpr AIpStack::Ip4Addr DeviceGatewayAddr = AIpStack::Ip4Addr(192, 168, 64, 1);
+constexpr AIpStack::MacAddr DeviceMacAddr =
+    AIpStack::MacAddr(0x8e, 0x86, 0x90, 0x97, 0x65, 0xd6);
+
+using IndexService = AIpStack::AvlTreeIndexService;
+
+// IP layer (IpStack) configuration
+using MyIpStackService = AIpStack::IpStackService<
+    AIpStack::IpStackOptions::HeaderBeforeIp::Is<AIpStack::EthHeader::Size>,
+    AIpStack::IpStackOptions::PathMtuCacheService::Is<
+        AIpStack::IpPathMtuCacheService<
+            AIpStack::IpPathMtuCacheOptions::NumMtuEntries::Is<64>,
+            AIpStack::IpPathMtuCacheOptions::MtuIndexService::Is<IndexService>
+        >
+    >,
+    AIpStack::IpStackOptions::ReassemblyService::Is<
+        AIpStack::IpReassemblyService<>
+    >
+>;
+
+// List of transport protocols. There need to be more PCBs than connections
+// since closed connections remain in TIME_WAIT for a while.
+using ProtocolServicesList = AIpStack::MakeTypeList<
+    AIpStack::IpTcpProtoService<
+        AIpStack::IpTcpProtoOptions::NumTcpPcbs::Is<8192>,
+        AIpStack::IpTcpProtoOptions::PcbIndexService::Is<IndexService>
+    >,
+    AIpStack::IpUdpProtoService<
+        AIpStack::IpUdpProtoOptions::UdpIndexService::Is<IndexService>
+    >
+>;
+
+// Ethernet layer (EthIpIface) configuration
+using MyEthIpIfaceService = AIpStack::EthIpIfaceService<
+    AIpStack::EthIpIfaceOptions::NumArpEntries::Is<16>,
+    AIpStack::EthIpIfaceOptions::ArpProtectCount::Is<8>,
+    AIpStack::EthIpIfaceOptions::HeaderBeforeEth::Is<0>,
+    AIpStack::EthIpIfaceOptions::TimersStructureService::Is<
+        AIpStack::LinkedHeapService
+    >
+>;
+
+// Load generator configuration.
+using MyLoadGenAppService = AIpStackExamples::LoadGenAppService<
+    // use defaults
+>;
+
+// CONFIGURATION - END
+
+
+using PlatformImpl = AIpStack::HostedPlatformImpl;
+using PlatformRef = AIpStack::PlatformRef<PlatformImpl>;
+using Platform = AIpStack::PlatformFacade<PlatformImpl>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = AIpStack::IpStack<IpStackArg>;
+
+using MyTapIface = AIpStackExamples::TapIface<
+    IpStackArg, MyEthIpIfaceService, AIpStack::TapDevice>;
+
+class MyLoadGenAppArg : public MyLoadGenAppService::template Compose<IpStackArg> {};
+using MyLoadGenApp = AIpStackExamples::LoadGenApp<MyLoadGenAppArg>;
+
+static void usage (char const *prog)
+{
+    std::fprintf(stderr,
+        "Usage: %s <device> <target-addr> [options]\n"
+        "  -c <n>     Number of TCP connections (default 0)\n"
+        "  -p <port>  TCP port (default 2001)\n"
+        "  -m <mode>  connect, rr (request/response, default) or bulk\n"
+        "  -r <str>   Request (default 64 bytes)\n"
+        "  -s <n>     Response size (default 64)\n"
+        "  -n <n>     Requests per connection, 0 for unlimited (default 0)\n"
+        "  -C <n>     Maximum connections being established (default 64)\n"
+        "  -u <pps>   UDP packets per second (default 0)\n"
+        "  -U <port>  UDP port (default 9)\n"
+        "  -l <n>     UDP payload size (default 18)\n"
+        "  -d <sec>   Duration, 0 for until interrupted (default 0)\n",
+        prog);
+}
+
+template<typename T>
+static bool parseIntArg (char const *str, T &out)
+{
+    return AIpStack::ParseInteger(AIpStack::MemRef(str), out);
+}
+
+static bool parseArgs (int argc, char *argv[], AIpStackExamples::LoadGenParams &params)
+{
+    if (!AIpStack::ParseIpAddr(AIpStack::MemRef(argv[2]), params.addr)) {
+        return false;
+    }
+    
+    for (int i = 3; i < argc; i += 2) {
+        if (std::strlen(argv[i]) != 2 || argv[i][0] != '-' || i + 1 >= argc) {
+            return false;
+        }
+        char const *val = argv[i + 1];
+        
+        bool ok = true;
+        switch (argv[i][1]) {
+            case 'c': ok = parseIntArg(val, params.num_connections); break;
+            case 'p': ok = parseIntArg(val, params.tcp_port); break;
+            case 'r': params.request = val; break;
+            case 's': ok = parseIntArg(val, params.response_size); break;
+            case 'n': ok = parseIntArg(val, params.requests_per_connection); break;
+            case 'C': ok = parseIntArg(val, params.max_connecting); break;
+            case 'u': ok = parseIntArg(val, params.udp_pps); break;
+            case 'U': ok = parseIntArg(val, params.udp_port); break;
+            case 'l': ok = parseIntArg(val, params.udp_size); break;
+            case 'd': ok = parseIntArg(val, params.duration_sec); break;
+            case 'm': {
+                std::string mode = val;
+                if (mode == "connect") {
+                    params.mode = AIpStackExamples::LoadGenMode::Connect;
+                } else if (mode == "rr") {
+                    params.mode = AIpStackExamples::LoadGenMode::RequestResponse;
+                } else if (mode == "bulk") {
+                    params.mode = AIpStackExamples::LoadGenMode::Bulk;
+                } else {
+                    ok = false;
+                }
+            } break;
+            default:
+                ok = false;
+        }
+        
+        if (!ok) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_load_gen;
+    
+    AIpStackExamples::LoadGenParams params;
+    if (argc < 3 || !parseArgs(argc, argv, params)) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    std::string device_id = argv[1];
+    
+    AIpStack::SignalCollector signal_collector(AIpStack::SignalType::ExitSignals);
+    
+    AIpStack::EventLoop event_loop;
+    
+    AIpStack::SignalWatcher signal_watcher(event_loop, signal_collector,
+    [&event_loop](AIpStack::SignalInfo signal_info) {
+        std::printf("Got signal %s, terminating...\n",
+            nativeNameForSignalType(signal_info.type));
+        event_loop.stop();
+    });
+    
+    PlatformImpl platform_impl{event_loop};
+    
+    Platform platform{PlatformRef{&platform_impl}};
+    
+    auto stack = std::make_unique<MyIpStack>(platform);
+    
+    std::unique_ptr<MyTapIface> iface;
+    try {
+        iface = std::make_unique<MyTapIface>(platform, &*stack, device_id, DeviceMacAddr);
+    }
+    catch (std::runtime_error const &ex) {
+        std::fprintf(stderr, "Error initializing TAP interface: %s\n",
+                     ex.what());
+        return 1;
+    }
+    
+    iface->iface().setIp4Addr(
+        AIpStack::IpIfaceIp4AddrSetting(DevicePrefixLength, DeviceIpAddr));
+    iface->iface().setIp4Gateway(
+        AIpStack::IpIfaceIp4GatewaySetting(DeviceGatewayAddr));
+    
+    // Construct the load generator, which stops the event loop when finished.
+    std::unique_ptr<MyLoadGenApp> load_gen;
+    try {
+        load_gen = std::make_unique<MyLoadGenApp>(&*stack, params,
+            [&event_loop]() { event_loop.stop(); });
+    }
+    catch (std::runtime_error const &ex) {
+        std::fprintf(stderr, "Error: %s\n", ex.what());
+        return 1;
+    }
+    
+    std::fprintf(stderr, "Initialized, entering event loop.\n");
+    
+    event_loop.run();
+    
+    load_gen->printSummary();
+    
+    return 0;
+}
@@ -0,0 +1,637 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_EXAMPLE_HTTP_SERVER_H
+#define AIPSTACK_EXAMPLE_HTTP_SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/misc/ResourceArray.h>
+#include <aipstack/infra/Options.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/utils/TcpListenQueue.h>
+#include <aipstack/utils/TcpConnectionPool.h>
+#include <aipstack/utils/TcpSendRegionQueue.h>
+#include <aipstack/utils/TcpRingBufferUtils.h>
+
+namespace AIpStackExamples {
+
+// In-memory cache of complete HTTP responses. For each file, the response
+// headers (in keep-alive and close variants) and the body are prepared when
+// the file is added, so that serving a request only links this memory into
+// the send buffer of the connection (see AIpStack::TcpSendRegionQueue). The
+// cache must not be modified while the server is running.
+class HttpFileCache :
+    private AIpStack::NonCopyable<HttpFileCache>
+{
+public:
+    struct Response {
+        std::string header_keep_alive;
+        std::string header_close;
+        std::string body;
+    };
+
+    HttpFileCache () :
+        m_bad_request(makeResponse("400 Bad Request", "text/plain", "Bad Request\n")),
+        m_not_found(makeResponse("404 Not Found", "text/plain", "Not Found\n")),
+        m_not_allowed(makeResponse(
+            "405 Method Not Allowed", "text/plain", "Method Not Allowed\n"))
+    {
+        addFile("/", "text/html",
+            "<html><head><title>AIpStack</title></head>"
+            "<body><p>Hello from AIpStack!</p></body></html>\n");
+    }
+
+    void addFile (std::string const &path, char const *content_type, std::string body)
+    {
+        m_files[path] = makeResponse("200 OK", content_type, std::move(body));
+    }
+
+    // Add a file from the file system, served at "/" followed by its base name.
+    void loadFile (std::string const &fs_path)
+    {
+        std::ifstream stream(fs_path, std::ios::binary);
+        if (!stream) {
+            throw std::runtime_error("HttpFileCache: cannot open " + fs_path);
+        }
+        
+        std::string body{std::istreambuf_iterator<char>(stream),
+                         std::istreambuf_iterator<char>()};
+        
+        std::size_t slash_pos = fs_path.find_last_of("/\\");
+        std::string name = (slash_pos == std::string::npos) ?
+            fs_path : fs_path.substr(slash_pos + 1);
+        
+        addFile("/" + name, contentTypeForName(name), std::move(body));
+    }
+
+    // Find the response for a path. The key argument is used as storage for
+    // the lookup key to avoid allocating memory for each request.
+    Response const * find (AIpStack::MemRef path, std::string &key) const
+    {
+        key.assign(path.ptr, path.len);
+        auto it = m_files.find(key);
+        return (it == m_files.end()) ? nullptr : &it->second;
+    }
+
+    inline Response const & badRequest () const { return m_bad_request; }
+    inline Response const & notFound () const { return m_not_found; }
+    inline Response const & notAllowed () const { return m_not_allowed; }
+
+private:
+    static Response makeResponse (
+        char const *status, char const *content_type, std::string body)
+    {
+        std::string header = std::string("HTTP/1.1 ") + status + "\r\n" +
+            "Server: AIpStack\r\n" +
+            "Content-Type: " + content_type + "\r\n" +
+            "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        
+        Response response;
+        response.header_keep_alive = header + "\r\n";
+        response.header_close = header + "Connection: close\r\n\r\n";
+        response.body = std::move(body);
+        return response;
+    }
+
+    static char const * contentTypeForName (std::string const &name)
+    {
+        static char const * const Types[][2] = {
+            {".html", "text/html"},
+            {".htm", "text/html"},
+            {".txt", "text/plain"},
+            {".css", "text/css"},
+            {".js", "application/javascript"},
+            {".json", "application/json"},
+            {".png", "image/png"},
+            {".jpg", "image/jpeg"},
+            {".gif", "image/gif"},
+        };
+        
+        for (auto const &type : Types) {
+            std::size_t ext_len = std::strlen(type[0]);
+            if (name.size() >= ext_len &&
+                name.compare(name.size() - ext_len, ext_len, type[0]) == 0)
+            {
+                return type[1];
+            }
+        }
+        return "application/octet-stream";
+    }
+
+private:
+    Response m_bad_request;
+    Response m_not_found;
+    Response m_not_allowed;
+    std::unordered_map<std::string, Response> m_files;
+};
+
+// Static HTTP/1.1 server serving responses from a HttpFileCache, intended as a
+// realistic end-to-end benchmark (e.g. with wrk). Connections are accepted in
+// batches from a TcpListenQueue into objects of a TcpConnectionPool, so there
+// is no dynamic allocation per connection, and responses are sent without
+// copying using TcpSendRegionQueue. Keep-alive and pipelined requests are
+// supported. The number of requests per second and the average latency from
+// parsing a request to the acknowledgement of its response are printed
+// periodically; since everything runs in one event loop, this is per core.
+template<typename Arg>
+class HttpServerApp :
+    private AIpStack::NonCopyable<HttpServerApp<Arg>>
+{
+    using StackArg = typename Arg::StackArg;
+    using Params = typename Arg::Params;
+    
+    using IpStack = AIpStack::IpStack<StackArg>;
+    using PlatformImpl = typename IpStack::PlatformImpl;
+    using Platform = typename IpStack::Platform;
+    using TimeType = typename Platform::TimeType;
+
+    using TcpArg = typename IpStack::template GetProtoArg<AIpStack::TcpApi>;
+    using TcpConnection = AIpStack::TcpConnection<TcpArg>;
+    using SendRegionQueue = AIpStack::TcpSendRegionQueue<TcpArg>;
+    using Region = typename SendRegionQueue::Region;
+
+    inline static constexpr std::size_t RxBufferSize = Params::RxBufferSize;
+    inline static constexpr std::size_t MaxLineLen = Params::MaxLineLen;
+    inline static constexpr std::size_t MaxPipelined = Params::MaxPipelined;
+
+    static_assert(Params::MaxConnections > 0);
+    static_assert(Params::ListenQueueSize > 0);
+    static_assert(MaxLineLen > 0 && MaxLineLen <= RxBufferSize);
+    static_assert(MaxPipelined > 0);
+
+    using ListenQueue = AIpStack::TcpListenQueue<PlatformImpl, TcpArg, RxBufferSize>;
+    using ListenQueueEntry = typename ListenQueue::ListenQueueEntry;
+    using QueuedListener = typename ListenQueue::QueuedListener;
+
+    class Client;
+
+public:
+    HttpServerApp (IpStack *stack, HttpFileCache const *cache) :
+        m_stack(stack),
+        m_cache(cache),
+        m_listener(stack->platform(),
+            AIPSTACK_BIND_MEMBER_TN(&HttpServerApp::connectionEstablished, this)),
+        m_stats_timer(stack->platform(),
+            AIPSTACK_BIND_MEMBER_TN(&HttpServerApp::statsTimerHandler, this)),
+        m_pool(this),
+        m_num_clients(0),
+        m_accept_blocked(false),
+        m_stat_requests(0),
+        m_stat_latency_sum(0.0)
+    {
+        typename ListenQueue::ListenQueueParams q_params;
+        q_params.min_rcv_buf_size = RxBufferSize;
+        q_params.queue_size = Params::ListenQueueSize;
+        q_params.queue_timeout = TimeType(
+            Params::ListenQueueTimeoutMs * (Platform::TimeFreq / 1000.0));
+        q_params.queue_entries = m_queue;
+        
+        if (!m_listener.startListening(tcp(), {
+            /*addr=*/ AIpStack::Ip4Addr::ZeroAddr(),
+            /*port=*/ Params::HttpPort,
+            /*max_pcbs=*/ std::numeric_limits<int>::max()
+        }, q_params)) {
+            throw std::runtime_error("HttpServerApp: startListening failed.");
+        }
+        
+        if (Params::StatsIntervalSec > 0) {
+            m_stats_timer.setAfter(statsInterval());
+        }
+    }
+    
+private:
+    inline AIpStack::TcpApi<TcpArg> & tcp () const
+    {
+        return m_stack->template getProtoApi<AIpStack::TcpApi>();
+    }
+    
+    inline Platform platform () const
+    {
+        return m_stack->platform();
+    }
+    
+    inline static TimeType statsInterval ()
+    {
+        return TimeType(Params::StatsIntervalSec * Platform::TimeFreq);
+    }
+    
+    void connectionEstablished ()
+    {
+        // Accept all ready connections in one go, as long as there are free
+        // client objects. Any remaining connections stay in the listen queue
+        // until a client is released (see releaseClient).
+        while (m_listener.hasReadyConnection()) {
+            Client *client = m_pool.allocate();
+            if (client == nullptr) {
+                m_accept_blocked = true;
+                return;
+            }
+            
+            m_num_clients++;
+            client->accept();
+        }
+    }
+    
+    void releaseClient (Client *client)
+    {
+        m_pool.release(client);
+        m_num_clients--;
+        
+        if (m_accept_blocked) {
+            m_accept_blocked = false;
+            m_listener.scheduleDequeue();
+        }
+    }
+    
+    void requestCompleted (TimeType start_time)
+    {
+        TimeType now = platform().getEventTime();
+        m_stat_requests++;
+        m_stat_latency_sum += double(TimeType(now - start_time)) / Platform::TimeFreq;
+    }
+    
+    void statsTimerHandler ()
+    {
+        m_stats_timer.setAt(m_stats_timer.getSetTime() + statsInterval());
+        
+        if (m_stat_requests > 0) {
+            std::fprintf(stderr,
+                "HTTP: %.0f req/s, avg latency %.1f us, %d connections\n",
+                double(m_stat_requests) / Params::StatsIntervalSec,
+                1e6 * m_stat_latency_sum / double(m_stat_requests),
+                m_num_clients);
+        }
+        
+        m_stat_requests = 0;
+        m_stat_latency_sum = 0.0;
+    }
+
+    class Client :
+        private TcpConnection,
+        private AIpStack::NonCopyable<Client>
+    {
+        enum class State {RecvRequestLine, RecvHeaders, Closing};
+        
+        // A queued response, consisting of the header and the body region
+        // which reference memory in the HttpFileCache.
+        struct PendingResponse {
+            PendingResponse (Client *client) :
+                header_region(AIPSTACK_BIND_MEMBER_TN(&Client::regionSent, client)),
+                body_region(AIPSTACK_BIND_MEMBER_TN(&Client::regionSent, client))
+            {}
+            
+            Region header_region;
+            Region body_region;
+            TimeType start_time;
+            int num_regions;
+        };
+        
+    public:
+        Client (HttpServerApp *parent) :
+            m_parent(parent),
+            m_responses(AIpStack::ResourceArrayInitSame(), this)
+        {}
+        
+        void accept ()
+        {
+            AIpStack::IpBufRef initial_rx_data;
+            if (m_parent->m_listener.acceptConnection(*this, initial_rx_data) !=
+                AIpStack::IpErr::Success)
+            {
+                return m_parent->releaseClient(this);
+            }
+            
+            m_state = State::RecvRequestLine;
+            m_rx_line_len = 0;
+            m_resp_first = 0;
+            m_resp_count = 0;
+            m_responses_freed = false;
+            
+            // Copy any data received while in the listen queue.
+            m_rx_ring_buf.setup(*this, m_rx_buffer, RxBufferSize,
+                                Params::WindowUpdateThresDiv, initial_rx_data);
+            
+            // There may already be a complete request and even a FIN.
+            processReceived();
+        }
+        
+    private:
+        void release (bool have_unprocessed_data)
+        {
+            m_send_queue.reset();
+            TcpConnection::reset(have_unprocessed_data);
+            m_parent->releaseClient(this);
+        }
+        
+        void connectionAborted () override final
+        {
+            release(false);
+        }
+        
+        void dataReceived ([[maybe_unused]] std::size_t amount) override final
+        {
+            processReceived();
+        }
+        
+        void dataSent (std::size_t amount) override final
+        {
+            if (amount == 0) {
+                // Our FIN has been acknowledged, there is nothing more to do.
+                AIPSTACK_ASSERT(m_state == State::Closing);
+                AIPSTACK_ASSERT(m_resp_count == 0);
+                return release(false);
+            }
+            
+            // This calls regionSent for completed regions.
+            m_send_queue.dataSent(amount);
+            
+            // Continue with requests which were waiting for a free response.
+            if (m_responses_freed) {
+                m_responses_freed = false;
+                processReceived();
+            }
+        }
+        
+        void regionSent ()
+        {
+            AIPSTACK_ASSERT(m_resp_count > 0);
+            
+            // Regions are completed in order, so this belongs to the oldest response.
+            PendingResponse &pending = m_responses[m_resp_first];
+            AIPSTACK_ASSERT(pending.num_regions > 0);
+            
+            if (--pending.num_regions > 0) {
+                return;
+            }
+            
+            m_parent->requestCompleted(pending.start_time);
+            
+            m_resp_first = (m_resp_first + 1) % MaxPipelined;
+            m_resp_count--;
+            m_responses_freed = true;
+        }
+        
+        void processReceived ()
+        {
+            while (m_state != State::Closing) {
+                // Wait until the oldest response has been sent if there is no
+                // free response for the request which may be completed.
+                if (m_resp_count == MaxPipelined) {
+                    return;
+                }
+                
+                AIpStack::IpBufRef rx_data = m_rx_ring_buf.getReadRange(*this);
+                
+                // Search for a newline after any data which was already searched.
+                AIpStack::IpBufRef unparsed_data = ipBufSkipBytes(rx_data, m_rx_line_len);
+                bool found_newline = ipBufFindByteMut(unparsed_data,
+                    '\n', MaxLineLen - m_rx_line_len);
+                m_rx_line_len = rx_data.tot_len - unparsed_data.tot_len;
+                
+                if (!found_newline) {
+                    if (m_rx_line_len >= MaxLineLen) {
+                        // Line too long, respond with an error and close.
+                        m_rx_line_len = 0;
+                        return queueResponse(m_parent->m_cache->badRequest(), false);
+                    }
+                    
+                    if (TcpConnection::wasEndReceived()) {
+                        // The client closed its side, close ours after any
+                        // queued responses.
+                        TcpConnection::closeSending();
+                        m_state = State::Closing;
+                    }
+                    return;
+                }
+                
+                // Copy the line (without the CR LF) to a local buffer and
+                // consume it from the receive buffer.
+                char buf[MaxLineLen];
+                std::size_t line_len = m_rx_line_len - 1;
+                ipBufTakeBytes(rx_data, line_len, buf);
+                m_rx_ring_buf.consumeData(*this, m_rx_line_len);
+                m_rx_line_len = 0;
+                
+                if (line_len > 0 && buf[line_len - 1] == '\r') {
+                    line_len--;
+                }
+                
+                processLine(AIpStack::MemRef(buf, line_len));
+            }
+        }
+        
+        void processLine (AIpStack::MemRef line)
+        {
+            HttpFileCache const &cache = *m_parent->m_cache;
+            
+            if (m_state == State::RecvRequestLine) {
+                // Ignore empty lines before a request (RFC 7230 section 3.5).
+                if (line.len == 0) {
+                    return;
+                }
+                
+                std::size_t sp1_pos;
+                std::size_t sp2_pos;
+                if (!line.findChar(' ', sp1_pos) ||
+                    !line.subFrom(sp1_pos + 1).findChar(' ', sp2_pos))
+                {
+                    return queueResponse(cache.badRequest(), false);
+                }
+                
+                AIpStack::MemRef method = line.subTo(sp1_pos);
+                AIpStack::MemRef target = line.subFrom(sp1_pos + 1).subTo(sp2_pos);
+                AIpStack::MemRef version = line.subFrom(sp1_pos + 1 + sp2_pos + 1);
+                
+                // Ignore any query string.
+                std::size_t query_pos;
+                if (target.findChar('?', query_pos)) {
+                    target = target.subTo(query_pos);
+                }
+                
+                if (version.equalTo("HTTP/1.1")) {
+                    m_req_keep_alive = true;
+                } else if (version.equalTo("HTTP/1.0")) {
+                    m_req_keep_alive = false;
+                } else {
+                    return queueResponse(cache.badRequest(), false);
+                }
+                
+                if (!method.equalTo("GET")) {
+                    m_req_response = &cache.notAllowed();
+                } else {
+                    m_req_response = cache.find(target, m_path_key);
+                    if (m_req_response == nullptr) {
+                        m_req_response = &cache.notFound();
+                    }
+                }
+                
+                m_state = State::RecvHeaders;
+            } else {
+                AIPSTACK_ASSERT(m_state == State::RecvHeaders);
+                
+                // An empty line ends the request, which has no body.
+                if (line.len == 0) {
+                    m_state = State::RecvRequestLine;
+                    return queueResponse(*m_req_response, m_req_keep_alive);
+                }
+                
+                // The only header of interest is Connection.
+                if (line.removePrefix("Connection:") || line.removePrefix("connection:")) {
+                    while (line.len > 0 && line.at(0) == ' ') {
+                        line = line.subFrom(1);
+                    }
+                    if (line.equalTo("close")) {
+                        m_req_keep_alive = false;
+                    } else if (line.equalTo("keep-alive")) {
+                        m_req_keep_alive = true;
+                    }
+                }
+            }
+        }
+        
+        void queueResponse (HttpFileCache::Response const &response, bool keep_alive)
+        {
+            AIPSTACK_ASSERT(m_state != State::Closing);
+            AIPSTACK_ASSERT(m_resp_count < MaxPipelined);
+            
+            PendingResponse &pending =
+                m_responses[(m_resp_first + m_resp_count) % MaxPipelined];
+            m_resp_count++;
+            
+            pending.start_time = m_parent->platform().getEventTime();
+            
+            std::string const &header =
+                keep_alive ? response.header_keep_alive : response.header_close;
+            m_send_queue.queueRegion(*this, pending.header_region,
+                                     header.data(), header.size());
+            pending.num_regions = 1;
+            
+            // A file may be empty, and regions may not.
+            if (!response.body.empty()) {
+                m_send_queue.queueRegion(*this, pending.body_region,
+                                         response.body.data(), response.body.size());
+                pending.num_regions++;
+            }
+            
+            if (!keep_alive) {
+                // Send FIN after the response; data received later is ignored.
+                TcpConnection::closeSending();
+                m_state = State::Closing;
+            } else {
+                TcpConnection::sendPush();
+            }
+        }
+        
+    private:
+        HttpServerApp *m_parent;
+        AIpStack::ResourceArray<PendingResponse, MaxPipelined> m_responses;
+        SendRegionQueue m_send_queue;
+        AIpStack::RecvRingBuffer<TcpArg> m_rx_ring_buf;
+        HttpFileCache::Response const *m_req_response;
+        std::string m_path_key;
+        std::size_t m_rx_line_len;
+        std::size_t m_resp_first;
+        std::size_t m_resp_count;
+        State m_state;
+        bool m_req_keep_alive;
+        bool m_responses_freed;
+        char m_rx_buffer[RxBufferSize];
+    };
+    
+private:
+    IpStack *m_stack;
+    HttpFileCache const *m_cache;
+    // The queue entries must outlive the listener which uses them.
+    ListenQueueEntry m_queue[Params::ListenQueueSize];
+    QueuedListener m_listener;
+    typename Platform::Timer m_stats_timer;
+    AIpStack::TcpConnectionPool<Client, Params::MaxConnections> m_pool;
+    int m_num_clients;
+    bool m_accept_blocked;
+    std::uint64_t m_stat_requests;
+    double m_stat_latency_sum;
+};
+
+struct HttpServerAppOptions {
+    AIPSTACK_OPTION_DECL_VALUE(HttpPort, std::uint16_t, 8080)
+    AIPSTACK_OPTION_DECL_VALUE(MaxConnections, std::size_t, 256)
+    AIPSTACK_OPTION_DECL_VALUE(RxBufferSize, std::size_t, 4096)
+    AIPSTACK_OPTION_DECL_VALUE(MaxLineLen, std::size_t, 1024)
+    AIPSTACK_OPTION_DECL_VALUE(MaxPipelined, std::size_t, 16)
+    AIPSTACK_OPTION_DECL_VALUE(ListenQueueSize, int, 64)
+    AIPSTACK_OPTION_DECL_VALUE(ListenQueueTimeoutMs, int, 10000)
+    AIPSTACK_OPTION_DECL_VALUE(WindowUpdateThresDiv, int, 8)
+    AIPSTACK_OPTION_DECL_VALUE(StatsIntervalSec, int, 5)
+};
+
+template<typename ...Options>
+class HttpServerAppService {
+    template<typename>
+    friend class HttpServerApp;
+    
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, HttpPort)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, MaxConnections)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, RxBufferSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, MaxLineLen)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, MaxPipelined)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, ListenQueueSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, ListenQueueTimeoutMs)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, WindowUpdateThresDiv)
+    AIPSTACK_OPTION_CONFIG_VALUE(HttpServerAppOptions, StatsIntervalSec)
+    
+public:
+    template<typename StackArg_>
+    struct Compose {
+        using StackArg = StackArg_;
+        using Params = HttpServerAppService;
+        AIPSTACK_DEF_INSTANCE(Compose, HttpServerApp) 
+    };
+};
+
+}
+
+#endif
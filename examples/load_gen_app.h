@@ -0,0 +1,703 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_EXAMPLE_LOAD_GEN_H
+#define AIPSTACK_EXAMPLE_LOAD_GEN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Options.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/udp/IpUdpProto.h>
+#include <aipstack/utils/TcpConnectionPool.h>
+
+namespace AIpStackExamples {
+
+// Histogram of latencies in microseconds with logarithmically sized buckets,
+// each power of two being divided into 8 buckets, so that percentiles are
+// accurate to within 12.5%.
+class LatencyHistogram {
+    inline static constexpr int SubBits = 3;
+    inline static constexpr std::size_t NumBuckets = (64 - SubBits + 1) << SubBits;
+    
+public:
+    void add (std::uint64_t value_us)
+    {
+        m_buckets[bucketForValue(value_us)]++;
+        m_count++;
+    }
+    
+    void merge (LatencyHistogram const &other)
+    {
+        for (std::size_t i = 0; i < NumBuckets; i++) {
+            m_buckets[i] += other.m_buckets[i];
+        }
+        m_count += other.m_count;
+    }
+    
+    inline std::uint64_t count () const { return m_count; }
+    
+    // Return the lowest value of the bucket containing the given fraction
+    // (between 0 and 1) of the values, or 0 if there are no values.
+    std::uint64_t percentile (double fraction) const
+    {
+        std::uint64_t rank = std::uint64_t(fraction * double(m_count));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < NumBuckets; i++) {
+            seen += m_buckets[i];
+            if (seen > rank) {
+                return valueForBucket(i);
+            }
+        }
+        return (m_count == 0) ? 0 : valueForBucket(NumBuckets - 1);
+    }
+    
+private:
+    static std::size_t bucketForValue (std::uint64_t value)
+    {
+        if (value < (std::uint64_t(1) << SubBits)) {
+            return std::size_t(value);
+        }
+        int msb = 63;
+        while ((value >> msb) == 0) {
+            msb--;
+        }
+        std::size_t sub = std::size_t(value >> (msb - SubBits)) & ((1 << SubBits) - 1);
+        return (std::size_t(msb - SubBits + 1) << SubBits) + sub;
+    }
+    
+    static std::uint64_t valueForBucket (std::size_t bucket)
+    {
+        if (bucket < (std::size_t(1) << SubBits)) {
+            return bucket;
+        }
+        int msb = int(bucket >> SubBits) + SubBits - 1;
+        std::uint64_t sub = bucket & ((1 << SubBits) - 1);
+        return (std::uint64_t(1) << msb) | (sub << (msb - SubBits));
+    }
+    
+private:
+    std::uint32_t m_buckets[NumBuckets] = {};
+    std::uint64_t m_count = 0;
+};
+
+enum class LoadGenMode {
+    // Only open connections (e.g. with requests_per_connection to measure
+    // the connect rate).
+    Connect,
+    // Send a request and wait for a response of a known size, repeatedly.
+    RequestResponse,
+    // Send data continuously and discard any received data.
+    Bulk,
+};
+
+// Run-time parameters of LoadGenApp.
+struct LoadGenParams {
+    AIpStack::Ip4Addr addr = AIpStack::Ip4Addr::ZeroAddr();
+    
+    // TCP load, disabled if num_connections is zero.
+    std::uint16_t tcp_port = 2001;
+    int num_connections = 0;
+    int max_connecting = 64;
+    LoadGenMode mode = LoadGenMode::RequestResponse;
+    // The request; the default is 64 bytes for the echo server of ExampleApp.
+    std::string request = std::string(64, 'x');
+    // Number of bytes of each response.
+    std::size_t response_size = 64;
+    // Connections are closed and reopened after this many responses (in Connect
+    // mode, right after being established if nonzero), 0 for never.
+    std::uint32_t requests_per_connection = 0;
+    
+    // UDP flood, disabled if udp_pps is zero.
+    std::uint16_t udp_port = 9;
+    std::uint16_t udp_src_port = 40000;
+    std::uint32_t udp_pps = 0;
+    std::size_t udp_size = 18;
+    
+    // Time after which the finished handler is called, 0 for never.
+    int duration_sec = 0;
+};
+
+// Load generator opening many outbound TCP connections and optionally
+// flooding UDP datagrams, for benchmarking one stack against another (e.g.
+// ExampleApp or HttpServerApp). Connection objects are preallocated and all
+// connections send from the same read-only request memory and receive into
+// the same discard buffer, so there is no memory per connection except for
+// the TcpConnection object itself. Throughput, connect rate and latency
+// percentiles are printed periodically and as a summary when finished.
+template<typename Arg>
+class LoadGenApp :
+    private AIpStack::NonCopyable<LoadGenApp<Arg>>
+{
+    using StackArg = typename Arg::StackArg;
+    using Params = typename Arg::Params;
+    
+    using IpStack = AIpStack::IpStack<StackArg>;
+    using Platform = typename IpStack::Platform;
+    using TimeType = typename Platform::TimeType;
+
+    using TcpArg = typename IpStack::template GetProtoArg<AIpStack::TcpApi>;
+    using TcpConnection = AIpStack::TcpConnection<TcpArg>;
+    using UdpArg = typename IpStack::template GetProtoArg<AIpStack::UdpApi>;
+    using UdpApi = AIpStack::UdpApi<UdpArg>;
+    
+    inline static constexpr std::size_t MaxConnections = Params::MaxConnections;
+    inline static constexpr std::size_t RxBufferSize = Params::RxBufferSize;
+    inline static constexpr std::size_t TxBufferSize = Params::TxBufferSize;
+    inline static constexpr std::size_t UdpBatchSize = Params::UdpBatchSize;
+    inline static constexpr std::size_t MaxUdpSize = Params::MaxUdpSize;
+    
+    static_assert(MaxConnections > 0);
+    static_assert(RxBufferSize > 0 && TxBufferSize > 0);
+    static_assert(UdpBatchSize > 0);
+    static_assert(MaxUdpSize <= UdpApi::MaxUdpDataLenIp4);
+    
+    // Counters which are reset for each stats interval.
+    struct Counters {
+        std::uint64_t connects = 0;
+        std::uint64_t connect_errors = 0;
+        std::uint64_t aborts = 0;
+        std::uint64_t responses = 0;
+        std::uint64_t bytes_sent = 0;
+        std::uint64_t bytes_received = 0;
+        std::uint64_t udp_sent = 0;
+        std::uint64_t udp_errors = 0;
+        LatencyHistogram connect_latency;
+        LatencyHistogram response_latency;
+        
+        void addTo (Counters &dst) const
+        {
+            dst.connects += connects;
+            dst.connect_errors += connect_errors;
+            dst.aborts += aborts;
+            dst.responses += responses;
+            dst.bytes_sent += bytes_sent;
+            dst.bytes_received += bytes_received;
+            dst.udp_sent += udp_sent;
+            dst.udp_errors += udp_errors;
+            dst.connect_latency.merge(connect_latency);
+            dst.response_latency.merge(response_latency);
+        }
+    };
+    
+    class Connection;
+    
+public:
+    using FinishedHandler = AIpStack::Function<void()>;
+    
+    LoadGenApp (IpStack *stack, LoadGenParams const &params,
+                FinishedHandler finished_handler) :
+        m_stack(stack),
+        m_params(params),
+        m_finished_handler(finished_handler),
+        m_connect_timer(stack->platform(),
+            AIPSTACK_BIND_MEMBER_TN(&LoadGenApp::connectTimerHandler, this)),
+        m_udp_timer(stack->platform(),
+            AIPSTACK_BIND_MEMBER_TN(&LoadGenApp::udpTimerHandler, this)),
+        m_stats_timer(stack->platform(),
+            AIPSTACK_BIND_MEMBER_TN(&LoadGenApp::statsTimerHandler, this)),
+        m_finish_timer(stack->platform(),
+            AIPSTACK_BIND_MEMBER_TN(&LoadGenApp::finishTimerHandler, this)),
+        m_pool(this),
+        m_num_active(0),
+        m_num_connecting(0),
+        m_udp_credit(0.0)
+    {
+        if (m_params.num_connections < 0 ||
+            std::size_t(m_params.num_connections) > MaxConnections)
+        {
+            throw std::runtime_error("LoadGenApp: num_connections out of range.");
+        }
+        if (m_params.max_connecting <= 0) {
+            throw std::runtime_error("LoadGenApp: max_connecting must be positive.");
+        }
+        if (m_params.mode == LoadGenMode::RequestResponse &&
+            (m_params.request.empty() || m_params.response_size == 0))
+        {
+            throw std::runtime_error("LoadGenApp: empty request or response.");
+        }
+        if (m_params.udp_size > MaxUdpSize) {
+            throw std::runtime_error("LoadGenApp: udp_size too large.");
+        }
+        
+        // Shared buffers, the rx and bulk tx buffers are circular.
+        m_request_node = AIpStack::IpBufNode{
+            const_cast<char *>(m_params.request.data()), m_params.request.size(), nullptr};
+        m_discard_node = AIpStack::IpBufNode{m_discard_buf, RxBufferSize, &m_discard_node};
+        m_bulk_node = AIpStack::IpBufNode{m_bulk_buf, TxBufferSize, &m_bulk_node};
+        std::memset(m_bulk_buf, 'x', TxBufferSize);
+        std::memset(m_udp_buf, 0, sizeof(m_udp_buf));
+        
+        TimeType now = platform().getTime();
+        m_start_time = now;
+        m_stats_time = now;
+        
+        if (m_params.num_connections > 0) {
+            m_connect_timer.setNow();
+        }
+        if (m_params.udp_pps > 0) {
+            m_udp_time = now;
+            m_udp_timer.setAfter(udpTickTime());
+        }
+        if (Params::StatsIntervalSec > 0) {
+            m_stats_timer.setAfter(TimeType(Params::StatsIntervalSec * Platform::TimeFreq));
+        }
+        if (m_params.duration_sec > 0) {
+            m_finish_timer.setAfter(TimeType(m_params.duration_sec * Platform::TimeFreq));
+        }
+    }
+    
+    // Print statistics for the whole run.
+    void printSummary ()
+    {
+        m_interval.addTo(m_total);
+        m_interval = Counters();
+        
+        double seconds = double(TimeType(platform().getTime() - m_start_time)) /
+            Platform::TimeFreq;
+        printCounters("Total", m_total, seconds);
+    }
+    
+private:
+    inline AIpStack::TcpApi<TcpArg> & tcp () const
+    {
+        return m_stack->template getProtoApi<AIpStack::TcpApi>();
+    }
+    
+    inline UdpApi & udp () const
+    {
+        return m_stack->template getProtoApi<AIpStack::UdpApi>();
+    }
+    
+    inline Platform platform () const
+    {
+        return m_stack->platform();
+    }
+    
+    inline static TimeType udpTickTime ()
+    {
+        return TimeType(Params::UdpTickMs * (Platform::TimeFreq / 1000.0));
+    }
+    
+    inline static std::uint64_t timeToUs (TimeType time)
+    {
+        return std::uint64_t(double(time) * (1e6 / Platform::TimeFreq));
+    }
+    
+    void connectTimerHandler ()
+    {
+        // Start connections up to the configured number, limiting the number
+        // of connections being established at the same time.
+        while (m_num_active < m_params.num_connections &&
+               m_num_connecting < m_params.max_connecting)
+        {
+            Connection *con = m_pool.allocate();
+            AIPSTACK_ASSERT(con != nullptr);
+            
+            m_num_active++;
+            
+            if (!con->start()) {
+                m_interval.connect_errors++;
+                releaseConnection(con);
+                
+                // Retry later rather than spinning (e.g. no route yet).
+                m_connect_timer.setAfter(TimeType(0.1 * Platform::TimeFreq));
+                return;
+            }
+        }
+    }
+    
+    void releaseConnection (Connection *con)
+    {
+        m_pool.release(con);
+        m_num_active--;
+        
+        // Open a replacement connection. This is deferred to the timer since
+        // this may be called from a callback of the connection.
+        if (!m_connect_timer.isSet()) {
+            m_connect_timer.setNow();
+        }
+    }
+    
+    void udpTimerHandler ()
+    {
+        TimeType now = m_udp_timer.getSetTime();
+        m_udp_timer.setAt(now + udpTickTime());
+        
+        // Accumulate the number of datagrams to send based on the elapsed time,
+        // not allowing too large bursts after delays.
+        double elapsed = double(TimeType(now - m_udp_time)) / Platform::TimeFreq;
+        m_udp_time = now;
+        m_udp_credit = AIpStack::MinValue(m_udp_credit + elapsed * m_params.udp_pps,
+            double(m_params.udp_pps) * (10 * Params::UdpTickMs / 1000.0) + 1.0);
+        
+        AIpStack::IpRouteInfoIp4<StackArg> route_info;
+        if (!m_stack->routeIp4(m_params.addr, route_info)) {
+            m_interval.udp_errors++;
+            m_udp_credit = 0.0;
+            return;
+        }
+        
+        AIpStack::Ip4AddrPair addrs{route_info.iface->getIp4Addr().addr, m_params.addr};
+        AIpStack::IpBufNode node{m_udp_buf, sizeof(m_udp_buf), nullptr};
+        
+        // All datagrams use the same buffer, which works because they are
+        // sent one after another.
+        AIpStack::UdpTxEntry<UdpArg> entries[UdpBatchSize];
+        for (auto &entry : entries) {
+            entry.addrs = addrs;
+            entry.udp_info = {m_params.udp_src_port, m_params.udp_port};
+            entry.udp_data = AIpStack::IpBufRef{
+                &node, UdpApi::HeaderBeforeUdpData, m_params.udp_size};
+        }
+        
+        while (m_udp_credit >= 1.0) {
+            std::size_t count = std::size_t(AIpStack::MinValue(
+                m_udp_credit, double(UdpBatchSize)));
+            
+            std::size_t num_sent;
+            AIpStack::IpErr err = udp().sendUdpIp4Packets(entries, count, num_sent,
+                nullptr, nullptr, AIpStack::IpSendFlags());
+            
+            m_interval.udp_sent += num_sent;
+            m_udp_credit -= double(num_sent);
+            
+            if (err != AIpStack::IpErr::Success) {
+                // The interface is presumably busy, drop the remaining credit.
+                m_interval.udp_errors++;
+                m_udp_credit = 0.0;
+            }
+        }
+    }
+    
+    void statsTimerHandler ()
+    {
+        m_stats_timer.setAt(m_stats_timer.getSetTime() +
+            TimeType(Params::StatsIntervalSec * Platform::TimeFreq));
+        
+        TimeType now = platform().getTime();
+        double seconds = double(TimeType(now - m_stats_time)) / Platform::TimeFreq;
+        m_stats_time = now;
+        
+        printCounters("Interval", m_interval, seconds);
+        
+        m_interval.addTo(m_total);
+        m_interval = Counters();
+    }
+    
+    void finishTimerHandler ()
+    {
+        m_finished_handler();
+    }
+    
+    void printCounters (char const *name, Counters const &c, double seconds)
+    {
+        if (seconds <= 0.0) {
+            return;
+        }
+        
+        std::fprintf(stderr,
+            "%s: %d connections, %.0f connects/s (%llu errors, %llu aborts), "
+            "%.0f responses/s, tx %.1f Mbit/s, rx %.1f Mbit/s, "
+            "udp %.0f pkts/s (%llu errors)\n",
+            name, m_num_active, double(c.connects) / seconds,
+            static_cast<unsigned long long>(c.connect_errors),
+            static_cast<unsigned long long>(c.aborts),
+            double(c.responses) / seconds,
+            double(c.bytes_sent) * 8e-6 / seconds,
+            double(c.bytes_received) * 8e-6 / seconds,
+            double(c.udp_sent) / seconds,
+            static_cast<unsigned long long>(c.udp_errors));
+        
+        printLatency("  connect latency", c.connect_latency);
+        printLatency("  response latency", c.response_latency);
+    }
+    
+    static void printLatency (char const *name, LatencyHistogram const &h)
+    {
+        if (h.count() == 0) {
+            return;
+        }
+        
+        std::fprintf(stderr, "%s us: p50 %llu, p90 %llu, p99 %llu, p99.9 %llu\n", name,
+            static_cast<unsigned long long>(h.percentile(0.5)),
+            static_cast<unsigned long long>(h.percentile(0.9)),
+            static_cast<unsigned long long>(h.percentile(0.99)),
+            static_cast<unsigned long long>(h.percentile(0.999)));
+    }
+    
+    class Connection :
+        private TcpConnection,
+        private AIpStack::NonCopyable<Connection>
+    {
+        enum class State {Connecting, Connected, WaitSendBuf};
+        
+    public:
+        Connection (LoadGenApp *app) :
+            m_app(app)
+        {}
+        
+        bool start ()
+        {
+            LoadGenParams const &params = m_app->m_params;
+            
+            AIpStack::TcpStartConnectionArgs<TcpArg> args;
+            args.addr = params.addr;
+            args.port = params.tcp_port;
+            args.rcv_wnd = RxBufferSize;
+            
+            if (TcpConnection::startConnection(m_app->tcp(), args) !=
+                AIpStack::IpErr::Success)
+            {
+                return false;
+            }
+            
+            TcpConnection::setRecvBuf(
+                AIpStack::IpBufRef{&m_app->m_discard_node, 0, RxBufferSize});
+            
+            m_state = State::Connecting;
+            m_start_time = m_app->platform().getTime();
+            m_num_responses = 0;
+            m_app->m_num_connecting++;
+            
+            return true;
+        }
+        
+    private:
+        void release ()
+        {
+            if (m_state == State::Connecting) {
+                m_app->m_num_connecting--;
+            }
+            
+            TcpConnection::reset();
+            m_app->releaseConnection(this);
+        }
+        
+        void connectionAborted () override final
+        {
+            m_app->m_interval.aborts++;
+            release();
+        }
+        
+        void connectionEstablished () override final
+        {
+            AIPSTACK_ASSERT(m_state == State::Connecting);
+            
+            m_app->m_num_connecting--;
+            m_state = State::Connected;
+            
+            Counters &counters = m_app->m_interval;
+            counters.connects++;
+            counters.connect_latency.add(
+                timeToUs(TimeType(m_app->platform().getTime() - m_start_time)));
+            
+            // Allow starting another connection.
+            if (!m_app->m_connect_timer.isSet()) {
+                m_app->m_connect_timer.setNow();
+            }
+            
+            switch (m_app->m_params.mode) {
+                case LoadGenMode::Connect:
+                    checkReconnect();
+                    return;
+                case LoadGenMode::RequestResponse:
+                    return sendRequest();
+                case LoadGenMode::Bulk:
+                    TcpConnection::setSendBuf(
+                        AIpStack::IpBufRef{&m_app->m_bulk_node, 0, TxBufferSize});
+                    TcpConnection::sendPush();
+                    return;
+            }
+        }
+        
+        void dataReceived (std::size_t amount) override final
+        {
+            if (amount == 0) {
+                // The other side closed the connection, open another one.
+                return release();
+            }
+            
+            // The received data is discarded.
+            TcpConnection::extendRecvBuf(amount);
+            m_app->m_interval.bytes_received += amount;
+            
+            if (m_app->m_params.mode != LoadGenMode::RequestResponse) {
+                return;
+            }
+            
+            if (amount < m_resp_remaining) {
+                m_resp_remaining -= amount;
+                return;
+            }
+            
+            // The response is complete. Data beyond the response is not expected
+            // because there is only one outstanding request.
+            Counters &counters = m_app->m_interval;
+            counters.responses++;
+            counters.response_latency.add(
+                timeToUs(TimeType(m_app->platform().getTime() - m_start_time)));
+            
+            m_num_responses++;
+            if (checkReconnect()) {
+                return;
+            }
+            
+            // The request is normally acknowledged by now, otherwise the next one
+            // is sent from dataSent.
+            if (TcpConnection::getSendBuf().tot_len > 0) {
+                m_state = State::WaitSendBuf;
+            } else {
+                sendRequest();
+            }
+        }
+        
+        void dataSent (std::size_t amount) override final
+        {
+            m_app->m_interval.bytes_sent += amount;
+            
+            if (m_app->m_params.mode == LoadGenMode::Bulk) {
+                // Refill the circular send buffer.
+                TcpConnection::extendSendBuf(amount);
+                TcpConnection::sendPush();
+            }
+            else if (m_state == State::WaitSendBuf &&
+                     TcpConnection::getSendBuf().tot_len == 0)
+            {
+                m_state = State::Connected;
+                sendRequest();
+            }
+        }
+        
+        void sendRequest ()
+        {
+            AIpStack::IpBufRef request{&m_app->m_request_node, 0,
+                                       m_app->m_params.request.size()};
+            TcpConnection::setSendBuf(request);
+            TcpConnection::sendPush();
+            
+            m_resp_remaining = m_app->m_params.response_size;
+            m_start_time = m_app->platform().getTime();
+        }
+        
+        // Close the connection if it has done its number of requests. The
+        // connection is abandoned to the stack which closes it gracefully.
+        bool checkReconnect ()
+        {
+            std::uint32_t limit = m_app->m_params.requests_per_connection;
+            if (limit == 0 ||
+                (m_app->m_params.mode != LoadGenMode::Connect && m_num_responses < limit))
+            {
+                return false;
+            }
+            
+            TcpConnection::closeSending();
+            release();
+            return true;
+        }
+        
+    private:
+        LoadGenApp *m_app;
+        TimeType m_start_time;
+        std::size_t m_resp_remaining;
+        std::uint32_t m_num_responses;
+        State m_state;
+    };
+    
+private:
+    IpStack *m_stack;
+    LoadGenParams m_params;
+    FinishedHandler m_finished_handler;
+    typename Platform::Timer m_connect_timer;
+    typename Platform::Timer m_udp_timer;
+    typename Platform::Timer m_stats_timer;
+    typename Platform::Timer m_finish_timer;
+    AIpStack::TcpConnectionPool<Connection, MaxConnections> m_pool;
+    int m_num_active;
+    int m_num_connecting;
+    TimeType m_start_time;
+    TimeType m_stats_time;
+    TimeType m_udp_time;
+    double m_udp_credit;
+    Counters m_interval;
+    Counters m_total;
+    AIpStack::IpBufNode m_request_node;
+    AIpStack::IpBufNode m_discard_node;
+    AIpStack::IpBufNode m_bulk_node;
+    char m_discard_buf[RxBufferSize];
+    char m_bulk_buf[TxBufferSize];
+    char m_udp_buf[UdpApi::HeaderBeforeUdpData + MaxUdpSize];
+};
+
+struct LoadGenAppOptions {
+    AIPSTACK_OPTION_DECL_VALUE(MaxConnections, std::size_t, 4096)
+    AIPSTACK_OPTION_DECL_VALUE(RxBufferSize, std::size_t, 65536)
+    AIPSTACK_OPTION_DECL_VALUE(TxBufferSize, std::size_t, 65536)
+    AIPSTACK_OPTION_DECL_VALUE(MaxUdpSize, std::size_t, 1472)
+    AIPSTACK_OPTION_DECL_VALUE(UdpBatchSize, std::size_t, 32)
+    AIPSTACK_OPTION_DECL_VALUE(UdpTickMs, int, 1)
+    AIPSTACK_OPTION_DECL_VALUE(StatsIntervalSec, int, 1)
+};
+
+template<typename ...Options>
+class LoadGenAppService {
+    template<typename>
+    friend class LoadGenApp;
+    
+    AIPSTACK_OPTION_CONFIG_VALUE(LoadGenAppOptions, MaxConnections)
+    AIPSTACK_OPTION_CONFIG_VALUE(LoadGenAppOptions, RxBufferSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(LoadGenAppOptions, TxBufferSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(LoadGenAppOptions, MaxUdpSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(LoadGenAppOptions, UdpBatchSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(LoadGenAppOptions, UdpTickMs)
+    AIPSTACK_OPTION_CONFIG_VALUE(LoadGenAppOptions, StatsIntervalSec)
+    
+public:
+    template<typename StackArg_>
+    struct Compose {
+        using StackArg = StackArg_;
+        using Params = LoadGenAppService;
+        AIPSTACK_DEF_INSTANCE(Compose, LoadGenApp) 
+    };
+};
+
+}
+
+#endif
@@ -25,9 +25,14 @@
 #ifndef AIPSTACK_TAP_IFACE_H
 #define AIPSTACK_TAP_IFACE_H
 
+#include <cstddef>
 #include <string>
+#include <type_traits>
 
+#include <aipstack/misc/Assert.h>
 #include <aipstack/misc/Function.h>
+#include <aipstack/misc/IntRange.h>
+#include <aipstack/misc/MinMax.h>
 #include <aipstack/infra/Instance.h>
 #include <aipstack/infra/Buf.h>
 #include <aipstack/infra/Err.h>
@@ -35,14 +40,26 @@
 #include <aipstack/platform/HostedPlatformImpl.h>
 #include <aipstack/eth/EthIpIface.h>
 #include <aipstack/eth/MacAddr.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/proto/Ip4Proto.h>
 #include <aipstack/tap/TapDevice.h>
+#if defined(__linux__)
+#include <aipstack/tap/linux/PacketDeviceLinux.h>
+#endif
 
 namespace AIpStackExamples {
 
-template<typename StackArg, typename TheEthIpIfaceService>
+template<typename StackArg, typename TheEthIpIfaceService,
+         typename Device = AIpStack::TapDevice>
 class TapIface {
     using Platform = AIpStack::PlatformFacade<AIpStack::HostedPlatformImpl>;
 
+#if defined(__linux__)
+    static constexpr bool IsPacketDevice =
+        std::is_same_v<Device, AIpStack::PacketDeviceLinux>;
+#endif
+
     AIPSTACK_MAKE_INSTANCE(TheEthIpIface, (TheEthIpIfaceService::template Compose<
         AIpStack::HostedPlatformImpl, StackArg>))
 
@@ -50,29 +67,139 @@ public:
     TapIface (Platform platform, AIpStack::IpStack<StackArg> *stack,
               std::string const &device_id, AIpStack::MacAddr const &mac_addr)
     :
-        m_tap_device(platform.ref().platformImpl()->getEventLoop(), device_id,
-            AIPSTACK_BIND_MEMBER_TN(&TapIface::frameReceived, this)),
+        m_tap_device(makeDevice(platform.ref().platformImpl()->getEventLoop(),
+                                device_id)),
         m_mac_addr(mac_addr),
-        m_eth_iface(platform, stack, AIpStack::EthIfaceDriverParams{
-            /*eth_mtu=*/ m_tap_device.getMtu(),
-            /*mac_addr=*/ &m_mac_addr,
-            AIPSTACK_BIND_MEMBER_TN(&TapIface::driverSendFrame, this),
-            AIPSTACK_BIND_MEMBER_TN(&TapIface::driverGetEthState, this)
-        })
-    {}
+        m_eth_iface(platform, stack, makeDriverParams())
+    {
+#if defined(__linux__)
+        // Read up to RxBatchSize frames for each readiness event (or whole blocks
+        // with the packet device) and pass them to the stack as a batch.
+        if constexpr (!IsPacketDevice) {
+            m_tap_device.setRxBudget(RxBatchSize);
+        }
+        m_tap_device.setFrameBatchHandler(
+            AIPSTACK_BIND_MEMBER_TN(&TapIface::framesReceived, this));
+#endif
+    }
 
     inline AIpStack::IpIface<StackArg> & iface () {
         return m_eth_iface.iface();
     }
     
 private:
+    Device makeDevice (AIpStack::EventLoop &loop, std::string const &device_id)
+    {
+        auto handler = AIPSTACK_BIND_MEMBER_TN(&TapIface::frameReceived, this);
+        
+#if defined(__linux__)
+        if constexpr (IsPacketDevice) {
+            // Frames are sent to the kernel when the stack flushes them.
+            AIpStack::PacketDeviceParams params;
+            params.defer_tx_kick = true;
+            return Device(loop, device_id, handler, params);
+        } else {
+            return Device(loop, device_id, handler,
+                          /*multi_queue=*/false, /*vnet_hdr=*/true);
+        }
+#else
+        return Device(loop, device_id, handler);
+#endif
+    }
+    
+    AIpStack::EthIfaceDriverParams makeDriverParams ()
+    {
+        AIpStack::EthIfaceDriverParams params;
+        params.eth_mtu = m_tap_device.getMtu();
+        params.mac_addr = &m_mac_addr;
+        params.send_frame = AIPSTACK_BIND_MEMBER_TN(&TapIface::driverSendFrame, this);
+        params.get_eth_state = AIPSTACK_BIND_MEMBER_TN(&TapIface::driverGetEthState, this);
+        
+#if defined(__linux__)
+        if constexpr (IsPacketDevice) {
+            params.rx_chksum_offload = ChksumOffloadTcpUdp;
+            params.flush_frames =
+                AIPSTACK_BIND_MEMBER_TN(&TapIface::driverFlushFrames, this);
+        } else {
+            // With vnet_hdr, checksums and segmentation are left to the kernel.
+            if (m_tap_device.hasVnetHdr()) {
+                params.tx_chksum_offload = ChksumOffloadTcpUdp;
+                params.rx_chksum_offload = ChksumOffloadTcpUdp;
+                params.tso_max_size = m_tap_device.getTsoMaxSize();
+                params.uso_max_size = m_tap_device.getUsoMaxSize();
+            }
+        }
+#endif
+        
+        return params;
+    }
+    
     void frameReceived (AIpStack::IpBufRef frame)
     {
+#if defined(__linux__)
+        if constexpr (!IsPacketDevice) {
+            if (m_tap_device.getRxChksumVerified()) {
+                return m_eth_iface.recvFrame(frame, ChksumOffloadTcpUdp);
+            }
+        }
+#endif
         return m_eth_iface.recvFrame(frame);
     }
     
+#if defined(__linux__)
+    void framesReceived (AIpStack::TapRxFrame const *frames, std::size_t count)
+    {
+        // Blocks of the packet device may hold more frames than RxBatchSize.
+        while (count > 0) {
+            std::size_t batch_count = AIpStack::MinValue(count, RxBatchSize);
+            
+            AIpStack::IpRxBatchEntry entries[RxBatchSize];
+            for (std::size_t i : AIpStack::IntRange(batch_count)) {
+                entries[i].buf = frames[i].frame;
+                if (frames[i].chksum_verified) {
+                    entries[i].chksum_verified = ChksumOffloadTcpUdp;
+                }
+            }
+            
+            m_eth_iface.recvFrames(entries, batch_count);
+            
+            frames += batch_count;
+            count -= batch_count;
+        }
+    }
+    
+    void driverFlushFrames ()
+    {
+        if constexpr (IsPacketDevice) {
+            m_tap_device.flushFrames();
+        }
+    }
+#endif
+    
     AIpStack::IpErr driverSendFrame (AIpStack::IpBufRef frame)
     {
+#if defined(__linux__)
+        if constexpr (!IsPacketDevice) {
+            if (m_tap_device.hasVnetHdr()) {
+                AIpStack::TapTxOffload offload;
+                offload.csum_partial = m_eth_iface.getTxChksumPartial(
+                    frame, offload.csum_start, offload.csum_offset);
+                
+                AIpStack::IpTxTsoInfo tso_info;
+                if (m_eth_iface.getTxTso(frame, tso_info)) {
+                    AIpStack::Ip4Protocol proto = AIpStack::Ip4Header::get(
+                        frame.getChunkPtr() + AIpStack::EthHeader::Size,
+                        AIpStack::Ip4Header::Proto());
+                    offload.gso_type = (proto == AIpStack::Ip4Protocol::Tcp) ?
+                        AIpStack::TapGsoType::Tcp4 : AIpStack::TapGsoType::Udp4;
+                    offload.hdr_len = tso_info.header_len;
+                    offload.gso_size = tso_info.mss;
+                }
+                
+                return m_tap_device.sendFrame(frame, offload);
+            }
+        }
+#endif
         return m_tap_device.sendFrame(frame);
     }
     
@@ -84,7 +211,13 @@ private:
     }
 
 private:
-    AIpStack::TapDevice m_tap_device;
+    static constexpr std::size_t RxBatchSize = 32;
+    
+    static constexpr AIpStack::IpChksumOffloadFlags ChksumOffloadTcpUdp =
+        AIpStack::IpChksumOffloadFlags::Tcp4|AIpStack::IpChksumOffloadFlags::Udp4;
+    
+private:
+    Device m_tap_device;
     AIpStack::MacAddr m_mac_addr;
     TheEthIpIface m_eth_iface;
 };
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/capture/PcapReplay.h>
+
+namespace AIpStack {
+
+namespace {
+
+constexpr std::uint32_t MagicMicro = 0xA1B2C3D4;
+constexpr std::uint32_t MagicNano = 0xA1B23C4D;
+constexpr std::uint32_t LinkTypeEthernet = 1;
+
+constexpr std::size_t FileHeaderSize = 24;
+constexpr std::size_t RecordHeaderSize = 16;
+
+// Gaps longer than this are waited for by sleeping, shorter ones by spinning.
+constexpr std::uint64_t SleepThresholdNs = 200000;
+
+inline std::uint32_t byteSwap32 (std::uint32_t x)
+{
+    return __builtin_bswap32(x);
+}
+
+class FieldReader {
+public:
+    FieldReader (char const *data, bool swapped) :
+        m_data(data),
+        m_swapped(swapped)
+    {}
+
+    std::uint32_t get32 (std::size_t offset) const
+    {
+        std::uint32_t value;
+        std::memcpy(&value, m_data + offset, sizeof(value));
+        return m_swapped ? byteSwap32(value) : value;
+    }
+
+private:
+    char const *m_data;
+    bool m_swapped;
+};
+
+using Clock = std::chrono::steady_clock;
+
+inline std::uint64_t nsSince (Clock::time_point start)
+{
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count());
+}
+
+}
+
+PcapFile::PcapFile (std::string const &path) :
+    m_map(nullptr),
+    m_map_size(0)
+{
+    m_fd = FileDescriptorWrapper(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!m_fd) {
+        throw std::runtime_error("PcapFile: open failed.");
+    }
+    
+    struct stat st;
+    if (::fstat(*m_fd, &st) < 0) {
+        throw std::runtime_error("PcapFile: fstat failed.");
+    }
+    if (std::size_t(st.st_size) < FileHeaderSize) {
+        throw std::runtime_error("PcapFile: file too short.");
+    }
+    m_map_size = std::size_t(st.st_size);
+    
+    // Map privately and writable, so that the stack may modify frames in place.
+    void *map = ::mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       *m_fd, 0);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("PcapFile: mmap failed.");
+    }
+    m_map = static_cast<char *>(map);
+    
+    std::uint32_t magic;
+    std::memcpy(&magic, m_map, sizeof(magic));
+    bool swapped = false;
+    if (magic == byteSwap32(MagicMicro) || magic == byteSwap32(MagicNano)) {
+        swapped = true;
+        magic = byteSwap32(magic);
+    }
+    if (magic != MagicMicro && magic != MagicNano) {
+        ::munmap(m_map, m_map_size);
+        throw std::runtime_error("PcapFile: not a pcap file.");
+    }
+    std::uint64_t frac_mult = (magic == MagicNano) ? 1 : 1000;
+    
+    FieldReader header(m_map, swapped);
+    if (header.get32(20) != LinkTypeEthernet) {
+        ::munmap(m_map, m_map_size);
+        throw std::runtime_error("PcapFile: link type is not Ethernet.");
+    }
+    
+    std::size_t pos = FileHeaderSize;
+    while (m_map_size - pos >= RecordHeaderSize) {
+        FieldReader record(m_map + pos, swapped);
+        std::uint32_t cap_len = record.get32(8);
+        if (m_map_size - pos - RecordHeaderSize < cap_len) {
+            break;
+        }
+        
+        PcapFrame frame;
+        frame.data = m_map + pos + RecordHeaderSize;
+        frame.cap_len = cap_len;
+        frame.orig_len = record.get32(12);
+        frame.time_ns = std::uint64_t(record.get32(0)) * 1000000000 +
+                        std::uint64_t(record.get32(4)) * frac_mult;
+        m_frames.push_back(frame);
+        
+        pos += RecordHeaderSize + cap_len;
+    }
+}
+
+PcapFile::~PcapFile ()
+{
+    ::munmap(m_map, m_map_size);
+}
+
+std::size_t PcapFile::getNumTruncated () const
+{
+    std::size_t count = 0;
+    for (PcapFrame const &frame : m_frames) {
+        if (frame.cap_len < frame.orig_len) {
+            count++;
+        }
+    }
+    return count;
+}
+
+PcapReplayer::PcapReplayer (PcapFile const &file, FrameBatchHandler handler,
+                            PcapReplayParams const &params) :
+    m_handler(handler),
+    m_params(params),
+    m_total_bytes(0)
+{
+    AIPSTACK_ASSERT(handler);
+    AIPSTACK_ASSERT(params.batch_size > 0);
+    AIPSTACK_ASSERT(params.speed > 0.0);
+    
+    std::size_t num_frames = file.getNumFrames();
+    m_times.resize(num_frames);
+    m_nodes.resize(num_frames);
+    m_entries.resize(num_frames);
+    
+    for (std::size_t i = 0; i < num_frames; i++) {
+        PcapFrame const &frame = file.getFrame(i);
+        std::uint64_t first_ns = file.getFrame(0).time_ns;
+        // Frames timestamped before the first are due immediately.
+        m_times[i] = (frame.time_ns > first_ns) ? (frame.time_ns - first_ns) : 0;
+        m_nodes[i] = IpBufNode{frame.data, frame.cap_len, nullptr};
+        m_entries[i].buf = IpBufRef{&m_nodes[i], 0, frame.cap_len};
+        m_total_bytes += frame.cap_len;
+    }
+}
+
+PcapReplayResult PcapReplayer::replay ()
+{
+    std::size_t num_frames = m_entries.size();
+    std::uint64_t busy_ns = 0;
+    Clock::time_point start = Clock::now();
+    
+    if (!m_params.recorded_timing) {
+        for (std::size_t pos = 0; pos < num_frames;) {
+            std::size_t count = MinValue(m_params.batch_size, num_frames - pos);
+            m_handler(&m_entries[pos], count);
+            pos += count;
+        }
+        busy_ns = nsSince(start);
+    } else {
+        for (std::size_t pos = 0; pos < num_frames;) {
+            std::uint64_t now_ns = nsSince(start);
+            std::uint64_t due_ns = std::uint64_t(double(m_times[pos]) / m_params.speed);
+            
+            if (due_ns > now_ns) {
+                if (due_ns - now_ns > SleepThresholdNs) {
+                    std::this_thread::sleep_until(start + std::chrono::nanoseconds(
+                        due_ns - SleepThresholdNs / 2));
+                }
+                continue;
+            }
+            
+            // Pass all frames which are due, up to the batch size.
+            std::size_t count = 1;
+            while (count < m_params.batch_size && pos + count < num_frames &&
+                   std::uint64_t(double(m_times[pos + count]) / m_params.speed) <= now_ns)
+            {
+                count++;
+            }
+            
+            Clock::time_point batch_start = Clock::now();
+            m_handler(&m_entries[pos], count);
+            busy_ns += nsSince(batch_start);
+            pos += count;
+        }
+    }
+    
+    PcapReplayResult result;
+    result.frames = num_frames;
+    result.bytes = m_total_bytes;
+    result.busy_ns = busy_ns;
+    result.elapsed_ns = nsSince(start);
+    return result;
+}
+
+}
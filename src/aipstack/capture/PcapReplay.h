@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_PCAP_REPLAY_H
+#define AIPSTACK_PCAP_REPLAY_H
+
+#if !defined(__linux__)
+#error "PcapReplay is only supported on Linux"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/ip/IpStackTypes.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup capture
+ * @{
+ */
+
+/**
+ * A frame in a @ref PcapFile.
+ */
+struct PcapFrame {
+    /**
+     * Pointer to the captured data, starting with the Ethernet header.
+     */
+    char *data;
+
+    /**
+     * Number of captured bytes.
+     */
+    std::uint32_t cap_len;
+
+    /**
+     * Original length of the frame, more than @ref cap_len if truncated.
+     */
+    std::uint32_t orig_len;
+
+    /**
+     * Timestamp in nanoseconds.
+     */
+    std::uint64_t time_ns;
+};
+
+/**
+ * A memory-mapped pcap file with Ethernet frames.
+ * 
+ * Classic pcap files (not pcapng) in either byte order and with microsecond or
+ * nanosecond timestamps are supported. The file is mapped privately, so the
+ * frame data is writable without affecting the file.
+ */
+class PcapFile :
+    private NonCopyable<PcapFile>
+{
+public:
+    /**
+     * Constructor, maps the file and indexes the frames.
+     * 
+     * @param path Path of the file.
+     * @throw std::runtime_error If opening or mapping the file fails, it is not
+     *        a pcap file or the link type is not Ethernet.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    explicit PcapFile (std::string const &path);
+
+    /**
+     * Destructor, unmaps the file.
+     */
+    ~PcapFile ();
+
+    /**
+     * Return the number of frames.
+     * 
+     * @return Number of frames in the file. An incomplete last frame is
+     *         ignored.
+     */
+    inline std::size_t getNumFrames () const
+    {
+        return m_frames.size();
+    }
+
+    /**
+     * Return a frame.
+     * 
+     * @param index Index of the frame, less than @ref getNumFrames.
+     * @return The frame.
+     */
+    inline PcapFrame const & getFrame (std::size_t index) const
+    {
+        return m_frames[index];
+    }
+
+    /**
+     * Return the number of frames which were truncated when captured.
+     * 
+     * @return Number of frames with @ref PcapFrame::cap_len less than
+     *         @ref PcapFrame::orig_len.
+     */
+    std::size_t getNumTruncated () const;
+
+private:
+    FileDescriptorWrapper m_fd;
+    char *m_map;
+    std::size_t m_map_size;
+    std::vector<PcapFrame> m_frames;
+};
+
+/**
+ * Configuration parameters for @ref PcapReplayer.
+ */
+struct PcapReplayParams {
+    /**
+     * Maximum number of frames passed in one batch.
+     */
+    std::size_t batch_size = 32;
+
+    /**
+     * Whether to pass frames at the times they were recorded (relative to the
+     * first frame), otherwise frames are passed as fast as possible.
+     */
+    bool recorded_timing = false;
+
+    /**
+     * Factor by which recorded timing is sped up.
+     */
+    double speed = 1.0;
+};
+
+/**
+ * Result of @ref PcapReplayer::replay.
+ */
+struct PcapReplayResult {
+    /**
+     * Number of frames passed.
+     */
+    std::size_t frames;
+
+    /**
+     * Number of bytes in the passed frames.
+     */
+    std::uint64_t bytes;
+
+    /**
+     * Time spent in the @ref PcapReplayer::FrameBatchHandler in nanoseconds
+     * (not including waiting for recorded timing).
+     */
+    std::uint64_t busy_ns;
+
+    /**
+     * Total elapsed time in nanoseconds.
+     */
+    std::uint64_t elapsed_ns;
+};
+
+/**
+ * Passes the frames of a @ref PcapFile to a receive function in batches, for
+ * benchmarking of the receive path.
+ * 
+ * The batch handler would usually call @ref EthIpIface::recvFrames. The
+ * @ref IpRxBatchEntry structures for all frames are prepared at construction,
+ * so that replay itself only measures the receive path.
+ * 
+ * The stack must not modify or retain the frame data, since the same data is
+ * passed again on the next @ref replay.
+ */
+class PcapReplayer :
+    private NonCopyable<PcapReplayer>
+{
+public:
+    /**
+     * Type of callback used to pass a batch of frames.
+     * 
+     * @param frames Array of frames, with no @ref IpRxBatchEntry::rx_buf.
+     * @param count Number of frames, at least one.
+     */
+    using FrameBatchHandler = Function<void(IpRxBatchEntry const *frames,
+                                            std::size_t count)>;
+
+    /**
+     * Constructor.
+     * 
+     * @param file File to replay; it must outlive this object.
+     * @param handler Callback used to pass frames (must not be null).
+     * @param params Configuration parameters.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    PcapReplayer (PcapFile const &file, FrameBatchHandler handler,
+                  PcapReplayParams const &params = PcapReplayParams());
+
+    /**
+     * Pass all frames of the file once.
+     * 
+     * @return Counts and times.
+     */
+    PcapReplayResult replay ();
+
+private:
+    FrameBatchHandler m_handler;
+    PcapReplayParams m_params;
+    std::vector<std::uint64_t> m_times;
+    std::vector<IpBufNode> m_nodes;
+    std::vector<IpRxBatchEntry> m_entries;
+    std::uint64_t m_total_bytes;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/TypedFunction.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/capture/PcapngCapture.h>
+
+namespace AIpStack {
+
+namespace {
+
+constexpr char CaptureMagic[8] = {'A', 'I', 'P', 'S', 'C', 'A', 'P', '1'};
+
+// pcapng block types and option codes.
+constexpr std::uint32_t SectionHeaderBlockType = 0x0A0D0D0A;
+constexpr std::uint32_t InterfaceDescriptionBlockType = 1;
+constexpr std::uint32_t EnhancedPacketBlockType = 6;
+constexpr std::uint32_t ByteOrderMagic = 0x1A2B3C4D;
+constexpr std::uint16_t LinkTypeEthernet = 1;
+constexpr std::uint16_t OptEndOfOpt = 0;
+constexpr std::uint16_t OptIfName = 2;
+constexpr std::uint16_t OptIfTsresol = 9;
+constexpr std::uint16_t OptEpbFlags = 2;
+
+constexpr std::size_t SectionHeaderBlockSize = 28;
+
+// Size of the Enhanced Packet Block without the packet data: the fixed part
+// (28 bytes), the epb_flags option (8 bytes), the end of options (4 bytes) and
+// the trailing block length (4 bytes).
+constexpr std::size_t EpbFixedSize = 28;
+constexpr std::size_t EpbTrailerSize = 16;
+
+inline std::size_t padTo4 (std::size_t len)
+{
+    return (len + 3) & ~std::size_t(3);
+}
+
+// Builds pcapng blocks in native byte order.
+class BlockWriter {
+public:
+    explicit BlockWriter (std::vector<char> &out) :
+        m_out(out)
+    {}
+
+    void put32 (std::uint32_t value)
+    {
+        put(&value, sizeof(value));
+    }
+
+    void put16 (std::uint16_t value)
+    {
+        put(&value, sizeof(value));
+    }
+
+    void put (void const *data, std::size_t len)
+    {
+        char const *bytes = static_cast<char const *>(data);
+        m_out.insert(m_out.end(), bytes, bytes + len);
+    }
+
+    void putOption (std::uint16_t code, void const *data, std::size_t len)
+    {
+        put16(code);
+        put16(std::uint16_t(len));
+        put(data, len);
+        m_out.resize(m_out.size() + (padTo4(len) - len), 0);
+    }
+
+private:
+    std::vector<char> &m_out;
+};
+
+}
+
+PcapngCaptureRing::PcapngCaptureRing (std::string const &path, std::size_t ring_size) :
+    m_map(nullptr),
+    m_map_size(ControlSize + ring_size),
+    m_ring_size(ring_size),
+    m_num_ifaces(0),
+    m_write_pos(0)
+{
+    AIPSTACK_ASSERT(ring_size >= 65536 && (ring_size & (ring_size - 1)) == 0);
+    
+    m_fd = FileDescriptorWrapper(
+        ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (!m_fd) {
+        throw std::runtime_error("PcapngCaptureRing: open failed.");
+    }
+    
+    if (::ftruncate(*m_fd, off_t(m_map_size)) < 0) {
+        throw std::runtime_error("PcapngCaptureRing: ftruncate failed.");
+    }
+    
+    void *map = ::mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, *m_fd, 0);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("PcapngCaptureRing: mmap failed.");
+    }
+    m_map = static_cast<char *>(map);
+    
+    // Write the Section Header Block (with unspecified section length).
+    std::vector<char> shb;
+    BlockWriter writer(shb);
+    writer.put32(SectionHeaderBlockType);
+    writer.put32(SectionHeaderBlockSize);
+    writer.put32(ByteOrderMagic);
+    writer.put16(1);
+    writer.put16(0);
+    writer.put32(0xFFFFFFFF);
+    writer.put32(0xFFFFFFFF);
+    writer.put32(SectionHeaderBlockSize);
+    AIPSTACK_ASSERT(shb.size() == SectionHeaderBlockSize);
+    std::memcpy(m_map + PreambleOffset, shb.data(), shb.size());
+    
+    std::memcpy(m_map + OffMagic, CaptureMagic, sizeof(CaptureMagic));
+    *controlField(OffRingSize) = ring_size;
+    *controlField(OffWriteBegin) = 0;
+    *controlField(OffWriteEnd) = 0;
+    *controlField(OffDropped) = 0;
+    __atomic_store_n(controlField(OffPreambleLen), std::uint64_t(shb.size()),
+                     __ATOMIC_RELEASE);
+}
+
+PcapngCaptureRing::~PcapngCaptureRing ()
+{
+    ::munmap(m_map, m_map_size);
+}
+
+std::uint64_t PcapngCaptureRing::getNumDropped () const
+{
+    return *controlField(OffDropped);
+}
+
+std::uint64_t * PcapngCaptureRing::controlField (std::size_t offset) const
+{
+    return reinterpret_cast<std::uint64_t *>(m_map + offset);
+}
+
+std::uint32_t PcapngCaptureRing::addInterface (
+    std::string const &name, std::uint32_t snaplen)
+{
+    std::vector<char> idb;
+    BlockWriter writer(idb);
+    std::size_t name_len = MinValueU(name.size(), std::size_t(255));
+    std::uint32_t block_len = std::uint32_t(16 + 4 + padTo4(name_len) + 8 + 4 + 4);
+    std::uint8_t tsresol = 9;
+    
+    writer.put32(InterfaceDescriptionBlockType);
+    writer.put32(block_len);
+    writer.put16(LinkTypeEthernet);
+    writer.put16(0);
+    writer.put32(snaplen);
+    writer.putOption(OptIfName, name.data(), name_len);
+    writer.putOption(OptIfTsresol, &tsresol, sizeof(tsresol));
+    writer.put16(OptEndOfOpt);
+    writer.put16(0);
+    writer.put32(block_len);
+    AIPSTACK_ASSERT(idb.size() == block_len);
+    
+    std::uint64_t preamble_len = *controlField(OffPreambleLen);
+    if (PreambleOffset + preamble_len + idb.size() > ControlSize) {
+        throw std::runtime_error("PcapngCaptureRing: too many interfaces.");
+    }
+    
+    std::memcpy(m_map + PreambleOffset + preamble_len, idb.data(), idb.size());
+    __atomic_store_n(controlField(OffPreambleLen), preamble_len + idb.size(),
+                     __ATOMIC_RELEASE);
+    
+    return m_num_ifaces++;
+}
+
+void PcapngCaptureRing::captureFrame (std::uint32_t iface_id, std::uint32_t snaplen,
+                                      EthCaptureDir dir, IpBufRef frame)
+{
+    std::size_t cap_len = MinValueU(frame.tot_len, std::size_t(snaplen));
+    std::size_t block_len = EpbFixedSize + padTo4(cap_len) + EpbTrailerSize;
+    
+    if (block_len > m_ring_size / 2) {
+        std::uint64_t *dropped = controlField(OffDropped);
+        __atomic_store_n(dropped, *dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    struct timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    std::uint64_t time_ns =
+        std::uint64_t(ts.tv_sec) * 1000000000 + std::uint64_t(ts.tv_nsec);
+    
+    std::uint32_t head[EpbFixedSize / 4] = {
+        EnhancedPacketBlockType,
+        std::uint32_t(block_len),
+        iface_id,
+        std::uint32_t(time_ns >> 32),
+        std::uint32_t(time_ns),
+        std::uint32_t(cap_len),
+        std::uint32_t(frame.tot_len),
+    };
+    
+    // The epb_flags option with the direction, the end of options and the
+    // trailing block length.
+    char trailer[EpbTrailerSize];
+    std::uint16_t opt_header[2] = {OptEpbFlags, 4};
+    std::uint32_t trailer_words[3] = {std::uint32_t(dir), OptEndOfOpt,
+                                      std::uint32_t(block_len)};
+    std::memcpy(trailer, opt_header, sizeof(opt_header));
+    std::memcpy(trailer + sizeof(opt_header), trailer_words, sizeof(trailer_words));
+    
+    // Announce the range being written before writing, so that a concurrent
+    // reader can tell if data it copied was overwritten.
+    std::uint64_t pos = m_write_pos;
+    __atomic_store_n(controlField(OffWriteBegin), pos + block_len, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    writeRing(pos, reinterpret_cast<char const *>(head), sizeof(head));
+    std::uint64_t data_pos = pos + sizeof(head);
+    
+    ipBufProcessBytes(frame, cap_len, makeTypedFunction(
+        [&](char *chunk_data, std::size_t chunk_len) {
+            writeRing(data_pos, chunk_data, chunk_len);
+            data_pos += chunk_len;
+            return chunk_len;
+        }));
+    
+    static char const zero_pad[3] = {};
+    writeRing(data_pos, zero_pad, padTo4(cap_len) - cap_len);
+    data_pos += padTo4(cap_len) - cap_len;
+    
+    writeRing(data_pos, trailer, sizeof(trailer));
+    
+    m_write_pos = pos + block_len;
+    __atomic_store_n(controlField(OffWriteEnd), m_write_pos, __ATOMIC_RELEASE);
+}
+
+void PcapngCaptureRing::writeRing (std::uint64_t pos, char const *data, std::size_t len)
+{
+    char *ring = m_map + ControlSize;
+    std::size_t offset = std::size_t(pos & (m_ring_size - 1));
+    std::size_t first = MinValueU(len, m_ring_size - offset);
+    
+    std::memcpy(ring + offset, data, first);
+    std::memcpy(ring, data + first, len - first);
+}
+
+PcapngCaptureIface::PcapngCaptureIface (
+    PcapngCaptureRing &ring, std::string const &name, std::uint32_t snaplen)
+:
+    m_ring(ring),
+    m_id(ring.addInterface(name, snaplen)),
+    m_snaplen(snaplen)
+{}
+
+PcapngCaptureReader::PcapngCaptureReader (std::string const &path) :
+    m_map(nullptr),
+    m_map_size(0),
+    m_preamble_pos(0),
+    m_lost_bytes(0)
+{
+    m_fd = FileDescriptorWrapper(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!m_fd) {
+        throw std::runtime_error("PcapngCaptureReader: open failed.");
+    }
+    
+    struct stat st;
+    if (::fstat(*m_fd, &st) < 0) {
+        throw std::runtime_error("PcapngCaptureReader: fstat failed.");
+    }
+    if (std::uint64_t(st.st_size) <= PcapngCaptureRing::ControlSize) {
+        throw std::runtime_error("PcapngCaptureReader: not a capture ring.");
+    }
+    m_map_size = std::size_t(st.st_size);
+    
+    void *map = ::mmap(nullptr, m_map_size, PROT_READ, MAP_SHARED, *m_fd, 0);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("PcapngCaptureReader: mmap failed.");
+    }
+    m_map = static_cast<char const *>(map);
+    
+    m_ring_size = std::size_t(loadField(PcapngCaptureRing::OffRingSize));
+    if (std::memcmp(m_map + PcapngCaptureRing::OffMagic, CaptureMagic,
+                    sizeof(CaptureMagic)) != 0 ||
+        m_map_size != PcapngCaptureRing::ControlSize + m_ring_size)
+    {
+        ::munmap(const_cast<char *>(m_map), m_map_size);
+        throw std::runtime_error("PcapngCaptureReader: not a capture ring.");
+    }
+    
+    m_read_pos = loadField(PcapngCaptureRing::OffWriteEnd);
+}
+
+PcapngCaptureReader::~PcapngCaptureReader ()
+{
+    ::munmap(const_cast<char *>(m_map), m_map_size);
+}
+
+std::uint64_t PcapngCaptureReader::loadField (std::size_t offset) const
+{
+    return __atomic_load_n(reinterpret_cast<std::uint64_t const *>(m_map + offset),
+                           __ATOMIC_ACQUIRE);
+}
+
+void PcapngCaptureReader::read (std::vector<char> &out)
+{
+    // Interface descriptions first, since new frames may refer to them.
+    std::size_t preamble_len = std::size_t(loadField(PcapngCaptureRing::OffPreambleLen));
+    if (preamble_len > m_preamble_pos) {
+        char const *preamble = m_map + PcapngCaptureRing::PreambleOffset;
+        out.insert(out.end(), preamble + m_preamble_pos, preamble + preamble_len);
+        m_preamble_pos = preamble_len;
+    }
+    
+    std::uint64_t end = loadField(PcapngCaptureRing::OffWriteEnd);
+    if (end - m_read_pos > m_ring_size) {
+        m_lost_bytes += end - m_read_pos;
+        m_read_pos = end;
+        return;
+    }
+    
+    char const *ring = m_map + PcapngCaptureRing::ControlSize;
+    std::size_t old_size = out.size();
+    std::uint64_t pos = m_read_pos;
+    while (pos != end) {
+        std::size_t offset = std::size_t(pos & (m_ring_size - 1));
+        std::size_t chunk = std::size_t(
+            MinValueU(end - pos, std::uint64_t(m_ring_size - offset)));
+        out.insert(out.end(), ring + offset, ring + offset + chunk);
+        pos += chunk;
+    }
+    
+    // Check that the writer has not started overwriting what we copied.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    std::uint64_t begin = __atomic_load_n(reinterpret_cast<std::uint64_t const *>(
+        m_map + PcapngCaptureRing::OffWriteBegin), __ATOMIC_RELAXED);
+    if (begin - m_read_pos > m_ring_size) {
+        out.resize(old_size);
+        m_lost_bytes += end - m_read_pos;
+    }
+    
+    m_read_pos = end;
+}
+
+}
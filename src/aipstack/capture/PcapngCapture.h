@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_PCAPNG_CAPTURE_H
+#define AIPSTACK_PCAPNG_CAPTURE_H
+
+#if !defined(__linux__)
+#error "PcapngCapture is only supported on Linux"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/eth/EthHw.h>
+
+namespace AIpStack {
+
+/**
+ * @defgroup capture Packet Capture
+ * @brief In-process capture of Ethernet frames into a shared memory ring, and
+ * replay of captured frames.
+ * 
+ * See the @ref PcapngCaptureRing and @ref PcapReplayer documentation.
+ * 
+ * @{
+ */
+
+/**
+ * Writes captured frames in pcapng format into a ring buffer in a memory-mapped
+ * file, from which another process can read them (see
+ * @ref PcapngCaptureReader).
+ * 
+ * Frames are written as Enhanced Packet Blocks with a nanosecond timestamp
+ * (`CLOCK_REALTIME`), truncated to the snapshot length of the interface, and
+ * with the direction in the `epb_flags` option. Interfaces are added using
+ * @ref PcapngCaptureIface, which can be connected to an @ref EthIpIface with
+ * @ref EthIpIface::setCaptureHandler.
+ * 
+ * The writer never waits for the reader: old data is overwritten when the ring
+ * is full, and the reader detects this and skips ahead. Writing is not
+ * thread-safe; all interfaces using a ring must be used from the same thread.
+ * 
+ * The file consists of a control area of @ref ControlSize bytes followed by the
+ * ring of the configured size. The control area contains the following fields
+ * in native byte order, followed by the Section Header Block and Interface
+ * Description Blocks starting at @ref PreambleOffset:
+ * 
+ * | Offset | Size | Field |
+ * |--------|------|-------|
+ * | 0      | 8    | Magic `AIPSCAP1` |
+ * | 8      | 8    | Size of the ring |
+ * | 16     | 8    | Length of the pcapng blocks at @ref PreambleOffset |
+ * | 24     | 8    | Ring position up to which data may be being written |
+ * | 32     | 8    | Ring position up to which data is complete |
+ * | 40     | 8    | Number of frames not captured because they did not fit |
+ * 
+ * Ring positions only increase and are reduced modulo the ring size to get an
+ * offset into the ring. The complete position is always at the end of a
+ * block. The positions and the preamble length are updated with release
+ * semantics after the data they cover is written.
+ */
+class PcapngCaptureRing :
+    private NonCopyable<PcapngCaptureRing>
+{
+    friend class PcapngCaptureIface;
+    friend class PcapngCaptureReader;
+
+public:
+    /**
+     * Size of the control area at the start of the file.
+     */
+    static constexpr std::size_t ControlSize = 4096;
+
+    /**
+     * Offset of the Section Header Block and Interface Description Blocks in
+     * the control area.
+     */
+    static constexpr std::size_t PreambleOffset = 64;
+
+    /**
+     * Constructor, creates (or truncates) and maps the file.
+     * 
+     * @param path Path of the file, e.g. in `/dev/shm`.
+     * @param ring_size Size of the ring in bytes, must be a power of two and at
+     *        least 65536.
+     * @throw std::runtime_error If creating or mapping the file fails.
+     */
+    PcapngCaptureRing (std::string const &path, std::size_t ring_size = 4194304);
+
+    /**
+     * Destructor, unmaps the file (the file is not removed).
+     */
+    ~PcapngCaptureRing ();
+
+    /**
+     * Return the number of frames which could not be captured.
+     * 
+     * @return Number of frames which were larger than half of the ring even
+     *         after truncation.
+     */
+    std::uint64_t getNumDropped () const;
+
+private:
+    static constexpr std::size_t OffMagic = 0;
+    static constexpr std::size_t OffRingSize = 8;
+    static constexpr std::size_t OffPreambleLen = 16;
+    static constexpr std::size_t OffWriteBegin = 24;
+    static constexpr std::size_t OffWriteEnd = 32;
+    static constexpr std::size_t OffDropped = 40;
+
+    std::uint32_t addInterface (std::string const &name, std::uint32_t snaplen);
+
+    void captureFrame (std::uint32_t iface_id, std::uint32_t snaplen,
+                       EthCaptureDir dir, IpBufRef frame);
+
+    void writeRing (std::uint64_t pos, char const *data, std::size_t len);
+
+    std::uint64_t * controlField (std::size_t offset) const;
+
+private:
+    FileDescriptorWrapper m_fd;
+    char *m_map;
+    std::size_t m_map_size;
+    std::size_t m_ring_size;
+    std::uint32_t m_num_ifaces;
+    std::uint64_t m_write_pos;
+};
+
+/**
+ * An interface of a @ref PcapngCaptureRing.
+ * 
+ * Constructing this object adds an Interface Description Block with link
+ * type Ethernet. Capture for an @ref EthIpIface (with
+ * @ref EthIpIfaceOptions::EnableCapture) is enabled as follows and can be
+ * disabled by setting a null handler:
+ * 
+ * ```
+ * eth_iface.setCaptureHandler(
+ *     AIPSTACK_BIND_MEMBER_TN(&PcapngCaptureIface::captureFrame, &capture_iface));
+ * ```
+ * 
+ * The interface remains described in the file after destruction.
+ */
+class PcapngCaptureIface :
+    private NonCopyable<PcapngCaptureIface>
+{
+public:
+    /**
+     * Constructor, adds the interface to the ring.
+     * 
+     * @param ring Ring to write to; it must outlive this object.
+     * @param name Name of the interface (`if_name` option).
+     * @param snaplen Maximum number of bytes captured of each frame.
+     * @throw std::runtime_error If there is no more space for interfaces.
+     */
+    PcapngCaptureIface (PcapngCaptureRing &ring, std::string const &name,
+                        std::uint32_t snaplen = 65535);
+
+    /**
+     * Capture a frame.
+     * 
+     * @param dir Whether the frame was received or sent.
+     * @param frame The frame, starting with the Ethernet header.
+     */
+    inline void captureFrame (EthCaptureDir dir, IpBufRef frame)
+    {
+        m_ring.captureFrame(m_id, m_snaplen, dir, frame);
+    }
+
+private:
+    PcapngCaptureRing &m_ring;
+    std::uint32_t m_id;
+    std::uint32_t m_snaplen;
+};
+
+/**
+ * Reads a pcapng stream from the file of a @ref PcapngCaptureRing, usually in
+ * another process.
+ * 
+ * Reading starts with the frames captured after construction. Each
+ * @ref read call appends data which together forms a valid pcapng stream,
+ * which can be written to a file or a pipe (e.g. to Wireshark).
+ */
+class PcapngCaptureReader :
+    private NonCopyable<PcapngCaptureReader>
+{
+public:
+    /**
+     * Constructor, opens and maps the file read-only.
+     * 
+     * @param path Path of the file.
+     * @throw std::runtime_error If opening or mapping the file fails or it is not
+     *        a capture ring.
+     */
+    explicit PcapngCaptureReader (std::string const &path);
+
+    /**
+     * Destructor, unmaps the file.
+     */
+    ~PcapngCaptureReader ();
+
+    /**
+     * Append new data of the pcapng stream.
+     * 
+     * This appends any new Interface Description Blocks (and the Section
+     * Header Block on the first call) and any blocks of captured frames since
+     * the previous call. If the writer has overwritten data before it could be
+     * read, that data is skipped.
+     * 
+     * @param out Vector to append to.
+     */
+    void read (std::vector<char> &out);
+
+    /**
+     * Return the number of ring bytes which were overwritten before they could
+     * be read.
+     * 
+     * @return Number of lost bytes.
+     */
+    inline std::uint64_t getLostBytes () const
+    {
+        return m_lost_bytes;
+    }
+
+private:
+    std::uint64_t loadField (std::size_t offset) const;
+
+private:
+    FileDescriptorWrapper m_fd;
+    char const *m_map;
+    std::size_t m_map_size;
+    std::size_t m_ring_size;
+    std::size_t m_preamble_pos;
+    std::uint64_t m_read_pos;
+    std::uint64_t m_lost_bytes;
+};
+
+/** @} */
+
+}
+
+#endif
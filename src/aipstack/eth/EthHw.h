@@ -25,6 +25,8 @@
 #ifndef AIPSTACK_ETH_HW_H
 #define AIPSTACK_ETH_HW_H
 
+#include <cstdint>
+
 #include <aipstack/misc/Use.h>
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/Function.h>
@@ -57,6 +59,21 @@ class EthArpObserver;
  */
 using EthArpObservable = Observable<EthArpObserver>;
 
+/**
+ * Direction of a captured frame, see @ref EthIpIface::setCaptureHandler.
+ */
+enum class EthCaptureDir : std::uint8_t {
+    /**
+     * The frame was received by the interface.
+     */
+    Inbound = 1,
+
+    /**
+     * The frame was sent through the interface.
+     */
+    Outbound = 2,
+};
+
 /**
  * Interface provided through @ref IpIface::getHwIface.
  *
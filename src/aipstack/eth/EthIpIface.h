@@ -27,6 +27,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 #include <aipstack/meta/ChooseInt.h>
 #include <aipstack/misc/Assert.h>
@@ -37,13 +39,18 @@
 #include <aipstack/misc/OneOf.h>
 #include <aipstack/misc/MinMax.h>
 #include <aipstack/misc/Function.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/misc/LazyResourceArray.h>
 #include <aipstack/structure/LinkModel.h>
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/structure/StructureRaiiWrapper.h>
 #include <aipstack/structure/TimerQueue.h>
 #include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/OperatorKeyCompare.h>
+#include <aipstack/structure/index/HashTableIndex.h>
 #include <aipstack/infra/Struct.h>
 #include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
 #include <aipstack/infra/SendRetry.h>
 #include <aipstack/infra/TxAllocHelper.h>
 #include <aipstack/infra/Err.h>
@@ -85,6 +92,8 @@ struct EthIfaceDriverParams {
      * Maximum frame size including the 14-byte Ethernet header.
      * 
      * The resulting IP MTU (14 bytes less) must be at least @ref IpStack::MinMTU.
+     * Jumbo frames (e.g. 9014 or 9216 bytes) are supported; an IP MTU above
+     * @ref IpStack::MaxMTU is reduced to that.
      */
     std::size_t eth_mtu = 0;
     
@@ -128,6 +137,123 @@ struct EthIfaceDriverParams {
      * @return Driver-provided-state (currently just the link-up flag).
      */
     Function<EthIfaceState()> get_eth_state = nullptr;
+    
+    /**
+     * Transmit checksum offload capabilities.
+     * 
+     * This is passed through as @ref IpIfaceDriverParams::tx_chksum_offload.
+     * The driver can use @ref EthIpIface::getTxChksumPartial for frames being
+     * sent to determine if checksum calculation must be completed.
+     */
+    IpChksumOffloadFlags tx_chksum_offload = IpChksumOffloadFlags();
+    
+    /**
+     * Receive checksum offload capabilities.
+     * 
+     * This is passed through as @ref IpIfaceDriverParams::rx_chksum_offload.
+     */
+    IpChksumOffloadFlags rx_chksum_offload = IpChksumOffloadFlags();
+    
+    /**
+     * Maximum size of TCP super-segments for TCP segmentation offload.
+     * 
+     * This is passed through as @ref IpIfaceDriverParams::tso_max_size and is
+     * therefore the size at the IP level (excluding the Ethernet header). The
+     * driver can use @ref EthIpIface::getTxTso for frames being sent to
+     * determine if they must be segmented.
+     */
+    std::size_t tso_max_size = 0;
+    
+    /**
+     * Maximum size of UDP super-datagrams for UDP segmentation offload.
+     * 
+     * This is passed through as @ref IpIfaceDriverParams::uso_max_size, see
+     * @ref tso_max_size for how the driver can handle such frames.
+     */
+    std::size_t uso_max_size = 0;
+    
+    /**
+     * Driver function to transmit frames held back by the driver (optional).
+     * 
+     * If this is provided, the driver may hold back frames passed to
+     * @ref send_frame and transmit them only when this is called. It is passed
+     * through as @ref IpIfaceDriverParams::flush_tx, see that for details;
+     * @ref EthIpIface takes care of requesting a flush for frames it sends
+     * itself (ARP).
+     */
+    Function<void()> flush_frames = nullptr;
+    
+    /**
+     * Driver function called when the set of multicast MAC addresses to be
+     * received has changed (optional).
+     * 
+     * The driver should then program its receive filter with the addresses from
+     * @ref EthIpIface::getMcastMacAddrs. It is passed through as
+     * @ref IpIfaceDriverParams::update_mcast_filter, see that for details.
+     */
+    Function<void()> update_mcast_filter = nullptr;
+    
+    /**
+     * Transmit queue of the driver, for flow control of senders (optional).
+     * 
+     * This is passed through as @ref IpIfaceDriverParams::tx_queue, see that
+     * for details. The driver reports the occupancy of its frame queue to the
+     * object. ARP packets are sent without a send-retry request and are
+     * therefore not held back.
+     */
+    IpSendRetryTxQueue *tx_queue = nullptr;
+};
+
+/**
+ * ARP cache statistics of an @ref EthIpIface.
+ * 
+ * This is returned by @ref EthIpIface::getArpStats. The counters wrap around on
+ * overflow. The refreshes and refresh_failures counters are always maintained,
+ * the others only if @ref IpStackOptions::EnableStats is enabled.
+ */
+struct EthArpStats {
+    /**
+     * Number of times a used entry started being refreshed with unicast
+     * requests.
+     */
+    std::uint32_t refreshes = 0;
+    
+    /**
+     * Number of times refreshing an entry failed, so that sending to the
+     * address stalled until a new broadcast query is answered.
+     */
+    std::uint32_t refresh_failures = 0;
+    
+    /**
+     * Number of unicast packets sent using a resolved hardware address.
+     */
+    std::uint32_t hits = 0;
+    
+    /**
+     * Number of unicast packets for which the hardware address was not yet
+     * resolved, so that they were queued or not sent.
+     */
+    std::uint32_t misses = 0;
+    
+    /**
+     * Number of ARP requests sent (broadcast queries and unicast refreshes).
+     */
+    std::uint32_t requests_sent = 0;
+    
+    /**
+     * Number of ARP replies sent.
+     */
+    std::uint32_t replies_sent = 0;
+    
+    /**
+     * Number of valid ARP requests received (for any address).
+     */
+    std::uint32_t requests_received = 0;
+    
+    /**
+     * Number of valid ARP replies received.
+     */
+    std::uint32_t replies_received = 0;
 };
 
 /**
@@ -171,8 +297,10 @@ class EthIpIface final :
     ,private EthHwIface
 #endif
 {
-    AIPSTACK_USE_VALS(Arg::Params, (NumArpEntries, ArpProtectCount, HeaderBeforeEth))
-    AIPSTACK_USE_TYPES(Arg::Params, (TimersStructureService))
+    AIPSTACK_USE_VALS(Arg::Params, (NumArpEntries, ArpProtectCount, HeaderBeforeEth,
+                                    NumArpPendingPackets, ArpPendingPacketSize,
+                                    EnableCapture))
+    AIPSTACK_USE_TYPES(Arg::Params, (TimersStructureService, ArpIndexService))
     AIPSTACK_USE_TYPES(Arg, (PlatformImpl, StackArg))
     
     using Platform = PlatformFacade<PlatformImpl>;
@@ -188,23 +316,43 @@ class EthIpIface final :
     
     inline static constexpr int ArpNonProtectCount = NumArpEntries - ArpProtectCount;
     
+    // Sanity check pending packets configuration.
+    static_assert(NumArpPendingPackets >= 0);
+    static_assert(NumArpPendingPackets == 0 || ArpPendingPacketSize >= Ip4Header::Size);
+    
+    // Size of the buffer of a pending packet, including space for the headers.
+    inline static constexpr std::size_t PendingFrameBufSize = NumArpPendingPackets == 0 ? 1 :
+        HeaderBeforeEth + EthHeader::Size + ArpPendingPacketSize;
+    
     // Get an unsigned integer type sufficient for ARP entry indexes and null value.
     using ArpEntryIndexType = ChooseIntForMax<NumArpEntries, false>;
     inline static constexpr ArpEntryIndexType ArpEntryNull = TypeMax<ArpEntryIndexType>;
     
     // Number of ARP resolution attempts in the Query and Refreshing states.
     inline static constexpr std::uint8_t ArpQueryAttempts = 3;
-    inline static constexpr std::uint8_t ArpRefreshAttempts = 2;
+    inline static constexpr std::uint8_t ArpRefreshAttempts = 3;
     
     // These need to fit in 4 bits available in ArpEntry::attempts_left.
     static_assert(ArpQueryAttempts <= 15);
     static_assert(ArpRefreshAttempts <= 15);
     
     // Base ARP response timeout, doubled for each retransmission.
-    inline static constexpr TimeType ArpBaseResponseTimeoutTicks = 1.0 * Platform::TimeFreq;
+    inline static constexpr double ArpBaseResponseTimeoutSec = 1.0;
+    inline static constexpr TimeType ArpBaseResponseTimeoutTicks =
+        ArpBaseResponseTimeoutSec * Platform::TimeFreq;
     
-    // Time after a Valid entry will go to Refreshing when used.
-    inline static constexpr TimeType ArpValidTimeoutTicks = 60.0 * Platform::TimeFreq;
+    // Lifetime of a MAC address after it has been confirmed.
+    inline static constexpr double ArpValidLifetimeSec = 60.0;
+    
+    // Time after a Valid entry will go to Refreshing when used. This is at 80% of
+    // the lifetime so that for entries in use the refresh normally completes
+    // before the lifetime ends, and traffic keeps using the entry meanwhile.
+    inline static constexpr TimeType ArpValidTimeoutTicks =
+        0.8 * ArpValidLifetimeSec * Platform::TimeFreq;
+    
+    // All refresh attempts need to fit into the rest of the lifetime.
+    static_assert(((1 << ArpRefreshAttempts) - 1) * ArpBaseResponseTimeoutSec <=
+                  0.2 * ArpValidLifetimeSec);
     
     struct ArpEntry;
     struct ArpEntryTimerQueueNodeUserData;
@@ -219,6 +367,13 @@ class EthIpIface final :
         ArpEntry, ArpEntryIndexType, ArpEntryNull, EthIpIface, ArpEntriesAccessor> {};
     using ArpEntryRef = typename ArpEntriesLinkModel::Ref;
     
+    // Index data structure for used ARP entries by IP address.
+    struct ArpIndexAccessor;
+    struct ArpIndexKeyFuncs;
+    AIPSTACK_MAKE_INSTANCE(ArpIndex, (ArpIndexService::template Index<
+        ArpIndexAccessor, Ip4Addr, ArpIndexKeyFuncs, ArpEntriesLinkModel,
+        /*Duplicates=*/false>))
+    
     // Nodes in ARP entry data structures.
     using ArpEntryListNode = LinkedListNode<ArpEntriesLinkModel>;
     using ArpEntryTimerQueueNode = typename TheTimerQueueService::template Node<
@@ -250,6 +405,29 @@ class EthIpIface final :
         std::uint8_t attempts_left : 4;
     };
     
+    // Packet waiting for address resolution (in array m_pending_packets).
+    struct PendingPacket;
+    using PendingPacketLinkModel = PointerLinkModel<PendingPacket>;
+    using PendingPacketListNode = LinkedListNode<PendingPacketLinkModel>;
+    
+    struct PendingPacket {
+        // Node in the pending list of an ARP entry or m_free_pending_list.
+        PendingPacketListNode list_node;
+        
+        // Length of the IP packet.
+        std::size_t len;
+        
+        // Buffer with the IP packet at offset HeaderBeforeEth + EthHeader::Size.
+        char frame_buf[PendingFrameBufSize];
+    };
+    
+    struct PendingPacketListNodeAccessor :
+        public MemberAccessor<PendingPacket, PendingPacketListNode,
+                              &PendingPacket::list_node> {};
+    
+    using PendingPacketList = LinkedList<
+        PendingPacketListNodeAccessor, PendingPacketLinkModel, true>;
+    
     // ARP table entry (in array m_arp_entries)
     struct ArpEntry {
         inline ArpEntryTimerQueueNodeUserData & nud()
@@ -257,20 +435,35 @@ class EthIpIface final :
             return timer_queue_node;
         }
         
-        // MAC address of the entry (valid in Valid and Refreshing states).
-        MacAddr mac_addr;
-        
-        // Node in linked lists (m_used_entries_list or m_free_entries_list).
-        ArpEntryListNode list_node;
+        // NOTE: Fields are ordered by decreasing alignment so that there is
+        // no padding between them.
         
         // Node in the timer queue (m_timer_queue).
         ArpEntryTimerQueueNode timer_queue_node;
         
+        // List of send-retry waiters to be notified when resolution is complete.
+        IpSendRetryList retry_list;
+        
+        // Packets to be sent when resolution is complete (only in Query state).
+        StructureRaiiWrapper<PendingPacketList> pending_list;
+        
         // IP address of the entry (valid in all states except Free).
         Ip4Addr ip_addr;
         
-        // List of send-retry waiters to be notified when resolution is complete.
-        IpSendRetryList retry_list;
+        // Node in the index (m_arp_index), for entries not in the free list.
+        typename ArpIndex::Node index_node;
+        
+        // Node in linked lists (m_hard_entries_list, m_weak_entries_list or
+        // m_free_entries_list).
+        ArpEntryListNode list_node;
+        
+        // MAC address of the entry (valid in Valid and Refreshing states).
+        MacAddr mac_addr;
+        
+        // Ethernet header for sending IPv4 packets to the entry. The source MAC
+        // address and type are set at construction, the destination MAC address
+        // is set together with mac_addr.
+        char eth_header[EthHeader::Size];
     };
     
     // Accessors for data structure nodes.
@@ -279,6 +472,22 @@ class EthIpIface final :
     struct ArpEntryTimerQueueNodeAccessor :
         public MemberAccessor<ArpEntry, ArpEntryTimerQueueNode,
                               &ArpEntry::timer_queue_node> {};
+    struct ArpIndexAccessor :
+        public MemberAccessor<ArpEntry, typename ArpIndex::Node, &ArpEntry::index_node> {};
+    
+    struct ArpIndexKeyFuncs : public OperatorKeyCompare {
+        inline static Ip4Addr GetKeyOfEntry (ArpEntry const &entry)
+        {
+            return entry.ip_addr;
+        }
+        
+        inline static std::size_t HashKey (Ip4Addr addr)
+        {
+            HashAccumulator hash;
+            hash.addWord(addr.value());
+            return hash.getHash();
+        }
+    };
     
     // Linked list type.
     using ArpEntryList = LinkedList<
@@ -310,26 +519,33 @@ public:
             /*hw_type=*/ IpHwType::Ethernet,
             /*hw_iface=*/ static_cast<EthHwIface *>(this),
             AIPSTACK_BIND_MEMBER_TN(&EthIpIface::driverSendIp4Packet, this),
-            AIPSTACK_BIND_MEMBER_TN(&EthIpIface::driverGetState, this)
+            AIPSTACK_BIND_MEMBER_TN(&EthIpIface::driverGetState, this),
+            params.tx_chksum_offload,
+            params.rx_chksum_offload,
+            params.tso_max_size,
+            params.uso_max_size,
+            params.flush_frames,
+            params.update_mcast_filter,
+            params.tx_queue
         }),
-        m_timer(platform_, AIPSTACK_BIND_MEMBER_TN(&EthIpIface::timerHandler, this))
+        m_timer(platform_, AIPSTACK_BIND_MEMBER_TN(&EthIpIface::timerHandler, this)),
+        m_arp_gen(1),
+        m_num_hard_entries(0),
+        m_num_used_entries(0),
+        m_arp_refreshes(0),
+        m_arp_refresh_failures(0)
     {
         AIPSTACK_ASSERT(params.eth_mtu >= EthHeader::Size);
         AIPSTACK_ASSERT(params.mac_addr != nullptr);
         AIPSTACK_ASSERT(params.send_frame);
         AIPSTACK_ASSERT(params.get_eth_state);
         
-        // Initialize ARP entries...
-        for (auto &e : m_arp_entries) {
-            // State Free, timer not active.
-            e.nud().state = ArpEntryState::Free;
-            e.nud().weak = false; // irrelevant, for efficiency
-            e.nud().timer_active = false;
-            e.nud().attempts_left = 0; // irrelevant, for efficiency
-            
-            // Insert to free list.
-            m_free_entries_list.append({e, *this}, *this);
-        }
+        // Prepare the Ethernet header for sending to the broadcast address.
+        init_ip4_eth_header(m_bcast_eth_header, MacAddr::BroadcastAddr());
+        init_ip4_eth_header(m_mcast_eth_header, MacAddr::BroadcastAddr());
+        
+        // ARP entries and pending packets are constructed as needed, when the
+        // respective free list is empty (see get_arp_entry, queue_pending_packet).
     }
 
     /**
@@ -363,14 +579,26 @@ public:
      * 
      * @param frame Received frame, presumably starting with the Ethernet header. The
      *              referenced buffers will only be read from within this function call.
+     * @param chksum_verified Checksums which have been verified by hardware, passed
+     *        to @ref IpDriverIface::recvIp4Packet for IPv4 packets.
+     * @param rx_buf If not null, the retainable buffer which contains the frame,
+     *        passed to @ref IpDriverIface::recvIp4Packet for IPv4 packets.
+     * @param rx_time The receive timestamp of the frame if available, passed to
+     *        @ref IpDriverIface::recvIp4Packet for IPv4 packets.
      */
-    void recvFrame (IpBufRef frame)
+    void recvFrame (IpBufRef frame,
+                    IpChksumOffloadFlags chksum_verified = IpChksumOffloadFlags(),
+                    IpRxBuf *rx_buf = nullptr, IpRxTimestamp rx_time = IpRxTimestamp())
     {
+        capture_frame(EthCaptureDir::Inbound, frame);
+        
         // Check that we have an Ethernet header.
         if (AIPSTACK_UNLIKELY(!frame.hasHeader(EthHeader::Size))) {
             return;
         }
         
+        m_driver_iface.beginRxLatencyTrace(IpLatencyStage::EthRx, rx_time);
+        
         // Store the reference to the Ethernet header (for getRxEthHeader).
         m_rx_eth_header = EthHeader::MakeRef(frame.getChunkPtr());
         
@@ -382,11 +610,203 @@ public:
         
         // Handle based on the EtherType.
         if (AIPSTACK_LIKELY(ethtype == EthType::Ipv4)) {
-            m_driver_iface.recvIp4Packet(pkt);
+            m_driver_iface.recvIp4Packet(pkt, chksum_verified, rx_buf, rx_time);
         }
         else if (ethtype == EthType::Arp) {
             recvArpPacket(pkt);
         }
+        
+        m_driver_iface.endRxLatencyTrace();
+    }
+    
+    /**
+     * Report the time when a frame was transmitted.
+     * 
+     * If the frame contains an IPv4 packet, this passes the packet and time to
+     * @ref IpDriverIface::reportTxTimestamp, otherwise it does nothing. The same
+     * restrictions apply.
+     * 
+     * @param frame The frame as passed to @ref EthIfaceDriverParams::send_frame,
+     *        starting with the Ethernet header.
+     * @param time The transmit time in platform time units.
+     */
+    void reportTxTimestamp (IpBufRef frame, std::uint64_t time)
+    {
+        if (frame.hasHeader(EthHeader::Size) &&
+            EthHeader::MakeRef(frame.getChunkPtr()).get(EthHeader::EthType()) ==
+                EthType::Ipv4)
+        {
+            m_driver_iface.reportTxTimestamp(frame.hideHeader(EthHeader::Size), time);
+        }
+    }
+    
+    /**
+     * Process a batch of received frames.
+     * 
+     * The frames are processed as within @ref beginRecvBatch and @ref endRecvBatch,
+     * one layer at a time: first all ARP packets are processed, so that the ARP
+     * cache is up to date when processing the IPv4 packets, then all IPv4 packets
+     * are passed to the stack in their original order. It must not be called
+     * within a batch.
+     * 
+     * @param frames Array of received frames, with the members of each as the
+     *        arguments of @ref recvFrame.
+     * @param count Number of frames in the array.
+     */
+    void recvFrames (IpRxBatchEntry const *frames, std::size_t count)
+    {
+        m_driver_iface.beginRecvBatch();
+        
+        // Capture in the original order, before processing can send frames.
+        if constexpr (EnableCapture) {
+            for (std::size_t i : IntRange(count)) {
+                capture_frame(EthCaptureDir::Inbound, frames[i].buf);
+            }
+        }
+        
+        // Process ARP packets.
+        for (std::size_t i : IntRange(count)) {
+            IpBufRef frame = frames[i].buf;
+            if (AIPSTACK_LIKELY(frame.hasHeader(EthHeader::Size))) {
+                m_rx_eth_header = EthHeader::MakeRef(frame.getChunkPtr());
+                if (m_rx_eth_header.get(EthHeader::EthType()) == EthType::Arp) {
+                    recvArpPacket(frame.hideHeader(EthHeader::Size));
+                }
+            }
+        }
+        
+        // Process IPv4 packets.
+        for (std::size_t i : IntRange(count)) {
+            IpBufRef frame = frames[i].buf;
+            if (AIPSTACK_LIKELY(frame.hasHeader(EthHeader::Size))) {
+                m_rx_eth_header = EthHeader::MakeRef(frame.getChunkPtr());
+                if (m_rx_eth_header.get(EthHeader::EthType()) == EthType::Ipv4) {
+                    m_driver_iface.beginRxLatencyTrace(
+                        IpLatencyStage::EthRx, frames[i].rx_time);
+                    m_driver_iface.recvIp4Packet(frame.hideHeader(EthHeader::Size),
+                        frames[i].chksum_verified, frames[i].rx_buf, frames[i].rx_time);
+                    m_driver_iface.endRxLatencyTrace();
+                }
+            }
+        }
+        
+        m_driver_iface.endRecvBatch();
+    }
+    
+    /**
+     * Begin a batch of received frames.
+     * 
+     * This is the equivalent of @ref IpDriverIface::beginRecvBatch for frames
+     * passed to @ref recvFrame. Within a batch, the buffers of frames must remain
+     * valid and unchanged until @ref endRecvBatch returns.
+     */
+    inline void beginRecvBatch ()
+    {
+        m_driver_iface.beginRecvBatch();
+    }
+    
+    /**
+     * End a batch of received frames.
+     * 
+     * This is the equivalent of @ref IpDriverIface::endRecvBatch.
+     */
+    inline void endRecvBatch ()
+    {
+        m_driver_iface.endRecvBatch();
+    }
+    
+    /**
+     * Type of callback which is called for each frame received or sent by the
+     * interface, see @ref setCaptureHandler.
+     * 
+     * @param dir Whether the frame was received or sent.
+     * @param frame The frame, starting with the Ethernet header. The referenced
+     *        buffers must not be used outside of the callback.
+     */
+    using CaptureHandler = Function<void(EthCaptureDir dir, IpBufRef frame)>;
+    
+    /**
+     * Set the callback which is called for each frame received or sent by the
+     * interface, for packet capture.
+     * 
+     * This may only be used if @ref EthIpIfaceOptions::EnableCapture is enabled.
+     * Received frames are reported on entry to @ref recvFrame or @ref recvFrames
+     * and sent frames when the driver has accepted them
+     * (@ref EthIfaceDriverParams::send_frame returned success). The callback
+     * must not send frames or otherwise call into the stack.
+     * 
+     * @param handler The callback, or null to disable capture.
+     */
+    void setCaptureHandler (CaptureHandler handler)
+    {
+        static_assert(EnableCapture, "EnableCapture option is not enabled");
+        
+        m_capture_handler = handler;
+    }
+    
+    /**
+     * Determine whether the transport checksum of a frame being sent must be
+     * completed by the driver.
+     * 
+     * This is the equivalent of @ref IpDriverIface::getTxChksumPartial for
+     * Ethernet frames passed to @ref EthIfaceDriverParams::send_frame.
+     * 
+     * @param frame Frame being sent, starting with the Ethernet header.
+     * @param csum_start On success, set to the offset of the transport header
+     *        relative to the start of the frame.
+     * @param csum_offset On success, set to the offset of the checksum field
+     *        relative to the start of the transport header.
+     * @return True if the checksum must be completed, false if not.
+     */
+    bool getTxChksumPartial (IpBufRef frame, std::size_t &csum_start,
+                             std::size_t &csum_offset)
+    {
+        AIPSTACK_ASSERT(frame.getChunkLength() >= EthHeader::Size);
+        
+        auto eth_header = EthHeader::MakeRef(frame.getChunkPtr());
+        if (eth_header.get(EthHeader::EthType()) != EthType::Ipv4) {
+            return false;
+        }
+        
+        if (!m_driver_iface.getTxChksumPartial(
+            frame.hideHeader(EthHeader::Size), csum_start, csum_offset))
+        {
+            return false;
+        }
+        
+        csum_start += EthHeader::Size;
+        return true;
+    }
+    
+    /**
+     * Determine whether a frame being sent contains a TCP super-segment or UDP
+     * super-datagram which must be segmented by the driver.
+     * 
+     * This is the equivalent of @ref IpDriverIface::getTxTso for Ethernet frames
+     * passed to @ref EthIfaceDriverParams::send_frame. The Ethernet header is
+     * considered part of the header template, that is it is included in
+     * @ref IpTxTsoInfo::header_len.
+     * 
+     * @param frame Frame being sent, starting with the Ethernet header.
+     * @param info On success, set to the segmentation descriptor.
+     * @return True if the frame contains a super-segment or super-datagram,
+     *         false if not.
+     */
+    bool getTxTso (IpBufRef frame, IpTxTsoInfo &info)
+    {
+        AIPSTACK_ASSERT(frame.getChunkLength() >= EthHeader::Size);
+        
+        auto eth_header = EthHeader::MakeRef(frame.getChunkPtr());
+        if (eth_header.get(EthHeader::EthType()) != EthType::Ipv4) {
+            return false;
+        }
+        
+        if (!m_driver_iface.getTxTso(frame.hideHeader(EthHeader::Size), info)) {
+            return false;
+        }
+        
+        info.header_len += EthHeader::Size;
+        return true;
     }
     
     /**
@@ -406,14 +826,88 @@ public:
         m_driver_iface.stateChanged();
     }
     
+    /**
+     * Get ARP cache statistics.
+     * 
+     * @return The current statistics.
+     */
+    inline EthArpStats getArpStats () const
+    {
+        EthArpStats stats = m_arp_stats.get();
+        stats.refreshes = m_arp_refreshes;
+        stats.refresh_failures = m_arp_refresh_failures;
+        return stats;
+    }
+    
+    /**
+     * Get the memory usage of the ARP cache.
+     * 
+     * Objects are ARP entries which are not free. The static bytes include the
+     * entries and the pending packet slots. The peak is only maintained if
+     * @ref IpStackOptions::EnableStats is enabled.
+     * 
+     * @return The current memory usage.
+     */
+    IpMemoryUsage getArpMemoryUsage () const
+    {
+        IpMemoryUsage usage;
+        usage.static_bytes = sizeof(m_arp_entries) + sizeof(m_pending_packets);
+        usage.capacity = NumArpEntries;
+        usage.used = m_num_used_entries;
+        usage.peak_used = m_peak_used_entries.get();
+        return usage;
+    }
+    
+    /**
+     * Get the multicast MAC addresses which should be received.
+     * 
+     * These are the MAC addresses of the multicast groups joined on the
+     * interface (see @ref IpMcastMembership), including the all-hosts group.
+     * Distinct groups may map to the same MAC address, duplicates are not
+     * returned where they can be detected.
+     * 
+     * @param addrs Array where up to `max_addrs` addresses are written.
+     * @param max_addrs Size of the array.
+     * @return Number of addresses. If this is greater than `max_addrs`, not all
+     *         addresses could be stored and the driver should receive all
+     *         multicast frames.
+     */
+    std::size_t getMcastMacAddrs (MacAddr *addrs, std::size_t max_addrs)
+    {
+        std::size_t num_addrs = 0;
+        
+        m_driver_iface.forEachIp4McastGroup([&](Ip4Addr group) {
+            MacAddr mac_addr = ip4_mcast_mac_addr(group);
+            for (std::size_t i : IntRange(MinValue(num_addrs, max_addrs))) {
+                if (addrs[i] == mac_addr) {
+                    return;
+                }
+            }
+            if (num_addrs < max_addrs) {
+                addrs[num_addrs] = mac_addr;
+            }
+            num_addrs++;
+        });
+        
+        return num_addrs;
+    }
+    
 private:
+    // Get the MAC address of an IPv4 multicast group (RFC 1112 section 6.4).
+    inline static MacAddr ip4_mcast_mac_addr (Ip4Addr group)
+    {
+        return MacAddr(0x01, 0x00, 0x5E, group.getByte<1>() & 0x7F,
+                       group.getByte<2>(), group.getByte<3>());
+    }
+    
     IpErr driverSendIp4Packet (IpBufRef pkt, Ip4Addr ip_addr,
                                IpSendRetryRequest *retryReq)
     {
-        // Try to resolve the MAC address.
-        MacAddr dst_mac;
-        IpErr resolve_err = resolve_hw_addr(ip_addr, &dst_mac, retryReq);
-        if (AIPSTACK_UNLIKELY(resolve_err != IpErr::Success)) {
+        // Try to resolve the MAC address, getting the prepared Ethernet header.
+        char const *eth_header;
+        IpErr resolve_err = resolve_hw_addr(ip_addr, &eth_header, retryReq, pkt);
+        if (AIPSTACK_UNLIKELY(resolve_err != IpErr::Success || eth_header == nullptr)) {
+            // Failure, or the packet was kept to be sent after resolution.
             return resolve_err;
         }
         
@@ -424,13 +918,10 @@ private:
         IpBufRef frame = pkt.revealHeader(EthHeader::Size);
         
         // Write the Ethernet header.
-        auto eth_header = EthHeader::MakeRef(frame.getChunkPtr());
-        eth_header.set(EthHeader::DstMac(),  dst_mac);
-        eth_header.set(EthHeader::SrcMac(),  *m_params.mac_addr);
-        eth_header.set(EthHeader::EthType(), EthType::Ipv4);
+        std::memcpy(frame.getChunkPtr(), eth_header, EthHeader::Size);
         
         // Send the frame via the lower-layer driver.
-        return m_params.send_frame(frame);
+        return send_frame(frame);
     }
     
     IpIfaceDriverState driverGetState ()
@@ -493,42 +984,64 @@ private:
         MacAddr src_mac     = arp_header.get(ArpIp4Header::SrcHwAddr());
         Ip4Addr src_ip_addr = arp_header.get(ArpIp4Header::SrcProtoAddr());
         
+        if (op_type == ArpOpType::Request) {
+            m_arp_stats.inc(&EthArpStats::requests_received);
+        }
+        else if (op_type == ArpOpType::Reply) {
+            m_arp_stats.inc(&EthArpStats::replies_received);
+        }
+        
         // Try to save the hardware address.
         save_hw_addr(src_ip_addr, src_mac);
         
-        // If this is an ARP request for our IP address, send a response.
+        // If this is an ARP request for one of our IP addresses, send a response.
         if (op_type == ArpOpType::Request) {
-            IpIfaceIp4Addrs const *ifaddr = m_driver_iface.getIp4Addrs();
-            if (ifaddr != nullptr &&
-                arp_header.get(ArpIp4Header::DstProtoAddr()) == ifaddr->addr)
-            {
-                send_arp_packet(ArpOpType::Reply, src_mac, src_ip_addr);
+            Ip4Addr target_addr = arp_header.get(ArpIp4Header::DstProtoAddr());
+            if (m_driver_iface.iface().ip4AddrIsLocalAddr(target_addr)) {
+                send_arp_packet(ArpOpType::Reply, src_mac, src_ip_addr, target_addr);
             }
         }
     }
     
+    // On success, *eth_header is set to the Ethernet header to send with, or to
+    // null if the packet has been kept to be sent when resolution completes.
     AIPSTACK_ALWAYS_INLINE
     IpErr resolve_hw_addr (
-        Ip4Addr ip_addr, MacAddr *mac_addr, IpSendRetryRequest *retryReq)
+        Ip4Addr ip_addr, char const **eth_header, IpSendRetryRequest *retryReq,
+        IpBufRef pkt)
     {
-        // First look if the first used entry is a match, as an optimization.
-        ArpEntryRef entry_ref = m_used_entries_list.first(*this);
+        // First look if the entry cached by the flow being sent for or the
+        // most recently used hard entry is a match, as an optimization.
+        IpNeighborCache *neigh_cache = m_driver_iface.getTxNeighborCache();
+        ArpEntryRef entry_ref = get_cached_arp_entry(neigh_cache, ip_addr);
+        if (entry_ref.isNull()) {
+            entry_ref = m_hard_entries_list.first(*this);
+        }
         
         if (AIPSTACK_LIKELY(!entry_ref.isNull() && (*entry_ref).ip_addr == ip_addr)) {
-            // Fast path, the first used entry is a match.
+            // Fast path, the entry is a match.
             AIPSTACK_ASSERT((*entry_ref).nud().state != ArpEntryState::Free);
             
-            // Make sure the entry is hard as get_arp_entry would do below.
-            (*entry_ref).nud().weak = false;
+            // Make sure the entry is hard and most recently used as get_arp_entry
+            // would do below.
+            make_entry_hard(entry_ref);
         } else {
             // Slow path: use get_arp_entry, make a hard entry.
             GetArpEntryRes get_res = get_arp_entry(ip_addr, false, entry_ref);
             
             // Did we not get an (old or new) entry for this address?
             if (AIPSTACK_UNLIKELY(get_res != GetArpEntryRes::GotArpEntry)) {
-                // If this is a broadcast IP address, return the broadcast MAC address.
+                // If this is a broadcast IP address, return the broadcast header.
                 if (get_res == GetArpEntryRes::BroadcastAddr) {
-                    *mac_addr = MacAddr::BroadcastAddr();
+                    *eth_header = m_bcast_eth_header;
+                    return IpErr::Success;
+                }
+                // If this is a multicast IP address, prepare the header with the
+                // MAC address of the group.
+                else if (get_res == GetArpEntryRes::MulticastAddr) {
+                    EthHeader::MakeRef(m_mcast_eth_header).set(
+                        EthHeader::DstMac(), ip4_mcast_mac_addr(ip_addr));
+                    *eth_header = m_mcast_eth_header;
                     return IpErr::Success;
                 } else {
                     // Failure, cannot get MAC address.
@@ -556,19 +1069,30 @@ private:
                 set_entry_timer(entry);
                 update_timer();
                 send_arp_packet(ArpOpType::Request, entry.mac_addr, entry.ip_addr);
+                m_arp_refreshes++;
+            }
+            
+            // Remember the entry in the neighbor cache of the flow.
+            if (neigh_cache != nullptr) {
+                neigh_cache->entry = &entry;
+                neigh_cache->gen = m_arp_gen;
             }
             
-            // Success, return MAC address.
-            *mac_addr = entry.mac_addr;
+            m_arp_stats.inc(&EthArpStats::hits);
+            
+            // Success, return the Ethernet header with the MAC address.
+            *eth_header = entry.eth_header;
             return IpErr::Success;
         } else {
+            m_arp_stats.inc(&EthArpStats::misses);
+            
             // If this is a Free entry, initialize it.
             if (entry.nud().state == ArpEntryState::Free) {
                 // Timer is not active for Free entries (needed by set_entry_timer).
                 AIPSTACK_ASSERT(!entry.nud().timer_active);
                 
                 // Go to Query state, start timeout, send first broadcast request.
-                // NOTE: Entry is already inserted to m_used_entries_list.
+                // NOTE: Entry is already inserted to m_hard_entries_list.
                 entry.nud().state = ArpEntryState::Query;
                 entry.nud().attempts_left = ArpQueryAttempts;
                 set_entry_timer(entry);
@@ -576,6 +1100,13 @@ private:
                 send_arp_packet(ArpOpType::Request, MacAddr::BroadcastAddr(), ip_addr);
             }
             
+            // Keep a copy of the packet to be sent when the address is resolved
+            // if possible, then the send is considered successful.
+            if (queue_pending_packet(entry, pkt)) {
+                *eth_header = nullptr;
+                return IpErr::Success;
+            }
+            
             // Add a request to the retry list if a request is supplied.
             entry.retry_list.addRequest(retryReq);
             
@@ -584,6 +1115,27 @@ private:
         }
     }
     
+    // Return the entry from a neighbor cache if the cache is still valid and
+    // the entry is for the given address. Otherwise return null.
+    AIPSTACK_ALWAYS_INLINE
+    ArpEntryRef get_cached_arp_entry (IpNeighborCache *neigh_cache, Ip4Addr ip_addr)
+    {
+        // The gen is never zero so an unset cache (with null entry) never matches.
+        // A matching gen means no entry has been reset since the entry was cached.
+        if (neigh_cache == nullptr || neigh_cache->gen != m_arp_gen) {
+            return ArpEntryRef::null();
+        }
+        
+        ArpEntry &entry = *static_cast<ArpEntry *>(neigh_cache->entry);
+        AIPSTACK_ASSERT(entry.nud().state != ArpEntryState::Free);
+        
+        if (AIPSTACK_UNLIKELY(entry.ip_addr != ip_addr)) {
+            return ArpEntryRef::null();
+        }
+        
+        return {entry, *this};
+    }
+    
     void save_hw_addr (Ip4Addr ip_addr, MacAddr mac_addr)
     {
         // Sanity check MAC address: not broadcast.
@@ -602,11 +1154,15 @@ private:
             // Set entry to Valid state, remember MAC address, start timeout.
             entry.nud().state = ArpEntryState::Valid;
             entry.mac_addr = mac_addr;
+            EthHeader::MakeRef(entry.eth_header).set(EthHeader::DstMac(), mac_addr);
             entry.nud().attempts_left = 1;
             clear_entry_timer(entry); // set_entry_timer requires !timer_active
             set_entry_timer(entry);
             update_timer();
             
+            // Send packets which were waiting for the resolution.
+            send_pending_packets(entry);
+            
             // Dispatch send-retry requests.
             // NOTE: The handlers called may end up changing this ARP entry, including
             // reusing it for a different IP address. In that case retry_list.reset()
@@ -626,46 +1182,35 @@ private:
         }
     }
     
-    enum class GetArpEntryRes {GotArpEntry, BroadcastAddr, InvalidAddr};
+    void init_ip4_eth_header (char *header, MacAddr dst_mac)
+    {
+        auto eth_header = EthHeader::MakeRef(header);
+        eth_header.set(EthHeader::DstMac(),  dst_mac);
+        eth_header.set(EthHeader::SrcMac(),  *m_params.mac_addr);
+        eth_header.set(EthHeader::EthType(), EthType::Ipv4);
+    }
+    
+    enum class GetArpEntryRes {GotArpEntry, BroadcastAddr, MulticastAddr, InvalidAddr};
     
     // NOTE: If a Free entry is obtained, then 'weak' and 'ip_addr' have been
-    // set, the entry is already in m_used_entries_list, but the caller must
-    // complete initializing it to a non-Free state. Also, update_timer is needed
-    // afterward then.
+    // set, the entry is already in the index and in m_hard_entries_list or
+    // m_weak_entries_list, but the caller must complete initializing it to a
+    // non-Free state. Also, update_timer is needed afterward then.
     GetArpEntryRes get_arp_entry (Ip4Addr ip_addr, bool weak, ArpEntryRef &out_entry)
     {
-        // Look for a used entry with this IP address while also collecting
-        // some information to be used in case we don't find an entry...
-        
-        int num_hard = 0;
-        ArpEntryRef last_weak_entry_ref = ArpEntryRef::null();
-        ArpEntryRef last_hard_entry_ref = ArpEntryRef::null();
-        
-        ArpEntryRef entry_ref = m_used_entries_list.first(*this);
-        
-        while (!entry_ref.isNull()) {
-            ArpEntry &entry = *entry_ref;
-            AIPSTACK_ASSERT(entry.nud().state != ArpEntryState::Free);
-            
-            if (entry.ip_addr == ip_addr) {
-                break;
-            }
-            
-            if (entry.nud().weak) {
-                last_weak_entry_ref = entry_ref;
-            } else {
-                num_hard++;
-                last_hard_entry_ref = entry_ref;
-            }
-            
-            entry_ref = m_used_entries_list.next(entry_ref, *this);
-        }
+        // Look for a used entry with this IP address.
+        ArpEntryRef entry_ref = m_arp_index.findEntry(ip_addr, *this);
         
         if (AIPSTACK_LIKELY(!entry_ref.isNull())) {
             // We found an entry with this IP address.
-            // If this is a hard request, make sure the entry is hard.
+            AIPSTACK_ASSERT((*entry_ref).nud().state != ArpEntryState::Free);
+            
+            // If this is a hard request, make sure the entry is hard. In any case
+            // make the entry most recently used.
             if (!weak) {
-                (*entry_ref).nud().weak = false;
+                make_entry_hard(entry_ref);
+            } else {
+                bump_entry(entry_ref);
             }
         } else {
             // We did not find an entry with this IP address.
@@ -681,6 +1226,11 @@ private:
                 return GetArpEntryRes::InvalidAddr;
             }
             
+            // Multicast addresses map to MAC addresses directly.
+            if (ip_addr.isMulticast()) {
+                return GetArpEntryRes::MulticastAddr;
+            }
+            
             // Check if the interface has an IP address assigned.
             IpIfaceIp4Addrs const *ifaddr = m_driver_iface.getIp4Addrs();
             if (ifaddr == nullptr) {
@@ -697,52 +1247,57 @@ private:
                 return GetArpEntryRes::BroadcastAddr;
             }
             
-            // Check if there is a Free entry available.
-            entry_ref = m_free_entries_list.first(*this);
+            // If there is no Free entry available, construct a new entry if not
+            // all have been constructed yet.
+            if (m_free_entries_list.isEmpty() && !m_arp_entries.allConstructed()) {
+                new_arp_entry();
+            }
             
-            if (!entry_ref.isNull()) {
-                // Got a Free entry.
-                AIPSTACK_ASSERT((*entry_ref).nud().state == ArpEntryState::Free);
-                AIPSTACK_ASSERT(!(*entry_ref).nud().timer_active);
-                AIPSTACK_ASSERT(!(*entry_ref).retry_list.hasRequests());
-                
-                // Move the entry from the free list to the used list.
-                m_free_entries_list.removeFirst(*this);
-                m_used_entries_list.prepend(entry_ref, *this);
-            } else {
-                // There is no Free entry available, we will recycle a used entry.
+            // If there is still no Free entry available, recycle a used entry.
+            if (m_free_entries_list.isEmpty()) {
                 // Determine whether to recycle a weak or hard entry.
                 bool use_weak;
                 if (weak) {
-                    use_weak =
-                        !(num_hard > ArpProtectCount || last_weak_entry_ref.isNull());
+                    use_weak = !(m_num_hard_entries > ArpProtectCount ||
+                                 m_weak_entries_list.isEmpty());
                 } else {
-                    int num_weak = NumArpEntries - num_hard;
-                    use_weak =
-                        (num_weak > ArpNonProtectCount || last_hard_entry_ref.isNull());
+                    int num_weak = NumArpEntries - m_num_hard_entries;
+                    use_weak = (num_weak > ArpNonProtectCount ||
+                                m_hard_entries_list.isEmpty());
                 }
                 
-                // Get the entry to be recycled.
-                entry_ref = use_weak ? last_weak_entry_ref : last_hard_entry_ref;
-                AIPSTACK_ASSERT(!entry_ref.isNull());
-                
-                // Reset the entry, but keep it in the used list.
-                reset_arp_entry(*entry_ref, true);
+                // Reset the least recently used entry of the chosen kind, which
+                // moves it to the free list.
+                ArpEntryList &recycle_list =
+                    use_weak ? m_weak_entries_list : m_hard_entries_list;
+                reset_arp_entry(*recycle_list.lastNotEmpty(*this));
             }
             
-            // NOTE: The entry is in Free state now but in the used list.
-            // The caller is responsible to set a non-Free state ensuring
-            // that the state corresponds with the list membership again.
+            // Get a Free entry.
+            entry_ref = m_free_entries_list.first(*this);
+            AIPSTACK_ASSERT(!entry_ref.isNull());
+            AIPSTACK_ASSERT((*entry_ref).nud().state == ArpEntryState::Free);
+            AIPSTACK_ASSERT(!(*entry_ref).nud().timer_active);
+            AIPSTACK_ASSERT(!(*entry_ref).retry_list.hasRequests());
             
             // Set IP address and weak flag.
             (*entry_ref).ip_addr = ip_addr;
             (*entry_ref).nud().weak = weak;
-        }
-        
-        // Bump to entry to the front of the used entries list.
-        if (!(entry_ref == m_used_entries_list.first(*this))) {
-            m_used_entries_list.remove(entry_ref, *this);
-            m_used_entries_list.prepend(entry_ref, *this);
+            
+            // Move the entry from the free list to the used list of its kind
+            // and insert it to the index.
+            m_free_entries_list.removeFirst(*this);
+            entries_list(*entry_ref).prepend(entry_ref, *this);
+            if (!weak) {
+                m_num_hard_entries++;
+            }
+            m_num_used_entries++;
+            m_peak_used_entries.update(m_num_used_entries);
+            m_arp_index.addEntry(entry_ref, *this);
+            
+            // NOTE: The entry is in Free state now but in a used list.
+            // The caller is responsible to set a non-Free state ensuring
+            // that the state corresponds with the list membership again.
         }
         
         // Return the entry.
@@ -750,8 +1305,38 @@ private:
         return GetArpEntryRes::GotArpEntry;
     }
     
+    // Return the used entries list which an entry belongs to.
+    inline ArpEntryList & entries_list (ArpEntry &entry)
+    {
+        return entry.nud().weak ? m_weak_entries_list : m_hard_entries_list;
+    }
+    
+    // Make a used entry the most recently used in its list.
+    inline void bump_entry (ArpEntryRef entry_ref)
+    {
+        ArpEntryList &list = entries_list(*entry_ref);
+        if (!(entry_ref == list.first(*this))) {
+            list.remove(entry_ref, *this);
+            list.prepend(entry_ref, *this);
+        }
+    }
+    
+    // Make a used entry hard and the most recently used hard entry.
+    inline void make_entry_hard (ArpEntryRef entry_ref)
+    {
+        ArpEntry &entry = *entry_ref;
+        if (AIPSTACK_UNLIKELY(entry.nud().weak)) {
+            m_weak_entries_list.remove(entry_ref, *this);
+            entry.nud().weak = false;
+            m_hard_entries_list.prepend(entry_ref, *this);
+            m_num_hard_entries++;
+        } else {
+            bump_entry(entry_ref);
+        }
+    }
+    
     // NOTE: update_timer is needed after this.
-    void reset_arp_entry (ArpEntry &entry, bool leave_in_used_list)
+    void reset_arp_entry (ArpEntry &entry)
     {
         AIPSTACK_ASSERT(entry.nud().state != ArpEntryState::Free);
         
@@ -761,18 +1346,67 @@ private:
         // Set the entry to Free state.
         entry.nud().state = ArpEntryState::Free;
         
-        // Reset the send-retry list for the entry.
+        // Invalidate neighbor caches of flows which may refer to the entry.
+        // Zero is skipped since it means that a cache is empty.
+        m_arp_gen++;
+        if (m_arp_gen == 0) {
+            m_arp_gen = 1;
+        }
+        
+        // Reset the send-retry list for the entry and drop any pending packets.
         entry.retry_list.reset();
+        free_pending_packets(entry);
         
-        // Move from used list to free list, unless requested not to.
-        if (!leave_in_used_list) {
-            m_used_entries_list.remove({entry, *this}, *this);
-            m_free_entries_list.prepend({entry, *this}, *this);
+        // Remove from the index and move from the used list to the free list.
+        m_arp_index.removeEntry({entry, *this}, *this);
+        entries_list(entry).remove({entry, *this}, *this);
+        if (!entry.nud().weak) {
+            m_num_hard_entries--;
         }
+        AIPSTACK_ASSERT(m_num_used_entries > 0);
+        m_num_used_entries--;
+        m_free_entries_list.prepend({entry, *this}, *this);
+    }
+    
+    inline void capture_frame (EthCaptureDir dir, IpBufRef frame)
+    {
+        if constexpr (EnableCapture) {
+            if (AIPSTACK_UNLIKELY(m_capture_handler)) {
+                m_capture_handler(dir, frame);
+            }
+        } else {
+            (void)dir;
+            (void)frame;
+        }
+    }
+    
+    inline IpErr send_frame (IpBufRef frame)
+    {
+        m_driver_iface.traceLatency(IpLatencyStage::EthTx);
+        IpErr err = m_params.send_frame(frame);
+        if constexpr (EnableCapture) {
+            if (err == IpErr::Success) {
+                capture_frame(EthCaptureDir::Outbound, frame);
+            }
+        }
+        return err;
     }
     
     IpErr send_arp_packet (ArpOpType op_type, MacAddr dst_mac, Ip4Addr dst_ipaddr)
     {
+        // The source IP address is the interface address, if any.
+        IpIfaceIp4Addrs const *ifaddr = m_driver_iface.getIp4Addrs();
+        Ip4Addr src_addr = (ifaddr != nullptr) ? ifaddr->addr : Ip4Addr::ZeroAddr();
+        
+        return send_arp_packet(op_type, dst_mac, dst_ipaddr, src_addr);
+    }
+    
+    IpErr send_arp_packet (ArpOpType op_type, MacAddr dst_mac, Ip4Addr dst_ipaddr,
+                           Ip4Addr src_addr)
+    {
+        m_arp_stats.inc(op_type == ArpOpType::Request ?
+            &EthArpStats::requests_sent : &EthArpStats::replies_sent);
+        
         // Get a local buffer for the frame,
         TxAllocHelper<EthArpPktSize, HeaderBeforeEth> frame_alloc(EthArpPktSize);
         
@@ -782,10 +1416,6 @@ private:
         eth_header.set(EthHeader::SrcMac(),  *m_params.mac_addr);
         eth_header.set(EthHeader::EthType(), EthType::Arp);
         
-        // Determine the source IP address.
-        IpIfaceIp4Addrs const *ifaddr = m_driver_iface.getIp4Addrs();
-        Ip4Addr src_addr = (ifaddr != nullptr) ? ifaddr->addr : Ip4Addr::ZeroAddr();
-        
         // Write the ARP header.
         auto arp_header = ArpIp4Header::MakeRef(frame_alloc.getPtr() + EthHeader::Size);
         arp_header.set(ArpIp4Header::HwType(),       ArpHwType::Eth);
@@ -798,8 +1428,111 @@ private:
         arp_header.set(ArpIp4Header::DstHwAddr(),    dst_mac);
         arp_header.set(ArpIp4Header::DstProtoAddr(), dst_ipaddr);
         
-        // Send the frame via the lower-layer driver.
-        return m_params.send_frame(frame_alloc.getBufRef());
+        // Send the frame via the lower-layer driver and make sure that it will
+        // be transmitted if the driver holds back frames.
+        IpErr err = send_frame(frame_alloc.getBufRef());
+        m_driver_iface.requestTxFlush();
+        return err;
+    }
+    
+    // Construct the next ARP entry in state Free and insert it to the free list.
+    void new_arp_entry ()
+    {
+        ArpEntry &e = m_arp_entries.constructNext();
+        
+        // Prepare the Ethernet header except for the destination MAC address.
+        init_ip4_eth_header(e.eth_header, MacAddr::ZeroAddr());
+        
+        // State Free, timer not active.
+        e.nud().state = ArpEntryState::Free;
+        e.nud().weak = false; // irrelevant, for efficiency
+        e.nud().timer_active = false;
+        e.nud().attempts_left = 0; // irrelevant, for efficiency
+        
+        // Insert to free list.
+        m_free_entries_list.append({e, *this}, *this);
+    }
+    
+    // Copy a packet being sent to an entry in Query state to a pending packet,
+    // returning whether this was done.
+    bool queue_pending_packet (ArpEntry &entry, IpBufRef pkt)
+    {
+        if constexpr (NumArpPendingPackets == 0) {
+            return false;
+        } else {
+            if (pkt.tot_len > ArpPendingPacketSize) {
+                return false;
+            }
+            
+            // If there is no free pending packet, construct a new one if not all
+            // have been constructed yet.
+            if (m_free_pending_list.isEmpty()) {
+                if (m_pending_packets.allConstructed()) {
+                    return false;
+                }
+                m_free_pending_list.append(m_pending_packets.constructNext());
+            }
+            
+            // A super-segment cannot be kept since its segmentation depends on
+            // the send operation in progress.
+            IpTxTsoInfo tso_info;
+            if (m_driver_iface.getTxTso(pkt, tso_info)) {
+                return false;
+            }
+            
+            PendingPacket &pending = *m_free_pending_list.first();
+            m_free_pending_list.removeFirst();
+            
+            pending.len = pkt.tot_len;
+            ipBufTakeBytes(pkt, pkt.tot_len,
+                           pending.frame_buf + HeaderBeforeEth + EthHeader::Size);
+            
+            entry.pending_list.append(pending);
+            return true;
+        }
+    }
+    
+    // Send the pending packets of an entry which has just become Valid.
+    void send_pending_packets (ArpEntry &entry)
+    {
+        if constexpr (NumArpPendingPackets > 0) {
+            if (entry.pending_list.isEmpty()) {
+                return;
+            }
+            
+            do {
+                PendingPacket &pending = *entry.pending_list.first();
+                entry.pending_list.removeFirst();
+                
+                std::memcpy(pending.frame_buf + HeaderBeforeEth, entry.eth_header,
+                            EthHeader::Size);
+                
+                IpBufNode node{pending.frame_buf,
+                               HeaderBeforeEth + EthHeader::Size + pending.len, nullptr};
+                IpBufRef frame{&node, HeaderBeforeEth, EthHeader::Size + pending.len};
+                
+                // The driver copies the frame if it holds it back, so the pending
+                // packet can be freed right away. Errors are ignored since the
+                // packet was already reported as sent.
+                send_frame(frame);
+                
+                m_free_pending_list.prepend(pending);
+            } while (!entry.pending_list.isEmpty());
+            
+            m_driver_iface.requestTxFlush();
+        }
+    }
+    
+    // Drop the pending packets of an entry.
+    void free_pending_packets (ArpEntry &entry)
+    {
+        if constexpr (NumArpPendingPackets > 0) {
+            while (!entry.pending_list.isEmpty()) {
+                PendingPacket &pending = *entry.pending_list.first();
+                entry.pending_list.removeFirst();
+                m_free_pending_list.prepend(pending);
+            }
+        }
     }
     
     // Set tne ARP entry timeout based on the entry state and attempts_left.
@@ -824,7 +1557,7 @@ private:
         }
         
         // Get the current time.
-        TimeType now = platform().getTime();
+        TimeType now = platform().getEventTime();
         
         // Update the reference time of the timer queue (needed before insert).
         m_timer_queue.updateReferenceTime(now, *this);
@@ -865,7 +1598,7 @@ private:
     void timerHandler ()
     {
         // Prepare timer queue for removing expired timers.
-        m_timer_queue.prepareForRemovingExpired(platform().getTime(), *this);
+        m_timer_queue.prepareForRemovingExpired(platform().getEventTime(), *this);
         
         // Dispatch expired timers...
         ArpEntryRef timer_ref;
@@ -898,7 +1631,7 @@ private:
             (entry.ip_addr & ifaddr->netmask) != ifaddr->netaddr ||
             entry.ip_addr == ifaddr->bcastaddr)
         {
-            reset_arp_entry(entry, false);
+            reset_arp_entry(entry);
             return;
         }
         
@@ -910,7 +1643,7 @@ private:
                 
                 entry.nud().attempts_left--;
                 if (entry.nud().attempts_left == 0) {
-                    reset_arp_entry(entry, false);
+                    reset_arp_entry(entry);
                 } else {
                     set_entry_timer(entry);
                     send_arp_packet(
@@ -934,6 +1667,7 @@ private:
                 
                 entry.nud().attempts_left--;
                 if (entry.nud().attempts_left == 0) {
+                    m_arp_refresh_failures++;
                     entry.nud().state = ArpEntryState::Query;
                     entry.nud().attempts_left = ArpQueryAttempts;
                     send_arp_packet(
@@ -950,19 +1684,36 @@ private:
     }
     
 private:
+    // Placeholder for m_capture_handler if capture is disabled.
+    struct NoCaptureHandler {};
+    
     EthIfaceDriverParams m_params;
     IpDriverIface<StackArg> m_driver_iface;
     typename Platform::Timer m_timer;
     EthArpObservable m_arp_observable;
-    StructureRaiiWrapper<ArpEntryList> m_used_entries_list;
+    StructureRaiiWrapper<typename ArpIndex::Index> m_arp_index;
+    StructureRaiiWrapper<ArpEntryList> m_hard_entries_list;
+    StructureRaiiWrapper<ArpEntryList> m_weak_entries_list;
     StructureRaiiWrapper<ArpEntryList> m_free_entries_list;
+    StructureRaiiWrapper<PendingPacketList> m_free_pending_list;
     StructureRaiiWrapper<ArpEntryTimerQueue> m_timer_queue;
     TimeType m_timers_ref_time;
+    std::uint32_t m_arp_gen;
+    int m_num_hard_entries;
+    std::size_t m_num_used_entries;
+    IpMemoryPeak<IpStack<StackArg>::StatsEnabled> m_peak_used_entries;
+    std::uint32_t m_arp_refreshes;
+    std::uint32_t m_arp_refresh_failures;
+    IpStatsCounters<IpStack<StackArg>::StatsEnabled, EthArpStats> m_arp_stats;
     EthHeader::Ref m_rx_eth_header;
-    ArpEntry m_arp_entries[NumArpEntries];
+    char m_bcast_eth_header[EthHeader::Size];
+    char m_mcast_eth_header[EthHeader::Size];
+    std::conditional_t<EnableCapture, CaptureHandler, NoCaptureHandler> m_capture_handler;
+    LazyResourceArray<ArpEntry, NumArpEntries> m_arp_entries;
+    LazyResourceArray<PendingPacket, MaxValue(1, NumArpPendingPackets)> m_pending_packets;
     
     struct ArpEntriesAccessor :
-        public MemberAccessor<EthIpIface, ArpEntry[NumArpEntries],
+        public MemberAccessor<EthIpIface, LazyResourceArray<ArpEntry, NumArpEntries>,
                               &EthIpIface::m_arp_entries> {};
 };
 
@@ -1004,9 +1755,51 @@ struct EthIpIfaceOptions {
      * Data structure to use for ARP entry timers.
      * 
      * This should be one of the implementations in the folder aipstack/structure/minimum.
-     * Specifically supported are @ref LinkedHeapService and @ref SortedListService.
+     * Specifically supported are @ref LinkedHeapService, @ref SortedListService and
+     * @ref ArrayHeapService (with `MaxEntries_` at least @ref NumArpEntries).
+     * Alternatively @ref TimerWheelService (aipstack/structure/TimerWheel.h) or
+     * @ref HierarchicalTimerWheelService (aipstack/structure/HierarchicalTimerWheel.h)
+     * may be given, in which case a timing wheel is used instead of a timer queue.
      */
     AIPSTACK_OPTION_DECL_TYPE(TimersStructureService, void)
+    
+    /**
+     * Data structure service for indexing ARP cache entries by IP address.
+     * 
+     * This should be one of the implementations in the folder
+     * aipstack/structure/index. Specifically supported are @ref AvlTreeIndexService,
+     * @ref MruListIndexService and @ref HashTableIndexService. For large ARP caches
+     * the hash table should be given enough buckets.
+     */
+    AIPSTACK_OPTION_DECL_TYPE(ArpIndexService, HashTableIndexService<16>)
+    
+    /**
+     * Number of buffers for IP packets waiting for address resolution.
+     * 
+     * When an IP packet is sent to an address which is being resolved, it is
+     * copied to a free buffer if there is one and is sent as soon as the ARP
+     * reply arrives, instead of the send failing with
+     * @ref IpErr::ArpQueryInProgress. The buffers are shared by all ARP
+     * entries. Packets are dropped if resolution fails. If this is zero, no
+     * packets are kept.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(NumArpPendingPackets, int, 0)
+    
+    /**
+     * Maximum size of an IP packet which can wait for address resolution
+     * (see @ref NumArpPendingPackets).
+     * 
+     * Larger packets fail to send as if there were no free buffer.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(ArpPendingPacketSize, std::size_t, 1500)
+    
+    /**
+     * Enable packet capture support (see @ref EthIpIface::setCaptureHandler).
+     * 
+     * If enabled, each received and sent frame costs one check whether a
+     * capture callback is set. If disabled, there is no cost.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(EnableCapture, bool, false)
 };
 
 /**
@@ -1036,6 +1829,10 @@ class EthIpIfaceService {
     AIPSTACK_OPTION_CONFIG_VALUE(EthIpIfaceOptions, ArpProtectCount)
     AIPSTACK_OPTION_CONFIG_VALUE(EthIpIfaceOptions, HeaderBeforeEth)
     AIPSTACK_OPTION_CONFIG_TYPE(EthIpIfaceOptions, TimersStructureService)
+    AIPSTACK_OPTION_CONFIG_TYPE(EthIpIfaceOptions, ArpIndexService)
+    AIPSTACK_OPTION_CONFIG_VALUE(EthIpIfaceOptions, NumArpPendingPackets)
+    AIPSTACK_OPTION_CONFIG_VALUE(EthIpIfaceOptions, ArpPendingPacketSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(EthIpIfaceOptions, EnableCapture)
     
 public:
     /**
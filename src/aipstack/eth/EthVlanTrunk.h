@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_ETH_VLAN_TRUNK_H
+#define AIPSTACK_ETH_VLAN_TRUNK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/RxBufPool.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/eth/MacAddr.h>
+#include <aipstack/ip/IpStackTypes.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup eth
+ * @{
+ */
+
+/**
+ * Encapsulates parameters passed to the @ref EthVlanTrunk constructor.
+ */
+struct EthVlanTrunkParams {
+    /**
+     * Driver function used to send a frame of one of the VLANs.
+     * 
+     * If @ref tx_tag_offload is false, the frame already contains the 802.1Q
+     * tag (unless the VID is 0) and the `vid` argument is only informational.
+     * If @ref tx_tag_offload is true, the frame is untagged and the driver must
+     * insert a tag with the given VID (unless it is 0).
+     * 
+     * This is called within @ref EthVlanTrunk::Vlan::sendFrame, see
+     * @ref EthIfaceDriverParams::send_frame for the requirements.
+     */
+    Function<IpErr(IpBufRef frame, std::uint16_t vid)> send_frame = nullptr;
+    
+    /**
+     * Whether the driver inserts 802.1Q tags into sent frames.
+     * 
+     * If false, tags are inserted by moving the MAC addresses 4 bytes into the
+     * header space before the frame. The @ref EthIpIface of each VLAN then needs
+     * @ref EthIpIfaceOptions::HeaderBeforeEth of at least 4 and the
+     * @ref IpStack needs @ref IpStackOptions::HeaderBeforeIp of at least 18.
+     */
+    bool tx_tag_offload = false;
+};
+
+/**
+ * Demultiplexes Ethernet frames of a single driver to interfaces for 802.1Q
+ * VLANs.
+ * 
+ * An @ref EthVlanTrunk is owned by the driver of a physical interface. For each
+ * VLAN, a @ref Vlan object is registered with the trunk and an @ref EthIpIface
+ * is constructed whose @ref EthIfaceDriverParams::send_frame calls
+ * @ref Vlan::sendFrame, while the receive handler of the @ref Vlan calls
+ * @ref EthIpIface::recvFrame. The driver passes all received frames to
+ * @ref recvFrame (or @ref recvStrippedFrame), which finds the VLAN by its VID
+ * using a hash table with NumBuckets buckets and removes the tag.
+ * 
+ * A @ref Vlan with VID 0 receives untagged and priority-tagged frames and
+ * sends untagged frames. Frames of unknown VLANs are dropped.
+ * 
+ * When tags are inserted in software, the MTU of each @ref EthIpIface should be
+ * 4 bytes less than that of the driver. Checksum and segmentation offload
+ * information obtained from an @ref EthIpIface (@ref EthIpIface::getTxChksumPartial
+ * and @ref EthIpIface::getTxTso) refers to the untagged frame.
+ * 
+ * @tparam NumBuckets Number of buckets of the VID hash table (must be \>0).
+ */
+template<std::size_t NumBuckets = 16>
+class EthVlanTrunk :
+    private NonCopyable<EthVlanTrunk<NumBuckets>>
+{
+    static_assert(NumBuckets > 0);
+    
+    inline static constexpr std::size_t MacAddrsSize = 2 * MacAddr::Size;
+    
+public:
+    class Vlan;
+    
+private:
+    using VlanLinkModel = PointerLinkModel<Vlan>;
+    
+public:
+    /**
+     * A VLAN registered with an @ref EthVlanTrunk.
+     */
+    class Vlan :
+        private NonCopyable<Vlan>
+    {
+        friend EthVlanTrunk;
+        
+    public:
+        /**
+         * Type of callback used to pass received frames of the VLAN, with the
+         * same arguments as @ref EthIpIface::recvFrame.
+         * 
+         * The frame has the tag removed.
+         */
+        using RecvHandler = Function<void(
+            IpBufRef frame, IpChksumOffloadFlags chksum_verified, IpRxBuf *rx_buf)>;
+        
+        /**
+         * Construct the VLAN and register it with the trunk.
+         * 
+         * @param trunk The trunk, which must outlive the VLAN.
+         * @param vid VLAN identifier, in the range [0, 4094]. Only one VLAN
+         *        with the same VID may be registered with a trunk.
+         */
+        Vlan (EthVlanTrunk &trunk, std::uint16_t vid) :
+            m_trunk(trunk),
+            m_recv_handler(nullptr),
+            m_vid(vid)
+        {
+            AIPSTACK_ASSERT(vid < EthVlanVidMask);
+            AIPSTACK_ASSERT(m_trunk.findVlan(vid) == nullptr);
+            
+            m_trunk.bucket(vid).prepend(*this);
+        }
+        
+        /**
+         * Unregister and destruct the VLAN.
+         */
+        ~Vlan ()
+        {
+            m_trunk.bucket(m_vid).remove(*this);
+        }
+        
+        /**
+         * Return the VLAN identifier.
+         * 
+         * @return The VID.
+         */
+        inline std::uint16_t getVid () const
+        {
+            return m_vid;
+        }
+        
+        /**
+         * Set the handler for received frames.
+         * 
+         * Frames received while the handler is null are dropped.
+         * 
+         * @param handler Receive handler (may be null).
+         */
+        inline void setRecvHandler (RecvHandler handler)
+        {
+            m_recv_handler = handler;
+        }
+        
+        /**
+         * Send a frame to the VLAN, intended to be used as
+         * @ref EthIfaceDriverParams::send_frame of the @ref EthIpIface.
+         * 
+         * @param frame Frame starting with the Ethernet header.
+         * @return Success or error code; @ref IpErr::NoHeaderSpace if the tag
+         *         needs to be inserted but there is no header space.
+         */
+        IpErr sendFrame (IpBufRef frame)
+        {
+            if (m_vid != 0 && !m_trunk.m_params.tx_tag_offload) {
+                if (AIPSTACK_UNLIKELY(frame.offset < EthVlanTag::Size ||
+                                      !frame.hasHeader(MacAddrsSize)))
+                {
+                    return IpErr::NoHeaderSpace;
+                }
+                
+                // Move the MAC addresses back and write the tag after them.
+                frame = frame.revealHeader(EthVlanTag::Size);
+                char *header = frame.getChunkPtr();
+                std::memmove(header, header + EthVlanTag::Size, MacAddrsSize);
+                
+                auto tag = EthVlanTag::MakeRef(header + MacAddrsSize);
+                tag.set(EthVlanTag::Tpid(), EthType::Vlan);
+                tag.set(EthVlanTag::Tci(), m_vid);
+            }
+            
+            return m_trunk.m_params.send_frame(frame, m_vid);
+        }
+        
+    private:
+        LinkedListNode<VlanLinkModel> m_list_node;
+        EthVlanTrunk &m_trunk;
+        RecvHandler m_recv_handler;
+        std::uint16_t m_vid;
+    };
+    
+    /**
+     * Construct the trunk.
+     * 
+     * @param params Parameters, @ref EthVlanTrunkParams::send_frame must not
+     *        be null.
+     */
+    EthVlanTrunk (EthVlanTrunkParams const &params) :
+        m_params(params)
+    {
+        AIPSTACK_ASSERT(params.send_frame);
+    }
+    
+    /**
+     * Destruct the trunk, all VLANs must have been destructed.
+     */
+    ~EthVlanTrunk ()
+    {
+        for ([[maybe_unused]] auto &list : m_buckets) {
+            AIPSTACK_ASSERT(list.isEmpty());
+        }
+    }
+    
+    /**
+     * Process a received frame, which may contain an 802.1Q tag.
+     * 
+     * The tag is removed by moving the MAC addresses forward in the buffer,
+     * so unlike @ref EthIpIface::recvFrame this writes to the buffer.
+     * 
+     * @param frame Received frame starting with the Ethernet header.
+     * @param chksum_verified Passed to the receive handler of the VLAN.
+     * @param rx_buf Passed to the receive handler of the VLAN.
+     */
+    void recvFrame (IpBufRef frame,
+                    IpChksumOffloadFlags chksum_verified = IpChksumOffloadFlags(),
+                    IpRxBuf *rx_buf = nullptr)
+    {
+        if (AIPSTACK_UNLIKELY(!frame.hasHeader(EthHeader::Size))) {
+            return;
+        }
+        
+        char *header = frame.getChunkPtr();
+        auto tag = EthVlanTag::MakeRef(header + MacAddrsSize);
+        
+        std::uint16_t vid = 0;
+        if (tag.get(EthVlanTag::Tpid()) == EthType::Vlan) {
+            if (AIPSTACK_UNLIKELY(!frame.hasHeader(EthHeader::Size + EthVlanTag::Size))) {
+                return;
+            }
+            vid = tag.get(EthVlanTag::Tci()) & EthVlanVidMask;
+            
+            // Remove the tag by moving the MAC addresses forward.
+            std::memmove(header + EthVlanTag::Size, header, MacAddrsSize);
+            frame = frame.hideHeader(EthVlanTag::Size);
+        }
+        
+        dispatch(vid, frame, chksum_verified, rx_buf);
+    }
+    
+    /**
+     * Process a received frame whose tag has been removed by the driver.
+     * 
+     * @param frame Received untagged frame starting with the Ethernet header.
+     * @param vid The VID from the removed tag, 0 if the frame had no tag.
+     * @param chksum_verified Passed to the receive handler of the VLAN.
+     * @param rx_buf Passed to the receive handler of the VLAN.
+     */
+    inline void recvStrippedFrame (IpBufRef frame, std::uint16_t vid,
+                    IpChksumOffloadFlags chksum_verified = IpChksumOffloadFlags(),
+                    IpRxBuf *rx_buf = nullptr)
+    {
+        dispatch(vid & EthVlanVidMask, frame, chksum_verified, rx_buf);
+    }
+    
+    /**
+     * Find a registered VLAN.
+     * 
+     * @param vid The VID.
+     * @return The VLAN or null if none is registered with this VID.
+     */
+    Vlan * findVlan (std::uint16_t vid)
+    {
+        auto &list = bucket(vid);
+        for (Vlan *vlan = list.first(); vlan != nullptr; vlan = list.next(*vlan)) {
+            if (vlan->m_vid == vid) {
+                return vlan;
+            }
+        }
+        return nullptr;
+    }
+    
+private:
+    struct VlanListNodeAccessor :
+        public MemberAccessor<Vlan, LinkedListNode<VlanLinkModel>, &Vlan::m_list_node> {};
+    
+    using VlanList = LinkedList<VlanListNodeAccessor, VlanLinkModel, false>;
+    
+    inline VlanList & bucket (std::uint16_t vid)
+    {
+        return m_buckets[vid % NumBuckets];
+    }
+    
+    void dispatch (std::uint16_t vid, IpBufRef frame,
+                   IpChksumOffloadFlags chksum_verified, IpRxBuf *rx_buf)
+    {
+        Vlan *vlan = findVlan(vid);
+        if (AIPSTACK_LIKELY(vlan != nullptr && vlan->m_recv_handler)) {
+            vlan->m_recv_handler(frame, chksum_verified, rx_buf);
+        }
+    }
+    
+private:
+    EthVlanTrunkParams m_params;
+    StructureRaiiWrapper<VlanList> m_buckets[NumBuckets];
+};
+
+/** @} */
+
+}
+
+#endif
@@ -22,8 +22,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstddef>
 #include <cstdint>
-#include <mutex>
+#include <atomic>
+#include <chrono>
 
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/OneOf.h>
@@ -33,7 +35,7 @@
 #include <aipstack/structure/Accessor.h>
 #include <aipstack/event_loop/EventLoop.h>
 
-#if AIPSTACK_EVENT_LOOP_HAS_IOCP
+#if AIPSTACK_EVENT_LOOP_HAS_IOCP || AIPSTACK_EVENT_LOOP_HAS_URING
 #include <cstdio>
 #include <utility>
 #include <memory>
@@ -42,6 +44,13 @@
 
 namespace AIpStack {
 
+#if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+
+struct EventLoopPriv::TimerListNodeAccessor :
+    public MemberAccessor<EventLoopTimer, TimerListNode, &EventLoopTimer::m_list_node> {};
+
+#else
+
 struct EventLoopPriv::TimerHeapNodeAccessor :
     public MemberAccessor<EventLoopTimer, TimerHeapNode, &EventLoopTimer::m_heap_node> {};
 
@@ -82,15 +91,34 @@ struct EventLoopPriv::TimerCompare {
     }
 };
 
+#endif
+
 struct EventLoopPriv::AsyncSignalNodeAccessor : public MemberAccessor<
     AsyncSignalNode, AsyncSignalListNode, &AsyncSignalNode::m_list_node> {};
 
+struct EventLoopPriv::BusyPollerListNodeAccessor : public MemberAccessor<
+    EventLoopBusyPoller, BusyPollerListNode, &EventLoopBusyPoller::m_list_node> {};
+
+struct EventLoopPriv::DeferredListNodeAccessor : public MemberAccessor<
+    EventLoopDeferred, DeferredListNode, &EventLoopDeferred::m_list_node> {};
+
 EventLoopMembers::EventLoopMembers() :
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    m_timer_wheel_epoch(EventLoop::getTime()),
+    m_timer_wheel_tick(0),
+    m_timer_resolution(std::chrono::milliseconds(1)),
+    #endif
+    m_timer_slack(EventLoopDuration::zero()),
     m_stop(false),
     m_recheck_async_signals(false),
     m_event_time(EventLoop::getTime()),
+    m_async_queue_head(nullptr),
+    m_async_wakeup_pending(false),
+    m_busy_poll_budget(EventLoopDuration::zero()),
     m_num_timers(0),
-    m_num_async_signals(0)
+    m_num_async_signals(0),
+    m_num_busy_pollers(0),
+    m_num_deferreds(0)
     #if AIPSTACK_EVENT_LOOP_HAS_FD
     ,m_num_fd_notifiers(0)
     #endif
@@ -98,8 +126,20 @@ EventLoopMembers::EventLoopMembers() :
     ,m_num_iocp_notifiers(0)
     ,m_num_iocp_resources(0)
     #endif
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    ,m_num_uring_notifiers(0)
+    ,m_num_uring_resources(0)
+    #endif
 {
-    EventLoop::AsyncSignalList::initLonely(m_pending_async_list);
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    for (EventLoopPriv::TimerList &list : m_timer_wheel) {
+        list.init();
+    }
+    for (std::uint64_t &bits : m_timer_wheel_bits) {
+        bits = 0;
+    }
+    #endif
+
     EventLoop::AsyncSignalList::initLonely(m_dispatch_async_list);    
 }
 
@@ -111,16 +151,28 @@ EventLoop::EventLoop () :
 EventLoop::~EventLoop ()
 {
     AIPSTACK_ASSERT(m_num_timers == 0);
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    AIPSTACK_ASSERT(timer_wheel_is_empty());
+    #else
     AIPSTACK_ASSERT(m_timer_heap.isEmpty());
+    #endif
     AIPSTACK_ASSERT(m_num_async_signals == 0);
-    AIPSTACK_ASSERT(AsyncSignalList::isLonely(m_pending_async_list));
+    AIPSTACK_ASSERT(m_async_queue_head.load(std::memory_order_relaxed) == nullptr);
     AIPSTACK_ASSERT(AsyncSignalList::isLonely(m_dispatch_async_list));
+    AIPSTACK_ASSERT(m_num_busy_pollers == 0);
+    AIPSTACK_ASSERT(m_busy_poller_list.isEmpty());
+    AIPSTACK_ASSERT(m_num_deferreds == 0);
+    AIPSTACK_ASSERT(m_deferred_list.isEmpty());
+    AIPSTACK_ASSERT(m_deferred_dispatch_list.isEmpty());
     #if AIPSTACK_EVENT_LOOP_HAS_FD
     AIPSTACK_ASSERT(m_num_fd_notifiers == 0);
     #endif
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP
     AIPSTACK_ASSERT(m_num_iocp_notifiers == 0);
     #endif
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    AIPSTACK_ASSERT(m_num_uring_notifiers == 0);
+    #endif
     
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP
     try {
@@ -131,6 +183,16 @@ EventLoop::~EventLoop ()
             "(memory leaked): %s\n", ex.what());
     }
     #endif
+
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    try {
+        wait_for_final_uring_results();
+    } catch (std::runtime_error const &ex) {
+        // Should not happen. Here we leak UringResource's including user_resource's.
+        std::fprintf(stderr, "EventLoop: exception in wait_for_final_uring_results "
+            "(memory leaked): %s\n", ex.what());
+    }
+    #endif
 }
 
 void EventLoop::stop ()
@@ -147,6 +209,10 @@ void EventLoop::run ()
     while (true) {
         m_event_time = getTime();
 
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        m_instrumentation.num_iterations++;
+        #endif
+
         prepare_timers_for_dispatch(m_event_time);
 
         if (!dispatch_timers()) {
@@ -163,12 +229,290 @@ void EventLoop::run ()
             return;
         }
 
+        if (!dispatch_deferreds()) {
+            return;
+        }
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        m_instrumentation.iteration_time.record(getTime() - m_event_time);
+        #endif
+
+        if (AIPSTACK_UNLIKELY(!m_deferred_list.isEmpty())) {
+            // Calls were scheduled by deferred handlers. Check for new events but do
+            // not block, then continue with the next iteration which makes the calls.
+            EventProvider::pollForEvents();
+            continue;
+        }
+
         EventLoopTime wait_time = get_timers_wait_time();
 
+        if (m_busy_poll_budget > EventLoopDuration::zero()) {
+            if (busy_poll(wait_time)) {
+                if (AIPSTACK_UNLIKELY(m_stop)) {
+                    return;
+                }
+                continue;
+            }
+        }
+
+        m_busy_poll_stats.num_blocking_waits++;
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        EventLoopTime wait_start_time = getTime();
+        #endif
+
         EventProvider::waitForEvents(wait_time);
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        m_instrumentation.wait_time.record(getTime() - wait_start_time);
+        #endif
     }
 }
 
+void EventLoop::setBusyPollBudget (EventLoopDuration budget)
+{
+    m_busy_poll_budget = MaxValue(EventLoopDuration::zero(), budget);
+}
+
+#if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+
+void EventLoop::resetInstrumentation ()
+{
+    m_instrumentation = EventLoopInstrumentation();
+}
+
+void EventLoop::record_handler_time (EventLoopHandlerType type, EventLoopTime start_time)
+{
+    m_instrumentation.handler_time[std::size_t(type)].record(getTime() - start_time);
+}
+
+#endif
+
+#if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+
+void EventLoop::setTimerResolution (EventLoopDuration resolution)
+{
+    AIPSTACK_ASSERT(resolution > EventLoopDuration::zero());
+    AIPSTACK_ASSERT(timer_wheel_is_empty());
+
+    m_timer_resolution = resolution;
+    m_timer_wheel_epoch = m_event_time;
+    m_timer_wheel_tick = 0;
+}
+
+void EventLoop::prepare_timers_for_dispatch (EventLoopTime now)
+{
+    // Process the wheel up to the tick of 'now', which moves all timers that are
+    // expired with respect to 'now' to the due list.
+    if (now > m_timer_wheel_epoch) {
+        auto now_tick = std::uint64_t((now - m_timer_wheel_epoch) / m_timer_resolution);
+        if (now_tick > m_timer_wheel_tick) {
+            timer_wheel_advance(now_tick);
+        }
+    }
+
+    // Change the state of all due timers to Dispatch. Timers which become due later
+    // (by being set to an expired time) are only dispatched in the next round, as
+    // with the heap.
+    while (EventLoopTimer *tim = m_timer_due_list.first()) {
+        AIPSTACK_ASSERT(tim->m_state == TimerState::Pending);
+
+        m_timer_due_list.removeFirst();
+        tim->m_state = TimerState::Dispatch;
+        tim->m_wheel_list = EventLoopPriv::TimerWheelDispatchList;
+        m_timer_dispatch_list.append(*tim);
+    }
+}
+
+bool EventLoop::dispatch_timers ()
+{
+    while (EventLoopTimer *tim = m_timer_dispatch_list.first()) {
+        AIPSTACK_ASSERT(tim->m_state == TimerState::Dispatch);
+
+        m_timer_dispatch_list.removeFirst();
+        tim->m_state = TimerState::Idle;
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        EventLoopTime start_time = getTime();
+        m_instrumentation.timer_lateness.record(start_time - tim->m_time);
+        #endif
+
+        tim->m_handler();
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        record_handler_time(EventLoopHandlerType::Timer, start_time);
+        #endif
+
+        if (AIPSTACK_UNLIKELY(m_stop)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+EventLoopTime EventLoop::get_timers_wait_time () const
+{
+    AIPSTACK_ASSERT(m_timer_dispatch_list.isEmpty());
+
+    // Due timers need to be dispatched right away.
+    if (!m_timer_due_list.isEmpty()) {
+        return m_event_time;
+    }
+
+    // Otherwise wait until the start of the first non-empty slot. If that is not in
+    // the lowest level, its timers will just be moved to lower levels then.
+    std::size_t index;
+    std::uint64_t tick;
+    if (!timer_wheel_next_slot(index, tick)) {
+        return EventLoopTime::max();
+    }
+
+    auto resolution = std::uint64_t(m_timer_resolution.count());
+    auto max_ticks = std::uint64_t(
+        (EventLoopTime::max() - m_timer_wheel_epoch).count()) / resolution;
+    if (tick > max_ticks) {
+        return EventLoopTime::max();
+    }
+
+    return apply_timer_slack(
+        m_timer_wheel_epoch + EventLoopDuration::rep(tick) * m_timer_resolution);
+}
+
+bool EventLoop::timer_wheel_is_empty () const
+{
+    for (std::uint64_t bits : m_timer_wheel_bits) {
+        if (bits != 0) {
+            return false;
+        }
+    }
+    return m_timer_due_list.isEmpty() && m_timer_dispatch_list.isEmpty();
+}
+
+std::uint64_t EventLoop::timer_wheel_tick_for_time (EventLoopTime time) const
+{
+    if (time <= m_timer_wheel_epoch) {
+        return 0;
+    }
+
+    // Round up so that a timer is not found expired before its time.
+    EventLoopDuration offset = time - m_timer_wheel_epoch;
+    auto tick = std::uint64_t(offset / m_timer_resolution);
+    if (offset % m_timer_resolution != EventLoopDuration::zero()) {
+        tick++;
+    }
+    return tick;
+}
+
+void EventLoop::timer_wheel_insert (EventLoopTimer &tim)
+{
+    using Priv = EventLoopPriv;
+
+    std::uint64_t tick = timer_wheel_tick_for_time(tim.m_time);
+
+    if (tick <= m_timer_wheel_tick) {
+        m_timer_due_list.append(tim);
+        tim.m_wheel_list = Priv::TimerWheelDueList;
+        return;
+    }
+
+    // The level is determined by the most significant bit in which the tick differs
+    // from the current tick, in which the tick has a one and the current tick a zero.
+    // Hence the slot is after that of the current tick in that level.
+    std::uint64_t diff = tick ^ m_timer_wheel_tick;
+    int level = (63 - __builtin_clzll(diff)) / Priv::TimerWheelSlotBits;
+    std::size_t slot = std::size_t(tick >> (level * Priv::TimerWheelSlotBits)) &
+        (Priv::TimerWheelSlots - 1);
+    std::size_t index = std::size_t(level) * Priv::TimerWheelSlots + slot;
+
+    m_timer_wheel[index].prepend(tim);
+    m_timer_wheel_bits[level] |= std::uint64_t(1) << slot;
+    tim.m_wheel_list = std::uint16_t(index);
+}
+
+void EventLoop::timer_wheel_remove (EventLoopTimer &tim)
+{
+    using Priv = EventLoopPriv;
+
+    if (tim.m_wheel_list == Priv::TimerWheelDueList) {
+        m_timer_due_list.remove(tim);
+    }
+    else if (tim.m_wheel_list == Priv::TimerWheelDispatchList) {
+        m_timer_dispatch_list.remove(tim);
+    }
+    else {
+        std::size_t index = tim.m_wheel_list;
+        AIPSTACK_ASSERT(index < Priv::TimerWheelNumLists);
+
+        m_timer_wheel[index].remove(tim);
+        if (m_timer_wheel[index].isEmpty()) {
+            m_timer_wheel_bits[index / Priv::TimerWheelSlots] &=
+                ~(std::uint64_t(1) << (index % Priv::TimerWheelSlots));
+        }
+    }
+}
+
+bool EventLoop::timer_wheel_next_slot (
+    std::size_t &out_index, std::uint64_t &out_tick) const
+{
+    using Priv = EventLoopPriv;
+
+    std::uint64_t cur_tick = m_timer_wheel_tick;
+
+    // Slots in lower levels are before all slots in higher levels, so the first
+    // level with a non-empty slot contains the first slot.
+    for (int level = 0; level < Priv::TimerWheelLevels; level++) {
+        int shift = level * Priv::TimerWheelSlotBits;
+        std::size_t cur_slot =
+            std::size_t(cur_tick >> shift) & (Priv::TimerWheelSlots - 1);
+
+        // Only slots after that of the current tick can be non-empty. For the last
+        // slot, the shift results in zero and hence an empty mask.
+        std::uint64_t after_mask = ~((std::uint64_t(2) << cur_slot) - 1);
+        std::uint64_t bits = m_timer_wheel_bits[level] & after_mask;
+
+        if (bits != 0) {
+            std::size_t slot = std::size_t(__builtin_ctzll(bits));
+            int high_shift = shift + Priv::TimerWheelSlotBits;
+            std::uint64_t high_mask =
+                (high_shift >= 64) ? 0 : (~std::uint64_t(0) << high_shift);
+
+            out_index = std::size_t(level) * Priv::TimerWheelSlots + slot;
+            out_tick = (cur_tick & high_mask) | (std::uint64_t(slot) << shift);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void EventLoop::timer_wheel_advance (std::uint64_t target_tick)
+{
+    AIPSTACK_ASSERT(target_tick > m_timer_wheel_tick);
+
+    // Visit the non-empty slots whose range starts no later than the target tick in
+    // order. At the start of the range of a slot, its timers are redistributed to lower
+    // levels or the due list. Empty stretches of ticks are skipped over.
+    std::size_t index;
+    std::uint64_t tick;
+    while (timer_wheel_next_slot(index, tick) && tick <= target_tick) {
+        m_timer_wheel_tick = tick;
+
+        EventLoopPriv::TimerList &list = m_timer_wheel[index];
+        m_timer_wheel_bits[index / EventLoopPriv::TimerWheelSlots] &=
+            ~(std::uint64_t(1) << (index % EventLoopPriv::TimerWheelSlots));
+
+        while (EventLoopTimer *tim = list.first()) {
+            list.removeFirst();
+            timer_wheel_insert(*tim);
+        }
+    }
+
+    m_timer_wheel_tick = target_tick;
+}
+
+#else
+
 void EventLoop::prepare_timers_for_dispatch (EventLoopTime now)
 {
     bool changed = false;
@@ -207,8 +551,17 @@ bool EventLoop::dispatch_timers ()
         m_timer_heap.remove(*tim);
         tim->m_state = TimerState::Idle;
 
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        EventLoopTime start_time = getTime();
+        m_instrumentation.timer_lateness.record(start_time - tim->m_time);
+        #endif
+
         tim->m_handler();
 
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        record_handler_time(EventLoopHandlerType::Timer, start_time);
+        #endif
+
         if (AIPSTACK_UNLIKELY(m_stop)) {
             return false;
         }
@@ -224,7 +577,136 @@ EventLoopTime EventLoop::get_timers_wait_time () const
         return EventLoopTime::max();
     }
     AIPSTACK_ASSERT(tim->m_state == TimerState::Pending);
-    return tim->m_time;
+    return apply_timer_slack(tim->m_time);
+}
+
+#endif
+
+void EventLoop::setTimerSlack (EventLoopDuration slack)
+{
+    m_timer_slack = MaxValue(EventLoopDuration::zero(), slack);
+}
+
+EventLoopTime EventLoop::apply_timer_slack (EventLoopTime time) const
+{
+    if (m_timer_slack == EventLoopDuration::zero()) {
+        return time;
+    }
+
+    // Round up to a multiple of the slack, so that the wait time does not change
+    // while the first timer stays within the same slack window.
+    EventLoopDuration rem = time.time_since_epoch() % m_timer_slack;
+    if (rem == EventLoopDuration::zero()) {
+        return time;
+    }
+    EventLoopDuration up =
+        (rem > EventLoopDuration::zero()) ? (m_timer_slack - rem) : -rem;
+
+    if (time > EventLoopTime::max() - up) {
+        return time;
+    }
+    return time + up;
+}
+
+bool EventLoop::busy_poll (EventLoopTime wait_time)
+{
+    EventLoopTime start_time = getTime();
+
+    // Don't spin past the expiration of the earliest timer. The addition cannot
+    // overflow in practice since the budget is a small duration.
+    EventLoopTime end_time = (wait_time - start_time <= m_busy_poll_budget) ?
+        wait_time : (start_time + m_busy_poll_budget);
+
+    m_busy_poll_stats.num_spin_periods++;
+
+    bool found_work;
+    EventLoopTime now;
+
+    while (true) {
+        // Note that the events obtained by pollForEvents will be dispatched by
+        // dispatchEvents in the next iteration of run().
+        if (EventProvider::pollForEvents() || call_busy_pollers()) {
+            now = getTime();
+            found_work = true;
+            break;
+        }
+
+        now = getTime();
+        if (now >= end_time) {
+            found_work = now >= wait_time;
+            break;
+        }
+    }
+
+    m_busy_poll_stats.spin_time += now - start_time;
+    if (found_work) {
+        m_busy_poll_stats.num_spin_hits++;
+    }
+
+    return found_work;
+}
+
+bool EventLoop::call_busy_pollers ()
+{
+    for (EventLoopBusyPoller *poller = m_busy_poller_list.first(); poller != nullptr;) {
+        // Get the next poller first, the handler may only modify the list when it
+        // returns true, after which we do not continue.
+        EventLoopBusyPoller *next_poller = BusyPollerList::next(*poller);
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        EventLoopTime start_time = getTime();
+        #endif
+
+        if (poller->m_handler()) {
+            #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+            record_handler_time(EventLoopHandlerType::BusyPoller, start_time);
+            #endif
+
+            return true;
+        }
+
+        poller = next_poller;
+    }
+
+    return false;
+}
+
+bool EventLoop::dispatch_deferreds ()
+{
+    // Move the scheduled calls to the dispatch list, so that calls scheduled by the
+    // handlers below are made only in the next iteration. If an exception occurred
+    // during a previous dispatch, the remaining calls are still in the dispatch list
+    // and are made first.
+    while (EventLoopDeferred *def = m_deferred_list.first()) {
+        AIPSTACK_ASSERT(def->m_state == DeferredState::Pending);
+
+        m_deferred_list.removeFirst();
+        def->m_state = DeferredState::Dispatch;
+        m_deferred_dispatch_list.append(*def);
+    }
+
+    while (EventLoopDeferred *def = m_deferred_dispatch_list.first()) {
+        AIPSTACK_ASSERT(def->m_state == DeferredState::Dispatch);
+
+        m_deferred_dispatch_list.removeFirst();
+        def->m_state = DeferredState::Idle;
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        EventLoopTime start_time = getTime();
+        #endif
+
+        def->m_handler();
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        record_handler_time(EventLoopHandlerType::Deferred, start_time);
+        #endif
+
+        if (AIPSTACK_UNLIKELY(m_stop)) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 bool EventLoop::dispatch_async_signals ()
@@ -235,42 +717,47 @@ bool EventLoop::dispatch_async_signals ()
     // call this function before waitForEvents.
     m_recheck_async_signals = true;
 
-    {
-        std::unique_lock<std::mutex> lock(m_async_signal_mutex);
+    // Clear the wakeup flag before taking signals from the queue, so that any signal
+    // queued after that will result in another wakeup.
+    m_async_wakeup_pending.store(false, std::memory_order_seq_cst);
 
-        // Move any signals in the pending list to the end of the dispatch list.
-        if (!AsyncSignalList::isLonely(m_pending_async_list)) {
-            AsyncSignalList::moveOtherNodesBefore(
-                m_pending_async_list, m_dispatch_async_list);
+    collect_async_signals();
+
+    // Dispatch signals in the dispatch list.
+    while (true) {
+        // Get the next signal, if any (note the list is circular).
+        AsyncSignalNode *node = AsyncSignalList::next(m_dispatch_async_list);
+        if (node == &m_dispatch_async_list) {
+            break;
         }
 
-        // Dispatch signals in the dispatch list.
-        while (true) {
-            // Get the next signal, if any (note the list is circular).
-            AsyncSignalNode *node = AsyncSignalList::next(m_dispatch_async_list);
-            if (node == &m_dispatch_async_list) {
-                break;
-            }
+        EventLoopAsyncSignal &asig = *static_cast<EventLoopAsyncSignal *>(node);
+        AIPSTACK_ASSERT(&asig.m_loop == this);
+        AIPSTACK_ASSERT(!AsyncSignalList::isRemoved(asig));
 
-            EventLoopAsyncSignal &asig = *static_cast<EventLoopAsyncSignal *>(node);
-            AIPSTACK_ASSERT(&asig.m_loop == this);
-            AIPSTACK_ASSERT(!AsyncSignalList::isRemoved(asig));
+        // Remove the signal from the list.
+        AsyncSignalList::remove(asig);
+        AsyncSignalList::markRemoved(asig);
 
-            // Remove the signal from the list.
-            AsyncSignalList::remove(asig);
-            AsyncSignalList::markRemoved(asig);
+        // Clear the state, after which signal() may queue the signal again. The handler
+        // is only called if the signal is still pending (it was not reset).
+        std::uint8_t state = asig.m_async_state.exchange(0, std::memory_order_acq_rel);
+        AIPSTACK_ASSERT((state & AsyncStateQueued) != 0);
 
-            // Unlock the mutex while calling the handler.
-            lock.unlock();
+        if ((state & AsyncStatePending) != 0) {
+            #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+            EventLoopTime start_time = getTime();
+            #endif
 
             asig.m_handler();
 
+            #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+            record_handler_time(EventLoopHandlerType::AsyncSignal, start_time);
+            #endif
+
             if (AIPSTACK_UNLIKELY(m_stop)) {
                 return false;
             }
-
-            // Lock mutex again before looking at the dispatch list.
-            lock.lock();
         }
     }
 
@@ -280,6 +767,30 @@ bool EventLoop::dispatch_async_signals ()
     return true;
 }
 
+void EventLoop::collect_async_signals ()
+{
+    // Take all signals from the atomic queue. Signals are pushed to the front so
+    // the chain is in reverse order of queuing.
+    AsyncSignalNode *node = m_async_queue_head.exchange(nullptr, std::memory_order_seq_cst);
+    if (node == nullptr) {
+        return;
+    }
+
+    // Insert the signals at the end of the dispatch list, restoring the order of
+    // queuing. Each signal is inserted before the previously inserted one.
+    AsyncSignalNode *insert_before = &m_dispatch_async_list;
+    
+    do {
+        AsyncSignalNode *next_node = node->m_queue_next;
+
+        AIPSTACK_ASSERT(AsyncSignalList::isRemoved(*node));
+        AsyncSignalList::initBefore(*node, *insert_before);
+        insert_before = node;
+
+        node = next_node;
+    } while (node != nullptr);
+}
+
 bool EventProviderBase::dispatchAsyncSignals ()
 {
     auto &event_loop = static_cast<EventLoop &>(*this);
@@ -294,11 +805,22 @@ bool EventProviderBase::handleIocpResult (void *completion_key, OVERLAPPED *over
 }
 #endif
 
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+bool EventProviderBase::handleUringResult (void *uring_resource, std::int32_t res)
+{
+    auto &event_loop = static_cast<EventLoop &>(*this);
+    return event_loop.handle_uring_result(uring_resource, res);
+}
+#endif
+
 EventLoopTimer::EventLoopTimer (EventLoop &loop, TimerHandler handler) :
     m_loop(loop),
     m_handler(handler),
     m_time(EventLoopTime()),
     m_state(TimerState::Idle)
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    ,m_wheel_list(0)
+    #endif
 {
     m_loop.m_num_timers++;
 }
@@ -306,7 +828,11 @@ EventLoopTimer::EventLoopTimer (EventLoop &loop, TimerHandler handler) :
 EventLoopTimer::~EventLoopTimer ()
 {
     if (m_state != TimerState::Idle) {
+        #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+        m_loop.timer_wheel_remove(*this);
+        #else
         m_loop.m_timer_heap.remove(*this);
+        #endif
     }
 
     AIPSTACK_ASSERT(m_loop.m_num_timers > 0);
@@ -316,7 +842,11 @@ EventLoopTimer::~EventLoopTimer ()
 void EventLoopTimer::unset ()
 {
     if (m_state != TimerState::Idle) {
+        #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+        m_loop.timer_wheel_remove(*this);
+        #else
         m_loop.m_timer_heap.remove(*this);
+        #endif
         m_state = TimerState::Idle;
     }
 }
@@ -328,11 +858,18 @@ void EventLoopTimer::setAt (EventLoopTime time)
     TimerState old_state = m_state;
     m_state = TimerState::Pending;
 
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    if (old_state != TimerState::Idle) {
+        m_loop.timer_wheel_remove(*this);
+    }
+    m_loop.timer_wheel_insert(*this);
+    #else
     if (old_state == TimerState::Idle) {
         m_loop.m_timer_heap.insert(*this);
     } else {
         m_loop.m_timer_heap.fixup(*this);            
     }
+    #endif
 }
 
 void EventLoopTimer::setAfter (EventLoopDuration duration)
@@ -368,7 +905,8 @@ void EventLoopFdWatcher::initFd (int fd, EventLoopFdEvents events)
 {
     AIPSTACK_ASSERT(m_watched_fd == -1);
     AIPSTACK_ASSERT(fd >= 0);
-    AIPSTACK_ASSERT((events & ~EventLoopFdEvents::All) == Enum0);
+    AIPSTACK_ASSERT((events & ~(EventLoopFdEvents::All|EventLoopFdEvents::EdgeTriggered))
+                    == Enum0);
 
     EventProviderFd::initFdImpl(fd, events);
 
@@ -380,7 +918,8 @@ void EventLoopFdWatcher::initFd (int fd, EventLoopFdEvents events)
 void EventLoopFdWatcher::updateEvents (EventLoopFdEvents events)
 {
     AIPSTACK_ASSERT(m_watched_fd >= 0);
-    AIPSTACK_ASSERT((events & ~EventLoopFdEvents::All) == Enum0);
+    AIPSTACK_ASSERT((events & ~(EventLoopFdEvents::All|EventLoopFdEvents::EdgeTriggered))
+                    == Enum0);
 
     EventProviderFd::updateEventsImpl(events);
 
@@ -408,7 +947,8 @@ void EventProviderFdBase::sanityCheck () const
 {
     auto &fd_watcher = static_cast<EventLoopFdWatcher const &>(*this);
     AIPSTACK_ASSERT(fd_watcher.m_watched_fd >= 0);
-    AIPSTACK_ASSERT((fd_watcher.m_events & ~EventLoopFdEvents::All) == Enum0);    
+    AIPSTACK_ASSERT((fd_watcher.m_events &
+        ~(EventLoopFdEvents::All|EventLoopFdEvents::EdgeTriggered)) == Enum0);
 }
 
 int EventProviderFdBase::getFd () const
@@ -427,8 +967,18 @@ bool EventProviderFdBase::callFdEventHandler (EventLoopFdEvents events)
 {
     auto &fd_watcher = static_cast<EventLoopFdWatcher &>(*this);
 
+    #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+    // The handler may destruct the watcher, so get the loop reference first.
+    EventLoop &loop = fd_watcher.m_loop;
+    EventLoopTime start_time = EventLoop::getTime();
+    #endif
+
     fd_watcher.m_handler(events);
 
+    #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+    loop.record_handler_time(EventLoopHandlerType::Fd, start_time);
+    #endif
+
     if (AIPSTACK_UNLIKELY(fd_watcher.m_loop.m_stop)) {
         return false;
     }
@@ -444,6 +994,8 @@ EventLoopIocpNotifier::EventLoopIocpNotifier (EventLoop &loop, IocpEventHandler
     m_loop(loop),
     m_handler(handler),
     m_iocp_resource(nullptr),
+    m_sync_deferred(loop,
+        AIPSTACK_BIND_MEMBER(&EventLoopIocpNotifier::syncCompletionHandler, this)),
     m_busy(false)
 {
     m_loop.m_num_iocp_notifiers++;
@@ -474,7 +1026,9 @@ void EventLoopIocpNotifier::prepare ()
 void EventLoopIocpNotifier::reset ()
 {
     if (m_iocp_resource != nullptr) {
-        if (m_busy) {
+        // A synchronously completed operation has no completion packet coming,
+        // so the resource can be freed right away.
+        if (m_busy && !m_sync_deferred.isScheduled()) {
             m_iocp_resource->notifier = nullptr;
         } else {
             AIPSTACK_ASSERT(m_loop.m_num_iocp_resources > 0);
@@ -483,6 +1037,7 @@ void EventLoopIocpNotifier::reset ()
         }
 
         m_iocp_resource = nullptr;
+        m_sync_deferred.cancel();
         m_busy = false;
     }
 }
@@ -496,6 +1051,24 @@ void EventLoopIocpNotifier::ioStarted (std::shared_ptr<void> user_resource)
     m_busy = true;
 }
 
+void EventLoopIocpNotifier::ioCompletedSynchronously ()
+{
+    AIPSTACK_ASSERT(m_iocp_resource != nullptr);
+    AIPSTACK_ASSERT(!m_busy);
+
+    m_sync_deferred.schedule();
+    m_busy = true;
+}
+
+void EventLoopIocpNotifier::syncCompletionHandler ()
+{
+    AIPSTACK_ASSERT(m_busy);
+
+    m_busy = false;
+
+    m_handler();
+}
+
 OVERLAPPED & EventLoopIocpNotifier::getOverlapped ()
 {
     AIPSTACK_ASSERT(m_iocp_resource != nullptr);
@@ -503,7 +1076,7 @@ OVERLAPPED & EventLoopIocpNotifier::getOverlapped ()
     return m_iocp_resource->overlapped;
 }
 
-bool EventLoop::addHandleToIocp (HANDLE handle, DWORD &out_error)
+bool EventLoop::addHandleToIocp (HANDLE handle, DWORD &out_error, bool skip_on_success)
 {
     auto iocp_res = ::CreateIoCompletionPort(
         handle, EventProvider::getIocpHandle(),
@@ -515,6 +1088,14 @@ bool EventLoop::addHandleToIocp (HANDLE handle, DWORD &out_error)
         return false;
     }
 
+    // Nothing waits on the handle itself, so setting its event can be skipped too.
+    if (skip_on_success && !::SetFileCompletionNotificationModes(handle,
+        FILE_SKIP_COMPLETION_PORT_ON_SUCCESS|FILE_SKIP_SET_EVENT_ON_HANDLE))
+    {
+        out_error = ::GetLastError();
+        return false;
+    }
+
     return true;
 }
 
@@ -540,8 +1121,16 @@ bool EventLoop::handle_iocp_result (void *completion_key, OVERLAPPED *overlapped
 
         notifier->m_busy = false;
 
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        EventLoopTime start_time = getTime();
+        #endif
+
         notifier->m_handler();
 
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        record_handler_time(EventLoopHandlerType::Iocp, start_time);
+        #endif
+
         if (AIPSTACK_UNLIKELY(m_stop)) {
             return false;
         }
@@ -575,18 +1164,221 @@ void EventLoop::wait_for_final_iocp_results ()
 
 #endif
 
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+
+EventLoopUringNotifier::EventLoopUringNotifier (
+    EventLoop &loop, UringEventHandler handler)
+:
+    m_loop(loop),
+    m_handler(handler),
+    m_uring_resource(nullptr),
+    m_busy(false)
+{
+    m_loop.m_num_uring_notifiers++;
+}
+
+EventLoopUringNotifier::~EventLoopUringNotifier ()
+{
+    reset();
+
+    AIPSTACK_ASSERT(m_loop.m_num_uring_notifiers > 0);
+    m_loop.m_num_uring_notifiers--;
+}
+
+void EventLoopUringNotifier::prepare ()
+{
+    AIPSTACK_ASSERT(m_uring_resource == nullptr);
+    AIPSTACK_ASSERT(!m_busy);
+
+    auto temp_uring_resource = std::make_unique<UringResource>();
+    temp_uring_resource->sqe[0] = {};
+    temp_uring_resource->loop = &m_loop;
+    temp_uring_resource->notifier = this;
+
+    m_uring_resource = temp_uring_resource.release();
+    m_loop.m_num_uring_resources++;
+}
+
+void EventLoopUringNotifier::reset ()
+{
+    if (m_uring_resource != nullptr) {
+        if (m_busy) {
+            m_uring_resource->notifier = nullptr;
+            m_loop.EventProvider::cancelUringOp(m_uring_resource);
+        } else {
+            AIPSTACK_ASSERT(m_loop.m_num_uring_resources > 0);
+            m_loop.m_num_uring_resources--;
+            delete m_uring_resource;
+        }
+
+        m_uring_resource = nullptr;
+        m_busy = false;
+    }
+}
+
+struct io_uring_sqe & EventLoopUringNotifier::getSqe ()
+{
+    AIPSTACK_ASSERT(m_uring_resource != nullptr);
+
+    return m_uring_resource->sqe[0];
+}
+
+void EventLoopUringNotifier::ioStarted (std::shared_ptr<void> user_resource)
+{
+    AIPSTACK_ASSERT(m_uring_resource != nullptr);
+    AIPSTACK_ASSERT(!m_busy);
+
+    m_loop.EventProvider::submitUringOp(m_uring_resource->sqe[0], m_uring_resource);
+
+    // Update these after submitUringOp so they remain unchanged in case of exception.
+    m_uring_resource->user_resource = std::move(user_resource);
+    m_busy = true;
+}
+
+bool EventLoop::registerUringBuffers (
+    struct iovec const *iovecs, unsigned num_iovecs, int &out_error)
+{
+    return EventProvider::registerUringBuffers(iovecs, num_iovecs, out_error);
+}
+
+bool EventLoop::handle_uring_result (void *uring_resource_ptr, std::int32_t res)
+{
+    UringResource *uring_resource = static_cast<UringResource *>(uring_resource_ptr);
+    AIPSTACK_ASSERT(uring_resource->loop == this);
+
+    uring_resource->user_resource.reset();
+
+    EventLoopUringNotifier *notifier = uring_resource->notifier;
+
+    if (notifier == nullptr) {
+        AIPSTACK_ASSERT(m_num_uring_resources > 0);
+        m_num_uring_resources--;
+        delete uring_resource;
+    } else {
+        AIPSTACK_ASSERT(&notifier->m_loop == this);
+        AIPSTACK_ASSERT(notifier->m_busy);
+        AIPSTACK_ASSERT(notifier->m_uring_resource == uring_resource);
+
+        notifier->m_busy = false;
+        uring_resource->sqe[0] = {};
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        EventLoopTime start_time = getTime();
+        #endif
+
+        notifier->m_handler(res);
+
+        #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+        record_handler_time(EventLoopHandlerType::Uring, start_time);
+        #endif
+
+        if (AIPSTACK_UNLIKELY(m_stop)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void EventLoop::wait_for_final_uring_results ()
+{
+    bool first_try = true;
+
+    // Besides abandoned operations, polls of reset fd-watchers may still be pending.
+    while (m_num_uring_resources > 0 || EventProvider::hasDetachedPolls()) {
+        // Call waitForEvents only on non-first iterations, after having just called
+        // dispatchEvents. This is because we must not call waitForEvents before all
+        // available events have been dispatched.
+        if (!first_try) {
+            EventProvider::waitForEvents(EventLoopTime::max());
+        }
+        first_try = false;
+
+        // Call dispatchEvents to wait for operations to complete.
+        bool dispatch_res = EventProvider::dispatchEvents();
+
+        // dispatchEvents only returns false if it observed m_stop after having called
+        // an event handler. This cannot happen here because there are no event handlers
+        // that could be called (async-signals must not exist at this point either).
+        AIPSTACK_ASSERT(dispatch_res);
+    }
+}
+
+#endif
+
+EventLoopBusyPoller::EventLoopBusyPoller (EventLoop &loop, BusyPollHandler handler) :
+    m_loop(loop),
+    m_handler(handler)
+{
+    m_loop.m_busy_poller_list.prepend(*this);
+
+    m_loop.m_num_busy_pollers++;
+}
+
+EventLoopBusyPoller::~EventLoopBusyPoller ()
+{
+    m_loop.m_busy_poller_list.remove(*this);
+
+    AIPSTACK_ASSERT(m_loop.m_num_busy_pollers > 0);
+    m_loop.m_num_busy_pollers--;
+}
+
+EventLoopDeferred::EventLoopDeferred (EventLoop &loop, DeferredHandler handler) :
+    m_loop(loop),
+    m_handler(handler),
+    m_state(DeferredState::Idle)
+{
+    m_loop.m_num_deferreds++;
+}
+
+EventLoopDeferred::~EventLoopDeferred ()
+{
+    cancel();
+
+    AIPSTACK_ASSERT(m_loop.m_num_deferreds > 0);
+    m_loop.m_num_deferreds--;
+}
+
+void EventLoopDeferred::schedule ()
+{
+    if (m_state == DeferredState::Idle) {
+        m_loop.m_deferred_list.append(*this);
+        m_state = DeferredState::Pending;
+    }
+}
+
+void EventLoopDeferred::cancel ()
+{
+    if (m_state == DeferredState::Pending) {
+        m_loop.m_deferred_list.remove(*this);
+    }
+    else if (m_state == DeferredState::Dispatch) {
+        m_loop.m_deferred_dispatch_list.remove(*this);
+    }
+    m_state = DeferredState::Idle;
+}
+
 EventLoopAsyncSignal::EventLoopAsyncSignal (EventLoop &loop, SignalEventHandler handler) :
     m_loop(loop),
     m_handler(handler)
 {
     AsyncSignalList::markRemoved(*this);
+    m_queue_next = nullptr;
+    m_async_state.store(0, std::memory_order_relaxed);
 
     m_loop.m_num_async_signals++;
 }
 
 EventLoopAsyncSignal::~EventLoopAsyncSignal ()
 {
-    reset();
+    if ((m_async_state.load(std::memory_order_relaxed) & AsyncStateQueued) != 0) {
+        // The signal may be in the atomic queue, from which it cannot be removed
+        // directly. Move everything to the dispatch list and remove it from there.
+        m_loop.collect_async_signals();
+
+        AIPSTACK_ASSERT(!AsyncSignalList::isRemoved(*this));
+        AsyncSignalList::remove(*this);
+    }
 
     AIPSTACK_ASSERT(m_loop.m_num_async_signals > 0);
     m_loop.m_num_async_signals--;
@@ -594,32 +1386,41 @@ EventLoopAsyncSignal::~EventLoopAsyncSignal ()
 
 void EventLoopAsyncSignal::signal ()
 {
-    bool inserted_first = false;
-
-    {
-        std::lock_guard<std::mutex> lock(m_loop.m_async_signal_mutex);
-
-        if (AsyncSignalList::isRemoved(*this)) {
-            inserted_first = AsyncSignalList::isLonely(m_loop.m_pending_async_list);
-            AsyncSignalList::initBefore(*this, m_loop.m_pending_async_list);
+    // Set the Pending and Queued bits. Only if the signal was not yet queued do we
+    // need to push it to the queue, which only one thread can observe since Queued is
+    // only cleared by the event loop after removing the signal from the dispatch list.
+    std::uint8_t state = m_async_state.load(std::memory_order_relaxed);
+    do {
+        if ((state & AsyncStatePending) != 0) {
+            return;
         }
+    } while (!m_async_state.compare_exchange_weak(state,
+        std::uint8_t(state | AsyncStatePending | AsyncStateQueued),
+        std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    if ((state & AsyncStateQueued) != 0) {
+        return;
     }
 
-    if (inserted_first) {
+    // Push the signal to the front of the atomic queue.
+    AsyncSignalNode *head = m_loop.m_async_queue_head.load(std::memory_order_relaxed);
+    do {
+        m_queue_next = head;
+    } while (!m_loop.m_async_queue_head.compare_exchange_weak(head, this,
+        std::memory_order_seq_cst, std::memory_order_relaxed));
+
+    // Wake up the event loop unless a wakeup is already pending. This means at most
+    // one wakeup per dispatch of signals regardless of the rate of signals.
+    if (!m_loop.m_async_wakeup_pending.exchange(true, std::memory_order_seq_cst)) {
         m_loop.EventProvider::signalToCheckAsyncSignals();
     }
 }
 
 void EventLoopAsyncSignal::reset ()
 {
-    {
-        std::lock_guard<std::mutex> lock(m_loop.m_async_signal_mutex);
-
-        if (!AsyncSignalList::isRemoved(*this)) {
-            AsyncSignalList::remove(*this);
-            AsyncSignalList::markRemoved(*this);
-        }
-    }
+    // Just clear the Pending bit; if the signal is queued, it will be removed from the
+    // queue in dispatch without calling the handler.
+    m_async_state.fetch_and(std::uint8_t(~AsyncStatePending), std::memory_order_relaxed);
 }
 
 }
@@ -25,8 +25,9 @@
 #ifndef AIPSTACK_EVENT_LOOP_H
 #define AIPSTACK_EVENT_LOOP_H
 
+#include <cstddef>
 #include <cstdint>
-#include <mutex>
+#include <atomic>
 
 #include <aipstack/misc/NonCopyable.h>
 #include <aipstack/misc/OneOf.h>
@@ -38,8 +39,12 @@
 #include <aipstack/structure/minimum/LinkedHeap.h>
 #include <aipstack/event_loop/EventLoopCommon.h>
 
-#if defined(__linux__)
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+#include <aipstack/event_loop/platform_specific/EventProviderLinuxUring.h>
+#elif defined(__linux__)
 #include <aipstack/event_loop/platform_specific/EventProviderLinux.h>
+#elif AIPSTACK_EVENT_LOOP_HAS_KQUEUE
+#include <aipstack/event_loop/platform_specific/EventProviderKqueue.h>
 #elif defined(_WIN32)
 #include <aipstack/event_loop/platform_specific/EventProviderWindows.h>
 #else
@@ -52,6 +57,13 @@
 #include <windows.h>
 #endif
 
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+#include <cstddef>
+#include <memory>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
 namespace AIpStack {
 
 /**
@@ -64,12 +76,17 @@ struct EventLoopMembers;
 class EventLoop;
 class EventLoopTimer;
 class EventLoopAsyncSignal;
+class EventLoopBusyPoller;
+class EventLoopDeferred;
 #if AIPSTACK_EVENT_LOOP_HAS_FD
 class EventLoopFdWatcher;
 #endif
 #if AIPSTACK_EVENT_LOOP_HAS_IOCP
 class EventLoopIocpNotifier;
 #endif
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+class EventLoopUringNotifier;
+#endif
 #endif
 
 #ifndef IN_DOXYGEN
@@ -77,12 +94,37 @@ class EventLoopPriv {
     friend struct EventLoopMembers;
     friend class EventLoop;
 
+    using TimerLinkModel = PointerLinkModel<EventLoopTimer>;
+
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    struct TimerListNodeAccessor;
+
+    using TimerList = LinkedList<TimerListNodeAccessor, TimerLinkModel, false>;
+    using TimerFifoList = LinkedList<TimerListNodeAccessor, TimerLinkModel, true>;
+    using TimerListNode = LinkedListNode<TimerLinkModel>;
+
+    // The timer wheel has TimerWheelLevels levels of TimerWheelSlots slots each. A
+    // timer whose tick first differs from the current tick in bit group L (bits
+    // [L*TimerWheelSlotBits, (L+1)*TimerWheelSlotBits)) is in level L, in the slot
+    // given by that bit group of its tick. The levels cover all 64-bit ticks.
+    inline static constexpr int TimerWheelSlotBits = 6;
+    inline static constexpr std::size_t TimerWheelSlots =
+        std::size_t(1) << TimerWheelSlotBits;
+    inline static constexpr int TimerWheelLevels =
+        (64 + TimerWheelSlotBits - 1) / TimerWheelSlotBits;
+    inline static constexpr std::size_t TimerWheelNumLists =
+        TimerWheelLevels * TimerWheelSlots;
+
+    // Values of EventLoopTimer::m_wheel_list other than slot indices.
+    inline static constexpr std::uint16_t TimerWheelDueList = TimerWheelNumLists;
+    inline static constexpr std::uint16_t TimerWheelDispatchList = TimerWheelNumLists + 1;
+    #else
     struct TimerHeapNodeAccessor;
     struct TimerCompare;
 
-    using TimerLinkModel = PointerLinkModel<EventLoopTimer>;
     using TimerHeap = LinkedHeap<TimerHeapNodeAccessor, TimerCompare, TimerLinkModel>;
     using TimerHeapNode = LinkedHeapNode<TimerLinkModel>;
+    #endif
 
     struct AsyncSignalNode;
     struct AsyncSignalNodeAccessor;
@@ -92,10 +134,31 @@ class EventLoopPriv {
         AsyncSignalNodeAccessor, AsyncSignalLinkModel>;
     using AsyncSignalListNode = LinkedListNode<AsyncSignalLinkModel>;
 
+    // Bits in AsyncSignalNode::m_async_state. Pending means that signal() was called
+    // and the handler needs to be called, Queued means that the node is in the atomic
+    // queue or the dispatch list.
+    inline static constexpr std::uint8_t AsyncStatePending = 1 << 0;
+    inline static constexpr std::uint8_t AsyncStateQueued  = 1 << 1;
+
     struct AsyncSignalNode {
         AsyncSignalListNode m_list_node;
+        AsyncSignalNode *m_queue_next;
+        std::atomic<std::uint8_t> m_async_state;
     };
 
+    struct BusyPollerListNodeAccessor;
+
+    using BusyPollerLinkModel = PointerLinkModel<EventLoopBusyPoller>;
+    using BusyPollerList = LinkedList<
+        BusyPollerListNodeAccessor, BusyPollerLinkModel, false>;
+    using BusyPollerListNode = LinkedListNode<BusyPollerLinkModel>;
+
+    struct DeferredListNodeAccessor;
+
+    using DeferredLinkModel = PointerLinkModel<EventLoopDeferred>;
+    using DeferredList = LinkedList<DeferredListNodeAccessor, DeferredLinkModel, true>;
+    using DeferredListNode = LinkedListNode<DeferredLinkModel>;
+
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP
     struct IocpResource {
         // The overlapped must be the first field so that we can easily convert
@@ -106,22 +169,211 @@ class EventLoopPriv {
         std::shared_ptr<void> user_resource;
     };
     #endif
+
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    struct UringResource {
+        EventLoop *loop;
+        EventLoopUringNotifier *notifier;
+        std::shared_ptr<void> user_resource;
+        // Declared as an array since io_uring_sqe ends with a flexible array member,
+        // which is not allowed in a non-array member in standard C++.
+        struct io_uring_sqe sqe[1];
+    };
+    #endif
 };
 #endif
 
+/**
+ * Statistics about busy-polling in an event loop.
+ * 
+ * See @ref EventLoop::setBusyPollBudget and @ref EventLoop::getBusyPollStats.
+ */
+struct EventLoopBusyPollStats {
+    /**
+     * Total time spent busy-polling.
+     * 
+     * This is approximately the CPU time which was consumed by busy-polling instead of
+     * blocking, excluding time spent in event handlers.
+     */
+    EventLoopDuration spin_time = EventLoopDuration::zero();
+
+    /**
+     * Number of busy-polling periods which were started.
+     */
+    std::uint64_t num_spin_periods = 0;
+
+    /**
+     * Number of busy-polling periods which ended because events or expired timers were
+     * found (as opposed to the budget being exhausted).
+     */
+    std::uint64_t num_spin_hits = 0;
+
+    /**
+     * Number of times the event loop blocked waiting for events.
+     */
+    std::uint64_t num_blocking_waits = 0;
+};
+
+#if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION || defined(IN_DOXYGEN)
+
+/**
+ * Histogram of durations with power-of-two microsecond buckets (only with
+ * instrumentation, see @ref AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION).
+ * 
+ * Bucket 0 counts durations below 1 microsecond and bucket `i` for `i > 0` counts
+ * durations of at least 2<sup>i-1</sup> and less than 2<sup>i</sup> microseconds,
+ * except that the last bucket also counts all longer durations.
+ */
+struct EventLoopHistogram {
+    /**
+     * Number of buckets.
+     */
+    inline static constexpr std::size_t NumBuckets = 24;
+
+    /**
+     * Number of recorded durations.
+     */
+    std::uint64_t count = 0;
+
+    /**
+     * Sum of recorded durations.
+     */
+    EventLoopDuration total = EventLoopDuration::zero();
+
+    /**
+     * Maximum recorded duration.
+     */
+    EventLoopDuration max = EventLoopDuration::zero();
+
+    /**
+     * Counts of recorded durations in each bucket.
+     */
+    std::uint64_t buckets[NumBuckets] = {};
+
+    /**
+     * Record a duration.
+     * 
+     * @param duration Duration to record. Negative values are recorded as zero.
+     */
+    void record (EventLoopDuration duration)
+    {
+        if (duration < EventLoopDuration::zero()) {
+            duration = EventLoopDuration::zero();
+        }
+
+        count++;
+        total += duration;
+        if (duration > max) {
+            max = duration;
+        }
+
+        auto us = std::uint64_t(
+            std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+        std::size_t bucket = (us == 0) ? 0 : std::size_t(64 - __builtin_clzll(us));
+        buckets[(bucket < NumBuckets) ? bucket : (NumBuckets - 1)]++;
+    }
+};
+
+/**
+ * Types of event handlers distinguished by the instrumentation (see @ref
+ * EventLoopInstrumentation::handler_time).
+ */
+enum class EventLoopHandlerType : std::uint8_t {
+    /** Handler of @ref EventLoopTimer. */
+    Timer,
+    /** Handler of @ref EventLoopAsyncSignal. */
+    AsyncSignal,
+    /** Handler of @ref EventLoopBusyPoller (only calls which returned true). */
+    BusyPoller,
+    /** Handler of @ref EventLoopDeferred. */
+    Deferred,
+    /** Handler of EventLoopFdWatcher. */
+    Fd,
+    /** Handler of EventLoopIocpNotifier. */
+    Iocp,
+    /** Handler of EventLoopUringNotifier. */
+    Uring,
+    /** Number of handler types (not a handler type). */
+    Count
+};
+
+/**
+ * Latency and utilization statistics of an event loop (only with instrumentation, see
+ * @ref AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION).
+ * 
+ * See @ref EventLoop::getInstrumentation. The fraction of time the event loop thread
+ * is busy can be computed from the totals of @ref iteration_time, @ref wait_time and
+ * the busy-polling time (@ref EventLoopBusyPollStats::spin_time). Stalls of the event
+ * loop, which for example increase TCP round-trip times, show up in the high buckets
+ * of @ref iteration_time, and the responsible handler type in @ref handler_time.
+ */
+struct EventLoopInstrumentation {
+    /**
+     * Number of event loop iterations.
+     */
+    std::uint64_t num_iterations = 0;
+
+    /**
+     * Time spent in each iteration dispatching expired timers and events, excluding
+     * busy-polling and blocking waits.
+     */
+    EventLoopHistogram iteration_time;
+
+    /**
+     * Time spent in each blocking wait for events.
+     */
+    EventLoopHistogram wait_time;
+
+    /**
+     * Duration of handler calls for each handler type, indexed by @ref
+     * EventLoopHandlerType. The count of each histogram is the number of events
+     * dispatched to handlers of that type.
+     */
+    EventLoopHistogram handler_time[std::size_t(EventLoopHandlerType::Count)];
+
+    /**
+     * Lateness of timer handler calls, that is the time from the expiration time of
+     * the timer (see @ref EventLoopTimer::getSetTime) to the start of the handler call.
+     */
+    EventLoopHistogram timer_lateness;
+};
+
+#endif
+
 #ifndef IN_DOXYGEN
 struct EventLoopMembers {
     EventLoopMembers();
     
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    EventLoopPriv::TimerList m_timer_wheel[EventLoopPriv::TimerWheelNumLists];
+    std::uint64_t m_timer_wheel_bits[EventLoopPriv::TimerWheelLevels];
+    StructureRaiiWrapper<EventLoopPriv::TimerFifoList> m_timer_due_list;
+    StructureRaiiWrapper<EventLoopPriv::TimerFifoList> m_timer_dispatch_list;
+    EventLoopTime m_timer_wheel_epoch;
+    std::uint64_t m_timer_wheel_tick;
+    EventLoopDuration m_timer_resolution;
+    #else
     StructureRaiiWrapper<EventLoopPriv::TimerHeap> m_timer_heap;
+    #endif
+    EventLoopDuration m_timer_slack;
     bool m_stop;
     bool m_recheck_async_signals;
     EventLoopTime m_event_time;
-    std::mutex m_async_signal_mutex;
-    EventLoopPriv::AsyncSignalNode m_pending_async_list;
+    std::atomic<EventLoopPriv::AsyncSignalNode *> m_async_queue_head;
+    std::atomic<bool> m_async_wakeup_pending;
     EventLoopPriv::AsyncSignalNode m_dispatch_async_list;
+    StructureRaiiWrapper<EventLoopPriv::BusyPollerList> m_busy_poller_list;
+    EventLoopDuration m_busy_poll_budget;
+    EventLoopBusyPollStats m_busy_poll_stats;
+    StructureRaiiWrapper<EventLoopPriv::DeferredList> m_deferred_list;
+    StructureRaiiWrapper<EventLoopPriv::DeferredList> m_deferred_dispatch_list;
+    #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+    EventLoopInstrumentation m_instrumentation;
+    #endif
     std::size_t m_num_timers;
     std::size_t m_num_async_signals;
+    std::size_t m_num_busy_pollers;
+    std::size_t m_num_deferreds;
     #if AIPSTACK_EVENT_LOOP_HAS_FD
     std::size_t m_num_fd_notifiers;
     #endif
@@ -129,6 +381,10 @@ struct EventLoopMembers {
     std::size_t m_num_iocp_notifiers;
     std::size_t m_num_iocp_resources;
     #endif
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    std::size_t m_num_uring_notifiers;
+    std::size_t m_num_uring_resources;
+    #endif
 };
 #endif
 
@@ -162,6 +418,8 @@ class EventLoop :
     friend struct EventLoopMembers;
     friend class EventLoopTimer;
     friend class EventLoopAsyncSignal;
+    friend class EventLoopBusyPoller;
+    friend class EventLoopDeferred;
     #if AIPSTACK_EVENT_LOOP_HAS_FD
     friend class EventLoopFdWatcher;
     friend class EventProviderFdBase;
@@ -169,8 +427,15 @@ class EventLoop :
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP
     friend class EventLoopIocpNotifier;
     #endif
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    friend class EventLoopUringNotifier;
+    #endif
 
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    AIPSTACK_USE_TYPES(EventLoopPriv, (TimerListNode))
+    #else
     AIPSTACK_USE_TYPES(EventLoopPriv, (TimerHeapNode))
+    #endif
 
     enum class TimerState : std::uint8_t {
         Idle       = 0,
@@ -182,11 +447,26 @@ class EventLoop :
         OneOf(TimerState::Dispatch, TimerState::Pending);
 
     AIPSTACK_USE_TYPES(EventLoopPriv, (AsyncSignalNode, AsyncSignalList))
+    AIPSTACK_USE_VALS(EventLoopPriv, (AsyncStatePending, AsyncStateQueued))
+
+    AIPSTACK_USE_TYPES(EventLoopPriv, (BusyPollerListNode, BusyPollerList))
+
+    AIPSTACK_USE_TYPES(EventLoopPriv, (DeferredListNode, DeferredList))
+
+    enum class DeferredState : std::uint8_t {
+        Idle       = 0,
+        Pending    = 1,
+        Dispatch   = 2
+    };
 
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP
     AIPSTACK_USE_TYPES(EventLoopPriv, (IocpResource))
     #endif
 
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    AIPSTACK_USE_TYPES(EventLoopPriv, (UringResource))
+    #endif
+
 public:
     /**
      * Construct the event loop.
@@ -207,7 +487,8 @@ public:
      * 
      * @note On Windows, destruction involves waiting for the completion of any pending
      * asynchronous I/O operations that had been abandoned by @ref EventLoopIocpNotifier
-     * objecs associated with this event loop.
+     * objecs associated with this event loop. The same applies to operations abandoned
+     * by @ref EventLoopUringNotifier objects with the io_uring based provider.
      */
     ~EventLoop ();
 
@@ -265,6 +546,121 @@ public:
         return m_event_time;
     }
 
+    /**
+     * Set the busy-polling budget.
+     * 
+     * When the budget is nonzero, the @ref run function does not immediately block when
+     * there are no events to dispatch but first polls for events without blocking for up
+     * to the specified duration. During this time, the handlers of all @ref
+     * EventLoopBusyPoller objects are also called repeatedly. Blocking is resumed once
+     * the budget is exhausted without events having been found (and the budget is
+     * renewed after each dispatch of events). This trades CPU time for lower latency of
+     * event dispatch, since the wakeup latency of blocking is avoided.
+     * 
+     * The budget is zero (busy-polling disabled) by default. Busy-polling never extends
+     * past the expiration time of the earliest timer.
+     * 
+     * @param budget Maximum duration of busy-polling after dispatching events. Negative
+     *        values are treated as zero.
+     */
+    void setBusyPollBudget (EventLoopDuration budget);
+
+    /**
+     * Get the busy-polling budget.
+     * 
+     * @return The budget as set by @ref setBusyPollBudget (zero by default).
+     */
+    inline EventLoopDuration getBusyPollBudget () const {
+        return m_busy_poll_budget;
+    }
+
+    /**
+     * Get busy-polling statistics.
+     * 
+     * The statistics are accumulated since the event loop was constructed; they can be
+     * used to assess the CPU cost of busy-polling (see @ref setBusyPollBudget).
+     * 
+     * @return Reference to the statistics (valid as long as the event loop exists).
+     */
+    inline EventLoopBusyPollStats const & getBusyPollStats () const {
+        return m_busy_poll_stats;
+    }
+
+    #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION || defined(IN_DOXYGEN)
+    /**
+     * Get latency and utilization statistics (only with instrumentation, see @ref
+     * AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION).
+     * 
+     * The statistics are accumulated since the event loop was constructed or since
+     * the last call of @ref resetInstrumentation. This may be called at any time from
+     * the event loop thread, including from event handlers.
+     * 
+     * @return Reference to the statistics (valid as long as the event loop exists).
+     */
+    inline EventLoopInstrumentation const & getInstrumentation () const {
+        return m_instrumentation;
+    }
+
+    /**
+     * Reset the latency and utilization statistics (only with instrumentation, see
+     * @ref AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION).
+     * 
+     * This is useful to collect statistics for consecutive intervals.
+     */
+    void resetInstrumentation ();
+    #endif
+
+    /**
+     * Set the timer slack, which allows coalescing the expiration of timers.
+     * 
+     * When the slack is nonzero, the time until which the event loop waits for the
+     * earliest timer is rounded up to a multiple of the slack (counted from the epoch
+     * of @ref EventLoopClock). Timers may therefore expire up to the slack late, but
+     * timers expiring within the same slack window are dispatched together, which
+     * reduces wakeups and reprogramming of the platform timer.
+     * 
+     * The slack is zero by default.
+     * 
+     * @param slack Timer slack. Negative values are treated as zero.
+     */
+    void setTimerSlack (EventLoopDuration slack);
+
+    /**
+     * Get the timer slack.
+     * 
+     * @return The slack as set by @ref setTimerSlack (zero by default).
+     */
+    inline EventLoopDuration getTimerSlack () const {
+        return m_timer_slack;
+    }
+
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL || defined(IN_DOXYGEN)
+    /**
+     * Set the resolution of the timer wheel (only with the timer wheel, see @ref
+     * AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL).
+     * 
+     * Timer expiration times are rounded up to a multiple of the resolution (counted
+     * from an unspecified starting time), so timers may expire up to the resolution
+     * late. The default resolution is 1 millisecond.
+     * 
+     * This must only be called when no timer associated with this event loop is
+     * running (e.g. just after the event loop is constructed).
+     * 
+     * @param resolution Timer resolution (must be positive).
+     */
+    void setTimerResolution (EventLoopDuration resolution);
+
+    /**
+     * Get the resolution of the timer wheel (only with the timer wheel, see @ref
+     * AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL).
+     * 
+     * @return The resolution as set by @ref setTimerResolution.
+     */
+    inline EventLoopDuration getTimerResolution () const {
+        return m_timer_resolution;
+    }
+    #endif
+
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP || defined(IN_DOXYGEN)
     /**
      * Call `CreateIoCompletionPort` to register a handle with the IOCP handle used by
@@ -281,12 +677,46 @@ public:
      * not respected, assertion errors and/or crashes will result as the event loop would
      * receive an unexpected IOCP event.
      * 
+     * If `skip_on_success` is true, the handle is additionally configured with
+     * `SetFileCompletionNotificationModes` so that operations which complete
+     * synchronously (the I/O function succeeds instead of failing with
+     * `ERROR_IO_PENDING`) do not queue a completion packet. Such completions must be
+     * reported using @ref EventLoopIocpNotifier::ioCompletedSynchronously instead of
+     * @ref EventLoopIocpNotifier::ioStarted. This saves a round trip through the IOCP
+     * for each such operation, which is common for reads and writes on busy devices.
+     * 
      * @param handle Handle to associate with IOCP.
      * @param out_error If association fails, the Windows error code resulting from
-     *        `CreateIoCompletionPort` will be stored here (unchanged on success).
+     *        `CreateIoCompletionPort` or `SetFileCompletionNotificationModes` will be
+     *        stored here (unchanged on success).
+     * @param skip_on_success Whether to skip completion packets for operations which
+     *        complete synchronously (`FILE_SKIP_COMPLETION_PORT_ON_SUCCESS`).
+     * @return True on success, false on failure.
+     */
+    bool addHandleToIocp (HANDLE handle, DWORD &out_error, bool skip_on_success = false);
+    #endif
+
+    #if AIPSTACK_EVENT_LOOP_HAS_URING || defined(IN_DOXYGEN)
+    /**
+     * Register buffers with the io_uring instance used by the event loop (Linux with
+     * io_uring only, see @ref AIPSTACK_EVENT_LOOP_HAS_URING).
+     * 
+     * This is a wrapper around `io_uring_register` with `IORING_REGISTER_BUFFERS`.
+     * Registered buffers can be used in operations submitted through @ref
+     * EventLoopUringNotifier with `IORING_OP_READ_FIXED` and `IORING_OP_WRITE_FIXED`,
+     * which avoids mapping the buffers for each operation. Only one set of buffers can
+     * be registered with an event loop, so this is best coordinated by the application
+     * among the drivers using the event loop.
+     * 
+     * @param iovecs Array of buffers to register. The memory of the buffers must remain
+     *        valid as long as the event loop exists.
+     * @param num_iovecs Number of buffers.
+     * @param out_error If registration fails, the error code (`errno`) will be stored
+     *        here (unchanged on success).
      * @return True on success, false on failure.
      */
-    bool addHandleToIocp (HANDLE handle, DWORD &out_error);
+    bool registerUringBuffers (
+        struct iovec const *iovecs, unsigned num_iovecs, int &out_error);
     #endif
 
 private:
@@ -296,13 +726,47 @@ private:
 
     EventLoopTime get_timers_wait_time () const;
 
+    EventLoopTime apply_timer_slack (EventLoopTime time) const;
+
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    bool timer_wheel_is_empty () const;
+
+    std::uint64_t timer_wheel_tick_for_time (EventLoopTime time) const;
+
+    void timer_wheel_insert (EventLoopTimer &tim);
+
+    void timer_wheel_remove (EventLoopTimer &tim);
+
+    bool timer_wheel_next_slot (std::size_t &out_index, std::uint64_t &out_tick) const;
+
+    void timer_wheel_advance (std::uint64_t target_tick);
+    #endif
+
     bool dispatch_async_signals ();
 
+    void collect_async_signals ();
+
+    bool busy_poll (EventLoopTime wait_time);
+
+    bool call_busy_pollers ();
+
+    bool dispatch_deferreds ();
+
+    #if AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION
+    void record_handler_time (EventLoopHandlerType type, EventLoopTime start_time);
+    #endif
+
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP
     bool handle_iocp_result (void *completion_key, OVERLAPPED *overlapped);
 
     void wait_for_final_iocp_results ();
     #endif
+
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    bool handle_uring_result (void *uring_resource, std::int32_t res);
+
+    void wait_for_final_uring_results ();
+    #endif
 };
 
 /**
@@ -322,6 +786,13 @@ private:
  * state just prior to the call. Periodic operation is intentionally not supported
  * directly but can be achieved by restarting the timer from the callback.
  * 
+ * By default, timers are kept in a binary heap, which makes starting and stopping a timer
+ * O(log n) in the number of running timers. Alternatively a hierarchical timer wheel can
+ * be used (see @ref AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL), for which these operations are
+ * O(1) but expiration times are rounded up to the resolution of the wheel (see @ref
+ * EventLoop::setTimerResolution). In either case, expirations of timers may also be
+ * delayed for coalescing by @ref EventLoop::setTimerSlack.
+ * 
  * The @ref EventLoopTimer class does not throw exceptions from any of its public functions
  * including the constructor.
  */
@@ -331,7 +802,11 @@ class EventLoopTimer :
     friend class EventLoopPriv;
     friend class EventLoop;
 
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    AIPSTACK_USE_TYPES(EventLoop, (TimerListNode, TimerState))
+    #else
     AIPSTACK_USE_TYPES(EventLoop, (TimerHeapNode, TimerState))
+    #endif
 
 public:
     /**
@@ -410,11 +885,18 @@ public:
     void setAfter (EventLoopDuration duration);
 
 private:
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    TimerListNode m_list_node;
+    #else
     TimerHeapNode m_heap_node;
+    #endif
     EventLoop &m_loop;
     TimerHandler m_handler;
     EventLoopTime m_time;
     TimerState m_state;
+    #if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+    std::uint16_t m_wheel_list;
+    #endif
 };
 
 /**
@@ -441,6 +923,7 @@ class EventLoopAsyncSignal :
     friend class EventLoop;
 
     AIPSTACK_USE_TYPES(EventLoop, (AsyncSignalList))
+    AIPSTACK_USE_VALS(EventLoop, (AsyncStatePending, AsyncStateQueued))
 
 public:
     /**
@@ -480,6 +963,10 @@ public:
      * This function is specifically thread-safe (unlike other functions which are not,
      * by default). However be careful with destruction of the async-signal object (see the
      * note in the destructor).
+     * 
+     * This function is lock-free. If the signal is already pending, it only performs an
+     * atomic load. The event loop is woken up at most once per dispatch of async-signals,
+     * regardless of the number of @ref signal calls on any async-signal objects.
      */
     void signal ();
 
@@ -502,6 +989,145 @@ private:
     SignalEventHandler m_handler;
 };
 
+/**
+ * Provides a hook called repeatedly while the event loop is busy-polling.
+ * 
+ * This allows drivers which can check for available work cheaply without a system
+ * call (such as by inspecting a shared-memory descriptor ring) to take part in
+ * busy-polling. The @ref BusyPollHandler of each busy-poller object is called
+ * repeatedly while the event loop is busy-polling (see @ref
+ * EventLoop::setBusyPollBudget); it is never called if busy-polling is disabled.
+ * 
+ * The @ref EventLoopBusyPoller class does not throw exceptions from any of its public
+ * functions including the constructor.
+ */
+class EventLoopBusyPoller :
+    private NonCopyable<EventLoopBusyPoller>
+{
+    friend class EventLoopPriv;
+    friend class EventLoop;
+
+    AIPSTACK_USE_TYPES(EventLoop, (BusyPollerListNode))
+
+public:
+    /**
+     * Type of callback function used for busy-polling.
+     * 
+     * The callback should check for work and return whether it found and processed any.
+     * It must return true if it did anything that affects the event loop or objects
+     * associated with it (in particular constructing or destructing any @ref
+     * EventLoopBusyPoller), or if it called @ref EventLoop::stop. When true is returned,
+     * the event loop ends the current busy-polling period and continues with dispatching
+     * events.
+     * 
+     * The callback is always called asynchronously (not from any public member function).
+     * 
+     * @return True if work was done, false if not.
+     */
+    using BusyPollHandler = Function<bool()>;
+
+    /**
+     * Construct the busy-poller object.
+     * 
+     * @param loop Event loop; it must outlive the busy-poller object.
+     * @param handler Callback function (must not be null).
+     */
+    EventLoopBusyPoller (EventLoop &loop, BusyPollHandler handler);
+
+    /**
+     * Destruct the busy-poller object.
+     * 
+     * The callback will not be called after destruction.
+     */
+    ~EventLoopBusyPoller ();
+
+private:
+    BusyPollerListNode m_list_node;
+    EventLoop &m_loop;
+    BusyPollHandler m_handler;
+};
+
+/**
+ * Allows calling a function from the event loop after the current event handler.
+ * 
+ * After @ref schedule is called, the @ref DeferredHandler is called once the event loop
+ * has dispatched the events it is currently processing and before it waits for new
+ * events. Scheduled calls are made in the order of @ref schedule calls. This is cheaper
+ * than an @ref EventLoopTimer with an expired time, since scheduling and cancelling are
+ * O(1) operations on a list and do not affect the wait time of the event loop. It is
+ * suitable to coalesce work triggered by multiple events, such as sending output or
+ * flushing a batch of frames after all received frames have been processed.
+ * 
+ * Calls scheduled from within a @ref DeferredHandler are made in the next event loop
+ * iteration, after checking for new events without blocking, so that rescheduling
+ * does not starve other events.
+ * 
+ * The @ref EventLoopDeferred class does not throw exceptions from any of its public
+ * functions including the constructor.
+ */
+class EventLoopDeferred :
+    private NonCopyable<EventLoopDeferred>
+{
+    friend class EventLoopPriv;
+    friend class EventLoop;
+
+    AIPSTACK_USE_TYPES(EventLoop, (DeferredListNode, DeferredState))
+
+public:
+    /**
+     * Type of callback function used to make scheduled calls.
+     * 
+     * The callback is always called asynchronously (not from any public member function).
+     * When it is called, the deferred object is no longer scheduled.
+     */
+    using DeferredHandler = Function<void()>;
+
+    /**
+     * Construct the deferred object.
+     * 
+     * The deferred object is initially not scheduled.
+     * 
+     * @param loop Event loop; it must outlive the deferred object.
+     * @param handler Callback function (must not be null).
+     */
+    EventLoopDeferred (EventLoop &loop, DeferredHandler handler);
+
+    /**
+     * Destruct the deferred object.
+     * 
+     * The callback will not be called after destruction.
+     */
+    ~EventLoopDeferred ();
+
+    /**
+     * Check if the deferred object is scheduled.
+     * 
+     * @return True if scheduled, false if not.
+     */
+    inline bool isScheduled () const {
+        return m_state != DeferredState::Idle;
+    }
+
+    /**
+     * Schedule a call of the callback.
+     * 
+     * If the deferred object is already scheduled, this has no effect (the call keeps
+     * its position in the order of calls).
+     */
+    void schedule ();
+
+    /**
+     * Cancel a scheduled call, if any.
+     */
+    void cancel ();
+
+private:
+    DeferredListNode m_list_node;
+    EventLoop &m_loop;
+    DeferredHandler m_handler;
+    DeferredState m_state;
+};
+
 #if AIPSTACK_EVENT_LOOP_HAS_FD || defined(IN_DOXYGEN)
 
 #ifndef IN_DOXYGEN
@@ -514,7 +1140,8 @@ struct EventLoopFdWatcherMembers {
 #endif
 
 /**
- * Provides notifications about I/O readiness of a file descriptor (Linux only).
+ * Provides notifications about I/O readiness of a file descriptor (Linux, macOS and FreeBSD
+ * only, see @ref AIPSTACK_EVENT_LOOP_HAS_FD).
  * 
  * An fd-watcher object provides notifications when an application-specified file
  * descriptor is ready for certain types of I/O operation (see @ref EventLoopFdEvents).
@@ -616,6 +1243,10 @@ public:
      * one @ref EventLoopFdWatcher instance at a time is not supported. The manifestations
      * of doing that are not defined and depend on the platform.
      * 
+     * With kqueue, the registration is only submitted with the next wait for events, and
+     * if it fails, this is reported as an @ref EventLoopFdEvents::Error "Error" event
+     * instead of an exception.
+     * 
      * @param fd File descriptor (must be an open file descriptor).
      * @param events Mask of I/O readiness types to monitor for, see @ref
      *        EventLoopFdEvents. Only bits which are defined there may be included.
@@ -690,6 +1321,11 @@ public:
  *   completed. From this callback you will want to call `GetOverlappedResult` to retrieve
  *   the result of the operation.
  * 
+ * If the handle was associated with skipping of completion packets on success (see
+ * @ref EventLoop::addHandleToIocp), an operation which completes synchronously must be
+ * reported using @ref ioCompletedSynchronously instead of @ref ioStarted. The callback
+ * is then called from the event loop without waiting for the IOCP.
+ * 
  * An IOCP-notifier object can be destructed or @ref reset even in Busy state, in which
  * case the implementation will still expect and be able to handle the completion message.
  * Further, the application may specify an abstract resource (possibly containing the
@@ -785,6 +1421,22 @@ public:
      */
     void ioStarted (std::shared_ptr<void> user_resource);
 
+    /**
+     * Report that an asynchronous I/O operation completed synchronously and no
+     * completion packet will be queued for it.
+     * 
+     * @note This function may only be called in Idle state.
+     * 
+     * This is to be used instead of @ref ioStarted when the handle was associated with
+     * skipping of completion packets on success (see @ref EventLoop::addHandleToIocp)
+     * and the I/O function returned success. The object transitions to Busy state and
+     * the @ref IocpEventHandler callback is called from the event loop like for other
+     * completions, so `GetOverlappedResult` can be used in the same way. Since the
+     * operation is no longer in progress, destruction or @ref reset in this state
+     * simply cancels the callback.
+     */
+    void ioCompletedSynchronously ();
+
     /**
      * Return whether the IOCP-notifier object has been prepared.
      * 
@@ -812,10 +1464,173 @@ public:
      */
     OVERLAPPED & getOverlapped ();
 
+private:
+    void syncCompletionHandler ();
+
 private:
     EventLoop &m_loop;
     Function<void()> m_handler;
     IocpResource *m_iocp_resource;
+    EventLoopDeferred m_sync_deferred;
+    bool m_busy;
+};
+
+#endif
+
+#if AIPSTACK_EVENT_LOOP_HAS_URING || defined(IN_DOXYGEN)
+
+/**
+ * Provides notifications of completed io_uring operations (Linux with io_uring only,
+ * see @ref AIPSTACK_EVENT_LOOP_HAS_URING).
+ * 
+ * An io_uring-notifier object allows drivers to perform completion-based I/O using the
+ * io_uring instance of the event loop, as an alternative to waiting for I/O readiness
+ * using @ref EventLoopFdWatcher. Operations are submitted together with waiting for
+ * events, so that for example a read does not need a separate system call after the
+ * file descriptor becomes readable.
+ * 
+ * The states of an io_uring-notifier object and their use are analogous to @ref
+ * EventLoopIocpNotifier:
+ * - Unprepared (this is the default after construction). Call @ref prepare to get to
+ *   Idle state.
+ * - Idle. In this state, the object is ready to submit an operation. Fill in the
+ *   submission queue entry returned by @ref getSqe and call @ref ioStarted, which will
+ *   cause a transition to the Busy state.
+ * - Busy. In this state, the object is responsible for an ongoing operation. The @ref
+ *   UringEventHandler callback will be called when the operation completes.
+ * 
+ * Only operations which produce a single completion are supported (not multishot
+ * operations). The `user_data` field of the submission queue entry is reserved for the
+ * event loop. Registered buffers (see @ref EventLoop::registerUringBuffers) may be used.
+ * 
+ * An io_uring-notifier object can be destructed or @ref reset even in Busy state, in
+ * which case cancellation of the operation is requested and the implementation will
+ * still expect and be able to handle the completion. Any memory used by the operation
+ * must remain valid until it completes, for which the application may specify an
+ * abstract resource to be kept alive; see @ref ioStarted for details.
+ */
+class EventLoopUringNotifier :
+    private NonCopyable<EventLoopUringNotifier>
+{
+    friend class EventLoop;
+
+    AIPSTACK_USE_TYPES(EventLoop, (UringResource))
+
+public:
+    /**
+     * Type of callback used to report completion of an io_uring operation.
+     * 
+     * It is guaranteed that the io_uring-notifier object was in Busy state and has
+     * transitioned to Idle state just before the call.
+     * 
+     * The callback is always called asynchronously (not from any public member function).
+     * 
+     * @param res The result of the operation (`res` field of the completion queue entry),
+     *        a negated `errno` value on error.
+     */
+    using UringEventHandler = Function<void(std::int32_t res)>;
+
+    /**
+     * Construct the io_uring-notifier object.
+     * 
+     * The object is initially in Unprepared state; @ref prepare must be called before
+     * @ref ioStarted.
+     * 
+     * @param loop Event loop; it must outlive the io_uring-notifier object.
+     * @param handler Callback function (must not be null).
+     */
+    EventLoopUringNotifier (EventLoop &loop, UringEventHandler handler);
+
+    /**
+     * Destruct the io_uring-notifier object.
+     * 
+     * See the notes about destruction in Busy state in @ref ioStarted.
+     * 
+     * The @ref UringEventHandler callback will not be called after destruction.
+     */
+    ~EventLoopUringNotifier ();
+
+    /**
+     * Allocate resources to allow the io_uring-notifier object to supervise an
+     * operation.
+     * 
+     * @note This function may only be called in Unprepared state.
+     * 
+     * On success (no exception), the object transitions to Idle state.
+     * 
+     * @throw std::bad_alloc If a memory allocation error occur (the object did not
+     *        transition to Idle state).
+     */
+    void prepare ();
+
+    /**
+     * Reset the io_uring-notifier object bringing it to Unprepared state.
+     * 
+     * This is equivalent to destructing and reconstrucing the object. The notes in @ref
+     * ioStarted concerning destruction in Busy state apply.
+     */
+    void reset ();
+
+    /**
+     * Return a reference to the submission queue entry to be submitted by @ref
+     * ioStarted.
+     * 
+     * @note This function must not be called in Unprepared state.
+     * 
+     * The entry is zeroed when the object enters Idle state.
+     * 
+     * @return Reference to the submission queue entry.
+     */
+    struct io_uring_sqe & getSqe ();
+
+    /**
+     * Submit the operation described by the submission queue entry (@ref getSqe).
+     * 
+     * @note This function may only be called in Idle state.
+     * 
+     * The operation is queued and will be passed to the kernel when the event loop
+     * next waits for events. The @ref UringEventHandler callback will be called when
+     * the operation completes. However, if this object is destructed or @ref reset is
+     * called before the callback, cancellation of the operation is requested and the
+     * callback would not be called.
+     * 
+     * This function accepts a `shared_ptr` representing an opaque resource to which a
+     * reference (`shared_ptr` instance) will be kept for the duration of the operation,
+     * typically the buffer used by the operation. If completion is reported by the @ref
+     * UringEventHandler callback, the reference is released just before the callback.
+     * If the operation is abandoned, the reference is released when it completes. Note
+     * that the @ref EventLoop destructor will wait for any such outstanding operations
+     * to complete, therefore the reference may also be released from there.
+     * 
+     * @param user_resource Shared pointer to an opaque resource to which a reference will
+     *        be kept for the duration of the operation (may be null).
+     * @throw std::runtime_error If the operation could not be queued (the object remains
+     *        in Idle state).
+     */
+    void ioStarted (std::shared_ptr<void> user_resource);
+
+    /**
+     * Return whether the io_uring-notifier object has been prepared.
+     * 
+     * @return True if the object is in Idle or Busy state, false if in Unprepared state.
+     */
+    inline bool isPrepared () const {
+        return m_uring_resource != nullptr;
+    }
+
+    /**
+     * Return whether the io_uring-notifier object is in Busy state.
+     * 
+     * @return The if the object is in Busy state, false if in Unprepared or Idle state.
+     */
+    inline bool isBusy () const {
+        return m_busy;
+    }
+
+private:
+    EventLoop &m_loop;
+    UringEventHandler m_handler;
+    UringResource *m_uring_resource;
     bool m_busy;
 };
 
@@ -40,10 +40,22 @@
  * Specifies whether the event loop supports watching file descriptors via @ref
  * AIpStack::EventLoopFdWatcher "EventLoopFdWatcher" (0 or 1).
  * 
- * Currently this is true for Linux.
+ * Currently this is true for Linux and for the platforms using the kqueue based event
+ * provider (see @ref AIPSTACK_EVENT_LOOP_HAS_KQUEUE).
  */
 #define AIPSTACK_EVENT_LOOP_HAS_FD PLATFORM_DEPENDENT
 
+/**
+ * Specifies whether the event loop uses the kqueue based event provider (0 or 1).
+ * 
+ * Currently this is true for macOS and FreeBSD. Changes to the monitored file
+ * descriptors and the timer are collected and submitted with the next `kevent` call
+ * which waits for events, so they do not need separate system calls. The timer uses
+ * `EVFILT_TIMER` and @ref AIpStack::EventLoopAsyncSignal "EventLoopAsyncSignal" uses
+ * `EVFILT_USER`.
+ */
+#define AIPSTACK_EVENT_LOOP_HAS_KQUEUE PLATFORM_DEPENDENT
+
 /**
  * Specifies whether the event loop supports integrating Windows IOCP via @ref
  * AIpStack::EventLoopIocpNotifier "EventLoopIocpNotifier" (0 or 1).
@@ -52,9 +64,62 @@
  */
 #define AIPSTACK_EVENT_LOOP_HAS_IOCP PLATFORM_DEPENDENT
 
+/**
+ * Specifies whether the event loop uses the io_uring based event provider and supports
+ * completion-based I/O via @ref AIpStack::EventLoopUringNotifier
+ * "EventLoopUringNotifier" (0 or 1).
+ * 
+ * This is true on Linux if `AIPSTACK_EVENT_LOOP_USE_IO_URING` is defined when compiling
+ * everything that uses the event loop (including `EventLoopAmalgamation.cpp`). Otherwise
+ * the epoll based event provider is used. The io_uring based provider requires Linux
+ * 5.13 or later.
+ */
+#define AIPSTACK_EVENT_LOOP_HAS_URING PLATFORM_DEPENDENT
+
+/**
+ * Specifies whether the event loop keeps timers in a hierarchical timer wheel instead of
+ * a binary heap (0 or 1).
+ * 
+ * This is true if `AIPSTACK_EVENT_LOOP_USE_TIMER_WHEEL` is defined when compiling
+ * everything that uses the event loop (including `EventLoopAmalgamation.cpp`). The timer
+ * wheel makes starting and stopping timers O(1), which is useful with very many timers,
+ * at the cost of rounding expiration times up to the timer resolution (see @ref
+ * AIpStack::EventLoop::setTimerResolution "EventLoop::setTimerResolution").
+ */
+#define AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL PLATFORM_DEPENDENT
+
+/**
+ * Specifies whether the event loop collects latency and utilization statistics (0 or
+ * 1).
+ * 
+ * This is true if `AIPSTACK_EVENT_LOOP_USE_INSTRUMENTATION` is defined when compiling
+ * everything that uses the event loop (including `EventLoopAmalgamation.cpp`). The
+ * statistics are available using @ref AIpStack::EventLoop::getInstrumentation
+ * "EventLoop::getInstrumentation". Collecting them requires reading the clock around
+ * every event handler call; without this option there is no overhead at all.
+ */
+#define AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION PLATFORM_DEPENDENT
+
+/**
+ * Maximum number of events obtained by the epoll or kqueue based event provider from
+ * one `epoll_wait` or `kevent` call.
+ * 
+ * The provider starts with 64 events and doubles the number whenever a call returns as
+ * many events as requested, up to this limit. This can be defined when compiling
+ * everything that uses the event loop (including `EventLoopAmalgamation.cpp`); the
+ * default is 1024.
+ */
+#define AIPSTACK_EVENT_LOOP_MAX_EPOLL_EVENTS 1024
+
 #else
 
-#if defined(__linux__)
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#define AIPSTACK_EVENT_LOOP_HAS_KQUEUE 1
+#else
+#define AIPSTACK_EVENT_LOOP_HAS_KQUEUE 0
+#endif
+
+#if defined(__linux__) || AIPSTACK_EVENT_LOOP_HAS_KQUEUE
 #define AIPSTACK_EVENT_LOOP_HAS_FD 1
 #else
 #define AIPSTACK_EVENT_LOOP_HAS_FD 0
@@ -66,6 +131,28 @@
 #define AIPSTACK_EVENT_LOOP_HAS_IOCP 0
 #endif
 
+#if defined(__linux__) && defined(AIPSTACK_EVENT_LOOP_USE_IO_URING)
+#define AIPSTACK_EVENT_LOOP_HAS_URING 1
+#else
+#define AIPSTACK_EVENT_LOOP_HAS_URING 0
+#endif
+
+#if defined(AIPSTACK_EVENT_LOOP_USE_TIMER_WHEEL)
+#define AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL 1
+#else
+#define AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL 0
+#endif
+
+#if defined(AIPSTACK_EVENT_LOOP_USE_INSTRUMENTATION)
+#define AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION 1
+#else
+#define AIPSTACK_EVENT_LOOP_HAS_INSTRUMENTATION 0
+#endif
+
+#ifndef AIPSTACK_EVENT_LOOP_MAX_EPOLL_EVENTS
+#define AIPSTACK_EVENT_LOOP_MAX_EPOLL_EVENTS 1024
+#endif
+
 #endif
 
 /** @} */
@@ -74,6 +161,10 @@
 #include <windows.h>
 #endif
 
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+#include <cstdint>
+#endif
+
 namespace AIpStack {
 
 /**
@@ -86,8 +177,8 @@ namespace AIpStack {
  * Type alias for the `std::chrono` clock which is used by the event loop for timers
  * (@ref EventLoopTimer).
  * 
- * Currently this is `std::chrono::steady_clock` on Linux and `std::chrono::system_clock`
- * on Windows. The rationale for such definition is:
+ * Currently this is `std::chrono::system_clock` on Windows and `std::chrono::steady_clock`
+ * on other platforms. The rationale for such definition is:
  * - `steady_clock` is preferrable because @ref EventLoopTimer is intented for relative
  *   timing events (`steady_clock` does not jump).
  * - Windows only has high-precision timer event facilities for UTC-based clocks and not
@@ -121,6 +212,9 @@ public:
     #if AIPSTACK_EVENT_LOOP_HAS_IOCP
     inline bool handleIocpResult (void *completion_key, OVERLAPPED *overlapped);
     #endif
+    #if AIPSTACK_EVENT_LOOP_HAS_URING
+    inline bool handleUringResult (void *uring_resource, std::int32_t res);
+    #endif
 };
 #endif
 
@@ -145,6 +239,14 @@ public:
  * those events could result in an infinite loop. On the other hand, the `Read` and `Write`
  * events are filtered such that they are only reported when they are requested.
  * 
+ * Additionally, `EdgeTriggered` may be included in the requested set (it is never
+ * reported). Events are then only reported when the readiness of the file descriptor
+ * changes (`EPOLLET`, or `EV_CLEAR` with kqueue) instead of whenever it is ready, which avoids redundant reports
+ * for busy file descriptors. In return, the handler must perform I/O until it fails with
+ * `EAGAIN` for every reported event type, otherwise it may not be notified again.
+ * The io_uring based provider ignores this flag and always reports events
+ * level-triggered, which is compatible with that contract.
+ * 
  * Operators provided by @ref AIPSTACK_ENUM_BITFIELD are available.
  */
 enum class EventLoopFdEvents {
@@ -154,6 +256,7 @@ enum class EventLoopFdEvents {
     Error = 1 << 2, /**< Error occurred. */
     Hup   = 1 << 3, /**< Hangup occurred. */
     All   = Read|Write|Error|Hup, /**< Mask of all above event types listed above. */
+    EdgeTriggered = 1 << 4, /**< Request edge-triggered reporting (see above). */
 };
 #ifndef IN_DOXYGEN
 AIPSTACK_ENUM_BITFIELD(EventLoopFdEvents)
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_EVENT_LOOP_RX_SCHEDULER_H
+#define AIPSTACK_EVENT_LOOP_RX_SCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/event_loop/EventLoop.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup event-loop
+ * @{
+ */
+
+class EventLoopRxSource;
+
+/**
+ * Configuration parameters for @ref EventLoopRxScheduler.
+ */
+struct EventLoopRxSchedulerParams {
+    /**
+     * Smallest budget of a source (must be positive).
+     */
+    std::size_t min_budget = 8;
+
+    /**
+     * Largest budget of a source (must be at least @ref min_budget).
+     */
+    std::size_t max_budget = 256;
+
+    /**
+     * Budget of a source when it is constructed (clamped to the range given by
+     * @ref min_budget and @ref max_budget).
+     */
+    std::size_t initial_budget = 64;
+
+    /**
+     * Number of consecutive polls of a source which find no frames after which the
+     * source returns from polling mode to interrupt mode.
+     * 
+     * If zero, a source returns to interrupt mode after any poll which does not
+     * exhaust its budget, like NAPI in Linux. Larger values keep moderately loaded
+     * sources in polling mode, which saves re-arming their wakeup mechanism at the
+     * cost of some extra polls when the load stops.
+     */
+    std::size_t idle_polls = 1;
+};
+
+/**
+ * Statistics of an @ref EventLoopRxScheduler.
+ */
+struct EventLoopRxSchedulerStats {
+    /**
+     * Number of rounds, in each of which every source in polling mode is polled once.
+     */
+    std::uint64_t num_rounds = 0;
+
+    /**
+     * Number of calls of poll handlers.
+     */
+    std::uint64_t num_polls = 0;
+
+    /**
+     * Total number of frames reported by poll handlers.
+     */
+    std::uint64_t num_frames = 0;
+
+    /**
+     * Number of polls which exhausted the budget of the source.
+     */
+    std::uint64_t num_budget_exhausted = 0;
+
+    /**
+     * Number of transitions of sources from interrupt mode to polling mode.
+     */
+    std::uint64_t num_wakeups = 0;
+
+    /**
+     * Number of transitions of sources from polling mode to interrupt mode.
+     */
+    std::uint64_t num_rearms = 0;
+};
+
+/**
+ * Shares receive processing in an event loop fairly between multiple drivers,
+ * adapting between interrupt-like and polling operation according to load.
+ * 
+ * Each driver (such as @ref TapDevice, @ref XdpDevice or a shared-memory ring)
+ * registers an @ref EventLoopRxSource. A source is either in interrupt mode, where
+ * the driver waits for a wakeup (for example readiness of a file descriptor), or in
+ * polling mode, where the scheduler calls its poll handler with a budget, the
+ * maximum number of frames to process in one call. This is the scheme used by NAPI
+ * in Linux:
+ * 
+ * - When the driver is woken up, it disables its wakeup mechanism and calls
+ *   @ref EventLoopRxSource::schedule, which puts the source into polling mode.
+ * - The scheduler polls the sources in polling mode round-robin, each once per
+ *   round, from an @ref EventLoopDeferred. Rounds are separated by a non-blocking
+ *   check for other events, so a busy source cannot monopolize the event loop.
+ * - When a source has been found idle (see @ref EventLoopRxSchedulerParams::idle_polls),
+ *   it returns to interrupt mode and its arm handler is called to re-enable the
+ *   wakeup mechanism.
+ * 
+ * The budget of each source adapts as well: it is doubled (up to
+ * @ref EventLoopRxSchedulerParams::max_budget) after a poll which exhausted it, so
+ * that under high load work is done in large batches, and halved (down to
+ * @ref EventLoopRxSchedulerParams::min_budget) after a poll which used less than a
+ * quarter of it, so that under light load the sources take turns quickly.
+ * 
+ * The @ref EventLoopRxScheduler class does not throw exceptions from any of its
+ * public functions except as noted for the constructor.
+ */
+class EventLoopRxScheduler :
+    private NonCopyable<EventLoopRxScheduler>
+{
+    friend class EventLoopRxSource;
+
+    struct SourceListNodeAccessor;
+    using SourceLinkModel = PointerLinkModel<EventLoopRxSource>;
+    using SourceList = LinkedList<SourceListNodeAccessor, SourceLinkModel, true>;
+    using SourceListNode = LinkedListNode<SourceLinkModel>;
+
+public:
+    /**
+     * Construct the scheduler.
+     * 
+     * @param loop Event loop; it must outlive the scheduler.
+     * @param params Configuration parameters.
+     */
+    EventLoopRxScheduler (EventLoop &loop,
+                          EventLoopRxSchedulerParams const &params =
+                              EventLoopRxSchedulerParams()) :
+        m_params(params),
+        m_deferred(loop, AIPSTACK_BIND_MEMBER(&EventLoopRxScheduler::deferredHandler, this)),
+        m_current_source(nullptr),
+        m_round(0)
+    {
+        AIPSTACK_ASSERT(m_params.min_budget > 0);
+        AIPSTACK_ASSERT(m_params.max_budget >= m_params.min_budget);
+    }
+
+    /**
+     * Destruct the scheduler.
+     * 
+     * All sources must have been destructed.
+     */
+    ~EventLoopRxScheduler ()
+    {
+        AIPSTACK_ASSERT(m_polling_list.isEmpty());
+    }
+
+    /**
+     * Get the configuration parameters.
+     * 
+     * @return Parameters as passed to the constructor.
+     */
+    inline EventLoopRxSchedulerParams const & getParams () const {
+        return m_params;
+    }
+
+    /**
+     * Get statistics.
+     * 
+     * @return Reference to the statistics, which remain valid and are updated as
+     *         sources are polled.
+     */
+    inline EventLoopRxSchedulerStats const & getStats () const {
+        return m_stats;
+    }
+
+private:
+    void deferredHandler ();
+
+private:
+    EventLoopRxSchedulerParams m_params;
+    EventLoopDeferred m_deferred;
+    StructureRaiiWrapper<SourceList> m_polling_list;
+    EventLoopRxSource *m_current_source;
+    std::uint64_t m_round;
+    EventLoopRxSchedulerStats m_stats;
+};
+
+/**
+ * Receive source of a driver, polled by an @ref EventLoopRxScheduler.
+ * 
+ * See @ref EventLoopRxScheduler for an explanation. A source starts in interrupt
+ * mode.
+ * 
+ * The @ref EventLoopRxSource class does not throw exceptions from any of its public
+ * functions including the constructor.
+ */
+class EventLoopRxSource :
+    private NonCopyable<EventLoopRxSource>
+{
+    friend class EventLoopRxScheduler;
+
+    AIPSTACK_USE_TYPES(EventLoopRxScheduler, (SourceListNode))
+
+public:
+    /**
+     * Type of callback function used to poll the source.
+     * 
+     * The callback should process up to `budget` received frames and return the
+     * number processed; returning `budget` means that there may be more. It may
+     * call @ref schedule, which has no effect in this case.
+     * 
+     * The callback is always called asynchronously (not from any public member
+     * function).
+     * 
+     * @param budget Maximum number of frames to process (positive).
+     * @return Number of frames processed (at most `budget`).
+     */
+    using PollHandler = Function<std::size_t(std::size_t budget)>;
+
+    /**
+     * Type of callback function used when the source returns to interrupt mode.
+     * 
+     * The callback should re-enable the wakeup mechanism of the driver, such that
+     * @ref schedule will be called when there are frames to receive (including
+     * frames which arrived while the source was in polling mode). It may call
+     * @ref schedule directly.
+     * 
+     * The callback is always called asynchronously (not from any public member
+     * function).
+     */
+    using ArmHandler = Function<void()>;
+
+    /**
+     * Construct the source.
+     * 
+     * @param scheduler Scheduler; it must outlive the source.
+     * @param poll_handler Callback used to poll the source (must not be null).
+     * @param arm_handler Callback used when the source returns to interrupt mode
+     *        (must not be null).
+     */
+    EventLoopRxSource (EventLoopRxScheduler &scheduler, PollHandler poll_handler,
+                       ArmHandler arm_handler) :
+        m_scheduler(scheduler),
+        m_poll_handler(poll_handler),
+        m_arm_handler(arm_handler),
+        m_budget(MaxValue(scheduler.m_params.min_budget,
+            MinValue(scheduler.m_params.initial_budget, scheduler.m_params.max_budget))),
+        m_idle_polls(0),
+        m_round(0),
+        m_polling(false)
+    {}
+
+    /**
+     * Destruct the source.
+     * 
+     * The callbacks will not be called after destruction. This may be done from
+     * within the poll handler.
+     */
+    ~EventLoopRxSource ()
+    {
+        if (m_scheduler.m_current_source == this) {
+            // Destructed from the poll handler, the source is not in the list.
+            m_scheduler.m_current_source = nullptr;
+        }
+        else if (m_polling) {
+            m_scheduler.m_polling_list.remove(*this);
+        }
+    }
+
+    /**
+     * Put the source into polling mode.
+     * 
+     * This should be called by the driver when it is woken up in interrupt mode, after
+     * disabling its wakeup mechanism. If the source is already in polling mode, this
+     * has no effect.
+     */
+    void schedule ()
+    {
+        if (m_polling) {
+            return;
+        }
+
+        m_polling = true;
+        m_idle_polls = 0;
+        m_scheduler.m_polling_list.append(*this);
+        m_scheduler.m_stats.num_wakeups++;
+
+        if (!m_scheduler.m_deferred.isScheduled()) {
+            m_scheduler.m_deferred.schedule();
+        }
+    }
+
+    /**
+     * Check whether the source is in polling mode.
+     * 
+     * @return True if in polling mode, false if in interrupt mode.
+     */
+    inline bool isPolling () const {
+        return m_polling;
+    }
+
+    /**
+     * Get the current budget.
+     * 
+     * @return The budget which will be passed to the next call of the poll handler.
+     */
+    inline std::size_t getBudget () const {
+        return m_budget;
+    }
+
+private:
+    SourceListNode m_list_node;
+    EventLoopRxScheduler &m_scheduler;
+    PollHandler m_poll_handler;
+    ArmHandler m_arm_handler;
+    std::size_t m_budget;
+    std::size_t m_idle_polls;
+    std::uint64_t m_round;
+    bool m_polling;
+};
+
+#ifndef IN_DOXYGEN
+
+struct EventLoopRxScheduler::SourceListNodeAccessor : public MemberAccessor<
+    EventLoopRxSource, SourceListNode, &EventLoopRxSource::m_list_node> {};
+
+inline void EventLoopRxScheduler::deferredHandler ()
+{
+    m_stats.num_rounds++;
+    m_round++;
+
+    // Poll each source which was in polling mode at the start of the round once.
+    // Sources which remain in polling mode are moved to the end of the list, and
+    // sources which enter polling mode during the round are polled after those.
+    while (!m_polling_list.isEmpty()) {
+        EventLoopRxSource &source = *m_polling_list.first();
+        if (source.m_round == m_round) {
+            break;
+        }
+
+        // The source remains marked as polling while its handler is called, so that
+        // schedule() has no effect.
+        m_polling_list.removeFirst();
+        source.m_round = m_round;
+
+        std::size_t budget = source.m_budget;
+
+        m_current_source = &source;
+        std::size_t count = source.m_poll_handler(budget);
+        AIPSTACK_ASSERT(count <= budget);
+
+        m_stats.num_polls++;
+        m_stats.num_frames += count;
+
+        if (m_current_source == nullptr) {
+            // The source was destructed by the poll handler.
+            continue;
+        }
+        m_current_source = nullptr;
+
+        if (count == budget) {
+            m_stats.num_budget_exhausted++;
+            source.m_budget = MinValue(2 * budget, m_params.max_budget);
+        }
+        else if (count < budget / 4) {
+            source.m_budget = MaxValue(budget / 2, m_params.min_budget);
+        }
+
+        bool keep_polling;
+        if (count == budget) {
+            source.m_idle_polls = 0;
+            keep_polling = true;
+        }
+        else if (m_params.idle_polls == 0) {
+            keep_polling = false;
+        }
+        else if (count > 0) {
+            source.m_idle_polls = 0;
+            keep_polling = true;
+        }
+        else {
+            source.m_idle_polls++;
+            keep_polling = source.m_idle_polls < m_params.idle_polls;
+        }
+
+        if (keep_polling) {
+            m_polling_list.append(source);
+        } else {
+            source.m_polling = false;
+            m_stats.num_rearms++;
+            source.m_arm_handler();
+        }
+    }
+
+    // If any sources are still polling, continue in the next event loop iteration,
+    // after other events have been checked for.
+    if (!m_polling_list.isEmpty()) {
+        m_deferred.schedule();
+    }
+}
+
+#endif
+
+/** @} */
+
+}
+
+#endif
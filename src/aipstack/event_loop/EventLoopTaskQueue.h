@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_EVENT_LOOP_TASK_QUEUE_H
+#define AIPSTACK_EVENT_LOOP_TASK_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/event_loop/EventLoop.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup event-loop
+ * @{
+ */
+
+/**
+ * Bounded queue of tasks submitted from arbitrary threads and executed in the event
+ * loop.
+ * 
+ * Tasks are submitted using @ref trySubmit, which may be called from any thread and is
+ * lock-free. Submitted tasks are executed in the event loop in the order of
+ * submission, in batches of up to a configured number of tasks per event loop
+ * iteration, so that a high rate of submissions does not starve other events.
+ * 
+ * The queue has a fixed capacity; when it is full, @ref trySubmit fails and the
+ * producer is responsible for reacting (backpressure), for example by retrying later
+ * or throttling its own work.
+ * 
+ * Internally, a ring buffer of slots with per-slot sequence numbers is used, which
+ * supports multiple concurrent producers and the event loop as the single consumer.
+ * Wakeup of the event loop uses an @ref EventLoopAsyncSignal.
+ * 
+ * @tparam Task Type of tasks. A task is executed by invoking it with no arguments
+ *         (`task()`). It must be default-constructible and nothrow move-assignable.
+ *         The default is `Function<void()>`, but a custom type can be used to carry
+ *         more data than fits into @ref Function.
+ */
+template <typename Task = Function<void()>>
+class EventLoopTaskQueue :
+    private NonCopyable<EventLoopTaskQueue<Task>>
+{
+    static_assert(std::is_default_constructible_v<Task>);
+    static_assert(std::is_nothrow_move_assignable_v<Task>);
+
+    struct Slot {
+        std::atomic<std::size_t> seq;
+        Task task;
+    };
+
+public:
+    /**
+     * Construct the task queue.
+     * 
+     * @param loop Event loop; it must outlive the task queue.
+     * @param capacity Minimum number of tasks which can be queued (must be positive).
+     *        It is rounded up to a power of two.
+     * @param max_batch Maximum number of tasks to execute in one event loop iteration
+     *        (must be positive).
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    EventLoopTaskQueue (EventLoop &loop, std::size_t capacity, std::size_t max_batch) :
+        m_async_signal(loop, AIPSTACK_BIND_MEMBER_TN(
+            &EventLoopTaskQueue::asyncSignalHandler, this)),
+        m_capacity(round_capacity(capacity)),
+        m_max_batch(max_batch),
+        m_slots(new Slot[m_capacity]),
+        m_enqueue_pos(0),
+        m_dequeue_pos(0)
+    {
+        AIPSTACK_ASSERT(max_batch > 0);
+
+        for (std::size_t i = 0; i < m_capacity; i++) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Destruct the task queue.
+     * 
+     * Any tasks which have not been executed yet are discarded.
+     * 
+     * @note It is the responsibility of the application to not call @ref trySubmit on a
+     * destructed task queue or one which may be destructed during the call.
+     */
+    ~EventLoopTaskQueue () = default;
+
+    /**
+     * Get the capacity of the queue.
+     * 
+     * @return Capacity (the requested capacity rounded up to a power of two).
+     */
+    inline std::size_t getCapacity () const {
+        return m_capacity;
+    }
+
+    /**
+     * Submit a task for execution in the event loop.
+     * 
+     * This function is specifically thread-safe and lock-free. However be careful with
+     * destruction of the task queue (see the note in the destructor).
+     * 
+     * @param task Task to execute. It is moved from only if submission succeeds.
+     * @return True if the task was queued, false if the queue is full.
+     */
+    bool trySubmit (Task &task)
+    {
+        std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        Slot *slot;
+
+        while (true) {
+            slot = &m_slots[pos & (m_capacity - 1)];
+            std::size_t seq = slot->seq.load(std::memory_order_acquire);
+            auto diff = std::intptr_t(seq) - std::intptr_t(pos);
+
+            if (diff == 0) {
+                // The slot is free for this position, try to claim it.
+                if (m_enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                // The slot still holds a task from the previous round, queue is full.
+                return false;
+            }
+            else {
+                // Another producer claimed this position, retry with the latest one.
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->task = std::move(task);
+        slot->seq.store(pos + 1, std::memory_order_release);
+
+        m_async_signal.signal();
+
+        return true;
+    }
+
+    /**
+     * Submit a task for execution in the event loop (rvalue version).
+     * 
+     * This is like @ref trySubmit(Task &) but accepts a temporary.
+     * 
+     * @param task Task to execute.
+     * @return True if the task was queued, false if the queue is full.
+     */
+    inline bool trySubmit (Task &&task)
+    {
+        return trySubmit(task);
+    }
+
+private:
+    static std::size_t round_capacity (std::size_t capacity)
+    {
+        AIPSTACK_ASSERT(capacity > 0);
+
+        std::size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded *= 2;
+        }
+        return rounded;
+    }
+
+    bool dequeue (Task &task)
+    {
+        Slot &slot = m_slots[m_dequeue_pos & (m_capacity - 1)];
+        std::size_t seq = slot.seq.load(std::memory_order_acquire);
+
+        if (seq != m_dequeue_pos + 1) {
+            return false;
+        }
+
+        task = std::move(slot.task);
+        slot.seq.store(m_dequeue_pos + m_capacity, std::memory_order_release);
+        m_dequeue_pos++;
+
+        return true;
+    }
+
+    void asyncSignalHandler ()
+    {
+        for (std::size_t i = 0; i < m_max_batch; i++) {
+            Task task;
+            if (!dequeue(task)) {
+                return;
+            }
+
+            // If the task throws, make sure remaining tasks are not forgotten.
+            try {
+                task();
+            } catch (...) {
+                m_async_signal.signal();
+                throw;
+            }
+        }
+
+        // Batch limit reached, continue in the next event loop iteration. If the queue
+        // happens to be empty this just results in a spurious call.
+        m_async_signal.signal();
+    }
+
+private:
+    EventLoopAsyncSignal m_async_signal;
+    std::size_t const m_capacity;
+    std::size_t const m_max_batch;
+    std::unique_ptr<Slot[]> const m_slots;
+    std::atomic<std::size_t> m_enqueue_pos;
+    std::size_t m_dequeue_pos;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -24,13 +24,13 @@
 
 #include <aipstack/event_loop/SignalCommon.h>
 
-#if defined(__linux__)
+#if defined(__linux__) || AIPSTACK_EVENT_LOOP_HAS_KQUEUE
 #include <signal.h>
 #endif
 
 namespace AIpStack {
 
-#if defined(__linux__)
+#if defined(__linux__) || AIPSTACK_EVENT_LOOP_HAS_KQUEUE
 
 #define AIPSTACK_FOR_ALL_SIGNALS(X) \
     X(SignalType::Interrupt,    SIGINT) \
@@ -25,12 +25,13 @@
 #ifndef AIPSTACK_SIGNAL_COMMON_H
 #define AIPSTACK_SIGNAL_COMMON_H
 
-#if defined(__linux__)
+#include <aipstack/misc/EnumBitfieldUtils.h>
+#include <aipstack/event_loop/EventLoopCommon.h>
+
+#if defined(__linux__) || AIPSTACK_EVENT_LOOP_HAS_KQUEUE
 #include <signal.h>
 #endif
 
-#include <aipstack/misc/EnumBitfieldUtils.h>
-
 namespace AIpStack {
 
 /**
@@ -104,7 +105,7 @@ char const * nativeNameForSignalType(SignalType signal);
 
 #ifndef IN_DOXYGEN
 
-#if defined(__linux__)
+#if defined(__linux__) || AIPSTACK_EVENT_LOOP_HAS_KQUEUE
 
 int signalTypeToSignum(SignalType signal);
 
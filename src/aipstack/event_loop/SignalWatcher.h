@@ -32,6 +32,8 @@
 
 #if defined(__linux__)
 #include <aipstack/event_loop/platform_specific/SignalWatcherImplLinux.h>
+#elif AIPSTACK_EVENT_LOOP_HAS_KQUEUE
+#include <aipstack/event_loop/platform_specific/SignalWatcherImplKqueue.h>
 #elif defined(_WIN32)
 #include <aipstack/event_loop/platform_specific/SignalWatcherImplWindows.h>
 #else
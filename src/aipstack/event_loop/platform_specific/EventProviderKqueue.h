@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_EVENT_PROVIDER_KQUEUE_H
+#define AIPSTACK_EVENT_PROVIDER_KQUEUE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/event_loop/EventLoopCommon.h>
+
+namespace AIpStack {
+
+class EventProviderKqueueFd;
+
+class EventProviderKqueue :
+    public EventProviderBase,
+    private NonCopyable<EventProviderKqueue>
+{
+    friend class EventProviderKqueueFd;
+    
+    // The number of events obtained by one kevent call starts at InitialKqueueEvents and
+    // is doubled whenever a call fills the buffer, up to MaxKqueueEvents.
+    inline static constexpr int InitialKqueueEvents = 64;
+    inline static constexpr int MaxKqueueEvents = AIPSTACK_EVENT_LOOP_MAX_EPOLL_EVENTS;
+    static_assert(MaxKqueueEvents >= 1);
+
+    // Identifiers of the timer (EVFILT_TIMER) and user event (EVFILT_USER).
+    inline static constexpr std::uintptr_t TimerIdent = 1;
+    inline static constexpr std::uintptr_t UserIdent = 1;
+
+public:
+    EventProviderKqueue ();
+
+    ~EventProviderKqueue ();
+
+    void waitForEvents (EventLoopTime wait_time);
+
+    bool pollForEvents ();
+
+    bool dispatchEvents ();
+
+    void signalToCheckAsyncSignals ();
+
+private:
+    void add_change (std::uintptr_t ident, short filter, unsigned short flags,
+                     unsigned int fflags, std::intptr_t data, void *udata);
+
+    int wait_kqueue (struct timespec const *timeout);
+
+private:
+    FileDescriptorWrapper m_kqueue_fd;
+    EventLoopTime m_timer_time;
+    bool m_timer_armed;
+    int m_cur_kqueue_event;
+    int m_num_kqueue_events;
+    std::vector<struct kevent> m_changes;
+    std::vector<struct kevent> m_kqueue_events;
+};
+
+class EventProviderKqueueFd :
+    public EventProviderFdBase,
+    private NonCopyable<EventProviderKqueueFd>
+{
+public:
+    void initFdImpl (int fd, EventLoopFdEvents events);
+
+    void updateEventsImpl (EventLoopFdEvents events);
+
+    void resetImpl ();
+
+private:
+    inline EventProviderKqueue & getProvider () const;
+
+    void update_filter (int fd, EventLoopFdEvents cur_events, EventLoopFdEvents events,
+                        EventLoopFdEvents type, short filter);
+};
+
+using EventProvider = EventProviderKqueue;
+using EventProviderFd = EventProviderKqueueFd;
+
+#define AIPSTACK_EVENT_PROVIDER_IMPL_FILE \
+    <aipstack/event_loop/platform_specific/EventProviderKqueue_impl.h>
+
+}
+
+#endif
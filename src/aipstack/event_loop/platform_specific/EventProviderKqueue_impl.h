@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/event_loop/EventLoopCommon.h>
+#include <aipstack/event_loop/platform_specific/EventProviderKqueue.h>
+
+namespace AIpStack {
+
+namespace EventProviderKqueuePriv {
+
+inline EventLoopFdEvents get_events_to_report (
+    struct kevent const &ev, EventLoopFdEvents req_ev)
+{
+    EventLoopFdEvents events = EventLoopFdEvents();
+    if (ev.filter == EVFILT_READ && (req_ev & EventLoopFdEvents::Read) != Enum0) {
+        events |= EventLoopFdEvents::Read;
+    }
+    if (ev.filter == EVFILT_WRITE && (req_ev & EventLoopFdEvents::Write) != Enum0) {
+        events |= EventLoopFdEvents::Write;
+    }
+    if ((ev.flags & EV_EOF) != 0) {
+        events |= EventLoopFdEvents::Hup;
+        // For sockets, a pending socket error is reported in fflags.
+        if (ev.fflags != 0) {
+            events |= EventLoopFdEvents::Error;
+        }
+    }
+    return events;
+}
+
+}
+
+EventProviderKqueue::EventProviderKqueue () :
+    m_timer_time(EventLoopTime::max()),
+    m_timer_armed(false),
+    m_cur_kqueue_event(0),
+    m_num_kqueue_events(0),
+    m_kqueue_events(std::size_t(MinValue(InitialKqueueEvents, MaxKqueueEvents)))
+{
+    m_kqueue_fd = FileDescriptorWrapper(::kqueue());
+    if (!m_kqueue_fd) {
+        throw std::runtime_error(formatString(
+            "EventProviderKqueue: kqueue failed, err=%d", errno));
+    }
+
+    if (::fcntl(*m_kqueue_fd, F_SETFD, FD_CLOEXEC) < 0) {
+        throw std::runtime_error(formatString(
+            "EventProviderKqueue: fcntl(F_SETFD) failed, err=%d", errno));
+    }
+
+    // Register the user event used by signalToCheckAsyncSignals right away, since
+    // that may be called from other threads before the first wait.
+    struct kevent ev;
+    EV_SET(&ev, UserIdent, EVFILT_USER, EV_ADD|EV_CLEAR, 0, 0, nullptr);
+    if (::kevent(*m_kqueue_fd, &ev, 1, nullptr, 0, nullptr) < 0) {
+        throw std::runtime_error(formatString(
+            "EventProviderKqueue: kevent failed to add EVFILT_USER, err=%d", errno));
+    }
+}
+
+EventProviderKqueue::~EventProviderKqueue ()
+{}
+
+void EventProviderKqueue::waitForEvents (EventLoopTime wait_time)
+{
+    AIPSTACK_ASSERT(m_cur_kqueue_event == m_num_kqueue_events);
+
+    namespace chrono = std::chrono;
+    using Period = EventLoopTime::period;
+    using NsecDuration = chrono::duration<std::intptr_t, std::nano>;
+
+    static_assert(Period::num == 1);
+    static_assert(Period::den <= std::nano::den);
+
+    if (wait_time == EventLoopTime::max()) {
+        if (m_timer_armed) {
+            add_change(TimerIdent, EVFILT_TIMER, EV_DELETE, 0, 0, nullptr);
+            m_timer_armed = false;
+        }
+    }
+    else if (!m_timer_armed || wait_time != m_timer_time) {
+        // EVFILT_TIMER does not support absolute times of this clock on all
+        // platforms, so the timer is armed relative to the current time.
+        EventLoopTime now = EventLoopClock::now();
+
+        std::intptr_t nsec = 1;
+        if (wait_time > now) {
+            EventLoopDuration rem = wait_time - now;
+            EventLoopDuration max_rem =
+                chrono::duration_cast<EventLoopDuration>(NsecDuration::max());
+            nsec = chrono::duration_cast<NsecDuration>(MinValue(rem, max_rem)).count();
+            // Prevent a zero timeout, which might not be accepted.
+            nsec = MaxValue(nsec, std::intptr_t(1));
+        }
+
+        add_change(TimerIdent, EVFILT_TIMER, EV_ADD|EV_ONESHOT, NOTE_NSECONDS, nsec,
+                   nullptr);
+
+        m_timer_time = wait_time;
+        m_timer_armed = true;
+    }
+
+    wait_kqueue(nullptr);
+}
+
+bool EventProviderKqueue::pollForEvents ()
+{
+    AIPSTACK_ASSERT(m_cur_kqueue_event == m_num_kqueue_events);
+
+    struct timespec timeout = {};
+    return wait_kqueue(&timeout) > 0;
+}
+
+bool EventProviderKqueue::dispatchEvents ()
+{
+    using namespace EventProviderKqueuePriv;
+
+    while (m_cur_kqueue_event < m_num_kqueue_events) {
+        struct kevent *ev = &m_kqueue_events[m_cur_kqueue_event++];
+
+        if ((ev->flags & EV_ERROR) != 0) {
+            // Failure of a change which was submitted with the wait. Failures to remove
+            // registrations are expected when the file descriptor has been closed in
+            // the meantime and are ignored (these changes have no udata).
+            if (ev->data == 0) {
+                continue;
+            }
+            if (ev->filter == EVFILT_TIMER) {
+                if (ev->data == ENOENT) {
+                    continue;
+                }
+                throw std::runtime_error(formatString(
+                    "EventProviderKqueue: kevent failed to arm EVFILT_TIMER, err=%d",
+                    int(ev->data)));
+            }
+            if (ev->udata == nullptr) {
+                continue;
+            }
+
+            // Failure to register a file descriptor is reported as an error event.
+            auto &fd = *static_cast<EventProviderKqueueFd *>(ev->udata);
+            fd.EventProviderFdBase::sanityCheck();
+
+            if (!fd.EventProviderFdBase::callFdEventHandler(EventLoopFdEvents::Error)) {
+                return false;
+            }
+        }
+        else if (ev->filter == EVFILT_TIMER) {
+            // The timer is one-shot, so it needs to be armed before the next wait.
+            m_timer_armed = false;
+        }
+        else if (ev->filter == EVFILT_USER) {
+            if (!EventProviderBase::dispatchAsyncSignals()) {
+                return false;
+            }
+        }
+        else {
+            if (ev->udata == nullptr) {
+                continue;
+            }
+
+            auto &fd = *static_cast<EventProviderKqueueFd *>(ev->udata);
+            fd.EventProviderFdBase::sanityCheck();
+
+            EventLoopFdEvents events =
+                get_events_to_report(*ev, fd.EventProviderFdBase::getFdEvents());
+
+            if (events != Enum0) {
+                if (!fd.EventProviderFdBase::callFdEventHandler(events)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+void EventProviderKqueue::signalToCheckAsyncSignals ()
+{
+    // This may be called from any thread so it cannot go through the changelist.
+    struct kevent ev;
+    EV_SET(&ev, UserIdent, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
+
+    if (AIPSTACK_UNLIKELY(::kevent(*m_kqueue_fd, &ev, 1, nullptr, 0, nullptr) < 0)) {
+        std::fprintf(stderr,
+            "EventProviderKqueue: kevent failed to trigger EVFILT_USER, err=%d\n", errno);
+    }
+}
+
+void EventProviderKqueue::add_change (std::uintptr_t ident, short filter,
+    unsigned short flags, unsigned int fflags, std::intptr_t data, void *udata)
+{
+    struct kevent ev;
+    EV_SET(&ev, ident, filter, flags, fflags, data, udata);
+    m_changes.push_back(ev);
+}
+
+int EventProviderKqueue::wait_kqueue (struct timespec const *timeout)
+{
+    // If the previous call filled the buffer, there were likely more events ready,
+    // so get more events at once from now on. The previous events have been
+    // dispatched so the buffer can be replaced.
+    int max_events = int(m_kqueue_events.size());
+    if (m_num_kqueue_events == max_events && max_events < MaxKqueueEvents) {
+        max_events = MinValue(2 * max_events, MaxKqueueEvents);
+    }
+
+    // Failed changes are returned in the event list, and kevent fails if they do not
+    // fit, so make sure there is space for all of them.
+    max_events = MaxValue(max_events, int(m_changes.size()));
+
+    if (std::size_t(max_events) != m_kqueue_events.size()) {
+        m_kqueue_events.resize(std::size_t(max_events));
+    }
+
+    int wait_res;
+    while (true) {
+        wait_res = ::kevent(*m_kqueue_fd, m_changes.data(), int(m_changes.size()),
+                            m_kqueue_events.data(), max_events, timeout);
+
+        // The changes are applied before waiting, so they must not be submitted again
+        // if the wait is interrupted.
+        m_changes.clear();
+
+        if (AIPSTACK_LIKELY(wait_res >= 0)) {
+            break;
+        }
+
+        int err = errno;
+        if (err != EINTR) {
+            throw std::runtime_error(formatString(
+                "EventProviderKqueue: kevent failed, err=%d", err));
+        }
+    }
+
+    AIPSTACK_ASSERT(wait_res <= max_events);
+
+    m_cur_kqueue_event = 0;
+    m_num_kqueue_events = wait_res;
+
+    return wait_res;
+}
+
+void EventProviderKqueueFd::initFdImpl (int fd, EventLoopFdEvents events)
+{
+    // The registration is submitted with the next wait, and if it fails, that is
+    // reported as an error event (see dispatchEvents).
+    update_filter(fd, EventLoopFdEvents(), events, EventLoopFdEvents::Read, EVFILT_READ);
+    update_filter(fd, EventLoopFdEvents(), events, EventLoopFdEvents::Write, EVFILT_WRITE);
+}
+
+void EventProviderKqueueFd::updateEventsImpl (EventLoopFdEvents events)
+{
+    int fd = EventProviderFdBase::getFd();
+    EventLoopFdEvents cur_events = EventProviderFdBase::getFdEvents();
+
+    update_filter(fd, cur_events, events, EventLoopFdEvents::Read, EVFILT_READ);
+    update_filter(fd, cur_events, events, EventLoopFdEvents::Write, EVFILT_WRITE);
+}
+
+void EventProviderKqueueFd::resetImpl ()
+{
+    EventProviderKqueue &prov = getProvider();
+
+    int fd = EventProviderFdBase::getFd();
+    EventLoopFdEvents cur_events = EventProviderFdBase::getFdEvents();
+
+    // Drop changes for this file descriptor which have not been submitted yet.
+    prov.m_changes.erase(std::remove_if(prov.m_changes.begin(), prov.m_changes.end(),
+        [&](struct kevent const &ev) { return ev.udata == this; }),
+        prov.m_changes.end());
+
+    // Remove the registrations with the next wait. The file descriptor may be closed
+    // before that, which removes them anyway, and then the failures are ignored.
+    update_filter(fd, cur_events, EventLoopFdEvents(), EventLoopFdEvents::Read,
+                  EVFILT_READ);
+    update_filter(fd, cur_events, EventLoopFdEvents(), EventLoopFdEvents::Write,
+                  EVFILT_WRITE);
+
+    // Set the udata pointer in any unprocessed events for this file descriptor to
+    // inhibit their processing.
+    for (int i = prov.m_cur_kqueue_event; i < prov.m_num_kqueue_events; i++) {
+        struct kevent &ev = prov.m_kqueue_events[std::size_t(i)];
+        if (ev.udata == this) {
+            ev.udata = nullptr;
+        }
+    }
+}
+
+EventProviderKqueue & EventProviderKqueueFd::getProvider () const
+{
+    return static_cast<EventProviderKqueue &>(EventProviderFdBase::getProvider());
+}
+
+void EventProviderKqueueFd::update_filter (int fd, EventLoopFdEvents cur_events,
+    EventLoopFdEvents events, EventLoopFdEvents type, short filter)
+{
+    EventProviderKqueue &prov = getProvider();
+
+    bool cur_enabled = (cur_events & type) != Enum0;
+    bool enabled = (events & type) != Enum0;
+    bool cur_edge = (cur_events & EventLoopFdEvents::EdgeTriggered) != Enum0;
+    bool edge = (events & EventLoopFdEvents::EdgeTriggered) != Enum0;
+
+    std::uintptr_t ident = std::uintptr_t(fd);
+
+    if (enabled) {
+        // EV_ADD also modifies an existing registration.
+        if (!cur_enabled || edge != cur_edge) {
+            unsigned short flags = EV_ADD | (edge ? EV_CLEAR : 0);
+            prov.add_change(ident, filter, flags, 0, 0, this);
+        }
+    }
+    else if (cur_enabled) {
+        prov.add_change(ident, filter, EV_DELETE, 0, 0, nullptr);
+    }
+}
+
+}
@@ -26,7 +26,9 @@
 #define AIPSTACK_EVENT_PROVIDER_LINUX_H
 
 #include <cstdint>
+#include <vector>
 
+#include <time.h>
 #include <sys/epoll.h>
 
 #include <aipstack/misc/NonCopyable.h>
@@ -43,7 +45,11 @@ class EventProviderLinux :
 {
     friend class EventProviderLinuxFd;
     
-    inline static constexpr int MaxEpollEvents = 64;
+    // The number of events obtained by one epoll_wait starts at InitialEpollEvents and
+    // is doubled whenever a call fills the buffer, up to MaxEpollEvents.
+    inline static constexpr int InitialEpollEvents = 64;
+    inline static constexpr int MaxEpollEvents = AIPSTACK_EVENT_LOOP_MAX_EPOLL_EVENTS;
+    static_assert(MaxEpollEvents >= 1);
 
 public:
     EventProviderLinux ();
@@ -52,6 +58,8 @@ public:
 
     void waitForEvents (EventLoopTime wait_time);
 
+    bool pollForEvents ();
+
     bool dispatchEvents ();
 
     void signalToCheckAsyncSignals ();
@@ -59,7 +67,17 @@ public:
 private:
     void control_epoll (int op, int fd, std::uint32_t events, void *data_ptr);
 
+    void update_timerfd (EventLoopTime wait_time);
+
+    int wait_epoll (struct timespec const *timeout);
+
+    int call_epoll_pwait2 (int max_events, struct timespec const *timeout);
+
 private:
+    // With epoll_pwait2 (Linux 5.11 or later) the timeout is passed to each wait call
+    // and m_timer_fd is not used. Otherwise the timerfd is armed to the earliest timer
+    // expiration and registered in the epoll set.
+    bool m_use_pwait2;
     FileDescriptorWrapper m_epoll_fd;
     FileDescriptorWrapper m_timer_fd;
     FileDescriptorWrapper m_event_fd;
@@ -67,7 +85,7 @@ private:
     bool m_force_timerfd_update;
     int m_cur_epoll_event;
     int m_num_epoll_events;
-    struct epoll_event m_epoll_events[MaxEpollEvents];
+    std::vector<struct epoll_event> m_epoll_events;
 };
 
 class EventProviderLinuxFd :
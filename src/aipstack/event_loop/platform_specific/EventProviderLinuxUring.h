@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_EVENT_PROVIDER_LINUX_URING_H
+#define AIPSTACK_EVENT_PROVIDER_LINUX_URING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/event_loop/EventLoopCommon.h>
+
+namespace AIpStack {
+
+class EventProviderLinuxUringFd;
+
+class EventProviderLinuxUring :
+    public EventProviderBase,
+    private NonCopyable<EventProviderLinuxUring>
+{
+    friend class EventProviderLinuxUringFd;
+    
+    inline static constexpr unsigned RingEntries = 256;
+
+    // The low bits of the user_data of submissions identify what the completion
+    // is for. The rest is a pointer to the associated object, if any.
+    enum class UserDataTag : std::uint64_t {
+        Ignore     = 0,
+        EventFd    = 1,
+        Poll       = 2,
+        UringOp    = 3,
+    };
+    inline static constexpr std::uint64_t UserDataTagMask = 3;
+
+    // Poll request for an fd-watcher. This is separate from the fd-watcher because
+    // a poll may still be in progress when the fd-watcher is reset or destructed.
+    struct PollEntry {
+        EventProviderLinuxUringFd *fd;
+        bool armed;
+    };
+
+    class MappedRegion :
+        private NonCopyable<MappedRegion>
+    {
+    public:
+        MappedRegion ();
+        ~MappedRegion ();
+        void map (int fd, std::size_t len, std::uint64_t offset);
+        inline char * ptr () const { return m_ptr; }
+
+    private:
+        char *m_ptr;
+        std::size_t m_len;
+    };
+
+public:
+    EventProviderLinuxUring ();
+
+    ~EventProviderLinuxUring ();
+
+    void waitForEvents (EventLoopTime wait_time);
+
+    bool pollForEvents ();
+
+    bool dispatchEvents ();
+
+    void signalToCheckAsyncSignals ();
+
+    void submitUringOp (struct io_uring_sqe const &sqe, void *uring_resource);
+
+    void cancelUringOp (void *uring_resource);
+
+    bool registerUringBuffers (
+        struct iovec const *iovecs, unsigned num_iovecs, int &out_error);
+
+    inline bool hasDetachedPolls () const {
+        return m_num_detached_polls > 0;
+    }
+
+private:
+    static std::uint64_t make_user_data (UserDataTag tag, void *ptr);
+
+    void queue_sqe (struct io_uring_sqe const &sqe);
+
+    unsigned get_num_unsubmitted () const;
+
+    void submit_unsubmitted ();
+
+    void arm_event_fd_poll ();
+
+    void arm_poll (PollEntry *entry, int fd, EventLoopFdEvents events);
+
+    void detach_poll (PollEntry *entry);
+
+    bool dispatch_poll_result (PollEntry *entry, std::int32_t res);
+
+private:
+    FileDescriptorWrapper m_ring_fd;
+    FileDescriptorWrapper m_event_fd;
+    MappedRegion m_sq_ring;
+    MappedRegion m_cq_ring;
+    MappedRegion m_sqes_region;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    struct io_uring_sqe *m_sqes;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+    unsigned m_sq_local_tail;
+    std::size_t m_num_detached_polls;
+};
+
+class EventProviderLinuxUringFd :
+    public EventProviderFdBase,
+    private NonCopyable<EventProviderLinuxUringFd>
+{
+    friend class EventProviderLinuxUring;
+
+public:
+    void initFdImpl (int fd, EventLoopFdEvents events);
+
+    void updateEventsImpl (EventLoopFdEvents events);
+
+    void resetImpl ();
+
+private:
+    inline EventProviderLinuxUring & getProvider () const;
+
+private:
+    EventProviderLinuxUring::PollEntry *m_poll_entry = nullptr;
+};
+
+using EventProvider = EventProviderLinuxUring;
+using EventProviderFd = EventProviderLinuxUringFd;
+
+#define AIPSTACK_EVENT_PROVIDER_IMPL_FILE \
+    <aipstack/event_loop/platform_specific/EventProviderLinuxUring_impl.h>
+
+}
+
+#endif
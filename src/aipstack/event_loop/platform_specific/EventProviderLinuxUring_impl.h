@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <chrono>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/event_loop/EventLoopCommon.h>
+#include <aipstack/event_loop/platform_specific/EventProviderLinuxUring.h>
+
+namespace AIpStack {
+
+namespace EventProviderLinuxUringPriv {
+
+inline int sys_io_uring_setup (unsigned entries, struct io_uring_params *params)
+{
+    return int(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int sys_io_uring_enter (int ring_fd, unsigned to_submit, unsigned min_complete,
+                               unsigned flags, void const *arg, std::size_t argsz)
+{
+    return int(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                         flags, arg, argsz));
+}
+
+inline int sys_io_uring_register (int ring_fd, unsigned opcode, void const *arg,
+                                  unsigned nr_args)
+{
+    return int(::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+inline std::uint32_t get_events_to_request (EventLoopFdEvents req_ev)
+{
+    std::uint32_t poll_ev = 0;
+    if ((req_ev & EventLoopFdEvents::Read) != Enum0) {
+        poll_ev |= POLLIN;
+    }
+    if ((req_ev & EventLoopFdEvents::Write) != Enum0) {
+        poll_ev |= POLLOUT;
+    }
+    return poll_ev;
+}
+
+inline EventLoopFdEvents get_events_to_report (
+    std::uint32_t poll_ev, EventLoopFdEvents req_ev)
+{
+    EventLoopFdEvents events = EventLoopFdEvents();
+    if ((req_ev & EventLoopFdEvents::Read) != Enum0 && (poll_ev & POLLIN) != 0) {
+        events |= EventLoopFdEvents::Read;
+    }
+    if ((req_ev & EventLoopFdEvents::Write) != Enum0 && (poll_ev & POLLOUT) != 0) {
+        events |= EventLoopFdEvents::Write;
+    }
+    if ((poll_ev & POLLERR) != 0) {
+        events |= EventLoopFdEvents::Error;
+    }
+    if ((poll_ev & POLLHUP) != 0) {
+        events |= EventLoopFdEvents::Hup;
+    }
+    return events;
+}
+
+}
+
+EventProviderLinuxUring::MappedRegion::MappedRegion () :
+    m_ptr(nullptr),
+    m_len(0)
+{}
+
+EventProviderLinuxUring::MappedRegion::~MappedRegion ()
+{
+    if (m_ptr != nullptr) {
+        ::munmap(m_ptr, m_len);
+    }
+}
+
+void EventProviderLinuxUring::MappedRegion::map (
+    int fd, std::size_t len, std::uint64_t offset)
+{
+    AIPSTACK_ASSERT(m_ptr == nullptr);
+
+    void *ptr = ::mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                       fd, off_t(offset));
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error(formatString(
+            "EventProviderLinuxUring: mmap failed, err=%d", errno));
+    }
+
+    m_ptr = static_cast<char *>(ptr);
+    m_len = len;
+}
+
+EventProviderLinuxUring::EventProviderLinuxUring () :
+    m_sq_local_tail(0),
+    m_num_detached_polls(0)
+{
+    using namespace EventProviderLinuxUringPriv;
+
+    struct io_uring_params params = {};
+    m_ring_fd = FileDescriptorWrapper(sys_io_uring_setup(RingEntries, &params));
+    if (!m_ring_fd) {
+        throw std::runtime_error(formatString(
+            "EventProviderLinuxUring: io_uring_setup failed, err=%d", errno));
+    }
+
+    // We need IORING_ENTER_EXT_ARG for waiting with a timeout, and no dropping of
+    // completions since losing one would break the fd-watcher and op accounting.
+    std::uint32_t required_features = IORING_FEAT_EXT_ARG|IORING_FEAT_NODROP;
+    if ((params.features & required_features) != required_features) {
+        throw std::runtime_error(
+            "EventProviderLinuxUring: io_uring lacks required features");
+    }
+
+    std::size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    std::size_t cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // With IORING_FEAT_SINGLE_MMAP the SQ and CQ rings are in one mapping.
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_ring_size = MaxValue(sq_ring_size, cq_ring_size);
+    }
+
+    m_sq_ring.map(*m_ring_fd, sq_ring_size, IORING_OFF_SQ_RING);
+    char *cq_ptr;
+    if (single_mmap) {
+        cq_ptr = m_sq_ring.ptr();
+    } else {
+        m_cq_ring.map(*m_ring_fd, cq_ring_size, IORING_OFF_CQ_RING);
+        cq_ptr = m_cq_ring.ptr();
+    }
+    m_sqes_region.map(*m_ring_fd,
+        params.sq_entries * sizeof(struct io_uring_sqe), IORING_OFF_SQES);
+
+    char *sq_ptr = m_sq_ring.ptr();
+    m_sq_head = reinterpret_cast<unsigned *>(sq_ptr + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned *>(sq_ptr + params.sq_off.tail);
+    m_sq_mask = *reinterpret_cast<unsigned *>(sq_ptr + params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_sqes = reinterpret_cast<struct io_uring_sqe *>(m_sqes_region.ptr());
+    m_cq_head = reinterpret_cast<unsigned *>(cq_ptr + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned *>(cq_ptr + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<unsigned *>(cq_ptr + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe *>(cq_ptr + params.cq_off.cqes);
+
+    // SQ array entries always refer to the SQE at the same index.
+    unsigned *sq_array = reinterpret_cast<unsigned *>(sq_ptr + params.sq_off.array);
+    for (unsigned i = 0; i < m_sq_entries; i++) {
+        sq_array[i] = i;
+    }
+
+    m_sq_local_tail = *m_sq_tail;
+
+    m_event_fd = FileDescriptorWrapper(::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC));
+    if (!m_event_fd) {
+        throw std::runtime_error(formatString(
+            "EventProviderLinuxUring: eventfd failed, err=%d", errno));
+    }
+
+    arm_event_fd_poll();
+}
+
+EventProviderLinuxUring::~EventProviderLinuxUring ()
+{
+    // Closing the ring fd cancels any remaining requests (only the eventfd poll is
+    // expected to remain, see EventLoop::wait_for_final_uring_results).
+    AIPSTACK_ASSERT(m_num_detached_polls == 0);
+}
+
+void EventProviderLinuxUring::waitForEvents (EventLoopTime wait_time)
+{
+    using namespace EventProviderLinuxUringPriv;
+
+    namespace chrono = std::chrono;
+    using SecType = decltype(__kernel_timespec().tv_sec);
+    using NsecType = decltype(__kernel_timespec().tv_nsec);
+    using NsecDuration = chrono::duration<NsecType, std::nano>;
+
+    // Instead of a timerfd, the timeout is passed directly to io_uring_enter.
+    // The timeout is relative, so it is calculated just before waiting.
+    struct __kernel_timespec ts = {};
+    struct io_uring_getevents_arg arg = {};
+    unsigned flags = IORING_ENTER_GETEVENTS;
+
+    if (wait_time != EventLoopTime::max()) {
+        EventLoopDuration rel_dur =
+            MaxValue(EventLoopDuration::zero(), wait_time - EventLoopClock::now());
+        auto rel_ns = chrono::duration_cast<NsecDuration>(rel_dur).count();
+
+        ts.tv_sec = SecType(rel_ns / NsecType(1000000000));
+        ts.tv_nsec = NsecType(rel_ns % NsecType(1000000000));
+
+        arg.ts = std::uint64_t(reinterpret_cast<std::uintptr_t>(&ts));
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    while (true) {
+        void const *argp = (flags & IORING_ENTER_EXT_ARG) != 0 ? &arg : nullptr;
+        std::size_t argsz = (flags & IORING_ENTER_EXT_ARG) != 0 ? sizeof(arg) : 0;
+
+        int res = sys_io_uring_enter(
+            *m_ring_fd, get_num_unsubmitted(), /*min_complete=*/1, flags, argp, argsz);
+        if (AIPSTACK_LIKELY(res >= 0)) {
+            break;
+        }
+
+        int err = errno;
+        if (err == ETIME) {
+            // Timeout expired, timers will be dispatched.
+            break;
+        }
+        if (err == EBUSY || err == EAGAIN) {
+            // Completions are backlogged, they need to be dispatched first.
+            break;
+        }
+        if (err != EINTR) {
+            throw std::runtime_error(formatString(
+                "EventProviderLinuxUring: io_uring_enter failed, err=%d", err));
+        }
+    }
+}
+
+bool EventProviderLinuxUring::pollForEvents ()
+{
+    using namespace EventProviderLinuxUringPriv;
+
+    // Submit any pending entries and let the kernel post completions which are
+    // ready, without waiting.
+    while (true) {
+        int res = sys_io_uring_enter(*m_ring_fd, get_num_unsubmitted(),
+            /*min_complete=*/0, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (AIPSTACK_LIKELY(res >= 0)) {
+            break;
+        }
+
+        int err = errno;
+        if (err == EBUSY || err == EAGAIN) {
+            break;
+        }
+        if (err != EINTR) {
+            throw std::runtime_error(formatString(
+                "EventProviderLinuxUring: io_uring_enter failed, err=%d", err));
+        }
+    }
+
+    return *m_cq_head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+}
+
+bool EventProviderLinuxUring::dispatchEvents ()
+{
+    while (true) {
+        unsigned head = *m_cq_head;
+        if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        // Consume the completion before handling it so that it is not handled
+        // again if a handler throws.
+        struct io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+        __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+        auto tag = UserDataTag(cqe.user_data & UserDataTagMask);
+        void *ptr = reinterpret_cast<void *>(
+            std::uintptr_t(cqe.user_data & ~UserDataTagMask));
+
+        switch (tag) {
+            case UserDataTag::EventFd: {
+                // The multishot poll ends e.g. on overflow, then it is rearmed.
+                if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                    arm_event_fd_poll();
+                }
+
+                std::uint64_t value;
+                auto res = ::read(*m_event_fd, &value, sizeof(value));
+
+                if (AIPSTACK_UNLIKELY(res < 0)) {
+                    int err = errno;
+                    if (err != EAGAIN) {
+                        std::fprintf(stderr,
+                            "EventProviderLinuxUring: read from eventfd failed, "
+                            "err=%d\n", err);
+                    }
+                }
+
+                if (!EventProviderBase::dispatchAsyncSignals()) {
+                    return false;
+                }
+            } break;
+
+            case UserDataTag::Poll: {
+                if (!dispatch_poll_result(static_cast<PollEntry *>(ptr), cqe.res)) {
+                    return false;
+                }
+            } break;
+
+            case UserDataTag::UringOp: {
+                if (!EventProviderBase::handleUringResult(ptr, cqe.res)) {
+                    return false;
+                }
+            } break;
+
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+void EventProviderLinuxUring::signalToCheckAsyncSignals ()
+{
+    std::uint64_t value = 1;
+    auto res = ::write(*m_event_fd, &value, sizeof(value));
+
+    if (AIPSTACK_UNLIKELY(res < 0)) {
+        int err = errno;
+        if (err != EAGAIN) {
+            std::fprintf(stderr,
+                "EventProviderLinuxUring: write to eventfd failed, err=%d\n", err);
+        }
+    }
+}
+
+void EventProviderLinuxUring::submitUringOp (
+    struct io_uring_sqe const &sqe, void *uring_resource)
+{
+    struct io_uring_sqe op_sqe = sqe;
+    op_sqe.user_data = make_user_data(UserDataTag::UringOp, uring_resource);
+
+    queue_sqe(op_sqe);
+}
+
+void EventProviderLinuxUring::cancelUringOp (void *uring_resource)
+{
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = make_user_data(UserDataTag::UringOp, uring_resource);
+    sqe.user_data = make_user_data(UserDataTag::Ignore, nullptr);
+
+    try {
+        queue_sqe(sqe);
+    } catch (std::runtime_error const &ex) {
+        // This is called from reset() and destructors and therefore must not throw.
+        // The operation will still complete eventually, just possibly later.
+        std::fprintf(stderr, "%s\n", ex.what());
+    }
+}
+
+bool EventProviderLinuxUring::registerUringBuffers (
+    struct iovec const *iovecs, unsigned num_iovecs, int &out_error)
+{
+    using namespace EventProviderLinuxUringPriv;
+
+    if (sys_io_uring_register(
+            *m_ring_fd, IORING_REGISTER_BUFFERS, iovecs, num_iovecs) < 0)
+    {
+        out_error = errno;
+        return false;
+    }
+
+    return true;
+}
+
+std::uint64_t EventProviderLinuxUring::make_user_data (UserDataTag tag, void *ptr)
+{
+    auto ptr_val = std::uint64_t(reinterpret_cast<std::uintptr_t>(ptr));
+    AIPSTACK_ASSERT((ptr_val & UserDataTagMask) == 0);
+    return ptr_val | std::uint64_t(tag);
+}
+
+void EventProviderLinuxUring::queue_sqe (struct io_uring_sqe const &sqe)
+{
+    // If the SQ ring is full, submit what is there to make space.
+    if (get_num_unsubmitted() == m_sq_entries) {
+        submit_unsubmitted();
+
+        if (get_num_unsubmitted() == m_sq_entries) {
+            throw std::runtime_error("EventProviderLinuxUring: SQ ring is full");
+        }
+    }
+
+    m_sqes[m_sq_local_tail & m_sq_mask] = sqe;
+    m_sq_local_tail++;
+
+    // Publish the entry. It will be submitted at the next io_uring_enter, normally
+    // together with waiting for events.
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+}
+
+unsigned EventProviderLinuxUring::get_num_unsubmitted () const
+{
+    return m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+}
+
+void EventProviderLinuxUring::submit_unsubmitted ()
+{
+    using namespace EventProviderLinuxUringPriv;
+
+    while (true) {
+        int res = sys_io_uring_enter(
+            *m_ring_fd, get_num_unsubmitted(), 0, 0, nullptr, 0);
+        if (AIPSTACK_LIKELY(res >= 0)) {
+            break;
+        }
+
+        int err = errno;
+        if (err == EBUSY || err == EAGAIN) {
+            // Nothing more can be done until completions are dispatched.
+            break;
+        }
+        if (err != EINTR) {
+            throw std::runtime_error(formatString(
+                "EventProviderLinuxUring: io_uring_enter failed, err=%d", err));
+        }
+    }
+}
+
+void EventProviderLinuxUring::arm_event_fd_poll ()
+{
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = *m_event_fd;
+    sqe.len = IORING_POLL_ADD_MULTI;
+    sqe.poll32_events = POLLIN;
+    sqe.user_data = make_user_data(UserDataTag::EventFd, nullptr);
+
+    queue_sqe(sqe);
+}
+
+void EventProviderLinuxUring::arm_poll (
+    PollEntry *entry, int fd, EventLoopFdEvents events)
+{
+    using namespace EventProviderLinuxUringPriv;
+
+    AIPSTACK_ASSERT(!entry->armed);
+
+    // A single-shot poll is used and rearmed after each result, which gives
+    // level-triggered semantics like epoll without EPOLLET.
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = fd;
+    sqe.poll32_events = get_events_to_request(events);
+    sqe.user_data = make_user_data(UserDataTag::Poll, entry);
+
+    queue_sqe(sqe);
+
+    entry->armed = true;
+}
+
+void EventProviderLinuxUring::detach_poll (PollEntry *entry)
+{
+    AIPSTACK_ASSERT(entry->fd != nullptr);
+
+    if (!entry->armed) {
+        delete entry;
+        return;
+    }
+
+    // The poll is in progress so the entry must remain until its completion.
+    entry->fd = nullptr;
+    m_num_detached_polls++;
+
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_POLL_REMOVE;
+    sqe.fd = -1;
+    sqe.addr = make_user_data(UserDataTag::Poll, entry);
+    sqe.user_data = make_user_data(UserDataTag::Ignore, nullptr);
+
+    try {
+        queue_sqe(sqe);
+    } catch (std::runtime_error const &ex) {
+        // This is called from EventLoopFdWatcher destructor and reset() and therefore
+        // must not throw. The poll will complete on its own once the file descriptor
+        // becomes ready or is closed, and the entry is freed then.
+        std::fprintf(stderr, "%s\n", ex.what());
+    }
+}
+
+bool EventProviderLinuxUring::dispatch_poll_result (PollEntry *entry, std::int32_t res)
+{
+    using namespace EventProviderLinuxUringPriv;
+
+    AIPSTACK_ASSERT(entry->armed);
+    entry->armed = false;
+
+    EventProviderLinuxUringFd *fd = entry->fd;
+
+    if (fd == nullptr) {
+        // The fd-watcher was reset, this is the final completion of the poll.
+        AIPSTACK_ASSERT(m_num_detached_polls > 0);
+        m_num_detached_polls--;
+        delete entry;
+        return true;
+    }
+
+    fd->EventProviderFdBase::sanityCheck();
+    AIPSTACK_ASSERT(fd->m_poll_entry == entry);
+
+    EventLoopFdEvents req_events = fd->EventProviderFdBase::getFdEvents();
+
+    // Rearm the poll before calling the handler, it is only submitted at the next
+    // wait. If the handler resets the fd-watcher, the poll will be removed.
+    arm_poll(entry, fd->EventProviderFdBase::getFd(), req_events);
+
+    // A failed poll should not normally happen, report it as an error event.
+    EventLoopFdEvents events = (res < 0) ? EventLoopFdEvents::Error :
+        get_events_to_report(std::uint32_t(res), req_events);
+
+    if (events != Enum0) {
+        if (!fd->EventProviderFdBase::callFdEventHandler(events)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void EventProviderLinuxUringFd::initFdImpl (int fd, EventLoopFdEvents events)
+{
+    EventProviderLinuxUring &prov = getProvider();
+
+    AIPSTACK_ASSERT(m_poll_entry == nullptr);
+
+    auto *entry = new EventProviderLinuxUring::PollEntry{this, false};
+
+    try {
+        prov.arm_poll(entry, fd, events);
+    } catch (...) {
+        delete entry;
+        throw;
+    }
+
+    m_poll_entry = entry;
+}
+
+void EventProviderLinuxUringFd::updateEventsImpl (EventLoopFdEvents events)
+{
+    EventProviderLinuxUring &prov = getProvider();
+
+    EventLoopFdEvents cur_events = EventProviderFdBase::getFdEvents();
+
+    EventLoopFdEvents mask = EventLoopFdEvents::Read|EventLoopFdEvents::Write;
+
+    if ((events & mask) != (cur_events & mask)) {
+        // Replace the poll with one for the new events.
+        auto *entry = new EventProviderLinuxUring::PollEntry{this, false};
+
+        try {
+            prov.arm_poll(entry, EventProviderFdBase::getFd(), events);
+        } catch (...) {
+            delete entry;
+            throw;
+        }
+
+        prov.detach_poll(m_poll_entry);
+        m_poll_entry = entry;
+    }
+}
+
+void EventProviderLinuxUringFd::resetImpl ()
+{
+    EventProviderLinuxUring &prov = getProvider();
+
+    AIPSTACK_ASSERT(m_poll_entry != nullptr);
+
+    prov.detach_poll(m_poll_entry);
+    m_poll_entry = nullptr;
+}
+
+EventProviderLinuxUring & EventProviderLinuxUringFd::getProvider () const
+{
+    return static_cast<EventProviderLinuxUring &>(EventProviderFdBase::getProvider());
+}
+
+}
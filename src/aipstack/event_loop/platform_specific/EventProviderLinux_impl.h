@@ -35,6 +35,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <sys/timerfd.h>
 #include <sys/eventfd.h>
 #include <sys/signalfd.h>
@@ -59,9 +60,35 @@ inline std::uint32_t get_events_to_request (EventLoopFdEvents req_ev)
     if ((req_ev & EventLoopFdEvents::Write) != Enum0) {
         epoll_ev |= EPOLLOUT;
     }
+    if ((req_ev & EventLoopFdEvents::EdgeTriggered) != Enum0) {
+        epoll_ev |= EPOLLET;
+    }
     return epoll_ev;
 }
 
+// Converts a duration to a timespec. The duration must not be negative.
+inline struct timespec duration_to_timespec (EventLoopDuration dur)
+{
+    namespace chrono = std::chrono;
+    using Period = EventLoopDuration::period;
+    using Rep = EventLoopDuration::rep;
+    using SecType = decltype(timespec().tv_sec);
+    using NsecType = decltype(timespec().tv_nsec);
+    using NsecDuration = chrono::duration<NsecType, std::nano>;
+
+    static_assert(Period::num == 1);
+    static_assert(Period::den <= std::nano::den);
+    static_assert(TypeMax<Rep> / Period::den <= TypeMax<SecType>);
+
+    AIPSTACK_ASSERT(dur >= EventLoopDuration::zero());
+
+    struct timespec ts = {};
+    ts.tv_sec = SecType(dur.count() / Period::den);
+    ts.tv_nsec = chrono::duration_cast<NsecDuration>(
+        EventLoopDuration(dur.count() % Period::den)).count();
+    return ts;
+}
+
 inline EventLoopFdEvents get_events_to_report (
     std::uint32_t epoll_ev, EventLoopFdEvents req_ev)
 {
@@ -84,10 +111,12 @@ inline EventLoopFdEvents get_events_to_report (
 }
 
 EventProviderLinux::EventProviderLinux () :
+    m_use_pwait2(false),
     m_timerfd_time(EventLoopTime::max()),
     m_force_timerfd_update(true),
     m_cur_epoll_event(0),
-    m_num_epoll_events(0)
+    m_num_epoll_events(0),
+    m_epoll_events(std::size_t(MinValue(InitialEpollEvents, MaxEpollEvents)))
 {
     m_epoll_fd = FileDescriptorWrapper(::epoll_create1(EPOLL_CLOEXEC));
     if (!m_epoll_fd) {
@@ -95,11 +124,26 @@ EventProviderLinux::EventProviderLinux () :
             "EventProviderLinux: epoll_create1 failed, err=%d", errno));
     }
 
-    m_timer_fd = FileDescriptorWrapper(
-        ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC));
-    if (!m_timer_fd) {
-        throw std::runtime_error(formatString(
-            "EventProviderLinux: timerfd_create failed, err=%d", errno));
+    // Check if epoll_pwait2 is supported. The epoll set is still empty so this
+    // returns immediately without consuming any events.
+    struct timespec zero_timeout = {};
+    if (call_epoll_pwait2(1, &zero_timeout) >= 0) {
+        m_use_pwait2 = true;
+    } else {
+        int err = errno;
+        if (err != ENOSYS) {
+            throw std::runtime_error(formatString(
+                "EventProviderLinux: epoll_pwait2 failed, err=%d", err));
+        }
+
+        m_timer_fd = FileDescriptorWrapper(
+            ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC));
+        if (!m_timer_fd) {
+            throw std::runtime_error(formatString(
+                "EventProviderLinux: timerfd_create failed, err=%d", errno));
+        }
+
+        control_epoll(EPOLL_CTL_ADD, *m_timer_fd, EPOLLIN, &m_timer_fd);
     }
 
     m_event_fd = FileDescriptorWrapper(::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC));
@@ -108,7 +152,6 @@ EventProviderLinux::EventProviderLinux () :
             "EventProviderLinux: eventfd failed, err=%d", errno));
     }
 
-    control_epoll(EPOLL_CTL_ADD, *m_timer_fd, EPOLLIN, &m_timer_fd);
     control_epoll(EPOLL_CTL_ADD, *m_event_fd, EPOLLIN, &m_event_fd);
 }
 
@@ -117,8 +160,39 @@ EventProviderLinux::~EventProviderLinux ()
 
 void EventProviderLinux::waitForEvents (EventLoopTime wait_time)
 {
+    using namespace EventProviderLinuxPriv;
+
     AIPSTACK_ASSERT(m_cur_epoll_event == m_num_epoll_events);
-    
+
+    if (!m_use_pwait2) {
+        update_timerfd(wait_time);
+        wait_epoll(nullptr);
+        return;
+    }
+
+    if (wait_time == EventLoopTime::max()) {
+        wait_epoll(nullptr);
+        return;
+    }
+
+    EventLoopTime now = EventLoopClock::now();
+    EventLoopDuration timeout_dur = (wait_time > now) ?
+        (wait_time - now) : EventLoopDuration::zero();
+
+    struct timespec timeout = duration_to_timespec(timeout_dur);
+    wait_epoll(&timeout);
+}
+
+bool EventProviderLinux::pollForEvents ()
+{
+    AIPSTACK_ASSERT(m_cur_epoll_event == m_num_epoll_events);
+
+    struct timespec zero_timeout = {};
+    return wait_epoll(&zero_timeout) > 0;
+}
+
+void EventProviderLinux::update_timerfd (EventLoopTime wait_time)
+{
     namespace chrono = std::chrono;
     using Period = EventLoopTime::period;
     using Rep = EventLoopTime::rep;
@@ -163,25 +237,6 @@ void EventProviderLinux::waitForEvents (EventLoopTime wait_time)
         m_timerfd_time = wait_time;
         m_force_timerfd_update = false;
     }
-
-    int wait_res;
-    while (true) {
-        wait_res = ::epoll_wait(*m_epoll_fd, m_epoll_events, MaxEpollEvents, -1);
-        if (AIPSTACK_LIKELY(wait_res >= 0)) {
-            break;
-        }
-        
-        int err = errno;
-        if (err != EINTR) {
-            throw std::runtime_error(formatString(
-                "EventProviderLinux: epoll_wait failed, err=%d", err));
-        }
-    }
-
-    AIPSTACK_ASSERT(wait_res <= MaxEpollEvents);
-
-    m_cur_epoll_event = 0;
-    m_num_epoll_events = wait_res;
 }
 
 bool EventProviderLinux::dispatchEvents ()
@@ -263,6 +318,61 @@ void EventProviderLinux::control_epoll (
     }
 }
 
+int EventProviderLinux::wait_epoll (struct timespec const *timeout)
+{
+    // If the previous call filled the buffer, there were likely more events ready,
+    // so get more events at once from now on. The previous events have been
+    // dispatched so the buffer can be replaced.
+    int max_events = int(m_epoll_events.size());
+    if (m_num_epoll_events == max_events && max_events < MaxEpollEvents) {
+        max_events = MinValue(2 * max_events, MaxEpollEvents);
+        m_epoll_events.resize(std::size_t(max_events));
+    }
+
+    int wait_res;
+    while (true) {
+        if (m_use_pwait2) {
+            wait_res = call_epoll_pwait2(max_events, timeout);
+        } else {
+            // Without epoll_pwait2 only infinite and zero timeouts are used, the timer
+            // expiration is reported through the timerfd.
+            AIPSTACK_ASSERT(timeout == nullptr ||
+                            (timeout->tv_sec == 0 && timeout->tv_nsec == 0));
+            wait_res = ::epoll_wait(*m_epoll_fd, m_epoll_events.data(), max_events,
+                                    (timeout == nullptr) ? -1 : 0);
+        }
+        if (AIPSTACK_LIKELY(wait_res >= 0)) {
+            break;
+        }
+
+        int err = errno;
+        if (err != EINTR) {
+            throw std::runtime_error(formatString(
+                "EventProviderLinux: epoll_wait failed, err=%d", err));
+        }
+    }
+
+    AIPSTACK_ASSERT(wait_res <= max_events);
+
+    m_cur_epoll_event = 0;
+    m_num_epoll_events = wait_res;
+
+    return wait_res;
+}
+
+int EventProviderLinux::call_epoll_pwait2 (int max_events, struct timespec const *timeout)
+{
+#ifdef __NR_epoll_pwait2
+    return int(::syscall(__NR_epoll_pwait2, *m_epoll_fd, m_epoll_events.data(),
+        max_events, timeout, nullptr, std::size_t(0)));
+#else
+    static_cast<void>(max_events);
+    static_cast<void>(timeout);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 void EventProviderLinuxFd::initFdImpl (int fd, EventLoopFdEvents events)
 {
     using namespace EventProviderLinuxPriv;
@@ -280,7 +390,8 @@ void EventProviderLinuxFd::updateEventsImpl (EventLoopFdEvents events)
 
     EventLoopFdEvents cur_events = EventProviderFdBase::getFdEvents();
 
-    EventLoopFdEvents mask = EventLoopFdEvents::Read|EventLoopFdEvents::Write;
+    EventLoopFdEvents mask = EventLoopFdEvents::Read|EventLoopFdEvents::Write|
+        EventLoopFdEvents::EdgeTriggered;
 
     if ((events & mask) != (cur_events & mask)) {
         int fd = EventProviderFdBase::getFd();
@@ -48,6 +48,8 @@ public:
 
     void waitForEvents (EventLoopTime wait_time);
 
+    bool pollForEvents ();
+
     bool dispatchEvents ();
 
     void signalToCheckAsyncSignals ();
@@ -151,6 +151,36 @@ void EventProviderWindows::waitForEvents (EventLoopTime wait_time)
     m_num_iocp_events = num_events;
 }
 
+bool EventProviderWindows::pollForEvents ()
+{
+    AIPSTACK_ASSERT(m_cur_iocp_event == m_num_iocp_events);
+
+    // The wait is not alertable, the timer APC is only relevant for blocking waits
+    // since the event loop checks for expired timers itself.
+    unsigned long num_events = 0;
+    bool wait_result = ::GetQueuedCompletionStatusEx(
+        *m_iocp_handle, m_iocp_events, MaxIocpEvents, &num_events,
+        /*dwMilliseconds=*/0, /*fAlertable=*/false);
+
+    if (!wait_result) {
+        auto err = ::GetLastError();
+        if (err == WAIT_TIMEOUT) {
+            num_events = 0;
+        } else {
+            throw std::runtime_error(formatString(
+                "EventProviderWindows: GetQueuedCompletionStatusEx failed, err=%u",
+                (unsigned int)err));
+        }
+    }
+
+    AIPSTACK_ASSERT(num_events <= MaxIocpEvents);
+
+    m_cur_iocp_event = 0;
+    m_num_iocp_events = num_events;
+
+    return num_events > 0;
+}
+
 bool EventProviderWindows::dispatchEvents ()
 {
     while (m_cur_iocp_event < m_num_iocp_events) {
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/event_loop/SignalCommon.h>
+#include <aipstack/event_loop/platform_specific/SignalWatcherImplKqueue.h>
+
+namespace AIpStack {
+
+SignalCollectorImplKqueue::SignalCollectorImplKqueue ()
+{
+    SignalType signals = SignalCollectorImplBase::baseGetSignals();
+
+    // EVFILT_SIGNAL records attempts to deliver a signal even if the signal is
+    // blocked, so the signals are blocked like with signalfd on Linux. They remain
+    // pending but that is harmless.
+    ::sigset_t sset;
+    initSigSetToSignals(sset, signals);
+
+    ::sigset_t orig_sset;
+    if (::pthread_sigmask(SIG_BLOCK, &sset, &orig_sset) != 0) {
+        throw std::runtime_error(formatString(
+            "SignalCollector: pthread_sigmask failed to block signals, err=%d", errno));
+    }
+
+    m_orig_blocked_signals = getSignalsFromSigSet(orig_sset);
+}
+
+SignalCollectorImplKqueue::~SignalCollectorImplKqueue ()
+{
+    SignalType signals = SignalCollectorImplBase::baseGetSignals();
+    SignalType unblock_signals = signals & ~m_orig_blocked_signals;
+
+    ::sigset_t sset;
+    initSigSetToSignals(sset, unblock_signals);
+
+    if (::pthread_sigmask(SIG_UNBLOCK, &sset, nullptr) != 0) {
+        std::fprintf(stderr,
+            "SignalCollector: pthread_sigmask failed to unblock signals, err=%d\n", errno);
+    }
+}
+
+SignalWatcherImplKqueue::SignalWatcherImplKqueue () :
+    m_fd_watcher(SignalWatcherImplBase::getEventLoop(),
+                 AIPSTACK_BIND_MEMBER(&SignalWatcherImplKqueue::fdWatcherHandler, this))
+{
+    SignalType signals = getCollector().SignalCollectorImplBase::baseGetSignals();
+
+    // The signals are watched using a separate kqueue which is itself watched by the
+    // event loop (a kqueue is readable when it has pending events), similar to a
+    // signalfd.
+    m_kqueue_fd = FileDescriptorWrapper(::kqueue());
+    if (!m_kqueue_fd) {
+        throw std::runtime_error(formatString(
+            "SignalWatcher: kqueue failed, err=%d", errno));
+    }
+
+    if (::fcntl(*m_kqueue_fd, F_SETFD, FD_CLOEXEC) < 0) {
+        throw std::runtime_error(formatString(
+            "SignalWatcher: fcntl(F_SETFD) failed, err=%d", errno));
+    }
+
+    for (int signum = 1; signum < NSIG; signum++) {
+        SignalType sig = signumToSignalType(signum);
+        if (sig == SignalType::None || (sig & signals) == Enum0) {
+            continue;
+        }
+
+        struct kevent ev;
+        EV_SET(&ev, std::uintptr_t(signum), EVFILT_SIGNAL, EV_ADD, 0, 0, nullptr);
+        if (::kevent(*m_kqueue_fd, &ev, 1, nullptr, 0, nullptr) < 0) {
+            throw std::runtime_error(formatString(
+                "SignalWatcher: kevent failed to add EVFILT_SIGNAL, err=%d", errno));
+        }
+    }
+
+    m_fd_watcher.initFd(*m_kqueue_fd, EventLoopFdEvents::Read);
+}
+
+SignalWatcherImplKqueue::~SignalWatcherImplKqueue ()
+{}
+
+SignalCollectorImplKqueue & SignalWatcherImplKqueue::getCollector () const
+{
+    return static_cast<SignalCollectorImplKqueue &>(SignalWatcherImplBase::getCollector());
+}
+
+void SignalWatcherImplKqueue::fdWatcherHandler([[maybe_unused]] EventLoopFdEvents events)
+{
+    // Take one signal per call like with signalfd; the kqueue remains readable if
+    // there are more.
+    struct kevent ev;
+    struct timespec timeout = {};
+    int res = ::kevent(*m_kqueue_fd, nullptr, 0, &ev, 1, &timeout);
+
+    if (res < 0) {
+        int err = errno;
+        if (err == EINTR) {
+            return;
+        }
+
+        std::fprintf(stderr, "SignalWatcher: kevent failed, err=%d\n", err);
+        return;
+    }
+
+    if (res == 0) {
+        return;
+    }
+
+    AIPSTACK_ASSERT(ev.filter == EVFILT_SIGNAL);
+
+    if (ev.ident > std::uintptr_t(TypeMax<int>)) {
+        std::fprintf(stderr,
+            "SignalWatcher: signal number is out of range for int.\n");
+        return;
+    }
+    int signum = int(ev.ident);
+
+    SignalType sig = signumToSignalType(signum);
+    if (sig == SignalType::None) {
+        std::fprintf(stderr, "SignalWatcher: signal number not recognized.\n");
+        return;
+    }
+
+    SignalType signals = getCollector().SignalCollectorImplBase::baseGetSignals();
+    if ((sig & signals) == Enum0) {
+        std::fprintf(stderr, "SignalWatcher: signal number is not requested.\n");
+        return;
+    }
+
+    return SignalWatcherImplBase::callHandler(SignalInfo{sig});
+}
+
+}
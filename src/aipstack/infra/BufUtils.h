@@ -29,6 +29,7 @@
 #include <cstring>
 
 #include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Hints.h>
 #include <aipstack/misc/MinMax.h>
 #include <aipstack/misc/MemRef.h>
 #include <aipstack/misc/TypedFunction.h>
@@ -398,6 +399,53 @@ inline bool ipBufStartsWith (IpBufRef buf, MemRef prefix, IpBufRef &remBuf)
     return true;
 }
 
+/**
+ * Export the memory range as an array of scatter-gather entries without copying
+ * the data.
+ * 
+ * The `setEntry` function is called for each contiguous chunk of the memory range
+ * in order, with a reference to the entry to be filled in, a char pointer to the
+ * start of the chunk and the size_t (nonzero) length of the chunk. This allows
+ * filling in arrays of system-specific structures such as `struct iovec`.
+ * 
+ * If more than `maxEntries` entries would be needed, the function fails and the
+ * caller should fall back to copying the data (e.g. using @ref ipBufTakeBytes).
+ * 
+ * @tparam Entry Type of scatter-gather entries.
+ * @tparam FuncImpl Type of function object wrapped by `setEntry`.
+ * @param buf Buffer to export.
+ * @param entries Pointer to the array of entries to fill in.
+ * @param maxEntries Number of available entries in the `entries` array.
+ * @param numEntries On success, set to the number of entries filled in (zero if
+ *        `buf.tot_len` is zero).
+ * @param setEntry Function to call in order to fill in an entry (see above).
+ * @return True on success, false if the entries do not suffice.
+ */
+template<typename Entry, typename FuncImpl>
+bool ipBufToScatterGather (IpBufRef buf, Entry *entries, std::size_t maxEntries,
+    std::size_t &numEntries,
+    TypedFunction<void(Entry &, char *, std::size_t), FuncImpl> setEntry)
+{
+    if (buf.tot_len == 0) {
+        numEntries = 0;
+        return true;
+    }
+    
+    std::size_t count = 0;
+    
+    IpBufRef rem = ipBufProcessBytes(buf, buf.tot_len, makeTypedFunction(
+        [&](char *chunkData, std::size_t chunkLen) -> std::size_t {
+            if (count == maxEntries) {
+                return 0;
+            }
+            setEntry(entries[count++], chunkData, chunkLen);
+            return chunkLen;
+        }));
+    
+    numEntries = count;
+    return rem.tot_len == 0;
+}
+
 /**
  * Return a sub-range of the buffer reference from the given offset of the given
  * length.
@@ -417,6 +465,192 @@ inline IpBufRef ipBufSubFromTo (IpBufRef buf, std::size_t offset, std::size_t le
     return buf.subTo(len);
 }
 
+/**
+ * Cursor for sequential reading and writing of a memory range.
+ * 
+ * The cursor caches the pointer to the current position and the number of bytes
+ * remaining in the current chunk, so that accessing bytes within the current chunk
+ * does not require re-deriving the position from the @ref IpBufRef as the
+ * functions such as @ref ipBufTakeByteMut do. This makes it suitable for parsing
+ * byte-oriented data such as protocol options.
+ * 
+ * Unlike @ref ipBufProcessBytes, the cursor moves to the next buffer lazily, that
+ * is only when more bytes are accessed.
+ */
+class IpBufCursor {
+public:
+    /**
+     * Construct a cursor positioned at the start of a memory range.
+     * 
+     * @param buf Memory range to work with. If `buf.tot_len` is nonzero then
+     *        `buf.node` must not be null.
+     */
+    inline IpBufCursor (IpBufRef buf) :
+        m_node(buf.node),
+        m_tot_len(buf.tot_len)
+    {
+        if (buf.tot_len > 0) {
+            IpBufRef::assertBufSanity(buf);
+            m_ptr = buf.node->ptr + buf.offset;
+            m_chunk_len = MinValue(std::size_t(buf.node->len - buf.offset), buf.tot_len);
+        } else {
+            m_ptr = (buf.node != nullptr) ? buf.node->ptr + buf.offset : nullptr;
+            m_chunk_len = 0;
+        }
+    }
+    
+    /**
+     * Return the number of bytes remaining after the current position.
+     * 
+     * @return Number of remaining bytes.
+     */
+    inline std::size_t getRemaining () const
+    {
+        return m_tot_len;
+    }
+    
+    /**
+     * Return an @ref IpBufRef referencing the remaining bytes.
+     * 
+     * @return Reference to the remaining part of the memory range.
+     */
+    inline IpBufRef getBufRef () const
+    {
+        if (m_node == nullptr) {
+            return IpBufRef{nullptr, 0, m_tot_len};
+        }
+        return IpBufRef{m_node, std::size_t(m_ptr - m_node->ptr), m_tot_len};
+    }
+    
+    /**
+     * Return the pointer to the current position if the given number of bytes are
+     * contiguous there, otherwise null.
+     * 
+     * This allows accessing fields within a single chunk directly. The bytes are
+     * not consumed (use @ref skipBytes afterward to do that).
+     * 
+     * @param len Number of bytes which must be contiguous. Must be less than or
+     *        equal to @ref getRemaining and must be nonzero.
+     * @return Pointer to the current position or null.
+     */
+    inline char * getContiguous (std::size_t len)
+    {
+        AIPSTACK_ASSERT(len > 0);
+        AIPSTACK_ASSERT(len <= m_tot_len);
+        
+        if (m_chunk_len == 0) {
+            next_chunk();
+        }
+        return AIPSTACK_LIKELY(len <= m_chunk_len) ? m_ptr : nullptr;
+    }
+    
+    /**
+     * Get and consume a single byte.
+     * 
+     * @return The byte at the current position. There must be at least one
+     *         remaining byte.
+     */
+    inline char takeByte ()
+    {
+        AIPSTACK_ASSERT(m_tot_len > 0);
+        
+        if (AIPSTACK_UNLIKELY(m_chunk_len == 0)) {
+            next_chunk();
+        }
+        m_chunk_len--;
+        m_tot_len--;
+        return *m_ptr++;
+    }
+    
+    /**
+     * Consume a number of bytes while copying them to the given memory location.
+     * 
+     * @param len Number of bytes to copy out and consume. Must be less than or
+     *        equal to @ref getRemaining.
+     * @param dst Location to copy to. May be null only if `len` is zero.
+     */
+    inline void takeBytes (std::size_t len, char *dst)
+    {
+        process_bytes(len, [&](char *chunk_ptr, std::size_t chunk_len) {
+            std::memcpy(dst, chunk_ptr, chunk_len);
+            dst += chunk_len;
+        });
+    }
+    
+    /**
+     * Consume a number of bytes while copying bytes from the given memory location
+     * into the memory range.
+     * 
+     * @param data Data to copy. Its length must be less than or equal to
+     *        @ref getRemaining.
+     */
+    inline void giveBytes (MemRef data)
+    {
+        char const *src = data.ptr;
+        process_bytes(data.len, [&](char *chunk_ptr, std::size_t chunk_len) {
+            std::memcpy(chunk_ptr, src, chunk_len);
+            src += chunk_len;
+        });
+    }
+    
+    /**
+     * Consume a number of bytes.
+     * 
+     * @param len Number of bytes to consume. Must be less than or equal to
+     *        @ref getRemaining.
+     */
+    inline void skipBytes (std::size_t len)
+    {
+        process_bytes(len, [](char *, std::size_t) {});
+    }
+
+private:
+    template<typename Func>
+    inline void process_bytes (std::size_t len, Func func)
+    {
+        AIPSTACK_ASSERT(len <= m_tot_len);
+        
+        // Fast path is that all the bytes are in the current chunk.
+        while (AIPSTACK_UNLIKELY(len > m_chunk_len)) {
+            if (m_chunk_len > 0) {
+                func(m_ptr, m_chunk_len);
+                len -= m_chunk_len;
+                m_tot_len -= m_chunk_len;
+                m_ptr += m_chunk_len;
+                m_chunk_len = 0;
+            }
+            next_chunk();
+        }
+        
+        if (len > 0) {
+            func(m_ptr, len);
+            m_ptr += len;
+            m_chunk_len -= len;
+            m_tot_len -= len;
+        }
+    }
+    
+    AIPSTACK_NO_INLINE
+    void next_chunk ()
+    {
+        AIPSTACK_ASSERT(m_chunk_len == 0);
+        AIPSTACK_ASSERT(m_tot_len > 0);
+        
+        do {
+            AIPSTACK_ASSERT(m_node->next != nullptr);
+            m_node = m_node->next;
+            m_ptr = m_node->ptr;
+            m_chunk_len = MinValue(m_node->len, m_tot_len);
+        } while (m_chunk_len == 0);
+    }
+
+private:
+    IpBufNode const *m_node;
+    char *m_ptr;
+    std::size_t m_chunk_len;
+    std::size_t m_tot_len;
+};
+
 /** @} */
 }
 
@@ -27,6 +27,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
 
 #include <aipstack/meta/BasicMetaUtils.h>
 #include <aipstack/misc/Assert.h>
@@ -37,6 +38,7 @@
 #include <aipstack/infra/Buf.h>
 #include <aipstack/infra/BufUtils.h>
 #include <aipstack/infra/Struct.h>
+#include <aipstack/infra/ChksumKernels.h>
 
 /**
  * @ingroup infra
@@ -45,6 +47,11 @@
  * 
  * For applications, the most important thing here is the \ref IpChksumInverted
  * function, for which an optimized implementation can be provided.
+ * 
+ * The built-in implementation already uses 64-bit accumulation and, where the
+ * target supports it, SSE2/AVX2 or NEON kernels (see @ref AIPSTACK_CHKSUM_SSE2,
+ * @ref AIPSTACK_CHKSUM_AVX2, @ref AIPSTACK_CHKSUM_AVX2_DISPATCH and
+ * @ref AIPSTACK_CHKSUM_NEON).
  */
 
 #if defined(AIPSTACK_EXTERNAL_CHKSUM)
@@ -69,6 +76,10 @@ extern "C" std::uint16_t IpChksumInverted (char const *data, std::size_t len);
  * function declaration is provided by the header file Chksum.h and the implementation
  * must be provided by the application.
  * 
+ * The built-in implementation selects the SIMD kernel at compile time according to
+ * the target instruction set. On x86-64 Linux without `-mavx2`, the AVX2 kernel is
+ * additionally selected at runtime for large buffers if the CPU supports it.
+ * 
  * @param data Pointer to data (must not be null).
  * @param len Number of bytes (may be zero). It must not exceed 65535 (this may
  *        allow a more optimized custom implementation).
@@ -77,25 +88,7 @@ extern "C" std::uint16_t IpChksumInverted (char const *data, std::size_t len);
 AIPSTACK_NO_INLINE
 inline std::uint16_t IpChksumInverted (char const *data, std::size_t len)
 {
-    using namespace AIpStack;
-    
-    char const *even_end = data + (len & std::size_t(-2));
-    std::uint32_t sum = 0;
-    
-    while (data < even_end) {
-        sum += ReadSingleField<std::uint16_t>(data);
-        data += 2;
-    }
-    
-    if ((len & 1) != 0) {
-        std::uint8_t byte = ReadSingleField<std::uint8_t>(data);
-        sum += std::uint32_t(std::uint16_t(byte) << 8);
-    }
-    
-    sum = (sum & std::uint32_t(0xFFFF)) + (sum >> 16);
-    sum = (sum & std::uint32_t(0xFFFF)) + (sum >> 16);
-    
-    return std::uint16_t(sum);
+    return AIpStack::ChksumPrivate::chksumInverted(data, len);
 }
 
 #endif
@@ -124,6 +117,31 @@ inline std::uint16_t IpChksum (char const *data, std::size_t len)
     return ~IpChksumInverted(data, len);
 }
 
+/**
+ * Copy a buffer and calculate the inverted IP checksum of the copied bytes.
+ * 
+ * This is functionally equivalent to copying the bytes using `std::memcpy` and then
+ * calling @ref IpChksumInverted on either copy, but the built-in implementation does
+ * both in a single pass over the data. If `AIPSTACK_EXTERNAL_CHKSUM` is defined, the
+ * bytes are copied first and the checksum is then calculated using the external
+ * @ref IpChksumInverted.
+ * 
+ * @param dst Pointer to destination (must not be null). The destination must not
+ *        overlap with the source.
+ * @param src Pointer to source data (must not be null).
+ * @param len Number of bytes (may be zero). It must not exceed 65535.
+ * @return Inverted IP checksum of the bytes.
+ */
+inline std::uint16_t IpChksumInvertedCopy (char *dst, char const *src, std::size_t len)
+{
+#if defined(AIPSTACK_EXTERNAL_CHKSUM)
+    std::memcpy(dst, src, len);
+    return IpChksumInverted(dst, len);
+#else
+    return ChksumPrivate::chksumInvertedCopy(dst, src, len);
+#endif
+}
+
 /**
  * Provides incremental IP checksum calculation of header words followed by data.
  * 
@@ -226,11 +244,58 @@ public:
     {
         AIPSTACK_ASSERT(num_bytes % 2 == 0);
         
-        char const *endptr = ptr + num_bytes;
-        while (ptr < endptr) {
-            std::uint16_t word = ReadSingleField<std::uint16_t>(ptr);
-            ptr += 2;
-            addWord(WrapType<std::uint16_t>(), word);
+        addInvertedSum(IpChksumInverted(ptr, num_bytes));
+    }
+    
+    /**
+     * Copy the data referenced by one @ref IpBufRef into the space referenced by
+     * another while adding the data to the running checksum.
+     * 
+     * The data is added as if it started at an even offset of the data being
+     * checksummed, so anything that is added by other means must have even length
+     * for the result to be correct.
+     * 
+     * @param dst Reference to the destination space. Its length (`dst.tot_len`)
+     *        must be greater than or equal to `src.tot_len`.
+     * @param src Reference to the sequence of data bytes to copy and add. Its length
+     *        may be any number including zero (if zero, then neither `dst.node` nor
+     *        `src.node` are examined and they may be null).
+     */
+    inline void addIpBufCopy (IpBufRef dst, IpBufRef src)
+    {
+        AIPSTACK_ASSERT(dst.tot_len >= src.tot_len);
+        
+        if (src.tot_len == 0) {
+            return;
+        }
+        
+        bool swapped = false;
+        
+        ipBufProcessBytes(dst, src.tot_len, makeTypedFunction(
+            [&](char *dstPtr, std::size_t dstLen)
+        {
+            src = ipBufProcessBytes(src, dstLen, makeTypedFunction(
+                [&](char *srcPtr, std::size_t srcLen)
+            {
+                // Copy and calculate sum of the piece and add it to our sum.
+                addInvertedSum(IpChksumInvertedCopy(dstPtr, srcPtr, srcLen));
+                dstPtr += srcLen;
+                
+                // If the piece has an odd length, swap bytes in sum.
+                if (srcLen % 2 != 0) {
+                    m_sum = swapBytes(m_sum);
+                    swapped = !swapped;
+                }
+                
+                return srcLen;
+            }));
+            
+            return dstLen;
+        }));
+        
+        // Swap bytes if we swapped an odd number of times.
+        if (swapped) {
+            m_sum = swapBytes(m_sum);
         }
     }
     
@@ -249,6 +314,25 @@ public:
         return std::uint16_t(~m_sum);
     }
     
+    /**
+     * Complete and return the inverted checksum without adding any additional data.
+     * 
+     * This returns the folded one's complement sum, which is what must be stored
+     * into the checksum field as the partial checksum when the rest of the
+     * checksum is to be calculated by hardware (checksum offload).
+     * 
+     * After this function is called, the @ref IpChksumAccumulator object is considered
+     * to be in an invalid state and its further use would have unspecified results.
+     * 
+     * @return The calculated inverted checksum.
+     */
+    inline std::uint16_t getChksumInverted ()
+    {
+        foldOnce();
+        foldOnce();
+        return std::uint16_t(m_sum);
+    }
+    
     /**
      * Add the data referenced by @ref IpBufRef then complete and return the checksum.
      * 
@@ -274,6 +358,17 @@ private:
         m_sum = (m_sum & TypeMax<std::uint16_t>) + (m_sum >> 16);
     }
     
+    inline void addInvertedSum (std::uint16_t buf_sum)
+    {
+        std::uint32_t old_sum = m_sum;
+        m_sum += buf_sum;
+        
+        // Fold back any overflow.
+        if (AIPSTACK_UNLIKELY(m_sum < old_sum)) {
+            m_sum++;
+        }
+    }
+    
     inline static std::uint32_t swapBytes (std::uint32_t x)
     {
         return ((x >> 8) & std::uint32_t(0x00FF00FF)) |
@@ -287,17 +382,8 @@ private:
         ipBufProcessBytes(buf, buf.tot_len, makeTypedFunction(
             [&](char *dataPtr, std::size_t dataLen)
         {
-            // Calculate sum of buffer.
-            std::uint16_t buf_sum = IpChksumInverted(dataPtr, dataLen);
-            
-            // Add the buffer sum to our sum.
-            std::uint32_t old_sum = m_sum;
-            m_sum += buf_sum;
-            
-            // Fold back any overflow.
-            if (AIPSTACK_UNLIKELY(m_sum < old_sum)) {
-                m_sum++;
-            }
+            // Calculate sum of buffer and add it to our sum.
+            addInvertedSum(IpChksumInverted(dataPtr, dataLen));
             
             // If the buffer has an odd length, swap bytes in sum.
             if (dataLen % 2 != 0) {
@@ -335,6 +421,84 @@ inline std::uint16_t IpChksum (IpBufRef buf)
     return accum.getChksum(buf);
 }
 
+/**
+ * Update an IP checksum for a change of a 16-bit word in the checksummed data.
+ * 
+ * This calculates the new checksum from the old checksum and the old and new values
+ * of the word, without having to recalculate the checksum over all the data. The
+ * calculation is done according to RFC 1624 (equation 3), which does not have the
+ * problems of the earlier RFC 1141 method.
+ * 
+ * Multiple changes can be applied by calling this function for each changed word.
+ * The word must be at an even offset in the checksummed data.
+ * 
+ * @param chksum The old checksum (as stored in protocol headers).
+ * @param old_word The old value of the changed word.
+ * @param new_word The new value of the changed word.
+ * @return The updated checksum.
+ */
+inline std::uint16_t IpChksumUpdate (std::uint16_t chksum, WrapType<std::uint16_t>,
+                                     std::uint16_t old_word, std::uint16_t new_word)
+{
+    // HC' = ~(~HC + ~m + m')
+    std::uint32_t sum = std::uint32_t(std::uint16_t(~chksum)) +
+        std::uint16_t(~old_word) + new_word;
+    sum = (sum & TypeMax<std::uint16_t>) + (sum >> 16);
+    sum = (sum & TypeMax<std::uint16_t>) + (sum >> 16);
+    return std::uint16_t(~sum);
+}
+
+/**
+ * Update an IP checksum for a change of a 32-bit word in the checksummed data.
+ * 
+ * This is equivalent to calling
+ * @ref IpChksumUpdate(std::uint16_t, WrapType<std::uint16_t>, std::uint16_t, std::uint16_t)
+ * for the high and low 16-bit halves of the word. The word must be at an even
+ * offset in the checksummed data.
+ * 
+ * @param chksum The old checksum (as stored in protocol headers).
+ * @param old_word The old value of the changed word.
+ * @param new_word The new value of the changed word.
+ * @return The updated checksum.
+ */
+inline std::uint16_t IpChksumUpdate (std::uint16_t chksum, WrapType<std::uint32_t>,
+                                     std::uint32_t old_word, std::uint32_t new_word)
+{
+    chksum = IpChksumUpdate(chksum, WrapType<std::uint16_t>(),
+                            std::uint16_t(old_word >> 16), std::uint16_t(new_word >> 16));
+    chksum = IpChksumUpdate(chksum, WrapType<std::uint16_t>(),
+                            std::uint16_t(old_word), std::uint16_t(new_word));
+    return chksum;
+}
+
+/**
+ * Copy a sequence of bytes described by @ref IpBufRef into space described by
+ * another @ref IpBufRef while adding the bytes to a partial checksum.
+ * 
+ * This is intended for places where data is both copied and checksummed, so that this
+ * can be done in a single pass over the data. It is implemented by constructing an
+ * @ref IpChksumAccumulator from the given state, calling @ref
+ * IpChksumAccumulator::addIpBufCopy and returning the new state. See that function for
+ * requirements regarding the position of the data in the data being checksummed.
+ * 
+ * This does not move the destination buffer reference; to consume the destination
+ * space use @ref ipBufSkipBytes with `src.tot_len`.
+ * 
+ * @param dst Reference to the destination space. Its length (`dst.tot_len`) must be
+ *        greater than or equal to `src.tot_len`.
+ * @param src Reference to the sequence of bytes to copy.
+ * @param state Partial checksum state to continue from (as returned by
+ *        @ref IpChksumAccumulator::getState).
+ * @return The partial checksum state including the copied bytes.
+ */
+inline IpChksumAccumulator::State ipBufCopyAndChksum (
+    IpBufRef dst, IpBufRef src, IpChksumAccumulator::State state)
+{
+    IpChksumAccumulator accum(state);
+    accum.addIpBufCopy(dst, src);
+    return accum.getState();
+}
+
 /** @} */
 
 }
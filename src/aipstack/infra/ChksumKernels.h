@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_CHKSUM_KERNELS_H
+#define AIPSTACK_CHKSUM_KERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <aipstack/misc/Hints.h>
+#include <aipstack/infra/Struct.h>
+
+/**
+ * @addtogroup checksum
+ * @{
+ */
+
+#ifdef IN_DOXYGEN
+
+/**
+ * Specifies whether the built-in @ref IpChksumInverted uses the optimized
+ * word-at-a-time implementation (0 or 1).
+ * 
+ * This is true when compiling with GCC or Clang, which is required for the
+ * byte-order detection and unaligned loads used by the optimized code. Otherwise
+ * the simple implementation which adds one 16-bit word at a time is used.
+ */
+#define AIPSTACK_CHKSUM_FAST PLATFORM_DEPENDENT
+
+/**
+ * Specifies whether the built-in @ref IpChksumInverted uses an SSE2 kernel (0 or 1).
+ * 
+ * This is decided at compile time based on the target instruction set. Defining
+ * `AIPSTACK_CONFIG_CHKSUM_DISABLE_SIMD` disables all SIMD kernels.
+ */
+#define AIPSTACK_CHKSUM_SSE2 PLATFORM_DEPENDENT
+
+/**
+ * Specifies whether the built-in @ref IpChksumInverted uses an AVX2 kernel
+ * unconditionally (0 or 1).
+ * 
+ * This is true when the target instruction set includes AVX2 (e.g. `-mavx2`).
+ */
+#define AIPSTACK_CHKSUM_AVX2 PLATFORM_DEPENDENT
+
+/**
+ * Specifies whether the built-in @ref IpChksumInverted selects the AVX2 kernel
+ * at runtime based on CPU detection (0 or 1).
+ * 
+ * This is true for x86-64 Linux builds where @ref AIPSTACK_CHKSUM_SSE2 is true but
+ * @ref AIPSTACK_CHKSUM_AVX2 is not. Defining `AIPSTACK_CONFIG_CHKSUM_DISABLE_DISPATCH`
+ * disables runtime selection, which is advisable when the application is built
+ * for a known CPU.
+ */
+#define AIPSTACK_CHKSUM_AVX2_DISPATCH PLATFORM_DEPENDENT
+
+/**
+ * Specifies whether the built-in @ref IpChksumInverted uses a NEON kernel (0 or 1).
+ * 
+ * This is decided at compile time based on the target instruction set.
+ */
+#define AIPSTACK_CHKSUM_NEON PLATFORM_DEPENDENT
+
+#else
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__BYTE_ORDER__) && \
+    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define AIPSTACK_CHKSUM_FAST 1
+#else
+#define AIPSTACK_CHKSUM_FAST 0
+#endif
+
+#if AIPSTACK_CHKSUM_FAST && !defined(AIPSTACK_CONFIG_CHKSUM_DISABLE_SIMD) && \
+    defined(__AVX2__)
+#define AIPSTACK_CHKSUM_AVX2 1
+#else
+#define AIPSTACK_CHKSUM_AVX2 0
+#endif
+
+#if AIPSTACK_CHKSUM_FAST && !defined(AIPSTACK_CONFIG_CHKSUM_DISABLE_SIMD) && \
+    defined(__SSE2__)
+#define AIPSTACK_CHKSUM_SSE2 1
+#else
+#define AIPSTACK_CHKSUM_SSE2 0
+#endif
+
+#if AIPSTACK_CHKSUM_SSE2 && !AIPSTACK_CHKSUM_AVX2 && \
+    !defined(AIPSTACK_CONFIG_CHKSUM_DISABLE_DISPATCH) && \
+    defined(__linux__) && defined(__x86_64__)
+#define AIPSTACK_CHKSUM_AVX2_DISPATCH 1
+#else
+#define AIPSTACK_CHKSUM_AVX2_DISPATCH 0
+#endif
+
+#if AIPSTACK_CHKSUM_FAST && !defined(AIPSTACK_CONFIG_CHKSUM_DISABLE_SIMD) && \
+    (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define AIPSTACK_CHKSUM_NEON 1
+#else
+#define AIPSTACK_CHKSUM_NEON 0
+#endif
+
+#endif
+
+/** @} */
+
+#if AIPSTACK_CHKSUM_SSE2 || AIPSTACK_CHKSUM_AVX2
+#include <immintrin.h>
+#endif
+
+#if AIPSTACK_CHKSUM_NEON
+#include <arm_neon.h>
+#endif
+
+#ifndef IN_DOXYGEN
+
+namespace AIpStack {
+
+namespace ChksumPrivate {
+
+#if AIPSTACK_CHKSUM_FAST
+
+    /*
+     * The optimized implementation adds the data as native byte order words into
+     * a 64-bit accumulator and only converts the final 16-bit sum to big-endian.
+     * This is correct because the ones-complement sum commutes with byte swapping.
+     * 
+     * All kernels add each 32-bit word into a 64-bit lane, which cannot overflow
+     * for any realistic length (more than 2^32 words would be needed).
+     */
+    
+    inline constexpr bool NativeBigEndian = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+    
+    // Minimum length for the alignment prologue to be worthwhile.
+    inline constexpr std::size_t AlignPrologueMinLen = 64;
+    
+    AIPSTACK_ALWAYS_INLINE
+    std::uint64_t loadNative64 (char const *ptr)
+    {
+        std::uint64_t w;
+        __builtin_memcpy(&w, ptr, sizeof(w));
+        return w;
+    }
+    
+    AIPSTACK_ALWAYS_INLINE
+    std::uint32_t loadNative32 (char const *ptr)
+    {
+        std::uint32_t w;
+        __builtin_memcpy(&w, ptr, sizeof(w));
+        return w;
+    }
+    
+    AIPSTACK_ALWAYS_INLINE
+    std::uint16_t loadNative16 (char const *ptr)
+    {
+        std::uint16_t w;
+        __builtin_memcpy(&w, ptr, sizeof(w));
+        return w;
+    }
+    
+    AIPSTACK_ALWAYS_INLINE
+    std::uint64_t addHalves64 (std::uint64_t sum, std::uint64_t w)
+    {
+        return sum + (w & std::uint32_t(0xFFFFFFFF)) + (w >> 32);
+    }
+    
+    AIPSTACK_ALWAYS_INLINE
+    std::uint16_t fold64 (std::uint64_t sum)
+    {
+        sum = (sum & std::uint32_t(0xFFFFFFFF)) + (sum >> 32);
+        sum = (sum & std::uint32_t(0xFFFFFFFF)) + (sum >> 32);
+        sum = (sum & std::uint16_t(0xFFFF)) + (sum >> 16);
+        sum = (sum & std::uint16_t(0xFFFF)) + (sum >> 16);
+        return std::uint16_t(sum);
+    }
+    
+    AIPSTACK_ALWAYS_INLINE
+    std::uint16_t nativeToBig16 (std::uint16_t x)
+    {
+        return NativeBigEndian ? x : __builtin_bswap16(x);
+    }
+
+#if AIPSTACK_CHKSUM_SSE2
+
+    inline constexpr std::size_t Sse2BlockSize = 64;
+    
+    // Sum a multiple of Sse2BlockSize bytes.
+    inline std::uint64_t sumBlocksSse2 (char const *data, std::size_t len)
+    {
+        __m128i const zero = _mm_setzero_si128();
+        __m128i acc0 = zero;
+        __m128i acc1 = zero;
+        
+        char const *end = data + len;
+        
+        while (data < end) {
+            for (int i = 0; i < 4; i++) {
+                __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const *>(data + 16 * i));
+                acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+                acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+            }
+            data += Sse2BlockSize;
+        }
+        
+        std::uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), _mm_add_epi64(acc0, acc1));
+        return lanes[0] + lanes[1];
+    }
+
+#endif
+
+#if AIPSTACK_CHKSUM_AVX2 || AIPSTACK_CHKSUM_AVX2_DISPATCH
+
+    inline constexpr std::size_t Avx2BlockSize = 128;
+    
+    // When dispatching at runtime, AVX2 is only used from this length on,
+    // below it the SSE2 kernel provides most of the benefit already.
+    inline constexpr std::size_t Avx2DispatchMinLen = 256;
+    
+    // Sum a multiple of Avx2BlockSize bytes. The interleaving of lanes by
+    // unpacklo/unpackhi is irrelevant since all lanes are summed.
+#if AIPSTACK_CHKSUM_AVX2_DISPATCH
+    __attribute__((target("avx2"))) AIPSTACK_NO_INLINE
+#endif
+    inline std::uint64_t sumBlocksAvx2 (char const *data, std::size_t len)
+    {
+        __m256i const zero = _mm256_setzero_si256();
+        __m256i acc0 = zero;
+        __m256i acc1 = zero;
+        
+        char const *end = data + len;
+        
+        while (data < end) {
+            for (int i = 0; i < 4; i++) {
+                __m256i v = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const *>(data + 32 * i));
+                acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+                acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+            }
+            data += Avx2BlockSize;
+        }
+        
+        std::uint64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes),
+                            _mm256_add_epi64(acc0, acc1));
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+
+#endif
+
+#if AIPSTACK_CHKSUM_AVX2_DISPATCH
+
+    inline bool cpuSupportsAvx2 ()
+    {
+        static bool const supported = (__builtin_cpu_init(),
+                                       __builtin_cpu_supports("avx2") != 0);
+        return supported;
+    }
+
+#endif
+
+#if AIPSTACK_CHKSUM_NEON
+
+    inline constexpr std::size_t NeonBlockSize = 64;
+    
+    // Sum a multiple of NeonBlockSize bytes.
+    inline std::uint64_t sumBlocksNeon (char const *data, std::size_t len)
+    {
+        uint64x2_t acc0 = vdupq_n_u64(0);
+        uint64x2_t acc1 = vdupq_n_u64(0);
+        
+        char const *end = data + len;
+        
+        while (data < end) {
+            auto ptr = reinterpret_cast<std::uint8_t const *>(data);
+            acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(ptr)));
+            acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(ptr + 16)));
+            acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(ptr + 32)));
+            acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(ptr + 48)));
+            data += NeonBlockSize;
+        }
+        
+        uint64x2_t acc = vaddq_u64(acc0, acc1);
+        return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+    }
+
+#endif
+
+    // Sum bytes as native-order words, with an odd trailing byte treated as if
+    // followed by a zero byte. The data pointer must be even when len is at least
+    // AlignPrologueMinLen.
+    AIPSTACK_ALWAYS_INLINE
+    std::uint64_t sumNative (char const *data, std::size_t len)
+    {
+        std::uint64_t sum = 0;
+        
+        // Alignment prologue: bring the pointer to an 8-byte boundary so that the
+        // wide loads below do not straddle cache lines.
+        if (len >= AlignPrologueMinLen) {
+            auto addr = reinterpret_cast<std::uintptr_t>(data);
+            if ((addr & 2) != 0) {
+                sum += loadNative16(data);
+                data += 2;
+                len -= 2;
+            }
+            if ((addr & 4) != 0) {
+                sum += loadNative32(data);
+                data += 4;
+                len -= 4;
+            }
+        }
+        
+        // Main body using the best available kernel.
+#if AIPSTACK_CHKSUM_AVX2 || AIPSTACK_CHKSUM_AVX2_DISPATCH
+#if AIPSTACK_CHKSUM_AVX2_DISPATCH
+        if (len >= Avx2DispatchMinLen && cpuSupportsAvx2())
+#endif
+        {
+            std::size_t body_len = len & ~(Avx2BlockSize - 1);
+            sum += sumBlocksAvx2(data, body_len);
+            data += body_len;
+            len -= body_len;
+        }
+#endif
+#if AIPSTACK_CHKSUM_SSE2
+        {
+            std::size_t body_len = len & ~(Sse2BlockSize - 1);
+            sum += sumBlocksSse2(data, body_len);
+            data += body_len;
+            len -= body_len;
+        }
+#endif
+#if AIPSTACK_CHKSUM_NEON
+        {
+            std::size_t body_len = len & ~(NeonBlockSize - 1);
+            sum += sumBlocksNeon(data, body_len);
+            data += body_len;
+            len -= body_len;
+        }
+#endif
+
+        // Unrolled 64-bit loop, handles everything when there is no SIMD
+        // and the remaining less than a block otherwise.
+        while (len >= 32) {
+            sum = addHalves64(sum, loadNative64(data));
+            sum = addHalves64(sum, loadNative64(data + 8));
+            sum = addHalves64(sum, loadNative64(data + 16));
+            sum = addHalves64(sum, loadNative64(data + 24));
+            data += 32;
+            len -= 32;
+        }
+        
+        // Epilogue.
+        while (len >= 8) {
+            sum = addHalves64(sum, loadNative64(data));
+            data += 8;
+            len -= 8;
+        }
+        if (len >= 4) {
+            sum += loadNative32(data);
+            data += 4;
+            len -= 4;
+        }
+        if (len >= 2) {
+            sum += loadNative16(data);
+            data += 2;
+            len -= 2;
+        }
+        if (len > 0) {
+            std::uint8_t byte = std::uint8_t(*data);
+            sum += NativeBigEndian ? std::uint16_t(std::uint16_t(byte) << 8) : byte;
+        }
+        
+        return sum;
+    }
+    
+    AIPSTACK_ALWAYS_INLINE
+    std::uint16_t chksumInverted (char const *data, std::size_t len)
+    {
+        // With an odd pointer, take the first byte separately so that the rest
+        // can use an even pointer. The rest is then summed in words which are
+        // offset by one byte, which is compensated by swapping bytes in its sum.
+        if (len >= AlignPrologueMinLen &&
+            (reinterpret_cast<std::uintptr_t>(data) & 1) != 0)
+        {
+            std::uint16_t rest = nativeToBig16(fold64(sumNative(data + 1, len - 1)));
+            std::uint32_t sum = std::uint32_t(std::uint8_t(*data)) << 8;
+            sum += __builtin_bswap16(rest);
+            sum = (sum & std::uint32_t(0xFFFF)) + (sum >> 16);
+            return std::uint16_t(sum);
+        }
+        
+        return nativeToBig16(fold64(sumNative(data, len)));
+    }
+
+    // Copy bytes while summing them in the same pass. No alignment prologue is
+    // done since source and destination alignment generally differ, and the
+    // loads and stores here are unaligned anyway.
+    AIPSTACK_ALWAYS_INLINE
+    std::uint16_t chksumInvertedCopy (char *dst, char const *src, std::size_t len)
+    {
+        std::uint64_t sum = 0;
+
+#if AIPSTACK_CHKSUM_SSE2
+        if (len >= Sse2BlockSize) {
+            __m128i const zero = _mm_setzero_si128();
+            __m128i acc0 = zero;
+            __m128i acc1 = zero;
+            
+            do {
+                for (int i = 0; i < 4; i++) {
+                    __m128i v = _mm_loadu_si128(
+                        reinterpret_cast<__m128i const *>(src + 16 * i));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16 * i), v);
+                    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+                    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+                }
+                src += Sse2BlockSize;
+                dst += Sse2BlockSize;
+                len -= Sse2BlockSize;
+            } while (len >= Sse2BlockSize);
+            
+            std::uint64_t lanes[2];
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes),
+                             _mm_add_epi64(acc0, acc1));
+            sum += lanes[0] + lanes[1];
+        }
+#endif
+
+        while (len >= 8) {
+            std::uint64_t w = loadNative64(src);
+            __builtin_memcpy(dst, &w, sizeof(w));
+            sum = addHalves64(sum, w);
+            src += 8;
+            dst += 8;
+            len -= 8;
+        }
+        if (len >= 4) {
+            std::uint32_t w = loadNative32(src);
+            __builtin_memcpy(dst, &w, sizeof(w));
+            sum += w;
+            src += 4;
+            dst += 4;
+            len -= 4;
+        }
+        if (len >= 2) {
+            std::uint16_t w = loadNative16(src);
+            __builtin_memcpy(dst, &w, sizeof(w));
+            sum += w;
+            src += 2;
+            dst += 2;
+            len -= 2;
+        }
+        if (len > 0) {
+            std::uint8_t byte = std::uint8_t(*src);
+            *dst = *src;
+            sum += NativeBigEndian ? std::uint16_t(std::uint16_t(byte) << 8) : byte;
+        }
+        
+        return nativeToBig16(fold64(sum));
+    }
+
+#else
+
+    inline std::uint16_t chksumInverted (char const *data, std::size_t len)
+    {
+        char const *even_end = data + (len & std::size_t(-2));
+        std::uint32_t sum = 0;
+        
+        while (data < even_end) {
+            sum += ReadSingleField<std::uint16_t>(data);
+            data += 2;
+        }
+        
+        if ((len & 1) != 0) {
+            std::uint8_t byte = ReadSingleField<std::uint8_t>(data);
+            sum += std::uint32_t(std::uint16_t(byte) << 8);
+        }
+        
+        sum = (sum & std::uint32_t(0xFFFF)) + (sum >> 16);
+        sum = (sum & std::uint32_t(0xFFFF)) + (sum >> 16);
+        
+        return std::uint16_t(sum);
+    }
+
+    inline std::uint16_t chksumInvertedCopy (char *dst, char const *src, std::size_t len)
+    {
+        std::memcpy(dst, src, len);
+        return chksumInverted(dst, len);
+    }
+
+#endif
+
+}
+
+}
+
+#endif
+
+#endif
@@ -55,7 +55,9 @@ enum class IpErr : std::uint8_t {
     LinkDown            = 12, /**< The link is down for the network interface. */
     BroadcastRejected   = 13, /**< Sending to a broadcast address was not allowed. */
     NonLocalSrc         = 14, /**< Sending from a non-local address was not allowed. */
-    AddrInUse           = 15  /**< Address is already in use. */
+    AddrInUse           = 15, /**< Address is already in use. */
+    RateLimited         = 16, /**< Sending was not allowed by a rate limit. */
+    ConnectionAborted   = 17  /**< The connection was aborted before it was established. */
 };
 
 /** @} */
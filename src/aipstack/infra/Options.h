@@ -93,15 +93,63 @@ namespace AIpStack {
  * >;
  * ```
  * 
+ * Option assignments can be grouped into a named preset using @ref ConfigOptionPreset.
+ * A preset passed as a template parameter behaves as if its option assignments were
+ * passed in its place, so assignments following the preset override those in it.
+ * Since options of other modules are ignored, a single preset may contain assignments
+ * for several modules and be passed to each of them. See @ref IpStackPresets.h for
+ * predefined presets.
+ * 
+ * ```
+ * using MyPreset = AIpStack::ConfigOptionPreset<
+ *     MyModuleOptions::ExampleTypeOption::Is<double>,
+ *     OtherModuleOptions::SomeOption::Is<10>
+ * >;
+ * 
+ * using MyModuleInstance = MyModule<
+ *     MyPreset,
+ *     MyModuleOptions::ExampleValueOption::Is<true>
+ * >;
+ * ```
+ * 
  * @{
  */
 
+/**
+ * A named group of option assignments.
+ * 
+ * See the @ref configuration module description. Presets may be nested.
+ * 
+ * @tparam Options Option assignments (@ref ConfigOptionType::Is or
+ *         @ref ConfigOptionValue::Is) or other presets.
+ */
+template<typename ...Options>
+struct ConfigOptionPreset {};
+
 #ifndef IN_DOXYGEN
 
 namespace OptionsPrivate {
+    // Prepends the options to Reversed in reverse order, expanding presets.
+    template<typename Reversed, typename ...Options>
+    struct ReverseFlatten {
+        using Result = Reversed;
+    };
+    
+    template<typename Reversed, typename Option, typename ...Options>
+    struct ReverseFlatten<Reversed, Option, Options...> {
+        using Result = typename ReverseFlatten<
+            ConsTypeList<Option, Reversed>, Options...>::Result;
+    };
+    
+    template<typename Reversed, typename ...PresetOptions, typename ...Options>
+    struct ReverseFlatten<Reversed, ConfigOptionPreset<PresetOptions...>, Options...> {
+        using Result = typename ReverseFlatten<
+            typename ReverseFlatten<Reversed, PresetOptions...>::Result, Options...>::Result;
+    };
+    
     template<typename Derived, typename DefaultValue, typename ...Options>
     using GetValue = TypeDictGetOrDefault<
-        TypeListReverse<MakeTypeList<Options...>>, Derived, DefaultValue
+        typename ReverseFlatten<EmptyTypeList, Options...>::Result, Derived, DefaultValue
     >;
 }
 
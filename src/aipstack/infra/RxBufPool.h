@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_RX_BUF_POOL_H
+#define AIPSTACK_RX_BUF_POOL_H
+
+#include <cstddef>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Options.h>
+#include <aipstack/infra/Instance.h>
+
+namespace AIpStack {
+
+#ifndef IN_DOXYGEN
+class IpRxBufPoolBase;
+
+template<typename Arg>
+class IpRxBufPool;
+#endif
+
+/**
+ * @addtogroup buffer
+ * @{
+ */
+
+/**
+ * A reference-counted receive buffer allocated from an @ref IpRxBufPool.
+ * 
+ * A driver which allocates its receive buffers from a pool passes the
+ * @ref IpRxBuf along with the received frame (see @ref EthIpIface::recvFrame
+ * and @ref IpDriverIface::recvIp4Packet). It then becomes available to protocol
+ * handlers and applications as @ref IpRxInfoIp4::rx_buf. Any party which wishes
+ * to access the received data after the receive callback has returned can call
+ * @ref retain, which keeps the buffer (including its @ref IpBufNode) valid until
+ * the corresponding call of @ref release. The data must not be modified.
+ * 
+ * The buffer is returned to its pool when the last reference is released.
+ */
+class IpRxBuf :
+    private NonCopyable<IpRxBuf>
+{
+    friend class IpRxBufPoolBase;
+    template<typename> friend class IpRxBufPool;
+
+public:
+    /**
+     * Return the pointer to the memory of the buffer.
+     * 
+     * @return Pointer to the memory of the buffer.
+     */
+    inline char * getData () const {
+        return m_node.ptr;
+    }
+    
+    /**
+     * Return the size of the memory of the buffer.
+     * 
+     * @return Size of the buffer in bytes.
+     */
+    inline std::size_t getCapacity () const {
+        return m_node.len;
+    }
+    
+    /**
+     * Return an @ref IpBufRef referencing the start of the buffer.
+     * 
+     * The node within the returned reference stays valid for as long as the
+     * buffer is retained, so the reference (and references derived from it,
+     * e.g. with @ref IpBufRef::hideHeader) may be stored while retained.
+     * 
+     * @param len Length of the data. Must not exceed @ref getCapacity.
+     * @return Reference to the first `len` bytes of the buffer.
+     */
+    inline IpBufRef getBufRef (std::size_t len) const {
+        AIPSTACK_ASSERT(len <= m_node.len);
+        return IpBufRef{&m_node, 0, len};
+    }
+    
+    /**
+     * Add a reference to the buffer.
+     * 
+     * May only be called while a reference is held (such as during the receive
+     * callback, where the driver holds a reference).
+     */
+    inline void retain () {
+        AIPSTACK_ASSERT(m_refcnt > 0);
+        m_refcnt++;
+    }
+    
+    /**
+     * Remove a reference to the buffer.
+     * 
+     * If this was the last reference, the buffer is returned to the pool.
+     */
+    inline void release ();
+
+private:
+    inline IpRxBuf () = default;
+
+private:
+    IpBufNode m_node;
+    std::size_t m_refcnt;
+    union {
+        IpRxBuf *m_next_free;
+        IpRxBufPoolBase *m_pool;
+    };
+};
+
+#ifndef IN_DOXYGEN
+
+class IpRxBufPoolBase :
+    private NonCopyable<IpRxBufPoolBase>
+{
+    friend class IpRxBuf;
+
+protected:
+    inline IpRxBufPoolBase () :
+        m_free_first(nullptr),
+        m_num_free(0)
+    {}
+    
+    inline void putFree (IpRxBuf *buf)
+    {
+        buf->m_next_free = m_free_first;
+        m_free_first = buf;
+        m_num_free++;
+    }
+    
+    inline IpRxBuf * takeFree ()
+    {
+        IpRxBuf *buf = m_free_first;
+        if (AIPSTACK_LIKELY(buf != nullptr)) {
+            m_free_first = buf->m_next_free;
+            m_num_free--;
+            buf->m_pool = this;
+            buf->m_refcnt = 1;
+        }
+        return buf;
+    }
+
+protected:
+    IpRxBuf *m_free_first;
+    std::size_t m_num_free;
+};
+
+inline void IpRxBuf::release ()
+{
+    AIPSTACK_ASSERT(m_refcnt > 0);
+    if (--m_refcnt == 0) {
+        m_pool->putFree(this);
+    }
+}
+
+#endif
+
+/**
+ * Fixed-size pool of reference-counted receive buffers.
+ * 
+ * A driver can allocate receive buffers from this pool (@ref alloc), receive
+ * frames into them and pass them to the stack together with the frame, so that
+ * receivers can retain the data instead of copying it (see @ref IpRxBuf). After
+ * the receive call returns, the driver releases its own reference.
+ * 
+ * All memory is embedded into this object so there is no dynamic allocation.
+ * Drivers which do not use a pool pass no @ref IpRxBuf, which costs only a
+ * null pointer in @ref IpRxInfoIp4.
+ * 
+ * @tparam Arg A type derived from an instantiated @ref IpRxBufPoolService, as
+ *         defined by @ref AIPSTACK_MAKE_INSTANCE, e.g.
+ *         `AIPSTACK_MAKE_INSTANCE(MyRxBufPool, (AIpStack::IpRxBufPoolService<>))`.
+ */
+template<typename Arg>
+class IpRxBufPool :
+    private IpRxBufPoolBase
+{
+    AIPSTACK_USE_VALS(Arg, (NumBuffers, BufferSize))
+    
+    static_assert(NumBuffers > 0);
+    static_assert(BufferSize > 0);
+
+public:
+    /**
+     * Construct the pool with all buffers free.
+     */
+    IpRxBufPool ()
+    {
+        for (std::size_t i = NumBuffers; i > 0; i--) {
+            IpRxBuf &buf = m_bufs[i - 1];
+            buf.m_node = IpBufNode{m_data[i - 1], BufferSize, nullptr};
+            putFree(&buf);
+        }
+    }
+    
+    /**
+     * Destruct the pool.
+     * 
+     * All buffers must have been released (this is an assert).
+     */
+    ~IpRxBufPool ()
+    {
+        AIPSTACK_ASSERT(m_num_free == NumBuffers);
+    }
+    
+    /**
+     * Allocate a buffer.
+     * 
+     * @return Allocated buffer with a reference count of one, or null if there
+     *         is no free buffer.
+     */
+    inline IpRxBuf * alloc ()
+    {
+        return takeFree();
+    }
+    
+    /**
+     * Return the number of free buffers.
+     * 
+     * @return Number of free buffers.
+     */
+    inline std::size_t getNumFree () const
+    {
+        return m_num_free;
+    }
+
+private:
+    IpRxBuf m_bufs[NumBuffers];
+    alignas(std::max_align_t) char m_data[NumBuffers][BufferSize];
+};
+
+/**
+ * Options for @ref IpRxBufPoolService.
+ */
+struct IpRxBufPoolOptions {
+    /**
+     * Number of buffers in the pool. This affects memory use.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(NumBuffers, std::size_t, 8)
+    
+    /**
+     * Size of each buffer in bytes. This affects memory use.
+     * 
+     * The default is suitable for Ethernet frames with a standard MTU.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(BufferSize, std::size_t, 1514)
+};
+
+/**
+ * Service definition for @ref IpRxBufPool.
+ * 
+ * The template parameters of this class are assignments of options defined in
+ * @ref IpRxBufPoolOptions, for example:
+ * AIpStack::IpRxBufPoolOptions::NumBuffers::Is\<16\>.
+ * 
+ * @tparam Options Assignments of options defined in @ref IpRxBufPoolOptions.
+ */
+template<typename ...Options>
+class IpRxBufPoolService {
+    template<typename>
+    friend class IpRxBufPool;
+    
+    AIPSTACK_OPTION_CONFIG_VALUE(IpRxBufPoolOptions, NumBuffers)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpRxBufPoolOptions, BufferSize)
+
+public:
+#ifndef IN_DOXYGEN
+    AIPSTACK_DEF_INSTANCE(IpRxBufPoolService, IpRxBufPool)
+#endif
+};
+
+/** @} */
+
+}
+
+#endif
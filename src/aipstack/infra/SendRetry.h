@@ -25,7 +25,15 @@
 #ifndef AIPSTACK_SEND_RETRY_H
 #define AIPSTACK_SEND_RETRY_H
 
-#include <aipstack/infra/ObserverNotification.h>
+#include <cstddef>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/structure/Accessor.h>
 
 namespace AIpStack {
 
@@ -46,6 +54,12 @@ namespace AIpStack {
  * call @ref IpSendRetryList::dispatchRequests, which would notify the senders which have
  * been added to the list.
  * 
+ * Requests are notified in the order in which they were added, and a module which has
+ * room for only some packets can notify only as many requests (see
+ * @ref IpSendRetryList::dispatchRequests(std::size_t)). Requests which fail again are
+ * added to the end of the list, so all senders get their turn. Drivers with a transmit
+ * queue can use @ref IpSendRetryTxQueue which does this based on the queue occupancy.
+ * 
  * The send-retry mechanism should be used as a hint only and must not be relied upon, as
  * there is generally no guarantee that this mechanism is supported, and even where it is
  * there is no guarantee that a notification will actually be generated in all possible
@@ -54,9 +68,6 @@ namespace AIpStack {
  * The @ref IpSendRetryRequest and @ref IpSendRetryList are not copy/move-constructible or
  * copy/move-assignable by design.
  * 
- * The implementation is based on the @ref observer mechanism and it essentially a simple
- * wrapper around that.
- * 
  * @{
  */
 
@@ -71,20 +82,18 @@ class IpSendRetryList;
  * A request object is either unassociated or associated with a specific
  * @ref IpSendRetryList. Association is established using @ref IpSendRetryList::addRequest.
  */
-class IpSendRetryRequest
-#ifndef IN_DOXYGEN
-    :private Observer<IpSendRetryRequest>
-#endif
+class IpSendRetryRequest :
+    private NonCopyable<IpSendRetryRequest>
 {
-    using SendRetryBaseObserver = Observer<IpSendRetryRequest>;
     friend class IpSendRetryList;
-    friend Observable<IpSendRetryRequest>;
     
 public:
     /**
      * Construct an unassociated request.
      */
-    IpSendRetryRequest () = default;
+    inline IpSendRetryRequest () :
+        m_retry_list(nullptr)
+    {}
     
     /**
      * Return whether the request is associated.
@@ -93,16 +102,13 @@ public:
      */
     inline bool isActive () const
     {
-        return SendRetryBaseObserver::isActive();
+        return m_retry_list != nullptr;
     }
     
     /**
      * Disassociate the request if associated.
      */
-    inline void reset ()
-    {
-        SendRetryBaseObserver::reset();
-    }
+    inline void reset ();
 
 protected:
     /**
@@ -111,7 +117,10 @@ protected:
      * This destructor is intentionally not virtual but is protected to prevent
      * incorrect usage.
      */
-    ~IpSendRetryRequest () = default;
+    inline ~IpSendRetryRequest ()
+    {
+        reset();
+    }
     
     /**
      * Callback called when sending should be retried, from
@@ -127,34 +136,52 @@ protected:
      * generally implies the restriction to not destruct the object managing it.
      */
     virtual void retrySending () = 0;
+
+private:
+    using LinkModel = PointerLinkModel<IpSendRetryRequest>;
+    
+    LinkedListNode<LinkModel> m_retry_node;
+    IpSendRetryList *m_retry_list;
 };
 
 /**
- * Represents a list of failed send attempts which can be notified all at once.
+ * Represents a list of failed send attempts which can be notified when sending
+ * should be retried.
  * 
  * See the @ref send-retry module description for an explanation of the send-retry
  * mechanism.
  * 
- * A retry list has an associated set of requests (@ref IpSendRetryRequest instances).
- * Requests can be associated and disassociated dynamically.
+ * A retry list has an associated set of requests (@ref IpSendRetryRequest instances)
+ * which is ordered by the time of association. Requests can be associated and
+ * disassociated dynamically.
  */
-class IpSendRetryList
-#ifndef IN_DOXYGEN
-    :private Observable<IpSendRetryRequest>
-#endif
+class IpSendRetryList :
+    private NonCopyable<IpSendRetryList>
 {
-    using BaseObservable = Observable<IpSendRetryRequest>;
+    friend class IpSendRetryRequest;
+    
+    using LinkModel = IpSendRetryRequest::LinkModel;
+    
+    struct RequestListAccessor : public MemberAccessor<IpSendRetryRequest,
+        LinkedListNode<LinkModel>, &IpSendRetryRequest::m_retry_node> {};
+    
+    using RequestList = LinkedList<RequestListAccessor, LinkModel, true>;
     
 public:
     /**
      * Construct a retry list with no associated requests.
      */
-    IpSendRetryList () = default;
+    inline IpSendRetryList () :
+        m_num_requests(0)
+    {}
     
     /**
      * Destruct the retry list, disassociating any requests.
      */
-    ~IpSendRetryList () = default;
+    inline ~IpSendRetryList ()
+    {
+        reset();
+    }
     
     /**
      * Return if the retry list has any associated requests.
@@ -163,7 +190,17 @@ public:
      */
     inline bool hasRequests () const
     {
-        return BaseObservable::hasObservers();
+        return m_num_requests > 0;
+    }
+    
+    /**
+     * Return the number of associated requests.
+     * 
+     * @return Number of associated requests.
+     */
+    inline std::size_t numRequests () const
+    {
+        return m_num_requests;
     }
     
     /**
@@ -171,22 +208,31 @@ public:
      * 
      * Any requests which were associated with this retry list become unassociated.
      */
-    inline void reset ()
+    void reset ()
     {
-        BaseObservable::reset();
+        while (!m_list.isEmpty()) {
+            IpSendRetryRequest *req = m_list.first();
+            m_list.removeFirst();
+            req->m_retry_list = nullptr;
+        }
+        m_num_requests = 0;
     }
     
     /**
      * Associate a request with this retry list.
      * 
+     * The request is added to the end of the list.
+     * 
      * @param req The request to associate, or null (in that case nothing is done).
      *        If the request is already associated, it is first disassociated.
      */
     void addRequest (IpSendRetryRequest *req)
     {
         if (req != nullptr) {
-            req->SendRetryBaseObserver::reset();
-            BaseObservable::addObserver(*req);
+            req->reset();
+            m_list.append(*req);
+            m_num_requests++;
+            req->m_retry_list = this;
         }
     }
     
@@ -194,15 +240,222 @@ public:
      * Notify the requests associated with this retry list while removing them.
      * 
      * This calls the @ref IpSendRetryRequest::retrySending callback for each request,
-     * disassociating each request from the retry list just before its call. The order of
-     * notifications is not specified.
+     * disassociating each request from the retry list just before its call. Requests
+     * are notified in the order in which they were associated. Requests associated from
+     * within the callbacks are not notified.
+     */
+    inline void dispatchRequests ()
+    {
+        dispatchRequests(m_num_requests);
+    }
+    
+    /**
+     * Notify at most the given number of requests associated with this retry list,
+     * removing them.
+     * 
+     * This is like @ref dispatchRequests() but only the first `max_count` requests in
+     * the order of association are notified. It is intended for modules which have
+     * room for only a limited number of packets, so that the remaining requests are
+     * not notified just to fail again.
+     * 
+     * @param max_count Maximum number of requests to notify.
+     * @return Number of requests notified.
+     */
+    std::size_t dispatchRequests (std::size_t max_count)
+    {
+        // Bound the count by the current number of requests so that requests
+        // added again from the callbacks are not notified in this call.
+        std::size_t count = (max_count < m_num_requests) ? max_count : m_num_requests;
+        
+        std::size_t notified = 0;
+        while (notified < count && !m_list.isEmpty()) {
+            IpSendRetryRequest *req = m_list.first();
+            m_list.removeFirst();
+            m_num_requests--;
+            req->m_retry_list = nullptr;
+            
+            notified++;
+            req->retrySending();
+        }
+        
+        return notified;
+    }
+    
+private:
+    void remove_request (IpSendRetryRequest &req)
+    {
+        AIPSTACK_ASSERT(m_num_requests > 0);
+        
+        m_list.remove(req);
+        m_num_requests--;
+    }
+    
+private:
+    StructureRaiiWrapper<RequestList> m_list;
+    std::size_t m_num_requests;
+};
+
+inline void IpSendRetryRequest::reset ()
+{
+    if (m_retry_list != nullptr) {
+        m_retry_list->remove_request(*this);
+        m_retry_list = nullptr;
+    }
+}
+
+/**
+ * Send-retry list for a transmit queue of a driver, which notifies requests
+ * based on the queue occupancy.
+ * 
+ * The driver reports packets entering the queue (@ref packetsQueued) and leaving
+ * it (@ref packetsCompleted). When the occupancy reaches the high watermark the
+ * queue is considered stopped, and @ref isStopped returns true until the
+ * occupancy drops to the low watermark. The driver should then fail sends with
+ * @ref IpErr::OutputBufferFull and associate the send-retry request (@ref
+ * addRequest). As packets complete while the queue is not stopped, waiting
+ * requests are notified in order of association, at most as many as there is
+ * room for in the queue. The gap between the watermarks avoids waking senders
+ * for every completed packet.
+ * 
+ * A callback can be set to be informed when the queue becomes stopped or is no
+ * longer stopped (@ref setWatermarkHandler), for example to stop polling
+ * for completions.
+ */
+class IpSendRetryTxQueue :
+    private NonCopyable<IpSendRetryTxQueue>
+{
+public:
+    /**
+     * Type of callback called when the queue becomes stopped or is no longer
+     * stopped.
+     * 
+     * The callback must not call functions of this object.
+     * 
+     * @param stopped True if the high watermark was reached, false if the
+     *        occupancy dropped to the low watermark.
+     */
+    using WatermarkHandler = Function<void(bool stopped)>;
+    
+    /**
+     * Construct the object for an empty queue.
+     * 
+     * @param capacity Capacity of the queue in packets.
+     * @param low_watermark Occupancy at or below which the queue is no longer
+     *        stopped, must be less than `high_watermark`.
+     * @param high_watermark Occupancy at which the queue becomes stopped, must be
+     *        at least 1 and at most `capacity`.
+     */
+    IpSendRetryTxQueue (std::size_t capacity, std::size_t low_watermark,
+                        std::size_t high_watermark) :
+        m_handler(nullptr),
+        m_capacity(capacity),
+        m_low_watermark(low_watermark),
+        m_high_watermark(high_watermark),
+        m_occupancy(0),
+        m_stopped(false)
+    {
+        AIPSTACK_ASSERT(high_watermark >= 1 && high_watermark <= capacity);
+        AIPSTACK_ASSERT(low_watermark < high_watermark);
+    }
+    
+    /**
+     * Set the callback called when the queue becomes stopped or is no longer
+     * stopped.
+     * 
+     * @param handler The callback, or null for none.
+     */
+    inline void setWatermarkHandler (WatermarkHandler handler)
+    {
+        m_handler = handler;
+    }
+    
+    /**
+     * Return whether the queue is stopped, that is whether sending should fail.
+     * 
+     * @return True if stopped.
+     */
+    inline bool isStopped () const
+    {
+        return m_stopped;
+    }
+    
+    /**
+     * Return the number of packets in the queue.
+     * 
+     * @return Occupancy of the queue.
      */
-    void dispatchRequests ()
+    inline std::size_t getOccupancy () const
     {
-        BaseObservable::notifyRemoveObservers([&](IpSendRetryRequest &request) {
-            request.retrySending();
-        });
+        return m_occupancy;
     }
+    
+    /**
+     * Associate a request to be notified when there is room in the queue.
+     * 
+     * @param req The request to associate, or null (in that case nothing is done).
+     */
+    inline void addRequest (IpSendRetryRequest *req)
+    {
+        m_retry_list.addRequest(req);
+    }
+    
+    /**
+     * Report that packets have entered the queue.
+     * 
+     * This may call the watermark handler.
+     * 
+     * @param count Number of packets. The occupancy must not exceed the capacity.
+     */
+    void packetsQueued (std::size_t count = 1)
+    {
+        AIPSTACK_ASSERT(count <= m_capacity - m_occupancy);
+        
+        m_occupancy += count;
+        
+        if (!m_stopped && m_occupancy >= m_high_watermark) {
+            m_stopped = true;
+            if (m_handler) {
+                m_handler(true);
+            }
+        }
+    }
+    
+    /**
+     * Report that packets have left the queue.
+     * 
+     * This may call the watermark handler, and unless the queue is stopped,
+     * notifies waiting requests up to the number of free places in the queue.
+     * Notified requests may send packets from within this call.
+     * 
+     * @param count Number of packets, at most the occupancy.
+     */
+    void packetsCompleted (std::size_t count = 1)
+    {
+        AIPSTACK_ASSERT(count <= m_occupancy);
+        
+        m_occupancy -= count;
+        
+        if (m_stopped) {
+            if (m_occupancy > m_low_watermark) {
+                return;
+            }
+            m_stopped = false;
+            if (m_handler) {
+                m_handler(false);
+            }
+        }
+        
+        m_retry_list.dispatchRequests(m_capacity - m_occupancy);
+    }
+    
+private:
+    WatermarkHandler m_handler;
+    IpSendRetryList m_retry_list;
+    std::size_t m_capacity;
+    std::size_t m_low_watermark;
+    std::size_t m_high_watermark;
+    std::size_t m_occupancy;
+    bool m_stopped;
 };
 
 /** @} */
@@ -28,6 +28,8 @@
 #include <cstddef>
 #include <cstring>
 #include <array>
+#include <tuple>
+#include <utility>
 #include <type_traits>
 
 #include <aipstack/meta/TypeListUtils.h>
@@ -113,6 +115,20 @@ namespace AIpStack {
  * @ref StructBase::MakeVal helper function can be used to create a @ref StructBase::Val
  * from existing data.
  * 
+ * When most fields of a structure are needed, the @ref StructBase::Native class can be
+ * used instead. It holds the decoded values of all fields in native representation;
+ * @ref StructBase::Decode reads the whole structure at once and @ref StructBase::Encode
+ * writes it back. This lets the compiler schedule all the loads (or stores) and byte
+ * swaps together instead of interleaving them with the code using the fields. For
+ * example:
+ * 
+ * ```
+ * MyHeader::Native hdr = MyHeader::Decode(data);
+ * std::uint32_t a = hdr.get(MyHeader::FieldA());
+ * hdr.set(MyHeader::FieldB(), 123);
+ * MyHeader::Encode(data, hdr);
+ * ```
+ * 
  * The system directly supports the following field types:
  * - Binary integer types including `char`, `unsigned char` and fixed-width integer types
  *   (`intN_t` and `uintN_t` for N=8,16,32,64), as well as enum types based on these
@@ -258,6 +274,7 @@ class StructBase {
         
         using Handler = StructFieldHandler<typename Field::StructFieldType>;
         using ValType = typename Handler::ValType;
+        inline static constexpr std::size_t Index = std::size_t(FieldIndex);
         inline static constexpr std::size_t FieldOffset =
             PrevFieldInfo::PartialStructSize;
         inline static constexpr std::size_t PartialStructSize =
@@ -270,9 +287,17 @@ class StructBase {
     template<typename This=StructBase>
     using LastFieldInfo = FieldInfo<TypeListLength<Fields<This>> - 1, void>;
     
+    template<typename This=StructBase>
+    using FieldIndices = std::make_index_sequence<TypeListLength<Fields<This>>>;
+    
+    template<std::size_t... FieldIndex>
+    static std::tuple<typename FieldInfo<int(FieldIndex)>::ValType...>
+    native_tuple_type (std::index_sequence<FieldIndex...>);
+    
 public:
     class Ref;
     class Val;
+    class Native;
     
     /**
      * Get the value type of a specific field.
@@ -388,6 +413,29 @@ public:
         return val;
     }
     
+    /**
+     * Decode all fields of a structure.
+     * 
+     * @param data Pointer to the start of the structure.
+     * @return A @ref Native object containing the values of all fields.
+     */
+    inline static Native Decode (char const *data)
+    {
+        return Native::decode_all(data, FieldIndices<>());
+    }
+    
+    /**
+     * Encode all fields of a structure.
+     * 
+     * @param data Pointer to the start of the structure.
+     * @param native Field values to write. All fields are written, so every field
+     *        must have been set.
+     */
+    inline static void Encode (char *data, Native const &native)
+    {
+        native.encode_all(data, FieldIndices<>());
+    }
+    
     /**
      * Base class with definitions common to @ref Val and @ref Ref.
      */
@@ -572,6 +620,64 @@ public:
          */
         char *data;
     };
+    
+    /**
+     * Holds the values of all fields of a structure in native representation.
+     * 
+     * Objects are created using @ref StructBase::Decode or default-constructed (which
+     * value-initializes all fields) and written using @ref StructBase::Encode.
+     */
+    class Native : public ValRefBase {
+        friend StructBase;
+        
+    public:
+        /**
+         * Get the value of a field.
+         * 
+         * @tparam Field Field identifier.
+         * @return Field value.
+         */
+        template<typename Field>
+        inline ValType<Field> get (Field) const
+        {
+            return std::get<GetFieldInfo<Field>::Index>(m_fields);
+        }
+        
+        /**
+         * Set the value of a field.
+         * 
+         * @tparam Field Field identifier.
+         * @param value Field value.
+         */
+        template<typename Field>
+        inline void set (Field, ValType<Field> value)
+        {
+            std::get<GetFieldInfo<Field>::Index>(m_fields) = value;
+        }
+        
+    private:
+        template<std::size_t... FieldIndex>
+        inline static Native decode_all (
+            char const *data, std::index_sequence<FieldIndex...>)
+        {
+            Native native;
+            ((std::get<FieldIndex>(native.m_fields) =
+                FieldInfo<int(FieldIndex)>::Handler::get(
+                    data + FieldInfo<int(FieldIndex)>::FieldOffset)), ...);
+            return native;
+        }
+        
+        template<std::size_t... FieldIndex>
+        inline void encode_all (char *data, std::index_sequence<FieldIndex...>) const
+        {
+            (FieldInfo<int(FieldIndex)>::Handler::set(
+                data + FieldInfo<int(FieldIndex)>::FieldOffset,
+                std::get<FieldIndex>(m_fields)), ...);
+        }
+        
+    private:
+        decltype(native_tuple_type(FieldIndices<>())) m_fields;
+    };
 };
 
 /**
@@ -28,6 +28,7 @@
 #include <cstddef>
 
 #include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
 #include <aipstack/infra/Buf.h>
 
 namespace AIpStack {
@@ -232,6 +233,256 @@ private:
     char m_data[TotalMaxSize];
 };
 
+/**
+ * Bump allocator for temporary allocation of outgoing packets.
+ * 
+ * This manages a memory region provided by the user, from which @ref
+ * TxArenaAllocHelper objects allocate their buffers. Allocations must be released in
+ * the reverse order of their allocation, which is naturally the case when the helpers
+ * are used as automatic variables. Once all helpers have been destructed (after the
+ * respective send functions have returned), the arena is empty again.
+ * 
+ * @ref IpStack contains an arena whose size is configured using
+ * @ref IpStackOptions::TxArenaSize, see @ref IpStack::getTxArena.
+ */
+class TxArena :
+    private NonCopyable<TxArena>
+{
+    template<std::size_t, std::size_t> friend class TxArenaAllocHelper;
+    
+    inline static constexpr std::size_t Align = alignof(std::max_align_t);
+
+public:
+    /**
+     * Construct the arena for the given memory region.
+     * 
+     * @param mem Start of the memory region. Should be aligned to
+     *        `alignof(std::max_align_t)`.
+     * @param size Size of the memory region.
+     */
+    inline TxArena (char *mem, std::size_t size) :
+        m_mem(mem),
+        m_size(size),
+        m_used(0)
+    {}
+    
+    /**
+     * Destruct the arena.
+     * 
+     * There must be no outstanding allocations (this is an assert).
+     */
+    inline ~TxArena ()
+    {
+        AIPSTACK_ASSERT(m_used == 0);
+    }
+    
+    /**
+     * Return the number of bytes still available for allocation.
+     * 
+     * @return Number of available bytes.
+     */
+    inline std::size_t getAvailable () const
+    {
+        return m_size - m_used;
+    }
+
+private:
+    inline char * alloc (std::size_t size)
+    {
+        std::size_t alloc_size = (size + (Align - 1)) / Align * Align;
+        if (alloc_size > m_size - m_used) {
+            return nullptr;
+        }
+        char *ptr = m_mem + m_used;
+        m_used += alloc_size;
+        return ptr;
+    }
+    
+    inline void free (char *ptr)
+    {
+        AIPSTACK_ASSERT(ptr >= m_mem && ptr <= m_mem + m_used);
+        m_used = std::size_t(ptr - m_mem);
+    }
+
+private:
+    char *m_mem;
+    std::size_t m_size;
+    std::size_t m_used;
+};
+
+/**
+ * Provides allocation for outgoing packets from a @ref TxArena.
+ * 
+ * This has the same interface as @ref TxAllocHelper except that the buffer is
+ * allocated from a @ref TxArena instead of being embedded in this object, so that
+ * large buffers do not need to be placed on the stack. The memory is allocated in the
+ * constructor and returned to the arena in the destructor.
+ * 
+ * Unlike with @ref TxAllocHelper, allocation can fail if the arena does not have enough
+ * free space. The user must therefore check @ref isAllocated after construction and
+ * must not use the other functions if it returns false.
+ * 
+ * @tparam MaxSize Maximum possible data size.
+ * @tparam HeaderBefore Space before the data to reserve for headers.
+ */
+template<std::size_t MaxSize, std::size_t HeaderBefore>
+class TxArenaAllocHelper :
+    private NonCopyable<TxArenaAllocHelper<MaxSize, HeaderBefore>>
+{
+    inline static constexpr std::size_t TotalMaxSize = HeaderBefore + MaxSize;
+
+public:
+    /**
+     * Allocate from the arena for data of the specified size.
+     * 
+     * @param arena Arena to allocate from. It must outlive this object.
+     * @param size Data size. Must be less than or equal to `MaxSize`.
+     */
+    inline TxArenaAllocHelper (TxArena &arena, std::size_t size) :
+        m_arena(arena)
+    {
+        AIPSTACK_ASSERT(size <= MaxSize);
+        
+        m_node.ptr = arena.alloc(TotalMaxSize);
+        m_node.len = HeaderBefore + size;
+        m_node.next = nullptr;
+        m_tot_len = size;
+    }
+    
+    /**
+     * Return the memory to the arena.
+     */
+    inline ~TxArenaAllocHelper ()
+    {
+        if (m_node.ptr != nullptr) {
+            m_arena.free(m_node.ptr);
+        }
+    }
+    
+    /**
+     * Check whether the allocation was successful.
+     * 
+     * @return True if memory was allocated, false if the arena did not have enough
+     *         free space.
+     */
+    inline bool isAllocated () const
+    {
+        return m_node.ptr != nullptr;
+    }
+    
+    /**
+     * Get the pointer to the allocated buffer.
+     * 
+     * See @ref TxAllocHelper::getPtr.
+     * 
+     * @return Pointer to allocated buffer, after any space reserved for headers.
+     */
+    inline char * getPtr ()
+    {
+        AIPSTACK_ASSERT(isAllocated());
+        
+        return m_node.ptr + HeaderBefore;
+    }
+    
+    /**
+     * Change the size of the data.
+     * 
+     * See @ref TxAllocHelper::changeSize.
+     * 
+     * @param size Data size. Must be less than or equal to `MaxSize`.
+     */
+    inline void changeSize (std::size_t size)
+    {
+        AIPSTACK_ASSERT(isAllocated());
+        AIPSTACK_ASSERT(m_node.next == nullptr);
+        AIPSTACK_ASSERT(size <= MaxSize);
+        
+        m_node.len = HeaderBefore + size;
+        m_tot_len = size;
+    }
+    
+    /**
+     * Link to additional data that will follow data in the allocated buffer.
+     * 
+     * See @ref TxAllocHelper::setNext.
+     * 
+     * @param next_node Pointer to the @ref IpBufNode where the additional data starts. Must
+     *        not be null.
+     * @param next_len Length of the additional data.
+     */
+    inline void setNext (IpBufNode const *next_node, std::size_t next_len)
+    {
+        AIPSTACK_ASSERT(isAllocated());
+        AIPSTACK_ASSERT(m_node.next == nullptr);
+        AIPSTACK_ASSERT(m_node.len == HeaderBefore + m_tot_len);
+        AIPSTACK_ASSERT(next_node != nullptr);
+        
+        m_node.next = next_node;
+        m_tot_len += next_len;
+    }
+    
+    /**
+     * Get an @ref IpBufRef referencing the allocated data and any additional data.
+     * 
+     * See @ref TxAllocHelper::getBufRef.
+     * 
+     * @return The @ref IpBufRef referencing the data.
+     */
+    inline IpBufRef getBufRef ()
+    {
+        AIPSTACK_ASSERT(isAllocated());
+        
+        return IpBufRef{&m_node, HeaderBefore, m_tot_len};
+    }
+
+private:
+    TxArena &m_arena;
+    IpBufNode m_node;
+    std::size_t m_tot_len;
+};
+
+#ifndef IN_DOXYGEN
+
+template<bool UseArena, std::size_t MaxSize, std::size_t HeaderBefore>
+class TxAllocHelperSelectImpl :
+    public TxArenaAllocHelper<MaxSize, HeaderBefore>
+{
+public:
+    using TxArenaAllocHelper<MaxSize, HeaderBefore>::TxArenaAllocHelper;
+};
+
+template<std::size_t MaxSize, std::size_t HeaderBefore>
+class TxAllocHelperSelectImpl<false, MaxSize, HeaderBefore> :
+    public TxAllocHelper<MaxSize, HeaderBefore>
+{
+public:
+    inline TxAllocHelperSelectImpl ([[maybe_unused]] TxArena &arena, std::size_t size) :
+        TxAllocHelper<MaxSize, HeaderBefore>(size)
+    {}
+    
+    inline static constexpr bool isAllocated ()
+    {
+        return true;
+    }
+};
+
+#endif
+
+/**
+ * Selects between @ref TxArenaAllocHelper and @ref TxAllocHelper at compile time.
+ * 
+ * Both alternatives are constructed using a @ref TxArena and the data size, and
+ * provide `isAllocated` (which is constant true for @ref TxAllocHelper). This allows
+ * senders to offer a configuration option for whether to use the arena.
+ * 
+ * @tparam UseArena Whether to use @ref TxArenaAllocHelper (true) or
+ *         @ref TxAllocHelper (false).
+ * @tparam MaxSize Maximum possible data size.
+ * @tparam HeaderBefore Space before the data to reserve for headers.
+ */
+template<bool UseArena, std::size_t MaxSize, std::size_t HeaderBefore>
+using TxAllocHelperSelect = TxAllocHelperSelectImpl<UseArena, MaxSize, HeaderBefore>;
+
 /** @} */
 
 }
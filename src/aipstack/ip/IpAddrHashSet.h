@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_ADDR_HASH_SET_H
+#define AIPSTACK_IP_ADDR_HASH_SET_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/ip/IpAddr.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Fixed-capacity set of IPv4 addresses with constant-time lookup.
+ * 
+ * The addresses are stored in an open-addressing hash table with linear
+ * probing, which has at least twice as many slots as the capacity so that
+ * lookups only need to examine a few slots. Removal shifts back the following
+ * entries of the probe sequence, so there are no tombstones and lookups do
+ * not get slower over time. The zero address marks an empty slot and cannot
+ * be stored.
+ * 
+ * @tparam Capacity Maximum number of addresses. If zero, the set takes no
+ *         memory and is always empty.
+ */
+template<std::size_t Capacity>
+class IpAddrHashSet
+{
+    inline static constexpr std::size_t TableSize = []() {
+        std::size_t size = 1;
+        while (size < 2 * Capacity) {
+            size *= 2;
+        }
+        return size;
+    }();
+    
+    inline static constexpr std::size_t Mask = TableSize - 1;
+    
+public:
+    /**
+     * Construct an empty set.
+     */
+    IpAddrHashSet () :
+        m_size(0)
+    {
+        for (Ip4Addr &slot : m_table) {
+            slot = Ip4Addr::ZeroAddr();
+        }
+    }
+    
+    /**
+     * Return the number of addresses in the set.
+     * 
+     * @return Number of addresses.
+     */
+    inline std::size_t size () const
+    {
+        return m_size;
+    }
+    
+    /**
+     * Check if an address is in the set.
+     * 
+     * @param addr Address to look for.
+     * @return Whether the address is in the set.
+     */
+    inline bool contains (Ip4Addr addr) const
+    {
+        if (m_size == 0) {
+            return false;
+        }
+        return m_table[find_slot(addr)] == addr && !addr.isZero();
+    }
+    
+    /**
+     * Add an address to the set.
+     * 
+     * @param addr Address to add (must not be zero).
+     * @return True if the address was added or was already in the set,
+     *         false if the set is full.
+     */
+    bool insert (Ip4Addr addr)
+    {
+        AIPSTACK_ASSERT(!addr.isZero());
+        
+        std::size_t index = find_slot(addr);
+        if (m_table[index] == addr) {
+            return true;
+        }
+        if (m_size == Capacity) {
+            return false;
+        }
+        
+        m_table[index] = addr;
+        m_size++;
+        return true;
+    }
+    
+    /**
+     * Remove an address from the set.
+     * 
+     * @param addr Address to remove.
+     * @return True if the address was removed, false if it was not in the set.
+     */
+    bool remove (Ip4Addr addr)
+    {
+        if (addr.isZero()) {
+            return false;
+        }
+        
+        std::size_t index = find_slot(addr);
+        if (m_table[index] != addr) {
+            return false;
+        }
+        
+        // Shift back entries of the probe sequence which would not be found
+        // after the slot becomes empty.
+        std::size_t hole = index;
+        std::size_t next = index;
+        while (true) {
+            next = (next + 1) & Mask;
+            Ip4Addr entry = m_table[next];
+            if (entry.isZero()) {
+                break;
+            }
+            std::size_t home = home_slot(entry);
+            if (((next - home) & Mask) >= ((next - hole) & Mask)) {
+                m_table[hole] = entry;
+                hole = next;
+            }
+        }
+        m_table[hole] = Ip4Addr::ZeroAddr();
+        
+        m_size--;
+        return true;
+    }
+    
+    /**
+     * Call a function for each address in the set, in no particular order.
+     * 
+     * The set must not be modified from the function.
+     * 
+     * @param func Function called as func(addr).
+     */
+    template<typename Func>
+    void forEach (Func func) const
+    {
+        for (Ip4Addr addr : m_table) {
+            if (!addr.isZero()) {
+                func(addr);
+            }
+        }
+    }
+    
+private:
+    inline static std::size_t home_slot (Ip4Addr addr)
+    {
+        HashAccumulator hash;
+        hash.addWord(addr.value());
+        return std::size_t(hash.getHash()) & Mask;
+    }
+    
+    // Find the slot with the address or the empty slot where it would be
+    // inserted. There is always an empty slot since the table is larger
+    // than the capacity.
+    std::size_t find_slot (Ip4Addr addr) const
+    {
+        std::size_t index = home_slot(addr);
+        while (!m_table[index].isZero() && m_table[index] != addr) {
+            index = (index + 1) & Mask;
+        }
+        return index;
+    }
+    
+private:
+    std::size_t m_size;
+    Ip4Addr m_table[TableSize];
+};
+
+#ifndef IN_DOXYGEN
+template<>
+class IpAddrHashSet<0>
+{
+public:
+    inline std::size_t size () const { return 0; }
+    
+    inline bool contains (Ip4Addr) const { return false; }
+    
+    inline bool insert (Ip4Addr) { return false; }
+    
+    inline bool remove (Ip4Addr) { return false; }
+    
+    template<typename Func>
+    inline void forEach (Func) const {}
+};
+#endif
+
+/** @} */
+
+}
+
+#endif
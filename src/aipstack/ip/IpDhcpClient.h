@@ -117,6 +117,8 @@ enum class IpDhcpClientEvent {
      * - The lease has timed out.
      * - A NAK was received in reponse to a request in the constext of the
      *   RENEWING or REBINDING state.
+     * - An ARP response revealed that the address is in use shortly after the
+     *   lease was obtained via the REBOOTING state.
      */
     LeaseLost,
 
@@ -160,7 +162,9 @@ public:
     inline IpDhcpClientInitOptions ()
     : client_id(MemRef::Null()),
       vendor_class_id(MemRef::Null()),
-      request_ip_address(Ip4Addr::ZeroAddr())
+      request_ip_address(Ip4Addr::ZeroAddr()),
+      request_server_identifier(0),
+      request_lease_time_left_s(TypeMax<std::uint32_t>)
     {}
     
     /**
@@ -183,9 +187,31 @@ public:
      * Address to request, zero for none.
      * 
      * If nonzero, then initially this address will be requested
-     * through the REBOOTING state.
+     * through the REBOOTING state (RFC 2131 INIT-REBOOT). This is
+     * intended for reusing a previously obtained lease, e.g. one
+     * persisted across a restart. The lease is obtained with a single
+     * request/ACK exchange, while the address is checked for conflicts
+     * using ARP in parallel.
      */
     Ip4Addr request_ip_address;
+    
+    /**
+     * DHCP server identifier of the lease of request_ip_address,
+     * zero if unknown.
+     * 
+     * If known, this is used to decline the address if a conflict is
+     * detected while rebooting.
+     */
+    std::uint32_t request_server_identifier;
+    
+    /**
+     * Remaining time in seconds of the lease of request_ip_address,
+     * the maximum value if unknown.
+     * 
+     * If this is zero, the lease is considered expired and
+     * request_ip_address is not requested, discovery is done instead.
+     */
+    std::uint32_t request_lease_time_left_s;
 };
 
 template<typename Arg>
@@ -383,8 +409,11 @@ public:
         // Start observing interface state.
         m_iface_observer.observe(*iface);
         
-        // Remember any requested IP address for Rebooting.
-        m_info.ip_address = opts.request_ip_address;
+        // Remember any requested IP address for Rebooting, unless the lease of
+        // that address is known to have expired.
+        m_info.ip_address = (opts.request_lease_time_left_s == 0) ?
+            Ip4Addr::ZeroAddr() : opts.request_ip_address;
+        m_info.dhcp_server_identifier = opts.request_server_identifier;
         
         if (iface->getDriverState().link_up) {
             // Start discovery/rebooting.
@@ -504,6 +533,10 @@ private:
     // Start discovery process.
     void start_discovery_or_rebooting ()
     {
+        // Unsubscribe from ARP updates in case we were checking for a conflict
+        // while rebooting.
+        m_arp_observer.reset();
+        
         // Generate an XID.
         new_xid();
         
@@ -514,6 +547,10 @@ private:
             // Going to Selecting state.
             m_state = DhcpState::Selecting;
             
+            // Remember when the first discover was sent, needed if the lease is
+            // obtained with rapid commit.
+            m_request_send_time = platform().getTime();
+            
             // Send discover.
             send_discover();
         } else {
@@ -525,6 +562,11 @@ private:
             
             // Send request.
             send_request();
+            
+            // Check that the address is not in use in parallel with the request,
+            // so that binding the lease is not delayed by this check.
+            m_arp_observer.observe(*ethHw());
+            ethHw()->sendArpQuery(m_info.ip_address);
         }
         
         // Set the timer for retransmission (or reverting from Rebooting to discovery).
@@ -589,6 +631,9 @@ private:
         if (m_request_count >= Params::XidReuseMax) {
             m_request_count = 1;
             new_xid();
+            
+            // Remember when the first discover with this XID is sent.
+            m_request_send_time = platform().getTime();
         } else {
             m_request_count++;
         }
@@ -624,6 +669,11 @@ private:
         // Send request.
         send_request();
         
+        // In Rebooting, also repeat the ARP query.
+        if (m_state == DhcpState::Rebooting) {
+            ethHw()->sendArpQuery(m_info.ip_address);
+        }
+        
         // Restart timer with doubled retransmission timeout.
         double_rtx_timeout();
         set_timer_for_rtx();
@@ -663,6 +713,9 @@ private:
         
         AIPSTACK_ASSERT(m_lease_time_passed <= m_info.lease_time_s);
         
+        // End any ARP check that was started in Rebooting.
+        m_arp_observer.reset();
+        
         TimeType now = platform().getTime();
         
         // Calculate how much time in seconds has passed since the time this timer
@@ -904,10 +957,13 @@ private:
             reset_rtx_timeout();
             set_timer_for_rtx();
         }
-        // Handle received ACK in Requesting/Renewing/Rebinding/Rebooting state.
+        // Handle received ACK in Requesting/Renewing/Rebinding/Rebooting state,
+        // or in Selecting state if rapid commit is used (RFC 4039).
         else if (opts.dhcp_message_type == DhcpMessageType::Ack &&
-                 m_state == OneOf(DhcpState::Requesting, DhcpState::Renewing,
-                                  DhcpState::Rebinding, DhcpState::Rebooting))
+                 (m_state == OneOf(DhcpState::Requesting, DhcpState::Renewing,
+                                   DhcpState::Rebinding, DhcpState::Rebooting) ||
+                  (m_state == DhcpState::Selecting && Params::RapidCommit &&
+                   opts.have.rapid_commit)))
         {
             // Sanity check and fixup lease information.
             if (!checkAndFixupAck(ip_address, opts)) {
@@ -922,7 +978,7 @@ private:
                     return;
                 }
             }
-            else if (m_state != DhcpState::Rebooting) {
+            else if (m_state == OneOf(DhcpState::Renewing, DhcpState::Rebinding)) {
                 // In Renewing/Rebinding, check that not too much time has passed
                 // that would make m_request_send_time invalid.
                 // This check effectively means that the timer is still set for the
@@ -936,6 +992,11 @@ private:
                     return;
                 }
             }
+            else if (m_state == DhcpState::Rebooting && ip_address != m_info.ip_address) {
+                // In Rebooting, the parallel ARP check does not apply to a
+                // different address than the one requested, so end it.
+                m_arp_observer.reset();
+            }
             
             // Remember/update the lease information.
             m_info.ip_address = ip_address;
@@ -952,8 +1013,9 @@ private:
                      opts.have.dns_servers * sizeof(Ip4Addr));
             m_info.server_mac = ethHw()->getRxEthHeader().get(EthHeader::SrcMac());
             
-            if (m_state == DhcpState::Requesting) {
-                // In Requesting state, we need to do the ARP check first.
+            if (m_state == OneOf(DhcpState::Requesting, DhcpState::Selecting)) {
+                // In Requesting state (or Selecting with rapid commit), we need to
+                // do the ARP check first.
                 go_checking();
             } else {
                 // Bind the lease.
@@ -1001,12 +1063,17 @@ private:
     
     void arpInfoReceived (Ip4Addr ip_addr, [[maybe_unused]] MacAddr mac_addr)
     {
-        AIPSTACK_ASSERT(m_state == DhcpState::Checking);
+        // In Rebooting and Bound we may be checking the address in parallel with
+        // requesting it and after having bound it (see go_bound).
+        AIPSTACK_ASSERT(m_state == OneOf(DhcpState::Checking,
+            DhcpState::Rebooting, DhcpState::Bound));
         
         // Is this an ARP message from the IP address we are checking?
         if (ip_addr == m_info.ip_address) {
-            // Send a Decline.
-            send_decline();
+            // Send a Decline, unless we are rebooting and don't know the server.
+            if (m_state != DhcpState::Rebooting || m_info.dhcp_server_identifier != 0) {
+                send_decline();
+            }
             
             // Unsubscribe from ARP updates.
             m_arp_observer.reset();
@@ -1116,6 +1183,9 @@ private:
     {
         bool had_lease = hasLease();
         
+        // Unsubscribe from ARP updates in case we were checking for a conflict.
+        m_arp_observer.reset();
+        
         if (discover_immediately) {
             // Go directly to Selecting state without delay.
             start_discovery();
@@ -1187,6 +1257,14 @@ private:
         // Limit to how far into the future the timer can be set.
         timer_rel_sec = MinValue(timer_rel_sec, MaxTimerSeconds);
         
+        // If we are still checking the address using ARP (after Rebooting),
+        // keep checking for a limited time after binding. The timer expiring
+        // earlier than the renewal time will end the check.
+        if (m_arp_observer.isActive()) {
+            timer_rel_sec = MinValue(timer_rel_sec,
+                std::uint32_t(Params::ArpResponseTimeoutSeconds));
+        }
+        
         // Set the timer and update m_lease_time_passed to reflect the time
         // that the timer is being set for.
         m_lease_time_passed += timer_rel_sec;
@@ -1239,6 +1317,10 @@ private:
         AIPSTACK_ASSERT(m_state == DhcpState::Selecting);
         
         DhcpSendOptions send_opts;
+        
+        // Ask for rapid commit if enabled.
+        send_opts.have.rapid_commit = Params::RapidCommit;
+        
         send_dhcp_message(DhcpMessageType::Discover, send_opts,
                           Ip4Addr::ZeroAddr(), Ip4Addr::AllOnesAddr());
     }
@@ -1274,7 +1356,8 @@ private:
     
     void send_decline ()
     {
-        AIPSTACK_ASSERT(m_state == DhcpState::Checking);
+        AIPSTACK_ASSERT(m_state == OneOf(DhcpState::Checking,
+            DhcpState::Rebooting, DhcpState::Bound));
         
         DhcpSendOptions send_opts;
         
@@ -1318,8 +1401,13 @@ private:
         }
         
         // Get a buffer for the message.
-        using AllocHelperType = TxAllocHelper<MaxDhcpSendMsgSize, HeaderBeforeUdpData>;
-        AllocHelperType dgram_alloc(MaxDhcpSendMsgSize);
+        using AllocHelperType = TxAllocHelperSelect<
+            Params::UseTxArena, MaxDhcpSendMsgSize, HeaderBeforeUdpData>;
+        AllocHelperType dgram_alloc(m_ipstack->getTxArena(), MaxDhcpSendMsgSize);
+        if (AIPSTACK_UNLIKELY(!dgram_alloc.isAllocated())) {
+            // Nothing to do, the message will be retransmitted by timeout.
+            return;
+        }
         
         // Write the DHCP header.
         auto dhcp_header1 = DhcpHeader1::MakeRef(dgram_alloc.getPtr());
@@ -1443,6 +1531,24 @@ struct IpDhcpClientOptions {
      * will be spent for checking the address using ARP.
      */
     AIPSTACK_OPTION_DECL_VALUE(NumArpQueries, std::uint8_t, 2)
+    
+    /**
+     * Whether to allocate outgoing DHCP messages from the transmit arena of the
+     * IP stack (see @ref IpStack::getTxArena) instead of on the stack.
+     * 
+     * If this is enabled, @ref IpStackOptions::TxArenaSize must be configured to
+     * provide space for at least one message including the space for headers.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(UseTxArena, bool, false)
+    
+    /**
+     * Whether to request rapid commit (RFC 4039) in discover messages.
+     * 
+     * If enabled and the server supports it, the lease is obtained with a
+     * DISCOVER/ACK exchange instead of DISCOVER/OFFER/REQUEST/ACK. Servers
+     * which do not support rapid commit respond with an offer as usual.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(RapidCommit, bool, false)
 };
 
 /**
@@ -1482,6 +1588,8 @@ class IpDhcpClientService {
     AIPSTACK_OPTION_CONFIG_VALUE(IpDhcpClientOptions, MinRenewRtxTimeoutSeconds)
     AIPSTACK_OPTION_CONFIG_VALUE(IpDhcpClientOptions, ArpResponseTimeoutSeconds)
     AIPSTACK_OPTION_CONFIG_VALUE(IpDhcpClientOptions, NumArpQueries)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpDhcpClientOptions, UseTxArena)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpDhcpClientOptions, RapidCommit)
     
 public:
     /**
@@ -94,6 +94,8 @@ public:
         OptSizeForSize(MaxVendorClassIdSize) +
         // message
         OptSizeForSize(MaxMessageSize) +
+        // rapid commit
+        OptSizeForSize(0) +
         // end
         1;
     
@@ -108,6 +110,7 @@ public:
             bool rebinding_time : 1;
             bool subnet_mask : 1;
             bool router : 1;
+            bool rapid_commit : 1;
             std::uint8_t dns_servers; // count
         } have;
         
@@ -138,6 +141,7 @@ public:
             bool max_dhcp_message_size : 1;
             bool parameter_request_list : 1;
             bool message : 1;
+            bool rapid_commit : 1;
         } have;
         
         // The option values (only options set in Have are relevant).
@@ -169,9 +173,12 @@ public:
         
         // This loop is for parsing different regions of options.
         while (true) {
-            while (data.tot_len > 0) {
+            // Read the region using a cursor which is fast for byte-wise access.
+            IpBufCursor cur(data);
+            
+            while (cur.getRemaining() > 0) {
                 // Read option type.
-                DhcpOptionType opt_type = DhcpOptionType(ipBufTakeByteMut(data));
+                DhcpOptionType opt_type = DhcpOptionType(cur.takeByte());
                 
                 // End option?
                 if (opt_type == DhcpOptionType::End) {
@@ -186,20 +193,20 @@ public:
                 }
                 
                 // Read option length.
-                if (data.tot_len == 0) {
+                if (cur.getRemaining() == 0) {
                     return false;
                 }
-                std::uint8_t opt_len = std::uint8_t(ipBufTakeByteMut(data));
+                std::uint8_t opt_len = std::uint8_t(cur.takeByte());
                 
                 // Check that the remainder of the option is available.
-                if (opt_len > data.tot_len) {
+                if (opt_len > cur.getRemaining()) {
                     return false;
                 }
                 
                 // Parse specific option types. This consumes the opt_len bytes
-                // of option payload in 'data'. It may also update the option_overload
+                // of option payload in 'cur'. It may also update the option_overload
                 // value if the OptionOverload option is found in the Options region.
-                parse_option(opt_type, opt_len, data, opts, region, option_overload);
+                parse_option(opt_type, opt_len, cur, opts, region, option_overload);
             }
             
             // Check if we need to continue parsing options from another region.
@@ -313,6 +320,13 @@ public:
                                 MaxMessageSize, opts.message);
         }
         
+        // Rapid commit
+        if (opts.have.rapid_commit) {
+            write_option(opt_writeptr, DhcpOptionType::RapidCommit, [&](char *) {
+                return std::size_t(0);
+            });
+        }
+        
         // end option
         WriteSingleField<DhcpOptionType>(opt_writeptr++, DhcpOptionType::End);
         
@@ -320,11 +334,11 @@ public:
     }
     
 private:
-    static void parse_option (DhcpOptionType opt_type, std::uint8_t opt_len, IpBufRef &data,
-                              DhcpRecvOptions &opts, OptionRegion region,
-                              DhcpOptionOverload &option_overload)
+    static void parse_option (DhcpOptionType opt_type, std::uint8_t opt_len,
+                              IpBufCursor &cur, DhcpRecvOptions &opts,
+                              OptionRegion region, DhcpOptionOverload &option_overload)
     {
-        AIPSTACK_ASSERT(data.tot_len >= opt_len);
+        AIPSTACK_ASSERT(cur.getRemaining() >= opt_len);
         
         // Handle different options.
         switch (opt_type) {
@@ -333,7 +347,7 @@ private:
                     goto skip_data;
                 }
                 DhcpOptMsgType::Val val;
-                data = ipBufTakeBytes(data, opt_len, val.data);
+                cur.takeBytes(opt_len, val.data);
                 opts.have.dhcp_message_type = true;
                 opts.dhcp_message_type = val.get(DhcpOptMsgType::MsgType());
             } break;
@@ -343,7 +357,7 @@ private:
                     goto skip_data;
                 }
                 DhcpOptServerId::Val val;
-                data = ipBufTakeBytes(data, opt_len, val.data);
+                cur.takeBytes(opt_len, val.data);
                 opts.have.dhcp_server_identifier = true;
                 opts.dhcp_server_identifier = val.get(DhcpOptServerId::ServerId());
             } break;
@@ -353,7 +367,7 @@ private:
                     goto skip_data;
                 }
                 DhcpOptTime::Val val;
-                data = ipBufTakeBytes(data, opt_len, val.data);
+                cur.takeBytes(opt_len, val.data);
                 opts.have.ip_address_lease_time = true;
                 opts.ip_address_lease_time = val.get(DhcpOptTime::Time());
             } break;
@@ -363,7 +377,7 @@ private:
                     goto skip_data;
                 }
                 DhcpOptTime::Val val;
-                data = ipBufTakeBytes(data, opt_len, val.data);
+                cur.takeBytes(opt_len, val.data);
                 opts.have.renewal_time = true;
                 opts.renewal_time = val.get(DhcpOptTime::Time());
             } break;
@@ -373,7 +387,7 @@ private:
                     goto skip_data;
                 }
                 DhcpOptTime::Val val;
-                data = ipBufTakeBytes(data, opt_len, val.data);
+                cur.takeBytes(opt_len, val.data);
                 opts.have.rebinding_time = true;
                 opts.rebinding_time = val.get(DhcpOptTime::Time());
             } break;
@@ -383,7 +397,7 @@ private:
                     goto skip_data;
                 }
                 DhcpOptAddr::Val val;
-                data = ipBufTakeBytes(data, opt_len, val.data);
+                cur.takeBytes(opt_len, val.data);
                 opts.have.subnet_mask = true;
                 opts.subnet_mask = val.get(DhcpOptAddr::Addr());
             } break;
@@ -396,10 +410,10 @@ private:
                     goto skip_data;
                 }
                 DhcpOptAddr::Val val;
-                data = ipBufTakeBytes(data, DhcpOptAddr::Size, val.data);
+                cur.takeBytes(DhcpOptAddr::Size, val.data);
                 opts.have.router = true;
                 opts.router = val.get(DhcpOptAddr::Addr());
-                data = ipBufSkipBytes(data, opt_len - DhcpOptAddr::Size);
+                cur.skipBytes(opt_len - DhcpOptAddr::Size);
             } break;
             
             case DhcpOptionType::DomainNameServer: {
@@ -411,7 +425,7 @@ private:
                     // Must consume all servers from data even if we can't save
                     // them.
                     DhcpOptAddr::Val val;
-                    data = ipBufTakeBytes(data, DhcpOptAddr::Size, val.data);
+                    cur.takeBytes(DhcpOptAddr::Size, val.data);
                     if (opts.have.dns_servers < MaxDnsServers) {
                         opts.dns_servers[opts.have.dns_servers++] =
                             val.get(DhcpOptAddr::Addr());
@@ -419,6 +433,13 @@ private:
                 }
             } break;
             
+            case DhcpOptionType::RapidCommit: {
+                if (opt_len != 0) {
+                    goto skip_data;
+                }
+                opts.have.rapid_commit = true;
+            } break;
+            
             case DhcpOptionType::OptionOverload: {
                 // Ignore if it appears in the file or sname region.
                 if (opt_len != DhcpOptOptionOverload::Size ||
@@ -427,7 +448,7 @@ private:
                     goto skip_data;
                 }
                 DhcpOptOptionOverload::Val val;
-                data = ipBufTakeBytes(data, opt_len, val.data);
+                cur.takeBytes(opt_len, val.data);
                 DhcpOptionOverload overload_val =
                     val.get(DhcpOptOptionOverload::Overload());
                 if (overload_val == OneOf(
@@ -442,7 +463,7 @@ private:
             // Unknown or bad option, consume the option data.
             skip_data:
             default: {
-                data = ipBufSkipBytes(data, opt_len);
+                cur.skipBytes(opt_len);
             } break;
         }
     }
@@ -25,8 +25,18 @@
 #ifndef AIPSTACK_IP_DRIVER_IFACE_H
 #define AIPSTACK_IP_DRIVER_IFACE_H
 
+#include <cstddef>
+#include <cstdint>
+
 #include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/EnumBitfieldUtils.h>
+#include <aipstack/misc/IntRange.h>
 #include <aipstack/infra/Buf.h>
+#include <aipstack/infra/RxBufPool.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Tcp4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/ip/IpStackTypes.h>
 #include <aipstack/ip/IpIface.h>
@@ -146,9 +156,265 @@ public:
      * @param pkt Received packet, presumably starting with the IP header.
      *            The referenced buffers will only be read from within this
      *            function call.
+     * @param chksum_verified Checksums which have been verified by hardware
+     *        (see @ref IpChksumOffloadFlags). Flags not present in @ref
+     *        IpIfaceDriverParams::rx_chksum_offload are ignored.
+     * @param rx_buf If not null, the retainable buffer which contains the packet,
+     *        and `pkt` must reference data within it (using its node as returned
+     *        by @ref IpRxBuf::getBufRef). See @ref IpRxBuf.
+     * @param rx_time The receive timestamp of the packet, if the driver can
+     *        provide one (see @ref IpRxTimestamp). It is made available to
+     *        protocols in @ref IpRxInfoIp4::rx_time, and TCP uses it to exclude
+     *        the time the packet spent queued before processing from round-trip
+     *        time measurements.
+     */
+    inline void recvIp4Packet (IpBufRef pkt,
+        IpChksumOffloadFlags chksum_verified = IpChksumOffloadFlags(),
+        IpRxBuf *rx_buf = nullptr, IpRxTimestamp rx_time = IpRxTimestamp())
+    {
+        IpStack<Arg>::processRecvedIp4Packet(&iface(), pkt,
+            chksum_verified & iface().m_params.rx_chksum_offload, rx_buf, rx_time);
+    }
+    
+    /**
+     * Begin latency tracing of a received packet at a stage below the stack.
+     * 
+     * This is intended for layers between the driver and the stack such as
+     * @ref EthIpIface, so that latency tracing (see @ref
+     * IpStackOptions::LatencyTraceInterval) includes their processing. It must
+     * be paired with @ref endRxLatencyTrace after processing of the packet,
+     * which includes passing it to @ref recvIp4Packet.
+     * 
+     * @param stage The stage at which processing starts.
+     * @param rx_time The receive timestamp of the packet, if any.
+     */
+    inline void beginRxLatencyTrace (IpLatencyStage stage, IpRxTimestamp rx_time)
+    {
+        IpStack<Arg> *stack = iface().m_stack;
+        stack->m_latency_tracer.rxBegin(stack->platform(), stage, rx_time);
+    }
+    
+    /**
+     * End latency tracing of a received packet, see @ref beginRxLatencyTrace.
+     */
+    inline void endRxLatencyTrace ()
+    {
+        iface().m_stack->m_latency_tracer.rxEnd();
+    }
+    
+    /**
+     * Record that the processing of the packet being sampled for latency
+     * tracing reached a stage, see @ref IpStack::traceLatency.
+     * 
+     * @param stage The stage which was reached.
+     */
+    inline void traceLatency (IpLatencyStage stage)
+    {
+        iface().m_stack->traceLatency(stage);
+    }
+    
+    /**
+     * Report the time when a packet was transmitted.
+     * 
+     * Drivers which can determine the transmit time of packets may call this
+     * to pass it to the callback set by @ref IpStack::setTxTimestampHandler
+     * (if any). This may be called at any time after the packet was passed to
+     * @ref IpIfaceDriverParams::send_ip4_packet, as long as the driver still
+     * has the packet data, but not from within a call into the stack.
+     * 
+     * @param pkt The packet, starting with the IP header.
+     * @param time The transmit time in platform time units.
+     */
+    inline void reportTxTimestamp (IpBufRef pkt, std::uint64_t time)
+    {
+        IpStack<Arg> *stack = iface().m_stack;
+        if (stack->m_tx_timestamp_handler) {
+            stack->m_tx_timestamp_handler(&iface(), pkt, time);
+        }
+    }
+    
+    /**
+     * Begin a batch of received packets.
+     * 
+     * A driver which receives multiple packets at a time (e.g. from a receive
+     * ring) can call this before passing them to @ref recvIp4Packet and
+     * @ref endRecvBatch after that. This allows the stack to coalesce TCP
+     * segments if configured (see @ref IpStackOptions::GroMaxSegs). Within
+     * a batch, the buffers of packets passed to @ref recvIp4Packet must remain
+     * valid and unchanged until @ref endRecvBatch returns.
+     * 
+     * Batches must not be nested, also not across different interfaces of the
+     * same stack.
+     */
+    inline void beginRecvBatch ()
+    {
+        iface().m_stack->beginRecvBatch();
+    }
+    
+    /**
+     * End a batch of received packets.
+     * 
+     * This processes any segments which were held back for coalescing and lets
+     * protocols do work deferred to the end of the batch, such as sending
+     * acknowledgements. See @ref beginRecvBatch.
+     */
+    inline void endRecvBatch ()
+    {
+        iface().m_stack->endRecvBatch();
+    }
+    
+    /**
+     * Request that the driver function @ref IpIfaceDriverParams::flush_tx be
+     * called to transmit held back packets.
+     * 
+     * This must be called by drivers which use @ref IpIfaceDriverParams::flush_tx
+     * after sending a packet other than from @ref IpIfaceDriverParams::send_ip4_packet
+     * (which is taken care of by the stack). The function is called right away,
+     * or at the end of the current transmit batch if one is active.
+     */
+    inline void requestTxFlush ()
+    {
+        iface().m_stack->tx_flush_needed(&iface());
+    }
+    
+    /**
+     * Process a batch of received IPv4 packets.
+     * 
+     * This is equivalent to calling @ref recvIp4Packet for each packet between
+     * @ref beginRecvBatch and @ref endRecvBatch. It must not be called within
+     * a batch.
+     * 
+     * @param pkts Array of received packets, with the members of each as the
+     *        arguments of @ref recvIp4Packet.
+     * @param count Number of packets in the array.
+     */
+    void recvIp4Packets (IpRxBatchEntry const *pkts, std::size_t count)
+    {
+        beginRecvBatch();
+        
+        for (std::size_t i : IntRange(count)) {
+            recvIp4Packet(pkts[i].buf, pkts[i].chksum_verified, pkts[i].rx_buf,
+                          pkts[i].rx_time);
+        }
+        
+        endRecvBatch();
+    }
+    
+    /**
+     * Determine whether the transport checksum of a packet being sent must be
+     * completed by the driver.
+     * 
+     * This is intended to be used from @ref IpIfaceDriverParams::send_ip4_packet
+     * by drivers which advertise transmit checksum offload, in order to determine
+     * whether to request checksum calculation by the hardware for a packet (or
+     * to complete the checksum otherwise). See @ref IpChksumOffloadFlags for
+     * details.
+     * 
+     * @param pkt Packet as passed to @ref IpIfaceDriverParams::send_ip4_packet.
+     * @param csum_start On success, set to the offset of the transport header
+     *        relative to the start of the packet (IHL*4).
+     * @param csum_offset On success, set to the offset of the checksum field
+     *        relative to the start of the transport header.
+     * @return True if the checksum must be completed (and the output arguments
+     *         were set), false if not.
+     */
+    bool getTxChksumPartial (IpBufRef pkt, std::size_t &csum_start,
+                             std::size_t &csum_offset)
+    {
+        AIPSTACK_ASSERT(pkt.tot_len >= Ip4Header::Size);
+        AIPSTACK_ASSERT(pkt.getChunkLength() >= Ip4Header::Size);
+        
+        auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
+        
+        Ip4Flags flags_offset = ip4_header.get(Ip4Header::FlagsOffset());
+        if ((flags_offset & (Ip4Flags::MF|Ip4Flags::OffsetMask)) != Enum0) {
+            return false;
+        }
+        
+        IpChksumOffloadFlags offload = iface().m_params.tx_chksum_offload;
+        Ip4Protocol proto = ip4_header.get(Ip4Header::Proto());
+        
+        if (proto == Ip4Protocol::Tcp &&
+            (offload & IpChksumOffloadFlags::Tcp4) != Enum0)
+        {
+            csum_offset = Tcp4Header::getOffset(Tcp4Header::Checksum());
+        }
+        else if (proto == Ip4Protocol::Udp &&
+            (offload & IpChksumOffloadFlags::Udp4) != Enum0)
+        {
+            csum_offset = Udp4Header::getOffset(Udp4Header::Checksum());
+        }
+        else {
+            return false;
+        }
+        
+        std::uint8_t version_ihl = ip4_header.get(Ip4Header::VersionIhlDscpEcn()) >> 8;
+        csum_start = std::size_t(version_ihl & Ip4IhlMask) * 4;
+        
+        return true;
+    }
+    
+    /**
+     * Get the neighbor cache of the flow of the packet being sent, if any.
+     * 
+     * This is intended to be used from @ref IpIfaceDriverParams::send_ip4_packet
+     * by drivers which perform a neighbor (link-layer address) lookup for the
+     * next hop. If the result is not null, the driver may use the hint stored in
+     * it to skip the lookup and should update it after a lookup. The driver must
+     * validate the hint itself, typically using a generation number which it
+     * changes whenever a neighbor entry is removed, reused or modified.
+     * 
+     * @return The neighbor cache (valid only during the send_ip4_packet call),
+     *         or null if the packet does not belong to a flow with a cache.
+     */
+    inline IpNeighborCache * getTxNeighborCache ()
+    {
+        return iface().m_tx_neigh_cache;
+    }
+    
+    /**
+     * Determine whether a packet being sent is a TCP super-segment or UDP
+     * super-datagram which must be segmented by the driver.
+     * 
+     * This is intended to be used from @ref IpIfaceDriverParams::send_ip4_packet
+     * by drivers which advertise TCP or UDP segmentation offload using
+     * @ref IpIfaceDriverParams::tso_max_size or
+     * @ref IpIfaceDriverParams::uso_max_size. See @ref IpTxTsoInfo for details.
+     * 
+     * @param pkt Packet as passed to @ref IpIfaceDriverParams::send_ip4_packet.
+     * @param info On success, set to the segmentation descriptor.
+     * @return True if the packet is a super-segment or super-datagram (and
+     *         `info` was set), false if it is an ordinary packet.
      */
-    inline void recvIp4Packet (IpBufRef pkt) {
-        IpStack<Arg>::processRecvedIp4Packet(&iface(), pkt);
+    bool getTxTso (IpBufRef pkt, IpTxTsoInfo &info)
+    {
+        std::uint16_t mss = iface().m_tx_tso_mss;
+        if (mss == 0) {
+            return false;
+        }
+        
+        AIPSTACK_ASSERT(pkt.getChunkLength() >= Ip4Header::Size);
+        
+        auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
+        std::uint8_t version_ihl = ip4_header.get(Ip4Header::VersionIhlDscpEcn()) >> 8;
+        std::size_t ip_header_len = std::size_t(version_ihl & Ip4IhlMask) * 4;
+        
+        info.mss = mss;
+        
+        if (ip4_header.get(Ip4Header::Proto()) == Ip4Protocol::Udp) {
+            info.header_len = ip_header_len + Udp4Header::Size;
+            return true;
+        }
+        
+        AIPSTACK_ASSERT(pkt.getChunkLength() >= ip_header_len + Tcp4Header::Size);
+        
+        auto tcp_header = Tcp4Header::MakeRef(pkt.getChunkPtr() + ip_header_len);
+        Tcp4Flags offset_flags = tcp_header.get(Tcp4Header::OffsetFlags());
+        
+        info.header_len = ip_header_len +
+            std::size_t(AsUnderlying(offset_flags) >> TcpOffsetShift) * 4;
+        
+        return true;
     }
     
     /**
@@ -167,6 +433,20 @@ public:
         return iface().m_have_addr ? &iface().m_addr : nullptr;
     }
     
+    /**
+     * Enumerate the multicast groups joined on the interface.
+     * 
+     * The function is called once for each distinct group, including the
+     * all-hosts group 224.0.0.1 which is always joined. This is intended to be
+     * used from @ref IpIfaceDriverParams::update_mcast_filter.
+     * 
+     * @param func Function called with each group address (`Ip4Addr`).
+     */
+    template<typename Func>
+    inline void forEachIp4McastGroup (Func func) {
+        iface().for_each_mcast_group(func);
+    }
+    
     /**
      * Notify that the driver-provided state may have changed.
      * 
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_DROP_TRACE_H
+#define AIPSTACK_IP_DROP_TRACE_H
+
+#include <cstdint>
+
+#if defined(AIPSTACK_CONFIG_DROP_TRACE_USDT) && defined(__linux__)
+#include <sys/sdt.h>
+#endif
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Reason why a packet was dropped, as reported by drop tracing (see
+ * @ref IpStackOptions::EnableDropTrace).
+ * 
+ * The numeric values are stable and will not be reused for different reasons,
+ * so that they can be stored or interpreted by external tools.
+ */
+enum class IpDropReason : std::uint8_t {
+    /**
+     * Invalid IPv4 version, header length or total length.
+     */
+    Ip4HeaderInvalid = 1,
+    
+    /**
+     * Bad IPv4 header checksum.
+     */
+    Ip4ChksumBad = 2,
+    
+    /**
+     * Matched a rule of the receive filter (see @ref IpStack::setRxFilterRule).
+     */
+    RxFiltered = 3,
+    
+    /**
+     * Addressed to a multicast group which is not joined on the interface.
+     */
+    McastNotJoined = 4,
+    
+    /**
+     * A fragment not addressed to the interface address.
+     */
+    FragNotLocal = 5,
+    
+    /**
+     * No protocol handler for the IP protocol number.
+     */
+    UnknownProtocol = 6,
+    
+    /**
+     * The source address is a broadcast or multicast address (failed
+     * @ref IpStack::checkUnicastSrcAddr or a similar check).
+     */
+    BadSrcAddr = 7,
+    
+    /**
+     * The destination address is not acceptable for the protocol.
+     */
+    BadDstAddr = 8,
+    
+    /**
+     * ICMP message too short.
+     */
+    IcmpHeaderInvalid = 9,
+    
+    /**
+     * Bad ICMP checksum.
+     */
+    IcmpChksumBad = 10,
+    
+    /**
+     * Not forwarded because the TTL would reach zero.
+     */
+    ForwardTtlExceeded = 11,
+    
+    /**
+     * Not forwarded because there is no route.
+     */
+    ForwardNoRoute = 12,
+    
+    /**
+     * Not forwarded because it is larger than the MTU of the outgoing
+     * interface.
+     */
+    ForwardTooBig = 13,
+    
+    /**
+     * Invalid UDP header or length.
+     */
+    UdpHeaderInvalid = 14,
+    
+    /**
+     * Bad UDP checksum.
+     */
+    UdpChksumBad = 15,
+    
+    /**
+     * Not accepted by any UDP association or listener.
+     */
+    UdpNoPort = 16,
+    
+    /**
+     * Invalid TCP header or data offset.
+     */
+    TcpHeaderInvalid = 17,
+    
+    /**
+     * Bad TCP checksum.
+     */
+    TcpChksumBad = 18,
+    
+    /**
+     * No TCP connection or listener for the segment (an RST may be sent).
+     */
+    TcpNoPcb = 19,
+    
+    /**
+     * TCP segment outside of the receive window (an ACK may be sent).
+     */
+    TcpOutOfWindow = 20,
+    
+    /**
+     * Not sent because the hardware address is being resolved and the packet
+     * could not be queued.
+     */
+    ArpUnresolved = 21,
+    
+    /**
+     * Not sent because the interface driver returned an error.
+     */
+    DriverSendError = 22,
+};
+
+#ifndef IN_DOXYGEN
+
+// Fire the USDT probe aipstack:drop with the reason and the data length, if
+// enabled by defining AIPSTACK_CONFIG_DROP_TRACE_USDT.
+#if defined(AIPSTACK_CONFIG_DROP_TRACE_USDT) && defined(__linux__)
+#define AIPSTACK_DROP_TRACE_USDT(reason, len) DTRACE_PROBE2(aipstack, drop, reason, len)
+#else
+#define AIPSTACK_DROP_TRACE_USDT(reason, len) ((void)0)
+#endif
+
+#endif
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,723 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_EGRESS_SCHEDULER_H
+#define AIPSTACK_IP_EGRESS_SCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/SendRetry.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Options.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Egress packet scheduler with fair queueing across flows.
+ * 
+ * The scheduler sits between an interface and its driver. Packets sent
+ * through the interface are copied into the scheduler by @ref enqueuePacket,
+ * which has the signature of @ref IpIfaceDriverParams::send_ip4_packet so
+ * that it can be used as that function directly. The driver takes packets
+ * out using @ref transmitPackets whenever it has room for transmission, and
+ * is told by the TX-ready handler when there are packets to take.
+ * 
+ * Packets are hashed into flow queues by the IPv4 addresses, the protocol and
+ * (for unfragmented TCP and UDP) the ports, so that each TCP connection or UDP
+ * socket normally has its own queue. The queues are served by deficit round
+ * robin with a quantum of @ref IpEgressSchedulerOptions::QuantumBytes. Like in
+ * FQ-CoDel, a queue which becomes active is served before the queues which
+ * have been active for a while, until it has used its quantum. A flow which
+ * sends only a little data, such as an interactive connection, therefore does
+ * not wait behind the backlog of bulk transfers.
+ * 
+ * The amount of queued data is limited in total and for each flow queue. If a
+ * packet does not fit, @ref enqueuePacket fails with @ref
+ * IpErr::OutputBufferFull and the send-retry request is notified when a
+ * packet of the same flow queue (or any packet, if the total limit was hit)
+ * has been transmitted. A bulk sender is thereby held back in its own flow
+ * queue while others can still queue packets.
+ * 
+ * With @ref IpEgressSchedulerOptions::NumPriorities greater than one, the
+ * flow queues are further divided into priority classes by the DSCP in the
+ * IPv4 header, and the classes are served with strict priority: a packet of
+ * a lower class is only transmitted when no higher class has packets. Fair
+ * queueing as above applies among the flows of the same class. Senders set
+ * the DSCP using @ref IpSendFlagsDscp (e.g. @ref TcpConnection::setDscp), so
+ * that control or heartbeat traffic does not wait behind bulk transfers.
+ * 
+ * Optionally, transmission is paced to a given rate (@ref setPacingRate),
+ * which is useful when the link is slower than the driver can accept packets,
+ * so that the queue builds up in the scheduler and not behind it.
+ * 
+ * The transmit queue of the driver behind the scheduler can be given to the
+ * scheduler (@ref setTxQueue), in which case @ref transmitPackets stops when
+ * that queue reaches its high watermark and the TX-ready handler is called
+ * again once it has drained to the low watermark. Packets then wait in the
+ * fair queues instead of being offered to a full driver queue. The transmit
+ * queue should not also be given to the interface (@ref
+ * IpIfaceDriverParams::tx_queue), since senders would then be held back
+ * before reaching the fair queues.
+ * 
+ * @tparam Arg An instantiation of the @ref IpEgressSchedulerService::Compose
+ *         template or a dummy class derived from such.
+ */
+template<typename Arg>
+class IpEgressScheduler :
+    private NonCopyable<IpEgressScheduler<Arg>>,
+    private IpSendRetryRequest
+{
+    AIPSTACK_USE_VALS(Arg::Params, (NumFlows, NumSlots, SlotSize, QueueBytes,
+                                    FlowQueueBytes, QuantumBytes, IpHeaderOffset,
+                                    NumPriorities))
+    AIPSTACK_USE_TYPES(Arg, (PlatformImpl))
+    
+    using Platform = PlatformFacade<PlatformImpl>;
+    using TimeType = typename Platform::TimeType;
+    
+    static_assert(NumFlows > 0);
+    static_assert(NumSlots > 0);
+    static_assert(SlotSize > IpHeaderOffset);
+    static_assert(QueueBytes >= SlotSize);
+    static_assert(FlowQueueBytes >= SlotSize && FlowQueueBytes <= QueueBytes);
+    static_assert(QuantumBytes > 0);
+    static_assert(NumPriorities > 0 && NumPriorities <= 8);
+    
+    // Index used as the null value of slot and flow links.
+    inline static constexpr std::size_t NullIndex = std::numeric_limits<std::size_t>::max();
+    
+    enum class FlowList : std::uint8_t {None, New, Old};
+    
+public:
+    /**
+     * Type of the TX-ready handler.
+     * 
+     * This is called when there are packets which can be transmitted, after
+     * packets were enqueued or a pacing delay has elapsed. It is called from a
+     * timer so never from within @ref enqueuePacket. The driver should then
+     * call @ref transmitPackets if it has room for transmission, and otherwise
+     * do so later when it does.
+     */
+    using TxReadyHandler = Function<void()>;
+    
+    /**
+     * Construct the scheduler with empty queues and without pacing.
+     * 
+     * @param platform The platform facade.
+     * @param tx_ready_handler The TX-ready handler (must not be null).
+     */
+    IpEgressScheduler (Platform platform, TxReadyHandler tx_ready_handler) :
+        m_tx_ready_handler(tx_ready_handler),
+        m_timer(platform, AIPSTACK_BIND_MEMBER_TN(&IpEgressScheduler::timerHandler, this)),
+        m_tx_queue(nullptr),
+        m_free_slot(0),
+        m_num_packets(0),
+        m_queued_bytes(0),
+        m_pacing_rate(0),
+        m_next_tx_time(0)
+    {
+        AIPSTACK_ASSERT(tx_ready_handler);
+        
+        for (std::size_t i = 0; i < NumSlots; i++) {
+            m_slots[i].next = (i + 1 < NumSlots) ? (i + 1) : NullIndex;
+        }
+        
+        for (Flow &flow : m_flows) {
+            flow.first_slot = NullIndex;
+            flow.last_slot = NullIndex;
+            flow.next_flow = NullIndex;
+            flow.bytes = 0;
+            flow.deficit = 0;
+            flow.list = FlowList::None;
+            flow.prio = 0;
+        }
+        
+        for (auto &prio_lists : m_lists) {
+            prio_lists[0] = ListHead{NullIndex, NullIndex};
+            prio_lists[1] = ListHead{NullIndex, NullIndex};
+        }
+    }
+    
+    /**
+     * Enqueue a packet for transmission.
+     * 
+     * This has the signature of @ref IpIfaceDriverParams::send_ip4_packet. When
+     * used for Ethernet frames (e.g. from @ref EthIfaceDriverParams::send_frame),
+     * the IPv4 header is expected at @ref IpEgressSchedulerOptions::IpHeaderOffset
+     * and ip_addr can be anything. Frames which do not contain an IPv4 packet are
+     * all put into the same flow queue.
+     * 
+     * @param pkt Packet to enqueue. It is copied and its size must not exceed
+     *        @ref IpEgressSchedulerOptions::SlotSize.
+     * @param ip_addr Next hop address, which is passed back in @ref transmitPackets.
+     * @param retryReq Send-retry request to be notified when the packet may
+     *        fit after a failure, or null.
+     * @return Success, or @ref IpErr::OutputBufferFull if the packet did not fit
+     *         into the total or flow queue limit.
+     */
+    IpErr enqueuePacket (IpBufRef pkt, Ip4Addr ip_addr, IpSendRetryRequest *retryReq)
+    {
+        AIPSTACK_ASSERT(pkt.tot_len <= SlotSize);
+        
+        std::uint8_t prio;
+        std::size_t flow_index = classify(pkt, prio);
+        Flow &flow = m_flows[flow_index];
+        
+        if (AIPSTACK_UNLIKELY(flow.bytes + pkt.tot_len > FlowQueueBytes)) {
+            flow.retry_list.addRequest(retryReq);
+            return IpErr::OutputBufferFull;
+        }
+        
+        if (AIPSTACK_UNLIKELY(m_free_slot == NullIndex ||
+                              m_queued_bytes + pkt.tot_len > QueueBytes))
+        {
+            m_retry_list.addRequest(retryReq);
+            return IpErr::OutputBufferFull;
+        }
+        
+        // Copy the packet into a free slot and append it to the flow queue.
+        std::size_t slot_index = m_free_slot;
+        Slot &slot = m_slots[slot_index];
+        m_free_slot = slot.next;
+        
+        slot.next = NullIndex;
+        slot.len = pkt.tot_len;
+        slot.ip_addr = ip_addr;
+        ipBufTakeBytes(pkt, pkt.tot_len, slot.data);
+        
+        if (flow.last_slot == NullIndex) {
+            flow.first_slot = slot_index;
+        } else {
+            m_slots[flow.last_slot].next = slot_index;
+        }
+        flow.last_slot = slot_index;
+        flow.bytes += slot.len;
+        
+        m_num_packets++;
+        m_queued_bytes += slot.len;
+        
+        // A flow which was not active starts in the new-flows list of the
+        // priority class of the packet.
+        if (flow.list == FlowList::None) {
+            flow.deficit = std::int32_t(QuantumBytes);
+            flow.prio = prio;
+            list_append(FlowList::New, flow_index);
+        }
+        
+        if (!m_timer.isSet()) {
+            m_timer.setNow();
+        }
+        
+        return IpErr::Success;
+    }
+    
+    /**
+     * Transmit queued packets in the order determined by the scheduler.
+     * 
+     * The function func is called for each packet as
+     * func(IpBufRef pkt, Ip4Addr ip_addr) and must return an IpErr. If it
+     * returns @ref IpErr::OutputBufferFull, the packet is kept as the next one
+     * to transmit and this function returns. For other errors the packet is
+     * discarded as for success. This also returns early if pacing does not yet
+     * allow transmission, in which case the TX-ready handler will be called when
+     * it does, and if the transmit queue set by @ref setTxQueue is stopped, in
+     * which case the TX-ready handler will be called when it is no longer
+     * stopped.
+     * 
+     * The function must not call @ref enqueuePacket.
+     * 
+     * @param func Function which transmits a packet.
+     * @param max_packets Maximum number of packets to transmit.
+     * @return Number of packets passed to func and not kept.
+     */
+    template<typename Func>
+    std::size_t transmitPackets (
+        Func func, std::size_t max_packets = std::numeric_limits<std::size_t>::max())
+    {
+        std::size_t count = 0;
+        
+        while (count < max_packets) {
+            std::size_t flow_index = select_flow();
+            if (flow_index == NullIndex) {
+                break;
+            }
+            
+            if (m_tx_queue != nullptr && m_tx_queue->isStopped()) {
+                m_tx_queue->addRequest(this);
+                break;
+            }
+            
+            TimeType now = TimeType();
+            if (m_pacing_rate != 0) {
+                now = m_timer.platform().getTime();
+                if (!Platform::timeGreaterOrEqual(now, m_next_tx_time)) {
+                    m_timer.setAt(m_next_tx_time);
+                    break;
+                }
+            }
+            
+            Flow &flow = m_flows[flow_index];
+            std::size_t slot_index = flow.first_slot;
+            Slot &slot = m_slots[slot_index];
+            
+            IpBufNode node = {slot.data, slot.len, nullptr};
+            IpErr err = func(IpBufRef{&node, 0, slot.len}, slot.ip_addr);
+            if (err == IpErr::OutputBufferFull) {
+                break;
+            }
+            
+            count++;
+            
+            if (m_pacing_rate != 0) {
+                pace_packet_sent(now, slot.len);
+            }
+            
+            // Remove the packet from the flow queue and free the slot.
+            flow.first_slot = slot.next;
+            if (flow.first_slot == NullIndex) {
+                flow.last_slot = NullIndex;
+            }
+            flow.bytes -= slot.len;
+            flow.deficit -= std::int32_t(slot.len);
+            
+            m_num_packets--;
+            m_queued_bytes -= slot.len;
+            
+            slot.next = m_free_slot;
+            m_free_slot = slot_index;
+            
+            // Let senders which were rejected retry. Waiters for the total
+            // limit are notified one per packet transmitted.
+            flow.retry_list.dispatchRequests();
+            m_retry_list.dispatchRequests(1);
+        }
+        
+        return count;
+    }
+    
+    /**
+     * Set the pacing rate.
+     * 
+     * If the rate is nonzero, @ref transmitPackets transmits packets only as
+     * fast as the rate allows, with packets larger than a time unit allows
+     * being sent as soon as the previous one is done.
+     * 
+     * @param bytes_per_sec Rate in bytes per second, or zero to not pace.
+     */
+    void setPacingRate (std::uint64_t bytes_per_sec)
+    {
+        m_pacing_rate = bytes_per_sec;
+        m_next_tx_time = m_timer.platform().getTime();
+        
+        if (m_num_packets > 0 && !m_timer.isSet()) {
+            m_timer.setNow();
+        }
+    }
+    
+    /**
+     * Set the transmit queue of the driver used for flow control.
+     * 
+     * The driver reports the occupancy of its queue to the object as
+     * described in @ref IpSendRetryTxQueue. While it is stopped,
+     * @ref transmitPackets does not transmit packets.
+     * 
+     * @param tx_queue The transmit queue (must outlive the scheduler or be
+     *        unset before it is destructed), or null for none.
+     */
+    void setTxQueue (IpSendRetryTxQueue *tx_queue)
+    {
+        IpSendRetryRequest::reset();
+        m_tx_queue = tx_queue;
+        
+        if (m_num_packets > 0 && !m_timer.isSet()) {
+            m_timer.setNow();
+        }
+    }
+    
+    /**
+     * Get the number of queued packets.
+     * 
+     * @return Number of packets enqueued and not yet transmitted.
+     */
+    inline std::size_t getNumQueuedPackets () const
+    {
+        return m_num_packets;
+    }
+    
+    /**
+     * Get the number of queued bytes.
+     * 
+     * @return Total size of the packets enqueued and not yet transmitted.
+     */
+    inline std::size_t getQueuedBytes () const
+    {
+        return m_queued_bytes;
+    }
+    
+private:
+    struct Slot {
+        std::size_t next;
+        std::size_t len;
+        Ip4Addr ip_addr;
+        char data[SlotSize];
+    };
+    
+    struct Flow {
+        IpSendRetryList retry_list;
+        std::size_t first_slot;
+        std::size_t last_slot;
+        std::size_t next_flow;
+        std::size_t bytes;
+        std::int32_t deficit;
+        FlowList list;
+        std::uint8_t prio;
+    };
+    
+    struct ListHead {
+        std::size_t first;
+        std::size_t last;
+    };
+    
+    void timerHandler ()
+    {
+        if (m_num_packets > 0) {
+            m_tx_ready_handler();
+        }
+    }
+    
+    void retrySending () override final
+    {
+        // The transmit queue has drained to the low watermark. Call the
+        // TX-ready handler from the timer since this is called from within
+        // the driver.
+        if (!m_timer.isSet()) {
+            m_timer.setNow();
+        }
+    }
+    
+    // Determine the flow queue and the priority class of a packet. The class
+    // is the precedence (the upper three bits of the DSCP) scaled to the number
+    // of classes, and the DSCP is included in the hash so that packets of
+    // different classes normally do not share a flow queue.
+    std::size_t classify (IpBufRef pkt, std::uint8_t &out_prio) const
+    {
+        out_prio = 0;
+        
+        if ((NumFlows == 1 && NumPriorities == 1) ||
+            !pkt.hasHeader(IpHeaderOffset + Ip4Header::Size))
+        {
+            return 0;
+        }
+        
+        char *ip_data = pkt.getChunkPtr() + IpHeaderOffset;
+        auto ip4_header = Ip4Header::MakeRef(ip_data);
+        
+        std::uint16_t version_ihl_dscp_ecn = ip4_header.get(Ip4Header::VersionIhlDscpEcn());
+        std::uint16_t version_ihl = version_ihl_dscp_ecn >> 8;
+        if ((version_ihl >> Ip4VersionShift) != 4) {
+            return 0;
+        }
+        
+        std::uint8_t dscp = std::uint8_t(
+            (version_ihl_dscp_ecn >> Ip4DscpShift) & Ip4DscpMask);
+        out_prio = std::uint8_t((dscp >> 3) * NumPriorities / 8);
+        
+        Ip4Protocol proto = ip4_header.get(Ip4Header::Proto());
+        
+        HashAccumulator hash;
+        hash.addWord(ip4_header.get(Ip4Header::SrcAddr()).value());
+        hash.addWord(ip4_header.get(Ip4Header::DstAddr()).value());
+        hash.addWord((std::uint32_t(dscp) << 8) | std::uint32_t(proto));
+        
+        // Add the ports of unfragmented TCP and UDP packets. The ports are at
+        // the same offset in both headers.
+        std::size_t header_len = std::size_t(version_ihl & Ip4IhlMask) * 4;
+        Ip4Flags flags_offset = ip4_header.get(Ip4Header::FlagsOffset());
+        if ((proto == Ip4Protocol::Tcp || proto == Ip4Protocol::Udp) &&
+            (flags_offset & (Ip4Flags::MF|Ip4Flags::OffsetMask)) == Enum0 &&
+            pkt.hasHeader(IpHeaderOffset + header_len + Udp4Header::Size))
+        {
+            auto udp_header = Udp4Header::MakeRef(ip_data + header_len);
+            hash.addWord((std::uint32_t(udp_header.get(Udp4Header::SrcPort())) << 16) |
+                         udp_header.get(Udp4Header::DstPort()));
+        }
+        
+        return std::size_t(hash.getHash() % NumFlows);
+    }
+    
+    // Select the flow queue to transmit from next, or return NullIndex if no
+    // packets are queued. The highest priority class with active flows is
+    // served.
+    std::size_t select_flow ()
+    {
+        for (std::size_t prio = NumPriorities; prio-- > 0;) {
+            std::size_t flow_index = select_flow_in_class(std::uint8_t(prio));
+            if (flow_index != NullIndex) {
+                return flow_index;
+            }
+        }
+        return NullIndex;
+    }
+    
+    // Select the flow queue of a priority class to transmit from next. New
+    // flows are served first. A flow which has used up its deficit gets
+    // another quantum and goes to the end of the old flows. A new flow which
+    // is empty also goes to the old flows, so that a flow cannot get priority
+    // over others by repeatedly becoming new.
+    std::size_t select_flow_in_class (std::uint8_t prio)
+    {
+        while (true) {
+            FlowList list_id;
+            if (list_head(prio, FlowList::New).first != NullIndex) {
+                list_id = FlowList::New;
+            } else if (list_head(prio, FlowList::Old).first != NullIndex) {
+                list_id = FlowList::Old;
+            } else {
+                return NullIndex;
+            }
+            
+            std::size_t flow_index = list_head(prio, list_id).first;
+            Flow &flow = m_flows[flow_index];
+            
+            if (flow.deficit <= 0) {
+                flow.deficit += std::int32_t(QuantumBytes);
+                list_remove_first(prio, list_id);
+                list_append(FlowList::Old, flow_index);
+                continue;
+            }
+            
+            if (flow.first_slot == NullIndex) {
+                list_remove_first(prio, list_id);
+                if (list_id == FlowList::New) {
+                    list_append(FlowList::Old, flow_index);
+                }
+                continue;
+            }
+            
+            return flow_index;
+        }
+    }
+    
+    // Advance the pacing time after a packet was sent at time now. The pacing
+    // time does not lag behind now, so there are no bursts after idle times.
+    void pace_packet_sent (TimeType now, std::size_t len)
+    {
+        if (!Platform::timeGreaterOrEqual(m_next_tx_time, now)) {
+            m_next_tx_time = now;
+        }
+        
+        m_next_tx_time += TimeType(double(len) * Platform::TimeFreq / double(m_pacing_rate));
+    }
+    
+    inline ListHead & list_head (std::uint8_t prio, FlowList list_id)
+    {
+        return m_lists[prio][(list_id == FlowList::New) ? 0 : 1];
+    }
+    
+    // Append a flow to a list of its priority class.
+    void list_append (FlowList list_id, std::size_t flow_index)
+    {
+        Flow &flow = m_flows[flow_index];
+        ListHead &head = list_head(flow.prio, list_id);
+        
+        flow.next_flow = NullIndex;
+        flow.list = list_id;
+        if (head.last == NullIndex) {
+            head.first = flow_index;
+        } else {
+            m_flows[head.last].next_flow = flow_index;
+        }
+        head.last = flow_index;
+    }
+    
+    void list_remove_first (std::uint8_t prio, FlowList list_id)
+    {
+        ListHead &head = list_head(prio, list_id);
+        Flow &flow = m_flows[head.first];
+        
+        head.first = flow.next_flow;
+        if (head.first == NullIndex) {
+            head.last = NullIndex;
+        }
+        flow.next_flow = NullIndex;
+        flow.list = FlowList::None;
+    }
+    
+private:
+    TxReadyHandler m_tx_ready_handler;
+    typename Platform::Timer m_timer;
+    IpSendRetryList m_retry_list;
+    IpSendRetryTxQueue *m_tx_queue;
+    std::size_t m_free_slot;
+    std::size_t m_num_packets;
+    std::size_t m_queued_bytes;
+    std::uint64_t m_pacing_rate;
+    TimeType m_next_tx_time;
+    ListHead m_lists[NumPriorities][2];
+    Flow m_flows[NumFlows];
+    Slot m_slots[NumSlots];
+};
+
+/**
+ * Static configuration options for @ref IpEgressScheduler.
+ */
+struct IpEgressSchedulerOptions {
+    /**
+     * Number of flow queues.
+     * 
+     * Flows are hashed to queues, so flows may share a queue if there are
+     * more flows than queues.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(NumFlows, std::size_t, 64)
+    
+    /**
+     * Number of packet slots, which is the maximum number of queued packets.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(NumSlots, std::size_t, 128)
+    
+    /**
+     * Size of a packet slot, which is the maximum packet size.
+     * 
+     * This must be at least the MTU of the interface, plus the size of the
+     * link-layer header if the scheduler is used for frames.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(SlotSize, std::size_t, 1536)
+    
+    /**
+     * Maximum total size of queued packets in bytes.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(QueueBytes, std::size_t, 65536)
+    
+    /**
+     * Maximum size of the packets queued in one flow queue in bytes.
+     * 
+     * This should be less than @ref QueueBytes so that a single flow cannot
+     * prevent others from queueing packets.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(FlowQueueBytes, std::size_t, 16384)
+    
+    /**
+     * Number of bytes a flow queue may transmit in one round.
+     * 
+     * This is normally the maximum packet size, so that each active flow
+     * transmits about one packet per round.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(QuantumBytes, std::uint32_t, 1514)
+    
+    /**
+     * Offset of the IPv4 header in enqueued packets.
+     * 
+     * This is zero when the scheduler is used for IP packets and the size of
+     * the link-layer header (e.g. @ref EthHeader::Size) when it is used for
+     * frames.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IpHeaderOffset, std::size_t, 0)
+    
+    /**
+     * Number of priority classes, at most 8.
+     * 
+     * The precedence of a packet (the upper three bits of the DSCP, 0 to 7)
+     * is mapped to the classes in equal ranges, so with 2 classes, DSCP values
+     * from CS4 (32) up, which includes EF and CS6, are in the high
+     * class, and with 8 classes each precedence is its own class. Packets with
+     * a higher class are always transmitted first.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(NumPriorities, std::size_t, 1)
+};
+
+/**
+ * Service definition for @ref IpEgressScheduler.
+ * 
+ * The template parameters of this class are assignments of options defined in
+ * @ref IpEgressSchedulerOptions, for example:
+ * AIpStack::IpEgressSchedulerOptions::NumFlows::Is\<256\>.
+ * 
+ * An @ref IpEgressScheduler class type can be obtained as follows:
+ * 
+ * ```
+ * using MySchedulerService = AIpStack::IpEgressSchedulerService<...options...>;
+ * class MySchedulerArg : public MySchedulerService::template Compose<
+ *     PlatformImpl> {};
+ * using MyScheduler = AIpStack::IpEgressScheduler<MySchedulerArg>;
+ * ```
+ * 
+ * @tparam Options Assignments of options defined in @ref IpEgressSchedulerOptions.
+ */
+template<typename ...Options>
+class IpEgressSchedulerService {
+    template<typename>
+    friend class IpEgressScheduler;
+    
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, NumFlows)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, NumSlots)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, SlotSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, QueueBytes)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, FlowQueueBytes)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, QuantumBytes)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, IpHeaderOffset)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpEgressSchedulerOptions, NumPriorities)
+    
+public:
+    /**
+     * Template to get the template parameter for @ref IpEgressScheduler.
+     * 
+     * @tparam PlatformImpl_ Platform layer implementation.
+     */
+    template<typename PlatformImpl_>
+    struct Compose {
+#ifndef IN_DOXYGEN
+        using PlatformImpl = PlatformImpl_;
+        using Params = IpEgressSchedulerService;
+
+        // This is for completeness and is not typically used.
+        AIPSTACK_DEF_INSTANCE(Compose, IpEgressScheduler)
+#endif
+    };
+};
+
+/** @} */
+
+}
+
+#endif
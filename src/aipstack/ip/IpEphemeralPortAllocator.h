@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_EPHEMERAL_PORT_ALLOCATOR_H
+#define AIPSTACK_IP_EPHEMERAL_PORT_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/IntRange.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/ip/IpAddr.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Ephemeral port selection for transport protocols.
+ * 
+ * The search for a port starts at an offset derived from a keyed hash of the
+ * local address, remote address and remote port plus a global counter (RFC 6056
+ * Algorithm 3), so that ports are not predictable by an off-path attacker
+ * but connections to the same destination still use ports sequentially.
+ * 
+ * If UseBitmap is true, a bitmap of ports allocated by this allocator is kept
+ * so that ports in use are skipped a word at a time without a lookup by the
+ * protocol. Only when all ports are allocated does the search fall back to
+ * checking every port, which allows the same local port to be used for
+ * different destinations. The bitmap is only a hint, the protocol still checks
+ * each candidate port, and it must call @ref release when an allocated port is
+ * no longer used.
+ * 
+ * @tparam PortFirst First port in the ephemeral port range.
+ * @tparam PortLast Last port in the ephemeral port range.
+ * @tparam UseBitmap Whether to keep the bitmap of allocated ports.
+ */
+template<PortNum PortFirst, PortNum PortLast, bool UseBitmap>
+class IpEphemeralPortAllocator :
+    private NonCopyable<IpEphemeralPortAllocator<PortFirst, PortLast, UseBitmap>>
+{
+    static_assert(PortFirst > 0);
+    static_assert(PortFirst <= PortLast);
+    
+    inline static constexpr std::size_t NumPorts = std::size_t(PortLast - PortFirst) + 1;
+    
+    using Word = std::uint32_t;
+    inline static constexpr std::size_t WordBits = 32;
+    inline static constexpr std::size_t NumWords =
+        UseBitmap ? (NumPorts + WordBits - 1) / WordBits : 1;
+    
+public:
+    /**
+     * Construct the allocator.
+     * 
+     * @param secret Secret for the hash function, which should be random.
+     */
+    IpEphemeralPortAllocator (std::uint32_t secret) :
+        m_secret(secret),
+        m_counter(0)
+    {
+        if constexpr (UseBitmap) {
+            for (Word &word : m_bitmap) {
+                word = 0;
+            }
+            
+            // Mark the bits past the end of the range as allocated.
+            if (NumPorts % WordBits != 0) {
+                m_bitmap[NumWords - 1] = TypeMax<Word> << (NumPorts % WordBits);
+            }
+        }
+    }
+    
+    /**
+     * Select an ephemeral port.
+     * 
+     * @param local_addr Local address.
+     * @param remote_addr Remote address.
+     * @param remote_port Remote port.
+     * @param is_free Function called as is_free(port) to check if the port can
+     *        be used, returning bool.
+     * @return The selected port, or zero if no port is available.
+     */
+    template<typename IsFreeFunc>
+    PortNum allocate (Ip4Addr local_addr, Ip4Addr remote_addr, PortNum remote_port,
+                      IsFreeFunc is_free)
+    {
+        HashAccumulator hash(m_secret);
+        hash.addWord(local_addr.value());
+        hash.addWord(remote_addr.value());
+        hash.addWord(remote_port);
+        std::size_t start = (hash.getHash() + m_counter) % NumPorts;
+        m_counter++;
+        
+        if constexpr (UseBitmap) {
+            // Check ports which are not allocated. A port may still be in use
+            // when it was not allocated by us, such as by a TIME_WAIT entry.
+            std::size_t index = start;
+            for ([[maybe_unused]] std::size_t i : IntRange(NumPorts)) {
+                index = find_unallocated(index);
+                if (index == NumPorts) {
+                    break;
+                }
+                
+                PortNum port = PortNum(PortFirst + index);
+                if (is_free(port)) {
+                    m_bitmap[index / WordBits] |= Word(1) << (index % WordBits);
+                    return port;
+                }
+                
+                index = (index + 1 == NumPorts) ? 0 : (index + 1);
+            }
+        }
+        
+        // Check all ports in order.
+        for (std::size_t i : IntRange(NumPorts)) {
+            std::size_t index = (start + i) % NumPorts;
+            PortNum port = PortNum(PortFirst + index);
+            if (is_free(port)) {
+                if constexpr (UseBitmap) {
+                    m_bitmap[index / WordBits] |= Word(1) << (index % WordBits);
+                }
+                return port;
+            }
+        }
+        
+        return 0;
+    }
+    
+    /**
+     * Notify that a port is used which was not selected by @ref allocate,
+     * so that it is not selected until it is released.
+     * 
+     * This may be called for any port including ports not in the ephemeral
+     * range, such are ignored.
+     * 
+     * @param port The port which is now used.
+     */
+    inline void reserve (PortNum port)
+    {
+        if constexpr (UseBitmap) {
+            if (port >= PortFirst && port <= PortLast) {
+                std::size_t index = std::size_t(port - PortFirst);
+                m_bitmap[index / WordBits] |= Word(1) << (index % WordBits);
+            }
+        }
+    }
+    
+    /**
+     * Notify that a port is no longer used.
+     * 
+     * This may be called for any port including ports not in the ephemeral
+     * range, such are ignored.
+     * 
+     * @param port The port which is no longer used.
+     */
+    inline void release (PortNum port)
+    {
+        if constexpr (UseBitmap) {
+            if (port >= PortFirst && port <= PortLast) {
+                std::size_t index = std::size_t(port - PortFirst);
+                m_bitmap[index / WordBits] &= ~(Word(1) << (index % WordBits));
+            }
+        }
+    }
+    
+private:
+    // Find the first unallocated port index starting at start and wrapping
+    // around, or return NumPorts if all are allocated.
+    std::size_t find_unallocated (std::size_t start) const
+    {
+        std::size_t word_idx = start / WordBits;
+        Word mask = TypeMax<Word> << (start % WordBits);
+        
+        // The last iteration checks the bits of the first word before start.
+        for ([[maybe_unused]] std::size_t i : IntRange(NumWords + 1)) {
+            Word free_bits = ~m_bitmap[word_idx] & mask;
+            if (free_bits != 0) {
+                return word_idx * WordBits + lowest_bit(free_bits);
+            }
+            mask = TypeMax<Word>;
+            word_idx = (word_idx + 1 == NumWords) ? 0 : (word_idx + 1);
+        }
+        
+        return NumPorts;
+    }
+    
+    inline static std::size_t lowest_bit (Word word)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return std::size_t(__builtin_ctz(word));
+#else
+        std::size_t bit = 0;
+        while ((word & 1) == 0) {
+            word >>= 1;
+            bit++;
+        }
+        return bit;
+#endif
+    }
+    
+private:
+    std::uint32_t m_secret;
+    std::uint32_t m_counter;
+    Word m_bitmap[UseBitmap ? NumWords : 1];
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_FLOW_STEERING_H
+#define AIPSTACK_IP_FLOW_STEERING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/misc/EnumBitfieldUtils.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Assignment of flows to shards for thread-per-core deployments.
+ * 
+ * In a sharded deployment, there are multiple independent instances of the stack,
+ * each with its own event loop running in its own thread, and each receiving from its
+ * own receive queue of the same network interface (e.g. one queue of a multi-queue TAP
+ * device). The application creates the threads and would normally pin each of them to
+ * its own core. Since nothing is shared between shards, no locking is needed in the
+ * packet processing path. For this to work, all packets of a flow must be processed by the shard which
+ * owns the flow.
+ * 
+ * This class computes the shard for a flow in the same way as Receive Side Scaling
+ * (RSS) on network cards: a Toeplitz hash of the source address, destination address,
+ * source port and destination port of a received packet is computed, and its low bits
+ * index an indirection table which gives the shard. With the same key and indirection
+ * table as programmed into the network card (or into a steering program of the virtual
+ * device), the result matches the receive queue which the packets of the flow arrive
+ * on. Packets which are not TCP or UDP, or are fragments, are hashed based on the
+ * addresses only, as with RSS.
+ * 
+ * Each shard has its own instance of this class with the same configuration except for
+ * the shard index. The TCP and UDP protocols can be configured to use it (see
+ * `TcpApi::setFlowSteering` and `UdpApi::setFlowSteering`), in which case they choose
+ * ephemeral ports only such that the resulting flows are owned by their shard, so that
+ * the responses to connections initiated by a shard arrive at that shard. Connections
+ * initiated by the remote side arrive at the owning shard naturally.
+ * 
+ * When the device cannot steer by this hash, @ref shardForIp4Packet can be used by the
+ * driver to detect packets which arrived at the wrong shard so that they can be handed
+ * over to the owning shard (e.g. using an `EventLoopTaskQueue`).
+ */
+class IpFlowSteering
+{
+public:
+    /**
+     * Size of the Toeplitz hash key in bytes.
+     */
+    inline static constexpr std::size_t KeySize = 40;
+
+    /**
+     * Number of entries in the indirection table.
+     */
+    inline static constexpr std::size_t IndirectionTableSize = 128;
+
+    /**
+     * The default Toeplitz hash key.
+     * 
+     * This is the key used in the Microsoft RSS specification, which is also the
+     * default of many network card drivers.
+     */
+    inline static constexpr std::uint8_t DefaultKey[KeySize] = {
+        0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+        0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+        0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+        0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+        0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+    };
+
+    /**
+     * Construct the flow steering object.
+     * 
+     * The key is initialized to @ref DefaultKey and the indirection table is initialized
+     * to assign shards to entries in a round-robin manner (entry `i` is assigned shard
+     * `i % num_shards`).
+     * 
+     * @param num_shards Number of shards (must be positive and not greater than @ref
+     *        IndirectionTableSize).
+     * @param shard_index Index of the shard which this object is used by (must be less
+     *        than num_shards).
+     */
+    IpFlowSteering (std::size_t num_shards, std::size_t shard_index) :
+        m_num_shards(num_shards),
+        m_shard_index(shard_index)
+    {
+        AIPSTACK_ASSERT(num_shards > 0);
+        AIPSTACK_ASSERT(num_shards <= IndirectionTableSize);
+        AIPSTACK_ASSERT(shard_index < num_shards);
+
+        setKey(DefaultKey);
+
+        for (std::size_t i = 0; i < IndirectionTableSize; i++) {
+            m_table[i] = std::uint8_t(i % num_shards);
+        }
+    }
+
+    /**
+     * Get the number of shards.
+     * 
+     * @return Number of shards.
+     */
+    inline std::size_t getNumShards () const {
+        return m_num_shards;
+    }
+
+    /**
+     * Get the index of the shard which this object is used by.
+     * 
+     * @return Shard index.
+     */
+    inline std::size_t getShardIndex () const {
+        return m_shard_index;
+    }
+
+    /**
+     * Set the Toeplitz hash key.
+     * 
+     * @param key Pointer to @ref KeySize bytes of the key.
+     */
+    void setKey (std::uint8_t const *key)
+    {
+        for (std::size_t i = 0; i < KeySize; i++) {
+            m_key[i] = key[i];
+        }
+    }
+
+    /**
+     * Set an entry in the indirection table.
+     * 
+     * @param index Index of the entry (must be less than @ref IndirectionTableSize).
+     * @param shard Shard for the entry (must be less than the number of shards).
+     */
+    void setIndirectionEntry (std::size_t index, std::size_t shard)
+    {
+        AIPSTACK_ASSERT(index < IndirectionTableSize);
+        AIPSTACK_ASSERT(shard < m_num_shards);
+
+        m_table[index] = std::uint8_t(shard);
+    }
+
+    /**
+     * Compute the Toeplitz hash of data.
+     * 
+     * @param key Hash key, of at least `data_len + 4` bytes.
+     * @param data Data to hash.
+     * @param data_len Length of data.
+     * @return Hash value.
+     */
+    static std::uint32_t toeplitzHash (
+        std::uint8_t const *key, std::uint8_t const *data, std::size_t data_len)
+    {
+        // The window holds the 32 bits of the key starting at the bit position
+        // corresponding to the current input bit.
+        std::uint32_t window = (std::uint32_t(key[0]) << 24) |
+            (std::uint32_t(key[1]) << 16) | (std::uint32_t(key[2]) << 8) |
+            std::uint32_t(key[3]);
+        std::uint32_t result = 0;
+
+        for (std::size_t i = 0; i < data_len; i++) {
+            std::uint8_t next_key_byte = key[i + 4];
+
+            for (int bit = 7; bit >= 0; bit--) {
+                if (((data[i] >> bit) & 1) != 0) {
+                    result ^= window;
+                }
+                window = (window << 1) | ((next_key_byte >> bit) & 1);
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * Compute the RSS hash of an IPv4 flow based on addresses and ports.
+     * 
+     * The addresses and ports are those of a received packet (source is remote).
+     * 
+     * @param src_addr Source address.
+     * @param dst_addr Destination address.
+     * @param src_port Source port.
+     * @param dst_port Destination port.
+     * @return Hash value.
+     */
+    std::uint32_t hashIp4Ports (Ip4Addr src_addr, Ip4Addr dst_addr,
+                                PortNum src_port, PortNum dst_port) const
+    {
+        std::uint8_t data[12];
+        write_addr(data + 0, src_addr);
+        write_addr(data + 4, dst_addr);
+        write_port(data + 8, src_port);
+        write_port(data + 10, dst_port);
+        return toeplitzHash(m_key, data, sizeof(data));
+    }
+
+    /**
+     * Compute the RSS hash of an IPv4 flow based on addresses only.
+     * 
+     * @param src_addr Source address.
+     * @param dst_addr Destination address.
+     * @return Hash value.
+     */
+    std::uint32_t hashIp4 (Ip4Addr src_addr, Ip4Addr dst_addr) const
+    {
+        std::uint8_t data[8];
+        write_addr(data + 0, src_addr);
+        write_addr(data + 4, dst_addr);
+        return toeplitzHash(m_key, data, sizeof(data));
+    }
+
+    /**
+     * Get the shard for a hash value using the indirection table.
+     * 
+     * @param hash Hash value.
+     * @return Shard index.
+     */
+    inline std::size_t shardForHash (std::uint32_t hash) const {
+        return m_table[hash % IndirectionTableSize];
+    }
+
+    /**
+     * Get the shard which owns a TCP or UDP flow.
+     * 
+     * @param local_addr Local address.
+     * @param remote_addr Remote address.
+     * @param local_port Local port.
+     * @param remote_port Remote port.
+     * @return Shard index.
+     */
+    std::size_t shardForFlow (Ip4Addr local_addr, Ip4Addr remote_addr,
+                              PortNum local_port, PortNum remote_port) const
+    {
+        // Received packets of the flow have the remote side as the source.
+        return shardForHash(hashIp4Ports(remote_addr, local_addr, remote_port, local_port));
+    }
+
+    /**
+     * Check if a TCP or UDP flow is owned by this shard.
+     * 
+     * @param local_addr Local address.
+     * @param remote_addr Remote address.
+     * @param local_port Local port.
+     * @param remote_port Remote port.
+     * @return True if the flow is owned by this shard.
+     */
+    inline bool isOwnFlow (Ip4Addr local_addr, Ip4Addr remote_addr,
+                           PortNum local_port, PortNum remote_port) const
+    {
+        return shardForFlow(local_addr, remote_addr, local_port, remote_port) ==
+            m_shard_index;
+    }
+
+    /**
+     * Get the shard for a received IPv4 packet.
+     * 
+     * This parses the IPv4 header and, for unfragmented TCP and UDP packets, the ports.
+     * 
+     * @param pkt The IPv4 packet, starting with the IPv4 header.
+     * @param out_shard On success, the shard index is stored here.
+     * @return True on success, false if the packet is not a valid IPv4 packet.
+     */
+    bool shardForIp4Packet (MemRef pkt, std::size_t &out_shard) const
+    {
+        if (pkt.len < Ip4Header::Size) {
+            return false;
+        }
+
+        char const *ip4_header = pkt.ptr;
+
+        std::uint16_t version_ihl_dscp_ecn =
+            Ip4Header::get(ip4_header, Ip4Header::VersionIhlDscpEcn());
+        std::uint8_t version = std::uint8_t(version_ihl_dscp_ecn >> (8 + Ip4VersionShift));
+        std::size_t header_len = std::size_t((version_ihl_dscp_ecn >> 8) & Ip4IhlMask) * 4;
+
+        if (version != 4 || header_len < Ip4Header::Size || pkt.len < header_len) {
+            return false;
+        }
+
+        Ip4Addr src_addr = Ip4Header::get(ip4_header, Ip4Header::SrcAddr());
+        Ip4Addr dst_addr = Ip4Header::get(ip4_header, Ip4Header::DstAddr());
+        Ip4Protocol proto = Ip4Header::get(ip4_header, Ip4Header::Proto());
+        Ip4Flags flags_offset = Ip4Header::get(ip4_header, Ip4Header::FlagsOffset());
+
+        bool is_fragment = (flags_offset & (Ip4Flags::MF | Ip4Flags::OffsetMask)) != Enum0;
+
+        // TCP and UDP headers both start with the source and destination ports.
+        if ((proto == Ip4Protocol::Tcp || proto == Ip4Protocol::Udp) && !is_fragment &&
+            pkt.len - header_len >= Udp4Header::Size)
+        {
+            char const *udp_header = pkt.ptr + header_len;
+            out_shard = shardForHash(hashIp4Ports(src_addr, dst_addr,
+                Udp4Header::get(udp_header, Udp4Header::SrcPort()),
+                Udp4Header::get(udp_header, Udp4Header::DstPort())));
+        } else {
+            out_shard = shardForHash(hashIp4(src_addr, dst_addr));
+        }
+
+        return true;
+    }
+
+private:
+    inline static void write_addr (std::uint8_t *dst, Ip4Addr addr)
+    {
+        std::uint32_t value = addr.value();
+        dst[0] = std::uint8_t(value >> 24);
+        dst[1] = std::uint8_t(value >> 16);
+        dst[2] = std::uint8_t(value >> 8);
+        dst[3] = std::uint8_t(value);
+    }
+
+    inline static void write_port (std::uint8_t *dst, PortNum port)
+    {
+        dst[0] = std::uint8_t(port >> 8);
+        dst[1] = std::uint8_t(port);
+    }
+
+private:
+    std::size_t m_num_shards;
+    std::size_t m_shard_index;
+    std::uint8_t m_key[KeySize];
+    std::uint8_t m_table[IndirectionTableSize];
+};
+
+/** @} */
+
+}
+
+#endif
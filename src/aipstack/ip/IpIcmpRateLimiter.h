@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_ICMP_RATE_LIMITER_H
+#define AIPSTACK_IP_ICMP_RATE_LIMITER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Token bucket rate limiter for sending ICMP messages.
+ * 
+ * Each bucket holds up to Burst tokens and one token is added every IntervalMs
+ * milliseconds. Sending a message takes a token, and if there is none the
+ * message is dropped and counted. If NumBuckets is greater than one, there is
+ * a bucket for each hash of the destination address prefix of length PrefixLen,
+ * so that one source of requests cannot use up the tokens of others. If Burst
+ * is zero, sending is not limited.
+ * 
+ * @tparam PlatformImpl The platform implementation type.
+ * @tparam Burst Maximum number of tokens in a bucket (zero to not limit).
+ * @tparam IntervalMs Interval in milliseconds for adding a token to a bucket.
+ * @tparam NumBuckets Number of buckets (must be \>0).
+ * @tparam PrefixLen Length of the address prefix which selects the bucket.
+ */
+template<typename PlatformImpl, std::uint8_t Burst, std::uint32_t IntervalMs,
+         std::size_t NumBuckets, std::uint8_t PrefixLen>
+class IpIcmpRateLimiter :
+    private NonCopyable<IpIcmpRateLimiter<
+        PlatformImpl, Burst, IntervalMs, NumBuckets, PrefixLen>>
+{
+    using Platform = PlatformFacade<PlatformImpl>;
+    using TimeType = typename Platform::TimeType;
+    
+    inline static constexpr TimeType IntervalTicks =
+        TimeType(IntervalMs * (Platform::TimeFreq / 1000.0));
+    
+    static_assert(NumBuckets > 0);
+    static_assert(PrefixLen <= Ip4Addr::Bits);
+    static_assert(Burst == 0 || IntervalTicks > 0,
+                  "The interval is too small for the platform time resolution");
+    
+public:
+    /**
+     * Construct the rate limiter with full buckets.
+     * 
+     * @param now The current time.
+     */
+    IpIcmpRateLimiter (TimeType now) :
+        m_drops(0)
+    {
+        for (Bucket &bucket : m_buckets) {
+            bucket.time = now;
+            bucket.tokens = Burst;
+        }
+    }
+    
+    /**
+     * Check if a message may be sent and take a token if so.
+     * 
+     * @param now The current time.
+     * @param addr Destination address of the message.
+     * @return True if the message may be sent, false if it should be dropped.
+     */
+    bool allow (TimeType now, Ip4Addr addr)
+    {
+        if (Burst == 0) {
+            return true;
+        }
+        
+        Bucket &bucket = m_buckets[bucket_index(addr)];
+        
+        TimeType elapsed = TimeType(now - bucket.time);
+        
+        if (elapsed >= IntervalTicks) {
+            TimeType num_intervals = elapsed / IntervalTicks;
+            if (num_intervals >= TimeType(Burst - bucket.tokens)) {
+                bucket.tokens = Burst;
+                bucket.time = now;
+            } else {
+                bucket.tokens += std::uint8_t(num_intervals);
+                bucket.time += TimeType(num_intervals * IntervalTicks);
+            }
+        }
+        
+        if (bucket.tokens == 0) {
+            m_drops++;
+            return false;
+        }
+        bucket.tokens--;
+        return true;
+    }
+    
+    /**
+     * Return the number of messages dropped due to the rate limit.
+     * 
+     * The counter wraps around on overflow.
+     * 
+     * @return Number of dropped messages.
+     */
+    inline std::uint32_t getDrops () const
+    {
+        return m_drops;
+    }
+    
+private:
+    inline static std::size_t bucket_index (Ip4Addr addr)
+    {
+        if (NumBuckets == 1) {
+            return 0;
+        }
+        
+        HashAccumulator hash;
+        hash.addWord((addr & Ip4Addr::PrefixMask(PrefixLen)).value());
+        return hash.getHash() % NumBuckets;
+    }
+    
+    struct Bucket {
+        TimeType time;
+        std::uint8_t tokens;
+    };
+    
+private:
+    Bucket m_buckets[NumBuckets];
+    std::uint32_t m_drops;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -25,21 +25,35 @@
 #ifndef AIPSTACK_IP_IFACE_H
 #define AIPSTACK_IP_IFACE_H
 
+#include <cstddef>
 #include <cstdint>
 
 #include <aipstack/misc/MinMax.h>
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/Hash.h>
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/structure/StructureRaiiWrapper.h>
 #include <aipstack/structure/Accessor.h>
 #include <aipstack/infra/ObserverNotification.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Chksum.h>
+#include <aipstack/infra/Struct.h>
+#include <aipstack/infra/TxAllocHelper.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/IgmpProto.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/ip/IpStackStats.h>
 #include <aipstack/ip/IpIfaceDriverParams.h>
 #include <aipstack/ip/IpHwCommon.h>
 #include <aipstack/ip/IpStackInternalDefs.h>
+#include <aipstack/ip/IpAddrHashSet.h>
 #include <aipstack/ip/IpIfaceListener.h>
+#include <aipstack/ip/IpMcastMembership.h>
+#include <aipstack/ip/IpRoute.h>
 
 namespace AIpStack {
 
@@ -77,29 +91,61 @@ class IpIface :
 {
     template<typename> friend class IpStack;
     template<typename> friend class IpIfaceListener;
+    template<typename> friend class IpMcastMembership;
     template<typename> friend class IpIfaceStateObserver;
     template<typename> friend class IpDriverIface;
+    template<typename> friend class IpRoute;
 
 private:
     IpIface (IpStack<Arg> *stack, IpIfaceDriverParams const &params) :
         m_stack(stack),
         m_params(params),
-        m_ip_mtu(MinValueU(TypeMax<std::uint16_t>, params.ip_mtu)),
+        m_ip_mtu(MinValueU(IpStack<Arg>::MaxMTU, params.ip_mtu)),
         m_have_addr(false),
-        m_have_gateway(false)
+        m_have_gateway(false),
+        m_tx_tso_mss(0),
+        m_tx_neigh_cache(nullptr),
+        m_num_routes(0),
+        m_tx_flush_pending(false),
+        m_mcast_filter(mcast_filter_bit(IgmpAllHostsAddr)),
+        m_igmp_timer(stack->platform(), AIPSTACK_BIND_MEMBER_TN(&IpIface::igmpTimerHandler, this)),
+        m_igmp_v2_mode(false),
+        m_igmp_general_pending(false)
     {
         AIPSTACK_ASSERT(stack != nullptr);
         AIPSTACK_ASSERT(m_ip_mtu >= IpStack<Arg>::MinMTU);
         AIPSTACK_ASSERT(params.send_ip4_packet);
         AIPSTACK_ASSERT(params.get_state);
         
+        // No protocols have listeners yet.
+        for (ListenerProtoWord &word : m_listener_protos) {
+            word = 0;
+        }
+        
         // Add the interface to the list of interfaces.
+        AIPSTACK_ASSERT(!IpStack<Arg>::SingleIface || m_stack->m_iface_list.isEmpty());
         m_stack->m_iface_list.prepend(*this);
     }
 
     ~IpIface ()
     {
         AIPSTACK_ASSERT(m_listeners_list.isEmpty());
+        AIPSTACK_ASSERT(m_mcast_list.isEmpty());
+        
+        // Remove the implicit routes, there must be no other routes through
+        // this interface.
+        remove_route(m_subnet_route);
+        remove_route(m_gateway_route);
+        AIPSTACK_ASSERT(m_num_routes == 0);
+        
+        // Drop datagrams being reassembled in receive buffers, which may
+        // belong to this interface.
+        m_stack->m_reassembly.dropChained();
+        
+        // Forget about any pending transmit flush.
+        if (m_tx_flush_pending) {
+            m_stack->m_tx_flush_list.remove(*this);
+        }
         
         // Remove the interface from the list of interfaces.
         m_stack->m_iface_list.remove(*this);
@@ -108,6 +154,22 @@ private:
     inline IpDriverIface<Arg> & driver () {
         return static_cast<IpDriverIface<Arg> &>(*this);
     }
+    
+    // Add one of the implicit routes of the interface.
+    void add_route (IpRouteEntry<Arg> &route)
+    {
+        route.iface = this;
+        route.metric = 0;
+        m_stack->add_route(route);
+    }
+    
+    // Remove one of the implicit routes of the interface if it is installed.
+    void remove_route (IpRouteEntry<Arg> &route)
+    {
+        if (route.installed) {
+            m_stack->remove_route(route);
+        }
+    }
 
 public:
     /**
@@ -133,6 +195,15 @@ public:
                 (Ip4Addr::AllOnesAddr() & ~m_addr.netmask);
             m_addr.prefix = value.prefix;
         }
+        
+        // Update the implicit route to the subnet.
+        remove_route(m_subnet_route);
+        if (value.present) {
+            m_subnet_route.net_addr = m_addr.netaddr;
+            m_subnet_route.prefix = m_addr.prefix;
+            m_subnet_route.have_gateway = false;
+            add_route(m_subnet_route);
+        }
     }
     
     /**
@@ -166,6 +237,16 @@ public:
         if (value.present) {
             m_gateway = value.addr;
         }
+        
+        // Update the implicit default route via the gateway.
+        remove_route(m_gateway_route);
+        if (value.present) {
+            m_gateway_route.net_addr = Ip4Addr::ZeroAddr();
+            m_gateway_route.prefix = 0;
+            m_gateway_route.have_gateway = true;
+            m_gateway_route.gateway = m_gateway;
+            add_route(m_gateway_route);
+        }
     }
     
     /**
@@ -182,6 +263,52 @@ public:
             IpIfaceIp4GatewaySetting(m_gateway) : IpIfaceIp4GatewaySetting();
     }
     
+    /**
+     * Add an additional IP address to the interface.
+     * 
+     * Packets addressed to additional addresses are delivered locally like
+     * those addressed to the address set by @ref setIp4Addr, and they can be
+     * used as the local address when sending. An additional address is a host
+     * address: no route is added for it and it has no broadcast address.
+     * Adding an address which is already present succeeds without effect.
+     * 
+     * The maximum number of additional addresses is given by @ref
+     * IpStackOptions::NumIfaceExtraAddrs.
+     * 
+     * @param addr Address to add. Must not be the zero address.
+     * @return True if the address was added or was already present, false if
+     *         the maximum number of additional addresses is reached.
+     */
+    bool addIp4ExtraAddr (Ip4Addr addr)
+    {
+        AIPSTACK_ASSERT(!addr.isZero());
+        
+        return m_extra_addrs.insert(addr);
+    }
+    
+    /**
+     * Remove an additional IP address from the interface.
+     * 
+     * @param addr Address to remove.
+     * @return True if the address was removed, false if it was not an
+     *         additional address of the interface.
+     */
+    bool removeIp4ExtraAddr (Ip4Addr addr)
+    {
+        return m_extra_addrs.remove(addr);
+    }
+    
+    /**
+     * Get the number of additional IP addresses of the interface.
+     * 
+     * @return Number of addresses added by @ref addIp4ExtraAddr and not
+     *         removed.
+     */
+    inline std::size_t getNumIp4ExtraAddrs () const
+    {
+        return m_extra_addrs.size();
+    }
+    
     /**
      * Get the type of the hardware-type-specific interface.
      * 
@@ -244,14 +371,46 @@ public:
     }
     
     /**
-     * Check if an address is the address of the interface.
+     * Check if an address is an address of the interface.
+     * 
+     * The address set by @ref setIp4Addr is compared first, and additional
+     * addresses (@ref addIp4ExtraAddr) are looked up in a hash table.
      * 
      * @param addr Address to check.
-     * @return True if the interface has an IP address assigned and the
-     *         assigned address is the given address, false otherwise.
+     * @return True if the given address is the assigned IP address of the
+     *         interface or one of its additional addresses, false otherwise.
      */
     inline bool ip4AddrIsLocalAddr (Ip4Addr addr) const {
-        return m_have_addr && addr == m_addr.addr;
+        return (m_have_addr && addr == m_addr.addr) || ip4AddrIsExtraAddr(addr);
+    }
+    
+    /**
+     * Check if an address is an additional address of the interface.
+     * 
+     * @param addr Address to check.
+     * @return True if the address was added by @ref addIp4ExtraAddr and not
+     *         removed, false otherwise.
+     */
+    inline bool ip4AddrIsExtraAddr (Ip4Addr addr) const {
+        return m_extra_addrs.contains(addr);
+    }
+    
+    /**
+     * Check if a multicast group has been joined on the interface.
+     * 
+     * A hashed filter rejects most groups which are not joined without a
+     * search of the memberships. The all-hosts group 224.0.0.1 is always
+     * joined.
+     * 
+     * @param group Multicast group address.
+     * @return True if there is an @ref IpMcastMembership for the group on the
+     *         interface or it is the all-hosts group, false otherwise.
+     */
+    inline bool ip4McastGroupIsJoined (Ip4Addr group) const {
+        if ((m_mcast_filter & mcast_filter_bit(group)) == 0) {
+            return false;
+        }
+        return group == IgmpAllHostsAddr || find_mcast_group(group) != nullptr;
     }
     
     /**
@@ -264,6 +423,45 @@ public:
         return m_ip_mtu;
     }
     
+    /**
+     * Return the transmit checksum offload capabilities of the interface.
+     * 
+     * See @ref IpChksumOffloadFlags for the meaning of the flags and the
+     * resulting requirements for TCP and UDP packets being sent.
+     * 
+     * @return Transmit checksum offload flags as provided by the driver
+     *         (@ref IpIfaceDriverParams::tx_chksum_offload).
+     */
+    inline IpChksumOffloadFlags getTxChksumOffload () const {
+        return m_params.tx_chksum_offload;
+    }
+    
+    /**
+     * Return the maximum size of TCP super-segments which the interface can
+     * segment itself.
+     * 
+     * @return Maximum super-segment size including the IP header, or zero if
+     *         TCP segmentation offload is not supported (or not usable due to
+     *         lack of TCP checksum offload). See @ref IpTxTsoInfo.
+     */
+    inline std::size_t getTsoMaxSize () const {
+        return ((m_params.tx_chksum_offload & IpChksumOffloadFlags::Tcp4) != Enum0) ?
+            m_params.tso_max_size : 0;
+    }
+    
+    /**
+     * Return the maximum size of UDP super-datagrams which the interface can
+     * segment itself.
+     * 
+     * @return Maximum super-datagram size including the IP header, or zero if
+     *         UDP segmentation offload is not supported (or not usable due to
+     *         lack of UDP checksum offload). See @ref IpTxTsoInfo.
+     */
+    inline std::size_t getUsoMaxSize () const {
+        return ((m_params.tx_chksum_offload & IpChksumOffloadFlags::Udp4) != Enum0) ?
+            m_params.uso_max_size : 0;
+    }
+    
     /**
      * Return the driver-provided interface state.
      * 
@@ -279,20 +477,365 @@ public:
         return m_params.get_state();
     }
 
+    /**
+     * Return whether the transmit queue of the driver is stopped.
+     *
+     * While it is stopped, packets sent with a send-retry request are failed
+     * with @ref IpErr::OutputBufferFull without being passed to the driver,
+     * see @ref IpIfaceDriverParams::tx_queue.
+     *
+     * @return True if the driver provides a transmit queue and it is stopped.
+     */
+    inline bool isTxStopped () const {
+        return m_params.tx_queue != nullptr && m_params.tx_queue->isStopped();
+    }
+
+    /**
+     * Get the statistics counters of the interface.
+     * 
+     * The counters are only maintained if @ref IpStackOptions::EnableStats is
+     * enabled, otherwise they are all zero.
+     * 
+     * @return The current counters.
+     */
+    inline IpIfaceStats getStats () const {
+        return m_stats.get();
+    }
+
 private:
     using InternalDefs = IpStackInternalDefs<Arg>;
     using IfaceListener = IpIfaceListener<Arg>;
     using IfaceLinkModel = typename InternalDefs::IfaceLinkModel;
     using IfaceListenerLinkModel = typename InternalDefs::IfaceListenerLinkModel;
+    using McastMembership = IpMcastMembership<Arg>;
+    using McastMembershipLinkModel = typename InternalDefs::McastMembershipLinkModel;
+    using Platform = PlatformFacade<typename Arg::PlatformImpl>;
+    using TimeType = typename Platform::TimeType;
 
     using IfaceListenerList = LinkedList<
         MemberAccessor<IfaceListener, LinkedListNode<IfaceListenerLinkModel>,
                        &IfaceListener::m_list_node>,
         IfaceListenerLinkModel, false>;
+    
+    using McastMembershipList = LinkedList<
+        MemberAccessor<McastMembership, LinkedListNode<McastMembershipLinkModel>,
+                       &McastMembership::m_list_node>,
+        McastMembershipLinkModel, false>;
+
+    // Bitmap of protocol numbers which have listeners, so that received
+    // datagrams can skip the listener list when there are none.
+    using ListenerProtoWord = std::uint32_t;
+    inline static constexpr int ListenerProtoWordBits = 32;
+    inline static constexpr int NumListenerProtoWords = 256 / ListenerProtoWordBits;
+    
+    inline bool has_listeners_for_proto (Ip4Protocol proto) const
+    {
+        int index = std::uint8_t(proto);
+        return (m_listener_protos[index / ListenerProtoWordBits] &
+                (ListenerProtoWord(1) << (index % ListenerProtoWordBits))) != 0;
+    }
+    
+    // Update the bitmap entry of a protocol after a listener has been
+    // added or removed.
+    void update_listeners_for_proto (Ip4Protocol proto)
+    {
+        bool have_listener = false;
+        for (IfaceListener *lis = m_listeners_list.first();
+             lis != nullptr; lis = m_listeners_list.next(*lis))
+        {
+            if (lis->m_proto == proto) {
+                have_listener = true;
+                break;
+            }
+        }
+        
+        int index = std::uint8_t(proto);
+        ListenerProtoWord mask = ListenerProtoWord(1) << (index % ListenerProtoWordBits);
+        ListenerProtoWord &word = m_listener_protos[index / ListenerProtoWordBits];
+        word = have_listener ? (word | mask) : (word & ~mask);
+    }
+    
+    inline static std::uint64_t mcast_filter_bit (Ip4Addr group)
+    {
+        HashAccumulator hash;
+        hash.addWord(group.value());
+        return std::uint64_t(1) << (hash.getHash() % 64);
+    }
+    
+    McastMembership * find_mcast_group (Ip4Addr group) const
+    {
+        for (McastMembership *mem = m_mcast_list.first();
+             mem != nullptr; mem = m_mcast_list.next(*mem))
+        {
+            if (mem->m_group == group) {
+                return mem;
+            }
+        }
+        return nullptr;
+    }
+    
+    // Call func(group) once for each joined group, including the all-hosts group.
+    template<typename Func>
+    void for_each_mcast_group (Func func) const
+    {
+        func(IgmpAllHostsAddr);
+        
+        for (McastMembership *mem = m_mcast_list.first();
+             mem != nullptr; mem = m_mcast_list.next(*mem))
+        {
+            if (mem->m_group != IgmpAllHostsAddr && find_mcast_group(mem->m_group) == mem) {
+                func(mem->m_group);
+            }
+        }
+    }
+    
+    void mcast_join (McastMembership &mem)
+    {
+        bool new_group = find_mcast_group(mem.m_group) == nullptr;
+        
+        mem.m_report_pending = false;
+        m_mcast_list.prepend(mem);
+        
+        if (new_group && mem.m_group != IgmpAllHostsAddr) {
+            m_mcast_filter |= mcast_filter_bit(mem.m_group);
+            mcast_groups_changed();
+            igmp_send_change(mem.m_group, /*join=*/true);
+        }
+    }
+    
+    void mcast_leave (McastMembership &mem)
+    {
+        m_mcast_list.remove(mem);
+        
+        if (find_mcast_group(mem.m_group) == nullptr && mem.m_group != IgmpAllHostsAddr) {
+            // Rebuild the filter since other groups may use the same bit.
+            m_mcast_filter = mcast_filter_bit(IgmpAllHostsAddr);
+            for (McastMembership *other = m_mcast_list.first();
+                 other != nullptr; other = m_mcast_list.next(*other))
+            {
+                m_mcast_filter |= mcast_filter_bit(other->m_group);
+            }
+            
+            mcast_groups_changed();
+            igmp_send_change(mem.m_group, /*join=*/false);
+        }
+    }
+    
+    void mcast_groups_changed ()
+    {
+        if (m_params.update_mcast_filter) {
+            m_params.update_mcast_filter();
+        }
+    }
+    
+    // Maximum number of group records in an IGMPv3 report, which keeps reports
+    // below the minimum MTU.
+    inline static constexpr std::size_t IgmpMaxV3Records = 32;
+    
+    inline static constexpr std::size_t IgmpIpHeaderSize =
+        Ip4Header::Size + Ip4RouterAlertOptionSize;
+    
+    inline static constexpr std::size_t IgmpMaxMsgSize =
+        Igmp3ReportHeader::Size + IgmpMaxV3Records * Igmp3GroupRecord::Size;
+    
+    using IgmpTxAlloc = TxAllocHelper<IgmpIpHeaderSize + IgmpMaxMsgSize,
+        IpStack<Arg>::HeaderBeforeIp4Dgram - Ip4Header::Size>;
+    
+    // Handle a received IGMP message. Only queries are processed, reports of
+    // other hosts do not suppress our reports (as permitted for IGMPv2 and
+    // required for IGMPv3).
+    void recv_igmp (IpBufRef dgram)
+    {
+        if (AIPSTACK_UNLIKELY(!dgram.hasHeader(IgmpHeader::Size)) || IpChksum(dgram) != 0) {
+            return;
+        }
+        
+        auto igmp_header = IgmpHeader::MakeRef(dgram.getChunkPtr());
+        if (igmp_header.get(IgmpHeader::Type()) != IgmpType::MembershipQuery) {
+            return;
+        }
+        
+        std::uint8_t max_resp_code = igmp_header.get(IgmpHeader::MaxRespCode());
+        Ip4Addr group = igmp_header.get(IgmpHeader::Group());
+        
+        // Determine the version of the query and the maximum response time in
+        // tenths of a second. An IGMPv1 query has a zero code and implies 10
+        // seconds. Reports are sent in the version of the latest query.
+        std::uint32_t max_resp_ds;
+        if (dgram.tot_len >= Igmp3QueryMinSize) {
+            m_igmp_v2_mode = false;
+            max_resp_ds = Igmp3DecodeMaxResp(max_resp_code);
+        } else {
+            m_igmp_v2_mode = true;
+            max_resp_ds = (max_resp_code == 0) ? 100 : max_resp_code;
+        }
+        
+        if (group.isZero()) {
+            m_igmp_general_pending = true;
+        } else {
+            McastMembership *mem = find_mcast_group(group);
+            if (mem == nullptr || group == IgmpAllHostsAddr) {
+                return;
+            }
+            mem->m_report_pending = true;
+        }
+        
+        // Respond after a random delay up to the maximum response time, unless
+        // a response is already scheduled earlier.
+        TimeType now = m_igmp_timer.platform().getEventTime();
+        HashAccumulator hash;
+        hash.addWord(std::uint32_t(now));
+        hash.addWord(std::uint32_t(reinterpret_cast<std::uintptr_t>(this)));
+        std::uint32_t delay_ms = hash.getHash() % (max_resp_ds * 100 + 1);
+        TimeType delay = TimeType(delay_ms * (Platform::TimeFreq / 1000.0));
+        
+        if (!m_igmp_timer.isSet() || TimeType(m_igmp_timer.getSetTime() - now) > delay) {
+            m_igmp_timer.setAt(TimeType(now + delay));
+        }
+    }
+    
+    void igmpTimerHandler ()
+    {
+        if (m_igmp_general_pending) {
+            m_igmp_general_pending = false;
+            
+            for (McastMembership *mem = m_mcast_list.first();
+                 mem != nullptr; mem = m_mcast_list.next(*mem))
+            {
+                mem->m_report_pending = false;
+            }
+            
+            igmp_send_all_reports();
+        } else {
+            for (McastMembership *mem = m_mcast_list.first();
+                 mem != nullptr; mem = m_mcast_list.next(*mem))
+            {
+                if (mem->m_report_pending) {
+                    mem->m_report_pending = false;
+                    igmp_send_reports(&mem->m_group, 1, Igmp3RecordType::ModeIsExclude);
+                }
+            }
+        }
+    }
+    
+    // Report all joined groups other than the all-hosts group.
+    void igmp_send_all_reports ()
+    {
+        Ip4Addr groups[IgmpMaxV3Records];
+        std::size_t num_groups = 0;
+        
+        for_each_mcast_group([&](Ip4Addr group) {
+            if (group == IgmpAllHostsAddr) {
+                return;
+            }
+            groups[num_groups++] = group;
+            if (num_groups == IgmpMaxV3Records) {
+                igmp_send_reports(groups, num_groups, Igmp3RecordType::ModeIsExclude);
+                num_groups = 0;
+            }
+        });
+        
+        if (num_groups > 0) {
+            igmp_send_reports(groups, num_groups, Igmp3RecordType::ModeIsExclude);
+        }
+    }
+    
+    // Report a change of membership of a group, which is sent right away.
+    void igmp_send_change (Ip4Addr group, bool join)
+    {
+        if (m_igmp_v2_mode && !join) {
+            igmp_send_v2(IgmpType::LeaveGroup, group, IgmpAllRoutersAddr);
+        } else {
+            igmp_send_reports(&group, 1, join ?
+                Igmp3RecordType::ChangeToExclude : Igmp3RecordType::ChangeToInclude);
+        }
+    }
+    
+    // Send reports for groups. With IGMPv3 this is a single report with a record
+    // of the given type for each group, with IGMPv2 a report for each group.
+    void igmp_send_reports (
+        Ip4Addr const *groups, std::size_t num_groups, Igmp3RecordType record_type)
+    {
+        AIPSTACK_ASSERT(num_groups > 0 && num_groups <= IgmpMaxV3Records);
+        
+        if (m_igmp_v2_mode) {
+            for (std::size_t i = 0; i < num_groups; i++) {
+                igmp_send_v2(IgmpType::V2Report, groups[i], groups[i]);
+            }
+            return;
+        }
+        
+        std::size_t msg_len = Igmp3ReportHeader::Size + num_groups * Igmp3GroupRecord::Size;
+        IgmpTxAlloc alloc(IgmpIpHeaderSize + msg_len);
+        char *msg = alloc.getPtr() + IgmpIpHeaderSize;
+        
+        auto report = Igmp3ReportHeader::MakeRef(msg);
+        report.set(Igmp3ReportHeader::Type(),       IgmpType::V3Report);
+        report.set(Igmp3ReportHeader::Reserved1(),  0);
+        report.set(Igmp3ReportHeader::Chksum(),     0);
+        report.set(Igmp3ReportHeader::Reserved2(),  0);
+        report.set(Igmp3ReportHeader::NumRecords(), std::uint16_t(num_groups));
+        
+        for (std::size_t i = 0; i < num_groups; i++) {
+            auto record = Igmp3GroupRecord::MakeRef(
+                msg + Igmp3ReportHeader::Size + i * Igmp3GroupRecord::Size);
+            record.set(Igmp3GroupRecord::RecordType(), record_type);
+            record.set(Igmp3GroupRecord::AuxDataLen(), 0);
+            record.set(Igmp3GroupRecord::NumSources(), 0);
+            record.set(Igmp3GroupRecord::Group(),      groups[i]);
+        }
+        
+        report.set(Igmp3ReportHeader::Chksum(), IpChksum(msg, msg_len));
+        
+        igmp_send(alloc, msg_len, Igmp3RoutersAddr);
+    }
+    
+    void igmp_send_v2 (IgmpType type, Ip4Addr group, Ip4Addr dst_addr)
+    {
+        IgmpTxAlloc alloc(IgmpIpHeaderSize + IgmpHeader::Size);
+        char *msg = alloc.getPtr() + IgmpIpHeaderSize;
+        
+        auto igmp_header = IgmpHeader::MakeRef(msg);
+        igmp_header.set(IgmpHeader::Type(),        type);
+        igmp_header.set(IgmpHeader::MaxRespCode(), 0);
+        igmp_header.set(IgmpHeader::Chksum(),      0);
+        igmp_header.set(IgmpHeader::Group(),       group);
+        igmp_header.set(IgmpHeader::Chksum(),      IpChksum(msg, IgmpHeader::Size));
+        
+        igmp_send(alloc, IgmpHeader::Size, dst_addr);
+    }
+    
+    // Write the IP header with the Router Alert option before an IGMP message
+    // and send the packet directly to the driver.
+    void igmp_send (IgmpTxAlloc &alloc, std::size_t msg_len, Ip4Addr dst_addr)
+    {
+        std::uint16_t total_len = std::uint16_t(IgmpIpHeaderSize + msg_len);
+        
+        auto ip4_header = Ip4Header::MakeRef(alloc.getPtr());
+        ip4_header.set(Ip4Header::VersionIhlDscpEcn(), std::uint16_t(
+            ((4 << Ip4VersionShift) | (IgmpIpHeaderSize / 4)) << 8 | IgmpTos));
+        ip4_header.set(Ip4Header::TotalLen(),     total_len);
+        ip4_header.set(Ip4Header::Ident(),        m_stack->m_next_id++);
+        ip4_header.set(Ip4Header::FlagsOffset(),  Ip4Flags());
+        ip4_header.set(Ip4Header::Ttl(),          IgmpTTL);
+        ip4_header.set(Ip4Header::Proto(),        Ip4Protocol::Igmp);
+        ip4_header.set(Ip4Header::HeaderChksum(), 0);
+        ip4_header.set(Ip4Header::SrcAddr(),
+                       m_have_addr ? m_addr.addr : Ip4Addr::ZeroAddr());
+        ip4_header.set(Ip4Header::DstAddr(),      dst_addr);
+        WriteSingleField<std::uint32_t>(alloc.getPtr() + Ip4Header::Size,
+                                        Ip4RouterAlertOption);
+        ip4_header.set(Ip4Header::HeaderChksum(),
+                       IpChksum(alloc.getPtr(), IgmpIpHeaderSize));
+        
+        IpStack<Arg>::driver_send_ip4_packet(
+            this, alloc.getBufRef(), dst_addr, nullptr);
+    }
 
 private:
     LinkedListNode<IfaceLinkModel> m_iface_list_node;
     StructureRaiiWrapper<IfaceListenerList> m_listeners_list;
+    ListenerProtoWord m_listener_protos[NumListenerProtoWords];
     Observable<IpIfaceStateObserver<Arg>> m_state_observable;
     IpStack<Arg> *m_stack;
     IpIfaceDriverParams m_params;
@@ -301,6 +844,20 @@ private:
     Ip4Addr m_gateway;
     bool m_have_addr;
     bool m_have_gateway;
+    IpAddrHashSet<InternalDefs::NumIfaceExtraAddrs> m_extra_addrs;
+    std::uint16_t m_tx_tso_mss;
+    IpNeighborCache *m_tx_neigh_cache;
+    IpRouteEntry<Arg> m_subnet_route;
+    IpRouteEntry<Arg> m_gateway_route;
+    std::size_t m_num_routes;
+    LinkedListNode<IfaceLinkModel> m_tx_flush_list_node;
+    bool m_tx_flush_pending;
+    StructureRaiiWrapper<McastMembershipList> m_mcast_list;
+    std::uint64_t m_mcast_filter;
+    typename Platform::Timer m_igmp_timer;
+    bool m_igmp_v2_mode;
+    bool m_igmp_general_pending;
+    IpStatsCounters<InternalDefs::EnableStats, IpIfaceStats> m_stats;
 };
 
 /** @} */
@@ -49,7 +49,10 @@ struct IpIfaceDriverParams {
     /**
      * The Maximum Transmission Unit (MTU), including the IP header.
      * 
-     * It must be at least @ref IpStack::MinMTU (this is an assert).
+     * It must be at least @ref IpStack::MinMTU (this is an assert). Larger
+     * values than @ref IpStack::MaxMTU are permitted and are reduced to that.
+     * Large MTUs such as those of jumbo frames are fully supported, for example
+     * TCP uses an MSS of 8960 bytes with a 9000 byte MTU.
      */
     std::size_t ip_mtu = 0;
     
@@ -108,6 +111,97 @@ struct IpIfaceDriverParams {
      * @return Driver-provided-state (currently just the link-up flag).
      */
     Function<IpIfaceDriverState()> get_state = nullptr;
+    
+    /**
+     * Transmit checksum offload capabilities.
+     * 
+     * If @ref IpChksumOffloadFlags::Tcp4 or @ref IpChksumOffloadFlags::Udp4 is
+     * set here, the driver must complete the checksums of the corresponding
+     * packets as described in @ref IpChksumOffloadFlags.
+     */
+    IpChksumOffloadFlags tx_chksum_offload = IpChksumOffloadFlags();
+    
+    /**
+     * Receive checksum offload capabilities.
+     * 
+     * Only flags set here are considered when the driver reports verified
+     * checksums to @ref IpDriverIface::recvIp4Packet.
+     */
+    IpChksumOffloadFlags rx_chksum_offload = IpChksumOffloadFlags();
+    
+    /**
+     * Maximum size of TCP super-segments for TCP segmentation offload.
+     * 
+     * If nonzero, the driver supports TCP segmentation offload (see
+     * @ref IpTxTsoInfo) for packets up to this size including the IP header.
+     * This is only used if @ref tx_chksum_offload includes
+     * @ref IpChksumOffloadFlags::Tcp4. If zero, super-segments are split into
+     * ordinary packets by the stack before being passed to the driver.
+     */
+    std::size_t tso_max_size = 0;
+    
+    /**
+     * Maximum size of UDP super-datagrams for UDP segmentation offload.
+     * 
+     * If nonzero, the driver supports UDP segmentation offload (see
+     * @ref IpTxTsoInfo) for packets up to this size including the IP header.
+     * This is only used if @ref tx_chksum_offload includes
+     * @ref IpChksumOffloadFlags::Udp4. If zero, super-datagrams are split into
+     * ordinary packets by the stack before being passed to the driver.
+     */
+    std::size_t uso_max_size = 0;
+    
+    /**
+     * Driver function to transmit packets held back by the driver (optional).
+     * 
+     * If this is provided, the driver may hold back packets passed to
+     * @ref send_ip4_packet (after copying them as needed) instead of transmitting
+     * them right away, and must transmit all held back packets when this is
+     * called. This allows a driver to transmit multiple packets using a single
+     * system call or hardware notification.
+     * 
+     * The stack calls this right after a packet is sent outside of a transmit
+     * batch, and once at the end of a transmit batch (see
+     * @ref IpStack::beginTxBatch) if any packet was sent through the interface
+     * in the batch. A driver which sends packets other than from
+     * @ref send_ip4_packet (e.g. ARP packets) must call
+     * @ref IpDriverIface::requestTxFlush after that.
+     * 
+     * This function must not send any packets through the stack.
+     */
+    Function<void()> flush_tx = nullptr;
+    
+    /**
+     * Driver function called when the set of multicast groups joined on the
+     * interface has changed (optional).
+     * 
+     * A driver with a hardware receive filter should then reprogram the filter
+     * to accept the groups reported by @ref IpDriverIface::forEachIp4McastGroup,
+     * so that frames for other groups are dropped in hardware. Datagrams for
+     * groups which are not joined are dropped by the stack in any case.
+     * 
+     * This function must not send any packets through the stack.
+     */
+    Function<void()> update_mcast_filter = nullptr;
+    
+    /**
+     * Transmit queue of the driver, for flow control of senders (optional).
+     * 
+     * If this is provided, the driver reports the occupancy of its transmit queue
+     * to this object and the stack uses the watermarks for flow control. While
+     * the queue is stopped (the high watermark was reached and the occupancy has
+     * not yet dropped to the low watermark), the stack does not pass packets
+     * which are sent with a send-retry request (e.g. TCP segments) to
+     * @ref send_ip4_packet but fails them with @ref IpErr::OutputBufferFull
+     * and associates the request with the queue, so that senders hold back
+     * until the queue drains instead of having packets rejected by the driver.
+     * Packets sent without a send-retry request (e.g. forwarded packets) are
+     * still passed to the driver, which should have room for them above the
+     * high watermark.
+     * 
+     * The object must outlive the interface.
+     */
+    IpSendRetryTxQueue *tx_queue = nullptr;
 };
 
 /** @} */
@@ -96,6 +96,7 @@ public:
         m_ip4_handler(ip4_handler)
     {
         m_iface->m_listeners_list.prepend(*this);
+        m_iface->update_listeners_for_proto(m_proto);
     }
     
     /**
@@ -104,6 +105,7 @@ public:
     ~IpIfaceListener ()
     {
         m_iface->m_listeners_list.remove(*this);
+        m_iface->update_listeners_for_proto(m_proto);
     }
     
     /**
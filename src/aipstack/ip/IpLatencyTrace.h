@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_LATENCY_TRACE_H
+#define AIPSTACK_IP_LATENCY_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Hints.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Points in the processing of a received packet at which latency tracing
+ * records the time (see @ref IpStackOptions::LatencyTraceInterval).
+ * 
+ * The stages are listed in the order in which they are reached. The
+ * transmit stages are reached if a packet is sent in response from within
+ * the processing of the received packet (for example, an ACK, or data sent
+ * by the application from its receive callback).
+ */
+enum class IpLatencyStage : std::uint8_t {
+    /**
+     * The frame was passed to @ref EthIpIface::recvFrame.
+     */
+    EthRx = 0,
+    
+    /**
+     * The IPv4 packet was passed to the stack by the driver (or by
+     * @ref EthIpIface).
+     */
+    IpRx,
+    
+    /**
+     * The datagram was dispatched to the protocol handler.
+     */
+    ProtoDemux,
+    
+    /**
+     * TCP input processing of the connection started.
+     */
+    TcpInput,
+    
+    /**
+     * The application callback with the received data (TCP or UDP) was
+     * called.
+     */
+    AppCallback,
+    
+    /**
+     * TCP built a segment to send.
+     */
+    TcpOutput,
+    
+    /**
+     * The IPv4 packet was passed to the interface driver.
+     */
+    IpTx,
+    
+    /**
+     * @ref EthIpIface passed the frame to its driver.
+     */
+    EthTx,
+};
+
+/**
+ * Number of stages in @ref IpLatencyStage.
+ */
+inline constexpr std::size_t IpLatencyNumStages = 8;
+
+/**
+ * Histogram of durations with power-of-two microsecond buckets.
+ * 
+ * Bucket 0 counts durations below 1 microsecond and bucket `i` for `i > 0`
+ * counts durations of at least 2<sup>i-1</sup> and less than 2<sup>i</sup>
+ * microseconds, except that the last bucket also counts all longer durations.
+ */
+struct IpLatencyHistogram {
+    /**
+     * Number of buckets.
+     */
+    inline static constexpr std::size_t NumBuckets = 24;
+    
+    /**
+     * Number of recorded durations.
+     */
+    std::uint64_t count = 0;
+    
+    /**
+     * Sum of recorded durations in microseconds.
+     */
+    std::uint64_t total_us = 0;
+    
+    /**
+     * Maximum recorded duration in microseconds.
+     */
+    std::uint64_t max_us = 0;
+    
+    /**
+     * Counts of recorded durations in each bucket.
+     */
+    std::uint64_t buckets[NumBuckets] = {};
+    
+    /**
+     * Record a duration.
+     * 
+     * @param time_us The duration in microseconds.
+     */
+    void record (std::uint64_t time_us)
+    {
+        count++;
+        total_us += time_us;
+        max_us = MaxValue(max_us, time_us);
+        
+        std::size_t bucket = 0;
+        while (time_us > 0 && bucket < NumBuckets - 1) {
+            time_us >>= 1;
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+};
+
+/**
+ * Latency statistics, as returned by @ref IpStack::getLatencyStats.
+ * 
+ * For each sampled packet, the histogram of a stage records the time from the
+ * previous stage which was reached to this stage. For the first stage reached
+ * (@ref IpLatencyStage::EthRx with @ref EthIpIface, otherwise
+ * @ref IpLatencyStage::IpRx), this is the time since the receive timestamp
+ * provided by the driver (see @ref IpRxTimestamp), that is the time the packet
+ * was queued before processing; nothing is recorded for this stage if the
+ * driver did not provide a timestamp. Stages which are not reached during
+ * the processing of the packet are not recorded.
+ */
+struct IpLatencyStats {
+    /**
+     * Number of sampled packets.
+     */
+    std::uint64_t samples = 0;
+    
+    /**
+     * Histograms for each stage, indexed by @ref IpLatencyStage.
+     */
+    IpLatencyHistogram stages[IpLatencyNumStages];
+};
+
+#ifndef IN_DOXYGEN
+
+// Samples one of every SampleInterval received packets and records the time
+// at which its processing reaches each stage.
+template<typename PlatformImpl, std::uint32_t SampleInterval>
+class IpLatencyTracer {
+    using Platform = PlatformFacade<PlatformImpl>;
+    using TimeType = typename Platform::TimeType;
+    
+    IpLatencyStats m_stats;
+    TimeType m_last_time = 0;
+    std::uint32_t m_countdown = SampleInterval;
+    std::uint8_t m_depth = 0;
+    std::uint8_t m_next_stage = 0;
+    bool m_active = false;
+    
+public:
+    // Called when processing of a received packet starts at the given stage.
+    // Nested calls (e.g. EthIpIface followed by IpStack) refer to the same
+    // packet and only mark the stage.
+    inline void rxBegin (Platform platform, IpLatencyStage stage, IpRxTimestamp rx_time)
+    {
+        if (m_depth++ > 0) {
+            mark(platform, stage);
+            return;
+        }
+        
+        if (AIPSTACK_LIKELY(--m_countdown > 0)) {
+            return;
+        }
+        m_countdown = SampleInterval;
+        
+        m_active = true;
+        m_stats.samples++;
+        
+        if (rx_time.valid) {
+            m_last_time = TimeType(rx_time.time);
+            m_next_stage = 0;
+            mark(platform, stage);
+        } else {
+            m_last_time = platform.getTime();
+            m_next_stage = std::uint8_t(std::uint8_t(stage) + 1);
+        }
+    }
+    
+    // Called when processing of a received packet started with rxBegin ends.
+    inline void rxEnd ()
+    {
+        if (--m_depth == 0) {
+            m_active = false;
+        }
+    }
+    
+    // Record reaching a stage if a packet is being sampled. Stages reached
+    // again or out of order are ignored.
+    inline void mark (Platform platform, IpLatencyStage stage)
+    {
+        if (AIPSTACK_LIKELY(!m_active) || std::uint8_t(stage) < m_next_stage) {
+            return;
+        }
+        
+        TimeType now = platform.getTime();
+        TimeType delta = Platform::timeGreaterOrEqual(now, m_last_time) ?
+            TimeType(now - m_last_time) : TimeType(0);
+        m_stats.stages[std::uint8_t(stage)].record(
+            std::uint64_t(double(delta) * (1e6 / Platform::TimeFreq)));
+        
+        m_last_time = now;
+        m_next_stage = std::uint8_t(std::uint8_t(stage) + 1);
+    }
+    
+    inline IpLatencyStats get () const
+    {
+        return m_stats;
+    }
+    
+    inline void reset ()
+    {
+        m_stats = IpLatencyStats();
+    }
+};
+
+template<typename PlatformImpl>
+class IpLatencyTracer<PlatformImpl, 0> {
+    using Platform = PlatformFacade<PlatformImpl>;
+    
+public:
+    inline void rxBegin (Platform, IpLatencyStage, IpRxTimestamp) {}
+    
+    inline void rxEnd () {}
+    
+    inline void mark (Platform, IpLatencyStage) {}
+    
+    inline IpLatencyStats get () const
+    {
+        return IpLatencyStats();
+    }
+    
+    inline void reset () {}
+};
+
+#endif
+
+/** @} */
+
+}
+
+#endif
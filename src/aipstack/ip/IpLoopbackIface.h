@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_LOOPBACK_IFACE_H
+#define AIPSTACK_IP_LOOPBACK_IFACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/SendRetry.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Options.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Loopback network interface which is part of the stack.
+ * 
+ * Packets sent through this interface are copied into a queue and delivered
+ * back to the same stack from a timer handler, without involving any driver.
+ * The deferral means that protocol handlers are never re-entered from within
+ * sending. Transport checksums are not calculated on transmission and not
+ * verified on reception (the interface advertises checksum offload in both
+ * directions).
+ * 
+ * The interface is assigned the address 127.0.0.1 with prefix length 8 when
+ * constructed, so 127.0.0.1 is reached through it. Additionally, packets which
+ * the stack sends to the address of another interface are passed to this
+ * interface instead of the driver of that interface, and are delivered as if
+ * received through the interface which has the address. Such packets are
+ * built for the other interface, so its MTU and checksum offload apply on
+ * transmission. At most one loopback interface may exist in a stack.
+ * 
+ * If the queue is full, sending fails with
+ * @ref IpErr::OutputBufferFull and the send-retry request is notified when
+ * space becomes available.
+ * 
+ * @tparam Arg An instantiation of the @ref IpLoopbackIfaceService::Compose
+ *         template or a dummy class derived from such.
+ */
+template<typename Arg>
+class IpLoopbackIface :
+    private NonCopyable<IpLoopbackIface<Arg>>
+{
+    AIPSTACK_USE_VALS(Arg::Params, (Mtu, QueueBytes))
+    AIPSTACK_USE_TYPES(Arg, (PlatformImpl, StackArg))
+    
+    using Platform = PlatformFacade<PlatformImpl>;
+    
+    static_assert(Mtu >= IpStack<StackArg>::MinMTU);
+    
+    // Packets are stored in the queue as records consisting of the length
+    // followed by the data, padded so that records start at aligned offsets.
+    inline static constexpr std::size_t RecordAlign = 8;
+    inline static constexpr std::uint32_t WrapMarker = 0xFFFFFFFF;
+    
+    inline static constexpr std::size_t RecordSize (std::size_t len)
+    {
+        return RecordAlign + (len + RecordAlign - 1) / RecordAlign * RecordAlign;
+    }
+    
+    static_assert(QueueBytes % RecordAlign == 0);
+    static_assert(QueueBytes >= RecordSize(Mtu));
+    
+    inline static constexpr IpChksumOffloadFlags AllChksumFlags =
+        IpChksumOffloadFlags::Ip4Header | IpChksumOffloadFlags::Tcp4 |
+        IpChksumOffloadFlags::Udp4;
+    
+public:
+    /**
+     * Construct the interface, registering it with the stack.
+     * 
+     * @param platform_ The platform facade (the same one that `stack` uses).
+     * @param stack Pointer to the IP stack (must outlive this interface).
+     */
+    IpLoopbackIface (PlatformFacade<PlatformImpl> platform_, IpStack<StackArg> *stack) :
+        m_stack(stack),
+        m_driver_iface(stack, make_params()),
+        m_timer(platform_, AIPSTACK_BIND_MEMBER_TN(&IpLoopbackIface::timerHandler, this)),
+        m_read_pos(0),
+        m_write_pos(0),
+        m_used_bytes(0),
+        m_num_packets(0)
+    {
+        AIPSTACK_ASSERT(stack->m_loopback_iface == nullptr);
+        
+        m_driver_iface.iface().setIp4Addr(
+            IpIfaceIp4AddrSetting(8, Ip4Addr(127, 0, 0, 1)));
+        
+        stack->m_loopback_iface = &m_driver_iface.iface();
+    }
+    
+    /**
+     * Destruct the interface, deregistering it from the stack.
+     * 
+     * Queued packets are dropped. The same restrictions apply as for
+     * destruction of an @ref IpDriverIface.
+     */
+    ~IpLoopbackIface ()
+    {
+        AIPSTACK_ASSERT(m_stack->m_loopback_iface == &m_driver_iface.iface());
+        
+        m_stack->m_loopback_iface = nullptr;
+    }
+    
+    /**
+     * Get the @ref IpIface representing this network interface.
+     * 
+     * @return Reference to the @ref IpIface.
+     */
+    inline IpIface<StackArg> & iface ()
+    {
+        return m_driver_iface.iface();
+    }
+    
+    /**
+     * Get the number of packets waiting in the queue.
+     * 
+     * @return Number of queued packets.
+     */
+    inline std::size_t getNumQueuedPackets () const
+    {
+        return m_num_packets;
+    }
+    
+private:
+    IpIfaceDriverParams make_params ()
+    {
+        IpIfaceDriverParams params;
+        params.ip_mtu = Mtu;
+        params.send_ip4_packet =
+            AIPSTACK_BIND_MEMBER_TN(&IpLoopbackIface::driverSendIp4Packet, this);
+        params.get_state = AIPSTACK_BIND_MEMBER_TN(&IpLoopbackIface::driverGetState, this);
+        params.tx_chksum_offload = IpChksumOffloadFlags::Tcp4 | IpChksumOffloadFlags::Udp4;
+        params.rx_chksum_offload = AllChksumFlags;
+        return params;
+    }
+    
+    IpErr driverSendIp4Packet (IpBufRef pkt, Ip4Addr, IpSendRetryRequest *retryReq)
+    {
+        AIPSTACK_ASSERT(pkt.tot_len <= Mtu);
+        
+        // Determine where the record goes. If it does not fit before the end
+        // of the queue memory, the remainder is skipped and it goes to the start.
+        std::size_t rec_size = RecordSize(pkt.tot_len);
+        std::size_t skip = (m_write_pos + rec_size > QueueBytes) ?
+            (QueueBytes - m_write_pos) : 0;
+        
+        if (m_used_bytes + skip + rec_size > QueueBytes) {
+            m_retry_list.addRequest(retryReq);
+            return IpErr::OutputBufferFull;
+        }
+        
+        if (skip > 0) {
+            write_length(m_write_pos, WrapMarker);
+            m_used_bytes += skip;
+            m_write_pos = 0;
+        }
+        
+        write_length(m_write_pos, std::uint32_t(pkt.tot_len));
+        ipBufTakeBytes(pkt, pkt.tot_len, m_queue + m_write_pos + RecordAlign);
+        
+        m_used_bytes += rec_size;
+        m_write_pos += rec_size;
+        if (m_write_pos == QueueBytes) {
+            m_write_pos = 0;
+        }
+        m_num_packets++;
+        
+        if (!m_timer.isSet()) {
+            m_timer.setNow();
+        }
+        
+        return IpErr::Success;
+    }
+    
+    IpIfaceDriverState driverGetState ()
+    {
+        IpIfaceDriverState state = {};
+        state.link_up = true;
+        return state;
+    }
+    
+    void timerHandler ()
+    {
+        // Process only the packets which are queued now, packets sent in
+        // response are processed in a later invocation.
+        std::size_t num_packets = m_num_packets;
+        AIPSTACK_ASSERT(num_packets > 0);
+        
+        m_driver_iface.beginRecvBatch();
+        
+        for (std::size_t i = 0; i < num_packets; i++) {
+            std::uint32_t len = read_length(m_read_pos);
+            if (len == WrapMarker) {
+                m_used_bytes -= QueueBytes - m_read_pos;
+                m_read_pos = 0;
+                len = read_length(m_read_pos);
+            }
+            
+            // The record remains in the queue while it is being processed, so
+            // it cannot be overwritten by packets sent in the meantime.
+            IpBufNode node = {m_queue + m_read_pos + RecordAlign, len, nullptr};
+            deliver_packet(IpBufRef{&node, 0, len});
+            
+            std::size_t rec_size = RecordSize(len);
+            m_used_bytes -= rec_size;
+            m_read_pos += rec_size;
+            if (m_read_pos == QueueBytes) {
+                m_read_pos = 0;
+            }
+            m_num_packets--;
+        }
+        
+        // Start from the beginning when empty to avoid skipping memory.
+        if (m_num_packets == 0) {
+            AIPSTACK_ASSERT(m_used_bytes == 0 && m_read_pos == m_write_pos);
+            m_read_pos = 0;
+            m_write_pos = 0;
+            m_used_bytes = 0;
+        }
+        
+        m_driver_iface.endRecvBatch();
+        
+        if (m_num_packets > 0 && !m_timer.isSet()) {
+            m_timer.setNow();
+        }
+        
+        // Only notify as many senders as there is room for maximum-size packets
+        // (but at least one), the others will be notified after the next drain.
+        std::size_t room = (QueueBytes - m_used_bytes) / RecordSize(Mtu);
+        m_retry_list.dispatchRequests((room > 0) ? room : 1);
+    }
+    
+    void deliver_packet (IpBufRef pkt)
+    {
+        // Deliver the packet through the interface which has the destination
+        // address, which is this interface except for packets which the stack
+        // redirected from another interface.
+        IpIface<StackArg> *target = &iface();
+        if (pkt.tot_len >= Ip4Header::Size) {
+            Ip4Addr dst_addr = Ip4Header::MakeRef(pkt.getChunkPtr()).get(Ip4Header::DstAddr());
+            if (!target->ip4AddrIsLocalAddr(dst_addr)) {
+                IpIface<StackArg> *other = m_stack->find_iface_with_addr(dst_addr);
+                if (other != nullptr) {
+                    target = other;
+                }
+            }
+        }
+        
+        IpStack<StackArg>::processRecvedIp4Packet(target, pkt, AllChksumFlags, nullptr);
+    }
+    
+    inline void write_length (std::size_t pos, std::uint32_t len)
+    {
+        std::memcpy(m_queue + pos, &len, sizeof(len));
+    }
+    
+    inline std::uint32_t read_length (std::size_t pos) const
+    {
+        std::uint32_t len;
+        std::memcpy(&len, m_queue + pos, sizeof(len));
+        return len;
+    }
+    
+private:
+    IpStack<StackArg> *m_stack;
+    IpDriverIface<StackArg> m_driver_iface;
+    typename Platform::Timer m_timer;
+    IpSendRetryList m_retry_list;
+    std::size_t m_read_pos;
+    std::size_t m_write_pos;
+    std::size_t m_used_bytes;
+    std::size_t m_num_packets;
+    alignas(RecordAlign) char m_queue[QueueBytes];
+};
+
+/**
+ * Static configuration options for @ref IpLoopbackIface.
+ */
+struct IpLoopbackIfaceOptions {
+    /**
+     * MTU of the interface.
+     * 
+     * The default is the largest possible IPv4 packet so that TCP can use
+     * large segments between local endpoints.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(Mtu, std::uint16_t, 65535)
+    
+    /**
+     * Size of the packet queue in bytes.
+     * 
+     * Each packet uses its length rounded up to a multiple of 8 plus 8 bytes.
+     * This must be a multiple of 8 and large enough for one packet of size
+     * @ref Mtu.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(QueueBytes, std::size_t, 262144)
+};
+
+/**
+ * Service definition for @ref IpLoopbackIface.
+ * 
+ * The template parameters of this class are assignments of options defined in
+ * @ref IpLoopbackIfaceOptions, for example:
+ * AIpStack::IpLoopbackIfaceOptions::QueueBytes::Is\<65536 + 8\>.
+ * 
+ * An @ref IpLoopbackIface class type can be obtained as follows:
+ * 
+ * ```
+ * using MyLoopbackService = AIpStack::IpLoopbackIfaceService<...options...>;
+ * class MyLoopbackArg : public MyLoopbackService::template Compose<
+ *     PlatformImpl, IpStackArg> {};
+ * using MyLoopbackIface = AIpStack::IpLoopbackIface<MyLoopbackArg>;
+ * ```
+ * 
+ * @tparam Options Assignments of options defined in @ref IpLoopbackIfaceOptions.
+ */
+template<typename ...Options>
+class IpLoopbackIfaceService {
+    template<typename>
+    friend class IpLoopbackIface;
+    
+    AIPSTACK_OPTION_CONFIG_VALUE(IpLoopbackIfaceOptions, Mtu)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpLoopbackIfaceOptions, QueueBytes)
+    
+public:
+    /**
+     * Template to get the template parameter for @ref IpLoopbackIface.
+     * 
+     * @tparam PlatformImpl_ Platform layer implementation, the same one as used by the
+     *         @ref IpStack (see @ref IpStackService::Compose).
+     * @tparam StackArg_ Template parameter of @ref IpStack.
+     */
+    template<typename PlatformImpl_, typename StackArg_>
+    struct Compose {
+#ifndef IN_DOXYGEN
+        using PlatformImpl = PlatformImpl_;
+        using StackArg = StackArg_;
+        using Params = IpLoopbackIfaceService;
+
+        // This is for completeness and is not typically used.
+        AIPSTACK_DEF_INSTANCE(Compose, IpLoopbackIface)
+#endif
+    };
+};
+
+/** @} */
+
+}
+
+#endif
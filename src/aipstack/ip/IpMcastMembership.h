@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_MCAST_MEMBERSHIP_H
+#define AIPSTACK_IP_MCAST_MEMBERSHIP_H
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStackInternalDefs.h>
+
+namespace AIpStack {
+
+#ifndef IN_DOXYGEN
+template<typename> class IpStack;
+template<typename> class IpIface;
+#endif
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Membership of a multicast group on a specific interface.
+ * 
+ * While at least one membership object for a group is joined on an interface,
+ * datagrams addressed to the group are accepted on that interface, the group
+ * is reported to multicast routers using IGMP, and the driver is asked to
+ * receive frames for the group (see @ref IpIfaceDriverParams::update_mcast_filter).
+ * Multiple memberships for the same group are allowed, for example by different
+ * UDP listeners. Datagrams for groups which are not joined are dropped early in
+ * receive processing.
+ * 
+ * The all-hosts group 224.0.0.1 is always implicitly joined.
+ * 
+ * @tparam Arg Template parameter of @ref IpStack.
+ */
+template<typename Arg>
+class IpMcastMembership :
+    private NonCopyable<IpMcastMembership<Arg>>
+{
+    template<typename> friend class IpStack;
+    template<typename> friend class IpIface;
+    
+public:
+    /**
+     * Construct the membership object, initially not joined.
+     */
+    inline IpMcastMembership () :
+        m_iface(nullptr)
+    {}
+    
+    /**
+     * Destruct the membership object, leaving the group if joined.
+     */
+    inline ~IpMcastMembership ()
+    {
+        leave();
+    }
+    
+    /**
+     * Join a multicast group on an interface.
+     * 
+     * @param iface The interface. It is the responsibility of the user to ensure
+     *        that the interface is not removed while the membership is joined.
+     * @param group The multicast group address (must satisfy
+     *        @ref Ip4Addr::isMulticast).
+     */
+    void join (IpIface<Arg> *iface, Ip4Addr group)
+    {
+        AIPSTACK_ASSERT(!isJoined());
+        AIPSTACK_ASSERT(iface != nullptr);
+        AIPSTACK_ASSERT(group.isMulticast());
+        
+        m_iface = iface;
+        m_group = group;
+        m_iface->mcast_join(*this);
+    }
+    
+    /**
+     * Leave the multicast group if joined.
+     */
+    void leave ()
+    {
+        if (m_iface != nullptr) {
+            m_iface->mcast_leave(*this);
+            m_iface = nullptr;
+        }
+    }
+    
+    /**
+     * Return whether the membership is joined.
+     * 
+     * @return Whether the membership is joined.
+     */
+    inline bool isJoined () const
+    {
+        return m_iface != nullptr;
+    }
+    
+    /**
+     * Return the interface on which the membership is joined.
+     * 
+     * @return Interface, or null if not joined.
+     */
+    inline IpIface<Arg> * getIface () const
+    {
+        return m_iface;
+    }
+    
+    /**
+     * Return the joined multicast group.
+     * 
+     * This may only be called when joined.
+     * 
+     * @return Multicast group address.
+     */
+    inline Ip4Addr getGroup () const
+    {
+        AIPSTACK_ASSERT(isJoined());
+        
+        return m_group;
+    }
+    
+private:
+    using InternalDefs = IpStackInternalDefs<Arg>;
+    using McastMembershipLinkModel = typename InternalDefs::McastMembershipLinkModel;
+    
+private:
+    LinkedListNode<McastMembershipLinkModel> m_list_node;
+    IpIface<Arg> *m_iface;
+    Ip4Addr m_group;
+    bool m_report_pending;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -113,7 +113,8 @@ public:
      *        (guaranteed to be at least MinMTU). On failure it will not be
      *        changed.
      * @return True on success (object enters setup state), false on failure
-     *         (object remains in not-setup state).
+     *         (object remains in not-setup state). Failure only occurs if
+     *         iface is null and there is no route to remote_addr.
      */
     inline bool setup (IpStack<Arg> *stack, Ip4Addr remote_addr, IpIface<Arg> *iface,
                        std::uint16_t &out_pmtu)
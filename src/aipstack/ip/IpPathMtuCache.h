@@ -35,6 +35,8 @@
 #include <aipstack/misc/NonCopyable.h>
 #include <aipstack/misc/OneOf.h>
 #include <aipstack/misc/Function.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/misc/LazyResourceArray.h>
 #include <aipstack/structure/LinkModel.h>
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/structure/OperatorKeyCompare.h>
@@ -45,6 +47,7 @@
 #include <aipstack/proto/Ip4Proto.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/ip/IpStackStats.h>
 #include <aipstack/platform/PlatformFacade.h>
 
 namespace AIpStack {
@@ -121,8 +124,11 @@ private:
     // Timeout period for the MTU timer (one minute).
     inline static constexpr TimeType MtuTimerTicks = 60.0 * TimeType(Platform::TimeFreq);
     
+    // Number of hash buckets for MtuRef objects without an MtuEntry.
+    inline static constexpr std::size_t NumDetachedBuckets = 64;
+    
     // MTU entry states.
-    enum class EntryState {
+    enum class EntryState : std::uint8_t {
         // Entry is not valid (not in index, in free list).
         Invalid,
         // Entry is valid and referenced (in index, not in free list).
@@ -139,6 +145,9 @@ private:
     // efficiently determine whether the node is the first node.
     // This Link struct enables this data structure. It simply
     // contains a pointer the same type.
+    // MtuRef objects for addresses without an MtuEntry (whose PMTU
+    // is the interface MTU) are kept in the same kind of lists with
+    // heads in m_detached_heads, bucketed by the hash of the address.
     struct Link {
         Link *link;
         
@@ -155,17 +164,18 @@ private:
     
     using FreeListNode = LinkedListNode<MtuLinkModel>;
     
-    // MTU entry structure.
+    // MTU entry structure. Fields are ordered by decreasing alignment so that
+    // there is no padding between them.
     struct MtuEntry {
-        typename MtuIndex::Node index_node;
         union {
             FreeListNode free_list_node;
             Link first_ref;
         };
+        Ip4Addr remote_addr;
         std::uint16_t mtu;
         EntryState state;
         std::uint8_t minutes_old;
-        Ip4Addr remote_addr;
+        typename MtuIndex::Node index_node;
     };
     
     // Node accessors for the data structures.
@@ -180,6 +190,14 @@ private:
         {
             return mtu_entry.remote_addr;
         }
+        
+        // Returns the hash of a key for hash table indexes.
+        inline static std::size_t HashKey (Ip4Addr addr)
+        {
+            HashAccumulator hash;
+            hash.addWord(addr.value());
+            return hash.getHash();
+        }
     };
     
 private:
@@ -187,32 +205,52 @@ private:
     IpStack<StackArg> *m_ip_stack;
     StructureRaiiWrapper<typename MtuIndex::Index> m_mtu_index;
     StructureRaiiWrapper<MtuFreeList> m_mtu_free_list;
-    MtuEntry m_mtu_entries[NumMtuEntries];
+    LazyResourceArray<MtuEntry, NumMtuEntries> m_mtu_entries;
+    Link m_detached_heads[NumDetachedBuckets];
+    std::size_t m_num_valid_entries;
+    IpMemoryPeak<Arg::EnableStats> m_peak_valid_entries;
     
     // Accessor for the m_mtu_entries array.
     struct MtuEntriesAccessor : public
-        MemberAccessor<IpPathMtuCache, MtuEntry[NumMtuEntries],
+        MemberAccessor<IpPathMtuCache, LazyResourceArray<MtuEntry, NumMtuEntries>,
                        &IpPathMtuCache::m_mtu_entries> {};
     
 public:
     IpPathMtuCache (PlatformFacade<PlatformImpl> platform, IpStack<StackArg> *ip_stack)
     :
         m_timer(platform, AIPSTACK_BIND_MEMBER_TN(&IpPathMtuCache::timerHandler, this)),
-        m_ip_stack(ip_stack)
+        m_ip_stack(ip_stack),
+        m_num_valid_entries(0)
     {
-        // Initialize the MTU entries.
-        for (MtuEntry &mtu_entry : m_mtu_entries) {
-            mtu_entry.state = EntryState::Invalid;
-            m_mtu_free_list.append({mtu_entry, *this}, *this);
+        // MTU entries are constructed as needed, in attach_detached_refs.
+        
+        // Initialize the detached reference lists as empty.
+        for (Link &head : m_detached_heads) {
+            head.link = nullptr;
         }
     }
     
+    // Return the memory usage, objects are entries which are not Invalid.
+    IpMemoryUsage getMemoryUsage () const
+    {
+        IpMemoryUsage usage;
+        usage.static_bytes = sizeof(IpPathMtuCache);
+        usage.capacity = NumMtuEntries;
+        usage.used = m_num_valid_entries;
+        usage.peak_used = m_peak_valid_entries.get();
+        return usage;
+    }
+    
     bool handlePacketTooBig (Ip4Addr remote_addr, std::uint16_t mtu_info)
     {
-        // Find the entry of this address. If it there is none, do nothing.
+        // Find the entry of this address. If there is none, an entry is
+        // created only if there are detached MtuRef for the address.
         MtuLinkModelRef mtu_ref = m_mtu_index.findEntry(remote_addr, *this);
         if (mtu_ref.isNull()) {
-            return false;
+            mtu_ref = attach_detached_refs(remote_addr, mtu_info);
+            if (mtu_ref.isNull()) {
+                return false;
+            }
         }
         
         MtuEntry &mtu_entry = *mtu_ref;
@@ -249,6 +287,44 @@ public:
         return true;
     }
     
+    bool handlePathMtuProbed (Ip4Addr remote_addr, std::uint16_t mtu)
+    {
+        // Find the entry of this address. If it there is none, do nothing,
+        // the PMTU is already the interface MTU.
+        MtuLinkModelRef mtu_ref = m_mtu_index.findEntry(remote_addr, *this);
+        if (mtu_ref.isNull()) {
+            return false;
+        }
+        
+        MtuEntry &mtu_entry = *mtu_ref;
+        AIPSTACK_ASSERT(mtu_entry.state == OneOf(EntryState::Referenced, EntryState::Unused));
+        AIPSTACK_ASSERT(mtu_entry.remote_addr == remote_addr);
+        
+        // Make sure the PMTU will not exceed the interface MTU. Without a
+        // route we cannot know the limit so do nothing.
+        IpRouteInfoIp4<StackArg> route_info;
+        if (!m_ip_stack->routeIp4(remote_addr, route_info)) {
+            return false;
+        }
+        std::uint16_t raise_mtu = MinValue(mtu, route_info.iface->getMtu());
+        
+        // Only ever raise the PMTU here.
+        if (raise_mtu <= mtu_entry.mtu) {
+            return false;
+        }
+        
+        // Update PMTU, reset timeout.
+        mtu_entry.mtu = raise_mtu;
+        mtu_entry.minutes_old = 0;
+        
+        // Notify all MtuRef referencing this entry.
+        if (mtu_entry.state == EntryState::Referenced) {
+            notify_pmtu_changed(mtu_entry);
+        }
+        
+        return true;
+    }
+    
     class MtuRef :
         private NonCopyable<MtuRef>
     #ifndef IN_DOXYGEN
@@ -276,7 +352,9 @@ public:
             // of PrevLink points back to NextLink (rather than to PrevLink).
             bool is_first = PrevLink::link->link == NextLink::self();
             
-            if (is_first && NextLink::link == nullptr) {
+            if (is_first && NextLink::link == nullptr &&
+                PrevLink::link != cache->detached_head(m_remote_addr))
+            {
                 // We are the only node in this entry.
                 MtuEntry &mtu_entry = get_entry_from_first(PrevLink::link);
                 assert_entry_referenced(mtu_entry);
@@ -288,24 +366,9 @@ public:
                 // to add to the end to keep Invalid entries at the front.
                 cache->m_mtu_free_list.append({mtu_entry, *cache}, *cache);
             } else {
-                // We are not the only node and need to remove ourselves.
-                
-                // Setup the link from the previous to the next node.
-                Link *prev_link_dst;
-                if (is_first) {
-                    MtuRef &next_ref = get_ref_from_prev_link(NextLink::link);
-                    prev_link_dst = next_ref.NextLink::self();
-                } else {
-                    AIPSTACK_ASSERT(PrevLink::link->link == PrevLink::self());
-                    prev_link_dst = NextLink::link;
-                }
-                PrevLink::link->link = prev_link_dst;
-                
-                // Setup the link from the next to the previous node, if any.
-                if (NextLink::link != nullptr) {
-                    AIPSTACK_ASSERT(NextLink::link->link == NextLink::self());
-                    NextLink::link->link = PrevLink::link;
-                }
+                // We are not the only node of an entry or we are detached,
+                // we just need to remove ourselves from the list.
+                unlink();
             }
             
             // Clear prev link to indicate unused MtuRef.
@@ -336,30 +399,25 @@ public:
                     // Remove entry from free list.
                     cache->m_mtu_free_list.remove(mtu_ref, *cache);
                     
-                    // Change the entry state from Unused to Referenced.
+                    // Change the entry state from Unused to Referenced, with
+                    // an empty list of references.
                     mtu_entry.state = EntryState::Referenced;
-                    
-                    // Set entry to Referenced state and setup our next link.
-                    NextLink::link = nullptr;
-                    
-                    // Links to/from the head are setup below.
+                    mtu_entry.first_ref.link = nullptr;
                 } else {
-                    // Referenced mtu_entry, we need to insert this MtuRef.
                     AIPSTACK_ASSERT(mtu_entry.state == EntryState::Referenced);
                     AIPSTACK_ASSERT(mtu_entry.first_ref.link != nullptr);
-                    
-                    // Get the current first MtuRef which will become the second.
-                    MtuRef &next_ref = get_ref_from_next_link(mtu_entry.first_ref.link);
-                    AIPSTACK_ASSERT(next_ref.PrevLink::link == mtu_entry.first_ref.self());
-                    
-                    // Setup links between this and the former first MtuRef.
-                    NextLink::link = next_ref.PrevLink::self();
-                    next_ref.PrevLink::link = NextLink::self();
-                    
-                    // Links to/from the head are setup below.
                 }
+                
+                // Insert this MtuRef into the list of the entry.
+                link_first(mtu_entry.first_ref);
+                
+                assert_entry_referenced(mtu_entry);
+                
+                out_pmtu = mtu_entry.mtu;
             } else {
-                // There is no MtuEntry for this address, we will try to add one.
+                // There is no MtuEntry for this address, so the PMTU is the
+                // interface MTU. An entry will only be allocated if the PMTU
+                // is lowered, until then we are kept in a detached list.
                 
                 // If no interface is provided, find the interface for the initial PMTU.
                 if (iface == nullptr) {
@@ -370,60 +428,14 @@ public:
                     iface = route_info.iface;
                 }
                 
-                // Get an MtuEntry from the free list.
-                mtu_ref = cache->m_mtu_free_list.first(*cache);
-                if (mtu_ref.isNull()) {
-                    return false;
-                }
-                
-                // An MtuEntry on the free list can be in Invalid or Unused state.
-                MtuEntry &mtu_entry = *mtu_ref;
-                AIPSTACK_ASSERT(mtu_entry.state ==
-                    OneOf(EntryState::Invalid, EntryState::Unused));
-                
-                // Remove the entry from the free list.
-                cache->m_mtu_free_list.removeFirst(*cache);
-                
-                // If the entry is in Unused state, it is inserted into the index
-                // and needs to be removed before being re-inserted with a different
-                // address.
-                if (mtu_entry.state == EntryState::Unused) {
-                    AIPSTACK_ASSERT(mtu_entry.remote_addr != remote_addr);
-                    cache->m_mtu_index.removeEntry(mtu_ref, *cache);
-                }
-                
-                // Setup some fields of the entry.
-                mtu_entry.state = EntryState::Referenced;
-                mtu_entry.remote_addr = remote_addr;
-                mtu_entry.mtu = iface->getMtu();
-                mtu_entry.minutes_old = 0;
-                
-                // Add the entry to the index with the new address.
-                cache->m_mtu_index.addEntry(mtu_ref, *cache);
-                
-                // Make sure the MtuTimer is running, since it would not have been
-                // running if we didn't have any non-Invalid timers before.
-                if (!cache->m_timer.isSet()) {
-                    mtu_entry.minutes_old = 1; // don't waste a minute
-                    cache->m_timer.setAfter(MtuTimerTicks);
-                }
-                
-                // Clear the next link since we are the first node.
-                NextLink::link = nullptr;
+                // Insert this MtuRef into the detached list for the address.
+                link_first(*cache->detached_head(remote_addr));
                 
-                // Links to/from the head are setup below.
+                out_pmtu = iface->getMtu();
             }
             
-            MtuEntry &mtu_entry = *mtu_ref;
-            
-            // In all cases we need to link ourselves with the head of the list.
-            mtu_entry.first_ref.link = NextLink::self();
-            PrevLink::link = mtu_entry.first_ref.self();
-            
-            assert_entry_referenced(mtu_entry);
+            m_remote_addr = remote_addr;
             
-            // Return the PMTU and success.
-            out_pmtu = mtu_entry.mtu;
             return true;
         }
         
@@ -436,9 +448,10 @@ public:
                 return;
             }
             
-            // Copy the prev and next links.
+            // Copy the prev and next links and the address.
             PrevLink::link = src.PrevLink::link;
             NextLink::link = src.NextLink::link;
+            m_remote_addr = src.m_remote_addr;
             
             // Fixup the link from prev (different for first and non-first node).
             if (PrevLink::link->link == src.NextLink::self()) {
@@ -469,6 +482,57 @@ public:
         // This is because the caller is iterating the linked list
         // of references without considerations for its modification.
         virtual void pmtuChanged (std::uint16_t pmtu) = 0;
+    
+    private:
+        // Insert this MtuRef at the front of the list with the given head.
+        void link_first (Link &head)
+        {
+            if (head.link != nullptr) {
+                // Get the current first MtuRef which will become the second.
+                MtuRef &next_ref = get_ref_from_next_link(head.link);
+                AIPSTACK_ASSERT(next_ref.PrevLink::link == head.self());
+                
+                // Setup links between this and the former first MtuRef.
+                NextLink::link = next_ref.PrevLink::self();
+                next_ref.PrevLink::link = NextLink::self();
+            } else {
+                // Clear the next link since we are the only node.
+                NextLink::link = nullptr;
+            }
+            
+            // Link ourselves with the head of the list.
+            head.link = NextLink::self();
+            PrevLink::link = head.self();
+        }
+        
+        // Remove this MtuRef from its list, leaving the list empty if this
+        // was the only node. PrevLink is not cleared.
+        void unlink ()
+        {
+            // Check if we are the first node by seeing if the destination
+            // of PrevLink points back to NextLink (rather than to PrevLink).
+            bool is_first = PrevLink::link->link == NextLink::self();
+            
+            // Setup the link from the previous node or head to the next node.
+            Link *prev_link_dst;
+            if (is_first) {
+                prev_link_dst = (NextLink::link == nullptr) ? nullptr :
+                    get_ref_from_prev_link(NextLink::link).NextLink::self();
+            } else {
+                AIPSTACK_ASSERT(PrevLink::link->link == PrevLink::self());
+                prev_link_dst = NextLink::link;
+            }
+            PrevLink::link->link = prev_link_dst;
+            
+            // Setup the link from the next to the previous node, if any.
+            if (NextLink::link != nullptr) {
+                AIPSTACK_ASSERT(NextLink::link->link == NextLink::self());
+                NextLink::link->link = PrevLink::link;
+            }
+        }
+    
+    private:
+        Ip4Addr m_remote_addr;
     };
     
 private:
@@ -488,6 +552,112 @@ private:
         return static_cast<MtuRef &>(static_cast<NextLink &>(*link));
     }
     
+    inline Link * detached_head (Ip4Addr remote_addr)
+    {
+        return &m_detached_heads[MtuIndexKeyFuncs::HashKey(remote_addr) %
+                                 NumDetachedBuckets];
+    }
+    
+    // Called when the PMTU of an address without an MtuEntry is to be lowered.
+    // If there are detached MtuRef for the address, allocate an entry with the
+    // interface MTU and move these references to it. Returns null if the PMTU
+    // would not be lowered, there are no references or no entry is available.
+    MtuLinkModelRef attach_detached_refs (Ip4Addr remote_addr, std::uint16_t mtu_info)
+    {
+        // Get the interface MTU which is the current PMTU of the references.
+        IpRouteInfoIp4<StackArg> route_info;
+        if (!m_ip_stack->routeIp4(remote_addr, route_info)) {
+            return MtuLinkModelRef::null();
+        }
+        std::uint16_t iface_mtu = route_info.iface->getMtu();
+        
+        // Nothing to do if the PMTU would not be lowered.
+        if (MaxValue(MinMTU, mtu_info) >= iface_mtu) {
+            return MtuLinkModelRef::null();
+        }
+        
+        // Check if there are any references for this address.
+        Link *head = detached_head(remote_addr);
+        MtuRef *ref = (head->link == nullptr) ? nullptr :
+            &get_ref_from_next_link(head->link);
+        while (ref != nullptr && ref->m_remote_addr != remote_addr) {
+            ref = (ref->NextLink::link == nullptr) ? nullptr :
+                &get_ref_from_prev_link(ref->NextLink::link);
+        }
+        if (ref == nullptr) {
+            return MtuLinkModelRef::null();
+        }
+        
+        // If there is no Invalid entry in the free list (these are at the front),
+        // construct a new entry if not all have been constructed yet.
+        if (!m_mtu_entries.allConstructed() && (m_mtu_free_list.isEmpty() ||
+            (*m_mtu_free_list.first(*this)).state != EntryState::Invalid))
+        {
+            MtuEntry &new_entry = m_mtu_entries.constructNext();
+            new_entry.state = EntryState::Invalid;
+            m_mtu_free_list.prepend({new_entry, *this}, *this);
+        }
+        
+        // Get an MtuEntry from the free list, preferring Invalid entries
+        // and otherwise taking the least recently used Unused entry.
+        MtuLinkModelRef mtu_ref = m_mtu_free_list.first(*this);
+        if (mtu_ref.isNull()) {
+            return MtuLinkModelRef::null();
+        }
+        
+        MtuEntry &mtu_entry = *mtu_ref;
+        AIPSTACK_ASSERT(mtu_entry.state == OneOf(EntryState::Invalid, EntryState::Unused));
+        
+        // Remove the entry from the free list.
+        m_mtu_free_list.removeFirst(*this);
+        
+        // If the entry is in Unused state, it is inserted into the index
+        // and needs to be removed before being re-inserted with a different
+        // address.
+        if (mtu_entry.state == EntryState::Unused) {
+            AIPSTACK_ASSERT(mtu_entry.remote_addr != remote_addr);
+            m_mtu_index.removeEntry(mtu_ref, *this);
+        } else {
+            m_num_valid_entries++;
+            m_peak_valid_entries.update(m_num_valid_entries);
+        }
+        
+        // Setup the entry with an empty list of references.
+        mtu_entry.state = EntryState::Referenced;
+        mtu_entry.first_ref.link = nullptr;
+        mtu_entry.remote_addr = remote_addr;
+        mtu_entry.mtu = iface_mtu;
+        mtu_entry.minutes_old = 0;
+        
+        // Add the entry to the index with the new address.
+        m_mtu_index.addEntry(mtu_ref, *this);
+        
+        // Make sure the MtuTimer is running, since it would not have been
+        // running if we didn't have any non-Invalid timers before.
+        if (!m_timer.isSet()) {
+            mtu_entry.minutes_old = 1; // don't waste a minute
+            m_timer.setAfter(MtuTimerTicks);
+        }
+        
+        // Move the references for this address from the detached list
+        // to the entry, starting with the first one found above.
+        while (ref != nullptr) {
+            MtuRef *next_ref = (ref->NextLink::link == nullptr) ? nullptr :
+                &get_ref_from_prev_link(ref->NextLink::link);
+            
+            if (ref->m_remote_addr == remote_addr) {
+                ref->unlink();
+                ref->link_first(mtu_entry.first_ref);
+            }
+            
+            ref = next_ref;
+        }
+        
+        assert_entry_referenced(mtu_entry);
+        
+        return mtu_ref;
+    }
+    
     inline static void assert_entry_referenced (MtuEntry &mtu_entry)
     {
         AIPSTACK_ASSERT(mtu_entry.state == EntryState::Referenced);
@@ -559,6 +729,8 @@ private:
         
         // Set entry to Invalid state.
         mtu_entry.state = EntryState::Invalid;
+        AIPSTACK_ASSERT(m_num_valid_entries > 0);
+        m_num_valid_entries--;
         
         // Move the entry to the front of the free list. We maintain all
         // Invalid entries at the front so that taking an Invalid entry is
@@ -605,6 +777,11 @@ private:
 struct IpPathMtuCacheOptions {
     /**
      * Number of PMTU cache entries (must be \>0).
+     * 
+     * Entries are only needed for destinations whose PMTU has been lowered
+     * below the interface MTU. Other destinations use the interface MTU
+     * without an entry, so users of the PMTU cache are not limited by the
+     * number of entries.
      */
     AIPSTACK_OPTION_DECL_VALUE(NumMtuEntries, std::size_t, 0)
     
@@ -617,8 +794,8 @@ struct IpPathMtuCacheOptions {
      * Data structure service for indexing PMTU cache entries by IP address.
      * 
      * This should be one of the implementations in the folder
-     * aipstack/structure/index. Specifically supported are @ref AvlTreeIndexService and
-     * @ref MruListIndexService.
+     * aipstack/structure/index. Specifically supported are @ref AvlTreeIndexService,
+     * @ref MruListIndexService and @ref HashTableIndexService.
      */
     AIPSTACK_OPTION_DECL_TYPE(MtuIndexService, void)
 };
@@ -645,10 +822,11 @@ class IpPathMtuCacheService {
     
 public:
 #ifndef IN_DOXYGEN
-    template<typename PlatformImpl_, typename StackArg_>
+    template<typename PlatformImpl_, typename StackArg_, bool EnableStats_ = false>
     struct Compose {
         using PlatformImpl = PlatformImpl_;
         using StackArg = StackArg_;
+        inline static constexpr bool EnableStats = EnableStats_;
         using Params = IpPathMtuCacheService;
         AIPSTACK_DEF_INSTANCE(Compose, IpPathMtuCache)        
     };
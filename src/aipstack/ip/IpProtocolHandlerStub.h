@@ -253,6 +253,21 @@ public:
     {
     }
     
+    /**
+     * Complete processing of a batch of received datagrams.
+     * 
+     * This is called at the end of a receive batch (see
+     * @ref IpDriverIface::beginRecvBatch), after all datagrams of the batch have
+     * been passed to @ref recvIp4Dgram. A protocol handler may defer work while
+     * @ref IpStack::isInRecvBatch is true, for example TCP sends a single
+     * acknowledgement for all segments of a connection received in the batch,
+     * and must complete such work here. When this is called, the batch is
+     * already no longer active.
+     */
+    void recvIp4BatchEnd ()
+    {
+    }
+    
 private:
     IpStack<StackArg> *m_stack;
 };
@@ -25,22 +25,33 @@
 #ifndef AIPSTACK_IPREASSEMBLY_H
 #define AIPSTACK_IPREASSEMBLY_H
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 
+#include <aipstack/meta/ChooseInt.h>
 #include <aipstack/misc/Use.h>
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/MinMax.h>
 #include <aipstack/misc/NonCopyable.h>
 #include <aipstack/misc/MinMax.h>
 #include <aipstack/misc/Function.h>
+#include <aipstack/misc/IntRange.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/index/HashTableIndex.h>
 #include <aipstack/infra/Struct.h>
 #include <aipstack/infra/Buf.h>
 #include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/RxBufPool.h>
 #include <aipstack/infra/Options.h>
 #include <aipstack/infra/Instance.h>
 #include <aipstack/proto/Ip4Proto.h>
 #include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStackStats.h>
 #include <aipstack/platform/PlatformFacade.h>
 
 namespace AIpStack {
@@ -61,6 +72,23 @@ class IpReassembly;
  * The implementation uses the strategy suggested in RFC 815, whereby hole
  * descriptors are placed at the beginnings of holes.
  * 
+ * Entries are found through an index by datagram identity (ReassIndexService),
+ * so the cost of processing a fragment does not depend on the number of
+ * entries. When a new datagram arrives and there is no free entry, the least
+ * recently used entry is reused.
+ * 
+ * Optionally (MaxChainedReassEntrys > 0), fragments received in retainable
+ * receive buffers (see @ref IpRxBuf) are not copied but kept in their buffers,
+ * and the reassembled datagram references them as a chain of buffer nodes.
+ * Such entries only hold fragment descriptors, and the total size of the
+ * retained buffers is limited by MaxChainedReassBytes.
+ * 
+ * So that a single source sending incomplete fragments cannot occupy all entries,
+ * the number of entries and the amount of fragment data per source address can be
+ * limited (MaxReassEntrysPerSource, MaxReassBytesPerSource). A source at its limit
+ * then only displaces its own entries. Datagrams with more holes than
+ * MaxReassHoles are dropped as soon as that is detected, before copying data.
+ * 
  * @tparam Arg An instantiated @ref IpReassemblyService::Compose template
  *         or a type derived from such. Note that the @ref IpStack actually
  *         performs this instantiation, the application must just pass an
@@ -71,8 +99,12 @@ class IpReassembly :
     private NonCopyable<IpReassembly<Arg>>
 {
     AIPSTACK_USE_VALS(Arg::Params, (MaxReassEntrys, MaxReassSize, MaxReassHoles,
-                                    MaxReassTimeSeconds))
+                                    MaxReassTimeSeconds, MaxChainedReassEntrys,
+                                    MaxChainedReassFrags, MaxChainedReassBytes,
+                                    MaxReassEntrysPerSource, MaxReassBytesPerSource))
+    AIPSTACK_USE_TYPES(Arg::Params, (ReassIndexService))
     AIPSTACK_USE_TYPES(Arg, (PlatformImpl))
+    AIPSTACK_USE_VALS(Arg, (EnableStats))
     
     using Platform = PlatformFacade<PlatformImpl>;
     AIPSTACK_USE_TYPES(Platform, (TimeType))
@@ -82,6 +114,21 @@ class IpReassembly :
     static_assert(MaxReassHoles >= 1);
     static_assert(MaxReassHoles <= 250); // important to prevent num_holes overflow
     static_assert(MaxReassTimeSeconds >= 5);
+    static_assert(MaxChainedReassEntrys >= 0);
+    static_assert(MaxChainedReassFrags >= 2);
+    static_assert(MaxReassEntrysPerSource >= 0);
+    
+    // Whether zero-copy reassembly in retained receive buffers is enabled.
+    inline static constexpr bool ChainedEnabled = MaxChainedReassEntrys > 0;
+    
+    // Whether the per-source quotas are enabled.
+    inline static constexpr bool SourceEntryQuota = MaxReassEntrysPerSource > 0;
+    inline static constexpr bool SourceByteQuota = MaxReassBytesPerSource > 0;
+    
+    // Maximum size of datagrams reassembled in retained receive buffers, that
+    // is the largest IP payload.
+    inline static constexpr std::uint16_t MaxChainedReassSize =
+        TypeMax<std::uint16_t> - Ip4Header::Size;
     
     // Null link value in HoleDescriptor lists.
     inline static constexpr std::uint16_t ReassNullLink = TypeMax<std::uint16_t>;
@@ -108,27 +155,238 @@ class IpReassembly :
     
     // Interval of the purge timer. Use as large as possible, we only need it to
     // expire before any expiration time becomes ambiguous due to clock wraparound.
-    inline static constexpr TimeType PurgeTimerInterval = Platform::WorkingTimeSpanTicks;
+    // With zero-copy reassembly use one second, so that receive buffers of
+    // expired entries are returned to their pools in a timely manner.
+    inline static constexpr TimeType PurgeTimerInterval =
+        ChainedEnabled ? TimeType(Platform::TimeFreq) : Platform::WorkingTimeSpanTicks;
+    
+    // Identity of the datagram which a fragment belongs to.
+    struct ReassKey {
+        Ip4Addr src_addr;
+        Ip4Addr dst_addr;
+        std::uint16_t ident;
+        Ip4Protocol proto;
+    };
     
-    struct ReassEntry {
-        // Offset in data to the first hole, or ReassNullLink for free entry.
+    // Table of reassembly entries of one kind, with an index by key. Entries in
+    // use are also in a list ordered by last use, for reuse of the least recently
+    // used entry when there are no free entries.
+    template<typename Data, int NumEntries>
+    class EntryTable :
+        private NonCopyable<EntryTable<Data, NumEntries>>
+    {
+    public:
+        struct Entry;
+    
+    private:
+        using IndexType = ChooseIntForMax<NumEntries, false>;
+        inline static constexpr IndexType IndexNull = IndexType(-1);
+        
+        struct EntriesAccessor;
+        using LinkModel = ArrayLinkModelWithAccessor<
+            Entry, IndexType, IndexNull, EntryTable, EntriesAccessor>;
+        
+        struct EntryIndexAccessor;
+        struct EntryIndexKeyFuncs;
+        AIPSTACK_MAKE_INSTANCE(EntryIndex, (ReassIndexService::template Index<
+            EntryIndexAccessor, ReassKey const &, EntryIndexKeyFuncs, LinkModel,
+            /*Duplicates=*/false>))
+        
+        // List of entries, used for the free list and for the LRU list.
+        struct EntryListAccessor;
+        using EntryList = LinkedList<EntryListAccessor, LinkModel, true>;
+    
+    public:
+        struct Entry : public Data {
+            typename EntryIndex::Node index_node;
+            LinkedListNode<LinkModel> list_node;
+            ReassKey key;
+            // Time after which the entry is considered invalid.
+            TimeType expiration_time;
+            // Fragment data accounted to the source (see MaxReassBytesPerSource).
+            std::size_t source_bytes;
+        };
+        
+        EntryTable () :
+            m_num_used(0)
+        {
+            for (Entry &entry : m_entries) {
+                m_free_list.append({entry, *this}, *this);
+            }
+        }
+        
+        // Find the entry for a key, which becomes the most recently used one.
+        Entry * findEntry (ReassKey const &key)
+        {
+            Entry *entry = m_index.findEntry(key, *this);
+            if (entry != nullptr) {
+                m_lru_list.remove({*entry, *this}, *this);
+                m_lru_list.append({*entry, *this}, *this);
+            }
+            return entry;
+        }
+        
+        // Return the least recently used entry, or null if no entry is in use.
+        inline Entry * leastRecentlyUsed ()
+        {
+            return m_lru_list.first(*this);
+        }
+        
+        // Return the entry used after the given one, for iteration.
+        inline Entry * nextUsed (Entry &entry)
+        {
+            return m_lru_list.next({entry, *this}, *this);
+        }
+        
+        // Return the number of entries in use.
+        inline std::size_t numUsed () const
+        {
+            return m_num_used;
+        }
+        
+        // Take an entry for a key which must not have an entry, reusing the least
+        // recently used entry if there are no free entries. The callback is called
+        // for a reused entry before it is removed.
+        template<typename ReuseFunc>
+        Entry & addEntry (ReassKey const &key, ReuseFunc reuse)
+        {
+            AIPSTACK_ASSERT(m_index.findEntry(key, *this).isNull());
+            
+            if (m_free_list.isEmpty()) {
+                Entry &lru_entry = *m_lru_list.first(*this);
+                reuse(lru_entry);
+                removeEntry(lru_entry);
+            }
+            
+            Entry *entry = m_free_list.first(*this);
+            m_free_list.removeFirst(*this);
+            m_num_used++;
+            
+            entry->key = key;
+            entry->source_bytes = 0;
+            m_index.addEntry({*entry, *this}, *this);
+            m_lru_list.append({*entry, *this}, *this);
+            
+            return *entry;
+        }
+        
+        // Return an entry in use to the free entries.
+        void removeEntry (Entry &entry)
+        {
+            m_index.removeEntry({entry, *this}, *this);
+            m_lru_list.remove({entry, *this}, *this);
+            m_free_list.prepend({entry, *this}, *this);
+            AIPSTACK_ASSERT(m_num_used > 0);
+            m_num_used--;
+        }
+    
+    private:
+        struct EntryIndexAccessor : public
+            MemberAccessor<Entry, typename EntryIndex::Node, &Entry::index_node> {};
+        struct EntryListAccessor : public
+            MemberAccessor<Entry, LinkedListNode<LinkModel>, &Entry::list_node> {};
+        
+        struct EntryIndexKeyFuncs {
+            inline static ReassKey const & GetKeyOfEntry (Entry const &entry)
+            {
+                return entry.key;
+            }
+            
+            static int CompareKeys (ReassKey const &op1, ReassKey const &op2)
+            {
+                if (op1.ident != op2.ident) {
+                    return (op1.ident < op2.ident) ? -1 : 1;
+                }
+                if (op1.src_addr != op2.src_addr) {
+                    return (op1.src_addr < op2.src_addr) ? -1 : 1;
+                }
+                if (op1.dst_addr != op2.dst_addr) {
+                    return (op1.dst_addr < op2.dst_addr) ? -1 : 1;
+                }
+                if (op1.proto != op2.proto) {
+                    return (op1.proto < op2.proto) ? -1 : 1;
+                }
+                return 0;
+            }
+            
+            static bool KeysAreEqual (ReassKey const &op1, ReassKey const &op2)
+            {
+                return op1.ident    == op2.ident    &&
+                       op1.src_addr == op2.src_addr &&
+                       op1.dst_addr == op2.dst_addr &&
+                       op1.proto    == op2.proto;
+            }
+            
+            static std::size_t HashKey (ReassKey const &key)
+            {
+                HashAccumulator hash;
+                hash.addWord(key.src_addr.value());
+                hash.addWord(key.dst_addr.value());
+                hash.addWord((std::uint32_t(key.ident) << 16) |
+                             std::uint32_t(key.proto));
+                return hash.getHash();
+            }
+        };
+    
+    private:
+        StructureRaiiWrapper<typename EntryIndex::Index> m_index;
+        StructureRaiiWrapper<EntryList> m_free_list;
+        StructureRaiiWrapper<EntryList> m_lru_list;
+        std::size_t m_num_used;
+        Entry m_entries[NumEntries];
+        
+        struct EntriesAccessor : public
+            MemberAccessor<EntryTable, Entry[NumEntries], &EntryTable::m_entries> {};
+    };
+    
+    struct ReassData {
+        // Offset in data to the first hole.
         std::uint16_t first_hole_offset;
         // The total data length, or 0 if last fragment not yet received.
         std::uint16_t data_length;
-        // Time after which the entry is considered invalid.
-        TimeType expiration_time;
-        // IPv4 header (options not stored).
-        char header[Ip4Header::Size];
         // Data and holes, each hole starts with a HoleDescriptor.
         // The last HoleDescriptor::Size bytes are to ensure these is space
         // for the last hole descriptor, they cannot contain data.
         char data[ReassBufferSize];
     };
     
+    using ReassTable = EntryTable<ReassData, MaxReassEntrys>;
+    using ReassEntry = typename ReassTable::Entry;
+    
+    // Fragment kept in its receive buffer for zero-copy reassembly.
+    struct ChainFrag {
+        // The retained receive buffer.
+        IpRxBuf *rx_buf;
+        // The fragment data, the next link is set when the datagram is complete.
+        IpBufNode node;
+        // Offset of the fragment data in the datagram.
+        std::uint16_t offset;
+    };
+    
+    struct ChainData {
+        // Number of fragments.
+        std::uint8_t num_frags;
+        // The total data length, or 0 if last fragment not yet received.
+        std::uint16_t data_length;
+        // The sum of the lengths of the fragments.
+        std::uint16_t recv_length;
+        // Fragments sorted by offset, they do not overlap.
+        ChainFrag frags[ChainedEnabled ? MaxChainedReassFrags : 1];
+    };
+    
+    using ChainTable = EntryTable<ChainData, ChainedEnabled ? MaxChainedReassEntrys : 1>;
+    using ChainEntry = typename ChainTable::Entry;
+    
 private:
     typename Platform::Timer m_timer;
     IpBufNode m_reass_node;
-    ReassEntry m_reass_packets[MaxReassEntrys];
+    ReassTable m_reass_table;
+    ChainTable m_chain_table;
+    std::size_t m_chain_bytes;
+    IpMemoryPeak<EnableStats> m_peak_used;
+    IpMemoryPeak<EnableStats> m_peak_chain_bytes;
+    ChainEntry *m_chain_delivered;
+    IpStatsCounters<EnableStats, IpStackStats> m_stats;
     
 public:
     /**
@@ -137,15 +395,12 @@ public:
      * @param platform_ The platform facade.
      */
     IpReassembly (Platform platform_) :
-        m_timer(platform_, AIPSTACK_BIND_MEMBER_TN(&IpReassembly::timerHandler, this))
+        m_timer(platform_, AIPSTACK_BIND_MEMBER_TN(&IpReassembly::timerHandler, this)),
+        m_chain_bytes(0),
+        m_chain_delivered(nullptr)
     {
         // Start the timer for the first interval.
         m_timer.setAfter(PurgeTimerInterval);
-        
-        // Mark all reassembly entries as unused.
-        for (auto &reass : m_reass_packets) {
-            reass.first_hole_offset = ReassNullLink;
-        }
     }
 
     inline Platform platform () const
@@ -167,23 +422,23 @@ public:
      * @param proto IP protocol number.
      * @param more_fragments More-fragments flag.
      * @param fragment_offset Fragment offset in bytes.
-     * @param header Pointer to the IPv4 header (only the base header is used).
-     *        The data in the header must match the various arguments of this
-     *        function (ident...fragment_offset).
+     * @param rx_buf The receive buffer containing the packet if it can be
+     *        retained (see @ref IpRxBuf), otherwise null.
      * @param dgram The IP payload of the incoming datagram must be passed,
      *        and if a datagram is reassembled (return value is true) then this
      *        will be changed to reference the reassembled payload, otherwise it
      *        will not be changed. If a reassembled datagram is returned, then the
-     *        referenced memory region may be used until the next call of this
-     *        function.
+     *        referenced memory region may be used until @ref releaseReassembled
+     *        is called, which must be done before the next call of this function.
      * @return True if a datagram was reassembled, false if not.
      */
     bool reassembleIp4 (std::uint16_t ident, Ip4Addr src_addr, Ip4Addr dst_addr,
         std::uint8_t ttl, Ip4Protocol proto, bool more_fragments,
-        std::uint16_t fragment_offset, char const *header, IpBufRef &dgram)
+        std::uint16_t fragment_offset, IpRxBuf *rx_buf, IpBufRef &dgram)
     {
         AIPSTACK_ASSERT(dgram.tot_len <= TypeMax<std::uint16_t>);
         AIPSTACK_ASSERT(more_fragments || fragment_offset > 0);
+        AIPSTACK_ASSERT(m_chain_delivered == nullptr);
         
         // Sanity check data length.
         if (dgram.tot_len == 0) {
@@ -191,15 +446,29 @@ public:
         }
         
         // Check if we have a reassembly entry for this datagram.
-        TimeType now = platform().getTime();
-        ReassEntry *reass = find_reass_entry(now, ident, src_addr, dst_addr, proto);
+        TimeType now = platform().getEventTime();
+        ReassKey key{src_addr, dst_addr, ident, proto};
+        ReassEntry *reass = find_reass_entry(now, key);
+        
+        if constexpr (ChainedEnabled) {
+            // Use zero-copy reassembly if the datagram is already being reassembled
+            // that way, or for a new datagram if the fragment is in a single chunk
+            // of a retainable buffer.
+            if (reass == nullptr) {
+                ChainEntry *chain = find_chain_entry(now, key);
+                
+                if (chain != nullptr ||
+                    (rx_buf != nullptr && dgram.getChunkLength() >= dgram.tot_len))
+                {
+                    return reassemble_chained(now, key, chain, ttl, more_fragments,
+                                              fragment_offset, rx_buf, dgram);
+                }
+            }
+        }
         
         if (reass == nullptr) {
             // Allocate an entry.
-            reass = alloc_reass_entry(now, ttl);
-            
-            // Copy the IP header.
-            std::memcpy(reass->header, header, Ip4Header::Size);
+            reass = alloc_reass_entry(now, key, ttl);
             
             // Set first hole and unknown data length.
             reass->first_hole_offset = 0;
@@ -223,6 +492,11 @@ public:
             }
             std::uint16_t fragment_end = std::uint16_t(fragment_offset + dgram.tot_len);
             
+            // Account the fragment data to the source.
+            if (!reserve_source_bytes(*reass, dgram.tot_len)) {
+                goto quota_drop_reass;
+            }
+            
             // Summary of last-fragment related sanity checks:
             // - When we first receive a last fragment, we remember the data size and
             //   also check that we have not yet received any data that would fall
@@ -279,7 +553,9 @@ public:
                 if (fragment_offset >= hole_end || fragment_end <= hole_offset) {
                     prev_hole_offset = hole_offset;
                     hole_offset = next_hole_offset;
-                    num_holes++;
+                    if (++num_holes > MaxReassHoles) {
+                        goto too_many_holes;
+                    }
                     continue;
                 }
                 
@@ -305,7 +581,9 @@ public:
                     // Advance prev_hole_offset to this hole.
                     prev_hole_offset = hole_offset;
                     
-                    num_holes++;
+                    if (++num_holes > MaxReassHoles) {
+                        goto too_many_holes;
+                    }
                 }
                 
                 // Create a new hole on the right if needed.
@@ -326,7 +604,9 @@ public:
                     // Advance prev_hole_offset to this hole.
                     prev_hole_offset = fragment_end;
                     
-                    num_holes++;
+                    if (++num_holes > MaxReassHoles) {
+                        goto too_many_holes;
+                    }
                 }
                 
                 // Setup the link to the next hole.
@@ -347,11 +627,9 @@ public:
             
             // If we have not yet received the final fragment or there
             // are still holes after the end, the reassembly is not complete.
+            // There are not too many holes, this was checked while counting
+            // them, before the data was copied.
             if (reass->data_length == 0 || reass->first_hole_offset < reass->data_length) {
-                // If there are too many holes, invalidate.
-                if (num_holes > MaxReassHoles) {
-                    goto invalidate_reass;
-                }
                 return false;
             }
             
@@ -369,8 +647,9 @@ public:
             AIPSTACK_ASSERT(next_hole_offset == ReassNullLink);
 #endif
             
-            // Invalidate the reassembly entry.
-            reass->first_hole_offset = ReassNullLink;
+            // Free the reassembly entry, the data stays in place until the entry
+            // is reused in a later call.
+            m_reass_table.removeEntry(*reass);
             
             // Setup dgram to point to the reassembled data.
             m_reass_node = IpBufNode{reass->data, MaxReassSize, nullptr};
@@ -380,71 +659,444 @@ public:
             return true;
         } while (false);
         
+    too_many_holes:
+        // The hole list may be inconsistent now, the entry is being dropped.
+        m_stats.inc(&IpStackStats::reasm_hole_drops);
+        goto invalidate_reass;
+        
+    quota_drop_reass:
+        m_stats.inc(&IpStackStats::reasm_quota_drops);
+        
     invalidate_reass:
-        reass->first_hole_offset = ReassNullLink;
+        m_reass_table.removeEntry(*reass);
+        m_stats.inc(&IpStackStats::reasm_fails);
         return false;
     }
     
+    /**
+     * Release the resources of the datagram returned by the last successful
+     * call of @ref reassembleIp4.
+     * 
+     * This must be called after a datagram was reassembled, when the reassembled
+     * data is no longer needed.
+     */
+    inline void releaseReassembled ()
+    {
+        if constexpr (ChainedEnabled) {
+            if (m_chain_delivered != nullptr) {
+                free_chain_entry(*m_chain_delivered);
+                m_chain_delivered = nullptr;
+            }
+        }
+    }
+    
+    /**
+     * Drop all datagrams being reassembled in retained receive buffers.
+     * 
+     * This must be called when a network interface is being removed, so that
+     * receive buffers which may belong to the interface are released.
+     */
+    void dropChained ()
+    {
+        AIPSTACK_ASSERT(m_chain_delivered == nullptr);
+        
+        if constexpr (ChainedEnabled) {
+            while (ChainEntry *chain = m_chain_table.leastRecentlyUsed()) {
+                free_chain_entry(*chain);
+            }
+        }
+    }
+    
+    /**
+     * Get the reassembly counters.
+     * 
+     * Only the reasm_fails, reasm_timeouts, reasm_quota_drops and reasm_hole_drops
+     * counters are maintained here, and only if statistics are enabled (see @ref IpStackOptions::EnableStats).
+     * 
+     * @return The counters.
+     */
+    inline IpStackStats getStats () const
+    {
+        return m_stats.get();
+    }
+    
+    /**
+     * Get the memory usage of reassembly.
+     * 
+     * Objects are reassembly entries, including chained reassembly entries if
+     * enabled. Dynamic bytes are the capacities of the receive buffers retained
+     * by chained reassembly. Peaks are only maintained if statistics are
+     * enabled (see @ref IpStackOptions::EnableStats).
+     * 
+     * @return The memory usage.
+     */
+    IpMemoryUsage getMemoryUsage () const
+    {
+        IpMemoryUsage usage;
+        usage.static_bytes = sizeof(IpReassembly);
+        usage.capacity = std::size_t(MaxReassEntrys) +
+            (ChainedEnabled ? std::size_t(MaxChainedReassEntrys) : 0);
+        usage.used = num_used_entries();
+        usage.peak_used = m_peak_used.get();
+        usage.dynamic_bytes = m_chain_bytes;
+        usage.peak_dynamic_bytes = m_peak_chain_bytes.get();
+        return usage;
+    }
+    
 private:
-    ReassEntry * find_reass_entry (TimeType now, std::uint16_t ident, Ip4Addr src_addr,
-                                   Ip4Addr dst_addr, Ip4Protocol proto)
+    inline std::size_t num_used_entries () const
+    {
+        return m_reass_table.numUsed() + (ChainedEnabled ? m_chain_table.numUsed() : 0);
+    }
+    
+
+    bool reassemble_chained (TimeType now, ReassKey const &key, ChainEntry *chain,
+        std::uint8_t ttl, bool more_fragments, std::uint16_t fragment_offset,
+        IpRxBuf *rx_buf, IpBufRef &dgram)
     {
-        ReassEntry *found_entry = nullptr;
+        if (chain == nullptr) {
+            // Allocate an entry.
+            chain = alloc_chain_entry(now, key, ttl);
+            
+            chain->num_frags = 0;
+            chain->data_length = 0;
+            chain->recv_length = 0;
+        }
         
-        for (auto &reass : m_reass_packets) {
-            // Ignore free entries.
-            if (reass.first_hole_offset == ReassNullLink) {
-                continue;
+        do {
+            // The fragment must be in a single chunk of a retainable buffer.
+            if (rx_buf == nullptr || dgram.getChunkLength() < dgram.tot_len) {
+                goto invalidate_chain;
+            }
+            
+            // Verify that the fragment is within the maximum datagram size.
+            if (fragment_offset > MaxChainedReassSize ||
+                dgram.tot_len > std::uint16_t(MaxChainedReassSize - fragment_offset))
+            {
+                goto invalidate_chain;
+            }
+            std::uint16_t fragment_end = std::uint16_t(fragment_offset + dgram.tot_len);
+            
+            std::uint8_t num_frags = chain->num_frags;
+            ChainFrag *frags = chain->frags;
+            
+            // Last-fragment related sanity checks, as for the reassembly buffers.
+            if (!more_fragments) {
+                if ((chain->data_length != 0 && fragment_end != chain->data_length) ||
+                    (num_frags > 0 && chain_frag_end(frags[num_frags - 1]) > fragment_end))
+                {
+                    goto invalidate_chain;
+                }
+                
+                chain->data_length = fragment_end;
+            } else {
+                if (chain->data_length != 0 && fragment_end > chain->data_length) {
+                    goto invalidate_chain;
+                }
             }
             
-            // If the entry has expired, mark is as free and ignore.
-            if (TimeType(reass.expiration_time - now) > ReassMaxExpirationTicks) {
-                reass.first_hole_offset = ReassNullLink;
-                continue;
+            // Find the position of the fragment in the sorted list.
+            std::uint8_t pos = 0;
+            while (pos < num_frags && frags[pos].offset < fragment_offset) {
+                pos++;
             }
             
-            // If the entry matches, return it after going through all
-            // so that we purge all expired entries.
-            auto reass_hdr = Ip4Header::MakeRef(reass.header);
-            if (reass_hdr.get(Ip4Header::Ident())   == ident &&
-                reass_hdr.get(Ip4Header::SrcAddr()) == src_addr &&
-                reass_hdr.get(Ip4Header::DstAddr()) == dst_addr &&
-                reass_hdr.get(Ip4Header::Proto())   == proto)
+            // Ignore an exact duplicate of a fragment we have. Any other overlap
+            // is treated as an error, which also means that the datagram is
+            // complete exactly when the fragments add up to its length.
+            if (pos < num_frags && frags[pos].offset == fragment_offset &&
+                frags[pos].node.len == dgram.tot_len)
             {
-                found_entry = &reass;
+                return false;
             }
+            if ((pos > 0 && chain_frag_end(frags[pos - 1]) > fragment_offset) ||
+                (pos < num_frags && frags[pos].offset < fragment_end))
+            {
+                goto invalidate_chain;
+            }
+            
+            // Drop the datagram if it is split into too many fragments.
+            if (num_frags == MaxChainedReassFrags) {
+                m_stats.inc(&IpStackStats::reasm_hole_drops);
+                goto invalidate_chain;
+            }
+            
+            // Account for the memory of the buffer, to the source and in total.
+            std::size_t buf_size = rx_buf->getCapacity();
+            if (!reserve_source_bytes(*chain, buf_size)) {
+                m_stats.inc(&IpStackStats::reasm_quota_drops);
+                goto invalidate_chain;
+            }
+            if (!reserve_chain_bytes(chain, buf_size)) {
+                goto invalidate_chain;
+            }
+            
+            // Insert the fragment, retaining the buffer.
+            for (std::uint8_t i = num_frags; i > pos; i--) {
+                frags[i] = frags[i - 1];
+            }
+            rx_buf->retain();
+            frags[pos] = ChainFrag{rx_buf,
+                IpBufNode{dgram.getChunkPtr(), dgram.tot_len, nullptr}, fragment_offset};
+            chain->num_frags = num_frags + 1;
+            chain->recv_length += std::uint16_t(dgram.tot_len);
+            m_chain_bytes += buf_size;
+            m_peak_chain_bytes.update(m_chain_bytes);
+            
+            // Check if the reassembly is complete.
+            if (chain->data_length == 0 || chain->recv_length < chain->data_length) {
+                return false;
+            }
+            AIPSTACK_ASSERT(chain->recv_length == chain->data_length);
+            
+            // Link the fragments into a chain of buffer nodes.
+            for (std::uint8_t i = 0; i + 1 < chain->num_frags; i++) {
+                frags[i].node.next = &frags[i + 1].node;
+            }
+            
+            // Setup dgram to point to the reassembled data. The entry is freed
+            // by releaseReassembled.
+            m_chain_delivered = chain;
+            dgram = IpBufRef{&frags[0].node, 0, chain->data_length};
+            
+            return true;
+        } while (false);
+        
+    invalidate_chain:
+        free_chain_entry(*chain);
+        m_stats.inc(&IpStackStats::reasm_fails);
+        return false;
+    }
+    
+    ChainEntry * find_chain_entry (TimeType now, ReassKey const &key)
+    {
+        ChainEntry *chain = m_chain_table.findEntry(key);
+        
+        // If the entry has expired, free it and ignore.
+        if (chain != nullptr && entry_expired(now, *chain)) {
+            free_chain_entry(*chain);
+            m_stats.inc(&IpStackStats::reasm_timeouts);
+            chain = nullptr;
         }
         
-        return found_entry;
+        return chain;
     }
     
-    ReassEntry * alloc_reass_entry (TimeType now, std::uint8_t ttl)
+    ChainEntry * alloc_chain_entry (TimeType now, ReassKey const &key, std::uint8_t ttl)
     {
-        TimeType future = now + ReassMaxExpirationTicks;
+        // Make sure the source stays within its entry quota.
+        reserve_source_entry(key.src_addr);
+        
+        // Take an entry, releasing the buffers of a reused entry.
+        ChainEntry &chain = m_chain_table.addEntry(key, [&](ChainEntry &reused) {
+            release_chain_bufs(reused);
+            m_stats.inc(&IpStackStats::reasm_fails);
+        });
+        m_peak_used.update(num_used_entries());
         
-        ReassEntry *result_reass = nullptr;
+        chain.expiration_time = entry_expiration_time(now, ttl);
         
-        for (auto &reass : m_reass_packets) {
-            // If the entry is unused, use it.
-            if (reass.first_hole_offset == ReassNullLink) {
-                result_reass = &reass;
-                break;
+        return &chain;
+    }
+    
+    // Make space for buffer memory of a new fragment by freeing the least
+    // recently used entries, other than the one for the fragment.
+    bool reserve_chain_bytes (ChainEntry *for_chain, std::size_t size)
+    {
+        if (size > MaxChainedReassBytes) {
+            return false;
+        }
+        
+        while (m_chain_bytes > MaxChainedReassBytes - size) {
+            ChainEntry *victim = m_chain_table.leastRecentlyUsed();
+            if (victim == for_chain) {
+                victim = m_chain_table.nextUsed(*victim);
             }
             
-            // Look for the entry with the least expiration time.
-            if (result_reass == nullptr ||
-                TimeType(future - reass.expiration_time) >
-                    TimeType(future - result_reass->expiration_time))
+            if (victim == nullptr) {
+                return false;
+            }
+            
+            free_chain_entry(*victim);
+        }
+        
+        return true;
+    }
+    
+    void free_chain_entry (ChainEntry &chain)
+    {
+        release_chain_bufs(chain);
+        m_chain_table.removeEntry(chain);
+    }
+    
+    void release_chain_bufs (ChainEntry &chain)
+    {
+        for (std::size_t i : IntRange(chain.num_frags)) {
+            IpRxBuf *rx_buf = chain.frags[i].rx_buf;
+            AIPSTACK_ASSERT(m_chain_bytes >= rx_buf->getCapacity());
+            m_chain_bytes -= rx_buf->getCapacity();
+            rx_buf->release();
+        }
+        
+        chain.num_frags = 0;
+    }
+    
+    inline static std::uint16_t chain_frag_end (ChainFrag const &frag)
+    {
+        return std::uint16_t(frag.offset + frag.node.len);
+    }
+    
+    ReassEntry * find_reass_entry (TimeType now, ReassKey const &key)
+    {
+        ReassEntry *reass = m_reass_table.findEntry(key);
+        
+        // If the entry has expired, free it and ignore.
+        if (reass != nullptr && entry_expired(now, *reass)) {
+            m_reass_table.removeEntry(*reass);
+            m_stats.inc(&IpStackStats::reasm_timeouts);
+            reass = nullptr;
+        }
+        
+        return reass;
+    }
+    
+    ReassEntry * alloc_reass_entry (TimeType now, ReassKey const &key, std::uint8_t ttl)
+    {
+        // Make sure the source stays within its entry quota.
+        reserve_source_entry(key.src_addr);
+        
+        // Take an entry, a reused entry only needs to be counted.
+        ReassEntry &reass = m_reass_table.addEntry(key, [&](ReassEntry &) {
+            m_stats.inc(&IpStackStats::reasm_fails);
+        });
+        m_peak_used.update(num_used_entries());
+        
+        reass.expiration_time = entry_expiration_time(now, ttl);
+        
+        return &reass;
+    }
+    
+    // Find the least recently used entry of a source in a table, other than
+    // the given entry.
+    template<typename Table>
+    static typename Table::Entry * source_lru_entry (
+        Table &table, Ip4Addr src_addr, void const *except)
+    {
+        typename Table::Entry *entry = table.leastRecentlyUsed();
+        while (entry != nullptr &&
+               (entry->key.src_addr != src_addr || entry == except))
+        {
+            entry = table.nextUsed(*entry);
+        }
+        return entry;
+    }
+    
+    // Drop the entry of a source which would expire first (considering the least
+    // recently used one of each table), other than the given entry. Returns false
+    // if the source has no other entry.
+    bool drop_source_entry (Ip4Addr src_addr, void const *except)
+    {
+        ReassEntry *reass = source_lru_entry(m_reass_table, src_addr, except);
+        ChainEntry *chain = nullptr;
+        if constexpr (ChainedEnabled) {
+            chain = source_lru_entry(m_chain_table, src_addr, except);
+        }
+        
+        if (reass == nullptr && chain == nullptr) {
+            return false;
+        }
+        
+        TimeType now = platform().getEventTime();
+        if (chain == nullptr || (reass != nullptr &&
+            TimeType(reass->expiration_time - now) <= TimeType(chain->expiration_time - now)))
+        {
+            m_reass_table.removeEntry(*reass);
+        } else {
+            free_chain_entry(*chain);
+        }
+        
+        m_stats.inc(&IpStackStats::reasm_quota_drops);
+        m_stats.inc(&IpStackStats::reasm_fails);
+        return true;
+    }
+    
+    // Count the entries of a source and the fragment data accounted to it.
+    void get_source_usage (Ip4Addr src_addr, std::size_t &entries, std::size_t &bytes)
+    {
+        entries = 0;
+        bytes = 0;
+        
+        auto count = [&](auto &table) {
+            for (auto *entry = table.leastRecentlyUsed(); entry != nullptr;
+                 entry = table.nextUsed(*entry))
             {
-                result_reass = &reass;
+                if (entry->key.src_addr == src_addr) {
+                    entries++;
+                    bytes += entry->source_bytes;
+                }
+            }
+        };
+        
+        count(m_reass_table);
+        if constexpr (ChainedEnabled) {
+            count(m_chain_table);
+        }
+    }
+    
+    // Before allocating an entry for a new datagram, drop entries of the same
+    // source if it is at its entry quota.
+    void reserve_source_entry (Ip4Addr src_addr)
+    {
+        if constexpr (SourceEntryQuota) {
+            std::size_t entries;
+            std::size_t bytes;
+            get_source_usage(src_addr, entries, bytes);
+            
+            for (; entries >= std::size_t(MaxReassEntrysPerSource); entries--) {
+                bool dropped = drop_source_entry(src_addr, nullptr);
+                AIPSTACK_ASSERT(dropped);
+                (void)dropped;
+            }
+        }
+    }
+    
+    // Account fragment data to the source of an entry, dropping other entries
+    // of the source as needed to stay within the byte quota. Returns false if
+    // this is not possible, in which case the entry itself must be dropped.
+    template<typename Entry>
+    bool reserve_source_bytes (Entry &entry, std::size_t size)
+    {
+        if constexpr (SourceByteQuota) {
+            if (size > MaxReassBytesPerSource) {
+                return false;
+            }
+            
+            std::size_t entries;
+            std::size_t bytes;
+            get_source_usage(entry.key.src_addr, entries, bytes);
+            
+            while (bytes > MaxReassBytesPerSource - size) {
+                if (!drop_source_entry(entry.key.src_addr, &entry)) {
+                    return false;
+                }
+                get_source_usage(entry.key.src_addr, entries, bytes);
             }
         }
         
-        // Set the expiration time.
+        entry.source_bytes += size;
+        return true;
+    }
+    
+    template<typename Entry>
+    inline static bool entry_expired (TimeType now, Entry const &entry)
+    {
+        return TimeType(entry.expiration_time - now) > ReassMaxExpirationTicks;
+    }
+    
+    inline static TimeType entry_expiration_time (TimeType now, std::uint8_t ttl)
+    {
         std::uint8_t seconds = MinValue(ttl, MaxReassTimeSeconds);
-        result_reass->expiration_time = now + seconds * TimeType(Platform::TimeFreq);
-        
-        return result_reass;
+        return now + seconds * TimeType(Platform::TimeFreq);
     }
     
     static void reass_link_prev (ReassEntry *reass, std::uint16_t prev_hole_offset, std::uint16_t hole_offset)
@@ -469,10 +1121,32 @@ private:
         // Restart the timer.
         m_timer.setAfter(PurgeTimerInterval);
         
-        // Purge any expired reassembly entries by calling find_reass_entry with
-        // dummy IP information.
-        TimeType now = platform().getTime();
-        find_reass_entry(now, 0, Ip4Addr::ZeroAddr(), Ip4Addr::ZeroAddr(), Ip4Protocol(0));
+        // Purge any expired reassembly entries.
+        TimeType now = platform().getEventTime();
+        
+        ReassEntry *reass = m_reass_table.leastRecentlyUsed();
+        while (reass != nullptr) {
+            ReassEntry *next = m_reass_table.nextUsed(*reass);
+            if (entry_expired(now, *reass)) {
+                m_reass_table.removeEntry(*reass);
+                m_stats.inc(&IpStackStats::reasm_timeouts);
+            }
+            reass = next;
+        }
+        
+        if constexpr (ChainedEnabled) {
+            // The entry of a datagram being delivered is not affected since
+            // it is released before returning to the event loop.
+            ChainEntry *chain = m_chain_table.leastRecentlyUsed();
+            while (chain != nullptr) {
+                ChainEntry *next = m_chain_table.nextUsed(*chain);
+                if (entry_expired(now, *chain)) {
+                    free_chain_entry(*chain);
+                    m_stats.inc(&IpStackStats::reasm_timeouts);
+                }
+                chain = next;
+            }
+        }
     }
 };
 
@@ -494,6 +1168,9 @@ struct IpReassemblyOptions {
     
     /**
      * Maximum number of holes in an incompletely reassembled datagram.
+     * 
+     * A datagram with more holes is dropped as soon as this is detected while
+     * processing a fragment, without copying its data.
      */
     AIPSTACK_OPTION_DECL_VALUE(MaxReassHoles, std::uint8_t, 10)
     
@@ -502,6 +1179,69 @@ struct IpReassemblyOptions {
      * as an additional restriction to the TTL seconds limit.
      */
     AIPSTACK_OPTION_DECL_VALUE(MaxReassTimeSeconds, std::uint8_t, 60)
+    
+    /**
+     * Maximum number of datagrams being reassembled without copying, in the
+     * receive buffers of the fragments (0 to disable).
+     * 
+     * This is used for fragments which the driver passes in retainable
+     * receive buffers (see @ref IpRxBuf). These entries hold only fragment
+     * descriptors (see @ref MaxChainedReassFrags), and the reassembled
+     * datagram is passed to the protocol handler as a chain of buffers.
+     * Datagrams of any size up to the IPv4 maximum are supported, regardless
+     * of @ref MaxReassSize.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(MaxChainedReassEntrys, int, 0)
+    
+    /**
+     * Maximum number of fragments of a datagram being reassembled without
+     * copying.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(MaxChainedReassFrags, std::uint8_t, 48)
+    
+    /**
+     * Maximum total size of receive buffers retained for reassembly without
+     * copying (the capacity of each buffer counts).
+     * 
+     * When a new fragment would exceed this, the datagrams which would expire
+     * first are dropped. This bounds how many buffers of receive buffer pools
+     * can be kept by reassembly.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(MaxChainedReassBytes, std::size_t, 65536)
+    
+    /**
+     * Maximum number of datagrams from one source address being reassembled,
+     * including those without copying (0 for no limit).
+     * 
+     * When a new datagram arrives from a source which is at the limit, a datagram
+     * of the same source is dropped instead of reusing an entry of another
+     * source. This keeps a source sending incomplete fragments from occupying
+     * all entries. Finding the entries of a source takes time linear in the
+     * number of entries in use.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(MaxReassEntrysPerSource, int, 0)
+    
+    /**
+     * Maximum amount of fragment data from one source address held for
+     * reassembly (0 for no limit).
+     * 
+     * Fragments copied to reassembly buffers count with their length (including
+     * duplicates) and fragments kept in receive buffers with the buffer capacity.
+     * When a fragment would exceed this, other datagrams of the source are
+     * dropped, and if that is not enough, the datagram of the fragment.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(MaxReassBytesPerSource, std::size_t, 0)
+    
+    /**
+     * Data structure service for finding reassembly entries by datagram
+     * identity.
+     * 
+     * This should be one of the implementations in the folder
+     * aipstack/structure/index. Specifically supported are @ref AvlTreeIndexService,
+     * @ref MruListIndexService and @ref HashTableIndexService. For a hash table,
+     * the number of buckets should be about the number of entries.
+     */
+    AIPSTACK_OPTION_DECL_TYPE(ReassIndexService, HashTableIndexService<16>)
 };
 
 /**
@@ -524,12 +1264,19 @@ class IpReassemblyService {
     AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxReassSize)
     AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxReassHoles)
     AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxReassTimeSeconds)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxChainedReassEntrys)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxChainedReassFrags)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxChainedReassBytes)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxReassEntrysPerSource)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpReassemblyOptions, MaxReassBytesPerSource)
+    AIPSTACK_OPTION_CONFIG_TYPE(IpReassemblyOptions, ReassIndexService)
     
 public:
 #ifndef IN_DOXYGEN
-    template<typename PlatformImpl_>
+    template<typename PlatformImpl_, bool EnableStats_ = false>
     struct Compose {
         using PlatformImpl = PlatformImpl_;
+        inline static constexpr bool EnableStats = EnableStats_;
         using Params = IpReassemblyService;
         AIPSTACK_DEF_INSTANCE(Compose, IpReassembly)        
     };
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_ROUTE_H
+#define AIPSTACK_IP_ROUTE_H
+
+#include <cstdint>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/ip/IpStackInternalDefs.h>
+
+namespace AIpStack {
+
+#ifndef IN_DOXYGEN
+template<typename> class IpStack;
+template<typename> class IpIface;
+#endif
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Parameters of a static IPv4 route, see @ref IpRoute::setRoute.
+ */
+struct IpRouteIp4Params {
+    /**
+     * Destination network address (host bits are ignored).
+     */
+    Ip4Addr dst_addr = Ip4Addr::ZeroAddr();
+    
+    /**
+     * Prefix length of the destination network (0 for a default route).
+     */
+    std::uint8_t prefix = 0;
+    
+    /**
+     * Gateway (next hop) address. If not present, destinations are
+     * considered to be directly reachable through the interface.
+     */
+    IpIfaceIp4GatewaySetting gateway;
+    
+    /**
+     * Metric of the route. Among routes with the longest matching prefix, the
+     * route with the lowest metric is used.
+     */
+    std::uint16_t metric = 0;
+};
+
+#ifndef IN_DOXYGEN
+
+// Entry in the routing table of the IP stack. These are embedded in IpRoute
+// objects and also in IpIface for the implicit routes of interfaces.
+template<typename Arg>
+struct IpRouteEntry {
+    using InternalDefs = IpStackInternalDefs<Arg>;
+    
+    typename InternalDefs::RouteIndex::Node index_node;
+    IpIface<Arg> *iface;
+    Ip4Addr net_addr;
+    Ip4Addr gateway;
+    std::uint16_t metric;
+    std::uint8_t prefix;
+    bool have_gateway;
+    bool installed = false;
+};
+
+template<typename Arg>
+struct IpStackInternalDefs<Arg>::RouteIndexAccessor : public MemberAccessor<
+    IpRouteEntry<Arg>, typename IpStackInternalDefs<Arg>::RouteIndex::Node,
+    &IpRouteEntry<Arg>::index_node> {};
+
+template<typename Arg>
+struct IpStackInternalDefs<Arg>::RouteIndexKeyFuncs : public IpRouteKeyCompare {
+    inline static IpRouteKey GetKeyOfEntry (IpRouteEntry<Arg> const &entry)
+    {
+        return IpRouteKey{entry.net_addr, entry.prefix};
+    }
+};
+
+#endif
+
+/**
+ * A static route in the routing table of the IP stack.
+ * 
+ * Routes are used by @ref IpStack::routeIp4 and @ref IpStack::routeIp4ForceIface
+ * in addition to the implicit routes of interfaces, which are a route to the
+ * subnet of the interface address and a default route via the gateway of the
+ * interface (see @ref IpIface::setIp4Addr and @ref IpIface::setIp4Gateway),
+ * both with metric zero.
+ * 
+ * The route must be removed (using @ref reset or by destructing the object)
+ * before the interface of the route is removed.
+ * 
+ * @tparam Arg Template parameter of @ref IpStack.
+ */
+template<typename Arg>
+class IpRoute :
+    private NonCopyable<IpRoute<Arg>>
+{
+    template<typename> friend class IpStack;
+    
+public:
+    /**
+     * Construct the route object, initially not in the routing table.
+     */
+    inline IpRoute () = default;
+    
+    /**
+     * Destruct the route object, removing the route if it is in the routing
+     * table.
+     */
+    inline ~IpRoute ()
+    {
+        reset();
+    }
+    
+    /**
+     * Add the route to the routing table, or change it if already added.
+     * 
+     * @param iface Interface to send through (must not be null).
+     * @param params Parameters of the route. The prefix must not be greater
+     *        than @ref Ip4Addr::Bits.
+     */
+    void setRoute (IpIface<Arg> *iface, IpRouteIp4Params const &params)
+    {
+        AIPSTACK_ASSERT(iface != nullptr);
+        AIPSTACK_ASSERT(params.prefix <= Ip4Addr::Bits);
+        
+        reset();
+        
+        m_entry.iface = iface;
+        m_entry.net_addr = params.dst_addr & Ip4Addr::PrefixMask(params.prefix);
+        m_entry.prefix = params.prefix;
+        m_entry.have_gateway = params.gateway.present;
+        m_entry.gateway = params.gateway.addr;
+        m_entry.metric = params.metric;
+        
+        iface->m_stack->add_route(m_entry);
+    }
+    
+    /**
+     * Remove the route from the routing table, if it is there.
+     */
+    void reset ()
+    {
+        if (m_entry.installed) {
+            m_entry.iface->m_stack->remove_route(m_entry);
+        }
+    }
+    
+    /**
+     * Return whether the route is in the routing table.
+     * 
+     * @return Whether the route is in the routing table.
+     */
+    inline bool isInstalled () const
+    {
+        return m_entry.installed;
+    }
+    
+private:
+    IpRouteEntry<Arg> m_entry;
+};
+
+/** @} */
+
+}
+
+#endif
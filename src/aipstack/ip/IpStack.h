@@ -27,11 +27,14 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include <aipstack/meta/ListForEach.h>
 #include <aipstack/meta/TypeListUtils.h>
 #include <aipstack/meta/FuncUtils.h>
 #include <aipstack/meta/InstantiateVariadic.h>
+#include <aipstack/meta/TypeSequence.h>
+#include <aipstack/meta/TypeSequenceFromList.h>
 #include <aipstack/meta/BasicMetaUtils.h>
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/Use.h>
@@ -40,6 +43,7 @@
 #include <aipstack/misc/EnumBitfieldUtils.h>
 #include <aipstack/misc/NonCopyable.h>
 #include <aipstack/misc/ResourceTuple.h>
+#include <aipstack/misc/Function.h>
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/structure/StructureRaiiWrapper.h>
 #include <aipstack/structure/Accessor.h>
@@ -54,13 +58,20 @@
 #include <aipstack/infra/Instance.h>
 #include <aipstack/proto/Ip4Proto.h>
 #include <aipstack/proto/Icmp4Proto.h>
+#include <aipstack/proto/Tcp4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/ip/IpStackStats.h>
+#include <aipstack/ip/IpDropTrace.h>
+#include <aipstack/ip/IpLatencyTrace.h>
 #include <aipstack/ip/IpIface.h>
 #include <aipstack/ip/IpIfaceListener.h>
 #include <aipstack/ip/IpIfaceStateObserver.h>
+#include <aipstack/ip/IpRoute.h>
 #include <aipstack/ip/IpDriverIface.h>
 #include <aipstack/ip/IpMtuRef.h>
+#include <aipstack/ip/IpIcmpRateLimiter.h>
 #include <aipstack/ip/IpStackInternalDefs.h>
 #include <aipstack/platform/PlatformFacade.h>
 
@@ -132,10 +143,23 @@ class IpStack :
     template<typename> friend class IpIfaceListener;
     template<typename> friend class IpDriverIface;
     template<typename> friend class IpMtuRef;
+    template<typename> friend class IpRoute;
+    template<typename> friend class IpLoopbackIface;
     
     AIPSTACK_USE_TYPES(Arg, (Params, ProtocolServicesList))
-    AIPSTACK_USE_VALS(Params, (HeaderBeforeIp, IcmpTTL, AllowBroadcastPing))
+    AIPSTACK_USE_VALS(Params, (HeaderBeforeIp, IcmpTTL, AllowBroadcastPing,
+                               TxArenaSize, IcmpUseTxArena, GroMaxSegs,
+                               EnableForwarding, ForwardIcmpBurst,
+                               ForwardIcmpIntervalMs, IcmpEchoBurst,
+                               IcmpEchoIntervalMs, IcmpErrorBurst,
+                               IcmpErrorIntervalMs, IcmpRateLimitBuckets,
+                               IcmpRateLimitPrefixLen, NumRxFilterRules,
+                               NumIfaceExtraAddrs, EnableStats, EnableDropTrace,
+                               LatencyTraceInterval, SingleIface))
     AIPSTACK_USE_TYPES(Params, (PathMtuCacheService, ReassemblyService))
+    
+    static_assert(!IcmpUseTxArena || TxArenaSize > 0,
+                  "IcmpUseTxArena requires a nonzero TxArenaSize");
 
 public:
     /**
@@ -152,10 +176,36 @@ public:
 private:
     AIPSTACK_USE_TYPE(Platform, TimeType)
     
-    AIPSTACK_MAKE_INSTANCE(Reassembly, (ReassemblyService::template Compose<PlatformImpl>))
+    // Rate limiters for ICMP echo replies, Destination Unreachable messages
+    // and ICMP errors for forwarded packets.
+    using IcmpEchoRateLimiter = IpIcmpRateLimiter<PlatformImpl, IcmpEchoBurst,
+        IcmpEchoIntervalMs, IcmpRateLimitBuckets, IcmpRateLimitPrefixLen>;
+    using IcmpErrorRateLimiter = IpIcmpRateLimiter<PlatformImpl, IcmpErrorBurst,
+        IcmpErrorIntervalMs, IcmpRateLimitBuckets, IcmpRateLimitPrefixLen>;
+    using FwdIcmpRateLimiter = IpIcmpRateLimiter<PlatformImpl,
+        EnableForwarding ? ForwardIcmpBurst : 0, ForwardIcmpIntervalMs,
+        IcmpRateLimitBuckets, IcmpRateLimitPrefixLen>;
+    
+    // Receive filter rule prepared for matching (see setRxFilterRule).
+    struct RxFilterRule {
+        bool active = false;
+        bool match_ports;
+        std::uint8_t proto_mask;
+        std::uint8_t proto;
+        Ip4Addr src_mask;
+        Ip4Addr src_addr;
+        Ip4Addr dst_mask;
+        Ip4Addr dst_addr;
+        PortNum dst_port_min;
+        PortNum dst_port_max;
+        std::uint32_t hits;
+    };
+    
+    AIPSTACK_MAKE_INSTANCE(Reassembly, (
+        ReassemblyService::template Compose<PlatformImpl, EnableStats>))
     
     AIPSTACK_MAKE_INSTANCE(PathMtuCache, (
-        PathMtuCacheService::template Compose<PlatformImpl, Arg>))
+        PathMtuCacheService::template Compose<PlatformImpl, Arg, EnableStats>))
     
     // Instantiate the protocols.
     template<int ProtocolIndex>
@@ -176,12 +226,74 @@ private:
         {
             return &stack->m_protocols.template get<ProtocolIndex>();
         }
+        
+        // Entry points for the protocol dispatch tables.
+        static void recvIp4Dgram (IpStack *stack, IpRxInfoIp4<Arg> const &ip_info,
+                                  IpBufRef dgram)
+        {
+            get(stack)->recvIp4Dgram(ip_info, dgram);
+        }
+        
+        static void handleIp4DestUnreach (IpStack *stack, Ip4DestUnreachMeta const &du_meta,
+                                          IpRxInfoIp4<Arg> const &ip_info, IpBufRef dgram)
+        {
+            get(stack)->handleIp4DestUnreach(du_meta, ip_info, dgram);
+        }
     };
     using ProtocolHelpersList =
         IndexElemList<ProtocolServicesList, ProtocolHelper>;
     
     inline static constexpr int NumProtocols = TypeListLength<ProtocolHelpersList>;
     
+    static_assert(NumProtocols < 256);
+    
+    // Dispatch tables for protocol handlers. ProtoIndexTable maps each IP protocol
+    // number to the index of the protocol handler, or NumProtocols if there is none,
+    // and the function tables are indexed by that. This way a protocol handler is
+    // reached with one table lookup and one indirect call, for any number of
+    // protocol handlers. If there are multiple protocol handlers for the same
+    // protocol number, the first one is used.
+    template<typename HelpersSequence>
+    struct ProtocolDispatchHelper;
+    
+    template<typename ...Helpers>
+    struct ProtocolDispatchHelper<TypeSequence<Helpers...>> {
+        using RecvIp4DgramFunc = void (*) (
+            IpStack *, IpRxInfoIp4<Arg> const &, IpBufRef);
+        using HandleIp4DestUnreachFunc = void (*) (
+            IpStack *, Ip4DestUnreachMeta const &, IpRxInfoIp4<Arg> const &, IpBufRef);
+        
+        struct IndexTable {
+            std::uint8_t index[256];
+        };
+        
+        static constexpr IndexTable makeIndexTable ()
+        {
+            IndexTable table = {};
+            for (std::uint8_t &index : table.index) {
+                index = NumProtocols;
+            }
+            
+            // The extra element avoids an empty array with no protocols.
+            Ip4Protocol const protocols[] = {Helpers::IpProtocolNumber..., Ip4Protocol()};
+            for (int i = NumProtocols - 1; i >= 0; i--) {
+                table.index[std::uint8_t(protocols[i])] = std::uint8_t(i);
+            }
+            
+            return table;
+        }
+        
+        inline static constexpr IndexTable ProtoIndexTable = makeIndexTable();
+        
+        inline static constexpr RecvIp4DgramFunc RecvIp4DgramFuncs[] = {
+            &Helpers::recvIp4Dgram..., nullptr};
+        
+        inline static constexpr HandleIp4DestUnreachFunc HandleIp4DestUnreachFuncs[] = {
+            &Helpers::handleIp4DestUnreach..., nullptr};
+    };
+    using ProtocolDispatch =
+        ProtocolDispatchHelper<TypeSequenceFromList<ProtocolHelpersList>>;
+    
     // Create a list of the instantiated protocols, for the tuple.
     template<typename Helper>
     using ProtocolForHelper = typename Helper::Protocol;
@@ -229,7 +341,20 @@ private:
     using Iface = IpIface<Arg>;
     using IfaceListener = IpIfaceListener<Arg>;
     using IfaceLinkModel = typename InternalDefs::IfaceLinkModel;
+    using RouteEntry = IpRouteEntry<Arg>;
+    using RouteIndex = typename InternalDefs::RouteIndex;
     
+    // State of receive segment coalescing, see gro_input.
+    struct GroState {
+        bool batch_active;
+        bool flushing;
+        std::uint8_t num_segs;
+        std::size_t tot_len;
+        TcpSeqNum next_seq;
+        IpRxInfoIp4<Arg> ip_info;
+        IpBufNode nodes[GroMaxSegs > 0 ? GroMaxSegs : 1];
+    };
+
 public:
     /**
      * Number of bytes which must be available in outgoing datagrams for headers.
@@ -254,6 +379,15 @@ public:
      */
     inline static constexpr std::uint16_t MinMTU = 256;
     
+    /**
+     * Maximum MTU of an interface.
+     * 
+     * This is the largest IPv4 packet size. Interfaces with a larger MTU, such as
+     * loopback or virtual interfaces with a 64 KiB MTU, are treated as having
+     * this MTU (see @ref IpIfaceDriverParams::ip_mtu).
+     */
+    inline static constexpr std::uint16_t MaxMTU = TypeMax<std::uint16_t>;
+    
     /**
      * Construct the IP stack.
      * 
@@ -267,7 +401,17 @@ public:
     IpStack (PlatformFacade<PlatformImpl> platform) :
         m_reassembly(platform),
         m_path_mtu_cache(platform, this),
+        m_loopback_iface(nullptr),
+        m_num_routes_by_prefix{},
+        m_route_gen(1),
         m_next_id(0),
+        m_icmp_echo_limiter(platform.getTime()),
+        m_icmp_error_limiter(platform.getTime()),
+        m_fwd_icmp_limiter(platform.getTime()),
+        m_tx_arena(m_tx_arena_mem, TxArenaSize),
+        m_gro{},
+        m_tx_batch_depth(0),
+        m_num_rx_filter_rules(0),
         m_protocols(ResourceTupleInitSame(), IpProtocolHandlerArgs<Arg>{platform, this})
     {}
     
@@ -281,6 +425,7 @@ public:
     ~IpStack ()
     {
         AIPSTACK_ASSERT(m_iface_list.isEmpty());
+        AIPSTACK_ASSERT(m_route_index.isEmpty());
     }
     
     /**
@@ -328,6 +473,22 @@ public:
         constexpr int ProtocolIndex = TypeListIndex<ProtocolsList, Protocol>;
         return m_protocols.template get<ProtocolIndex>().getApi();
     }
+    
+    /**
+     * Return the transmit arena of the stack.
+     * 
+     * The arena has the size configured using @ref IpStackOptions::TxArenaSize and
+     * can be used with @ref TxArenaAllocHelper for temporary allocation of outgoing
+     * packets, as an alternative to @ref TxAllocHelper which would place the buffer
+     * on the stack. This is used internally by the ICMP and DHCP senders if so
+     * configured, and may also be used by applications for allocating UDP packets.
+     * 
+     * @return Reference to the transmit arena.
+     */
+    inline TxArena & getTxArena ()
+    {
+        return m_tx_arena;
+    }
 
 public:
     /**
@@ -380,6 +541,8 @@ public:
         // Copy the flags into a variable as we may modify them below.
         IpSendFlags send_flags = common.send_flags;
 
+        m_stats.inc(&IpStackStats::out_requests);
+        
         // Reveal IP header.
         IpBufRef pkt = dgram.revealHeader(Ip4Header::Size);
         
@@ -392,6 +555,7 @@ public:
             route_ok = routeIp4(common.addrs.remote_addr, route_info);
         }
         if (AIPSTACK_UNLIKELY(!route_ok)) {
+            m_stats.inc(&IpStackStats::out_no_routes);
             return IpErr::NoIpRoute;
         }
         
@@ -407,6 +571,7 @@ public:
         if (AIPSTACK_UNLIKELY(pkt.tot_len > route_info.iface->getMtu())) {
             // Reject fragmentation?
             if (AIPSTACK_UNLIKELY((send_flags & IpSendFlags::DontFragmentFlag) != Enum0)) {
+                m_stats.inc(&IpStackStats::frag_fails);
                 return IpErr::FragmentationNeeded;
             }
             
@@ -420,11 +585,17 @@ public:
             pkt_send_len = std::uint16_t(pkt.tot_len);
         }
         
-        // Write IP header fields and calculate header checksum inline...
-        auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
+        // If the transport checksum was left partial, complete it in software
+        // unless the interface will do it.
+        if ((send_flags & IpSendFlags::ChksumPartialFlag) != Enum0) {
+            complete_chksum_partial(dgram, common.proto, send_flags, route_info.iface);
+        }
+        
+        // Prepare IP header fields and calculate header checksum inline...
+        Ip4Header::Native ip4_header;
         IpChksumAccumulator chksum;
         
-        std::uint16_t version_ihl_dscp_ecn = std::uint16_t((4 << Ip4VersionShift) | 5) << 8;
+        std::uint16_t version_ihl_dscp_ecn = ip4_version_ihl_dscp_ecn(send_flags);
         chksum.addWord(WrapType<std::uint16_t>(), version_ihl_dscp_ecn);
         ip4_header.set(Ip4Header::VersionIhlDscpEcn(), version_ihl_dscp_ecn);
         
@@ -449,14 +620,15 @@ public:
         chksum.addWord(WrapType<std::uint32_t>(), common.addrs.remote_addr.value());
         ip4_header.set(Ip4Header::DstAddr(), common.addrs.remote_addr);
         
-        // Set the IP header checksum.
+        // Set the IP header checksum and write the header.
         ip4_header.set(Ip4Header::HeaderChksum(), chksum.getChksum());
+        Ip4Header::Encode(pkt.getChunkPtr(), ip4_header);
         
         // Send the packet to the driver.
         // Fast path is no fragmentation, this permits tail call optimization.
         if (AIPSTACK_LIKELY((send_flags & IpFlagsToSendFlags(Ip4Flags::MF)) == Enum0)) {
-            return route_info.iface->m_params.send_ip4_packet(
-                pkt, route_info.addr, retryReq);
+            return driver_send_ip4_packet(
+                route_info.iface, pkt, route_info.addr, retryReq);
         }
         
         // Slow path...
@@ -464,16 +636,66 @@ public:
     }
     
 private:
+    static void complete_chksum_partial (IpBufRef dgram, Ip4Protocol proto,
+                                         IpSendFlags send_flags, Iface *iface)
+    {
+        AIPSTACK_ASSERT(proto == Ip4Protocol::Tcp || proto == Ip4Protocol::Udp);
+        
+        bool is_udp = proto == Ip4Protocol::Udp;
+        IpChksumOffloadFlags offload_flag =
+            is_udp ? IpChksumOffloadFlags::Udp4 : IpChksumOffloadFlags::Tcp4;
+        
+        // The interface completes the checksum only for unfragmented packets.
+        if ((send_flags & IpFlagsToSendFlags(Ip4Flags::MF)) == Enum0 &&
+            (iface->getTxChksumOffload() & offload_flag) != Enum0)
+        {
+            return;
+        }
+        
+        std::size_t chksum_offset = is_udp ?
+            Udp4Header::getOffset(Udp4Header::Checksum()) :
+            Tcp4Header::getOffset(Tcp4Header::Checksum());
+        AIPSTACK_ASSERT(dgram.getChunkLength() >= chksum_offset + 2);
+        
+        // The checksum field contains the pseudo-header sum so the checksum over
+        // the entire datagram is the final checksum. For UDP, zero means that
+        // there is no checksum, so send all-ones instead.
+        std::uint16_t chksum = IpChksum(dgram);
+        if (is_udp && chksum == 0) {
+            chksum = TypeMax<std::uint16_t>;
+        }
+        WriteSingleField<std::uint16_t>(dgram.getChunkPtr() + chksum_offset, chksum);
+    }
+    
     IpErr send_fragmented (IpBufRef pkt, IpRouteInfoIp4<Arg> route_info,
                            IpSendFlags send_flags, IpSendRetryRequest *retryReq)
+    {
+        // Send the fragments within a transmit batch, so that a driver which
+        // holds back packets transmits all of them together.
+        beginTxBatch();
+        IpErr err = send_fragments(pkt, route_info, send_flags, retryReq);
+        endTxBatch();
+        
+        if (err == IpErr::Success) {
+            m_stats.inc(&IpStackStats::frag_oks);
+        }
+        return err;
+    }
+    
+    // Each fragment references the header in the original packet (updated in
+    // place, with the checksum adjusted incrementally) followed by a part of
+    // the original data, so the data is not copied.
+    IpErr send_fragments (IpBufRef pkt, IpRouteInfoIp4<Arg> route_info,
+                          IpSendFlags send_flags, IpSendRetryRequest *retryReq)
     {
         // Recalculate pkt_send_len (not passed for optimization).
         std::uint16_t pkt_send_len =
             Ip4RoundFragLen(Ip4Header::Size, route_info.iface->getMtu());
         
         // Send the first fragment.
-        IpErr err = route_info.iface->m_params.send_ip4_packet(
-            pkt.subTo(pkt_send_len), route_info.addr, retryReq);
+        m_stats.inc(&IpStackStats::frag_creates);
+        IpErr err = driver_send_ip4_packet(
+            route_info.iface, pkt.subTo(pkt_send_len), route_info.addr, retryReq);
         if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
             return err;
         }
@@ -503,16 +725,21 @@ private:
             auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
             
             // Write the fragment-specific IP header fields.
+            std::uint16_t old_total_len = ip4_header.get(Ip4Header::TotalLen());
             ip4_header.set(Ip4Header::TotalLen(), pkt_send_len);
+            Ip4Flags old_flags_offset = ip4_header.get(Ip4Header::FlagsOffset());
             Ip4Flags flags_offset =
                 IpFlagsInSendFlags(send_flags) | Ip4Flags(fragment_offset / 8);
             ip4_header.set(Ip4Header::FlagsOffset(), flags_offset);
-            ip4_header.set(Ip4Header::HeaderChksum(), 0);
             
-            // Calculate the IP header checksum.
-            // Not inline since fragmentation is uncommon, better save program space.
-            std::uint16_t calc_chksum = IpChksum(ip4_header.data, Ip4Header::Size);
-            ip4_header.set(Ip4Header::HeaderChksum(), calc_chksum);
+            // Update the IP header checksum for the changed fields, the header
+            // still has the correct checksum from the previous fragment.
+            std::uint16_t chksum = ip4_header.get(Ip4Header::HeaderChksum());
+            chksum = IpChksumUpdate(chksum, WrapType<std::uint16_t>(),
+                                    old_total_len, pkt_send_len);
+            chksum = IpChksumUpdate(chksum, WrapType<std::uint16_t>(),
+                AsUnderlying(old_flags_offset), AsUnderlying(flags_offset));
+            ip4_header.set(Ip4Header::HeaderChksum(), chksum);
             
             // Construct a packet with header and partial data.
             IpBufNode data_node = ipBufRefToNode(dgram);
@@ -521,8 +748,9 @@ private:
                 Ip4Header::Size, &data_node, pkt_send_len, &header_node);
             
             // Send the packet to the driver.
-            err = route_info.iface->m_params.send_ip4_packet(
-                frag_pkt, route_info.addr, retryReq);
+            m_stats.inc(&IpStackStats::frag_creates);
+            err = driver_send_ip4_packet(
+                route_info.iface, frag_pkt, route_info.addr, retryReq);
             
             // If this was the last fragment or there was an error, return.
             if ((send_flags & IpFlagsToSendFlags(Ip4Flags::MF)) == Enum0 ||
@@ -553,22 +781,51 @@ public:
      * Sending to a broadcast address or from a non-local address is only permitted with
      * specific flags in `common.send_flags`; see @ref sendIp4Dgram for details.
      * 
+     * If a route cache is given, the routing information stored in it is used
+     * when it is still valid for the destination address, that is when no route
+     * has been added or removed since it was stored. Otherwise the route is looked
+     * up and stored into the cache. The neighbor cache within the route cache is
+     * then passed to the interface driver when sending the prepared datagrams.
+     * 
      * @param header_end_ptr Pointer to the end of the IPv4 header (and start of data).
      *                       This must be the same location as for subsequent datagrams.
      * @param prep Internal information is stored into this structure.
      * @param common Specifies addresses, the TTL, the protocol number and send flags.
      *        In `common.send_flags`, all flags declared in @ref IpSendFlags are allowed.
+     * @param cache Route cache of the flow, or null. If not null, it must remain
+     *        valid for as long as prep is used.
      * @return Success or error code.
      */
     AIPSTACK_ALWAYS_INLINE
     IpErr prepareSendIp4Dgram (
-        char *header_end_ptr, IpSendPreparedIp4<Arg> &prep, Ip4CommonSendParams common)
+        char *header_end_ptr, IpSendPreparedIp4<Arg> &prep, Ip4CommonSendParams common,
+        IpRouteCacheIp4<Arg> *cache = nullptr)
     {
         AIPSTACK_ASSERT((common.send_flags & ~IpSendFlags::AllFlags) == Enum0);
         
-        // Get routing information (fill in route_info).
-        if (AIPSTACK_UNLIKELY(!routeIp4(common.addrs.remote_addr, prep.route_info))) {
-            return IpErr::NoIpRoute;
+        // Get routing information (fill in route_info), from the cache if possible.
+        if (cache == nullptr) {
+            if (AIPSTACK_UNLIKELY(!routeIp4(common.addrs.remote_addr, prep.route_info))) {
+                m_stats.inc(&IpStackStats::out_no_routes);
+                return IpErr::NoIpRoute;
+            }
+            prep.neigh_cache = nullptr;
+        } else {
+            if (AIPSTACK_UNLIKELY(cache->route_gen != m_route_gen ||
+                                  cache->dst_addr != common.addrs.remote_addr))
+            {
+                cache->route_gen = 0;
+                if (AIPSTACK_UNLIKELY(
+                        !routeIp4(common.addrs.remote_addr, cache->route_info))) {
+                    m_stats.inc(&IpStackStats::out_no_routes);
+                    return IpErr::NoIpRoute;
+                }
+                cache->dst_addr = common.addrs.remote_addr;
+                cache->route_gen = m_route_gen;
+                cache->neigh = IpNeighborCache{};
+            }
+            prep.route_info = cache->route_info;
+            prep.neigh_cache = &cache->neigh;
         }
         
         // Check if sending is allowed.
@@ -582,7 +839,7 @@ public:
         auto ip4_header = Ip4Header::MakeRef(header_end_ptr - Ip4Header::Size);
         IpChksumAccumulator chksum;
         
-        std::uint16_t version_ihl_dscp_ecn = std::uint16_t((4 << Ip4VersionShift) | 5) << 8;
+        std::uint16_t version_ihl_dscp_ecn = ip4_version_ihl_dscp_ecn(common.send_flags);
         chksum.addWord(WrapType<std::uint16_t>(), version_ihl_dscp_ecn);
         ip4_header.set(Ip4Header::VersionIhlDscpEcn(), version_ihl_dscp_ecn);
         
@@ -606,6 +863,23 @@ public:
         return IpErr::Success;
     }
     
+    /**
+     * Check whether the routing information in a route cache is current.
+     * 
+     * This returns false when a route has been added or removed since the
+     * information was stored by @ref prepareSendIp4Dgram. As long as it returns
+     * true, an @ref IpSendPreparedIp4 prepared with this cache remains usable,
+     * including when its IP header is copied to other buffers before calling
+     * @ref sendIp4DgramFast.
+     * 
+     * @param cache Route cache to check.
+     * @return Whether the cached routing information is current.
+     */
+    inline bool ip4RouteCacheIsCurrent (IpRouteCacheIp4<Arg> const &cache) const
+    {
+        return cache.route_gen == m_route_gen;
+    }
+    
     /**
      * Send a datagram after preparation with @ref prepareSendIp4Dgram.
      * 
@@ -640,9 +914,235 @@ public:
         
         // This function does not support fragmentation.
         if (AIPSTACK_UNLIKELY(pkt.tot_len > prep.route_info.iface->getMtu())) {
+            m_stats.inc(&IpStackStats::frag_fails);
+            return IpErr::FragmentationNeeded;
+        }
+        
+        return send_prepared_ip4_pkt(prep, pkt, retryReq);
+    }
+    
+    /**
+     * Send a TCP super-segment after preparation with @ref prepareSendIp4Dgram.
+     * 
+     * This is like @ref sendIp4DgramFast but the datagram is a TCP segment
+     * which may carry more data than fits into the MTU, to be split into
+     * segments with at most `mss` bytes of data each. If the interface supports
+     * TCP segmentation offload (@ref IpIface::getTsoMaxSize) and the packet is
+     * not too large for that, it is passed to the driver as a single packet
+     * (see @ref IpTxTsoInfo). Otherwise the segmentation is done here just
+     * before passing packets to the driver, reusing the prepared IP header and
+     * the TCP header of the super-segment for all segments.
+     * 
+     * The TCP header together with any options must be contained in the first
+     * buffer node, with no data in that node. Its checksum field must contain the
+     * non-inverted one's complement sum of the pseudo-header without the TCP
+     * length (see @ref IpTxTsoInfo). The FIN and PSH flags, if set, are only
+     * sent in the last segment.
+     * 
+     * When segmenting in software, if sending a segment fails then no further
+     * segments are sent and the error is returned, in which case some leading
+     * segments may have been sent.
+     * 
+     * @param prep Structure with internal information that was filled in
+     *             using @ref prepareSendIp4Dgram.
+     * @param dgram The TCP segment to send, see @ref sendIp4DgramFast for the
+     *              requirements. The tot_len of the datagram must not exceed
+     *              2^16-1 minus the IPv4 header size.
+     * @param mss Maximum number of data bytes for each segment. Must be
+     *            positive.
+     * @param retryReq If not null, this may provide notification when to retry sending
+     *                 after an unsuccessful attempt (notification is not guaranteed).
+     * @return Success or error code.
+     */
+    IpErr sendIp4DgramFastSeg (IpSendPreparedIp4<Arg> const &prep, IpBufRef dgram,
+                               std::uint16_t mss, IpSendRetryRequest *retryReq)
+    {
+        AIPSTACK_ASSERT(dgram.tot_len <= TypeMax<std::uint16_t> - Ip4Header::Size);
+        AIPSTACK_ASSERT(dgram.offset >= Ip4Header::Size);
+        AIPSTACK_ASSERT(mss > 0);
+        AIPSTACK_ASSERT(dgram.getChunkLength() >= Tcp4Header::Size);
+        
+        Iface *iface = prep.route_info.iface;
+        
+        // Pass the super-segment to the driver if it can do the segmentation.
+        IpBufRef pkt = dgram.revealHeader(Ip4Header::Size);
+        if (pkt.tot_len <= iface->getTsoMaxSize()) {
+            iface->m_tx_tso_mss = mss;
+            IpErr err = send_prepared_ip4_pkt(prep, pkt, retryReq);
+            iface->m_tx_tso_mss = 0;
+            return err;
+        }
+        
+        // Get information from the TCP header.
+        auto tcp_header = Tcp4Header::MakeRef(dgram.getChunkPtr());
+        Tcp4Flags offset_flags = tcp_header.get(Tcp4Header::OffsetFlags());
+        TcpSeqNum seq_num = tcp_header.get(Tcp4Header::SeqNum());
+        std::uint16_t pseudo_sum = tcp_header.get(Tcp4Header::Checksum());
+        std::size_t tcp_header_len =
+            std::size_t(AsUnderlying(offset_flags) >> TcpOffsetShift) * 4;
+        AIPSTACK_ASSERT(dgram.getChunkLength() == tcp_header_len);
+        
+        bool chksum_offload =
+            (iface->getTxChksumOffload() & IpChksumOffloadFlags::Tcp4) != Enum0;
+        
+        IpBufRef data = ipBufSkipBytes(dgram, tcp_header_len);
+        
+        while (true) {
+            std::size_t seg_data_len = MinValueU(data.tot_len, mss);
+            bool last = seg_data_len == data.tot_len;
+            IpBufRef seg_data = data.subTo(seg_data_len);
+            
+            // Adjust the TCP header for this segment.
+            Tcp4Flags seg_offset_flags = last ? offset_flags :
+                (offset_flags & ~(Tcp4Flags::Fin|Tcp4Flags::Psh));
+            tcp_header.set(Tcp4Header::SeqNum(), seq_num);
+            tcp_header.set(Tcp4Header::OffsetFlags(), seg_offset_flags);
+            
+            // Calculate the checksum, starting with the pseudo-header.
+            std::uint16_t tcp_len = std::uint16_t(tcp_header_len + seg_data_len);
+            IpChksumAccumulator chksum{IpChksumAccumulator::State(pseudo_sum)};
+            chksum.addWord(WrapType<std::uint16_t>(), tcp_len);
+            if (chksum_offload) {
+                tcp_header.set(Tcp4Header::Checksum(), chksum.getChksumInverted());
+            } else {
+                tcp_header.set(Tcp4Header::Checksum(), 0);
+                chksum.addEvenBytes(dgram.getChunkPtr(), tcp_header_len);
+                tcp_header.set(Tcp4Header::Checksum(), chksum.getChksum(seg_data));
+            }
+            
+            // Link the TCP header to the data of this segment.
+            IpBufNode data_node = ipBufRefToNode(seg_data);
+            IpBufNode header_node = {
+                dgram.node->ptr, dgram.offset + tcp_header_len, &data_node};
+            IpBufRef seg_dgram = {&header_node, dgram.offset, tcp_len};
+            
+            // Send the segment.
+            IpErr err = sendIp4DgramFast(prep, seg_dgram, retryReq);
+            if (last || AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+                return err;
+            }
+            
+            seq_num += TcpSeqInt(seg_data_len);
+            data = ipBufSkipBytes(data, seg_data_len);
+        }
+    }
+    
+    /**
+     * Send a UDP super-datagram after preparation with @ref prepareSendIp4Dgram.
+     * 
+     * This is the UDP equivalent of @ref sendIp4DgramFastSeg. The data following
+     * the UDP header is split into datagrams with `seg_size` bytes of data each,
+     * except that the last one may be shorter. If the interface supports UDP
+     * segmentation offload (@ref IpIface::getUsoMaxSize) and the packet is not
+     * too large for that, it is passed to the driver as a single packet (see
+     * @ref IpTxTsoInfo). Otherwise the segmentation is done here, reusing the
+     * prepared IP header and the UDP header for all datagrams.
+     * 
+     * The UDP header must be contained in the first buffer node, and its
+     * checksum field must contain the non-inverted one's complement sum of the
+     * pseudo-header without the UDP length. The UDP length field is set here.
+     * Each datagram including the IP header must fit into the MTU of the
+     * interface, otherwise nothing is sent and @ref IpErr::FragmentationNeeded
+     * is returned.
+     * 
+     * When segmenting in software, if sending a datagram fails then no further
+     * datagrams are sent and the error is returned.
+     * 
+     * @param prep Structure with internal information that was filled in
+     *             using @ref prepareSendIp4Dgram.
+     * @param dgram The UDP super-datagram to send, see @ref sendIp4DgramFast for
+     *              the requirements. The tot_len of the datagram must not exceed
+     *              2^16-1 minus the IPv4 header size.
+     * @param seg_size Number of data bytes in each datagram. Must be positive.
+     * @param retryReq If not null, this may provide notification when to retry sending
+     *                 after an unsuccessful attempt (notification is not guaranteed).
+     * @return Success or error code.
+     */
+    IpErr sendIp4DgramFastUdpSeg (IpSendPreparedIp4<Arg> const &prep, IpBufRef dgram,
+                                  std::uint16_t seg_size, IpSendRetryRequest *retryReq)
+    {
+        AIPSTACK_ASSERT(dgram.tot_len <= TypeMax<std::uint16_t> - Ip4Header::Size);
+        AIPSTACK_ASSERT(dgram.tot_len >= Udp4Header::Size);
+        AIPSTACK_ASSERT(dgram.offset >= Ip4Header::Size);
+        AIPSTACK_ASSERT(seg_size > 0);
+        AIPSTACK_ASSERT(dgram.getChunkLength() >= Udp4Header::Size);
+        
+        Iface *iface = prep.route_info.iface;
+        
+        std::size_t data_len = dgram.tot_len - Udp4Header::Size;
+        std::size_t max_data_len = MinValueU(data_len, seg_size);
+        if (AIPSTACK_UNLIKELY(Ip4Header::Size + Udp4Header::Size + max_data_len >
+                              iface->getMtu()))
+        {
+            m_stats.inc(&IpStackStats::frag_fails);
             return IpErr::FragmentationNeeded;
         }
         
+        auto udp_header = Udp4Header::MakeRef(dgram.getChunkPtr());
+        std::uint16_t pseudo_sum = udp_header.get(Udp4Header::Checksum());
+        
+        // Pass the super-datagram to the driver if it can do the segmentation.
+        IpBufRef pkt = dgram.revealHeader(Ip4Header::Size);
+        if (data_len > seg_size && pkt.tot_len <= iface->getUsoMaxSize()) {
+            udp_header.set(Udp4Header::Length(),
+                           std::uint16_t(Udp4Header::Size + seg_size));
+            iface->m_tx_tso_mss = seg_size;
+            IpErr err = send_prepared_ip4_pkt(prep, pkt, retryReq);
+            iface->m_tx_tso_mss = 0;
+            return err;
+        }
+        
+        bool chksum_offload =
+            (iface->getTxChksumOffload() & IpChksumOffloadFlags::Udp4) != Enum0;
+        
+        IpBufRef data = ipBufSkipBytes(dgram, Udp4Header::Size);
+        
+        while (true) {
+            std::size_t seg_data_len = MinValueU(data.tot_len, seg_size);
+            bool last = seg_data_len == data.tot_len;
+            IpBufRef seg_data = data.subTo(seg_data_len);
+            
+            // Set the UDP length and calculate the checksum.
+            std::uint16_t udp_len = std::uint16_t(Udp4Header::Size + seg_data_len);
+            udp_header.set(Udp4Header::Length(), udp_len);
+            IpChksumAccumulator chksum{IpChksumAccumulator::State(pseudo_sum)};
+            chksum.addWord(WrapType<std::uint16_t>(), udp_len);
+            if (chksum_offload) {
+                udp_header.set(Udp4Header::Checksum(), chksum.getChksumInverted());
+            } else {
+                udp_header.set(Udp4Header::Checksum(), 0);
+                chksum.addEvenBytes(dgram.getChunkPtr(), Udp4Header::Size);
+                std::uint16_t checksum = chksum.getChksum(seg_data);
+                if (checksum == 0) {
+                    checksum = TypeMax<std::uint16_t>;
+                }
+                udp_header.set(Udp4Header::Checksum(), checksum);
+            }
+            
+            // Link the UDP header to the data of this datagram.
+            IpBufNode data_node = ipBufRefToNode(seg_data);
+            IpBufNode header_node = {
+                dgram.node->ptr, dgram.offset + Udp4Header::Size, &data_node};
+            IpBufRef seg_dgram = {&header_node, dgram.offset, udp_len};
+            
+            // Send the datagram.
+            IpErr err = send_prepared_ip4_pkt(
+                prep, seg_dgram.revealHeader(Ip4Header::Size), retryReq);
+            if (last || AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+                return err;
+            }
+            
+            data = ipBufSkipBytes(data, seg_data_len);
+        }
+    }
+
+private:
+    AIPSTACK_ALWAYS_INLINE
+    IpErr send_prepared_ip4_pkt (IpSendPreparedIp4<Arg> const &prep, IpBufRef pkt,
+                                 IpSendRetryRequest *retryReq)
+    {
+        m_stats.inc(&IpStackStats::out_requests);
+        
         // Write remaining IP header fields and continue calculating header checksum...
         auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
         IpChksumAccumulator chksum(prep.partial_chksum_state);
@@ -657,12 +1157,25 @@ public:
         // Set the IP header checksum.
         ip4_header.set(Ip4Header::HeaderChksum(), chksum.getChksum());
         
-        // Send the packet to the driver.
-        return prep.route_info.iface->m_params.send_ip4_packet(
-            pkt, prep.route_info.addr, retryReq);
+        // Send the packet to the driver, making the neighbor cache available
+        // to it for the duration of the call.
+        Iface *iface = prep.route_info.iface;
+        iface->m_tx_neigh_cache = prep.neigh_cache;
+        IpErr err = driver_send_ip4_packet(iface, pkt, prep.route_info.addr, retryReq);
+        iface->m_tx_neigh_cache = nullptr;
+        return err;
+    }
+
+    // Get the first 16-bit word of the IP header for sending (no options).
+    inline static std::uint16_t ip4_version_ihl_dscp_ecn (IpSendFlags send_flags)
+    {
+        std::uint8_t ecn = ((send_flags & IpSendFlags::EcnCapableFlag) != Enum0) ?
+            Ip4EcnEct0 : Ip4EcnNotEct;
+        std::uint8_t tos = std::uint8_t(
+            (IpDscpInSendFlags(send_flags) << Ip4DscpShift) | ecn);
+        return std::uint16_t(std::uint16_t((4 << Ip4VersionShift) | 5) << 8 | tos);
     }
 
-private:
     inline static IpErr checkSendIp4Allowed (
         Ip4AddrPair const &addrs, IpSendFlags send_flags, Iface *iface)
     {
@@ -679,9 +1192,7 @@ private:
         }
 
         if (AIPSTACK_LIKELY((send_flags & IpSendFlags::AllowNonLocalSrc) == Enum0)) {
-            if (AIPSTACK_UNLIKELY(!iface->m_have_addr ||
-                                  addrs.local_addr != iface->m_addr.addr))
-            {
+            if (AIPSTACK_UNLIKELY(!iface->ip4AddrIsLocalAddr(addrs.local_addr))) {
                 return IpErr::NonLocalSrc;
             }
         }
@@ -694,16 +1205,22 @@ public:
      * Determine routing for the given destination address.
      * 
      * Determines the interface and next hop address for sending a packet to
-     * the given address. The logic is:
-     * - If there is any interface with an address configured for which the
-     *   destination address belongs to the subnet of the interface, the
-     *   resulting interface is the most recently added interface out of
-     *   such interfaces with the longest prefix length, and the resulting
-     *   hop address is the destination address.
-     * - Otherwise, if any interface has a gateway configured, the resulting
-     *   interface is the most recently added such interface, and the
-     *   resulting hop address is the gateway address of that interface.
-     * - Otherwise, the function fails (returns false).
+     * the given address using the routing table. The routing table consists
+     * of the implicit routes of interfaces (a route to the subnet of the
+     * interface address and a default route via the interface gateway, both
+     * with metric zero) and any static routes (see @ref IpRoute). The logic is:
+     * - Out of the routes whose destination network contains the destination
+     *   address, the one with the longest prefix length is used, and if there
+     *   are multiple such routes, the one with the lowest metric (out of
+     *   routes with equal metrics, it is unspecified which is used).
+     * - The resulting interface is the interface of the route, and the
+     *   resulting hop address is the gateway address of the route if it has
+     *   one and the destination is not a multicast address, otherwise the
+     *   destination address.
+     * - If no route matches, the function fails (returns false).
+     * 
+     * The cost of the lookup is one index lookup for each distinct prefix
+     * length in the routing table, not dependent on the number of interfaces.
      * 
      * @param dst_addr Destination address to determine routing for.
      * @param route_info Routing information will be written here.
@@ -712,30 +1229,21 @@ public:
      */
     bool routeIp4 (Ip4Addr dst_addr, IpRouteInfoIp4<Arg> &route_info) const
     {
-        int best_prefix = -1;
-        Iface *best_iface = nullptr;
-        
-        for (Iface *iface = m_iface_list.first(); iface != nullptr;
-             iface = m_iface_list.next(*iface))
-        {
-            if (iface->ip4AddrIsLocal(dst_addr)) {
-                int iface_prefix = iface->m_addr.prefix;
-                if (iface_prefix > best_prefix) {
-                    best_prefix = iface_prefix;
-                    best_iface = iface;
-                }
-            }
-            else if (iface->m_have_gateway && best_iface == nullptr) {
-                best_iface = iface;
+        if constexpr (SingleIface) {
+            Iface *iface = single_iface_implicit_routes();
+            if (AIPSTACK_LIKELY(iface != nullptr)) {
+                return route_single_iface(dst_addr, iface, route_info);
             }
         }
         
-        if (AIPSTACK_UNLIKELY(best_iface == nullptr)) {
+        RouteEntry *route = find_route(dst_addr, nullptr);
+        if (AIPSTACK_UNLIKELY(route == nullptr)) {
             return false;
         }
         
-        route_info.iface = best_iface;
-        route_info.addr = (best_prefix >= 0) ? dst_addr : best_iface->m_gateway;
+        route_info.iface = route->iface;
+        route_info.addr = (route->have_gateway && !dst_addr.isMulticast()) ?
+            route->gateway : dst_addr;
         
         return true;
     }
@@ -744,16 +1252,15 @@ public:
      * Determine routing for the given destination address through
      * the given interface.
      * 
-     * This is like @ref routeIp4 restricted to one interface with the exception
-     * that it also accepts the all-ones broadcast address. The logic is:
-     * - If the destination address is all-ones, or the interface has an address
-     *   configured and the destination address belongs to the subnet of the interface,
-     *   the resulting hop address is the destination address (and the resulting
-     *   interface is as given).
-     * - Otherwise, if the interface has a gateway configured, the resulting
-     *   hop address is the gateway address of the interface (and the resulting
-     *   interface is as given).
-     * - Otherwise, the function fails (returns false).
+     * This is like @ref routeIp4 restricted to routes through the given interface
+     * with the exception that it also accepts the all-ones broadcast address
+     * and multicast addresses. The logic is:
+     * - If the destination address is all-ones or multicast, the resulting hop
+     *   address is the destination address (and the resulting interface is as
+     *   given).
+     * - Otherwise, the route is selected as in @ref routeIp4 but considering
+     *   only the routes through the given interface.
+     * - If no such route matches, the function fails (returns false).
      * 
      * @param dst_addr Destination address to determine routing for.
      * @param iface Interface which is to be used.
@@ -766,14 +1273,20 @@ public:
     {
         AIPSTACK_ASSERT(iface != nullptr);
         
-        if (dst_addr.isAllOnes() || iface->ip4AddrIsLocal(dst_addr)) {
+        if (dst_addr.isAllOnesOrMulticast()) {
             route_info.addr = dst_addr;
-        }
-        else if (iface->m_have_gateway) {
-            route_info.addr = iface->m_gateway;
-        }
-        else {
-            return false;
+        } else {
+            if constexpr (SingleIface) {
+                if (AIPSTACK_LIKELY(single_iface_implicit_routes() == iface)) {
+                    return route_single_iface(dst_addr, iface, route_info);
+                }
+            }
+            
+            RouteEntry *route = find_route(dst_addr, iface);
+            if (route == nullptr) {
+                return false;
+            }
+            route_info.addr = route->have_gateway ? route->gateway : dst_addr;
         }
         route_info.iface = iface;
         return true;
@@ -784,9 +1297,9 @@ public:
      * 
      * This function checks the Path MTU estimate for an address and lowers it
      * to min(interface_mtu, max(MinMTU, mtu_info)) if it is greater than that.
-     * However, nothing is done if there is no existing Path MTU estimate for
-     * the address. Also if there is no route for the address then the min is
-     * not done.
+     * However, nothing is done if there is no @ref IpMtuRef setup for the
+     * address and no cached Path MTU estimate. Also if there is no route for the
+     * address then the min is not done.
      * 
      * If the Path MTU estimate was lowered, then all existing @ref IpMtuRef setup
      * for this address are notified (@ref IpMtuRef::pmtuChanged are called),
@@ -823,6 +1336,77 @@ public:
         return m_path_mtu_cache.handlePacketTooBig(remote_addr, TypeMax<std::uint16_t>);
     }
     
+    /**
+     * Return whether a batch of received packets is being processed.
+     * 
+     * This is true between @ref IpDriverIface::beginRecvBatch and
+     * @ref IpDriverIface::endRecvBatch. Protocol handlers can use this to defer
+     * work to the end of the batch, see @ref IpProtocolHandlerStub::recvIp4BatchEnd.
+     * 
+     * @return Whether a receive batch is active.
+     */
+    inline bool isInRecvBatch () const
+    {
+        return m_gro.batch_active;
+    }
+    
+    /**
+     * Begin a transmit batch.
+     * 
+     * Within a transmit batch, drivers which support it (see
+     * @ref IpIfaceDriverParams::flush_tx) may hold back sent packets, which are
+     * transmitted when the batch ends. Batches may be nested, in which case only
+     * the end of the outermost batch has this effect. Each call must be matched
+     * by a call to @ref endTxBatch.
+     * 
+     * The stack itself sends packets within a transmit batch while processing
+     * a receive batch, and TCP sends all segments for one output pass of
+     * a connection within a transmit batch.
+     */
+    inline void beginTxBatch ()
+    {
+        m_tx_batch_depth++;
+    }
+    
+    /**
+     * End a transmit batch.
+     * 
+     * If this ends the outermost batch, the drivers of interfaces through which
+     * packets were sent within the batch are asked to transmit them.
+     */
+    void endTxBatch ()
+    {
+        AIPSTACK_ASSERT(m_tx_batch_depth > 0);
+        
+        m_tx_batch_depth--;
+        if (m_tx_batch_depth == 0) {
+            tx_flush_pending_ifaces();
+        }
+    }
+    
+    /**
+     * Raise the Path MTU estimate for an address after successful probing.
+     *
+     * This should be called by a protocol handler implementing Packetization
+     * Layer Path MTU Discovery (RFC 4821) when a probe packet of the given size
+     * (including the IP header) has been confirmed to reach the destination.
+     * It raises the Path MTU estimate to min(interface_mtu, mtu) if it is less
+     * than that. Nothing is done if there is no existing Path MTU estimate for
+     * the address or if there is no route for the address.
+     *
+     * If the Path MTU estimate was raised, then all existing @ref IpMtuRef setup
+     * for this address are notified (@ref IpMtuRef::pmtuChanged are called),
+     * directly from this function.
+     *
+     * @param remote_addr Address to which the probe was sent.
+     * @param mtu Size of the probe packet including the IP header.
+     * @return True if the Path MTU estimate was raised, false if not.
+     */
+    inline bool handlePathMtuProbed (Ip4Addr remote_addr, std::uint16_t mtu)
+    {
+        return m_path_mtu_cache.handlePathMtuProbed(remote_addr, mtu);
+    }
+    
     /**
      * Check if the source address of a received datagram appears to be
      * a unicast address.
@@ -882,219 +1466,1250 @@ public:
         // calculated length.
         IpBufRef data = rx_dgram.revealHeader(rx_ip_info.header_len).subTo(data_len);
 
+        // Apply the rate limit for ICMP errors.
+        if (!m_icmp_error_limiter.allow(platform().getEventTime(), rx_ip_info.src_addr)) {
+            return IpErr::RateLimited;
+        }
+        
         return sendIcmp4Message(addrs, rx_ip_info.iface, Icmp4Type::DestUnreach,
                                 du_meta.icmp_code, du_meta.icmp_rest, data);
     }
 
     /**
-     * Select an interface and local IP address to be used for communication with a
-     * specific remote IP address.
+     * Get the numbers of ICMP messages not sent due to rate limits.
      * 
-     * This checks for a route to the given remote IP address and verifies that the
-     * selected network interface has an IP address configured. If that is OK, it succeeds
-     * and provides the interface and its local address.
+     * See @ref IpStackOptions::IcmpEchoBurst, @ref IpStackOptions::IcmpErrorBurst
+     * and @ref IpStackOptions::ForwardIcmpBurst.
      * 
-     * @param remote_addr Remote IP address.
-     * @param out_iface On success, is set to a pointer to the selected network interface
-     *        (not changed on failure).
-     * @param out_local_addr On success, is set to the selected local IP address (not
-     *        changed on failure).
-     * @return Success or error code.
+     * @return Counters of dropped ICMP messages.
      */
-    IpErr selectLocalIp4Address (
-        Ip4Addr remote_addr, IpIface<Arg> *&out_iface, Ip4Addr &out_local_addr) const
+    IpIcmpRateLimitStats getIcmpRateLimitStats () const
     {
-        // Determine the local interface.
-        IpRouteInfoIp4<Arg> route_info;
-        if (!routeIp4(remote_addr, route_info)) {
-            return IpErr::NoIpRoute;
-        }
-        
-        // Determine the local IP address.
-        IpIfaceIp4AddrSetting addr_setting = route_info.iface->getIp4Addr();
-        if (!addr_setting.present) {
-            return IpErr::NoIpRoute;
-        }
-
-        out_iface = route_info.iface;
-        out_local_addr = addr_setting.addr;
-        return IpErr::Success;
+        IpIcmpRateLimitStats stats;
+        stats.echo_replies_dropped = m_icmp_echo_limiter.getDrops();
+        stats.dest_unreach_dropped = m_icmp_error_limiter.getDrops();
+        stats.forward_errors_dropped = m_fwd_icmp_limiter.getDrops();
+        return stats;
     }
     
-private:    
-    using IfaceList = LinkedList<
-        MemberAccessor<Iface, LinkedListNode<IfaceLinkModel>, &Iface::m_iface_list_node>,
-        IfaceLinkModel, false>;
-    
-    // Public works around access control issue from IpMtuRef with some compilers.
-public:
-#ifndef IN_DOXYGEN
-    using BaseMtuRef = typename PathMtuCache::MtuRef;
-#endif
+    /**
+     * Get the stack-wide statistics counters.
+     * 
+     * The counters are only maintained if @ref IpStackOptions::EnableStats is
+     * enabled, otherwise they are all zero. Counters of specific interfaces are
+     * returned by @ref IpIface::getStats.
+     * 
+     * @return The current counters.
+     */
+    IpStackStats getStats () const
+    {
+        IpStackStats stats = m_stats.get();
+        IpStackStats reass_stats = m_reassembly.getStats();
+        stats.reasm_fails = reass_stats.reasm_fails;
+        stats.reasm_timeouts = reass_stats.reasm_timeouts;
+        stats.reasm_quota_drops = reass_stats.reasm_quota_drops;
+        stats.reasm_hole_drops = reass_stats.reasm_hole_drops;
+        return stats;
+    }
     
-private:
-    static void processRecvedIp4Packet (Iface *iface, IpBufRef pkt)
+    /**
+     * Get the memory usage of the stack and its subsystems.
+     * 
+     * Current usage is always reported, while peak values are only maintained
+     * if @ref IpStackOptions::EnableStats is enabled. Memory used by TCP and
+     * ARP is reported by @ref TcpApi::getMemoryStats and
+     * @ref EthIpIface::getArpMemoryUsage.
+     * 
+     * @return The current memory usage.
+     */
+    IpStackMemoryStats getMemoryStats () const
     {
-        // Check base IP header length.
-        if (AIPSTACK_UNLIKELY(!pkt.hasHeader(Ip4Header::Size))) {
-            return;
+        IpStackMemoryStats stats;
+        stats.stack_bytes = sizeof(IpStack);
+        stats.path_mtu = m_path_mtu_cache.getMemoryUsage();
+        stats.reassembly = m_reassembly.getMemoryUsage();
+        return stats;
+    }
+    
+    /**
+     * Increment a stack-wide statistics counter.
+     * 
+     * This is intended for protocol handlers which maintain counters in
+     * @ref IpStackStats (such as UDP). It does nothing if statistics are not
+     * enabled.
+     * 
+     * @param counter The counter to increment.
+     */
+    inline void incStat (std::uint32_t IpStackStats::*counter)
+    {
+        m_stats.inc(counter);
+    }
+    
+    /**
+     * Whether statistics counters are maintained, that is the value of
+     * @ref IpStackOptions::EnableStats.
+     */
+    inline static constexpr bool StatsEnabled = EnableStats;
+    
+    /**
+     * Type of callback used to report dropped packets (see @ref setDropHandler).
+     * 
+     * @param reason The reason for dropping.
+     * @param iface The interface the packet was received on or was to be sent
+     *        to, or null if not known (e.g. for TCP segments outside the window).
+     * @param data The dropped data, starting at the header of the protocol
+     *        layer where it was dropped, or only the payload if the header is no
+     *        longer available. The referenced buffers must not be used outside
+     *        of the callback.
+     */
+    using DropHandler = Function<void(IpDropReason reason, IpIface<Arg> *iface,
+                                      IpBufRef data)>;
+    
+    /**
+     * Set the callback which is called for each dropped packet.
+     * 
+     * This may only be used if @ref IpStackOptions::EnableDropTrace is enabled.
+     * The callback must not send packets or otherwise call into the stack.
+     * 
+     * @param handler The callback, or null to disable reporting.
+     */
+    void setDropHandler (DropHandler handler)
+    {
+        static_assert(EnableDropTrace, "EnableDropTrace option is not enabled");
+        
+        m_drop_handler = handler;
+    }
+    
+    /**
+     * Report a dropped packet.
+     * 
+     * This is intended for protocol handlers and interface drivers. If
+     * @ref IpStackOptions::EnableDropTrace is enabled, this fires the USDT probe
+     * (if configured) and calls the callback set by @ref setDropHandler (if
+     * any), otherwise it does nothing.
+     * 
+     * @param reason The reason for dropping.
+     * @param iface The interface or null, see @ref DropHandler.
+     * @param data The dropped data, see @ref DropHandler.
+     */
+    inline void traceDrop (IpDropReason reason, IpIface<Arg> *iface, IpBufRef data)
+    {
+        if constexpr (EnableDropTrace) {
+            AIPSTACK_DROP_TRACE_USDT(AsUnderlying(reason), data.tot_len);
+            if (AIPSTACK_UNLIKELY(m_drop_handler)) {
+                m_drop_handler(reason, iface, data);
+            }
+        } else {
+            (void)reason;
+            (void)iface;
+            (void)data;
+        }
+    }
+    
+    /**
+     * Record that the processing of the packet being sampled for latency
+     * tracing reached a stage.
+     * 
+     * This is intended for protocol handlers and interface drivers. It does
+     * nothing if @ref IpStackOptions::LatencyTraceInterval is zero or if no
+     * packet is being sampled.
+     * 
+     * @param stage The stage which was reached.
+     */
+    inline void traceLatency (IpLatencyStage stage)
+    {
+        m_latency_tracer.mark(platform(), stage);
+    }
+    
+    /**
+     * Get the latency statistics.
+     * 
+     * These are only maintained if @ref IpStackOptions::LatencyTraceInterval
+     * is nonzero, otherwise they are all zero.
+     * 
+     * @return The latency statistics (see @ref IpLatencyStats).
+     */
+    IpLatencyStats getLatencyStats () const
+    {
+        return m_latency_tracer.get();
+    }
+    
+    /**
+     * Reset the latency statistics.
+     */
+    void resetLatencyStats ()
+    {
+        m_latency_tracer.reset();
+    }
+    
+    /**
+     * Type of callback used to report transmit timestamps (see
+     * @ref setTxTimestampHandler).
+     * 
+     * @param iface The interface the packet was sent through.
+     * @param pkt The packet as it was passed to the driver, starting with the
+     *        IP header. The referenced buffers must not be used outside of the
+     *        callback.
+     * @param time The time when the packet was transmitted, in platform time
+     *        units (see @ref PlatformFacade::getTime).
+     */
+    using TxTimestampHandler = Function<void(IpIface<Arg> *iface, IpBufRef pkt,
+                                             std::uint64_t time)>;
+    
+    /**
+     * Set the callback which is called when a driver reports the transmit
+     * time of a packet.
+     * 
+     * Drivers which can determine when a packet actually left the interface
+     * (e.g. from NIC timestamps, `SO_TIMESTAMPING` or completion of the
+     * transmission) report it using @ref IpDriverIface::reportTxTimestamp.
+     * The application can identify the packet from its headers, for example
+     * by the sequence number of a TCP segment. The callback must not send
+     * packets or otherwise call into the stack.
+     * 
+     * @param handler The callback, or null to disable reporting.
+     */
+    void setTxTimestampHandler (TxTimestampHandler handler)
+    {
+        m_tx_timestamp_handler = handler;
+    }
+    
+    /**
+     * Set a rule of the receive filter.
+     * 
+     * Received packets matching any rule of the receive filter are dropped
+     * immediately after the IP header is parsed, before the IP header
+     * checksum is verified, reassembly, forwarding or any other processing.
+     * The number of rules is given by @ref IpStackOptions::NumRxFilterRules.
+     * Setting a rule resets its hit counter.
+     * 
+     * @param index Index of the rule (must be less than NumRxFilterRules).
+     * @param rule The rule.
+     */
+    void setRxFilterRule (std::size_t index, IpRxFilterRule const &rule)
+    {
+        AIPSTACK_ASSERT(index < NumRxFilterRules);
+        AIPSTACK_ASSERT(rule.src_prefix_len <= Ip4Addr::Bits);
+        AIPSTACK_ASSERT(rule.dst_prefix_len <= Ip4Addr::Bits);
+        AIPSTACK_ASSERT(rule.dst_port_min <= rule.dst_port_max);
+        
+        RxFilterRule &frule = m_rx_filter_rules[index];
+        
+        if (!frule.active) {
+            frule.active = true;
+            m_num_rx_filter_rules++;
+        }
+        
+        frule.src_mask = Ip4Addr::PrefixMask(rule.src_prefix_len);
+        frule.src_addr = rule.src_addr & frule.src_mask;
+        frule.dst_mask = Ip4Addr::PrefixMask(rule.dst_prefix_len);
+        frule.dst_addr = rule.dst_addr & frule.dst_mask;
+        frule.proto_mask = rule.match_proto ? 0xFF : 0;
+        frule.proto = rule.match_proto ? AsUnderlying(rule.proto) : 0;
+        frule.match_ports =
+            rule.dst_port_min != 0 || rule.dst_port_max != PortNum(-1);
+        frule.dst_port_min = rule.dst_port_min;
+        frule.dst_port_max = rule.dst_port_max;
+        frule.hits = 0;
+    }
+    
+    /**
+     * Remove a rule of the receive filter.
+     * 
+     * @param index Index of the rule (must be less than NumRxFilterRules).
+     */
+    void clearRxFilterRule (std::size_t index)
+    {
+        AIPSTACK_ASSERT(index < NumRxFilterRules);
+        
+        RxFilterRule &frule = m_rx_filter_rules[index];
+        
+        if (frule.active) {
+            frule.active = false;
+            m_num_rx_filter_rules--;
+        }
+    }
+    
+    /**
+     * Return the number of packets dropped by a rule of the receive filter
+     * since it was set.
+     * 
+     * The counter wraps around on overflow.
+     * 
+     * @param index Index of the rule (must be less than NumRxFilterRules).
+     * @return Number of dropped packets.
+     */
+    std::uint32_t getRxFilterRuleHits (std::size_t index) const
+    {
+        AIPSTACK_ASSERT(index < NumRxFilterRules);
+        
+        return m_rx_filter_rules[index].hits;
+    }
+    
+    /**
+     * Select an interface and local IP address to be used for communication with a
+     * specific remote IP address.
+     * 
+     * This checks for a route to the given remote IP address and verifies that the
+     * selected network interface has an IP address configured. If that is OK, it succeeds
+     * and provides the interface and its local address.
+     * 
+     * The local address is the address set by @ref IpIface::setIp4Addr, except when
+     * the remote address is itself an additional address of the interface (@ref
+     * IpIface::addIp4ExtraAddr), in which case that address is used so that traffic
+     * to an additional address of the stack stays on that address. Other additional
+     * addresses are only used as local addresses when bound explicitly.
+     * 
+     * @param remote_addr Remote IP address.
+     * @param out_iface On success, is set to a pointer to the selected network interface
+     *        (not changed on failure).
+     * @param out_local_addr On success, is set to the selected local IP address (not
+     *        changed on failure).
+     * @return Success or error code.
+     */
+    IpErr selectLocalIp4Address (
+        Ip4Addr remote_addr, IpIface<Arg> *&out_iface, Ip4Addr &out_local_addr) const
+    {
+        // Determine the local interface.
+        IpRouteInfoIp4<Arg> route_info;
+        if (!routeIp4(remote_addr, route_info)) {
+            return IpErr::NoIpRoute;
+        }
+        
+        // Determine the local IP address.
+        if (AIPSTACK_UNLIKELY(route_info.iface->ip4AddrIsExtraAddr(remote_addr))) {
+            out_iface = route_info.iface;
+            out_local_addr = remote_addr;
+            return IpErr::Success;
+        }
+        IpIfaceIp4AddrSetting addr_setting = route_info.iface->getIp4Addr();
+        if (!addr_setting.present) {
+            return IpErr::NoIpRoute;
+        }
+
+        out_iface = route_info.iface;
+        out_local_addr = addr_setting.addr;
+        return IpErr::Success;
+    }
+    
+private:
+    // Find the route to use for a destination address, only considering routes
+    // through the given interface if it is not null. Prefix lengths without
+    // any routes are skipped based on m_num_routes_by_prefix.
+    RouteEntry * find_route (Ip4Addr dst_addr, Iface *iface) const
+    {
+        for (std::size_t i = Ip4Addr::Bits + 1; i > 0; i--) {
+            std::size_t prefix = i - 1;
+            if (m_num_routes_by_prefix[prefix] == 0) {
+                continue;
+            }
+            
+            IpRouteKey key{dst_addr & Ip4Addr::PrefixMask(prefix), std::uint8_t(prefix)};
+            RouteEntry *best_route = nullptr;
+            
+            for (RouteEntry *route = m_route_index.findFirst(key); route != nullptr;
+                 route = m_route_index.findNext(key, *route))
+            {
+                if ((iface == nullptr || route->iface == iface) &&
+                    (best_route == nullptr || route->metric < best_route->metric))
+                {
+                    best_route = route;
+                }
+            }
+            
+            if (best_route != nullptr) {
+                return best_route;
+            }
+        }
+        
+        return nullptr;
+    }
+    
+    // With SingleIface, return the interface if only its implicit routes (to
+    // the subnet and via the gateway) are installed, otherwise null.
+    Iface * single_iface_implicit_routes () const
+    {
+        static_assert(SingleIface);
+        
+        Iface *iface = m_iface_list.first();
+        if (iface == nullptr || iface->m_num_routes !=
+            std::size_t(iface->m_subnet_route.installed) +
+            std::size_t(iface->m_gateway_route.installed))
+        {
+            return nullptr;
+        }
+        
+        return iface;
+    }
+    
+    // Route using the implicit routes of the single interface, with the same
+    // result as find_route (the subnet route has the longer prefix).
+    static bool route_single_iface (Ip4Addr dst_addr, Iface *iface,
+                                    IpRouteInfoIp4<Arg> &route_info)
+    {
+        if (iface->m_have_addr &&
+            (dst_addr & iface->m_addr.netmask) == iface->m_addr.netaddr)
+        {
+            route_info.addr = dst_addr;
+        }
+        else if (iface->m_have_gateway) {
+            route_info.addr = dst_addr.isMulticast() ? dst_addr : iface->m_gateway;
+        }
+        else {
+            return false;
+        }
+        
+        route_info.iface = iface;
+        return true;
+    }
+    
+    void add_route (RouteEntry &route)
+    {
+        AIPSTACK_ASSERT(!route.installed);
+        AIPSTACK_ASSERT(route.prefix <= Ip4Addr::Bits);
+        
+        m_route_index.addEntry(route);
+        m_num_routes_by_prefix[route.prefix]++;
+        bump_route_gen();
+        route.iface->m_num_routes++;
+        route.installed = true;
+    }
+    
+    // Invalidate all route caches. Zero is skipped since it means that
+    // a cache is empty.
+    void bump_route_gen ()
+    {
+        m_route_gen++;
+        if (m_route_gen == 0) {
+            m_route_gen = 1;
+        }
+    }
+    
+    void remove_route (RouteEntry &route)
+    {
+        AIPSTACK_ASSERT(route.installed);
+        AIPSTACK_ASSERT(m_num_routes_by_prefix[route.prefix] > 0);
+        AIPSTACK_ASSERT(route.iface->m_num_routes > 0);
+        
+        m_route_index.removeEntry(route);
+        m_num_routes_by_prefix[route.prefix]--;
+        bump_route_gen();
+        route.iface->m_num_routes--;
+        route.installed = false;
+    }
+    
+    using IfaceList = LinkedList<
+        MemberAccessor<Iface, LinkedListNode<IfaceLinkModel>, &Iface::m_iface_list_node>,
+        IfaceLinkModel, false>;
+    
+    using TxFlushIfaceList = LinkedList<
+        MemberAccessor<Iface, LinkedListNode<IfaceLinkModel>,
+                       &Iface::m_tx_flush_list_node>,
+        IfaceLinkModel, false>;
+    
+    // Pass a packet to the driver and arrange for the driver to transmit it.
+    // Packets to an address of the interface itself are passed to the loopback
+    // interface if there is one (see IpLoopbackIface).
+    inline static IpErr driver_send_ip4_packet (Iface *iface, IpBufRef pkt,
+        Ip4Addr addr, IpSendRetryRequest *retryReq)
+    {
+        if (AIPSTACK_UNLIKELY(iface->ip4AddrIsLocalAddr(addr)) &&
+            iface->m_stack->m_loopback_iface != nullptr)
+        {
+            iface = iface->m_stack->m_loopback_iface;
+        }
+        
+        // If the transmit queue of the driver is stopped, hold back senders
+        // which will be notified when it drains, rather than having the driver
+        // reject the packet once the queue is full.
+        IpSendRetryTxQueue *tx_queue = iface->m_params.tx_queue;
+        if (AIPSTACK_UNLIKELY(tx_queue != nullptr && tx_queue->isStopped()) &&
+            retryReq != nullptr)
+        {
+            tx_queue->addRequest(retryReq);
+            iface->m_stats.inc(&IpIfaceStats::out_throttled);
+            return IpErr::OutputBufferFull;
+        }
+        
+        iface->m_stack->traceLatency(IpLatencyStage::IpTx);
+        IpErr err = iface->m_params.send_ip4_packet(pkt, addr, retryReq);
+        iface->m_stack->tx_flush_needed(iface);
+        
+        if (AIPSTACK_LIKELY(err == IpErr::Success)) {
+            iface->m_stats.inc(&IpIfaceStats::out_transmits);
+            iface->m_stats.add(&IpIfaceStats::out_octets, std::uint64_t(pkt.tot_len));
+        } else {
+            iface->m_stats.inc(&IpIfaceStats::out_discards);
+            iface->m_stack->traceDrop((err == IpErr::ArpQueryInProgress) ?
+                IpDropReason::ArpUnresolved : IpDropReason::DriverSendError, iface, pkt);
+        }
+        return err;
+    }
+    
+    // Call the flush_tx driver function of an interface if it is provided,
+    // right away or at the end of the current transmit batch.
+    void tx_flush_needed (Iface *iface)
+    {
+        if (!iface->m_params.flush_tx) {
+            return;
+        }
+        
+        if (m_tx_batch_depth == 0) {
+            iface->m_params.flush_tx();
+        }
+        else if (!iface->m_tx_flush_pending) {
+            iface->m_tx_flush_pending = true;
+            m_tx_flush_list.prepend(*iface);
+        }
+    }
+    
+    void tx_flush_pending_ifaces ()
+    {
+        // Drivers cannot send packets through the stack from flush_tx so there
+        // is no concern about the list changing other than by our removals.
+        while (Iface *iface = m_tx_flush_list.first()) {
+            m_tx_flush_list.removeFirst();
+            iface->m_tx_flush_pending = false;
+            iface->m_params.flush_tx();
+        }
+    }
+    
+    // Public works around access control issue from IpMtuRef with some compilers.
+public:
+#ifndef IN_DOXYGEN
+    using BaseMtuRef = typename PathMtuCache::MtuRef;
+#endif
+    
+private:
+    static void processRecvedIp4Packet (Iface *iface, IpBufRef pkt,
+        IpChksumOffloadFlags chksum_verified, IpRxBuf *rx_buf,
+        IpRxTimestamp rx_time = IpRxTimestamp())
+    {
+        // Count the received packet.
+        iface->m_stack->m_stats.inc(&IpStackStats::in_receives);
+        iface->m_stats.inc(&IpIfaceStats::in_receives);
+        iface->m_stats.add(&IpIfaceStats::in_octets, std::uint64_t(pkt.tot_len));
+        
+        IpStack *stack = iface->m_stack;
+        stack->m_latency_tracer.rxBegin(stack->platform(), IpLatencyStage::IpRx, rx_time);
+        
+        // Most packets are handled by the fast path.
+        if (AIPSTACK_UNLIKELY(
+            !rx_ip4_fast_path(iface, pkt, chksum_verified, rx_buf, rx_time)))
+        {
+            process_ip4_packet_general(iface, pkt, chksum_verified, rx_buf, rx_time);
+        }
+        
+        stack->m_latency_tracer.rxEnd();
+    }
+    
+    // General receive processing for packets not handled by rx_ip4_fast_path.
+    AIPSTACK_NO_INLINE
+    static void process_ip4_packet_general (Iface *iface, IpBufRef pkt,
+        IpChksumOffloadFlags chksum_verified, IpRxBuf *rx_buf, IpRxTimestamp rx_time)
+    {
+        // Check base IP header length.
+        if (AIPSTACK_UNLIKELY(!pkt.hasHeader(Ip4Header::Size))) {
+            return rx_drop_hdr_error(iface, pkt, IpDropReason::Ip4HeaderInvalid);
+        }
+        
+        // Decode the fixed part of the IP header in one go.
+        char const *ip4_header_data = pkt.getChunkPtr();
+        Ip4Header::Native ip4_header = Ip4Header::Decode(ip4_header_data);
+        
+        // We will be calculating the header checksum inline.
+        IpChksumAccumulator chksum;
+        
+        // Read Version+IHL+DSCP+ECN and add to checksum.
+        std::uint16_t version_ihl_dscp_ecn = ip4_header.get(Ip4Header::VersionIhlDscpEcn());
+        chksum.addWord(WrapType<std::uint16_t>(), version_ihl_dscp_ecn);
+        
+        // Check IP version and header length...
+        std::uint8_t version_ihl = version_ihl_dscp_ecn >> 8;
+        std::uint8_t header_len;
+        
+        // Fast path is that the version is correctly 4 and the header
+        // length is minimal (5 words = 20 bytes).
+        if (AIPSTACK_LIKELY(version_ihl == ((4 << Ip4VersionShift) | 5))) {
+            // Header length is minimal, no options. There is no need to check
+            // pkt.hasHeader(header_len) since that was already done above.
+            header_len = Ip4Header::Size;
+        } else {
+            // Check IP version.
+            if (AIPSTACK_UNLIKELY((version_ihl >> Ip4VersionShift) != 4)) {
+                return rx_drop_hdr_error(iface, pkt, IpDropReason::Ip4HeaderInvalid);
+            }
+            
+            // Check header length.
+            // We require the entire header to fit into the first buffer.
+            header_len = (version_ihl & Ip4IhlMask) * 4;
+            if (AIPSTACK_UNLIKELY(header_len < Ip4Header::Size ||
+                                 !pkt.hasHeader(header_len)))
+            {
+                return rx_drop_hdr_error(iface, pkt, IpDropReason::Ip4HeaderInvalid);
+            }
+            
+            // Add options to checksum, unless it was verified by hardware.
+            if ((chksum_verified & IpChksumOffloadFlags::Ip4Header) == Enum0) {
+                chksum.addEvenBytes(ip4_header_data + Ip4Header::Size,
+                                    header_len - Ip4Header::Size);
+            }
+        }
+        
+        // Read total length and add to checksum.
+        std::uint16_t total_len = ip4_header.get(Ip4Header::TotalLen());
+        chksum.addWord(WrapType<std::uint16_t>(), total_len);
+        
+        // Check total length.
+        if (AIPSTACK_UNLIKELY(total_len < header_len || total_len > pkt.tot_len)) {
+            return rx_drop_hdr_error(iface, pkt, IpDropReason::Ip4HeaderInvalid);
+        }
+        
+        // Create a reference to the payload.
+        IpBufRef dgram = pkt.hideHeader(header_len).subTo(total_len - header_len);
+        
+        // Add ident and header checksum to checksum.
+        chksum.addWord(WrapType<std::uint16_t>(), ip4_header.get(Ip4Header::Ident()));
+        chksum.addWord(WrapType<std::uint16_t>(),
+                       ip4_header.get(Ip4Header::HeaderChksum()));
+        
+        // Read TTL and protocol number and add to checksum.
+        std::uint8_t ttl = ip4_header.get(Ip4Header::Ttl());
+        Ip4Protocol proto = ip4_header.get(Ip4Header::Proto());
+        chksum.addWordOctets(ttl, AsUnderlying(proto));
+        
+        // Read addresses and add to checksum
+        Ip4Addr src_addr = ip4_header.get(Ip4Header::SrcAddr());
+        chksum.addWord(WrapType<std::uint32_t>(), src_addr.value());
+        Ip4Addr dst_addr = ip4_header.get(Ip4Header::DstAddr());
+        chksum.addWord(WrapType<std::uint32_t>(), dst_addr.value());
+        
+        // Get flags+offset and add to checksum.
+        Ip4Flags flags_offset = ip4_header.get(Ip4Header::FlagsOffset());
+        chksum.addWord(WrapType<std::uint16_t>(), AsUnderlying(flags_offset));
+        
+        // Apply the receive filter before any further processing.
+        if constexpr (NumRxFilterRules > 0) {
+            if (AIPSTACK_UNLIKELY(iface->m_stack->m_num_rx_filter_rules > 0) &&
+                iface->m_stack->rx_filter_drops(src_addr, dst_addr, proto,
+                                                flags_offset, dgram))
+            {
+                return rx_drop_discard(iface, pkt, &IpStackStats::in_filtered,
+                                       IpDropReason::RxFiltered);
+            }
+        }
+        
+        // Drop multicast packets for groups which are not joined on the interface.
+        // Most such groups are rejected by a hashed filter without a search.
+        if (AIPSTACK_UNLIKELY(dst_addr.isMulticast()) &&
+            !iface->ip4McastGroupIsJoined(dst_addr))
+        {
+            return rx_drop_discard(iface, pkt, &IpStackStats::in_addr_errors,
+                                   IpDropReason::McastNotJoined);
+        }
+        
+        // Verify IP header checksum, unless verified by hardware.
+        if ((chksum_verified & IpChksumOffloadFlags::Ip4Header) == Enum0 &&
+            AIPSTACK_UNLIKELY(chksum.getChksum() != 0))
+        {
+            return rx_drop_hdr_error(iface, pkt, IpDropReason::Ip4ChksumBad);
+        }
+        
+        // If forwarding is enabled, forward the packet if it is not addressed to
+        // this host. Fragments are forwarded as they are, without reassembly.
+        if constexpr (EnableForwarding) {
+            if (AIPSTACK_UNLIKELY(!iface->m_stack->ip4_dst_is_local(iface, dst_addr))) {
+                return iface->m_stack->forward_ip4_packet(iface, pkt.subTo(total_len),
+                    header_len, src_addr, dst_addr, ttl, proto, flags_offset);
+            }
+        }
+        
+        // Check if the more-fragments flag is set or the fragment offset is nonzero.
+        if (AIPSTACK_UNLIKELY((flags_offset & (Ip4Flags::MF|Ip4Flags::OffsetMask)) != Enum0)) {
+            // Only accept fragmented packets which are unicasts to the
+            // incoming interface address. This is to prevent filling up
+            // our reassembly buffers with irrelevant packets. Note that
+            // we don't check this for non-fragmented packets for
+            // performance reasons, it generally up to protocol handlers.
+            if (!iface->ip4AddrIsLocalAddr(dst_addr)) {
+                return rx_drop_discard(iface, pkt, &IpStackStats::in_addr_errors,
+                                       IpDropReason::FragNotLocal);
+            }
+            
+            // Get the more-fragments flag and the fragment offset in bytes.
+            bool more_fragments = (flags_offset & Ip4Flags::MF) != Enum0;
+            std::uint16_t fragment_offset =
+                std::uint16_t(flags_offset & Ip4Flags::OffsetMask) * 8;
+            
+            // Perform reassembly.
+            iface->m_stack->m_stats.inc(&IpStackStats::reasm_reqds);
+            if (!iface->m_stack->m_reassembly.reassembleIp4(
+                ip4_header.get(Ip4Header::Ident()), src_addr, dst_addr, ttl, proto,
+                more_fragments, fragment_offset, rx_buf, dgram))
+            {
+                return;
+            }
+            iface->m_stack->m_stats.inc(&IpStackStats::reasm_oks);
+            // Continue processing the reassembled datagram.
+            // Note, dgram was modified pointing to the reassembled data.
+            // Any hardware verification of transport checksums applied only
+            // to the fragment, not to the reassembled datagram.
+            // The reassembled data is not in (just) the receive buffer.
+            IpRxInfoIp4<Arg> ip_info{src_addr, dst_addr, ttl, proto,
+                std::uint8_t(version_ihl_dscp_ecn), iface, header_len,
+                IpChksumOffloadFlags(), /*rx_buf=*/nullptr, IpRxTimestamp()};
+            
+            return recv_reassembled_ip4(ip_info, dgram);
+        }
+        
+        // Create the IpRxInfoIp4 struct.
+        IpRxInfoIp4<Arg> ip_info{src_addr, dst_addr, ttl, proto,
+            std::uint8_t(version_ihl_dscp_ecn), iface, header_len, chksum_verified, rx_buf,
+            rx_time};
+        
+        // If the driver is delivering a batch of packets, try to coalesce TCP segments.
+        if (GroMaxSegs > 0 && iface->m_stack->m_gro.batch_active) {
+            return gro_input(ip_info, dgram);
+        }
+        
+        // Do the real processing now that the datagram is complete and
+        // sanity checked.
+        recvIp4Dgram(ip_info, dgram);
+    }
+    
+    // Fast path of processRecvedIp4Packet for the common case: the header is in
+    // the first chunk, has no options and a valid checksum, and the packet is not
+    // fragmented and is addressed to an address of the interface. This does not
+    // need the multicast, forwarding and reassembly checks of the general path.
+    // Returns false without side effects if the packet needs the general path,
+    // which also takes care of counting and tracing any errors.
+    AIPSTACK_ALWAYS_INLINE
+    static bool rx_ip4_fast_path (Iface *iface, IpBufRef pkt,
+        IpChksumOffloadFlags chksum_verified, IpRxBuf *rx_buf, IpRxTimestamp rx_time)
+    {
+        if (AIPSTACK_UNLIKELY(!pkt.hasHeader(Ip4Header::Size))) {
+            return false;
+        }
+        
+        char const *ip4_header_data = pkt.getChunkPtr();
+        Ip4Header::Native ip4_header = Ip4Header::Decode(ip4_header_data);
+        
+        std::uint16_t version_ihl_dscp_ecn = ip4_header.get(Ip4Header::VersionIhlDscpEcn());
+        std::uint16_t total_len = ip4_header.get(Ip4Header::TotalLen());
+        Ip4Flags flags_offset = ip4_header.get(Ip4Header::FlagsOffset());
+        Ip4Addr dst_addr = ip4_header.get(Ip4Header::DstAddr());
+        
+        if (AIPSTACK_UNLIKELY(
+            (version_ihl_dscp_ecn >> 8) != ((4 << Ip4VersionShift) | 5) ||
+            total_len < Ip4Header::Size || total_len > pkt.tot_len ||
+            (flags_offset & (Ip4Flags::MF|Ip4Flags::OffsetMask)) != Enum0 ||
+            !iface->ip4AddrIsLocalAddr(dst_addr)))
+        {
+            return false;
+        }
+        
+        if ((chksum_verified & IpChksumOffloadFlags::Ip4Header) == Enum0 &&
+            AIPSTACK_UNLIKELY(!ip4_min_header_chksum_ok(ip4_header_data)))
+        {
+            return false;
+        }
+        
+        Ip4Addr src_addr = ip4_header.get(Ip4Header::SrcAddr());
+        Ip4Protocol proto = ip4_header.get(Ip4Header::Proto());
+        IpBufRef dgram = pkt.hideHeader(Ip4Header::Size).subTo(
+            total_len - Ip4Header::Size);
+        
+        if constexpr (NumRxFilterRules > 0) {
+            if (AIPSTACK_UNLIKELY(iface->m_stack->m_num_rx_filter_rules > 0) &&
+                iface->m_stack->rx_filter_drops(src_addr, dst_addr, proto,
+                                                flags_offset, dgram))
+            {
+                rx_drop_discard(iface, pkt, &IpStackStats::in_filtered,
+                                IpDropReason::RxFiltered);
+                return true;
+            }
+        }
+        
+        IpRxInfoIp4<Arg> ip_info{src_addr, dst_addr, ip4_header.get(Ip4Header::Ttl()),
+            proto, std::uint8_t(version_ihl_dscp_ecn), iface, Ip4Header::Size,
+            chksum_verified, rx_buf, rx_time};
+        
+        if (GroMaxSegs > 0 && iface->m_stack->m_gro.batch_active) {
+            gro_input(ip_info, dgram);
+            return true;
+        }
+        
+        // Go straight to the protocol handler unless recvIp4Dgram is needed for
+        // interface listeners or protocols handled by the stack itself.
+        int proto_index = ProtocolDispatch::ProtoIndexTable.index[std::uint8_t(proto)];
+        if (AIPSTACK_LIKELY(proto_index < NumProtocols) &&
+            AIPSTACK_LIKELY(!iface->has_listeners_for_proto(proto)))
+        {
+            iface->m_stack->m_stats.inc(&IpStackStats::in_delivers);
+            iface->m_stack->traceLatency(IpLatencyStage::ProtoDemux);
+            ProtocolDispatch::RecvIp4DgramFuncs[proto_index](iface->m_stack, ip_info, dgram);
+        } else {
+            recvIp4Dgram(ip_info, dgram);
+        }
+        return true;
+    }
+    
+    // Check the checksum of an IPv4 header without options using 32-bit loads.
+    // The one's complement sum does not depend on byte order, so the words are
+    // summed in native order and the folded sum must be all ones.
+    inline static bool ip4_min_header_chksum_ok (char const *header)
+    {
+        std::uint32_t words[Ip4Header::Size / 4];
+        std::memcpy(words, header, Ip4Header::Size);
+        
+        std::uint64_t sum = 0;
+        for (std::uint32_t word : words) {
+            sum += word;
+        }
+        sum = (sum & 0xFFFFFFFFu) + (sum >> 32);
+        sum = (sum & 0xFFFFu) + (sum >> 16);
+        sum = (sum & 0xFFFFu) + (sum >> 16);
+        sum = (sum & 0xFFFFu) + (sum >> 16);
+        
+        return sum == 0xFFFFu;
+    }
+    
+    // Count and trace a received packet dropped due to an invalid IP header.
+    static void rx_drop_hdr_error (Iface *iface, IpBufRef pkt, IpDropReason reason)
+    {
+        iface->m_stack->m_stats.inc(&IpStackStats::in_hdr_errors);
+        iface->m_stats.inc(&IpIfaceStats::in_hdr_errors);
+        iface->m_stack->traceDrop(reason, iface, pkt);
+    }
+    
+    // Count and trace a received packet dropped for another reason.
+    static void rx_drop_discard (Iface *iface, IpBufRef pkt,
+        std::uint32_t IpStackStats::*counter, IpDropReason reason)
+    {
+        iface->m_stack->m_stats.inc(counter);
+        iface->m_stats.inc(&IpIfaceStats::in_discards);
+        iface->m_stack->traceDrop(reason, iface, pkt);
+    }
+    
+    // Check if a received packet matches a rule of the receive filter, and
+    // count the hit if so.
+    bool rx_filter_drops (Ip4Addr src_addr, Ip4Addr dst_addr, Ip4Protocol proto,
+                          Ip4Flags flags_offset, IpBufRef dgram)
+    {
+        // Get the destination port if this is the first or only fragment
+        // of a TCP or UDP datagram (the port is at the same offset).
+        bool have_port = (proto == Ip4Protocol::Tcp || proto == Ip4Protocol::Udp) &&
+            (flags_offset & Ip4Flags::OffsetMask) == Enum0 &&
+            dgram.hasHeader(Udp4Header::Size);
+        PortNum dst_port = have_port ?
+            Udp4Header::MakeRef(dgram.getChunkPtr()).get(Udp4Header::DstPort()) : 0;
+        
+        for (RxFilterRule &frule : m_rx_filter_rules) {
+            if (frule.active &&
+                (src_addr & frule.src_mask) == frule.src_addr &&
+                (dst_addr & frule.dst_mask) == frule.dst_addr &&
+                (AsUnderlying(proto) & frule.proto_mask) == frule.proto &&
+                (!frule.match_ports || (have_port &&
+                    dst_port >= frule.dst_port_min && dst_port <= frule.dst_port_max)))
+            {
+                frule.hits++;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    // Process a reassembled datagram. It is not coalesced (see gro_input) since
+    // its data is only valid until the reassembly is told to release it.
+    static void recv_reassembled_ip4 (IpRxInfoIp4<Arg> const &ip_info, IpBufRef dgram)
+    {
+        IpStack *stack = ip_info.iface->m_stack;
+        
+        // Pass any coalesced segments first to preserve ordering.
+        if constexpr (GroMaxSegs > 0) {
+            stack->gro_flush();
+        }
+        
+        recvIp4Dgram(ip_info, dgram);
+        
+        stack->m_reassembly.releaseReassembled();
+    }
+    
+    void beginRecvBatch ()
+    {
+        AIPSTACK_ASSERT(!m_gro.batch_active);
+        
+        m_gro.batch_active = true;
+        
+        // Packets sent while processing the batch are transmitted at the end.
+        beginTxBatch();
+    }
+    
+    void endRecvBatch ()
+    {
+        AIPSTACK_ASSERT(m_gro.batch_active);
+        
+        gro_flush();
+        m_gro.batch_active = false;
+        
+        // Let the protocol handlers do work deferred to the end of the batch.
+        ListFor<ProtocolHelpersList>([&] AIPSTACK_TL(Helper, {
+            Helper::get(this)->recvIp4BatchEnd();
+        }));
+        
+        endTxBatch();
+    }
+    
+    // Receive segment coalescing (GRO). Within a receive batch, consecutive
+    // in-sequence TCP data segments of the same connection are collected and
+    // passed to TCP as a single segment when the batch ends or a segment which
+    // cannot be coalesced arrives. The driver keeps the buffers of the batch
+    // valid until the end of the batch, so the data is not copied.
+    static void gro_input (IpRxInfoIp4<Arg> ip_info, IpBufRef dgram)
+    {
+        IpStack *stack = ip_info.iface->m_stack;
+        GroState &gro = stack->m_gro;
+        
+        // Process the packet normally unless it is a candidate for coalescing,
+        // but flush any coalesced segments first to preserve ordering.
+        if (gro.flushing || !gro_is_candidate(ip_info, dgram)) {
+            stack->gro_flush();
+            return recvIp4Dgram(ip_info, dgram);
+        }
+        
+        // The checksum has been verified in gro_is_candidate.
+        ip_info.chksum_verified |= IpChksumOffloadFlags::Tcp4;
+        
+        auto tcp_header = Tcp4Header::MakeRef(dgram.getChunkPtr());
+        TcpSeqNum seq_num = tcp_header.get(Tcp4Header::SeqNum());
+        std::size_t hdr_len =
+            gro_tcp_header_len(tcp_header.get(Tcp4Header::OffsetFlags()));
+        std::size_t data_len = dgram.tot_len - hdr_len;
+        
+        // Check if the segment continues the collected ones.
+        bool append = false;
+        if (gro.num_segs > 0) {
+            auto first_header = Tcp4Header::MakeRef(gro.nodes[0].ptr);
+            append =
+                ip_info.iface == gro.ip_info.iface &&
+                ip_info.src_addr == gro.ip_info.src_addr &&
+                ip_info.dst_addr == gro.ip_info.dst_addr &&
+                ip_info.tos == gro.ip_info.tos &&
+                seq_num == gro.next_seq &&
+                gro.tot_len + data_len <= TypeMax<std::uint16_t> &&
+                std::memcmp(tcp_header.data, first_header.data,
+                            Tcp4Header::getOffset(Tcp4Header::SeqNum())) == 0 &&
+                tcp_header.get(Tcp4Header::AckNum()) ==
+                    first_header.get(Tcp4Header::AckNum()) &&
+                tcp_header.get(Tcp4Header::WindowSize()) ==
+                    first_header.get(Tcp4Header::WindowSize()) &&
+                hdr_len == gro_tcp_header_len(
+                    first_header.get(Tcp4Header::OffsetFlags())) &&
+                std::memcmp(tcp_header.data + Tcp4Header::Size,
+                            first_header.data + Tcp4Header::Size,
+                            hdr_len - Tcp4Header::Size) == 0;
+        }
+        
+        if (append) {
+            gro.nodes[gro.num_segs++] =
+                IpBufNode{dgram.getChunkPtr() + hdr_len, data_len, nullptr};
+            gro.tot_len += data_len;
+        } else {
+            stack->gro_flush();
+            gro.ip_info = ip_info;
+            gro.nodes[0] = IpBufNode{dgram.getChunkPtr(), dgram.tot_len, nullptr};
+            gro.num_segs = 1;
+            gro.tot_len = dgram.tot_len;
+        }
+        gro.next_seq = seq_num + TcpSeqInt(data_len);
+        
+        // Flush if a PSH was received or there is no space for more segments.
+        Tcp4Flags flags = tcp_header.get(Tcp4Header::OffsetFlags());
+        if ((flags & Tcp4Flags::Psh) != Enum0 || gro.num_segs == GroMaxSegs) {
+            stack->gro_flush();
+        }
+    }
+    
+    static bool gro_is_candidate (IpRxInfoIp4<Arg> const &ip_info, IpBufRef dgram)
+    {
+        // We only coalesce TCP segments with data contained in a single buffer.
+        if (ip_info.proto != Ip4Protocol::Tcp ||
+            dgram.tot_len <= Tcp4Header::Size || dgram.getChunkLength() < dgram.tot_len)
+        {
+            return false;
+        }
+        
+        // Only the ACK and possibly PSH flags may be set. There must be no options
+        // other than the timestamps option in the recommended layout (RFC 7323
+        // Appendix A), which is present in all segments if timestamps are used.
+        auto tcp_header = Tcp4Header::MakeRef(dgram.getChunkPtr());
+        Tcp4Flags flags = tcp_header.get(Tcp4Header::OffsetFlags()) & ~Tcp4Flags::Psh;
+        if (flags == (Tcp4EncodeOffset(5) | Tcp4Flags::Ack)) {
+            // No options.
+        }
+        else if (flags == (Tcp4EncodeOffset(8) | Tcp4Flags::Ack)) {
+            // There must be data after the options.
+            if (dgram.tot_len <= Tcp4Header::Size + GroTsOptLen) {
+                return false;
+            }
+            
+            // Check for NOP, NOP, Timestamps with length 10.
+            char const *opt = tcp_header.data + Tcp4Header::Size;
+            if (ReadSingleField<std::uint32_t>(opt) != 0x0101080a) {
+                return false;
+            }
+        }
+        else {
+            return false;
         }
         
-        // Get a reference to the IP header.
-        auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
+        // Verify the checksum here since it cannot be verified after coalescing.
+        // A segment with a bad checksum is left for TCP to drop.
+        if ((ip_info.chksum_verified & IpChksumOffloadFlags::Tcp4) == Enum0) {
+            IpChksumAccumulator chksum;
+            chksum.addWord(WrapType<std::uint32_t>(), ip_info.src_addr.value());
+            chksum.addWord(WrapType<std::uint32_t>(), ip_info.dst_addr.value());
+            chksum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Tcp));
+            chksum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
+            if (chksum.getChksum(dgram) != 0) {
+                return false;
+            }
+        }
         
-        // We will be calculating the header checksum inline.
-        IpChksumAccumulator chksum;
+        return true;
+    }
+    
+    // Length of aligned TCP timestamps option allowed in coalesced segments.
+    inline static constexpr std::size_t GroTsOptLen = 12;
+    
+    // Get the TCP header length of a segment accepted by gro_is_candidate.
+    inline static std::size_t gro_tcp_header_len (Tcp4Flags offset_flags)
+    {
+        return (AsUnderlying(offset_flags) >> TcpOffsetShift) * 4;
+    }
+    
+    void gro_flush ()
+    {
+        if (m_gro.num_segs == 0) {
+            return;
+        }
         
-        // Read Version+IHL+DSCP+ECN and add to checksum.
-        std::uint16_t version_ihl_dscp_ecn = ip4_header.get(Ip4Header::VersionIhlDscpEcn());
-        chksum.addWord(WrapType<std::uint16_t>(), version_ihl_dscp_ecn);
+        // Link the nodes of the coalesced segments.
+        for (std::uint8_t i = 0; i + 1 < m_gro.num_segs; i++) {
+            m_gro.nodes[i].next = &m_gro.nodes[i + 1];
+        }
         
-        // Check IP version and header length...
-        std::uint8_t version_ihl = version_ihl_dscp_ecn >> 8;
-        std::uint8_t header_len;
+        IpBufRef dgram{&m_gro.nodes[0], 0, m_gro.tot_len};
         
-        // Fast path is that the version is correctly 4 and the header
-        // length is minimal (5 words = 20 bytes).
-        if (AIPSTACK_LIKELY(version_ihl == ((4 << Ip4VersionShift) | 5))) {
-            // Header length is minimal, no options. There is no need to check
-            // pkt.hasHeader(header_len) since that was already done above.
-            header_len = Ip4Header::Size;
-        } else {
-            // Check IP version.
-            if (AIPSTACK_UNLIKELY((version_ihl >> Ip4VersionShift) != 4)) {
-                return;
-            }
-            
-            // Check header length.
-            // We require the entire header to fit into the first buffer.
-            header_len = (version_ihl & Ip4IhlMask) * 4;
-            if (AIPSTACK_UNLIKELY(header_len < Ip4Header::Size ||
-                                 !pkt.hasHeader(header_len)))
-            {
-                return;
-            }
-            
-            // Add options to checksum.
-            chksum.addEvenBytes(ip4_header.data + Ip4Header::Size,
-                                header_len - Ip4Header::Size);
+        // The data is no longer in a single receive buffer if coalesced.
+        IpRxInfoIp4<Arg> ip_info = m_gro.ip_info;
+        if (m_gro.num_segs > 1) {
+            ip_info.rx_buf = nullptr;
         }
         
-        // Read total length and add to checksum.
-        std::uint16_t total_len = ip4_header.get(Ip4Header::TotalLen());
-        chksum.addWord(WrapType<std::uint16_t>(), total_len);
+        // Process the segment. Packets received from within this processing
+        // bypass coalescing since the nodes are in use.
+        m_gro.num_segs = 0;
+        m_gro.flushing = true;
+        recvIp4Dgram(ip_info, dgram);
+        m_gro.flushing = false;
+    }
+    
+    // Determine whether a packet received through an interface is to be processed
+    // locally rather than forwarded. Packets received through an interface without
+    // an address (e.g. during DHCP) are always processed locally.
+    AIPSTACK_ALWAYS_INLINE
+    bool ip4_dst_is_local (Iface *iface, Ip4Addr dst_addr)
+    {
+        if (AIPSTACK_LIKELY(iface->ip4AddrIsLocalAddr(dst_addr)) || !iface->m_have_addr) {
+            return true;
+        }
         
-        // Check total length.
-        if (AIPSTACK_UNLIKELY(total_len < header_len || total_len > pkt.tot_len)) {
-            return;
+        return ip4_dst_is_local_slow(iface, dst_addr);
+    }
+    
+    AIPSTACK_NO_INLINE
+    bool ip4_dst_is_local_slow (Iface *iface, Ip4Addr dst_addr)
+    {
+        if (dst_addr.isAllOnesOrMulticast() || iface->ip4AddrIsLocalBcast(dst_addr)) {
+            return true;
         }
         
-        // Create a reference to the payload.
-        IpBufRef dgram = pkt.hideHeader(header_len).subTo(total_len - header_len);
+        // Addresses of other interfaces are local too.
+        if constexpr (SingleIface) {
+            return false;
+        } else {
+            return find_iface_with_addr(dst_addr) != nullptr;
+        }
+    }
+    
+    // Find an interface which has the given address assigned.
+    Iface * find_iface_with_addr (Ip4Addr addr)
+    {
+        for (Iface *iface = m_iface_list.first(); iface != nullptr;
+             iface = m_iface_list.next(*iface))
+        {
+            if (iface->ip4AddrIsLocalAddr(addr)) {
+                return iface;
+            }
+        }
         
-        // Add ident and header checksum to checksum.
-        chksum.addWord(WrapType<std::uint16_t>(), ip4_header.get(Ip4Header::Ident()));
-        chksum.addWord(WrapType<std::uint16_t>(),
-                       ip4_header.get(Ip4Header::HeaderChksum()));
+        return nullptr;
+    }
+    
+    // Forward a received packet which is not addressed to this host. The packet
+    // is transmitted from the receive buffer, with only the TTL and header
+    // checksum updated in place.
+    AIPSTACK_NO_INLINE
+    void forward_ip4_packet (Iface *in_iface, IpBufRef pkt, std::uint8_t header_len,
+        Ip4Addr src_addr, Ip4Addr dst_addr, std::uint8_t ttl, Ip4Protocol proto,
+        Ip4Flags flags_offset)
+    {
+        // Do not forward packets with a bad source address.
+        if (src_addr.isAllOnesOrMulticast() || src_addr.isZero() ||
+            in_iface->ip4AddrIsLocalBcast(src_addr))
+        {
+            return traceDrop(IpDropReason::BadSrcAddr, in_iface, pkt);
+        }
         
-        // Read TTL and protocol number and add to checksum.
-        std::uint8_t ttl = ip4_header.get(Ip4Header::Ttl());
-        Ip4Protocol proto = ip4_header.get(Ip4Header::Proto());
-        chksum.addWordOctets(ttl, AsUnderlying(proto));
+        // If the TTL would reach zero, drop the packet and report that.
+        if (ttl <= 1) {
+            traceDrop(IpDropReason::ForwardTtlExceeded, in_iface, pkt);
+            send_forward_icmp(in_iface, pkt, header_len, src_addr,
+                Icmp4Type::TimeExceeded, Icmp4Code::TimeExceededTtl, Icmp4RestType());
+            return;
+        }
         
-        // Read addresses and add to checksum
-        Ip4Addr src_addr = ip4_header.get(Ip4Header::SrcAddr());
-        chksum.addWord(WrapType<std::uint32_t>(), src_addr.value());
-        Ip4Addr dst_addr = ip4_header.get(Ip4Header::DstAddr());
-        chksum.addWord(WrapType<std::uint32_t>(), dst_addr.value());
+        // Find the route, drop the packet if there is none.
+        RouteEntry *route = find_route(dst_addr, nullptr);
+        if (route == nullptr) {
+            return traceDrop(IpDropReason::ForwardNoRoute, in_iface, pkt);
+        }
+        Iface *out_iface = route->iface;
+        Ip4Addr hop_addr = route->have_gateway ? route->gateway : dst_addr;
         
-        // Get flags+offset and add to checksum.
-        Ip4Flags flags_offset = ip4_header.get(Ip4Header::FlagsOffset());
-        chksum.addWord(WrapType<std::uint16_t>(), AsUnderlying(flags_offset));
+        // Do not forward directed broadcasts.
+        if (out_iface->ip4AddrIsLocalBcast(dst_addr)) {
+            return traceDrop(IpDropReason::BadDstAddr, in_iface, pkt);
+        }
         
-        // Verify IP header checksum.
-        if (AIPSTACK_UNLIKELY(chksum.getChksum() != 0)) {
+        // Packets are not fragmented when forwarding. If the packet is too large,
+        // report that if the DF flag is set (needed for Path MTU Discovery), and
+        // drop it.
+        if (pkt.tot_len > out_iface->getMtu()) {
+            traceDrop(IpDropReason::ForwardTooBig, in_iface, pkt);
+            if ((flags_offset & Ip4Flags::DF) != Enum0) {
+                send_forward_icmp(in_iface, pkt, header_len, src_addr,
+                    Icmp4Type::DestUnreach, Icmp4Code::DestUnreachFragNeeded,
+                    Icmp4MakeMtuRest(out_iface->getMtu()));
+            }
             return;
         }
         
-        // Check if the more-fragments flag is set or the fragment offset is nonzero.
-        if (AIPSTACK_UNLIKELY((flags_offset & (Ip4Flags::MF|Ip4Flags::OffsetMask)) != Enum0)) {
-            // Only accept fragmented packets which are unicasts to the
-            // incoming interface address. This is to prevent filling up
-            // our reassembly buffers with irrelevant packets. Note that
-            // we don't check this for non-fragmented packets for
-            // performance reasons, it generally up to protocol handlers.
-            if (!iface->ip4AddrIsLocalAddr(dst_addr)) {
+        // Decrement the TTL and update the header checksum incrementally.
+        auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
+        std::uint8_t new_ttl = ttl - 1;
+        ip4_header.set(Ip4Header::Ttl(), new_ttl);
+        ip4_header.set(Ip4Header::HeaderChksum(), IpChksumUpdate(
+            ip4_header.get(Ip4Header::HeaderChksum()), WrapType<std::uint16_t>(),
+            std::uint16_t((std::uint16_t(ttl) << 8) | AsUnderlying(proto)),
+            std::uint16_t((std::uint16_t(new_ttl) << 8) | AsUnderlying(proto))));
+        
+        // Send the packet through the outgoing interface.
+        m_stats.inc(&IpStackStats::forw_datagrams);
+        driver_send_ip4_packet(out_iface, pkt, hop_addr, /*retryReq=*/nullptr);
+    }
+    
+    // Send an ICMP error message for a packet which could not be forwarded,
+    // subject to rate limiting.
+    void send_forward_icmp (Iface *in_iface, IpBufRef pkt, std::uint8_t header_len,
+        Ip4Addr src_addr, Icmp4Type type, Icmp4Code code, Icmp4RestType rest)
+    {
+        // Do not send ICMP errors for non-first fragments or for ICMP errors
+        // (RFC 1812 section 4.3.2.7).
+        auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
+        if ((ip4_header.get(Ip4Header::FlagsOffset()) & Ip4Flags::OffsetMask) != Enum0) {
+            return;
+        }
+        if (ip4_header.get(Ip4Header::Proto()) == Ip4Protocol::Icmp) {
+            IpBufRef icmp_data = pkt.hideHeader(header_len);
+            if (!icmp_data.hasHeader(Icmp4Header::Size)) {
                 return;
             }
-            
-            // Get the more-fragments flag and the fragment offset in bytes.
-            bool more_fragments = (flags_offset & Ip4Flags::MF) != Enum0;
-            std::uint16_t fragment_offset =
-                std::uint16_t(flags_offset & Ip4Flags::OffsetMask) * 8;
-            
-            // Perform reassembly.
-            if (!iface->m_stack->m_reassembly.reassembleIp4(
-                ip4_header.get(Ip4Header::Ident()), src_addr, dst_addr, ttl, proto,
-                more_fragments, fragment_offset, ip4_header.data, dgram))
-            {
+            Icmp4Type icmp_type =
+                Icmp4Header::MakeRef(icmp_data.getChunkPtr()).get(Icmp4Header::Type());
+            if (icmp_type != Icmp4Type::EchoRequest && icmp_type != Icmp4Type::EchoReply) {
                 return;
             }
-            // Continue processing the reassembled datagram.
-            // Note, dgram was modified pointing to the reassembled data.
         }
         
-        // Create the IpRxInfoIp4 struct.
-        IpRxInfoIp4<Arg> ip_info{src_addr, dst_addr, ttl, proto, iface, header_len};
-
-        // Do the real processing now that the datagram is complete and
-        // sanity checked.
-        recvIp4Dgram(ip_info, dgram);
+        if (!m_fwd_icmp_limiter.allow(platform().getEventTime(), src_addr)) {
+            return;
+        }
+        
+        // Include the IP header and up to 8 data bytes as required by RFC 792.
+        std::size_t data_len =
+            std::size_t(header_len) + MinValue(std::size_t(8), pkt.tot_len - header_len);
+        
+        Ip4AddrPair addrs = {in_iface->m_addr.addr, src_addr};
+        sendIcmp4Message(addrs, in_iface, type, code, rest, pkt.subTo(data_len));
     }
     
     static void recvIp4Dgram (IpRxInfoIp4<Arg> ip_info, IpBufRef dgram)
     {
         // Pass to interface listeners. If any listener accepts the
-        // packet, inhibit further processing.
-        for (IfaceListener *lis = ip_info.iface->m_listeners_list.first();
-             lis != nullptr; lis = ip_info.iface->m_listeners_list.next(*lis))
-        {
-            if (lis->m_proto == ip_info.proto) {
-                if (AIPSTACK_UNLIKELY(lis->m_ip4_handler(ip_info, dgram))) {
-                    return;
+        // packet, inhibit further processing. The listener list is only
+        // scanned if there are listeners for this protocol.
+        if (AIPSTACK_UNLIKELY(ip_info.iface->has_listeners_for_proto(ip_info.proto))) {
+            for (IfaceListener *lis = ip_info.iface->m_listeners_list.first();
+                 lis != nullptr; lis = ip_info.iface->m_listeners_list.next(*lis))
+            {
+                if (lis->m_proto == ip_info.proto) {
+                    if (AIPSTACK_UNLIKELY(lis->m_ip4_handler(ip_info, dgram))) {
+                        ip_info.iface->m_stack->m_stats.inc(&IpStackStats::in_delivers);
+                        return;
+                    }
                 }
             }
         }
         
-        // Handle using a protocol listener if existing.
-        bool not_handled = ListForBreak<ProtocolHelpersList>(
-            [&] AIPSTACK_TL(Helper,
-        {
-            if (ip_info.proto == Helper::IpProtocolNumber) {
-                Helper::get(ip_info.iface->m_stack)->recvIp4Dgram(
-                    static_cast<IpRxInfoIp4<Arg> const &>(ip_info),
-                    static_cast<IpBufRef>(dgram));
-                return false;
-            }
-            return true;
-        }));
+        IpStack *stack = ip_info.iface->m_stack;
         
-        // If the packet was handled by a protocol handler, we are done.
-        if (!not_handled) {
-            return;
+        // Handle using a protocol handler if existing. Most packets are for
+        // a protocol handler (TCP or UDP).
+        int proto_index = ProtocolDispatch::ProtoIndexTable.index[
+            std::uint8_t(ip_info.proto)];
+        if (AIPSTACK_LIKELY(proto_index < NumProtocols)) {
+            stack->m_stats.inc(&IpStackStats::in_delivers);
+            stack->traceLatency(IpLatencyStage::ProtoDemux);
+            return ProtocolDispatch::RecvIp4DgramFuncs[proto_index](
+                stack, ip_info, dgram);
         }
         
         // Handle ICMP packets.
         if (ip_info.proto == Ip4Protocol::Icmp) {
+            stack->m_stats.inc(&IpStackStats::in_delivers);
             return recvIcmp4Dgram(ip_info, dgram);
         }
+        
+        // Handle IGMP packets.
+        if (ip_info.proto == Ip4Protocol::Igmp) {
+            stack->m_stats.inc(&IpStackStats::in_delivers);
+            return ip_info.iface->recv_igmp(dgram);
+        }
+        
+        stack->m_stats.inc(&IpStackStats::in_unknown_protos);
+        stack->traceDrop(IpDropReason::UnknownProtocol, ip_info.iface, dgram);
     }
     
     static void recvIcmp4Dgram (IpRxInfoIp4<Arg> const &ip_info, IpBufRef const &dgram)
     {
+        IpStack *stack = ip_info.iface->m_stack;
+        
         // Sanity check source address - reject broadcast addresses.
         if (AIPSTACK_UNLIKELY(!checkUnicastSrcAddr(ip_info))) {
-            return;
+            return stack->traceDrop(IpDropReason::BadSrcAddr, ip_info.iface, dgram);
         }
         
         // Check destination address.
@@ -1107,14 +2722,17 @@ private:
                 !ip_info.iface->ip4AddrIsLocalBcast(ip_info.dst_addr) &&
                 ip_info.dst_addr != Ip4Addr::AllOnesAddr()))
             {
-                return;
+                return stack->traceDrop(IpDropReason::BadDstAddr, ip_info.iface, dgram);
             }
             is_broadcast_dst = true;
         }
         
+        stack->m_stats.inc(&IpStackStats::icmp_in_msgs);
+        
         // Check ICMP header length.
         if (AIPSTACK_UNLIKELY(!dgram.hasHeader(Icmp4Header::Size))) {
-            return;
+            stack->m_stats.inc(&IpStackStats::icmp_in_errors);
+            return stack->traceDrop(IpDropReason::IcmpHeaderInvalid, ip_info.iface, dgram);
         }
         
         // Read ICMP header fields.
@@ -1126,38 +2744,53 @@ private:
         // Verify ICMP checksum.
         std::uint16_t calc_chksum = IpChksum(dgram);
         if (AIPSTACK_UNLIKELY(calc_chksum != 0)) {
-            return;
+            stack->m_stats.inc(&IpStackStats::icmp_in_errors);
+            return stack->traceDrop(IpDropReason::IcmpChksumBad, ip_info.iface, dgram);
         }
         
         // Get ICMP data by hiding the ICMP header.
         IpBufRef icmp_data = dgram.hideHeader(Icmp4Header::Size);
         
-        IpStack *stack = ip_info.iface->m_stack;
-        
         if (type == Icmp4Type::EchoRequest) {
+            stack->m_stats.inc(&IpStackStats::icmp_in_echos);
+            
             // Got echo request, send echo reply.
             // But if this is a broadcast request, respond only if allowed.
             if (is_broadcast_dst && !AllowBroadcastPing) {
                 return;
             }
-            stack->sendIcmp4EchoReply(rest, icmp_data, ip_info.src_addr, ip_info.iface);
+            stack->sendIcmp4EchoReply(rest, icmp_data, ip_info.src_addr,
+                                      ip_info.dst_addr, ip_info.iface);
         }
         else if (type == Icmp4Type::DestUnreach) {
+            stack->m_stats.inc(&IpStackStats::icmp_in_dest_unreachs);
             stack->handleIcmp4DestUnreach(code, rest, icmp_data, ip_info.iface);
         }
     }
     
-    void sendIcmp4EchoReply (
-        Icmp4RestType rest, IpBufRef data, Ip4Addr dst_addr, Iface *iface)
+    void sendIcmp4EchoReply (Icmp4RestType rest, IpBufRef data, Ip4Addr dst_addr,
+        Ip4Addr request_dst_addr, Iface *iface)
     {
         AIPSTACK_ASSERT(iface != nullptr);
 
-        // Can only reply when we have an address assigned.
-        if (AIPSTACK_UNLIKELY(!iface->m_have_addr)) {
+        // Reply from the additional address if the request was sent to one,
+        // otherwise from the interface address, which must be assigned.
+        Ip4Addr src_addr;
+        if (AIPSTACK_UNLIKELY(iface->ip4AddrIsExtraAddr(request_dst_addr))) {
+            src_addr = request_dst_addr;
+        } else {
+            if (AIPSTACK_UNLIKELY(!iface->m_have_addr)) {
+                return;
+            }
+            src_addr = iface->m_addr.addr;
+        }
+        
+        // Apply the rate limit for echo replies.
+        if (!m_icmp_echo_limiter.allow(platform().getEventTime(), dst_addr)) {
             return;
         }
         
-        Ip4AddrPair addrs = {iface->m_addr.addr, dst_addr};
+        Ip4AddrPair addrs = {src_addr, dst_addr};
         sendIcmp4Message(addrs, iface, Icmp4Type::EchoReply, Icmp4Code::Zero, rest, data);
     }
 
@@ -1165,8 +2798,11 @@ private:
         Icmp4Type type, Icmp4Code code, Icmp4RestType rest, IpBufRef data)
     {
         // Allocate memory for headers.
-        TxAllocHelper<Icmp4Header::Size, HeaderBeforeIp4Dgram>
-            dgram_alloc(Icmp4Header::Size);
+        TxAllocHelperSelect<IcmpUseTxArena, Icmp4Header::Size, HeaderBeforeIp4Dgram>
+            dgram_alloc(m_tx_arena, Icmp4Header::Size);
+        if (AIPSTACK_UNLIKELY(!dgram_alloc.isAllocated())) {
+            return IpErr::OutputBufferFull;
+        }
         
         // Write the ICMP header.
         auto icmp4_header = Icmp4Header::MakeRef(dgram_alloc.getPtr());
@@ -1184,6 +2820,18 @@ private:
         std::uint16_t calc_chksum = IpChksum(dgram);
         icmp4_header.set(Icmp4Header::Chksum(), calc_chksum);
         
+        // Count the message by type.
+        m_stats.inc(&IpStackStats::icmp_out_msgs);
+        if (type == Icmp4Type::EchoReply) {
+            m_stats.inc(&IpStackStats::icmp_out_echo_reps);
+        }
+        else if (type == Icmp4Type::DestUnreach) {
+            m_stats.inc(&IpStackStats::icmp_out_dest_unreachs);
+        }
+        else if (type == Icmp4Type::TimeExceeded) {
+            m_stats.inc(&IpStackStats::icmp_out_time_excds);
+        }
+        
         // Send the datagram.
         return sendIp4Dgram(dgram, iface, /*retryReq=*/nullptr,
             Ip4CommonSendParams{addrs, IcmpTTL, Ip4Protocol::Icmp, IpSendFlags()});
@@ -1198,8 +2846,8 @@ private:
         }
         
         // Read IP header fields.
-        auto ip4_header = Ip4Header::MakeRef(icmp_data.getChunkPtr());
-        std::uint8_t version_ihl = ip4_header.get(Ip4Header::VersionIhlDscpEcn()) >> 8;
+        auto ip4_header = Ip4Header::Decode(icmp_data.getChunkPtr());
+        std::uint16_t version_ihl_dscp_ecn = ip4_header.get(Ip4Header::VersionIhlDscpEcn());
         std::uint16_t total_len  = ip4_header.get(Ip4Header::TotalLen());
         std::uint8_t ttl         = ip4_header.get(Ip4Header::Ttl());
         Ip4Protocol proto        = ip4_header.get(Ip4Header::Proto());
@@ -1207,6 +2855,7 @@ private:
         Ip4Addr dst_addr         = ip4_header.get(Ip4Header::DstAddr());
         
         // Check IP version.
+        std::uint8_t version_ihl = version_ihl_dscp_ecn >> 8;
         if (AIPSTACK_UNLIKELY((version_ihl >> Ip4VersionShift) != 4)) {
             return;
         }
@@ -1229,30 +2878,49 @@ private:
         Ip4DestUnreachMeta du_meta = {code, rest};
         
         // Create the IpRxInfoIp4 struct.
-        IpRxInfoIp4<Arg> ip_info{src_addr, dst_addr, ttl, proto, iface, header_len};
+        IpRxInfoIp4<Arg> ip_info{
+            src_addr, dst_addr, ttl, proto, std::uint8_t(version_ihl_dscp_ecn), iface,
+            header_len, IpChksumOffloadFlags(), /*rx_buf=*/nullptr, IpRxTimestamp()};
         
         // Get the included IP data.
         std::size_t data_len = MinValueU(icmp_data.tot_len, total_len) - header_len;
         IpBufRef dgram_initial = icmp_data.hideHeader(header_len).subTo(data_len);
         
         // Dispatch based on the protocol.
-        ListForBreak<ProtocolHelpersList>([&] AIPSTACK_TL(Helper, {
-            if (ip_info.proto == Helper::IpProtocolNumber) {
-                Helper::get(this)->handleIp4DestUnreach(
-                    static_cast<Ip4DestUnreachMeta const &>(du_meta),
-                    static_cast<IpRxInfoIp4<Arg> const &>(ip_info),
-                    static_cast<IpBufRef>(dgram_initial));
-                return false;
-            }
-            return true;
-        }));
+        int proto_index = ProtocolDispatch::ProtoIndexTable.index[
+            std::uint8_t(ip_info.proto)];
+        if (proto_index < NumProtocols) {
+            ProtocolDispatch::HandleIp4DestUnreachFuncs[proto_index](
+                this, du_meta, ip_info, dgram_initial);
+        }
     }
     
 private:
+    // Placeholder for m_drop_handler if drop tracing is disabled.
+    struct NoDropHandler {};
+    
     Reassembly m_reassembly;
     PathMtuCache m_path_mtu_cache;
     StructureRaiiWrapper<IfaceList> m_iface_list;
+    StructureRaiiWrapper<TxFlushIfaceList> m_tx_flush_list;
+    Iface *m_loopback_iface;
+    StructureRaiiWrapper<typename RouteIndex::Index> m_route_index;
+    std::size_t m_num_routes_by_prefix[Ip4Addr::Bits + 1];
+    std::uint32_t m_route_gen;
     std::uint16_t m_next_id;
+    IcmpEchoRateLimiter m_icmp_echo_limiter;
+    IcmpErrorRateLimiter m_icmp_error_limiter;
+    FwdIcmpRateLimiter m_fwd_icmp_limiter;
+    IpStatsCounters<EnableStats, IpStackStats> m_stats;
+    std::conditional_t<EnableDropTrace, DropHandler, NoDropHandler> m_drop_handler;
+    TxTimestampHandler m_tx_timestamp_handler;
+    IpLatencyTracer<PlatformImpl, LatencyTraceInterval> m_latency_tracer;
+    alignas(std::max_align_t) char m_tx_arena_mem[TxArenaSize > 0 ? TxArenaSize : 1];
+    TxArena m_tx_arena;
+    GroState m_gro;
+    std::size_t m_tx_batch_depth;
+    std::size_t m_num_rx_filter_rules;
+    RxFilterRule m_rx_filter_rules[NumRxFilterRules > 0 ? NumRxFilterRules : 1];
     InstantiateVariadic<ResourceTuple, ProtocolsList> m_protocols;
 };
 
@@ -1281,6 +2949,175 @@ struct IpStackOptions {
      */
     AIPSTACK_OPTION_DECL_VALUE(AllowBroadcastPing, bool, false)
     
+    /**
+     * Size of the transmit arena in bytes (see @ref IpStack::getTxArena).
+     * 
+     * This is zero by default so that no memory is used when no sender is configured
+     * to use the arena. It must be large enough for the largest set of allocations
+     * which may be outstanding at the same time, otherwise sends will fail.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(TxArenaSize, std::size_t, 0)
+    
+    /**
+     * Whether to allocate outgoing ICMP headers from the transmit arena.
+     * 
+     * If false, they are allocated on the stack using @ref TxAllocHelper.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IcmpUseTxArena, bool, false)
+    
+    /**
+     * Maximum number of TCP segments to coalesce within a receive batch.
+     * 
+     * If nonzero, consecutive in-sequence TCP data segments of the same connection
+     * which a driver delivers within a batch (see @ref IpDriverIface::beginRecvBatch)
+     * are passed to TCP as a single segment, so that acknowledgement and window
+     * processing is done once for the batch. Zero disables coalescing.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(GroMaxSegs, std::uint8_t, 0)
+    
+    /**
+     * Whether to forward received packets which are not addressed to this host.
+     * 
+     * If enabled, packets received through an interface with an address assigned,
+     * whose destination is not an address of any interface or a broadcast or
+     * multicast address, are forwarded according to the routing table (see
+     * @ref IpRoute). The TTL is decremented and the packet is transmitted directly
+     * from the receive buffer. Packets are not fragmented; packets too large for
+     * the outgoing interface are dropped. ICMP Time Exceeded and Fragmentation
+     * Needed messages are sent, rate limited by @ref ForwardIcmpBurst and
+     * @ref ForwardIcmpIntervalMs.
+     * 
+     * Drivers must reserve @ref HeaderBeforeIp bytes before the IP header of
+     * received packets, which is normally the case since link-layer headers are
+     * there, otherwise forwarded packets cannot be sent.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(EnableForwarding, bool, false)
+    
+    /**
+     * Maximum number of ICMP error messages for forwarded packets sent in a burst.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(ForwardIcmpBurst, std::uint8_t, 10)
+    
+    /**
+     * Interval in milliseconds for which one more ICMP error message for
+     * forwarded packets is allowed (in addition to the burst).
+     */
+    AIPSTACK_OPTION_DECL_VALUE(ForwardIcmpIntervalMs, std::uint32_t, 100)
+    
+    /**
+     * Maximum number of ICMP echo replies sent in a burst.
+     * 
+     * Echo requests received when no more replies are allowed are dropped and
+     * counted (see @ref IpStack::getIcmpRateLimitStats). Zero disables the limit.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IcmpEchoBurst, std::uint8_t, 50)
+    
+    /**
+     * Interval in milliseconds for which one more ICMP echo reply is allowed
+     * (in addition to the burst).
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IcmpEchoIntervalMs, std::uint32_t, 10)
+    
+    /**
+     * Maximum number of ICMP Destination Unreachable messages sent by
+     * @ref IpStack::sendIp4DestUnreach in a burst.
+     * 
+     * Messages which are not allowed are not sent and counted (see
+     * @ref IpStack::getIcmpRateLimitStats). Zero disables the limit.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IcmpErrorBurst, std::uint8_t, 50)
+    
+    /**
+     * Interval in milliseconds for which one more ICMP Destination Unreachable
+     * message is allowed (in addition to the burst).
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IcmpErrorIntervalMs, std::uint32_t, 20)
+    
+    /**
+     * Number of token buckets for each kind of ICMP rate limit (must be \>0).
+     * 
+     * If greater than one, the bucket is selected by a hash of the address
+     * prefix (see @ref IcmpRateLimitPrefixLen) of the destination of the ICMP
+     * message, so that a single source of requests cannot use up the messages
+     * allowed for others.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IcmpRateLimitBuckets, std::size_t, 1)
+    
+    /**
+     * Length of the address prefix which selects the ICMP rate limit bucket
+     * (only relevant if @ref IcmpRateLimitBuckets is greater than one).
+     */
+    AIPSTACK_OPTION_DECL_VALUE(IcmpRateLimitPrefixLen, std::uint8_t, 24)
+    
+    /**
+     * Number of rules of the receive filter (see @ref IpStack::setRxFilterRule).
+     * 
+     * Zero removes the receive filter from the receive path.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(NumRxFilterRules, std::size_t, 0)
+    
+    /**
+     * Maximum number of additional IP addresses of each interface (see @ref
+     * IpIface::addIp4ExtraAddr).
+     * 
+     * The additional addresses are kept in a hash table in each interface so
+     * that checking whether a packet is addressed to the interface takes
+     * constant time. Zero removes the table and the related checks.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(NumIfaceExtraAddrs, std::size_t, 0)
+    
+    /**
+     * Whether to maintain statistics counters.
+     * 
+     * If enabled, the counters returned by @ref IpStack::getStats, @ref
+     * IpIface::getStats and the ARP counters of @ref EthIpIface::getArpStats
+     * are maintained. If disabled, the counters do not take any memory (other
+     * than possibly padding) and counting has no cost.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(EnableStats, bool, false)
+    
+    /**
+     * Whether to report dropped packets together with the reason.
+     * 
+     * If enabled, packets dropped in IP, ICMP, UDP and TCP input processing and
+     * packets which could not be passed to the interface driver are reported
+     * to the callback set by @ref IpStack::setDropHandler (see
+     * @ref IpDropReason). Additionally, if the macro
+     * `AIPSTACK_CONFIG_DROP_TRACE_USDT` is defined (Linux only, requires
+     * `<sys/sdt.h>`), the USDT probe `aipstack:drop` is fired with the reason
+     * and the data length as arguments. If disabled, the trace points compile
+     * to nothing.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(EnableDropTrace, bool, false)
+    
+    /**
+     * Sampling interval for latency tracing, or zero to disable it.
+     * 
+     * If nonzero, one of every this many received packets is sampled and the
+     * time at which its processing reaches each stage (see @ref
+     * IpLatencyStage) is recorded into histograms, which are returned by
+     * @ref IpStack::getLatencyStats. This shows how much of the latency is
+     * spent in driver queues, in the layers of the stack, in the application
+     * and on the way back to the driver. Together with receive timestamps
+     * (@ref IpRxTimestamp) it helps to tell whether latency outliers come from
+     * the stack or from the event loop. If disabled, the trace points compile
+     * to nothing.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(LatencyTraceInterval, std::uint32_t, 0)
+    
+    /**
+     * Whether the stack has at most one interface.
+     * 
+     * If enabled, only one @ref IpIface may exist at a time (including an
+     * @ref IpLoopbackIface). Routing (@ref IpStack::routeIp4 and
+     * @ref IpStack::routeIp4ForceIface, which also serve sending and
+     * @ref IpStack::selectLocalIp4Address) is then done directly from the
+     * address and gateway of the interface, without the routing table lookup,
+     * as long as no @ref IpRoute is installed. Checking whether a received
+     * packet is addressed to this host does not iterate the interfaces.
+     */
+    AIPSTACK_OPTION_DECL_VALUE(SingleIface, bool, false)
+    
     /**
      * Path MTU Discovery parameters/implementation.
      * 
@@ -1318,9 +3155,30 @@ class IpStackService {
     template<typename>
     friend class IpStack;
     
+    template<typename>
+    friend class IpStackInternalDefs;
+    
     AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, HeaderBeforeIp)
     AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpTTL)
     AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, AllowBroadcastPing)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, TxArenaSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpUseTxArena)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, GroMaxSegs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, EnableForwarding)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, ForwardIcmpBurst)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, ForwardIcmpIntervalMs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpEchoBurst)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpEchoIntervalMs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpErrorBurst)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpErrorIntervalMs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpRateLimitBuckets)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, IcmpRateLimitPrefixLen)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, NumRxFilterRules)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, NumIfaceExtraAddrs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, EnableStats)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, EnableDropTrace)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, LatencyTraceInterval)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpStackOptions, SingleIface)
     AIPSTACK_OPTION_CONFIG_TYPE(IpStackOptions, PathMtuCacheService)
     AIPSTACK_OPTION_CONFIG_TYPE(IpStackOptions, ReassemblyService)
     
@@ -25,7 +25,13 @@
 #ifndef AIPSTACK_IPSTACK_INTERNAL_DEFS_H
 #define AIPSTACK_IPSTACK_INTERNAL_DEFS_H
 
+#include <cstddef>
+#include <cstdint>
+
 #include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/ip/IpAddr.h>
 
 namespace AIpStack {
 
@@ -34,6 +40,34 @@ namespace AIpStack {
 template<typename> class IpStack;
 template<typename> class IpIface;
 template<typename> class IpIfaceListener;
+template<typename> class IpMcastMembership;
+template<typename> class IpRoute;
+template<typename> struct IpRouteEntry;
+
+// Key of routing table entries: the destination network and prefix length.
+struct IpRouteKey {
+    Ip4Addr net_addr;
+    std::uint8_t prefix;
+};
+
+class IpRouteKeyCompare {
+public:
+    static int CompareKeys (IpRouteKey const &op1, IpRouteKey const &op2)
+    {
+        if (op1.prefix != op2.prefix) {
+            return (op1.prefix < op2.prefix) ? -1 : 1;
+        }
+        if (op1.net_addr != op2.net_addr) {
+            return (op1.net_addr < op2.net_addr) ? -1 : 1;
+        }
+        return 0;
+    }
+    
+    static bool KeysAreEqual (IpRouteKey const &op1, IpRouteKey const &op2)
+    {
+        return op1.prefix == op2.prefix && op1.net_addr == op2.net_addr;
+    }
+};
 
 // This class provides some types that cannot be defined in IpStack because that
 // would cause circular dependency problems, e.g. from IpIface.
@@ -43,10 +77,33 @@ class IpStackInternalDefs
     template<typename> friend class IpStack;
     template<typename> friend class IpIface;
     template<typename> friend class IpIfaceListener;
+    template<typename> friend class IpMcastMembership;
+    template<typename> friend class IpRoute;
+    template<typename> friend struct IpRouteEntry;
 
 private:
+    // Whether statistics counters are maintained (IpStackOptions::EnableStats).
+    inline static constexpr bool EnableStats = Arg::Params::EnableStats;
+    
+    // Maximum number of additional interface addresses
+    // (IpStackOptions::NumIfaceExtraAddrs).
+    inline static constexpr std::size_t NumIfaceExtraAddrs =
+        Arg::Params::NumIfaceExtraAddrs;
+    
     using IfaceLinkModel = PointerLinkModel<IpIface<Arg>>;
     using IfaceListenerLinkModel = PointerLinkModel<IpIfaceListener<Arg>>;
+    using McastMembershipLinkModel = PointerLinkModel<IpMcastMembership<Arg>>;
+    
+    // Index of routing table entries by IpRouteKey. Duplicates are allowed
+    // since there may be multiple routes to the same network with different
+    // interfaces or metrics. The accessor and key functions are defined in
+    // IpRoute.h since they need IpRouteEntry to be complete.
+    using RouteLinkModel = PointerLinkModel<IpRouteEntry<Arg>>;
+    struct RouteIndexAccessor;
+    struct RouteIndexKeyFuncs;
+    AIPSTACK_MAKE_INSTANCE(RouteIndex, (AvlTreeIndexService::template Index<
+        RouteIndexAccessor, IpRouteKey const &, RouteIndexKeyFuncs, RouteLinkModel,
+        /*Duplicates=*/true>))
 };
 
 #endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_STACK_PRESETS_H
+#define AIPSTACK_IP_STACK_PRESETS_H
+
+#include <aipstack/infra/Options.h>
+#include <aipstack/structure/index/MruListIndex.h>
+#include <aipstack/structure/index/HashTableIndex.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/udp/IpUdpProto.h>
+#include <aipstack/eth/EthIpIface.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup configuration
+ * @{
+ */
+
+/**
+ * Configuration preset for small embedded systems.
+ * 
+ * A handful of TCP connections and ARP entries, with linked-list indices which
+ * have the smallest per-entry overhead and are fast enough at these sizes.
+ * 
+ * Like the other presets in this file, this contains options for
+ * @ref IpStackService (including its PMTU cache and reassembly services),
+ * @ref IpTcpProtoService, @ref IpUdpProtoService and @ref EthIpIfaceService, and
+ * is meant to be passed as the first template argument of each of these, followed
+ * by any overrides:
+ * 
+ * ```
+ * using MyIpStackService = AIpStack::IpStackService<AIpStack::EmbeddedProfile>;
+ * using MyTcpService = AIpStack::IpTcpProtoService<
+ *     AIpStack::EmbeddedProfile,
+ *     AIpStack::IpTcpProtoOptions::NumTcpPcbs::Is<8>
+ * >;
+ * ```
+ * 
+ * The memory used with each preset is reported by tests/preset_footprint.cpp.
+ */
+using EmbeddedProfile = ConfigOptionPreset<
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<8>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<MruListIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<
+            IpReassemblyOptions::MaxReassEntrys::Is<1>,
+            IpReassemblyOptions::MaxReassSize::Is<1480>,
+            IpReassemblyOptions::ReassIndexService::Is<MruListIndexService>
+        >
+    >,
+    IpTcpProtoOptions::NumTcpPcbs::Is<16>,
+    IpTcpProtoOptions::NumOosSegs::Is<4>,
+    IpTcpProtoOptions::PcbIndexService::Is<MruListIndexService>,
+    IpUdpProtoOptions::UdpIndexService::Is<MruListIndexService>,
+    IpUdpProtoOptions::NumListenerBuckets::Is<8>,
+    EthIpIfaceOptions::NumArpEntries::Is<8>,
+    EthIpIfaceOptions::ArpProtectCount::Is<4>,
+    EthIpIfaceOptions::TimersStructureService::Is<LinkedHeapService>,
+    EthIpIfaceOptions::ArpIndexService::Is<MruListIndexService>
+>;
+
+/**
+ * Configuration preset for servers handling many concurrent connections.
+ * 
+ * Thousands of TCP connections with hash table indices sized to match, a PCB
+ * timer wheel, a TIME-WAIT table, SYN cookies, ephemeral port bitmaps, receive
+ * coalescing and receive buffer auto-tuning, and caches large enough for busy
+ * subnets. See @ref EmbeddedProfile for usage.
+ */
+using ServerProfile = ConfigOptionPreset<
+    IpStackOptions::GroMaxSegs::Is<16>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<1024>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<HashTableIndexService<1024>>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<
+            IpReassemblyOptions::MaxReassEntrys::Is<16>,
+            IpReassemblyOptions::MaxReassSize::Is<60000>,
+            IpReassemblyOptions::MaxChainedReassEntrys::Is<16>
+        >
+    >,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4096>,
+    IpTcpProtoOptions::NumOosSegs::Is<32>,
+    IpTcpProtoOptions::OosBufferTree::Is<true>,
+    IpTcpProtoOptions::PcbIndexService::Is<HashTableIndexService<4096>>,
+    IpTcpProtoOptions::PcbTimerWheelSlots::Is<256>,
+    IpTcpProtoOptions::NumTimeWaitEntries::Is<4096>,
+    IpTcpProtoOptions::EnableSynCookies::Is<true>,
+    IpTcpProtoOptions::EphemeralPortBitmap::Is<true>,
+    IpTcpProtoOptions::RcvBufAutoTuning::Is<true>,
+    IpUdpProtoOptions::UdpIndexService::Is<HashTableIndexService<256>>,
+    IpUdpProtoOptions::NumListenerBuckets::Is<256>,
+    IpUdpProtoOptions::EphemeralPortBitmap::Is<true>,
+    EthIpIfaceOptions::NumArpEntries::Is<256>,
+    EthIpIfaceOptions::ArpProtectCount::Is<128>,
+    EthIpIfaceOptions::TimersStructureService::Is<LinkedHeapService>,
+    EthIpIfaceOptions::ArpIndexService::Is<HashTableIndexService<256>>,
+    EthIpIfaceOptions::NumArpPendingPackets::Is<16>
+>;
+
+/**
+ * Configuration preset for latency-sensitive applications.
+ * 
+ * A moderate number of connections with hash table indices. Receive coalescing
+ * and delayed ACKs are off so that every segment is processed and acknowledged
+ * immediately, RACK-TLP and Proportional Rate Reduction are enabled for fast and
+ * smooth loss recovery, and packets waiting for ARP resolution are queued rather
+ * than failing. See @ref EmbeddedProfile for usage.
+ */
+using LowLatencyProfile = ConfigOptionPreset<
+    IpStackOptions::GroMaxSegs::Is<0>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<64>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<HashTableIndexService<64>>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<
+            IpReassemblyOptions::MaxReassEntrys::Is<4>,
+            IpReassemblyOptions::MaxReassSize::Is<60000>
+        >
+    >,
+    IpTcpProtoOptions::NumTcpPcbs::Is<256>,
+    IpTcpProtoOptions::NumOosSegs::Is<8>,
+    IpTcpProtoOptions::PcbIndexService::Is<HashTableIndexService<256>>,
+    IpTcpProtoOptions::EnableDelayedAck::Is<false>,
+    IpTcpProtoOptions::EnableRackTlp::Is<true>,
+    IpTcpProtoOptions::EnablePrr::Is<true>,
+    IpUdpProtoOptions::UdpIndexService::Is<HashTableIndexService<64>>,
+    IpUdpProtoOptions::NumListenerBuckets::Is<64>,
+    EthIpIfaceOptions::NumArpEntries::Is<64>,
+    EthIpIfaceOptions::ArpProtectCount::Is<32>,
+    EthIpIfaceOptions::TimersStructureService::Is<LinkedHeapService>,
+    EthIpIfaceOptions::ArpIndexService::Is<HashTableIndexService<64>>,
+    EthIpIfaceOptions::NumArpPendingPackets::Is<8>
+>;
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IP_STACK_STATS_H
+#define AIPSTACK_IP_STACK_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup ip-stack
+ * @{
+ */
+
+/**
+ * Stack-wide counters of the IP layer, ICMP, reassembly and UDP, as returned by
+ * @ref IpStack::getStats.
+ * 
+ * The groups of counters follow the corresponding groups of the SNMP MIB-II
+ * (RFC 4293 and RFC 4113). The counters are only maintained if the
+ * @ref IpStackOptions::EnableStats option is enabled, otherwise they are all
+ * zero. The counters wrap around on overflow.
+ * 
+ * TCP counters (segments, retransmissions, resets, active and passive opens)
+ * are provided by @ref TcpApi::getStats, subject to the EnableStats option of
+ * the TCP protocol.
+ */
+struct IpStackStats {
+    // Received packets passed to the stack by interface drivers.
+    std::uint32_t in_receives = 0;
+    
+    // Received packets dropped due to an invalid IP version, header length,
+    // total length or header checksum.
+    std::uint32_t in_hdr_errors = 0;
+    
+    // Received packets dropped due to an unexpected destination address
+    // (a multicast group which is not joined or a fragment which is not
+    // addressed to the interface).
+    std::uint32_t in_addr_errors = 0;
+    
+    // Received packets dropped by the receive filter.
+    std::uint32_t in_filtered = 0;
+    
+    // Received datagrams for a protocol which is not supported.
+    std::uint32_t in_unknown_protos = 0;
+    
+    // Received datagrams passed to a protocol handler, ICMP, IGMP or an
+    // interface listener.
+    std::uint32_t in_delivers = 0;
+    
+    // Datagrams passed to the IP layer for sending by protocol handlers and
+    // ICMP (a super-segment passed to the driver as a single packet is
+    // counted once).
+    std::uint32_t out_requests = 0;
+    
+    // Datagrams not sent because there was no route.
+    std::uint32_t out_no_routes = 0;
+    
+    // Packets forwarded to another interface.
+    std::uint32_t forw_datagrams = 0;
+    
+    // Datagrams successfully fragmented.
+    std::uint32_t frag_oks = 0;
+    
+    // Datagrams not sent because fragmentation was needed but not allowed.
+    std::uint32_t frag_fails = 0;
+    
+    // Fragments sent as a result of fragmentation.
+    std::uint32_t frag_creates = 0;
+    
+    // Received fragments which needed reassembly.
+    std::uint32_t reasm_reqds = 0;
+    
+    // Datagrams successfully reassembled.
+    std::uint32_t reasm_oks = 0;
+    
+    // Datagrams whose reassembly was abandoned because of inconsistent
+    // fragments or lack of resources.
+    std::uint32_t reasm_fails = 0;
+    
+    // Datagrams whose reassembly was abandoned because it timed out.
+    std::uint32_t reasm_timeouts = 0;
+    
+    // Datagrams whose reassembly was abandoned to keep their source within its
+    // quota (see IpReassemblyOptions::MaxReassEntrysPerSource and
+    // MaxReassBytesPerSource), also counted in reasm_fails.
+    std::uint32_t reasm_quota_drops = 0;
+    
+    // Datagrams whose reassembly was abandoned early because they had too many
+    // holes or fragments, also counted in reasm_fails.
+    std::uint32_t reasm_hole_drops = 0;
+    
+    // Received ICMP messages, including those with errors.
+    std::uint32_t icmp_in_msgs = 0;
+    
+    // Received ICMP messages dropped due to a bad header or checksum.
+    std::uint32_t icmp_in_errors = 0;
+    
+    // Received ICMP Echo Request messages.
+    std::uint32_t icmp_in_echos = 0;
+    
+    // Received ICMP Destination Unreachable messages.
+    std::uint32_t icmp_in_dest_unreachs = 0;
+    
+    // ICMP messages passed to the IP layer for sending.
+    std::uint32_t icmp_out_msgs = 0;
+    
+    // Sent ICMP Echo Reply messages.
+    std::uint32_t icmp_out_echo_reps = 0;
+    
+    // Sent ICMP Destination Unreachable messages.
+    std::uint32_t icmp_out_dest_unreachs = 0;
+    
+    // Sent ICMP Time Exceeded messages.
+    std::uint32_t icmp_out_time_excds = 0;
+    
+    // Received UDP datagrams accepted by an association or listener.
+    std::uint32_t udp_in_datagrams = 0;
+    
+    // Received UDP datagrams not accepted by any association or listener.
+    std::uint32_t udp_no_ports = 0;
+    
+    // Received UDP datagrams dropped due to a bad length or checksum.
+    std::uint32_t udp_in_errors = 0;
+    
+    // UDP datagrams passed to the IP layer for sending (a super-datagram is
+    // counted once).
+    std::uint32_t udp_out_datagrams = 0;
+};
+
+/**
+ * Counters of a network interface, as returned by @ref IpIface::getStats.
+ * 
+ * The counters are only maintained if the @ref IpStackOptions::EnableStats
+ * option is enabled, otherwise they are all zero. The counters wrap around on
+ * overflow.
+ */
+struct IpIfaceStats {
+    // Received packets passed to the stack by the driver.
+    std::uint32_t in_receives = 0;
+    
+    // Bytes of received packets, including the IP header.
+    std::uint64_t in_octets = 0;
+    
+    // Received packets dropped due to an invalid IP header.
+    std::uint32_t in_hdr_errors = 0;
+    
+    // Received packets dropped for other reasons before they were delivered
+    // or forwarded (receive filter or unexpected destination address).
+    std::uint32_t in_discards = 0;
+    
+    // Packets accepted by the driver for sending (including fragments and
+    // forwarded packets, a super-segment is counted once).
+    std::uint32_t out_transmits = 0;
+    
+    // Bytes of packets accepted by the driver, including the IP header.
+    std::uint64_t out_octets = 0;
+    
+    // Packets for which the driver returned an error.
+    std::uint32_t out_discards = 0;
+    
+    // Packets which were not passed to the driver because its transmit queue
+    // was stopped (see @ref IpIfaceDriverParams::tx_queue).
+    std::uint32_t out_throttled = 0;
+};
+
+/**
+ * Memory usage of one subsystem, as part of @ref IpStackMemoryStats and
+ * similar structures of other modules.
+ * 
+ * Objects are the units which the subsystem allocates, such as cache entries or
+ * PCBs. The current values are determined when the statistics are requested.
+ * The peak values are only maintained if statistics are enabled (EnableStats
+ * option of the module), otherwise they are zero.
+ */
+struct IpMemoryUsage {
+    // Bytes of memory allocated statically for the subsystem, as determined by
+    // the configuration.
+    std::size_t static_bytes = 0;
+    
+    // Maximum number of objects.
+    std::size_t capacity = 0;
+    
+    // Number of objects in use.
+    std::size_t used = 0;
+    
+    // Highest number of objects in use.
+    std::size_t peak_used = 0;
+    
+    // Bytes of memory held by the subsystem in addition to static_bytes, such as
+    // heap allocations, retained receive buffers or application buffers.
+    std::size_t dynamic_bytes = 0;
+    
+    // Highest value of dynamic_bytes.
+    std::size_t peak_dynamic_bytes = 0;
+};
+
+/**
+ * Memory usage of the IP layer, as returned by @ref IpStack::getMemoryStats.
+ * 
+ * Memory of TCP is provided by @ref TcpApi::getMemoryStats and that of the
+ * ARP cache by @ref EthIpIface::getArpMemoryUsage.
+ */
+struct IpStackMemoryStats {
+    // Size of the IpStack object, which includes the subsystems below and the
+    // protocol handlers (including statically allocated TCP PCBs).
+    std::size_t stack_bytes = 0;
+    
+    // Path MTU cache, objects are cache entries.
+    IpMemoryUsage path_mtu;
+    
+    // Reassembly, objects are datagrams being reassembled and dynamic memory
+    // is that of receive buffers retained for chained reassembly.
+    IpMemoryUsage reassembly;
+};
+
+/**
+ * Cache line size used for aligning blocks of statistics counters, so that they
+ * do not share a cache line with other data.
+ */
+inline constexpr std::size_t IpStatsCacheLineSize = 64;
+
+#ifndef IN_DOXYGEN
+
+// Holds a block of counters aligned to a cache line, or nothing if statistics
+// are disabled.
+template<bool Enabled, typename Counters>
+class alignas(IpStatsCacheLineSize) IpStatsCounters {
+    Counters m_counters = Counters();
+
+public:
+    inline void inc (std::uint32_t Counters::*counter)
+    {
+        m_counters.*counter += 1;
+    }
+    
+    template<typename CounterType>
+    inline void add (CounterType Counters::*counter, CounterType value)
+    {
+        m_counters.*counter += value;
+    }
+    
+    inline Counters get () const
+    {
+        return m_counters;
+    }
+};
+
+template<typename Counters>
+class IpStatsCounters<false, Counters> {
+public:
+    inline void inc (std::uint32_t Counters::*) {}
+    
+    template<typename CounterType>
+    inline void add (CounterType Counters::*, CounterType) {}
+    
+    inline Counters get () const
+    {
+        return Counters();
+    }
+};
+
+// Tracks the highest value of a quantity, or nothing if statistics are
+// disabled.
+template<bool Enabled>
+class IpMemoryPeak {
+    std::size_t m_peak = 0;
+
+public:
+    inline void update (std::size_t value)
+    {
+        if (value > m_peak) {
+            m_peak = value;
+        }
+    }
+    
+    inline std::size_t get () const
+    {
+        return m_peak;
+    }
+};
+
+template<>
+class IpMemoryPeak<false> {
+public:
+    inline void update (std::size_t) {}
+    
+    inline std::size_t get () const
+    {
+        return 0;
+    }
+};
+
+#endif
+
+/** @} */
+
+}
+
+#endif
@@ -30,6 +30,7 @@
 #include <aipstack/misc/EnumBitfieldUtils.h>
 #include <aipstack/misc/EnumUtils.h>
 #include <aipstack/infra/Chksum.h>
+#include <aipstack/infra/RxBufPool.h>
 #include <aipstack/proto/Ip4Proto.h>
 #include <aipstack/proto/Icmp4Proto.h>
 #include <aipstack/ip/IpAddr.h>
@@ -192,17 +193,17 @@ struct IpIfaceDriverState {
  * Note that internally in the implementation, standard IP flags (as in the IP
  * header) are used with this enum type for performance reasons. To support this,
  * the @ref IpSendFlags::DontFragmentFlag "DontFragmentFlag" flag has the same
- * value as the IP flag "DF" and the other (non-IP) flags defined here use low bits
+ * value as the IP flag "DF" and the other (non-IP) flags defined here use bits
  * which do not conflict with IP flags.
  */
-enum class IpSendFlags : std::uint16_t {
+enum class IpSendFlags : std::uint32_t {
     /**
      * Allow broadcast.
      * 
      * This flag is required in order to send to a local broadcast or all-ones address.
      * If it is set then sending to non-broadcast addresses is still allowed.
      */
-    AllowBroadcastFlag = std::uint16_t(1) << 0,
+    AllowBroadcastFlag = std::uint32_t(1) << 0,
 
     /**
      * Allow sending from from a non-local address.
@@ -210,7 +211,7 @@ enum class IpSendFlags : std::uint16_t {
      * This flag is required in order to send using a source address that is not the
      * address of the outgoing network interface.
      */
-    AllowNonLocalSrc = std::uint16_t(1) << 1,
+    AllowNonLocalSrc = std::uint32_t(1) << 1,
 
     /**
      * Do-not-fragment flag.
@@ -220,17 +221,70 @@ enum class IpSendFlags : std::uint16_t {
      */
     DontFragmentFlag = AsUnderlying(Ip4Flags::DF),
 
+    /**
+     * The TCP or UDP checksum field contains only the pseudo-header sum.
+     * 
+     * This flag is only supported by @ref IpStack::sendIp4Dgram and only for
+     * TCP and UDP datagrams. It indicates that the checksum field of the
+     * transport header contains the non-inverted one's complement sum of the
+     * pseudo-header, and that the checksum over the rest of the datagram
+     * still needs to be added (see @ref IpChksumOffloadFlags). The stack will
+     * leave this to the interface if it supports the corresponding transmit
+     * checksum offload and the datagram is not fragmented, otherwise it will
+     * complete the checksum in software.
+     */
+    ChksumPartialFlag = std::uint32_t(1) << 2,
+    
+    /**
+     * Mark the datagram as ECN-capable.
+     * 
+     * This sets the ECT(0) codepoint in the ECN field of the IP header
+     * (RFC 3168). It should only be used by transport protocols which
+     * react to congestion indicated by the CE codepoint.
+     */
+    EcnCapableFlag = std::uint32_t(1) << 3,
+    
+    /**
+     * Mask of the field which contains the DSCP value for the IP header.
+     * 
+     * The DSCP (RFC 2474) is sent in the outgoing datagrams and selects the
+     * priority class when an @ref IpEgressScheduler with multiple priority
+     * classes is used. The field is set using @ref IpSendFlagsDscp and is zero
+     * (the default class) unless set.
+     */
+    DscpMask = std::uint32_t(0x3F) << 16,
+    
     /**
      * Mask of all flags which may be passed to send functions.
      */
-    AllFlags = AllowBroadcastFlag|AllowNonLocalSrc|DontFragmentFlag,
+    AllFlags = AllowBroadcastFlag|AllowNonLocalSrc|ChksumPartialFlag|EcnCapableFlag|
+               DontFragmentFlag|DscpMask,
 };
 #ifndef IN_DOXYGEN
 AIPSTACK_ENUM_BITFIELD(IpSendFlags)
 #endif
 
+/**
+ * Get the send flags which specify a DSCP value.
+ * 
+ * The result is to be combined with other flags and is used for the
+ * @ref IpSendFlags::DscpMask field.
+ * 
+ * @param dscp DSCP value, must be less than 64.
+ * @return Send flags with the DSCP field set to dscp and other flags unset.
+ */
+inline constexpr IpSendFlags IpSendFlagsDscp (std::uint8_t dscp)
+{
+    return IpSendFlags(std::uint32_t(dscp & Ip4DscpMask) << 16);
+}
+
 #ifndef IN_DOXYGEN
 
+// Extract the DSCP value from IpSendFlags (for internal use).
+inline constexpr std::uint8_t IpDscpInSendFlags(IpSendFlags send_flags) {
+    return std::uint8_t((AsUnderlying(send_flags) >> 16) & Ip4DscpMask);
+}
+
 // Convert IP flags to IpSendFlags (for internal use).
 inline constexpr IpSendFlags IpFlagsToSendFlags(Ip4Flags flags) {
     return IpSendFlags(AsUnderlying(flags));
@@ -239,13 +293,101 @@ inline constexpr IpSendFlags IpFlagsToSendFlags(Ip4Flags flags) {
 // Extract only IP flags from IpSendFlags (for internal use).
 inline constexpr Ip4Flags IpFlagsInSendFlags(IpSendFlags send_flags) {
     // One might argue we should AND with 0xE000 but this is fine as
-    // well since we the defined flags in IpSendFlags use very low
-    // low bits, and may be a bit more efficient.
-    return Ip4Flags(AsUnderlying(send_flags) & 0xFF00);
+    // well since the other flags in IpSendFlags use very low bits or
+    // bits from 16 up, and may be a bit more efficient.
+    return Ip4Flags(std::uint16_t(AsUnderlying(send_flags) & 0xFF00));
 }
 
 #endif
 
+/**
+ * Checksum offload flags, used to describe checksum offload capabilities of
+ * interfaces and checksums verified by hardware for received packets.
+ * 
+ * For transmission, if an interface advertises @ref Tcp4 or @ref Udp4 in
+ * @ref IpIfaceDriverParams::tx_chksum_offload, then for all TCP or UDP
+ * (respectively) packets sent through that interface which are not IP fragments
+ * (neither the MF flag is set nor the fragment offset is nonzero), the checksum
+ * field of the transport header contains only the non-inverted one's complement
+ * sum of the pseudo-header. The driver (or hardware) must then calculate the
+ * checksum starting at the transport header (offset IHL*4) until the end of
+ * the IP datagram (as given by the total length) and store its inverse into the
+ * checksum field, at offset 16 for TCP and 6 for UDP; this corresponds to the
+ * `CHECKSUM_PARTIAL` semantics of Linux. For UDP, a resulting checksum of zero
+ * must be sent as 0xFFFF. See @ref IpDriverIface::getTxChksumPartial.
+ * 
+ * For reception, the driver may indicate which checksums of a particular packet
+ * have been verified by hardware when calling @ref IpDriverIface::recvIp4Packet,
+ * and the stack will then skip verification of those checksums. Only flags
+ * which are also in @ref IpIfaceDriverParams::rx_chksum_offload are considered.
+ */
+enum class IpChksumOffloadFlags : std::uint8_t {
+    /**
+     * The IPv4 header checksum.
+     * 
+     * For transmission this has no effect since the stack calculates the header
+     * checksum as part of constructing the header at negligible cost.
+     */
+    Ip4Header = std::uint8_t(1) << 0,
+    
+    /**
+     * The TCP checksum for TCP over IPv4.
+     */
+    Tcp4 = std::uint8_t(1) << 1,
+    
+    /**
+     * The UDP checksum for UDP over IPv4.
+     */
+    Udp4 = std::uint8_t(1) << 2,
+};
+#ifndef IN_DOXYGEN
+AIPSTACK_ENUM_BITFIELD(IpChksumOffloadFlags)
+#endif
+
+/**
+ * Segmentation descriptor for TCP super-segments passed to drivers supporting
+ * TCP segmentation offload (TSO).
+ * 
+ * If an interface has a nonzero @ref IpIfaceDriverParams::tso_max_size, the
+ * stack may pass it TCP/IPv4 packets which exceed the MTU (but not
+ * `tso_max_size`). Such a super-segment consists of a single IPv4 header and
+ * TCP header (the "header template") followed by data which must be split into
+ * segments of at most @ref mss bytes of data. For each segment, the driver (or
+ * hardware) must copy the header template and adjust:
+ * - the IP total length, identification (incrementing for each segment) and
+ *   header checksum,
+ * - the TCP sequence number (advancing by the data in preceding segments),
+ * - the TCP FIN and PSH flags, which must be cleared in all but the last
+ *   segment,
+ * - the TCP checksum. In a super-segment, the checksum field contains the
+ *   non-inverted one's complement sum of the pseudo-header without the TCP
+ *   length, which must be added for each segment before completing the
+ *   checksum as for @ref IpChksumOffloadFlags::Tcp4.
+ * 
+ * This corresponds to the TSO semantics commonly implemented by network
+ * controllers. Drivers use @ref IpDriverIface::getTxTso to determine whether
+ * a packet is a super-segment and obtain this descriptor.
+ * 
+ * UDP segmentation offload works the same way for interfaces with a nonzero
+ * @ref IpIfaceDriverParams::uso_max_size. A UDP super-datagram consists of an
+ * IPv4 header and UDP header followed by data which must be split into
+ * datagrams of exactly @ref mss bytes of data, except that the last one may be
+ * shorter. For each datagram, the IP header is adjusted as above, the UDP
+ * length is set, and the UDP checksum is completed as for TCP, its field
+ * containing the pseudo-header sum without the UDP length.
+ */
+struct IpTxTsoInfo {
+    /**
+     * Length of the IP and TCP or UDP headers (the header template) in bytes.
+     */
+    std::size_t header_len;
+    
+    /**
+     * Maximum number of TCP or UDP data bytes in each segment.
+     */
+    std::uint16_t mss;
+};
+
 /**
  * Contains information about a received ICMP Destination Unreachable message.
  */
@@ -263,6 +405,72 @@ struct Ip4DestUnreachMeta {
     Icmp4RestType icmp_rest = {};
 };
 
+/**
+ * Numbers of ICMP messages not sent due to rate limits, as returned by
+ * @ref IpStack::getIcmpRateLimitStats.
+ * 
+ * The counters wrap around on overflow.
+ */
+struct IpIcmpRateLimitStats {
+    // Echo replies not sent.
+    std::uint32_t echo_replies_dropped = 0;
+    
+    // Destination Unreachable messages not sent by IpStack::sendIp4DestUnreach.
+    std::uint32_t dest_unreach_dropped = 0;
+    
+    // ICMP errors for forwarded packets not sent.
+    std::uint32_t forward_errors_dropped = 0;
+};
+
+/**
+ * Rule of the receive filter which drops matching received packets early,
+ * see @ref IpStack::setRxFilterRule.
+ * 
+ * A packet matches the rule if all of the conditions match. The default
+ * values match any packet.
+ */
+struct IpRxFilterRule {
+    /**
+     * Source address prefix to match (bits beyond src_prefix_len are ignored).
+     */
+    Ip4Addr src_addr = Ip4Addr::ZeroAddr();
+    
+    /**
+     * Length of the source address prefix (zero matches any source).
+     */
+    std::uint8_t src_prefix_len = 0;
+    
+    /**
+     * Destination address prefix to match (bits beyond dst_prefix_len are
+     * ignored).
+     */
+    Ip4Addr dst_addr = Ip4Addr::ZeroAddr();
+    
+    /**
+     * Length of the destination address prefix (zero matches any destination).
+     */
+    std::uint8_t dst_prefix_len = 0;
+    
+    /**
+     * Whether to match only packets with the protocol number @ref proto.
+     */
+    bool match_proto = false;
+    
+    /**
+     * Protocol number to match if @ref match_proto is true.
+     */
+    Ip4Protocol proto = Ip4Protocol::Icmp;
+    
+    /**
+     * Range of TCP or UDP destination ports to match.
+     * 
+     * If the range is not the full range, only TCP and UDP packets which
+     * include the port numbers match (not fragments other than the first).
+     */
+    PortNum dst_port_min = 0;
+    PortNum dst_port_max = PortNum(-1);
+};
+
 /**
  * Encapsulates certain parameters relevant for sending IP datagrams.
  * 
@@ -347,6 +555,29 @@ struct IpRouteInfoIp4 {
     Ip4Addr addr;
 };
 
+/**
+ * Receive timestamp of a packet, as provided by the interface driver.
+ * 
+ * The driver may obtain the time from hardware (e.g. a PTP clock of the NIC),
+ * from the operating system (e.g. `SO_TIMESTAMPING`) or by reading a software
+ * clock when the packet is taken from the device. In any case it must convert
+ * the time to the time of the platform (see @ref PlatformFacade::getTime), so
+ * that the stack can compare it with the current time.
+ */
+struct IpRxTimestamp {
+    /**
+     * Whether the timestamp is present.
+     */
+    bool valid = false;
+    
+    /**
+     * The time when the packet was received, in platform time units.
+     * 
+     * This is only meaningful if @ref valid is true.
+     */
+    std::uint64_t time = 0;
+};
+
 /**
  * Encapsulates information about a received IPv4 datagram.
  * 
@@ -377,6 +608,13 @@ struct IpRxInfoIp4 {
      */
     Ip4Protocol proto;
     
+    /**
+     * The DSCP+ECN octet (formerly TOS).
+     * 
+     * The ECN codepoint is in the low two bits (see @ref Ip4EcnMask).
+     */
+    std::uint8_t tos;
+    
     /**
      * The interface through which the packet was received.
      */
@@ -386,6 +624,118 @@ struct IpRxInfoIp4 {
      * The length of the IPv4 header in bytes.
      */
     std::uint8_t header_len;
+    
+    /**
+     * Transport layer checksums which have already been verified by hardware.
+     * 
+     * This is always zero for reassembled datagrams.
+     */
+    IpChksumOffloadFlags chksum_verified;
+    
+    /**
+     * The retainable receive buffer containing the packet, or null.
+     * 
+     * If not null, the packet data is contained in this buffer and can be kept
+     * valid beyond the receive callback using @ref IpRxBuf::retain (see
+     * @ref IpRxBuf). This is null if the driver does not use an @ref IpRxBufPool
+     * and for reassembled datagrams.
+     */
+    IpRxBuf *rx_buf;
+    
+    /**
+     * The receive timestamp provided by the driver, if any.
+     * 
+     * This is not present for reassembled datagrams and for datagrams included
+     * in ICMP errors.
+     */
+    IpRxTimestamp rx_time;
+};
+
+/**
+ * Describes one received packet or frame passed in a batch.
+ * 
+ * An array of these is passed to @ref IpDriverIface::recvIp4Packets and
+ * @ref EthIpIface::recvFrames. The members correspond to the arguments of
+ * @ref IpDriverIface::recvIp4Packet and @ref EthIpIface::recvFrame.
+ */
+struct IpRxBatchEntry {
+    /**
+     * The packet or frame.
+     */
+    IpBufRef buf;
+    
+    /**
+     * Checksums which have been verified by hardware.
+     */
+    IpChksumOffloadFlags chksum_verified = IpChksumOffloadFlags();
+    
+    /**
+     * The retainable buffer which contains the data, or null.
+     */
+    IpRxBuf *rx_buf = nullptr;
+    
+    /**
+     * The receive timestamp, if provided by the driver.
+     */
+    IpRxTimestamp rx_time = IpRxTimestamp();
+};
+
+/**
+ * Cached reference to a neighbor (link-layer address) entry of an interface.
+ * 
+ * This is an opaque hint interpreted by the interface driver (see
+ * @ref IpDriverIface::getTxNeighborCache). The driver stores a pointer to its
+ * neighbor entry together with a generation number and only uses the entry if
+ * the generation still matches, so a stale hint is harmless.
+ */
+struct IpNeighborCache {
+    /**
+     * Driver-specific neighbor entry, or null (should not be used externally).
+     */
+    void *entry = nullptr;
+    
+    /**
+     * Driver-specific generation number (should not be used externally).
+     */
+    std::uint32_t gen = 0;
+};
+
+/**
+ * Per-flow cache of routing and neighbor information.
+ * 
+ * This can be passed to @ref IpStack::prepareSendIp4Dgram by protocols which
+ * repeatedly send to the same destination (connected flows). The route lookup
+ * is then skipped as long as no route has been added or removed since the
+ * information was cached, and the interface driver can skip its neighbor lookup
+ * based on @ref neigh.
+ * 
+ * The structure must be default-initialized before first use and contains no
+ * references which would need to be released, so it can simply be discarded.
+ * 
+ * @tparam Arg Template parameter of @ref IpStack.
+ */
+template<typename Arg>
+struct IpRouteCacheIp4 {
+    /**
+     * Cached routing information (valid only if route_gen matches).
+     */
+    IpRouteInfoIp4<Arg> route_info = {};
+    
+    /**
+     * Destination address for which the routing information was cached.
+     */
+    Ip4Addr dst_addr = Ip4Addr::ZeroAddr();
+    
+    /**
+     * Routing generation of the stack when the information was cached,
+     * zero means nothing is cached.
+     */
+    std::uint32_t route_gen = 0;
+    
+    /**
+     * Cached neighbor entry for the next hop of the cached route.
+     */
+    IpNeighborCache neigh;
 };
 
 /**
@@ -410,6 +760,11 @@ struct IpSendPreparedIp4 {
      * Partially calculated IP header checksum (should not be used externally).
      */
     IpChksumAccumulator::State partial_chksum_state;
+    
+    /**
+     * Neighbor cache passed to the driver, or null (should not be used externally).
+     */
+    IpNeighborCache *neigh_cache;
 };
 
 /** @} */
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/memif/MemifClient.h>
+
+namespace AIpStack {
+
+MemifClient::MemifClient (std::string const &socket_path) :
+    m_region(nullptr)
+{
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("MemifClient: Socket path is too long.");
+    }
+    std::memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+    
+    m_socket_fd = AIpStack::FileDescriptorWrapper(
+        ::socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0));
+    if (!m_socket_fd) {
+        throw std::runtime_error(formatString(
+            "MemifClient: socket failed, err=%d", errno));
+    }
+    
+    if (::connect(*m_socket_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                  sizeof(addr)) < 0)
+    {
+        throw std::runtime_error(formatString(
+            "MemifClient: connect failed, err=%d", errno));
+    }
+    
+    // Receive the connect message with the file descriptors.
+    MemifConnectMessage msg;
+    
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * MemifConnectNumFds)];
+    } control;
+    
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    
+    struct msghdr mh;
+    std::memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    
+    auto res = ::recvmsg(*m_socket_fd, &mh, MSG_CMSG_CLOEXEC|MSG_WAITALL);
+    if (res < 0) {
+        throw std::runtime_error(formatString(
+            "MemifClient: recvmsg failed, err=%d", errno));
+    }
+    
+    AIpStack::FileDescriptorWrapper fds[MemifConnectNumFds];
+    std::size_t num_fds = 0;
+    
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&mh, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (std::size_t i = 0; i < count; i++) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            AIpStack::FileDescriptorWrapper fd_wrapper(fd);
+            if (num_fds < MemifConnectNumFds) {
+                fds[num_fds++] = std::move(fd_wrapper);
+            }
+        }
+    }
+    
+    if (std::size_t(res) != sizeof(msg) || num_fds != MemifConnectNumFds ||
+        msg.magic != MemifMagic || msg.version != MemifVersion)
+    {
+        throw std::runtime_error("MemifClient: Invalid connect message.");
+    }
+    
+    // Check the region header before mapping, so that nothing needs to be
+    // cleaned up if it is not acceptable.
+    MemifRegionHeader header;
+    struct stat st;
+    if (::pread(*fds[0], &header, sizeof(header), 0) != sizeof(header) ||
+        ::fstat(*fds[0], &st) < 0)
+    {
+        throw std::runtime_error("MemifClient: Cannot read the region header.");
+    }
+    
+    std::size_t ring_size = header.ring_size;
+    std::size_t buf_size = header.buf_size;
+    if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0 ||
+        buf_size == 0 || buf_size % MemifLayout::Align != 0 ||
+        header.frame_mtu > buf_size ||
+        (header.mode != MemifMode::Ethernet && header.mode != MemifMode::Ip))
+    {
+        throw std::runtime_error("MemifClient: Invalid region header.");
+    }
+    
+    MemifLayout layout = MemifLayout::compute(ring_size, buf_size);
+    if (layout.total_size != msg.region_size ||
+        std::uint64_t(st.st_size) < msg.region_size)
+    {
+        throw std::runtime_error("MemifClient: Invalid region size.");
+    }
+    
+    void *ptr = ::mmap(nullptr, layout.total_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED, *fds[0], 0);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error(formatString(
+            "MemifClient: mmap failed, err=%d", errno));
+    }
+    
+    m_frame_mtu = header.frame_mtu;
+    m_mode = header.mode;
+    m_region = static_cast<char *>(ptr);
+    m_region_size = layout.total_size;
+    m_rx_ring.attach(m_region, layout, MemifRingToClient, ring_size, buf_size);
+    m_tx_ring.attach(m_region, layout, MemifRingToDevice, ring_size, buf_size);
+    m_device_doorbell_fd = std::move(fds[1]);
+    m_client_doorbell_fd = std::move(fds[2]);
+}
+
+MemifClient::~MemifClient ()
+{
+    ::munmap(m_region, m_region_size);
+}
+
+MemifMode MemifClient::getMode () const
+{
+    return m_mode;
+}
+
+std::size_t MemifClient::getMtu () const
+{
+    return m_frame_mtu;
+}
+
+int MemifClient::getDoorbellFd () const
+{
+    return *m_client_doorbell_fd;
+}
+
+int MemifClient::getSocketFd () const
+{
+    return *m_socket_fd;
+}
+
+void MemifClient::clearDoorbell ()
+{
+    std::uint64_t value;
+    if (::read(*m_client_doorbell_fd, &value, sizeof(value)) < 0) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "MemifClient: read from doorbell failed, err=%d\n",
+                err);
+        }
+    }
+}
+
+std::size_t MemifClient::rxAvailable ()
+{
+    return m_rx_ring.consumerAvailable();
+}
+
+AIpStack::MemRef MemifClient::rxFrame (std::size_t offset)
+{
+    return m_rx_ring.consumerFrame(offset);
+}
+
+void MemifClient::rxRelease (std::size_t count)
+{
+    m_rx_ring.consumerRelease(count);
+}
+
+std::size_t MemifClient::txSpace ()
+{
+    return m_tx_ring.producerSpace();
+}
+
+char * MemifClient::txBuffer (std::size_t offset)
+{
+    return m_tx_ring.producerBuffer(offset);
+}
+
+void MemifClient::txSetLength (std::size_t offset, std::size_t len)
+{
+    AIPSTACK_ASSERT(len <= m_frame_mtu);
+    
+    m_tx_ring.producerSetLength(offset, len);
+}
+
+void MemifClient::txCommit (std::size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    
+    m_tx_ring.producerCommit(count);
+    
+    std::uint64_t value = 1;
+    if (::write(*m_device_doorbell_fd, &value, sizeof(value)) < 0) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "MemifClient: write to doorbell failed, err=%d\n",
+                err);
+        }
+    }
+}
+
+}
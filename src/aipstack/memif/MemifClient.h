@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_MEMIF_CLIENT_H
+#define AIPSTACK_MEMIF_CLIENT_H
+
+#if !defined(__linux__)
+#error "MemifClient is only supported on Linux"
+#endif
+
+#include <cstddef>
+#include <string>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/memif/MemifRing.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup memif
+ * @{
+ */
+
+/**
+ * Application side of a shared-memory packet interface, connecting to a
+ * @ref MemifDevice in the process running the stack (Linux only).
+ * 
+ * This class does not depend on the %AIpStack event loop, so that it can be
+ * used by any application. The application waits for the doorbell
+ * (@ref getDoorbellFd) to become readable using its own mechanism, then calls
+ * @ref clearDoorbell and checks both rings. Frames are accessed in place in
+ * shared memory in both directions:
+ * - Received frames are accessed using @ref rxAvailable and @ref rxFrame, and
+ *   the slots are freed using @ref rxRelease.
+ * - Frames to be sent are written into the buffers obtained using
+ *   @ref txBuffer, their lengths are set using @ref txSetLength and they are
+ *   passed to the device using @ref txCommit, which also rings the doorbell of
+ *   the device. If there is no space, the device rings the doorbell of the
+ *   client after it has freed some slots.
+ * 
+ * When the device goes away, the socket (@ref getSocketFd) becomes readable
+ * with end of file; the application should then destroy the client.
+ * 
+ * The functions of one MemifClient object must not be called concurrently.
+ */
+class MemifClient :
+    private AIpStack::NonCopyable<MemifClient>
+{
+public:
+    /**
+     * Constructor, connects to the device and maps the shared memory.
+     * 
+     * @param socket_path Path of the Unix socket of the @ref MemifDevice.
+     * @throw std::runtime_error If connecting fails or the device sent
+     *        unexpected data.
+     */
+    explicit MemifClient (std::string const &socket_path);
+
+    /**
+     * Destructor, unmaps the shared memory and disconnects.
+     */
+    ~MemifClient ();
+
+    /**
+     * Get the type of frames, as configured in the device.
+     * 
+     * @return Frame type.
+     */
+    MemifMode getMode () const;
+
+    /**
+     * Get the maximum frame size, as configured in the device.
+     * 
+     * @return Maximum frame size, which is also the maximum length accepted by
+     *         @ref txSetLength.
+     */
+    std::size_t getMtu () const;
+
+    /**
+     * Get the file descriptor of the doorbell of the client, which becomes
+     * readable when it is rung by the device.
+     * 
+     * @return File descriptor (an eventfd).
+     */
+    int getDoorbellFd () const;
+
+    /**
+     * Get the file descriptor of the socket connected to the device.
+     * 
+     * @return File descriptor.
+     */
+    int getSocketFd () const;
+
+    /**
+     * Reset the doorbell of the client after it has become readable.
+     */
+    void clearDoorbell ();
+
+    /**
+     * Return the number of frames received from the device.
+     * 
+     * @return Number of frames which may be accessed using @ref rxFrame.
+     */
+    std::size_t rxAvailable ();
+
+    /**
+     * Access a received frame.
+     * 
+     * @param offset Offset from the oldest frame, must be less than the result
+     *        of the last @ref rxAvailable call.
+     * @return Frame data in shared memory, valid until released.
+     */
+    AIpStack::MemRef rxFrame (std::size_t offset);
+
+    /**
+     * Release the oldest received frames.
+     * 
+     * @param count Number of frames, at most the result of the last
+     *        @ref rxAvailable call.
+     */
+    void rxRelease (std::size_t count);
+
+    /**
+     * Return the number of frames which can be sent.
+     * 
+     * @return Number of buffers which may be written and committed.
+     */
+    std::size_t txSpace ();
+
+    /**
+     * Access a buffer for a frame to be sent.
+     * 
+     * @param offset Offset from the first free buffer, must be less than the
+     *        result of the last @ref txSpace call.
+     * @return Pointer to the buffer in shared memory, with space for
+     *         @ref getMtu bytes.
+     */
+    char * txBuffer (std::size_t offset);
+
+    /**
+     * Set the length of a frame to be sent.
+     * 
+     * @param offset Offset from the first free buffer, as for @ref txBuffer.
+     * @param len Frame length, at most @ref getMtu.
+     */
+    void txSetLength (std::size_t offset, std::size_t len);
+
+    /**
+     * Pass frames to the device and ring its doorbell.
+     * 
+     * @param count Number of frames, at most the result of the last
+     *        @ref txSpace call.
+     */
+    void txCommit (std::size_t count);
+
+private:
+    std::size_t m_frame_mtu;
+    MemifMode m_mode;
+    char *m_region;
+    std::size_t m_region_size;
+    MemifRing m_rx_ring;
+    MemifRing m_tx_ring;
+    AIpStack::FileDescriptorWrapper m_socket_fd;
+    AIpStack::FileDescriptorWrapper m_device_doorbell_fd;
+    AIpStack::FileDescriptorWrapper m_client_doorbell_fd;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/memif/MemifDevice.h>
+
+namespace AIpStack {
+
+MemifDevice::MemifDevice (
+    AIpStack::EventLoop &loop, std::string const &socket_path,
+    FrameReceivedHandler handler, MemifDeviceParams const &params)
+:
+    m_handler(handler),
+    m_params(params),
+    m_socket_path(socket_path),
+    m_buf_size((params.frame_mtu + MemifLayout::Align - 1) /
+               MemifLayout::Align * MemifLayout::Align),
+    m_layout(MemifLayout::compute(params.ring_size, m_buf_size)),
+    m_region(nullptr),
+    m_listen_watcher(loop,
+        AIPSTACK_BIND_MEMBER(&MemifDevice::handleListenEvents, this)),
+    m_conn_watcher(loop,
+        AIPSTACK_BIND_MEMBER(&MemifDevice::handleConnEvents, this)),
+    m_doorbell_watcher(loop,
+        AIPSTACK_BIND_MEMBER(&MemifDevice::handleDoorbell, this)),
+    m_rx_deferred(loop, AIPSTACK_BIND_MEMBER(&MemifDevice::processRxRing, this)),
+    m_kick_deferred(loop, AIPSTACK_BIND_MEMBER(&MemifDevice::ringClientDoorbell, this))
+{
+    AIPSTACK_ASSERT(handler);
+    AIPSTACK_ASSERT(params.frame_mtu > 0);
+    AIPSTACK_ASSERT(params.ring_size > 0 &&
+                    (params.ring_size & (params.ring_size - 1)) == 0);
+    AIPSTACK_ASSERT(params.rx_budget > 0);
+    
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("MemifDevice: Socket path is too long.");
+    }
+    std::memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+    
+    m_listen_fd = AIpStack::FileDescriptorWrapper(
+        ::socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0));
+    if (!m_listen_fd) {
+        throw std::runtime_error(formatString(
+            "MemifDevice: socket failed, err=%d", errno));
+    }
+    
+    ::unlink(socket_path.c_str());
+    
+    if (::bind(*m_listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+               sizeof(addr)) < 0)
+    {
+        throw std::runtime_error(formatString(
+            "MemifDevice: bind failed, err=%d", errno));
+    }
+    
+    if (::listen(*m_listen_fd, 1) < 0) {
+        throw std::runtime_error(formatString(
+            "MemifDevice: listen failed, err=%d", errno));
+    }
+    
+    m_listen_watcher.initFd(*m_listen_fd, AIpStack::EventLoopFdEvents::Read);
+    
+    if (params.rx_scheduler != nullptr) {
+        m_rx_source = std::make_unique<AIpStack::EventLoopRxSource>(*params.rx_scheduler,
+            AIPSTACK_BIND_MEMBER(&MemifDevice::pollRxSource, this),
+            AIPSTACK_BIND_MEMBER(&MemifDevice::armRxSource, this));
+    }
+}
+
+MemifDevice::~MemifDevice ()
+{
+    if (m_region != nullptr) {
+        ::munmap(m_region, m_layout.total_size);
+    }
+    
+    if (m_listen_fd) {
+        ::unlink(m_socket_path.c_str());
+    }
+}
+
+std::size_t MemifDevice::getMtu () const
+{
+    return m_params.frame_mtu;
+}
+
+bool MemifDevice::isConnected () const
+{
+    return m_region != nullptr;
+}
+
+AIpStack::IpErr MemifDevice::sendFrame (AIpStack::IpBufRef frame)
+{
+    if (!isConnected()) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    else if (frame.tot_len > m_params.frame_mtu) {
+        return AIpStack::IpErr::PacketTooLarge;
+    }
+    else if (m_tx_ring.producerSpace() == 0) {
+        return AIpStack::IpErr::OutputBufferFull;
+    }
+    
+    std::size_t len = frame.tot_len;
+    AIpStack::ipBufTakeBytes(frame, len, m_tx_ring.producerBuffer(0));
+    m_tx_ring.producerSetLength(0, len);
+    m_tx_ring.producerCommit(1);
+    
+    // Frames sent in the same event loop iteration share one doorbell write.
+    m_kick_deferred.schedule();
+    
+    return AIpStack::IpErr::Success;
+}
+
+void MemifDevice::handleListenEvents (AIpStack::EventLoopFdEvents)
+{
+    AIPSTACK_ASSERT(!m_conn_fd);
+    
+    AIpStack::FileDescriptorWrapper fd(
+        ::accept4(*m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK|SOCK_CLOEXEC));
+    if (!fd) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "MemifDevice: accept failed, err=%d\n", err);
+        }
+        return;
+    }
+    
+    m_conn_fd = std::move(fd);
+    
+    if (!setupConnection()) {
+        disconnect();
+        return;
+    }
+    
+    // Only one connection is served at a time.
+    m_conn_watcher.initFd(*m_conn_fd, AIpStack::EventLoopFdEvents::Read);
+    m_doorbell_watcher.initFd(*m_device_doorbell_fd, AIpStack::EventLoopFdEvents::Read);
+    m_listen_watcher.updateEvents(AIpStack::EventLoopFdEvents());
+}
+
+void MemifDevice::handleConnEvents (AIpStack::EventLoopFdEvents events)
+{
+    // The client does not send anything, so any event other than data (which
+    // is discarded) means that the connection is gone.
+    if ((events & AIpStack::EventLoopFdEvents::Error) == AIpStack::Enum0) {
+        char buf[64];
+        auto res = ::recv(*m_conn_fd, buf, sizeof(buf), 0);
+        if (res > 0 || (res < 0 &&
+            AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(errno)))
+        {
+            return;
+        }
+    }
+    
+    disconnect();
+}
+
+void MemifDevice::handleDoorbell (AIpStack::EventLoopFdEvents)
+{
+    std::uint64_t value;
+    if (::read(*m_device_doorbell_fd, &value, sizeof(value)) < 0) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "MemifDevice: read from doorbell failed, err=%d\n",
+                err);
+        }
+    }
+    
+    if (m_rx_source != nullptr) {
+        // Stop monitoring the doorbell and let the scheduler poll the ring until
+        // the source returns to interrupt mode.
+        m_doorbell_watcher.updateEvents(AIpStack::EventLoopFdEvents());
+        m_rx_source->schedule();
+        return;
+    }
+    
+    processRxRing();
+}
+
+bool MemifDevice::setupConnection ()
+{
+    AIpStack::FileDescriptorWrapper mem_fd(::memfd_create("aipstack-memif", MFD_CLOEXEC));
+    if (!mem_fd) {
+        std::fprintf(stderr, "MemifDevice: memfd_create failed, err=%d\n", errno);
+        return false;
+    }
+    
+    if (::ftruncate(*mem_fd, off_t(m_layout.total_size)) < 0) {
+        std::fprintf(stderr, "MemifDevice: ftruncate failed, err=%d\n", errno);
+        return false;
+    }
+    
+    m_device_doorbell_fd = AIpStack::FileDescriptorWrapper(
+        ::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC));
+    m_client_doorbell_fd = AIpStack::FileDescriptorWrapper(
+        ::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC));
+    if (!m_device_doorbell_fd || !m_client_doorbell_fd) {
+        std::fprintf(stderr, "MemifDevice: eventfd failed, err=%d\n", errno);
+        return false;
+    }
+    
+    void *ptr = ::mmap(nullptr, m_layout.total_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED, *mem_fd, 0);
+    if (ptr == MAP_FAILED) {
+        std::fprintf(stderr, "MemifDevice: mmap failed, err=%d\n", errno);
+        return false;
+    }
+    m_region = static_cast<char *>(ptr);
+    
+    MemifRegionHeader header = {};
+    header.magic = MemifMagic;
+    header.version = MemifVersion;
+    header.mode = m_params.mode;
+    header.ring_size = std::uint32_t(m_params.ring_size);
+    header.buf_size = std::uint32_t(m_buf_size);
+    header.frame_mtu = std::uint32_t(m_params.frame_mtu);
+    std::memcpy(m_region, &header, sizeof(header));
+    
+    m_tx_ring.attach(m_region, m_layout, MemifRingToClient, m_params.ring_size,
+                     m_buf_size);
+    m_tx_ring.resetShared();
+    m_rx_ring.attach(m_region, m_layout, MemifRingToDevice, m_params.ring_size,
+                     m_buf_size);
+    m_rx_ring.resetShared();
+    
+    MemifConnectMessage msg = {};
+    msg.magic = MemifMagic;
+    msg.version = MemifVersion;
+    msg.region_size = m_layout.total_size;
+    
+    int fds[MemifConnectNumFds] = {*mem_fd, *m_device_doorbell_fd, *m_client_doorbell_fd};
+    
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    std::memset(&control, 0, sizeof(control));
+    
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    
+    struct msghdr mh;
+    std::memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    
+    // The message is small and the socket is new, so it is sent in one piece.
+    auto res = ::sendmsg(*m_conn_fd, &mh, MSG_NOSIGNAL);
+    if (res != sizeof(msg)) {
+        std::fprintf(stderr, "MemifDevice: sendmsg failed, err=%d\n", errno);
+        return false;
+    }
+    
+    return true;
+}
+
+void MemifDevice::disconnect ()
+{
+    m_rx_deferred.cancel();
+    m_kick_deferred.cancel();
+    
+    m_doorbell_watcher.reset();
+    m_conn_watcher.reset();
+    m_device_doorbell_fd = AIpStack::FileDescriptorWrapper();
+    m_client_doorbell_fd = AIpStack::FileDescriptorWrapper();
+    m_conn_fd = AIpStack::FileDescriptorWrapper();
+    
+    if (m_region != nullptr) {
+        ::munmap(m_region, m_layout.total_size);
+        m_region = nullptr;
+    }
+    
+    // Wait for the next client.
+    m_listen_watcher.updateEvents(AIpStack::EventLoopFdEvents::Read);
+}
+
+void MemifDevice::processRxRing ()
+{
+    std::size_t count = receiveFrames(m_params.rx_budget);
+    
+    // Continue later if there are more frames.
+    if (count == m_params.rx_budget && isConnected() &&
+        m_rx_ring.consumerAvailable() > 0)
+    {
+        m_rx_deferred.schedule();
+    }
+}
+
+std::size_t MemifDevice::receiveFrames (std::size_t budget)
+{
+    if (!isConnected()) {
+        return 0;
+    }
+    
+    std::size_t avail = m_rx_ring.consumerAvailable();
+    std::size_t count = (avail < budget) ? avail : budget;
+    if (count == 0) {
+        return 0;
+    }
+    
+    for (std::size_t i = 0; i < count; i++) {
+        AIpStack::MemRef data = m_rx_ring.consumerFrame(i);
+        AIpStack::IpBufNode node{const_cast<char *>(data.ptr), data.len, nullptr};
+        m_handler(AIpStack::IpBufRef{&node, 0, data.len});
+        
+        // The handler may have caused the connection to be closed.
+        if (!isConnected()) {
+            return i + 1;
+        }
+    }
+    
+    m_rx_ring.consumerRelease(count);
+    
+    // Let a client which is waiting for space know that there is some.
+    m_kick_deferred.schedule();
+    
+    return count;
+}
+
+std::size_t MemifDevice::pollRxSource (std::size_t budget)
+{
+    return receiveFrames(budget);
+}
+
+void MemifDevice::armRxSource ()
+{
+    if (isConnected()) {
+        m_doorbell_watcher.updateEvents(AIpStack::EventLoopFdEvents::Read);
+    }
+}
+
+void MemifDevice::ringClientDoorbell ()
+{
+    std::uint64_t value = 1;
+    if (::write(*m_client_doorbell_fd, &value, sizeof(value)) < 0) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "MemifDevice: write to doorbell failed, err=%d\n",
+                err);
+        }
+    }
+}
+
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_MEMIF_DEVICE_H
+#define AIPSTACK_MEMIF_DEVICE_H
+
+#if !defined(__linux__)
+#error "MemifDevice is only supported on Linux"
+#endif
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/event_loop/EventLoopRxScheduler.h>
+#include <aipstack/memif/MemifRing.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup memif
+ * @{
+ */
+
+/**
+ * Configuration parameters for @ref MemifDevice.
+ */
+struct MemifDeviceParams {
+    /**
+     * Type of the frames, which is passed to the client.
+     */
+    MemifMode mode = MemifMode::Ethernet;
+
+    /**
+     * Maximum frame size, as returned by @ref MemifDevice::getMtu. With
+     * @ref MemifMode::Ethernet this includes the 14-byte Ethernet header.
+     */
+    std::size_t frame_mtu = 1514;
+
+    /**
+     * Number of slots in each ring, must be a power of two.
+     */
+    std::size_t ring_size = 256;
+
+    /**
+     * Maximum number of frames received for one notification from the client,
+     * for fairness with respect to other event sources.
+     */
+    std::size_t rx_budget = 64;
+
+    /**
+     * Scheduler which receives frames in its polls, or null.
+     * 
+     * If not null, a notification from the client only puts the device's
+     * @ref EventLoopRxSource into polling mode and frames are received in polls of
+     * the scheduler, with its adaptive budget instead of @ref rx_budget (see
+     * @ref EventLoopRxScheduler). The scheduler must outlive the @ref MemifDevice.
+     */
+    EventLoopRxScheduler *rx_scheduler = nullptr;
+};
+
+/**
+ * Provides packet I/O with another process on the same machine through rings
+ * in shared memory (Linux only).
+ * 
+ * This facility relies on the @ref event-loop implementation in %AIpStack and has
+ * the same interface as @ref TapDevice, so in @ref MemifMode::Ethernet it can be
+ * connected to an @ref EthIpIface in the same way (in @ref MemifMode::Ip, frames
+ * are IP packets and an @ref IpDriverIface would be used instead).
+ * 
+ * The device listens on a Unix socket, to which an application process connects
+ * using @ref MemifClient. For each connection the device creates a shared
+ * memory region (a memfd) with one ring in each direction (see @ref MemifRing)
+ * and two eventfds used as doorbells, and passes them to the client over the
+ * socket. The socket is then only used to detect that either side has gone
+ * away. Only one client can be connected at a time; when it disconnects, the
+ * device waits for a new connection. For several application processes, one
+ * device (socket) is used for each.
+ * 
+ * Frames are exchanged through the buffers in shared memory:
+ * - Frames written by the client are passed to the @ref FrameReceivedHandler
+ *   referencing the buffers of the ring directly, without copying.
+ * - Frames passed to @ref sendFrame are copied from their buffers into the
+ *   buffers of the ring once, where the client accesses them in place.
+ * 
+ * The doorbell of the client is rung at most once per event loop iteration,
+ * after frames have been sent or after slots of the receive ring have been
+ * freed, so that a client waiting for space can continue.
+ */
+class MemifDevice :
+    private AIpStack::NonCopyable<MemifDevice>
+{
+public:
+    /**
+     * Type of callback used to deliver received frames.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef). The referenced
+     *        buffer is in shared memory and must not be used outside of the
+     *        callback function.
+     */
+    using FrameReceivedHandler = Function<void(AIpStack::IpBufRef frame)>;
+
+    /**
+     * Constructor, starts listening on the socket.
+     * 
+     * Any existing file at the socket path is removed first.
+     * 
+     * @param loop Event loop; it must outlive the MemifDevice object.
+     * @param socket_path Path of the Unix socket.
+     * @param handler Callback function used to deliver received frames (must not
+     *        be null).
+     * @param params Configuration parameters.
+     * @throw std::runtime_error If creating the socket fails.
+     */
+    MemifDevice (AIpStack::EventLoop &loop, std::string const &socket_path,
+                 FrameReceivedHandler handler,
+                 MemifDeviceParams const &params = MemifDeviceParams());
+
+    /**
+     * Destructor, disconnects any client and removes the socket.
+     */
+    ~MemifDevice ();
+
+    /**
+     * Get the maximum frame size.
+     * 
+     * @return The maximum frame size from @ref MemifDeviceParams::frame_mtu.
+     */
+    std::size_t getMtu () const;
+
+    /**
+     * Check whether a client is connected.
+     * 
+     * @return True if a client is connected.
+     */
+    bool isConnected () const;
+
+    /**
+     * Send a frame to the client.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef).
+     * @return Success or error code (@ref IpErr::OutputBufferFull if the ring
+     *         to the client is full, @ref IpErr::HardwareError if no client is
+     *         connected).
+     */
+    AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame);
+
+private:
+    void handleListenEvents (AIpStack::EventLoopFdEvents events);
+
+    void handleConnEvents (AIpStack::EventLoopFdEvents events);
+
+    void handleDoorbell (AIpStack::EventLoopFdEvents events);
+
+    bool setupConnection ();
+
+    void disconnect ();
+
+    void processRxRing ();
+
+    // Receive up to budget frames, returns the number received.
+    std::size_t receiveFrames (std::size_t budget);
+
+    std::size_t pollRxSource (std::size_t budget);
+
+    void armRxSource ();
+
+    void ringClientDoorbell ();
+
+private:
+    FrameReceivedHandler m_handler;
+    MemifDeviceParams m_params;
+    std::string m_socket_path;
+    std::size_t m_buf_size;
+    MemifLayout m_layout;
+    char *m_region;
+    MemifRing m_tx_ring;
+    MemifRing m_rx_ring;
+    // First fds then watchers for proper destruction order.
+    AIpStack::FileDescriptorWrapper m_listen_fd;
+    AIpStack::FileDescriptorWrapper m_conn_fd;
+    AIpStack::FileDescriptorWrapper m_device_doorbell_fd;
+    AIpStack::FileDescriptorWrapper m_client_doorbell_fd;
+    AIpStack::EventLoopFdWatcher m_listen_watcher;
+    AIpStack::EventLoopFdWatcher m_conn_watcher;
+    AIpStack::EventLoopFdWatcher m_doorbell_watcher;
+    AIpStack::EventLoopDeferred m_rx_deferred;
+    AIpStack::EventLoopDeferred m_kick_deferred;
+    std::unique_ptr<AIpStack::EventLoopRxSource> m_rx_source;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_MEMIF_RING_H
+#define AIPSTACK_MEMIF_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MemRef.h>
+
+namespace AIpStack {
+
+/**
+ * @defgroup memif Shared-Memory Packet Interface
+ * @brief Packet I/O with co-located processes through rings in shared memory.
+ * 
+ * See the @ref MemifDevice and @ref MemifClient documentation.
+ * 
+ * @{
+ */
+
+/**
+ * Type of frames exchanged over a shared-memory packet interface.
+ */
+enum class MemifMode : std::uint32_t {
+    /** Frames start with the 14-byte Ethernet header. */
+    Ethernet = 1,
+    /** Frames are IPv4 packets with no link-layer header. */
+    Ip = 2,
+};
+
+/**
+ * Header at the start of the shared memory region of a shared-memory packet
+ * interface, written by @ref MemifDevice before the region is shared.
+ */
+struct MemifRegionHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    MemifMode mode;
+    std::uint32_t ring_size;
+    std::uint32_t buf_size;
+    std::uint32_t frame_mtu;
+};
+
+/**
+ * Values identifying the shared memory region layout described here.
+ */
+inline constexpr std::uint32_t MemifMagic = 0x4D454D46;
+inline constexpr std::uint32_t MemifVersion = 1;
+
+/**
+ * Message sent by @ref MemifDevice to a new client over the Unix socket.
+ * 
+ * It is accompanied (SCM_RIGHTS) by the file descriptors of the shared memory
+ * region, the doorbell of the device and the doorbell of the client, in this
+ * order.
+ */
+struct MemifConnectMessage {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t region_size;
+};
+
+/**
+ * Number of file descriptors accompanying the @ref MemifConnectMessage.
+ */
+inline constexpr std::size_t MemifConnectNumFds = 3;
+
+/**
+ * Index of the ring carrying frames from @ref MemifDevice to @ref MemifClient.
+ */
+inline constexpr std::size_t MemifRingToClient = 0;
+
+/**
+ * Index of the ring carrying frames from @ref MemifClient to @ref MemifDevice.
+ */
+inline constexpr std::size_t MemifRingToDevice = 1;
+
+/**
+ * Offsets of the parts of the shared memory region.
+ * 
+ * The region starts with the @ref MemifRegionHeader, followed by two rings and
+ * then the buffers of each ring. A ring consists of the producer index and the
+ * consumer index, each in its own cache line, followed by one descriptor per
+ * slot. Each slot has a fixed buffer, so only frame lengths are passed in the
+ * descriptors.
+ */
+struct MemifLayout {
+    static constexpr std::size_t Align = 64;
+    
+    std::size_t ring_offset[2];
+    std::size_t buf_offset[2];
+    std::size_t total_size;
+    
+    /**
+     * Compute the layout for the given ring parameters.
+     * 
+     * @param ring_size Number of slots in each ring.
+     * @param buf_size Size of each buffer, must be a multiple of @ref Align.
+     * @return The layout.
+     */
+    static MemifLayout compute (std::size_t ring_size, std::size_t buf_size);
+};
+
+/**
+ * Per-process view of one ring in a shared memory region, used by both the
+ * producer and the consumer.
+ * 
+ * The interface follows @ref SpscRing: the producer writes frames in place into
+ * the buffers of free slots and publishes them using @ref producerCommit, and
+ * the consumer accesses frames in place and frees the slots using
+ * @ref consumerRelease. The indices are free-running 32-bit counters, stored
+ * with release semantics and loaded with acquire semantics.
+ * 
+ * The other process is not trusted to keep the ring consistent: counts
+ * computed from its index are limited to the ring size and frame lengths are
+ * limited to the buffer size, so that a misbehaving peer cannot cause accesses
+ * outside of the region.
+ */
+class MemifRing {
+public:
+    /**
+     * Attach to a ring.
+     * 
+     * @param region Start of the shared memory region.
+     * @param layout Layout of the region.
+     * @param index Index of the ring (@ref MemifRingToClient or
+     *        @ref MemifRingToDevice).
+     * @param ring_size Number of slots, must be a power of two.
+     * @param buf_size Size of each buffer.
+     */
+    void attach (char *region, MemifLayout const &layout, std::size_t index,
+                 std::size_t ring_size, std::size_t buf_size);
+    
+    /**
+     * Set both indices in the shared memory to zero.
+     * 
+     * This is done by the device when preparing a region, before it is shared.
+     */
+    void resetShared ();
+    
+    /**
+     * Return the size of the buffer of each slot.
+     * 
+     * @return Buffer size.
+     */
+    inline std::size_t bufferSize () const
+    {
+        return m_buf_size;
+    }
+    
+    /**
+     * Return the number of free slots (producer side).
+     * 
+     * @return Number of slots which may be written and committed.
+     */
+    std::size_t producerSpace ();
+    
+    /**
+     * Access the buffer of a free slot (producer side).
+     * 
+     * @param offset Offset from the first free slot, must be less than the
+     *        result of the last @ref producerSpace call.
+     * @return Pointer to the buffer of @ref bufferSize bytes.
+     */
+    inline char * producerBuffer (std::size_t offset)
+    {
+        return m_bufs + slotIndex(m_pos + std::uint32_t(offset)) * m_buf_size;
+    }
+    
+    /**
+     * Set the length of the frame in a free slot (producer side).
+     * 
+     * @param offset Offset from the first free slot, as for @ref producerBuffer.
+     * @param len Frame length, must not exceed @ref bufferSize.
+     */
+    inline void producerSetLength (std::size_t offset, std::size_t len)
+    {
+        AIPSTACK_ASSERT(len <= m_buf_size);
+        m_desc[slotIndex(m_pos + std::uint32_t(offset))].len.store(
+            std::uint32_t(len), std::memory_order_relaxed);
+    }
+    
+    /**
+     * Publish written slots to the consumer (producer side).
+     * 
+     * @param count Number of slots, at most the result of the last
+     *        @ref producerSpace call.
+     */
+    void producerCommit (std::size_t count);
+    
+    /**
+     * Return the number of published frames (consumer side).
+     * 
+     * @return Number of frames which may be accessed using @ref consumerFrame.
+     */
+    std::size_t consumerAvailable ();
+    
+    /**
+     * Access a published frame (consumer side).
+     * 
+     * @param offset Offset from the oldest frame, must be less than the result
+     *        of the last @ref consumerAvailable call.
+     * @return Frame data in the buffer of the slot, valid until the slot is
+     *         released.
+     */
+    MemRef consumerFrame (std::size_t offset);
+    
+    /**
+     * Free the oldest slots (consumer side).
+     * 
+     * @param count Number of slots, at most the result of the last
+     *        @ref consumerAvailable call.
+     */
+    void consumerRelease (std::size_t count);
+    
+private:
+    struct alignas(MemifLayout::Align) SharedIndex {
+        std::atomic<std::uint32_t> value;
+    };
+    
+    static_assert(std::atomic<std::uint32_t>::is_always_lock_free,
+                  "Lock-free 32-bit atomics are needed for shared memory.");
+    
+    struct Desc {
+        std::atomic<std::uint32_t> len;
+        std::uint32_t reserved;
+    };
+    
+    friend struct MemifLayout;
+    
+    inline std::size_t slotIndex (std::uint32_t pos) const
+    {
+        return pos & m_mask;
+    }
+    
+private:
+    SharedIndex *m_head;
+    SharedIndex *m_tail;
+    Desc *m_desc;
+    char *m_bufs;
+    std::uint32_t m_mask;
+    std::size_t m_buf_size;
+    // Own position (head for the producer, tail for the consumer) and the last
+    // loaded index of the other side.
+    std::uint32_t m_pos;
+    std::uint32_t m_other;
+};
+
+inline MemifLayout MemifLayout::compute (std::size_t ring_size, std::size_t buf_size)
+{
+    AIPSTACK_ASSERT(buf_size % Align == 0);
+    
+    auto align_up = [](std::size_t x) { return (x + Align - 1) / Align * Align; };
+    
+    std::size_t ring_bytes = align_up(2 * sizeof(MemifRing::SharedIndex) +
+                                      ring_size * sizeof(MemifRing::Desc));
+    
+    MemifLayout layout;
+    std::size_t offset = align_up(sizeof(MemifRegionHeader));
+    for (std::size_t i = 0; i < 2; i++) {
+        layout.ring_offset[i] = offset;
+        offset += ring_bytes;
+    }
+    for (std::size_t i = 0; i < 2; i++) {
+        layout.buf_offset[i] = offset;
+        offset += ring_size * buf_size;
+    }
+    layout.total_size = offset;
+    return layout;
+}
+
+inline void MemifRing::attach (char *region, MemifLayout const &layout,
+                               std::size_t index, std::size_t ring_size,
+                               std::size_t buf_size)
+{
+    AIPSTACK_ASSERT(index < 2);
+    AIPSTACK_ASSERT(ring_size > 0 && (ring_size & (ring_size - 1)) == 0);
+    
+    char *ring = region + layout.ring_offset[index];
+    m_head = reinterpret_cast<SharedIndex *>(ring);
+    m_tail = m_head + 1;
+    m_desc = reinterpret_cast<Desc *>(m_head + 2);
+    m_bufs = region + layout.buf_offset[index];
+    m_mask = std::uint32_t(ring_size - 1);
+    m_buf_size = buf_size;
+    m_pos = 0;
+    m_other = 0;
+}
+
+inline void MemifRing::resetShared ()
+{
+    m_head->value.store(0, std::memory_order_relaxed);
+    m_tail->value.store(0, std::memory_order_relaxed);
+}
+
+inline std::size_t MemifRing::producerSpace ()
+{
+    std::uint32_t size = m_mask + 1;
+    if (std::uint32_t(m_pos - m_other) == size) {
+        m_other = m_tail->value.load(std::memory_order_acquire);
+    }
+    std::uint32_t used = m_pos - m_other;
+    return (used <= size) ? (size - used) : 0;
+}
+
+inline void MemifRing::producerCommit (std::size_t count)
+{
+    m_pos += std::uint32_t(count);
+    m_head->value.store(m_pos, std::memory_order_release);
+}
+
+inline std::size_t MemifRing::consumerAvailable ()
+{
+    if (m_other == m_pos) {
+        m_other = m_head->value.load(std::memory_order_acquire);
+    }
+    std::uint32_t avail = m_other - m_pos;
+    return (avail <= m_mask + 1) ? avail : 0;
+}
+
+inline MemRef MemifRing::consumerFrame (std::size_t offset)
+{
+    std::size_t slot = slotIndex(m_pos + std::uint32_t(offset));
+    // Read the length once, since the peer could change it concurrently.
+    std::uint32_t len = m_desc[slot].len.load(std::memory_order_relaxed);
+    return MemRef(m_bufs + slot * m_buf_size, (len <= m_buf_size) ? len : m_buf_size);
+}
+
+inline void MemifRing::consumerRelease (std::size_t count)
+{
+    m_pos += std::uint32_t(count);
+    m_tail->value.store(m_pos, std::memory_order_release);
+}
+
+/** @} */
+
+}
+
+#endif
@@ -26,10 +26,15 @@
 #define AIPSTACK_BINARY_TOOLS_H
 
 #include <cstdint>
+#include <cstring>
 
 #include <type_traits>
 #include <limits>
 
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
 #include <aipstack/misc/Hints.h>
 
 namespace AIpStack {
@@ -46,6 +51,12 @@ namespace AIpStack {
  * The supported types are all binary integer types (signed and unsigned) which are
  * 8, 16, 32 or 64-bits wide.
  * 
+ * On targets known to handle unaligned access well (x86, ARMv7+ with unaligned access
+ * enabled, and the equivalent MSVC targets), 16/32/64-bit values are accessed with a
+ * single load or store plus a byte swap intrinsic (`__builtin_bswap*` or
+ * `_byteswap_*`). Elsewhere a portable byte-by-byte implementation is used. Defining
+ * `AIPSTACK_CONFIG_BINARYTOOLS_DISABLE_FAST` forces the portable implementation.
+ * 
  * @{
  */
 
@@ -140,10 +151,32 @@ namespace BinaryToolsPrivate {
         }
     };
     
-#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
-    defined(__ARM_ARCH) && __ARM_ARCH >= 7 && \
-    defined(__ARM_FEATURE_UNALIGNED) && __ARM_FEATURE_UNALIGNED
+    /*
+     * Fast implementations for architectures which support unaligned
+     * memory access, with the intention that the memcpy is compiled to
+     * a single load/store instruction followed or preceded by a byte
+     * swap intrinsic where the byte order differs.
+     * 
+     * These are not enabled generally since they may result in much
+     * worse code than the default implementations above. For example
+     * on ARM cortex-m3 with forced -mno-unaligned-access, actual memcpy
+     * calls have been seen. So, specific configurations should be added
+     * below only after it is confirmed the result is good. On x86, GCC
+     * does not merge the byte loads of the generic 32-bit read, so this
+     * is a significant improvement there.
+     * 
+     * Defining AIPSTACK_CONFIG_BINARYTOOLS_DISABLE_FAST forces use of
+     * the generic implementations.
+     */
     
+#if defined(AIPSTACK_CONFIG_BINARYTOOLS_DISABLE_FAST)
+#define AIPSTACK_BINARYTOOLS_FAST 0
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__BYTE_ORDER__) && ( \
+    (defined(__ARM_ARCH) && __ARM_ARCH >= 7 && \
+     defined(__ARM_FEATURE_UNALIGNED) && __ARM_FEATURE_UNALIGNED) || \
+    defined(__x86_64__) || defined(__i386__))
+    
+#define AIPSTACK_BINARYTOOLS_FAST 1
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 #define AIPSTACK_BINARYTOOLS_BIG_ENDIAN 0
 #elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
@@ -151,62 +184,76 @@ namespace BinaryToolsPrivate {
 #else
 #error "Unknown endian"
 #endif
+#define AIPSTACK_BINARYTOOLS_MEMCPY __builtin_memcpy
+#define AIPSTACK_BINARYTOOLS_BSWAP16 __builtin_bswap16
+#define AIPSTACK_BINARYTOOLS_BSWAP32 __builtin_bswap32
+#define AIPSTACK_BINARYTOOLS_BSWAP64 __builtin_bswap64
     
-    /*
-     * These implementations are for architectures which support
-     * unaligned memory access, with the intention that the memcpy
-     * is compiled to a single load/store instruction.
-     * 
-     * The code should work generally with GCC however it is not enabled
-     * by default since it may result in much worse code than default
-     * implementations above. For example on ARM cortex-m3 with forced
-     * -mno-unaligned-access, actual memcpy calls have been seen.
-     * So, specific configurations should be added in the test above
-     * only after it is confirmed the result is good.
-     */
+#elif defined(_MSC_VER) && \
+    (defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64))
     
-    template<bool BigEndian>
-    struct ReadUnsigned<std::uint32_t, BigEndian> {
-        AIPSTACK_ALWAYS_INLINE
-        static std::uint32_t readInt (char const *src)
-        {
-            std::uint32_t w;
-            __builtin_memcpy(&w, src, sizeof(w));
-            return BigEndian != AIPSTACK_BINARYTOOLS_BIG_ENDIAN ? __builtin_bswap32(w) : w;
-        }
-    };
+// All Windows targets are little endian.
+#define AIPSTACK_BINARYTOOLS_FAST 1
+#define AIPSTACK_BINARYTOOLS_BIG_ENDIAN 0
+#define AIPSTACK_BINARYTOOLS_MEMCPY std::memcpy
+#define AIPSTACK_BINARYTOOLS_BSWAP16 _byteswap_ushort
+#define AIPSTACK_BINARYTOOLS_BSWAP32 _byteswap_ulong
+#define AIPSTACK_BINARYTOOLS_BSWAP64 _byteswap_uint64
     
-    template<bool BigEndian>
-    struct WriteUnsigned<std::uint32_t, BigEndian> {
-        AIPSTACK_ALWAYS_INLINE
-        static void writeInt (std::uint32_t value, char *dst)
-        {
-            std::uint32_t w = BigEndian != AIPSTACK_BINARYTOOLS_BIG_ENDIAN ? __builtin_bswap32(value) : value;
-            __builtin_memcpy(dst, &w, sizeof(w));
-        }
-    };
+#else
+#define AIPSTACK_BINARYTOOLS_FAST 0
+#endif
+    
+#if AIPSTACK_BINARYTOOLS_FAST
+    
+    AIPSTACK_ALWAYS_INLINE std::uint16_t ByteSwap (std::uint16_t x)
+    {
+        return AIPSTACK_BINARYTOOLS_BSWAP16(x);
+    }
+    
+    AIPSTACK_ALWAYS_INLINE std::uint32_t ByteSwap (std::uint32_t x)
+    {
+        return AIPSTACK_BINARYTOOLS_BSWAP32(x);
+    }
     
-    template<bool BigEndian>
-    struct ReadUnsigned<std::uint16_t, BigEndian> {
+    AIPSTACK_ALWAYS_INLINE std::uint64_t ByteSwap (std::uint64_t x)
+    {
+        return AIPSTACK_BINARYTOOLS_BSWAP64(x);
+    }
+    
+    template<typename T, bool BigEndian>
+    struct ReadUnsignedFast {
         AIPSTACK_ALWAYS_INLINE
-        static std::uint16_t readInt (char const *src)
+        static T readInt (char const *src)
         {
-            std::uint16_t w;
-            __builtin_memcpy(&w, src, sizeof(w));
-            return BigEndian != AIPSTACK_BINARYTOOLS_BIG_ENDIAN ? __builtin_bswap16(w) : w;
+            T w;
+            AIPSTACK_BINARYTOOLS_MEMCPY(&w, src, sizeof(w));
+            return BigEndian != AIPSTACK_BINARYTOOLS_BIG_ENDIAN ? ByteSwap(w) : w;
         }
     };
     
-    template<bool BigEndian>
-    struct WriteUnsigned<std::uint16_t, BigEndian> {
+    template<typename T, bool BigEndian>
+    struct WriteUnsignedFast {
         AIPSTACK_ALWAYS_INLINE
-        static void writeInt (std::uint16_t value, char *dst)
+        static void writeInt (T value, char *dst)
         {
-            std::uint16_t w = BigEndian != AIPSTACK_BINARYTOOLS_BIG_ENDIAN ? __builtin_bswap16(value) : value;
-            __builtin_memcpy(dst, &w, sizeof(w));
+            T w = BigEndian != AIPSTACK_BINARYTOOLS_BIG_ENDIAN ? ByteSwap(value) : value;
+            AIPSTACK_BINARYTOOLS_MEMCPY(dst, &w, sizeof(w));
         }
     };
     
+    #define AIPSTACK_BINARYTOOLS_DEFINE_FAST(type) \
+    template<bool BigEndian> \
+    struct ReadUnsigned<type, BigEndian> : public ReadUnsignedFast<type, BigEndian> {}; \
+    template<bool BigEndian> \
+    struct WriteUnsigned<type, BigEndian> : public WriteUnsignedFast<type, BigEndian> {};
+    
+    AIPSTACK_BINARYTOOLS_DEFINE_FAST(std::uint16_t)
+    AIPSTACK_BINARYTOOLS_DEFINE_FAST(std::uint32_t)
+    AIPSTACK_BINARYTOOLS_DEFINE_FAST(std::uint64_t)
+    
+    #undef AIPSTACK_BINARYTOOLS_DEFINE_FAST
+    
 #endif
     
     template<bool IsSigned>
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_HASH_H
+#define AIPSTACK_HASH_H
+
+#include <cstdint>
+
+namespace AIpStack {
+
+/**
+ * @ingroup misc
+ * @defgroup hash Hashing Utilities
+ * @brief Non-cryptographic hashing for hash tables.
+ * 
+ * @{
+ */
+
+/**
+ * Incremental hash of 32-bit words.
+ * 
+ * This is based on the MurmurHash3 (32-bit) mixing functions. It is intended for
+ * hash tables and is not resistant to deliberate collisions.
+ */
+class HashAccumulator {
+public:
+    /**
+     * Construct the accumulator with the given seed.
+     * 
+     * @param seed Initial value of the hash state.
+     */
+    inline constexpr HashAccumulator (std::uint32_t seed = 0) :
+        m_state(seed)
+    {}
+    
+    /**
+     * Add a 32-bit word to the hash.
+     * 
+     * @param word Word to add.
+     */
+    inline constexpr void addWord (std::uint32_t word)
+    {
+        word *= 0xcc9e2d51u;
+        word = Rotl(word, 15);
+        word *= 0x1b873593u;
+        
+        m_state ^= word;
+        m_state = Rotl(m_state, 13);
+        m_state = m_state * 5u + 0xe6546b64u;
+    }
+    
+    /**
+     * Get the hash of the words added so far.
+     * 
+     * All bits of the result depend on all bits of the input, so the
+     * low bits can be used directly for indexing a table.
+     * 
+     * @return The hash value.
+     */
+    inline constexpr std::uint32_t getHash () const
+    {
+        std::uint32_t h = m_state;
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+private:
+    inline static constexpr std::uint32_t Rotl (std::uint32_t x, int n)
+    {
+        return std::uint32_t(x << n) | (x >> (32 - n));
+    }
+
+private:
+    std::uint32_t m_state;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -64,6 +64,19 @@
  *     arg.foo();
  * }
  * ```
+ * 
+ * The macro @ref AIPSTACK_PREFETCH is a statement-like hint that memory at an address will
+ * soon be read, which is useful when walking linked structures: the next node can be
+ * fetched while the current one is being examined.
+ * 
+ * ```
+ * for (Node *n = first; n != nullptr; n = n->next) {
+ *     if (n->next != nullptr) {
+ *         AIPSTACK_PREFETCH(n->next);
+ *     }
+ *     // ... examine n ...
+ * }
+ * ```
  * @{
  */
 
@@ -122,6 +135,16 @@
  */
 #define AIPSTACK_OPTIMIZE_SIZE
 
+/**
+ * Hint that memory at the given address will soon be read.
+ * 
+ * This has no functional effect. The address is evaluated but the memory is not accessed
+ * in a way that could fault, though it should point to an object anyway.
+ * 
+ * @param addr Address of the memory (a pointer expression).
+ */
+#define AIPSTACK_PREFETCH(addr) ((void)(addr))
+
 #else
 
 #define AIPSTACK_LIKELY(x) __builtin_expect(!!(x), 1)
@@ -129,6 +152,7 @@
 #define AIPSTACK_ALWAYS_INLINE __attribute__((always_inline)) inline
 #define AIPSTACK_NO_INLINE __attribute__((noinline))
 #define AIPSTACK_NO_RETURN __attribute__((noreturn))
+#define AIPSTACK_PREFETCH(addr) __builtin_prefetch(addr)
 
 #ifndef __clang__
 #define AIPSTACK_UNROLL_LOOPS __attribute__((optimize("unroll-loops")))
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_LAZY_RESOURCE_ARRAY_H
+#define AIPSTACK_LAZY_RESOURCE_ARRAY_H
+
+#include <cstddef>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup misc
+ * @{
+ */
+
+/**
+ * Container for a statically-sized array whose elements are constructed on demand.
+ * 
+ * Unlike @ref ResourceArray, construction of the container does not construct any
+ * elements and does not write to their storage. Elements are constructed one at a
+ * time in order of their indices using @ref constructNext, so the number of
+ * constructed elements is a high-water mark. This is intended for large tables where
+ * entries are taken from never-used storage before reusing entries from a free list,
+ * so that construction takes constant time and memory is only touched (and with
+ * demand paging, faulted in) as the table is actually used.
+ * 
+ * The destructor destructs the constructed elements in reverse order. Iteration
+ * (@ref begin, @ref end) covers only the constructed elements.
+ * 
+ * @tparam Elem Type of array elements.
+ * @tparam Size Number of array elements. Must be positive.
+ */
+template<typename Elem, std::size_t Size>
+class LazyResourceArray :
+    private NonCopyable<LazyResourceArray<Elem, Size>>
+{
+    static_assert(Size > 0);
+
+    using Storage = std::aligned_storage_t<sizeof(Elem), alignof(Elem)>;
+
+    static_assert(sizeof(Storage) == sizeof(Elem));
+
+public:
+    /**
+     * Construct the container with no constructed elements.
+     */
+    inline LazyResourceArray () :
+        m_num_constructed(0)
+    {}
+
+    /**
+     * Destruct the constructed elements in reverse order.
+     */
+    ~LazyResourceArray ()
+    {
+        for (std::size_t i = m_num_constructed; i > 0; i--) {
+            elem_ptr(i - 1)->Elem::~Elem();
+        }
+    }
+
+    /**
+     * Return the number of constructed elements.
+     * 
+     * @return Number of constructed elements, these are the elements with indices
+     *         less than this.
+     */
+    inline std::size_t numConstructed () const
+    {
+        return m_num_constructed;
+    }
+
+    /**
+     * Return whether all elements have been constructed.
+     * 
+     * @return True if @ref numConstructed is `Size`.
+     */
+    inline bool allConstructed () const
+    {
+        return m_num_constructed == Size;
+    }
+
+    /**
+     * Construct the next element.
+     * 
+     * This must not be called if all elements have been constructed (see
+     * @ref allConstructed). If the constructor throws, the number of constructed
+     * elements is unchanged.
+     * 
+     * @tparam Args Types of constructor arguments.
+     * @param args Arguments passed to the constructor of the element.
+     * @return Reference to the constructed element.
+     */
+    template<typename ...Args>
+    Elem & constructNext (Args && ... args)
+    {
+        AIPSTACK_ASSERT(m_num_constructed < Size);
+
+        Elem *elem = new(elem_ptr(m_num_constructed)) Elem(std::forward<Args>(args)...);
+        m_num_constructed++;
+        return *elem;
+    }
+
+    /**
+     * Return a reference to the element at the given index (non-const).
+     * 
+     * @param index Index of element. Must be less than `Size`. The element must
+     *        have been constructed unless the reference is only used to obtain its
+     *        address.
+     * @return Reference to the element at index `index`.
+     */
+    inline Elem & operator[] (std::size_t index)
+    {
+        AIPSTACK_ASSERT(index < Size);
+        return *elem_ptr(index);
+    }
+
+    /**
+     * Return a reference to the element at the given index (const).
+     * 
+     * @param index Index of element. See the non-const version.
+     * @return Reference to the element at index `index`.
+     */
+    inline Elem const & operator[] (std::size_t index) const
+    {
+        AIPSTACK_ASSERT(index < Size);
+        return *elem_ptr(index);
+    }
+
+    /**
+     * Return the number of elements including those not constructed.
+     * 
+     * @return `Size`
+     */
+    inline constexpr static std::size_t size ()
+    {
+        return Size;
+    }
+
+    /**
+     * Iterator type (pointer to element).
+     */
+    using iterator = Elem *;
+
+    /**
+     * Const iterator type (const pointer to element).
+     */
+    using const_iterator = Elem const *;
+
+    /**
+     * Return the begin iterator (non-const).
+     * 
+     * @return Begin iterator (pointer to start of array).
+     */
+    inline iterator begin ()
+    {
+        return elem_ptr(0);
+    }
+
+    /**
+     * Return the begin iterator (const).
+     * 
+     * @return Begin iterator (pointer to start of array).
+     */
+    inline const_iterator begin () const
+    {
+        return elem_ptr(0);
+    }
+
+    /**
+     * Return the end iterator (non-const).
+     * 
+     * @return End iterator (pointer past the last constructed element).
+     */
+    inline iterator end ()
+    {
+        return elem_ptr(m_num_constructed);
+    }
+
+    /**
+     * Return the end iterator (const).
+     * 
+     * @return End iterator (pointer past the last constructed element).
+     */
+    inline const_iterator end () const
+    {
+        return elem_ptr(m_num_constructed);
+    }
+
+private:
+    inline Elem * elem_ptr (std::size_t index)
+    {
+        return reinterpret_cast<Elem *>(&m_arr) + index;
+    }
+
+    inline Elem const * elem_ptr (std::size_t index) const
+    {
+        return reinterpret_cast<Elem const *>(&m_arr) + index;
+    }
+
+private:
+    std::size_t m_num_constructed;
+    Storage m_arr[Size];
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_HUGE_PAGE_MEMORY_H
+#define AIPSTACK_HUGE_PAGE_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Assert.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup misc-platform_specific
+ * @{
+ */
+
+/**
+ * Parameters for @ref HugePageMemory.
+ */
+struct HugePageMemoryParams {
+    /**
+     * NUMA node to bind the memory to, or -1 to use the default memory policy.
+     * 
+     * In a sharded deployment (see @ref IpFlowSteering), this would be the node
+     * of the core which the shard runs on, see @ref HugePageMemory::currentNumaNode.
+     */
+    int numa_node = -1;
+    
+    /**
+     * Whether to fail if explicit huge pages (`MAP_HUGETLB`) are not available.
+     * 
+     * If false, ordinary pages are used in that case, with transparent huge
+     * pages requested using `madvise(MADV_HUGEPAGE)`.
+     */
+    bool require_huge_pages = false;
+};
+
+/**
+ * Memory backed by 2 MiB huge pages, optionally bound to a NUMA node.
+ * 
+ * This class is only available on Linux.
+ * 
+ * The stack itself does not allocate memory, all its arrays (PCBs, ARP and
+ * path MTU entries and such) are members of the objects which the application
+ * creates. When these objects are large, such as stacks with many PCBs, or
+ * for large application buffers, allocating them in this memory reduces TLB
+ * misses, and binding them to the NUMA node of the core which uses them
+ * avoids remote memory accesses. @ref HugePageObject can be used to construct
+ * an object in such memory.
+ * 
+ * The size is rounded up to a multiple of 2 MiB. The memory is zero-filled
+ * and the pages are allocated (on the requested node) when first touched.
+ */
+class HugePageMemory :
+    private AIpStack::NonCopyable<HugePageMemory>
+{
+private:
+    // Values from linux/mempolicy.h, which is not included by the libc
+    // headers (numaif.h is part of libnuma).
+    inline static constexpr int MpolBind = 2;
+    inline static constexpr unsigned MpolMfStrict = 1u << 0;
+    
+    inline static constexpr int MapHuge2Mb = 21 << 26; // MAP_HUGE_2MB
+    
+    char *m_ptr;
+    std::size_t m_size;
+    bool m_huge_pages;
+
+public:
+    /**
+     * Size of a huge page.
+     */
+    inline static constexpr std::size_t HugePageSize = std::size_t(2) * 1024 * 1024;
+    
+    /**
+     * Allocate the memory.
+     * 
+     * @param min_size Minimum size of the memory, must be greater than zero.
+     *        The actual size is this rounded up to a multiple of @ref HugePageSize.
+     * @param params Parameters, see @ref HugePageMemoryParams.
+     * @throw std::runtime_error If allocating the memory or binding it to the
+     *        NUMA node fails, or if explicit huge pages are required but not
+     *        available.
+     */
+    explicit HugePageMemory (std::size_t min_size, HugePageMemoryParams const &params = {})
+    {
+        AIPSTACK_ASSERT(min_size > 0);
+        
+        if (min_size > std::size_t(-1) - HugePageSize) {
+            throw std::runtime_error("HugePageMemory: size is too large.");
+        }
+        m_size = (min_size + HugePageSize - 1) / HugePageSize * HugePageSize;
+        
+        // Try explicit huge pages first (these must have been reserved by the
+        // administrator, see vm.nr_hugepages).
+        void *ptr = ::mmap(nullptr, m_size, PROT_READ|PROT_WRITE,
+                           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MapHuge2Mb, -1, 0);
+        m_huge_pages = ptr != MAP_FAILED;
+        
+        if (!m_huge_pages) {
+            if (params.require_huge_pages) {
+                throw std::runtime_error("HugePageMemory: huge pages are not available.");
+            }
+            
+            // Use ordinary pages, reserving an extra huge page so that the
+            // memory can be aligned to HugePageSize, which is needed for the
+            // kernel to back it with transparent huge pages.
+            void *base = ::mmap(nullptr, m_size + HugePageSize, PROT_READ|PROT_WRITE,
+                                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) {
+                throw std::runtime_error("HugePageMemory: mmap failed.");
+            }
+            
+            // Unmap the unaligned head and the remaining tail.
+            char *base_ptr = static_cast<char *>(base);
+            std::size_t head = (HugePageSize - reinterpret_cast<std::uintptr_t>(base_ptr) %
+                                HugePageSize) % HugePageSize;
+            if (head > 0) {
+                ::munmap(base_ptr, head);
+            }
+            ::munmap(base_ptr + head + m_size, HugePageSize - head);
+            ptr = base_ptr + head;
+            
+            // Failure only means that transparent huge pages are not available.
+            ::madvise(ptr, m_size, MADV_HUGEPAGE);
+        }
+        
+        m_ptr = static_cast<char *>(ptr);
+        
+        // Bind the memory to the NUMA node. This is done before the memory is
+        // touched so that the pages are allocated on that node.
+        if (params.numa_node >= 0 && !bind_to_node(params.numa_node)) {
+            ::munmap(m_ptr, m_size);
+            throw std::runtime_error("HugePageMemory: mbind failed.");
+        }
+    }
+    
+    /**
+     * Destructor, unmaps the memory.
+     * 
+     * If unmapping fails, an error message is printed to standard error.
+     */
+    ~HugePageMemory ()
+    {
+        if (::munmap(m_ptr, m_size) < 0) {
+            int err = errno;
+            std::fprintf(stderr, "HugePageMemory: munmap failed, errno=%d\n", err);
+        }
+    }
+    
+    /**
+     * Get the start of the memory.
+     * 
+     * @return Pointer to the start of the memory, aligned to @ref HugePageSize.
+     */
+    inline char * ptr () const
+    {
+        return m_ptr;
+    }
+    
+    /**
+     * Get the size of the memory.
+     * 
+     * @return The size of the memory, a multiple of @ref HugePageSize.
+     */
+    inline std::size_t size () const
+    {
+        return m_size;
+    }
+    
+    /**
+     * Check whether the memory is backed by explicit huge pages.
+     * 
+     * @return True if explicit huge pages are used, false if ordinary pages
+     *         are used (which may still be backed by transparent huge pages).
+     */
+    inline bool usesHugePages () const
+    {
+        return m_huge_pages;
+    }
+    
+    /**
+     * Get the NUMA node of the core which the calling thread runs on.
+     * 
+     * This is intended to be called from a thread pinned to a core (as in a
+     * sharded deployment) to determine @ref HugePageMemoryParams::numa_node.
+     * 
+     * @return The NUMA node, or -1 if it could not be determined.
+     */
+    static int currentNumaNode ()
+    {
+        unsigned cpu;
+        unsigned node;
+        if (::syscall(SYS_getcpu, &cpu, &node, nullptr) < 0) {
+            return -1;
+        }
+        return int(node);
+    }
+
+private:
+    bool bind_to_node (int node)
+    {
+        constexpr std::size_t BitsPerWord = 8 * sizeof(unsigned long);
+        constexpr std::size_t MaxNodes = 1024;
+        
+        if (std::size_t(node) >= MaxNodes) {
+            return false;
+        }
+        
+        unsigned long nodemask[MaxNodes / BitsPerWord] = {};
+        nodemask[std::size_t(node) / BitsPerWord] |=
+            1ul << (std::size_t(node) % BitsPerWord);
+        
+        return ::syscall(SYS_mbind, m_ptr, m_size, MpolBind, nodemask,
+                         MaxNodes + 1, MpolMfStrict) == 0;
+    }
+};
+
+/**
+ * An object constructed in @ref HugePageMemory.
+ * 
+ * This is a convenience for allocating large objects such as an @ref IpStack
+ * in huge pages bound to a NUMA node. The object is constructed in the
+ * constructor and destructed in the destructor.
+ * 
+ * @tparam T Type of the object. Its alignment must not exceed @ref
+ *         HugePageMemory::HugePageSize.
+ */
+template<typename T>
+class HugePageObject :
+    private AIpStack::NonCopyable<HugePageObject<T>>
+{
+    static_assert(alignof(T) <= HugePageMemory::HugePageSize);
+
+private:
+    HugePageMemory m_mem;
+    T *m_obj;
+
+public:
+    /**
+     * Allocate the memory and construct the object.
+     * 
+     * @param params Parameters for @ref HugePageMemory.
+     * @param args Arguments to the constructor of the object.
+     * @throw std::runtime_error If allocating the memory fails. Any exception
+     *        from the constructor of the object is propagated.
+     */
+    template<typename... Args>
+    explicit HugePageObject (HugePageMemoryParams const &params, Args &&... args) :
+        m_mem(sizeof(T), params)
+    {
+        m_obj = new(m_mem.ptr()) T(std::forward<Args>(args)...);
+    }
+    
+    /**
+     * Destruct the object and free the memory.
+     */
+    ~HugePageObject ()
+    {
+        m_obj->~T();
+    }
+    
+    /**
+     * Get the memory which the object is in.
+     * 
+     * @return Reference to the memory.
+     */
+    inline HugePageMemory const & memory () const
+    {
+        return m_mem;
+    }
+    
+    /**
+     * Get a pointer to the object.
+     * 
+     * @return Pointer to the object.
+     */
+    inline T * get () const
+    {
+        return m_obj;
+    }
+    
+    /**
+     * Access the object.
+     * 
+     * @return Reference to the object.
+     */
+    inline T & operator* () const
+    {
+        return *m_obj;
+    }
+    
+    /**
+     * Access the object.
+     * 
+     * @return Pointer to the object.
+     */
+    inline T * operator-> () const
+    {
+        return m_obj;
+    }
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_MIRRORED_RING_MEMORY_H
+#define AIPSTACK_MIRRORED_RING_MEMORY_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cerrno>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup misc-platform_specific
+ * @{
+ */
+
+/**
+ * Memory for a ring buffer which is mapped twice back to back.
+ * 
+ * This class is only available on Linux.
+ * 
+ * The memory is allocated as an anonymous file (`memfd_create`) which is mapped
+ * twice into a contiguous virtual address range, so that for any offset less
+ * than @ref size(), the byte at (@ref ptr() + offset + @ref size()) is the same
+ * as the byte at (@ref ptr() + offset). Consequently any range of up to @ref
+ * size() bytes within the ring buffer is contiguous in memory, which allows
+ * using the buffer with @ref SendRingBuffer::setupMirrored and @ref
+ * RecvRingBuffer::setupMirrored.
+ */
+class MirroredRingMemory :
+    private AIpStack::NonCopyable<MirroredRingMemory>
+{
+private:
+    char *m_ptr;
+    std::size_t m_size;
+    
+public:
+    /**
+     * Allocate and map the memory.
+     * 
+     * @param min_size Minimum size of the ring buffer, must be greater than zero.
+     *        The actual size is this rounded up to a multiple of the page size.
+     * @throw std::runtime_error If allocating or mapping the memory fails.
+     */
+    explicit MirroredRingMemory (std::size_t min_size)
+    {
+        AIPSTACK_ASSERT(min_size > 0);
+        
+        long page_size = ::sysconf(_SC_PAGESIZE);
+        if (page_size <= 0) {
+            throw std::runtime_error("sysconf(_SC_PAGESIZE) failed.");
+        }
+        
+        std::size_t page = std::size_t(page_size);
+        if (min_size > (std::size_t(-1) / 2) - page) {
+            throw std::runtime_error("MirroredRingMemory: size is too large.");
+        }
+        m_size = (min_size + page - 1) / page * page;
+        
+        FileDescriptorWrapper fd(::memfd_create("aipstack-ring", MFD_CLOEXEC));
+        if (!fd) {
+            throw std::runtime_error("memfd_create failed.");
+        }
+        
+        if (::ftruncate(*fd, off_t(m_size)) < 0) {
+            throw std::runtime_error("ftruncate failed.");
+        }
+        
+        // Reserve the address range for both mappings, then map the file over
+        // each half of it.
+        void *base = ::mmap(nullptr, 2 * m_size, PROT_NONE,
+                            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("mmap (reserve) failed.");
+        }
+        m_ptr = static_cast<char *>(base);
+        
+        for (std::size_t half_offset : {std::size_t(0), m_size}) {
+            void *addr = ::mmap(m_ptr + half_offset, m_size, PROT_READ|PROT_WRITE,
+                                MAP_SHARED|MAP_FIXED, *fd, 0);
+            if (addr == MAP_FAILED) {
+                ::munmap(m_ptr, 2 * m_size);
+                throw std::runtime_error("mmap (mirror) failed.");
+            }
+        }
+        
+        // The file descriptor is closed here, the mappings keep the file alive.
+    }
+    
+    /**
+     * Destructor, unmaps the memory.
+     * 
+     * If unmapping fails, an error message is printed to standard error.
+     */
+    ~MirroredRingMemory ()
+    {
+        if (::munmap(m_ptr, 2 * m_size) < 0) {
+            int err = errno;
+            std::fprintf(stderr, "MirroredRingMemory: munmap failed, errno=%d\n", err);
+        }
+    }
+    
+    /**
+     * Get the start of the memory.
+     * 
+     * @return Pointer to the start of the memory; (2 * @ref size()) bytes are
+     *         accessible starting here.
+     */
+    inline char * ptr () const
+    {
+        return m_ptr;
+    }
+    
+    /**
+     * Get the size of the ring buffer.
+     * 
+     * @return The size of the ring buffer, which is half of the mapped size.
+     */
+    inline std::size_t size () const
+    {
+        return m_size;
+    }
+};
+
+/** @} */
+
+}
+
+#endif
@@ -46,6 +46,10 @@ namespace AIpStack {
  * a platform implementation. It implements all the functionality described in
  * the @ref PlatformImplStub documentation. Note that the documentation of this
  * class does not include definitions matching those in @ref PlatformImplStub.
+ * 
+ * The `getEventTime` function returns the time captured by the event loop once
+ * per iteration (@ref EventLoop::getEventTime) and is therefore much cheaper than
+ * `getTime`, which reads the system clock on every call.
  */
 class HostedPlatformImpl :
     public NonCopyable<HostedPlatformImpl>
@@ -144,6 +144,10 @@ public:
      * This function must implement a clock as described in @ref TimeType and
      * @ref TimeFreq.
      * 
+     * The stack uses this function only where an accurate time is needed, such
+     * as for pacing and for generating initial sequence numbers. Elsewhere it uses
+     * @ref getEventTime, which may be cheaper.
+     * 
      * This function must never throw an exception.
      * 
      * @return The current time in ticks.
@@ -158,7 +162,10 @@ public:
      * 
      * This function is like @ref getTime, except that it may return a cached value
      * taken at the start of an event loop iteration or other time which is not
-     * significantly earlier than the actual time of this call. 
+     * significantly earlier than the actual time of this call. The stack uses this
+     * function on hot paths (for example RTT measurement and setting timers), so
+     * an implementation should make it cheap, for example by capturing the time
+     * once per event loop iteration.
      * 
      * This function must never throw an exception.
      * 
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_PLATFORM_TIMER_WHEEL_H
+#define AIPSTACK_PLATFORM_TIMER_WHEEL_H
+
+#include <cstddef>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/structure/TimerWheel.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * @ingroup platform
+ * @{
+ */
+
+/**
+ * Multiplexes many timers onto a single platform timer using a hashed
+ * timing wheel (@ref TimerWheelService).
+ * 
+ * Starting and stopping a @ref Timer is O(1) and does not touch the platform
+ * timer except when the new expiration is earlier than the one the platform
+ * timer is currently set for. Timers which expire within the same tick
+ * (2^TickShift platform time units) are dispatched together from one platform
+ * timer callback, and may be dispatched up to one tick late.
+ * 
+ * This is useful when a large number of mostly short-lived timers is needed
+ * (e.g. TCP connection timers), so that the event loop only has to manage a
+ * single timer for all of them.
+ * 
+ * @tparam PlatformImpl The platform implementation class.
+ * @tparam NumSlots Number of wheel slots, must be a power of two.
+ * @tparam TickShift Base-2 logarithm of the tick duration in platform time units.
+ */
+template<typename PlatformImpl, std::size_t NumSlots, int TickShift>
+class PlatformTimerWheel :
+    private NonCopyable<PlatformTimerWheel<PlatformImpl, NumSlots, TickShift>>
+{
+    using Platform = PlatformFacade<PlatformImpl>;
+    AIPSTACK_USE_TYPES(Platform, (TimeType))
+    
+    struct WheelNodeUserData {};
+    
+public:
+    class Timer;
+    
+private:
+    using LinkModel = PointerLinkModel<Timer>;
+    
+    using TheTimerWheelService = TimerWheelService<NumSlots, TickShift>;
+    
+    using WheelNode = typename TheTimerWheelService::template Node<
+        LinkModel, TimeType, WheelNodeUserData>;
+    
+public:
+    /**
+     * Timer in a @ref PlatformTimerWheel.
+     * 
+     * The interface matches that of @ref PlatformFacade::Timer, except that the
+     * constructor takes the timer wheel instead of the platform facade. The
+     * timer wheel must outlive the timer.
+     */
+    class Timer :
+        private NonCopyable<Timer>
+    {
+        friend PlatformTimerWheel;
+    
+    public:
+        /**
+         * Type of callback used to report the expiration of the timer.
+         */
+        using TimerHandler = Function<void()>;
+        
+        /**
+         * Construct the timer, initially not set.
+         * 
+         * @param wheel The timer wheel.
+         * @param handler Callback function (must not be null).
+         */
+        inline Timer (PlatformTimerWheel &wheel, TimerHandler handler) :
+            m_wheel(&wheel),
+            m_handler(handler),
+            m_set_time(0),
+            m_is_set(false)
+        {}
+        
+        /**
+         * Destruct the timer, unsetting it if it is set.
+         */
+        inline ~Timer ()
+        {
+            unset();
+        }
+        
+        /**
+         * Return the platform facade of the timer wheel.
+         * 
+         * @return The platform facade.
+         */
+        inline Platform platform () const
+        {
+            return m_wheel->platform();
+        }
+        
+        /**
+         * Return whether the timer is set.
+         * 
+         * @return Whether the timer is set.
+         */
+        inline bool isSet () const
+        {
+            return m_is_set;
+        }
+        
+        /**
+         * Return the last time that the timer was set to.
+         * 
+         * This is exactly the time passed to @ref setAt, even though the timer
+         * wheel may dispatch the timer later.
+         * 
+         * @return The last time the timer was set to.
+         */
+        inline TimeType getSetTime () const
+        {
+            return m_set_time;
+        }
+        
+        /**
+         * Unset the timer if it is set.
+         */
+        void unset ()
+        {
+            if (m_is_set) {
+                m_wheel->m_wheel.remove(*this);
+                m_is_set = false;
+            }
+        }
+        
+        /**
+         * Set the timer to expire at the given time.
+         * 
+         * @param abs_time Absolute expiration time.
+         */
+        void setAt (TimeType abs_time)
+        {
+            unset();
+            m_set_time = abs_time;
+            m_is_set = true;
+            m_wheel->insert_timer(*this, abs_time);
+        }
+        
+        /**
+         * Set the timer to expire after the given relative time.
+         * 
+         * @param rel_time Relative expiration time.
+         */
+        void setAfter (TimeType rel_time)
+        {
+            TimeType abs_time = platform().getTime() + rel_time;
+            return setAt(abs_time);
+        }
+        
+        /**
+         * Set the timer to expire now.
+         */
+        inline void setNow ()
+        {
+            return setAfter(0);
+        }
+    
+    private:
+        WheelNode m_wheel_node;
+        PlatformTimerWheel *m_wheel;
+        TimerHandler m_handler;
+        TimeType m_set_time;
+        bool m_is_set;
+    };
+    
+private:
+    struct TimerNodeAccessor :
+        public MemberAccessor<Timer, WheelNode, &Timer::m_wheel_node> {};
+    
+    using Wheel = typename TheTimerWheelService::template Queue<
+        LinkModel, TimerNodeAccessor, TimeType, WheelNodeUserData>;
+    
+public:
+    /**
+     * Construct the timer wheel.
+     * 
+     * @param platform_ The platform facade.
+     */
+    inline PlatformTimerWheel (Platform platform_) :
+        m_timer(platform_, AIPSTACK_BIND_MEMBER_TN(&PlatformTimerWheel::timerHandler, this))
+    {}
+    
+    /**
+     * Return the platform facade.
+     * 
+     * @return The platform facade.
+     */
+    inline Platform platform () const
+    {
+        return m_timer.platform();
+    }
+    
+private:
+    void insert_timer (Timer &timer, TimeType abs_time)
+    {
+        TimeType now = platform().getTime();
+        m_wheel.updateReferenceTime(now);
+        m_wheel.insert(timer, abs_time);
+        
+        // Only move the platform timer earlier. Removals never update it, if
+        // it expires with nothing to dispatch it is simply rescheduled.
+        TimeType first_time;
+        bool have_first = m_wheel.getFirstTime(first_time);
+        AIPSTACK_ASSERT(have_first);
+        (void)have_first;
+        
+        if (!m_timer.isSet() ||
+            TimeType(first_time - now) < TimeType(m_timer.getSetTime() - now))
+        {
+            m_timer.setAt(first_time);
+        }
+    }
+    
+    void timerHandler ()
+    {
+        m_wheel.prepareForRemovingExpired(platform().getTime());
+        
+        // Dispatch expired timers. Handlers may freely set and unset timers
+        // including ones which are about to be dispatched.
+        typename LinkModel::Ref timer_ref;
+        while (!(timer_ref = m_wheel.removeExpired()).isNull()) {
+            Timer &timer = *timer_ref;
+            AIPSTACK_ASSERT(timer.m_is_set);
+            
+            timer.m_is_set = false;
+            timer.m_handler();
+        }
+        
+        TimeType first_time;
+        if (m_wheel.getFirstTime(first_time)) {
+            m_timer.setAt(first_time);
+        } else {
+            m_timer.unset();
+        }
+    }
+    
+private:
+    typename Platform::Timer m_timer;
+    StructureRaiiWrapper<Wheel, StructureDestructAction::AssertEmpty> m_wheel;
+};
+
+/** @} */
+
+}
+
+#endif
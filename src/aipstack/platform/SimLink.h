@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_SIM_LINK_H
+#define AIPSTACK_SIM_LINK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup platform
+ * @{
+ */
+
+/**
+ * Configuration parameters for one direction of a @ref SimLink.
+ */
+struct SimLinkParams {
+    /**
+     * One-way propagation delay in @ref SimPlatformImpl ticks (nanoseconds).
+     */
+    std::uint64_t delay = 0;
+
+    /**
+     * Bandwidth in bits per second, zero for infinite bandwidth.
+     * 
+     * Frames are transmitted one after another, each taking its size divided
+     * by the bandwidth, and wait in a transmit queue while the link is busy.
+     */
+    std::uint64_t bandwidth = 0;
+
+    /**
+     * Maximum number of bytes in the transmit queue, zero for no limit.
+     * 
+     * A frame which would make the queue exceed this is dropped (tail drop).
+     * This has no effect with infinite bandwidth.
+     */
+    std::size_t queue_size = 0;
+
+    /**
+     * Probability that a frame is lost after transmission.
+     */
+    double loss = 0.0;
+
+    /**
+     * Probability that a frame is delayed by an additional @ref reorder_delay,
+     * so that frames sent after it may overtake it.
+     */
+    double reorder = 0.0;
+
+    /**
+     * Additional delay of reordered frames in ticks.
+     */
+    std::uint64_t reorder_delay = 0;
+
+    /**
+     * Seed of the pseudo-random generator used for loss and reordering.
+     */
+    std::uint64_t seed = 1;
+};
+
+/**
+ * Statistics for one direction of a @ref SimLink.
+ */
+struct SimLinkStats {
+    /**
+     * Number of frames accepted for transmission.
+     */
+    std::uint64_t tx_frames = 0;
+
+    /**
+     * Number of bytes accepted for transmission.
+     */
+    std::uint64_t tx_bytes = 0;
+
+    /**
+     * Number of frames dropped because the transmit queue was full.
+     */
+    std::uint64_t queue_drops = 0;
+
+    /**
+     * Number of frames lost according to @ref SimLinkParams::loss.
+     */
+    std::uint64_t lost_frames = 0;
+
+    /**
+     * Number of frames delayed according to @ref SimLinkParams::reorder.
+     */
+    std::uint64_t reordered_frames = 0;
+
+    /**
+     * Number of frames delivered to the receiving endpoint.
+     */
+    std::uint64_t delivered_frames = 0;
+};
+
+/**
+ * Simulated point-to-point Ethernet link for use with @ref SimPlatformImpl.
+ * 
+ * The link has two endpoints (see @ref Endpoint) whose interface resembles that
+ * of @ref TapDevice, so that each can serve as the driver of an @ref EthIpIface
+ * of a different stack. Frames sent at one endpoint are delivered to the other
+ * endpoint from a timer handler, according to the @ref SimLinkParams of that
+ * direction, which model delay, bandwidth, queuing, loss and reordering.
+ * 
+ * Loss and reordering are decided using a pseudo-random generator with a fixed
+ * seed, so a simulation is reproducible.
+ */
+class SimLink :
+    private NonCopyable<SimLink>
+{
+    using Platform = PlatformFacade<SimPlatformImpl>;
+    using TimeType = SimPlatformImpl::TimeType;
+
+public:
+    /**
+     * One endpoint of a @ref SimLink.
+     */
+    class Endpoint :
+        private NonCopyable<Endpoint>
+    {
+        friend SimLink;
+
+    public:
+        /**
+         * Type of callback used to deliver frames received from the other endpoint.
+         * 
+         * @param frame Frame data, starting with the 14-byte Ethernet header. The
+         *        referenced buffers must not be used outside of the callback
+         *        function.
+         */
+        using FrameReceivedHandler = Function<void(IpBufRef frame)>;
+
+        /**
+         * Set the callback used to deliver received frames.
+         * 
+         * Frames arriving while no handler is set are discarded.
+         * 
+         * @param handler Callback function, or null.
+         */
+        inline void setFrameReceivedHandler (FrameReceivedHandler handler)
+        {
+            m_handler = handler;
+        }
+
+        /**
+         * Get the IP MTU of the link.
+         * 
+         * @return The IP MTU, not including the 14-byte Ethernet header.
+         */
+        inline std::size_t getMtu () const
+        {
+            return m_link->m_mtu;
+        }
+
+        /**
+         * Send a frame to the other endpoint.
+         * 
+         * The frame is copied and the call never delivers frames synchronously.
+         * 
+         * @param frame Frame data, starting with the 14-byte Ethernet header.
+         * @return Success, or an error if the frame is too short or too long.
+         *         Dropped and lost frames are reported as success.
+         */
+        IpErr sendFrame (IpBufRef frame);
+
+        /**
+         * Get the parameters of the direction from this endpoint to the other.
+         * 
+         * @return The parameters.
+         */
+        inline SimLinkParams const & getParams () const
+        {
+            return m_params;
+        }
+
+        /**
+         * Set the parameters of the direction from this endpoint to the other.
+         * 
+         * This affects frames sent afterwards, and also resets the pseudo-random
+         * generator using the new seed.
+         * 
+         * @param params The parameters.
+         */
+        void setParams (SimLinkParams const &params);
+
+        /**
+         * Get the statistics of the direction from this endpoint to the other.
+         * 
+         * @return The statistics.
+         */
+        inline SimLinkStats const & getStats () const
+        {
+            return m_stats;
+        }
+
+    private:
+        struct InFlightFrame {
+            TimeType arrival_time;
+            std::uint64_t seq;
+            std::vector<char> data;
+
+            // Heap ordering, so that the earliest frame is at the front.
+            inline bool operator< (InFlightFrame const &other) const
+            {
+                if (arrival_time != other.arrival_time) {
+                    return arrival_time > other.arrival_time;
+                }
+                return seq > other.seq;
+            }
+        };
+
+        Endpoint (SimLink *link, Platform platform, SimLinkParams const &params);
+
+        TimeType transmit_ticks (std::size_t len) const;
+
+        double random_unit ();
+
+        void timerHandler ();
+
+    private:
+        SimLink *m_link;
+        Endpoint *m_peer;
+        Platform::Timer m_timer;
+        FrameReceivedHandler m_handler;
+        SimLinkParams m_params;
+        SimLinkStats m_stats;
+        std::vector<InFlightFrame> m_in_flight;
+        TimeType m_busy_until;
+        std::uint64_t m_next_seq;
+        std::uint64_t m_random_state;
+    };
+
+    /**
+     * Construct the link with the same parameters for both directions.
+     * 
+     * @param platform Platform facade of the @ref SimPlatformImpl.
+     * @param mtu IP MTU of the link, not including the Ethernet header.
+     * @param params Parameters of both directions. The seed of the direction
+     *        from endpoint 1 to endpoint 0 is modified so that the directions
+     *        are independent.
+     */
+    SimLink (Platform platform, std::size_t mtu, SimLinkParams const &params);
+
+    /**
+     * Construct the link with different parameters for each direction.
+     * 
+     * @param platform Platform facade of the @ref SimPlatformImpl.
+     * @param mtu IP MTU of the link, not including the Ethernet header.
+     * @param params0 Parameters of the direction from endpoint 0 to endpoint 1.
+     * @param params1 Parameters of the direction from endpoint 1 to endpoint 0.
+     */
+    SimLink (Platform platform, std::size_t mtu, SimLinkParams const &params0,
+             SimLinkParams const &params1);
+
+    /**
+     * Get one of the endpoints.
+     * 
+     * @param index Endpoint index, 0 or 1.
+     * @return The endpoint.
+     */
+    inline Endpoint & endpoint (int index)
+    {
+        AIPSTACK_ASSERT(index == 0 || index == 1);
+        return (index == 0) ? m_endpoint0 : m_endpoint1;
+    }
+
+private:
+    inline static SimLinkParams reverse_params (SimLinkParams params)
+    {
+        params.seed ^= 0x5bd1e9955bd1e995;
+        return params;
+    }
+
+private:
+    std::size_t m_mtu;
+    Endpoint m_endpoint0;
+    Endpoint m_endpoint1;
+};
+
+#ifndef IN_DOXYGEN
+
+inline SimLink::SimLink (Platform platform, std::size_t mtu, SimLinkParams const &params) :
+    SimLink(platform, mtu, params, reverse_params(params))
+{}
+
+inline SimLink::SimLink (Platform platform, std::size_t mtu,
+                         SimLinkParams const &params0, SimLinkParams const &params1) :
+    m_mtu(mtu),
+    m_endpoint0(this, platform, params0),
+    m_endpoint1(this, platform, params1)
+{
+    m_endpoint0.m_peer = &m_endpoint1;
+    m_endpoint1.m_peer = &m_endpoint0;
+}
+
+inline SimLink::Endpoint::Endpoint (
+    SimLink *link, Platform platform, SimLinkParams const &params)
+:
+    m_link(link),
+    m_peer(nullptr),
+    m_timer(platform, AIPSTACK_BIND_MEMBER_TN(&Endpoint::timerHandler, this)),
+    m_busy_until(platform.getTime()),
+    m_next_seq(0)
+{
+    setParams(params);
+}
+
+inline void SimLink::Endpoint::setParams (SimLinkParams const &params)
+{
+    m_params = params;
+    m_random_state = params.seed;
+}
+
+inline IpErr SimLink::Endpoint::sendFrame (IpBufRef frame)
+{
+    if (frame.tot_len < EthHeader::Size) {
+        return IpErr::HardwareError;
+    }
+    if (frame.tot_len > EthHeader::Size + m_link->m_mtu) {
+        return IpErr::PacketTooLarge;
+    }
+
+    Platform platform = m_timer.platform();
+    TimeType now = platform.getTime();
+
+    // Determine when transmission can start, after the frames already queued.
+    TimeType start_time = Platform::timeGreaterOrEqual(m_busy_until, now) ?
+        m_busy_until : now;
+    TimeType tx_ticks = transmit_ticks(frame.tot_len);
+
+    if (m_params.queue_size != 0 && m_params.bandwidth != 0) {
+        TimeType queue_ticks = TimeType(start_time - now) + tx_ticks;
+        if (queue_ticks > transmit_ticks(m_params.queue_size)) {
+            m_stats.queue_drops++;
+            return IpErr::Success;
+        }
+    }
+
+    m_busy_until = start_time + tx_ticks;
+    m_stats.tx_frames++;
+    m_stats.tx_bytes += frame.tot_len;
+
+    // The frame occupies the link even if it is lost.
+    if (m_params.loss > 0.0 && random_unit() < m_params.loss) {
+        m_stats.lost_frames++;
+        return IpErr::Success;
+    }
+
+    TimeType arrival_time = m_busy_until + m_params.delay;
+    if (m_params.reorder > 0.0 && random_unit() < m_params.reorder) {
+        arrival_time += m_params.reorder_delay;
+        m_stats.reordered_frames++;
+    }
+
+    InFlightFrame entry{arrival_time, m_next_seq++, std::vector<char>(frame.tot_len)};
+    ipBufTakeBytes(frame, frame.tot_len, entry.data.data());
+    m_in_flight.push_back(std::move(entry));
+    std::push_heap(m_in_flight.begin(), m_in_flight.end());
+
+    TimeType first_time = m_in_flight.front().arrival_time;
+    if (!m_timer.isSet() || m_timer.getSetTime() != first_time) {
+        m_timer.setAt(first_time);
+    }
+
+    return IpErr::Success;
+}
+
+inline auto SimLink::Endpoint::transmit_ticks (std::size_t len) const -> TimeType
+{
+    if (m_params.bandwidth == 0) {
+        return 0;
+    }
+    return TimeType(len) * 8 * SimPlatformImpl::TicksPerSecond / m_params.bandwidth;
+}
+
+inline double SimLink::Endpoint::random_unit ()
+{
+    // SplitMix64, using the top 53 bits for the mantissa.
+    std::uint64_t z = (m_random_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z = z ^ (z >> 31);
+    return double(z >> 11) * (1.0 / double(std::uint64_t(1) << 53));
+}
+
+inline void SimLink::Endpoint::timerHandler ()
+{
+    // Deliver one frame per timer expiration, since the receive handler may
+    // destroy the link.
+    AIPSTACK_ASSERT(!m_in_flight.empty());
+    AIPSTACK_ASSERT(Platform::timeGreaterOrEqual(
+        m_timer.platform().getTime(), m_in_flight.front().arrival_time));
+
+    std::pop_heap(m_in_flight.begin(), m_in_flight.end());
+    std::vector<char> data = std::move(m_in_flight.back().data);
+    m_in_flight.pop_back();
+
+    if (!m_in_flight.empty()) {
+        m_timer.setAt(m_in_flight.front().arrival_time);
+    }
+
+    m_stats.delivered_frames++;
+
+    if (m_peer->m_handler) {
+        IpBufNode node{data.data(), data.size(), nullptr};
+        m_peer->m_handler(IpBufRef{&node, 0, data.size()});
+    }
+}
+
+#endif
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_SIM_PLATFORM_IMPL_H
+#define AIPSTACK_SIM_PLATFORM_IMPL_H
+
+#include <cstdint>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup platform
+ * @{
+ */
+
+/**
+ * Platform implementation with a simulated clock, for deterministic tests and
+ * benchmarks.
+ * 
+ * It implements all the functionality described in the @ref PlatformImplStub
+ * documentation. Note that the documentation of this class does not include
+ * definitions matching those in @ref PlatformImplStub.
+ * 
+ * The clock does not advance by itself. Instead, the application drives the
+ * simulation using @ref runOne, @ref runUntil or @ref runFor, which dispatch
+ * expired timers in order of their expiration time and advance the clock to
+ * the expiration time of each timer as it is dispatched. Timers expiring at the
+ * same time are dispatched in the order in which they were set. The result of
+ * a simulation therefore depends only on its inputs and it runs as fast as the
+ * handlers execute, regardless of the simulated time span.
+ * 
+ * Any number of stacks may share a single SimPlatformImpl; they can be connected
+ * using @ref SimLink. The clock starts at zero and has a resolution of one
+ * nanosecond (see @ref TicksPerSecond). Since nothing advances the clock while
+ * a handler runs, `getTime` and `getEventTime` are equivalent.
+ */
+class SimPlatformImpl :
+    public NonCopyable<SimPlatformImpl>
+{
+public:
+    #ifndef IN_DOXYGEN
+    class Timer;
+    #endif
+
+private:
+    using TimerLinkModel = PointerLinkModel<Timer>;
+    using TimerHeapNode = LinkedHeapNode<TimerLinkModel>;
+    struct TimerHeapNodeAccessor;
+    struct TimerCompare;
+    using TimerHeap = LinkedHeap<TimerHeapNodeAccessor, TimerCompare, TimerLinkModel>;
+
+public:
+    /**
+     * Type used to represent time, same as @ref PlatformImplStub::TimeType.
+     */
+    using TimeType = std::uint64_t;
+
+    /**
+     * Number of clock ticks in one second.
+     */
+    inline static constexpr TimeType TicksPerSecond = 1000000000;
+
+    /**
+     * Construct the platform implementation, with the clock at zero and no
+     * timers set.
+     */
+    inline SimPlatformImpl ();
+
+    /**
+     * Dispatch the timer which expires first.
+     * 
+     * The clock is advanced to the expiration time of the timer (unless it was
+     * set to a time in the past) and its handler is called.
+     * 
+     * This must not be called from a timer handler.
+     * 
+     * @return True if a timer was dispatched, false if no timer is set.
+     */
+    inline bool runOne ();
+
+    /**
+     * Dispatch all timers which expire no later than the given time and then
+     * advance the clock to that time.
+     * 
+     * This includes timers which are set by the handlers while this is running.
+     * If the time is in the past, this does nothing.
+     * 
+     * This must not be called from a timer handler.
+     * 
+     * @param end_time Absolute time to run the simulation until.
+     */
+    inline void runUntil (TimeType end_time);
+
+    /**
+     * Run the simulation for the given duration.
+     * 
+     * This is equivalent to @ref runUntil ""(getTime() + duration).
+     * 
+     * @param duration Duration in ticks.
+     */
+    inline void runFor (TimeType duration);
+
+    /**
+     * Return whether any timer is set.
+     * 
+     * @return True if a timer is set, false if the simulation has nothing to do.
+     */
+    inline bool hasTimers () const;
+
+    /**
+     * Return the number of timer handlers that have been called.
+     * 
+     * @return Number of dispatched timers.
+     */
+    inline std::uint64_t getNumDispatched () const;
+
+    #ifndef IN_DOXYGEN
+
+    using ThePlatformRef = PlatformRef<SimPlatformImpl>;
+
+    inline static constexpr bool ImplIsStatic = false;
+
+    inline static constexpr double TimeFreq = TicksPerSecond;
+
+    inline static constexpr TimeType RelativeTimeLimit = TypeMax<TimeType>;
+
+    inline TimeType getTime ();
+
+    inline TimeType getEventTime ();
+
+    class Timer :
+        private NonCopyable<Timer>,
+        private ThePlatformRef
+    {
+        friend SimPlatformImpl;
+
+    public:
+        inline Timer (ThePlatformRef ref, Function<void()> handler);
+
+        inline ~Timer ();
+
+        using ThePlatformRef::ref;
+
+        inline bool isSet () const;
+
+        inline TimeType getSetTime () const;
+
+        inline void unset ();
+
+        inline void setAt (TimeType abs_time);
+
+    private:
+        TimerHeapNode m_heap_node;
+        Function<void()> m_handler;
+        TimeType m_set_time;
+        // Expiration time clamped to be not earlier than the time the timer was
+        // set, so that it can be compared without regard to clock wraparound.
+        TimeType m_expire_time;
+        // Sequence number for dispatching in the order of setting.
+        std::uint64_t m_seq;
+        bool m_is_set;
+    };
+
+    #endif
+
+private:
+    inline void dispatch_first ();
+
+private:
+    TimeType m_now;
+    std::uint64_t m_next_seq;
+    std::uint64_t m_num_dispatched;
+    StructureRaiiWrapper<TimerHeap, StructureDestructAction::AssertEmpty> m_timer_heap;
+};
+
+#ifndef IN_DOXYGEN
+
+struct SimPlatformImpl::TimerHeapNodeAccessor :
+    public MemberAccessor<Timer, TimerHeapNode, &Timer::m_heap_node> {};
+
+struct SimPlatformImpl::TimerCompare {
+    AIPSTACK_USE_TYPES(TimerLinkModel, (State, Ref))
+
+    inline static int compareEntries (State, Ref ref1, Ref ref2)
+    {
+        Timer &tim1 = *ref1;
+        Timer &tim2 = *ref2;
+
+        if (tim1.m_expire_time != tim2.m_expire_time) {
+            return (tim1.m_expire_time < tim2.m_expire_time) ? -1 : 1;
+        }
+
+        if (tim1.m_seq != tim2.m_seq) {
+            return (tim1.m_seq < tim2.m_seq) ? -1 : 1;
+        }
+
+        return 0;
+    }
+};
+
+SimPlatformImpl::SimPlatformImpl () :
+    m_now(0),
+    m_next_seq(0),
+    m_num_dispatched(0)
+{}
+
+bool SimPlatformImpl::runOne ()
+{
+    if (m_timer_heap.isEmpty()) {
+        return false;
+    }
+
+    dispatch_first();
+    return true;
+}
+
+void SimPlatformImpl::runUntil (TimeType end_time)
+{
+    // Times up to half of the clock period in the past are considered past.
+    TimeType rel_end = end_time - m_now;
+    if (rel_end >= PlatformFacade<SimPlatformImpl>::TimeMSB) {
+        return;
+    }
+
+    // The expiration times of set timers are never earlier than the clock, so
+    // this does not overflow for the lifetime of any simulation.
+    TimeType abs_end = m_now + rel_end;
+
+    while (Timer *tim = m_timer_heap.first()) {
+        if (tim->m_expire_time > abs_end) {
+            break;
+        }
+        dispatch_first();
+    }
+
+    m_now = abs_end;
+}
+
+void SimPlatformImpl::runFor (TimeType duration)
+{
+    return runUntil(m_now + duration);
+}
+
+bool SimPlatformImpl::hasTimers () const
+{
+    return !m_timer_heap.isEmpty();
+}
+
+std::uint64_t SimPlatformImpl::getNumDispatched () const
+{
+    return m_num_dispatched;
+}
+
+auto SimPlatformImpl::getTime () -> TimeType
+{
+    return m_now;
+}
+
+auto SimPlatformImpl::getEventTime () -> TimeType
+{
+    return m_now;
+}
+
+void SimPlatformImpl::dispatch_first ()
+{
+    Timer *tim = m_timer_heap.first();
+    AIPSTACK_ASSERT(tim != nullptr);
+    AIPSTACK_ASSERT(tim->m_is_set);
+    AIPSTACK_ASSERT(tim->m_expire_time >= m_now);
+
+    m_timer_heap.remove(*tim);
+    tim->m_is_set = false;
+
+    m_now = tim->m_expire_time;
+    m_num_dispatched++;
+
+    return tim->m_handler();
+}
+
+SimPlatformImpl::Timer::Timer (ThePlatformRef ref, Function<void()> handler) :
+    ThePlatformRef(ref),
+    m_handler(handler),
+    m_set_time(0),
+    m_expire_time(0),
+    m_seq(0),
+    m_is_set(false)
+{}
+
+SimPlatformImpl::Timer::~Timer ()
+{
+    unset();
+}
+
+bool SimPlatformImpl::Timer::isSet () const
+{
+    return m_is_set;
+}
+
+auto SimPlatformImpl::Timer::getSetTime () const -> TimeType
+{
+    return m_set_time;
+}
+
+void SimPlatformImpl::Timer::unset ()
+{
+    if (m_is_set) {
+        ref().platformImpl()->m_timer_heap.remove(*this);
+        m_is_set = false;
+    }
+}
+
+void SimPlatformImpl::Timer::setAt (TimeType abs_time)
+{
+    SimPlatformImpl &sim = *ref().platformImpl();
+
+    // A time in the past means that the timer expires as soon as possible.
+    TimeType rel_time = abs_time - sim.m_now;
+    if (rel_time >= PlatformFacade<SimPlatformImpl>::TimeMSB) {
+        rel_time = 0;
+    }
+
+    bool was_set = m_is_set;
+
+    m_set_time = abs_time;
+    m_expire_time = sim.m_now + rel_time;
+    m_seq = sim.m_next_seq++;
+    m_is_set = true;
+
+    if (!was_set) {
+        sim.m_timer_heap.insert(*this);
+    } else {
+        sim.m_timer_heap.fixup(*this);
+    }
+}
+
+#endif
+
+/** @} */
+
+}
+
+#endif
@@ -74,6 +74,7 @@ enum class DhcpOptionType : std::uint8_t {
     RebindingTimeValue = 59,
     VendorClassIdentifier = 60,
     ClientIdentifier = 61,
+    RapidCommit = 80,
 };
 
 enum class DhcpMessageType : std::uint8_t {
@@ -35,6 +35,7 @@ namespace AIpStack {
 enum class EthType : std::uint16_t {
     Ipv4 = 0x0800,
     Arp  = 0x0806,
+    Vlan = 0x8100,
 };
 
 AIPSTACK_DEFINE_STRUCT(EthHeader,
@@ -43,6 +44,14 @@ AIPSTACK_DEFINE_STRUCT(EthHeader,
     (EthType, AIpStack::EthType)
 )
 
+// 802.1Q tag, which follows the MAC addresses in a tagged frame.
+AIPSTACK_DEFINE_STRUCT(EthVlanTag,
+    (Tpid,    AIpStack::EthType)
+    (Tci,     std::uint16_t)
+)
+
+inline constexpr std::uint16_t EthVlanVidMask = 0x0FFF;
+
 }
 
 #endif
@@ -38,12 +38,14 @@ enum class Icmp4Type : std::uint8_t {
     EchoReply   = 0,
     EchoRequest = 8,
     DestUnreach = 3,
+    TimeExceeded = 11,
 };
 
 enum class Icmp4Code : std::uint8_t {
     Zero                   = 0,
     DestUnreachPortUnreach = 3,
     DestUnreachFragNeeded  = 4,
+    TimeExceededTtl        = 0,
 };
 
 AIPSTACK_DEFINE_STRUCT(Icmp4Header,
@@ -57,6 +59,12 @@ inline std::uint16_t Icmp4GetMtuFromRest (Icmp4RestType rest) {
     return ReadSingleField<std::uint16_t>(rest.data() + 2);
 }
 
+inline Icmp4RestType Icmp4MakeMtuRest (std::uint16_t mtu) {
+    Icmp4RestType rest = {};
+    WriteSingleField<std::uint16_t>(rest.data() + 2, mtu);
+    return rest;
+}
+
 }
 
 #endif
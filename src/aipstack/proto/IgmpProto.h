@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2016 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_IGMP_PROTO_H
+#define AIPSTACK_IGMP_PROTO_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/infra/Struct.h>
+#include <aipstack/ip/IpAddr.h>
+
+namespace AIpStack {
+
+enum class IgmpType : std::uint8_t {
+    MembershipQuery = 0x11,
+    V1Report        = 0x12,
+    V2Report        = 0x16,
+    LeaveGroup      = 0x17,
+    V3Report        = 0x22,
+};
+
+enum class Igmp3RecordType : std::uint8_t {
+    ModeIsExclude     = 2,
+    ChangeToInclude   = 3,
+    ChangeToExclude   = 4,
+};
+
+// IGMPv1/v2 message, and the start of an IGMPv3 query.
+AIPSTACK_DEFINE_STRUCT(IgmpHeader,
+    (Type,        IgmpType)
+    (MaxRespCode, std::uint8_t)
+    (Chksum,      std::uint16_t)
+    (Group,       Ip4Addr)
+)
+
+// An IGMPv3 query is at least this long, shorter queries are IGMPv1/v2.
+inline constexpr std::size_t Igmp3QueryMinSize = 12;
+
+AIPSTACK_DEFINE_STRUCT(Igmp3ReportHeader,
+    (Type,        IgmpType)
+    (Reserved1,   std::uint8_t)
+    (Chksum,      std::uint16_t)
+    (Reserved2,   std::uint16_t)
+    (NumRecords,  std::uint16_t)
+)
+
+AIPSTACK_DEFINE_STRUCT(Igmp3GroupRecord,
+    (RecordType,  Igmp3RecordType)
+    (AuxDataLen,  std::uint8_t)
+    (NumSources,  std::uint16_t)
+    (Group,       Ip4Addr)
+)
+
+// IP Router Alert option (RFC 2113), included in all IGMP messages sent.
+inline constexpr std::uint32_t Ip4RouterAlertOption = 0x94040000;
+inline constexpr std::size_t Ip4RouterAlertOptionSize = 4;
+
+inline constexpr std::uint8_t IgmpTTL = 1;
+
+// Type of service of IGMP messages (DSCP CS6, network control).
+inline constexpr std::uint8_t IgmpTos = 0xC0;
+
+inline constexpr Ip4Addr IgmpAllHostsAddr = Ip4Addr(224, 0, 0, 1);
+inline constexpr Ip4Addr IgmpAllRoutersAddr = Ip4Addr(224, 0, 0, 2);
+inline constexpr Ip4Addr Igmp3RoutersAddr = Ip4Addr(224, 0, 0, 22);
+
+// Decode the Max Resp Code of an IGMPv3 query to tenths of a second
+// (RFC 3376 section 4.1.1). For IGMPv2 the code is the value directly.
+inline constexpr std::uint32_t Igmp3DecodeMaxResp (std::uint8_t code)
+{
+    if (code < 128) {
+        return code;
+    }
+    std::uint32_t mant = code & 0xF;
+    std::uint32_t exp = (code >> 4) & 0x7;
+    return (mant | 0x10) << (exp + 3);
+}
+
+}
+
+#endif
@@ -36,6 +36,7 @@ namespace AIpStack {
 
 enum class Ip4Protocol : std::uint8_t {
     Icmp = 1,
+    Igmp = 2,
     Tcp  = 6,
     Udp  = 17,
 };
@@ -62,6 +63,24 @@ AIPSTACK_DEFINE_STRUCT(Ip4Header,
 inline constexpr int Ip4VersionShift = 4;
 inline constexpr std::uint8_t Ip4IhlMask = 0xF;
 
+// ECN field in the low bits of the DSCP+ECN octet (RFC 3168).
+inline constexpr std::uint8_t Ip4EcnMask = 0x3;
+inline constexpr std::uint8_t Ip4EcnNotEct = 0x0;
+inline constexpr std::uint8_t Ip4EcnEct1 = 0x1;
+inline constexpr std::uint8_t Ip4EcnEct0 = 0x2;
+inline constexpr std::uint8_t Ip4EcnCe = 0x3;
+
+// DSCP field in the high bits of the DSCP+ECN octet (RFC 2474), and some
+// codepoints: class selectors (RFC 2474) and Expedited Forwarding (RFC 3246).
+inline constexpr int Ip4DscpShift = 2;
+inline constexpr std::uint8_t Ip4DscpMask = 0x3F;
+inline constexpr std::uint8_t Ip4DscpCs0 = 0;
+inline constexpr std::uint8_t Ip4DscpCs1 = 8;
+inline constexpr std::uint8_t Ip4DscpCs4 = 32;
+inline constexpr std::uint8_t Ip4DscpEf = 46;
+inline constexpr std::uint8_t Ip4DscpCs6 = 48;
+inline constexpr std::uint8_t Ip4DscpCs7 = 56;
+
 inline constexpr std::size_t Ip4MaxHeaderSize = 60;
 
 // The full datagram size which every internet destination must be
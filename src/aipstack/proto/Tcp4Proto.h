@@ -72,6 +72,10 @@ enum class TcpOption : std::uint8_t {
     Nop = 1,
     MSS = 2,
     WndScale = 3,
+    SackPerm = 4,
+    Sack = 5,
+    Timestamps = 8,
+    FastOpen = 34,
 };
 
 inline constexpr std::size_t Ip4TcpHeaderSize = Ip4Header::Size + Tcp4Header::Size;
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_SPSC_ETH_DEVICE_H
+#define AIPSTACK_SPSC_ETH_DEVICE_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/RxBufPool.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/spsc/SpscRing.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup spsc
+ * @{
+ */
+
+/**
+ * Configuration parameters for @ref SpscEthDevice.
+ */
+struct SpscEthDeviceParams {
+    /**
+     * Number of entries in each of the rings, must be a power of two.
+     */
+    std::size_t ring_size = 256;
+
+    /**
+     * Maximum size of sent frames including the 14-byte Ethernet header. This
+     * much memory is allocated for each entry of the transmit ring.
+     */
+    std::size_t tx_frame_size = 1514;
+
+    /**
+     * Maximum number of received frames passed to the stack in one batch. If
+     * more frames are available, the rest are processed in a later event, for
+     * fairness with respect to other event sources.
+     */
+    std::size_t rx_budget = 64;
+};
+
+/**
+ * Passes Ethernet frames between a driver running in its own thread and the
+ * event loop thread of the stack, without locks.
+ * 
+ * This facility relies on the @ref event-loop implementation in %AIpStack. The
+ * stack side of the interface is like @ref TapDevice, except that received
+ * frames are delivered in batches, which are intended to be passed to
+ * @ref EthIpIface::recvFrames. The driver side consists of the functions whose
+ * names start with `driver`, which may only be called from a single driver
+ * thread (which may change only with external synchronization). All other
+ * functions, including the constructor and destructor, may only be called from
+ * the event loop thread.
+ * 
+ * Frames are passed through three single-producer single-consumer rings
+ * (@ref SpscRing):
+ * - Fill ring (event loop to driver): free receive buffers allocated from an
+ *   @ref IpRxBufPool. The event loop refills it after each batch.
+ * - Receive ring (driver to event loop): buffers into which the driver has
+ *   received a frame. The driver wakes the event loop using an
+ *   @ref EventLoopAsyncSignal.
+ * - Transmit ring (event loop to driver): frames to be sent, copied into
+ *   memory owned by this object.
+ * 
+ * Receive buffers are passed to the stack along with the frames (see
+ * @ref IpRxBuf), so received data can be retained without copying. Since the
+ * reference counts of buffers are not atomic, the pool is only accessed from
+ * the event loop thread and the driver only ever owns buffers taken from the
+ * fill ring. The pool must have enough buffers to fill the fill ring, plus any
+ * that may be retained by the stack.
+ * 
+ * The driver polls the fill ring and the transmit ring; there is no
+ * notification towards the driver thread. When the driver finds no free
+ * receive buffer, it signals the event loop to refill the fill ring.
+ * 
+ * @tparam RxBufPoolType Type of the receive buffer pool, an instantiated
+ *         @ref IpRxBufPool.
+ */
+template<typename RxBufPoolType>
+class SpscEthDevice :
+    private NonCopyable<SpscEthDevice<RxBufPoolType>>
+{
+public:
+    /**
+     * Type of callback used to deliver a batch of received frames.
+     * 
+     * The frames start with the 14-byte Ethernet header and reference
+     * buffers from the pool (@ref IpRxBatchEntry::rx_buf). This object holds a
+     * reference to each buffer for the duration of the callback only. The
+     * callback must not destruct this object.
+     * 
+     * @param frames Array of received frames.
+     * @param count Number of frames, at least one.
+     */
+    using FrameBatchHandler = Function<void(IpRxBatchEntry const *frames,
+                                            std::size_t count)>;
+
+    /**
+     * Constructor.
+     * 
+     * The fill ring is filled from the pool.
+     * 
+     * @param loop Event loop; it must outlive the @ref SpscEthDevice object.
+     * @param pool Receive buffer pool; it must outlive the @ref SpscEthDevice
+     *        object.
+     * @param handler Callback function used to deliver received frames (must
+     *        not be null).
+     * @param params Configuration parameters.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    SpscEthDevice (EventLoop &loop, RxBufPoolType &pool, FrameBatchHandler handler,
+                   SpscEthDeviceParams const &params = SpscEthDeviceParams()) :
+        m_pool(pool),
+        m_handler(handler),
+        m_params(params),
+        m_fill_ring(params.ring_size),
+        m_rx_ring(params.ring_size),
+        m_tx_ring(params.ring_size),
+        m_tx_data(new char[params.ring_size * params.tx_frame_size]),
+        m_batch(params.rx_budget),
+        m_signal(loop, AIPSTACK_BIND_MEMBER_TN(&SpscEthDevice::signalHandler, this))
+    {
+        AIPSTACK_ASSERT(handler);
+        AIPSTACK_ASSERT(params.tx_frame_size >= EthHeader::Size);
+        AIPSTACK_ASSERT(params.rx_budget > 0);
+
+        // Assign memory to the transmit ring entries. These pointers are never
+        // changed, only the lengths are written when sending.
+        for (std::size_t i = 0; i < params.ring_size; i++) {
+            m_tx_ring.producerSlot(i).data = m_tx_data.get() + i * params.tx_frame_size;
+        }
+
+        m_drv.fill_taken = 0;
+        m_drv.rx_pending = 0;
+
+        refillRxBuffers();
+    }
+
+    /**
+     * Destructor, returns the buffers in the rings to the pool.
+     * 
+     * The driver thread must no longer use this object.
+     */
+    ~SpscEthDevice ()
+    {
+        IpRxBuf *buf;
+        while (m_fill_ring.pop(buf)) {
+            buf->release();
+        }
+
+        RxSlot slot;
+        while (m_rx_ring.pop(slot)) {
+            slot.buf->release();
+        }
+    }
+
+    /**
+     * Get the maximum frame size.
+     * 
+     * @return The maximum size of sent frames including the 14-byte Ethernet
+     *         header (@ref SpscEthDeviceParams::tx_frame_size).
+     */
+    inline std::size_t getMtu () const
+    {
+        return m_params.tx_frame_size;
+    }
+
+    /**
+     * Queue an Ethernet frame to be sent by the driver.
+     * 
+     * The frame is copied and made available to the driver immediately.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef), starting with the
+     *        14-byte Ethernet header.
+     * @return Success or error code (@ref IpErr::OutputBufferFull if the transmit
+     *         ring is full).
+     */
+    IpErr sendFrame (IpBufRef frame)
+    {
+        if (frame.tot_len < EthHeader::Size) {
+            return IpErr::HardwareError;
+        }
+        else if (frame.tot_len > m_params.tx_frame_size) {
+            return IpErr::PacketTooLarge;
+        }
+
+        if (m_tx_ring.producerSpace() == 0) {
+            return IpErr::OutputBufferFull;
+        }
+
+        TxSlot &slot = m_tx_ring.producerSlot(0);
+        slot.len = frame.tot_len;
+        ipBufTakeBytes(frame, frame.tot_len, slot.data);
+        m_tx_ring.producerCommit(1);
+
+        return IpErr::Success;
+    }
+
+    /**
+     * Get memory for receiving a frame (driver thread).
+     * 
+     * This returns the same buffer until @ref driverRxFrame is called. If no
+     * buffer is available, the event loop is signaled to refill the fill ring.
+     * 
+     * @param capacity Set to the size of the buffer on success.
+     * @return Pointer to the memory of a free receive buffer, or null if there
+     *         is no free buffer or the receive ring is full. The memory may be
+     *         written to until @ref driverRxFrame.
+     */
+    char * driverRxBuffer (std::size_t &capacity)
+    {
+        if (m_fill_ring.consumerAvailable() <= m_drv.fill_taken) {
+            m_signal.signal();
+            return nullptr;
+        }
+
+        if (m_rx_ring.producerSpace() <= m_drv.rx_pending) {
+            return nullptr;
+        }
+
+        IpRxBuf *buf = m_fill_ring.consumerSlot(m_drv.fill_taken);
+        capacity = buf->getCapacity();
+        return buf->getData();
+    }
+
+    /**
+     * Complete receiving a frame into the buffer returned by the last
+     * @ref driverRxBuffer call (driver thread).
+     * 
+     * The frame is passed to the event loop at the next @ref driverRxFlush.
+     * 
+     * @param len Length of the frame, must not exceed the buffer size.
+     * @param chksum_verified Checksums which have been verified by hardware.
+     */
+    void driverRxFrame (std::size_t len,
+                        IpChksumOffloadFlags chksum_verified = IpChksumOffloadFlags())
+    {
+        IpRxBuf *buf = m_fill_ring.consumerSlot(m_drv.fill_taken);
+        AIPSTACK_ASSERT(len <= buf->getCapacity());
+
+        RxSlot &slot = m_rx_ring.producerSlot(m_drv.rx_pending);
+        slot.buf = buf;
+        slot.len = len;
+        slot.chksum_verified = chksum_verified;
+
+        m_drv.fill_taken++;
+        m_drv.rx_pending++;
+    }
+
+    /**
+     * Pass the frames completed using @ref driverRxFrame to the event loop
+     * (driver thread).
+     * 
+     * The event loop is signaled if there were any frames. Calling this once
+     * for a batch of frames reduces the cost of synchronization.
+     */
+    void driverRxFlush ()
+    {
+        if (m_drv.rx_pending == 0) {
+            return;
+        }
+
+        m_fill_ring.consumerRelease(m_drv.fill_taken);
+        m_rx_ring.producerCommit(m_drv.rx_pending);
+        m_drv.fill_taken = 0;
+        m_drv.rx_pending = 0;
+
+        m_signal.signal();
+    }
+
+    /**
+     * Return the number of frames to be sent (driver thread).
+     * 
+     * @return Number of frames which may be accessed using @ref driverTxFrame.
+     */
+    inline std::size_t driverTxAvailable ()
+    {
+        return m_tx_ring.consumerAvailable();
+    }
+
+    /**
+     * Access a frame to be sent (driver thread).
+     * 
+     * @param offset Index of the frame starting from the oldest, must be less than
+     *        the result of the last @ref driverTxAvailable call.
+     * @return Reference to the frame data, starting with the Ethernet header,
+     *         which remains valid until the frame is released.
+     */
+    inline MemRef driverTxFrame (std::size_t offset)
+    {
+        TxSlot &slot = m_tx_ring.consumerSlot(offset);
+        return MemRef(slot.data, slot.len);
+    }
+
+    /**
+     * Release the oldest frames to be sent, after the driver is done with them
+     * (driver thread).
+     * 
+     * @param count Number of frames to release, at most the result of the last
+     *        @ref driverTxAvailable call.
+     */
+    inline void driverTxRelease (std::size_t count)
+    {
+        m_tx_ring.consumerRelease(count);
+    }
+
+private:
+    struct RxSlot {
+        IpRxBuf *buf;
+        std::size_t len;
+        IpChksumOffloadFlags chksum_verified;
+    };
+
+    struct TxSlot {
+        char *data;
+        std::size_t len;
+    };
+
+    // Driver-side state, kept away from the state used by the event loop.
+    struct alignas(SpscCacheLineSize) DriverState {
+        // Number of buffers taken from the fill ring but not yet released.
+        std::size_t fill_taken;
+        // Number of frames written to the receive ring but not yet committed.
+        std::size_t rx_pending;
+    };
+
+    void refillRxBuffers ()
+    {
+        std::size_t space = m_fill_ring.producerSpace();
+        std::size_t count = 0;
+
+        while (count < space) {
+            IpRxBuf *buf = m_pool.alloc();
+            if (buf == nullptr) {
+                break;
+            }
+            m_fill_ring.producerSlot(count) = buf;
+            count++;
+        }
+
+        if (count > 0) {
+            m_fill_ring.producerCommit(count);
+        }
+    }
+
+    void signalHandler ()
+    {
+        std::size_t avail = m_rx_ring.consumerAvailable();
+        std::size_t count = (avail < m_params.rx_budget) ? avail : m_params.rx_budget;
+
+        if (count > 0) {
+            for (std::size_t i = 0; i < count; i++) {
+                RxSlot &slot = m_rx_ring.consumerSlot(i);
+                IpRxBatchEntry &entry = m_batch[i];
+                entry.buf = slot.buf->getBufRef(slot.len);
+                entry.chksum_verified = slot.chksum_verified;
+                entry.rx_buf = slot.buf;
+            }
+
+            m_handler(m_batch.data(), count);
+
+            // Drop our references, buffers which were not retained go back to
+            // the pool and can be used for refilling right away.
+            for (std::size_t i = 0; i < count; i++) {
+                m_rx_ring.consumerSlot(i).buf->release();
+            }
+            m_rx_ring.consumerRelease(count);
+
+            // Continue later if there are more frames.
+            if (avail > count) {
+                m_signal.signal();
+            }
+        }
+
+        refillRxBuffers();
+    }
+
+private:
+    RxBufPoolType &m_pool;
+    FrameBatchHandler m_handler;
+    SpscEthDeviceParams m_params;
+    SpscRing<IpRxBuf *> m_fill_ring;
+    SpscRing<RxSlot> m_rx_ring;
+    SpscRing<TxSlot> m_tx_ring;
+    std::unique_ptr<char[]> m_tx_data;
+    std::vector<IpRxBatchEntry> m_batch;
+    DriverState m_drv;
+    EventLoopAsyncSignal m_signal;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_SPSC_RING_H
+#define AIPSTACK_SPSC_RING_H
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+
+namespace AIpStack {
+
+/**
+ * @defgroup spsc Thread Hand-off
+ * @brief Lock-free passing of frames between a driver thread and the event loop.
+ * 
+ * See the @ref SpscRing and @ref SpscEthDevice documentation.
+ * 
+ * @{
+ */
+
+/**
+ * Size assumed for a cache line, used to keep the indices of the producer and
+ * the consumer of an @ref SpscRing in separate cache lines.
+ */
+inline constexpr std::size_t SpscCacheLineSize = 64;
+
+/**
+ * Lock-free ring buffer with a single producer thread and a single consumer
+ * thread.
+ * 
+ * The producer writes elements in place into free slots and publishes them
+ * using @ref producerCommit; the consumer accesses published elements in place
+ * and frees them using @ref consumerRelease. Slots are accessed by offset from
+ * the current position, so that multiple elements can be written or read
+ * before a single commit or release, which is the only synchronization between
+ * the threads (a release store of the index, paired with an acquire load on
+ * the other side).
+ * 
+ * Each side keeps a cached copy of the other side's index and only loads the
+ * shared index when the cached copy indicates no space or no elements, so in
+ * the steady state the cache line of the other side is only read once per
+ * batch.
+ * 
+ * The producer functions may only be called by one thread at a time, and the
+ * same goes for the consumer functions.
+ * 
+ * @tparam T Element type, must be default-constructible. Elements are not
+ *         destructed when released, only overwritten.
+ */
+template<typename T>
+class SpscRing :
+    private NonCopyable<SpscRing<T>>
+{
+public:
+    /**
+     * Construct an empty ring.
+     * 
+     * @param capacity Number of slots, must be a power of two.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    explicit SpscRing (std::size_t capacity) :
+        m_slots(new T[capacity]),
+        m_mask(capacity - 1)
+    {
+        AIPSTACK_ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+        
+        m_prod.pos.store(0, std::memory_order_relaxed);
+        m_prod.cached_other = capacity;
+        m_cons.pos.store(0, std::memory_order_relaxed);
+        m_cons.cached_other = 0;
+    }
+    
+    /**
+     * Return the number of slots.
+     * 
+     * @return Capacity of the ring.
+     */
+    inline std::size_t capacity () const
+    {
+        return m_mask + 1;
+    }
+    
+    /**
+     * Return the number of free slots (producer side).
+     * 
+     * The result may be less than the actual number if the consumer has
+     * released elements concurrently.
+     * 
+     * @return Number of slots which may be written and committed.
+     */
+    std::size_t producerSpace ()
+    {
+        std::size_t pos = m_prod.pos.load(std::memory_order_relaxed);
+        if (m_prod.cached_other == pos) {
+            m_prod.cached_other =
+                m_cons.pos.load(std::memory_order_acquire) + capacity();
+        }
+        return m_prod.cached_other - pos;
+    }
+    
+    /**
+     * Access a free slot (producer side).
+     * 
+     * @param offset Offset from the first free slot, must be less than the
+     *        result of the last @ref producerSpace call.
+     * @return Reference to the slot.
+     */
+    inline T & producerSlot (std::size_t offset)
+    {
+        std::size_t pos = m_prod.pos.load(std::memory_order_relaxed);
+        return m_slots[(pos + offset) & m_mask];
+    }
+    
+    /**
+     * Publish written slots to the consumer (producer side).
+     * 
+     * @param count Number of slots to publish, starting with the first free
+     *        slot. Must not exceed the result of the last @ref producerSpace
+     *        call.
+     */
+    inline void producerCommit (std::size_t count)
+    {
+        std::size_t pos = m_prod.pos.load(std::memory_order_relaxed);
+        AIPSTACK_ASSERT(count <= m_prod.cached_other - pos);
+        m_prod.pos.store(pos + count, std::memory_order_release);
+    }
+    
+    /**
+     * Write and publish a single element (producer side).
+     * 
+     * @param value Value to write.
+     * @return True if written, false if the ring is full.
+     */
+    bool push (T const &value)
+    {
+        if (producerSpace() == 0) {
+            return false;
+        }
+        producerSlot(0) = value;
+        producerCommit(1);
+        return true;
+    }
+    
+    /**
+     * Return the number of published elements (consumer side).
+     * 
+     * The result may be less than the actual number if the producer has
+     * published elements concurrently.
+     * 
+     * @return Number of elements which may be read and released.
+     */
+    std::size_t consumerAvailable ()
+    {
+        std::size_t pos = m_cons.pos.load(std::memory_order_relaxed);
+        if (m_cons.cached_other == pos) {
+            m_cons.cached_other = m_prod.pos.load(std::memory_order_acquire);
+        }
+        return m_cons.cached_other - pos;
+    }
+    
+    /**
+     * Access a published element (consumer side).
+     * 
+     * @param offset Offset from the oldest element, must be less than the result
+     *        of the last @ref consumerAvailable call.
+     * @return Reference to the element.
+     */
+    inline T & consumerSlot (std::size_t offset)
+    {
+        std::size_t pos = m_cons.pos.load(std::memory_order_relaxed);
+        return m_slots[(pos + offset) & m_mask];
+    }
+    
+    /**
+     * Free the oldest elements, making their slots available to the producer
+     * (consumer side).
+     * 
+     * @param count Number of elements to free. Must not exceed the result of the
+     *        last @ref consumerAvailable call.
+     */
+    inline void consumerRelease (std::size_t count)
+    {
+        std::size_t pos = m_cons.pos.load(std::memory_order_relaxed);
+        AIPSTACK_ASSERT(count <= m_cons.cached_other - pos);
+        m_cons.pos.store(pos + count, std::memory_order_release);
+    }
+    
+    /**
+     * Read and free a single element (consumer side).
+     * 
+     * @param value Set to the element on success.
+     * @return True if an element was read, false if the ring is empty.
+     */
+    bool pop (T &value)
+    {
+        if (consumerAvailable() == 0) {
+            return false;
+        }
+        value = consumerSlot(0);
+        consumerRelease(1);
+        return true;
+    }
+    
+private:
+    // State written by one side. The position is read by the other side, the
+    // cached position of the other side only by this side.
+    struct alignas(SpscCacheLineSize) SideState {
+        std::atomic<std::size_t> pos;
+        std::size_t cached_other;
+    };
+    
+    std::unique_ptr<T[]> m_slots;
+    std::size_t m_mask;
+    SideState m_prod;
+    SideState m_cons;
+};
+
+/** @} */
+
+}
+
+#endif
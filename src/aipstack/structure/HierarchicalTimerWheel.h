@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_HIERARCHICAL_TIMER_WHEEL_H
+#define AIPSTACK_HIERARCHICAL_TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/TimerQueue.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup structure
+ * @{
+ */
+
+#ifndef IN_DOXYGEN
+
+template<typename, typename, typename, typename, int, int>
+class HierarchicalTimerWheel;
+
+template<typename LinkModel, typename NodeUserData>
+class HierarchicalTimerWheelNode : public NodeUserData
+{
+    template<typename, typename, typename, typename, int, int>
+    friend class HierarchicalTimerWheel;
+    
+private:
+    // Node in the list of a slot or in the expired list.
+    LinkedListNode<LinkModel> list_node;
+    
+    // Wheel tick at which the timer expires, relevant only if in a slot.
+    std::uint64_t tick;
+    
+    // Index of the slot list the timer is in, or ExpiredList.
+    std::uint16_t list;
+};
+
+/**
+ * Hierarchical timing wheel with the same interface as @ref TimerQueue.
+ * 
+ * Time is divided into ticks of 2^TickShift time units, counted by a 64-bit
+ * wheel tick which starts at zero and never wraps around. There are multiple
+ * levels of 2^SlotBits slots each. A timer whose tick first differs from the
+ * current tick in bit group L (bits [L*SlotBits, (L+1)*SlotBits)) is in level
+ * L, in the slot given by that bit group of its tick, and the levels cover all
+ * 64-bit ticks. When the current tick reaches the start of the range of a slot
+ * in a higher level, its timers are cascaded into lower levels, so each timer
+ * is moved at most once per level. Insertion and removal are O(1).
+ * 
+ * The expiration time of a timer is rounded up to a tick, so timers are never
+ * dispatched early but may be dispatched up to one tick late.
+ */
+template<
+    typename LinkModel,
+    typename Accessor,
+    typename TimeType,
+    typename NodeUserData,
+    int TickShift,
+    int SlotBits
+>
+class HierarchicalTimerWheel
+{
+    static_assert(std::is_arithmetic_v<TimeType>);
+    static_assert(std::is_unsigned_v<TimeType>);
+    static_assert(TickShift >= 0 && TickShift < std::numeric_limits<TimeType>::digits - 2);
+    static_assert(SlotBits >= 1 && SlotBits <= 6);
+    
+    AIPSTACK_USE_TYPES(LinkModel, (State, Ref))
+    
+    using Node = HierarchicalTimerWheelNode<LinkModel, NodeUserData>;
+    
+    struct ListNodeAccessor : public ComposedAccessor<
+        Accessor, MemberAccessor<Node, LinkedListNode<LinkModel>, &Node::list_node>> {};
+    
+    using List = LinkedList<ListNodeAccessor, LinkModel, false>;
+    
+    inline static constexpr std::size_t NumSlots = std::size_t(1) << SlotBits;
+    inline static constexpr int NumLevels = (64 + SlotBits - 1) / SlotBits;
+    inline static constexpr std::size_t NumLists = NumLevels * NumSlots;
+    
+    // Value of Node::list for timers in the expired list.
+    inline static constexpr std::uint16_t ExpiredList = NumLists;
+    
+    inline static constexpr TimeType TimeMsb = (TypeMax<TimeType> / 2) + 1;
+    inline static constexpr TimeType TimeMaxFutureInterval = TimeMsb / 2 + TimeMsb / 4;
+    
+    inline static constexpr TimeType TickMask = (TimeType(1) << TickShift) - 1;
+    
+private:
+    // Lists of timers in the slots of all levels.
+    List m_slots[NumLists];
+    
+    // Timers found expired by prepareForRemovingExpired (or inserted expired).
+    List m_expired;
+    
+    // Occupancy bitmaps of the slots of each level.
+    std::uint64_t m_slot_bits[NumLevels];
+    
+    // Number of inserted timers (including expired ones).
+    std::size_t m_count;
+    
+    // Number of timers in slots.
+    std::size_t m_num_pending;
+    
+    // Current wheel tick and the time at which it starts.
+    std::uint64_t m_tick;
+    TimeType m_tick_time;
+    
+    // All inserted timers are at or after this time (with the same
+    // considerations as in TimerQueue). It is in the current tick.
+    TimeType m_reference_time;
+    
+public:
+    void init ()
+    {
+        for (List &slot : m_slots) {
+            slot.init();
+        }
+        m_expired.init();
+        
+        for (std::uint64_t &bits : m_slot_bits) {
+            bits = 0;
+        }
+        
+        m_count = 0;
+        m_num_pending = 0;
+        m_tick = 0;
+    }
+    
+    inline bool isEmpty () const
+    {
+        return m_count == 0;
+    }
+    
+    void updateReferenceTime (TimeType now, State = State())
+    {
+        // The reference time can only be moved when the wheel is empty, otherwise
+        // ticks between it and now would not be processed.
+        if (m_count == 0) {
+            m_reference_time = now;
+            m_tick_time = now;
+        }
+    }
+    
+    // NOTE: Same requirements as TimerQueue::insert.
+    void insert (Ref entry, TimeType time, State st = State())
+    {
+        if (time_less(time, m_reference_time)) {
+            time = m_reference_time;
+        }
+        
+        // Round up to a tick relative to the start of the current tick.
+        TimeType rel_time = TimeType(time - m_tick_time);
+        std::uint64_t ticks = std::uint64_t(rel_time >> TickShift) +
+            ((rel_time & TickMask) != 0);
+        
+        insert_at_tick(entry, m_tick + ticks, st);
+        
+        m_count++;
+    }
+    
+    void remove (Ref entry, State st = State())
+    {
+        AIPSTACK_ASSERT(m_count > 0);
+        
+        std::size_t index = ac(entry).list;
+        
+        if (index == ExpiredList) {
+            m_expired.remove(entry, st);
+        } else {
+            AIPSTACK_ASSERT(index < NumLists);
+            remove_from_slot(entry, index, st);
+        }
+        
+        m_count--;
+    }
+    
+    void prepareForRemovingExpired (TimeType now, State st = State())
+    {
+        if (m_num_pending != 0) {
+            if (AIPSTACK_UNLIKELY(time_less(now, m_reference_time))) {
+                // The clock jumped into the past. As in TimerQueue, all timers
+                // are dispatched.
+                expire_all(st);
+            } else {
+                TimeType rel_time = TimeType(now - m_tick_time);
+                std::uint64_t ticks = std::uint64_t(rel_time >> TickShift);
+                
+                if (ticks > 0) {
+                    advance(m_tick + ticks, st);
+                    m_tick_time += TimeType(rel_time & ~TickMask);
+                }
+            }
+        }
+        
+        // Without timers in slots, the current tick may start at any time.
+        if (m_num_pending == 0) {
+            m_tick_time = now;
+        }
+        
+        m_reference_time = now;
+    }
+    
+    // NOTE: prepareForRemovingExpired must be called before calling this.
+    Ref removeExpired (State st = State())
+    {
+        Ref entry = m_expired.first(st);
+        if (entry.isNull()) {
+            return Ref::null();
+        }
+        
+        m_expired.removeFirst(st);
+        m_count--;
+        
+        return entry;
+    }
+    
+    bool getFirstTime (TimeType &out_time, State = State())
+    {
+        if (m_count == 0) {
+            return false;
+        }
+        
+        TimeType max_time = m_reference_time + TimeMaxFutureInterval;
+        TimeType time;
+        
+        if (!m_expired.isEmpty()) {
+            time = m_reference_time;
+        } else {
+            // Report the start of the first non-empty slot. If that is not in
+            // the lowest level, its timers will just be cascaded then.
+            std::size_t index;
+            std::uint64_t tick;
+            bool found = next_slot(index, tick);
+            AIPSTACK_ASSERT(found);
+            (void)found;
+            
+            std::uint64_t ticks = tick - m_tick;
+            if (ticks > std::uint64_t(TimeMaxFutureInterval >> TickShift)) {
+                time = max_time;
+            } else {
+                time = TimeType(m_tick_time + TimeType(TimeType(ticks) << TickShift));
+            }
+        }
+        
+        if (time_less(max_time, time)) {
+            time = max_time;
+        }
+        
+        out_time = time;
+        return true;
+    }
+    
+private:
+    inline static Node & ac (Ref ref)
+    {
+        return Accessor::access(*ref);
+    }
+    
+    inline static bool time_less (TimeType time1, TimeType time2)
+    {
+        return TimeType(time1 - time2) >= TimeMsb;
+    }
+    
+    void insert_at_tick (Ref entry, std::uint64_t tick, State st)
+    {
+        if (tick <= m_tick) {
+            m_expired.prepend(entry, st);
+            ac(entry).list = ExpiredList;
+            return;
+        }
+        
+        // The level is determined by the most significant bit in which the tick
+        // differs from the current tick, in which the tick has a one and the
+        // current tick a zero. Hence the slot is after that of the current tick
+        // in that level.
+        std::uint64_t diff = tick ^ m_tick;
+        int level = (63 - __builtin_clzll(diff)) / SlotBits;
+        std::size_t slot = std::size_t(tick >> (level * SlotBits)) & (NumSlots - 1);
+        std::size_t index = std::size_t(level) * NumSlots + slot;
+        
+        m_slots[index].prepend(entry, st);
+        m_slot_bits[level] |= std::uint64_t(1) << slot;
+        ac(entry).tick = tick;
+        ac(entry).list = std::uint16_t(index);
+        
+        m_num_pending++;
+    }
+    
+    void remove_from_slot (Ref entry, std::size_t index, State st)
+    {
+        m_slots[index].remove(entry, st);
+        if (m_slots[index].isEmpty()) {
+            m_slot_bits[index / NumSlots] &= ~(std::uint64_t(1) << (index % NumSlots));
+        }
+        
+        m_num_pending--;
+    }
+    
+    // Finds the first non-empty slot and the tick at which its range starts.
+    bool next_slot (std::size_t &out_index, std::uint64_t &out_tick) const
+    {
+        // Slots in lower levels are before all slots in higher levels, so the
+        // first level with a non-empty slot contains the first slot.
+        for (int level = 0; level < NumLevels; level++) {
+            int shift = level * SlotBits;
+            std::size_t cur_slot = std::size_t(m_tick >> shift) & (NumSlots - 1);
+            
+            // Only slots after that of the current tick can be non-empty. For the
+            // last slot, the shift results in zero and hence an empty mask.
+            std::uint64_t after_mask = ~((std::uint64_t(2) << cur_slot) - 1);
+            std::uint64_t bits = m_slot_bits[level] & after_mask;
+            
+            if (bits != 0) {
+                std::size_t slot = std::size_t(__builtin_ctzll(bits));
+                int high_shift = shift + SlotBits;
+                std::uint64_t high_mask =
+                    (high_shift >= 64) ? 0 : (~std::uint64_t(0) << high_shift);
+                
+                out_index = std::size_t(level) * NumSlots + slot;
+                out_tick = (m_tick & high_mask) | (std::uint64_t(slot) << shift);
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    void advance (std::uint64_t target_tick, State st)
+    {
+        AIPSTACK_ASSERT(target_tick > m_tick);
+        
+        // Visit the non-empty slots whose range starts no later than the target
+        // tick in order. At the start of the range of a slot, its timers are
+        // cascaded to lower levels or the expired list. Empty stretches of ticks
+        // are skipped over.
+        std::size_t index;
+        std::uint64_t tick;
+        while (next_slot(index, tick) && tick <= target_tick) {
+            m_tick = tick;
+            
+            List &list = m_slots[index];
+            while (!list.isEmpty()) {
+                Ref entry = list.first(st);
+                remove_from_slot(entry, index, st);
+                insert_at_tick(entry, ac(entry).tick, st);
+            }
+        }
+        
+        m_tick = target_tick;
+    }
+    
+    void expire_all (State st)
+    {
+        for (std::size_t index = 0; index < NumLists; index++) {
+            List &list = m_slots[index];
+            while (!list.isEmpty()) {
+                Ref entry = list.first(st);
+                remove_from_slot(entry, index, st);
+                m_expired.prepend(entry, st);
+                ac(entry).list = ExpiredList;
+            }
+        }
+    }
+};
+
+#endif
+
+/**
+ * Service definition for the hierarchical timing wheel.
+ * 
+ * This can be used wherever a data structure for a @ref TimerQueue is selected
+ * (e.g. @ref EthIpIfaceOptions::TimersStructureService), in which case the timing
+ * wheel replaces the timer queue as a whole. Unlike @ref TimerWheelService, timers
+ * far in the future are not visited until they are near expiration, which suits
+ * many long timers with a coarse resolution.
+ * 
+ * @tparam TickShift_ Base-2 logarithm of the tick duration in platform time units.
+ * @tparam SlotBits_ Base-2 logarithm of the number of slots in each level
+ *         (1 to 6). There are ceil(64 / SlotBits_) levels.
+ */
+template<int TickShift_, int SlotBits_ = 6>
+class HierarchicalTimerWheelService {
+public:
+    #ifndef IN_DOXYGEN
+    
+    inline static constexpr int TickShift = TickShift_;
+    inline static constexpr int SlotBits = SlotBits_;
+    
+    template<typename LinkModel, typename TimeType, typename NodeUserData>
+    using Node = HierarchicalTimerWheelNode<LinkModel, NodeUserData>;
+    
+    template<typename LinkModel, typename Accessor,
+             typename TimeType, typename NodeUserData>
+    using Queue = HierarchicalTimerWheel<LinkModel, Accessor, TimeType, NodeUserData,
+                                         TickShift, SlotBits>;
+    
+    #endif
+};
+
+#ifndef IN_DOXYGEN
+
+template<int TickShift, int SlotBits>
+struct TimerQueueService<HierarchicalTimerWheelService<TickShift, SlotBits>> :
+    public HierarchicalTimerWheelService<TickShift, SlotBits> {};
+
+#endif
+
+/** @} */
+
+}
+
+#endif
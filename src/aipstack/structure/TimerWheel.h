@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_TIMER_WHEEL_H
+#define AIPSTACK_TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/TimerQueue.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup structure
+ * @{
+ */
+
+#ifndef IN_DOXYGEN
+
+template<typename, typename, typename, typename, std::size_t, int>
+class TimerWheel;
+
+template<typename LinkModel, typename TimeType, typename NodeUserData>
+class TimerWheelNode : public NodeUserData
+{
+    template<typename, typename, typename, typename, std::size_t, int>
+    friend class TimerWheel;
+    
+private:
+    // Node in the list of a slot or in the expired list.
+    LinkedListNode<LinkModel> list_node;
+    
+    // Expiration time, relevant only if inserted.
+    TimeType time;
+    
+    // Whether the timer is in the expired list (as opposed to a slot list).
+    bool expired;
+};
+
+/**
+ * Hashed timing wheel with the same interface as @ref TimerQueue.
+ * 
+ * Timers are hashed into NumSlots slots based on the tick of their expiration
+ * time, a tick being 2^TickShift time units. Insertion and removal are O(1).
+ * Expired timers are collected one tick at a time, and getFirstTime reports the
+ * end of the first non-empty tick, so that all timers within a tick are batched
+ * together. Consequently timers may be dispatched up to one tick late.
+ * 
+ * Timers further in the future than one revolution of the wheel share slots
+ * with nearer timers and are skipped over when their slot is processed, so the
+ * number of slots should be chosen to cover the common timeouts.
+ */
+template<
+    typename LinkModel,
+    typename Accessor,
+    typename TimeType,
+    typename NodeUserData,
+    std::size_t NumSlots,
+    int TickShift
+>
+class TimerWheel
+{
+    static_assert(std::is_arithmetic_v<TimeType>);
+    static_assert(std::is_unsigned_v<TimeType>);
+    static_assert(NumSlots > 0 && (NumSlots & (NumSlots - 1)) == 0,
+                  "NumSlots must be a power of two");
+    static_assert(TickShift >= 0 && TickShift < std::numeric_limits<TimeType>::digits - 2);
+    
+    AIPSTACK_USE_TYPES(LinkModel, (State, Ref))
+    
+    using Node = TimerWheelNode<LinkModel, TimeType, NodeUserData>;
+    
+    struct ListNodeAccessor : public ComposedAccessor<
+        Accessor, MemberAccessor<Node, LinkedListNode<LinkModel>, &Node::list_node>> {};
+    
+    using List = LinkedList<ListNodeAccessor, LinkModel, false>;
+    
+    // Bitmap of non-empty slots, allowing to quickly find the next timer.
+    using BitsWord = std::uint32_t;
+    inline static constexpr std::size_t WordBits = 32;
+    inline static constexpr std::size_t NumWords = (NumSlots + WordBits - 1) / WordBits;
+    
+    inline static constexpr TimeType TimeMsb = (TypeMax<TimeType> / 2) + 1;
+    inline static constexpr TimeType TimeMaxFutureInterval = TimeMsb / 2 + TimeMsb / 4;
+    
+    // Mask for differences of ticks, which wrap around at this value.
+    inline static constexpr TimeType MaxTick = TypeMax<TimeType> >> TickShift;
+    
+private:
+    // Lists of timers in each slot.
+    List m_slots[NumSlots];
+    
+    // Timers found expired by prepareForRemovingExpired.
+    List m_expired;
+    
+    // Occupancy bitmap of m_slots.
+    BitsWord m_slot_bits[NumWords];
+    
+    // Number of inserted timers (including expired ones).
+    std::size_t m_count;
+    
+    // Time up to which slots have been processed. All inserted timers are
+    // at or after this time (with the same considerations as in TimerQueue).
+    TimeType m_reference_time;
+    
+public:
+    void init ()
+    {
+        for (List &slot : m_slots) {
+            slot.init();
+        }
+        m_expired.init();
+        
+        for (BitsWord &word : m_slot_bits) {
+            word = 0;
+        }
+        
+        m_count = 0;
+    }
+    
+    inline bool isEmpty () const
+    {
+        return m_count == 0;
+    }
+    
+    void updateReferenceTime (TimeType now, State = State())
+    {
+        // The reference time can only be moved when the wheel is empty, otherwise
+        // slots between it and now would not be processed. It lags behind now by
+        // at most the time until the next prepareForRemovingExpired.
+        if (m_count == 0) {
+            m_reference_time = now;
+        }
+    }
+    
+    // NOTE: Same requirements as TimerQueue::insert.
+    void insert (Ref entry, TimeType time, State st = State())
+    {
+        if (time_less(time, m_reference_time)) {
+            time = m_reference_time;
+        }
+        
+        ac(entry).time = time;
+        ac(entry).expired = false;
+        
+        std::size_t slot = slot_for_time(time);
+        m_slots[slot].prepend(entry, st);
+        set_slot_bit(slot);
+        
+        m_count++;
+    }
+    
+    void remove (Ref entry, State st = State())
+    {
+        AIPSTACK_ASSERT(m_count > 0);
+        
+        if (ac(entry).expired) {
+            m_expired.remove(entry, st);
+        } else {
+            std::size_t slot = slot_for_time(ac(entry).time);
+            m_slots[slot].remove(entry, st);
+            if (m_slots[slot].isEmpty()) {
+                clear_slot_bit(slot);
+            }
+        }
+        
+        m_count--;
+    }
+    
+    void prepareForRemovingExpired (TimeType now, State st = State())
+    {
+        if (m_count != 0) {
+            // See TimerQueue::prepareForRemovingExpired for the clock jump case.
+            TimeType dispatch_time;
+            if (AIPSTACK_UNLIKELY(time_less(now, m_reference_time))) {
+                dispatch_time = m_reference_time + (TimeMsb - 1);
+            } else {
+                dispatch_time = now;
+            }
+            
+            // Process the slots for all ticks from the reference time up to the
+            // dispatch time, but each slot at most once.
+            TimeType start_tick = m_reference_time >> TickShift;
+            TimeType num_ticks =
+                TimeType((dispatch_time >> TickShift) - start_tick) & MaxTick;
+            std::size_t num_scan = (num_ticks >= NumSlots - 1) ?
+                NumSlots : std::size_t(num_ticks + 1);
+            
+            for (std::size_t i = 0; i < num_scan; i++) {
+                std::size_t slot = std::size_t((start_tick + i) & (NumSlots - 1));
+                if (get_slot_bit(slot)) {
+                    collect_expired_in_slot(slot, dispatch_time, now, st);
+                }
+            }
+        }
+        
+        // All remaining timers are after the dispatch time and expired ones
+        // have their time set to now.
+        m_reference_time = now;
+    }
+    
+    // NOTE: prepareForRemovingExpired must be called before calling this.
+    Ref removeExpired (State st = State())
+    {
+        Ref entry = m_expired.first(st);
+        if (entry.isNull()) {
+            return Ref::null();
+        }
+        
+        m_expired.removeFirst(st);
+        ac(entry).expired = false;
+        m_count--;
+        
+        return entry;
+    }
+    
+    bool getFirstTime (TimeType &out_time, State = State())
+    {
+        if (m_count == 0) {
+            return false;
+        }
+        
+        TimeType time;
+        
+        if (!m_expired.isEmpty()) {
+            time = m_reference_time;
+        } else {
+            // Find the first non-empty slot starting with that of the reference
+            // time. Report the end of its tick so that all timers in the tick
+            // expire together.
+            TimeType start_tick = m_reference_time >> TickShift;
+            std::size_t offset = find_next_slot_offset(
+                std::size_t(start_tick & (NumSlots - 1)));
+            time = TimeType((start_tick + offset + 1) << TickShift);
+        }
+        
+        TimeType max_time = m_reference_time + TimeMaxFutureInterval;
+        if (time_less(max_time, time)) {
+            time = max_time;
+        }
+        
+        out_time = time;
+        return true;
+    }
+    
+private:
+    inline static Node & ac (Ref ref)
+    {
+        return Accessor::access(*ref);
+    }
+    
+    inline static bool time_less (TimeType time1, TimeType time2)
+    {
+        return TimeType(time1 - time2) >= TimeMsb;
+    }
+    
+    inline static std::size_t slot_for_time (TimeType time)
+    {
+        return std::size_t((time >> TickShift) & (NumSlots - 1));
+    }
+    
+    inline bool get_slot_bit (std::size_t slot) const
+    {
+        return (m_slot_bits[slot / WordBits] & (BitsWord(1) << (slot % WordBits))) != 0;
+    }
+    
+    inline void set_slot_bit (std::size_t slot)
+    {
+        m_slot_bits[slot / WordBits] |= BitsWord(1) << (slot % WordBits);
+    }
+    
+    inline void clear_slot_bit (std::size_t slot)
+    {
+        m_slot_bits[slot / WordBits] &= ~(BitsWord(1) << (slot % WordBits));
+    }
+    
+    void collect_expired_in_slot (
+        std::size_t slot, TimeType dispatch_time, TimeType now, State st)
+    {
+        List &list = m_slots[slot];
+        
+        Ref entry = list.first(st);
+        while (!entry.isNull()) {
+            Ref next = List::next(entry, st);
+            
+            if (!time_less(dispatch_time, ac(entry).time)) {
+                list.remove(entry, st);
+                ac(entry).time = now;
+                ac(entry).expired = true;
+                m_expired.prepend(entry, st);
+            }
+            
+            entry = next;
+        }
+        
+        if (list.isEmpty()) {
+            clear_slot_bit(slot);
+        }
+    }
+    
+    // Return the distance in slots from start_slot to the first non-empty slot,
+    // cyclically. At least one slot must be non-empty.
+    std::size_t find_next_slot_offset (std::size_t start_slot) const
+    {
+        std::size_t word_idx = start_slot / WordBits;
+        BitsWord word = m_slot_bits[word_idx] & (BitsWord(-1) << (start_slot % WordBits));
+        
+        for (std::size_t i = 0; i <= NumWords; i++) {
+            if (word != 0) {
+                std::size_t slot = word_idx * WordBits + lowest_bit_index(word);
+                return (slot - start_slot) & (NumSlots - 1);
+            }
+            word_idx = (word_idx + 1) % NumWords;
+            word = m_slot_bits[word_idx];
+        }
+        
+        AIPSTACK_ASSERT(false);
+        return 0;
+    }
+    
+    inline static std::size_t lowest_bit_index (BitsWord word)
+    {
+        std::size_t index = 0;
+        while ((word & 1) == 0) {
+            word >>= 1;
+            index++;
+        }
+        return index;
+    }
+};
+
+#endif
+
+/**
+ * Service definition for the hashed timing wheel.
+ * 
+ * This can be used wherever a data structure for a @ref TimerQueue is selected
+ * (e.g. @ref EthIpIfaceOptions::TimersStructureService), in which case the timing
+ * wheel replaces the timer queue as a whole. It is also used by
+ * @ref PlatformTimerWheel.
+ * 
+ * @tparam NumSlots_ Number of slots, must be a power of two.
+ * @tparam TickShift_ Base-2 logarithm of the tick duration in platform time units.
+ */
+template<std::size_t NumSlots_, int TickShift_>
+class TimerWheelService {
+public:
+    #ifndef IN_DOXYGEN
+    
+    inline static constexpr std::size_t NumSlots = NumSlots_;
+    inline static constexpr int TickShift = TickShift_;
+    
+    template<typename LinkModel, typename TimeType, typename NodeUserData>
+    using Node = TimerWheelNode<LinkModel, TimeType, NodeUserData>;
+    
+    template<typename LinkModel, typename Accessor,
+             typename TimeType, typename NodeUserData>
+    using Queue = TimerWheel<LinkModel, Accessor, TimeType, NodeUserData,
+                             NumSlots, TickShift>;
+    
+    #endif
+};
+
+#ifndef IN_DOXYGEN
+
+template<std::size_t NumSlots, int TickShift>
+struct TimerQueueService<TimerWheelService<NumSlots, TickShift>> :
+    public TimerWheelService<NumSlots, TickShift> {};
+
+#endif
+
+/** @} */
+
+}
+
+#endif
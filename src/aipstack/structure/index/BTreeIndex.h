@@ -0,0 +1,623 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_BTREE_INDEX_H
+#define AIPSTACK_BTREE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <functional>
+#include <utility>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Instance.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup structure
+ * @{
+ */
+
+#ifndef IN_DOXYGEN
+
+template<typename Arg>
+class BTreeIndex {
+    AIPSTACK_USE_TYPES(Arg, (HookAccessor, LookupKeyArg, KeyFuncs, LinkModel))
+    AIPSTACK_USE_VALS(Arg, (Duplicates, MaxEntries, NodeCapacity))
+    
+    AIPSTACK_USE_TYPES(LinkModel, (State, Ref, Link))
+    
+    static_assert(MaxEntries > 0);
+    static_assert(NodeCapacity >= 4 && NodeCapacity <= 1024);
+    
+    using Entry = std::remove_reference_t<decltype(*std::declval<Ref>())>;
+    
+    // Minimum number of entries (leaves) or children (inner nodes) of nodes
+    // other than the root.
+    inline static constexpr std::size_t MinFill = NodeCapacity / 2;
+    
+    // Calculate the maximum number of tree nodes with MaxEntries entries. On
+    // each level, all nodes other than the root have at least MinFill entries
+    // or children.
+    static constexpr std::size_t CalcMaxNodes ()
+    {
+        std::size_t total = 0;
+        std::size_t level = MaxValue(std::size_t(1), MaxEntries / MinFill);
+        while (level > 1) {
+            total += level;
+            level = MaxValue(std::size_t(1), level / MinFill);
+        }
+        return total + 1;
+    }
+    
+    inline static constexpr std::size_t MaxNodes = CalcMaxNodes();
+    
+    using NodeIdx = std::conditional_t<(MaxNodes < TypeMax<std::uint16_t>),
+                                       std::uint16_t, std::uint32_t>;
+    
+    inline static constexpr NodeIdx NullNode = TypeMax<NodeIdx>;
+    
+public:
+    class Node {
+        friend BTreeIndex;
+        
+        // Leaf which contains the entry.
+        NodeIdx leaf;
+    };
+    
+    class Index {
+        // Type of keys stored in the tree nodes. This is defined here since the
+        // key functions may be incomplete where the Node type is needed.
+        using Key = std::remove_cv_t<std::remove_reference_t<
+            decltype(KeyFuncs::GetKeyOfEntry(std::declval<Entry &>()))>>;
+        
+        struct TreeNode {
+            // Number of entries (leaf) or children (inner node).
+            std::uint16_t count;
+            bool is_leaf;
+            NodeIdx parent;
+            // Next leaf in order (leaves) or next free node (free nodes).
+            NodeIdx next;
+            // Leaf: keys of the entries in order. Inner node: keys[i] is the
+            // lower bound of the entries in the subtree children[i] (for i=0 this
+            // is only used when the child is moved to another node).
+            Key keys[NodeCapacity];
+            // Leaf: the entries. Inner node: the entries corresponding to keys, which
+            // are only used for ordering entries with equal keys if Duplicates.
+            Link links[NodeCapacity];
+            // Inner node: the children.
+            NodeIdx children[NodeCapacity];
+        };
+        
+    public:
+        inline void init ()
+        {
+            m_root = NullNode;
+            m_free = NullNode;
+            m_num_used = 0;
+        }
+        
+        void addEntry (Ref e, State st = State())
+        {
+            Key const &key = KeyFuncs::GetKeyOfEntry(*e);
+            Entry *ent = e;
+            
+            if (m_root == NullNode) {
+                m_root = allocNode(/*is_leaf=*/true, NullNode);
+            }
+            
+            // Find the leaf and the position where the entry belongs.
+            NodeIdx ni = m_root;
+            while (!nd(ni).is_leaf) {
+                TreeNode const &n = nd(ni);
+                std::size_t pos = ScanWhile(1, n.count, [&](std::size_t i) {
+                    return CompareStored(n.keys[i], n.links[i], key, ent, st) <= 0;
+                });
+                ni = n.children[pos - 1];
+            }
+            
+            TreeNode *leaf = &nd(ni);
+            std::size_t pos = ScanWhile(0, leaf->count, [&](std::size_t i) {
+                return CompareStored(leaf->keys[i], leaf->links[i], key, ent, st) < 0;
+            });
+            AIPSTACK_ASSERT(Duplicates || pos == leaf->count ||
+                            !KeyFuncs::KeysAreEqual(leaf->keys[pos], key));
+            
+            // Split the leaf if it is full and continue with the half where the
+            // entry belongs. The position is never at the start of the right half,
+            // so the lower bound of the right half remains valid.
+            if (leaf->count == NodeCapacity) {
+                NodeIdx right_ni = splitNode(ni, st);
+                if (pos > leaf->count) {
+                    pos -= leaf->count;
+                    ni = right_ni;
+                    leaf = &nd(ni);
+                }
+            }
+            
+            shiftSlotsUp(*leaf, pos);
+            leaf->keys[pos] = key;
+            leaf->links[pos] = e.link(st);
+            ac(e).leaf = ni;
+        }
+        
+        void removeEntry (Ref e, State st = State())
+        {
+            NodeIdx ni = ac(e).leaf;
+            TreeNode &leaf = nd(ni);
+            
+            shiftSlotsDown(leaf, slotOfLink(leaf, e.link(st)));
+            
+            rebalance(ni, st);
+        }
+        
+        template<bool Enable = !Duplicates, typename = std::enable_if_t<Enable>>
+        Ref findEntry (LookupKeyArg key, State st = State()) const
+        {
+            if (m_root == NullNode) {
+                return Ref::null();
+            }
+            
+            NodeIdx ni = m_root;
+            while (!nd(ni).is_leaf) {
+                TreeNode const &n = nd(ni);
+                std::size_t pos = ScanWhile(1, n.count, [&](std::size_t i) {
+                    return KeyFuncs::CompareKeys(key, n.keys[i]) >= 0;
+                });
+                ni = n.children[pos - 1];
+            }
+            
+            TreeNode const &leaf = nd(ni);
+            std::size_t pos = ScanWhile(0, leaf.count, [&](std::size_t i) {
+                return KeyFuncs::CompareKeys(key, leaf.keys[i]) > 0;
+            });
+            if (pos == leaf.count || !KeyFuncs::KeysAreEqual(key, leaf.keys[pos])) {
+                return Ref::null();
+            }
+            return leaf.links[pos].ref(st);
+        }
+        
+        template<bool Enable = Duplicates, typename = std::enable_if_t<Enable>>
+        Ref findFirst (LookupKeyArg key, State st = State()) const
+        {
+            if (m_root == NullNode) {
+                return Ref::null();
+            }
+            
+            // The lookup key is ordered before all entries with an equal key, so
+            // descend to the subtree with the last lower bound less than the key.
+            NodeIdx ni = m_root;
+            while (!nd(ni).is_leaf) {
+                TreeNode const &n = nd(ni);
+                std::size_t pos = ScanWhile(1, n.count, [&](std::size_t i) {
+                    return KeyFuncs::CompareKeys(key, n.keys[i]) > 0;
+                });
+                ni = n.children[pos - 1];
+            }
+            
+            // The first entry not less than the key is in this leaf or, if all
+            // entries in it are less, it is the first entry of the next leaf.
+            TreeNode const *leaf = &nd(ni);
+            std::size_t pos = ScanWhile(0, leaf->count, [&](std::size_t i) {
+                return KeyFuncs::CompareKeys(key, leaf->keys[i]) > 0;
+            });
+            if (pos == leaf->count) {
+                if (leaf->next == NullNode) {
+                    return Ref::null();
+                }
+                leaf = &nd(leaf->next);
+                pos = 0;
+            }
+            
+            if (!KeyFuncs::KeysAreEqual(key, leaf->keys[pos])) {
+                return Ref::null();
+            }
+            return leaf->links[pos].ref(st);
+        }
+        
+        template<bool Enable = Duplicates, typename = std::enable_if_t<Enable>>
+        inline Ref findNext (LookupKeyArg key, Ref prev_e, State st = State()) const
+        {
+            Ref entry = next(prev_e, st);
+            if (!entry.isNull() &&
+                !KeyFuncs::KeysAreEqual(key, KeyFuncs::GetKeyOfEntry(*entry)))
+            {
+                entry = Ref::null();
+            }
+            return entry;
+        }
+        
+        inline bool isEmpty () const
+        {
+            return m_root == NullNode;
+        }
+        
+        Ref first (State st = State()) const
+        {
+            if (m_root == NullNode) {
+                return Ref::null();
+            }
+            
+            NodeIdx ni = m_root;
+            while (!nd(ni).is_leaf) {
+                ni = nd(ni).children[0];
+            }
+            return nd(ni).links[0].ref(st);
+        }
+        
+        Ref next (Ref node, State st = State()) const
+        {
+            TreeNode const &leaf = nd(ac(node).leaf);
+            std::size_t pos = slotOfLink(leaf, node.link(st)) + 1;
+            if (pos < leaf.count) {
+                return leaf.links[pos].ref(st);
+            }
+            if (leaf.next == NullNode) {
+                return Ref::null();
+            }
+            return nd(leaf.next).links[0].ref(st);
+        }
+        
+    private:
+        inline static Node & ac (Ref ref)
+        {
+            return HookAccessor::access(*ref);
+        }
+        
+        inline TreeNode & nd (NodeIdx ni)
+        {
+            return m_nodes[ni];
+        }
+        
+        inline TreeNode const & nd (NodeIdx ni) const
+        {
+            return m_nodes[ni];
+        }
+        
+        // Compare a stored key and entry to a new entry. With Duplicates, entries
+        // with equal keys are ordered by address so that there is a total order.
+        inline static int CompareStored (Key const &key1, [[maybe_unused]] Link link1,
+            Key const &key2, [[maybe_unused]] Entry *ent2, [[maybe_unused]] State st)
+        {
+            int cmp = KeyFuncs::CompareKeys(key1, key2);
+            if constexpr (Duplicates) {
+                if (cmp == 0) {
+                    Entry *ent1 = link1.ref(st);
+                    cmp = std::less<Entry *>()(ent1, ent2) ? -1 :
+                          std::less<Entry *>()(ent2, ent1) ? 1 : 0;
+                }
+            }
+            return cmp;
+        }
+        
+        // Find the first index in [start, end) for which pred is false, given
+        // that pred is true for a prefix of the range. A linear scan is used
+        // since for the small nodes it is faster than a binary search, having
+        // sequential memory access and predictable branches.
+        template<typename Pred>
+        inline static std::size_t ScanWhile (
+            std::size_t start, std::size_t end, Pred pred)
+        {
+            while (start < end && pred(start)) {
+                start++;
+            }
+            return start;
+        }
+        
+        inline static std::size_t slotOfLink (TreeNode const &leaf, Link link)
+        {
+            std::size_t pos = 0;
+            while (!(leaf.links[pos] == link)) {
+                pos++;
+                AIPSTACK_ASSERT(pos < leaf.count);
+            }
+            return pos;
+        }
+        
+        inline static std::size_t slotOfChild (TreeNode const &n, NodeIdx child)
+        {
+            std::size_t pos = 0;
+            while (n.children[pos] != child) {
+                pos++;
+                AIPSTACK_ASSERT(pos < n.count);
+            }
+            return pos;
+        }
+        
+        NodeIdx allocNode (bool is_leaf, NodeIdx parent)
+        {
+            NodeIdx ni;
+            if (m_free != NullNode) {
+                ni = m_free;
+                m_free = nd(ni).next;
+            } else {
+                // This can only fail if there are more than MaxEntries entries.
+                AIPSTACK_ASSERT_FORCE(m_num_used < MaxNodes);
+                ni = NodeIdx(m_num_used++);
+            }
+            
+            TreeNode &n = nd(ni);
+            n.count = 0;
+            n.is_leaf = is_leaf;
+            n.parent = parent;
+            n.next = NullNode;
+            return ni;
+        }
+        
+        void freeNode (NodeIdx ni)
+        {
+            nd(ni).next = m_free;
+            m_free = ni;
+        }
+        
+        // Copy an entry (leaf) or child (inner node) from one node to another,
+        // updating the reference to the containing node.
+        void moveSlot (TreeNode const &src, std::size_t src_pos, NodeIdx dst_ni,
+                       std::size_t dst_pos, State st)
+        {
+            TreeNode &dst = nd(dst_ni);
+            dst.keys[dst_pos] = src.keys[src_pos];
+            dst.links[dst_pos] = src.links[src_pos];
+            if (dst.is_leaf) {
+                ac(dst.links[dst_pos].ref(st)).leaf = dst_ni;
+            } else {
+                dst.children[dst_pos] = src.children[src_pos];
+                nd(dst.children[dst_pos]).parent = dst_ni;
+            }
+        }
+        
+        // Move the upper half of a full node into a new node which is inserted
+        // into the parent after it, returning the new node. A full parent is
+        // split first and a new root is made if the node is the root.
+        NodeIdx splitNode (NodeIdx ni, State st)
+        {
+            if (nd(ni).parent == NullNode) {
+                NodeIdx root_ni = allocNode(/*is_leaf=*/false, NullNode);
+                TreeNode &root = nd(root_ni);
+                root.count = 1;
+                root.children[0] = ni;
+                nd(ni).parent = root_ni;
+                m_root = root_ni;
+            }
+            else if (nd(nd(ni).parent).count == NodeCapacity) {
+                splitNode(nd(ni).parent, st);
+            }
+            
+            NodeIdx parent_ni = nd(ni).parent;
+            NodeIdx right_ni = allocNode(nd(ni).is_leaf, parent_ni);
+            TreeNode &n = nd(ni);
+            TreeNode &right = nd(right_ni);
+            
+            std::size_t keep = NodeCapacity / 2;
+            for (std::size_t i = keep; i < NodeCapacity; i++) {
+                moveSlot(n, i, right_ni, i - keep, st);
+            }
+            right.count = std::uint16_t(NodeCapacity - keep);
+            n.count = std::uint16_t(keep);
+            
+            if (n.is_leaf) {
+                right.next = n.next;
+                n.next = right_ni;
+            }
+            
+            // For an inner node, the lower bound of its first moved child becomes
+            // the lower bound of the new node.
+            TreeNode &parent = nd(parent_ni);
+            std::size_t pos = slotOfChild(parent, ni) + 1;
+            shiftSlotsUp(parent, pos);
+            parent.keys[pos] = right.keys[0];
+            parent.links[pos] = right.links[0];
+            parent.children[pos] = right_ni;
+            
+            return right_ni;
+        }
+        
+        // Restore the minimum fill of a node after something was removed from it,
+        // by moving over one entry or child from a sibling or merging with it.
+        void rebalance (NodeIdx ni, State st)
+        {
+            TreeNode &n = nd(ni);
+            
+            if (n.parent == NullNode) {
+                if (n.is_leaf && n.count == 0) {
+                    freeNode(ni);
+                    m_root = NullNode;
+                }
+                else if (!n.is_leaf && n.count == 1) {
+                    m_root = n.children[0];
+                    nd(m_root).parent = NullNode;
+                    freeNode(ni);
+                }
+                return;
+            }
+            
+            if (n.count >= MinFill) {
+                return;
+            }
+            
+            NodeIdx parent_ni = n.parent;
+            TreeNode &parent = nd(parent_ni);
+            std::size_t pos = slotOfChild(parent, ni);
+            
+            if (pos > 0) {
+                NodeIdx left_ni = parent.children[pos - 1];
+                TreeNode &left = nd(left_ni);
+                
+                if (left.count > MinFill) {
+                    // Move the last entry or child of the left sibling to the front.
+                    shiftSlotsUp(n, 0);
+                    moveSlot(left, left.count - 1, ni, 0, st);
+                    if (!n.is_leaf) {
+                        n.keys[1] = parent.keys[pos];
+                        n.links[1] = parent.links[pos];
+                    }
+                    left.count--;
+                    parent.keys[pos] = n.keys[0];
+                    parent.links[pos] = n.links[0];
+                    return;
+                }
+                
+                mergeNodes(left_ni, ni, parent.keys[pos], parent.links[pos], st);
+                shiftSlotsDown(parent, pos);
+                freeNode(ni);
+            } else {
+                NodeIdx right_ni = parent.children[1];
+                TreeNode &right = nd(right_ni);
+                
+                if (right.count > MinFill) {
+                    // Move the first entry or child of the right sibling to the end.
+                    moveSlot(right, 0, ni, n.count, st);
+                    if (!n.is_leaf) {
+                        n.keys[n.count] = parent.keys[1];
+                        n.links[n.count] = parent.links[1];
+                    }
+                    n.count++;
+                    shiftSlotsDown(right, 0);
+                    parent.keys[1] = right.keys[0];
+                    parent.links[1] = right.links[0];
+                    return;
+                }
+                
+                mergeNodes(ni, right_ni, parent.keys[1], parent.links[1], st);
+                shiftSlotsDown(parent, 1);
+                freeNode(right_ni);
+            }
+            
+            rebalance(parent_ni, st);
+        }
+        
+        // Append the contents of a node to its left sibling, given the lower
+        // bound of the node.
+        void mergeNodes (NodeIdx left_ni, NodeIdx right_ni, Key const &bound_key,
+                         Link bound_link, State st)
+        {
+            TreeNode &left = nd(left_ni);
+            TreeNode const &right = nd(right_ni);
+            
+            for (std::size_t i = 0; i < right.count; i++) {
+                moveSlot(right, i, left_ni, left.count + i, st);
+            }
+            
+            if (left.is_leaf) {
+                left.next = right.next;
+            } else {
+                left.keys[left.count] = bound_key;
+                left.links[left.count] = bound_link;
+            }
+            
+            left.count += right.count;
+        }
+        
+        // Make room for a slot at the given position. The lower bound of the
+        // first child of an inner node is not used, so it is not moved.
+        static void shiftSlotsUp (TreeNode &n, std::size_t pos)
+        {
+            std::size_t key_pos = n.is_leaf ? pos : MaxValue(pos, std::size_t(1));
+            for (std::size_t i = n.count; i > key_pos; i--) {
+                n.keys[i] = n.keys[i - 1];
+                n.links[i] = n.links[i - 1];
+            }
+            if (!n.is_leaf) {
+                for (std::size_t i = n.count; i > pos; i--) {
+                    n.children[i] = n.children[i - 1];
+                }
+            }
+            n.count++;
+        }
+        
+        // Remove the slot at the given position.
+        static void shiftSlotsDown (TreeNode &n, std::size_t pos)
+        {
+            for (std::size_t i = pos + 1; i < n.count; i++) {
+                n.keys[i - 1] = n.keys[i];
+                n.links[i - 1] = n.links[i];
+                if (!n.is_leaf) {
+                    n.children[i - 1] = n.children[i];
+                }
+            }
+            n.count--;
+        }
+        
+    private:
+        NodeIdx m_root;
+        NodeIdx m_free;
+        std::size_t m_num_used;
+        TreeNode m_nodes[MaxNodes];
+    };
+};
+
+#endif
+
+/**
+ * An "index" family data structure implementation based on a B+tree.
+ * 
+ * Keys are stored in the tree nodes, each of which holds up to `NodeCapacity_`
+ * entries or children.
+ * Compared to @ref AvlTreeIndexService, a lookup touches only a few
+ * contiguous nodes and the entries themselves are not accessed, which is
+ * faster when the index does not fit in the CPU caches. The leaves are linked
+ * so that iteration in order is sequential.
+ * 
+ * The tree nodes are preallocated within the index for up to `MaxEntries_`
+ * entries and adding more entries is a fatal error. The key of an entry is
+ * copied into the tree so it must be copyable and must not change while the
+ * entry is in the index. Only `GetKeyOfEntry`, `CompareKeys` and
+ * `KeysAreEqual` of the key functions are used.
+ * 
+ * Consult the @ref structure module for general information regarding
+ * configuration of data structures.
+ * 
+ * @tparam MaxEntries_ Maximum number of entries in the index.
+ * @tparam NodeCapacity_ Maximum number of entries or children of a tree node
+ *         (at least 4). Nodes other than the root are at least half full. Nodes
+ *         are searched linearly, so large values make lookups slower.
+ */
+template<std::size_t MaxEntries_, std::size_t NodeCapacity_ = 16>
+class BTreeIndexService {
+public:
+    #ifndef IN_DOXYGEN
+    template<typename HookAccessor_, typename LookupKeyArg_,
+              typename KeyFuncs_, typename LinkModel_, bool Duplicates_>
+    struct Index {
+        using HookAccessor = HookAccessor_;
+        using LookupKeyArg = LookupKeyArg_;
+        using KeyFuncs = KeyFuncs_;
+        using LinkModel = LinkModel_;
+        inline static constexpr bool Duplicates = Duplicates_;
+        inline static constexpr std::size_t MaxEntries = MaxEntries_;
+        inline static constexpr std::size_t NodeCapacity = NodeCapacity_;
+        AIPSTACK_DEF_INSTANCE(Index, BTreeIndex)
+    };
+    #endif
+};
+
+/** @} */
+
+}
+
+#endif
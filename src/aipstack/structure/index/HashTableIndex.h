@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_HASH_TABLE_INDEX_H
+#define AIPSTACK_HASH_TABLE_INDEX_H
+
+#include <cstddef>
+#include <type_traits>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/infra/Instance.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup structure
+ * @{
+ */
+
+#ifndef IN_DOXYGEN
+
+template<typename Arg>
+class HashTableIndex {
+    AIPSTACK_USE_TYPES(Arg, (HookAccessor, LookupKeyArg, KeyFuncs, LinkModel, HashFunc))
+    AIPSTACK_USE_VALS(Arg, (Duplicates, NumBuckets))
+    
+    AIPSTACK_USE_TYPES(LinkModel, (State, Ref, Link))
+    
+    static_assert(NumBuckets > 0 && (NumBuckets & (NumBuckets - 1)) == 0);
+
+public:
+    class Node {
+        friend HashTableIndex;
+        
+        // Next entry in the same bucket.
+        Link next;
+    };
+    
+    class Index {
+    public:
+        inline void init ()
+        {
+            for (Link &bucket : m_buckets) {
+                bucket = Link::null();
+            }
+        }
+        
+        inline void addEntry (Ref e, State st = State())
+        {
+            Link &bucket = m_buckets[bucketOfEntry(e)];
+            ac(e).next = bucket;
+            bucket = e.link(st);
+        }
+        
+        void removeEntry (Ref e, State st = State())
+        {
+            Link e_link = e.link(st);
+            Link *link_ptr = &m_buckets[bucketOfEntry(e)];
+            while (!(*link_ptr == e_link)) {
+                AIPSTACK_ASSERT(!link_ptr->isNull());
+                link_ptr = &ac(link_ptr->ref(st)).next;
+            }
+            *link_ptr = ac(e).next;
+        }
+        
+        template<bool Enable = !Duplicates, typename = std::enable_if_t<Enable>>
+        inline Ref findEntry (LookupKeyArg key, State st = State()) const
+        {
+            return findFromLink(key, m_buckets[bucketOfKey(key)], st);
+        }
+        
+        template<bool Enable = Duplicates, typename = std::enable_if_t<Enable>>
+        inline Ref findFirst (LookupKeyArg key, State st = State()) const
+        {
+            return findFromLink(key, m_buckets[bucketOfKey(key)], st);
+        }
+        
+        template<bool Enable = Duplicates, typename = std::enable_if_t<Enable>>
+        inline Ref findNext (LookupKeyArg key, Ref prev_e, State st = State()) const
+        {
+            return findFromLink(key, ac(prev_e).next, st);
+        }
+        
+        inline bool isEmpty () const
+        {
+            for (Link const &bucket : m_buckets) {
+                if (!bucket.isNull()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        
+        inline Ref first (State st = State()) const
+        {
+            return firstFromBucket(0, st);
+        }
+        
+        inline Ref next (Ref node, State st = State()) const
+        {
+            Link next_link = ac(node).next;
+            if (!next_link.isNull()) {
+                return next_link.ref(st);
+            }
+            return firstFromBucket(bucketOfEntry(node) + 1, st);
+        }
+    
+    private:
+        inline static Node & ac (Ref ref)
+        {
+            return HookAccessor::access(*ref);
+        }
+        
+        inline static std::size_t bucketOfKey (LookupKeyArg key)
+        {
+            return std::size_t(HashFunc::template Hash<KeyFuncs>(key)) &
+                   (NumBuckets - 1);
+        }
+        
+        inline static std::size_t bucketOfEntry (Ref e)
+        {
+            return bucketOfKey(KeyFuncs::GetKeyOfEntry(*e));
+        }
+        
+        static Ref findFromLink (LookupKeyArg key, Link link, State st)
+        {
+            for (Ref e = link.ref(st); !e.isNull(); e = ac(e).next.ref(st)) {
+                // Fetch the next entry in the chain while this one is compared.
+                Ref next = ac(e).next.ref(st);
+                if (!next.isNull()) {
+                    AIPSTACK_PREFETCH(&*next);
+                }
+                if (KeyFuncs::KeysAreEqual(KeyFuncs::GetKeyOfEntry(*e), key)) {
+                    return e;
+                }
+            }
+            return Ref::null();
+        }
+        
+        Ref firstFromBucket (std::size_t start, State st) const
+        {
+            for (std::size_t i = start; i < NumBuckets; i++) {
+                if (!m_buckets[i].isNull()) {
+                    return m_buckets[i].ref(st);
+                }
+            }
+            return Ref::null();
+        }
+    
+    private:
+        Link m_buckets[NumBuckets];
+    };
+};
+
+#endif
+
+/**
+ * Default hash function for @ref HashTableIndexService, which uses the
+ * `HashKey` function of the key functions.
+ */
+struct HashTableKeyFuncsHash {
+    /**
+     * Calculate the hash of a key.
+     * 
+     * @tparam KeyFuncs Key functions of the index.
+     * @tparam Key Type of the key.
+     * @param key The key.
+     * @return `KeyFuncs::HashKey(key)`.
+     */
+    template<typename KeyFuncs, typename Key>
+    inline static std::size_t Hash (Key const &key)
+    {
+        return std::size_t(KeyFuncs::HashKey(key));
+    }
+};
+
+/**
+ * An "index" family data structure implementation based on a hash table with
+ * a fixed number of buckets.
+ * 
+ * Entries hashing to the same bucket are kept in a singly-linked list through
+ * the nodes, so the number of entries is not limited by the number of buckets,
+ * though lookups slow down once there are many more entries than buckets. The
+ * buckets contain links of the link model, so with an array link model the
+ * table is as compact as the array indices.
+ * 
+ * Keys are hashed using the `HashFunc_` class, which must have a static
+ * function template `Hash<KeyFuncs>(key)` returning a `std::size_t`. The
+ * default @ref HashTableKeyFuncsHash uses the `HashKey` function of the key
+ * functions, which all indices in the stack provide (see @ref HashAccumulator).
+ * A different hash function can be used for example to add a secret seed.
+ * Besides hashing, only `GetKeyOfEntry` and `KeysAreEqual` of the key functions
+ * are used, key comparison (`CompareKeys`) is not.
+ * 
+ * Consult the @ref structure module for general information regarding
+ * configuration of data structures.
+ * 
+ * @tparam NumBuckets_ Number of buckets, must be a power of two. A good
+ *         choice is at least the expected number of entries.
+ * @tparam HashFunc_ Hash function class (see above). Since the bucket is
+ *         selected using the low bits of the hash, these must be well mixed.
+ */
+template<std::size_t NumBuckets_, typename HashFunc_ = HashTableKeyFuncsHash>
+class HashTableIndexService {
+public:
+    #ifndef IN_DOXYGEN
+    template<typename HookAccessor_, typename LookupKeyArg_,
+              typename KeyFuncs_, typename LinkModel_, bool Duplicates_>
+    struct Index {
+        using HookAccessor = HookAccessor_;
+        using LookupKeyArg = LookupKeyArg_;
+        using KeyFuncs = KeyFuncs_;
+        using LinkModel = LinkModel_;
+        using HashFunc = HashFunc_;
+        inline static constexpr bool Duplicates = Duplicates_;
+        inline static constexpr std::size_t NumBuckets = NumBuckets_;
+        AIPSTACK_DEF_INSTANCE(Index, HashTableIndex)
+    };
+    #endif
+};
+
+/** @} */
+
+}
+
+#endif
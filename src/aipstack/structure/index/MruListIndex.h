@@ -28,6 +28,7 @@
 #include <type_traits>
 
 #include <aipstack/misc/Use.h>
+#include <aipstack/misc/Hints.h>
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/structure/Accessor.h>
 #include <aipstack/infra/Instance.h>
@@ -84,6 +85,7 @@ public:
         Ref findEntry (LookupKeyArg key, State st = State()) const
         {
             for (Ref e = m_list.first(st); !e.isNull(); e = m_list.next(e, st)) {
+                prefetch_next(e, st);
                 if (KeyFuncs::KeysAreEqual(KeyFuncs::GetKeyOfEntry(*e), key)) {
                     if (!(e == m_list.first(st))) {
                         m_list.remove(e, st);
@@ -126,6 +128,7 @@ public:
         Ref findFirstNextCommon (LookupKeyArg key, Ref start, State st)
         {
             for (Ref e = start; !e.isNull(); e = m_list.next(e, st)) {
+                prefetch_next(e, st);
                 if (KeyFuncs::KeysAreEqual(KeyFuncs::GetKeyOfEntry(*e), key)) {
                     return e;
                 }
@@ -133,6 +136,15 @@ public:
             return Ref::null();
         }
         
+        // Prefetch the entry after e, to be examined after e in a list walk.
+        inline void prefetch_next (Ref e, State st) const
+        {
+            Ref next = m_list.next(e, st);
+            if (!next.isNull()) {
+                AIPSTACK_PREFETCH(&*next);
+            }
+        }
+        
     private:
         mutable EntryList m_list;
     };
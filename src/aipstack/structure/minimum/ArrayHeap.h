@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_ARRAY_HEAP_H
+#define AIPSTACK_ARRAY_HEAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/misc/MinMax.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup structure
+ * @{
+ */
+
+#ifndef IN_DOXYGEN
+
+#ifndef AIPSTACK_ARRAY_HEAP_VERIFY
+#define AIPSTACK_ARRAY_HEAP_VERIFY 0
+#endif
+
+template<typename, typename, typename, std::size_t, std::size_t>
+class ArrayHeap;
+
+template<typename IndexType>
+class ArrayHeapNode {
+    template<typename, typename, typename, std::size_t, std::size_t>
+    friend class ArrayHeap;
+    
+private:
+    // Position of the entry in the heap array.
+    IndexType index;
+};
+
+template<std::size_t MaxEntries>
+using ArrayHeapIndexType = std::conditional_t<(MaxEntries <= TypeMax<std::uint16_t>),
+    std::uint16_t, std::conditional_t<(MaxEntries <= TypeMax<std::uint32_t>),
+    std::uint32_t, std::size_t>>;
+
+template<
+    typename Accessor,
+    typename Compare,
+    typename LinkModel,
+    std::size_t MaxEntries,
+    std::size_t Arity
+>
+class ArrayHeap
+{
+    static_assert(MaxEntries > 0);
+    static_assert(Arity >= 2);
+    static_assert(MaxEntries <= TypeMax<std::size_t> / Arity - 1);
+    
+    using Link = typename LinkModel::Link;
+    using IndexType = ArrayHeapIndexType<MaxEntries>;
+    
+    // Returned by next_lesser_or_equal when there are no more entries.
+    inline static constexpr std::size_t NullPos = TypeMax<std::size_t>;
+    
+private:
+    IndexType m_count;
+    Link m_heap[MaxEntries];
+    
+public:
+    using State = typename LinkModel::State;
+    using Ref = typename LinkModel::Ref;
+    
+    inline void init ()
+    {
+        m_count = 0;
+    }
+    
+    inline bool isEmpty () const
+    {
+        return m_count == 0;
+    }
+    
+    inline Ref first (State st = State()) const
+    {
+        return m_count == 0 ? Ref::null() : m_heap[0].ref(st);
+    }
+    
+    void insert (Ref node, State st = State())
+    {
+        AIPSTACK_ASSERT_FORCE(m_count < MaxEntries);
+        
+        std::size_t pos = m_count;
+        m_count = IndexType(pos + 1);
+        
+        sift_up(st, node, pos);
+        
+        assertValidHeap(st);
+    }
+    
+    void remove (Ref node, State st = State())
+    {
+        AIPSTACK_ASSERT(m_count > 0);
+        
+        std::size_t pos = ac(node).index;
+        AIPSTACK_ASSERT(pos < m_count);
+        AIPSTACK_ASSERT(m_heap[pos] == node.link(st));
+        
+        std::size_t last_pos = std::size_t(m_count - 1);
+        m_count = IndexType(last_pos);
+        
+        // Move the last entry into the vacated position and restore the heap
+        // property around it.
+        if (pos != last_pos) {
+            fixup_at(st, m_heap[last_pos].ref(st), pos);
+        }
+        
+        assertValidHeap(st);
+    }
+    
+    void fixup (Ref node, State st = State())
+    {
+        AIPSTACK_ASSERT(m_count > 0);
+        
+        std::size_t pos = ac(node).index;
+        AIPSTACK_ASSERT(pos < m_count);
+        AIPSTACK_ASSERT(m_heap[pos] == node.link(st));
+        
+        fixup_at(st, node, pos);
+        
+        assertValidHeap(st);
+    }
+    
+    template<typename KeyType, typename Func>
+    inline void findAllLesserOrEqual (KeyType key, Func func, State st = State())
+    {
+        // The callback may change the values of reported entries, so only
+        // entries which have not been reported yet are compared (with the key).
+        std::size_t pos = next_lesser_or_equal(st, key, 0);
+        
+        while (pos != NullPos) {
+            func(m_heap[pos].ref(st));
+            pos = next_lesser_or_equal(st, key, Arity * pos + 1);
+        }
+    }
+    
+    template<typename KeyType>
+    Ref findFirstLesserOrEqual (KeyType key, State st = State())
+    {
+        if (m_count > 0) {
+            Ref root = m_heap[0].ref(st);
+            if (Compare::compareKeyEntry(st, key, root) >= 0) {
+                return root;
+            }
+        }
+        
+        return Ref::null();
+    }
+    
+    template<typename KeyType>
+    Ref findNextLesserOrEqual (KeyType key, Ref node, State st = State())
+    {
+        AIPSTACK_ASSERT(!node.isNull());
+        
+        std::size_t pos = ac(node).index;
+        AIPSTACK_ASSERT(pos < m_count);
+        
+        pos = next_lesser_or_equal(st, key, Arity * pos + 1);
+        
+        return pos == NullPos ? Ref::null() : m_heap[pos].ref(st);
+    }
+    
+    inline void assertValidHeap ([[maybe_unused]] State st = State())
+    {
+#if AIPSTACK_ARRAY_HEAP_VERIFY
+        verifyHeap(st);
+#endif
+    }
+    
+    void verifyHeap (State st = State())
+    {
+        AIPSTACK_ASSERT_FORCE(m_count <= MaxEntries);
+        
+        for (std::size_t pos = 0; pos < m_count; pos++) {
+            Ref node = m_heap[pos].ref(st);
+            AIPSTACK_ASSERT_FORCE(!node.isNull());
+            AIPSTACK_ASSERT_FORCE(ac(node).index == pos);
+            
+            if (pos > 0) {
+                Ref parent = m_heap[(pos - 1) / Arity].ref(st);
+                AIPSTACK_ASSERT_FORCE(Compare::compareEntries(st, parent, node) <= 0);
+            }
+        }
+    }
+    
+private:
+    inline static ArrayHeapNode<IndexType> & ac (Ref ref)
+    {
+        return Accessor::access(*ref);
+    }
+    
+    inline void place (State st, Ref node, std::size_t pos)
+    {
+        m_heap[pos] = node.link(st);
+        ac(node).index = IndexType(pos);
+    }
+    
+    void fixup_at (State st, Ref node, std::size_t pos)
+    {
+        if (pos > 0 && Compare::compareEntries(
+                st, node, m_heap[(pos - 1) / Arity].ref(st)) < 0)
+        {
+            sift_up(st, node, pos);
+        } else {
+            sift_down(st, node, pos);
+        }
+    }
+    
+    // Moves node from the (vacant) position pos toward the root.
+    void sift_up (State st, Ref node, std::size_t pos)
+    {
+        while (pos > 0) {
+            std::size_t parent_pos = (pos - 1) / Arity;
+            Ref parent = m_heap[parent_pos].ref(st);
+            
+            if (Compare::compareEntries(st, parent, node) <= 0) {
+                break;
+            }
+            
+            place(st, parent, pos);
+            pos = parent_pos;
+        }
+        
+        place(st, node, pos);
+    }
+    
+    // Moves node from the (vacant) position pos toward the leaves.
+    void sift_down (State st, Ref node, std::size_t pos)
+    {
+        std::size_t count = m_count;
+        
+        while (true) {
+            std::size_t child_pos = Arity * pos + 1;
+            if (child_pos >= count) {
+                break;
+            }
+            
+            std::size_t end_pos = MinValue(child_pos + Arity, count);
+            
+            std::size_t min_pos = child_pos;
+            Ref min_child = m_heap[child_pos].ref(st);
+            
+            for (std::size_t i = child_pos + 1; i < end_pos; i++) {
+                Ref child = m_heap[i].ref(st);
+                if (Compare::compareEntries(st, child, min_child) < 0) {
+                    min_pos = i;
+                    min_child = child;
+                }
+            }
+            
+            if (Compare::compareEntries(st, min_child, node) >= 0) {
+                break;
+            }
+            
+            place(st, min_child, pos);
+            pos = min_pos;
+        }
+        
+        place(st, node, pos);
+    }
+    
+    // Returns the first position in pre-order, starting at the candidate
+    // position pos, whose entry is lesser than or equal to the key. Subtrees
+    // of entries greater than the key are skipped. The candidate position may
+    // be beyond the end of the array.
+    template<typename KeyType>
+    std::size_t next_lesser_or_equal (State st, KeyType key, std::size_t pos)
+    {
+        while (true) {
+            if (pos < m_count &&
+                Compare::compareKeyEntry(st, key, m_heap[pos].ref(st)) >= 0)
+            {
+                return pos;
+            }
+            
+            // Go up while this is the last child (or the root), then go to
+            // the next sibling.
+            while (pos % Arity == 0) {
+                if (pos == 0) {
+                    return NullPos;
+                }
+                pos = (pos - 1) / Arity;
+            }
+            
+            pos++;
+        }
+    }
+};
+
+#endif
+
+/**
+ * A "minimum" family data structure implementation based on an implicit
+ * d-ary heap stored in an array.
+ * 
+ * The links of the entries are stored in an array within the structure and
+ * each entry only records its position in the array, which allows removal and
+ * fixup in logarithmic time. Navigating the heap does not touch the entries,
+ * and the children of a node are adjacent in the array, so this is more
+ * cache-friendly than @ref LinkedHeapService. The array is preallocated for
+ * up to `MaxEntries_` entries and inserting more entries is a fatal error.
+ * 
+ * Consult the @ref structure module for general information regarding
+ * configuration of data structures.
+ * 
+ * @tparam MaxEntries_ Maximum number of entries in the heap.
+ * @tparam Arity_ Number of children of each heap node (at least 2).
+ */
+template<std::size_t MaxEntries_, std::size_t Arity_ = 4>
+class ArrayHeapService {
+public:
+    #ifndef IN_DOXYGEN
+
+    template<typename LinkModel>
+    using Node = ArrayHeapNode<ArrayHeapIndexType<MaxEntries_>>;
+    
+    template<typename Accessor, typename Compare, typename LinkModel>
+    using Structure = ArrayHeap<Accessor, Compare, LinkModel, MaxEntries_, Arity_>;
+
+    #endif
+};
+
+/** @} */
+
+}
+
+#endif
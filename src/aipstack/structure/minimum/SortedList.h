@@ -194,7 +194,7 @@ public:
         return next_lesser_or_equal(st, key, m_list.next(node, st));
     }
     
-    inline void assertValidHeap (State st = State())
+    inline void assertValidHeap ([[maybe_unused]] State st = State())
     {
 #if AIPSTACK_SORTED_LIST_VERIFY
         verifyHeap(st);
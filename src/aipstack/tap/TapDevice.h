@@ -53,7 +53,11 @@ namespace AIpStack {
  * 
  * The following platforms are currently supported:
  * - Linux: Uses the TUN/TAP driver that comes with the kernel.
- * - Windows: Uses the TAP-Windows driver.
+ * - Windows: Uses the TAP-Windows driver. For point-to-point use at higher
+ *   rates, see also @ref WintunDevice, which is a layer-3 device.
+ * 
+ * On macOS, which has no TAP driver, the layer-3 @ref UtunDevice can be used
+ * instead.
  * 
  * After a @ref TapDevice object is constructed, frames received from the driver
  * will be reported via the @ref FrameReceivedHandler callback function and
@@ -77,6 +81,20 @@ public:
      */
     using FrameReceivedHandler = Function<void(AIpStack::IpBufRef frame)>;
 
+    /**
+     * Type of callback used to deliver a batch of received frames (Linux only).
+     * 
+     * See @ref setFrameBatchHandler.
+     * 
+     * @param frames Array of received frames (see @ref TapRxFrame). The array and
+     *        the referenced buffers must not be used outside of the callback
+     *        function.
+     * @param count Number of frames in the array (positive and not greater than
+     *        the budget set using @ref setRxBudget).
+     */
+    using FrameBatchReceivedHandler =
+        Function<void(TapRxFrame const *frames, std::size_t count)>;
+
     /**
      * Constructor, initializes the driver and related resources.
      * 
@@ -86,14 +104,37 @@ public:
      *   the name of a TAP-Windows device as seen in "Network Connections".
      *   Non-ASCII characters in the name are not supported.
      * 
+     * On Windows, the constructor instead takes the optional arguments
+     * `num_reads` and `num_writes` (after `handler`), which are the numbers of
+     * overlapped read and write operations which may be in progress at the same
+     * time (defaults 8 and 16). Received frames are still delivered in order.
+     * 
      * @param loop Event loop; it must outlive the TapDevice object.
      * @param device_id Specifies which virtual Ethernet device to use (see
      *        description).
      * @param handler Callback function used to deliver Ethernet frames received
      *        from the driver (must not be null).
+     * @param multi_queue (Linux only) Attach as one queue of a multi-queue TAP
+     *        interface (`IFF_MULTI_QUEUE`). Each @ref TapDevice constructed for the
+     *        same interface then receives its own subset of frames, as selected by the
+     *        kernel (by default based on its flow hash, or by a steering program
+     *        installed with `TUNSETSTEERINGEBPF`), which allows running an
+     *        independent stack instance per queue, each with its own event loop (see
+     *        @ref IpFlowSteering). All queues of an interface must be opened with
+     *        this flag.
+     * @param vnet_hdr (Linux only) Exchange frames with the kernel together with a
+     *        `virtio_net_hdr` (`IFF_VNET_HDR`) and enable checksum offload and TCP
+     *        segmentation offload in both directions (`TUNSETOFFLOAD` with
+     *        `TUN_F_CSUM` and `TUN_F_TSO4`), as well as UDP segmentation offload
+     *        for sending if the kernel supports it. Received frames may then be
+     *        TCP super-segments of up to 64 KiB and may have an incomplete
+     *        checksum (see @ref getRxChksumVerified), and frames can be sent with
+     *        offload information using @ref sendFrame(AIpStack::IpBufRef, TapTxOffload const &).
+     * @throw std::runtime_error If opening or configuring the device fails.
      */
     TapDevice (AIpStack::EventLoop &loop, std::string const &device_id,
-               FrameReceivedHandler handler);
+               FrameReceivedHandler handler, bool multi_queue = false,
+               bool vnet_hdr = false);
     
     /**
      * Destructor, disconnects from the driver and releases resources.
@@ -107,6 +148,131 @@ public:
      */
     std::size_t getMtu () const;
 
+    /**
+     * Get the name of the network interface (Linux only).
+     * 
+     * This is useful when `device_id` was empty and the kernel assigned the name,
+     * in order to open further queues of the same interface.
+     * 
+     * @return Interface name.
+     */
+    std::string const & getDeviceName () const;
+
+    /**
+     * Check whether the device was opened as a queue of a multi-queue interface
+     * (Linux only).
+     * 
+     * @return The `multi_queue` argument of the constructor.
+     */
+    bool isMultiQueue () const;
+
+    /**
+     * Attach or detach the queue from the multi-queue interface (Linux only).
+     * 
+     * A detached queue does not receive any frames, the kernel distributes frames
+     * among the remaining queues. Queues are attached initially. This may only
+     * be called if the device was opened with `multi_queue`.
+     * 
+     * @param enabled True to attach, false to detach.
+     * @throw std::runtime_error If the `TUNSETQUEUE` ioctl fails.
+     */
+    void setQueueEnabled (bool enabled);
+
+    /**
+     * Check whether the device was opened with `vnet_hdr` (Linux only).
+     * 
+     * @return The `vnet_hdr` argument of the constructor.
+     */
+    bool hasVnetHdr () const;
+
+    /**
+     * Get the maximum size of TCP super-segments which can be sent (Linux only).
+     * 
+     * This is suitable for @ref EthIfaceDriverParams::tso_max_size.
+     * 
+     * @return Maximum size at the IP level, or zero if the device was not opened
+     *         with `vnet_hdr`.
+     */
+    std::size_t getTsoMaxSize () const;
+
+    /**
+     * Get the maximum size of UDP super-datagrams which can be sent (Linux only).
+     * 
+     * This is suitable for @ref EthIfaceDriverParams::uso_max_size.
+     * 
+     * @return Maximum size at the IP level, or zero if the device was not opened
+     *         with `vnet_hdr` or the kernel does not support UDP segmentation
+     *         offload (before Linux 6.2).
+     */
+    std::size_t getUsoMaxSize () const;
+
+    /**
+     * Check whether the TCP or UDP checksum of the frame being received does not
+     * need to be verified (Linux only).
+     * 
+     * This may only be called from within @ref FrameReceivedHandler. It is true if
+     * the kernel reported that the checksum has been verified or that the frame
+     * originates from the local host and its checksum was not calculated, which
+     * is the case for all super-segments. A stack should then not verify the
+     * checksum (see @ref IpChksumOffloadFlags). Note that such frames should not
+     * be forwarded to another interface as they are.
+     * 
+     * @return Whether the checksum does not need to be verified, always false
+     *         if the device was not opened with `vnet_hdr`.
+     */
+    bool getRxChksumVerified () const;
+
+    /**
+     * Set the maximum number of frames read for one readiness event of the
+     * device (Linux only).
+     * 
+     * Frames are read until there are no more or this many have been read, and
+     * remaining frames are read in a later event loop iteration, so that other
+     * events are not starved. The default is 1. With the io_uring-based event loop
+     * frames are read by submitted read operations one at a time and this has no
+     * effect.
+     * 
+     * This must not be called from within a frame handler.
+     * 
+     * @param max_frames Maximum number of frames (must be positive).
+     */
+    void setRxBudget (std::size_t max_frames);
+
+    /**
+     * Set a handler which receives frames in batches instead of the
+     * @ref FrameReceivedHandler (Linux only).
+     * 
+     * If set, the frames read for one readiness event (see @ref setRxBudget) are
+     * read into separate buffers and then delivered in a single call, for example
+     * to be passed to @ref EthIpIface::recvFrames. Note that this requires a read
+     * buffer for each frame in the budget, each large enough for a super-segment
+     * if the device was opened with `vnet_hdr`.
+     * 
+     * This must not be called from within a frame handler.
+     * 
+     * @param handler Batch handler, or null to use the @ref FrameReceivedHandler.
+     */
+    void setFrameBatchHandler (FrameBatchReceivedHandler handler);
+
+    /**
+     * Set a scheduler which reads received frames in its polls (Linux only).
+     * 
+     * If set, a readiness event of the device only puts its @ref EventLoopRxSource
+     * into polling mode, and frames are read in polls of the scheduler, which
+     * shares receive processing fairly with other devices and adapts between
+     * waiting for readiness and polling according to load (see
+     * @ref EventLoopRxScheduler). The budget of the scheduler then applies instead
+     * of the one set using @ref setRxBudget, except that a batch handler still gets
+     * at most that many frames per call. With the io_uring-based event loop this has
+     * no effect.
+     * 
+     * This must not be called from within a frame handler.
+     * 
+     * @param scheduler Scheduler, or null to read frames for each readiness event.
+     *        It must outlive its use by the device.
+     */
+    void setRxScheduler (AIpStack::EventLoopRxScheduler *scheduler);
+
     /**
      * Send an Ethernet frame to the driver, which will be processed by the OS
      * as an incoming frame.
@@ -116,6 +282,22 @@ public:
      * @return Success or error code.
      */
     AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame);
+
+    /**
+     * Send an Ethernet frame with checksum or segmentation offload (Linux only).
+     * 
+     * This may only request offload if the device was opened with `vnet_hdr`,
+     * and UDP segmentation only if @ref getUsoMaxSize is nonzero. The checksum
+     * field of super-segments is adjusted as expected by the kernel in a copy of
+     * the header template, the frame itself is not modified.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef), starting with
+     *        the 14-byte Ethernet header. For a super-segment, the header template
+     *        must be contained in the first @ref TapTxOffload::hdr_len bytes.
+     * @param offload Offload information, see @ref TapTxOffload.
+     * @return Success or error code.
+     */
+    AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame, TapTxOffload const &offload);
 };
 
 #else
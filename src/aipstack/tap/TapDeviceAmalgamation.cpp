@@ -24,7 +24,11 @@
 
 #if defined(__linux__)
 #include <aipstack/tap/linux/TapDeviceLinux.cpp>
+#include <aipstack/tap/linux/PacketDeviceLinux.cpp>
 #elif defined(_WIN32)
 #include <aipstack/tap/windows/TapDeviceWindows.cpp>
 #include <aipstack/tap/windows/tapwin_funcs.cpp>
+#include <aipstack/tap/windows/WintunDevice.cpp>
+#elif defined(__APPLE__)
+#include <aipstack/tap/macos/UtunDevice.cpp>
 #endif
@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/tap/linux/PacketDeviceLinux.h>
+
+// Definition missing from older kernel headers (supported since Linux 4.20).
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+namespace AIpStack {
+
+namespace {
+
+// Accesses to the status words of blocks and frames, which are shared with the
+// kernel.
+inline std::uint32_t loadAcquire (std::uint32_t const *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+inline void storeRelease (std::uint32_t *ptr, std::uint32_t value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+// Offset of frame data in a TX frame slot, used by the kernel when
+// PACKET_TX_HAS_OFF is not enabled.
+constexpr std::size_t TxDataOffset = TPACKET_ALIGN(sizeof(struct tpacket3_hdr));
+
+}
+
+PacketDeviceLinux::Mapping::Mapping () :
+    m_ptr(MAP_FAILED),
+    m_size(0)
+{}
+
+PacketDeviceLinux::Mapping::~Mapping ()
+{
+    if (m_ptr != MAP_FAILED) {
+        ::munmap(m_ptr, m_size);
+    }
+}
+
+void PacketDeviceLinux::Mapping::map (std::size_t size, int fd)
+{
+    AIPSTACK_ASSERT(m_ptr == MAP_FAILED);
+    
+    m_ptr = ::mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                   fd, 0);
+    if (m_ptr == MAP_FAILED) {
+        throw std::runtime_error("PacketDeviceLinux: mmap failed.");
+    }
+    m_size = size;
+}
+
+char * PacketDeviceLinux::Mapping::ptr () const
+{
+    return static_cast<char *>(m_ptr);
+}
+
+PacketDeviceLinux::PacketDeviceLinux (
+    AIpStack::EventLoop &loop, std::string const &device_id, FrameReceivedHandler handler,
+    PacketDeviceParams const &params)
+:
+    m_handler(handler),
+    m_params(params),
+    m_tx_ring(nullptr),
+    m_rx_block(0),
+    m_tx_frame(0),
+    m_tx_pending(false),
+    m_fd_watcher(loop, AIPSTACK_BIND_MEMBER(&PacketDeviceLinux::handleFdEvents, this)),
+    m_active(true)
+{
+    std::uint32_t page_size = std::uint32_t(::sysconf(_SC_PAGESIZE));
+    
+    AIPSTACK_ASSERT(params.block_size > 0 && params.block_size % page_size == 0);
+    AIPSTACK_ASSERT((params.block_size & (params.block_size - 1)) == 0);
+    AIPSTACK_ASSERT(params.num_blocks > 0);
+    AIPSTACK_ASSERT(params.tx_frame_size % TPACKET_ALIGNMENT == 0);
+    AIPSTACK_ASSERT(params.tx_frame_size >= TxDataOffset + AIpStack::EthHeader::Size);
+    AIPSTACK_ASSERT(params.num_tx_frames > 0);
+    AIPSTACK_ASSERT(params.rx_budget > 0);
+    
+    // TX frame slots must not cross block boundaries, so put as many as fit into
+    // each block of whole pages.
+    m_tx_frames_per_block = MaxValue(std::uint32_t(1), page_size / params.tx_frame_size);
+    m_tx_block_size = (m_tx_frames_per_block * params.tx_frame_size + page_size - 1) /
+        page_size * page_size;
+    std::uint32_t tx_num_blocks = (params.num_tx_frames + m_tx_frames_per_block - 1) /
+        m_tx_frames_per_block;
+    m_tx_num_frames = tx_num_blocks * m_tx_frames_per_block;
+    
+    unsigned int ifindex = ::if_nametoindex(device_id.c_str());
+    if (ifindex == 0) {
+        throw std::runtime_error("PacketDeviceLinux: Interface not found.");
+    }
+    
+    m_fd = AIpStack::FileDescriptorWrapper{
+        ::socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))};
+    if (!m_fd) {
+        throw std::runtime_error("PacketDeviceLinux: socket(AF_PACKET) failed.");
+    }
+    
+    m_fd.setNonblocking();
+    
+    {
+        int version = TPACKET_V3;
+        if (::setsockopt(*m_fd, SOL_PACKET, PACKET_VERSION,
+                         &version, sizeof(version)) < 0)
+        {
+            throw std::runtime_error("PacketDeviceLinux: setsockopt(PACKET_VERSION) "
+                "failed.");
+        }
+    }
+    
+    // Frames that we send are not of interest. If this is not supported, they are
+    // recognized by their packet type when receiving.
+    {
+        int ignore = 1;
+        ::setsockopt(*m_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+    }
+    
+    {
+        struct tpacket_req3 req;
+        std::memset(&req, 0, sizeof(req));
+        req.tp_block_size = params.block_size;
+        req.tp_block_nr = params.num_blocks;
+        // Frame size does not really matter for V3 receiving since frames are
+        // packed into blocks, but the kernel requires it to divide the block size.
+        req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+        req.tp_frame_nr = params.block_size / req.tp_frame_size * params.num_blocks;
+        req.tp_retire_blk_tov = params.block_timeout_ms;
+        
+        if (::setsockopt(*m_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+            throw std::runtime_error("PacketDeviceLinux: setsockopt(PACKET_RX_RING) "
+                "failed.");
+        }
+    }
+    
+    {
+        struct tpacket_req3 req;
+        std::memset(&req, 0, sizeof(req));
+        req.tp_block_size = m_tx_block_size;
+        req.tp_block_nr = tx_num_blocks;
+        req.tp_frame_size = params.tx_frame_size;
+        req.tp_frame_nr = m_tx_num_frames;
+        
+        if (::setsockopt(*m_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+            throw std::runtime_error("PacketDeviceLinux: setsockopt(PACKET_TX_RING) "
+                "failed.");
+        }
+    }
+    
+    // The RX ring and the TX ring are mapped together, in that order.
+    std::size_t rx_ring_size = std::size_t(params.block_size) * params.num_blocks;
+    m_ring.map(rx_ring_size + std::size_t(m_tx_block_size) * tx_num_blocks, *m_fd);
+    m_tx_ring = m_ring.ptr() + rx_ring_size;
+    
+    if (params.promiscuous) {
+        struct packet_mreq mreq;
+        std::memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = int(ifindex);
+        mreq.mr_type = PACKET_MR_PROMISC;
+        
+        if (::setsockopt(*m_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                         &mreq, sizeof(mreq)) < 0)
+        {
+            throw std::runtime_error("PacketDeviceLinux: setsockopt("
+                "PACKET_ADD_MEMBERSHIP) failed.");
+        }
+    }
+    
+    {
+        struct sockaddr_ll addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = int(ifindex);
+        
+        if (::bind(*m_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                   sizeof(addr)) < 0)
+        {
+            throw std::runtime_error("PacketDeviceLinux: bind failed.");
+        }
+    }
+    
+    {
+        struct ifreq ifr;
+        std::memset(&ifr, 0, sizeof(ifr));
+        std::snprintf(ifr.ifr_name, IFNAMSIZ, "%s", device_id.c_str());
+        
+        if (::ioctl(*m_fd, SIOCGIFMTU, reinterpret_cast<void *>(&ifr)) < 0) {
+            throw std::runtime_error("PacketDeviceLinux: ioctl(SIOCGIFMTU) failed.");
+        }
+        
+        m_frame_mtu = MinValue(std::size_t(ifr.ifr_mtu) + AIpStack::EthHeader::Size,
+                               std::size_t(params.tx_frame_size) - TxDataOffset);
+    }
+    
+    m_fd_watcher.initFd(*m_fd, AIpStack::EventLoopFdEvents::Read);
+}
+
+PacketDeviceLinux::~PacketDeviceLinux ()
+{}
+
+std::size_t PacketDeviceLinux::getMtu () const
+{
+    return m_frame_mtu;
+}
+
+void PacketDeviceLinux::setFrameBatchHandler (FrameBatchReceivedHandler handler)
+{
+    m_batch_handler = handler;
+}
+
+AIpStack::IpErr PacketDeviceLinux::sendFrame (AIpStack::IpBufRef frame)
+{
+    if (!m_active) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    
+    if (frame.tot_len < AIpStack::EthHeader::Size) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    else if (frame.tot_len > m_frame_mtu) {
+        return AIpStack::IpErr::PacketTooLarge;
+    }
+    
+    // The kernel processes frame slots in order, so the next slot is free if it
+    // has been completed (or rejected).
+    char *slot = txFrame(m_tx_frame);
+    auto *hdr = reinterpret_cast<struct tpacket3_hdr *>(slot);
+    
+    std::uint32_t status = loadAcquire(&hdr->tp_status);
+    if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) {
+        // Make sure the kernel is processing any frames we queued earlier.
+        kickTx();
+        return AIpStack::IpErr::OutputBufferFull;
+    }
+    
+    std::size_t len = frame.tot_len;
+    AIpStack::ipBufTakeBytes(frame, len, slot + TxDataOffset);
+    
+    hdr->tp_next_offset = 0;
+    hdr->tp_len = std::uint32_t(len);
+    hdr->tp_snaplen = std::uint32_t(len);
+    
+    storeRelease(&hdr->tp_status, TP_STATUS_SEND_REQUEST);
+    
+    m_tx_frame = (m_tx_frame + 1 == m_tx_num_frames) ? 0 : m_tx_frame + 1;
+    m_tx_pending = true;
+    
+    if (!m_params.defer_tx_kick) {
+        kickTx();
+    }
+    
+    return AIpStack::IpErr::Success;
+}
+
+void PacketDeviceLinux::flushFrames ()
+{
+    if (m_active && m_tx_pending) {
+        kickTx();
+    }
+}
+
+char * PacketDeviceLinux::txFrame (std::uint32_t index) const
+{
+    std::uint32_t block = index / m_tx_frames_per_block;
+    std::uint32_t frame = index % m_tx_frames_per_block;
+    
+    return m_tx_ring + std::size_t(block) * m_tx_block_size +
+        std::size_t(frame) * m_params.tx_frame_size;
+}
+
+void PacketDeviceLinux::kickTx ()
+{
+    // With MSG_DONTWAIT the kernel only takes the queued frames from the ring and
+    // does not wait for them to be sent. Errors are not reported since the frames
+    // are then just dropped, like when the device queue is full.
+    ::send(*m_fd, nullptr, 0, MSG_DONTWAIT);
+    
+    m_tx_pending = false;
+}
+
+void PacketDeviceLinux::processBlock (char *block)
+{
+    auto *desc = reinterpret_cast<struct tpacket_block_desc *>(block);
+    std::uint32_t num_pkts = desc->hdr.bh1.num_pkts;
+    
+    if (m_rx_frames.size() < num_pkts) {
+        m_rx_frames.resize(num_pkts);
+        m_rx_nodes.resize(num_pkts);
+    }
+    
+    std::size_t num_frames = 0;
+    char *pkt = block + desc->hdr.bh1.offset_to_first_pkt;
+    
+    for (std::uint32_t i = 0; i < num_pkts; i++) {
+        auto *hdr = reinterpret_cast<struct tpacket3_hdr *>(pkt);
+        auto *ll = reinterpret_cast<struct sockaddr_ll *>(pkt + TxDataOffset);
+        
+        // Skip frames which were truncated because they did not fit into the
+        // block, frames which had a VLAN tag (it has been removed from the frame
+        // data) and frames which were sent by the host.
+        if (hdr->tp_snaplen == hdr->tp_len &&
+            hdr->tp_len >= AIpStack::EthHeader::Size &&
+            (hdr->tp_status & TP_STATUS_VLAN_VALID) == 0 &&
+            ll->sll_pkttype != PACKET_OUTGOING)
+        {
+            char *data = pkt + hdr->tp_mac;
+            std::size_t len = hdr->tp_snaplen;
+            
+            m_rx_nodes[num_frames] = AIpStack::IpBufNode{data, len, nullptr};
+            TapRxFrame &frame = m_rx_frames[num_frames];
+            frame.frame = AIpStack::IpBufRef{&m_rx_nodes[num_frames], 0, len};
+            // A partial checksum means that the frame comes from the local host
+            // (e.g. over a veth pair) and its data did not pass through a wire.
+            frame.chksum_verified = (hdr->tp_status &
+                (TP_STATUS_CSUM_VALID|TP_STATUS_CSUMNOTREADY)) != 0;
+            num_frames++;
+        }
+        
+        pkt += hdr->tp_next_offset;
+    }
+    
+    if (num_frames == 0) {
+        return;
+    }
+    
+    if (m_batch_handler) {
+        m_batch_handler(m_rx_frames.data(), num_frames);
+    } else {
+        for (std::size_t i = 0; i < num_frames; i++) {
+            m_handler(m_rx_frames[i].frame);
+        }
+    }
+}
+
+void PacketDeviceLinux::handleFdEvents (AIpStack::EventLoopFdEvents events)
+{
+    AIPSTACK_ASSERT(m_active);
+    
+    if ((events & AIpStack::EventLoopFdEvents::Error) != AIpStack::Enum0) {
+        std::fprintf(stderr, "PacketDeviceLinux: Error event. Stopping.\n");
+        m_fd_watcher.reset();
+        m_active = false;
+        return;
+    }
+    
+    // Process blocks passed to us by the kernel, up to the budget. If there are
+    // more, the event loop reports the socket again.
+    for (std::size_t i = 0; i < m_params.rx_budget; i++) {
+        char *block = m_ring.ptr() + std::size_t(m_rx_block) * m_params.block_size;
+        auto *desc = reinterpret_cast<struct tpacket_block_desc *>(block);
+        
+        if ((loadAcquire(&desc->hdr.bh1.block_status) & TP_STATUS_USER) == 0) {
+            break;
+        }
+        
+        processBlock(block);
+        
+        // Give the block back to the kernel, frames in it are no longer used.
+        storeRelease(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL);
+        
+        m_rx_block = (m_rx_block + 1 == m_params.num_blocks) ? 0 : m_rx_block + 1;
+    }
+}
+
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2017 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_PACKET_DEVICE_LINUX_H
+#define AIPSTACK_PACKET_DEVICE_LINUX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/tap/linux/TapDeviceLinux.h>
+
+namespace AIpStack {
+
+/**
+ * Configuration parameters for @ref PacketDeviceLinux.
+ */
+struct PacketDeviceParams {
+    /**
+     * Size of each block of the receive ring, must be a multiple of the page
+     * size and a power of two.
+     */
+    std::uint32_t block_size = std::uint32_t(1) << 18;
+
+    /**
+     * Number of blocks of the receive ring.
+     */
+    std::uint32_t num_blocks = 16;
+
+    /**
+     * Time in milliseconds after which a block which is not full is passed to us
+     * anyway. This bounds the latency added by block-based receiving.
+     */
+    std::uint32_t block_timeout_ms = 1;
+
+    /**
+     * Size of each frame slot of the transmit ring, must be a multiple of 16
+     * (`TPACKET_ALIGNMENT`). It includes a header of 48 bytes.
+     */
+    std::uint32_t tx_frame_size = 2048;
+
+    /**
+     * Number of frame slots of the transmit ring.
+     */
+    std::uint32_t num_tx_frames = 512;
+
+    /**
+     * Maximum number of blocks processed for one readiness event of the socket,
+     * for fairness with respect to other event sources.
+     */
+    std::size_t rx_budget = 4;
+
+    /**
+     * Whether to enable promiscuous mode of the interface, which is needed for
+     * receiving frames sent to a MAC address different from that of the
+     * interface.
+     */
+    bool promiscuous = true;
+
+    /**
+     * Do not notify the kernel of frames sent using
+     * @ref PacketDeviceLinux::sendFrame immediately but only in
+     * @ref PacketDeviceLinux::flushFrames, which must then be called (e.g. via
+     * @ref EthIfaceDriverParams::flush_frames).
+     */
+    bool defer_tx_kick = false;
+};
+
+/**
+ * Provides access to a network interface using a Linux `AF_PACKET` socket with
+ * memory-mapped `TPACKET_V3` rings (Linux only).
+ * 
+ * This is an alternative to @ref XdpDevice where AF_XDP is not available, with an
+ * interface like that of @ref TapDevice. Received frames are read from blocks of
+ * the receive ring shared with the kernel, where each block holds many frames, so
+ * that no system call is needed per frame. Frames are passed to the
+ * @ref FrameReceivedHandler one by one, or a block at a time to a handler set
+ * using @ref setFrameBatchHandler. Frames to be sent are copied into the transmit
+ * ring and the kernel is notified once for possibly many frames (see
+ * @ref PacketDeviceParams::defer_tx_kick).
+ * 
+ * The kernel network stack still processes frames received on the interface as
+ * well, so the stack should use its own MAC address (hence the default of
+ * @ref PacketDeviceParams::promiscuous). Frames with a VLAN tag are not
+ * delivered, and receive offloads which coalesce frames beyond the MTU (GRO and
+ * LRO) should be disabled on the interface, as such frames are dropped when
+ * they do not fit into a block.
+ */
+class PacketDeviceLinux :
+    private AIpStack::NonCopyable<PacketDeviceLinux>
+{
+public:
+    /**
+     * Type of callback used to deliver received frames.
+     * 
+     * See @ref TapDevice::FrameReceivedHandler.
+     */
+    using FrameReceivedHandler = Function<void(AIpStack::IpBufRef frame)>;
+
+    /**
+     * Type of callback used to deliver a batch of received frames.
+     * 
+     * See @ref TapDevice::FrameBatchReceivedHandler.
+     */
+    using FrameBatchReceivedHandler =
+        Function<void(TapRxFrame const *frames, std::size_t count)>;
+
+    /**
+     * Constructor, creates the socket and rings.
+     * 
+     * @param loop Event loop; it must outlive the PacketDeviceLinux object.
+     * @param device_id Name of the network interface.
+     * @param handler Callback function used to deliver received Ethernet frames
+     *        (must not be null).
+     * @param params Configuration parameters.
+     * @throw std::runtime_error If creating or configuring the socket fails.
+     */
+    PacketDeviceLinux (AIpStack::EventLoop &loop, std::string const &device_id,
+                       FrameReceivedHandler handler,
+                       PacketDeviceParams const &params = PacketDeviceParams());
+
+    /**
+     * Destructor, releases the socket and rings.
+     */
+    ~PacketDeviceLinux ();
+
+    /**
+     * Get the maximum frame size.
+     * 
+     * @return The maximum frame size including the 14-byte Ethernet header, based
+     *         on the interface MTU and the transmit frame slot size.
+     */
+    std::size_t getMtu () const;
+
+    /**
+     * Set a handler which receives the frames of each block in batches instead
+     * of the @ref FrameReceivedHandler.
+     * 
+     * This must not be called from within a frame handler.
+     * 
+     * @param handler Batch handler, or null to use the @ref FrameReceivedHandler.
+     */
+    void setFrameBatchHandler (FrameBatchReceivedHandler handler);
+
+    /**
+     * Send an Ethernet frame through the network interface.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef), starting with the
+     *        14-byte Ethernet header.
+     * @return Success or error code (@ref IpErr::OutputBufferFull if the transmit
+     *         ring is full).
+     */
+    AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame);
+
+    /**
+     * Notify the kernel of frames sent using @ref sendFrame, if needed.
+     * 
+     * This only needs to be called with @ref PacketDeviceParams::defer_tx_kick.
+     */
+    void flushFrames ();
+
+private:
+    // RAII holder of the mapping of the rings.
+    class Mapping :
+        private AIpStack::NonCopyable<Mapping>
+    {
+    public:
+        Mapping ();
+        ~Mapping ();
+        void map (std::size_t size, int fd);
+        char * ptr () const;
+
+    private:
+        void *m_ptr;
+        std::size_t m_size;
+    };
+
+    void processBlock (char *block);
+
+    char * txFrame (std::uint32_t index) const;
+
+    void kickTx ();
+
+    void handleFdEvents (AIpStack::EventLoopFdEvents events);
+
+private:
+    FrameReceivedHandler m_handler;
+    FrameBatchReceivedHandler m_batch_handler;
+    PacketDeviceParams m_params;
+    std::size_t m_frame_mtu;
+    std::uint32_t m_tx_block_size;
+    std::uint32_t m_tx_frames_per_block;
+    std::uint32_t m_tx_num_frames;
+    AIpStack::FileDescriptorWrapper m_fd;
+    Mapping m_ring;
+    char *m_tx_ring;
+    std::uint32_t m_rx_block;
+    std::uint32_t m_tx_frame;
+    bool m_tx_pending;
+    std::vector<AIpStack::IpBufNode> m_rx_nodes;
+    std::vector<TapRxFrame> m_rx_frames;
+    AIpStack::EventLoopFdWatcher m_fd_watcher;
+    bool m_active;
+};
+
+}
+
+#endif
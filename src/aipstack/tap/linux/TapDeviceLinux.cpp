@@ -26,7 +26,9 @@
 #include <cstdio>
 #include <cerrno>
 #include <cstddef>
+#include <cstdint>
 #include <stdexcept>
+#include <memory>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -34,23 +36,78 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <linux/if_tun.h>
 
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/Function.h>
+#include <aipstack/misc/TypedFunction.h>
+#include <aipstack/misc/MinMax.h>
 #include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Chksum.h>
+#include <aipstack/infra/Struct.h>
 #include <aipstack/proto/EthernetProto.h>
+#include <aipstack/proto/Udp4Proto.h>
 #include <aipstack/tap/linux/TapDeviceLinux.h>
 
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+#include <poll.h>
+#include <linux/io_uring.h>
+#endif
+
+// Definitions missing from older kernel headers (USO is supported since Linux 6.2).
+#ifndef TUN_F_USO4
+#define TUN_F_USO4 0x20
+#endif
+#ifndef TUN_F_USO6
+#define TUN_F_USO6 0x40
+#endif
+
 namespace AIpStack {
 
+namespace {
+
+// The legacy virtio_net_hdr in native byte order, as used by the TUN/TAP driver
+// with IFF_VNET_HDR. It is defined here because <linux/virtio_net.h> cannot be
+// included from C++ (it has a struct member named "class").
+struct VirtioNetHdr {
+    std::uint8_t flags;
+    std::uint8_t gso_type;
+    std::uint16_t hdr_len;
+    std::uint16_t gso_size;
+    std::uint16_t csum_start;
+    std::uint16_t csum_offset;
+};
+static_assert(sizeof(VirtioNetHdr) == 10);
+
+constexpr std::uint8_t VirtioNetHdrFlagNeedsCsum = 1;
+constexpr std::uint8_t VirtioNetHdrFlagDataValid = 2;
+
+constexpr std::uint8_t VirtioNetHdrGsoNone = 0;
+constexpr std::uint8_t VirtioNetHdrGsoTcp4 = 1;
+constexpr std::uint8_t VirtioNetHdrGsoUdpL4 = 5;
+
+}
+
 TapDeviceLinux::TapDeviceLinux (
-    AIpStack::EventLoop &loop, std::string const &device_id, FrameReceivedHandler handler)
+    AIpStack::EventLoop &loop, std::string const &device_id, FrameReceivedHandler handler,
+    bool multi_queue, bool vnet_hdr)
 :
     m_handler(handler),
+    m_multi_queue(multi_queue),
+    m_vnet_hdr(vnet_hdr),
+    m_uso_supported(false),
+    m_rx_chksum_verified(false),
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+    m_uring_notifier(loop,
+        AIPSTACK_BIND_MEMBER(&TapDeviceLinux::handleUringCompleted, this)),
+    m_uring_polling(false),
+#else
     m_fd_watcher(loop, AIPSTACK_BIND_MEMBER(&TapDeviceLinux::handleFdEvents, this)),
+#endif
+    m_rx_budget(1),
     m_active(true)
 {
     m_fd = AIpStack::FileDescriptorWrapper{::open("/dev/net/tun", O_RDWR)};
@@ -60,19 +117,39 @@ TapDeviceLinux::TapDeviceLinux (
     
     m_fd.setNonblocking();
     
-    std::string devname_real;
-
     {
         struct ifreq ifr;
         std::memset(&ifr, 0, sizeof(ifr));
         ifr.ifr_flags |= IFF_NO_PI|IFF_TAP;
+        if (multi_queue) {
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        }
+        if (vnet_hdr) {
+            ifr.ifr_flags |= IFF_VNET_HDR;
+        }
         std::snprintf(ifr.ifr_name, IFNAMSIZ, "%s", device_id.c_str());
         
         if (::ioctl(*m_fd, TUNSETIFF, reinterpret_cast<void *>(&ifr)) < 0) {
             throw std::runtime_error("ioctl(TUNSETIFF) failed.");
         }
 
-        devname_real = ifr.ifr_name;
+        m_device_name = ifr.ifr_name;
+    }
+    
+    if (vnet_hdr) {
+        // Tell the kernel that we can receive frames with an incomplete checksum
+        // and TCP super-segments. USO is only used for sending, since the stack
+        // cannot receive UDP super-datagrams, but the kernel accepts sending them
+        // exactly when it supports USO offload flags, so probe for that first.
+        unsigned long offload = TUN_F_CSUM|TUN_F_TSO4;
+        
+        if (::ioctl(*m_fd, TUNSETOFFLOAD, offload|TUN_F_USO4|TUN_F_USO6) == 0) {
+            m_uso_supported = true;
+        }
+        
+        if (::ioctl(*m_fd, TUNSETOFFLOAD, offload) < 0) {
+            throw std::runtime_error("ioctl(TUNSETOFFLOAD) failed.");
+        }
     }
     
     {
@@ -83,7 +160,7 @@ TapDeviceLinux::TapDeviceLinux (
         
         struct ifreq ifr;
         std::memset(&ifr, 0, sizeof(ifr));
-        std::strcpy(ifr.ifr_name, devname_real.c_str());
+        std::strcpy(ifr.ifr_name, m_device_name.c_str());
         
         if (::ioctl(*sock, SIOCGIFMTU, reinterpret_cast<void *>(&ifr)) < 0) {
             throw std::runtime_error("ioctl(SIOCGIFMTU) failed.");
@@ -92,10 +169,28 @@ TapDeviceLinux::TapDeviceLinux (
         m_frame_mtu = std::size_t(ifr.ifr_mtu) + AIpStack::EthHeader::Size;
     }
     
-    m_read_buffer.resize(m_frame_mtu);
-    m_write_buffer.resize(m_frame_mtu);
+    // With vnet_hdr, the kernel may pass us super-segments and we may pass it
+    // super-segments or super-datagrams, each up to GsoMaxSize at the IP level.
+    std::size_t max_frame = m_frame_mtu;
+    m_read_size = m_frame_mtu;
+    if (vnet_hdr) {
+        max_frame = MaxValue(max_frame, AIpStack::EthHeader::Size + GsoMaxSize);
+        m_read_size = sizeof(VirtioNetHdr) + max_frame;
+    }
+    
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+    m_read_buffer = std::make_shared<std::vector<char>>(m_read_size);
+#else
+    updateReadBuffers();
+#endif
+    m_write_buffer.resize(max_frame);
     
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+    m_uring_notifier.prepare();
+    startRead();
+#else
     m_fd_watcher.initFd(*m_fd, AIpStack::EventLoopFdEvents::Read);
+#endif
 }
 
 TapDeviceLinux::~TapDeviceLinux ()
@@ -106,25 +201,192 @@ std::size_t TapDeviceLinux::getMtu () const
     return m_frame_mtu;
 }
 
+std::string const & TapDeviceLinux::getDeviceName () const
+{
+    return m_device_name;
+}
+
+bool TapDeviceLinux::isMultiQueue () const
+{
+    return m_multi_queue;
+}
+
+void TapDeviceLinux::setQueueEnabled (bool enabled)
+{
+    AIPSTACK_ASSERT(m_multi_queue);
+    
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = enabled ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+    
+    if (::ioctl(*m_fd, TUNSETQUEUE, reinterpret_cast<void *>(&ifr)) < 0) {
+        throw std::runtime_error("ioctl(TUNSETQUEUE) failed.");
+    }
+}
+
+bool TapDeviceLinux::hasVnetHdr () const
+{
+    return m_vnet_hdr;
+}
+
+std::size_t TapDeviceLinux::getTsoMaxSize () const
+{
+    return m_vnet_hdr ? GsoMaxSize : 0;
+}
+
+std::size_t TapDeviceLinux::getUsoMaxSize () const
+{
+    return m_uso_supported ? GsoMaxSize : 0;
+}
+
+bool TapDeviceLinux::getRxChksumVerified () const
+{
+    return m_rx_chksum_verified;
+}
+
+void TapDeviceLinux::setRxBudget (std::size_t max_frames)
+{
+    AIPSTACK_ASSERT(max_frames > 0);
+    
+    m_rx_budget = max_frames;
+#if !AIPSTACK_EVENT_LOOP_HAS_URING
+    updateReadBuffers();
+#endif
+}
+
+void TapDeviceLinux::setFrameBatchHandler (FrameBatchReceivedHandler handler)
+{
+    m_batch_handler = handler;
+#if !AIPSTACK_EVENT_LOOP_HAS_URING
+    updateReadBuffers();
+#endif
+}
+
+void TapDeviceLinux::setRxScheduler (AIpStack::EventLoopRxScheduler *scheduler)
+{
+#if !AIPSTACK_EVENT_LOOP_HAS_URING
+    // If the previous source is in polling mode the fd is not being monitored.
+    if (m_rx_source != nullptr && m_rx_source->isPolling() && m_active) {
+        m_fd_watcher.updateEvents(AIpStack::EventLoopFdEvents::Read);
+    }
+    
+    m_rx_source.reset();
+    
+    if (scheduler != nullptr) {
+        m_rx_source = std::make_unique<AIpStack::EventLoopRxSource>(*scheduler,
+            AIPSTACK_BIND_MEMBER(&TapDeviceLinux::pollRxSource, this),
+            AIPSTACK_BIND_MEMBER(&TapDeviceLinux::armRxSource, this));
+    }
+#else
+    static_cast<void>(scheduler);
+#endif
+}
+
 AIpStack::IpErr TapDeviceLinux::sendFrame (AIpStack::IpBufRef frame)
 {
+    return sendFrame(frame, TapTxOffload());
+}
+
+AIpStack::IpErr TapDeviceLinux::sendFrame (
+    AIpStack::IpBufRef frame, TapTxOffload const &offload)
+{
+    bool gso = offload.gso_type != TapGsoType::None;
+    AIPSTACK_ASSERT(m_vnet_hdr || (!offload.csum_partial && !gso));
+    AIPSTACK_ASSERT(!gso || offload.csum_partial);
+    AIPSTACK_ASSERT(offload.gso_type != TapGsoType::Udp4 || m_uso_supported);
+    
     if (!m_active) {
         return AIpStack::IpErr::HardwareError;
     }
     
+    std::size_t max_len = gso ? AIpStack::EthHeader::Size + GsoMaxSize : m_frame_mtu;
     if (frame.tot_len < AIpStack::EthHeader::Size) {
         return AIpStack::IpErr::HardwareError;
     }
-    else if (frame.tot_len > m_frame_mtu) {
+    else if (frame.tot_len > max_len) {
         return AIpStack::IpErr::PacketTooLarge;
     }
     
-    char *buffer = m_write_buffer.data();
-    
     std::size_t len = frame.tot_len;
-    frame = ipBufTakeBytes(frame, len, buffer);
     
-    auto write_res = ::write(*m_fd, buffer, len);
+    struct iovec iov[MaxWriteIovecs];
+    std::size_t num_iov = 0;
+    
+    // With vnet_hdr, each frame is preceded by a virtio_net_hdr.
+    VirtioNetHdr vnet_hdr;
+    if (m_vnet_hdr) {
+        std::memset(&vnet_hdr, 0, sizeof(vnet_hdr));
+        
+        if (offload.csum_partial) {
+            vnet_hdr.flags = VirtioNetHdrFlagNeedsCsum;
+            vnet_hdr.csum_start = std::uint16_t(offload.csum_start);
+            vnet_hdr.csum_offset = std::uint16_t(offload.csum_offset);
+        }
+        
+        iov[num_iov].iov_base = &vnet_hdr;
+        iov[num_iov].iov_len = sizeof(vnet_hdr);
+        num_iov++;
+    }
+    
+    if (gso) {
+        AIPSTACK_ASSERT(offload.hdr_len <= MaxGsoHeaderLen);
+        AIPSTACK_ASSERT(offload.hdr_len < frame.tot_len);
+        AIPSTACK_ASSERT(offload.csum_start + offload.csum_offset + 2 <= offload.hdr_len);
+        
+        bool tcp = offload.gso_type == TapGsoType::Tcp4;
+        vnet_hdr.gso_type = tcp ? VirtioNetHdrGsoTcp4 : VirtioNetHdrGsoUdpL4;
+        vnet_hdr.gso_size = offload.gso_size;
+        vnet_hdr.hdr_len = std::uint16_t(offload.hdr_len);
+        
+        // Copy the header template, because the checksum field needs adjusting.
+        // The stack leaves the length out of the pseudo-header sum, while Linux
+        // expects it to include the TCP length of the whole super-segment or the
+        // UDP length as found in the UDP header (that of one datagram).
+        char *header = m_gso_header;
+        frame = ipBufTakeBytes(frame, offload.hdr_len, header);
+        
+        std::uint16_t l4_len;
+        if (tcp) {
+            l4_len = std::uint16_t(len - offload.csum_start);
+        } else {
+            l4_len = Udp4Header::get(header + offload.csum_start, Udp4Header::Length());
+        }
+        
+        char *csum_field = header + offload.csum_start + offload.csum_offset;
+        IpChksumAccumulator chksum{IpChksumAccumulator::State(
+            ReadSingleField<std::uint16_t>(csum_field))};
+        chksum.addWord(WrapType<std::uint16_t>(), l4_len);
+        WriteSingleField<std::uint16_t>(csum_field, chksum.getChksumInverted());
+        
+        iov[num_iov].iov_base = header;
+        iov[num_iov].iov_len = offload.hdr_len;
+        num_iov++;
+    }
+    
+    // Write the frame directly from the buffers if it does not consist of too
+    // many chunks, otherwise copy it into the write buffer.
+    std::size_t num_data_iov;
+    if (!ipBufToScatterGather(frame, iov + num_iov, MaxWriteIovecs - num_iov,
+        num_data_iov, makeTypedFunction(
+        [](struct iovec &entry, char *chunk_ptr, std::size_t chunk_len) {
+            entry.iov_base = chunk_ptr;
+            entry.iov_len = chunk_len;
+        })))
+    {
+        char *buffer = m_write_buffer.data();
+        std::size_t data_len = frame.tot_len;
+        ipBufTakeBytes(frame, data_len, buffer);
+        iov[num_iov].iov_base = buffer;
+        iov[num_iov].iov_len = data_len;
+        num_data_iov = 1;
+    }
+    num_iov += num_data_iov;
+    
+    if (m_vnet_hdr) {
+        len += sizeof(vnet_hdr);
+    }
+    
+    auto write_res = ::writev(*m_fd, iov, int(num_iov));
     if (write_res < 0) {
         int error = errno;
         if (AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(error)) {
@@ -139,50 +401,254 @@ AIpStack::IpErr TapDeviceLinux::sendFrame (AIpStack::IpBufRef frame)
     return AIpStack::IpErr::Success;
 }
 
-void TapDeviceLinux::handleFdEvents (AIpStack::EventLoopFdEvents events)
+bool TapDeviceLinux::parseReadFrame (
+    char *data, std::size_t len, AIpStack::IpBufNode &node, TapRxFrame &frame)
 {
-    AIPSTACK_ASSERT(m_active);
+    frame.chksum_verified = false;
     
-    do {
-        if ((events & AIpStack::EventLoopFdEvents::Error) != AIpStack::Enum0) {
-            std::fprintf(stderr, "TapDeviceLinux: Error event. Stopping.\n");
-            goto error;
+    if (m_vnet_hdr) {
+        if (len < sizeof(VirtioNetHdr)) {
+            return false;
         }
-        if ((events & AIpStack::EventLoopFdEvents::Hup) != AIpStack::Enum0) {
-            std::fprintf(stderr, "TapDeviceLinux: HUP event. Stopping.\n");
-            goto error;
+        
+        VirtioNetHdr vnet_hdr;
+        std::memcpy(&vnet_hdr, data, sizeof(vnet_hdr));
+        data += sizeof(vnet_hdr);
+        len -= sizeof(vnet_hdr);
+        
+        // Only TCP super-segments are enabled, which the stack receives as they
+        // are (the IP total length covers the entire super-segment). Drop any
+        // other kind of super-frame.
+        if (vnet_hdr.gso_type != VirtioNetHdrGsoNone &&
+            vnet_hdr.gso_type != VirtioNetHdrGsoTcp4)
+        {
+            return false;
         }
         
-        auto read_res = ::read(*m_fd, m_read_buffer.data(), m_frame_mtu);
-        if (read_res <= 0) {
-            bool is_error = false;
-            if (read_res < 0) {
-                int err = errno;
-                is_error = !AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err);
+        // A frame with a partial checksum originates from the local host and its
+        // checksum does not need to be verified (it could not be anyway).
+        frame.chksum_verified = (vnet_hdr.flags &
+            (VirtioNetHdrFlagNeedsCsum|VirtioNetHdrFlagDataValid)) != 0;
+    }
+    
+    node = AIpStack::IpBufNode{data, len, nullptr};
+    frame.frame = AIpStack::IpBufRef{&node, 0, len};
+    
+    return true;
+}
+
+void TapDeviceLinux::deliverReadFrame (char *data, std::size_t len)
+{
+    AIpStack::IpBufNode node;
+    TapRxFrame frame;
+    if (!parseReadFrame(data, len, node, frame)) {
+        return;
+    }
+    
+    if (m_batch_handler) {
+        m_batch_handler(&frame, 1);
+    } else {
+        m_rx_chksum_verified = frame.chksum_verified;
+        m_handler(frame.frame);
+    }
+}
+
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+
+void TapDeviceLinux::startRead ()
+{
+    struct io_uring_sqe &sqe = m_uring_notifier.getSqe();
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = *m_fd;
+    sqe.addr = std::uint64_t(reinterpret_cast<std::uintptr_t>(m_read_buffer->data()));
+    sqe.len = std::uint32_t(m_read_size);
+    sqe.off = std::uint64_t(-1);
+    
+    m_uring_polling = false;
+    m_uring_notifier.ioStarted(m_read_buffer);
+}
+
+void TapDeviceLinux::startPoll ()
+{
+    struct io_uring_sqe &sqe = m_uring_notifier.getSqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = *m_fd;
+    sqe.poll32_events = POLLIN;
+    
+    m_uring_polling = true;
+    m_uring_notifier.ioStarted(nullptr);
+}
+
+void TapDeviceLinux::handleUringCompleted (std::int32_t res)
+{
+    AIPSTACK_ASSERT(m_active);
+    
+    if (m_uring_polling) {
+        if (res < 0) {
+            return stopWithError("TapDeviceLinux: poll failed. Stopping.\n");
+        }
+        if ((std::uint32_t(res) & POLLERR) != 0) {
+            return stopWithError("TapDeviceLinux: Error event. Stopping.\n");
+        }
+        if ((std::uint32_t(res) & POLLHUP) != 0) {
+            return stopWithError("TapDeviceLinux: HUP event. Stopping.\n");
+        }
+        return startRead();
+    }
+    
+    if (res <= 0) {
+        // The file descriptor is non-blocking so the read may fail when there is
+        // no frame, then wait until there is one.
+        if (res == -EAGAIN || res == -EWOULDBLOCK) {
+            return startPoll();
+        }
+        return stopWithError("TapDeviceLinux: read failed. Stopping.\n");
+    }
+    
+    AIPSTACK_ASSERT(std::size_t(res) <= m_read_size);
+    
+    deliverReadFrame(m_read_buffer->data(), std::size_t(res));
+    
+    // Receive the next frame, the buffer is no longer used.
+    startRead();
+}
+
+void TapDeviceLinux::stopWithError (char const *msg)
+{
+    std::fprintf(stderr, "%s", msg);
+    m_uring_notifier.reset();
+    m_active = false;
+}
+
+#else
+
+void TapDeviceLinux::handleFdEvents (AIpStack::EventLoopFdEvents events)
+{
+    AIPSTACK_ASSERT(m_active);
+    
+    if ((events & AIpStack::EventLoopFdEvents::Error) != AIpStack::Enum0) {
+        return stopWithError("TapDeviceLinux: Error event. Stopping.\n");
+    }
+    if ((events & AIpStack::EventLoopFdEvents::Hup) != AIpStack::Enum0) {
+        return stopWithError("TapDeviceLinux: HUP event. Stopping.\n");
+    }
+    
+    if (m_rx_source != nullptr) {
+        // Stop monitoring the fd and let the scheduler poll for frames until the
+        // source returns to interrupt mode.
+        m_fd_watcher.updateEvents(AIpStack::EventLoopFdEvents());
+        m_rx_source->schedule();
+        return;
+    }
+    
+    receiveFrames(m_rx_budget);
+}
+
+std::size_t TapDeviceLinux::receiveFrames (std::size_t budget)
+{
+    std::size_t total = 0;
+    
+    if (!m_batch_handler) {
+        // Read and deliver frames one by one, using the single read buffer.
+        while (total < budget) {
+            auto read_res = ::read(*m_fd, m_read_buffer.data(), m_read_size);
+            if (read_res <= 0) {
+                if (read_res < 0 && !AIpStack::FileDescriptorWrapper::
+                    errIsEAGAINorEWOULDBLOCK(errno))
+                {
+                    stopWithError("TapDeviceLinux: read failed. Stopping.\n");
+                }
+                break;
             }
-            if (is_error) {
-                std::fprintf(stderr, "TapDeviceLinux: read failed. Stopping.\n");
-                goto error;
+            
+            AIPSTACK_ASSERT(std::size_t(read_res) <= m_read_size);
+            
+            total++;
+            deliverReadFrame(m_read_buffer.data(), std::size_t(read_res));
+        }
+    } else {
+        // Read frames into separate buffers until there are no more or the buffers
+        // are full, then deliver them all at once. This is repeated while the budget
+        // allows; if it is exhausted, remaining frames are read when the event loop
+        // reports the fd again or in the next poll.
+        while (total < budget) {
+            std::size_t max_frames = AIpStack::MinValue(budget - total, m_rx_budget);
+            std::size_t num_read = 0;
+            std::size_t num_frames = 0;
+            bool read_error = false;
+            
+            while (num_read < max_frames) {
+                char *buffer = m_read_buffer.data() + num_frames * m_read_size;
+                
+                auto read_res = ::read(*m_fd, buffer, m_read_size);
+                if (read_res <= 0) {
+                    read_error = read_res < 0 && !AIpStack::FileDescriptorWrapper::
+                        errIsEAGAINorEWOULDBLOCK(errno);
+                    break;
+                }
+                
+                AIPSTACK_ASSERT(std::size_t(read_res) <= m_read_size);
+                
+                num_read++;
+                if (parseReadFrame(buffer, std::size_t(read_res),
+                                   m_rx_nodes[num_frames], m_rx_frames[num_frames]))
+                {
+                    num_frames++;
+                }
+            }
+            
+            total += num_read;
+            
+            if (read_error) {
+                stopWithError("TapDeviceLinux: read failed. Stopping.\n");
+                break;
+            }
+            
+            if (num_frames > 0) {
+                m_batch_handler(m_rx_frames.data(), num_frames);
+            }
+            
+            if (num_read < max_frames) {
+                break;
             }
-            return;
         }
-        
-        AIPSTACK_ASSERT(std::size_t(read_res) <= m_frame_mtu);
-        
-        AIpStack::IpBufNode node{
-            m_read_buffer.data(),
-            std::size_t(read_res),
-            nullptr
-        };
-        
-        m_handler(AIpStack::IpBufRef{&node, 0, std::size_t(read_res)});
-    } while (false);
+    }
     
-    return;
+    return total;
+}
+
+std::size_t TapDeviceLinux::pollRxSource (std::size_t budget)
+{
+    if (!m_active) {
+        return 0;
+    }
     
-error:
+    return receiveFrames(budget);
+}
+
+void TapDeviceLinux::armRxSource ()
+{
+    if (m_active) {
+        m_fd_watcher.updateEvents(AIpStack::EventLoopFdEvents::Read);
+    }
+}
+
+void TapDeviceLinux::stopWithError (char const *msg)
+{
+    std::fprintf(stderr, "%s", msg);
     m_fd_watcher.reset();
     m_active = false;
 }
 
+void TapDeviceLinux::updateReadBuffers ()
+{
+    std::size_t num_buffers = m_batch_handler ? m_rx_budget : 1;
+    
+    m_read_buffer.resize(num_buffers * m_read_size);
+    m_rx_nodes.resize(num_buffers);
+    m_rx_frames.resize(num_buffers);
+}
+
+#endif
+
 }
@@ -26,6 +26,8 @@
 #define AIPSTACK_TAP_DEVICE_LINUX_H
 
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -35,34 +37,213 @@
 #include <aipstack/infra/Err.h>
 #include <aipstack/infra/Buf.h>
 #include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/event_loop/EventLoopRxScheduler.h>
 
 namespace AIpStack {
 
+/**
+ * Type of segmentation requested for a frame sent with offload
+ * (see @ref TapTxOffload).
+ */
+enum class TapGsoType : std::uint8_t {
+    /**
+     * Ordinary frame, no segmentation.
+     */
+    None,
+
+    /**
+     * TCP/IPv4 super-segment.
+     */
+    Tcp4,
+
+    /**
+     * UDP/IPv4 super-datagram.
+     */
+    Udp4,
+};
+
+/**
+ * Offload information for a frame sent through a TAP device opened with
+ * `vnet_hdr` (Linux only).
+ * 
+ * The fields correspond to what a driver obtains using
+ * @ref EthIpIface::getTxChksumPartial and @ref EthIpIface::getTxTso.
+ */
+struct TapTxOffload {
+    /**
+     * Whether the transport checksum must be completed by the kernel.
+     */
+    bool csum_partial = false;
+
+    /**
+     * Offset of the transport header relative to the start of the frame
+     * (if @ref csum_partial).
+     */
+    std::size_t csum_start = 0;
+
+    /**
+     * Offset of the checksum field relative to the transport header
+     * (if @ref csum_partial).
+     */
+    std::size_t csum_offset = 0;
+
+    /**
+     * Type of segmentation. If not @ref TapGsoType::None, @ref csum_partial
+     * must be set and the checksum field must contain the pseudo-header sum
+     * without the length, as described for @ref IpTxTsoInfo.
+     */
+    TapGsoType gso_type = TapGsoType::None;
+
+    /**
+     * Length of the header template including the Ethernet header
+     * (if segmenting).
+     */
+    std::size_t hdr_len = 0;
+
+    /**
+     * Number of data bytes in each segment (if segmenting).
+     */
+    std::uint16_t gso_size = 0;
+};
+
+/**
+ * A received frame delivered in a batch (Linux only).
+ */
+struct TapRxFrame {
+    /**
+     * Frame data, starting with the 14-byte Ethernet header.
+     */
+    AIpStack::IpBufRef frame;
+
+    /**
+     * Whether the TCP or UDP checksum does not need to be verified
+     * (see @ref TapDevice::getRxChksumVerified).
+     */
+    bool chksum_verified;
+};
+
 class TapDeviceLinux :
     private AIpStack::NonCopyable<TapDeviceLinux>
 {
 public:
     using FrameReceivedHandler = Function<void(AIpStack::IpBufRef frame)>;
 
+    using FrameBatchReceivedHandler =
+        Function<void(TapRxFrame const *frames, std::size_t count)>;
+
     TapDeviceLinux (AIpStack::EventLoop &loop, std::string const &device_id,
-                    FrameReceivedHandler handler);
+                    FrameReceivedHandler handler, bool multi_queue = false,
+                    bool vnet_hdr = false);
     
     ~TapDeviceLinux ();
     
     std::size_t getMtu () const;
 
+    std::string const & getDeviceName () const;
+
+    bool isMultiQueue () const;
+
+    void setQueueEnabled (bool enabled);
+
+    bool hasVnetHdr () const;
+
+    std::size_t getTsoMaxSize () const;
+
+    std::size_t getUsoMaxSize () const;
+
+    bool getRxChksumVerified () const;
+
+    void setRxBudget (std::size_t max_frames);
+
+    void setFrameBatchHandler (FrameBatchReceivedHandler handler);
+
+    void setRxScheduler (AIpStack::EventLoopRxScheduler *scheduler);
+
     AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame);
 
+    AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame, TapTxOffload const &offload);
+
 private:
+    // Maximum number of buffer chunks written directly with writev(),
+    // frames with more chunks are copied into m_write_buffer.
+    static constexpr std::size_t MaxWriteIovecs = 16;
+    
+    // Maximum IP packet size for segmentation offload with vnet_hdr.
+    static constexpr std::size_t GsoMaxSize = 65535;
+    
+    // Maximum header template length of super-segments: the Ethernet header and
+    // IPv4 and TCP headers with maximum options.
+    static constexpr std::size_t MaxGsoHeaderLen = 14 + 60 + 60;
+    
+    // Parse a frame read into a read buffer, which starts with the virtio_net_hdr
+    // if vnet_hdr is used. Returns false if the frame is to be dropped.
+    bool parseReadFrame (char *data, std::size_t len, AIpStack::IpBufNode &node,
+                         TapRxFrame &frame);
+    
+    // Deliver a single frame to the batch handler if set, else to the frame handler.
+    void deliverReadFrame (char *data, std::size_t len);
+    
+#if !AIPSTACK_EVENT_LOOP_HAS_URING
+    // Allocate the read buffers for the current budget and handler.
+    void updateReadBuffers ();
+#endif
+    
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+    // With io_uring, frames are received using read operations submitted to the
+    // event loop, falling back to a poll operation when no frame is available.
+    void startRead ();
+
+    void startPoll ();
+
+    void handleUringCompleted (std::int32_t res);
+
+    void stopWithError (char const *msg);
+#else
     void handleFdEvents (AIpStack::EventLoopFdEvents events);
 
+    // Read and deliver up to budget frames, returns the number read.
+    std::size_t receiveFrames (std::size_t budget);
+
+    std::size_t pollRxSource (std::size_t budget);
+
+    void armRxSource ();
+
+    void stopWithError (char const *msg);
+#endif
+
 private:
     FrameReceivedHandler m_handler;
+    FrameBatchReceivedHandler m_batch_handler;
     AIpStack::FileDescriptorWrapper m_fd;
+    std::string m_device_name;
+    bool m_multi_queue;
+    bool m_vnet_hdr;
+    bool m_uso_supported;
+    bool m_rx_chksum_verified;
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+    AIpStack::EventLoopUringNotifier m_uring_notifier;
+    bool m_uring_polling;
+#else
     AIpStack::EventLoopFdWatcher m_fd_watcher;
+#endif
     std::size_t m_frame_mtu;
+    std::size_t m_read_size;
+    std::size_t m_rx_budget;
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+    // Shared with any pending read operation which may outlive this object.
+    std::shared_ptr<std::vector<char>> m_read_buffer;
+#else
+    // With a batch handler, this holds m_rx_budget buffers of m_read_size bytes,
+    // otherwise just one.
     std::vector<char> m_read_buffer;
+    std::vector<AIpStack::IpBufNode> m_rx_nodes;
+    std::vector<TapRxFrame> m_rx_frames;
+    // If set, frames are read in polls of the scheduler, with the fd watcher not
+    // monitoring the fd while the source is in polling mode.
+    std::unique_ptr<AIpStack::EventLoopRxSource> m_rx_source;
+#endif
     std::vector<char> m_write_buffer;
+    char m_gso_header[MaxGsoHeaderLen];
     bool m_active;    
 };
 
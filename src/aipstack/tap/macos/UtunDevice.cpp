@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/kern_control.h>
+#include <sys/sys_domain.h>
+#include <net/if.h>
+#include <net/if_utun.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/TypedFunction.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/tap/macos/UtunDevice.h>
+
+namespace AIpStack {
+
+namespace {
+
+// Each packet is preceded by the protocol family in network byte order.
+constexpr std::size_t UtunHeaderSize = 4;
+
+constexpr std::size_t UtunMaxIpPacketSize = 0xFFFF;
+
+}
+
+UtunDevice::UtunDevice (
+    AIpStack::EventLoop &loop, PacketBatchReceivedHandler handler,
+    UtunDeviceParams const &params)
+:
+    m_handler(handler),
+    m_params(params),
+    m_active(true),
+    m_read_size(UtunHeaderSize + params.mtu),
+    m_read_buffer(params.rx_budget * m_read_size),
+    m_write_buffer(params.mtu),
+    m_rx_nodes(params.rx_budget),
+    m_rx_pkts(params.rx_budget),
+    m_fd_watcher(loop, AIPSTACK_BIND_MEMBER(&UtunDevice::handleFdEvents, this))
+{
+    AIPSTACK_ASSERT(handler);
+    AIPSTACK_ASSERT(params.unit >= -1);
+    AIPSTACK_ASSERT(params.mtu > 0 && params.mtu <= UtunMaxIpPacketSize);
+    AIPSTACK_ASSERT(params.rx_budget > 0);
+    
+    m_fd = AIpStack::FileDescriptorWrapper(
+        ::socket(PF_SYSTEM, SOCK_DGRAM, SYSPROTO_CONTROL));
+    if (!m_fd) {
+        throw std::runtime_error(formatString(
+            "UtunDevice: socket failed, err=%d", errno));
+    }
+    
+    if (::fcntl(*m_fd, F_SETFD, FD_CLOEXEC) < 0) {
+        throw std::runtime_error(formatString(
+            "UtunDevice: fcntl(F_SETFD) failed, err=%d", errno));
+    }
+    
+    struct ctl_info info = {};
+    std::strncpy(info.ctl_name, UTUN_CONTROL_NAME, sizeof(info.ctl_name) - 1);
+    if (::ioctl(*m_fd, CTLIOCGINFO, &info) < 0) {
+        throw std::runtime_error(formatString(
+            "UtunDevice: ioctl(CTLIOCGINFO) failed, err=%d", errno));
+    }
+    
+    // Unit zero means the first available unit, otherwise utun<N> is unit N+1.
+    struct sockaddr_ctl addr = {};
+    addr.sc_len = sizeof(addr);
+    addr.sc_family = AF_SYSTEM;
+    addr.ss_sysaddr = AF_SYS_CONTROL;
+    addr.sc_id = info.ctl_id;
+    addr.sc_unit = std::uint32_t(params.unit + 1);
+    if (::connect(*m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        throw std::runtime_error(formatString(
+            "UtunDevice: connect failed, err=%d", errno));
+    }
+    
+    char ifname[IFNAMSIZ] = {};
+    socklen_t ifname_len = sizeof(ifname);
+    if (::getsockopt(*m_fd, SYSPROTO_CONTROL, UTUN_OPT_IFNAME, ifname, &ifname_len) < 0) {
+        throw std::runtime_error(formatString(
+            "UtunDevice: getsockopt(UTUN_OPT_IFNAME) failed, err=%d", errno));
+    }
+    m_device_name = std::string(ifname, ::strnlen(ifname, sizeof(ifname)));
+    
+    // The MTU of the interface is set through an ordinary socket.
+    AIpStack::FileDescriptorWrapper ctl_fd(::socket(AF_INET, SOCK_DGRAM, 0));
+    if (!ctl_fd) {
+        throw std::runtime_error(formatString(
+            "UtunDevice: socket(AF_INET) failed, err=%d", errno));
+    }
+    
+    struct ifreq ifr = {};
+    std::strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+    ifr.ifr_mtu = int(params.mtu);
+    if (::ioctl(*ctl_fd, SIOCSIFMTU, &ifr) < 0) {
+        throw std::runtime_error(formatString(
+            "UtunDevice: ioctl(SIOCSIFMTU) failed, err=%d", errno));
+    }
+    
+    m_fd.setNonblocking();
+    
+    m_fd_watcher.initFd(*m_fd, AIpStack::EventLoopFdEvents::Read);
+}
+
+UtunDevice::~UtunDevice ()
+{}
+
+std::size_t UtunDevice::getMtu () const
+{
+    return m_params.mtu;
+}
+
+std::string const & UtunDevice::getDeviceName () const
+{
+    return m_device_name;
+}
+
+AIpStack::IpErr UtunDevice::sendPacket (AIpStack::IpBufRef pkt)
+{
+    if (!m_active || pkt.tot_len == 0) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    else if (pkt.tot_len > m_params.mtu) {
+        return AIpStack::IpErr::PacketTooLarge;
+    }
+    
+    std::size_t len = UtunHeaderSize + pkt.tot_len;
+    
+    std::uint32_t family = htonl(AF_INET);
+    
+    struct iovec iov[MaxWriteIovecs];
+    iov[0].iov_base = &family;
+    iov[0].iov_len = UtunHeaderSize;
+    
+    // Write the packet directly from the buffers if it does not consist of too
+    // many chunks, otherwise copy it into the write buffer.
+    std::size_t num_data_iov;
+    if (!ipBufToScatterGather(pkt, iov + 1, MaxWriteIovecs - 1,
+        num_data_iov, makeTypedFunction(
+        [](struct iovec &entry, char *chunk_ptr, std::size_t chunk_len) {
+            entry.iov_base = chunk_ptr;
+            entry.iov_len = chunk_len;
+        })))
+    {
+        char *buffer = m_write_buffer.data();
+        std::size_t data_len = pkt.tot_len;
+        ipBufTakeBytes(pkt, data_len, buffer);
+        iov[1].iov_base = buffer;
+        iov[1].iov_len = data_len;
+        num_data_iov = 1;
+    }
+    
+    auto write_res = ::writev(*m_fd, iov, int(1 + num_data_iov));
+    if (write_res < 0) {
+        int error = errno;
+        if (AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(error) ||
+            error == ENOBUFS)
+        {
+            return AIpStack::IpErr::OutputBufferFull;
+        }
+        return AIpStack::IpErr::HardwareError;
+    }
+    if (std::size_t(write_res) != len) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    
+    return AIpStack::IpErr::Success;
+}
+
+void UtunDevice::handleFdEvents (AIpStack::EventLoopFdEvents events)
+{
+    AIPSTACK_ASSERT(m_active);
+    
+    if ((events & AIpStack::EventLoopFdEvents::Error) != AIpStack::Enum0) {
+        std::fprintf(stderr, "UtunDevice: Error event. Stopping.\n");
+        goto error;
+    }
+    if ((events & AIpStack::EventLoopFdEvents::Hup) != AIpStack::Enum0) {
+        std::fprintf(stderr, "UtunDevice: HUP event. Stopping.\n");
+        goto error;
+    }
+    
+    {
+        // Read packets into separate buffers until there are no more or the
+        // budget is exhausted, then deliver them all at once. If the budget is
+        // exhausted, remaining packets are read when the event loop reports the
+        // fd again.
+        std::size_t count = 0;
+        bool read_error = false;
+        
+        for (std::size_t i = 0; i < m_params.rx_budget; i++) {
+            char *buffer = m_read_buffer.data() + count * m_read_size;
+            
+            auto read_res = ::read(*m_fd, buffer, m_read_size);
+            if (read_res <= 0) {
+                read_error = read_res < 0 && !AIpStack::FileDescriptorWrapper::
+                    errIsEAGAINorEWOULDBLOCK(errno);
+                break;
+            }
+            
+            std::size_t len = std::size_t(read_res);
+            AIPSTACK_ASSERT(len <= m_read_size);
+            
+            std::uint32_t family;
+            if (len <= UtunHeaderSize) {
+                continue;
+            }
+            std::memcpy(&family, buffer, sizeof(family));
+            if (ntohl(family) != AF_INET) {
+                continue;
+            }
+            
+            std::size_t pkt_len = len - UtunHeaderSize;
+            m_rx_nodes[count] = AIpStack::IpBufNode{
+                buffer + UtunHeaderSize, pkt_len, nullptr};
+            m_rx_pkts[count].buf = AIpStack::IpBufRef{&m_rx_nodes[count], 0, pkt_len};
+            count++;
+        }
+        
+        if (read_error) {
+            std::fprintf(stderr, "UtunDevice: read failed. Stopping.\n");
+            goto error;
+        }
+        
+        if (count > 0) {
+            m_handler(m_rx_pkts.data(), count);
+        }
+    }
+    
+    return;
+    
+error:
+    m_fd_watcher.reset();
+    m_active = false;
+}
+
+}
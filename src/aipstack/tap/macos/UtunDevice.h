@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_UTUN_DEVICE_H
+#define AIPSTACK_UTUN_DEVICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/event_loop/EventLoop.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup tap
+ * @{
+ */
+
+/**
+ * Configuration parameters for @ref UtunDevice.
+ */
+struct UtunDeviceParams {
+    /**
+     * Unit number of the interface (`utun<unit>`), or -1 to use the first
+     * available unit.
+     */
+    int unit = -1;
+
+    /**
+     * IP MTU, which is also configured for the interface. It must not exceed
+     * 65535.
+     */
+    std::size_t mtu = 1500;
+
+    /**
+     * Maximum number of packets delivered in one batch, and read for one event
+     * of the event loop, for fairness with respect to other event sources.
+     */
+    std::size_t rx_budget = 64;
+};
+
+/**
+ * Provides access to a utun virtual layer-3 device (macOS only).
+ * 
+ * A utun interface is created by connecting a kernel control socket, and
+ * exchanges IP packets with the network stack of the system through that
+ * socket, each preceded by a 4-byte protocol family header. The interface is
+ * removed when the device is destructed. Creating it requires root
+ * privileges; addresses and routes are configured externally (e.g. with
+ * `ifconfig`).
+ * 
+ * It is to be used with an @ref IpDriverIface: received packets are passed to a
+ * @ref PacketBatchReceivedHandler, which would pass them to @ref
+ * IpDriverIface::recvIp4Packets, and packets are sent by @ref sendPacket,
+ * which would be called from @ref IpIfaceDriverParams::send_ip4_packet. The
+ * socket is watched using @ref EventLoopFdWatcher, which with the kqueue based
+ * event provider costs no additional system calls. Packets other than IPv4
+ * packets are dropped.
+ */
+class UtunDevice :
+    private AIpStack::NonCopyable<UtunDevice>
+{
+public:
+    /**
+     * Type of callback used to deliver a batch of received packets.
+     * 
+     * @param pkts Array of received packets, suitable for @ref
+     *        IpDriverIface::recvIp4Packets. The array and the referenced buffers
+     *        must not be used outside of the callback function.
+     * @param count Number of packets in the array (positive and not greater than
+     *        @ref UtunDeviceParams::rx_budget).
+     */
+    using PacketBatchReceivedHandler =
+        Function<void(AIpStack::IpRxBatchEntry const *pkts, std::size_t count)>;
+
+    /**
+     * Constructor, creates the interface.
+     * 
+     * @param loop Event loop; it must outlive the UtunDevice object.
+     * @param handler Callback function used to deliver received packets (must
+     *        not be null).
+     * @param params Configuration parameters.
+     * @throw std::runtime_error If creating or configuring the interface fails.
+     */
+    UtunDevice (AIpStack::EventLoop &loop, PacketBatchReceivedHandler handler,
+                UtunDeviceParams const &params = UtunDeviceParams());
+
+    /**
+     * Destructor, removes the interface.
+     */
+    ~UtunDevice ();
+
+    /**
+     * Get the IP MTU.
+     * 
+     * @return The MTU from @ref UtunDeviceParams::mtu.
+     */
+    std::size_t getMtu () const;
+
+    /**
+     * Get the name of the interface (e.g. `utun3`).
+     * 
+     * @return Interface name.
+     */
+    std::string const & getDeviceName () const;
+
+    /**
+     * Send an IPv4 packet through the interface.
+     * 
+     * @param pkt Packet data (referenced using @ref IpBufRef), starting with the
+     *        IP header.
+     * @return Success or error code (@ref IpErr::OutputBufferFull if the socket
+     *         buffer is full).
+     */
+    AIpStack::IpErr sendPacket (AIpStack::IpBufRef pkt);
+
+private:
+    // Maximum number of buffer chunks written directly with writev(),
+    // packets with more chunks are copied into m_write_buffer.
+    static constexpr std::size_t MaxWriteIovecs = 16;
+
+    void handleFdEvents (AIpStack::EventLoopFdEvents events);
+
+private:
+    PacketBatchReceivedHandler m_handler;
+    UtunDeviceParams m_params;
+    std::string m_device_name;
+    bool m_active;
+    std::size_t m_read_size;
+    std::vector<char> m_read_buffer;
+    std::vector<char> m_write_buffer;
+    std::vector<AIpStack::IpBufNode> m_rx_nodes;
+    std::vector<AIpStack::IpRxBatchEntry> m_rx_pkts;
+    // First fd then watcher for proper destruction order.
+    AIpStack::FileDescriptorWrapper m_fd;
+    AIpStack::EventLoopFdWatcher m_fd_watcher;
+};
+
+/** @} */
+
+}
+
+#endif
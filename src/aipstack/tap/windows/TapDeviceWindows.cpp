@@ -40,9 +40,13 @@
 
 namespace AIpStack {
 
-TapDeviceWindows::IoUnit::IoUnit (EventLoop &loop, TapDeviceWindows &parent) :
+TapDeviceWindows::IoUnit::IoUnit (
+    EventLoop &loop, TapDeviceWindows &parent, bool is_recv, std::size_t index)
+:
     m_iocp_notifier(loop, AIPSTACK_BIND_MEMBER(&IoUnit::iocpNotifierHandler, this)),
-    m_parent(parent)
+    m_parent(parent),
+    m_is_recv(is_recv),
+    m_index(index)
 {}
 
 void TapDeviceWindows::IoUnit::init (
@@ -59,29 +63,40 @@ void TapDeviceWindows::IoUnit::init (
     m_resource = std::move(resource);    
 }
 
-void TapDeviceWindows::IoUnit::ioStarted ()
+void TapDeviceWindows::IoUnit::ioStarted (bool completed)
 {
-    m_iocp_notifier.ioStarted(std::static_pointer_cast<void>(m_resource));
+    if (completed) {
+        m_iocp_notifier.ioCompletedSynchronously();
+    } else {
+        m_iocp_notifier.ioStarted(std::static_pointer_cast<void>(m_resource));
+    }
 }
 
 void TapDeviceWindows::IoUnit::iocpNotifierHandler ()
 {
-    if (this == &m_parent.m_recv_unit) {
-        return m_parent.recvCompleted(*this);
+    if (m_is_recv) {
+        return m_parent.recvCompleted();
     } else {
         return m_parent.sendCompleted(*this);
     }
 }
 
 TapDeviceWindows::TapDeviceWindows (
-    EventLoop &loop, std::string const &device_id, FrameReceivedHandler handler)
+    EventLoop &loop, std::string const &device_id, FrameReceivedHandler handler,
+    std::size_t num_reads, std::size_t num_writes)
 :
     m_handler(handler),
     m_send_first(0),
     m_send_count(0),
-    m_send_units(ResourceArrayInitSame(), std::ref(loop), std::ref(*this)),
-    m_recv_unit(loop, *this)
+    m_recv_first(0),
+    m_recv_failed(false)
 {
+    AIPSTACK_ASSERT(num_reads > 0);
+    AIPSTACK_ASSERT(num_writes > 0);
+    
+    createUnits(m_send_units, num_writes, loop, *this, false);
+    createUnits(m_recv_units, num_reads, loop, *this, true);
+    
     std::string component_id;
     std::string device_name;
     if (!tapwin_parse_tap_spec(device_id, component_id, device_name)) {
@@ -118,19 +133,37 @@ TapDeviceWindows::TapDeviceWindows (
         throw std::runtime_error("TAP_IOCTL_SET_MEDIA_STATUS failed.");
     }
     
-    for (IoUnit &send_unit : m_send_units) {
-        send_unit.init(m_device, m_frame_mtu);
+    for (auto &send_unit : m_send_units) {
+        send_unit->init(m_device, m_frame_mtu);
     }
 
-    m_recv_unit.init(m_device, m_frame_mtu);
+    for (auto &recv_unit : m_recv_units) {
+        recv_unit->init(m_device, m_frame_mtu);
+    }
     
+    // Reads and writes often complete synchronously when frames are already
+    // queued in the driver; skip the completion packets for those.
     DWORD add_error;
-    if (!loop.addHandleToIocp(**m_device, add_error)) {
+    if (!loop.addHandleToIocp(**m_device, add_error, /*skip_on_success=*/true)) {
         throw std::runtime_error("CreateIoCompletionPort failed.");
     }
     
-    if (!startRecv()) {
-        throw std::runtime_error("Failed to start receive operation.");
+    // Keep multiple reads pending so that the driver can complete further reads
+    // while we are processing a frame, instead of each frame needing a full round
+    // trip through the IOCP before the next read is started.
+    for (auto &recv_unit : m_recv_units) {
+        if (!startRecv(*recv_unit)) {
+            throw std::runtime_error("Failed to start receive operation.");
+        }
+    }
+}
+
+void TapDeviceWindows::createUnits (std::vector<std::unique_ptr<IoUnit>> &units,
+    std::size_t count, EventLoop &loop, TapDeviceWindows &parent, bool is_recv)
+{
+    units.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        units.push_back(std::make_unique<IoUnit>(loop, parent, is_recv, i));
     }
 }
 
@@ -151,14 +184,16 @@ IpErr TapDeviceWindows::sendFrame (IpBufRef frame)
         return IpErr::PacketTooLarge;
     }
     
-    if (m_send_count >= NumSendUnits) {
+    std::size_t num_units = m_send_units.size();
+    
+    if (m_send_count >= num_units) {
         //std::fprintf(stderr, "TAP send: out of buffers\n");
         return IpErr::OutputBufferFull;
     }
     
-    std::size_t unit_index = Modulo(NumSendUnits).add(m_send_first, m_send_count);
+    std::size_t unit_index = Modulo(num_units).add(m_send_first, m_send_count);
     
-    IoUnit &send_unit = m_send_units[unit_index];
+    IoUnit &send_unit = *m_send_units[unit_index];
     AIPSTACK_ASSERT(!send_unit.m_iocp_notifier.isBusy());
     
     char *buffer = send_unit.m_resource->buffer.data();
@@ -177,15 +212,14 @@ IpErr TapDeviceWindows::sendFrame (IpBufRef frame)
         return IpErr::HardwareError;
     }
     
-    send_unit.ioStarted();
+    send_unit.ioStarted(/*completed=*/res);
     m_send_count++;
     
     return IpErr::Success;
 }
 
-bool TapDeviceWindows::startRecv ()
+bool TapDeviceWindows::startRecv (IoUnit &recv_unit)
 {
-    IoUnit &recv_unit = m_recv_unit;
     AIPSTACK_ASSERT(!recv_unit.m_iocp_notifier.isBusy());
     
     char *buffer = recv_unit.m_resource->buffer.data();
@@ -201,16 +235,18 @@ bool TapDeviceWindows::startRecv ()
         return false;
     }
     
-    recv_unit.ioStarted();
+    recv_unit.ioStarted(/*completed=*/res);
     
     return true;
 }
 
 void TapDeviceWindows::sendCompleted (IoUnit &send_unit)
 {
-    std::size_t index = &send_unit - &m_send_units[0];
-    AIPSTACK_ASSERT(index >= 0 && index < NumSendUnits);
-    AIPSTACK_ASSERT(Modulo(NumSendUnits).sub(index, m_send_first) < m_send_count);
+    std::size_t num_units = m_send_units.size();
+    
+    std::size_t index = send_unit.m_index;
+    AIPSTACK_ASSERT(index < num_units);
+    AIPSTACK_ASSERT(Modulo(num_units).sub(index, m_send_first) < m_send_count);
     
     OVERLAPPED &olap = send_unit.m_iocp_notifier.getOverlapped();
     
@@ -223,34 +259,48 @@ void TapDeviceWindows::sendCompleted (IoUnit &send_unit)
         AIPSTACK_ASSERT(bytes <= m_frame_mtu);
     }
     
-    while (m_send_count > 0 && !m_send_units[m_send_first].m_iocp_notifier.isBusy()) {
-        m_send_first = Modulo(NumSendUnits).inc(m_send_first);
+    while (m_send_count > 0 && !m_send_units[m_send_first]->m_iocp_notifier.isBusy()) {
+        m_send_first = Modulo(num_units).inc(m_send_first);
         m_send_count--;
     }
 }
 
-void TapDeviceWindows::recvCompleted (IoUnit &recv_unit)
+void TapDeviceWindows::recvCompleted ()
 {
-    AIPSTACK_ASSERT(&recv_unit == &m_recv_unit);
+    // Reads may complete out of order, so deliver frames in the order in which
+    // the reads were started, each read being restarted after its frame has
+    // been delivered.
+    while (!m_recv_failed) {
+        IoUnit &recv_unit = *m_recv_units[m_recv_first];
+        if (recv_unit.m_iocp_notifier.isBusy()) {
+            break;
+        }
+        
+        OVERLAPPED &olap = recv_unit.m_iocp_notifier.getOverlapped();
+        
+        DWORD bytes;
+        if (!::GetOverlappedResult(**m_device, &olap, &bytes, false)) {
+            std::fprintf(stderr, "TAP ReadFile async failed (err=%u)!\n",
+                (unsigned int)::GetLastError());
+            m_recv_failed = true;
+            return;
+        }
+        
+        AIPSTACK_ASSERT(bytes <= m_frame_mtu);
 
-    OVERLAPPED &olap = recv_unit.m_iocp_notifier.getOverlapped();
-    
-    DWORD bytes;
-    if (!::GetOverlappedResult(**m_device, &olap, &bytes, false)) {
-        std::fprintf(stderr, "TAP ReadFile async failed (err=%u)!\n",
-            (unsigned int)::GetLastError());
-        return;
+        char *buffer = recv_unit.m_resource->buffer.data();
+        
+        IpBufNode node{buffer, (std::size_t)bytes, nullptr};
+        
+        m_handler(IpBufRef{&node, 0, (std::size_t)bytes});
+        
+        if (!startRecv(recv_unit)) {
+            m_recv_failed = true;
+            return;
+        }
+        
+        m_recv_first = Modulo(m_recv_units.size()).inc(m_recv_first);
     }
-    
-    AIPSTACK_ASSERT(bytes <= m_frame_mtu);
-
-    char *buffer = recv_unit.m_resource->buffer.data();
-    
-    IpBufNode node{buffer, (std::size_t)bytes, nullptr};
-    
-    m_handler(IpBufRef{&node, 0, (std::size_t)bytes});
-    
-    startRecv();
 }
 
 }
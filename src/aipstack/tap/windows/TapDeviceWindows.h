@@ -29,12 +29,10 @@
 #include <string>
 #include <memory>
 #include <vector>
-#include <functional>
 
 #include <aipstack/misc/NonCopyable.h>
 #include <aipstack/misc/Function.h>
 #include <aipstack/misc/platform_specific/WinHandleWrapper.h>
-#include <aipstack/misc/ResourceArray.h>
 #include <aipstack/infra/Err.h>
 #include <aipstack/infra/Buf.h>
 #include <aipstack/event_loop/EventLoop.h>
@@ -44,32 +42,40 @@ namespace AIpStack {
 class TapDeviceWindows :
     private NonCopyable<TapDeviceWindows>
 {
-    inline static constexpr std::size_t NumSendUnits = 16;
-    
     struct IoResource {
         std::shared_ptr<WinHandleWrapper> device;
         std::vector<char> buffer;
     };
 
     struct IoUnit {
-        IoUnit (EventLoop &loop, TapDeviceWindows &parent);
+        IoUnit (EventLoop &loop, TapDeviceWindows &parent, bool is_recv,
+                std::size_t index);
 
         void init (std::shared_ptr<WinHandleWrapper> device, std::size_t buffer_size);
 
-        void ioStarted ();
+        // Called after starting an operation; completed means that it completed
+        // synchronously and no completion packet will be queued.
+        void ioStarted (bool completed);
         
         void iocpNotifierHandler ();
 
         EventLoopIocpNotifier m_iocp_notifier;
         TapDeviceWindows &m_parent;
+        bool m_is_recv;
+        std::size_t m_index;
         std::shared_ptr<IoResource> m_resource;
     };
     
 public:
+    inline static constexpr std::size_t DefaultNumReads = 8;
+    inline static constexpr std::size_t DefaultNumWrites = 16;
+    
     using FrameReceivedHandler = Function<void(AIpStack::IpBufRef frame)>;
     
     TapDeviceWindows (EventLoop &loop, std::string const &device_id,
-                      FrameReceivedHandler handler);
+                      FrameReceivedHandler handler,
+                      std::size_t num_reads = DefaultNumReads,
+                      std::size_t num_writes = DefaultNumWrites);
 
     ~TapDeviceWindows ();
     
@@ -80,9 +86,11 @@ public:
     IpErr sendFrame (IpBufRef frame);
     
 private:
-    bool startRecv ();
+    static void createUnits (std::vector<std::unique_ptr<IoUnit>> &units,
+        std::size_t count, EventLoop &loop, TapDeviceWindows &parent, bool is_recv);
+    bool startRecv (IoUnit &recv_unit);
     void sendCompleted (IoUnit &send_unit);
-    void recvCompleted (IoUnit &recv_unit);
+    void recvCompleted ();
     
 private:
     FrameReceivedHandler m_handler;
@@ -90,8 +98,10 @@ private:
     std::size_t m_frame_mtu;
     std::size_t m_send_first;
     std::size_t m_send_count;
-    ResourceArray<IoUnit, NumSendUnits> m_send_units;
-    IoUnit m_recv_unit;    
+    std::size_t m_recv_first;
+    bool m_recv_failed;
+    std::vector<std::unique_ptr<IoUnit>> m_send_units;
+    std::vector<std::unique_ptr<IoUnit>> m_recv_units;
 };
 
 }
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <windows.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/tap/windows/WintunDevice.h>
+
+namespace AIpStack {
+
+namespace {
+
+// Types of the functions of the Wintun library which are used (see wintun.h
+// in the Wintun distribution). Handles of adapters and sessions are opaque
+// pointers.
+using WintunCreateAdapterFunc = void * (WINAPI *) (
+    WCHAR const *name, WCHAR const *tunnel_type, GUID const *requested_guid);
+using WintunOpenAdapterFunc = void * (WINAPI *) (WCHAR const *name);
+using WintunCloseAdapterFunc = void (WINAPI *) (void *adapter);
+using WintunStartSessionFunc = void * (WINAPI *) (void *adapter, DWORD capacity);
+using WintunEndSessionFunc = void (WINAPI *) (void *session);
+using WintunGetReadWaitEventFunc = HANDLE (WINAPI *) (void *session);
+using WintunReceivePacketFunc = BYTE * (WINAPI *) (void *session, DWORD *packet_size);
+using WintunReleaseReceivePacketFunc = void (WINAPI *) (void *session, BYTE const *packet);
+using WintunAllocateSendPacketFunc = BYTE * (WINAPI *) (void *session, DWORD packet_size);
+using WintunSendPacketFunc = void (WINAPI *) (void *session, BYTE const *packet);
+
+constexpr std::uint32_t WintunMinRingCapacity = std::uint32_t(1) << 17;
+constexpr std::uint32_t WintunMaxRingCapacity = std::uint32_t(1) << 26;
+constexpr std::size_t WintunMaxIpPacketSize = 0xFFFF;
+
+template<typename FuncType>
+void load_function (HMODULE library, char const *name, FuncType &out_func)
+{
+    FARPROC proc = ::GetProcAddress(library, name);
+    if (proc == nullptr) {
+        throw std::runtime_error(
+            std::string("WintunDevice: Function missing in wintun.dll: ") + name);
+    }
+    out_func = reinterpret_cast<FuncType>(reinterpret_cast<void (*) ()>(proc));
+}
+
+std::wstring utf8_to_wide (std::string const &str)
+{
+    if (str.empty()) {
+        return std::wstring();
+    }
+    
+    int len = ::MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
+        str.data(), int(str.size()), nullptr, 0);
+    if (len <= 0) {
+        throw std::runtime_error("WintunDevice: Invalid adapter name.");
+    }
+    
+    std::wstring wstr(std::size_t(len), L'\0');
+    ::MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
+        str.data(), int(str.size()), &wstr[0], len);
+    return wstr;
+}
+
+}
+
+struct WintunDevice::WintunApi {
+    WintunCreateAdapterFunc CreateAdapter;
+    WintunOpenAdapterFunc OpenAdapter;
+    WintunCloseAdapterFunc CloseAdapter;
+    WintunStartSessionFunc StartSession;
+    WintunEndSessionFunc EndSession;
+    WintunGetReadWaitEventFunc GetReadWaitEvent;
+    WintunReceivePacketFunc ReceivePacket;
+    WintunReleaseReceivePacketFunc ReleaseReceivePacket;
+    WintunAllocateSendPacketFunc AllocateSendPacket;
+    WintunSendPacketFunc SendPacket;
+};
+
+WintunDevice::WintunDevice (
+    AIpStack::EventLoop &loop, std::string const &adapter_name,
+    PacketBatchReceivedHandler handler, WintunDeviceParams const &params)
+:
+    m_handler(handler),
+    m_params(params),
+    m_api(std::make_unique<WintunApi>()),
+    m_library(nullptr),
+    m_adapter(nullptr),
+    m_session(nullptr),
+    m_read_event(nullptr),
+    m_wait_handle(nullptr),
+    m_recv_failed(false),
+    m_rx_nodes(params.rx_budget),
+    m_rx_pkts(params.rx_budget),
+    m_rx_bufs(params.rx_budget),
+    m_read_signal(loop, AIPSTACK_BIND_MEMBER(&WintunDevice::readEventSignaled, this)),
+    m_read_deferred(loop, AIPSTACK_BIND_MEMBER(&WintunDevice::readEventSignaled, this)),
+    m_busy_poller(loop, AIPSTACK_BIND_MEMBER(&WintunDevice::receivePackets, this))
+{
+    AIPSTACK_ASSERT(handler);
+    AIPSTACK_ASSERT(params.ring_capacity >= WintunMinRingCapacity);
+    AIPSTACK_ASSERT(params.ring_capacity <= WintunMaxRingCapacity);
+    AIPSTACK_ASSERT((params.ring_capacity & (params.ring_capacity - 1)) == 0);
+    AIPSTACK_ASSERT(params.mtu > 0 && params.mtu <= WintunMaxIpPacketSize);
+    AIPSTACK_ASSERT(params.rx_budget > 0);
+    
+    try {
+        std::wstring name = utf8_to_wide(adapter_name);
+        
+        // Only search the application and system directories, as recommended
+        // for loading wintun.dll.
+        m_library = ::LoadLibraryExW(L"wintun.dll", nullptr,
+            LOAD_LIBRARY_SEARCH_APPLICATION_DIR|LOAD_LIBRARY_SEARCH_SYSTEM32);
+        if (m_library == nullptr) {
+            throw std::runtime_error("WintunDevice: Failed to load wintun.dll.");
+        }
+        
+        load_function(m_library, "WintunCreateAdapter", m_api->CreateAdapter);
+        load_function(m_library, "WintunOpenAdapter", m_api->OpenAdapter);
+        load_function(m_library, "WintunCloseAdapter", m_api->CloseAdapter);
+        load_function(m_library, "WintunStartSession", m_api->StartSession);
+        load_function(m_library, "WintunEndSession", m_api->EndSession);
+        load_function(m_library, "WintunGetReadWaitEvent", m_api->GetReadWaitEvent);
+        load_function(m_library, "WintunReceivePacket", m_api->ReceivePacket);
+        load_function(m_library, "WintunReleaseReceivePacket",
+                      m_api->ReleaseReceivePacket);
+        load_function(m_library, "WintunAllocateSendPacket", m_api->AllocateSendPacket);
+        load_function(m_library, "WintunSendPacket", m_api->SendPacket);
+        
+        m_adapter = m_api->OpenAdapter(name.c_str());
+        if (m_adapter == nullptr && params.create_adapter) {
+            m_adapter = m_api->CreateAdapter(name.c_str(), L"AIpStack", nullptr);
+        }
+        if (m_adapter == nullptr) {
+            throw std::runtime_error("WintunDevice: Failed to open adapter.");
+        }
+        
+        m_session = m_api->StartSession(m_adapter, params.ring_capacity);
+        if (m_session == nullptr) {
+            throw std::runtime_error("WintunDevice: WintunStartSession failed.");
+        }
+        
+        // The event belongs to the session and must not be closed.
+        m_read_event = m_api->GetReadWaitEvent(m_session);
+        
+        // The wait callback only wakes up the event loop, so it can run in the
+        // wait thread. The event is an auto-reset event so the wait is not
+        // satisfied again until the driver signals it again.
+        if (!::RegisterWaitForSingleObject(&m_wait_handle, m_read_event,
+                &WintunDevice::waitCallback, this, INFINITE, WT_EXECUTEINWAITTHREAD))
+        {
+            m_wait_handle = nullptr;
+            throw std::runtime_error(
+                "WintunDevice: RegisterWaitForSingleObject failed.");
+        }
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+    
+    // Packets may have been queued before the wait was registered.
+    m_read_deferred.schedule();
+}
+
+WintunDevice::~WintunDevice ()
+{
+    release();
+}
+
+std::size_t WintunDevice::getMtu () const
+{
+    return m_params.mtu;
+}
+
+AIpStack::IpErr WintunDevice::sendPacket (AIpStack::IpBufRef pkt)
+{
+    if (pkt.tot_len == 0) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    else if (pkt.tot_len > m_params.mtu) {
+        return AIpStack::IpErr::PacketTooLarge;
+    }
+    
+    BYTE *buffer = m_api->AllocateSendPacket(m_session, DWORD(pkt.tot_len));
+    if (buffer == nullptr) {
+        DWORD error = ::GetLastError();
+        if (error == ERROR_BUFFER_OVERFLOW) {
+            return AIpStack::IpErr::OutputBufferFull;
+        }
+        std::fprintf(stderr, "WintunDevice: WintunAllocateSendPacket failed (err=%u)!\n",
+            (unsigned int)error);
+        return AIpStack::IpErr::HardwareError;
+    }
+    
+    AIpStack::ipBufTakeBytes(pkt, pkt.tot_len, reinterpret_cast<char *>(buffer));
+    
+    m_api->SendPacket(m_session, buffer);
+    
+    return AIpStack::IpErr::Success;
+}
+
+void CALLBACK WintunDevice::waitCallback (void *arg, BOOLEAN)
+{
+    // Called from a thread-pool thread, EventLoopAsyncSignal::signal is
+    // thread-safe.
+    static_cast<WintunDevice *>(arg)->m_read_signal.signal();
+}
+
+void WintunDevice::readEventSignaled ()
+{
+    receivePackets();
+}
+
+bool WintunDevice::receivePackets ()
+{
+    if (m_recv_failed) {
+        return false;
+    }
+    
+    // Take packets from the receive ring until it is empty or the budget is
+    // exhausted, then deliver them all at once and release them.
+    std::size_t count = 0;
+    while (count < m_params.rx_budget) {
+        DWORD size;
+        BYTE *packet = m_api->ReceivePacket(m_session, &size);
+        if (packet == nullptr) {
+            DWORD error = ::GetLastError();
+            if (error != ERROR_NO_MORE_ITEMS) {
+                std::fprintf(stderr,
+                    "WintunDevice: WintunReceivePacket failed (err=%u). Stopping.\n",
+                    (unsigned int)error);
+                m_recv_failed = true;
+            }
+            break;
+        }
+        
+        m_rx_bufs[count] = packet;
+        m_rx_nodes[count] = AIpStack::IpBufNode{
+            reinterpret_cast<char *>(packet), std::size_t(size), nullptr};
+        m_rx_pkts[count].buf = AIpStack::IpBufRef{&m_rx_nodes[count], 0, std::size_t(size)};
+        count++;
+    }
+    
+    if (count > 0) {
+        m_handler(m_rx_pkts.data(), count);
+        
+        for (std::size_t i = 0; i < count; i++) {
+            m_api->ReleaseReceivePacket(m_session, m_rx_bufs[i]);
+        }
+    }
+    
+    // If the budget was exhausted there may be more packets, for which the
+    // driver does not signal the event, so continue after other events.
+    if (count == m_params.rx_budget && !m_recv_failed) {
+        m_read_deferred.schedule();
+    }
+    
+    return count > 0;
+}
+
+void WintunDevice::release ()
+{
+    // Wait for any running wait callback to complete before the async-signal
+    // could be destructed.
+    if (m_wait_handle != nullptr) {
+        if (!::UnregisterWaitEx(m_wait_handle, INVALID_HANDLE_VALUE)) {
+            std::fprintf(stderr, "WintunDevice: UnregisterWaitEx failed (err=%u)!\n",
+                (unsigned int)::GetLastError());
+        }
+        m_wait_handle = nullptr;
+    }
+    
+    if (m_session != nullptr) {
+        m_api->EndSession(m_session);
+        m_session = nullptr;
+    }
+    
+    if (m_adapter != nullptr) {
+        m_api->CloseAdapter(m_adapter);
+        m_adapter = nullptr;
+    }
+    
+    if (m_library != nullptr) {
+        ::FreeLibrary(m_library);
+        m_library = nullptr;
+    }
+}
+
+}
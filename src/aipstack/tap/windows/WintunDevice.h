@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_WINTUN_DEVICE_H
+#define AIPSTACK_WINTUN_DEVICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/event_loop/EventLoop.h>
+
+namespace AIpStack {
+
+/**
+ * @addtogroup tap
+ * @{
+ */
+
+/**
+ * Configuration parameters for @ref WintunDevice.
+ */
+struct WintunDeviceParams {
+    /**
+     * Capacity of each of the rings shared with the driver in bytes, must be a
+     * power of two between 128 KiB and 64 MiB.
+     */
+    std::uint32_t ring_capacity = std::uint32_t(1) << 22;
+
+    /**
+     * IP MTU, which should be the MTU of the adapter as configured in Windows.
+     * It must not exceed 65535.
+     */
+    std::size_t mtu = 1500;
+
+    /**
+     * Maximum number of packets delivered in one batch, and processed for one
+     * event of the event loop, for fairness with respect to other event
+     * sources.
+     */
+    std::size_t rx_budget = 64;
+
+    /**
+     * Whether to create the adapter if no adapter with the given name exists.
+     * This requires administrative privileges, and the adapter is removed
+     * again when the device is destructed.
+     */
+    bool create_adapter = false;
+};
+
+/**
+ * Provides access to a Wintun virtual layer-3 device (Windows only).
+ * 
+ * Wintun is a point-to-point interface which exchanges IP packets with the
+ * Windows network stack through two rings in memory shared with the driver,
+ * so unlike with @ref TapDevice (TAP-Windows), no system call or I/O
+ * completion is needed per packet. It is to be used with an @ref
+ * IpDriverIface: received packets are passed to a
+ * @ref PacketBatchReceivedHandler, which would pass them to
+ * @ref IpDriverIface::recvIp4Packets, and packets are sent by @ref sendPacket,
+ * which would be called from @ref IpIfaceDriverParams::send_ip4_packet.
+ * 
+ * The Wintun library (`wintun.dll`) is loaded at runtime from the directory of
+ * the application or the system directory. When the receive ring is empty, the
+ * driver signals the read-wait event of the session, which is waited for using
+ * a thread-pool wait (`RegisterWaitForSingleObject`) that wakes the event
+ * loop through an @ref EventLoopAsyncSignal. While there are packets, they are
+ * taken from the ring in batches of up to @ref WintunDeviceParams::rx_budget,
+ * deferring further batches after other events (@ref EventLoopDeferred). The
+ * device also takes part in busy-polling of the event loop (see @ref
+ * EventLoopBusyPoller), in which case packets are found without waiting for
+ * the event.
+ * 
+ * Packets other than IPv4 packets (e.g. IPv6) are passed to the handler too,
+ * and would be dropped by the stack.
+ */
+class WintunDevice :
+    private AIpStack::NonCopyable<WintunDevice>
+{
+    struct WintunApi;
+
+public:
+    /**
+     * Type of callback used to deliver a batch of received packets.
+     * 
+     * @param pkts Array of received packets, suitable for @ref
+     *        IpDriverIface::recvIp4Packets. The array and the referenced buffers
+     *        must not be used outside of the callback function.
+     * @param count Number of packets in the array (positive and not greater than
+     *        @ref WintunDeviceParams::rx_budget).
+     */
+    using PacketBatchReceivedHandler =
+        Function<void(AIpStack::IpRxBatchEntry const *pkts, std::size_t count)>;
+
+    /**
+     * Constructor, opens the adapter and starts a session.
+     * 
+     * @param loop Event loop; it must outlive the WintunDevice object.
+     * @param adapter_name Name of the Wintun adapter (UTF-8).
+     * @param handler Callback function used to deliver received packets (must
+     *        not be null).
+     * @param params Configuration parameters.
+     * @throw std::runtime_error If loading Wintun, opening the adapter or
+     *        starting the session fails.
+     */
+    WintunDevice (AIpStack::EventLoop &loop, std::string const &adapter_name,
+                  PacketBatchReceivedHandler handler,
+                  WintunDeviceParams const &params = WintunDeviceParams());
+
+    /**
+     * Destructor, ends the session and closes the adapter.
+     */
+    ~WintunDevice ();
+
+    /**
+     * Get the IP MTU.
+     * 
+     * @return The MTU from @ref WintunDeviceParams::mtu.
+     */
+    std::size_t getMtu () const;
+
+    /**
+     * Send an IP packet through the adapter.
+     * 
+     * The packet is copied into the send ring and the driver takes it from
+     * there.
+     * 
+     * @param pkt Packet data (referenced using @ref IpBufRef), starting with the
+     *        IP header.
+     * @return Success or error code (@ref IpErr::OutputBufferFull if the send
+     *         ring is full).
+     */
+    AIpStack::IpErr sendPacket (AIpStack::IpBufRef pkt);
+
+private:
+    static void CALLBACK waitCallback (void *arg, BOOLEAN timed_out);
+
+    void readEventSignaled ();
+
+    bool receivePackets ();
+
+    void release ();
+
+private:
+    PacketBatchReceivedHandler m_handler;
+    WintunDeviceParams m_params;
+    std::unique_ptr<WintunApi> m_api;
+    HMODULE m_library;
+    void *m_adapter;
+    void *m_session;
+    HANDLE m_read_event;
+    HANDLE m_wait_handle;
+    bool m_recv_failed;
+    std::vector<AIpStack::IpBufNode> m_rx_nodes;
+    std::vector<AIpStack::IpRxBatchEntry> m_rx_pkts;
+    std::vector<unsigned char const *> m_rx_bufs;
+    AIpStack::EventLoopAsyncSignal m_read_signal;
+    AIpStack::EventLoopDeferred m_read_deferred;
+    AIpStack::EventLoopBusyPoller m_busy_poller;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -37,9 +37,12 @@
 #include <aipstack/misc/IntRange.h>
 #include <aipstack/misc/MinMax.h>
 #include <aipstack/misc/ResourceArray.h>
+#include <aipstack/misc/LazyResourceArray.h>
 #include <aipstack/misc/NonCopyable.h>
 #include <aipstack/misc/OneOf.h>
 #include <aipstack/misc/EnumUtils.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/misc/Function.h>
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/structure/LinkModel.h>
 #include <aipstack/structure/StructureRaiiWrapper.h>
@@ -51,7 +54,10 @@
 #include <aipstack/proto/Tcp4Proto.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpEphemeralPortAllocator.h>
+#include <aipstack/ip/IpFlowSteering.h>
 #include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/PlatformTimerWheel.h>
 #include <aipstack/tcp/TcpState.h>
 #include <aipstack/tcp/TcpSeqNum.h>
 #include <aipstack/tcp/TcpPcbFlags.h>
@@ -61,7 +67,14 @@
 #include <aipstack/tcp/TcpConnection.h>
 #include <aipstack/tcp/TcpMultiTimer.h>
 #include <aipstack/tcp/TcpPcbKey.h>
+#include <aipstack/tcp/TcpSynCookie.h>
+#include <aipstack/tcp/TcpTimeWaitTable.h>
+#include <aipstack/tcp/TcpPcbPool.h>
+#include <aipstack/tcp/TcpFastOpenCache.h>
 #include <aipstack/tcp/TcpOptions.h>
+#include <aipstack/tcp/TcpSackScoreboard.h>
+#include <aipstack/tcp/TcpStats.h>
+#include <aipstack/tcp/TcpCongCtrlReno.h>
 #include <aipstack/tcp/IpTcpProto_constants.h>
 #include <aipstack/tcp/IpTcpProto_input.h>
 #include <aipstack/tcp/IpTcpProto_output.h>
@@ -76,18 +89,42 @@ class IpTcpProto :
     private NonCopyable<IpTcpProto<Arg>>,
     private TcpApi<Arg>
 {
-    AIPSTACK_USE_VALS(Arg::Params, (TcpTTL, NumTcpPcbs, NumOosSegs,
-        EphemeralPortFirst, EphemeralPortLast, LinkWithArrayIndices))
-    AIPSTACK_USE_TYPES(Arg::Params, (PcbIndexService))
+    AIPSTACK_USE_VALS(Arg::Params, (TcpTTL, NumTcpPcbs, NumOosSegs, OosBufferTree,
+        EphemeralPortFirst, EphemeralPortLast, LinkWithArrayIndices,
+        MaxSuperSegmentData, NumSackBlocks, EnableTimestamps, EnablePacing,
+        PacingBurstSegs, EnableDelayedAck, DelayedAckTimeoutMs, QuickAckSegs,
+        EnableSynCookies, SynCookiePcbPercent, NumTimeWaitEntries, RcvBufAutoTuning,
+        EnableStats, EnableFastOpen, NumFastOpenCacheEntries))
+    AIPSTACK_USE_VALS(Arg::Params, (EnableRackTlp, PcbTimerWheelSlots,
+        PcbPoolChunkSize, EnableEcn, EcnDctcp, EnablePmtuProbing, EphemeralPortBitmap,
+        EnableKeepalive, SharedPersistTimer, CoalesceDataCallbacks, RcvMemBudget,
+        RcvMemPressurePercent, HighResRtt, MinRtxTimeUs, InitialRtxTimeUs,
+        TimeWaitTimeMs, EnablePrr))
+    AIPSTACK_USE_TYPES(Arg::Params, (PcbIndexService, CongCtrlService,
+                                     StaticConnectionClass))
     AIPSTACK_USE_TYPES(Arg, (PlatformImpl, StackArg))
     
     using Platform = PlatformFacade<PlatformImpl>;
     AIPSTACK_USE_TYPE(Platform, TimeType)
     
     static_assert(NumTcpPcbs > 0);
-    static_assert(NumOosSegs > 0 && NumOosSegs < 16);
+    static_assert(PcbPoolChunkSize >= 0);
+    static_assert(NumOosSegs > 0 && (OosBufferTree || NumOosSegs < 16));
     static_assert(EphemeralPortFirst > 0);
     static_assert(EphemeralPortFirst <= EphemeralPortLast);
+    static_assert(PacingBurstSegs > 0);
+    static_assert(DelayedAckTimeoutMs > 0 && DelayedAckTimeoutMs <= 500);
+    static_assert(SynCookiePcbPercent <= 100);
+    static_assert(NumTimeWaitEntries >= 0);
+    static_assert(NumFastOpenCacheEntries > 0);
+    static_assert(MaxSuperSegmentData <=
+        TypeMax<std::uint16_t> - Ip4Header::Size - Tcp4Header::Size);
+    static_assert(NumSackBlocks < 16);
+    static_assert((PcbTimerWheelSlots & (PcbTimerWheelSlots - 1)) == 0);
+    static_assert(RcvMemPressurePercent > 0 && RcvMemPressurePercent <= 100);
+    static_assert(MinRtxTimeUs > 0 && MinRtxTimeUs <= InitialRtxTimeUs);
+    static_assert(InitialRtxTimeUs <= 60000000);
+    static_assert(TimeWaitTimeMs > 0);
     
     template<typename> friend class IpTcpProto_constants;
     template<typename> friend class IpTcpProto_input;
@@ -95,6 +132,8 @@ class IpTcpProto :
     template<typename> friend class TcpApi;
     template<typename> friend class TcpListener;
     template<typename> friend class TcpConnection;
+    template<typename, typename, typename, std::size_t, std::size_t>
+    friend class TcpPcbPool;
     
     using Constants = IpTcpProto_constants<Arg>;
     using Input = IpTcpProto_input<Arg>;
@@ -102,24 +141,54 @@ class IpTcpProto :
     
     AIPSTACK_USE_TYPES(Constants, (RttType))
     
+    // Whether the timestamps option is used, which also requires a suitable clock.
+    inline static constexpr bool UseTimestamps =
+        EnableTimestamps && Constants::TimestampClockOk;
+    
+    // Whether RACK-TLP loss detection is used, which relies on SACK.
+    inline static constexpr bool UseRackTlp = EnableRackTlp && NumSackBlocks > 0;
+    
+    // Whether the DCTCP-style response to ECN is used instead of the standard one.
+    inline static constexpr bool UseDctcp = EnableEcn && EcnDctcp;
+    
+    // Whether connections in TIME_WAIT are kept in the TIME_WAIT table
+    // instead of in PCBs.
+    inline static constexpr bool UseTimeWaitTable = NumTimeWaitEntries > 0;
+    
     struct TcpPcb;
     
-    // Number of ephemeral ports.
-    inline static constexpr PortNum NumEphemeralPorts =
-        EphemeralPortLast - EphemeralPortFirst + 1;
+    // Whether PCBs are allocated in chunks on demand (growable pool) instead
+    // of being in a static array.
+    inline static constexpr bool UsePcbPool = PcbPoolChunkSize > 0;
+    
+    // Number of chunks in the growable pool, such that NumTcpPcbs is rounded
+    // up to whole chunks.
+    inline static constexpr std::size_t NumPcbChunks = !UsePcbPool ? 1 :
+        (std::size_t(NumTcpPcbs) + PcbPoolChunkSize - 1) / PcbPoolChunkSize;
+    
+    // Maximum number of PCBs.
+    inline static constexpr std::size_t PcbCapacity = !UsePcbPool ? NumTcpPcbs :
+        NumPcbChunks * PcbPoolChunkSize;
     
     // Unsigned integer type usable as an index for the PCBs array.
     // We use the largest value of that type as null (which cannot
     // be a valid PCB index).
-    using PcbIndexType = ChooseIntForMax<NumTcpPcbs, false>;
+    using PcbIndexType = ChooseIntForMax<PcbCapacity, false>;
     inline static constexpr PcbIndexType PcbIndexNull = PcbIndexType(-1);
     
     // Instantiate the out-of-sequence buffering.
     using OosBufferService = TcpOosBufferService<
-        TcpOosBufferServiceOptions::NumOosSegs::Is<NumOosSegs>
+        TcpOosBufferServiceOptions::NumOosSegs::Is<NumOosSegs>,
+        TcpOosBufferServiceOptions::UseIntervalTree::Is<OosBufferTree>
     >;
     AIPSTACK_MAKE_INSTANCE(OosBuffer, (OosBufferService))
     
+    // Scoreboard for data reported by SACK (even if SACK is disabled).
+    using SackScoreboard = TcpSackScoreboard<MaxValue(std::uint8_t(1), NumSackBlocks)>;
+    
+    // Instantiate the congestion control algorithm.
+    AIPSTACK_MAKE_INSTANCE(CongCtrl, (CongCtrlService::template Algorithm<Constants>))
+    
     struct PcbLinkModel;
     
     // Instantiate the PCB index.
@@ -132,9 +201,47 @@ class IpTcpProto :
     
     using ListenerLinkModel = PointerLinkModel<TcpListener<Arg>>;
     
+    // Instantiate the listener index, using the same service as for PCBs.
+    struct ListenerIndexAccessor;
+    using ListenerIndexLookupKeyArg = TcpListenerKey const &;
+    struct ListenerIndexKeyFuncs;
+    AIPSTACK_MAKE_INSTANCE(ListenerIndex, (PcbIndexService::template Index<
+        ListenerIndexAccessor, ListenerIndexLookupKeyArg, ListenerIndexKeyFuncs,
+        ListenerLinkModel, /*Duplicates=*/false>))
+    
+    // Circular list of the listeners in a reuse-port group. Only the head of
+    // a group is in the listener index.
+    struct ListenerGroupAccessor;
+    using ListenerGroupList = CircularLinkedList<ListenerGroupAccessor, ListenerLinkModel>;
+    
+    // Table of TIME_WAIT entries. If the table is not used, it is still
+    // instantiated with one entry for simplicity.
+    using TimeWaitTable = TcpTimeWaitTable<PlatformImpl, PcbIndexService,
+        MaxValue(1, NumTimeWaitEntries)>;
+    using TimeWaitEntry = typename TimeWaitTable::Entry;
+    
+    // Client-side cache of Fast Open cookies. If Fast Open is disabled, it is
+    // still instantiated with one entry for simplicity.
+    using FastOpenCache = TcpFastOpenCache<PcbIndexService,
+        EnableFastOpen ? NumFastOpenCacheEntries : 1>;
+    
     using Listener = TcpListener<Arg>;
     using Connection = TcpConnection<Arg>;
     
+    // Whether PCB timers are multiplexed onto a timer wheel instead of each
+    // PCB using its own platform timer.
+    inline static constexpr bool UsePcbTimerWheel = PcbTimerWheelSlots > 0;
+    
+    // Timer wheel for PCB timers, with ticks of about one millisecond. If the
+    // timer wheel is not used, it is still instantiated with one slot for
+    // simplicity.
+    using PcbTimerWheel = PlatformTimerWheel<PlatformImpl,
+        MaxValue(std::size_t(1), PcbTimerWheelSlots), Constants::TsClockShift>;
+    
+    // The underlying timer of each PCB.
+    using PcbBaseTimer = std::conditional_t<UsePcbTimerWheel,
+        typename PcbTimerWheel::Timer, typename Platform::Timer>;
+    
     // These TcpPcb fields are injected into TcpMultiTimer to fill up what
     // would otherwise be holes in the layout, for better memory use.
     struct MultiTimerUserData {
@@ -143,6 +250,9 @@ class IpTcpProto :
         // In the SYN_SENT state this is set based on the interface MTU and
         // the calculation is completed at the transition to ESTABLISHED.
         std::uint16_t base_snd_mss;
+        
+        // Index of the PCB in the growable pool (only used with the pool).
+        PcbIndexType pool_index;
     };
     
     /**
@@ -150,12 +260,19 @@ class IpTcpProto :
      * AbrtTimer: for aborting PCB (TIME_WAIT, abandonment)
      * OutputTimer: for pcb_output after send buffer extension
      * RtxTimer: for retransmission, window probe and cwnd idle reset
+     * PaceTimer: for pcb_output when sending was delayed by pacing
+     * DelAckTimer: for sending a delayed ACK
+     * LossTimer: for RACK reordering timeout and tail loss probe
      */
     struct AbrtTimer {};
     struct OutputTimer {};
     struct RtxTimer {};
-    using PcbMultiTimer = TcpMultiTimer<
-        PlatformImpl, TcpPcb, MultiTimerUserData, AbrtTimer, OutputTimer, RtxTimer>;
+    struct PaceTimer {};
+    struct DelAckTimer {};
+    struct LossTimer {};
+    using PcbMultiTimer = TcpMultiTimer<PlatformImpl, PcbBaseTimer, TcpPcb,
+        MultiTimerUserData,
+        AbrtTimer, OutputTimer, RtxTimer, PaceTimer, DelAckTimer, LossTimer>;
     
     /**
      * A TCP Protocol Control Block.
@@ -173,14 +290,17 @@ class IpTcpProto :
         using PcbMultiTimer::platform;
         
         inline TcpPcb (typename IpTcpProto::Platform platform_, IpTcpProto *tcp_) :
-            PcbMultiTimer(platform_),
+            PcbMultiTimer(IpTcpProto::pcb_timer_arg(platform_, tcp_)),
             tcp(tcp_),
-            state_val(TcpStates::CLOSED.value())
+            state_val(TcpStates::CLOSED.value()),
+            persist_active(false),
+            batch_queued(false)
         {
             con = nullptr;
             
-            // Add the PCB to the list of unreferenced PCBs.
-            tcp->m_unrefed_pcbs_list.prepend({*this, *tcp}, *tcp);
+            // NOTE: The PCB is added to the list of unreferenced PCBs by
+            // IpTcpProto, since with the growable pool the pool_index must be
+            // set first.
         }
         
         inline ~TcpPcb ()
@@ -189,18 +309,17 @@ class IpTcpProto :
             AIPSTACK_ASSERT(con == nullptr);
         }
         
+        // NOTE: The fields are ordered so that those used for processing
+        // most segments (lookup, sequence numbers, windows, flags) directly
+        // follow the key and are close together, and fields which are used
+        // only occasionally are at the end, so that processing a segment
+        // touches as few cache lines of the PCB as possible.
+        
         // Node for the PCB index.
         typename PcbIndex::Node index_hook;
         
-        // Node for the unreferenced PCBs list.
-        // The function pcb_is_in_unreferenced_list specifies exactly when
-        // a PCB is suposed to be in the unreferenced list. The only
-        // exception to this is while pcb_unlink_con is during the callback
-        // pcb_unlink_con-->pcb_aborted-->connectionAborted.
-        LinkedListNode<PcbLinkModel> unrefed_list_node;
-        
         // Pointer back to IpTcpProto.
-        IpTcpProto *tcp;    
+        IpTcpProto *tcp;
         
         union {
             // Pointer to the associated Listener, if in SYN_RCVD.
@@ -218,13 +337,21 @@ class IpTcpProto :
         TcpSeqNum rcv_nxt;
         TcpSeqInt rcv_ann_wnd; // ensured to fit in size_t (in case size_t is 16-bit)
         
-        // Round-trip-time and retransmission time management.
-        typename IpTcpProto::TimeType rtt_test_time;
+        // Timestamp to be echoed (TS.Recent), valid if the Timestamps flag is set.
+        std::uint32_t ts_recent;
+        
+        // Offset added to the timestamp clock for the timestamps we send. This
+        // is zero except for imported connections, whose timestamps continue
+        // from those sent before the export (see Output::pcb_ts_clock).
+        std::uint32_t ts_offset;
+        
+        // Retransmission time.
         RttType rto;
         
         // The maximum segment size we will send.
         // This is dynamic based on Path MTU Discovery, but it will always
-        // be between Constants::MinAllowedMss and base_snd_mss.
+        // be between Constants::MinAllowedMss and base_snd_mss, less the
+        // length of the timestamps option if timestamps are used.
         // It is first properly initialized at the transition to ESTABLISHED
         // state, before that in SYN_SENT/SYN_RCVD is is used to store the
         // pmtu/iface_mss respectively.
@@ -233,23 +360,92 @@ class IpTcpProto :
         // ssthresh, cwnd and rtx_timer (see pcb_pmtu_changed).
         std::uint16_t snd_mss;
         
-        // NOTE: The following 5 fields are uint32_t to encourage compilers
+        // Flags (see comments in TcpPcbFlags).
+        TcpPcbFlagsBaseType flags;
+        
+        // NOTE: The following fields are uint32_t to encourage compilers
         // to pack them into a single 32-bit word, if they were narrower
         // they may be packed less efficiently.
         
-        // Flags (see comments in TcpPcbFlags).
-        std::uint32_t flags : TcpPcbFlagsBits;
-        
         // PCB state.
         std::uint32_t state_val : TcpState::Bits;
         
         // Number of duplicate ACKs (>=FastRtxDupAcks means we're in fast recovery).
+        // In SYN_RCVD, the number of SYN-ACK retransmissions instead.
         std::uint32_t num_dupack : Constants::DupAckBits;
         
         // Window shift values.
         std::uint32_t snd_wnd_shift : 4;
         std::uint32_t rcv_wnd_shift : 4;
         
+        // Fast Open state (only used if EnableFastOpen). In SYN_SENT, fast_open
+        // means that Fast Open is used and in SYN_RCVD that a cookie is to be sent
+        // in the SYN-ACK. In other states, fast_open_syn_ack means that the
+        // connection was accepted with data in the SYN and our SYN-ACK might not
+        // have been received yet.
+        std::uint32_t fast_open : 1;
+        std::uint32_t fast_open_syn_ack : 1;
+        
+        // ECN state (only used if EnableEcn). The ecn_ok means that ECN is
+        // used, in SYN_SENT that an ECN-setup SYN is to be sent and in SYN_RCVD
+        // that an ECN-setup SYN-ACK is to be sent. The ecn_ce_echo means that
+        // ECE is to be sent in ACKs, ecn_cwr_pending that CWR is to be sent in
+        // the next new data segment, and ecn_reduced that the window has been
+        // reduced and ECE is ignored until snd_una reaches con->m_v.ecn_recover.
+        std::uint32_t ecn_ok : 1;
+        std::uint32_t ecn_ce_echo : 1;
+        std::uint32_t ecn_cwr_pending : 1;
+        std::uint32_t ecn_reduced : 1;
+        
+        // Whether the PCB is in the list of PCBs probing a zero window (only
+        // used if SharedPersistTimer).
+        std::uint32_t persist_active : 1;
+        
+        // Whether the PCB is in the list of PCBs with work deferred to the end
+        // of the receive batch (see pcb_defer_to_batch_end).
+        std::uint32_t batch_queued : 1;
+        
+        // DSCP value for outgoing segments (see TcpConnection::setDscp).
+        std::uint32_t dscp : 6;
+        
+        // The following fields are used only occasionally.
+        
+        // Node for the unreferenced PCBs list.
+        // The function pcb_is_in_unreferenced_list specifies exactly when
+        // a PCB is suposed to be in the unreferenced list. The only
+        // exception to this is while pcb_unlink_con is during the callback
+        // pcb_unlink_con-->pcb_aborted-->connectionAborted.
+        LinkedListNode<PcbLinkModel> unrefed_list_node;
+        
+        // Node for the list of PCBs probing a zero window, the interval between
+        // window probes and the time until the next probe, in persist ticks
+        // (only used if SharedPersistTimer, see pcb_persist_start).
+        LinkedListNode<PcbLinkModel> persist_list_node;
+        std::uint16_t persist_interval;
+        std::uint16_t persist_ticks_left;
+        
+        // Node for the list of PCBs with work deferred to the end of the
+        // receive batch.
+        LinkedListNode<PcbLinkModel> batch_list_node;
+        
+        // Start time of the round-trip-time measurement.
+        typename IpTcpProto::TimeType rtt_test_time;
+        
+        // Statistics counters (empty if EnableStats is false).
+        TcpStatsCounters<EnableStats, TcpConnectionCounters> stats;
+        
+        // Time when the PCB was created by a listener, for the SYN-to-accept
+        // time statistics (empty if EnableStats is false).
+        TcpStatsTime<EnableStats, typename IpTcpProto::TimeType> create_time;
+        
+        // Cached route and neighbor entry for sending segments, so that
+        // these do not need to be looked up for each segment.
+        IpRouteCacheIp4<StackArg> route_cache;
+        
+        // Checksum of the pseudo-header without the TCP length, which is the
+        // same for all segments (see Output::pcb_init_pseudo_chksum).
+        IpChksumAccumulator::State pseudo_chksum;
+        
         // Convenience functions for flags.
         inline bool hasFlag (TcpPcbFlags flag) const {
             return (TcpPcbFlags(flags) & flag) != Enum0;
@@ -320,6 +516,21 @@ class IpTcpProto :
             Output::pcb_rtx_timer_handler(this);
         }
         
+        inline void timerExpired (PaceTimer)
+        {
+            Output::pcb_output_timer_handler(this);
+        }
+        
+        inline void timerExpired (DelAckTimer)
+        {
+            Output::pcb_delack_timer_handler(this);
+        }
+        
+        inline void timerExpired (LossTimer)
+        {
+            Output::pcb_loss_timer_handler(this);
+        }
+        
         // Send retry callback.
         void retrySending () override final {
             Output::pcb_send_retry(this);
@@ -339,10 +550,50 @@ public:
     IpTcpProto (IpProtocolHandlerArgs<StackArg> args) :
         m_stack(args.stack),
         m_current_pcb(nullptr),
-        m_next_ephemeral_port(EphemeralPortFirst),
+        m_ephemeral_ports(std::uint32_t(args.platform.getTime()) ^
+                          std::uint32_t(reinterpret_cast<std::uintptr_t>(this))),
+        m_flow_steering(nullptr),
+        m_num_syn_rcvd_pcbs(0),
+        m_num_used_pcbs(0),
+        m_num_keepalive_cons(0),
+        m_keepalive_timer(args.platform,
+            AIPSTACK_BIND_MEMBER_TN(&IpTcpProto::keepalive_timer_handler, this)),
+        m_num_persist_pcbs(0),
+        m_persist_timer(args.platform,
+            AIPSTACK_BIND_MEMBER_TN(&IpTcpProto::persist_timer_handler, this)),
+        m_rcv_mem_used(0),
+        m_rcv_mem_pressure(false),
+        m_rcv_mem_reported(false),
+        m_rcv_mem_timer(args.platform,
+            AIPSTACK_BIND_MEMBER_TN(&IpTcpProto::rcv_mem_timer_handler, this)),
+        m_timewait_table(args.platform),
+        m_pcb_timer_wheel(args.platform),
         m_pcbs(ResourceArrayInitSame(), args.platform, this)
     {
         AIPSTACK_ASSERT(args.stack != nullptr);
+        
+        // There are no PCBs initially, they are constructed as needed by
+        // allocate_pcb (see StaticPcbArray) or with the growable pool.
+        
+        m_stats.reset();
+        
+        // Initialize the SYN cookie secret. There is no good source of randomness,
+        // so this relies on the startup time and memory layout being unpredictable.
+        if (EnableSynCookies) {
+            HashAccumulator hash;
+            hash.addWord(std::uint32_t(platform().getTime()));
+            hash.addWord(std::uint32_t(reinterpret_cast<std::uintptr_t>(this)));
+            m_syn_cookie_secret = hash.getHash();
+        }
+        
+        // Initialize the Fast Open cookie secret in the same way, but with another
+        // seed so that it differs from the SYN cookie secret.
+        if (EnableFastOpen) {
+            HashAccumulator hash(0x54464f31u);
+            hash.addWord(std::uint32_t(platform().getTime()));
+            hash.addWord(std::uint32_t(reinterpret_cast<std::uintptr_t>(this)));
+            m_fast_open_secret = hash.getHash();
+        }
     }
     
     /**
@@ -353,7 +604,7 @@ public:
      */
     ~IpTcpProto ()
     {
-        AIPSTACK_ASSERT(m_listeners_list.isEmpty());
+        AIPSTACK_ASSERT(m_listener_index.isEmpty());
         AIPSTACK_ASSERT(m_current_pcb == nullptr);
     }
     
@@ -373,14 +624,83 @@ public:
         Input::handleIp4DestUnreach(this, du_meta, ip_info, dgram_initial);
     }
     
+    void recvIp4BatchEnd ()
+    {
+        AIPSTACK_ASSERT(m_current_pcb == nullptr);
+        
+        // Deliver the data callbacks and send the ACKs deferred during the
+        // batch. A PCB may have been aborted or reused in the meantime, in which
+        // case the AckPending flag has been cleared or the ACK is just as well
+        // sent for the new connection, and any amounts to report are in the
+        // Connection which has been disassociated.
+        while (!m_batch_pcbs_list.isEmpty()) {
+            TcpPcb *pcb = m_batch_pcbs_list.first(*this);
+            m_batch_pcbs_list.removeFirst(*this);
+            AIPSTACK_ASSERT(pcb->batch_queued);
+            pcb->batch_queued = false;
+            
+            if (pcb->state() == TcpStates::CLOSED) {
+                continue;
+            }
+            
+            if (CoalesceDataCallbacks && pcb->con != nullptr &&
+                pcb->con->has_batch_data())
+            {
+                // This also sends any data queued by the application and the ACK.
+                Input::pcb_batch_data_input(pcb);
+            }
+            else if (pcb->hasAndClearFlag(TcpPcbFlags::AckPending)) {
+                Output::pcb_send_empty_ack(pcb);
+            }
+        }
+    }
+    
 private:
     inline Platform platform () const
     {
-        return m_pcbs[0].platform();
+        if constexpr (UsePcbPool) {
+            return m_pcbs.platform();
+        } else {
+            return m_stack->platform();
+        }
+    }
+    
+    // Convert a time duration to milliseconds for statistics, saturating.
+    inline static std::uint32_t time_to_ms (TimeType time)
+    {
+        return std::uint32_t(MinValue(double(time) * (1e3 / Platform::TimeFreq),
+                                      double(TypeMax<std::uint32_t>)));
+    }
+    
+    // Return what the PCB timer is constructed from, the platform or the
+    // PCB timer wheel.
+    inline static decltype(auto) pcb_timer_arg (Platform platform_, IpTcpProto *tcp)
+    {
+        if constexpr (UsePcbTimerWheel) {
+            return static_cast<PcbTimerWheel &>(tcp->m_pcb_timer_wheel);
+        } else {
+            return Platform(platform_);
+        }
     }
     
     TcpPcb * allocate_pcb ()
     {
+        // If no PCB is available or the PCB to be used would have to be aborted,
+        // construct a new PCB in the static array or add a chunk of PCBs to the
+        // growable pool. If this is not possible, the PCB will be aborted.
+        if (m_unrefed_pcbs_list.isEmpty() ||
+            (*m_unrefed_pcbs_list.lastNotEmpty(*this)).state() != TcpStates::CLOSED)
+        {
+            if constexpr (UsePcbPool) {
+                pcb_pool_grow();
+            } else {
+                if (!m_pcbs.allConstructed()) {
+                    TcpPcb &new_pcb = m_pcbs.constructNext(platform(), this);
+                    m_unrefed_pcbs_list.append({new_pcb, *this}, *this);
+                }
+            }
+        }
+        
         // No PCB available?
         if (m_unrefed_pcbs_list.isEmpty()) {
             return nullptr;
@@ -397,14 +717,80 @@ private:
             pcb_assert_closed(pcb);
         }
         
+        // The caller will move the PCB out of the CLOSED state.
+        m_num_used_pcbs++;
+        m_peak_used_pcbs.update(m_num_used_pcbs);
+        
         return pcb;
     }
     
+    void pcb_pool_grow ()
+    {
+        int chunk_idx = m_pcbs.addChunk();
+        if (chunk_idx < 0) {
+            return;
+        }
+        
+        // Assign the indices of the new PCBs then add them to the end of the list
+        // of unreferenced PCBs, so they are used before any PCB is aborted.
+        auto &chunk = *m_pcbs.getChunk(std::size_t(chunk_idx));
+        for (std::size_t i : IntRange(std::size_t(PcbPoolChunkSize))) {
+            TcpPcb &pcb = chunk[i];
+            pcb.pool_index = PcbIndexType(std::size_t(chunk_idx) * PcbPoolChunkSize + i);
+            m_unrefed_pcbs_list.append({pcb, *this}, *this);
+        }
+        
+        m_peak_pcb_pool_bytes.update(pcb_pool_bytes());
+    }
+    
+    std::size_t pcb_pool_bytes () const
+    {
+        std::size_t bytes = 0;
+        for (std::size_t chunk_idx : IntRange(NumPcbChunks)) {
+            if (m_pcbs.getChunk(chunk_idx) != nullptr) {
+                bytes += sizeof(typename PcbStorage::Chunk);
+            }
+        }
+        return bytes;
+    }
+    
+    // Called periodically by the growable pool to release chunks in which all
+    // PCBs are closed. This is never called from within TCP processing so
+    // there can be no references to closed PCBs.
+    void pcb_pool_reclaim ()
+    {
+        for (std::size_t chunk_idx : IntRange(NumPcbChunks)) {
+            auto *chunk = m_pcbs.getChunk(chunk_idx);
+            if (chunk == nullptr) {
+                continue;
+            }
+            
+            bool idle = true;
+            for (TcpPcb &pcb : *chunk) {
+                if (pcb.state() != TcpStates::CLOSED) {
+                    idle = false;
+                    break;
+                }
+            }
+            
+            if (idle) {
+                for (TcpPcb &pcb : *chunk) {
+                    pcb_assert_closed(&pcb);
+                    m_unrefed_pcbs_list.remove({pcb, *this}, *this);
+                }
+                m_pcbs.removeChunk(chunk_idx);
+            }
+        }
+    }
+    
     void pcb_assert_closed (TcpPcb *pcb)
     {
         AIPSTACK_ASSERT(!pcb->tim(AbrtTimer()).isSet());
         AIPSTACK_ASSERT(!pcb->tim(OutputTimer()).isSet());
         AIPSTACK_ASSERT(!pcb->tim(RtxTimer()).isSet());
+        AIPSTACK_ASSERT(!pcb->tim(PaceTimer()).isSet());
+        AIPSTACK_ASSERT(!pcb->tim(DelAckTimer()).isSet());
+        AIPSTACK_ASSERT(!pcb->tim(LossTimer()).isSet());
         AIPSTACK_ASSERT(!pcb->IpSendRetryRequest::isActive());
         AIPSTACK_ASSERT(pcb->tcp == this);
         AIPSTACK_ASSERT(pcb->state() == TcpStates::CLOSED);
@@ -454,8 +840,11 @@ private:
             tcp->m_pcb_index_active.removeEntry({*pcb, *tcp}, *tcp);
         }
         
+        // The local port may now be used for another connection.
+        tcp->m_ephemeral_ports.release(pcb->local_port);
+        
         // Make sure the PCB is at the end of the unreferenced list.
-        if (pcb != tcp->m_unrefed_pcbs_list.lastNotEmpty(*tcp)) {
+        if (pcb != static_cast<TcpPcb *>(tcp->m_unrefed_pcbs_list.lastNotEmpty(*tcp))) {
             tcp->m_unrefed_pcbs_list.remove({*pcb, *tcp}, *tcp);
             tcp->m_unrefed_pcbs_list.append({*pcb, *tcp}, *tcp);
         }
@@ -464,6 +853,8 @@ private:
         pcb->PcbMultiTimer::unsetAll();
         pcb->IpSendRetryRequest::reset();
         pcb->setState(TcpStates::CLOSED);
+        AIPSTACK_ASSERT(tcp->m_num_used_pcbs > 0);
+        tcp->m_num_used_pcbs--;
         
         tcp->pcb_assert_closed(pcb);
     }
@@ -485,6 +876,12 @@ private:
         // transitions where this is not the case.
         pcb->snd_nxt = pcb->snd_una;
         
+        // If the TIME_WAIT table is used, move the connection there and close
+        // the PCB.
+        if (UseTimeWaitTable) {
+            return pcb_move_to_time_wait_table(pcb);
+        }
+        
         // Change state.
         pcb->setState(TcpStates::TIME_WAIT);
         
@@ -496,6 +893,12 @@ private:
         // Stop timers due to asserts in their handlers.
         pcb->tim(OutputTimer()).unset();
         pcb->tim(RtxTimer()).unset();
+        pcb->tim(PaceTimer()).unset();
+        pcb->tim(LossTimer()).unset();
+        
+        // Any ACK is sent right away in TIME_WAIT.
+        pcb->clearFlag(TcpPcbFlags::AckDelayed);
+        pcb->tim(DelAckTimer()).unset();
         
         // Clear the OutPending flag due to its preconditions.
         pcb->clearFlag(TcpPcbFlags::OutPending);
@@ -504,6 +907,36 @@ private:
         pcb->tim(AbrtTimer()).setAfter(Constants::TimeWaitTimeTicks);
     }
     
+    static void pcb_move_to_time_wait_table (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(UseTimeWaitTable);
+        AIPSTACK_ASSERT(pcb->con == nullptr);
+        IpTcpProto *tcp = pcb->tcp;
+        
+        // Clear RcvWndUpd flag since this flag must imply con != nullptr.
+        pcb->clearFlag(TcpPcbFlags::RcvWndUpd);
+        
+        // Send any pending or delayed ACK (normally acknowledging the FIN) now,
+        // since the PCB will be closed.
+        if (pcb->hasAndClearFlag(TcpPcbFlags::AckPending) ||
+            pcb->hasFlag(TcpPcbFlags::AckDelayed))
+        {
+            Output::pcb_send_empty_ack(pcb);
+        }
+        
+        // Add the TIME_WAIT entry with what is needed to send ACKs.
+        TimeWaitEntry &entry =
+            tcp->m_timewait_table.addEntry(*pcb, Constants::TimeWaitTimeTicks);
+        entry.snd_nxt = pcb->snd_nxt;
+        entry.rcv_nxt = pcb->rcv_nxt;
+        entry.ts_recent = pcb->ts_recent;
+        entry.rcv_wnd = Input::pcb_ann_wnd(pcb);
+        entry.timestamps = UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps);
+        
+        // Close the PCB. This makes it available for reuse right away.
+        pcb_abort(pcb, false);
+    }
+    
     // NOTE: doDelayedTimerUpdate must be called after return.
     // We are okay because this is only called from pcb_input.
     static void pcb_go_to_fin_wait_2 (TcpPcb *pcb)
@@ -516,6 +949,9 @@ private:
         // Stop these timers due to asserts in their handlers.
         pcb->tim(OutputTimer()).unset();
         pcb->tim(RtxTimer()).unset();
+        pcb->tim(PaceTimer()).unset();
+        pcb->tim(LossTimer()).unset();
+        pcb_persist_stop(pcb);
         
         // Clear the OutPending flag due to its preconditions.
         pcb->clearFlag(TcpPcbFlags::OutPending);
@@ -530,6 +966,9 @@ private:
     {
         AIPSTACK_ASSERT(pcb->state() != OneOf(TcpStates::CLOSED, TcpStates::SYN_RCVD));
         
+        // Window probing with the shared persist timer requires a Connection.
+        pcb_persist_stop(pcb);
+        
         if (pcb->con != nullptr) {
             // Inform the connection object about the aborting.
             // Note that the PCB is not yet on the list of unreferenced
@@ -562,6 +1001,8 @@ private:
         // Decrement the listener's PCB count.
         AIPSTACK_ASSERT(lis->m_num_pcbs > 0);
         lis->m_num_pcbs--;
+        AIPSTACK_ASSERT(pcb->tcp->m_num_syn_rcvd_pcbs > 0);
+        pcb->tcp->m_num_syn_rcvd_pcbs--;
         
         // Is this a PCB which is being accepted?
         if (lis->m_accept_pcb == pcb) {
@@ -598,13 +1039,22 @@ private:
         // Clear RcvWndUpd flag since this flag must imply con != nullptr.
         pcb->clearFlag(TcpPcbFlags::RcvWndUpd);
         
-        // Abort if in SYN_SENT state or some data is queued or some data was received but
-        // not processed by the application. The pcb_abort() will decide whether to send an
-        // RST (no RST in SYN_SENT, RST otherwise).
-        if (pcb->state() == TcpStates::SYN_SENT || rst_needed) {
+        // Abort without an RST if in SYN_SENT state.
+        if (pcb->state() == TcpStates::SYN_SENT) {
             return pcb_abort(pcb);
         }
         
+        // Abort with an RST if some data is queued or some data was received but not
+        // processed by the application. The RST is sent at snd_una, which is rcv_nxt of
+        // the peer as far as we know. At snd_nxt it could be beyond the window of the
+        // peer and be ignored, for example after a zero window probe. If the peer has
+        // received more, it ignores this RST, but its ACK will then get an RST reply
+        // with the acked sequence number since the PCB is gone.
+        if (rst_needed) {
+            Output::pcb_send_rst(pcb, pcb->snd_una);
+            return pcb_abort(pcb, false);
+        }
+        
         // Make sure any idle timeout is stopped, because pcb_rtx_timer_handler
         // requires the connection to not be abandoned when the idle timeout expires.
         if (pcb->hasFlag(TcpPcbFlags::IdleTimer)) {
@@ -612,6 +1062,19 @@ private:
             pcb->tim(RtxTimer()).unset();
         }
         
+        // Stop the LossTimer, RACK-TLP is not done for abandoned connections
+        // since it needs the send buffer.
+        pcb->tim(LossTimer()).unset();
+        
+        // Abandoned PCBs probe a zero window using the RtxTimer, since the
+        // shared persist timer requires a Connection.
+        if (SharedPersistTimer && pcb->persist_active) {
+            pcb_persist_stop(pcb);
+            if (!pcb->tim(RtxTimer()).isSet()) {
+                pcb->tim(RtxTimer()).setAfter(Output::pcb_rto_time(pcb));
+            }
+        }
+        
         // Arrange for sending the FIN.
         if (pcb->state().isSndOpen()) {
             Output::pcb_end_sending(pcb);
@@ -629,6 +1092,21 @@ private:
         pcb->doDelayedTimerUpdateIfNeeded();
     }
     
+    // This is called from Connection::exportConnection after the Connection
+    // has disassociated from the PCB. The PCB is closed without sending
+    // anything since the connection continues elsewhere.
+    static void pcb_exported (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->state() == TcpStates::ESTABLISHED);
+        AIPSTACK_ASSERT(pcb->con == nullptr); // Connection just cleared it
+        IpTcpProto *tcp = pcb->tcp;
+        
+        // Add the PCB to the unreferenced PCBs list as pcb_abort expects.
+        tcp->m_unrefed_pcbs_list.append({*pcb, *tcp}, *tcp);
+        
+        pcb_abort(pcb, false);
+    }
+    
     static void pcb_abrt_timer_handler (TcpPcb *pcb)
     {
         AIPSTACK_ASSERT(pcb->state() != TcpStates::CLOSED);
@@ -658,27 +1136,335 @@ private:
         return TcpSeqNum(TcpSeqInt(platform().getTime()));
     }
     
-    Listener * find_listener (Ip4Addr addr, PortNum port)
+    TcpMemoryStats get_memory_stats () const
     {
-        for (Listener *lis = m_listeners_list.first();
-             lis != nullptr; lis = m_listeners_list.next(*lis))
-        {
-            AIPSTACK_ASSERT(lis->m_listening);
-            if (lis->m_addr == addr && lis->m_port == port) {
-                return lis;
+        TcpMemoryStats stats;
+        stats.pcbs.capacity = PcbCapacity;
+        stats.pcbs.used = m_num_used_pcbs;
+        stats.pcbs.peak_used = m_peak_used_pcbs.get();
+        
+        if constexpr (UsePcbPool) {
+            stats.pcbs.dynamic_bytes = pcb_pool_bytes();
+            stats.pcbs.peak_dynamic_bytes = m_peak_pcb_pool_bytes.get();
+        } else {
+            stats.pcbs.static_bytes = sizeof(m_pcbs);
+        }
+        
+        const_cast<IpTcpProto *>(this)->for_each_pcb([&](TcpPcb &pcb) {
+            if (pcb.con != nullptr) {
+                stats.snd_buf_bytes += pcb.con->m_v.snd_buf.tot_len;
+                stats.rcv_buf_bytes += pcb.con->m_v.rcv_buf.tot_len;
+            }
+        });
+        
+        return stats;
+    }
+    
+    template<typename Func>
+    void for_each_pcb (Func func)
+    {
+        if constexpr (UsePcbPool) {
+            m_pcbs.forEach(func);
+        } else {
+            for (TcpPcb &pcb : m_pcbs) {
+                func(pcb);
+            }
+        }
+    }
+    
+    // Called when keepalive is enabled for a connection which has a PCB.
+    void keepalive_con_added ()
+    {
+        AIPSTACK_ASSERT(EnableKeepalive);
+        
+        // Start the sweep timer with the first connection.
+        if (m_num_keepalive_cons++ == 0) {
+            m_keepalive_timer.setAfter(Constants::KeepaliveSweepTicks);
+        }
+    }
+    
+    // Called when keepalive is disabled for a connection or the connection
+    // is disassociated from its PCB. The sweep timer is stopped lazily.
+    void keepalive_con_removed ()
+    {
+        AIPSTACK_ASSERT(m_num_keepalive_cons > 0);
+        
+        m_num_keepalive_cons--;
+    }
+    
+    // Instead of a timer per PCB, a single timer periodically sweeps all PCBs
+    // and counts down the keepalive time of connections with keepalive enabled.
+    // Receiving any acceptable segment restarts the idle time (see pcb_input_core).
+    void keepalive_timer_handler ()
+    {
+        AIPSTACK_ASSERT(m_current_pcb == nullptr);
+        
+        if (m_num_keepalive_cons == 0) {
+            return;
+        }
+        
+        for_each_pcb([&](TcpPcb &pcb) {
+            if (!pcb.state().isActive() || pcb.con == nullptr) {
+                return;
+            }
+            
+            Connection *con = pcb.con;
+            if (con->m_v.ka_idle == 0) {
+                return;
+            }
+            
+            if (--con->m_v.ka_time_left > 0) {
+                return;
+            }
+            
+            // Probe only when there is nothing to send or retransmit, otherwise
+            // the retransmissions detect a dead peer.
+            if (pcb.state().canOutput() && Output::pcb_has_snd_outstanding(&pcb)) {
+                con->m_v.ka_time_left = con->m_v.ka_idle;
+                con->m_v.ka_probes = 0;
+                return;
+            }
+            
+            // Abort the connection if too many probes were not answered.
+            if (con->m_v.ka_probes >= con->m_v.ka_count) {
+                pcb_abort(&pcb, true);
+                return;
+            }
+            
+            Output::pcb_send_keepalive(&pcb);
+            con->m_v.ka_probes++;
+            con->m_v.ka_time_left = con->m_v.ka_interval;
+        });
+        
+        if (m_num_keepalive_cons > 0) {
+            m_keepalive_timer.setAfter(Constants::KeepaliveSweepTicks);
+        }
+    }
+    
+    // Enter the zero-window persist state with the shared persist timer. Instead
+    // of the RtxTimer of each PCB, a single timer ticks for all PCBs probing a
+    // zero window, so that many stalled connections cost one timer expiration
+    // per tick, with probes due in the same tick sent together.
+    static void pcb_persist_start (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(SharedPersistTimer);
+        AIPSTACK_ASSERT(pcb->state().canOutput());
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        if (pcb->persist_active) {
+            return;
+        }
+        
+        // The first probe is sent after the RTO rounded up to whole ticks, with
+        // exponential backoff for subsequent probes as with the RtxTimer.
+        TimeType rto_ticks = (Output::pcb_rto_time(pcb) + (Constants::PersistTickTicks - 1))
+            / Constants::PersistTickTicks;
+        pcb->persist_interval = std::uint16_t(
+            MaxValue(TimeType(1), MinValue(rto_ticks, TimeType(Constants::MaxPersistTicks))));
+        pcb->persist_ticks_left = pcb->persist_interval;
+        pcb->persist_active = true;
+        
+        IpTcpProto *tcp = pcb->tcp;
+        tcp->m_persist_pcbs_list.prepend({*pcb, *tcp}, *tcp);
+        
+        if (tcp->m_num_persist_pcbs++ == 0) {
+            tcp->m_persist_timer.setAfter(Constants::PersistTickTicks);
+        }
+    }
+    
+    // Leave the zero-window persist state, if in it.
+    static void pcb_persist_stop (TcpPcb *pcb)
+    {
+        if (!SharedPersistTimer || !pcb->persist_active) {
+            return;
+        }
+        
+        pcb->persist_active = false;
+        
+        IpTcpProto *tcp = pcb->tcp;
+        tcp->m_persist_pcbs_list.remove({*pcb, *tcp}, *tcp);
+        
+        AIPSTACK_ASSERT(tcp->m_num_persist_pcbs > 0);
+        if (--tcp->m_num_persist_pcbs == 0) {
+            tcp->m_persist_timer.unset();
+        }
+    }
+    
+    // Queue the PCB for work at the end of the receive batch (recvIp4BatchEnd):
+    // sending the ACK for which the AckPending flag is set, so that one ACK is
+    // sent for all segments of the PCB in the batch, and with CoalesceDataCallbacks
+    // delivering the dataSent/dataReceived callbacks for the whole batch. PCBs
+    // with a nonzero DSCP are queued at the front so that their segments are
+    // sent before those of the other PCBs.
+    static void pcb_defer_to_batch_end (TcpPcb *pcb)
+    {
+        if (!pcb->batch_queued) {
+            IpTcpProto *tcp = pcb->tcp;
+            pcb->batch_queued = true;
+            if (pcb->dscp != 0) {
+                tcp->m_batch_pcbs_list.prepend({*pcb, *tcp}, *tcp);
+            } else {
+                tcp->m_batch_pcbs_list.append({*pcb, *tcp}, *tcp);
+            }
+        }
+    }
+    
+    void persist_timer_handler ()
+    {
+        AIPSTACK_ASSERT(m_current_pcb == nullptr);
+        
+        for (Ref ref = m_persist_pcbs_list.first(*this); !ref.isNull();) {
+            TcpPcb *pcb = ref;
+            ref = PersistPcbsList::next(ref, *this);
+            
+            AIPSTACK_ASSERT(pcb->persist_active);
+            AIPSTACK_ASSERT(pcb->state().canOutput());
+            AIPSTACK_ASSERT(pcb->con != nullptr);
+            
+            // Leave the persist state if the window is no longer being probed,
+            // for example because all data was acknowledged.
+            if (pcb->con->m_v.snd_wnd != 0 || !Output::pcb_has_snd_outstanding(pcb) ||
+                Output::pcb_has_snd_unacked(pcb))
+            {
+                pcb_persist_stop(pcb);
+                continue;
+            }
+            
+            if (--pcb->persist_ticks_left > 0) {
+                continue;
+            }
+            
+            // Send a window probe and back off. Sending does not invoke any
+            // callbacks so the PCBs in the list cannot change.
+            m_stats.inc(&TcpProtoStats::window_probes);
+            Output::pcb_output(pcb, true);
+            pcb->doDelayedTimerUpdate();
+            
+            pcb->persist_interval = std::uint16_t(MinValue(
+                std::uint32_t(Constants::MaxPersistTicks),
+                std::uint32_t(2 * std::uint32_t(pcb->persist_interval))));
+            pcb->persist_ticks_left = pcb->persist_interval;
+        }
+        
+        if (m_num_persist_pcbs > 0) {
+            m_persist_timer.setAfter(Constants::PersistTickTicks);
+        }
+    }
+    
+    // Stack-wide receive memory budget (RcvMemBudget). The receive windows
+    // announced by connections are summed in m_rcv_mem_used, this being the
+    // amount of data which peers may send and the application would have to
+    // absorb. The sum is kept within the budget by limiting window growth in
+    // pcb_calc_wnd_update. Above the pressure threshold, the growth of each
+    // window is further limited to a fair share of the budget and receive
+    // buffer auto-tuning is suspended, until usage falls below the lower
+    // relief threshold.
+    static constexpr std::size_t RcvMemPressureThres =
+        RcvMemBudget / 100 * RcvMemPressurePercent;
+    static constexpr std::size_t RcvMemReliefThres = RcvMemPressureThres / 4 * 3;
+    
+    // Update the accounted window of a connection after rcv_ann_wnd changed.
+    static void pcb_rcv_mem_update (TcpPcb *pcb)
+    {
+        if constexpr (RcvMemBudget > 0) {
+            AIPSTACK_ASSERT(pcb->con != nullptr);
+            
+            IpTcpProto *tcp = pcb->tcp;
+            Connection *con = pcb->con;
+            
+            AIPSTACK_ASSERT(tcp->m_rcv_mem_used >= con->m_v.rcv_mem_acct);
+            tcp->m_rcv_mem_used -= con->m_v.rcv_mem_acct;
+            con->m_v.rcv_mem_acct = pcb->rcv_ann_wnd;
+            tcp->m_rcv_mem_used += con->m_v.rcv_mem_acct;
+            
+            tcp->rcv_mem_check_pressure();
+        }
+    }
+    
+    // Called when a connection is disassociated from its PCB.
+    void rcv_mem_con_removed (Connection *con)
+    {
+        if constexpr (RcvMemBudget > 0) {
+            AIPSTACK_ASSERT(m_rcv_mem_used >= con->m_v.rcv_mem_acct);
+            m_rcv_mem_used -= con->m_v.rcv_mem_acct;
+            con->m_v.rcv_mem_acct = 0;
+            
+            rcv_mem_check_pressure();
+        }
+    }
+    
+    void rcv_mem_check_pressure ()
+    {
+        bool pressure = m_rcv_mem_pressure ?
+            (m_rcv_mem_used > RcvMemReliefThres) : (m_rcv_mem_used >= RcvMemPressureThres);
+        
+        if (pressure != m_rcv_mem_pressure) {
+            m_rcv_mem_pressure = pressure;
+            
+            // Connections and the application are informed from the timer handler,
+            // since this may be called in input processing or in callbacks.
+            m_rcv_mem_timer.setAfter(0);
+        }
+    }
+    
+    // Return the largest receive window which a connection may announce with
+    // respect to the budget.
+    static TcpSeqInt pcb_rcv_mem_limit (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        IpTcpProto *tcp = pcb->tcp;
+        std::size_t acct = pcb->con->m_v.rcv_mem_acct;
+        
+        std::size_t headroom = (tcp->m_rcv_mem_used < RcvMemBudget) ?
+            (RcvMemBudget - tcp->m_rcv_mem_used) : 0;
+        std::size_t limit = acct + headroom;
+        
+        if (tcp->m_rcv_mem_pressure) {
+            std::size_t share = RcvMemBudget / MaxValue(std::size_t(1), tcp->m_num_used_pcbs);
+            limit = MinValue(limit, MaxValue(acct, share));
+        }
+        
+        return TcpSeqInt(MinValueU(limit, TypeMax<TcpSeqInt>));
+    }
+    
+    void rcv_mem_timer_handler ()
+    {
+        AIPSTACK_ASSERT(m_current_pcb == nullptr);
+        
+        // When the pressure is relieved, let connections announce the window
+        // which was held back.
+        if (!m_rcv_mem_pressure) {
+            for_each_pcb([&](TcpPcb &pcb) {
+                if (pcb.con != nullptr && pcb.state().isAcceptingData()) {
+                    Input::pcb_rcv_buf_extended(&pcb);
+                }
+            });
+        }
+        
+        if (m_rcv_mem_reported != m_rcv_mem_pressure) {
+            m_rcv_mem_reported = m_rcv_mem_pressure;
+            if (m_rcv_mem_pressure_handler) {
+                m_rcv_mem_pressure_handler(m_rcv_mem_reported);
             }
         }
-        return nullptr;
+    }
+    
+    Listener * find_listener (Ip4Addr addr, PortNum port)
+    {
+        Listener *lis = m_listener_index.findEntry(TcpListenerKey{addr, port});
+        AIPSTACK_ASSERT(lis == nullptr || lis->m_listening);
+        return lis;
     }
     
     void unlink_listener (Listener *lis)
     {
         // Abort any PCBs associated with the listener (without RST).
-        for (TcpPcb &pcb : m_pcbs) {
+        for_each_pcb([&](TcpPcb &pcb) {
             if (pcb.state() == TcpStates::SYN_RCVD && pcb.lis == lis) {
                 pcb_abort(&pcb, false);
             }
-        }
+        });
     }
     
     IpErr create_connection (Connection *con, TcpStartConnectionArgs<Arg> const &args,
@@ -733,23 +1519,40 @@ private:
         
         // Initialize most of the PCB.
         pcb->setState(TcpStates::SYN_SENT);
-        // WndScale to send the window scale option
-        pcb->flags = AsUnderlying(TcpPcbFlags::WndScale);
+        // WndScale to send the window scale option, SackPerm to send
+        // the SACK-permitted option if SACK is enabled, Timestamps to send
+        // the timestamps option if timestamps are enabled
+        pcb->flags = AsUnderlying(TcpPcbFlags::WndScale |
+            ((NumSackBlocks > 0) ? TcpPcbFlags::SackPerm : TcpPcbFlags(0)) |
+            (UseTimestamps ? TcpPcbFlags::Timestamps : TcpPcbFlags(0)));
         pcb->con = con;
         pcb->local_addr = local_addr;
         pcb->remote_addr = remote_addr;
         pcb->local_port = local_port;
         pcb->remote_port = remote_port;
+        Output::pcb_init_pseudo_chksum(pcb);
         pcb->rcv_nxt = TcpSeqNum(0u); // it is sent in the SYN
         pcb->rcv_ann_wnd = rcv_wnd;
         pcb->snd_una = iss;
         pcb->snd_nxt = iss;
         pcb->snd_mss = pmtu; // store PMTU here temporarily
         pcb->base_snd_mss = iface_mss; // will be updated when the SYN-ACK is received
+        pcb->ts_offset = 0;
         pcb->rto = Constants::InitialRtxTime;
         pcb->num_dupack = 0;
         pcb->snd_wnd_shift = 0;
-        pcb->rcv_wnd_shift = Constants::RcvWndShift;
+        pcb->rcv_wnd_shift = Constants::RcvWndShiftForBuffer(
+            (args.max_rcv_buf == 0) ? 0 : MaxValue(args.max_rcv_buf, user_rcv_wnd));
+        pcb->fast_open = EnableFastOpen && args.fast_open;
+        pcb->fast_open_syn_ack = false;
+        pcb->ecn_ok = EnableEcn;
+        pcb->ecn_ce_echo = false;
+        pcb->ecn_cwr_pending = false;
+        pcb->ecn_reduced = false;
+        pcb->dscp = args.dscp & Ip4DscpMask;
+        pcb->stats.reset();
+        
+        m_stats.inc(&TcpProtoStats::active_opens);
         
         // Add the PCB to the active index.
         m_pcb_index_active.addEntry({*pcb, *this}, *this);
@@ -762,28 +1565,126 @@ private:
         
         pcb->doDelayedTimerUpdate();
         
-        // Send the SYN.
-        Output::pcb_send_syn(pcb);
+        // NOTE: The SYN is sent by the caller (TcpConnection::startConnection)
+        // once the initial send buffer is set, since with Fast Open some data
+        // may be sent in the SYN.
         
         // Return the PCB.
         *out_pcb = pcb;
         return IpErr::Success;
     }
     
-    PortNum get_ephemeral_port (
-        Ip4Addr local_addr, Ip4Addr remote_addr, PortNum remote_port)
+    IpErr import_connection (Connection *con, TcpConnectionState const &state,
+                             TcpPcb **out_pcb)
     {
-        for ([[maybe_unused]] PortNum i : IntRange(NumEphemeralPorts)) {
-            PortNum port = m_next_ephemeral_port;
-            m_next_ephemeral_port = (port < EphemeralPortLast) ?
-                (port + 1) : EphemeralPortFirst;
-            
-            if (find_pcb({local_addr, remote_addr, port, remote_port}) == nullptr) {
-                return port;
-            }
+        AIPSTACK_ASSERT(con != nullptr);
+        AIPSTACK_ASSERT(con->mtu_ref().isSetup());
+        AIPSTACK_ASSERT(out_pcb != nullptr);
+        
+        // Determine the interface used to reach the remote address and check
+        // that the local address is an address of that interface.
+        IpIface<StackArg> *iface;
+        Ip4Addr iface_addr;
+        IpErr select_err = m_stack->selectLocalIp4Address(
+            state.remote_addr, iface, iface_addr);
+        if (select_err != IpErr::Success) {
+            return select_err;
+        }
+        if (!iface->ip4AddrIsLocalAddr(state.local_addr)) {
+            return IpErr::NonLocalSrc;
+        }
+        
+        // Check that the address tuple is not used by another connection.
+        TcpPcbKey key{state.local_addr, state.remote_addr,
+                      state.local_port, state.remote_port};
+        if (find_pcb(key) != nullptr ||
+            (UseTimeWaitTable && m_timewait_table.findEntry(key) != nullptr))
+        {
+            return IpErr::AddrInUse;
         }
         
-        return 0;
+        // The MSS is limited by the interface MTU, which may differ from
+        // that at the time of export.
+        std::uint16_t iface_mss = iface->getMtu() - Ip4TcpHeaderSize;
+        std::uint16_t base_snd_mss = MaxValue(Constants::MinAllowedMss,
+            MinValue(iface_mss, state.base_snd_mss));
+        
+        // Allocate the PCB.
+        TcpPcb *pcb = allocate_pcb();
+        if (pcb == nullptr) {
+            return IpErr::NoPcbAvailable;
+        }
+        
+        // Remove the PCB from the unreferenced PCBs list.
+        m_unrefed_pcbs_list.remove({*pcb, *this}, *this);
+        
+        // Initialize the PCB as if it had just completed the handshake. The
+        // send window is stuffed into snd_una and snd_nxt is the real snd_una,
+        // as expected by Input::pcb_complete_established_transition. All
+        // unacknowledged data will be sent again.
+        pcb->setState(TcpStates::ESTABLISHED);
+        pcb->flags = AsUnderlying(
+            (state.wnd_scale ? TcpPcbFlags::WndScale : TcpPcbFlags(0)) |
+            ((NumSackBlocks > 0 && state.sack_perm) ?
+                TcpPcbFlags::SackPerm : TcpPcbFlags(0)) |
+            ((UseTimestamps && state.timestamps) ?
+                TcpPcbFlags::Timestamps : TcpPcbFlags(0)));
+        pcb->con = con;
+        pcb->local_addr = state.local_addr;
+        pcb->remote_addr = state.remote_addr;
+        pcb->local_port = state.local_port;
+        pcb->remote_port = state.remote_port;
+        Output::pcb_init_pseudo_chksum(pcb);
+        pcb->rcv_nxt = state.rcv_nxt;
+        pcb->rcv_ann_wnd = MinValue(Constants::MaxWindow, state.rcv_ann_wnd);
+        pcb->snd_una = TcpSeqNum(MinValue(Constants::MaxWindow, state.snd_wnd));
+        pcb->snd_nxt = state.snd_una;
+        pcb->snd_mss = base_snd_mss; // updated from the PMTU by the caller
+        pcb->base_snd_mss = base_snd_mss;
+        pcb->ts_recent = state.ts_recent;
+        // The offset is relative to the plain clock, pcb_ts_clock would include
+        // the previous offset of the PCB.
+        pcb->ts_offset = 0;
+        pcb->ts_offset = state.ts_val - Output::pcb_ts_clock(pcb);
+        pcb->rto = Constants::InitialRtxTime;
+        pcb->num_dupack = 0;
+        pcb->snd_wnd_shift = state.wnd_scale ? MinValue(std::uint8_t(14), state.snd_wnd_shift) : 0;
+        pcb->rcv_wnd_shift = state.wnd_scale ? MinValue(std::uint8_t(14), state.rcv_wnd_shift) : 0;
+        pcb->fast_open = false;
+        pcb->fast_open_syn_ack = false;
+        pcb->ecn_ok = EnableEcn && state.ecn_ok;
+        pcb->ecn_ce_echo = false;
+        pcb->ecn_cwr_pending = false;
+        pcb->ecn_reduced = false;
+        pcb->dscp = state.dscp & Ip4DscpMask;
+        pcb->stats.reset();
+        
+        // The local port is now in use.
+        m_ephemeral_ports.reserve(state.local_port);
+        
+        // Add the PCB to the active index.
+        m_pcb_index_active.addEntry({*pcb, *this}, *this);
+        
+        // Return the PCB.
+        *out_pcb = pcb;
+        return IpErr::Success;
+    }
+    
+    PortNum get_ephemeral_port (
+        Ip4Addr local_addr, Ip4Addr remote_addr, PortNum remote_port)
+    {
+        return m_ephemeral_ports.allocate(
+            local_addr, remote_addr, remote_port, [&](PortNum port) {
+                // With flow steering, only use ports for which responses will
+                // arrive at this shard.
+                if (m_flow_steering != nullptr && !m_flow_steering->isOwnFlow(
+                        local_addr, remote_addr, port, remote_port)) {
+                    return false;
+                }
+                TcpPcbKey key{local_addr, remote_addr, port, remote_port};
+                return find_pcb(key) == nullptr &&
+                    (!UseTimeWaitTable || m_timewait_table.findEntry(key) == nullptr);
+            });
     }
     
     inline static bool pcb_is_in_unreferenced_list (TcpPcb *pcb)
@@ -796,7 +1697,7 @@ private:
     {
         AIPSTACK_ASSERT(pcb_is_in_unreferenced_list(pcb));
         
-        if (pcb != m_unrefed_pcbs_list.first(*this)) {
+        if (pcb != static_cast<TcpPcb *>(m_unrefed_pcbs_list.first(*this))) {
             m_unrefed_pcbs_list.remove({*pcb, *this}, *this);
             m_unrefed_pcbs_list.prepend({*pcb, *this}, *this);
         }
@@ -821,21 +1722,40 @@ private:
     
     // Find a listener by local address and port. This also considers listeners bound
     // to wildcard address since it is used to associate received segments with a listener.
-    Listener * find_listener_for_rx (Ip4Addr local_addr, PortNum local_port)
+    // A listener bound to the specific address takes precedence. If the listener is
+    // the head of a reuse-port group, a member of the group is selected based on the
+    // hash of the 4-tuple, so that all segments of a connection (including the ACK
+    // completing a SYN cookie handshake) go to the same member.
+    Listener * find_listener_for_rx (Ip4Addr local_addr, PortNum local_port,
+                                     Ip4Addr remote_addr, PortNum remote_port)
     {
-        for (Listener *lis = m_listeners_list.first();
-             lis != nullptr; lis = m_listeners_list.next(*lis))
-        {
-            AIPSTACK_ASSERT(lis->m_listening);
-            if (lis->m_port == local_port &&
-                (lis->m_addr == local_addr || lis->m_addr.isZero()))
-            {
-                return lis;
+        Listener *lis = find_listener(local_addr, local_port);
+        if (lis == nullptr && !local_addr.isZero()) {
+            lis = find_listener(Ip4Addr::ZeroAddr(), local_port);
+        }
+        if (lis != nullptr && AIPSTACK_UNLIKELY(lis->m_group_size > 1)) {
+            HashAccumulator hash;
+            hash.addWord(local_addr.value());
+            hash.addWord(remote_addr.value());
+            hash.addWord((std::uint32_t(local_port) << 16) | remote_port);
+            
+            std::uint32_t index = hash.getHash() % std::uint32_t(lis->m_group_size);
+            for (; index > 0; index--) {
+                lis = ListenerGroupList::next(*lis);
             }
         }
-        return nullptr;
+        return lis;
     }
     
+    // This is used by the listener index to obtain the keys of listeners.
+    // The key comparison functions are inherited from TcpListenerKeyCompare.
+    struct ListenerIndexKeyFuncs : public TcpListenerKeyCompare {
+        inline static TcpListenerKey GetKeyOfEntry (Listener const &lis)
+        {
+            return TcpListenerKey{lis.m_addr, lis.m_port};
+        }
+    };
+    
     // This is used by the two PCB indexes to obtain the keys
     // defining the ordering of the PCBs and compare keys.
     // The key comparison functions are inherited from TcpPcbKeyCompare.
@@ -847,62 +1767,207 @@ private:
         }
     };
     
+    // Link model state for array indices into the growable pool.
+    class PcbPoolLinkState {
+    public:
+        PcbPoolLinkState () = delete;
+        
+        inline PcbPoolLinkState (IpTcpProto &tcp) :
+            m_tcp(&tcp)
+        {}
+        
+        inline TcpPcb & getEntryAt (std::size_t index)
+        {
+            return m_tcp->m_pcbs.getEntryAt(index);
+        }
+        
+        inline std::size_t getEntryIndex (TcpPcb &pcb)
+        {
+            return pcb.pool_index;
+        }
+        
+    private:
+        IpTcpProto *m_tcp;
+    };
+    
     // Define the link model for data structures of PCBs.
     struct PcbArrayAccessor;
     struct PcbLinkModel : public std::conditional_t<LinkWithArrayIndices,
-        ArrayLinkModelWithAccessor<
-            TcpPcb, PcbIndexType, PcbIndexNull, IpTcpProto, PcbArrayAccessor>,
+        std::conditional_t<UsePcbPool,
+            ArrayLinkModel<TcpPcb, PcbIndexType, PcbIndexNull, PcbPoolLinkState>,
+            ArrayLinkModelWithAccessor<
+                TcpPcb, PcbIndexType, PcbIndexNull, IpTcpProto, PcbArrayAccessor>>,
         PointerLinkModel<TcpPcb>
     > {};
     AIPSTACK_USE_TYPES(PcbLinkModel, (Ref, State))
     
 private:
-    using ListenersList = LinkedList<
-        MemberAccessor<Listener, LinkedListNode<ListenerLinkModel>,
-                       &Listener::m_listeners_node>,
-        ListenerLinkModel, false>;
+    struct ListenerIndexAccessor : public MemberAccessor<
+        Listener, typename ListenerIndex::Node, &Listener::m_index_node> {};
+    
+    struct ListenerGroupAccessor : public MemberAccessor<
+        Listener, LinkedListNode<ListenerLinkModel>, &Listener::m_group_node> {};
+    
+    // Static array of PCBs. The PCBs are constructed in order of their indices as
+    // needed (when no closed PCB is available), so that construction of IpTcpProto
+    // does not have to touch the memory of all PCBs. The constructor arguments
+    // are only for compatibility with the growable pool.
+    struct StaticPcbArray : public LazyResourceArray<TcpPcb, NumTcpPcbs> {
+        inline StaticPcbArray (ResourceArrayInitSame, Platform, IpTcpProto *) {}
+    };
+    
+    // Storage of PCBs, a static array or the growable pool.
+    using PcbStorage = std::conditional_t<UsePcbPool,
+        TcpPcbPool<PlatformImpl, TcpPcb, IpTcpProto, MaxValue(1, PcbPoolChunkSize),
+                   NumPcbChunks>,
+        StaticPcbArray>;
     
     using UnrefedPcbsList = LinkedList<
         MemberAccessor<TcpPcb, LinkedListNode<PcbLinkModel>, &TcpPcb::unrefed_list_node>,
         PcbLinkModel, true>;
     
+    using PersistPcbsList = LinkedList<
+        MemberAccessor<TcpPcb, LinkedListNode<PcbLinkModel>, &TcpPcb::persist_list_node>,
+        PcbLinkModel, false>;
+    
+    using BatchPcbsList = LinkedList<
+        MemberAccessor<TcpPcb, LinkedListNode<PcbLinkModel>, &TcpPcb::batch_list_node>,
+        PcbLinkModel, true>;
+    
     IpStack<StackArg> *m_stack;
-    StructureRaiiWrapper<ListenersList> m_listeners_list;
+    StructureRaiiWrapper<typename ListenerIndex::Index> m_listener_index;
     TcpPcb *m_current_pcb;
     IpBufRef m_received_opts_buf;
+    IpRxTimestamp m_rx_time;
+    IpBufRef m_rcv_precopied_buf;
+    IpRxBuf *m_rcv_rx_buf;
     TcpOptions m_received_opts;
-    PortNum m_next_ephemeral_port;
+    IpEphemeralPortAllocator<EphemeralPortFirst, EphemeralPortLast, EphemeralPortBitmap>
+        m_ephemeral_ports;
+    IpFlowSteering const *m_flow_steering;
+    int m_num_syn_rcvd_pcbs;
+    std::size_t m_num_used_pcbs;
+    IpMemoryPeak<EnableStats> m_peak_used_pcbs;
+    IpMemoryPeak<EnableStats && UsePcbPool> m_peak_pcb_pool_bytes;
+    std::size_t m_num_keepalive_cons;
+    typename Platform::Timer m_keepalive_timer;
+    std::size_t m_num_persist_pcbs;
+    typename Platform::Timer m_persist_timer;
+    std::size_t m_rcv_mem_used;
+    bool m_rcv_mem_pressure;
+    bool m_rcv_mem_reported;
+    Function<void(bool pressure)> m_rcv_mem_pressure_handler;
+    typename Platform::Timer m_rcv_mem_timer;
+    std::uint32_t m_syn_cookie_secret;
+    std::uint32_t m_fast_open_secret;
     StructureRaiiWrapper<UnrefedPcbsList> m_unrefed_pcbs_list;
+    StructureRaiiWrapper<PersistPcbsList> m_persist_pcbs_list;
+    StructureRaiiWrapper<BatchPcbsList> m_batch_pcbs_list;
     StructureRaiiWrapper<typename PcbIndex::Index> m_pcb_index_active;
     StructureRaiiWrapper<typename PcbIndex::Index> m_pcb_index_timewait;
-    ResourceArray<TcpPcb, NumTcpPcbs> m_pcbs;
+    TimeWaitTable m_timewait_table;
+    FastOpenCache m_fast_open_cache;
+    TcpStatsCounters<EnableStats, TcpProtoStats> m_stats;
+    PcbTimerWheel m_pcb_timer_wheel;
+    PcbStorage m_pcbs;
     
     struct PcbArrayAccessor : public MemberAccessor<
-        IpTcpProto, ResourceArray<TcpPcb, NumTcpPcbs>, &IpTcpProto::m_pcbs> {};
+        IpTcpProto, PcbStorage, &IpTcpProto::m_pcbs> {};
 };
 
 struct IpTcpProtoOptions {
     AIPSTACK_OPTION_DECL_VALUE(TcpTTL, std::uint8_t, 64)
     AIPSTACK_OPTION_DECL_VALUE(NumTcpPcbs, int, 32)
-    AIPSTACK_OPTION_DECL_VALUE(NumOosSegs, std::uint8_t, 4)
+    AIPSTACK_OPTION_DECL_VALUE(NumOosSegs, std::uint16_t, 4)
+    AIPSTACK_OPTION_DECL_VALUE(OosBufferTree, bool, false)
     AIPSTACK_OPTION_DECL_VALUE(EphemeralPortFirst, std::uint16_t, 49152)
     AIPSTACK_OPTION_DECL_VALUE(EphemeralPortLast, std::uint16_t, 65535)
     AIPSTACK_OPTION_DECL_TYPE(PcbIndexService, void)
     AIPSTACK_OPTION_DECL_VALUE(LinkWithArrayIndices, bool, true)
+    AIPSTACK_OPTION_DECL_VALUE(MaxSuperSegmentData, std::size_t, 0)
+    AIPSTACK_OPTION_DECL_VALUE(NumSackBlocks, std::uint8_t, 4)
+    AIPSTACK_OPTION_DECL_VALUE(EnableTimestamps, bool, true)
+    AIPSTACK_OPTION_DECL_TYPE(CongCtrlService, TcpCongCtrlRenoService)
+    AIPSTACK_OPTION_DECL_VALUE(EnablePacing, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(PacingBurstSegs, std::uint8_t, 4)
+    AIPSTACK_OPTION_DECL_VALUE(EnableDelayedAck, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(DelayedAckTimeoutMs, std::uint16_t, 40)
+    AIPSTACK_OPTION_DECL_VALUE(QuickAckSegs, std::uint8_t, 8)
+    AIPSTACK_OPTION_DECL_VALUE(EnableSynCookies, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(SynCookiePcbPercent, std::uint8_t, 50)
+    AIPSTACK_OPTION_DECL_VALUE(NumTimeWaitEntries, int, 0)
+    AIPSTACK_OPTION_DECL_VALUE(RcvBufAutoTuning, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(EnableStats, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(EnableFastOpen, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(NumFastOpenCacheEntries, int, 8)
+    AIPSTACK_OPTION_DECL_VALUE(EnableRackTlp, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(PcbTimerWheelSlots, std::size_t, 0)
+    AIPSTACK_OPTION_DECL_VALUE(PcbPoolChunkSize, int, 0)
+    AIPSTACK_OPTION_DECL_VALUE(EnableEcn, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(EcnDctcp, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(EnablePmtuProbing, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(EphemeralPortBitmap, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(EnableKeepalive, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(SharedPersistTimer, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(CoalesceDataCallbacks, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(RcvMemBudget, std::size_t, 0)
+    AIPSTACK_OPTION_DECL_VALUE(RcvMemPressurePercent, std::uint8_t, 75)
+    AIPSTACK_OPTION_DECL_VALUE(HighResRtt, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(MinRtxTimeUs, std::uint32_t, 250000)
+    AIPSTACK_OPTION_DECL_VALUE(InitialRtxTimeUs, std::uint32_t, 1000000)
+    AIPSTACK_OPTION_DECL_VALUE(TimeWaitTimeMs, std::uint32_t, 120000)
+    AIPSTACK_OPTION_DECL_VALUE(EnablePrr, bool, false)
+    AIPSTACK_OPTION_DECL_TYPE(StaticConnectionClass, void)
 };
 
 template<typename ...Options>
 class IpTcpProtoService {
     template<typename> friend class IpTcpProto;
+    template<typename> friend class IpTcpProto_constants;
     template<typename> friend class TcpConnection;
     
     AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, TcpTTL)
     AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, NumTcpPcbs)
     AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, NumOosSegs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, OosBufferTree)
     AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EphemeralPortFirst)
     AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EphemeralPortLast)
     AIPSTACK_OPTION_CONFIG_TYPE(IpTcpProtoOptions, PcbIndexService)
     AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, LinkWithArrayIndices)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, MaxSuperSegmentData)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, NumSackBlocks)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableTimestamps)
+    AIPSTACK_OPTION_CONFIG_TYPE(IpTcpProtoOptions, CongCtrlService)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnablePacing)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, PacingBurstSegs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableDelayedAck)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, DelayedAckTimeoutMs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, QuickAckSegs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableSynCookies)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, SynCookiePcbPercent)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, NumTimeWaitEntries)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, RcvBufAutoTuning)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableStats)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableFastOpen)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, NumFastOpenCacheEntries)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableRackTlp)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, PcbTimerWheelSlots)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, PcbPoolChunkSize)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableEcn)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EcnDctcp)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnablePmtuProbing)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EphemeralPortBitmap)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnableKeepalive)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, SharedPersistTimer)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, CoalesceDataCallbacks)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, RcvMemBudget)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, RcvMemPressurePercent)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, HighResRtt)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, MinRtxTimeUs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, InitialRtxTimeUs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, TimeWaitTimeMs)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpTcpProtoOptions, EnablePrr)
+    AIPSTACK_OPTION_CONFIG_TYPE(IpTcpProtoOptions, StaticConnectionClass)
     
 public:
     // This tells IpStack which IP protocol we receive packets for.
@@ -25,7 +25,9 @@
 #ifndef AIPSTACK_IP_TCP_PROTO_CONSTANTS_H
 #define AIPSTACK_IP_TCP_PROTO_CONSTANTS_H
 
+#include <cstddef>
 #include <cstdint>
+#include <type_traits>
 
 #include <aipstack/meta/BitsInInt.h>
 #include <aipstack/meta/BitsInFloat.h>
@@ -42,6 +44,8 @@ namespace AIpStack {
 template<typename Arg>
 class IpTcpProto_constants
 {
+    AIPSTACK_USE_VALS(Arg::Params, (HighResRtt, MinRtxTimeUs, InitialRtxTimeUs,
+                                    TimeWaitTimeMs))
     AIPSTACK_USE_TYPES(Arg, (PlatformImpl, StackArg))
 
     using Platform = PlatformFacade<PlatformImpl>;
@@ -51,21 +55,58 @@ class IpTcpProto_constants
     static_assert(IpStack<StackArg>::MinMTU >= Ip4TcpHeaderSize + 32);
     
 public:
-    // For retransmission time calculations we right-shift the TimeType
-    // to obtain granularity between 1ms and 2ms.
-    inline static constexpr int RttShift = BitsInFloat(1e-3 * Platform::TimeFreq);
-    static_assert(RttShift >= 0);
-
+    // For the timestamps option we right-shift the TimeType to obtain
+    // granularity between 1ms and 2ms. The PCB timer wheel uses the same ticks.
+    inline static constexpr int TsClockShift = BitsInFloat(1e-3 * Platform::TimeFreq);
+    static_assert(TsClockShift >= 0);
+    
+    // The resulting frequency of such right-shifted time.
+    inline static constexpr double TsClockFreq =
+        Platform::TimeFreq / PowerOfTwo<double>(TsClockShift);
+    
+    // Mask for differences of the timestamp clock truncated to 32 bits, which
+    // has fewer bits if the platform time has fewer bits.
+    inline static constexpr std::uint32_t TsClockMask =
+        (Platform::TimeBits - TsClockShift >= 32) ? TypeMax<std::uint32_t> :
+        std::uint32_t((std::uint64_t(1) << (Platform::TimeBits - TsClockShift)) - 1);
+    
+    // The timestamps option uses the timestamp clock truncated to 32 bits,
+    // which is only correct if the clock has at least 32 bits. The frequency
+    // of 500-1000 Hz satisfies the RFC 7323 requirement of 1 Hz to 1 kHz.
+    inline static constexpr bool TimestampClockOk = TsClockMask == TypeMax<std::uint32_t>;
+    
+    // For retransmission time calculations we right-shift the TimeType to
+    // obtain granularity between 1ms and 2ms, or with HighResRtt between 1us
+    // and 2us (or the platform time unit if that is coarser).
+    inline static constexpr int RttShift = !HighResRtt ? TsClockShift :
+        MaxValue(0, BitsInFloat(1e-6 * Platform::TimeFreq));
+    
     // The resulting frequency of such right-shifted time.
     inline static constexpr double RttTimeFreq =
         Platform::TimeFreq / PowerOfTwo<double>(RttShift);
     
-    // We store such scaled times in 16-bit variables. This gives us a range of at least 65
-    // seconds.
-    using RttType = std::uint16_t;
+    // We store such scaled times in 16-bit variables, giving a range of at
+    // least 65 seconds, or with HighResRtt in 32-bit variables, giving a range
+    // of at least 4294 seconds.
+    using RttType = std::conditional_t<HighResRtt, std::uint32_t, std::uint16_t>;
     
     // For intermediate RTT results we need a larger type.
-    using RttNextType = std::uint32_t;
+    using RttNextType = std::conditional_t<HighResRtt, std::uint64_t, std::uint32_t>;
+    
+    // Congestion control and pacing use a finer clock than RTT measurement,
+    // about 64 times faster, so that short intervals can be measured.
+    inline static constexpr int CcClockShift = MaxValue(0, RttShift - 6);
+    inline static constexpr double CcClockFreq =
+        Platform::TimeFreq / PowerOfTwo<double>(CcClockShift);
+    
+    // Mask for differences of the congestion control clock truncated to 32 bits.
+    inline static constexpr std::uint32_t CcClockMask =
+        (Platform::TimeBits - CcClockShift >= 32) ? TypeMax<std::uint32_t> :
+        std::uint32_t((std::uint64_t(1) << (Platform::TimeBits - CcClockShift)) - 1);
+    
+    // Received timestamps are not checked against TS.Recent (PAWS) if it
+    // has not been updated for this long (RFC 7323 section 5.5).
+    inline static constexpr std::uint32_t PawsIdleTime = 24.0 * 86400.0 * TsClockFreq;
 
     // Don't allow the remote host to lower the MSS beyond this.
     // NOTE: pcb_calc_snd_mss_from_pmtu relies on this definition.
@@ -92,7 +133,8 @@ public:
     inline static constexpr TimeType SynSentTimeoutTicks     = 30.0  * Platform::TimeFreq;
     
     // TIME_WAIT state timeout.
-    inline static constexpr TimeType TimeWaitTimeTicks       = 120.0 * Platform::TimeFreq;
+    inline static constexpr TimeType TimeWaitTimeTicks       =
+        (TimeWaitTimeMs / 1000.0) * Platform::TimeFreq;
     
     // Timeout to abort connection after it has been abandoned.
     inline static constexpr TimeType AbandonedTimeoutTicks   = 30.0  * Platform::TimeFreq;
@@ -106,16 +148,38 @@ public:
     // Time to retry after sending failed with error other then IpErr::OutputBufferFull.
     inline static constexpr TimeType OutputRetryOtherTicks   = 2.0 * Platform::TimeFreq;
     
-    // Initial retransmission time, before any round-trip-time measurement.
-    inline static constexpr RttType InitialRtxTime           = 1.0 * RttTimeFreq;
+    // For the SYN cookie time counter we right-shift the TimeType to obtain
+    // a period between 16 and 32 seconds, and truncate it to 32 bits.
+    inline static constexpr int SynCookieCounterShift =
+        BitsInFloat(16.0 * Platform::TimeFreq);
+    inline static constexpr std::uint32_t SynCookieCounterMask =
+        (Platform::TimeBits - SynCookieCounterShift >= 32) ? TypeMax<std::uint32_t> :
+        std::uint32_t(
+            (std::uint64_t(1) << (Platform::TimeBits - SynCookieCounterShift)) - 1);
     
-    // Minimum retransmission time.
-    inline static constexpr RttType MinRtxTime               = 0.25 * RttTimeFreq;
+    // Maximum delay between segments due to pacing.
+    inline static constexpr TimeType MaxPaceDelayTicks       = 1.0 * Platform::TimeFreq;
     
     // Maximum retransmission time (need care not to overflow RttType).
     inline static constexpr RttType MaxRtxTime =
         MinValue(double(TypeMax<RttType>), 60. * RttTimeFreq);
     
+    // Initial retransmission time, before any round-trip-time measurement.
+    inline static constexpr RttType InitialRtxTime =
+        MinValue(double(MaxRtxTime), (InitialRtxTimeUs / 1e6) * RttTimeFreq);
+    
+    // Minimum retransmission time, at least one RTT unit.
+    inline static constexpr RttType MinRtxTime = MaxValue(1.0,
+        MinValue(double(MaxRtxTime), (MinRtxTimeUs / 1e6) * RttTimeFreq));
+    static_assert(MinRtxTime <= InitialRtxTime);
+    
+    // Minimum tail loss probe timeout (RFC 8985 section 7.2).
+    inline static constexpr RttType MinTlpTime               = 0.01 * RttTimeFreq;
+    
+    // Allowance for a delayed ACK in the tail loss probe timeout when only
+    // one segment is in flight (WCDelAckT in RFC 8985).
+    inline static constexpr RttType TlpDelAckTime            = 0.2 * RttTimeFreq;
+    
     // Number of duplicate ACKs to trigger fast retransmit/recovery.
     inline static constexpr std::uint8_t FastRtxDupAcks = 3;
     
@@ -126,9 +190,58 @@ public:
     inline static constexpr int DupAckBits =
         BitsInInt<FastRtxDupAcks + MaxAdditionaDupAcks>;
     
-    // Window scale shift count to send and use in outgoing ACKs.
-    inline static constexpr std::uint8_t RcvWndShift = 6;
-    static_assert(RcvWndShift <= 14);
+    // DCTCP congestion estimate (alpha) is a fraction with this many bits,
+    // and is updated with gain 1/2^DctcpGainShift (RFC 8257 section 3.3).
+    inline static constexpr int DctcpAlphaBits = 10;
+    inline static constexpr int DctcpGainShift = 4;
+    
+    // Path MTU probing (RFC 4821): minimum MTU increase worth probing for,
+    // time to wait after a failed probe, and time after the search completed
+    // to probe again for a larger PMTU.
+    inline static constexpr std::uint16_t PmtuProbeMinStep   = 32;
+    inline static constexpr TimeType PmtuProbeRetryTicks     = 5.0 * Platform::TimeFreq;
+    inline static constexpr TimeType PmtuProbeRaiseTicks     = 60.0 * Platform::TimeFreq;
+    
+    // PMTU assumed when a black hole is detected by repeated retransmission
+    // timeouts (only with path MTU probing).
+    inline static constexpr std::uint16_t PmtuBlackHoleMtu   = 1280;
+    
+    // Period of the sweep over PCBs for keepalive, which is also the unit
+    // of keepalive times.
+    inline static constexpr TimeType KeepaliveSweepTicks     = 1.0 * Platform::TimeFreq;
+    
+    // Period of the shared persist timer, which is also the unit of window
+    // probe intervals, and the maximum window probe interval in persist ticks
+    // (only with the shared persist timer).
+    inline static constexpr TimeType PersistTickTicks        = 0.2 * Platform::TimeFreq;
+    inline static constexpr std::uint16_t MaxPersistTicks    = 300;
+    
+    // Maximum window scale shift count (RFC 7323 section 2.3).
+    inline static constexpr std::uint8_t MaxRcvWndShift = 14;
+    
+    // Window scale shift count to send and use in outgoing ACKs, when the
+    // maximum receive buffer of the connection is not known. This allows
+    // windows of up to about 4 MiB with 64-byte granularity.
+    inline static constexpr std::uint8_t DefaultRcvWndShift = 6;
+    static_assert(DefaultRcvWndShift <= MaxRcvWndShift);
+    
+    // Choose the window scale shift count for a connection whose receive
+    // buffer may grow to max_rcv_buf bytes: the smallest one which allows
+    // announcing that much, so that smaller windows keep a finer granularity.
+    // Zero means that the maximum is not known.
+    inline static constexpr std::uint8_t RcvWndShiftForBuffer (std::size_t max_rcv_buf)
+    {
+        if (max_rcv_buf == 0) {
+            return DefaultRcvWndShift;
+        }
+        std::uint8_t shift = 0;
+        while (shift < MaxRcvWndShift &&
+               (std::size_t(TypeMax<std::uint16_t>) << shift) < max_rcv_buf)
+        {
+            shift++;
+        }
+        return shift;
+    }
     
     // Minimum amount to extend the receive window when a PCB is
     // abandoned before the FIN has been received.
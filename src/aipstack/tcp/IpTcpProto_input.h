@@ -48,6 +48,8 @@
 #include <aipstack/tcp/TcpSeqNum.h>
 #include <aipstack/tcp/TcpPcbFlags.h>
 #include <aipstack/tcp/TcpOptions.h>
+#include <aipstack/tcp/TcpSynCookie.h>
+#include <aipstack/tcp/TcpFastOpenCookie.h>
 
 namespace AIpStack {
 
@@ -61,43 +63,41 @@ class IpTcpProto_input
     using TcpProto = IpTcpProto<Arg>;
     
     AIPSTACK_USE_TYPES(TcpProto, (Listener, Connection, TcpPcb, Output, Constants,
-                                  AbrtTimer, RtxTimer, OutputTimer, StackArg))
+                                  AbrtTimer, RtxTimer, OutputTimer, PaceTimer,
+                                  DelAckTimer, LossTimer, StackArg, Platform, TimeType,
+                                  TimeWaitEntry))
     AIPSTACK_USE_VALS(TcpProto, (pcb_aborted_in_callback))
     
+    // Delayed ACK timeout.
+    inline static constexpr TimeType DelayedAckTicks =
+        (TcpProto::DelayedAckTimeoutMs / 1000.0) * Platform::TimeFreq;
+
 public:
     static void recvIp4Dgram (TcpProto *tcp, IpRxInfoIp4<StackArg> const &ip_info,
                               IpBufRef dgram)
     {
         // The destination address must be the address of the incoming interface.
         if (AIPSTACK_UNLIKELY(!ip_info.iface->ip4AddrIsLocalAddr(ip_info.dst_addr))) {
-            return;
+            return tcp->m_stack->traceDrop(IpDropReason::BadDstAddr, ip_info.iface, dgram);
         }
         
         // Check header size, must fit in first buffer.
         if (AIPSTACK_UNLIKELY(!dgram.hasHeader(Tcp4Header::Size))) {
-            return;
+            return tcp->m_stack->traceDrop(
+                IpDropReason::TcpHeaderInvalid, ip_info.iface, dgram);
         }
         
         TcpSegMeta tcp_meta;
         
         // Read header fields.
-        auto tcp_header = Tcp4Header::MakeRef(dgram.getChunkPtr());
+        auto tcp_header = Tcp4Header::Decode(dgram.getChunkPtr());
         tcp_meta.remote_port = tcp_header.get(Tcp4Header::SrcPort());
         tcp_meta.local_port  = tcp_header.get(Tcp4Header::DstPort());
         tcp_meta.seq_num     = tcp_header.get(Tcp4Header::SeqNum());
         tcp_meta.ack_num     = tcp_header.get(Tcp4Header::AckNum());
         tcp_meta.flags       = tcp_header.get(Tcp4Header::OffsetFlags());
         tcp_meta.window_size = tcp_header.get(Tcp4Header::WindowSize());
-        
-        // Check TCP checksum.
-        IpChksumAccumulator chksum_accum;
-        chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.src_addr.value());
-        chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.dst_addr.value());
-        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Tcp));
-        chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
-        if (AIPSTACK_UNLIKELY(chksum_accum.getChksum(dgram) != 0)) {
-            return;
-        }
+        tcp_meta.ecn_ce      = (ip_info.tos & Ip4EcnMask) == Ip4EcnCe;
         
         // Get a buffer reference starting at the option data.
         IpBufRef tcp_data = dgram.hideHeader(Tcp4Header::Size);
@@ -112,23 +112,78 @@ public:
         // The former bound is checked indirectly since opts_len would have
         // wrapped around.
         if (AIPSTACK_UNLIKELY(opts_len > tcp_data.tot_len)) {
-            return;
+            return tcp->m_stack->traceDrop(
+                IpDropReason::TcpHeaderInvalid, ip_info.iface, dgram);
         }
         
         // Remember the options region and skip over the options.
         // The options will only be parsed when they are needed,
         // using parse_received_opts.
         tcp->m_received_opts_buf = tcp_data.subTo(opts_len);
+        tcp->m_rx_time = ip_info.rx_time;
         tcp_data = ipBufSkipBytes(tcp_data, opts_len);
         
-        // Try to handle using a PCB.
+        // Look up the PCB. This is done before verifying the checksum so that the
+        // data of an in-sequence segment can be copied into the receive buffer while
+        // calculating the checksum.
         TcpPcb *pcb = tcp->find_pcb({ip_info.dst_addr, ip_info.src_addr,
                                      tcp_meta.local_port, tcp_meta.remote_port});
+        
+        // Check TCP checksum, unless it has been verified by hardware.
+        IpChksumAccumulator chksum_accum;
+        chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.src_addr.value());
+        chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.dst_addr.value());
+        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Tcp));
+        chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
+        
+        tcp->m_rcv_precopied_buf = IpBufRef{};
+        tcp->m_rcv_rx_buf = ip_info.rx_buf;
+        
+        if ((ip_info.chksum_verified & IpChksumOffloadFlags::Tcp4) != Enum0) {
+            // Nothing to do, the data will be copied in pcb_input_rcv_processing.
+        }
+        else if (pcb != nullptr && pcb_can_precopy_data(pcb, tcp_meta, tcp_data)) {
+            // Copy the data into the receive buffer in the same pass as checksumming.
+            // The header with options has even length as required. If the checksum
+            // is bad or the data is not accepted, the copy is harmless since this only
+            // writes into free receive buffer space where nothing is buffered.
+            IpBufRef rcv_buf = pcb->con->m_v.rcv_buf;
+            IpChksumAccumulator data_accum(
+                ipBufCopyAndChksum(rcv_buf, tcp_data, chksum_accum.getState()));
+            if (AIPSTACK_UNLIKELY(data_accum.getChksum(dgram.subTo(data_offset)) != 0)) {
+                tcp->m_stats.inc(&TcpProtoStats::bad_chksum);
+                return tcp->m_stack->traceDrop(
+                    IpDropReason::TcpChksumBad, ip_info.iface, dgram);
+            }
+            
+            // Remember where the data was copied so the copy can be skipped later.
+            tcp->m_rcv_precopied_buf = rcv_buf.subTo(tcp_data.tot_len);
+        } else {
+            if (AIPSTACK_UNLIKELY(chksum_accum.getChksum(dgram) != 0)) {
+                tcp->m_stats.inc(&TcpProtoStats::bad_chksum);
+                return tcp->m_stack->traceDrop(
+                    IpDropReason::TcpChksumBad, ip_info.iface, dgram);
+            }
+        }
+        
+        tcp->m_stats.inc(&TcpProtoStats::segs_received);
+        
+        // Try to handle using a PCB.
         if (AIPSTACK_LIKELY(pcb != nullptr)) {
             pcb_input(tcp, pcb, tcp_meta, tcp_data);
             return;
         }
         
+        // Try to handle using a TIME_WAIT entry.
+        if (TcpProto::UseTimeWaitTable) {
+            TimeWaitEntry *tw_entry = tcp->m_timewait_table.findEntry(
+                {ip_info.dst_addr, ip_info.src_addr,
+                 tcp_meta.local_port, tcp_meta.remote_port});
+            if (tw_entry != nullptr) {
+                return time_wait_input(tcp, *tw_entry, tcp_meta);
+            }
+        }
+        
         // Sanity check source address - reject broadcast addresses.
         // We do this after looking up the PCB for performance, since
         // the PCBs already have sanity checked addresses. There is a
@@ -136,21 +191,51 @@ public:
         // a different subnet broadcast address but we prefer speed to
         // completeness of this check.
         if (AIPSTACK_UNLIKELY(!IpStack<StackArg>::checkUnicastSrcAddr(ip_info))) {
-            return;
+            return tcp->m_stack->traceDrop(IpDropReason::BadSrcAddr, ip_info.iface, dgram);
         }
         
         // Try to handle using a listener.
-        Listener *lis = tcp->find_listener_for_rx(ip_info.dst_addr, tcp_meta.local_port);
+        Listener *lis = tcp->find_listener_for_rx(
+            ip_info.dst_addr, tcp_meta.local_port, ip_info.src_addr, tcp_meta.remote_port);
         if (lis != nullptr) {
-            return listen_input(lis, ip_info, tcp_meta, tcp_data.tot_len);
+            return listen_input(lis, ip_info, tcp_meta, tcp_data);
         }
         
+        tcp->m_stack->traceDrop(IpDropReason::TcpNoPcb, ip_info.iface, dgram);
+        
         // Reply with RST, unless this is an RST.
         if ((tcp_meta.flags & Tcp4Flags::Rst) == Enum0) {
             Output::send_rst_reply(tcp, ip_info, tcp_meta, tcp_data.tot_len);
         }
     }
     
+    // Check if the data of a received segment can be copied into the receive buffer
+    // before the segment is processed (see recvIp4Dgram). This is only for the common
+    // case of an in-sequence segment when nothing is buffered out-of-sequence, as in
+    // the fast path of pcb_input_rcv_processing.
+    inline static bool pcb_can_precopy_data (
+        TcpPcb *pcb, TcpSegMeta const &tcp_meta, IpBufRef tcp_data)
+    {
+        Connection *con = pcb->con;
+        
+        return con != nullptr &&
+            pcb->state().isAcceptingData() &&
+            tcp_data.tot_len > 0 &&
+            (tcp_meta.flags & (Tcp4Flags::Syn|Tcp4Flags::Rst)) == Enum0 &&
+            tcp_meta.seq_num == pcb->rcv_nxt &&
+            con->m_v.ooseq.isNothingBuffered() &&
+            tcp_data.tot_len <= con->m_v.rcv_buf.tot_len &&
+            !pcb_can_zero_copy(pcb);
+    }
+    
+    // Check if in-sequence data can be given to the application without copying
+    // (see TcpConnection::setRecvZeroCopy).
+    inline static bool pcb_can_zero_copy (TcpPcb *pcb)
+    {
+        return AIPSTACK_UNLIKELY(pcb->con->m_v.rcv_zero_copy) &&
+            pcb->tcp->m_rcv_rx_buf != nullptr;
+    }
+    
     static void handleIp4DestUnreach (
         TcpProto *tcp, Ip4DestUnreachMeta const &du_meta,
         IpRxInfoIp4<StackArg> const &ip_info, IpBufRef dgram_initial)
@@ -246,6 +331,7 @@ public:
                 TcpSeqInt ann_wnd = pcb_calc_wnd_update(pcb);
                 if (ann_wnd > pcb->rcv_ann_wnd) {
                     pcb->rcv_ann_wnd = ann_wnd;
+                    TcpProto::pcb_rcv_mem_update(pcb);
                 }
             }
         }
@@ -283,6 +369,7 @@ public:
                 // in rcv_ann_wnd.
                 pcb->rcv_ann_wnd = ann_wnd;
                 pcb->clearFlag(TcpPcbFlags::RcvWndUpd);
+                TcpProto::pcb_rcv_mem_update(pcb);
                 
                 // Force an ACK.
                 Output::pcb_need_ack(pcb);
@@ -296,6 +383,64 @@ public:
         }
     }
     
+    // Receive buffer auto-tuning, similar to dynamic right-sizing in Linux.
+    // The amount of in-sequence data received is measured over periods of
+    // at least SRTT. If the application could have received more data than
+    // half of the receive buffer within one period, the application is asked
+    // to grow the receive buffer to twice that amount, but not beyond the
+    // configured maximum or the maximum window that can be announced. The
+    // application then extends the receive buffer, which results in a window
+    // update via pcb_rcv_buf_extended.
+    static bool pcb_rcv_buf_autotune (TcpPcb *pcb, std::size_t rcv_datalen)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        Connection *con = pcb->con;
+        
+        // The period length is based on SRTT, so nothing can be done without it.
+        if (!pcb->hasFlag(TcpPcbFlags::RttValid)) {
+            return true;
+        }
+        
+        // Start a new measurement period if not in one.
+        TimeType now = pcb->platform().getEventTime();
+        if (con->m_v.rcv_tune_bytes == 0) {
+            con->m_v.rcv_tune_time = now;
+        }
+        
+        // Count the received data.
+        con->m_v.rcv_tune_bytes +=
+            MinValue(rcv_datalen, TypeMax<std::size_t> - con->m_v.rcv_tune_bytes);
+        
+        // Check if the measurement period has ended.
+        TimeType period_end = con->m_v.rcv_tune_time +
+            (TimeType(con->m_v.srtt) << Constants::RttShift);
+        if (!Platform::timeGreaterOrEqual(now, period_end)) {
+            return true;
+        }
+        
+        std::size_t measured = con->m_v.rcv_tune_bytes;
+        con->m_v.rcv_tune_bytes = 0;
+        
+        // Calculate the desired buffer size, twice the measured amount.
+        std::size_t max_size = MinValueU(con->m_v.rcv_tune_max, max_rcv_wnd_ann(pcb));
+        std::size_t new_size = (measured > max_size / 2) ? max_size : (2 * measured);
+        
+        // Nothing to do if the buffer is already large enough.
+        if (new_size <= con->m_v.rcv_tune_size) {
+            return true;
+        }
+        
+        // Growing is suspended under receive memory pressure (RcvMemBudget).
+        if (TcpProto::RcvMemBudget > 0 && pcb->tcp->m_rcv_mem_pressure) {
+            return true;
+        }
+        
+        // Ask the application to grow the buffer.
+        con->rcv_buf_grow_requested(new_size);
+        return !pcb_aborted_in_callback(pcb);
+    }
+    
     static void pcb_update_rcv_wnd_after_abandoned (TcpPcb *pcb, TcpSeqInt rcv_ann_thres)
     {
         AIPSTACK_ASSERT(pcb->state().isAcceptingData());
@@ -345,6 +490,9 @@ public:
         // pcb_input_syn_sent_rcvd_processing because it must imply pcb->con != nullptr.
         pcb->setFlag(TcpPcbFlags::RcvWndUpd);
         
+        // Account the current window in the receive memory budget.
+        TcpProto::pcb_rcv_mem_update(pcb);
+        
         // Update snd_mss now that we have an updated base_snd_mss (SYN_SENT) or
         // the mss_ref has been setup (SYN_RCVD).
         pcb->snd_mss = Output::pcb_calc_snd_mss_from_pmtu(pcb, pmtu);
@@ -360,16 +508,85 @@ public:
         con->m_v.cwnd = CalcInitialTcpCwnd(pcb->snd_mss);
         pcb->setFlag(TcpPcbFlags::CwndInit);
         con->m_v.ssthresh = Constants::MaxWindow;
-        con->m_v.cwnd_acked = 0;
+        con->m_v.cc.init(Output::pcb_cc_context(pcb));
+        
+        // Allow sending a burst right away when pacing.
+        if (TcpProto::EnablePacing) {
+            con->m_v.pace_time = pcb->platform().getTime();
+        }
+        
+        // No tail loss probe has been sent and the LossTimer is not set.
+        if (TcpProto::UseRackTlp) {
+            con->m_v.tlp_active = false;
+            con->m_v.rack_reo_timer = false;
+        }
+        
+        // Start the first DCTCP observation window, assuming no congestion.
+        if (TcpProto::UseDctcp) {
+            con->m_v.dctcp_alpha = 0;
+            con->m_v.dctcp_wnd_end = pcb->snd_nxt;
+            con->m_v.dctcp_acked = 0;
+            con->m_v.dctcp_ce_acked = 0;
+        }
+        
+        // Allow probing for a larger PMTU right away.
+        if (TcpProto::EnablePmtuProbing) {
+            con->m_v.pmtu_probe_time = pcb->platform().getEventTime();
+            con->m_v.pmtu_probe_mtu = 0;
+            con->m_v.pmtu_search_high = TypeMax<std::uint16_t>;
+        }
+        
+        // Start tracking the age of TS.Recent.
+        if (TcpProto::UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+            con->m_v.ts_recent_time = Output::pcb_ts_clock(pcb);
+        }
+        
+        // Acknowledge the first segments of data right away (quick-ack).
+        if (TcpProto::EnableDelayedAck) {
+            con->m_v.quick_acks = TcpProto::QuickAckSegs;
+            con->m_v.rcv_data_time = pcb->platform().getEventTime();
+        }
+    }
+    
+    // Deliver the dataSent/dataReceived callbacks accumulated during a receive
+    // batch (CoalesceDataCallbacks), called at the end of the batch. This is
+    // done as if in input processing, so that data queued by the application
+    // from the callbacks is sent right away along with any pending ACK.
+    static void pcb_batch_data_input (TcpPcb *pcb)
+    {
+        TcpProto *tcp = pcb->tcp;
+        AIPSTACK_ASSERT(tcp->m_current_pcb == nullptr);
+        AIPSTACK_ASSERT(!tcp->m_stack->isInRecvBatch());
+        
+        tcp->m_current_pcb = pcb;
+        
+        if (pcb_deliver_batch_data(pcb)) {
+            pcb_input_output(pcb);
+        }
+        
+        if (AIPSTACK_LIKELY(tcp->m_current_pcb != nullptr)) {
+            tcp->m_current_pcb->doDelayedTimerUpdate();
+            tcp->m_current_pcb = nullptr;
+        }
     }
     
 private:
     static void listen_input (Listener *lis, IpRxInfoIp4<StackArg> const &ip_info,
-                              TcpSegMeta const &tcp_meta, std::size_t tcp_data_len)
+                              TcpSegMeta const &tcp_meta, IpBufRef tcp_data)
     {
         do {
             // For a new connection we expect SYN flag and no FIN, RST, ACK.
             if ((tcp_meta.flags & Tcp4Flags::BasicFlags) != Tcp4Flags::Syn) {
+                // With SYN cookies, this may be the ACK to a SYN-ACK that was sent
+                // without creating a PCB.
+                if (TcpProto::EnableSynCookies &&
+                    (tcp_meta.flags & (Tcp4Flags::Rst|Tcp4Flags::Syn|Tcp4Flags::Ack)) ==
+                        Tcp4Flags::Ack &&
+                    listen_cookie_ack_input(lis, ip_info, tcp_meta, tcp_data))
+                {
+                    return;
+                }
+                
                 // If the segment has no RST and has ACK, reply with RST; otherwise drop.
                 // This includes dropping SYN+FIN packets though RFC 793 does not say this
                 // should be done.
@@ -379,89 +596,61 @@ private:
                 return;
             }
             
+            TcpProto *tcp = lis->m_tcp;
+            
+            lis->m_stats.inc(&TcpListenerStats::syns_received);
+            
             // Check maximum number of PCBs for this listener.
-            if (lis->m_num_pcbs >= lis->m_max_pcbs) {
+            bool backlog_full = lis->m_num_pcbs >= lis->m_max_pcbs;
+            
+            // Answer with a SYN cookie instead of creating a PCB if the backlog is
+            // full or too many PCBs are used for SYN_RCVD.
+            if (TcpProto::EnableSynCookies && (backlog_full || syn_cookies_needed(tcp))) {
+                if (!listen_send_syn_cookie(lis, ip_info, tcp_meta)) {
+                    goto refuse;
+                }
+                lis->m_stats.inc(&TcpListenerStats::syn_cookies_sent);
+                return;
+            }
+            
+            if (backlog_full) {
+                lis->m_stats.inc(&TcpListenerStats::syns_refused_backlog);
                 goto refuse;
             }
             
             // Calculate the MSS based on the interface MTU.
             std::uint16_t iface_mss = ip_info.iface->getMtu() - Ip4TcpHeaderSize;
             
-            TcpProto *tcp = lis->m_tcp;
-            
             // Make sure received options are parsed.
             parse_received_opts(tcp);
             
-            // Calculate the base_snd_mss.
-            std::uint16_t base_snd_mss;
-            if (!CalcTcpSndMss<Constants::MinAllowedMss>(
-                    iface_mss, tcp->m_received_opts, &base_snd_mss))
-            {
-                goto refuse;
-            }
-            
-            // Allocate a PCB.
-            TcpPcb *pcb = tcp->allocate_pcb();
+            // Create a PCB in SYN_RCVD state.
+            TcpPcb *pcb = listen_create_pcb(lis, ip_info, tcp_meta, tcp->make_iss(),
+                tcp_meta.seq_num + 1u, iface_mss, tcp->m_received_opts);
             if (pcb == nullptr) {
                 goto refuse;
             }
             
-            // Generate an initial sequence number.
-            TcpSeqNum iss = tcp->make_iss();
-            
-            // Initially advertised receive window, at most 16-bit wide since
-            // SYN-ACK segments have unscaled window.
-            // NOTE: rcv_ann_wnd fits into size_t as required since m_initial_rcv_wnd
-            // also does (Listener::setInitialReceiveWindow).
-            AIPSTACK_ASSERT(lis->m_initial_rcv_wnd <= TypeMax<std::size_t>);
-            TcpSeqInt rcv_wnd = MinValueU(lis->m_initial_rcv_wnd, TypeMax<std::uint16_t>);
-            
-            // Initialize most of the PCB.
-            pcb->setState(TcpStates::SYN_RCVD);
-            pcb->flags = 0;
-            pcb->lis = lis;
-            pcb->local_addr = ip_info.dst_addr;
-            pcb->remote_addr = ip_info.src_addr;
-            pcb->local_port = tcp_meta.local_port;
-            pcb->remote_port = tcp_meta.remote_port;
-            pcb->rcv_nxt = tcp_meta.seq_num + 1u;
-            pcb->rcv_ann_wnd = rcv_wnd;
-            pcb->snd_una = iss;
-            pcb->snd_nxt = iss;
-            pcb->snd_mss = iface_mss; // store iface_mss here temporarily
-            pcb->base_snd_mss = base_snd_mss;
-            pcb->rto = Constants::InitialRtxTime;
-            pcb->num_dupack = 0;
-            pcb->snd_wnd_shift = 0;
-            pcb->rcv_wnd_shift = 0;
-            
-            // Note, the PCB is on the list of unreferenced PCBs and we leave
-            // it since SYN_RCVD PCBs are considered unreferenced (except while
-            // being accepted).
-            
-            // Handle window scaling option.
-            if ((tcp->m_received_opts.options & TcpOptionFlags::WndScale) != Enum0) {
-                pcb->setFlag(TcpPcbFlags::WndScale);
-                pcb->snd_wnd_shift =
-                    MinValue(std::uint8_t(14), tcp->m_received_opts.wnd_scale);
-                pcb->rcv_wnd_shift = Constants::RcvWndShift;
+            // Remember the timestamp to be echoed.
+            if (pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+                pcb->ts_recent = tcp->m_received_opts.ts_val;
             }
             
-            // Increment the listener's PCB count.
-            AIPSTACK_ASSERT(lis->m_num_pcbs < TypeMax<int>);
-            lis->m_num_pcbs++;
-            
-            // Add the PCB to the active index.
-            tcp->m_pcb_index_active.addEntry({*pcb, *tcp}, *tcp);
-            
-            // Move the PCB to the front of the unreferenced list.
-            tcp->move_unrefed_pcb_to_front(pcb);
-            
-            // Start the SYN_RCVD abort timeout.
-            pcb->tim(AbrtTimer()).setAfter(Constants::SynRcvdTimeoutTicks);
+            // Use ECN if this is an ECN-setup SYN (RFC 3168 section 6.1.1).
+            if (TcpProto::EnableEcn &&
+                (tcp_meta.flags & (Tcp4Flags::Ece|Tcp4Flags::Cwr)) ==
+                    (Tcp4Flags::Ece|Tcp4Flags::Cwr))
+            {
+                pcb->ecn_ok = true;
+            }
             
-            // Start the retransmission timer.
-            pcb->tim(RtxTimer()).setAfter(Output::pcb_rto_time(pcb));
+            // Handle the Fast Open option if Fast Open is enabled for the listener.
+            if (TcpProto::EnableFastOpen && lis->m_fast_open &&
+                (tcp->m_received_opts.options & TcpOptionFlags::FastOpen) != Enum0 &&
+                listen_fast_open_input(pcb, tcp_meta, tcp_data))
+            {
+                return;
+            }
             
             pcb->doDelayedTimerUpdate();
             
@@ -472,7 +661,355 @@ private:
         
     refuse:
         // Refuse connection by RST.
-        Output::send_rst_reply(lis->m_tcp, ip_info, tcp_meta, tcp_data_len);
+        Output::send_rst_reply(lis->m_tcp, ip_info, tcp_meta, tcp_data.tot_len);
+    }
+    
+    // Allocate and initialize a PCB in SYN_RCVD state for a connection to a
+    // listener, where opts are the options received in the SYN. The PCB is
+    // considered to not have sent the SYN-ACK yet. Returns null on failure.
+    // NOTE: doDelayedTimerUpdate must be called after return.
+    static TcpPcb * listen_create_pcb (Listener *lis, IpRxInfoIp4<StackArg> const &ip_info,
+        TcpSegMeta const &tcp_meta, TcpSeqNum iss, TcpSeqNum rcv_nxt,
+        std::uint16_t iface_mss, TcpOptions const &opts)
+    {
+        TcpProto *tcp = lis->m_tcp;
+        
+        // Calculate the base_snd_mss.
+        std::uint16_t base_snd_mss;
+        if (!CalcTcpSndMss<Constants::MinAllowedMss>(iface_mss, opts, &base_snd_mss)) {
+            return nullptr;
+        }
+        
+        // Allocate a PCB.
+        TcpPcb *pcb = tcp->allocate_pcb();
+        if (pcb == nullptr) {
+            lis->m_stats.inc(&TcpListenerStats::syns_refused_no_pcb);
+            return nullptr;
+        }
+        
+        // Initialize most of the PCB.
+        pcb->setState(TcpStates::SYN_RCVD);
+        pcb->flags = 0;
+        pcb->lis = lis;
+        pcb->local_addr = ip_info.dst_addr;
+        pcb->remote_addr = ip_info.src_addr;
+        pcb->local_port = tcp_meta.local_port;
+        pcb->remote_port = tcp_meta.remote_port;
+        Output::pcb_init_pseudo_chksum(pcb);
+        pcb->rcv_nxt = rcv_nxt;
+        pcb->rcv_ann_wnd = listen_initial_rcv_wnd(lis);
+        pcb->snd_una = iss;
+        pcb->snd_nxt = iss;
+        pcb->snd_mss = iface_mss; // store iface_mss here temporarily
+        pcb->base_snd_mss = base_snd_mss;
+        pcb->ts_offset = 0;
+        pcb->rto = Constants::InitialRtxTime;
+        pcb->num_dupack = 0;
+        pcb->snd_wnd_shift = 0;
+        pcb->rcv_wnd_shift = 0;
+        pcb->fast_open = false;
+        pcb->fast_open_syn_ack = false;
+        pcb->ecn_ok = false;
+        pcb->ecn_ce_echo = false;
+        pcb->ecn_cwr_pending = false;
+        pcb->ecn_reduced = false;
+        pcb->dscp = 0;
+        pcb->stats.reset();
+        pcb->create_time.set(tcp->platform().getTime());
+        
+        tcp->m_stats.inc(&TcpProtoStats::passive_opens);
+        
+        // Note, the PCB is on the list of unreferenced PCBs and we leave
+        // it since SYN_RCVD PCBs are considered unreferenced (except while
+        // being accepted).
+        
+        // Handle window scaling option.
+        if ((opts.options & TcpOptionFlags::WndScale) != Enum0) {
+            pcb->setFlag(TcpPcbFlags::WndScale);
+            pcb->snd_wnd_shift = MinValue(std::uint8_t(14), opts.wnd_scale);
+            pcb->rcv_wnd_shift = listen_rcv_wnd_shift(lis);
+        }
+        
+        // Use SACK if the peer permits it and it is enabled.
+        if (TcpProto::NumSackBlocks > 0 &&
+            (opts.options & TcpOptionFlags::SackPerm) != Enum0)
+        {
+            pcb->setFlag(TcpPcbFlags::SackPerm);
+        }
+        
+        // Use timestamps if the peer sent the option and they are enabled.
+        // The caller sets ts_recent.
+        if (TcpProto::UseTimestamps &&
+            (opts.options & TcpOptionFlags::Timestamps) != Enum0)
+        {
+            pcb->setFlag(TcpPcbFlags::Timestamps);
+        }
+        
+        // Increment the listener's PCB count.
+        AIPSTACK_ASSERT(lis->m_num_pcbs < TypeMax<int>);
+        lis->m_num_pcbs++;
+        lis->m_stats.updateMax(&TcpListenerStats::backlog_peak,
+                               std::uint32_t(lis->m_num_pcbs));
+        tcp->m_num_syn_rcvd_pcbs++;
+        
+        // Add the PCB to the active index.
+        tcp->m_pcb_index_active.addEntry({*pcb, *tcp}, *tcp);
+        
+        // Move the PCB to the front of the unreferenced list.
+        tcp->move_unrefed_pcb_to_front(pcb);
+        
+        // Start the SYN_RCVD abort timeout.
+        pcb->tim(AbrtTimer()).setAfter(Constants::SynRcvdTimeoutTicks);
+        
+        // Start the retransmission timer.
+        pcb->tim(RtxTimer()).setAfter(Output::pcb_rto_time(pcb));
+        
+        return pcb;
+    }
+    
+    // Handle a SYN with the Fast Open option for a newly created PCB in SYN_RCVD.
+    // If the SYN has a valid cookie and data, the SYN-ACK is sent and the data
+    // processed right away, and true is returned. Otherwise false is returned and
+    // the caller continues as normal, sending the SYN-ACK with a cookie.
+    static bool listen_fast_open_input (TcpPcb *pcb, TcpSegMeta const &tcp_meta,
+                                        IpBufRef tcp_data)
+    {
+        AIPSTACK_ASSERT(pcb->state() == TcpStates::SYN_RCVD);
+        
+        TcpProto *tcp = pcb->tcp;
+        TcpOptions const &opts = tcp->m_received_opts;
+        
+        // Without a valid cookie, any data is not acknowledged (the client will
+        // retransmit it) and a cookie is sent in the SYN-ACK.
+        if (!TcpFastOpenCookie::check(tcp->m_fast_open_secret, pcb->local_addr,
+                pcb->remote_addr, opts.fast_open_cookie, opts.fast_open_cookie_len))
+        {
+            pcb->fast_open = true;
+            return false;
+        }
+        
+        // Accept as much data as fits into the receive window. Without any data,
+        // there is nothing special to do.
+        tcp_data.tot_len = MinValueU(tcp_data.tot_len, pcb->rcv_ann_wnd);
+        if (tcp_data.tot_len == 0) {
+            return false;
+        }
+        
+        // Send the SYN-ACK acknowledging the data now, so that it precedes any
+        // response of the application. For this the data is temporarily
+        // considered received.
+        TcpSeqNum syn_rcv_nxt = pcb->rcv_nxt;
+        TcpSeqInt syn_rcv_ann_wnd = pcb->rcv_ann_wnd;
+        pcb->rcv_nxt += TcpSeqInt(tcp_data.tot_len);
+        pcb->rcv_ann_wnd -= TcpSeqInt(tcp_data.tot_len);
+        Output::pcb_send_syn(pcb);
+        pcb->rcv_nxt = syn_rcv_nxt;
+        pcb->rcv_ann_wnd = syn_rcv_ann_wnd;
+        
+        // If the SYN-ACK could not be sent, continue as without a cookie, the
+        // SYN-ACK will be retransmitted (without acknowledging the data).
+        if (pcb->snd_nxt == pcb->snd_una) {
+            return false;
+        }
+        
+        // The connection is established right away so the round-trip-time
+        // cannot be measured.
+        pcb->clearFlag(TcpPcbFlags::RttPending);
+        
+        // Remember that the SYN-ACK may need to be retransmitted in response to
+        // a retransmitted SYN, the flag remains set after the transition to
+        // ESTABLISHED until an ACK is received.
+        pcb->fast_open_syn_ack = true;
+        
+        // Process the data as if it had been received in the ACK to the SYN-ACK,
+        // which is expected to complete the transition to ESTABLISHED when the
+        // connection is accepted. The window size is adjusted because the window
+        // in the SYN is unscaled. This also does the delayed timer update.
+        TcpSegMeta ack_meta = tcp_meta;
+        ack_meta.seq_num = tcp_meta.seq_num + 1u;
+        ack_meta.ack_num = pcb->snd_nxt;
+        ack_meta.window_size = std::uint16_t(tcp_meta.window_size >> pcb->snd_wnd_shift);
+        ack_meta.flags = Tcp4Flags::Ack|Tcp4Flags::Psh;
+        pcb_input(tcp, pcb, ack_meta, tcp_data);
+        return true;
+    }
+    
+    // Initially advertised receive window, at most 16-bit wide since
+    // SYN-ACK segments have unscaled window.
+    inline static TcpSeqInt listen_initial_rcv_wnd (Listener *lis)
+    {
+        // NOTE: rcv_ann_wnd fits into size_t as required since m_initial_rcv_wnd
+        // also does (Listener::setInitialReceiveWindow).
+        AIPSTACK_ASSERT(lis->m_initial_rcv_wnd <= TypeMax<std::size_t>);
+        return MinValueU(lis->m_initial_rcv_wnd, TypeMax<std::uint16_t>);
+    }
+    
+    // Window scale shift count for connections to a listener. This must give
+    // the same result for the SYN-ACK with a SYN cookie and for the PCB created
+    // when the cookie is returned.
+    inline static std::uint8_t listen_rcv_wnd_shift (Listener *lis)
+    {
+        return Constants::RcvWndShiftForBuffer(lis->m_max_rcv_buf);
+    }
+    
+    // Check if a segment completing the handshake is to be ignored due to
+    // deferred accept, apart from the SYN-ACK retransmission count.
+    inline static bool listen_defer_ack (Listener *lis, TcpSegMeta const &tcp_meta,
+                                         std::size_t data_len)
+    {
+        return AIPSTACK_UNLIKELY(lis->m_defer_accept != 0) && data_len == 0 &&
+            (tcp_meta.flags & Tcp4Flags::Fin) == Enum0;
+    }
+    
+    // Check if SYN cookies should be used because too many PCBs are in SYN_RCVD.
+    inline static bool syn_cookies_needed (TcpProto *tcp)
+    {
+        return tcp->m_num_syn_rcvd_pcbs * 100 >=
+            TcpProto::NumTcpPcbs * int(TcpProto::SynCookiePcbPercent);
+    }
+    
+    // Get the current SYN cookie time counter.
+    inline static std::uint32_t syn_cookie_counter (TcpProto *tcp)
+    {
+        return std::uint32_t(tcp->platform().getTime() >> Constants::SynCookieCounterShift);
+    }
+    
+    // Reply to a SYN with a SYN-ACK whose sequence number is a SYN cookie, without
+    // creating a PCB. Returns false if a cookie could not be made.
+    static bool listen_send_syn_cookie (Listener *lis,
+        IpRxInfoIp4<StackArg> const &ip_info, TcpSegMeta const &tcp_meta)
+    {
+        TcpProto *tcp = lis->m_tcp;
+        
+        // Make sure received options are parsed.
+        parse_received_opts(tcp);
+        TcpOptions const &syn_opts = tcp->m_received_opts;
+        
+        // Check that the MSS would be acceptable, as done when creating a PCB.
+        std::uint16_t iface_mss = ip_info.iface->getMtu() - Ip4TcpHeaderSize;
+        std::uint16_t base_snd_mss;
+        if (!CalcTcpSndMss<Constants::MinAllowedMss>(iface_mss, syn_opts, &base_snd_mss)) {
+            return false;
+        }
+        
+        // Make the cookie.
+        TcpPcbKey key{ip_info.dst_addr, ip_info.src_addr,
+                      tcp_meta.local_port, tcp_meta.remote_port};
+        TcpSeqNum cookie;
+        if (!TcpSynCookie::make(tcp->m_syn_cookie_secret, key, tcp_meta.seq_num,
+                                syn_cookie_counter(tcp), syn_opts, cookie))
+        {
+            return false;
+        }
+        
+        // Send the SYN-ACK with the options that a PCB would send.
+        TcpOptions tcp_opts;
+        tcp_opts.options = TcpOptionFlags::Mss;
+        tcp_opts.mss = iface_mss;
+        if ((syn_opts.options & TcpOptionFlags::WndScale) != Enum0) {
+            tcp_opts.options |= TcpOptionFlags::WndScale;
+            tcp_opts.wnd_scale = listen_rcv_wnd_shift(lis);
+        }
+        if (TcpProto::NumSackBlocks > 0 &&
+            (syn_opts.options & TcpOptionFlags::SackPerm) != Enum0)
+        {
+            tcp_opts.options |= TcpOptionFlags::SackPerm;
+        }
+        if (TcpProto::UseTimestamps &&
+            (syn_opts.options & TcpOptionFlags::Timestamps) != Enum0)
+        {
+            tcp_opts.options |= TcpOptionFlags::Timestamps;
+            tcp_opts.ts_ecr = syn_opts.ts_val;
+        }
+        
+        Output::send_syn_ack_stateless(tcp, key, cookie, tcp_meta.seq_num + 1u,
+            std::uint16_t(listen_initial_rcv_wnd(lis)), tcp_opts);
+        return true;
+    }
+    
+    // Handle an ACK without a PCB which may acknowledge a SYN cookie. If the cookie
+    // is valid, a PCB is created and the segment processed using it. Returns false
+    // if the cookie is not valid, in which case nothing has been done.
+    static bool listen_cookie_ack_input (Listener *lis,
+        IpRxInfoIp4<StackArg> const &ip_info, TcpSegMeta const &tcp_meta,
+        IpBufRef tcp_data)
+    {
+        TcpProto *tcp = lis->m_tcp;
+        
+        // Check the cookie, which is one less than the acknowledgement number.
+        TcpPcbKey key{ip_info.dst_addr, ip_info.src_addr,
+                      tcp_meta.local_port, tcp_meta.remote_port};
+        TcpSeqNum peer_isn = tcp_meta.seq_num - 1u;
+        TcpSeqNum cookie = tcp_meta.ack_num - 1u;
+        TcpOptions syn_opts;
+        if (!TcpSynCookie::check(tcp->m_syn_cookie_secret, key, peer_isn,
+                syn_cookie_counter(tcp), Constants::SynCookieCounterMask, cookie, syn_opts))
+        {
+            return false;
+        }
+        
+        // If the backlog is still full, drop the segment. The peer will retransmit
+        // any data and the cookie remains valid for a while.
+        if (lis->m_num_pcbs >= lis->m_max_pcbs) {
+            return true;
+        }
+        
+        // With deferred accept, drop an ACK without data in the same way. There
+        // is no SYN-ACK retransmission to time out with a SYN cookie.
+        if (listen_defer_ack(lis, tcp_meta, tcp_data.tot_len)) {
+            lis->m_stats.inc(&TcpListenerStats::deferred_acks);
+            return true;
+        }
+        
+        // If the peer uses timestamps, take TS.Recent from this segment.
+        parse_received_opts(tcp);
+        if ((tcp->m_received_opts.options & TcpOptionFlags::Timestamps) == Enum0) {
+            syn_opts.options &= ~TcpOptionFlags::Timestamps;
+        }
+        
+        // Create the PCB as if it had received the SYN and sent the SYN-ACK.
+        std::uint16_t iface_mss = ip_info.iface->getMtu() - Ip4TcpHeaderSize;
+        TcpPcb *pcb = listen_create_pcb(lis, ip_info, tcp_meta, cookie, tcp_meta.seq_num,
+                                        iface_mss, syn_opts);
+        if (pcb == nullptr) {
+            return false;
+        }
+        pcb->snd_nxt = cookie + 1u;
+        if (pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+            pcb->ts_recent = tcp->m_received_opts.ts_val;
+        }
+        
+        // Process the segment as for any SYN_RCVD PCB, this is expected to complete
+        // the transition to ESTABLISHED. It also does the delayed timer update.
+        pcb_input(tcp, pcb, tcp_meta, tcp_data);
+        return true;
+    }
+    
+    // Handle a segment for a connection in the TIME_WAIT table. The only segment
+    // expected is a retransmission of the FIN, which is acknowledged and restarts
+    // the timeout (RFC 793 p73). Other segments except RST are answered with an ACK.
+    static void time_wait_input (TcpProto *tcp, TimeWaitEntry &tw_entry,
+                                 TcpSegMeta const &tcp_meta)
+    {
+        if ((tcp_meta.flags & Tcp4Flags::Rst) != Enum0) {
+            // Remove the entry for an RST exactly at rcv_nxt. Other RSTs are
+            // ignored since the receive window is not remembered.
+            if (tcp_meta.seq_num == tw_entry.rcv_nxt) {
+                tcp->m_timewait_table.removeEntry(tw_entry);
+            }
+            return;
+        }
+        
+        // Drop segments with neither SYN nor ACK (as pcb_uncommon_flags_processing).
+        if ((tcp_meta.flags & (Tcp4Flags::Syn|Tcp4Flags::Ack)) == Enum0) {
+            return;
+        }
+        
+        if ((tcp_meta.flags & (Tcp4Flags::Syn|Tcp4Flags::Fin)) == Tcp4Flags::Fin) {
+            tcp->m_timewait_table.restartEntry(tw_entry, Constants::TimeWaitTimeTicks);
+        }
+        
+        Output::send_time_wait_ack(tcp, tw_entry);
     }
     
     static void pcb_input (TcpProto *tcp, TcpPcb *pcb, TcpSegMeta const &tcp_meta,
@@ -485,6 +1022,10 @@ private:
         // Set the m_current_pcb to this PCB.
         tcp->m_current_pcb = pcb;
         
+        tcp->m_stack->traceLatency(IpLatencyStage::TcpInput);
+        
+        pcb->stats.inc(&TcpConnectionCounters::segs_received);
+        
         // Do the input processing.
         pcb_input_core(pcb, tcp_meta, tcp_data);
         
@@ -498,11 +1039,47 @@ private:
         }
     }
     
+    // Deliver the amounts accumulated for the dataSent/dataReceived callbacks
+    // (see TcpConnection::data_sent), also before other callbacks so that these
+    // are delivered in order. Returns false if the PCB was aborted in a callback.
+    static bool pcb_deliver_batch_data (TcpPcb *pcb)
+    {
+        if (!TcpProto::CoalesceDataCallbacks) {
+            return true;
+        }
+        
+        if (pcb->con != nullptr && pcb->con->m_v.batch_sent > 0) {
+            pcb->con->batch_data_sent();
+            if (AIPSTACK_UNLIKELY(pcb_aborted_in_callback(pcb))) {
+                return false;
+            }
+        }
+        
+        if (pcb->con != nullptr && pcb->con->m_v.batch_received > 0) {
+            pcb->con->batch_data_received();
+            if (AIPSTACK_UNLIKELY(pcb_aborted_in_callback(pcb))) {
+                return false;
+            }
+        }
+        
+        return true;
+    }
+    
     static void pcb_input_core (TcpPcb *pcb, TcpSegMeta const &tcp_meta, IpBufRef tcp_data)
     {
         AIPSTACK_ASSERT(pcb->state() != TcpStates::CLOSED);
         AIPSTACK_ASSERT(pcb->tcp->m_current_pcb == pcb);
         
+        // Try header prediction, which handles the most common segments of an
+        // established connection with fewer checks.
+        PredictResult predict_res = pcb_input_predicted(pcb, tcp_meta, tcp_data);
+        if (AIPSTACK_LIKELY(predict_res != PredictResult::NotPredicted)) {
+            if (predict_res == PredictResult::Continue) {
+                pcb_input_output(pcb);
+            }
+            return;
+        }
+        
         // Remember original data length.
         std::size_t orig_data_len = tcp_data.tot_len;
         
@@ -520,10 +1097,20 @@ private:
             return;
         }
         
+        // Any acceptable segment restarts the keepalive idle time.
+        if (TcpProto::EnableKeepalive && pcb->state() != TcpStates::SYN_RCVD &&
+            pcb->con != nullptr)
+        {
+            pcb->con->m_v.ka_time_left = pcb->con->m_v.ka_idle;
+            pcb->con->m_v.ka_probes = 0;
+        }
+        
         if (AIPSTACK_UNLIKELY(pcb->state().isSynSentOrRcvd())) {
             // Do SYN_SENT or SYN_RCVD specific processing.
             // Normally we transition to ESTABLISHED state here.
-            if (!pcb_input_syn_sent_rcvd_processing(pcb, tcp_meta, acked)) {
+            if (!pcb_input_syn_sent_rcvd_processing(pcb, tcp_meta, acked,
+                                                    orig_data_len))
+            {
                 return;
             }
             
@@ -535,6 +1122,11 @@ private:
             if (!pcb_input_ack_wnd_processing(pcb, tcp_meta, acked, orig_data_len)) {
                 return;
             }
+            
+            // Process ECN signals in the segment.
+            if (TcpProto::EnableEcn && pcb->ecn_ok) {
+                pcb_input_ecn_processing(pcb, tcp_meta, acked);
+            }
         }
         
         if (AIPSTACK_LIKELY(pcb->state().isAcceptingData())) {
@@ -549,6 +1141,12 @@ private:
             pcb->tim(AbrtTimer()).setAfter(Constants::TimeWaitTimeTicks);
         }
         
+        pcb_input_output(pcb);
+    }
+    
+    // Send any output resulting from processing a received segment.
+    static void pcb_input_output (TcpPcb *pcb)
+    {
         // Output if needed.
         if (pcb->hasAndClearFlag(TcpPcbFlags::OutPending)) {
             // These are implied by the OutPending flag.
@@ -561,10 +1159,118 @@ private:
         
         // Send an empty ACK if desired.
         // Note, AckPending will have been cleared above if pcb_output sent anything,
-        // in that case we don't need an empty ACK here.
-        if (pcb->hasAndClearFlag(TcpPcbFlags::AckPending)) {
-            Output::pcb_send_empty_ack(pcb);
+        // in that case we don't need an empty ACK here. Within a receive batch, the
+        // ACK is deferred to the end of the batch so that it covers all segments.
+        if (pcb->hasFlag(TcpPcbFlags::AckPending)) {
+            if (pcb->tcp->m_stack->isInRecvBatch()) {
+                TcpProto::pcb_defer_to_batch_end(pcb);
+            } else {
+                pcb->clearFlag(TcpPcbFlags::AckPending);
+                Output::pcb_send_empty_ack(pcb);
+            }
+        }
+    }
+    
+    // Result of pcb_input_predicted.
+    enum class PredictResult {NotPredicted, Continue, Stop};
+    
+    // Header prediction (Van Jacobson). For an ESTABLISHED connection, this
+    // handles a pure ACK acknowledging new data and an in-sequence data segment
+    // while nothing is unacknowledged, skipping the checks of the general path
+    // which cannot apply. Returns NotPredicted without having changed any state
+    // if the segment is not one of these, otherwise Continue if output should
+    // be done or Stop if processing ended (e.g. the PCB was aborted).
+    static PredictResult pcb_input_predicted (TcpPcb *pcb, TcpSegMeta const &tcp_meta,
+                                              IpBufRef tcp_data)
+    {
+        TcpProto *tcp = pcb->tcp;
+        Connection *con = pcb->con;
+        
+        // Common conditions: ESTABLISHED with a Connection, ACK as the only basic
+        // flag (no SYN, RST or FIN) and the sequence number at rcv_nxt.
+        if (AIPSTACK_UNLIKELY(pcb->state() != TcpStates::ESTABLISHED ||
+            con == nullptr ||
+            (tcp_meta.flags & Tcp4Flags::BasicFlags) != Tcp4Flags::Ack ||
+            tcp_meta.seq_num != pcb->rcv_nxt))
+        {
+            return PredictResult::NotPredicted;
+        }
+        
+        if (TcpProto::EnableFastOpen && AIPSTACK_UNLIKELY(pcb->fast_open_syn_ack)) {
+            return PredictResult::NotPredicted;
+        }
+        
+        TcpSeqInt acked = tcp_meta.ack_num - pcb->snd_una;
+        
+        if (tcp_data.tot_len == 0) {
+            // Pure ACK: it must acknowledge new data but no more than was sent.
+            if (AIPSTACK_UNLIKELY(acked == 0 || acked > pcb->snd_nxt - pcb->snd_una)) {
+                return PredictResult::NotPredicted;
+            }
+        } else {
+            // Data: nothing may be unacknowledged so that there is no ACK
+            // processing, and the data must go directly into the receive buffer.
+            // This implies that the segment is within the receive window.
+            if (AIPSTACK_UNLIKELY(acked != 0 || pcb->snd_una != pcb->snd_nxt ||
+                !con->m_v.ooseq.isNothingBuffered() ||
+                tcp_data.tot_len > con->m_v.rcv_buf.tot_len))
+            {
+                return PredictResult::NotPredicted;
+            }
+        }
+        
+        // SACK blocks are left to the general path.
+        if (TcpProto::NumSackBlocks > 0 && tcp->m_received_opts_buf.tot_len != 0 &&
+            pcb->hasFlag(TcpPcbFlags::SackPerm))
+        {
+            parse_received_opts(tcp);
+            if ((tcp->m_received_opts.options & TcpOptionFlags::Sack) != Enum0) {
+                return PredictResult::NotPredicted;
+            }
+        }
+        
+        // Handle the timestamps option, including PAWS.
+        if (TcpProto::UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+            if (AIPSTACK_UNLIKELY(!pcb_input_ts_processing(pcb, tcp_meta))) {
+                return PredictResult::Stop;
+            }
+        }
+        
+        pcb->stats.inc(&TcpConnectionCounters::predicted_segs);
+        
+        // Any acceptable segment restarts the keepalive idle time.
+        if (TcpProto::EnableKeepalive) {
+            con->m_v.ka_time_left = con->m_v.ka_idle;
+            con->m_v.ka_probes = 0;
+        }
+        
+        if (tcp_data.tot_len == 0) {
+            // Process the acknowledgement and window update.
+            if (!pcb_input_ack_wnd_processing(pcb, tcp_meta, acked, 0)) {
+                return PredictResult::Stop;
+            }
+        } else {
+            // With nothing unacknowledged only the window can change.
+            Output::pcb_update_snd_wnd(pcb, pcb_decode_wnd_size(pcb, tcp_meta.window_size));
+        }
+        
+        // Process ECN signals in the segment.
+        if (TcpProto::EnableEcn && pcb->ecn_ok) {
+            pcb_input_ecn_processing(pcb, tcp_meta, acked);
+        }
+        
+        if (tcp_data.tot_len > 0) {
+            // Accept the data, there is enough buffer space as checked above.
+            IpBufRef zc_data = IpBufRef{};
+            pcb_rcv_in_sequence_data(pcb, tcp_data, zc_data);
+            
+            TcpSeqInt rcv_seqlen = TcpSeqInt(tcp_data.tot_len);
+            if (!pcb_process_received(pcb, rcv_seqlen, tcp_data.tot_len, zc_data)) {
+                return PredictResult::Stop;
+            }
         }
+        
+        return PredictResult::Continue;
     }
     
     static bool pcb_input_basic_processing (TcpPcb *pcb, TcpSegMeta const &tcp_meta,
@@ -589,9 +1295,14 @@ private:
             seg_fin = false;
             
             // Check ACK validity for SYN_SENT state (RFC 793 p66).
-            // We require that the ACK acknowledges the SYN. We must also
-            // check that we have event sent the SYN (snd_nxt).
-            if (pcb->snd_nxt == pcb->snd_una || tcp_meta.ack_num != pcb->snd_nxt) {
+            // We require that the ACK acknowledges the SYN, and no more than any
+            // data sent in the SYN with Fast Open. We must also check that we have
+            // event sent the SYN (snd_nxt).
+            TcpSeqInt syn_data_len = TcpProto::EnableFastOpen ?
+                pcb->con->m_v.syn_data_len : 0;
+            if (pcb->snd_nxt == pcb->snd_una ||
+                TcpSeqInt(tcp_meta.ack_num - pcb->snd_nxt) > syn_data_len)
+            {
                 Output::send_rst(pcb->tcp, /*key=*/*pcb,
                     /*seq_num=*/tcp_meta.ack_num, /*ack=*/false, /*ack_num=*/TcpSeqNum(0));
                 return false;
@@ -633,6 +1344,8 @@ private:
                 
                 // If not acceptable, send any appropriate response and drop.
                 if (AIPSTACK_UNLIKELY(!acceptable)) {
+                    pcb->tcp->m_stack->traceDrop(
+                        IpDropReason::TcpOutOfWindow, nullptr, tcp_data);
                     Output::pcb_send_empty_ack(pcb);
                     return false;
                 }
@@ -673,6 +1386,8 @@ private:
                     else {
                         // The segment is completely outside the receive window.
                         // It is unacceptable -> send ACK and stop processing.
+                        pcb->tcp->m_stack->traceDrop(
+                            IpDropReason::TcpOutOfWindow, nullptr, tcp_data);
                         Output::pcb_send_empty_ack(pcb);
                         return false;
                     }
@@ -694,6 +1409,66 @@ private:
                 }
                 acked = 0;
             }
+            
+            // Handle the timestamps option, including PAWS.
+            if (TcpProto::UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+                if (AIPSTACK_UNLIKELY(!pcb_input_ts_processing(pcb, tcp_meta))) {
+                    return false;
+                }
+            }
+        }
+        
+        return true;
+    }
+    
+    // Process the timestamps option of a received segment (RFC 7323). This
+    // implements PAWS (rejecting segments with old timestamps) and updates
+    // TS.Recent. The PAWS check is done after the acceptability checks rather
+    // than before, which is equivalent since both reject by sending an ACK.
+    static bool pcb_input_ts_processing (TcpPcb *pcb, TcpSegMeta const &tcp_meta)
+    {
+        TcpProto *tcp = pcb->tcp;
+        
+        // Make sure received options are parsed. Note that the timestamp echo
+        // is later used for RTT measurement (Output::pcb_get_ts_rtt_sample).
+        parse_received_opts(tcp);
+        
+        // Accept segments without the option. RFC 7323 allows dropping these
+        // but accepting them is more robust.
+        TcpOptions const &opts = tcp->m_received_opts;
+        if (AIPSTACK_UNLIKELY((opts.options & TcpOptionFlags::Timestamps) == Enum0)) {
+            return true;
+        }
+        
+        // In SYN_RCVD pcb->con is not valid since pcb->lis is used instead.
+        Connection *con = (pcb->state() == TcpStates::SYN_RCVD) ? nullptr : pcb->con;
+        std::uint32_t ts_now = Output::pcb_ts_clock(pcb);
+        
+        // Is the timestamp older than TS.Recent?
+        if (AIPSTACK_UNLIKELY(opts.ts_val - pcb->ts_recent >= std::uint32_t(1) << 31)) {
+            // Without a Connection (SYN_RCVD or abandoned) the age of TS.Recent
+            // is not tracked. Then just ignore the timestamp and do not do PAWS,
+            // which is only important for high-rate transfers anyway.
+            if (con == nullptr) {
+                return true;
+            }
+            
+            // Reject the segment unless TS.Recent is invalid due to having not
+            // been updated for a very long time.
+            if (ts_now - con->m_v.ts_recent_time <= Constants::PawsIdleTime) {
+                Output::pcb_send_empty_ack(pcb);
+                return false;
+            }
+        }
+        
+        // Update TS.Recent if the segment does not start beyond rcv_nxt (which
+        // we use in place of Last.ACK.sent), so that the timestamps of
+        // out-of-sequence segments are not echoed.
+        if (!pcb->rcv_nxt.mod_lt(tcp_meta.seq_num)) {
+            pcb->ts_recent = opts.ts_val;
+            if (con != nullptr) {
+                con->m_v.ts_recent_time = ts_now;
+            }
         }
         
         return true;
@@ -753,6 +1528,11 @@ private:
                     Output::pcb_send_syn(pcb);
                     pcb->tim(AbrtTimer()).setAfter(Constants::SynRcvdTimeoutTicks);
                 }
+                // For a connection accepted with Fast Open, a SYN may be
+                // a retransmission due to loss of our SYN-ACK, so resend it.
+                else if (TcpProto::EnableFastOpen && pcb->fast_open_syn_ack) {
+                    Output::pcb_resend_fast_open_syn_ack(pcb);
+                }
                 else {
                     Output::pcb_send_empty_ack(pcb);
                 }
@@ -770,7 +1550,8 @@ private:
     }
     
     static bool pcb_input_syn_sent_rcvd_processing (
-        TcpPcb *pcb, TcpSegMeta const &tcp_meta, TcpSeqInt acked)
+        TcpPcb *pcb, TcpSegMeta const &tcp_meta, TcpSeqInt acked,
+        std::size_t orig_data_len)
     {
         AIPSTACK_ASSERT(pcb->state() == OneOf(TcpStates::SYN_SENT, TcpStates::SYN_RCVD));
         AIPSTACK_ASSERT(pcb->state() != TcpStates::SYN_SENT || pcb->con != nullptr);
@@ -802,6 +1583,14 @@ private:
         else if (syn_sent && (tcp_meta.flags & Tcp4Flags::Syn) == Enum0) {
             proceed = false;
         }
+        // With deferred accept, drop an ACK without data silently, until the
+        // SYN-ACK has been retransmitted enough times (counted in num_dupack).
+        else if (!syn_sent && listen_defer_ack(pcb->lis, tcp_meta, orig_data_len) &&
+                 pcb->num_dupack < pcb->lis->m_defer_accept)
+        {
+            pcb->lis->m_stats.inc(&TcpListenerStats::deferred_acks);
+            proceed = false;
+        }
         
         if (!proceed) {
             // If this PCB is unreferenced, move it to the front of
@@ -813,10 +1602,21 @@ private:
             return false;
         }
         
-        // In SYN_SENT and SYN_RCVD the remote acks only our SYN no more.
-        // Otherwise we would have bailed out already.
+        // In SYN_SENT and SYN_RCVD the remote acks only our SYN no more, except
+        // any data sent in the SYN (SYN_SENT with Fast Open). Otherwise we would
+        // have bailed out already.
         AIPSTACK_ASSERT(pcb->snd_nxt == pcb->snd_una + 1u);
-        AIPSTACK_ASSERT(tcp_meta.ack_num == pcb->snd_nxt);
+        AIPSTACK_ASSERT(syn_sent || tcp_meta.ack_num == pcb->snd_nxt);
+        
+        // Amount of data sent in the SYN which is acknowledged.
+        TcpSeqInt syn_data_acked = tcp_meta.ack_num - pcb->snd_nxt;
+        
+        // The Fast Open state of SYN_SENT/SYN_RCVD is no longer needed.
+        bool fast_open = TcpProto::EnableFastOpen && pcb->fast_open;
+        pcb->fast_open = false;
+        
+        // Reset num_dupack which counted SYN-ACK retransmissions in SYN_RCVD.
+        pcb->num_dupack = 0;
         
         // Stop the SYN_RCVD abort timer.
         pcb->tim(AbrtTimer()).unset();
@@ -875,6 +1675,37 @@ private:
                 pcb->rcv_wnd_shift = 0;
             }
             
+            // If the remote did not send the SACK-permitted option, SACK
+            // must not be used.
+            if ((tcp->m_received_opts.options & TcpOptionFlags::SackPerm) == Enum0) {
+                pcb->clearFlag(TcpPcbFlags::SackPerm);
+            }
+            
+            // ECN is only used if the SYN-ACK is an ECN-setup SYN-ACK, which has
+            // ECE but not CWR (RFC 3168 section 6.1.1).
+            if ((tcp_meta.flags & (Tcp4Flags::Ece|Tcp4Flags::Cwr)) != Tcp4Flags::Ece) {
+                pcb->ecn_ok = false;
+            }
+            
+            // If the remote did not send the timestamps option, timestamps must
+            // not be used, otherwise remember the timestamp to be echoed.
+            if ((tcp->m_received_opts.options & TcpOptionFlags::Timestamps) == Enum0) {
+                pcb->clearFlag(TcpPcbFlags::Timestamps);
+            } else {
+                pcb->ts_recent = tcp->m_received_opts.ts_val;
+            }
+            
+            // Remember any Fast Open cookie for later connections to the server,
+            // along with the MSS of the server.
+            if (fast_open &&
+                (tcp->m_received_opts.options & TcpOptionFlags::FastOpen) != Enum0 &&
+                tcp->m_received_opts.fast_open_cookie_len > 0)
+            {
+                tcp->m_fast_open_cache.storeCookie(pcb->remote_addr,
+                    tcp->m_received_opts.fast_open_cookie,
+                    tcp->m_received_opts.fast_open_cookie_len, pcb->base_snd_mss);
+            }
+            
             // Initialize certain sender variables.
             std::uint16_t pmtu = pcb->snd_mss; // pmtu was stored to snd_mss temporarily
             pcb_complete_established_transition(pcb, pmtu);
@@ -908,6 +1739,13 @@ private:
             
             // Possible transitions in callback (except to CLOSED):
             // - ESTABLISHED->FIN_WAIT_1
+            
+            // Handle data sent in the SYN which was acknowledged.
+            if (TcpProto::EnableFastOpen && syn_data_acked > 0) {
+                if (!pcb_syn_data_acked(pcb, syn_data_acked)) {
+                    return false;
+                }
+            }
         } else {
             // We have a Listener (if it went away the PCB would have been aborted).
             Listener *lis = pcb->lis;
@@ -925,6 +1763,7 @@ private:
             
             // Call the EstablishedHandler callback of the listener to allow the
             // application to accept the connection.
+            lis->m_stats.inc(&TcpListenerStats::established);
             lis->m_established_handler();
             
             // Handle abort of PCB.
@@ -960,6 +1799,38 @@ private:
         return true;
     }
     
+    // Advance over data sent in the SYN (Fast Open) which was acknowledged by the
+    // SYN-ACK, in the same way as pcb_input_ack_wnd_processing does for other data.
+    // Returns false if the PCB was aborted in the callback.
+    static bool pcb_syn_data_acked (TcpPcb *pcb, TcpSeqInt data_acked)
+    {
+        AIPSTACK_ASSERT(pcb->snd_nxt == pcb->snd_una);
+        
+        Connection *con = pcb->con;
+        AIPSTACK_ASSERT(con != nullptr);
+        AIPSTACK_ASSERT(data_acked <= con->m_v.snd_buf.tot_len);
+        // Nothing has been sent since the SYN so the send offset is zero.
+        AIPSTACK_ASSERT(con->m_v.snd_buf_cur.tot_len == con->m_v.snd_buf.tot_len);
+        
+        pcb->snd_una += data_acked;
+        pcb->snd_nxt = pcb->snd_una;
+        
+        con->m_v.snd_buf = ipBufSkipBytes(con->m_v.snd_buf, data_acked);
+        con->m_v.snd_buf_cur = con->m_v.snd_buf;
+        con->m_v.snd_psh_index -= MinValueU(data_acked, con->m_v.snd_psh_index);
+        
+        // The snd_wnd is relative to the acknowledgement number so it is already
+        // correct. If all data was acknowledged, there may be nothing left to send
+        // and the OutPending flag must be cleared (see its description).
+        if (!Output::pcb_has_snd_outstanding(pcb)) {
+            pcb->clearFlag(TcpPcbFlags::OutPending);
+        }
+        
+        // Report data-sent event to the user.
+        con->data_sent(data_acked);
+        return !pcb_aborted_in_callback(pcb);
+    }
+    
     static bool pcb_input_ack_wnd_processing (TcpPcb *pcb,
         TcpSegMeta const &tcp_meta, TcpSeqInt acked, std::size_t orig_data_len)
     {
@@ -971,6 +1842,19 @@ private:
             pcb->tcp->move_unrefed_pcb_to_front(pcb);
         }
         
+        // With Fast Open, an ACK implies that our SYN-ACK has been received.
+        if (TcpProto::EnableFastOpen && AIPSTACK_UNLIKELY(pcb->fast_open_syn_ack)) {
+            pcb->fast_open_syn_ack = false;
+        }
+        
+        // Process any SACK blocks in the segment.
+        if (TcpProto::NumSackBlocks > 0 && pcb->hasFlag(TcpPcbFlags::SackPerm)) {
+            pcb_input_sack_processing(pcb);
+        }
+        
+        // Whether this is a duplicate ACK, set below.
+        bool dup_ack = false;
+        
         // Handle new acknowledgments.
         if (acked > 0) {
             // We can only get here if there was anything pending acknowledgement
@@ -987,6 +1871,11 @@ private:
             // measurement and congestion control related processing.
             Output::pcb_output_handle_acked(pcb, tcp_meta.ack_num, acked);
             
+            // Remove SACK information about data that is now ACKed.
+            if (TcpProto::NumSackBlocks > 0 && pcb->con != nullptr) {
+                pcb->con->m_v.sack_sb.ackReceived(pcb->snd_una, tcp_meta.ack_num);
+            }
+            
             // Update snd_una due to sequences having been ACKed.
             pcb->snd_una = tcp_meta.ack_num;
             
@@ -1054,6 +1943,11 @@ private:
                 AIPSTACK_ASSERT(pcb->state() ==
                     OneOf(TcpStates::FIN_WAIT_1, TcpStates::CLOSING, TcpStates::LAST_ACK));
                 
+                // Report any data sent which was held back first.
+                if (AIPSTACK_UNLIKELY(!pcb_deliver_batch_data(pcb))) {
+                    return false;
+                }
+                
                 // Tell Connection and application (if any) about end sent.
                 Connection *con = pcb->con;
                 if (AIPSTACK_LIKELY(con != nullptr)) {
@@ -1087,8 +1981,10 @@ private:
                 // Is any data or FIN outstanding?
                 if (AIPSTACK_LIKELY(Output::pcb_has_snd_outstanding(pcb))) {
                     // Stop the rtx_timer since any running timeout is no longer
-                    // valid due to something having been acked.
+                    // valid due to something having been acked. The same goes for
+                    // the LossTimer, it is set again below or by output if needed.
                     pcb->tim(RtxTimer()).unset();
+                    pcb->tim(LossTimer()).unset();
                     
                     // Schedule pcb_output_active/pcb_output_abandoned, so that the
                     // rtx_timer will be restarted if needed (for retransmission or
@@ -1102,8 +1998,11 @@ private:
                     // Clear the OutPending flag due to its preconditions.
                     pcb->clearFlag(TcpPcbFlags::OutPending);
                     
-                    // Stop the output timer due to assert in its handler.
+                    // Stop the output timers due to asserts in their handlers,
+                    // and the LossTimer which is not needed with nothing unacked.
                     pcb->tim(OutputTimer()).unset();
+                    pcb->tim(PaceTimer()).unset();
+                    pcb->tim(LossTimer()).unset();
                 }
             }
         }
@@ -1118,10 +2017,23 @@ private:
                 pcb->con != nullptr &&
                 pcb_decode_wnd_size(pcb, tcp_meta.window_size) == pcb->con->m_v.snd_wnd
             ) {
+                pcb->stats.inc(&TcpConnectionCounters::dup_acks);
+                dup_ack = true;
+                
                 if (pcb->num_dupack <
                         Constants::FastRtxDupAcks + Constants::MaxAdditionaDupAcks)
                 {
                     pcb->num_dupack++;
+                    
+                    // With SACK, the threshold for fast retransmit is also reached if
+                    // at least that many segments of data have been SACKed (RFC 6675
+                    // section 5). This matters if the receiver coalesces segments.
+                    if (pcb->num_dupack < Constants::FastRtxDupAcks &&
+                        pcb_sack_dupthresh_reached(pcb))
+                    {
+                        pcb->num_dupack = Constants::FastRtxDupAcks;
+                    }
+                    
                     if (pcb->num_dupack == Constants::FastRtxDupAcks) {
                         Output::pcb_fast_rtx_dup_acks_received(pcb);
                     }
@@ -1132,6 +2044,21 @@ private:
             }
         }
         
+        // With PRR, determine how much to send in fast recovery for this ACK.
+        if (TcpProto::EnablePrr && pcb->num_dupack >= Constants::FastRtxDupAcks &&
+            pcb->state().canOutput() && pcb->con != nullptr &&
+            Output::pcb_has_snd_unacked(pcb))
+        {
+            Output::pcb_prr_ack_received(pcb, acked, dup_ack);
+        }
+        
+        // With RACK, start the reordering timeout if SACK has reported a hole.
+        if (TcpProto::UseRackTlp && pcb->state().canOutput() && pcb->con != nullptr &&
+            pcb->hasFlag(TcpPcbFlags::SackPerm))
+        {
+            Output::pcb_rack_ack_processed(pcb);
+        }
+        
         // Handle window updates.
         // Our update logic is much simpler than recommented RFC 793:
         // update the window if the segment is not an old ACK. This is
@@ -1152,6 +2079,119 @@ private:
         return true;
     }
     
+    // Process the ECN signals of a segment for a connection using ECN (RFC 3168,
+    // or RFC 8257 with UseDctcp). As the receiver, congestion experienced is
+    // echoed back with ECE. As the sender, ECE results in a window reduction at
+    // most once per window of data, and the next new data segment carries CWR.
+    static void pcb_input_ecn_processing (TcpPcb *pcb, TcpSegMeta const &tcp_meta,
+                                          TcpSeqInt acked)
+    {
+        AIPSTACK_ASSERT(TcpProto::EnableEcn);
+        AIPSTACK_ASSERT(pcb->ecn_ok);
+        
+        if (AIPSTACK_UNLIKELY(tcp_meta.ecn_ce)) {
+            pcb->stats.inc(&TcpConnectionCounters::ecn_ce_received);
+        }
+        
+        if (TcpProto::UseDctcp) {
+            // Echo the CE state of the latest segment, acknowledging right away
+            // when it changes so that the sender sees the exact marked fraction.
+            if (pcb->ecn_ce_echo != tcp_meta.ecn_ce) {
+                pcb->ecn_ce_echo = tcp_meta.ecn_ce;
+                pcb->setFlag(TcpPcbFlags::AckPending);
+            }
+        } else {
+            // Stop sending ECE when the sender reports that it has reduced the
+            // window with CWR, but start again for a new CE. A CE is acknowledged
+            // right away so that the sender can respond quickly.
+            if ((tcp_meta.flags & Tcp4Flags::Cwr) != Enum0) {
+                pcb->ecn_ce_echo = false;
+            }
+            if (AIPSTACK_UNLIKELY(tcp_meta.ecn_ce)) {
+                pcb->ecn_ce_echo = true;
+                pcb->setFlag(TcpPcbFlags::AckPending);
+            }
+        }
+        
+        // The rest is sender processing which needs the Connection.
+        Connection *con = pcb->con;
+        if (AIPSTACK_UNLIKELY(con == nullptr) || !pcb->state().canOutput()) {
+            return;
+        }
+        
+        bool ece = (tcp_meta.flags & Tcp4Flags::Ece) != Enum0;
+        
+        // Allow another reduction once the data sent at the last one is acked.
+        if (pcb->ecn_reduced && !pcb->snd_una.mod_lt(con->m_v.ecn_recover)) {
+            pcb->ecn_reduced = false;
+        }
+        
+        if (TcpProto::UseDctcp) {
+            // Count acknowledged bytes and those acknowledged with ECE. At the
+            // end of each window of data, update the estimate of the fraction
+            // of marked data: alpha = (1 - g) * alpha + g * F.
+            con->m_v.dctcp_acked += acked;
+            if (ece) {
+                con->m_v.dctcp_ce_acked += acked;
+            }
+            
+            if (!pcb->snd_una.mod_lt(con->m_v.dctcp_wnd_end)) {
+                std::uint32_t frac = 0;
+                if (con->m_v.dctcp_acked > 0) {
+                    frac = std::uint32_t((std::uint64_t(con->m_v.dctcp_ce_acked) <<
+                        Constants::DctcpAlphaBits) / con->m_v.dctcp_acked);
+                }
+                std::uint32_t alpha = con->m_v.dctcp_alpha;
+                alpha = alpha - (alpha >> Constants::DctcpGainShift) +
+                    (frac >> Constants::DctcpGainShift);
+                con->m_v.dctcp_alpha = std::uint16_t(
+                    MinValue(alpha, std::uint32_t(1) << Constants::DctcpAlphaBits));
+                
+                con->m_v.dctcp_wnd_end = pcb->snd_nxt;
+                con->m_v.dctcp_acked = 0;
+                con->m_v.dctcp_ce_acked = 0;
+            }
+        }
+        
+        // Reduce the window in response to ECE, except during loss recovery
+        // which has reduced the window already.
+        if (ece && !pcb->ecn_reduced && !Output::pcb_in_recovery(pcb)) {
+            Output::pcb_ecn_reduce_cwnd(pcb);
+        }
+    }
+    
+    // Update the SACK scoreboard based on SACK blocks in the received segment.
+    static void pcb_input_sack_processing (TcpPcb *pcb)
+    {
+        TcpProto *tcp = pcb->tcp;
+        
+        // Quick check that there are any options at all, and that we have
+        // something unacknowledged to which SACK blocks could apply.
+        if (AIPSTACK_LIKELY(tcp->m_received_opts_buf.tot_len == 0) ||
+            pcb->snd_una == pcb->snd_nxt || pcb->con == nullptr)
+        {
+            return;
+        }
+        
+        // Make sure received options are parsed.
+        parse_received_opts(tcp);
+        
+        TcpOptions const &opts = tcp->m_received_opts;
+        if ((opts.options & TcpOptionFlags::Sack) != Enum0) {
+            pcb->con->m_v.sack_sb.addBlocks(pcb->snd_una, pcb->snd_nxt,
+                                            opts.sack_blocks, opts.num_sack_blocks);
+        }
+    }
+    
+    // Check if enough data has been SACKed to consider the first unacknowledged
+    // segment lost.
+    inline static bool pcb_sack_dupthresh_reached (TcpPcb *pcb)
+    {
+        return TcpProto::NumSackBlocks > 0 && pcb->hasFlag(TcpPcbFlags::SackPerm) &&
+            pcb->con->m_v.sack_sb.getTotalSackedLen() >=
+                Constants::FastRtxDupAcks * TcpSeqInt(pcb->snd_mss);
+    }
+    
     static bool pcb_input_rcv_processing (TcpPcb *pcb,
         TcpSeqInt eff_rel_seq, bool seg_fin, IpBufRef const &tcp_data)
     {
@@ -1171,6 +2211,9 @@ private:
         std::size_t rcv_datalen;
         bool rcv_fin;
         
+        // In-sequence data to be given to the application without copying, if any.
+        IpBufRef zc_data = IpBufRef{};
+        
         // Handling for abandoned connection
         if (AIPSTACK_UNLIKELY(con == nullptr)) {
             // If the segment is out-of-sequence, or has any data, abort the
@@ -1200,12 +2243,15 @@ private:
                     return false;
                 }
                 
-                // Copy any received data into the receive buffer, shifting it.
-                con->m_v.rcv_buf = ipBufGiveBuf(con->m_v.rcv_buf, tcp_data);
+                pcb_rcv_in_sequence_data(pcb, tcp_data, zc_data);
             }
         }
         // Slow path performs out-of-sequence buffering.
         else {
+            if (eff_rel_seq != 0) {
+                pcb->stats.inc(&TcpConnectionCounters::oos_segs);
+            }
+            
             // Update information about out-of-sequence data and FIN.
             TcpSeqNum eff_seq = pcb->rcv_nxt + eff_rel_seq;
             bool need_ack;
@@ -1223,6 +2269,12 @@ private:
                 pcb->setFlag(TcpPcbFlags::AckPending);
             }
             
+            // Out-of-sequence data suggests loss, so acknowledge subsequent data
+            // right away to help the sender recover.
+            if (TcpProto::EnableDelayedAck) {
+                con->m_v.quick_acks = TcpProto::QuickAckSegs;
+            }
+            
             if (tcp_data.tot_len > 0) {
                 // Check that there is buffer space available for the received data.
                 if (AIPSTACK_UNLIKELY(
@@ -1257,13 +2309,85 @@ private:
         TcpSeqInt rcv_seqlen = TcpSeqInt(rcv_datalen) + rcv_fin;
         
         // Process received data/FIN.
-        return pcb_process_received(pcb, rcv_seqlen, rcv_datalen);
+        return pcb_process_received(pcb, rcv_seqlen, rcv_datalen, zc_data);
+    }
+    
+    // Copy received in-sequence data into the receive buffer, shifting it, when
+    // nothing is buffered out-of-sequence and there is enough buffer space.
+    // The copy is skipped if recvIp4Dgram already copied exactly this data to the
+    // same place, or if the data will be given to the application in the
+    // retainable receive buffer (zero-copy mode), in which case zc_data is set.
+    // In the latter case the receive buffer is still shifted so that the data
+    // held by the application is accounted in the window.
+    inline static void pcb_rcv_in_sequence_data (TcpPcb *pcb, IpBufRef const &tcp_data,
+                                                 IpBufRef &zc_data)
+    {
+        Connection *con = pcb->con;
+        std::size_t datalen = tcp_data.tot_len;
+        AIPSTACK_ASSERT(con->m_v.ooseq.isNothingBuffered());
+        AIPSTACK_ASSERT(con->m_v.rcv_buf.tot_len >= datalen);
+        
+        IpBufRef precopied = pcb->tcp->m_rcv_precopied_buf;
+        if (pcb_can_zero_copy(pcb)) {
+            con->m_v.rcv_buf = ipBufSkipBytes(con->m_v.rcv_buf, datalen);
+            zc_data = tcp_data;
+        }
+        else if (AIPSTACK_LIKELY(precopied.node == con->m_v.rcv_buf.node &&
+                            precopied.offset == con->m_v.rcv_buf.offset &&
+                            precopied.tot_len == datalen))
+        {
+            con->m_v.rcv_buf = ipBufSkipBytes(con->m_v.rcv_buf, datalen);
+        } else {
+            con->m_v.rcv_buf = ipBufGiveBuf(con->m_v.rcv_buf, tcp_data);
+        }
+    }
+    
+    // Decide whether the ACK for received in-sequence data can be delayed (RFC 1122,
+    // RFC 5681) and if so start the delayed ACK timer. An ACK is sent right away if
+    // a delayed ACK is already pending (so every second segment is acknowledged),
+    // for the first QuickAckSegs segments after the connection was established,
+    // after receiving out-of-sequence data or after an idle period, and while
+    // out-of-sequence data is buffered.
+    static bool pcb_delay_ack (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(TcpProto::EnableDelayedAck);
+        
+        Connection *con = pcb->con;
+        if (AIPSTACK_UNLIKELY(con == nullptr)) {
+            return false;
+        }
+        
+        // Enter quick-ack if no data has been received for longer than RTO,
+        // since the sender may be restarting from a small cwnd.
+        TimeType now = pcb->platform().getEventTime();
+        TimeType idle_end = con->m_v.rcv_data_time + Output::pcb_rto_time(pcb);
+        if (!Platform::timeGreaterOrEqual(idle_end, now)) {
+            con->m_v.quick_acks = TcpProto::QuickAckSegs;
+        }
+        con->m_v.rcv_data_time = now;
+        
+        if (con->m_v.quick_acks > 0) {
+            con->m_v.quick_acks--;
+            return false;
+        }
+        
+        if (pcb->hasFlag(TcpPcbFlags::AckDelayed) ||
+            !con->m_v.ooseq.isNothingBuffered())
+        {
+            return false;
+        }
+        
+        pcb->setFlag(TcpPcbFlags::AckDelayed);
+        pcb->tim(DelAckTimer()).setAfter(DelayedAckTicks);
+        return true;
     }
     
     // Update state due to any received data (e.g. rcv_nxt), make state transitions
     // due to any received FIN, and call associated application callbacks.
-    static bool pcb_process_received (
-        TcpPcb *pcb, TcpSeqInt rcv_seqlen, std::size_t rcv_datalen)
+    // If zc_data.node is not null, the data is given to the application without
+    // copying (zc_data.tot_len equals rcv_datalen).
+    static bool pcb_process_received (TcpPcb *pcb, TcpSeqInt rcv_seqlen,
+                                      std::size_t rcv_datalen, IpBufRef zc_data)
     {
         // If nothing was received we have nothing to do.
         if (rcv_seqlen == 0) {
@@ -1282,9 +2406,20 @@ private:
         } else {
             pcb->rcv_ann_wnd = 0;
         }
+        if (TcpProto::RcvMemBudget > 0 && pcb->con != nullptr) {
+            TcpProto::pcb_rcv_mem_update(pcb);
+        }
         
-        // Make sure an ACK is sent.
-        pcb->setFlag(TcpPcbFlags::AckPending);
+        // Make sure an ACK is sent, possibly delayed if only data was received.
+        // Data received in a Fast Open SYN has already been acknowledged by the
+        // SYN-ACK (see listen_fast_open_input), any later segment would have
+        // cleared fast_open_syn_ack in pcb_input_ack_wnd_processing.
+        if (TcpProto::EnableFastOpen && AIPSTACK_UNLIKELY(pcb->fast_open_syn_ack)) {}
+        else if (!TcpProto::EnableDelayedAck || rcv_seqlen != rcv_datalen ||
+            !pcb_delay_ack(pcb))
+        {
+            pcb->setFlag(TcpPcbFlags::AckPending);
+        }
         
         // Processing a FIN?
         if (AIPSTACK_UNLIKELY(rcv_seqlen > rcv_datalen)) {
@@ -1318,17 +2453,43 @@ private:
             pcb->setFlag(TcpPcbFlags::RcvWndUpd);
             
             // Give any data to the user.
-            con->data_received(rcv_datalen);
+            pcb->tcp->m_stack->traceLatency(IpLatencyStage::AppCallback);
+            if (AIPSTACK_LIKELY(zc_data.node == nullptr)) {
+                con->data_received(rcv_datalen);
+            } else {
+                AIPSTACK_ASSERT(zc_data.tot_len == rcv_datalen);
+                // Report any data received which was held back first.
+                if (AIPSTACK_UNLIKELY(!pcb_deliver_batch_data(pcb))) {
+                    return false;
+                }
+                if (AIPSTACK_LIKELY(pcb->con != nullptr)) {
+                    pcb->con->data_received_zero_copy(zc_data, pcb->tcp->m_rcv_rx_buf);
+                }
+            }
             if (AIPSTACK_UNLIKELY(pcb_aborted_in_callback(pcb))) {
                 return false;
             }
             // Possible transitions in callback (except to CLOSED):
             // - ESTABLISHED->FIN_WAIT_1
             // - CLOSE_WAIT->LAST_ACK
+            
+            // Do receive buffer auto-tuning if enabled.
+            if (TcpProto::RcvBufAutoTuning && pcb->con != nullptr &&
+                pcb->con->m_v.rcv_tune_size > 0)
+            {
+                if (AIPSTACK_UNLIKELY(!pcb_rcv_buf_autotune(pcb, rcv_datalen))) {
+                    return false;
+                }
+            }
         }
         
         // Processing a FIN?
         if (AIPSTACK_UNLIKELY(rcv_seqlen > rcv_datalen)) {
+            // Report any data received which was held back first.
+            if (AIPSTACK_UNLIKELY(!pcb_deliver_batch_data(pcb))) {
+                return false;
+            }
+            
             // Tell Connection and application (if any) about end received.
             Connection *con = pcb->con;
             if (AIPSTACK_LIKELY(con != nullptr)) {
@@ -1343,6 +2504,12 @@ private:
             // Complete transition from FIN_WAIT_2 to TIME_WAIT.
             if (pcb->state() == TcpStates::FIN_WAIT_2_TIME_WAIT) {
                 TcpProto::pcb_go_to_time_wait(pcb);
+                
+                // With the TIME_WAIT table the PCB has been closed (and the ACK
+                // has been sent).
+                if (TcpProto::UseTimeWaitTable) {
+                    return false;
+                }
             }
         }
         
@@ -1377,6 +2544,16 @@ private:
         // MaxWindow since max_ann will be less than MaxWindow.
         TcpSeqInt bounded_wnd = MinValueU(pcb->con->m_v.rcv_buf.tot_len, max_ann);
         
+        // Limit the window according to the receive memory budget. While it is
+        // limited, RcvWndUpd is kept set so that pcb_ann_wnd tries again.
+        if constexpr (TcpProto::RcvMemBudget > 0) {
+            TcpSeqInt limit = TcpProto::pcb_rcv_mem_limit(pcb);
+            if (bounded_wnd > limit) {
+                bounded_wnd = limit;
+                pcb->setFlag(TcpPcbFlags::RcvWndUpd);
+            }
+        }
+        
         // Clear the lowest order bits which cannot be sent with the current
         // window scale factor. The already calculated max_ann is suitable
         // as a mask for this (consider that bounded_wnd<=max_ann).
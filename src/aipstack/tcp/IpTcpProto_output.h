@@ -27,6 +27,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
 
 #include <aipstack/misc/Use.h>
 #include <aipstack/misc/Assert.h>
@@ -48,6 +49,8 @@
 #include <aipstack/tcp/TcpPcbFlags.h>
 #include <aipstack/tcp/TcpPcbKey.h>
 #include <aipstack/tcp/TcpOptions.h>
+#include <aipstack/tcp/TcpFastOpenCookie.h>
+#include <aipstack/tcp/TcpCongCtrl.h>
 
 namespace AIpStack {
 
@@ -60,13 +63,23 @@ class IpTcpProto_output
 {
     using TcpProto = IpTcpProto<Arg>;
     
-    AIPSTACK_USE_TYPES(TcpProto, (TcpPcb, Input, TimeType, Constants, OutputTimer,
-                                  RtxTimer, StackArg, Connection))
+    AIPSTACK_USE_TYPES(TcpProto, (TcpPcb, Input, Platform, TimeType, Constants,
+                                  OutputTimer, RtxTimer, PaceTimer, LossTimer, StackArg,
+                                  Connection, TimeWaitEntry))
     AIPSTACK_USE_TYPES(Constants, (RttType, RttNextType))
     AIPSTACK_USE_VALS(IpStack<StackArg>, (HeaderBeforeIp4Dgram))
 
     inline static constexpr RttType RttTypeMax = TypeMax<RttType>;
     
+    // Maximum number of SACK blocks in segments other than SYN.
+    inline static constexpr std::uint8_t MaxSendSackBlocks =
+        TcpProto::UseTimestamps ? TcpMaxSackBlocksWithTimestamps : TcpMaxSackBlocks;
+    
+    // Maximum length of TCP options in data segments (timestamps and SACK).
+    inline static constexpr std::size_t MaxDataSegOptsLen =
+        (TcpProto::UseTimestamps ? TcpOptionWriteLen::Timestamps : 0) +
+        ((TcpProto::NumSackBlocks > 0) ? TcpSackOptionWriteLen(MaxSendSackBlocks) : 0);
+
 public:
     // Check if our FIN has been ACKed.
     static bool pcb_fin_acked (TcpPcb *pcb)
@@ -75,22 +88,32 @@ public:
     }
     
     // Send SYN or SYN-ACK packet (in the SYN_SENT or SYN_RCVD states respectively).
+    // With Fast Open, the first SYN may include data and the SYN-ACK a cookie.
     AIPSTACK_NO_INLINE
     static void pcb_send_syn (TcpPcb *pcb)
     {
         AIPSTACK_ASSERT(pcb->state() == OneOf(TcpStates::SYN_SENT, TcpStates::SYN_RCVD));
         
-        // Include the MSS option.
+        // Include the common SYN options. The iface_mss is stored in a variable
+        // otherwise unused in this state.
         TcpOptions tcp_opts;
-        tcp_opts.options = TcpOptionFlags::Mss;
-        // The iface_mss is stored in a variable otherwise unused in this state.
-        tcp_opts.mss = (pcb->state() == TcpStates::SYN_SENT) ?
-            pcb->base_snd_mss : pcb->snd_mss;
-        
-        // Send the window scale option if needed.
-        if (pcb->hasFlag(TcpPcbFlags::WndScale)) {
-            tcp_opts.options |= TcpOptionFlags::WndScale;
-            tcp_opts.wnd_scale = pcb->rcv_wnd_shift;
+        pcb_make_syn_opts(pcb, (pcb->state() == TcpStates::SYN_SENT) ?
+            pcb->base_snd_mss : pcb->snd_mss, tcp_opts);
+        
+        // Include the Fast Open option if needed, possibly with data.
+        IpBufRef data = IpBufRef{};
+        if (TcpProto::EnableFastOpen && pcb->fast_open) {
+            if (pcb->state() == TcpStates::SYN_SENT) {
+                // Only the first SYN uses Fast Open, retransmissions are normal.
+                if (pcb->snd_nxt == pcb->snd_una) {
+                    pcb_make_fast_open_syn(pcb, tcp_opts, data);
+                }
+            } else {
+                tcp_opts.options |= TcpOptionFlags::FastOpen;
+                tcp_opts.fast_open_cookie_len = TcpFastOpenCookie::Length;
+                TcpFastOpenCookie::make(pcb->tcp->m_fast_open_secret,
+                    pcb->local_addr, pcb->remote_addr, tcp_opts.fast_open_cookie);
+            }
         }
         
         // The SYN and SYN-ACK must always have non-scaled window size.
@@ -102,9 +125,23 @@ public:
         Tcp4Flags flags = Tcp4Flags::Syn |
             ((pcb->state() == TcpStates::SYN_RCVD) ? Tcp4Flags::Ack : Tcp4Flags(0));
         
+        // Request or confirm ECN (RFC 3168 section 6.1.1). A retransmitted SYN
+        // does not request ECN in case the ECN-setup SYN is dropped by the path.
+        if (TcpProto::EnableEcn && pcb->ecn_ok) {
+            if (pcb->state() == TcpStates::SYN_RCVD) {
+                flags |= Tcp4Flags::Ece;
+            }
+            else if (pcb->snd_nxt == pcb->snd_una) {
+                flags |= Tcp4Flags::Ece|Tcp4Flags::Cwr;
+            }
+            else {
+                pcb->ecn_ok = false;
+            }
+        }
+        
         // Send the segment.
-        IpErr err = send_tcp_nodata(pcb->tcp, *pcb, pcb->snd_una, pcb->rcv_nxt,
-                                    window_size, flags, &tcp_opts, pcb);
+        IpErr err = send_tcp_data(pcb->tcp, *pcb, pcb->snd_una, pcb->rcv_nxt,
+                                  window_size, flags, &tcp_opts, pcb, data);
         
         if (err == IpErr::Success) {
             // Have we sent the SYN for the first time?
@@ -121,24 +158,259 @@ public:
         }
     }
     
+    // Resend the SYN-ACK of a connection which was accepted with Fast Open, in
+    // response to a retransmitted SYN when our SYN-ACK may have been lost.
+    static void pcb_resend_fast_open_syn_ack (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->state() != TcpStates::CLOSED);
+        AIPSTACK_ASSERT(!pcb->state().isSynSentOrRcvd());
+        AIPSTACK_ASSERT(pcb->fast_open_syn_ack);
+        
+        // Our MSS is not remembered but base_snd_mss is not larger.
+        TcpOptions tcp_opts;
+        pcb_make_syn_opts(pcb, pcb->base_snd_mss, tcp_opts);
+        
+        // Nothing can have been acknowledged beyond the SYN, so this is the
+        // sequence number of the SYN. The window is not scaled in a SYN-ACK.
+        std::uint16_t window_size = MinValueU(pcb->rcv_ann_wnd, TypeMax<std::uint16_t>);
+        Tcp4Flags flags = Tcp4Flags::Syn|Tcp4Flags::Ack;
+        if (TcpProto::EnableEcn && pcb->ecn_ok) {
+            flags |= Tcp4Flags::Ece;
+        }
+        pcb_send_nodata(pcb, pcb->snd_una - 1u, window_size, flags, &tcp_opts);
+    }
+    
+    // Prepare the options common to the SYN and SYN-ACK (MSS, window scale,
+    // SACK-permitted and timestamps).
+    static void pcb_make_syn_opts (TcpPcb *pcb, std::uint16_t mss, TcpOptions &tcp_opts)
+    {
+        // Include the MSS option.
+        tcp_opts.options = TcpOptionFlags::Mss;
+        tcp_opts.mss = mss;
+        
+        // Send the window scale option if needed.
+        if (pcb->hasFlag(TcpPcbFlags::WndScale)) {
+            tcp_opts.options |= TcpOptionFlags::WndScale;
+            tcp_opts.wnd_scale = pcb->rcv_wnd_shift;
+        }
+        
+        // Send the SACK-permitted option if SACK is to be used.
+        if (TcpProto::NumSackBlocks > 0 && pcb->hasFlag(TcpPcbFlags::SackPerm)) {
+            tcp_opts.options |= TcpOptionFlags::SackPerm;
+        }
+        
+        // Send the timestamps option if timestamps are to be used. In SYN_SENT
+        // the echoed timestamp is zero, otherwise it is TS.Recent (in SYN_RCVD
+        // that of the SYN).
+        if (TcpProto::UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+            tcp_opts.options |= TcpOptionFlags::Timestamps;
+            tcp_opts.ts_val = pcb_ts_clock(pcb);
+            tcp_opts.ts_ecr = (pcb->state() == TcpStates::SYN_SENT) ? 0 : pcb->ts_recent;
+        }
+    }
+    
+    // Add the Fast Open option to the first SYN of a connection. If a cookie for
+    // the server is cached, it is sent along with as much data as fits into the
+    // segment, otherwise a cookie is requested.
+    static void pcb_make_fast_open_syn (TcpPcb *pcb, TcpOptions &tcp_opts, IpBufRef &data)
+    {
+        AIPSTACK_ASSERT(pcb->state() == TcpStates::SYN_SENT);
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        tcp_opts.options |= TcpOptionFlags::FastOpen;
+        
+        auto *entry = pcb->tcp->m_fast_open_cache.findEntry(pcb->remote_addr);
+        if (entry == nullptr) {
+            tcp_opts.fast_open_cookie_len = 0;
+            return;
+        }
+        
+        tcp_opts.fast_open_cookie_len = entry->cookie_len;
+        std::memcpy(tcp_opts.fast_open_cookie, entry->cookie, entry->cookie_len);
+        
+        // The segment must fit within the MSS of the server remembered with the
+        // cookie, the interface MSS (base_snd_mss) and the PMTU (stored in snd_mss).
+        std::uint16_t mss = MinValue(entry->mss, MinValue(pcb->base_snd_mss,
+            std::uint16_t(pcb->snd_mss - Ip4TcpHeaderSize)));
+        std::uint8_t opts_len = CalcTcpOptionsLength(tcp_opts);
+        
+        Connection *con = pcb->con;
+        data = con->m_v.snd_buf;
+        std::size_t max_data = (mss > opts_len) ? std::size_t(mss - opts_len) : 0;
+        data.tot_len = MinValue(data.tot_len, max_data);
+        
+        // Remember how much data was sent, the SYN-ACK may acknowledge it.
+        con->m_v.syn_data_len = std::uint16_t(data.tot_len);
+    }
+    
     // Send an empty ACK (which may be a window update).
     AIPSTACK_NO_INLINE
     static void pcb_send_empty_ack (TcpPcb *pcb)
     {
+        // Any delayed ACK is sent now. The DelAckTimer is left to expire
+        // since changing it would require a delayed timer update.
+        pcb->clearFlag(TcpPcbFlags::AckDelayed);
+        
         // Get the window size value.
         std::uint16_t window_size = Input::pcb_ann_wnd(pcb);
         
+        // Include timestamps and SACK blocks if appropriate.
+        TcpOptions tcp_opts;
+        bool have_opts = pcb_make_opts(pcb, tcp_opts);
+        
+        // Echo congestion experienced if needed.
+        Tcp4Flags flags = Tcp4Flags::Ack;
+        if (TcpProto::EnableEcn && pcb->ecn_ce_echo) {
+            flags |= Tcp4Flags::Ece;
+        }
+        
         // Send it.
-        send_tcp_nodata(pcb->tcp, *pcb, pcb->snd_nxt, pcb->rcv_nxt, window_size,
-                        Tcp4Flags::Ack, nullptr, pcb);
+        pcb_send_nodata(pcb, pcb->snd_nxt, window_size, flags,
+                        have_opts ? &tcp_opts : nullptr);
+    }
+    
+    // Send a keepalive probe, an ACK with the sequence number one before snd_una,
+    // to which the peer responds with an ACK (RFC 1122 section 4.2.3.6).
+    static void pcb_send_keepalive (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->state().isActive());
+        
+        std::uint16_t window_size = Input::pcb_ann_wnd(pcb);
+        
+        TcpOptions tcp_opts;
+        bool have_opts = pcb_make_opts(pcb, tcp_opts);
+        
+        pcb_send_nodata(pcb, pcb->snd_una - 1u, window_size, Tcp4Flags::Ack,
+                        have_opts ? &tcp_opts : nullptr);
+    }
+    
+    // Prepare the options to be sent in a segment other than SYN. These are the
+    // timestamps option if timestamps are used and the SACK option if SACK is used
+    // and there is out-of-sequence data buffered. Returns whether any options
+    // are to be sent.
+    static bool pcb_make_opts (TcpPcb *pcb, TcpOptions &tcp_opts)
+    {
+        tcp_opts.options = TcpOptionFlags(0);
+        std::uint8_t max_sack_blocks = TcpMaxSackBlocks;
+        
+        if (TcpProto::UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+            tcp_opts.options |= TcpOptionFlags::Timestamps;
+            tcp_opts.ts_val = pcb_ts_clock(pcb);
+            tcp_opts.ts_ecr = pcb->ts_recent;
+            max_sack_blocks = TcpMaxSackBlocksWithTimestamps;
+        }
+        
+        Connection *con = pcb->con;
+        if (TcpProto::NumSackBlocks > 0 && pcb->hasFlag(TcpPcbFlags::SackPerm) &&
+            con != nullptr && AIPSTACK_UNLIKELY(!con->m_v.ooseq.isNothingBuffered()))
+        {
+            // Get the blocks, there may be none if only a FIN is buffered.
+            std::uint8_t num_blocks =
+                con->m_v.ooseq.getSackBlocks(tcp_opts.sack_blocks, max_sack_blocks);
+            if (num_blocks > 0) {
+                tcp_opts.options |= TcpOptionFlags::Sack;
+                tcp_opts.num_sack_blocks = num_blocks;
+            }
+        }
+        
+        return tcp_opts.options != Enum0;
+    }
+    
+    // Get the current time of the timestamp clock truncated to 32 bits, used
+    // for the timestamps option (see Constants::TsClockMask), plus the offset
+    // of the PCB (nonzero only for imported connections).
+    inline static std::uint32_t pcb_ts_clock (TcpPcb *pcb)
+    {
+        return std::uint32_t(pcb->platform().getEventTime() >> Constants::TsClockShift) +
+            pcb->ts_offset;
+    }
+    
+    // Get the current time for congestion control (see Constants::CcClockMask).
+    inline static std::uint32_t pcb_cc_clock (TcpPcb *pcb)
+    {
+        return std::uint32_t(pcb->platform().getEventTime() >> Constants::CcClockShift);
+    }
+    
+    // Get the pacing rate in bytes per congestion control clock unit (with
+    // TcpCongCtrlRateBits fractional bits), or zero if there is no suitable rate.
+    static std::uint32_t pcb_pacing_rate (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        Connection *con = pcb->con;
+        
+        // Use any rate provided by congestion control.
+        std::uint32_t rate = con->m_v.cc.pacingRate(pcb_cc_context(pcb));
+        
+        // Otherwise pace at cwnd/srtt, but faster to allow growth of cwnd.
+        // The percentages are those used by Linux.
+        if (rate == 0 && pcb->hasFlag(TcpPcbFlags::RttValid)) {
+            std::uint64_t percent = (con->m_v.cwnd < con->m_v.ssthresh / 2u) ? 200 : 120;
+            std::uint64_t cwnd_scaled = std::uint64_t(con->m_v.cwnd) << TcpCongCtrlRateBits;
+            std::uint64_t srtt = std::uint64_t(MaxValue(con->m_v.srtt, RttType(1))) <<
+                (Constants::RttShift - Constants::CcClockShift);
+            std::uint64_t rate64 = (cwnd_scaled * percent / 100) / srtt;
+            rate = std::uint32_t(MinValue(rate64, std::uint64_t(TypeMax<std::uint32_t>)));
+        }
+        
+        return rate;
+    }
+    
+    // Update the pacing time after a segment has been sent at time now. Up to
+    // PacingBurstSegs segments may be sent back to back, after that sending
+    // continues at the pacing rate.
+    static void pcb_pace_segment_sent (TcpPcb *pcb, TimeType now, TcpSeqInt seg_seqlen,
+                                       std::uint32_t pace_rate)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        AIPSTACK_ASSERT(pace_rate > 0);
+        Connection *con = pcb->con;
+        
+        constexpr int Shift = TcpCongCtrlRateBits + Constants::CcClockShift;
+        constexpr std::uint64_t MaxDelay = Constants::MaxPaceDelayTicks;
+        
+        // Don't let the pacing time lag behind more than allows for a burst.
+        TcpSeqInt burst_len = TcpSeqInt(TcpProto::PacingBurstSegs - 1) * pcb->snd_mss;
+        TimeType burst_time =
+            MinValue((std::uint64_t(burst_len) << Shift) / pace_rate, MaxDelay);
+        TimeType start_time = con->m_v.pace_time;
+        if (!Platform::timeGreaterOrEqual(start_time, TimeType(now - burst_time))) {
+            start_time = now - burst_time;
+        }
+        
+        // Advance by the time needed to send the segment at the pacing rate.
+        TimeType seg_time = MinValue(
+            (std::uint64_t(seg_seqlen) << Shift) / pace_rate, MaxDelay);
+        con->m_v.pace_time = start_time + seg_time;
+    }
+    
+    // Make the context for calling congestion control hooks.
+    inline static TcpCongCtrlContext pcb_cc_context (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        Connection *con = pcb->con;
+        
+        return TcpCongCtrlContext{
+            /*cwnd=*/con->m_v.cwnd,
+            /*ssthresh=*/con->m_v.ssthresh,
+            /*flight_size=*/TcpSeqInt(pcb->snd_nxt - pcb->snd_una),
+            /*srtt=*/pcb->hasFlag(TcpPcbFlags::RttValid) ? con->m_v.srtt : RttType(0),
+            /*snd_mss=*/pcb->snd_mss,
+            /*now=*/pcb_cc_clock(pcb)
+        };
     }
     
     // Send an RST for this PCB.
     static void pcb_send_rst (TcpPcb *pcb)
+    {
+        pcb_send_rst(pcb, pcb->snd_nxt);
+    }
+    
+    // Send an RST for this PCB with the given sequence number.
+    static void pcb_send_rst (TcpPcb *pcb, TcpSeqNum seq_num)
     {
         bool ack = pcb->state() != TcpStates::SYN_SENT;
         
-        send_rst(pcb->tcp, *pcb, /*seq_num=*/pcb->snd_nxt, ack, /*ack_num=*/pcb->rcv_nxt);
+        send_rst(pcb->tcp, *pcb, seq_num, ack, /*ack_num=*/pcb->rcv_nxt);
     }
     
     static void pcb_need_ack (TcpPcb *pcb)
@@ -267,6 +539,7 @@ public:
         TcpSeqInt rem_wnd;
         std::size_t data_threshold;
         bool fin;
+        bool cwnd_limited = false;
         
         if (AIPSTACK_UNLIKELY(rtx_or_window_probe)) {
             // Send from the start of the start buffer. We take care to not
@@ -298,6 +571,12 @@ public:
             // we can send relative to the start of the send buffer.
             TcpSeqInt full_wnd = MinValue(con->m_v.snd_wnd, con->m_v.cwnd);
             
+            // Whether sending is limited by cwnd outside of loss recovery (see
+            // its use below).
+            cwnd_limited = con->m_v.cwnd < con->m_v.snd_wnd &&
+                pcb->num_dupack < Constants::FastRtxDupAcks &&
+                !pcb->hasFlag(TcpPcbFlags::RtxActive);
+            
             // Calculate the remaining window relative to snd_buf_cur.
             std::size_t snd_offset = con->m_v.snd_buf.tot_len - snd_buf_cur->tot_len;
             if (AIPSTACK_LIKELY(snd_offset <= full_wnd)) {
@@ -313,21 +592,113 @@ public:
             std::size_t psh_to_end = con->m_v.snd_buf.tot_len - con->m_v.snd_psh_index;
             data_threshold = MinValue(psh_to_end, std::size_t(pcb->snd_mss - 1));
             
+            // Also delay pushed data less than snd_mss when corked, and with the
+            // Nagle algorithm when some data is unacknowledged. Then at most one
+            // segment less than snd_mss is in flight. All data is sent after
+            // sending was closed.
+            if (AIPSTACK_UNLIKELY(con->m_v.snd_mode != TcpSendMode::Immediate) &&
+                pcb->state().isSndOpen() && (con->m_v.snd_mode == TcpSendMode::Cork ||
+                                             pcb_has_snd_unacked(pcb)))
+            {
+                data_threshold = pcb->snd_mss - 1;
+            }
+            
             // Allow sending a FIN if it is queued.
             fin = pcb->hasFlag(TcpPcbFlags::FinPending);
         }
         
         // Create the output helper (which optimizes sending multiple segments at a time).
-        PcbOutputHelper output_helper;
+        PcbOutputHelper output_helper(pcb);
+        
+        // Determine the pacing rate, zero if sending is not paced. Retransmissions
+        // and window probes are not paced.
+        std::uint32_t pace_rate = 0;
+        TimeType now = 0;
+        if (TcpProto::EnablePacing && AIPSTACK_LIKELY(!rtx_or_window_probe)) {
+            pace_rate = pcb_pacing_rate(pcb);
+            now = pcb->platform().getTime();
+        }
+        
+        // Determine the maximum data length of a segment. If super-segments are
+        // enabled, we send up to a multiple of the segment MSS in one segment,
+        // which is split by the interface or by the IP layer. This is not done
+        // for retransmission and window probes which should send one segment only.
+        std::size_t seg_mss = output_helper.getSegMss(pcb);
+        std::size_t max_seg_data = seg_mss;
+        if (TcpProto::MaxSuperSegmentData > 0 && AIPSTACK_LIKELY(!rtx_or_window_probe)) {
+            max_seg_data = MaxValue(max_seg_data,
+                TcpProto::MaxSuperSegmentData / seg_mss * seg_mss);
+            
+            // When pacing, do not send more than a burst in one segment.
+            if (TcpProto::EnablePacing && pace_rate != 0) {
+                max_seg_data = MinValue(max_seg_data,
+                    std::size_t(TcpProto::PacingBurstSegs) * seg_mss);
+            }
+        }
+        
+        // Check if a Path MTU probe should be sent, giving the probe MTU and the
+        // data length of the probe segment.
+        std::uint16_t probe_mtu = 0;
+        std::size_t probe_data_len = 0;
+        if (TcpProto::EnablePmtuProbing && AIPSTACK_LIKELY(!rtx_or_window_probe)) {
+            probe_mtu = pcb_pmtu_probe_size(pcb, seg_mss, probe_data_len);
+        }
         
         // Send segments while we have some non-delayable data or FIN
         // queued, and there is some window availabe. But for the case
         // of rtx_or_window_probe, this condition is always true.
         while ((snd_buf_cur->tot_len > data_threshold || fin) && rem_wnd > 0) {
+            // When retransmitting after requeuing (pcb_rtx_timer_handler_core),
+            // skip over data which the receiver has reported as received by SACK.
+            if (TcpProto::NumSackBlocks > 0 &&
+                AIPSTACK_UNLIKELY(!con->m_v.sack_sb.isEmpty()) && !rtx_or_window_probe)
+            {
+                std::size_t offset = con->m_v.snd_buf.tot_len - snd_buf_cur->tot_len;
+                TcpSeqInt sacked_len =
+                    con->m_v.sack_sb.getSackedLen(pcb->snd_una, pcb->snd_una + offset);
+                std::size_t skip_len = MinValueU(sacked_len, snd_buf_cur->tot_len);
+                if (skip_len > 0) {
+                    *snd_buf_cur = ipBufSkipBytes(*snd_buf_cur, skip_len);
+                    rem_wnd -= MinValueU(rem_wnd, skip_len);
+                    continue;
+                }
+            }
+            
+            // Don't send a less than full segment only because cwnd is nearly used
+            // up while more data is queued. Since cwnd>=snd_mss, there is data in
+            // flight in this case, and ACKs will allow sending full segments. This
+            // is not done in loss recovery where ACKs may not be forthcoming.
+            if (cwnd_limited && rem_wnd < seg_mss && snd_buf_cur->tot_len > rem_wnd) {
+                break;
+            }
+            
+            // If pacing does not allow sending yet, continue sending from the
+            // PaceTimer when it does.
+            if (TcpProto::EnablePacing && pace_rate != 0 &&
+                !Platform::timeGreaterOrEqual(now, con->m_v.pace_time))
+            {
+                pcb->tim(PaceTimer()).setAt(con->m_v.pace_time);
+                break;
+            }
+            
+            // Send the probe instead of a regular segment if it is pending and
+            // this would be new data. The probe must fit into the window and must
+            // not be the last data, so that its loss can be detected quickly.
+            std::size_t seg_max_data = max_seg_data;
+            bool pmtu_probe = false;
+            if (TcpProto::EnablePmtuProbing && AIPSTACK_UNLIKELY(probe_mtu != 0) &&
+                snd_buf_cur->tot_len > probe_data_len && rem_wnd >= probe_data_len &&
+                pcb->snd_una + (con->m_v.snd_buf.tot_len - snd_buf_cur->tot_len) ==
+                    pcb->snd_nxt)
+            {
+                seg_max_data = probe_data_len;
+                pmtu_probe = true;
+            }
+            
             // Send a segment.
             TcpSeqInt seg_seqlen;
-            IpErr err = pcb_output_segment(
-                pcb, output_helper, *snd_buf_cur, fin, rem_wnd, &seg_seqlen);
+            IpErr err = pcb_output_segment(pcb, output_helper, *snd_buf_cur, fin,
+                                           rem_wnd, seg_max_data, &seg_seqlen, pmtu_probe);
             
             // If we got the FragmentationNeeded error, make sure the Path MTU estimate
             // does not exceed the interface MTU, to handle lowering of the
@@ -355,6 +726,14 @@ public:
             AIPSTACK_ASSERT(seg_seqlen <= rem_wnd);
             AIPSTACK_ASSERT(seg_seqlen <= snd_buf_cur->tot_len + fin);
             
+            // Remember the probe so that its fate can be determined.
+            if (TcpProto::EnablePmtuProbing && AIPSTACK_UNLIKELY(pmtu_probe)) {
+                AIPSTACK_ASSERT(seg_seqlen == probe_data_len);
+                con->m_v.pmtu_probe_mtu = probe_mtu;
+                con->m_v.pmtu_probe_end = pcb->snd_nxt;
+                probe_mtu = 0;
+            }
+            
             // Check sent sequence length to see if a FIN was sent.
             std::size_t data_sent;
             if (AIPSTACK_UNLIKELY(seg_seqlen > snd_buf_cur->tot_len)) {
@@ -382,10 +761,28 @@ public:
             // Decrement remaining window.
             rem_wnd -= seg_seqlen;
             
+            // Advance the pacing time.
+            if (TcpProto::EnablePacing && pace_rate != 0) {
+                pcb_pace_segment_sent(pcb, now, seg_seqlen, pace_rate);
+            }
+            
             // Clear AckPending flag to avoid sending an empty ACK needlessly.
             pcb->clearFlag(TcpPcbFlags::AckPending);
         }
         
+        // Count the reason that sending stopped, unless this was due to pacing
+        // or an error (when some window remains).
+        if (TcpProto::EnableStats) {
+            if (snd_buf_cur->tot_len <= data_threshold && !fin) {
+                pcb->stats.inc(&TcpConnectionCounters::app_limited);
+            }
+            else if (rem_wnd == 0 || (cwnd_limited && rem_wnd < seg_mss)) {
+                pcb->stats.inc((con->m_v.snd_wnd <= con->m_v.cwnd) ?
+                    &TcpConnectionCounters::rwnd_limited :
+                    &TcpConnectionCounters::cwnd_limited);
+            }
+        }
+        
         // If the IdleTimer flag is set, clear it and ensure that the RtxTimer
         // is set. This way the code below for setting the timer does not need
         // to concern itself with the idle timeout, and performance is improved
@@ -399,12 +796,24 @@ public:
         // Otherwise start it if we have sent and unacknowledged data or
         // if we have zero window (to send windor probe). Note that for
         // zero window it would not be wrong to have an extra condition
-        // !pcb_may_delay_snd but we don't for simplicity.
+        // !pcb_may_delay_snd but we don't for simplicity. With the shared
+        // persist timer, window probes are scheduled by that instead.
         if (!pcb->tim(RtxTimer()).isSet()) {
-            if (AIPSTACK_LIKELY(pcb_has_snd_unacked(pcb)) || pcb->con->m_v.snd_wnd == 0) {
+            if (AIPSTACK_LIKELY(pcb_has_snd_unacked(pcb))) {
                 pcb->tim(RtxTimer()).setAfter(pcb_rto_time(pcb));
+            } else if (pcb->con->m_v.snd_wnd == 0) {
+                if (TcpProto::SharedPersistTimer) {
+                    TcpProto::pcb_persist_start(pcb);
+                } else {
+                    pcb->tim(RtxTimer()).setAfter(pcb_rto_time(pcb));
+                }
             }
         }
+        
+        // Schedule a tail loss probe if appropriate.
+        if (TcpProto::UseRackTlp) {
+            pcb_schedule_tail_loss_probe(pcb);
+        }
     }
     
     /**
@@ -478,6 +887,19 @@ public:
         pcb->doDelayedTimerUpdate();
     }
     
+    inline static void pcb_delack_timer_handler (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->state() != TcpStates::CLOSED);
+        
+        // Send the ACK unless it has been sent since the timer was set.
+        if (pcb->hasAndClearFlag(TcpPcbFlags::AckDelayed)) {
+            pcb_send_empty_ack(pcb);
+        }
+        
+        // Delayed timer update is needed by timer expiration.
+        pcb->doDelayedTimerUpdate();
+    }
+    
     inline static void pcb_rtx_timer_handler (TcpPcb *pcb)
     {
         // Handle retransmission or idle timeout.
@@ -521,15 +943,20 @@ public:
             
             Connection *con = pcb->con;
             
+            // Keep the CWND if the application disabled the restart.
+            if (!con->m_v.idle_cwnd_restart) {
+                return;
+            }
+            
             // Reduce the CWND (RFC 5681 section 4.1).
-            // Also reset cwnd_acked to avoid old accumulated value
-            // from causing an undesired cwnd increase later.
             TcpSeqInt initial_cwnd = CalcInitialTcpCwnd(pcb->snd_mss);
             if (con->m_v.cwnd >= initial_cwnd) {
                 con->m_v.cwnd = initial_cwnd;
                 pcb->setFlag(TcpPcbFlags::CwndInit);
             }
-            con->m_v.cwnd_acked = 0;
+            
+            // Let congestion control know about the restart.
+            con->m_v.cc.idleRestart(pcb_cc_context(pcb));
             
             // This is all, the remainder of this function is for retransmission.
             return;
@@ -553,13 +980,31 @@ public:
             return;
         }
         
+        pcb->stats.inc(&TcpConnectionCounters::rto_expired);
+        pcb->tcp->m_stats.inc(&TcpProtoStats::rto_expired);
+        
+        // Stop any RACK reordering timeout or tail loss probe, the RTO takes over.
+        if (TcpProto::UseRackTlp && !syn_sent_rcvd) {
+            pcb->tim(LossTimer()).unset();
+            if (pcb->con != nullptr) {
+                pcb->con->m_v.tlp_active = false;
+            }
+        }
+        
         // Double the retransmission timeout and restart the timer.
         RttType doubled_rto = (pcb->rto > RttTypeMax / 2) ? RttTypeMax : (2 * pcb->rto);
         pcb->rto = MinValue(Constants::MaxRtxTime, doubled_rto);
         pcb->tim(RtxTimer()).setAfter(pcb_rto_time(pcb));
         
-        // In SYN_SENT and SYN_RCVD, only retransmit the SYN or SYN-ACK.
+        // In SYN_SENT and SYN_RCVD, only retransmit the SYN or SYN-ACK. In
+        // SYN_RCVD, count the retransmissions in num_dupack for deferred
+        // accept (see Input::pcb_input_syn_sent_rcvd_processing).
         if (syn_sent_rcvd) {
+            if (pcb->state() == TcpStates::SYN_RCVD &&
+                pcb->num_dupack < Constants::FastRtxDupAcks + Constants::MaxAdditionaDupAcks)
+            {
+                pcb->num_dupack++;
+            }
             pcb_send_syn(pcb);
             return;
         }
@@ -576,21 +1021,28 @@ public:
             // This is for data or FIN retransmission while not abandoned.
             
             // Check for first retransmission.
-            if (!pcb->hasFlag(TcpPcbFlags::RtxActive)) {
+            bool first_rtx = !pcb->hasFlag(TcpPcbFlags::RtxActive);
+            if (first_rtx) {
                 // Set flag to indicate there has been a retransmission.
                 // This will be cleared upon new ACK.
                 pcb->setFlag(TcpPcbFlags::RtxActive);
-                
-                // Update ssthresh (RFC 5681).
-                pcb_update_ssthresh_for_rtx(pcb);
+            }
+            
+            // Let congestion control update ssthresh (on the first retransmission).
+            con->m_v.cc.rtoExpired(pcb_cc_context(pcb), first_rtx);
+            
+            // Consider any outstanding Path MTU probe to have failed, and on
+            // repeated timeouts suspect a PMTU black hole.
+            if (TcpProto::EnablePmtuProbing) {
+                pcb_pmtu_probe_lost(pcb);
+                if (!first_rtx) {
+                    pcb_pmtu_black_hole(pcb);
+                }
             }
             
             // Set cwnd to one segment (RFC 5681).
-            // Also reset cwnd_acked to avoid old accumulated value
-            // from causing an undesired cwnd increase later.
             con->m_v.cwnd = pcb->snd_mss;
             pcb->clearFlag(TcpPcbFlags::CwndInit);
-            con->m_v.cwnd_acked = 0;
             
             // Set recover.
             pcb->setFlag(TcpPcbFlags::Recover);
@@ -599,6 +1051,13 @@ public:
             // Exit any fast recovery.
             pcb->num_dupack = 0;
             
+            // Forget any SACK information for data at snd_una. The receiver would
+            // have acknowledged such data unless it has discarded it, so that
+            // data must not be skipped when retransmitting.
+            if (TcpProto::NumSackBlocks > 0) {
+                con->m_v.sack_sb.ackReceived(pcb->snd_una, pcb->snd_una);
+            }
+            
             // Requeue all data and FIN.
             pcb_requeue_everything(pcb);
             
@@ -642,6 +1101,10 @@ public:
         
         Connection *con = pcb->con;
         
+        // Get a round-trip-time sample from the echoed timestamp if possible.
+        RttType ts_rtt;
+        bool have_ts_rtt = pcb_get_ts_rtt_sample(pcb, ts_rtt);
+        
         // Handle end of round-trip-time measurement.
         if (pcb->hasFlag(TcpPcbFlags::RttPending)) {
             // If we have RttPending outside of SYN_SENT/SYN_RCVD we must
@@ -649,14 +1112,36 @@ public:
             AIPSTACK_ASSERT(con != nullptr);
             
             if (con->m_v.rtt_test_seq.mod_lt(ack_num)) {
-                // Update the RTT variables and RTO.
-                pcb_end_rtt_measurement(pcb);
+                // Update the RTT variables and RTO, unless the timestamp
+                // sample is used instead.
+                if (have_ts_rtt) {
+                    pcb->clearFlag(TcpPcbFlags::RttPending);
+                } else {
+                    pcb_end_rtt_measurement(pcb);
+                }
                 
-                // Allow more CWND increase in congestion avoidance.
-                pcb->clearFlag(TcpPcbFlags::CwndIncrd);
+                // Let congestion control know that a round trip has completed.
+                con->m_v.cc.roundTripCompleted();
             }
         }
         
+        // With timestamps, the RTT variables and RTO are updated for every ACK.
+        if (have_ts_rtt) {
+            pcb_update_rtt(pcb, ts_rtt);
+        }
+        
+        // Handle the end of a tail loss probe episode.
+        if (TcpProto::UseRackTlp && AIPSTACK_LIKELY(con != nullptr) &&
+            AIPSTACK_UNLIKELY(con->m_v.tlp_active) && !ack_num.mod_lt(con->m_v.tlp_high_seq))
+        {
+            pcb_tail_loss_probe_acked(pcb);
+        }
+        
+        // Let congestion control know about delivered data.
+        if (TcpProto::CongCtrl::SamplesDelivery && AIPSTACK_LIKELY(con != nullptr)) {
+            con->m_v.cc.dataAcked(pcb_cc_context(pcb), ack_num, acked);
+        }
+        
         // Connection was abandoned?
         if (AIPSTACK_UNLIKELY(con == nullptr)) {
             // Reset the duplicate ACK counter.
@@ -668,23 +1153,12 @@ public:
             pcb->num_dupack = 0;
             
             // Perform congestion-control processing.
-            if (con->m_v.cwnd <= con->m_v.ssthresh) {
-                // Slow start.
-                pcb_increase_cwnd_acked(pcb, acked);
-            } else {
-                // Congestion avoidance.
-                if (!pcb->hasFlag(TcpPcbFlags::CwndIncrd)) {
-                    // Increment cwnd_acked.
-                    AddToSat(con->m_v.cwnd_acked, acked);
-                    
-                    // If cwnd data has now been acked, increment cwnd and reset cwnd_acked,
-                    // and inhibit such increments until the next RTT measurement completes.
-                    if (AIPSTACK_UNLIKELY(con->m_v.cwnd_acked >= con->m_v.cwnd)) {
-                        pcb_increase_cwnd_acked(pcb, con->m_v.cwnd_acked);
-                        con->m_v.cwnd_acked = 0;
-                        pcb->setFlag(TcpPcbFlags::CwndIncrd);
-                    }
-                }
+            TcpSeqInt old_cwnd = con->m_v.cwnd;
+            con->m_v.cc.ackReceived(pcb_cc_context(pcb), acked);
+            
+            // No longer have initial CWND if it was increased.
+            if (con->m_v.cwnd != old_cwnd) {
+                pcb->clearFlag(TcpPcbFlags::CwndInit);
             }
         }
         // In fast recovery
@@ -706,9 +1180,20 @@ public:
                 
                 // Reset num_dupack to indicate end of fast recovery.
                 pcb->num_dupack = 0;
-            } else {
-                // Retransmit the first unacknowledged segment.
-                pcb_output_active(pcb, true);
+            }
+            // With PRR, partial ACKs are handled by pcb_prr_ack_received after
+            // this ACK has been processed.
+            else if (!TcpProto::EnablePrr) {
+                // Retransmit the next hole reported by SACK, or otherwise the
+                // first unacknowledged segment. When SACK is used and there is
+                // no known hole, the latter is only done if all retransmissions
+                // have been acknowledged.
+                if (!pcb_sack_rtx_next_hole(pcb, ack_num) &&
+                    (TcpProto::NumSackBlocks == 0 || !pcb->hasFlag(TcpPcbFlags::SackPerm) ||
+                     !ack_num.mod_lt(con->m_v.sack_rtx_nxt)))
+                {
+                    pcb_output_active(pcb, true);
+                }
                 
                 // Deflate CWND by the amount of data ACKed.
                 // Be careful to not bring CWND below snd_mss.
@@ -731,6 +1216,17 @@ public:
         {
             pcb->clearFlag(TcpPcbFlags::Recover);
         }
+        
+        // If a Path MTU probe has been acknowledged, raise the PMTU estimate. This
+        // calls pcb_pmtu_changed for this and other PCBs to the same address.
+        if (TcpProto::EnablePmtuProbing && AIPSTACK_LIKELY(con != nullptr) &&
+            AIPSTACK_UNLIKELY(con->m_v.pmtu_probe_mtu != 0) &&
+            !ack_num.mod_lt(con->m_v.pmtu_probe_end))
+        {
+            std::uint16_t probe_mtu = con->m_v.pmtu_probe_mtu;
+            con->m_v.pmtu_probe_mtu = 0;
+            pcb->tcp->m_stack->handlePathMtuProbed(pcb->remote_addr, probe_mtu);
+        }
     }
     
     // Called from Input when the number of duplicate ACKs has
@@ -750,21 +1246,57 @@ public:
             return;
         }
         
-        // Do the retransmission.
-        pcb_output(pcb, true);
+        pcb->stats.inc(&TcpConnectionCounters::fast_recoveries);
         
         Connection *con = pcb->con;
+        
+        // Do the retransmission. If SACK is used retransmit the first hole,
+        // which is normally the same as the first unacknowledged segment.
+        if (AIPSTACK_LIKELY(con != nullptr)) {
+            con->m_v.sack_rtx_nxt = pcb->snd_una;
+            
+            // Start counting for PRR, the retransmission is included in prr_out.
+            if (TcpProto::EnablePrr) {
+                con->m_v.prr_recover_fs = pcb->snd_nxt - pcb->snd_una;
+                con->m_v.prr_delivered = 0;
+                con->m_v.prr_out = 0;
+                con->m_v.prr_sacked = (TcpProto::NumSackBlocks > 0) ?
+                    con->m_v.sack_sb.getTotalSackedLen() : 0;
+            }
+        }
+        if (con == nullptr || !pcb_sack_rtx_next_hole(pcb, pcb->snd_una)) {
+            pcb_output(pcb, true);
+        }
+        
         if (AIPSTACK_LIKELY(con != nullptr)) {
             // Set recover.
             pcb->setFlag(TcpPcbFlags::Recover);
             con->m_v.recover = pcb->snd_nxt;
             
-            // Update ssthresh.
-            pcb_update_ssthresh_for_rtx(pcb);
+            // Let congestion control update ssthresh.
+            con->m_v.cc.fastRetransmit(pcb_cc_context(pcb));
+            
+            // Consider any outstanding Path MTU probe to have failed.
+            if (TcpProto::EnablePmtuProbing) {
+                pcb_pmtu_probe_lost(pcb);
+            }
+            
+            // Do not also reduce the window for ECE in this window of data.
+            if (TcpProto::EnableEcn && pcb->ecn_ok) {
+                pcb->ecn_reduced = true;
+                con->m_v.ecn_recover = pcb->snd_nxt;
+            }
             
-            // Update cwnd.
-            TcpSeqInt cwnd = con->m_v.ssthresh;
-            AddToSat(cwnd, 3u * TcpSeqInt(pcb->snd_mss));
+            // Update cwnd. With PRR, no new data is sent until further ACKs
+            // arrive, then pcb_prr_ack_received sets cwnd.
+            TcpSeqInt cwnd;
+            if (TcpProto::EnablePrr) {
+                cwnd = MaxValue(TcpSeqInt(pcb->snd_nxt - pcb->snd_una),
+                                TcpSeqInt(pcb->snd_mss));
+            } else {
+                cwnd = con->m_v.ssthresh;
+                AddToSat(cwnd, 3u * TcpSeqInt(pcb->snd_mss));
+            }
             con->m_v.cwnd = cwnd;
             pcb->clearFlag(TcpPcbFlags::CwndInit);
             
@@ -781,7 +1313,19 @@ public:
         AIPSTACK_ASSERT(pcb_has_snd_unacked(pcb));
         AIPSTACK_ASSERT(pcb->num_dupack > Constants::FastRtxDupAcks);
         
+        // With PRR this is handled by pcb_prr_ack_received.
+        if (TcpProto::EnablePrr) {
+            return;
+        }
+        
         if (AIPSTACK_LIKELY(pcb->con != nullptr)) {
+            // If SACK reports another hole, retransmit it. In this case we do
+            // not inflate CWND since the retransmission replaces the segment
+            // which has left the network.
+            if (pcb_sack_rtx_next_hole(pcb, pcb->snd_una)) {
+                return;
+            }
+            
             // Increment CWND by snd_mss.
             AddToSat(pcb->con->m_v.cwnd, pcb->snd_mss);
             
@@ -790,55 +1334,487 @@ public:
         }
     }
     
-    static TimeType pcb_rto_time (TcpPcb *pcb)
+    // Called from Input with EnablePrr for every ACK received in fast recovery,
+    // after snd_una and the SACK scoreboard have been updated. This implements
+    // Proportional Rate Reduction (RFC 6937) with the slow start reduction
+    // bound: the amount sent for each ACK is based on the amount of data it
+    // reports as delivered, so that the data in flight is brought down to
+    // ssthresh gradually and stays ACK-clocked, instead of first stopping and
+    // then sending a burst as with inflating and deflating cwnd. The acked is
+    // the amount of newly acknowledged sequence space and dup_ack is whether
+    // this was a duplicate ACK.
+    static void pcb_prr_ack_received (TcpPcb *pcb, TcpSeqInt acked, bool dup_ack)
     {
-        return TimeType(pcb->rto) << Constants::RttShift;
+        AIPSTACK_ASSERT(TcpProto::EnablePrr);
+        AIPSTACK_ASSERT(pcb->state().canOutput());
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        AIPSTACK_ASSERT(pcb->num_dupack >= Constants::FastRtxDupAcks);
+        AIPSTACK_ASSERT(pcb_has_snd_unacked(pcb));
+        
+        Connection *con = pcb->con;
+        TcpSeqInt snd_mss = pcb->snd_mss;
+        
+        // Determine the amount of data delivered: newly acknowledged plus newly
+        // SACKed data. Without SACK, a duplicate ACK means one segment.
+        bool use_sack = TcpProto::NumSackBlocks > 0 && pcb->hasFlag(TcpPcbFlags::SackPerm);
+        TcpSeqInt sacked = 0;
+        TcpSeqInt delivered;
+        if (use_sack) {
+            sacked = con->m_v.sack_sb.getTotalSackedLen();
+            TcpSeqInt prev_sacked = con->m_v.prr_sacked;
+            delivered = (acked + sacked > prev_sacked) ? acked + sacked - prev_sacked : 0;
+        } else {
+            delivered = dup_ack ? snd_mss : acked;
+        }
+        con->m_v.prr_sacked = sacked;
+        con->m_v.prr_delivered += delivered;
+        
+        // Estimate the amount of data in the network (pipe) as the flight size
+        // less data known to have been received out of order. Without SACK, each
+        // duplicate ACK is assumed to be for one segment.
+        TcpSeqInt flight_size = pcb->snd_nxt - pcb->snd_una;
+        TcpSeqInt out_of_order = use_sack ? sacked : TcpSeqInt(pcb->num_dupack) * snd_mss;
+        TcpSeqInt pipe = flight_size - MinValue(flight_size, out_of_order);
+        
+        TcpSeqInt ssthresh = con->m_v.ssthresh;
+        TcpSeqInt prr_delivered = con->m_v.prr_delivered;
+        TcpSeqInt prr_out = con->m_v.prr_out;
+        
+        TcpSeqInt sndcnt;
+        if (pipe > ssthresh) {
+            // Send in proportion to the delivered data, so that ssthresh of data
+            // is sent while recover_fs of data is delivered.
+            TcpSeqInt recover_fs = MaxValue(con->m_v.prr_recover_fs, TcpSeqInt(1));
+            std::uint64_t target = (std::uint64_t(prr_delivered) * ssthresh +
+                                    (recover_fs - 1)) / recover_fs;
+            sndcnt = (target > prr_out) ? TcpSeqInt(target - prr_out) : 0;
+        } else {
+            // Slow start toward ssthresh, at most one segment more than delivered.
+            TcpSeqInt limit = MaxValue(
+                TcpSeqInt((prr_delivered > prr_out) ? prr_delivered - prr_out : 0),
+                delivered);
+            AddToSat(limit, snd_mss);
+            sndcnt = MinValue(TcpSeqInt(ssthresh - pipe), limit);
+        }
+        
+        // Retransmit the next hole reported by SACK, or for a partial ACK the
+        // first unacknowledged segment (see pcb_output_handle_acked). This uses
+        // up the allowance.
+        if (sndcnt > 0) {
+            if (!pcb_sack_rtx_next_hole(pcb, pcb->snd_una) && acked > 0 &&
+                (!use_sack || !pcb->snd_una.mod_lt(con->m_v.sack_rtx_nxt)))
+            {
+                pcb_output_active(pcb, true);
+            }
+            sndcnt -= MinValue(sndcnt, TcpSeqInt(con->m_v.prr_out - prr_out));
+        }
+        
+        // Set cwnd so that the remaining allowance can be used for new data.
+        TcpSeqInt cwnd = pcb->snd_nxt - pcb->snd_una;
+        AddToSat(cwnd, sndcnt);
+        con->m_v.cwnd = MaxValue(cwnd, snd_mss);
+        
+        // Schedule output due to possible CWND increase.
+        pcb->setFlag(TcpPcbFlags::OutPending);
     }
     
-    static void pcb_end_rtt_measurement (TcpPcb *pcb)
+    // Retransmit one segment from the first hole reported by SACK which is at or
+    // after con->m_v.sack_rtx_nxt and ack_num, and advance sack_rtx_nxt over it.
+    // The ack_num is the ACK number being processed, which may be newer than
+    // snd_una (see pcb_output_handle_acked). Returns whether anything was sent.
+    static bool pcb_sack_rtx_next_hole (TcpPcb *pcb, TcpSeqNum ack_num)
     {
-        AIPSTACK_ASSERT(pcb->hasFlag(TcpPcbFlags::RttPending));
+        AIPSTACK_ASSERT(pcb->state().canOutput());
         AIPSTACK_ASSERT(pcb->con != nullptr);
         
-        // Clear the flag to indicate end of RTT measurement.
-        pcb->clearFlag(TcpPcbFlags::RttPending);
+        Connection *con = pcb->con;
         
-        // Calculate how much time has passed, also in RTT units.
-        TimeType time_diff = pcb->platform().getTime() - pcb->rtt_test_time;
-        RttType this_rtt = MinValueU(RttTypeMax, time_diff >> Constants::RttShift);
+        if (TcpProto::NumSackBlocks == 0 || !pcb->hasFlag(TcpPcbFlags::SackPerm) ||
+            AIPSTACK_LIKELY(con->m_v.sack_sb.isEmpty()))
+        {
+            return false;
+        }
         
-        Connection *con = pcb->con;
+        // Find the hole.
+        TcpSeqNum from = ack_num.mod_lt(con->m_v.sack_rtx_nxt) ?
+            con->m_v.sack_rtx_nxt : ack_num;
+        TcpSeqNum hole_start;
+        TcpSeqInt hole_len;
+        if (!con->m_v.sack_sb.findHole(pcb->snd_una, from, hole_start, hole_len)) {
+            return false;
+        }
         
-        // Update RTTVAR and SRTT.
-        if (!pcb->hasFlag(TcpPcbFlags::RttValid)) {
-            pcb->setFlag(TcpPcbFlags::RttValid);
-            con->m_v.rttvar = this_rtt/2;
-            con->m_v.srtt = this_rtt;
-        } else {
-            RttType rtt_diff = AbsoluteDiff(con->m_v.srtt, this_rtt);
-            con->m_v.rttvar = (RttNextType(3) * con->m_v.rttvar + rtt_diff) / 4;
-            con->m_v.srtt = (RttNextType(7) * con->m_v.srtt + this_rtt) / 8;
+        // The hole is followed by SACKed data, so it consists of sent data only.
+        std::size_t offset = hole_start - pcb->snd_una;
+        AIPSTACK_ASSERT(offset + hole_len <= con->m_v.snd_buf.tot_len);
+        IpBufRef data = ipBufSkipBytes(con->m_v.snd_buf, offset);
+        
+        // Send one segment, not more than the hole.
+        PcbOutputHelper output_helper(pcb);
+        std::size_t seg_mss = output_helper.getSegMss(pcb);
+        TcpSeqInt seg_seqlen;
+        IpErr err = pcb_output_segment(pcb, output_helper, data, /*fin=*/false,
+                                       hole_len, seg_mss, &seg_seqlen);
+        if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+            return false;
         }
         
-        // Update RTO.
-        int const k = 4;
-        RttType k_rttvar = (con->m_v.rttvar > RttTypeMax / k) ?
-            RttTypeMax : (k * con->m_v.rttvar);
-        RttType var_part = MaxValue(RttType(1), k_rttvar);
-        RttType base_rto = (var_part > RttTypeMax - con->m_v.srtt) ?
-            RttTypeMax : (con->m_v.srtt + var_part);
-        pcb->rto = MaxValue(Constants::MinRtxTime,
-            MinValue(Constants::MaxRtxTime, base_rto));
+        con->m_v.sack_rtx_nxt = hole_start + seg_seqlen;
+        return true;
     }
     
-    // This is called from the lower layers when sending failed but
-    // is now expected to succeed. Currently the mechanism is used to
-    // retry after ARP resolution completes.
-    static void pcb_send_retry (TcpPcb *pcb)
+    // Called from Input when ECE is received and the window has not been reduced
+    // for congestion in the current window of data. The reduction is determined
+    // by congestion control (ecnCongestion), or with UseDctcp based on the
+    // fraction of marked data: cwnd = cwnd * (1 - alpha / 2) (RFC 8257).
+    static void pcb_ecn_reduce_cwnd (TcpPcb *pcb)
     {
-        AIPSTACK_ASSERT(pcb->state() != TcpStates::CLOSED);
+        AIPSTACK_ASSERT(TcpProto::EnableEcn);
+        AIPSTACK_ASSERT(pcb->state().canOutput());
+        AIPSTACK_ASSERT(pcb->con != nullptr);
         
-        if (pcb->state() == OneOf(TcpStates::SYN_SENT, TcpStates::SYN_RCVD)) {
+        Connection *con = pcb->con;
+        
+        pcb->stats.inc(&TcpConnectionCounters::ecn_reductions);
+        
+        // Let congestion control update ssthresh.
+        con->m_v.cc.ecnCongestion(pcb_cc_context(pcb));
+        
+        if (TcpProto::UseDctcp) {
+            TcpSeqInt cwnd = con->m_v.cwnd;
+            TcpSeqInt reduction = TcpSeqInt((std::uint64_t(cwnd) *
+                con->m_v.dctcp_alpha) >> (Constants::DctcpAlphaBits + 1));
+            con->m_v.ssthresh = MaxValue(TcpSeqInt(cwnd - reduction),
+                                         TcpSeqInt(2u * TcpSeqInt(pcb->snd_mss)));
+        }
+        
+        // Set cwnd to the new ssthresh, but do not increase it.
+        AIPSTACK_ASSERT(con->m_v.ssthresh >= pcb->snd_mss);
+        con->m_v.cwnd = MinValue(con->m_v.cwnd, con->m_v.ssthresh);
+        pcb->clearFlag(TcpPcbFlags::CwndInit);
+        
+        // Tell the receiver with CWR and ignore ECE until the data sent
+        // so far is acknowledged.
+        pcb->ecn_cwr_pending = true;
+        pcb->ecn_reduced = true;
+        con->m_v.ecn_recover = pcb->snd_nxt;
+    }
+    
+    // Check if fast recovery or RTO recovery is in progress.
+    inline static bool pcb_in_recovery (TcpPcb *pcb)
+    {
+        return pcb->num_dupack >= Constants::FastRtxDupAcks ||
+            pcb->hasFlag(TcpPcbFlags::RtxActive);
+    }
+    
+    // Called from Input after an ACK has been processed, for RACK loss detection
+    // (RFC 8985). Per-segment transmission times are not kept, instead it is
+    // used that data at snd_una was sent before any data reported by SACK unless
+    // it has been retransmitted, which is only the case in recovery. So when SACK
+    // reports a hole and it is not filled within the reordering window
+    // (SRTT/4), the data at snd_una is considered lost. This does not depend
+    // on the number of duplicate ACKs, which may be too few for a short flow.
+    // NOTE: doDelayedTimerUpdate must be called after return.
+    static void pcb_rack_ack_processed (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(TcpProto::UseRackTlp);
+        AIPSTACK_ASSERT(pcb->state().canOutput());
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        AIPSTACK_ASSERT(pcb->hasFlag(TcpPcbFlags::SackPerm));
+        
+        Connection *con = pcb->con;
+        
+        // SACK information is trimmed to after snd_una, so there is a hole at
+        // snd_una if there is any. A reordering timeout which has already been
+        // started is not restarted.
+        if (AIPSTACK_LIKELY(con->m_v.sack_sb.isEmpty()) || pcb_in_recovery(pcb) ||
+            pcb->hasFlag(TcpPcbFlags::Recover) || !pcb->hasFlag(TcpPcbFlags::RttValid) ||
+            (con->m_v.rack_reo_timer && pcb->tim(LossTimer()).isSet()))
+        {
+            return;
+        }
+        
+        // Start the reordering timeout, replacing any tail loss probe timeout.
+        RttType reo_wnd = MaxValue(RttType(1), RttType(con->m_v.srtt / 4));
+        pcb->tim(LossTimer()).setAfter(TimeType(reo_wnd) << Constants::RttShift);
+        con->m_v.rack_reo_timer = true;
+    }
+    
+    // Set the LossTimer for a tail loss probe (RFC 8985 section 7.2), which allows
+    // a lost segment at the end of a flight to be detected without waiting for the
+    // RTO. This is done when there is unacknowledged data, no loss recovery is in
+    // progress and no probe has been sent since the last progress.
+    // NOTE: doDelayedTimerUpdate must be called after return.
+    static void pcb_schedule_tail_loss_probe (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(TcpProto::UseRackTlp);
+        AIPSTACK_ASSERT(pcb->state().canOutput());
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        Connection *con = pcb->con;
+        
+        if (!pcb->hasFlag(TcpPcbFlags::SackPerm) || pcb->tim(LossTimer()).isSet() ||
+            !pcb->hasFlag(TcpPcbFlags::RttValid) || con->m_v.tlp_active ||
+            pcb_in_recovery(pcb) || con->m_v.snd_wnd == 0 || !pcb_has_snd_unacked(pcb))
+        {
+            return;
+        }
+        
+        // The probe timeout is twice SRTT, plus an allowance for a delayed ACK if
+        // there is only one segment in flight.
+        RttType pto = (con->m_v.srtt > RttTypeMax / 2) ? RttTypeMax : (2 * con->m_v.srtt);
+        if (pcb->snd_nxt - pcb->snd_una <= pcb->snd_mss) {
+            pto = (pto > RttTypeMax - Constants::TlpDelAckTime) ?
+                RttTypeMax : RttType(pto + Constants::TlpDelAckTime);
+        }
+        pto = MaxValue(pto, Constants::MinTlpTime);
+        
+        // The probe is not useful if the retransmission timer expires first.
+        TimeType probe_time = pcb->platform().getEventTime() +
+            (TimeType(pto) << Constants::RttShift);
+        if (pcb->tim(RtxTimer()).isSet() &&
+            Platform::timeGreaterOrEqual(probe_time, pcb->tim(RtxTimer()).getSetTime()))
+        {
+            return;
+        }
+        
+        pcb->tim(LossTimer()).setAt(probe_time);
+        con->m_v.rack_reo_timer = false;
+    }
+    
+    inline static void pcb_loss_timer_handler (TcpPcb *pcb)
+    {
+        // Handle RACK reordering timeout or tail loss probe.
+        pcb_loss_timer_handler_core(pcb);
+        
+        // Delayed timer update is needed by timer expiration and
+        // pcb_loss_timer_handler_core.
+        pcb->doDelayedTimerUpdate();
+    }
+    
+    static void pcb_loss_timer_handler_core (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(TcpProto::UseRackTlp);
+        // The timer is stopped when leaving the states where output is possible
+        // and when the connection is abandoned.
+        AIPSTACK_ASSERT(pcb->state().canOutput());
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        Connection *con = pcb->con;
+        
+        bool reo_timer = con->m_v.rack_reo_timer;
+        con->m_v.rack_reo_timer = false;
+        
+        // Nothing to do if everything has been acknowledged or recovery has
+        // started since the timer was set.
+        if (!pcb_has_snd_unacked(pcb) || pcb_in_recovery(pcb)) {
+            return;
+        }
+        
+        // If SACK still reports a hole at snd_una, the data there is lost
+        // according to RACK, start fast recovery. This also applies when a
+        // probe timeout expires after a hole was reported by the probe's ACK.
+        if (!con->m_v.sack_sb.isEmpty()) {
+            if (!pcb->hasFlag(TcpPcbFlags::Recover)) {
+                pcb->num_dupack = Constants::FastRtxDupAcks;
+                pcb_fast_rtx_dup_acks_received(pcb);
+                
+                // Send more as allowed by the new cwnd (we are not in input
+                // processing where OutPending would be handled).
+                if (pcb->hasAndClearFlag(TcpPcbFlags::OutPending)) {
+                    pcb_output_active(pcb, false);
+                }
+            }
+            return;
+        }
+        
+        // Send a tail loss probe.
+        if (!reo_timer) {
+            pcb_send_tail_loss_probe(pcb);
+        }
+    }
+    
+    // Send a tail loss probe by retransmitting the last segment sent (RFC 8985
+    // section 7.3). The ACK of the probe carries SACK information which allows
+    // a loss to be repaired by fast recovery. Sending new data instead, which the
+    // RFC prefers when possible, is not done since it would have to bypass the
+    // send queue management in pcb_output_active.
+    static void pcb_send_tail_loss_probe (TcpPcb *pcb)
+    {
+        Connection *con = pcb->con;
+        
+        // With zero window, window probes are sent based on the RtxTimer.
+        if (con->m_v.snd_wnd == 0) {
+            return;
+        }
+        
+        // Determine the length of data sent and whether a FIN was sent. After
+        // the last segment the FIN is not queued, so FinPending means that
+        // a FIN has not been sent.
+        std::size_t sent_len = con->m_v.snd_buf.tot_len - con->m_v.snd_buf_cur.tot_len;
+        bool fin = !pcb->state().isSndOpen() && !pcb->hasFlag(TcpPcbFlags::FinPending);
+        
+        // Send one segment ending with the last sent data or FIN.
+        PcbOutputHelper output_helper(pcb);
+        std::size_t seg_mss = output_helper.getSegMss(pcb);
+        std::size_t offset = sent_len - MinValue(sent_len, seg_mss);
+        IpBufRef data = ipBufSkipBytes(con->m_v.snd_buf, offset);
+        TcpSeqInt probe_len = TcpSeqInt(sent_len - offset) + fin;
+        TcpSeqInt seg_seqlen;
+        IpErr err = pcb_output_segment(pcb, output_helper, data, fin, probe_len,
+                                       seg_mss, &seg_seqlen);
+        if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+            return;
+        }
+        
+        pcb->stats.inc(&TcpConnectionCounters::tail_loss_probes);
+        
+        // Remember the probe until an ACK covers it.
+        con->m_v.tlp_active = true;
+        con->m_v.tlp_high_seq = pcb->snd_nxt;
+        
+        // Restart the retransmission timer (RFC 8985 section 7.3).
+        pcb->tim(RtxTimer()).setAfter(pcb_rto_time(pcb));
+    }
+    
+    // Called when an ACK covers a tail loss probe. Without DSACK it is not known
+    // whether the probe repaired a loss or the original segment arrived, so
+    // a loss is assumed (as in RFC 8985 section 7.4.2 without DSACK) and the
+    // congestion window is reduced, unless fast recovery has already done that.
+    static void pcb_tail_loss_probe_acked (TcpPcb *pcb)
+    {
+        Connection *con = pcb->con;
+        con->m_v.tlp_active = false;
+        
+        if (pcb_in_recovery(pcb)) {
+            return;
+        }
+        
+        // Let congestion control update ssthresh, then cwnd is set to it.
+        con->m_v.cc.fastRetransmit(pcb_cc_context(pcb));
+        AIPSTACK_ASSERT(con->m_v.ssthresh >= pcb->snd_mss);
+        con->m_v.cwnd = MinValue(con->m_v.cwnd, con->m_v.ssthresh);
+        pcb->clearFlag(TcpPcbFlags::CwndInit);
+    }
+    
+    static TimeType pcb_rto_time (TcpPcb *pcb)
+    {
+        return TimeType(pcb->rto) << Constants::RttShift;
+    }
+    
+    static void pcb_end_rtt_measurement (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->hasFlag(TcpPcbFlags::RttPending));
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        // Clear the flag to indicate end of RTT measurement.
+        pcb->clearFlag(TcpPcbFlags::RttPending);
+        
+        // Calculate how much time has passed, also in RTT units. Time that the
+        // ACK spent queued before being processed is not part of the RTT.
+        TimeType time_diff = pcb->platform().getEventTime() - pcb->rtt_test_time;
+        time_diff -= MinValue(time_diff, pcb_rx_queue_delay(pcb));
+        RttType this_rtt = MinValueU(RttTypeMax, time_diff >> Constants::RttShift);
+        
+        // Update the RTT variables and RTO.
+        pcb_update_rtt(pcb, this_rtt);
+    }
+    
+    // Get a round-trip-time sample based on the timestamp echoed in a received
+    // ACK (RFC 7323 section 4). The received options must have been parsed.
+    // With HighResRtt the timestamp clock is too coarse for RTT samples, so
+    // only the per-RTT measurement (pcb_end_rtt_measurement) is used.
+    static bool pcb_get_ts_rtt_sample (TcpPcb *pcb, RttType &out_rtt)
+    {
+        if (!TcpProto::UseTimestamps || Constants::RttShift != Constants::TsClockShift ||
+            !pcb->hasFlag(TcpPcbFlags::Timestamps) || pcb->con == nullptr)
+        {
+            return false;
+        }
+        
+        // Input processing parses the options when timestamps are used.
+        TcpProto *tcp = pcb->tcp;
+        AIPSTACK_ASSERT(tcp->m_received_opts_buf.node == nullptr);
+        TcpOptions const &opts = tcp->m_received_opts;
+        if ((opts.options & TcpOptionFlags::Timestamps) == Enum0) {
+            return false;
+        }
+        
+        // Ignore the sample if the echoed timestamp is not plausible, since the
+        // TSecr is not covered by the PAWS check.
+        std::uint32_t ts_diff = pcb_ts_clock(pcb) - opts.ts_ecr;
+        if (AIPSTACK_UNLIKELY(ts_diff > Constants::MaxRtxTime)) {
+            return false;
+        }
+        
+        // Exclude the time that the ACK spent queued before being processed.
+        // The delay is bounded so it fits into the timestamp clock.
+        std::uint32_t ts_delay =
+            std::uint32_t(pcb_rx_queue_delay(pcb) >> Constants::TsClockShift);
+        ts_diff -= MinValue(ts_diff, ts_delay);
+        
+        out_rtt = RttType(ts_diff);
+        return true;
+    }
+    
+    // Get the time between reception of the segment being processed by the
+    // driver and the current event, based on the receive timestamp if the
+    // driver provided one (IpRxTimestamp). This is the time the segment spent
+    // in receive queues, which must be excluded from RTT samples so that load
+    // on the receive path does not inflate the RTO. Implausible delays (such
+    // as from a timestamp in the future) are ignored.
+    static TimeType pcb_rx_queue_delay (TcpPcb *pcb)
+    {
+        TcpProto *tcp = pcb->tcp;
+        if (!pcb->inInputProcessing() || !tcp->m_rx_time.valid) {
+            return 0;
+        }
+        
+        TimeType delay = pcb->platform().getEventTime() - TimeType(tcp->m_rx_time.time);
+        if (AIPSTACK_UNLIKELY(delay > (TimeType(Constants::MaxRtxTime) << Constants::RttShift))) {
+            return 0;
+        }
+        
+        return delay;
+    }
+    
+    // Update the RTT variables and RTO based on an RTT sample (RFC 6298).
+    static void pcb_update_rtt (TcpPcb *pcb, RttType this_rtt)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        Connection *con = pcb->con;
+        
+        // Update RTTVAR and SRTT.
+        if (!pcb->hasFlag(TcpPcbFlags::RttValid)) {
+            pcb->setFlag(TcpPcbFlags::RttValid);
+            con->m_v.rttvar = this_rtt/2;
+            con->m_v.srtt = this_rtt;
+        } else {
+            RttType rtt_diff = AbsoluteDiff(con->m_v.srtt, this_rtt);
+            con->m_v.rttvar = (RttNextType(3) * con->m_v.rttvar + rtt_diff) / 4;
+            con->m_v.srtt = (RttNextType(7) * con->m_v.srtt + this_rtt) / 8;
+        }
+        
+        // Update RTO.
+        int const k = 4;
+        RttType k_rttvar = (con->m_v.rttvar > RttTypeMax / k) ?
+            RttTypeMax : (k * con->m_v.rttvar);
+        RttType var_part = MaxValue(RttType(1), k_rttvar);
+        RttType base_rto = (var_part > RttTypeMax - con->m_v.srtt) ?
+            RttTypeMax : (con->m_v.srtt + var_part);
+        pcb->rto = MaxValue(Constants::MinRtxTime,
+            MinValue(Constants::MaxRtxTime, base_rto));
+    }
+    
+    // This is called from the lower layers when sending failed but
+    // is now expected to succeed. Currently the mechanism is used to
+    // retry after ARP resolution completes.
+    static void pcb_send_retry (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->state() != TcpStates::CLOSED);
+        
+        if (pcb->state() == OneOf(TcpStates::SYN_SENT, TcpStates::SYN_RCVD)) {
             // Retry sending SYN or SYN-ACK.
             pcb_send_syn(pcb);
         }
@@ -866,6 +1842,13 @@ public:
         //   MinAllowedMss==MinMTU-Ip4TcpHeaderSize.
         AIPSTACK_ASSERT(snd_mss >= Constants::MinAllowedMss);
         
+        // If timestamps are used, the option is present in every segment, so
+        // exclude it from snd_mss (RFC 6691). This way congestion control and
+        // segmentation work in terms of the data in full-sized segments.
+        if (TcpProto::UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+            snd_mss -= TcpOptionWriteLen::Timestamps;
+        }
+        
         return snd_mss;
     }
     
@@ -936,6 +1919,101 @@ public:
         // handleLocalPacketTooBig -> pcb_pmtu_changed.
     }
     
+    // Return the PMTU corresponding to the current snd_mss. This is the actual
+    // PMTU estimate unless snd_mss is limited by base_snd_mss.
+    static std::uint16_t pcb_pmtu_from_snd_mss (TcpPcb *pcb)
+    {
+        std::uint16_t mtu = pcb->snd_mss + Ip4TcpHeaderSize;
+        if (TcpProto::UseTimestamps && pcb->hasFlag(TcpPcbFlags::Timestamps)) {
+            mtu += TcpOptionWriteLen::Timestamps;
+        }
+        return mtu;
+    }
+    
+    // Determine whether a Path MTU probe (RFC 4821) should be sent now. Returns
+    // the probe MTU and sets probe_data_len to the data length of the probe
+    // segment, or returns zero if no probe is to be sent. The search starts by
+    // probing for the largest MTU allowed by base_snd_mss, then does a binary
+    // search between the current PMTU and the smallest MTU known to fail.
+    static std::uint16_t pcb_pmtu_probe_size (TcpPcb *pcb, std::size_t seg_mss,
+                                              std::size_t &probe_data_len)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        Connection *con = pcb->con;
+        
+        // Don't probe while a probe is outstanding or during loss recovery.
+        if (con->m_v.pmtu_probe_mtu != 0 || pcb->num_dupack >= Constants::FastRtxDupAcks ||
+            pcb->hasFlag(TcpPcbFlags::RtxActive))
+        {
+            return 0;
+        }
+        
+        TimeType now = pcb->platform().getEventTime();
+        if (!Platform::timeGreaterOrEqual(now, con->m_v.pmtu_probe_time)) {
+            return 0;
+        }
+        
+        std::uint16_t cur_mtu = pcb_pmtu_from_snd_mss(pcb);
+        std::uint16_t max_mtu = pcb->base_snd_mss + Ip4TcpHeaderSize;
+        std::uint16_t high_mtu = MinValue(max_mtu, con->m_v.pmtu_search_high);
+        
+        // If the search has completed, start a new search some time later in
+        // case the path has changed.
+        if (high_mtu < cur_mtu + Constants::PmtuProbeMinStep) {
+            con->m_v.pmtu_search_high = max_mtu;
+            con->m_v.pmtu_probe_time = now + Constants::PmtuProbeRaiseTicks;
+            return 0;
+        }
+        
+        std::uint16_t probe_mtu = max_mtu;
+        if (high_mtu < max_mtu) {
+            probe_mtu = MaxValue(std::uint16_t(cur_mtu + (high_mtu - cur_mtu) / 2),
+                                 std::uint16_t(cur_mtu + Constants::PmtuProbeMinStep));
+        }
+        
+        // The headers and options take the same space as in a regular segment.
+        probe_data_len = seg_mss + (probe_mtu - cur_mtu);
+        
+        return probe_mtu;
+    }
+    
+    // Called on loss detection, considers any outstanding Path MTU probe
+    // to have failed. Probe loss is not distinguished from congestion loss.
+    static void pcb_pmtu_probe_lost (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        Connection *con = pcb->con;
+        
+        if (con->m_v.pmtu_probe_mtu != 0) {
+            con->m_v.pmtu_search_high = con->m_v.pmtu_probe_mtu - 1;
+            con->m_v.pmtu_probe_mtu = 0;
+            con->m_v.pmtu_probe_time =
+                pcb->platform().getEventTime() + Constants::PmtuProbeRetryTicks;
+        }
+    }
+    
+    // Called on repeated retransmission timeouts. Lower the PMTU estimate in case
+    // packets are being dropped due to their size without any ICMP message being
+    // received (RFC 4821 section 7.7). Probing will raise it again if appropriate.
+    static void pcb_pmtu_black_hole (TcpPcb *pcb)
+    {
+        AIPSTACK_ASSERT(pcb->con != nullptr);
+        
+        std::uint16_t cur_mtu = pcb_pmtu_from_snd_mss(pcb);
+        
+        if (cur_mtu > Constants::PmtuBlackHoleMtu &&
+            pcb->tcp->m_stack->handleIcmpPacketTooBig(
+                pcb->remote_addr, Constants::PmtuBlackHoleMtu))
+        {
+            Connection *con = pcb->con;
+            con->m_v.pmtu_search_high = cur_mtu - 1;
+            con->m_v.pmtu_probe_time =
+                pcb->platform().getEventTime() + Constants::PmtuProbeRetryTicks;
+        }
+    }
+    
     // Update the snd_wnd to the given value.
     // NOTE: doDelayedTimerUpdate must be called after return.
     static void pcb_update_snd_wnd (TcpPcb *pcb, TcpSeqInt new_snd_wnd)
@@ -965,6 +2043,13 @@ public:
         // Update the window.
         con->m_v.snd_wnd = new_snd_wnd;
         
+        if (new_snd_wnd == 0) {
+            pcb->stats.inc(&TcpConnectionCounters::zero_wnd_stalls);
+        } else {
+            // Window probing is no longer needed.
+            TcpProto::pcb_persist_stop(pcb);
+        }
+        
         // Is there any data or FIN outstanding to be sent/acked?
         if (pcb_has_snd_outstanding(pcb)) {
             // Set the flag OutPending so that more can be sent due to window
@@ -1008,6 +2093,39 @@ public:
         send_rst(tcp, key, rst_seq_num, rst_ack, rst_ack_num);
     }
     
+    // Send a SYN-ACK which is not associated with a PCB (for SYN cookies). If the
+    // timestamps option is included, ts_val is filled in here.
+    static void send_syn_ack_stateless (TcpProto *tcp, TcpPcbKey const &key,
+        TcpSeqNum seq_num, TcpSeqNum ack_num, std::uint16_t window_size,
+        TcpOptions &tcp_opts)
+    {
+        if ((tcp_opts.options & TcpOptionFlags::Timestamps) != Enum0) {
+            tcp_opts.ts_val = std::uint32_t(
+                tcp->platform().getEventTime() >> Constants::TsClockShift);
+        }
+        
+        send_tcp_nodata(tcp, key, seq_num, ack_num, window_size,
+            Tcp4Flags::Syn|Tcp4Flags::Ack, &tcp_opts, /*retryReq=*/nullptr);
+        
+        tcp->m_stats.inc(&TcpProtoStats::syn_cookies_sent);
+    }
+    
+    // Send an ACK for a connection in the TIME_WAIT table.
+    static void send_time_wait_ack (TcpProto *tcp, TimeWaitEntry const &tw_entry)
+    {
+        TcpOptions tcp_opts;
+        if (tw_entry.timestamps) {
+            tcp_opts.options = TcpOptionFlags::Timestamps;
+            tcp_opts.ts_val = std::uint32_t(
+                tcp->platform().getTime() >> Constants::TsClockShift);
+            tcp_opts.ts_ecr = tw_entry.ts_recent;
+        }
+        
+        send_tcp_nodata(tcp, tw_entry, tw_entry.snd_nxt, tw_entry.rcv_nxt,
+            tw_entry.rcv_wnd, Tcp4Flags::Ack, tw_entry.timestamps ? &tcp_opts : nullptr,
+            /*retryReq=*/nullptr);
+    }
+    
     AIPSTACK_NO_INLINE
     static void send_rst (TcpProto *tcp,
         TcpPcbKey const &key, TcpSeqNum seq_num, bool ack, TcpSeqNum ack_num)
@@ -1015,6 +2133,87 @@ public:
         Tcp4Flags flags = Tcp4Flags::Rst | (ack ? Tcp4Flags::Ack : Tcp4Flags(0));
         send_tcp_nodata(tcp, key, seq_num, ack_num,
             /*window_size=*/0, flags, /*opts=*/nullptr, /*retryReq=*/nullptr);
+        
+        tcp->m_stats.inc(&TcpProtoStats::rsts_sent);
+    }
+    
+    // Calculate the checksum of the pseudo-header without the TCP length, which
+    // is the same for all segments of the PCB. This must be called when the
+    // addresses of the PCB have been set.
+    static void pcb_init_pseudo_chksum (TcpPcb *pcb)
+    {
+        IpChksumAccumulator chksum;
+        chksum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Tcp));
+        chksum.addWord(WrapType<std::uint32_t>(), pcb->local_addr.value());
+        chksum.addWord(WrapType<std::uint32_t>(), pcb->remote_addr.value());
+        pcb->pseudo_chksum = chksum.getState();
+    }
+    
+    // Get the flags for sending segments of a PCB, which include its DSCP.
+    inline static IpSendFlags pcb_ip_send_flags (TcpPcb *pcb)
+    {
+        return Constants::TcpIpSendFlags | IpSendFlagsDscp(std::uint8_t(pcb->dscp));
+    }
+    
+    // Send a segment without data for a PCB (e.g. an empty ACK). Unlike
+    // send_tcp_nodata, this uses the route cache of the PCB and the precomputed
+    // pseudo-header checksum, and calculates the checksum right away.
+    AIPSTACK_NO_INLINE
+    static IpErr pcb_send_nodata (TcpPcb *pcb, TcpSeqNum seq_num,
+        std::uint16_t window_size, Tcp4Flags flags, TcpOptions *opts)
+    {
+        pcb->tcp->m_stack->traceLatency(IpLatencyStage::TcpOutput);
+        
+        // Compute length of TCP options.
+        std::uint8_t opts_len = (opts != nullptr) ? CalcTcpOptionsLength(*opts) : 0;
+        std::uint16_t tcp_len = std::uint16_t(Tcp4Header::Size + opts_len);
+        
+        // Allocate memory for headers.
+        TxAllocHelper<Tcp4Header::Size+MaxTcpOptionsWriteLen, HeaderBeforeIp4Dgram>
+            dgram_alloc(tcp_len);
+        char *tcp_ptr = dgram_alloc.getPtr();
+        
+        // Write the IP header fields and get the route, from the route cache
+        // unless routes have changed.
+        IpSendPreparedIp4<StackArg> ip_prep;
+        IpErr err = pcb->tcp->m_stack->prepareSendIp4Dgram(
+            tcp_ptr, ip_prep, Ip4CommonSendParams{
+                *pcb, TcpProto::TcpTTL, Ip4Protocol::Tcp, pcb_ip_send_flags(pcb)},
+            &pcb->route_cache);
+        if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+            return err;
+        }
+        
+        // Write the TCP header with a zero checksum and any options.
+        auto tcp_header = Tcp4Header::MakeRef(tcp_ptr);
+        tcp_header.set(Tcp4Header::SrcPort(),     pcb->local_port);
+        tcp_header.set(Tcp4Header::DstPort(),     pcb->remote_port);
+        tcp_header.set(Tcp4Header::SeqNum(),      seq_num);
+        tcp_header.set(Tcp4Header::AckNum(),      pcb->rcv_nxt);
+        tcp_header.set(Tcp4Header::OffsetFlags(), Tcp4EncodeOffset(5 + opts_len / 4) | flags);
+        tcp_header.set(Tcp4Header::WindowSize(),  window_size);
+        tcp_header.set(Tcp4Header::Checksum(),    0);
+        tcp_header.set(Tcp4Header::UrgentPtr(),   0);
+        if (opts != nullptr) {
+            WriteTcpOptions(*opts, tcp_ptr + Tcp4Header::Size);
+        }
+        
+        // Calculate the checksum, or only the pseudo-header part if the interface
+        // will calculate the rest.
+        IpChksumAccumulator chksum(pcb->pseudo_chksum);
+        chksum.addWord(WrapType<std::uint16_t>(), tcp_len);
+        std::uint16_t calc_chksum;
+        if (AIPSTACK_LIKELY((ip_prep.route_info.iface->getTxChksumOffload() &
+                             IpChksumOffloadFlags::Tcp4) == Enum0))
+        {
+            chksum.addEvenBytes(tcp_ptr, tcp_len);
+            calc_chksum = chksum.getChksum();
+        } else {
+            calc_chksum = chksum.getChksumInverted();
+        }
+        tcp_header.set(Tcp4Header::Checksum(), calc_chksum);
+        
+        return pcb->tcp->m_stack->sendIp4DgramFast(ip_prep, dgram_alloc.getBufRef(), pcb);
     }
     
 private:
@@ -1057,7 +2256,8 @@ private:
     // inlined into pcb_output_active and should not be called from elsewhere.
     AIPSTACK_ALWAYS_INLINE
     static IpErr pcb_output_segment (TcpPcb *pcb, PcbOutputHelper &helper,
-        IpBufRef data, bool fin, TcpSeqInt rem_wnd, TcpSeqInt *out_seg_seqlen)
+        IpBufRef data, bool fin, TcpSeqInt rem_wnd, std::size_t max_seg_data,
+        TcpSeqInt *out_seg_seqlen, bool pmtu_probe = false)
     {
         AIPSTACK_ASSERT(pcb->state().canOutput());
         AIPSTACK_ASSERT(pcb->con != nullptr);
@@ -1066,14 +2266,16 @@ private:
         AIPSTACK_ASSERT(data.tot_len > 0 || fin);
         AIPSTACK_ASSERT(rem_wnd > 0);
         
+        pcb->tcp->m_stack->traceLatency(IpLatencyStage::TcpOutput);
+        
         std::size_t rem_data_len = data.tot_len;
         
         // Calculate segment data length and adjust data to contain only that.
         // We send the minimum of:
         // - remaining data in the send buffer,
         // - remaining available window,
-        // - maximum segment size.
-        data.tot_len = MinValueU(rem_data_len, MinValueU(rem_wnd, pcb->snd_mss));
+        // - maximum segment size (or super-segment size).
+        data.tot_len = MinValueU(rem_data_len, MinValueU(rem_wnd, max_seg_data));
         
         // We always send the ACK flag, others may be added below.
         Tcp4Flags seg_flags = Tcp4Flags::Ack;
@@ -1101,12 +2303,28 @@ private:
         // Calculate the sequence number.
         TcpSeqNum seq_num = pcb->snd_una + offset;
         
+        // Add ECN flags: ECE to echo congestion experienced and CWR in the first
+        // new data segment after the window was reduced due to ECE.
+        if (TcpProto::EnableEcn) {
+            if (AIPSTACK_UNLIKELY(pcb->ecn_ce_echo)) {
+                seg_flags |= Tcp4Flags::Ece;
+            }
+            if (AIPSTACK_UNLIKELY(pcb->ecn_cwr_pending) && seq_num == pcb->snd_nxt) {
+                seg_flags |= Tcp4Flags::Cwr;
+            }
+        }
+        
         // Send the segment.
-        IpErr err = helper.sendSegment(pcb, seq_num, seg_flags, data);
+        IpErr err = helper.sendSegment(pcb, seq_num, seg_flags, data, pmtu_probe);
         if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
             return err;
         }
         
+        // CWR has been sent.
+        if (TcpProto::EnableEcn && (seg_flags & Tcp4Flags::Cwr) != Enum0) {
+            pcb->ecn_cwr_pending = false;
+        }
+        
         // Calculate the sequence length of the segment and set
         // the FinSent flag if a FIN was sent.
         TcpSeqInt seg_seqlen = TcpSeqInt(data.tot_len);
@@ -1118,6 +2336,17 @@ private:
         // Return the sequence length to the caller.
         *out_seg_seqlen = seg_seqlen;
         
+        // Update statistics.
+        pcb->stats.inc(&TcpConnectionCounters::data_segs_sent);
+        pcb->tcp->m_stats.inc(&TcpProtoStats::data_segs_sent);
+        if (seq_num != pcb->snd_nxt) {
+            pcb->stats.inc(&TcpConnectionCounters::rtx_segs);
+            pcb->tcp->m_stats.inc(&TcpProtoStats::rtx_segs);
+        }
+        
+        // The segment carries an ACK so any delayed ACK is no longer needed.
+        pcb->clearFlag(TcpPcbFlags::AckDelayed);
+        
         // Stop a round-trip-time measurement if we have retransmitted
         // a segment containing the associated sequence number.
         if (AIPSTACK_LIKELY(pcb->hasFlag(TcpPcbFlags::RttPending))) {
@@ -1129,6 +2358,17 @@ private:
         // Calculate the end sequence number of the sent segment.
         TcpSeqNum seg_endseq = seq_num + seg_seqlen;
         
+        // Let congestion control know about the segment.
+        if (TcpProto::CongCtrl::SamplesDelivery) {
+            bool rtx = seq_num != pcb->snd_nxt;
+            pcb->con->m_v.cc.segmentSent(pcb_cc_context(pcb), seg_endseq, rtx);
+        }
+        
+        // Count data sent in fast recovery for PRR (see pcb_prr_ack_received).
+        if (TcpProto::EnablePrr && pcb->num_dupack >= Constants::FastRtxDupAcks) {
+            pcb->con->m_v.prr_out += seg_seqlen;
+        }
+        
         // Did we send anything new?
         if (AIPSTACK_LIKELY(pcb->snd_nxt.mod_lt(seg_endseq))) {
             // Start a round-trip-time measurement if not already started
@@ -1153,12 +2393,15 @@ private:
         
         // Get the windows size to announce.
         std::uint16_t window_size = Input::pcb_ann_wnd(pcb);
+        
+        // Include timestamps if appropriate.
+        TcpOptions tcp_opts;
+        bool have_opts = pcb_make_opts(pcb, tcp_opts);
 
         // Send a FIN segment.
         Tcp4Flags flags = Tcp4Flags::Ack|Tcp4Flags::Fin|Tcp4Flags::Psh;
-        IpErr err = send_tcp_nodata(pcb->tcp, *pcb,
-            /*seq_num=*/pcb->snd_una, /*ack_num=*/pcb->rcv_nxt,
-            window_size, flags, /*opts=*/nullptr, /*retryReq=*/pcb);
+        IpErr err = pcb_send_nodata(pcb, /*seq_num=*/pcb->snd_una, window_size, flags,
+                                    have_opts ? &tcp_opts : nullptr);
         
         // On success take note of what was sent.
         if (AIPSTACK_LIKELY(err == IpErr::Success)) {
@@ -1174,30 +2417,6 @@ private:
         return err;     
     }
     
-    static void pcb_increase_cwnd_acked (TcpPcb *pcb, TcpSeqInt acked)
-    {
-        AIPSTACK_ASSERT(pcb->state().canOutput());
-        AIPSTACK_ASSERT(pcb->con != nullptr);
-        
-        // Increase cwnd by acked but no more than snd_mss.
-        TcpSeqInt cwnd_inc = MinValueU(acked, pcb->snd_mss);
-        AddToSat(pcb->con->m_v.cwnd, cwnd_inc);
-        
-        // No longer have initial CWND.
-        pcb->clearFlag(TcpPcbFlags::CwndInit);
-    }
-    
-    // Sets sshthresh according to RFC 5681 equation (4).
-    static void pcb_update_ssthresh_for_rtx (TcpPcb *pcb)
-    {
-        AIPSTACK_ASSERT(pcb->state().canOutput());
-        AIPSTACK_ASSERT(pcb->con != nullptr);
-        
-        TcpSeqInt half_flight_size = (pcb->snd_nxt - pcb->snd_una) / 2u;
-        TcpSeqInt two_smss = 2u * TcpSeqInt(pcb->snd_mss);
-        pcb->con->m_v.ssthresh = MaxValue(half_flight_size, two_smss);
-    }
-    
     static void pcb_start_rtt_measurement (TcpPcb *pcb, bool syn)
     {
         AIPSTACK_ASSERT(!syn ||
@@ -1207,7 +2426,7 @@ private:
         
         // Set the flag, remember the time.
         pcb->setFlag(TcpPcbFlags::RttPending);
-        pcb->rtt_test_time = pcb->platform().getTime();
+        pcb->rtt_test_time = pcb->platform().getEventTime();
         
         // Remember the sequence number except for SYN.
         if (AIPSTACK_LIKELY(!syn)) {
@@ -1218,26 +2437,58 @@ private:
     class PcbOutputHelper {
     private:
         bool prepared;
+        std::uint8_t opts_len;
         IpChksumAccumulator::State partial_chksum_state;
         IpSendPreparedIp4<StackArg> ip_prep;
-        TxAllocHelper<Tcp4Header::Size, HeaderBeforeIp4Dgram> dgram_alloc;
+        TxAllocHelper<Tcp4Header::Size + MaxDataSegOptsLen, HeaderBeforeIp4Dgram>
+            dgram_alloc;
+        TcpOptions tcp_opts;
+        IpStack<StackArg> *tx_batch_stack;
         
     public:
-        inline PcbOutputHelper ()
+        inline PcbOutputHelper (TcpPcb *pcb)
         : prepared(false),
-          dgram_alloc(TxAllocHelperUninitialized())
+          opts_len(0),
+          dgram_alloc(TxAllocHelperUninitialized()),
+          tx_batch_stack(nullptr)
         {
             // We try to do as little as possible here since it would be a waste if
             // pcb_output_active() then determines that nothing needs to be sent.
             // At the first sendSegment call, we will call prepare() to setup common
             // things, to optimize sending multiple segments at a time.
+            
+            // But the options need to be known to determine the segment size.
+            if (pcb_make_opts(pcb, tcp_opts)) {
+                opts_len = CalcTcpOptionsLength(tcp_opts);
+                AIPSTACK_ASSERT(opts_len <= MaxDataSegOptsLen);
+            }
+        }
+        
+        inline ~PcbOutputHelper ()
+        {
+            // End the transmit batch started in prepareCommon, so that drivers
+            // transmit all segments sent using this helper at once.
+            if (tx_batch_stack != nullptr) {
+                tx_batch_stack->endTxBatch();
+            }
+        }
+        
+        // Get the maximum data length of an actual segment, considering options.
+        // The timestamps option is already accounted for in snd_mss.
+        inline std::uint16_t getSegMss (TcpPcb *pcb) const
+        {
+            std::uint8_t extra_opts_len = opts_len;
+            if ((tcp_opts.options & TcpOptionFlags::Timestamps) != Enum0) {
+                extra_opts_len -= TcpOptionWriteLen::Timestamps;
+            }
+            return pcb->snd_mss - extra_opts_len;
         }
         
         IpErr sendSegment (TcpPcb *pcb,
-            TcpSeqNum seq_num, Tcp4Flags seg_flags, IpBufRef data)
+            TcpSeqNum seq_num, Tcp4Flags seg_flags, IpBufRef data, bool pmtu_probe = false)
         {
             // Reset the TxAllocHelper.
-            dgram_alloc.reset(Tcp4Header::Size);
+            dgram_alloc.reset(Tcp4Header::Size + opts_len);
             
             // If this is the first tranamission, prepare common things.
             if (!prepared) {
@@ -1258,12 +2509,13 @@ private:
             chksum.addWord(WrapType<TcpSeqInt>(), seq_num.value());
             
             // Offset+flags
-            Tcp4Flags offset_flags = Tcp4EncodeOffset(5) | seg_flags;
+            Tcp4Flags offset_flags = Tcp4EncodeOffset(5 + opts_len / 4) | seg_flags;
             tcp_header.set(Tcp4Header::OffsetFlags(), offset_flags);
             chksum.addWord(WrapType<std::uint16_t>(), AsUnderlying(offset_flags));
             
             // Add TCP length to checksum.
-            std::uint16_t tcp_len = std::uint16_t(Tcp4Header::Size + data.tot_len);
+            std::uint16_t tcp_len =
+                std::uint16_t(Tcp4Header::Size + opts_len + data.tot_len);
             chksum.addWord(WrapType<std::uint16_t>(), tcp_len);
             
             // Include any data.
@@ -1273,8 +2525,31 @@ private:
                 dgram_alloc.setNext(&data_node, data.tot_len);
             }
             
-            // Calculate checksum.
-            tcp_header.set(Tcp4Header::Checksum(), chksum.getChksum(data));
+            // For a super-segment, write only the pseudo-header sum without the
+            // length, and let the IP layer or the interface do the segmentation.
+            // A Path MTU probe is larger than the segment MSS but must be sent
+            // as a single packet.
+            if (AIPSTACK_UNLIKELY(data.tot_len > getSegMss(pcb)) && !pmtu_probe) {
+                IpChksumAccumulator pseudo_chksum(pcb->pseudo_chksum);
+                tcp_header.set(Tcp4Header::Checksum(), pseudo_chksum.getChksumInverted());
+                
+                return pcb->tcp->m_stack->sendIp4DgramFastSeg(
+                    ip_prep, dgram_alloc.getBufRef(), getSegMss(pcb), pcb);
+            }
+            
+            // Calculate checksum, or only the pseudo-header part if the interface
+            // will calculate the rest.
+            std::uint16_t calc_chksum;
+            if (AIPSTACK_LIKELY((ip_prep.route_info.iface->getTxChksumOffload() &
+                                 IpChksumOffloadFlags::Tcp4) == Enum0))
+            {
+                calc_chksum = chksum.getChksum(data);
+            } else {
+                IpChksumAccumulator pseudo_chksum(pcb->pseudo_chksum);
+                pseudo_chksum.addWord(WrapType<std::uint16_t>(), tcp_len);
+                calc_chksum = pseudo_chksum.getChksumInverted();
+            }
+            tcp_header.set(Tcp4Header::Checksum(), calc_chksum);
             
             // Get the complete datagram reference starting with the TCP header.
             IpBufRef dgram = dgram_alloc.getBufRef();
@@ -1286,8 +2561,9 @@ private:
     private:
         IpErr prepareCommon (TcpPcb *pcb)
         {
-            // We will calculate part of the checksum.
-            IpChksumAccumulator chksum;
+            // We will calculate part of the checksum, starting with the
+            // pseudo-header.
+            IpChksumAccumulator chksum(pcb->pseudo_chksum);
             
             // Write known TCP header fields...
             auto tcp_header = Tcp4Header::MakeRef(dgram_alloc.getPtr());
@@ -1312,32 +2588,55 @@ private:
             // Urgent pointer
             tcp_header.set(Tcp4Header::UrgentPtr(), 0);
             
-            // Add known pseudo-header fields to checksum.
-            chksum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Tcp));
-            chksum.addWord(WrapType<std::uint32_t>(), pcb->local_addr.value());
-            chksum.addWord(WrapType<std::uint32_t>(), pcb->remote_addr.value());
+            // Options (length is a multiple of 4)
+            if (opts_len > 0) {
+                char *opts_ptr = dgram_alloc.getPtr() + Tcp4Header::Size;
+                WriteTcpOptions(tcp_opts, opts_ptr);
+                chksum.addEvenBytes(opts_ptr, opts_len);
+            }
             
             // Store the state of the partial checksum.
             partial_chksum_state = chksum.getState();
             
             // Perform IP level preparation.
+            // Data segments are ECN-capable if ECN is used.
+            IpSendFlags send_flags = pcb_ip_send_flags(pcb);
+            if (TcpProto::EnableEcn && pcb->ecn_ok) {
+                send_flags |= IpSendFlags::EcnCapableFlag;
+            }
+            
             IpErr err = pcb->tcp->m_stack->prepareSendIp4Dgram(
                 dgram_alloc.getPtr(), ip_prep, Ip4CommonSendParams{
-                    *pcb, TcpProto::TcpTTL, Ip4Protocol::Tcp, Constants::TcpIpSendFlags});
+                    *pcb, TcpProto::TcpTTL, Ip4Protocol::Tcp, send_flags},
+                &pcb->route_cache);
             if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
                 return err;
             }
             
             prepared = true;
             
+            // Send the segments within a transmit batch (see the destructor).
+            tx_batch_stack = pcb->tcp->m_stack;
+            tx_batch_stack->beginTxBatch();
+            
             return IpErr::Success;
         }
     };
     
     AIPSTACK_NO_INLINE
-    static IpErr send_tcp_nodata (TcpProto *tcp, TcpPcbKey const &key,
+    inline static IpErr send_tcp_nodata (TcpProto *tcp, TcpPcbKey const &key,
         TcpSeqNum seq_num, TcpSeqNum ack_num, std::uint16_t window_size,
         Tcp4Flags flags, TcpOptions *opts, IpSendRetryRequest *retryReq)
+    {
+        return send_tcp_data(tcp, key, seq_num, ack_num, window_size, flags, opts,
+                             retryReq, IpBufRef{});
+    }
+    
+    // Send a segment outside of pcb_output_active, possibly with data
+    // (only used for a SYN carrying Fast Open data).
+    static IpErr send_tcp_data (TcpProto *tcp, TcpPcbKey const &key,
+        TcpSeqNum seq_num, TcpSeqNum ack_num, std::uint16_t window_size,
+        Tcp4Flags flags, TcpOptions *opts, IpSendRetryRequest *retryReq, IpBufRef data)
     {
         // Compute length of TCP options.
         std::uint8_t opts_len = (opts != nullptr) ? CalcTcpOptionsLength(*opts) : 0;
@@ -1349,34 +2648,14 @@ private:
         // Caculate the offset+flags field.
         Tcp4Flags offset_flags = Tcp4EncodeOffset(5 + opts_len / 4) | flags;
         
-        // The header parts of the checksum will be calculated inline.
-        IpChksumAccumulator chksum_accum;
-        
-        // Adding constants to checksum is more easily optimized if done first.
-        // Add protocol field of pseudo-header.
-        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Tcp));
-        
-        // Write the TCP header...
-        auto tcp_header = Tcp4Header::MakeRef(dgram_alloc.getPtr());
-        
+        // Prepare the TCP header, it is written once the checksum is known.
+        Tcp4Header::Native tcp_header;
         tcp_header.set(Tcp4Header::SrcPort(),     key.local_port);
-        chksum_accum.addWord(WrapType<std::uint16_t>(), key.local_port);
-        
         tcp_header.set(Tcp4Header::DstPort(),     key.remote_port);
-        chksum_accum.addWord(WrapType<std::uint16_t>(), key.remote_port);
-        
         tcp_header.set(Tcp4Header::SeqNum(),      seq_num);
-        chksum_accum.addWord(WrapType<TcpSeqInt>(), seq_num.value());
-        
         tcp_header.set(Tcp4Header::AckNum(),      ack_num);
-        chksum_accum.addWord(WrapType<TcpSeqInt>(), ack_num.value());
-        
         tcp_header.set(Tcp4Header::OffsetFlags(), offset_flags);
-        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(offset_flags));
-        
         tcp_header.set(Tcp4Header::WindowSize(),  window_size);
-        chksum_accum.addWord(WrapType<std::uint16_t>(), window_size);
-        
         tcp_header.set(Tcp4Header::UrgentPtr(),   0);
         
         // Write any TCP options.
@@ -1385,22 +2664,28 @@ private:
         }
         
         // Construct the datagram reference including any data.
+        IpBufNode data_node;
+        if (data.tot_len > 0) {
+            data_node = ipBufRefToNode(data);
+            dgram_alloc.setNext(&data_node, data.tot_len);
+        }
         IpBufRef dgram = dgram_alloc.getBufRef();
         
-        // Add remaining pseudo-header to checksum (protocol was added above).
+        // Write only the pseudo-header sum into the checksum field. Since the
+        // interface is not known here, the IP layer will complete the checksum
+        // (in software or by offloading to the interface).
+        IpChksumAccumulator chksum_accum;
+        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Tcp));
         chksum_accum.addWord(WrapType<std::uint32_t>(), key.local_addr.value());
         chksum_accum.addWord(WrapType<std::uint32_t>(), key.remote_addr.value());
         chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
-        
-        // Complete and write checksum.
-        std::uint16_t calc_chksum =
-            chksum_accum.getChksum(dgram.hideHeader(Tcp4Header::Size));
-        tcp_header.set(Tcp4Header::Checksum(), calc_chksum);
+        tcp_header.set(Tcp4Header::Checksum(), chksum_accum.getChksumInverted());
+        Tcp4Header::Encode(dgram_alloc.getPtr(), tcp_header);
         
         // Send the datagram.
         return tcp->m_stack->sendIp4Dgram(dgram, /*iface=*/nullptr, retryReq,
-            Ip4CommonSendParams{
-                key, TcpProto::TcpTTL, Ip4Protocol::Tcp, Constants::TcpIpSendFlags});
+            Ip4CommonSendParams{key, TcpProto::TcpTTL, Ip4Protocol::Tcp,
+                Constants::TcpIpSendFlags|IpSendFlags::ChksumPartialFlag});
     }
 };
 
@@ -25,12 +25,17 @@
 #ifndef AIPSTACK_TCP_API_H
 #define AIPSTACK_TCP_API_H
 
+#include <cstddef>
+
 #include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
 #include <aipstack/platform/PlatformFacade.h>
 #include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpStats.h>
 #include <aipstack/tcp/TcpListener.h>
 #include <aipstack/tcp/TcpConnection.h>
 #include <aipstack/tcp/IpTcpProto_constants.h>
+#include <aipstack/ip/IpFlowSteering.h>
 
 namespace AIpStack {
 
@@ -73,6 +78,100 @@ public:
     {
         return proto().platform();
     }
+    
+    /**
+     * Get the stack-wide TCP statistics.
+     * 
+     * The counters are only maintained if the EnableStats option is enabled,
+     * otherwise they are all zero. The window probe statistics are additionally
+     * only maintained if the SharedPersistTimer option is enabled.
+     * 
+     * @return Snapshot of the statistics counters.
+     */
+    inline TcpProtoStats getStats () const
+    {
+        TcpProtoStats stats = proto().m_stats.get();
+        if (IpTcpProto<Arg>::EnableStats && IpTcpProto<Arg>::SharedPersistTimer) {
+            stats.wnd_stalled_pcbs = std::uint32_t(proto().m_num_persist_pcbs);
+        }
+        return stats;
+    }
+    
+    /**
+     * Get the memory usage of TCP.
+     * 
+     * The peak number of PCBs and the peak size of the growable PCB pool are
+     * only maintained if the EnableStats option is enabled. The buffer values
+     * are computed by iterating over the PCBs.
+     * 
+     * @return The current memory usage.
+     */
+    inline TcpMemoryStats getMemoryStats () const
+    {
+        return proto().get_memory_stats();
+    }
+
+    /**
+     * Set the flow steering configuration used for choosing ephemeral ports.
+     * 
+     * When set, ports for outgoing connections are only chosen such that the
+     * connection is owned by this shard according to @ref IpFlowSteering
+     * (@ref IpFlowSteering::isOwnFlow), so that received segments of the
+     * connection are steered to this instance of the stack.
+     * 
+     * @param steering Flow steering object which must remain valid while it is
+     *        set, or null to disable.
+     */
+    inline void setFlowSteering (IpFlowSteering const *steering)
+    {
+        proto().m_flow_steering = steering;
+    }
+    
+    /**
+     * Get the receive memory currently committed by TCP connections.
+     * 
+     * This is the sum of the receive windows announced by connections, that is
+     * the amount of data which peers may send before they receive further window
+     * updates. It is only maintained if the RcvMemBudget option is nonzero,
+     * otherwise it is zero. With RcvMemBudget, window growth is limited so that
+     * it does not exceed the budget (except for the windows of SYN segments).
+     * 
+     * @return The committed receive memory in bytes.
+     */
+    inline std::size_t getRcvMemUsage () const
+    {
+        return proto().m_rcv_mem_used;
+    }
+    
+    /**
+     * Check whether TCP is under receive memory pressure.
+     * 
+     * Pressure is entered when the usage (see @ref getRcvMemUsage) reaches
+     * RcvMemPressurePercent of RcvMemBudget, and left when it falls below three
+     * quarters of that. Under pressure, each connection can only grow its window
+     * to a fair share of the budget and receive buffer auto-tuning is suspended.
+     * 
+     * @return Whether there is pressure (always false without RcvMemBudget).
+     */
+    inline bool isRcvMemPressure () const
+    {
+        return proto().m_rcv_mem_pressure;
+    }
+    
+    /**
+     * Set the callback function for changes of receive memory pressure.
+     * 
+     * The callback is called with true when pressure is entered and with false
+     * when it is left (see @ref isRcvMemPressure). It is called from a timer
+     * shortly after the change and not from within other TCP processing, so it
+     * may do anything (for example, reset connections to reduce load).
+     * 
+     * @param handler Callback function, or null for none.
+     */
+    inline void setRcvMemPressureHandler (Function<void(bool pressure)> handler)
+    {
+        proto().m_rcv_mem_pressure_handler = handler;
+    }
 };
 
 }
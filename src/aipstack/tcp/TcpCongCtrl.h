@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_CONG_CTRL_H
+#define AIPSTACK_TCP_CONG_CTRL_H
+
+#include <cstdint>
+
+#include <aipstack/tcp/TcpSeqNum.h>
+
+namespace AIpStack {
+
+/**
+ * Number of fractional bits of rates used by congestion control, which are
+ * in bytes per unit of the congestion control clock (see TcpCongCtrlContext::now).
+ */
+inline constexpr int TcpCongCtrlRateBits = 8;
+
+/**
+ * Variables and information passed to congestion control hooks.
+ * 
+ * Congestion control is provided by a service type selected with
+ * IpTcpProtoOptions::CongCtrlService (see TcpCongCtrlRenoService,
+ * TcpCongCtrlCubicService and TcpCongCtrlBbrService). The service defines a nested template
+ * `Algorithm<Constants>` with an instance of a class which holds the
+ * per-connection state of the algorithm and provides a constant
+ * `static constexpr bool SamplesDelivery` and these hooks (all must be
+ * defined even if not called):
+ * 
+ * - `void init (TcpCongCtrlContext const &ctx)`: called when the connection
+ *   becomes established, after cwnd and ssthresh have been initialized.
+ * - `void segmentSent (TcpCongCtrlContext const &ctx, TcpSeqNum end_seq,
+ *   bool rtx)`: only if SamplesDelivery, called when a data or FIN segment has
+ *   been sent, before the segment is included in flight_size. The rtx argument
+ *   indicates whether the segment includes sequence space sent before.
+ * - `void dataAcked (TcpCongCtrlContext const &ctx, TcpSeqNum ack_num,
+ *   TcpSeqInt acked)`: only if SamplesDelivery, called for every ACK of new
+ *   data (also in fast recovery) before ackReceived. This can be used to
+ *   sample the delivery rate (see TcpRateSampler).
+ * - `void ackReceived (TcpCongCtrlContext const &ctx, TcpSeqInt acked)`: called
+ *   when new data is acknowledged outside of fast recovery. This should
+ *   adjust cwnd (e.g. slow start and congestion avoidance).
+ * - `void roundTripCompleted ()`: called about once per round-trip time, when
+ *   the per-window round-trip-time measurement completes.
+ * - `void fastRetransmit (TcpCongCtrlContext const &ctx)`: called when fast
+ *   recovery is started. This must set ssthresh, after that cwnd is set to
+ *   ssthresh plus three segments (RFC 5681, RFC 6582), or with
+ *   IpTcpProtoOptions::EnablePrr it is brought down toward ssthresh over
+ *   the recovery by Proportional Rate Reduction (RFC 6937).
+ * - `void rtoExpired (TcpCongCtrlContext const &ctx, bool first_rtx)`: called on
+ *   a retransmission timeout. If first_rtx, this must set ssthresh. After that
+ *   cwnd is set to one segment.
+ * - `void ecnCongestion (TcpCongCtrlContext const &ctx)`: only if ECN is used
+ *   (IpTcpProtoOptions::EnableEcn), called when ECN-Echo is received, at most
+ *   once per window of data and not in loss recovery. This must set ssthresh,
+ *   after that cwnd is reduced to ssthresh (RFC 3168 section 6.1.2). With
+ *   IpTcpProtoOptions::EcnDctcp ssthresh is then overridden by the DCTCP
+ *   reduction, but the hook is still called to let the algorithm update its
+ *   state.
+ * - `void idleRestart (TcpCongCtrlContext const &ctx)`: called when sending
+ *   restarts after an idle period, after cwnd has been reduced.
+ * - `std::uint32_t pacingRate (TcpCongCtrlContext const &ctx)`: called when
+ *   pacing is enabled (IpTcpProtoOptions::EnablePacing) to get the rate at
+ *   which to send, in bytes per clock unit with @ref TcpCongCtrlRateBits
+ *   fractional bits. Zero means that the default rate based on cwnd and
+ *   srtt is used.
+ * 
+ * The hooks must keep ssthresh at least snd_mss and must not decrease cwnd
+ * below snd_mss. Loss recovery itself (inflating and deflating cwnd in fast
+ * recovery) is not part of congestion control.
+ */
+struct TcpCongCtrlContext {
+    // Congestion window and slow-start threshold.
+    TcpSeqInt &cwnd;
+    TcpSeqInt &ssthresh;
+    
+    // Amount of sent but unacknowledged data (before any ACK being processed).
+    TcpSeqInt flight_size;
+    
+    // Smoothed round-trip-time in RTT units (zero if not known yet). RTT
+    // units are microseconds-scale with IpTcpProtoOptions::HighResRtt.
+    std::uint32_t srtt;
+    
+    // Current maximum segment size.
+    std::uint16_t snd_mss;
+    
+    // Current time of the congestion control clock, which is finer than RTT
+    // units, truncated to 32 bits (see Constants::CcClockShift, CcClockMask).
+    std::uint32_t now;
+};
+
+}
+
+#endif
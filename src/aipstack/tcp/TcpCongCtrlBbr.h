@@ -0,0 +1,476 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_CONG_CTRL_BBR_H
+#define AIPSTACK_TCP_CONG_CTRL_BBR_H
+
+#include <cstdint>
+
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpMiscUtils.h>
+#include <aipstack/tcp/TcpCongCtrl.h>
+#include <aipstack/tcp/TcpRateSampler.h>
+
+namespace AIpStack {
+
+/**
+ * BBR model-based congestion control (draft-cardwell-iccrg-bbr-congestion-control).
+ * 
+ * Instead of reacting to loss, this builds a model of the path consisting of
+ * the bottleneck bandwidth (windowed maximum of delivery rate samples over 10
+ * round trips) and the round-trip propagation delay (minimum RTT over 10
+ * seconds), and sets cwnd to a multiple of the estimated bandwidth-delay
+ * product. This keeps queues at a shallow-buffer bottleneck small and avoids
+ * the throughput collapse of loss-based algorithms with random loss.
+ * 
+ * The state machine follows BBR: Startup grows cwnd until the bandwidth stops
+ * growing, Drain removes the queue created in Startup, ProbeBW cycles the gain
+ * to probe for more bandwidth and then drain again, and ProbeRTT periodically
+ * reduces cwnd to refresh the minimum RTT. The gains of each state are applied
+ * to the pacing rate (when pacing is enabled) as well as to cwnd, so that the
+ * amount of data in flight is controlled even without pacing.
+ * 
+ * Loss is handled by the generic loss recovery, limited to the model-based
+ * cwnd instead of halving it.
+ */
+template<typename Arg>
+class TcpCongCtrlBbr
+{
+    using Constants = typename Arg::Constants;
+    
+    enum class Mode : std::uint8_t {Startup, Drain, ProbeBw, ProbeRtt};
+    
+    // Gains are fixed-point with this many fractional bits.
+    inline static constexpr int GainBits = 8;
+    inline static constexpr std::uint16_t GainUnit = std::uint16_t(1) << GainBits;
+    
+    // Gain in Startup, 2/ln(2).
+    inline static constexpr std::uint16_t HighGain = 739;
+    
+    // Pacing gain in Drain, the inverse of HighGain.
+    inline static constexpr std::uint16_t DrainGain = 89;
+    
+    // Gains cycled through in ProbeBW, each for about a minimum RTT.
+    inline static constexpr int NumCycleGains = 8;
+    inline static constexpr std::uint16_t CycleGains[NumCycleGains] = {
+        GainUnit * 5 / 4, GainUnit * 3 / 4, GainUnit, GainUnit,
+        GainUnit, GainUnit, GainUnit, GainUnit};
+    
+    // The pipe is considered full when the bandwidth has not grown by
+    // at least 25% for this many round trips.
+    inline static constexpr std::uint16_t FullBwThreshold = GainUnit * 5 / 4;
+    inline static constexpr std::uint8_t FullBwRounds = 3;
+    
+    // Bandwidth is in bytes per clock unit with this many fractional bits.
+    inline static constexpr int BwBits = TcpCongCtrlRateBits;
+    
+    // Window of the bandwidth filter in round trips.
+    inline static constexpr std::uint32_t BwWindowRounds = 10;
+    
+    // Window of the minimum RTT filter (10 seconds) and the time
+    // spent in ProbeRTT (200 ms), in clock units.
+    inline static constexpr std::uint32_t MinRttWindow = 10.0 * Constants::CcClockFreq;
+    inline static constexpr std::uint32_t ProbeRttTime = 0.2 * Constants::CcClockFreq;
+    
+    // Minimum cwnd in segments, which is also the cwnd in ProbeRTT.
+    inline static constexpr TcpSeqInt MinCwndSegs = 4;
+    
+    // Allowance for delayed and aggregated ACKs in segments, added to cwnd.
+    inline static constexpr TcpSeqInt CwndQuantumSegs = 3;
+    
+    // Number of segments sampled for delivery rate at a time.
+    inline static constexpr std::uint8_t NumRateRecords = 4;
+    
+    struct BwEntry {
+        std::uint32_t round;
+        std::uint32_t bw;
+    };
+    
+    TcpRateSampler<Constants::CcClockMask, NumRateRecords> m_sampler;
+    
+    // Windowed maximum filter of the bandwidth, best three samples.
+    BwEntry m_bw[3];
+    
+    // Round trip counting based on delivered data.
+    TcpSeqNum m_next_round_delivered;
+    std::uint32_t m_round_count;
+    
+    // Minimum RTT (TypeMax if unknown) and when it was last updated.
+    std::uint32_t m_min_rtt;
+    std::uint32_t m_min_rtt_stamp;
+    
+    // Time of the start of the current ProbeBW phase or of the minimum
+    // duration of ProbeRTT.
+    std::uint32_t m_phase_stamp;
+    
+    // Bandwidth seen when detecting a full pipe in Startup.
+    std::uint32_t m_full_bw;
+    std::uint8_t m_full_bw_count;
+    
+    Mode m_mode;
+    std::uint8_t m_cycle_index;
+    std::uint16_t m_cwnd_gain;
+    std::uint16_t m_pacing_gain;
+    bool m_filled_pipe;
+    bool m_round_start;
+    bool m_probe_rtt_started;
+    bool m_probe_rtt_round_done;
+
+public:
+    // Whether the segmentSent and dataAcked hooks are used.
+    inline static constexpr bool SamplesDelivery = true;
+    
+    void init (TcpCongCtrlContext const &ctx)
+    {
+        m_sampler.init(ctx.now);
+        for (BwEntry &entry : m_bw) {
+            entry = BwEntry{0, 0};
+        }
+        m_next_round_delivered = TcpSeqNum(0);
+        m_round_count = 0;
+        m_min_rtt = TypeMax<std::uint32_t>;
+        m_min_rtt_stamp = ctx.now;
+        m_full_bw = 0;
+        m_full_bw_count = 0;
+        m_filled_pipe = false;
+        m_round_start = false;
+        enterStartup();
+    }
+    
+    inline void segmentSent (TcpCongCtrlContext const &ctx, TcpSeqNum end_seq, bool rtx)
+    {
+        m_sampler.segmentSent(ctx, end_seq, rtx);
+    }
+    
+    void dataAcked (TcpCongCtrlContext const &ctx, TcpSeqNum ack_num, TcpSeqInt acked)
+    {
+        TcpSeqInt inflight = ctx.flight_size - MinValue(acked, ctx.flight_size);
+        
+        // Update the model based on any rate sample.
+        TcpRateSample sample;
+        bool min_rtt_expired = false;
+        m_round_start = false;
+        if (m_sampler.dataAcked(ctx, ack_num, acked, sample)) {
+            updateRound(sample);
+            updateBw(sample);
+            min_rtt_expired = updateMinRtt(ctx, sample);
+        }
+        
+        // Advance the state machine.
+        if (m_round_start) {
+            checkFullPipe();
+        }
+        if (m_mode == Mode::Startup && m_filled_pipe) {
+            m_mode = Mode::Drain;
+            m_cwnd_gain = GainUnit;
+            m_pacing_gain = DrainGain;
+        }
+        if (m_mode == Mode::Drain && inflight <= bdpCwnd(ctx, GainUnit)) {
+            enterProbeBw(ctx);
+        }
+        if (m_mode == Mode::ProbeBw) {
+            updateCycle(ctx, inflight);
+        }
+        updateProbeRtt(ctx, inflight, min_rtt_expired);
+    }
+    
+    void ackReceived (TcpCongCtrlContext const &ctx, TcpSeqInt acked)
+    {
+        TcpSeqInt target = bdpCwnd(ctx, m_cwnd_gain);
+        TcpSeqInt cwnd = ctx.cwnd;
+        
+        // Once the pipe is full, approach the target from either side. Before
+        // that, grow cwnd like slow start since the model is still immature.
+        if (m_filled_pipe) {
+            AddToSat(cwnd, acked);
+            cwnd = MinValue(cwnd, target);
+        } else if (cwnd < target) {
+            AddToSat(cwnd, acked);
+        }
+        
+        TcpSeqInt min_cwnd = MinCwndSegs * ctx.snd_mss;
+        cwnd = MaxValue(cwnd, min_cwnd);
+        if (m_mode == Mode::ProbeRtt) {
+            cwnd = MinValue(cwnd, min_cwnd);
+        }
+        
+        ctx.cwnd = cwnd;
+    }
+    
+    inline void roundTripCompleted ()
+    {
+    }
+    
+    void fastRetransmit (TcpCongCtrlContext const &ctx)
+    {
+        updateSsthreshForLoss(ctx);
+    }
+    
+    void rtoExpired (TcpCongCtrlContext const &ctx, bool first_rtx)
+    {
+        if (first_rtx) {
+            updateSsthreshForLoss(ctx);
+        }
+    }
+    
+    inline void ecnCongestion (TcpCongCtrlContext const &ctx)
+    {
+        // The model is not based on ECN, so the window is not reduced.
+        ctx.ssthresh = MaxValue(ctx.cwnd, TcpSeqInt(2u * TcpSeqInt(ctx.snd_mss)));
+    }
+    
+    inline void idleRestart (TcpCongCtrlContext const &)
+    {
+    }
+    
+    std::uint32_t pacingRate (TcpCongCtrlContext const &)
+    {
+        // Without a bandwidth estimate this is zero and the default rate is used.
+        std::uint64_t rate = (std::uint64_t(m_bw[0].bw) * m_pacing_gain) >> GainBits;
+        return std::uint32_t(MinValue(rate, std::uint64_t(TypeMax<std::uint32_t>)));
+    }
+
+private:
+    void enterStartup ()
+    {
+        m_mode = Mode::Startup;
+        m_cwnd_gain = HighGain;
+        m_pacing_gain = HighGain;
+    }
+    
+    void enterProbeBw (TcpCongCtrlContext const &ctx)
+    {
+        // Start in a phase with unity gain, since the queue has just been
+        // drained.
+        m_mode = Mode::ProbeBw;
+        m_cycle_index = 2;
+        m_cwnd_gain = CycleGains[m_cycle_index];
+        m_pacing_gain = m_cwnd_gain;
+        m_phase_stamp = ctx.now;
+    }
+    
+    void updateRound (TcpRateSample const &sample)
+    {
+        // A round trip ends when a segment sent after the start of the
+        // round trip has been acknowledged.
+        if (!sample.prior_delivered.mod_lt(m_next_round_delivered)) {
+            m_next_round_delivered = m_sampler.delivered();
+            m_round_count++;
+            m_round_start = true;
+        }
+    }
+    
+    void updateBw (TcpRateSample const &sample)
+    {
+        // Intervals shorter than the clock resolution say nothing about the rate.
+        if (sample.interval == 0) {
+            return;
+        }
+        
+        std::uint64_t bw64 = (std::uint64_t(sample.delivered) << BwBits) / sample.interval;
+        std::uint32_t bw =
+            std::uint32_t(MinValue(bw64, std::uint64_t(TypeMax<std::uint32_t>)));
+        
+        // Windowed maximum filter keeping the best, second best and third best
+        // samples from successive parts of the window.
+        std::uint32_t round = m_round_count;
+        BwEntry entry = BwEntry{round, bw};
+        
+        if (bw >= m_bw[0].bw || round - m_bw[2].round > BwWindowRounds) {
+            m_bw[0] = m_bw[1] = m_bw[2] = entry;
+            return;
+        }
+        
+        if (bw >= m_bw[1].bw) {
+            m_bw[1] = m_bw[2] = entry;
+        } else if (bw >= m_bw[2].bw) {
+            m_bw[2] = entry;
+        }
+        
+        std::uint32_t dt = round - m_bw[0].round;
+        if (dt > BwWindowRounds) {
+            m_bw[0] = m_bw[1];
+            m_bw[1] = m_bw[2];
+            m_bw[2] = entry;
+            if (round - m_bw[0].round > BwWindowRounds) {
+                m_bw[0] = m_bw[1];
+                m_bw[1] = m_bw[2];
+            }
+        } else if (m_bw[1].round == m_bw[0].round && dt > BwWindowRounds / 4) {
+            m_bw[1] = m_bw[2] = entry;
+        } else if (m_bw[2].round == m_bw[1].round && dt > BwWindowRounds / 2) {
+            m_bw[2] = entry;
+        }
+    }
+    
+    // Returns whether the minimum RTT filter had expired.
+    bool updateMinRtt (TcpCongCtrlContext const &ctx, TcpRateSample const &sample)
+    {
+        bool expired = elapsed(ctx.now, m_min_rtt_stamp) > MinRttWindow;
+        
+        if (sample.rtt <= m_min_rtt || expired) {
+            m_min_rtt = sample.rtt;
+            m_min_rtt_stamp = ctx.now;
+        }
+        
+        return expired;
+    }
+    
+    void checkFullPipe ()
+    {
+        if (m_filled_pipe) {
+            return;
+        }
+        
+        std::uint32_t bw = m_bw[0].bw;
+        if (std::uint64_t(bw) << GainBits >= std::uint64_t(m_full_bw) * FullBwThreshold) {
+            m_full_bw = bw;
+            m_full_bw_count = 0;
+            return;
+        }
+        
+        if (++m_full_bw_count >= FullBwRounds) {
+            m_filled_pipe = true;
+        }
+    }
+    
+    void updateCycle (TcpCongCtrlContext const &ctx, TcpSeqInt inflight)
+    {
+        bool full_length = elapsed(ctx.now, m_phase_stamp) > m_min_rtt;
+        
+        // Stay in a probing phase until the data in flight reaches the
+        // higher target, and leave a draining phase early once the data in
+        // flight falls to the estimated BDP.
+        bool next;
+        if (m_cwnd_gain > GainUnit) {
+            next = full_length && inflight >= bdpCwnd(ctx, m_cwnd_gain);
+        } else if (m_cwnd_gain < GainUnit) {
+            next = full_length || inflight <= bdpCwnd(ctx, GainUnit);
+        } else {
+            next = full_length;
+        }
+        
+        if (next) {
+            m_cycle_index = (m_cycle_index + 1) % NumCycleGains;
+            m_cwnd_gain = CycleGains[m_cycle_index];
+            m_pacing_gain = m_cwnd_gain;
+            m_phase_stamp = ctx.now;
+        }
+    }
+    
+    void updateProbeRtt (TcpCongCtrlContext const &ctx, TcpSeqInt inflight, bool expired)
+    {
+        if (expired && m_mode != Mode::ProbeRtt) {
+            m_mode = Mode::ProbeRtt;
+            m_pacing_gain = GainUnit;
+            m_probe_rtt_started = false;
+        }
+        
+        if (m_mode != Mode::ProbeRtt) {
+            return;
+        }
+        
+        if (!m_probe_rtt_started) {
+            // Wait for the data in flight to reach the minimum cwnd, then stay
+            // for at least ProbeRttTime and one round trip.
+            if (inflight <= MinCwndSegs * ctx.snd_mss) {
+                m_probe_rtt_started = true;
+                m_probe_rtt_round_done = false;
+                m_phase_stamp = ctx.now;
+                m_next_round_delivered = m_sampler.delivered();
+            }
+        } else {
+            if (m_round_start) {
+                m_probe_rtt_round_done = true;
+            }
+            
+            if (m_probe_rtt_round_done && elapsed(ctx.now, m_phase_stamp) >= ProbeRttTime) {
+                m_min_rtt_stamp = ctx.now;
+                if (m_filled_pipe) {
+                    enterProbeBw(ctx);
+                } else {
+                    enterStartup();
+                }
+            }
+        }
+    }
+    
+    inline static std::uint32_t elapsed (std::uint32_t now, std::uint32_t stamp)
+    {
+        return (now - stamp) & Constants::CcClockMask;
+    }
+    
+    // Calculate cwnd for a multiple of the estimated bandwidth-delay product.
+    TcpSeqInt bdpCwnd (TcpCongCtrlContext const &ctx, std::uint16_t gain) const
+    {
+        // If there is no estimate use the initial cwnd.
+        if (m_min_rtt == TypeMax<std::uint32_t> || m_bw[0].bw == 0) {
+            return CalcInitialTcpCwnd(ctx.snd_mss);
+        }
+        
+        std::uint64_t bdp = (std::uint64_t(m_bw[0].bw) *
+            MaxValue(m_min_rtt, std::uint32_t(1))) >> BwBits;
+        std::uint64_t cwnd = ((bdp * gain) >> GainBits) + CwndQuantumSegs * ctx.snd_mss;
+        
+        cwnd = MaxValue(cwnd, std::uint64_t(MinCwndSegs * ctx.snd_mss));
+        return TcpSeqInt(MinValue(cwnd, std::uint64_t(Constants::MaxWindow)));
+    }
+    
+    // Set ssthresh, which limits cwnd after loss recovery, such that cwnd
+    // follows the model. Without a model, use the standard reduction.
+    void updateSsthreshForLoss (TcpCongCtrlContext const &ctx)
+    {
+        TcpSeqInt two_smss = 2u * TcpSeqInt(ctx.snd_mss);
+        TcpSeqInt ssthresh;
+        if (m_bw[0].bw == 0) {
+            ssthresh = ctx.flight_size / 2u;
+        } else {
+            ssthresh = bdpCwnd(ctx, m_cwnd_gain);
+        }
+        ctx.ssthresh = MaxValue(ssthresh, two_smss);
+    }
+};
+
+/**
+ * Service type for BBR congestion control (@ref TcpCongCtrlBbr).
+ * 
+ * This can be used as IpTcpProtoOptions::CongCtrlService.
+ */
+class TcpCongCtrlBbrService {
+public:
+    #ifndef IN_DOXYGEN
+    template<typename Constants_>
+    struct Algorithm {
+        using Constants = Constants_;
+        AIPSTACK_DEF_INSTANCE(Algorithm, TcpCongCtrlBbr)
+    };
+    #endif
+};
+
+}
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_CONG_CTRL_CUBIC_H
+#define AIPSTACK_TCP_CONG_CTRL_CUBIC_H
+
+#include <cstdint>
+
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpCongCtrl.h>
+
+namespace AIpStack {
+
+/**
+ * CUBIC congestion control (RFC 8312).
+ * 
+ * In congestion avoidance, cwnd follows a cubic function of the time since
+ * the last congestion event, which makes window growth independent of the
+ * round-trip time and quickly recovers the window on long fat networks. The
+ * Reno-friendly region ensures that cwnd grows at least as fast as with Reno.
+ * Slow start is the same as with Reno.
+ * 
+ * All calculations are done using integer arithmetic. Times are represented
+ * in units of 1/1024 seconds and window sizes in bytes.
+ */
+template<typename Arg>
+class TcpCongCtrlCubic
+{
+    using Constants = typename Arg::Constants;
+    
+    // Number of fractional bits of times used in calculations (seconds).
+    inline static constexpr int TimeBits = 10;
+    
+    // Factors for converting from RTT units and clock units to calculation
+    // time units, with 16 fractional bits.
+    inline static constexpr std::uint64_t RttToTimeFactor =
+        65536.0 * double(std::uint32_t(1) << TimeBits) / Constants::RttTimeFreq;
+    inline static constexpr std::uint64_t ClockToTimeFactor =
+        65536.0 * double(std::uint32_t(1) << TimeBits) / Constants::CcClockFreq;
+    
+    // Limit for time differences in calculations, which prevents overflow.
+    // This corresponds to 1024 seconds, cwnd would be huge by then.
+    inline static constexpr std::uint64_t MaxTimeDiff = std::uint64_t(1) << 20;
+    
+    // Constant C = 0.4 (window growth in segments per second cubed).
+    inline static constexpr std::uint64_t CNum = 2;
+    inline static constexpr std::uint64_t CDen = 5;
+    
+    // Multiplicative decrease factor beta = 0.7.
+    inline static constexpr std::uint64_t BetaNum = 7;
+    inline static constexpr std::uint64_t BetaDen = 10;
+    
+    // Fast convergence factor (1 + beta) / 2 = 0.85.
+    inline static constexpr std::uint64_t FastConvNum = 17;
+    inline static constexpr std::uint64_t FastConvDen = 20;
+    
+    // Additive increase factor in the Reno-friendly region,
+    // 3 * (1 - beta) / (1 + beta) = 9/17 (segments per round trip).
+    inline static constexpr std::uint64_t AlphaNum = 9;
+    inline static constexpr std::uint64_t AlphaDen = 17;
+    
+    // Window size just before the last reduction (W_max).
+    TcpSeqInt m_w_max;
+    
+    // Window size at the plateau of the cubic function in this epoch.
+    TcpSeqInt m_origin;
+    
+    // Window size at the start of the epoch.
+    TcpSeqInt m_epoch_cwnd;
+    
+    // Remainder of cwnd increments (fraction of a byte times cwnd).
+    TcpSeqInt m_inc_rem;
+    
+    // Time when the epoch started (clock units).
+    std::uint32_t m_epoch_start;
+    
+    // Time from the start of the epoch to the plateau (K).
+    std::uint32_t m_k;
+    
+    // Whether an epoch has started (in congestion avoidance).
+    bool m_epoch_valid;
+
+public:
+    // Whether the segmentSent and dataAcked hooks are used.
+    inline static constexpr bool SamplesDelivery = false;
+    
+    inline void init (TcpCongCtrlContext const &)
+    {
+        m_w_max = 0;
+        m_epoch_valid = false;
+    }
+    
+    inline void segmentSent (TcpCongCtrlContext const &, TcpSeqNum, bool)
+    {
+    }
+    
+    inline void dataAcked (TcpCongCtrlContext const &, TcpSeqNum, TcpSeqInt)
+    {
+    }
+    
+    void ackReceived (TcpCongCtrlContext const &ctx, TcpSeqInt acked)
+    {
+        if (ctx.cwnd <= ctx.ssthresh) {
+            // Slow start.
+            AddToSat(ctx.cwnd, MinValueU(acked, ctx.snd_mss));
+            return;
+        }
+        
+        // Congestion avoidance, start an epoch on the first ACK.
+        if (!m_epoch_valid) {
+            startEpoch(ctx);
+        }
+        
+        // Get the time since the start of the epoch and the round-trip time.
+        std::uint64_t t = clockToTime(elapsed(ctx.now, m_epoch_start));
+        std::uint64_t rtt = MaxValue(std::uint64_t(1), rttToTime(ctx.srtt));
+        
+        // In the Reno-friendly region (the cubic window is less than the window
+        // Reno would have), use the latter.
+        TcpSeqInt w_est = renoFriendlyWindow(ctx, t, rtt);
+        if (cubicWindow(ctx, t) < w_est) {
+            if (ctx.cwnd < w_est) {
+                ctx.cwnd = w_est;
+            }
+            return;
+        }
+        
+        // Get the target window, which is the cubic window one round-trip
+        // time ahead, but within [cwnd, 1.5*cwnd].
+        TcpSeqInt target = cubicWindow(ctx, t + rtt);
+        target = MinValue(target, TcpSeqInt(ctx.cwnd + ctx.cwnd / 2u));
+        if (target <= ctx.cwnd) {
+            return;
+        }
+        
+        // Increase cwnd by (target - cwnd) / cwnd per segment acknowledged,
+        // keeping the remainder of the division for the next increase.
+        std::uint64_t inc = std::uint64_t(target - ctx.cwnd) * acked + m_inc_rem;
+        TcpSeqInt cwnd = ctx.cwnd;
+        AddToSat(ctx.cwnd, TcpSeqInt(inc / cwnd));
+        m_inc_rem = TcpSeqInt(inc % cwnd);
+    }
+    
+    inline void roundTripCompleted ()
+    {
+    }
+    
+    void fastRetransmit (TcpCongCtrlContext const &ctx)
+    {
+        congestionEvent(ctx);
+    }
+    
+    void ecnCongestion (TcpCongCtrlContext const &ctx)
+    {
+        congestionEvent(ctx);
+    }
+    
+    void rtoExpired (TcpCongCtrlContext const &ctx, bool first_rtx)
+    {
+        if (first_rtx) {
+            congestionEvent(ctx);
+        }
+        
+        // The window will grow in slow start first, start a new epoch later.
+        m_epoch_valid = false;
+    }
+    
+    inline void idleRestart (TcpCongCtrlContext const &)
+    {
+        // Do not continue the cubic function from before the idle period.
+        m_epoch_valid = false;
+    }
+
+    inline std::uint32_t pacingRate (TcpCongCtrlContext const &)
+    {
+        return 0;
+    }
+
+private:
+    void congestionEvent (TcpCongCtrlContext const &ctx)
+    {
+        // Remember the window size at the reduction (W_max). With fast
+        // convergence, if the window did not reach the previous W_max, reduce
+        // W_max further to release bandwidth to new flows.
+        TcpSeqInt cwnd = ctx.cwnd;
+        m_w_max = (cwnd < m_w_max) ?
+            TcpSeqInt(std::uint64_t(cwnd) * FastConvNum / FastConvDen) : cwnd;
+        
+        // Multiplicative decrease.
+        TcpSeqInt reduced_cwnd = TcpSeqInt(std::uint64_t(cwnd) * BetaNum / BetaDen);
+        ctx.ssthresh = MaxValue(reduced_cwnd, TcpSeqInt(2u * TcpSeqInt(ctx.snd_mss)));
+        
+        m_epoch_valid = false;
+    }
+    
+    void startEpoch (TcpCongCtrlContext const &ctx)
+    {
+        m_epoch_valid = true;
+        m_epoch_start = ctx.now;
+        m_epoch_cwnd = ctx.cwnd;
+        m_inc_rem = 0;
+        
+        if (ctx.cwnd < m_w_max) {
+            // The plateau is at W_max and is reached after time
+            // K = cbrt((W_max - cwnd) / C), with the window in segments.
+            // The window difference is computed with 10 fractional bits and
+            // the cube of time in calculation units has 30 fractional bits.
+            std::uint64_t diff = (std::uint64_t(m_w_max - ctx.cwnd) << 10) / ctx.snd_mss;
+            m_k = cubeRoot(((diff * CDen) / CNum) << (3 * TimeBits - 10));
+            m_origin = m_w_max;
+        } else {
+            // Start at the plateau.
+            m_k = 0;
+            m_origin = ctx.cwnd;
+        }
+    }
+    
+    // Calculate W_cubic(t) = C * (t - K)^3 + W_max.
+    TcpSeqInt cubicWindow (TcpCongCtrlContext const &ctx, std::uint64_t t) const
+    {
+        bool before_plateau = t < m_k;
+        std::uint64_t d = before_plateau ? (m_k - t) : (t - m_k);
+        d = MinValue(d, MaxTimeDiff);
+        
+        // C * d^3 in segments with 10 fractional bits, then in bytes.
+        std::uint64_t delta_segs = (CNum * d * d * d / CDen) >> (3 * TimeBits - 10);
+        std::uint64_t delta = (delta_segs * ctx.snd_mss) >> 10;
+        
+        if (before_plateau) {
+            return TcpSeqInt(m_origin - MinValue(delta, std::uint64_t(m_origin)));
+        } else {
+            return TcpSeqInt(
+                MinValue(m_origin + delta, std::uint64_t(Constants::MaxWindow)));
+        }
+    }
+    
+    // Calculate the window Reno would have at time t of the epoch:
+    // W_est(t) = cwnd_epoch + alpha * t / RTT, with alpha in segments.
+    TcpSeqInt renoFriendlyWindow (TcpCongCtrlContext const &ctx,
+                                  std::uint64_t t, std::uint64_t rtt) const
+    {
+        std::uint64_t inc = (AlphaNum * ctx.snd_mss * t) / (AlphaDen * rtt);
+        return TcpSeqInt(
+            MinValue(m_epoch_cwnd + inc, std::uint64_t(Constants::MaxWindow)));
+    }
+    
+    inline static std::uint32_t elapsed (std::uint32_t now, std::uint32_t stamp)
+    {
+        return (now - stamp) & Constants::CcClockMask;
+    }
+    
+    inline static std::uint64_t clockToTime (std::uint32_t clock_time)
+    {
+        return (std::uint64_t(clock_time) * ClockToTimeFactor) >> 16;
+    }
+    
+    inline static std::uint64_t rttToTime (std::uint32_t rtt_time)
+    {
+        return (std::uint64_t(rtt_time) * RttToTimeFactor) >> 16;
+    }
+    
+    // Integer cube root, rounded down.
+    static std::uint32_t cubeRoot (std::uint64_t x)
+    {
+        std::uint64_t y = 0;
+        for (int s = 63; s >= 0; s -= 3) {
+            y *= 2;
+            std::uint64_t b = 3 * y * (y + 1) + 1;
+            if ((x >> s) >= b) {
+                x -= b << s;
+                y++;
+            }
+        }
+        return std::uint32_t(y);
+    }
+};
+
+/**
+ * Service type for CUBIC congestion control (@ref TcpCongCtrlCubic).
+ * 
+ * This can be used as IpTcpProtoOptions::CongCtrlService.
+ */
+class TcpCongCtrlCubicService {
+public:
+    #ifndef IN_DOXYGEN
+    template<typename Constants_>
+    struct Algorithm {
+        using Constants = Constants_;
+        AIPSTACK_DEF_INSTANCE(Algorithm, TcpCongCtrlCubic)
+    };
+    #endif
+};
+
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_CONG_CTRL_RENO_H
+#define AIPSTACK_TCP_CONG_CTRL_RENO_H
+
+#include <cstdint>
+
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpCongCtrl.h>
+
+namespace AIpStack {
+
+/**
+ * Reno congestion control (RFC 5681).
+ * 
+ * In congestion avoidance, cwnd is increased by snd_mss once cwnd data has
+ * been acknowledged, but at most once per round-trip time.
+ */
+template<typename Arg>
+class TcpCongCtrlReno
+{
+    // Amount of data acknowledged in congestion avoidance since the last
+    // cwnd increment.
+    TcpSeqInt m_cwnd_acked;
+    
+    // Whether cwnd was incremented in congestion avoidance in this round trip.
+    bool m_cwnd_incrd;
+
+public:
+    // Whether the segmentSent and dataAcked hooks are used.
+    inline static constexpr bool SamplesDelivery = false;
+    
+    inline void init (TcpCongCtrlContext const &)
+    {
+        m_cwnd_acked = 0;
+        m_cwnd_incrd = false;
+    }
+    
+    inline void segmentSent (TcpCongCtrlContext const &, TcpSeqNum, bool)
+    {
+    }
+    
+    inline void dataAcked (TcpCongCtrlContext const &, TcpSeqNum, TcpSeqInt)
+    {
+    }
+    
+    void ackReceived (TcpCongCtrlContext const &ctx, TcpSeqInt acked)
+    {
+        if (ctx.cwnd <= ctx.ssthresh) {
+            // Slow start.
+            increaseCwndAcked(ctx, acked);
+        } else {
+            // Congestion avoidance.
+            if (!m_cwnd_incrd) {
+                // Increment cwnd_acked.
+                AddToSat(m_cwnd_acked, acked);
+                
+                // If cwnd data has now been acked, increment cwnd and reset cwnd_acked,
+                // and inhibit such increments until the round trip completes.
+                if (AIPSTACK_UNLIKELY(m_cwnd_acked >= ctx.cwnd)) {
+                    increaseCwndAcked(ctx, m_cwnd_acked);
+                    m_cwnd_acked = 0;
+                    m_cwnd_incrd = true;
+                }
+            }
+        }
+    }
+    
+    inline void roundTripCompleted ()
+    {
+        // Allow more cwnd increase in congestion avoidance.
+        m_cwnd_incrd = false;
+    }
+    
+    void fastRetransmit (TcpCongCtrlContext const &ctx)
+    {
+        updateSsthreshForRtx(ctx);
+    }
+    
+    void ecnCongestion (TcpCongCtrlContext const &ctx)
+    {
+        // Respond as to a loss (RFC 3168 section 6.1.2).
+        updateSsthreshForRtx(ctx);
+        m_cwnd_acked = 0;
+    }
+    
+    void rtoExpired (TcpCongCtrlContext const &ctx, bool first_rtx)
+    {
+        if (first_rtx) {
+            updateSsthreshForRtx(ctx);
+        }
+        
+        // Reset cwnd_acked to avoid old accumulated value from causing an
+        // undesired cwnd increase later.
+        m_cwnd_acked = 0;
+    }
+    
+    inline void idleRestart (TcpCongCtrlContext const &)
+    {
+        // Reset cwnd_acked for the same reason as in rtoExpired.
+        m_cwnd_acked = 0;
+    }
+
+    inline std::uint32_t pacingRate (TcpCongCtrlContext const &)
+    {
+        return 0;
+    }
+
+private:
+    // Increase cwnd by acked but no more than snd_mss.
+    inline static void increaseCwndAcked (TcpCongCtrlContext const &ctx, TcpSeqInt acked)
+    {
+        TcpSeqInt cwnd_inc = MinValueU(acked, ctx.snd_mss);
+        AddToSat(ctx.cwnd, cwnd_inc);
+    }
+    
+    // Sets sshthresh according to RFC 5681 equation (4).
+    inline static void updateSsthreshForRtx (TcpCongCtrlContext const &ctx)
+    {
+        TcpSeqInt half_flight_size = ctx.flight_size / 2u;
+        TcpSeqInt two_smss = 2u * TcpSeqInt(ctx.snd_mss);
+        ctx.ssthresh = MaxValue(half_flight_size, two_smss);
+    }
+};
+
+/**
+ * Service type for Reno congestion control (@ref TcpCongCtrlReno).
+ * 
+ * This is the default for IpTcpProtoOptions::CongCtrlService.
+ */
+class TcpCongCtrlRenoService {
+public:
+    #ifndef IN_DOXYGEN
+    template<typename Constants_>
+    struct Algorithm {
+        using Constants = Constants_;
+        AIPSTACK_DEF_INSTANCE(Algorithm, TcpCongCtrlReno)
+    };
+    #endif
+};
+
+}
+
+#endif
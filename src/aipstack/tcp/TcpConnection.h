@@ -37,10 +37,14 @@
 #include <aipstack/infra/Buf.h>
 #include <aipstack/infra/BufUtils.h>
 #include <aipstack/infra/Err.h>
+#include <aipstack/infra/RxBufPool.h>
+#include <aipstack/proto/Ip4Proto.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/ip/IpMtuRef.h>
 #include <aipstack/tcp/TcpState.h>
 #include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpPcbFlags.h>
+#include <aipstack/tcp/TcpStats.h>
 #include <aipstack/tcp/TcpListener.h>
 
 namespace AIpStack {
@@ -50,6 +54,7 @@ template<typename> class IpTcpProto;
 template<typename> class IpTcpProto_input;
 template<typename> class IpTcpProto_output;
 template<typename> class TcpApi;
+template<typename, typename> class TcpConnectionT;
 #endif
 
 /**
@@ -60,6 +65,110 @@ struct TcpStartConnectionArgs {
     Ip4Addr addr = Ip4Addr::ZeroAddr();
     std::uint16_t port = 0;
     std::size_t rcv_wnd = 0;
+    
+    /**
+     * Maximum size that the receive buffer may reach (including growth by
+     * auto-tuning, see @ref TcpConnection::setRecvBufAutoTuning), which
+     * determines the window scale factor sent in the SYN. This works like
+     * @ref TcpListener::setMaxReceiveBuffer, 0 means that it is not known.
+     */
+    std::size_t max_rcv_buf = 0;
+    
+    /**
+     * Initial send buffer, as if set by @ref TcpConnection::setSendBuf and
+     * pushed by @ref TcpConnection::sendPush right after the connection is started.
+     */
+    IpBufRef snd_buf = IpBufRef{};
+    
+    /**
+     * Whether to use TCP Fast Open (RFC 7413), requires the EnableFastOpen option.
+     * If a cookie for the server is cached, part of snd_buf (if any) is sent in
+     * the SYN, otherwise a cookie is requested for subsequent connections.
+     */
+    bool fast_open = false;
+    
+    /**
+     * DSCP value for the segments of the connection including the SYN, see
+     * @ref TcpConnection::setDscp. Must be less than 64.
+     */
+    std::uint8_t dscp = 0;
+};
+
+/**
+ * State of an established connection, as exported by
+ * @ref TcpConnection::exportConnection and adopted by
+ * @ref TcpConnection::importConnection, possibly in another @ref IpStack
+ * object or another process.
+ *
+ * The state only covers the protocol; the data is referenced from the
+ * application's buffers. The send buffer at the time of export starts at
+ * snd_una and contains the unacknowledged and the unsent data, all of which
+ * is sent again after import. Data received out of sequence is not part of
+ * the state, the peer will retransmit it. Times are in microseconds.
+ */
+struct TcpConnectionState {
+    Ip4Addr local_addr = Ip4Addr::ZeroAddr();
+    Ip4Addr remote_addr = Ip4Addr::ZeroAddr();
+    std::uint16_t local_port = 0;
+    std::uint16_t remote_port = 0;
+
+    // Sequence numbers: the first unacknowledged byte and the next byte
+    // expected from the peer.
+    TcpSeqNum snd_una = TcpSeqNum(0u);
+    TcpSeqNum rcv_nxt = TcpSeqNum(0u);
+
+    // The send window announced by the peer and the receive window we have
+    // announced (relative to rcv_nxt), which must not shrink after import.
+    TcpSeqInt snd_wnd = 0;
+    TcpSeqInt rcv_ann_wnd = 0;
+
+    // Negotiated options.
+    bool wnd_scale = false;
+    bool sack_perm = false;
+    bool timestamps = false;
+    bool ecn_ok = false;
+    std::uint8_t snd_wnd_shift = 0;
+    std::uint8_t rcv_wnd_shift = 0;
+
+    // Maximum segment size allowed by the peer and the interface.
+    std::uint16_t base_snd_mss = 0;
+
+    // Timestamp to echo (TS.Recent) and the last timestamp value we sent,
+    // the timestamps sent after import continue from that value.
+    std::uint32_t ts_recent = 0;
+    std::uint32_t ts_val = 0;
+
+    // Congestion control and RTT estimate.
+    TcpSeqInt cwnd = 0;
+    TcpSeqInt ssthresh = 0;
+    bool rtt_valid = false;
+    std::uint32_t srtt_us = 0;
+
+    // DSCP value for outgoing segments.
+    std::uint8_t dscp = 0;
+};
+
+/**
+ * Modes of sending data which does not fill a segment, see
+ * @ref TcpConnection::setSendMode.
+ */
+enum class TcpSendMode : std::uint8_t {
+    /**
+     * Pushed data is sent right away (the default).
+     */
+    Immediate,
+    
+    /**
+     * Pushed data which does not fill a segment is only sent when there is no
+     * unacknowledged data (Nagle algorithm, RFC 896).
+     */
+    Nagle,
+    
+    /**
+     * Data which does not fill a segment is not sent even if pushed, until the
+     * mode is changed or sending is closed.
+     */
+    Cork,
 };
 
 /**
@@ -80,6 +189,7 @@ class TcpConnection :
     template<typename> friend class IpTcpProto;
     template<typename> friend class IpTcpProto_input;
     template<typename> friend class IpTcpProto_output;
+    template<typename, typename> friend class TcpConnectionT;
     
     using TcpConStackArg = typename Arg::StackArg;
     
@@ -89,6 +199,9 @@ class TcpConnection :
     using TcpConOutput = typename TcpConProto::Output;
     using TcpConConstants = typename TcpConProto::Constants;
     using TcpConOosBuffer = typename TcpConProto::OosBuffer;
+    using TcpConSackScoreboard = typename TcpConProto::SackScoreboard;
+    using TcpConCongCtrl = typename TcpConProto::CongCtrl;
+    using TcpConStaticClass = typename TcpConProto::StaticConnectionClass;
 
 public:
     /**
@@ -98,6 +211,7 @@ public:
     TcpConnection ()
     {
         m_v.pcb = nullptr;
+        m_v.static_dispatch = false;
         reset_flags();
     }
     
@@ -116,12 +230,8 @@ public:
             
             TcpConPcb *pcb = m_v.pcb;
             
-            // Reset the MtuRef.
-            mtu_ref().reset(pcb->tcp->m_stack);
-            
             // Disassociate with the PCB.
-            pcb->con = nullptr;
-            m_v.pcb = nullptr;
+            detach_pcb();
             
             // Handle abandonment of connection.
             bool rst_needed = m_v.snd_buf.tot_len > 0 || have_unprocessed_data;
@@ -156,9 +266,18 @@ public:
         // Clear the m_accept_pcb link from the listener.
         lis.m_accept_pcb = nullptr;
         
+        // Update the listener statistics.
+        lis.m_stats.inc(&TcpListenerStats::accepted);
+        if (TcpConProto::EnableStats) {
+            lis.m_stats.addTime(&TcpListenerStats::syn_to_accept_time,
+                TcpConProto::time_to_ms(tcp->platform().getTime() - pcb->create_time.get()));
+        }
+        
         // Decrement the listener's PCB count.
         AIPSTACK_ASSERT(lis.m_num_pcbs > 0);
         lis.m_num_pcbs--;
+        AIPSTACK_ASSERT(tcp->m_num_syn_rcvd_pcbs > 0);
+        tcp->m_num_syn_rcvd_pcbs--;
         
         // Note that the PCB has already been removed from the list of
         // unreferenced PCBs, so we must not try to remove it here.
@@ -218,6 +337,17 @@ public:
         // Initialize TcpConnection variables, set STARTED flag.
         setup_common_started();
         
+        // Account the window of the SYN in the receive memory budget.
+        TcpConProto::pcb_rcv_mem_update(pcb);
+        
+        // Set the initial send buffer.
+        m_v.snd_buf = args.snd_buf;
+        m_v.snd_buf_cur = args.snd_buf;
+        m_v.snd_psh_index = args.snd_buf.tot_len;
+        
+        // Send the SYN.
+        TcpConOutput::pcb_send_syn(pcb);
+        
         return IpErr::Success;
     }
     
@@ -234,8 +364,11 @@ public:
         
         static_assert(std::is_trivially_copy_constructible_v<TcpConOosBuffer>);
         
-        // Byte-copy the whole m_v.
+        // Byte-copy the whole m_v, except static_dispatch which depends on the
+        // type of the object.
+        bool static_dispatch = m_v.static_dispatch;
         std::memcpy(&m_v, &src_con->m_v, sizeof(m_v));
+        m_v.static_dispatch = static_dispatch;
         
         // Update the PCB association.
         m_v.pcb->con = this;
@@ -248,6 +381,154 @@ public:
         src_con->reset_flags();
     }
     
+    /**
+     * Exports the state of an established connection and releases the
+     * connection from this stack without notifying the peer.
+     * 
+     * This is intended for handing a connection over to another @ref IpStack
+     * (e.g. in a restarted process), which continues it using
+     * @ref importConnection. The data is not part of the state: the current
+     * send buffer (@ref getSendBuf) starts at the first unacknowledged byte,
+     * and the receive buffer (@ref getRecvBuf) must be at least as large
+     * when given to the new connection object.
+     * 
+     * Exporting is only possible in ESTABLISHED state before @ref closeSending
+     * and outside of data callbacks. On success, this brings the object from
+     * the CONNECTED to CLOSED state without calling connectionAborted.
+     * On failure, the connection is not affected.
+     * May only be called in CONNECTED or CLOSED state.
+     * 
+     * @param state Receives the connection state.
+     * @return True on success, false if the connection cannot be exported.
+     */
+    bool exportConnection (TcpConnectionState &state)
+    {
+        assert_started();
+        
+        TcpConPcb *pcb = m_v.pcb;
+        if (pcb == nullptr || pcb->state() != TcpStates::ESTABLISHED ||
+            m_v.snd_closed || has_batch_data())
+        {
+            return false;
+        }
+        
+        state.local_addr = pcb->local_addr;
+        state.remote_addr = pcb->remote_addr;
+        state.local_port = pcb->local_port;
+        state.remote_port = pcb->remote_port;
+        state.snd_una = pcb->snd_una;
+        state.rcv_nxt = pcb->rcv_nxt;
+        state.snd_wnd = m_v.snd_wnd;
+        state.rcv_ann_wnd = pcb->rcv_ann_wnd;
+        state.wnd_scale = pcb->hasFlag(TcpPcbFlags::WndScale);
+        state.sack_perm = pcb->hasFlag(TcpPcbFlags::SackPerm);
+        state.timestamps = pcb->hasFlag(TcpPcbFlags::Timestamps);
+        state.ecn_ok = pcb->ecn_ok;
+        state.snd_wnd_shift = pcb->snd_wnd_shift;
+        state.rcv_wnd_shift = pcb->rcv_wnd_shift;
+        state.base_snd_mss = pcb->base_snd_mss;
+        state.ts_recent = pcb->ts_recent;
+        state.ts_val = TcpConOutput::pcb_ts_clock(pcb);
+        state.cwnd = m_v.cwnd;
+        state.ssthresh = m_v.ssthresh;
+        state.rtt_valid = pcb->hasFlag(TcpPcbFlags::RttValid);
+        state.srtt_us = state.rtt_valid ? rtt_to_us(m_v.srtt) : 0;
+        state.dscp = pcb->dscp;
+        
+        // Disassociate with the PCB and let it go away silently.
+        detach_pcb();
+        TcpConProto::pcb_exported(pcb);
+        
+        return true;
+    }
+    
+    /**
+     * Continues a connection exported by @ref exportConnection, possibly
+     * from another @ref IpStack.
+     * 
+     * No segments are exchanged to set up the connection; the peer does not
+     * notice the handover except that unacknowledged data is sent again. The
+     * connection is reported as established right away (the connectionEstablished
+     * callback is not called). Afterward the application must call
+     * @ref setRecvBuf with a buffer of at least state.rcv_ann_wnd bytes,
+     * normally the receive buffer of the exported connection.
+     * 
+     * On success, this brings the object from the INIT to CONNECTED state.
+     * On failure, the object remains in INIT state. Failure occurs when the
+     * local address is not an address of the interface used to reach the
+     * remote address (@ref IpErr::NonLocalSrc), when the address tuple is in
+     * use (@ref IpErr::AddrInUse) or due to lack of resources.
+     * May only be called in INIT state.
+     * 
+     * @param api TCP protocol API of the stack to continue the connection in.
+     * @param state Connection state from @ref exportConnection.
+     * @param snd_buf Send buffer starting at state.snd_una, i.e. the send
+     *        buffer of the exported connection.
+     * @return Success or error code.
+     */
+    IpErr importConnection (TcpApi<Arg> &api, TcpConnectionState const &state,
+                            IpBufRef snd_buf)
+    {
+        assert_init();
+        
+        TcpConProto &tcp = api.proto();
+        
+        // Setup the MTU reference.
+        std::uint16_t pmtu;
+        if (!mtu_ref().setup(tcp.m_stack, state.remote_addr, nullptr, pmtu)) {
+            return IpErr::NoMtuEntryAvailable;
+        }
+        
+        // Create the PCB in ESTABLISHED state.
+        TcpConPcb *pcb = nullptr;
+        IpErr err = tcp.import_connection(this, state, &pcb);
+        if (err != IpErr::Success) {
+            mtu_ref().reset(tcp.m_stack);
+            return err;
+        }
+        
+        // Remember the PCB (the link to us already exists).
+        AIPSTACK_ASSERT(pcb != nullptr);
+        AIPSTACK_ASSERT(pcb->con == this);
+        m_v.pcb = pcb;
+        
+        // Initialize TcpConnection variables, set STARTED flag.
+        setup_common_started();
+        
+        // Initialize the sender state as after the handshake.
+        TcpConInput::pcb_complete_established_transition(pcb, pmtu);
+        
+        // Restore the congestion state, cwnd only if it has grown beyond the
+        // initial window.
+        m_v.ssthresh = MaxValue(TcpSeqInt(pcb->snd_mss),
+            MinValue(TcpConConstants::MaxWindow, state.ssthresh));
+        if (state.cwnd > m_v.cwnd) {
+            m_v.cwnd = MinValue(TcpConConstants::MaxWindow, state.cwnd);
+            pcb->clearFlag(TcpPcbFlags::CwndInit);
+        }
+        
+        // Restore the RTT estimate.
+        if (state.rtt_valid) {
+            double rtt = double(state.srtt_us) * (TcpConConstants::RttTimeFreq / 1e6);
+            TcpConOutput::pcb_update_rtt(pcb, typename TcpConConstants::RttType(
+                MinValue(rtt, double(TypeMax<typename TcpConConstants::RttType>))));
+        }
+        
+        // Set the send buffer, all of it is considered pushed.
+        m_v.snd_buf = snd_buf;
+        m_v.snd_buf_cur = snd_buf;
+        m_v.snd_psh_index = snd_buf.tot_len;
+        
+        // Send the data again, or just an ACK to let the peer know we're here.
+        if (snd_buf.tot_len > 0) {
+            TcpConOutput::pcb_push_output(pcb);
+        } else {
+            TcpConOutput::pcb_send_empty_ack(pcb);
+        }
+        
+        return IpErr::Success;
+    }
+    
     /**
      * Returns whether the object is in INIT state.
      */
@@ -382,6 +663,51 @@ public:
         return std::size_t(ann_wnd);
     }
     
+    /**
+     * Get a snapshot of the connection state and statistics.
+     * May only be called in CONNECTED state.
+     * 
+     * The counters (TcpConnectionStats::counters) are only maintained if the
+     * EnableStats option is enabled. In SYN_SENT state, only the state, RTO,
+     * buffer lengths and counters are reported.
+     * 
+     * @return Snapshot of the connection state and statistics.
+     */
+    TcpConnectionStats getStats () const
+    {
+        assert_connected();
+        
+        TcpConPcb *pcb = m_v.pcb;
+        
+        TcpConnectionStats stats;
+        stats.state = pcb->state();
+        stats.rto_us = rtt_to_us(pcb->rto);
+        stats.snd_buf_len = m_v.snd_buf.tot_len;
+        stats.rcv_buf_len = m_v.rcv_buf.tot_len;
+        stats.counters = pcb->stats.get();
+        
+        // The remaining variables are not yet valid in SYN_SENT.
+        if (pcb->state() != TcpStates::SYN_SENT) {
+            stats.rtt_valid = pcb->hasFlag(TcpPcbFlags::RttValid);
+            if (stats.rtt_valid) {
+                stats.srtt_us = rtt_to_us(m_v.srtt);
+                stats.rttvar_us = rtt_to_us(m_v.rttvar);
+            }
+            stats.in_recovery = pcb->hasFlag(TcpPcbFlags::RtxActive) ||
+                pcb->num_dupack >= TcpConConstants::FastRtxDupAcks;
+            stats.cwnd = m_v.cwnd;
+            stats.ssthresh = m_v.ssthresh;
+            stats.snd_wnd = m_v.snd_wnd;
+            stats.rcv_wnd = pcb->rcv_ann_wnd;
+            stats.snd_wnd_shift = pcb->snd_wnd_shift;
+            stats.rcv_wnd_shift = pcb->rcv_wnd_shift;
+            stats.snd_unacked = pcb->snd_nxt - pcb->snd_una;
+            stats.snd_mss = pcb->snd_mss;
+        }
+        
+        return stats;
+    }
+    
     /**
      * Sets the receive buffer.
      * Typically the application will call this once just after a connection
@@ -424,6 +750,116 @@ public:
         }
     }
     
+    /**
+     * Enables or disables zero-copy receive mode.
+     * May only be called in CONNECTED or CLOSED state.
+     * 
+     * In zero-copy mode, in-sequence data which was received in a
+     * retainable receive buffer (see @ref IpRxBuf) is not copied into the
+     * receive buffer but is passed to @ref dataReceivedZeroCopy instead of
+     * @ref dataReceived. The receive buffer is still shifted by the amount
+     * of data, so the receive window accounts for the data which the
+     * application holds until it extends the receive buffer again. The
+     * receive buffer is still used for data received otherwise (such
+     * as when it arrives out of sequence or from a driver without a
+     * buffer pool). Zero-copy mode is disabled when a connection is
+     * started.
+     */
+    void setRecvZeroCopy (bool enabled)
+    {
+        assert_started();
+        
+        m_v.rcv_zero_copy = enabled;
+    }
+    
+    /**
+     * Enables or disables receive buffer auto-tuning.
+     * May only be called in CONNECTED or CLOSED state.
+     * 
+     * Auto-tuning requires the RcvBufAutoTuning option of the TCP protocol.
+     * When enabled, the stack measures how much data is received per
+     * round-trip time and calls @ref recvBufGrowRequested when a larger
+     * receive buffer would be needed to not limit the throughput. Auto-tuning
+     * is disabled when a connection is started.
+     * 
+     * @param buf_size The current size of the receive buffer of the
+     *        application (including data not yet processed), or zero to
+     *        disable auto-tuning.
+     * @param max_size The maximum size of the receive buffer that the stack
+     *        may request. Must not be less than buf_size.
+     */
+    void setRecvBufAutoTuning (std::size_t buf_size, std::size_t max_size)
+    {
+        assert_started();
+        AIPSTACK_ASSERT(TcpConProto::RcvBufAutoTuning || buf_size == 0);
+        AIPSTACK_ASSERT(max_size >= buf_size);
+        
+        m_v.rcv_tune_size = buf_size;
+        m_v.rcv_tune_max = max_size;
+        m_v.rcv_tune_bytes = 0;
+    }
+    
+    /**
+     * Enables or disables keepalive.
+     * May only be called in CONNECTED state.
+     * 
+     * Keepalive requires the EnableKeepalive option of the TCP protocol. When
+     * enabled and nothing has been received for the idle time while there is
+     * nothing to send, the stack sends keepalive probes and aborts the
+     * connection (see @ref connectionAborted) if count probes in a row are not
+     * answered. There is no timer per connection, instead all connections are
+     * swept once per second, so times are accurate to about one second.
+     * Keepalive is disabled when a connection is started.
+     * 
+     * @param idle_secs Idle time in seconds before the first probe, or zero to
+     *        disable keepalive.
+     * @param interval_secs Time in seconds between probes. Must be greater than
+     *        zero if idle_secs is not zero.
+     * @param count Number of unanswered probes after which the connection is
+     *        aborted.
+     */
+    void setKeepalive (
+        std::uint16_t idle_secs, std::uint16_t interval_secs, std::uint8_t count)
+    {
+        assert_connected();
+        AIPSTACK_ASSERT(TcpConProto::EnableKeepalive || idle_secs == 0);
+        AIPSTACK_ASSERT(idle_secs == 0 || interval_secs > 0);
+        
+        TcpConProto *tcp = m_v.pcb->tcp;
+        if (m_v.ka_idle == 0 && idle_secs != 0) {
+            tcp->keepalive_con_added();
+        }
+        else if (m_v.ka_idle != 0 && idle_secs == 0) {
+            tcp->keepalive_con_removed();
+        }
+        
+        m_v.ka_idle = idle_secs;
+        m_v.ka_interval = interval_secs;
+        m_v.ka_count = count;
+        m_v.ka_time_left = idle_secs;
+        m_v.ka_probes = 0;
+    }
+    
+    /**
+     * Enables or disables the reduction of the congestion window after idle.
+     * May only be called in CONNECTED or CLOSED state.
+     * 
+     * When nothing has been sent for a retransmission timeout, the congestion
+     * window is normally reduced to the initial window (RFC 5681 section 4.1).
+     * Disabling this keeps the congestion window learned by the connection, which
+     * is intended for connections which are reused for requests to the same peer
+     * over a path that is known not to change (e.g. with @ref TcpUpstreamPool).
+     * It is enabled when a connection is started.
+     * 
+     * @param enabled Whether to reduce the congestion window after idle.
+     */
+    void setIdleCwndRestart (bool enabled)
+    {
+        assert_started();
+        
+        m_v.idle_cwnd_restart = enabled;
+    }
+    
     /**
      * Returns the current receive buffer.
      * May only be called in CONNECTED or CLOSED state.
@@ -453,7 +889,8 @@ public:
     
     /**
      * Returns the amount of send buffer that could remain unsent
-     * indefinitely in the absence of sendPush or endSending.
+     * indefinitely in the absence of sendPush or endSending (or while
+     * the send mode is @ref TcpSendMode::Cork).
      * 
      * For accepted connections, this does not change, and for
      * initiated connections, it only possibly decreases when the
@@ -501,6 +938,28 @@ public:
         }
     }
     
+    /**
+     * Moves the send buffer to different memory.
+     * May only be called in CONNECTED or CLOSED state.
+     * 
+     * Unlike @ref setSendBuf, this may also be called after @ref closeSending.
+     * The new buffer must have the same size as the current send buffer
+     * (@ref getSendBuf) and the same data must have been copied into it.
+     * 
+     * @param snd_buf The new send buffer.
+     */
+    void relocateSendBuf (IpBufRef snd_buf)
+    {
+        assert_started();
+        AIPSTACK_ASSERT(snd_buf.tot_len == m_v.snd_buf.tot_len);
+        AIPSTACK_ASSERT(m_v.snd_buf_cur.tot_len <= m_v.snd_buf.tot_len);
+        
+        std::size_t snd_offset = m_v.snd_buf.tot_len - m_v.snd_buf_cur.tot_len;
+        
+        m_v.snd_buf = snd_buf;
+        m_v.snd_buf_cur = ipBufSkipBytes(snd_buf, snd_offset);
+    }
+    
     /**
      * Extends the send buffer for the specified amount.
      * May only be called in CONNECTED or CLOSED state.
@@ -609,6 +1068,81 @@ public:
         }
     }
     
+    /**
+     * Sets the mode of sending data which does not fill a segment.
+     * May only be called in CONNECTED or CLOSED state.
+     * 
+     * The mode only affects pushed data which does not fill a segment (see
+     * @ref sendPush), full segments are always sent when the windows allow.
+     * Changing the mode from @ref TcpSendMode::Cork sends any data held back,
+     * up to the last push. Closing sending always sends all data. The mode
+     * is @ref TcpSendMode::Immediate when a connection is started.
+     * 
+     * @param mode The new send mode.
+     */
+    void setSendMode (TcpSendMode mode)
+    {
+        assert_started();
+        
+        TcpSendMode old_mode = m_v.snd_mode;
+        m_v.snd_mode = mode;
+        
+        // Push output if the new mode may allow sending more.
+        if (old_mode != TcpSendMode::Immediate && mode != TcpSendMode::Cork &&
+            !m_v.snd_closed && m_v.pcb != nullptr && m_v.pcb->state().isSndOpen() &&
+            m_v.snd_buf.tot_len > 0)
+        {
+            TcpConOutput::pcb_push_output(m_v.pcb);
+        }
+    }
+    
+    /**
+     * Returns the mode of sending data which does not fill a segment.
+     * May only be called in CONNECTED or CLOSED state.
+     * 
+     * @return The send mode.
+     */
+    inline TcpSendMode getSendMode () const
+    {
+        assert_started();
+        
+        return m_v.snd_mode;
+    }
+    
+    /**
+     * Set the DSCP value for the segments of the connection.
+     * May only be called in CONNECTED state.
+     * 
+     * The DSCP (RFC 2474) is written into the IP header of segments sent
+     * from now on, and selects the priority class of the segments when
+     * they pass through an @ref IpEgressScheduler with priority classes.
+     * This can be used to keep control or heartbeat traffic from waiting
+     * behind bulk transfers. The DSCP is zero unless set here or when
+     * starting the connection (@ref TcpStartConnectionArgs::dscp).
+     * 
+     * @param dscp DSCP value, must be less than 64.
+     */
+    void setDscp (std::uint8_t dscp)
+    {
+        assert_connected();
+        AIPSTACK_ASSERT(dscp <= Ip4DscpMask);
+        
+        m_v.pcb->dscp = dscp;
+    }
+    
+    /**
+     * Returns the DSCP value for the segments of the connection.
+     * May only be called in CONNECTED state.
+     * 
+     * @return The DSCP value (see @ref setDscp).
+     */
+    inline std::uint8_t getDscp () const
+    {
+        assert_connected();
+        
+        return std::uint8_t(m_v.pcb->dscp);
+    }
+    
 protected:
     /**
      * Deinitializes the connection object.
@@ -643,18 +1177,69 @@ protected:
      * Each callback corresponds to shifting of the receive
      * buffer by that amount. Zero amount indicates that FIN
      * was received.
+     * 
+     * With the CoalesceDataCallbacks option of @ref IpTcpProtoService, data
+     * received within a receive batch (see @ref IpDriverIface::beginRecvBatch)
+     * is reported with a single callback at the end of the batch, except in
+     * zero-copy mode.
      */
     virtual void dataReceived (std::size_t amount) = 0;
     
+    /**
+     * Called in zero-copy receive mode when in-sequence data has been
+     * received in a retainable buffer (see @ref setRecvZeroCopy).
+     * 
+     * The callback corresponds to shifting of the receive buffer by
+     * `data.tot_len`, but the data has not been copied into the receive
+     * buffer. Instead `data` references it within `rx_buf`. The application
+     * may call @ref IpRxBuf::retain to keep `data` valid after the callback
+     * returns, in which case it must call @ref IpRxBuf::release when done.
+     * 
+     * The default implementation must not be called, the application must
+     * override this if it enables zero-copy mode.
+     */
+    virtual void dataReceivedZeroCopy (
+        [[maybe_unused]] IpBufRef data, [[maybe_unused]] IpRxBuf *rx_buf)
+    {
+        AIPSTACK_ASSERT(false);
+    }
+    
     /**
      * Called when some data or FIN has been sent and acknowledged.
      * 
      * Each dataSent callback corresponds to shifting of the send buffer
      * by that amount. Zero amount indicates that FIN was acknowledged.
+     * 
+     * With the CoalesceDataCallbacks option of @ref IpTcpProtoService, data
+     * acknowledged within a receive batch is reported with a single callback at
+     * the end of the batch, so that the send buffer can be refilled once for
+     * all acknowledgements in the batch.
+     * 
+     * When sending from external memory regions using @ref TcpSendRegionQueue,
+     * this should be forwarded to @ref TcpSendRegionQueue::dataSent.
      */
     virtual void dataSent (std::size_t amount) = 0;
     
+    /**
+     * Called when receive buffer auto-tuning (see @ref setRecvBufAutoTuning)
+     * determines that the receive buffer should be grown.
+     * 
+     * The application should grow its receive buffer to new_size and make
+     * the additional space available using @ref extendRecvBuf or
+     * @ref setRecvBuf, either from this callback or later. The stack assumes
+     * the new size from now on and will only request further growth beyond
+     * it. The default implementation ignores the request.
+     * 
+     * @param new_size The requested size of the receive buffer.
+     */
+    virtual void recvBufGrowRequested ([[maybe_unused]] std::size_t new_size) {}
+
 private:
+    inline static std::uint32_t rtt_to_us (typename TcpConConstants::RttType rtt)
+    {
+        return std::uint32_t(double(rtt) * (1e6 / TcpConConstants::RttTimeFreq));
+    }
+    
     inline IpMtuRef<TcpConStackArg> & mtu_ref () {
         return *this;
     }
@@ -689,6 +1274,26 @@ private:
         AIPSTACK_ASSERT(!m_v.snd_closed);
     }
     
+    void detach_pcb ()
+    {
+        TcpConPcb *pcb = m_v.pcb;
+        
+        // Reset the MtuRef.
+        mtu_ref().reset(pcb->tcp->m_stack);
+        
+        // Stop keepalive for this connection.
+        if (m_v.ka_idle != 0) {
+            pcb->tcp->keepalive_con_removed();
+        }
+        
+        // Release the window from the receive memory budget.
+        pcb->tcp->rcv_mem_con_removed(this);
+        
+        // Disassociate with the PCB.
+        pcb->con = nullptr;
+        m_v.pcb = nullptr;
+    }
+    
     void setup_common_started ()
     {
         // Clear buffer variables.
@@ -700,9 +1305,37 @@ private:
         // Initialize rcv_ann_thres.
         m_v.rcv_ann_thres = TcpConConstants::DefaultWndAnnThreshold;
         
+        // Zero-copy receive mode is disabled by default.
+        m_v.rcv_zero_copy = false;
+        
+        // Receive buffer auto-tuning is disabled by default.
+        m_v.rcv_tune_size = 0;
+        
+        // Pushed data is sent right away by default.
+        m_v.snd_mode = TcpSendMode::Immediate;
+        
+        // Keepalive is disabled by default.
+        m_v.ka_idle = 0;
+        
+        // The congestion window is reduced after idle by default.
+        m_v.idle_cwnd_restart = true;
+        
+        // No data has been sent in a SYN (Fast Open).
+        m_v.syn_data_len = 0;
+        
+        // No dataSent/dataReceived amounts are held back (CoalesceDataCallbacks).
+        m_v.batch_sent = 0;
+        m_v.batch_received = 0;
+        
+        // No window is accounted in the receive memory budget yet (RcvMemBudget).
+        m_v.rcv_mem_acct = 0;
+        
         // Initialize the out-of-sequence information.
         m_v.ooseq.init();
         
+        // Initialize the SACK scoreboard.
+        m_v.sack_sb.init();
+        
         // Set STARTED flag to indicate we're no longer in INIT state.
         m_v.started = true;
     }
@@ -718,17 +1351,11 @@ private:
     {
         assert_connected();
         
-        TcpConPcb *pcb = m_v.pcb;
-        
-        // Reset the MtuRef.
-        mtu_ref().reset(pcb->tcp->m_stack);
-        
         // Disassociate with the PCB.
-        pcb->con = nullptr;
-        m_v.pcb = nullptr;
+        detach_pcb();
         
         // Call the application callback.
-        connectionAborted();
+        call_connection_aborted();
     }
     
     void connection_established ()
@@ -736,7 +1363,7 @@ private:
         assert_connected();
         
         // Call the application callback.
-        connectionEstablished();
+        call_connection_established();
     }
     
     void data_sent (std::size_t amount)
@@ -745,8 +1372,28 @@ private:
         AIPSTACK_ASSERT(!m_v.end_sent);
         AIPSTACK_ASSERT(amount > 0);
         
+        // Within a receive batch, only accumulate the amount if callbacks are
+        // coalesced, the callback is delivered by batch_data_sent.
+        if (TcpConProto::CoalesceDataCallbacks && defer_to_batch_end()) {
+            m_v.batch_sent += amount;
+            return;
+        }
+        
         // Call the application callback.
-        dataSent(amount);
+        call_data_sent(amount);
+    }
+    
+    void batch_data_sent ()
+    {
+        assert_connected();
+        AIPSTACK_ASSERT(!m_v.end_sent);
+        AIPSTACK_ASSERT(m_v.batch_sent > 0);
+        
+        std::size_t amount = m_v.batch_sent;
+        m_v.batch_sent = 0;
+        
+        // Call the application callback.
+        call_data_sent(amount);
     }
     
     void end_sent ()
@@ -759,7 +1406,7 @@ private:
         m_v.end_sent = true;
         
         // Call the application callback.
-        dataSent(0);
+        call_data_sent(0);
     }
     
     void data_received (std::size_t amount)
@@ -768,8 +1415,59 @@ private:
         AIPSTACK_ASSERT(!m_v.end_received);
         AIPSTACK_ASSERT(amount > 0);
         
+        // Accumulate the amount as for data_sent, except in zero-copy mode since
+        // data passed to dataReceivedZeroCopy cannot be held back.
+        if (TcpConProto::CoalesceDataCallbacks && !m_v.rcv_zero_copy &&
+            defer_to_batch_end())
+        {
+            m_v.batch_received += amount;
+            return;
+        }
+        
         // Call the application callback.
-        dataReceived(amount);
+        call_data_received(amount);
+    }
+    
+    void batch_data_received ()
+    {
+        assert_connected();
+        AIPSTACK_ASSERT(!m_v.end_received);
+        AIPSTACK_ASSERT(m_v.batch_received > 0);
+        
+        std::size_t amount = m_v.batch_received;
+        m_v.batch_received = 0;
+        
+        // Call the application callback.
+        call_data_received(amount);
+    }
+    
+    inline bool has_batch_data () const
+    {
+        return m_v.batch_sent > 0 || m_v.batch_received > 0;
+    }
+    
+    // If a receive batch is being processed, queue the PCB so that the
+    // accumulated amounts are reported at the end of the batch.
+    bool defer_to_batch_end ()
+    {
+        TcpConPcb *pcb = m_v.pcb;
+        if (!pcb->tcp->m_stack->isInRecvBatch()) {
+            return false;
+        }
+        TcpConProto::pcb_defer_to_batch_end(pcb);
+        return true;
+    }
+    
+    void data_received_zero_copy (IpBufRef data, IpRxBuf *rx_buf)
+    {
+        assert_connected();
+        AIPSTACK_ASSERT(!m_v.end_received);
+        AIPSTACK_ASSERT(m_v.rcv_zero_copy);
+        AIPSTACK_ASSERT(data.tot_len > 0);
+        AIPSTACK_ASSERT(rx_buf != nullptr);
+        
+        // Call the application callback.
+        call_data_received_zero_copy(data, rx_buf);
     }
     
     void end_received ()
@@ -781,7 +1479,20 @@ private:
         m_v.end_received = true;
         
         // Call the application callback.
-        dataReceived(0);
+        call_data_received(0);
+    }
+    
+    void rcv_buf_grow_requested (std::size_t new_size)
+    {
+        assert_connected();
+        AIPSTACK_ASSERT(new_size > m_v.rcv_tune_size);
+        AIPSTACK_ASSERT(new_size <= m_v.rcv_tune_max);
+        
+        // Remember the new size so that it is not requested again.
+        m_v.rcv_tune_size = new_size;
+        
+        // Call the application callback.
+        call_recv_buf_grow_requested(new_size);
     }
     
     // Callback from MtuRef when the PMTU changes.
@@ -792,6 +1503,85 @@ private:
         TcpConOutput::pcb_pmtu_changed(m_v.pcb, pmtu);
     }
     
+    // The application callbacks are called through these. For a TcpConnectionT
+    // whose Derived class is the StaticConnectionClass of the stack, the handler
+    // of the derived class is called directly so that it can be inlined, otherwise
+    // the virtual function is called.
+    
+    inline bool use_static_dispatch () const
+    {
+        if constexpr (std::is_void_v<TcpConStaticClass>) {
+            return false;
+        } else {
+            return AIPSTACK_LIKELY(m_v.static_dispatch);
+        }
+    }
+    
+    inline TcpConnectionT<Arg, TcpConStaticClass> & static_con ()
+    {
+        return static_cast<TcpConnectionT<Arg, TcpConStaticClass> &>(*this);
+    }
+    
+    void call_connection_aborted ()
+    {
+        if constexpr (!std::is_void_v<TcpConStaticClass>) {
+            if (use_static_dispatch()) {
+                return static_con().static_connection_aborted();
+            }
+        }
+        connectionAborted();
+    }
+    
+    void call_connection_established ()
+    {
+        if constexpr (!std::is_void_v<TcpConStaticClass>) {
+            if (use_static_dispatch()) {
+                return static_con().static_connection_established();
+            }
+        }
+        connectionEstablished();
+    }
+    
+    void call_data_received (std::size_t amount)
+    {
+        if constexpr (!std::is_void_v<TcpConStaticClass>) {
+            if (use_static_dispatch()) {
+                return static_con().static_data_received(amount);
+            }
+        }
+        dataReceived(amount);
+    }
+    
+    void call_data_received_zero_copy (IpBufRef data, IpRxBuf *rx_buf)
+    {
+        if constexpr (!std::is_void_v<TcpConStaticClass>) {
+            if (use_static_dispatch()) {
+                return static_con().static_data_received_zero_copy(data, rx_buf);
+            }
+        }
+        dataReceivedZeroCopy(data, rx_buf);
+    }
+    
+    void call_data_sent (std::size_t amount)
+    {
+        if constexpr (!std::is_void_v<TcpConStaticClass>) {
+            if (use_static_dispatch()) {
+                return static_con().static_data_sent(amount);
+            }
+        }
+        dataSent(amount);
+    }
+    
+    void call_recv_buf_grow_requested (std::size_t new_size)
+    {
+        if constexpr (!std::is_void_v<TcpConStaticClass>) {
+            if (use_static_dispatch()) {
+                return static_con().static_recv_buf_grow_requested(new_size);
+            }
+        }
+        recvBufGrowRequested(new_size);
+    }
+    
     void reset_flags ()
     {
         m_v.started      = false;
@@ -811,7 +1601,6 @@ private:
         TcpSeqInt snd_closed : 1;
         TcpSeqInt cwnd;
         TcpSeqInt ssthresh;
-        TcpSeqInt cwnd_acked;
         TcpSeqNum recover;
         TcpSeqInt rcv_ann_thres : 30;
         TcpSeqInt end_sent : 1;
@@ -819,13 +1608,130 @@ private:
         TcpSeqNum rtt_test_seq;
         typename TcpConConstants::RttType rttvar;
         typename TcpConConstants::RttType srtt;
+        std::uint32_t ts_recent_time;
+        typename TcpConProto::TimeType pace_time;
+        typename TcpConProto::TimeType rcv_data_time;
         TcpConOosBuffer ooseq;
+        TcpConSackScoreboard sack_sb;
+        TcpConCongCtrl cc;
+        TcpSeqNum sack_rtx_nxt;
+        TcpSeqInt prr_recover_fs;
+        TcpSeqInt prr_delivered;
+        TcpSeqInt prr_out;
+        TcpSeqInt prr_sacked;
+        TcpSeqNum tlp_high_seq;
+        TcpSeqNum ecn_recover;
+        TcpSeqNum dctcp_wnd_end;
+        TcpSeqInt dctcp_acked;
+        TcpSeqInt dctcp_ce_acked;
+        TcpSeqNum pmtu_probe_end;
+        typename TcpConProto::TimeType pmtu_probe_time;
         std::size_t snd_psh_index;
+        std::size_t rcv_tune_size;
+        std::size_t rcv_tune_max;
+        std::size_t rcv_tune_bytes;
+        std::size_t batch_sent;
+        std::size_t batch_received;
+        std::size_t rcv_mem_acct;
+        typename TcpConProto::TimeType rcv_tune_time;
+        std::uint16_t syn_data_len;
+        std::uint16_t dctcp_alpha;
+        std::uint16_t pmtu_probe_mtu;
+        std::uint16_t pmtu_search_high;
+        std::uint16_t ka_idle;
+        std::uint16_t ka_interval;
+        std::uint16_t ka_time_left;
+        std::uint8_t ka_count;
+        std::uint8_t ka_probes;
+        std::uint8_t quick_acks;
+        TcpSendMode snd_mode;
+        bool rcv_zero_copy;
+        bool idle_cwnd_restart;
+        bool static_dispatch;
+        bool tlp_active;
+        bool rack_reo_timer;
     };
     
     TcpConVars m_v;
 };
 
+/**
+ * Base class for connections with statically dispatched callbacks.
+ * 
+ * This is a @ref TcpConnection with the same interface and semantics. The
+ * derived class implements the callbacks in the same way, overriding the
+ * virtual functions of @ref TcpConnection. If the derived class is configured
+ * as the StaticConnectionClass option of @ref IpTcpProtoService, the stack
+ * calls these directly instead of through the virtual functions, so that they
+ * can be inlined into the stack. Other connection objects of the same stack
+ * (including those of @ref TcpListenQueue) still work through the virtual
+ * functions.
+ * 
+ * The callbacks of the derived class must be accessible to this class, for
+ * example by declaring it a friend.
+ * 
+ * @tparam Arg Template parameter of @ref TcpConnection.
+ * @tparam Derived The class inheriting this class.
+ */
+template<typename Arg, typename Derived>
+class TcpConnectionT :
+    public TcpConnection<Arg>
+{
+    template<typename> friend class TcpConnection;
+    
+    using Base = TcpConnection<Arg>;
+    
+public:
+    /**
+     * Initializes the connection object.
+     * The object is initialized in INIT state.
+     */
+    TcpConnectionT ()
+    {
+        this->m_v.static_dispatch =
+            std::is_same_v<Derived, typename Base::TcpConStaticClass>;
+    }
+    
+protected:
+    ~TcpConnectionT () = default;
+    
+private:
+    inline Derived & derived ()
+    {
+        return static_cast<Derived &>(*this);
+    }
+    
+    inline void static_connection_aborted ()
+    {
+        derived().Derived::connectionAborted();
+    }
+    
+    inline void static_connection_established ()
+    {
+        derived().Derived::connectionEstablished();
+    }
+    
+    inline void static_data_received (std::size_t amount)
+    {
+        derived().Derived::dataReceived(amount);
+    }
+    
+    inline void static_data_received_zero_copy (IpBufRef data, IpRxBuf *rx_buf)
+    {
+        derived().Derived::dataReceivedZeroCopy(data, rx_buf);
+    }
+    
+    inline void static_data_sent (std::size_t amount)
+    {
+        derived().Derived::dataSent(amount);
+    }
+    
+    inline void static_recv_buf_grow_requested (std::size_t new_size)
+    {
+        derived().Derived::recvBufGrowRequested(new_size);
+    }
+};
+
 }
 
 #endif
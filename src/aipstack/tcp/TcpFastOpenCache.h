@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_FAST_OPEN_CACHE_H
+#define AIPSTACK_TCP_FAST_OPEN_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <aipstack/meta/ChooseInt.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/OperatorKeyCompare.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/tcp/TcpOptions.h>
+
+namespace AIpStack {
+
+/**
+ * Client-side cache of TCP Fast Open cookies by server address (RFC 7413).
+ * 
+ * Along with the cookie, the MSS of the server is remembered, since the data
+ * sent in a SYN must fit into a segment before the MSS option in the SYN-ACK
+ * is received. Entries are kept in a list ordered by last use and when all
+ * entries are in use, the least recently used one is replaced.
+ */
+template<typename IndexService, int NumEntries>
+class TcpFastOpenCache :
+    private NonCopyable<TcpFastOpenCache<IndexService, NumEntries>>
+{
+    static_assert(NumEntries > 0);
+
+public:
+    struct Entry;
+
+private:
+    using IndexType = ChooseIntForMax<NumEntries, false>;
+    inline static constexpr IndexType IndexNull = IndexType(-1);
+    
+    struct EntriesAccessor;
+    using LinkModel = ArrayLinkModelWithAccessor<
+        Entry, IndexType, IndexNull, TcpFastOpenCache, EntriesAccessor>;
+    
+    // Index of entries which are in use by server address.
+    struct EntryIndexAccessor;
+    using EntryIndexLookupKeyArg = Ip4Addr;
+    struct EntryIndexKeyFuncs;
+    AIPSTACK_MAKE_INSTANCE(EntryIndex, (IndexService::template Index<
+        EntryIndexAccessor, EntryIndexLookupKeyArg, EntryIndexKeyFuncs, LinkModel,
+        /*Duplicates=*/false>))
+    
+    // List of entries, used for the free list and for the LRU list.
+    struct EntryListAccessor;
+    using EntryList = LinkedList<EntryListAccessor, LinkModel, true>;
+
+public:
+    // A cache entry.
+    struct Entry {
+        typename EntryIndex::Node index_node;
+        LinkedListNode<LinkModel> list_node;
+        Ip4Addr remote_addr;
+        std::uint16_t mss;
+        std::uint8_t cookie_len;
+        char cookie[TcpMaxFastOpenCookieLen];
+    };
+    
+    TcpFastOpenCache ()
+    {
+        for (Entry &entry : m_entries) {
+            m_free_list.append({entry, *this}, *this);
+        }
+    }
+    
+    // Find the entry for a server address, returns null if there is none.
+    // The entry becomes the most recently used one.
+    Entry * findEntry (Ip4Addr remote_addr)
+    {
+        Entry *entry = m_index.findEntry(remote_addr, *this);
+        if (entry != nullptr) {
+            m_lru_list.remove({*entry, *this}, *this);
+            m_lru_list.append({*entry, *this}, *this);
+        }
+        return entry;
+    }
+    
+    // Remember the cookie and MSS of a server, replacing any existing entry.
+    void storeCookie (Ip4Addr remote_addr, char const *cookie, std::uint8_t cookie_len,
+                      std::uint16_t mss)
+    {
+        AIPSTACK_ASSERT(cookie_len <= TcpMaxFastOpenCookieLen);
+        
+        // Find an existing entry, otherwise take a free entry if possible or
+        // reuse the least recently used entry.
+        Entry *entry = findEntry(remote_addr);
+        if (entry == nullptr) {
+            if (!m_free_list.isEmpty()) {
+                entry = m_free_list.first(*this);
+                m_free_list.removeFirst(*this);
+            } else {
+                entry = m_lru_list.first(*this);
+                m_lru_list.removeFirst(*this);
+                m_index.removeEntry({*entry, *this}, *this);
+            }
+            
+            entry->remote_addr = remote_addr;
+            m_index.addEntry({*entry, *this}, *this);
+            m_lru_list.append({*entry, *this}, *this);
+        }
+        
+        entry->mss = mss;
+        entry->cookie_len = cookie_len;
+        std::memcpy(entry->cookie, cookie, cookie_len);
+    }
+    
+    // Remove the entry for a server address if there is one.
+    void removeCookie (Ip4Addr remote_addr)
+    {
+        Entry *entry = m_index.findEntry(remote_addr, *this);
+        if (entry != nullptr) {
+            m_index.removeEntry({*entry, *this}, *this);
+            m_lru_list.remove({*entry, *this}, *this);
+            m_free_list.prepend({*entry, *this}, *this);
+        }
+    }
+
+private:
+    struct EntryIndexAccessor : public
+        MemberAccessor<Entry, typename EntryIndex::Node, &Entry::index_node> {};
+    struct EntryListAccessor : public
+        MemberAccessor<Entry, LinkedListNode<LinkModel>, &Entry::list_node> {};
+    
+    struct EntryIndexKeyFuncs : public OperatorKeyCompare {
+        inline static Ip4Addr GetKeyOfEntry (Entry const &entry)
+        {
+            return entry.remote_addr;
+        }
+        
+        inline static std::size_t HashKey (Ip4Addr addr)
+        {
+            HashAccumulator hash;
+            hash.addWord(addr.value());
+            return hash.getHash();
+        }
+    };
+
+private:
+    StructureRaiiWrapper<typename EntryIndex::Index> m_index;
+    StructureRaiiWrapper<EntryList> m_free_list;
+    StructureRaiiWrapper<EntryList> m_lru_list;
+    Entry m_entries[NumEntries];
+    
+    struct EntriesAccessor : public
+        MemberAccessor<TcpFastOpenCache, Entry[NumEntries],
+                       &TcpFastOpenCache::m_entries> {};
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_FAST_OPEN_COOKIE_H
+#define AIPSTACK_TCP_FAST_OPEN_COOKIE_H
+
+#include <cstdint>
+#include <cstring>
+
+#include <aipstack/misc/Hash.h>
+#include <aipstack/infra/Struct.h>
+#include <aipstack/ip/IpAddr.h>
+
+namespace AIpStack {
+
+// Generation and validation of TCP Fast Open cookies on the server (RFC 7413).
+// A cookie is a MAC over the client and server addresses, so a client can use
+// the cookie for any connection to the same server address. Cookies stay valid
+// as long as the secret does not change.
+class TcpFastOpenCookie {
+public:
+    // Length of the cookies that we generate.
+    inline static constexpr std::uint8_t Length = 8;
+    
+    // Make the cookie for a client.
+    static void make (std::uint32_t secret, Ip4Addr local_addr, Ip4Addr remote_addr,
+                      char *cookie)
+    {
+        HashAccumulator hash(secret);
+        hash.addWord(local_addr.value());
+        hash.addWord(remote_addr.value());
+        std::uint32_t word1 = hash.getHash();
+        hash.addWord(word1);
+        std::uint32_t word2 = hash.getHash();
+        
+        WriteSingleField<std::uint32_t>(cookie, word1);
+        WriteSingleField<std::uint32_t>(cookie + 4, word2);
+    }
+    
+    // Check a cookie received from a client.
+    static bool check (std::uint32_t secret, Ip4Addr local_addr, Ip4Addr remote_addr,
+                       char const *cookie, std::uint8_t cookie_len)
+    {
+        if (cookie_len != Length) {
+            return false;
+        }
+        char expected[Length];
+        make(secret, local_addr, remote_addr, expected);
+        return std::memcmp(cookie, expected, Length) == 0;
+    }
+};
+
+}
+
+#endif
@@ -26,6 +26,7 @@
 #define AIPSTACK_TCP_LISTENER_H
 
 #include <cstddef>
+#include <cstdint>
 
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/NonCopyable.h>
@@ -35,6 +36,7 @@
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpStats.h>
 
 #include "TcpListener.h"
 
@@ -54,6 +56,10 @@ struct TcpListenParams {
     Ip4Addr addr = Ip4Addr::ZeroAddr();
     PortNum port = 0;
     int max_pcbs = 0;
+    // If true, the listener may share the address and port with other listeners
+    // which also set reuse_port (a reuse-port group). New connections are then
+    // distributed among the members of the group by a hash of the 4-tuple.
+    bool reuse_port = false;
 };
 
 /**
@@ -69,7 +75,7 @@ class TcpListener :
     
     using TcpProto = IpTcpProto<Arg>;
 
-    AIPSTACK_USE_TYPES(TcpProto, (TcpPcb, Constants))
+    AIPSTACK_USE_TYPES(TcpProto, (TcpPcb, Constants, ListenerLinkModel, ListenerGroupList))
     
 public:
     /**
@@ -98,8 +104,12 @@ public:
     TcpListener (EstablishedHandler established_handler) :
         m_established_handler(established_handler),
         m_initial_rcv_wnd(0),
+        m_max_rcv_buf(0),
         m_accept_pcb(nullptr),
-        m_listening(false)
+        m_listening(false),
+        m_reuse_port(false),
+        m_fast_open(false),
+        m_defer_accept(0)
     {}
     
     /**
@@ -124,14 +134,18 @@ public:
     {
         // Stop listening.
         if (m_listening) {
-            m_tcp->m_listeners_list.remove(*this);
+            leave_group();
             m_tcp->unlink_listener(this);
         }
         
         // Reset variables.
         m_initial_rcv_wnd = 0;
+        m_max_rcv_buf = 0;
         m_accept_pcb = nullptr;
         m_listening = false;
+        m_reuse_port = false;
+        m_fast_open = false;
+        m_defer_accept = 0;
     }
     
     /**
@@ -168,7 +182,11 @@ public:
      * Listening on the all-zeros address listens on all local addresses.
      * Must not be called when already listening.
      * Return success/failure to start listening. It can fail only if there
-     * is another listener listening on the same pair of address and port.
+     * is another listener listening on the same pair of address and port,
+     * unless both that listener and this one use @ref TcpListenParams::reuse_port.
+     * In that case this listener joins the reuse-port group of the existing
+     * listener. Each listener in the group keeps its own settings, queue limit
+     * and statistics.
      */
     bool startListening (TcpApi<Arg> &api, TcpListenParams const &params)
     {
@@ -178,7 +196,9 @@ public:
         TcpProto &tcp = api.proto();
         
         // Check if there is an existing listener listning on this address+port.
-        if (tcp.find_listener(params.addr, params.port) != nullptr) {
+        // This is allowed only if both that and this listener allow port sharing.
+        TcpListener *group_head = tcp.find_listener(params.addr, params.port);
+        if (group_head != nullptr && !(params.reuse_port && group_head->m_reuse_port)) {
             return false;
         }
         
@@ -189,7 +209,21 @@ public:
         m_max_pcbs = params.max_pcbs;
         m_num_pcbs = 0;
         m_listening = true;
-        m_tcp->m_listeners_list.prepend(*this);
+        m_reuse_port = params.reuse_port;
+        m_stats.reset();
+        
+        if (group_head == nullptr) {
+            // Start a new group with just this listener and add it to the index.
+            ListenerGroupList::initLonely(*this);
+            m_group_head = this;
+            m_group_size = 1;
+            m_tcp->m_listener_index.addEntry(*this);
+        } else {
+            // Join the existing group, at the end of the circular list.
+            ListenerGroupList::initBefore(*this, *group_head);
+            m_group_head = group_head;
+            group_head->m_group_size++;
+        }
         
         return true;
     }
@@ -213,17 +247,144 @@ public:
         m_initial_rcv_wnd = MinValueU(rcv_wnd, Constants::MaxWindow);
     }
     
+    /**
+     * Set the maximum size of the receive buffers of connections to this
+     * listener, which determines the window scale factor.
+     * 
+     * The window scale factor is negotiated in the SYN and SYN-ACK and cannot
+     * change later. It is chosen as the smallest one which allows announcing
+     * a window of this size (including any growth by auto-tuning, see
+     * @ref TcpConnection::setRecvBufAutoTuning), up to the maximum of 2^14
+     * which allows windows of about 1 GiB. A smaller scale factor gives a
+     * finer window granularity. The default of 0 means that the maximum is
+     * not known, in which case a scale factor of 2^6 is used, which limits
+     * the window to about 4 MiB.
+     * 
+     * @param max_rcv_buf Maximum receive buffer size, or 0 for the default.
+     */
+    void setMaxReceiveBuffer (std::size_t max_rcv_buf)
+    {
+        m_max_rcv_buf = max_rcv_buf;
+    }
+    
+    /**
+     * Set whether TCP Fast Open (RFC 7413) is accepted for connections to this
+     * listener. Requires the EnableFastOpen option, default is false.
+     * 
+     * With Fast Open, clients that request it are given a cookie, and clients
+     * presenting a valid cookie may send data in the SYN. The
+     * @ref EstablishedHandler is then called when the SYN is received and the
+     * data is delivered to the connection once it is accepted. The data is
+     * limited by the initial receive window (@ref setInitialReceiveWindow).
+     * 
+     * Note that a SYN with data may be replayed and create another connection,
+     * so this should only be enabled for applications which tolerate that
+     * (RFC 7413 section 6).
+     */
+    void setFastOpen (bool enabled)
+    {
+        m_fast_open = enabled;
+    }
+    
+    /**
+     * Set deferred accept for connections to this listener, so that a
+     * connection is only reported by the @ref EstablishedHandler once the
+     * client has sent data, or after a timeout.
+     * 
+     * When enabled, an ACK without data or FIN which would complete the
+     * handshake is ignored as if it had been lost, and the connection remains
+     * in SYN_RCVD. The connection is established by the first segment with
+     * data (or FIN), which is then delivered to the connection right after
+     * it has been accepted. As a timeout, the SYN-ACK is retransmitted as
+     * usual and an ACK without data is accepted once the SYN-ACK has been
+     * retransmitted syn_ack_rtx times (with the default initial
+     * retransmission time of 1s, syn_ack_rtx=3 corresponds to 7s). A
+     * connection which does not complete by the SYN_RCVD timeout is dropped
+     * without ever being reported.
+     * 
+     * This saves accepting and setting up connections which are idle or dead,
+     * but must only be used for protocols where the client sends first. For
+     * a connection answered with a SYN cookie (EnableSynCookies), there is no
+     * SYN-ACK retransmission and no state before the ACK, so an ACK without
+     * data is always ignored.
+     * 
+     * @param syn_ack_rtx Number of SYN-ACK retransmissions after which an ACK
+     *        without data is accepted, or 0 to disable deferred accept
+     *        (the default).
+     */
+    void setDeferAccept (std::uint8_t syn_ack_rtx)
+    {
+        m_defer_accept = syn_ack_rtx;
+    }
+    
+    /**
+     * Return the statistics of the listener.
+     * 
+     * The statistics are only maintained if the EnableStats option is enabled,
+     * otherwise they are all zero. They are reset by @ref startListening and
+     * retained after the listener stops listening.
+     * 
+     * @return Snapshot of the statistics.
+     */
+    TcpListenerStats getStats () const
+    {
+        TcpListenerStats stats = m_stats.get();
+        if (TcpProto::EnableStats && m_listening) {
+            stats.backlog_pcbs = std::uint32_t(m_num_pcbs);
+        }
+        return stats;
+    }
+    
+private:
+    void leave_group ()
+    {
+        if (m_group_head != this) {
+            // Not the head, just remove from the group.
+            ListenerGroupList::remove(*this);
+            m_group_head->m_group_size--;
+            return;
+        }
+        
+        m_tcp->m_listener_index.removeEntry(*this);
+        
+        if (m_group_size > 1) {
+            // Make the next listener the head of the group and put it
+            // into the index in place of this one.
+            TcpListener *new_head = ListenerGroupList::next(*this);
+            ListenerGroupList::remove(*this);
+            new_head->m_group_size = m_group_size - 1;
+            
+            TcpListener *lis = new_head;
+            do {
+                lis->m_group_head = new_head;
+                lis = ListenerGroupList::next(*lis);
+            } while (lis != new_head);
+            
+            m_tcp->m_listener_index.addEntry(*new_head);
+        }
+    }
+    
 private:
     EstablishedHandler m_established_handler;
-    LinkedListNode<typename TcpProto::ListenerLinkModel> m_listeners_node;
+    typename TcpProto::ListenerIndex::Node m_index_node;
+    LinkedListNode<ListenerLinkModel> m_group_node;
+    // Head of the reuse-port group (this if not sharing the port).
+    TcpListener *m_group_head;
     TcpProto *m_tcp;
     TcpSeqInt m_initial_rcv_wnd;
+    std::size_t m_max_rcv_buf;
     TcpPcb *m_accept_pcb;
     Ip4Addr m_addr;
     PortNum m_port;
     int m_max_pcbs;
     int m_num_pcbs;
+    // Number of listeners in the group, valid only in the group head.
+    int m_group_size;
     bool m_listening;
+    bool m_reuse_port;
+    bool m_fast_open;
+    std::uint8_t m_defer_accept;
+    TcpStatsCounters<TcpProto::EnableStats, TcpListenerStats> m_stats;
 };
 
 }
@@ -45,6 +45,7 @@ struct TcpSegMeta {
     std::uint16_t window_size;
     Tcp4Flags flags;
     TcpOptions *opts; // not used for RX (undefined), may be null for TX
+    bool ecn_ce; // only for RX, whether the IP header had the CE codepoint
 };
 
 inline std::size_t CalcTcpSeqLen (Tcp4Flags flags, std::size_t tcp_data_len)
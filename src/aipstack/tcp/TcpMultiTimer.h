@@ -66,7 +66,7 @@ public:
     
     inline void setAfter (TimeType rel_time)
     {
-        TimeType abs_time = mt().platform().getTime() + rel_time;
+        TimeType abs_time = mt().platform().getEventTime() + rel_time;
         setAt(abs_time);
     }
     
@@ -82,18 +82,26 @@ private:
     }
 };
 
-template<typename PlatformImpl, typename Derived, typename UserData, typename ...TimerIds>
+// The underlying timer (BaseTimer) is normally PlatformFacade::Timer but may be
+// any class with the same interface, such as PlatformTimerWheel::Timer. It is
+// constructed from the argument passed to the TcpMultiTimer constructor and the
+// handler function.
+template<
+    typename PlatformImpl, typename BaseTimer, typename Derived, typename UserData,
+    typename ...TimerIds>
 class TcpMultiTimer :
     private TcpMultiTimerOne<PlatformImpl,
-        TcpMultiTimer<PlatformImpl, Derived, UserData, TimerIds...>, TimerIds>...,
-    private PlatformFacade<PlatformImpl>::Timer,
+        TcpMultiTimer<PlatformImpl, BaseTimer, Derived, UserData, TimerIds...>, TimerIds>...,
+    private BaseTimer,
     public UserData
 {
     template<typename, typename, typename>
     friend class TcpMultiTimerOne;
     
     using Platform = PlatformFacade<PlatformImpl>;
-    AIPSTACK_USE_TYPES(Platform, (TimeType, Timer))
+    AIPSTACK_USE_TYPES(Platform, (TimeType))
+    
+    using Timer = BaseTimer;
     
     inline static constexpr int NumTimers = sizeof...(TimerIds);
     using TimerIdsList = MakeTypeList<TimerIds...>;
@@ -123,8 +131,9 @@ private:
 public:
     using Timer::platform;
     
-    inline TcpMultiTimer (Platform platform_) :
-        Timer(platform_, AIPSTACK_BIND_MEMBER_TN(&TcpMultiTimer::timerHandler, this)),
+    template<typename TimerArg>
+    inline TcpMultiTimer (TimerArg &&timer_arg) :
+        Timer(timer_arg, AIPSTACK_BIND_MEMBER_TN(&TcpMultiTimer::timerHandler, this)),
         m_state(0)
     {
     }
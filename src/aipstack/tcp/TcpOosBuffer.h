@@ -28,12 +28,15 @@
 #include <cstdint>
 #include <cstddef>
 #include <algorithm>
+#include <type_traits>
 
 #include <aipstack/meta/ChooseInt.h>
 #include <aipstack/misc/Assert.h>
 #include <aipstack/infra/Options.h>
 #include <aipstack/infra/Instance.h>
 #include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpOptions.h>
+#include <aipstack/tcp/TcpOosTreeBuffer.h>
 
 namespace AIpStack {
 
@@ -109,6 +112,11 @@ private:
     // the end segment are undefined.
     OosSeg m_ooseq[NumOosSegs];
     
+    // Index of the segment which was most recently updated with received
+    // data, or NumOosSegs if none. This is used to report that segment in
+    // the first SACK block (RFC 2018 section 4).
+    IndexType m_recent;
+
 public:
     /**
      * Initialize (clear) the out-of-sequence information.
@@ -117,6 +125,8 @@ public:
     {
         // Set the first element to an end segment.
         m_ooseq[0] = OosSeg::MakeEnd();
+        
+        m_recent = NumOosSegs;
     }
     
     /**
@@ -221,6 +231,7 @@ public:
                     }
                     m_ooseq[pos] = OosSeg{seg_start, seg_end};
                     num_ooseq++;
+                    m_recent = pos;
                 }
             } else {
                 // The segment at [pos] cannot be a FIN.
@@ -230,6 +241,9 @@ public:
                 // have failed and we wouldn't be here.
                 AIPSTACK_ASSERT(!m_ooseq[pos].isFin());
                 
+                // This segment will contain the new data.
+                m_recent = pos;
+                
                 // Extend the existing segment to the left if needed.
                 if (rcv_nxt.ref_lt(seg_start, m_ooseq[pos].start)) {
                     need_ack = true;
@@ -326,6 +340,10 @@ public:
             num_ooseq--;
             m_ooseq[num_ooseq] = OosSeg::MakeEnd();
             
+            // Adjust the index of the most recently updated segment.
+            m_recent = (m_recent > 0 && m_recent < NumOosSegs) ?
+                IndexType(m_recent - 1) : NumOosSegs;
+            
             // The next segment is not supposed to have any data that we
             // could immediately consume since there are always gaps
             // between segments.
@@ -343,6 +361,40 @@ public:
             m_ooseq[0].getFinSeq() == rcv_nxt + datalen;
     }
     
+    /**
+     * Get SACK blocks describing the buffered out-of-sequence data.
+     * 
+     * The segment which was most recently updated with received data is
+     * reported first (if it still exists), followed by other segments in
+     * sequence order. A buffered FIN is not reported.
+     * 
+     * @param blocks Array where the blocks will be written.
+     * @param max_blocks Maximum number of blocks to write.
+     * @return Number of blocks written.
+     */
+    std::uint8_t getSackBlocks (TcpSackBlock *blocks, std::uint8_t max_blocks) const
+    {
+        std::uint8_t num_blocks = 0;
+        
+        if (num_blocks < max_blocks && m_recent < NumOosSegs &&
+            !m_ooseq[m_recent].isEndOrFin())
+        {
+            OosSeg const &seg = m_ooseq[m_recent];
+            blocks[num_blocks++] = TcpSackBlock{seg.start, seg.end};
+        }
+        
+        for (IndexType i = 0; i < NumOosSegs && num_blocks < max_blocks; i++) {
+            if (m_ooseq[i].isEndOrFin()) {
+                break;
+            }
+            if (i != m_recent) {
+                blocks[num_blocks++] = TcpSackBlock{m_ooseq[i].start, m_ooseq[i].end};
+            }
+        }
+        
+        return num_blocks;
+    }
+
 private:
     // Return the number of out-of-sequence segments by counting
     // until an end marker is found or the end of segments is reached.
@@ -358,6 +410,7 @@ private:
 
 struct TcpOosBufferServiceOptions {
     AIPSTACK_OPTION_DECL_VALUE(NumOosSegs, std::size_t, 4)
+    AIPSTACK_OPTION_DECL_VALUE(UseIntervalTree, bool, false)
 };
 
 template<typename ...Options>
@@ -365,10 +418,19 @@ class TcpOosBufferService {
     template<typename>
     friend class TcpOosBuffer;
     
+    template<typename>
+    friend class TcpOosTreeBuffer;
+    
     AIPSTACK_OPTION_CONFIG_VALUE(TcpOosBufferServiceOptions, NumOosSegs)
+    AIPSTACK_OPTION_CONFIG_VALUE(TcpOosBufferServiceOptions, UseIntervalTree)
+    
+    // Select the implementation based on the UseIntervalTree option.
+    template<typename Arg>
+    using Impl = std::conditional_t<UseIntervalTree,
+        TcpOosTreeBuffer<Arg>, TcpOosBuffer<Arg>>;
 
 public:
-    AIPSTACK_DEF_INSTANCE(TcpOosBufferService, TcpOosBuffer)
+    AIPSTACK_DEF_INSTANCE(TcpOosBufferService, Impl)
 };
 
 }
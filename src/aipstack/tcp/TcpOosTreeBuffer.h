@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_OOS_TREE_BUFFER_H
+#define AIPSTACK_TCP_OOS_TREE_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <aipstack/meta/ChooseInt.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/AvlTree.h>
+#include <aipstack/structure/TreeCompare.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpOptions.h>
+
+namespace AIpStack {
+
+/**
+ * Alternative implementation of maintaining information about received
+ * out-of-sequence TCP data or FIN, with the same interface as
+ * @ref TcpOosBuffer.
+ * 
+ * The contiguous ranges of data are kept in an AVL tree ordered by
+ * sequence number, so that updates take logarithmic time, which makes
+ * it practical to track many more ranges. The nodes come from a
+ * per-buffer pool and are linked by array indices, so that the object
+ * remains trivially copyable. A FIN is not stored as a range but
+ * separately.
+ * 
+ * Ranges are ordered by comparing sequence numbers modulo 2^32. This
+ * is consistent because all buffered data is within the receive window.
+ */
+template<typename Arg>
+class TcpOosTreeBuffer
+{
+    static_assert(Arg::NumOosSegs > 0);
+    using IndexType = ChooseIntForMax<Arg::NumOosSegs, false>;
+    inline static constexpr IndexType NumOosSegs = Arg::NumOosSegs;
+    inline static constexpr IndexType IndexNull = IndexType(-1);
+    
+    struct OosNode;
+    struct NodesAccessor;
+    using LinkModel = ArrayLinkModelWithAccessor<
+        OosNode, IndexType, IndexNull, TcpOosTreeBuffer, NodesAccessor>;
+    using Ref = typename LinkModel::Ref;
+    
+    // Represents one contiguous region of buffered data.
+    struct OosNode {
+        AvlTreeNode<LinkModel> tree_node;
+        
+        // First sequence number.
+        TcpSeqNum start;
+        
+        // One-past-last sequence number.
+        TcpSeqNum end;
+        
+        // Next node in the free list, valid for nodes not in the tree.
+        IndexType next_free;
+    };
+    
+    struct NodeKeyFuncs {
+        inline static TcpSeqNum GetKeyOfEntry (OosNode const &node)
+        {
+            return node.start;
+        }
+        
+        inline static int CompareKeys (TcpSeqNum op1, TcpSeqNum op2)
+        {
+            return (op1 == op2) ? 0 : op1.mod_lt(op2) ? -1 : 1;
+        }
+    };
+    
+    struct TreeNodeAccessor : public
+        MemberAccessor<OosNode, AvlTreeNode<LinkModel>, &OosNode::tree_node> {};
+    
+    using NodeTree = AvlTree<TreeNodeAccessor, TreeCompare<LinkModel, NodeKeyFuncs>,
+                             LinkModel>;
+
+private:
+    // Tree of buffered ranges.
+    NodeTree m_tree;
+    
+    // First node in the free list, or IndexNull.
+    IndexType m_free_first;
+    
+    // Index of the range which was most recently updated with received
+    // data, or IndexNull if none (see getSackBlocks).
+    IndexType m_recent;
+    
+    // Whether a FIN is buffered and its sequence number.
+    bool m_have_fin;
+    TcpSeqNum m_fin_seq;
+    
+    // Pool of nodes.
+    OosNode m_nodes[NumOosSegs];
+    
+    struct NodesAccessor : public MemberAccessor<
+        TcpOosTreeBuffer, OosNode[NumOosSegs], &TcpOosTreeBuffer::m_nodes> {};
+
+public:
+    /**
+     * Initialize (clear) the out-of-sequence information.
+     */
+    void init ()
+    {
+        m_tree.init();
+        
+        for (IndexType i = 0; i < NumOosSegs; i++) {
+            m_nodes[i].next_free = (i + 1 < NumOosSegs) ? IndexType(i + 1) : IndexNull;
+        }
+        m_free_first = 0;
+        
+        m_recent = IndexNull;
+        m_have_fin = false;
+    }
+    
+    /**
+     * Check if there is no out-of-sequence data or FIN buffered.
+     * 
+     * @return Whether neither data nor FIN is buffered.
+     */
+    inline bool isNothingBuffered () const
+    {
+        return m_tree.isEmpty() && !m_have_fin;
+    }
+    
+    /**
+     * Update out-of-sequence information due to arrival of a new segment.
+     * 
+     * See @ref TcpOosBuffer::updateForSegmentReceived.
+     */
+    bool updateForSegmentReceived (TcpSeqNum rcv_nxt, TcpSeqNum seg_start,
+        std::size_t seg_datalen, bool seg_fin, bool &need_ack)
+    {
+        // Initialize need_ack to whether the segment is out of sequence.
+        // If the segment fills in a gap this will be set to true below.
+        need_ack = seg_start != rcv_nxt;
+        
+        // Calculate sequence number for end of data.
+        TcpSeqNum seg_end = seg_start + seg_datalen;
+        
+        // Check for FIN-related inconsistencies.
+        if (m_have_fin) {
+            // Check if we just received data beyond the buffered FIN.
+            if (seg_datalen > 0 && !rcv_nxt.ref_lte(seg_end, m_fin_seq)) {
+                return false;
+            }
+            
+            // Check if we just received a FIN at a different position.
+            if (seg_fin && seg_end != m_fin_seq) {
+                return false;
+            }
+        } else {
+            // Check if we just received a FIN that is before already received data.
+            if (seg_fin && !m_tree.isEmpty() &&
+                !rcv_nxt.ref_lte((*m_tree.last(st())).end, seg_end)) {
+                return false;
+            }
+        }
+        
+        // If the new segment has any data, update the ranges.
+        if (seg_datalen > 0) {
+            // Find the first range which is not strictly before the new segment.
+            Ref pos = find_first_not_before(rcv_nxt, seg_start);
+            
+            // If there is no such range or it is strictly after the new segment,
+            // insert a new range. Otherwise the new segment intersects or touches
+            // [pos] and we merge it with [pos] and possibly subsequent ranges.
+            if (pos.isNull() || rcv_nxt.ref_lt(seg_end, (*pos).start)) {
+                insert_range(seg_start, seg_end, !pos.isNull(), need_ack);
+            } else {
+                merge_range(rcv_nxt, pos, seg_start, seg_end, need_ack);
+            }
+        }
+        
+        // If we got a FIN, remember it.
+        if (seg_fin) {
+            m_have_fin = true;
+            m_fin_seq = seg_end;
+        }
+        
+        return true;
+    }
+    
+    /**
+     * Shifts any available data or FIN from the front of the
+     * out-of-sequence information buffer.
+     * 
+     * See @ref TcpOosBuffer::shiftAvailable.
+     */
+    void shiftAvailable (TcpSeqNum rcv_nxt, std::size_t &datalen, bool &fin)
+    {
+        // Check if we have a range starting at rcv_nxt.
+        Ref first = m_tree.first(st());
+        if (!first.isNull() && (*first).start == rcv_nxt) {
+            // Return the data length to the caller.
+            TcpSeqNum seq_end = (*first).end;
+            datalen = std::size_t(seq_end - (*first).start);
+            
+            // Remove the range.
+            free_node(first);
+            
+            // The next range is not supposed to have any data that we
+            // could immediately consume since there are always gaps
+            // between ranges.
+            AIPSTACK_ASSERT(m_tree.isEmpty() ||
+                            !rcv_nxt.ref_lte((*m_tree.first(st())).start, seq_end));
+        } else {
+            // Not returning any data.
+            datalen = 0;
+        }
+        
+        // Check if we have a FIN with sequence number rcv_nxt+datalen.
+        // There is no need to consume the FIN.
+        fin = m_have_fin && m_fin_seq == rcv_nxt + datalen;
+    }
+    
+    /**
+     * Get SACK blocks describing the buffered out-of-sequence data.
+     * 
+     * See @ref TcpOosBuffer::getSackBlocks.
+     */
+    std::uint8_t getSackBlocks (TcpSackBlock *blocks, std::uint8_t max_blocks) const
+    {
+        std::uint8_t num_blocks = 0;
+        
+        if (num_blocks < max_blocks && m_recent != IndexNull) {
+            OosNode const &node = m_nodes[m_recent];
+            blocks[num_blocks++] = TcpSackBlock{node.start, node.end};
+        }
+        
+        for (Ref ref = m_tree.first(st()); !ref.isNull() && num_blocks < max_blocks;
+             ref = m_tree.next(ref, st()))
+        {
+            if (ref.getIndex(st()) != m_recent) {
+                blocks[num_blocks++] = TcpSackBlock{(*ref).start, (*ref).end};
+            }
+        }
+        
+        return num_blocks;
+    }
+
+private:
+    inline typename LinkModel::State st () const
+    {
+        return const_cast<TcpOosTreeBuffer &>(*this);
+    }
+    
+    // Return the first range whose end is not before seg_start, or null.
+    Ref find_first_not_before (TcpSeqNum rcv_nxt, TcpSeqNum seg_start)
+    {
+        // Find the last range starting no later than seg_start, if any.
+        int cmp;
+        Ref ref = m_tree.lookupInexact(seg_start, cmp, st());
+        if (!ref.isNull() && cmp < 0) {
+            ref = m_tree.prev(ref, st());
+        }
+        
+        // If there is no such range, the first range is the answer.
+        if (ref.isNull()) {
+            return m_tree.first(st());
+        }
+        
+        // Otherwise it is this range if it reaches seg_start, else the next one.
+        if (rcv_nxt.ref_lt((*ref).end, seg_start)) {
+            ref = m_tree.next(ref, st());
+        }
+        return ref;
+    }
+    
+    void insert_range (TcpSeqNum seg_start, TcpSeqNum seg_end, bool have_after,
+                       bool &need_ack)
+    {
+        // If all nodes are used and the new range is not the last, release
+        // the last range. This ensures that we can always accept in-sequence
+        // data, and not stall after all nodes are exhausted.
+        if (m_free_first == IndexNull) {
+            if (!have_after) {
+                return;
+            }
+            
+            Ref last = m_tree.last(st());
+            free_node(last);
+            have_after = !m_tree.isEmpty() &&
+                seg_start.mod_lt((*m_tree.last(st())).start);
+        }
+        
+        // Filling a gap before existing data needs an ACK.
+        if (have_after) {
+            need_ack = true;
+        }
+        
+        // Take a node from the free list and insert it.
+        IndexType index = m_free_first;
+        OosNode &node = m_nodes[index];
+        m_free_first = node.next_free;
+        
+        node.start = seg_start;
+        node.end = seg_end;
+        bool inserted = m_tree.insert(Ref(node), nullptr, st());
+        AIPSTACK_ASSERT(inserted);
+        
+        m_recent = index;
+    }
+    
+    void merge_range (TcpSeqNum rcv_nxt, Ref pos, TcpSeqNum seg_start,
+                      TcpSeqNum seg_end, bool &need_ack)
+    {
+        OosNode &node = *pos;
+        
+        // This range will contain the new data.
+        m_recent = pos.getIndex(st());
+        
+        // Extend the existing range to the left if needed. This does not change
+        // its position in the tree since the previous range ends before seg_start.
+        if (rcv_nxt.ref_lt(seg_start, node.start)) {
+            need_ack = true;
+            node.start = seg_start;
+        }
+        
+        // Extend the existing range to the right if needed.
+        if (!rcv_nxt.ref_lte(seg_end, node.end)) {
+            need_ack = true;
+            node.end = seg_end;
+            
+            // Merge the extended range with any subsequent ranges that it now
+            // intersects or touches.
+            Ref next = m_tree.next(pos, st());
+            while (!next.isNull() && !rcv_nxt.ref_lt(seg_end, (*next).start)) {
+                // If the extended range extends no more than to the end of [next],
+                // then [next] is the last range to be merged.
+                bool last_merged = rcv_nxt.ref_lte(seg_end, (*next).end);
+                if (last_merged) {
+                    node.end = (*next).end;
+                }
+                
+                Ref after = m_tree.next(next, st());
+                free_node(next);
+                
+                if (last_merged) {
+                    break;
+                }
+                next = after;
+            }
+        }
+    }
+    
+    void free_node (Ref ref)
+    {
+        IndexType index = ref.getIndex(st());
+        
+        m_tree.remove(ref, st());
+        
+        (*ref).next_free = m_free_first;
+        m_free_first = index;
+        
+        if (m_recent == index) {
+            m_recent = IndexNull;
+        }
+    }
+};
+
+}
+
+#endif
@@ -27,47 +27,108 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
 
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/EnumUtils.h>
 #include <aipstack/misc/EnumBitfieldUtils.h>
+#include <aipstack/misc/MinMax.h>
 #include <aipstack/infra/Buf.h>
 #include <aipstack/infra/BufUtils.h>
 #include <aipstack/infra/Struct.h>
 #include <aipstack/proto/Tcp4Proto.h>
+#include <aipstack/tcp/TcpSeqNum.h>
 
 namespace AIpStack {
 
 // TCP options flags used in TcpOptions options field.
 enum class TcpOptionFlags : std::uint8_t {
-    Mss      = 1 << 0,
-    WndScale = 1 << 1,
+    Mss        = 1 << 0,
+    WndScale   = 1 << 1,
+    SackPerm   = 1 << 2,
+    Sack       = 1 << 3,
+    Timestamps = 1 << 4,
+    FastOpen   = 1 << 5,
 };
 AIPSTACK_ENUM_BITFIELD(TcpOptionFlags)
 
+// Maximum number of SACK blocks in a SACK option (limited by option space).
+inline constexpr std::uint8_t TcpMaxSackBlocks = 4;
+
+// Maximum number of SACK blocks when the timestamps option is also sent.
+inline constexpr std::uint8_t TcpMaxSackBlocksWithTimestamps = 3;
+
+// Supported lengths of a TCP Fast Open cookie (RFC 7413). The RFC allows up to
+// 16 bytes, but longer cookies would not fit into a SYN with the other options.
+inline constexpr std::uint8_t TcpMinFastOpenCookieLen = 4;
+inline constexpr std::uint8_t TcpMaxFastOpenCookieLen = 12;
+
+// A SACK block, reporting received data [start, end).
+struct TcpSackBlock {
+    TcpSeqNum start;
+    TcpSeqNum end;
+};
+
 // Container for TCP options that we care about.
 struct TcpOptions {
     TcpOptionFlags options;
     std::uint8_t wnd_scale;
     std::uint16_t mss;
+    std::uint32_t ts_val;
+    std::uint32_t ts_ecr;
+    std::uint8_t num_sack_blocks;
+    TcpSackBlock sack_blocks[TcpMaxSackBlocks];
+    std::uint8_t fast_open_cookie_len;
+    char fast_open_cookie[TcpMaxFastOpenCookieLen];
 };
 
 namespace TcpOptionWriteLen {
     inline constexpr std::size_t MSS = 4;
     inline constexpr std::size_t WndScale = 4;
+    inline constexpr std::size_t SackPerm = 4;
+    inline constexpr std::size_t Timestamps = 12;
+    inline constexpr std::size_t SackBase = 4;
+    inline constexpr std::size_t SackBlock = 8;
+    inline constexpr std::size_t FastOpenBase = 4;
+}
+
+// Length of a SACK option with the given number of blocks (including padding).
+inline constexpr std::size_t TcpSackOptionWriteLen (std::uint8_t num_blocks)
+{
+    return TcpOptionWriteLen::SackBase + num_blocks * TcpOptionWriteLen::SackBlock;
+}
+
+// Length of a Fast Open option with the given cookie length (including padding).
+// A zero cookie length is used for a cookie request.
+inline constexpr std::size_t TcpFastOpenOptionWriteLen (std::uint8_t cookie_len)
+{
+    return TcpOptionWriteLen::FastOpenBase + (cookie_len + 3u) / 4u * 4u;
 }
 
-inline constexpr std::size_t MaxTcpOptionsWriteLen =
-    TcpOptionWriteLen::MSS + TcpOptionWriteLen::WndScale;
+// SYN segments have MSS, WndScale, SackPerm, Timestamps and FastOpen, other
+// segments Timestamps and/or SACK.
+inline constexpr std::size_t MaxTcpOptionsWriteLen = MaxValue(
+    TcpOptionWriteLen::MSS + TcpOptionWriteLen::WndScale + TcpOptionWriteLen::SackPerm +
+        TcpOptionWriteLen::Timestamps + TcpFastOpenOptionWriteLen(TcpMaxFastOpenCookieLen),
+    MaxValue(
+        TcpOptionWriteLen::Timestamps +
+            TcpSackOptionWriteLen(TcpMaxSackBlocksWithTimestamps),
+        TcpSackOptionWriteLen(TcpMaxSackBlocks)));
+
+// Everything must fit into the maximum option space of a TCP header.
+static_assert(MaxTcpOptionsWriteLen <= 40);
 
 inline void ParseTcpOptions (IpBufRef buf, TcpOptions &out_opts)
 {
     // Clear options flags. Below we will set flags for options that we find.
     out_opts.options = TcpOptionFlags(0);
     
-    while (buf.tot_len > 0) {
+    // Read the options using a cursor which is fast for byte-wise access.
+    IpBufCursor cur(buf);
+    
+    while (cur.getRemaining() > 0) {
         // Read the option kind.
-        TcpOption kind = TcpOption(std::uint8_t(ipBufTakeByteMut(buf)));
+        TcpOption kind = TcpOption(std::uint8_t(cur.takeByte()));
         
         // Hanlde end option and nop option.
         if (kind == TcpOption::End) {
@@ -78,17 +139,17 @@ inline void ParseTcpOptions (IpBufRef buf, TcpOptions &out_opts)
         }
         
         // Read the option length.
-        if (buf.tot_len == 0) {
+        if (cur.getRemaining() == 0) {
             break;
         }
-        std::uint8_t length = std::uint8_t(ipBufTakeByteMut(buf));
+        std::uint8_t length = std::uint8_t(cur.takeByte());
         
         // Check the option length.
         if (length < 2) {
             break;
         }
         std::uint8_t opt_data_len = length - 2;
-        if (buf.tot_len < opt_data_len) {
+        if (cur.getRemaining() < opt_data_len) {
             break;
         }
         
@@ -100,7 +161,7 @@ inline void ParseTcpOptions (IpBufRef buf, TcpOptions &out_opts)
                     goto skip_option;
                 }
                 char opt_data[2];
-                buf = ipBufTakeBytes(buf, opt_data_len, opt_data);
+                cur.takeBytes(opt_data_len, opt_data);
                 out_opts.options |= TcpOptionFlags::Mss;
                 out_opts.mss = ReadSingleField<std::uint16_t>(opt_data);
             } break;
@@ -110,15 +171,66 @@ inline void ParseTcpOptions (IpBufRef buf, TcpOptions &out_opts)
                 if (opt_data_len != 1) {
                     goto skip_option;
                 }
-                std::uint8_t value = std::uint8_t(ipBufTakeByteMut(buf));
+                std::uint8_t value = std::uint8_t(cur.takeByte());
                 out_opts.options |= TcpOptionFlags::WndScale;
                 out_opts.wnd_scale = value;
             } break;
             
+            // SACK Permitted
+            case TcpOption::SackPerm: {
+                if (opt_data_len != 0) {
+                    goto skip_option;
+                }
+                out_opts.options |= TcpOptionFlags::SackPerm;
+            } break;
+            
+            // Timestamps
+            case TcpOption::Timestamps: {
+                if (opt_data_len != 8) {
+                    goto skip_option;
+                }
+                char opt_data[8];
+                cur.takeBytes(opt_data_len, opt_data);
+                out_opts.options |= TcpOptionFlags::Timestamps;
+                out_opts.ts_val = ReadSingleField<std::uint32_t>(opt_data);
+                out_opts.ts_ecr = ReadSingleField<std::uint32_t>(opt_data + 4);
+            } break;
+            
+            // SACK (any blocks beyond TcpMaxSackBlocks are ignored)
+            case TcpOption::Sack: {
+                if (opt_data_len == 0 || opt_data_len % TcpOptionWriteLen::SackBlock != 0) {
+                    goto skip_option;
+                }
+                std::uint8_t num_blocks = opt_data_len / TcpOptionWriteLen::SackBlock;
+                out_opts.options |= TcpOptionFlags::Sack;
+                out_opts.num_sack_blocks = MinValue(num_blocks, TcpMaxSackBlocks);
+                for (std::uint8_t i = 0; i < num_blocks; i++) {
+                    char block_data[TcpOptionWriteLen::SackBlock];
+                    cur.takeBytes(TcpOptionWriteLen::SackBlock, block_data);
+                    if (i < TcpMaxSackBlocks) {
+                        out_opts.sack_blocks[i] = TcpSackBlock{
+                            TcpSeqNum::readBinary(block_data),
+                            TcpSeqNum::readBinary(block_data + TcpSeqNum::Size)};
+                    }
+                }
+            } break;
+            
+            // Fast Open (cookies of unsupported length are ignored)
+            case TcpOption::FastOpen: {
+                if (opt_data_len != 0 && (opt_data_len < TcpMinFastOpenCookieLen ||
+                    opt_data_len > TcpMaxFastOpenCookieLen || opt_data_len % 2 != 0))
+                {
+                    goto skip_option;
+                }
+                out_opts.options |= TcpOptionFlags::FastOpen;
+                out_opts.fast_open_cookie_len = opt_data_len;
+                cur.takeBytes(opt_data_len, out_opts.fast_open_cookie);
+            } break;
+            
             // Unknown option (also used to handle bad options).
             skip_option:
             default: {
-                buf = ipBufSkipBytes(buf, opt_data_len);
+                cur.skipBytes(opt_data_len);
             } break;
         }
     }
@@ -133,6 +245,21 @@ inline std::uint8_t CalcTcpOptionsLength (TcpOptions const &tcp_opts)
     if ((tcp_opts.options & TcpOptionFlags::WndScale) != Enum0) {
         opts_len += TcpOptionWriteLen::WndScale;
     }
+    if ((tcp_opts.options & TcpOptionFlags::SackPerm) != Enum0) {
+        opts_len += TcpOptionWriteLen::SackPerm;
+    }
+    if ((tcp_opts.options & TcpOptionFlags::Timestamps) != Enum0) {
+        opts_len += TcpOptionWriteLen::Timestamps;
+    }
+    if ((tcp_opts.options & TcpOptionFlags::Sack) != Enum0) {
+        AIPSTACK_ASSERT(tcp_opts.num_sack_blocks > 0);
+        AIPSTACK_ASSERT(tcp_opts.num_sack_blocks <= TcpMaxSackBlocks);
+        opts_len += TcpSackOptionWriteLen(tcp_opts.num_sack_blocks);
+    }
+    if ((tcp_opts.options & TcpOptionFlags::FastOpen) != Enum0) {
+        AIPSTACK_ASSERT(tcp_opts.fast_open_cookie_len <= TcpMaxFastOpenCookieLen);
+        opts_len += TcpFastOpenOptionWriteLen(tcp_opts.fast_open_cookie_len);
+    }
     AIPSTACK_ASSERT(opts_len <= MaxTcpOptionsWriteLen);
     AIPSTACK_ASSERT(opts_len % 4 == 0); // caller needs padding to 4-byte alignment
     return opts_len;
@@ -154,6 +281,53 @@ inline void WriteTcpOptions (TcpOptions const &tcp_opts, char *out)
         WriteSingleField<std::uint8_t>(out + 3, tcp_opts.wnd_scale);
         out += TcpOptionWriteLen::WndScale;
     }
+    
+    if ((tcp_opts.options & TcpOptionFlags::SackPerm) != Enum0) {
+        WriteSingleField<std::uint8_t>(out + 0, AsUnderlying(TcpOption::Nop));
+        WriteSingleField<std::uint8_t>(out + 1, AsUnderlying(TcpOption::Nop));
+        WriteSingleField<std::uint8_t>(out + 2, AsUnderlying(TcpOption::SackPerm));
+        WriteSingleField<std::uint8_t>(out + 3, /*length=*/2);
+        out += TcpOptionWriteLen::SackPerm;
+    }
+    
+    if ((tcp_opts.options & TcpOptionFlags::Timestamps) != Enum0) {
+        WriteSingleField<std::uint8_t >(out + 0, AsUnderlying(TcpOption::Nop));
+        WriteSingleField<std::uint8_t >(out + 1, AsUnderlying(TcpOption::Nop));
+        WriteSingleField<std::uint8_t >(out + 2, AsUnderlying(TcpOption::Timestamps));
+        WriteSingleField<std::uint8_t >(out + 3, /*length=*/10);
+        WriteSingleField<std::uint32_t>(out + 4, tcp_opts.ts_val);
+        WriteSingleField<std::uint32_t>(out + 8, tcp_opts.ts_ecr);
+        out += TcpOptionWriteLen::Timestamps;
+    }
+    
+    if ((tcp_opts.options & TcpOptionFlags::Sack) != Enum0) {
+        std::uint8_t num_blocks = tcp_opts.num_sack_blocks;
+        WriteSingleField<std::uint8_t>(out + 0, AsUnderlying(TcpOption::Nop));
+        WriteSingleField<std::uint8_t>(out + 1, AsUnderlying(TcpOption::Nop));
+        WriteSingleField<std::uint8_t>(out + 2, AsUnderlying(TcpOption::Sack));
+        WriteSingleField<std::uint8_t>(out + 3,
+            std::uint8_t(2 + num_blocks * TcpOptionWriteLen::SackBlock));
+        out += TcpOptionWriteLen::SackBase;
+        
+        for (std::uint8_t i = 0; i < num_blocks; i++) {
+            tcp_opts.sack_blocks[i].start.writeBinary(out);
+            tcp_opts.sack_blocks[i].end.writeBinary(out + TcpSeqNum::Size);
+            out += TcpOptionWriteLen::SackBlock;
+        }
+    }
+    
+    if ((tcp_opts.options & TcpOptionFlags::FastOpen) != Enum0) {
+        // Pad with NOPs in front so that the option ends at a 4-byte boundary.
+        std::uint8_t cookie_len = tcp_opts.fast_open_cookie_len;
+        std::size_t pad_len = TcpFastOpenOptionWriteLen(cookie_len) - (2 + cookie_len);
+        for (std::size_t i = 0; i < pad_len; i++) {
+            WriteSingleField<std::uint8_t>(out + i, AsUnderlying(TcpOption::Nop));
+        }
+        out += pad_len;
+        WriteSingleField<std::uint8_t>(out + 0, AsUnderlying(TcpOption::FastOpen));
+        WriteSingleField<std::uint8_t>(out + 1, std::uint8_t(2 + cookie_len));
+        std::memcpy(out + 2, tcp_opts.fast_open_cookie, cookie_len);
+    }
 }
 
 }
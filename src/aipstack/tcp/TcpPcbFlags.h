@@ -33,7 +33,6 @@ namespace AIpStack {
 
 using TcpPcbFlagsBaseType = std::uint16_t;
 
-inline constexpr int TcpPcbFlagsBits = 14;
 
 enum class TcpPcbFlags : TcpPcbFlagsBaseType {
     // ACK is needed; used in input processing
@@ -51,8 +50,8 @@ enum class TcpPcbFlags : TcpPcbFlagsBaseType {
     RttPending = TcpPcbFlagsBaseType(1) << 4,
     // Round-trip-time is not in initial state
     RttValid   = TcpPcbFlagsBaseType(1) << 5,
-    // cwnd has been increaded by snd_mss this round-trip
-    CwndIncrd  = TcpPcbFlagsBaseType(1) << 6,
+    // An ACK for received data is being delayed (DelAckTimer is set)
+    AckDelayed = TcpPcbFlagsBaseType(1) << 6,
     // A segment has been retransmitted and not yet acked
     RtxActive  = TcpPcbFlagsBaseType(1) << 7,
     // The recover variable valid (and >=snd_una)
@@ -67,7 +66,11 @@ enum class TcpPcbFlags : TcpPcbFlagsBaseType {
     OutRetry   = TcpPcbFlagsBaseType(1) << 12,
     // rcv_ann_wnd needs update before sending a segment, implies con != nullptr
     RcvWndUpd  = TcpPcbFlagsBaseType(1) << 13,
-    // NOTE: Currently no more bits are available, see TcpPcb::flags.
+    // SACK is used (SYN_SENT: SACK-permitted is to be sent)
+    SackPerm   = TcpPcbFlagsBaseType(1) << 14,
+    // Timestamps are used (SYN_SENT: timestamps option is to be sent)
+    Timestamps = TcpPcbFlagsBaseType(1) << 15,
+    // NOTE: Currently no bits are available, see TcpPcb::flags.
 };
 AIPSTACK_ENUM_BITFIELD(TcpPcbFlags)
 
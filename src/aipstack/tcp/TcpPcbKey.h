@@ -25,6 +25,10 @@
 #ifndef AIPSTACK_TCP_PCB_KEY_H
 #define AIPSTACK_TCP_PCB_KEY_H
 
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Hash.h>
 #include <aipstack/ip/IpAddr.h>
 
 namespace AIpStack {
@@ -46,7 +50,7 @@ struct TcpPcbKey : public Ip4AddrPair {
     PortNum remote_port;
 };
 
-// Provides comparison functions for TcpPcbKey
+// Provides comparison and hash functions for TcpPcbKey
 class TcpPcbKeyCompare {
 public:
     static int CompareKeys (TcpPcbKey const &op1, TcpPcbKey const &op2)
@@ -92,6 +96,57 @@ public:
                op1.local_port  == op2.local_port  &&
                op1.local_addr  == op2.local_addr;
     }
+    
+    static std::size_t HashKey (TcpPcbKey const &key)
+    {
+        HashAccumulator hash;
+        hash.addWord(key.remote_addr.value());
+        hash.addWord(key.local_addr.value());
+        hash.addWord((std::uint32_t(key.remote_port) << 16) | key.local_port);
+        return hash.getHash();
+    }
+};
+
+// Lookup key for TCP listeners (the zero address matches all local addresses)
+struct TcpListenerKey {
+    Ip4Addr addr;
+    PortNum port;
+};
+
+// Provides comparison and hash functions for TcpListenerKey
+class TcpListenerKeyCompare {
+public:
+    static int CompareKeys (TcpListenerKey const &op1, TcpListenerKey const &op2)
+    {
+        if (op1.port < op2.port) {
+            return -1;
+        }
+        if (op1.port > op2.port) {
+            return 1;
+        }
+        
+        if (op1.addr < op2.addr) {
+            return -1;
+        }
+        if (op1.addr > op2.addr) {
+            return 1;
+        }
+        
+        return 0;
+    }
+    
+    static bool KeysAreEqual (TcpListenerKey const &op1, TcpListenerKey const &op2)
+    {
+        return op1.port == op2.port && op1.addr == op2.addr;
+    }
+    
+    static std::size_t HashKey (TcpListenerKey const &key)
+    {
+        HashAccumulator hash;
+        hash.addWord(key.addr.value());
+        hash.addWord(key.port);
+        return hash.getHash();
+    }
 };
 
 }
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_TCP_PCB_POOL_H
+#define AIPSTACK_TCP_PCB_POOL_H
+
+#include <cstddef>
+#include <new>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/ResourceArray.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * Growable pool of PCBs, allocated from the heap in chunks.
+ * 
+ * The pool starts empty and chunks are added with addChunk when the owner
+ * runs out of PCBs. PCBs are identified by a global index (chunk index times
+ * ChunkSize plus the index within the chunk) which stays valid as long as the
+ * chunk exists, so that array-index link models can still be used.
+ * 
+ * While any chunk exists, a timer periodically calls the owner's function
+ * pcb_pool_reclaim, which is expected to release idle chunks using
+ * removeChunk. The constructor arguments match those of a ResourceArray
+ * of PCBs so that the two can be used interchangeably.
+ */
+template<typename PlatformImpl, typename Pcb, typename Owner,
+         std::size_t ChunkSize, std::size_t NumChunks>
+class TcpPcbPool :
+    private NonCopyable<TcpPcbPool<PlatformImpl, Pcb, Owner, ChunkSize, NumChunks>>
+{
+    static_assert(ChunkSize > 0);
+    static_assert(NumChunks > 0);
+    
+    using Platform = PlatformFacade<PlatformImpl>;
+    AIPSTACK_USE_TYPES(Platform, (TimeType))
+    
+    // Interval at which the owner is asked to release idle chunks.
+    inline static constexpr TimeType ReclaimTicks = 10.0 * Platform::TimeFreq;
+    
+public:
+    using Chunk = ResourceArray<Pcb, ChunkSize>;
+    
+    // Maximum number of PCBs which can exist.
+    inline static constexpr std::size_t Capacity = ChunkSize * NumChunks;
+    
+    TcpPcbPool (ResourceArrayInitSame, Platform platform, Owner *owner) :
+        m_timer(platform, AIPSTACK_BIND_MEMBER_TN(&TcpPcbPool::timerHandler, this)),
+        m_owner(owner)
+    {
+        for (Chunk *&chunk : m_chunks) {
+            chunk = nullptr;
+        }
+    }
+    
+    ~TcpPcbPool ()
+    {
+        for (Chunk *chunk : m_chunks) {
+            delete chunk;
+        }
+    }
+    
+    inline Platform platform () const
+    {
+        return m_timer.platform();
+    }
+    
+    // Allocate a new chunk of PCBs, constructed with the same arguments as
+    // PCBs in a ResourceArray. Returns the chunk index, or -1 if the maximum
+    // number of chunks exists or memory allocation failed.
+    int addChunk ()
+    {
+        for (std::size_t chunk_idx = 0; chunk_idx < NumChunks; chunk_idx++) {
+            if (m_chunks[chunk_idx] == nullptr) {
+                Chunk *chunk = new(std::nothrow) Chunk(
+                    ResourceArrayInitSame(), platform(), m_owner);
+                if (chunk == nullptr) {
+                    return -1;
+                }
+                
+                m_chunks[chunk_idx] = chunk;
+                
+                if (!m_timer.isSet()) {
+                    m_timer.setAfter(ReclaimTicks);
+                }
+                
+                return int(chunk_idx);
+            }
+        }
+        
+        return -1;
+    }
+    
+    // Destruct and free a chunk. The owner must have removed its PCBs from
+    // any data structures.
+    void removeChunk (std::size_t chunk_idx)
+    {
+        AIPSTACK_ASSERT(chunk_idx < NumChunks);
+        AIPSTACK_ASSERT(m_chunks[chunk_idx] != nullptr);
+        
+        delete m_chunks[chunk_idx];
+        m_chunks[chunk_idx] = nullptr;
+    }
+    
+    // Return a chunk, or null if the chunk does not exist.
+    inline Chunk * getChunk (std::size_t chunk_idx) const
+    {
+        AIPSTACK_ASSERT(chunk_idx < NumChunks);
+        
+        return m_chunks[chunk_idx];
+    }
+    
+    // Return the PCB with the given global index, the chunk must exist.
+    inline Pcb & getEntryAt (std::size_t index) const
+    {
+        Chunk *chunk = m_chunks[index / ChunkSize];
+        AIPSTACK_ASSERT(chunk != nullptr);
+        
+        return (*chunk)[index % ChunkSize];
+    }
+    
+    // Call func for each existing PCB.
+    template<typename Func>
+    void forEach (Func func) const
+    {
+        for (Chunk *chunk : m_chunks) {
+            if (chunk != nullptr) {
+                for (Pcb &pcb : *chunk) {
+                    func(pcb);
+                }
+            }
+        }
+    }
+    
+private:
+    void timerHandler ()
+    {
+        m_owner->pcb_pool_reclaim();
+        
+        for (Chunk *chunk : m_chunks) {
+            if (chunk != nullptr) {
+                m_timer.setAfter(ReclaimTicks);
+                break;
+            }
+        }
+    }
+    
+private:
+    typename Platform::Timer m_timer;
+    Owner *m_owner;
+    Chunk *m_chunks[NumChunks];
+};
+
+}
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_RATE_SAMPLER_H
+#define AIPSTACK_TCP_RATE_SAMPLER_H
+
+#include <cstdint>
+
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpCongCtrl.h>
+
+namespace AIpStack {
+
+/**
+ * A delivery rate sample produced by @ref TcpRateSampler.
+ */
+struct TcpRateSample {
+    // Amount of data delivered during the interval.
+    TcpSeqInt delivered;
+    
+    // Value of the delivered counter when the sampled segment was sent.
+    TcpSeqNum prior_delivered;
+    
+    // Length of the interval in clock units (may be zero).
+    std::uint32_t interval;
+    
+    // Round-trip time of the sampled segment in clock units.
+    std::uint32_t rtt;
+};
+
+/**
+ * Delivery rate estimation for congestion control algorithms
+ * (draft-cheng-iccrg-delivery-rate-estimation).
+ * 
+ * The sampler counts delivered (cumulatively acknowledged) data and remembers
+ * the state of the counter and related times for some sent segments. When such
+ * a segment is acknowledged, a rate sample is produced which covers the data
+ * delivered between the sending and the acknowledgement of the segment. The
+ * interval is the longer of the send and ACK intervals, which prevents ACK
+ * compression from causing overestimation.
+ * 
+ * Segments are selected for sampling such that they are spread over the
+ * window, giving up to NumRecords samples per round trip. Retransmissions make
+ * outstanding samples ambiguous, therefore they are discarded at that point.
+ * 
+ * @tparam ClockMask Mask for differences of times (see
+ *         IpTcpProto_constants::CcClockMask).
+ * @tparam NumRecords Maximum number of segments being sampled at a time.
+ */
+template<std::uint32_t ClockMask, std::uint8_t NumRecords>
+class TcpRateSampler
+{
+    static_assert(NumRecords > 0);
+    
+    struct Record {
+        // End sequence number of the segment.
+        TcpSeqNum end_seq;
+        // Delivered counter and time of its last change, when sent.
+        TcpSeqNum delivered;
+        std::uint32_t delivered_time;
+        // Time when the start of the send interval was sent.
+        std::uint32_t first_sent_time;
+        // Time when the segment was sent.
+        std::uint32_t sent_time;
+    };
+    
+    Record m_records[NumRecords];
+    TcpSeqNum m_delivered;
+    std::uint32_t m_delivered_time;
+    std::uint32_t m_first_sent_time;
+    std::uint8_t m_start;
+    std::uint8_t m_count;
+
+public:
+    void init (std::uint32_t now)
+    {
+        m_delivered = TcpSeqNum(0);
+        m_delivered_time = now;
+        m_first_sent_time = now;
+        m_start = 0;
+        m_count = 0;
+    }
+    
+    /**
+     * Return the counter of delivered data.
+     */
+    inline TcpSeqNum delivered () const
+    {
+        return m_delivered;
+    }
+    
+    /**
+     * Take note of a segment being sent.
+     * 
+     * @param ctx Congestion control context, flight_size must not yet include
+     *        the segment.
+     * @param end_seq End sequence number of the segment.
+     * @param rtx Whether the segment includes sequence space sent before.
+     */
+    void segmentSent (TcpCongCtrlContext const &ctx, TcpSeqNum end_seq, bool rtx)
+    {
+        if (rtx) {
+            m_count = 0;
+            return;
+        }
+        
+        // When sending starts with nothing in flight, start a new interval.
+        if (ctx.flight_size == 0) {
+            m_delivered_time = ctx.now;
+            m_first_sent_time = ctx.now;
+        }
+        
+        if (m_count == NumRecords) {
+            return;
+        }
+        
+        // Spread the sampled segments over the window.
+        if (m_count > 0) {
+            Record const &last = m_records[index(m_count - 1)];
+            if (end_seq - last.end_seq < ctx.cwnd / NumRecords) {
+                return;
+            }
+        }
+        
+        m_records[index(m_count)] = Record{
+            end_seq, m_delivered, m_delivered_time, m_first_sent_time, ctx.now};
+        m_count++;
+    }
+    
+    /**
+     * Take note of newly acknowledged data and produce a rate sample if a
+     * sampled segment has been acknowledged.
+     * 
+     * @param ctx Congestion control context.
+     * @param ack_num The ACK number.
+     * @param acked Amount of data newly acknowledged.
+     * @param sample On success, is set to the rate sample.
+     * @return Whether a sample was produced.
+     */
+    bool dataAcked (TcpCongCtrlContext const &ctx, TcpSeqNum ack_num, TcpSeqInt acked,
+                    TcpRateSample &sample)
+    {
+        m_delivered += acked;
+        m_delivered_time = ctx.now;
+        
+        // Find the most recently sent sampled segment which has been acked.
+        Record const *rec = nullptr;
+        while (m_count > 0 && !ack_num.mod_lt(m_records[m_start].end_seq)) {
+            rec = &m_records[m_start];
+            m_start = (m_start == NumRecords - 1) ? 0 : (m_start + 1);
+            m_count--;
+        }
+        
+        if (rec == nullptr) {
+            return false;
+        }
+        
+        // The next send interval starts at the sending of this segment.
+        m_first_sent_time = rec->sent_time;
+        
+        std::uint32_t send_elapsed = (rec->sent_time - rec->first_sent_time) & ClockMask;
+        std::uint32_t ack_elapsed = (m_delivered_time - rec->delivered_time) & ClockMask;
+        
+        sample.delivered = m_delivered - rec->delivered;
+        sample.prior_delivered = rec->delivered;
+        sample.interval = MaxValue(send_elapsed, ack_elapsed);
+        sample.rtt = (ctx.now - rec->sent_time) & ClockMask;
+        return true;
+    }
+
+private:
+    inline std::uint8_t index (std::uint8_t pos) const
+    {
+        std::uint8_t i = m_start + pos;
+        return (i >= NumRecords) ? (i - NumRecords) : i;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_SACK_SCOREBOARD_H
+#define AIPSTACK_TCP_SACK_SCOREBOARD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include <aipstack/meta/ChooseInt.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpOptions.h>
+
+namespace AIpStack {
+
+/**
+ * Keeps track of sent data which the receiver has reported as received
+ * using SACK blocks (RFC 2018).
+ * 
+ * It keeps up to a statically configured number of non-overlapping and
+ * non-touching ranges of sequence numbers, in sequence order. All ranges
+ * are within [snd_una, snd_nxt]. When there is no more
+ * space for a new range, the range with the highest sequence numbers is
+ * forgotten, which is harmless since it only results in more retransmission.
+ * 
+ * @tparam NumBlocks Maximum number of ranges (must be positive).
+ */
+template<std::size_t NumBlocks>
+class TcpSackScoreboard
+{
+    static_assert(NumBlocks > 0);
+    using IndexType = ChooseIntForMax<NumBlocks, false>;
+
+private:
+    IndexType m_num_blocks;
+    TcpSackBlock m_blocks[NumBlocks];
+
+public:
+    /**
+     * Initialize (clear) the scoreboard.
+     */
+    inline void init ()
+    {
+        m_num_blocks = 0;
+    }
+    
+    /**
+     * Check if no SACKed data is known.
+     */
+    inline bool isEmpty () const
+    {
+        return m_num_blocks == 0;
+    }
+    
+    /**
+     * Add SACK blocks received in a segment.
+     * 
+     * Any part of a block before snd_una is trimmed, and blocks which do not
+     * end within (snd_una, snd_nxt] are ignored.
+     * 
+     * @param snd_una The snd_una of the PCB before processing the segment.
+     * @param snd_nxt The snd_nxt of the PCB.
+     * @param blocks Received SACK blocks.
+     * @param num_blocks Number of received SACK blocks.
+     */
+    void addBlocks (TcpSeqNum snd_una, TcpSeqNum snd_nxt,
+                    TcpSackBlock const *blocks, std::uint8_t num_blocks)
+    {
+        for (std::uint8_t i = 0; i < num_blocks; i++) {
+            TcpSackBlock block = blocks[i];
+            
+            // Ignore the block unless its end is within (snd_una, snd_nxt].
+            if (block.end == snd_una || !snd_una.ref_lte(block.end, snd_nxt)) {
+                continue;
+            }
+            
+            // Trim any part before snd_una, ignore the block if it is inverted.
+            if (block.start.mod_lt(snd_una)) {
+                block.start = snd_una;
+            }
+            if (!snd_una.ref_lt(block.start, block.end)) {
+                continue;
+            }
+            
+            add_block(snd_una, block);
+        }
+    }
+    
+    /**
+     * Remove information about data that has been cumulatively acknowledged.
+     * 
+     * A range which would start at or before the new snd_una after trimming
+     * is removed. Such a range indicates that the receiver has discarded
+     * data that it has reported with SACK (reneging), so the data must
+     * not be considered received any more.
+     * 
+     * @param old_snd_una The snd_una before it was updated.
+     * @param new_snd_una The new snd_una.
+     */
+    void ackReceived (TcpSeqNum old_snd_una, TcpSeqNum new_snd_una)
+    {
+        IndexType pos = 0;
+        while (pos < m_num_blocks &&
+               !old_snd_una.ref_lt(new_snd_una, m_blocks[pos].start))
+        {
+            pos++;
+        }
+        
+        if (pos > 0) {
+            std::move(&m_blocks[pos], &m_blocks[m_num_blocks], &m_blocks[0]);
+            m_num_blocks -= pos;
+        }
+    }
+    
+    /**
+     * Find the first hole (range of data not reported by SACK) which starts
+     * at or after a given sequence number and is followed by SACKed data.
+     * 
+     * @param snd_una The snd_una of the PCB.
+     * @param from Sequence number to start looking at (>= snd_una).
+     * @param hole_start Set to the start of the hole if found.
+     * @param hole_len Set to the length of the hole if found.
+     * @return Whether a hole was found.
+     */
+    bool findHole (TcpSeqNum snd_una, TcpSeqNum from,
+                   TcpSeqNum &hole_start, TcpSeqInt &hole_len) const
+    {
+        TcpSeqNum pos = from;
+        
+        for (IndexType i = 0; i < m_num_blocks; i++) {
+            TcpSackBlock const &block = m_blocks[i];
+            
+            if (snd_una.ref_lte(block.end, pos)) {
+                continue;
+            }
+            
+            if (snd_una.ref_lte(block.start, pos)) {
+                pos = block.end;
+                continue;
+            }
+            
+            hole_start = pos;
+            hole_len = block.start - pos;
+            return true;
+        }
+        
+        return false;
+    }
+    
+    /**
+     * Return the length of SACKed data starting at the given sequence number,
+     * or zero if the sequence number is not within SACKed data.
+     * 
+     * @param snd_una The snd_una of the PCB.
+     * @param seq Sequence number (>= snd_una).
+     */
+    TcpSeqInt getSackedLen (TcpSeqNum snd_una, TcpSeqNum seq) const
+    {
+        for (IndexType i = 0; i < m_num_blocks; i++) {
+            TcpSackBlock const &block = m_blocks[i];
+            
+            if (snd_una.ref_lt(seq, block.start)) {
+                break;
+            }
+            
+            if (snd_una.ref_lt(seq, block.end)) {
+                return block.end - seq;
+            }
+        }
+        
+        return 0;
+    }
+    
+    /**
+     * Return the total length of SACKed data.
+     */
+    TcpSeqInt getTotalSackedLen () const
+    {
+        TcpSeqInt len = 0;
+        for (IndexType i = 0; i < m_num_blocks; i++) {
+            len += m_blocks[i].end - m_blocks[i].start;
+        }
+        return len;
+    }
+
+private:
+    void add_block (TcpSeqNum ref, TcpSackBlock block)
+    {
+        // Skip over ranges strictly before the new block.
+        IndexType pos = 0;
+        while (pos < m_num_blocks && ref.ref_lt(m_blocks[pos].end, block.start)) {
+            pos++;
+        }
+        
+        // Determine the ranges which intersect or touch the new block
+        // and merge them into it.
+        IndexType end_pos = pos;
+        while (end_pos < m_num_blocks && !ref.ref_lt(block.end, m_blocks[end_pos].start)) {
+            if (ref.ref_lt(m_blocks[end_pos].start, block.start)) {
+                block.start = m_blocks[end_pos].start;
+            }
+            if (ref.ref_lt(block.end, m_blocks[end_pos].end)) {
+                block.end = m_blocks[end_pos].end;
+            }
+            end_pos++;
+        }
+        
+        if (end_pos > pos) {
+            // Replace the merged ranges with the new block.
+            m_blocks[pos] = block;
+            if (end_pos > pos + 1) {
+                std::move(&m_blocks[end_pos], &m_blocks[m_num_blocks], &m_blocks[pos + 1]);
+                m_num_blocks -= end_pos - (pos + 1);
+            }
+        } else {
+            // Insert the new block at pos, forgetting the last range if there is
+            // no space. If the new block would be the last, it is itself dropped.
+            if (m_num_blocks == NumBlocks) {
+                if (pos == NumBlocks) {
+                    return;
+                }
+                m_num_blocks--;
+            }
+            std::move_backward(
+                &m_blocks[pos], &m_blocks[m_num_blocks], &m_blocks[m_num_blocks + 1]);
+            m_blocks[pos] = block;
+            m_num_blocks++;
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_STATS_H
+#define AIPSTACK_TCP_STATS_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/ip/IpStackStats.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpState.h>
+
+namespace AIpStack {
+
+/**
+ * Event counters of a TCP connection.
+ * 
+ * The counters are only maintained if the EnableStats option of the TCP
+ * protocol is enabled, otherwise they are all zero. The counters wrap around
+ * on overflow.
+ * 
+ * The cwnd_limited, rwnd_limited and app_limited counters count the times
+ * that sending of new data stopped for the respective reason: because the
+ * congestion window was used up, because the receiver window was used up,
+ * or because there was no more data to send.
+ */
+struct TcpConnectionCounters {
+    // Data and FIN segments sent, including retransmissions.
+    std::uint32_t data_segs_sent = 0;
+    
+    // Retransmitted segments.
+    std::uint32_t rtx_segs = 0;
+    
+    // Expirations of the retransmission timer.
+    std::uint32_t rto_expired = 0;
+    
+    // Entries into fast recovery.
+    std::uint32_t fast_recoveries = 0;
+    
+    // Tail loss probes sent (RACK-TLP).
+    std::uint32_t tail_loss_probes = 0;
+    
+    // Received segments with the CE codepoint (ECN).
+    std::uint32_t ecn_ce_received = 0;
+    
+    // Congestion window reductions due to ECN-Echo.
+    std::uint32_t ecn_reductions = 0;
+    
+    // Received duplicate ACKs.
+    std::uint32_t dup_acks = 0;
+    
+    // Received segments.
+    std::uint32_t segs_received = 0;
+    
+    // Received out-of-sequence segments with data or FIN.
+    std::uint32_t oos_segs = 0;
+    
+    // Received segments handled by header prediction.
+    std::uint32_t predicted_segs = 0;
+    
+    // Times that the send window reported by the peer became zero.
+    std::uint32_t zero_wnd_stalls = 0;
+    
+    // Reasons for stopping sending of new data (see above).
+    std::uint32_t cwnd_limited = 0;
+    std::uint32_t rwnd_limited = 0;
+    std::uint32_t app_limited = 0;
+};
+
+/**
+ * Snapshot of the state of a TCP connection, as returned by
+ * @ref TcpConnection::getStats.
+ * 
+ * Times are in microseconds. The RTT values are only meaningful if
+ * rtt_valid is true, that is after the first RTT measurement.
+ */
+struct TcpConnectionStats {
+    TcpState state = TcpStates::CLOSED;
+    bool rtt_valid = false;
+    bool in_recovery = false;
+    std::uint32_t srtt_us = 0;
+    std::uint32_t rttvar_us = 0;
+    std::uint32_t rto_us = 0;
+    TcpSeqInt cwnd = 0;
+    TcpSeqInt ssthresh = 0;
+    TcpSeqInt snd_wnd = 0;
+    TcpSeqInt rcv_wnd = 0;
+    std::uint8_t snd_wnd_shift = 0;
+    std::uint8_t rcv_wnd_shift = 0;
+    TcpSeqInt snd_unacked = 0;
+    std::uint16_t snd_mss = 0;
+    std::size_t snd_buf_len = 0;
+    std::size_t rcv_buf_len = 0;
+    TcpConnectionCounters counters;
+};
+
+/**
+ * Stack-wide TCP counters, as returned by @ref TcpApi::getStats.
+ * 
+ * The counters are only maintained if the EnableStats option of the TCP
+ * protocol is enabled, otherwise they are all zero. The counters wrap around
+ * on overflow.
+ */
+struct TcpProtoStats {
+    // Received segments (with a valid checksum).
+    std::uint32_t segs_received = 0;
+    
+    // Received segments dropped due to a bad checksum.
+    std::uint32_t bad_chksum = 0;
+    
+    // Data and FIN segments sent by all connections.
+    std::uint32_t data_segs_sent = 0;
+    
+    // Segments retransmitted by all connections.
+    std::uint32_t rtx_segs = 0;
+    
+    // Expirations of the retransmission timer of all connections.
+    std::uint32_t rto_expired = 0;
+    
+    // Sent RST segments.
+    std::uint32_t rsts_sent = 0;
+    
+    // Connections started using TcpConnection::startConnection.
+    std::uint32_t active_opens = 0;
+    
+    // Connections created due to a SYN received by a listener.
+    std::uint32_t passive_opens = 0;
+    
+    // SYN-ACK segments sent with a SYN cookie.
+    std::uint32_t syn_cookies_sent = 0;
+    
+    // Zero window probes sent by the shared persist timer (only with the
+    // SharedPersistTimer option).
+    std::uint32_t window_probes = 0;
+    
+    // Current number of connections probing a zero window, which is not a
+    // counter (only with the SharedPersistTimer option).
+    std::uint32_t wnd_stalled_pcbs = 0;
+};
+
+/**
+ * Memory usage of TCP, as returned by @ref TcpApi::getMemoryStats.
+ * 
+ * The send and receive buffers are provided by the application, the values
+ * here are how much of them is referenced by TCP.
+ */
+struct TcpMemoryStats {
+    // PCBs, objects are PCBs not in the CLOSED state. The static bytes are zero
+    // if the PCBs are in the growable pool (PcbPoolChunkSize option), in which
+    // case the dynamic bytes are those of the allocated chunks.
+    IpMemoryUsage pcbs;
+    
+    // Total length of send buffers of connections (data queued for sending,
+    // including data sent but not yet acknowledged).
+    std::size_t snd_buf_bytes = 0;
+    
+    // Total length of receive buffers of connections (space available for
+    // received data).
+    std::size_t rcv_buf_bytes = 0;
+};
+
+/**
+ * Histogram of durations with logarithmic buckets.
+ * 
+ * Bucket 0 counts durations below one millisecond and bucket i for i>0
+ * counts durations of at least 2^(i-1) and less than 2^i milliseconds,
+ * except that the last bucket also counts all longer durations.
+ */
+struct TcpTimeHistogram {
+    inline static constexpr std::size_t NumBuckets = 16;
+    
+    std::uint32_t buckets[NumBuckets] = {};
+    
+    /**
+     * Count a duration.
+     * 
+     * @param time_ms The duration in milliseconds.
+     */
+    inline void add (std::uint32_t time_ms)
+    {
+        std::size_t bucket = 0;
+        while (time_ms > 0 && bucket < NumBuckets - 1) {
+            time_ms >>= 1;
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+};
+
+/**
+ * Statistics of a TCP listener, as returned by @ref TcpListener::getStats.
+ * 
+ * The statistics are only maintained if the EnableStats option of the TCP
+ * protocol is enabled, otherwise they are all zero. They are reset when the
+ * listener starts listening. The counters wrap around on overflow.
+ */
+struct TcpListenerStats {
+    // Received SYN segments for new connections (including retransmissions
+    // of SYNs that were refused or answered with a SYN cookie).
+    std::uint32_t syns_received = 0;
+    
+    // SYNs refused because the listener already had max_pcbs PCBs.
+    std::uint32_t syns_refused_backlog = 0;
+    
+    // SYNs (or ACKs of SYN cookies) refused because no PCB could be allocated.
+    std::uint32_t syns_refused_no_pcb = 0;
+    
+    // SYN-ACK segments sent with a SYN cookie.
+    std::uint32_t syn_cookies_sent = 0;
+    
+    // ACKs without data completing the handshake which were ignored due to
+    // deferred accept (see TcpListener::setDeferAccept).
+    std::uint32_t deferred_acks = 0;
+    
+    // Connections reported by the EstablishedHandler callback.
+    std::uint32_t established = 0;
+    
+    // Connections accepted using TcpConnection::acceptConnection.
+    std::uint32_t accepted = 0;
+    
+    // Current number of PCBs of the listener, that is connections in SYN_RCVD
+    // state or not yet accepted, which is limited by max_pcbs (not a counter).
+    std::uint32_t backlog_pcbs = 0;
+    
+    // Highest number of PCBs of the listener (not a counter).
+    std::uint32_t backlog_peak = 0;
+    
+    // Time from creation of the PCB (reception of the SYN, or of the ACK
+    // for a SYN cookie) to acceptance of the connection.
+    TcpTimeHistogram syn_to_accept_time;
+};
+
+#ifndef IN_DOXYGEN
+
+// Holds a set of counters, or nothing if statistics are disabled.
+template<bool Enabled, typename Counters>
+class TcpStatsCounters {
+    Counters m_counters;
+
+public:
+    inline void reset ()
+    {
+        m_counters = Counters();
+    }
+    
+    inline void inc (std::uint32_t Counters::*counter)
+    {
+        m_counters.*counter += 1;
+    }
+    
+    inline void updateMax (std::uint32_t Counters::*counter, std::uint32_t value)
+    {
+        m_counters.*counter = MaxValue(m_counters.*counter, value);
+    }
+    
+    inline void addTime (TcpTimeHistogram Counters::*histogram, std::uint32_t time_ms)
+    {
+        (m_counters.*histogram).add(time_ms);
+    }
+    
+    inline Counters get () const
+    {
+        return m_counters;
+    }
+};
+
+template<typename Counters>
+class TcpStatsCounters<false, Counters> {
+public:
+    inline void reset () {}
+    
+    inline void inc (std::uint32_t Counters::*) {}
+    
+    inline void updateMax (std::uint32_t Counters::*, std::uint32_t) {}
+    
+    inline void addTime (TcpTimeHistogram Counters::*, std::uint32_t) {}
+    
+    inline Counters get () const
+    {
+        return Counters();
+    }
+};
+
+// Holds a time value, or nothing if statistics are disabled.
+template<bool Enabled, typename TimeType>
+class TcpStatsTime {
+    TimeType m_time;
+
+public:
+    inline void set (TimeType time)
+    {
+        m_time = time;
+    }
+    
+    inline TimeType get () const
+    {
+        return m_time;
+    }
+};
+
+template<typename TimeType>
+class TcpStatsTime<false, TimeType> {
+public:
+    inline void set (TimeType) {}
+    
+    inline TimeType get () const
+    {
+        return 0;
+    }
+};
+
+#endif
+
+}
+
+#endif
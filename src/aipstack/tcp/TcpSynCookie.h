@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_SYN_COOKIE_H
+#define AIPSTACK_TCP_SYN_COOKIE_H
+
+#include <cstdint>
+
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Hash.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpOptions.h>
+#include <aipstack/tcp/TcpPcbKey.h>
+
+namespace AIpStack {
+
+// Encoding and validation of SYN cookies (RFC 4987). A SYN cookie is the initial
+// sequence number of a SYN-ACK sent without allocating a PCB. It encodes the options
+// of the SYN that are needed to create the connection when the ACK arrives, a
+// coarse time counter and a MAC over these and the connection identification.
+//
+// Layout (from the least significant bit):
+// - bit 0: timestamps option was received,
+// - bit 1: SACK-permitted option was received,
+// - bits 2-5: received window scale (NoWndScale if no window scale option),
+// - bits 6-8: index in MssTable of the largest MSS not above the received MSS,
+// - bits 9-11: time counter modulo CounterModulo,
+// - bits 12-31: MAC.
+class TcpSynCookie {
+    inline static constexpr std::uint16_t MssTable[] = {
+        536, 1220, 1360, 1400, 1440, 1460, 4312, 8960};
+    inline static constexpr int NumMss = sizeof(MssTable) / sizeof(MssTable[0]);
+    
+    inline static constexpr std::uint32_t TimestampsBit = 1;
+    inline static constexpr std::uint32_t SackPermBit = 2;
+    inline static constexpr int WndScalePos = 2;
+    inline static constexpr std::uint32_t NoWndScale = 15;
+    inline static constexpr int MssPos = 6;
+    inline static constexpr int CounterPos = 9;
+    inline static constexpr int MacPos = 12;
+    
+    inline static constexpr std::uint32_t ParamsMask = (std::uint32_t(1) << MacPos) - 1;
+
+public:
+    // The number of distinct time counter values encoded in a cookie.
+    inline static constexpr std::uint32_t CounterModulo = 8;
+    
+    // A cookie is accepted if it was made at most this many counter periods ago.
+    inline static constexpr std::uint32_t MaxAge = 1;
+    
+    // Make a cookie for a received SYN with the given key, sequence number and
+    // options. Returns false if a cookie cannot be made because the received MSS
+    // is too small to be encoded.
+    static bool make (std::uint32_t secret, TcpPcbKey const &key, TcpSeqNum peer_isn,
+                      std::uint32_t counter, TcpOptions const &opts, TcpSeqNum &cookie)
+    {
+        int mss_index = 0;
+        if ((opts.options & TcpOptionFlags::Mss) != Enum0) {
+            if (opts.mss < MssTable[0]) {
+                return false;
+            }
+            while (mss_index + 1 < NumMss && MssTable[mss_index + 1] <= opts.mss) {
+                mss_index++;
+            }
+        }
+        
+        std::uint32_t wnd_scale = ((opts.options & TcpOptionFlags::WndScale) != Enum0) ?
+            MinValue(std::uint8_t(14), opts.wnd_scale) : NoWndScale;
+        
+        std::uint32_t params =
+            (((opts.options & TcpOptionFlags::Timestamps) != Enum0) ? TimestampsBit : 0) |
+            (((opts.options & TcpOptionFlags::SackPerm) != Enum0) ? SackPermBit : 0) |
+            (wnd_scale << WndScalePos) |
+            (std::uint32_t(mss_index) << MssPos) |
+            ((counter % CounterModulo) << CounterPos);
+        
+        cookie = TcpSeqNum(calcMac(secret, key, peer_isn, counter, params) | params);
+        return true;
+    }
+    
+    // Check a cookie acknowledged by an ACK with the given key and sequence number,
+    // where counter is the current time counter and counter_mask the mask which the
+    // counter wraps around with. If the cookie is valid, returns true and sets the
+    // options which had been received in the SYN (the MSS is rounded down).
+    static bool check (std::uint32_t secret, TcpPcbKey const &key, TcpSeqNum peer_isn,
+                       std::uint32_t counter, std::uint32_t counter_mask,
+                       TcpSeqNum cookie, TcpOptions &opts)
+    {
+        std::uint32_t params = cookie.value() & ParamsMask;
+        
+        std::uint32_t age = (counter - (params >> CounterPos)) % CounterModulo;
+        if (age > MaxAge) {
+            return false;
+        }
+        
+        std::uint32_t cookie_counter = (counter - age) & counter_mask;
+        if ((cookie.value() & ~ParamsMask) !=
+            calcMac(secret, key, peer_isn, cookie_counter, params))
+        {
+            return false;
+        }
+        
+        std::uint32_t wnd_scale = (params >> WndScalePos) & 15;
+        
+        opts.options = TcpOptionFlags::Mss;
+        opts.mss = MssTable[(params >> MssPos) & 7];
+        if (wnd_scale != NoWndScale) {
+            opts.options |= TcpOptionFlags::WndScale;
+            opts.wnd_scale = std::uint8_t(wnd_scale);
+        }
+        if ((params & SackPermBit) != 0) {
+            opts.options |= TcpOptionFlags::SackPerm;
+        }
+        if ((params & TimestampsBit) != 0) {
+            opts.options |= TcpOptionFlags::Timestamps;
+        }
+        
+        return true;
+    }
+
+private:
+    static std::uint32_t calcMac (std::uint32_t secret, TcpPcbKey const &key,
+        TcpSeqNum peer_isn, std::uint32_t counter, std::uint32_t params)
+    {
+        HashAccumulator hash(secret);
+        hash.addWord(key.local_addr.value());
+        hash.addWord(key.remote_addr.value());
+        hash.addWord((std::uint32_t(key.local_port) << 16) | key.remote_port);
+        hash.addWord(peer_isn.value());
+        hash.addWord(counter);
+        hash.addWord(params);
+        return hash.getHash() & ~ParamsMask;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_TIME_WAIT_TABLE_H
+#define AIPSTACK_TCP_TIME_WAIT_TABLE_H
+
+#include <cstdint>
+
+#include <aipstack/meta/ChooseInt.h>
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/tcp/TcpSeqNum.h>
+#include <aipstack/tcp/TcpPcbKey.h>
+
+namespace AIpStack {
+
+/**
+ * Table of compact records of connections in TIME_WAIT state.
+ * 
+ * Each entry keeps just what is needed to respond to segments
+ * received in TIME_WAIT, so that the full PCB can be released when
+ * TIME_WAIT is entered. Entries which are in use are kept in a queue
+ * ordered by expiration time, and a single timer is used to expire the
+ * entry at the front. This relies on the timeout being the same for all
+ * entries. When all entries are in use, the oldest one is reused.
+ */
+template<typename PlatformImpl, typename IndexService, int NumEntries>
+class TcpTimeWaitTable :
+    private NonCopyable<TcpTimeWaitTable<PlatformImpl, IndexService, NumEntries>>
+{
+    static_assert(NumEntries > 0);
+    
+    using Platform = PlatformFacade<PlatformImpl>;
+    AIPSTACK_USE_TYPES(Platform, (TimeType))
+
+public:
+    struct Entry;
+
+private:
+    using IndexType = ChooseIntForMax<NumEntries, false>;
+    inline static constexpr IndexType IndexNull = IndexType(-1);
+    
+    struct EntriesAccessor;
+    using LinkModel = ArrayLinkModelWithAccessor<
+        Entry, IndexType, IndexNull, TcpTimeWaitTable, EntriesAccessor>;
+    
+    // Index of entries which are in use by address tuple.
+    struct EntryIndexAccessor;
+    using EntryIndexLookupKeyArg = TcpPcbKey const &;
+    struct EntryIndexKeyFuncs;
+    AIPSTACK_MAKE_INSTANCE(EntryIndex, (IndexService::template Index<
+        EntryIndexAccessor, EntryIndexLookupKeyArg, EntryIndexKeyFuncs, LinkModel,
+        /*Duplicates=*/false>))
+    
+    // List of entries, used for the free list and for the expiration queue.
+    struct EntryListAccessor;
+    using EntryList = LinkedList<EntryListAccessor, LinkModel, true>;
+
+public:
+    // A TIME_WAIT entry. The fields other than the key are filled in by the user.
+    struct Entry : public TcpPcbKey {
+        typename EntryIndex::Node index_node;
+        LinkedListNode<LinkModel> list_node;
+        
+        // Time when the entry expires.
+        TimeType expire_time;
+        
+        // Sequence numbers to be used in ACKs.
+        TcpSeqNum snd_nxt;
+        TcpSeqNum rcv_nxt;
+        
+        // Timestamp to be echoed, valid if timestamps is true.
+        std::uint32_t ts_recent;
+        
+        // Window size value (already scaled) to be used in ACKs.
+        std::uint16_t rcv_wnd;
+        
+        // Whether the timestamps option is to be included in ACKs.
+        bool timestamps;
+    };
+    
+    TcpTimeWaitTable (Platform platform) :
+        m_timer(platform, AIPSTACK_BIND_MEMBER_TN(&TcpTimeWaitTable::timerHandler, this))
+    {
+        for (Entry &entry : m_entries) {
+            m_free_list.append({entry, *this}, *this);
+        }
+    }
+    
+    // Find the entry for an address tuple, returns null if there is none.
+    inline Entry * findEntry (TcpPcbKey const &key)
+    {
+        return m_index.findEntry(key, *this);
+    }
+    
+    // Add an entry for an address tuple which must not already have an entry.
+    // The entry will expire after the given timeout, which must be the same
+    // for all entries.
+    Entry & addEntry (TcpPcbKey const &key, TimeType timeout)
+    {
+        AIPSTACK_ASSERT(findEntry(key) == nullptr);
+        
+        // Take a free entry if possible, otherwise reuse the oldest entry.
+        Entry *entry;
+        if (!m_free_list.isEmpty()) {
+            entry = m_free_list.first(*this);
+            m_free_list.removeFirst(*this);
+        } else {
+            entry = m_queue.first(*this);
+            m_queue.removeFirst(*this);
+            m_index.removeEntry({*entry, *this}, *this);
+        }
+        
+        static_cast<TcpPcbKey &>(*entry) = key;
+        m_index.addEntry({*entry, *this}, *this);
+        
+        enqueue_entry(*entry, timeout);
+        
+        return *entry;
+    }
+    
+    // Remove an entry.
+    void removeEntry (Entry &entry)
+    {
+        Entry *first = m_queue.first(*this);
+        bool was_first = &entry == first;
+        
+        m_index.removeEntry({entry, *this}, *this);
+        m_queue.remove({entry, *this}, *this);
+        m_free_list.prepend({entry, *this}, *this);
+        
+        if (was_first) {
+            update_timer();
+        }
+    }
+    
+    // Restart the timeout of an entry.
+    void restartEntry (Entry &entry, TimeType timeout)
+    {
+        m_queue.remove({entry, *this}, *this);
+        enqueue_entry(entry, timeout);
+    }
+
+private:
+    void enqueue_entry (Entry &entry, TimeType timeout)
+    {
+        entry.expire_time = m_timer.platform().getEventTime() + timeout;
+        m_queue.append({entry, *this}, *this);
+        
+        // The timer is always set for the entry at the front.
+        update_timer();
+    }
+    
+    void update_timer ()
+    {
+        if (m_queue.isEmpty()) {
+            m_timer.unset();
+        } else {
+            m_timer.setAt((*m_queue.first(*this)).expire_time);
+        }
+    }
+    
+    void timerHandler ()
+    {
+        // Remove all expired entries from the front of the queue.
+        TimeType now = m_timer.platform().getEventTime();
+        
+        while (!m_queue.isEmpty()) {
+            Entry &entry = *m_queue.first(*this);
+            if (!Platform::timeGreaterOrEqual(now, entry.expire_time)) {
+                break;
+            }
+            
+            m_index.removeEntry({entry, *this}, *this);
+            m_queue.removeFirst(*this);
+            m_free_list.prepend({entry, *this}, *this);
+        }
+        
+        update_timer();
+    }
+    
+    struct EntryIndexAccessor : public
+        MemberAccessor<Entry, typename EntryIndex::Node, &Entry::index_node> {};
+    struct EntryListAccessor : public
+        MemberAccessor<Entry, LinkedListNode<LinkModel>, &Entry::list_node> {};
+    
+    struct EntryIndexKeyFuncs : public TcpPcbKeyCompare {
+        inline static TcpPcbKey const & GetKeyOfEntry (Entry const &entry)
+        {
+            return entry;
+        }
+    };
+
+private:
+    typename Platform::Timer m_timer;
+    StructureRaiiWrapper<typename EntryIndex::Index> m_index;
+    StructureRaiiWrapper<EntryList> m_free_list;
+    StructureRaiiWrapper<EntryList> m_queue;
+    Entry m_entries[NumEntries];
+    
+    struct EntriesAccessor : public
+        MemberAccessor<TcpTimeWaitTable, Entry[NumEntries],
+                       &TcpTimeWaitTable::m_entries> {};
+};
+
+}
+
+#endif
@@ -27,6 +27,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
 
 #include <aipstack/meta/BasicMetaUtils.h>
 #include <aipstack/misc/Use.h>
@@ -34,9 +35,9 @@
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/Hints.h>
 #include <aipstack/misc/MinMax.h>
-#include <aipstack/misc/IntRange.h>
 #include <aipstack/misc/Function.h>
 #include <aipstack/misc/EnumUtils.h>
+#include <aipstack/misc/Hash.h>
 #include <aipstack/structure/LinkedList.h>
 #include <aipstack/structure/LinkModel.h>
 #include <aipstack/structure/StructureRaiiWrapper.h>
@@ -46,6 +47,7 @@
 #include <aipstack/infra/Instance.h>
 #include <aipstack/infra/Err.h>
 #include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
 #include <aipstack/infra/Chksum.h>
 #include <aipstack/infra/SendRetry.h>
 #include <aipstack/proto/Ip4Proto.h>
@@ -54,6 +56,9 @@
 #include <aipstack/platform/PlatformFacade.h>
 #include <aipstack/ip/IpAddr.h>
 #include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpMcastMembership.h>
+#include <aipstack/ip/IpEphemeralPortAllocator.h>
+#include <aipstack/ip/IpFlowSteering.h>
 
 namespace AIpStack {
 
@@ -78,6 +83,16 @@ struct UdpListenParams {
     bool accept_broadcast = false;
     bool accept_nonlocal_dst = false;
     IpIface<typename Arg::StackArg> *iface = nullptr;
+    Ip4Addr mcast_group = Ip4Addr::ZeroAddr();
+    // If true, the listener may be given datagrams whose checksum has not been
+    // verified yet (UdpRxInfo::checksum_pending), so that verification can be
+    // combined with copying the data (UdpApi::copyVerifyUdpData).
+    bool defer_checksum = false;
+    // If true, the listener may form a reuse-port group with other listeners
+    // which also set reuse_port and have the same parameters (except for
+    // defer_checksum). A datagram matching the group is then given to only one
+    // member, selected by a hash of the 4-tuple.
+    bool reuse_port = false;
 };
 
 template<typename Arg>
@@ -85,6 +100,12 @@ struct UdpRxInfo {
     std::uint16_t src_port;
     std::uint16_t dst_port;
     bool has_checksum;
+    // If true, the checksum still needs to be verified, which should be done
+    // using UdpApi::copyVerifyUdpData. This is only the case for listeners and
+    // associations with defer_checksum.
+    bool checksum_pending;
+    // Partial checksum of the pseudo-header and UDP header, if checksum_pending.
+    IpChksumAccumulator::State checksum_state;
 };
 
 enum class UdpRecvResult {
@@ -99,6 +120,13 @@ struct UdpTxInfo {
     std::uint16_t dst_port;
 };
 
+template<typename Arg>
+struct UdpTxEntry {
+    Ip4AddrPair addrs;
+    UdpTxInfo<Arg> udp_info;
+    IpBufRef udp_data;
+};
+
 struct UdpAssociationKey {
     Ip4Addr local_addr;
     Ip4Addr remote_addr;
@@ -110,6 +138,8 @@ template<typename Arg>
 struct UdpAssociationParams {
     UdpAssociationKey key;
     bool accept_nonlocal_dst = false;
+    // See UdpListenParams::defer_checksum.
+    bool defer_checksum = false;
 };
 
 template<typename Arg>
@@ -149,6 +179,37 @@ public:
     inline static constexpr std::size_t MaxUdpDataLenIp4 =
         TypeMax<std::uint16_t> - Udp4Header::Size;
 
+    inline static constexpr std::size_t MaxUdpSegDataLenIp4 =
+        TypeMax<std::uint16_t> - Ip4Header::Size - Udp4Header::Size;
+    
+    // Copy received UDP data to dst (which must be at least as long) and
+    // complete any pending checksum verification in the same pass. Returns
+    // false if the checksum is bad, in which case the datagram should be
+    // discarded. If the checksum is not pending, this is just a copy.
+    static bool copyVerifyUdpData (UdpRxInfo<Arg> const &udp_info, IpBufRef udp_data,
+                                   IpBufRef dst)
+    {
+        AIPSTACK_ASSERT(dst.tot_len >= udp_data.tot_len);
+        
+        if (!udp_info.checksum_pending) {
+            ipBufGiveBuf(dst, udp_data);
+            return true;
+        }
+        
+        IpChksumAccumulator::State state =
+            ipBufCopyAndChksum(dst, udp_data, udp_info.checksum_state);
+        return IpChksumAccumulator(state).getChksum() == 0;
+    }
+    
+    // Set the flow steering configuration (or null to disable). When set,
+    // ephemeral ports for associations are only chosen such that datagrams from
+    // the remote side are steered to this shard (IpFlowSteering::isOwnFlow).
+    // The object must remain valid while it is set.
+    inline void setFlowSteering (IpFlowSteering const *steering)
+    {
+        proto().m_flow_steering = steering;
+    }
+    
     IpErr sendUdpIp4Packet (Ip4AddrPair const &addrs, UdpTxInfo<Arg> const &udp_info,
                             IpBufRef udp_data, IpIface<StackArg> *iface,
                             IpSendRetryRequest *retryReq, IpSendFlags send_flags)
@@ -164,23 +225,166 @@ public:
         udp_header.set(Udp4Header::SrcPort(),  udp_info.src_port);
         udp_header.set(Udp4Header::DstPort(),  udp_info.dst_port);
         udp_header.set(Udp4Header::Length(),   std::uint16_t(dgram.tot_len));
-        udp_header.set(Udp4Header::Checksum(), 0);
         
-        // Calculate UDP checksum.
+        // Write only the pseudo-header sum into the checksum field. The IP layer
+        // will complete the checksum, in software or by offloading to the
+        // interface (it also takes care of replacing a zero checksum).
         IpChksumAccumulator chksum_accum;
         chksum_accum.addWord(WrapType<std::uint32_t>(), addrs.local_addr.value());
         chksum_accum.addWord(WrapType<std::uint32_t>(), addrs.remote_addr.value());
         chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Udp));
         chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
-        std::uint16_t checksum = chksum_accum.getChksum(dgram);
-        if (checksum == 0) {
-            checksum = TypeMax<std::uint16_t>;
-        }
-        udp_header.set(Udp4Header::Checksum(), checksum);
+        udp_header.set(Udp4Header::Checksum(), chksum_accum.getChksumInverted());
         
         // Send the datagram.
+        proto().m_stack->incStat(&IpStackStats::udp_out_datagrams);
         return proto().m_stack->sendIp4Dgram(dgram, iface, retryReq,
+            Ip4CommonSendParams{addrs, UdpTTL, Ip4Protocol::Udp,
+                send_flags|IpSendFlags::ChksumPartialFlag});
+    }
+    
+    // Send a burst of datagrams to one destination, splitting udp_data into
+    // datagrams with seg_size bytes of data each (the last one may be shorter).
+    // The headers are built once and reused for all datagrams, and the whole
+    // burst is passed to the driver as one packet if the interface supports UDP
+    // segmentation offload. The length of udp_data must not exceed
+    // MaxUdpSegDataLenIp4, and IpErr::FragmentationNeeded is returned if a
+    // datagram would not fit into the MTU. The send_flags are as for
+    // sendUdpIp4Packet. If an error occurs while sending, some leading
+    // datagrams may have been sent.
+    IpErr sendUdpIp4PacketSeg (Ip4AddrPair const &addrs, UdpTxInfo<Arg> const &udp_info,
+                               IpBufRef udp_data, std::uint16_t seg_size,
+                               IpSendRetryRequest *retryReq, IpSendFlags send_flags)
+    {
+        AIPSTACK_ASSERT(udp_data.tot_len <= MaxUdpSegDataLenIp4);
+        AIPSTACK_ASSERT(udp_data.offset >= Ip4Header::Size + Udp4Header::Size);
+        AIPSTACK_ASSERT(seg_size > 0);
+        
+        IpStack<StackArg> *stack = proto().m_stack;
+        
+        // Reveal the UDP header.
+        IpBufRef dgram = udp_data.revealHeader(Udp4Header::Size);
+        
+        // Prepare the IP header which is shared by all datagrams.
+        IpSendPreparedIp4<StackArg> prep;
+        IpErr err = stack->prepareSendIp4Dgram(dgram.getChunkPtr(), prep,
             Ip4CommonSendParams{addrs, UdpTTL, Ip4Protocol::Udp, send_flags});
+        if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+            return err;
+        }
+        
+        // Write the UDP header template, with the pseudo-header sum without the
+        // length in the checksum field. The length is set for each datagram.
+        auto udp_header = Udp4Header::MakeRef(dgram.getChunkPtr());
+        udp_header.set(Udp4Header::SrcPort(), udp_info.src_port);
+        udp_header.set(Udp4Header::DstPort(), udp_info.dst_port);
+        
+        IpChksumAccumulator chksum_accum;
+        chksum_accum.addWord(WrapType<std::uint32_t>(), addrs.local_addr.value());
+        chksum_accum.addWord(WrapType<std::uint32_t>(), addrs.remote_addr.value());
+        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Udp));
+        udp_header.set(Udp4Header::Checksum(), chksum_accum.getChksumInverted());
+        
+        stack->incStat(&IpStackStats::udp_out_datagrams);
+        return stack->sendIp4DgramFastUdpSeg(prep, dgram, seg_size, retryReq);
+    }
+    
+    // Send multiple datagrams within a transmit batch, stopping at the first
+    // error. Routing and the neighbor (ARP) entry are looked up once for
+    // consecutive entries with the same destination address. Each entry has the
+    // same requirements as the arguments of sendUdpIp4Packet. The number of
+    // datagrams sent successfully is stored to num_sent.
+    IpErr sendUdpIp4Packets (UdpTxEntry<Arg> const *entries, std::size_t count,
+                             std::size_t &num_sent, IpIface<StackArg> *iface,
+                             IpSendRetryRequest *retryReq, IpSendFlags send_flags)
+    {
+        IpStack<StackArg> *stack = proto().m_stack;
+        IpRouteCacheIp4<StackArg> route_cache;
+        IpErr err = IpErr::Success;
+        
+        stack->beginTxBatch();
+        
+        for (num_sent = 0; num_sent < count; num_sent++) {
+            UdpTxEntry<Arg> const &entry = entries[num_sent];
+            
+            if (AIPSTACK_UNLIKELY(iface != nullptr)) {
+                err = sendUdpIp4Packet(entry.addrs, entry.udp_info, entry.udp_data,
+                                       iface, retryReq, send_flags);
+            } else {
+                err = send_batch_entry(entry, route_cache, retryReq, send_flags);
+            }
+            
+            if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+                break;
+            }
+        }
+        
+        stack->endTxBatch();
+        
+        return err;
+    }
+
+private:
+    IpErr send_batch_entry (UdpTxEntry<Arg> const &entry,
+                            IpRouteCacheIp4<StackArg> &route_cache,
+                            IpSendRetryRequest *retryReq, IpSendFlags send_flags)
+    {
+        AIPSTACK_ASSERT(entry.udp_data.tot_len <= MaxUdpDataLenIp4);
+        AIPSTACK_ASSERT(entry.udp_data.offset >= Ip4Header::Size + Udp4Header::Size);
+        
+        IpStack<StackArg> *stack = proto().m_stack;
+        
+        // Reveal the UDP header.
+        IpBufRef dgram = entry.udp_data.revealHeader(Udp4Header::Size);
+        
+        // Prepare the IP header, using the route cache shared by the batch.
+        IpSendPreparedIp4<StackArg> prep;
+        IpErr err = stack->prepareSendIp4Dgram(dgram.getChunkPtr(), prep,
+            Ip4CommonSendParams{entry.addrs, UdpTTL, Ip4Protocol::Udp, send_flags},
+            &route_cache);
+        if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+            return err;
+        }
+        
+        // Datagrams which need fragmentation are sent the normal way.
+        if (AIPSTACK_UNLIKELY(Ip4Header::Size + dgram.tot_len >
+                              prep.route_info.iface->getMtu()))
+        {
+            return sendUdpIp4Packet(entry.addrs, entry.udp_info, entry.udp_data,
+                                    nullptr, retryReq, send_flags);
+        }
+        
+        // Write the UDP header.
+        auto udp_header = Udp4Header::MakeRef(dgram.getChunkPtr());
+        udp_header.set(Udp4Header::SrcPort(),  entry.udp_info.src_port);
+        udp_header.set(Udp4Header::DstPort(),  entry.udp_info.dst_port);
+        udp_header.set(Udp4Header::Length(),   std::uint16_t(dgram.tot_len));
+        udp_header.set(Udp4Header::Checksum(), 0);
+        
+        // Calculate the checksum, or only the pseudo-header part if the interface
+        // will calculate the rest.
+        IpChksumAccumulator chksum_accum;
+        chksum_accum.addWord(WrapType<std::uint32_t>(), entry.addrs.local_addr.value());
+        chksum_accum.addWord(WrapType<std::uint32_t>(), entry.addrs.remote_addr.value());
+        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Udp));
+        chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
+        
+        std::uint16_t checksum;
+        if (AIPSTACK_LIKELY((prep.route_info.iface->getTxChksumOffload() &
+                             IpChksumOffloadFlags::Udp4) == Enum0))
+        {
+            // Zero means that there is no checksum, so send all-ones instead.
+            checksum = chksum_accum.getChksum(dgram);
+            if (checksum == 0) {
+                checksum = TypeMax<std::uint16_t>;
+            }
+        } else {
+            checksum = chksum_accum.getChksumInverted();
+        }
+        udp_header.set(Udp4Header::Checksum(), checksum);
+        
+        stack->incStat(&IpStackStats::udp_out_datagrams);
+        return stack->sendIp4DgramFast(prep, dgram, retryReq);
     }
 };
 
@@ -190,7 +394,7 @@ class UdpListener :
 {
     template<typename> friend class IpUdpProto;
     
-    AIPSTACK_USE_TYPES(IpUdpProto<Arg>, (ListenersLinkModel))
+    AIPSTACK_USE_TYPES(IpUdpProto<Arg>, (ListenersLinkModel, ListenerGroupList))
 
 public:
     using StackArg = typename Arg::StackArg;
@@ -212,11 +416,36 @@ public:
     void reset ()
     {
         if (m_udp != nullptr) {
-            if (m_udp->m_next_listener == this) {
-                m_udp->m_next_listener = m_udp->m_listeners_list.next(*this);
+            if (m_group_head != this) {
+                // Not the head of a reuse-port group, just remove from the group.
+                ListenerGroupList::remove(*this);
+                m_group_head->m_group_size--;
+            } else {
+                auto &list = m_udp->listeners_for_port(m_params.port);
+                if (m_group_size > 1) {
+                    // Make the next listener the head of the group and put it
+                    // into the list in place of this one.
+                    UdpListener *new_head = ListenerGroupList::next(*this);
+                    ListenerGroupList::remove(*this);
+                    new_head->m_group_size = m_group_size - 1;
+                    new_head->m_seq = m_seq;
+                    UdpListener *lis = new_head;
+                    do {
+                        lis->m_group_head = new_head;
+                        lis = ListenerGroupList::next(*lis);
+                    } while (lis != new_head);
+                    list.insertAfter(*new_head, *this);
+                }
+                if (m_udp->m_next_port_listener == this) {
+                    m_udp->m_next_port_listener = list.next(*this);
+                }
+                if (m_udp->m_next_any_listener == this) {
+                    m_udp->m_next_any_listener = list.next(*this);
+                }
+                list.remove(*this);
             }
-            m_udp->m_listeners_list.remove(*this);
             m_udp = nullptr;
+            m_mcast_membership.leave();
         }
     }
 
@@ -242,11 +471,33 @@ public:
     IpErr startListening (UdpApi<Arg> &udp, UdpListenParams<Arg> const &params)
     {
         AIPSTACK_ASSERT(!isListening());
+        AIPSTACK_ASSERT(params.mcast_group.isZero() ||
+                        (params.mcast_group.isMulticast() && params.iface != nullptr));
 
         m_udp = &udp.proto();
         m_params = params;
         
-        m_udp->m_listeners_list.prepend(*this);
+        UdpListener *group_head = !params.reuse_port ? nullptr :
+            m_udp->find_reuse_port_group(params);
+        
+        if (group_head == nullptr) {
+            ListenerGroupList::initLonely(*this);
+            m_group_head = this;
+            m_group_size = 1;
+            m_seq = m_udp->m_next_listener_seq++;
+            m_udp->listeners_for_port(m_params.port).prepend(*this);
+        } else {
+            // Join the group, only the head is in the list of listeners.
+            ListenerGroupList::initBefore(*this, *group_head);
+            m_group_head = group_head;
+            group_head->m_group_size++;
+        }
+        
+        // Join the multicast group on the interface, so that datagrams sent to
+        // the group are received.
+        if (!params.mcast_group.isZero()) {
+            m_mcast_membership.join(params.iface, params.mcast_group);
+        }
 
         return IpErr::Success;
     }
@@ -275,7 +526,12 @@ private:
             return false;
         }
 
-        if (!m_params.accept_nonlocal_dst && !is_bcast && !dst_is_iface_addr) {
+        bool is_mcast_member = !m_params.mcast_group.isZero() &&
+            ip_info.dst_addr == m_params.mcast_group;
+        
+        if (!m_params.accept_nonlocal_dst && !is_bcast && !is_mcast_member &&
+            !dst_is_iface_addr)
+        {
             return false;
         }
 
@@ -291,8 +547,15 @@ private:
 private:
     UdpIp4PacketHandler m_handler;
     LinkedListNode<ListenersLinkModel> m_list_node;
+    LinkedListNode<ListenersLinkModel> m_group_node;
     IpUdpProto<Arg> *m_udp;
     UdpListenParams<Arg> m_params;
+    std::uint32_t m_seq;
+    // Head of the reuse-port group (this if not sharing the port).
+    UdpListener *m_group_head;
+    // Number of listeners in the group, valid only in the group head.
+    int m_group_size;
+    IpMcastMembership<StackArg> m_mcast_membership;
 };
 
 template<typename Arg>
@@ -301,6 +564,8 @@ class UdpAssociation :
 {
     template<typename> friend class IpUdpProto;
     
+    AIPSTACK_USE_VALS(Arg::Params, (UdpTTL))
+    
 public:
     using StackArg = typename Arg::StackArg;
 
@@ -310,7 +575,8 @@ public:
     
     UdpAssociation (UdpIp4PacketHandler handler) :
         m_handler(handler),
-        m_udp(nullptr)
+        m_udp(nullptr),
+        m_tx_prepared(false)
     {}
 
     ~UdpAssociation ()
@@ -322,7 +588,9 @@ public:
     {
         if (m_udp != nullptr) {
             m_udp->m_associations_index.removeEntry(*this);
+            m_udp->m_ephemeral_ports.release(m_params.key.local_port);
             m_udp = nullptr;
+            m_tx_prepared = false;
         }
     }
 
@@ -380,11 +648,135 @@ public:
         return IpErr::Success;
     }
 
+    // Prepare for sending datagrams with sendPrepared. This does the routing
+    // and send checks and builds the IP and UDP header template which is then
+    // reused for all datagrams. The prepared state is kept until the
+    // association is reset and is refreshed automatically by sendPrepared when
+    // routing changes (which includes changes of interface addresses) or when
+    // the preparation has failed. Neighbor (ARP) information is cached per
+    // association and revalidated by the interface driver.
+    IpErr prepareSend (IpSendFlags send_flags = IpSendFlags())
+    {
+        AIPSTACK_ASSERT(isAssociated());
+        AIPSTACK_ASSERT((send_flags & ~IpSendFlags::AllFlags) == Enum0);
+        
+        m_tx_prepared = true;
+        m_tx_send_flags = send_flags;
+        m_tx_route_cache = IpRouteCacheIp4<StackArg>{};
+        
+        return prepare_tx_template();
+    }
+    
+    // Send a datagram to the remote address and port of the association, after
+    // preparation with prepareSend. The requirements for udp_data are as for
+    // UdpApi::sendUdpIp4Packet. Datagrams which need fragmentation are sent the
+    // normal way with UdpApi::sendUdpIp4Packet.
+    IpErr sendPrepared (IpBufRef udp_data, IpSendRetryRequest *retryReq = nullptr)
+    {
+        AIPSTACK_ASSERT(isAssociated());
+        AIPSTACK_ASSERT(m_tx_prepared);
+        AIPSTACK_ASSERT(udp_data.tot_len <= UdpApi<Arg>::MaxUdpDataLenIp4);
+        AIPSTACK_ASSERT(udp_data.offset >= Ip4Header::Size + Udp4Header::Size);
+        
+        IpStack<StackArg> *stack = m_udp->m_stack;
+        
+        // Redo the preparation if routing has changed or it has failed.
+        if (AIPSTACK_UNLIKELY(!stack->ip4RouteCacheIsCurrent(m_tx_route_cache))) {
+            IpErr err = prepare_tx_template();
+            if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+                return err;
+            }
+        }
+        
+        // Reveal the UDP header.
+        IpBufRef dgram = udp_data.revealHeader(Udp4Header::Size);
+        
+        IpIface<StackArg> *iface = m_tx_prep.route_info.iface;
+        if (AIPSTACK_UNLIKELY(Ip4Header::Size + dgram.tot_len > iface->getMtu())) {
+            return getApi().sendUdpIp4Packet(get_tx_addrs(), UdpTxInfo<Arg>{
+                m_params.key.local_port, m_params.key.remote_port}, udp_data,
+                nullptr, retryReq, m_tx_send_flags);
+        }
+        
+        // Copy the header template and set the UDP length.
+        std::memcpy(dgram.getChunkPtr() - Ip4Header::Size, m_tx_header,
+                    sizeof(m_tx_header));
+        auto udp_header = Udp4Header::MakeRef(dgram.getChunkPtr());
+        udp_header.set(Udp4Header::Length(), std::uint16_t(dgram.tot_len));
+        
+        // Calculate the checksum starting with the precomputed pseudo-header
+        // sum, or leave the rest to the interface.
+        IpChksumAccumulator chksum_accum{m_tx_pseudo_sum};
+        chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
+        
+        std::uint16_t checksum;
+        if (AIPSTACK_LIKELY((iface->getTxChksumOffload() &
+                             IpChksumOffloadFlags::Udp4) == Enum0))
+        {
+            // Zero means that there is no checksum, so send all-ones instead.
+            checksum = chksum_accum.getChksum(dgram);
+            if (checksum == 0) {
+                checksum = TypeMax<std::uint16_t>;
+            }
+        } else {
+            checksum = chksum_accum.getChksumInverted();
+        }
+        udp_header.set(Udp4Header::Checksum(), checksum);
+        
+        stack->incStat(&IpStackStats::udp_out_datagrams);
+        return stack->sendIp4DgramFast(m_tx_prep, dgram, retryReq);
+    }
+
+private:
+    Ip4AddrPair get_tx_addrs () const
+    {
+        return Ip4AddrPair{m_params.key.local_addr, m_params.key.remote_addr};
+    }
+    
+    IpErr prepare_tx_template ()
+    {
+        Ip4AddrPair addrs = get_tx_addrs();
+        
+        // Fill in the IP header and the routing information.
+        IpErr err = m_udp->m_stack->prepareSendIp4Dgram(
+            m_tx_header + Ip4Header::Size, m_tx_prep,
+            Ip4CommonSendParams{addrs, UdpTTL, Ip4Protocol::Udp, m_tx_send_flags},
+            &m_tx_route_cache);
+        if (AIPSTACK_UNLIKELY(err != IpErr::Success)) {
+            // Make sure that the preparation is retried.
+            m_tx_route_cache.route_gen = 0;
+            return err;
+        }
+        
+        // Fill in the UDP header, with a zero checksum as needed for calculating
+        // it in sendPrepared.
+        auto udp_header = Udp4Header::MakeRef(m_tx_header + Ip4Header::Size);
+        udp_header.set(Udp4Header::SrcPort(),  m_params.key.local_port);
+        udp_header.set(Udp4Header::DstPort(),  m_params.key.remote_port);
+        udp_header.set(Udp4Header::Length(),   0);
+        udp_header.set(Udp4Header::Checksum(), 0);
+        
+        // Calculate the pseudo-header sum without the UDP length.
+        IpChksumAccumulator chksum_accum;
+        chksum_accum.addWord(WrapType<std::uint32_t>(), addrs.local_addr.value());
+        chksum_accum.addWord(WrapType<std::uint32_t>(), addrs.remote_addr.value());
+        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Udp));
+        m_tx_pseudo_sum = chksum_accum.getState();
+        
+        return IpErr::Success;
+    }
+
 private:
     UdpIp4PacketHandler m_handler;
     typename IpUdpProto<Arg>::AssociationIndex::Node m_index_node;
     IpUdpProto<Arg> *m_udp;
     UdpAssociationParams<Arg> m_params;
+    bool m_tx_prepared;
+    IpSendFlags m_tx_send_flags;
+    IpChksumAccumulator::State m_tx_pseudo_sum;
+    IpSendPreparedIp4<StackArg> m_tx_prep;
+    IpRouteCacheIp4<StackArg> m_tx_route_cache;
+    char m_tx_header[Ip4Header::Size + Udp4Header::Size];
 };
 
 #ifndef IN_DOXYGEN
@@ -398,18 +790,17 @@ class IpUdpProto :
     template<typename> friend class UdpListener;
     template<typename> friend class UdpAssociation;
 
-    AIPSTACK_USE_VALS(Arg::Params, (UdpTTL, EphemeralPortFirst, EphemeralPortLast))
+    AIPSTACK_USE_VALS(Arg::Params, (UdpTTL, EphemeralPortFirst, EphemeralPortLast,
+        EphemeralPortBitmap, NumListenerBuckets))
     AIPSTACK_USE_TYPES(Arg::Params, (UdpIndexService))
     AIPSTACK_USE_TYPES(Arg, (PlatformImpl, StackArg))
 
     static_assert(EphemeralPortFirst > 0);
     static_assert(EphemeralPortFirst <= EphemeralPortLast);
+    static_assert(NumListenerBuckets > 0);
 
     using Platform = PlatformFacade<PlatformImpl>;
 
-    inline static constexpr PortNum NumEphemeralPorts =
-        EphemeralPortLast - EphemeralPortFirst + 1;
-
     struct ListenerListNodeAccessor;
     using ListenersLinkModel = PointerLinkModel<UdpListener<Arg>>;
 
@@ -420,6 +811,13 @@ class IpUdpProto :
         UdpListener<Arg>, LinkedListNode<ListenersLinkModel>,
         &UdpListener<Arg>::m_list_node> {};
     
+    // Circular list of the listeners in a reuse-port group. Only the head of
+    // a group is in the list of listeners.
+    struct ListenerGroupAccessor : public MemberAccessor<
+        UdpListener<Arg>, LinkedListNode<ListenersLinkModel>,
+        &UdpListener<Arg>::m_group_node> {};
+    using ListenerGroupList = CircularLinkedList<ListenerGroupAccessor, ListenersLinkModel>;
+    
     struct AssociationIndexNodeAccessor;
     struct AssociationIndexKeyFuncs;
     using AssociationLinkModel = PointerLinkModel<UdpAssociation<Arg>>;
@@ -446,20 +844,37 @@ class IpUdpProto :
         {
             return assoc.m_params.key;
         }
+        
+        static std::size_t HashKey (UdpAssociationKey const &key)
+        {
+            HashAccumulator hash;
+            hash.addWord(key.remote_addr.value());
+            hash.addWord(key.local_addr.value());
+            hash.addWord((std::uint32_t(key.remote_port) << 16) | key.local_port);
+            return hash.getHash();
+        }
     };
 
 public:
     IpUdpProto (IpProtocolHandlerArgs<StackArg> args) :
         m_stack(args.stack),
-        m_next_listener(nullptr),
-        m_next_ephemeral_port(EphemeralPortFirst)
+        m_next_port_listener(nullptr),
+        m_next_any_listener(nullptr),
+        m_next_listener_seq(0),
+        m_ephemeral_ports(std::uint32_t(args.platform.getTime()) ^
+                          std::uint32_t(reinterpret_cast<std::uintptr_t>(this))),
+        m_flow_steering(nullptr)
     {}
 
     ~IpUdpProto ()
     {
-        AIPSTACK_ASSERT(m_listeners_list.isEmpty());
+        for ([[maybe_unused]] auto &list : m_port_listeners) {
+            AIPSTACK_ASSERT(list.isEmpty());
+        }
+        AIPSTACK_ASSERT(m_any_port_listeners.isEmpty());
         AIPSTACK_ASSERT(m_associations_index.isEmpty());
-        AIPSTACK_ASSERT(m_next_listener == nullptr);
+        AIPSTACK_ASSERT(m_next_port_listener == nullptr);
+        AIPSTACK_ASSERT(m_next_any_listener == nullptr);
     }
 
     inline UdpApi<Arg> & getApi ()
@@ -471,21 +886,26 @@ public:
     {
         // Check that there is a UDP header.
         if (AIPSTACK_UNLIKELY(!dgram.hasHeader(Udp4Header::Size))) {
-            return;
+            m_stack->incStat(&IpStackStats::udp_in_errors);
+            return m_stack->traceDrop(IpDropReason::UdpHeaderInvalid, ip_info.iface, dgram);
         }
         auto udp_header = Udp4Header::MakeRef(dgram.getChunkPtr());
 
-        // Fill in UdpRxInfo (has_checksum would be set later).
+        // Fill in UdpRxInfo.
         UdpRxInfo<Arg> udp_info;
         udp_info.src_port = udp_header.get(Udp4Header::SrcPort());
         udp_info.dst_port = udp_header.get(Udp4Header::DstPort());
+        udp_info.has_checksum = udp_header.get(Udp4Header::Checksum()) != 0;
+        udp_info.checksum_pending = false;
+        udp_info.checksum_state = IpChksumAccumulator::State();
 
         // Check UDP length.
         std::uint16_t udp_length = udp_header.get(Udp4Header::Length());
         if (AIPSTACK_UNLIKELY(udp_length < Udp4Header::Size ||
                               udp_length > dgram.tot_len))
         {
-            return;
+            m_stack->incStat(&IpStackStats::udp_in_errors);
+            return m_stack->traceDrop(IpDropReason::UdpHeaderInvalid, ip_info.iface, dgram);
         }
         
         // Truncate datagram to UDP length.
@@ -506,12 +926,15 @@ public:
         updateCachedInfo();
 
         // We will verify the checksum when we find the first matching listener.
-        bool checksum_verified = false;
+        // There is nothing to verify in software if there is no checksum or it
+        // has been verified by the interface.
+        bool checksum_verified = !udp_info.has_checksum ||
+            (ip_info.chksum_verified & IpChksumOffloadFlags::Udp4) != Enum0;
 
         // This lambda function is used to verify the checksum on demand.
         auto verifyChecksumOnDemand = [&]() -> bool {
             if (!checksum_verified) {
-                if (!verifyChecksum(ip_info, udp_header, dgram, udp_info.has_checksum)) {
+                if (!verifyChecksum(ip_info, dgram)) {
                     // Bad checksum, calling code should drop the packet.
                     return false;
                 }
@@ -520,6 +943,29 @@ public:
             return true;
         };
 
+        // UdpRxInfo for listeners and associations which defer verification,
+        // initialized when first needed.
+        UdpRxInfo<Arg> deferred_udp_info;
+        bool have_deferred_udp_info = false;
+        
+        // This lambda function verifies the checksum unless verification is to be
+        // deferred, and returns the UdpRxInfo to pass to the handler (or null for
+        // a bad checksum).
+        auto getRxInfoForHandler = [&](bool defer_checksum) -> UdpRxInfo<Arg> const * {
+            if (!defer_checksum || checksum_verified) {
+                return verifyChecksumOnDemand() ? &udp_info : nullptr;
+            }
+            if (!have_deferred_udp_info) {
+                deferred_udp_info = udp_info;
+                deferred_udp_info.checksum_pending = true;
+                IpChksumAccumulator chksum_accum = pseudoHeaderChksum(ip_info, dgram);
+                chksum_accum.addEvenBytes(dgram.getChunkPtr(), Udp4Header::Size);
+                deferred_udp_info.checksum_state = chksum_accum.getState();
+                have_deferred_udp_info = true;
+            }
+            return &deferred_udp_info;
+        };
+        
         // We will remember if any association or listener accepted the packet.
         bool accepted = false;
 
@@ -536,18 +982,24 @@ public:
                 continue;
             }
 
-            if (!verifyChecksumOnDemand()) {
+            UdpRxInfo<Arg> const *handler_udp_info =
+                getRxInfoForHandler(assoc->m_params.defer_checksum);
+            if (handler_udp_info == nullptr) {
                 // Bad checksum, drop packet.
-                return;
+                m_stack->incStat(&IpStackStats::udp_in_errors);
+                return m_stack->traceDrop(IpDropReason::UdpChksumBad, ip_info.iface, dgram);
             }
 
             // Pass the packet to the association.
             IpBufRef udp_data = dgram.hideHeader(Udp4Header::Size);
-            UdpRecvResult recv_result = assoc->m_handler(ip_info, udp_info, udp_data);
+            m_stack->traceLatency(IpLatencyStage::AppCallback);
+            UdpRecvResult recv_result =
+                assoc->m_handler(ip_info, *handler_udp_info, udp_data);
             
             // If the association wants that we don't pass the packet to any listener, then
             // return here.
             if (recv_result == UdpRecvResult::AcceptStop) {
+                m_stack->incStat(&IpStackStats::udp_in_datagrams);
                 return;
             }
 
@@ -560,40 +1012,80 @@ public:
             updateCachedInfo();
         } while (false);
         
-        // Look for listeners which match the incoming packet.
-        // NOTE: `lis` must be properly adjusted at the end of each iteration!
-        for (UdpListener<Arg> *lis = m_listeners_list.first(); lis != nullptr;) {
+        // Look for listeners which match the incoming packet. Listeners for the
+        // destination port are in the bucket for that port (along with listeners
+        // for other ports in the same bucket) and listeners for any port are in a
+        // separate list. Both lists are ordered from the most recently started
+        // listener, and they are merged so that listeners are tried in that order.
+        // NOTE: `port_lis` and `any_lis` must be properly adjusted in each iteration!
+        ListenersList &port_list = listeners_for_port(udp_info.dst_port);
+        UdpListener<Arg> *port_lis = port_list.first();
+        UdpListener<Arg> *any_lis = m_any_port_listeners.first();
+        
+        while (port_lis != nullptr || any_lis != nullptr) {
+            // Skip listeners for other ports in the same bucket.
+            if (port_lis != nullptr && port_lis->m_params.port != udp_info.dst_port) {
+                port_lis = port_list.next(*port_lis);
+                continue;
+            }
+            
+            // Take the more recently started of the two listeners.
+            UdpListener<Arg> *lis;
+            if (any_lis == nullptr ||
+                (port_lis != nullptr && std::int32_t(port_lis->m_seq - any_lis->m_seq) > 0))
+            {
+                lis = port_lis;
+                port_lis = port_list.next(*lis);
+            } else {
+                lis = any_lis;
+                any_lis = m_any_port_listeners.next(*lis);
+            }
+            
             AIPSTACK_ASSERT(lis->m_udp == this);
             
             // Check if the listener matches, if not skip it.
             if (!lis->incomingPacketMatches(ip_info, udp_info, dst_is_iface_addr)) {
-                lis = m_listeners_list.next(*lis);
                 continue;
             }
 
-            if (!verifyChecksumOnDemand()) {
+            // For a reuse-port group, select one member by the 4-tuple hash.
+            if (AIPSTACK_UNLIKELY(lis->m_group_size > 1)) {
+                lis = select_group_member(lis, ip_info, udp_info);
+            }
+
+            UdpRxInfo<Arg> const *handler_udp_info =
+                getRxInfoForHandler(lis->m_params.defer_checksum);
+            if (handler_udp_info == nullptr) {
                 // Bad checksum, drop packet.
-                return;
+                m_stack->incStat(&IpStackStats::udp_in_errors);
+                return m_stack->traceDrop(IpDropReason::UdpChksumBad, ip_info.iface, dgram);
             }
 
-            // Set the m_next_listener pointer to the next listener on the list (if any).
-            // In case the following callback resets (or destructs) the next listener,
-            // UdpListener::reset() will advance m_next_listener so that we can safely
-            // continue iterating.
-            AIPSTACK_ASSERT(m_next_listener == nullptr);
-            m_next_listener = m_listeners_list.next(*lis);
+            // Set the m_next_*_listener pointers to the next listeners (if any).
+            // In case the following callback resets (or destructs) one of these
+            // listeners, UdpListener::reset() will advance the pointer so that we
+            // can safely continue iterating.
+            AIPSTACK_ASSERT(m_next_port_listener == nullptr);
+            AIPSTACK_ASSERT(m_next_any_listener == nullptr);
+            m_next_port_listener = port_lis;
+            m_next_any_listener = any_lis;
 
             // Pass the packet to the listener.
             IpBufRef udp_data = dgram.hideHeader(Udp4Header::Size);
-            UdpRecvResult recv_result = lis->m_handler(ip_info, udp_info, udp_data);
+            m_stack->traceLatency(IpLatencyStage::AppCallback);
+            UdpRecvResult recv_result =
+                lis->m_handler(ip_info, *handler_udp_info, udp_data);
 
-            // Update `lis` to the next listener (if any) and clear m_next_listener.
-            lis = m_next_listener;
-            m_next_listener = nullptr;
+            // Update the next listeners and clear the m_next_*_listener pointers.
+            port_lis = m_next_port_listener;
+            any_lis = m_next_any_listener;
+            m_next_port_listener = nullptr;
+            m_next_any_listener = nullptr;
 
             // If the listener wants that we don't pass the packet to any further listener,
             // then return here.
             if (recv_result == UdpRecvResult::AcceptStop) {
+                m_stack->incStat(&IpStackStats::udp_in_datagrams);
                 return;
             }
 
@@ -606,6 +1098,13 @@ public:
             updateCachedInfo();
         }
 
+        if (accepted) {
+            m_stack->incStat(&IpStackStats::udp_in_datagrams);
+        } else {
+            m_stack->incStat(&IpStackStats::udp_no_ports);
+            m_stack->traceDrop(IpDropReason::UdpNoPort, ip_info.iface, dgram);
+        }
+        
         // If no association or listener has accepted the datagram and it is for our IP
         // address, we should send an ICMP message.
         if (!accepted && dst_is_iface_addr) {
@@ -627,53 +1126,100 @@ public:
     {
     }
 
-private:
-    static bool verifyChecksum (
-        IpRxInfoIp4<StackArg> const &ip_info, Udp4Header::Ref udp_header,
-        IpBufRef dgram, bool &has_checksum)
+    void recvIp4BatchEnd ()
     {
-        std::uint16_t checksum = udp_header.get(Udp4Header::Checksum());
+    }
 
-        has_checksum = (checksum != 0);
+private:
+    static IpChksumAccumulator pseudoHeaderChksum (
+        IpRxInfoIp4<StackArg> const &ip_info, IpBufRef dgram)
+    {
+        IpChksumAccumulator chksum_accum;
+        chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.src_addr.value());
+        chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.dst_addr.value());
+        chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Udp));
+        chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
+        return chksum_accum;
+    }
 
-        if (has_checksum) {
-            IpChksumAccumulator chksum_accum;
-            chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.src_addr.value());
-            chksum_accum.addWord(WrapType<std::uint32_t>(), ip_info.dst_addr.value());
-            chksum_accum.addWord(WrapType<std::uint16_t>(), AsUnderlying(Ip4Protocol::Udp));
-            chksum_accum.addWord(WrapType<std::uint16_t>(), std::uint16_t(dgram.tot_len));
+    static bool verifyChecksum (IpRxInfoIp4<StackArg> const &ip_info, IpBufRef dgram)
+    {
+        return pseudoHeaderChksum(ip_info, dgram).getChksum(dgram) == 0;
+    }
 
-            if (chksum_accum.getChksum(dgram) != 0) {
-                return false;
+    // Find the head of the reuse-port group which a listener with the given
+    // parameters should join, if any.
+    UdpListener<Arg> * find_reuse_port_group (UdpListenParams<Arg> const &params)
+    {
+        ListenersList &list = listeners_for_port(params.port);
+        for (UdpListener<Arg> *lis = list.first(); lis != nullptr; lis = list.next(*lis)) {
+            UdpListenParams<Arg> const &lp = lis->m_params;
+            if (lp.reuse_port && lp.port == params.port &&
+                lp.iface_addr == params.iface_addr && lp.iface == params.iface &&
+                lp.mcast_group == params.mcast_group &&
+                lp.accept_broadcast == params.accept_broadcast &&
+                lp.accept_nonlocal_dst == params.accept_nonlocal_dst)
+            {
+                return lis;
             }
         }
+        return nullptr;
+    }
 
-        return true;
+    static UdpListener<Arg> * select_group_member (UdpListener<Arg> *head,
+        IpRxInfoIp4<StackArg> const &ip_info, UdpRxInfo<Arg> const &udp_info)
+    {
+        HashAccumulator hash;
+        hash.addWord(ip_info.dst_addr.value());
+        hash.addWord(ip_info.src_addr.value());
+        hash.addWord((std::uint32_t(udp_info.dst_port) << 16) | udp_info.src_port);
+
+        UdpListener<Arg> *lis = head;
+        std::uint32_t index = hash.getHash() % std::uint32_t(head->m_group_size);
+        for (; index > 0; index--) {
+            lis = ListenerGroupList::next(*lis);
+        }
+        return lis;
     }
 
+    // Return the list of listeners which includes those with the given port.
+    inline ListenersList & listeners_for_port (PortNum port)
+    {
+        return (port == 0) ? m_any_port_listeners : m_port_listeners[port % NumListenerBuckets];
+    }
+    
     bool get_ephemeral_port (UdpAssociationKey &key)
     {
-        for ([[maybe_unused]] PortNum i : IntRange(NumEphemeralPorts)) {
-            PortNum port = m_next_ephemeral_port;
-            m_next_ephemeral_port = (port < EphemeralPortLast) ?
-                (port + 1) : EphemeralPortFirst;
-            
-            key.local_port = port;
-
-            if (m_associations_index.findEntry(key).isNull()) {
-                return true;
-            }
+        UdpAssociationKey cand_key = key;
+        PortNum port = m_ephemeral_ports.allocate(
+            key.local_addr, key.remote_addr, key.remote_port, [&](PortNum cand_port) {
+                if (m_flow_steering != nullptr && !m_flow_steering->isOwnFlow(
+                        key.local_addr, key.remote_addr, cand_port, key.remote_port)) {
+                    return false;
+                }
+                cand_key.local_port = cand_port;
+                return m_associations_index.findEntry(cand_key).isNull();
+            });
+        
+        if (port == 0) {
+            return false;
         }
         
-        return false;
+        key.local_port = port;
+        return true;
     }
     
 private:
     IpStack<StackArg> *m_stack;
-    StructureRaiiWrapper<ListenersList> m_listeners_list;
+    StructureRaiiWrapper<ListenersList> m_port_listeners[NumListenerBuckets];
+    StructureRaiiWrapper<ListenersList> m_any_port_listeners;
     StructureRaiiWrapper<typename AssociationIndex::Index> m_associations_index;
-    UdpListener<Arg> *m_next_listener;
-    PortNum m_next_ephemeral_port;
+    UdpListener<Arg> *m_next_port_listener;
+    UdpListener<Arg> *m_next_any_listener;
+    std::uint32_t m_next_listener_seq;
+    IpEphemeralPortAllocator<EphemeralPortFirst, EphemeralPortLast, EphemeralPortBitmap>
+        m_ephemeral_ports;
+    IpFlowSteering const *m_flow_steering;
 };
 
 #endif
@@ -682,6 +1228,8 @@ struct IpUdpProtoOptions {
     AIPSTACK_OPTION_DECL_VALUE(UdpTTL, std::uint8_t, 64)
     AIPSTACK_OPTION_DECL_VALUE(EphemeralPortFirst, std::uint16_t, 49152)
     AIPSTACK_OPTION_DECL_VALUE(EphemeralPortLast, std::uint16_t, 65535)
+    AIPSTACK_OPTION_DECL_VALUE(EphemeralPortBitmap, bool, false)
+    AIPSTACK_OPTION_DECL_VALUE(NumListenerBuckets, std::size_t, 64)
     AIPSTACK_OPTION_DECL_TYPE(UdpIndexService, void)
 };
 
@@ -689,10 +1237,13 @@ template<typename ...Options>
 class IpUdpProtoService {
     template<typename> friend class IpUdpProto;
     template<typename> friend class UdpApi;
+    template<typename> friend class UdpAssociation;
     
     AIPSTACK_OPTION_CONFIG_VALUE(IpUdpProtoOptions, UdpTTL)
     AIPSTACK_OPTION_CONFIG_VALUE(IpUdpProtoOptions, EphemeralPortFirst)
     AIPSTACK_OPTION_CONFIG_VALUE(IpUdpProtoOptions, EphemeralPortLast)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpUdpProtoOptions, EphemeralPortBitmap)
+    AIPSTACK_OPTION_CONFIG_VALUE(IpUdpProtoOptions, NumListenerBuckets)
     AIPSTACK_OPTION_CONFIG_TYPE(IpUdpProtoOptions, UdpIndexService)
     
 public:
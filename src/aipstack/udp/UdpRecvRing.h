@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_UDP_RECV_RING_H
+#define AIPSTACK_UDP_RECV_RING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Hints.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/RxBufPool.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/udp/IpUdpProto.h>
+
+namespace AIpStack {
+
+/**
+ * Bounded queue of received UDP datagrams for deferred processing.
+ * 
+ * The ring is used as the receive handler of a @ref UdpListener or
+ * @ref UdpAssociation (see @ref getHandler), so that datagrams are only queued
+ * in the receive path and the application processes them later in batches
+ * (@ref drain), for example from its own event loop callback. This way slow
+ * processing does not delay the receive path of the stack.
+ * 
+ * A datagram received in a retainable buffer (@ref IpRxInfoIp4::rx_buf) is
+ * queued by retaining the buffer, other datagrams are copied into the ring if
+ * they fit into CopyBufSize bytes. Datagrams which cannot be queued because the
+ * ring is full or they are too large to be copied are dropped and counted.
+ * 
+ * If the listener or association defers checksum verification
+ * (@ref UdpListenParams::defer_checksum), the checksum of copied datagrams is
+ * verified while copying, and datagrams with a bad checksum are dropped. For
+ * retained datagrams the pending verification is left to the application
+ * (@ref UdpRxInfo::checksum_pending in @ref Entry::udp_info).
+ * 
+ * @tparam Arg Template parameter of @ref UdpApi.
+ * @tparam Size Maximum number of queued datagrams (must be \>0).
+ * @tparam CopyBufSize Size of the copy buffer of each entry (may be zero if
+ *         all datagrams are expected in retainable buffers).
+ */
+template<typename Arg, std::size_t Size, std::size_t CopyBufSize>
+class UdpRecvRing :
+    private NonCopyable<UdpRecvRing<Arg, Size, CopyBufSize>>
+{
+    static_assert(Size > 0);
+    
+    using StackArg = typename Arg::StackArg;
+    
+public:
+    /**
+     * A queued datagram.
+     */
+    class Entry :
+        private NonCopyable<Entry>
+    {
+        friend UdpRecvRing;
+        
+    public:
+        /**
+         * Source address of the datagram.
+         */
+        Ip4Addr src_addr;
+        
+        /**
+         * Destination address of the datagram.
+         */
+        Ip4Addr dst_addr;
+        
+        /**
+         * UDP header information of the datagram.
+         */
+        UdpRxInfo<Arg> udp_info;
+        
+        /**
+         * The UDP payload, valid until the entry is removed from the ring.
+         */
+        IpBufRef data;
+    
+    private:
+        IpRxBuf *m_rx_buf;
+        IpBufNode m_copy_node;
+        char m_copy_buf[CopyBufSize > 0 ? CopyBufSize : 1];
+    };
+    
+    /**
+     * Type of callback used to report that the ring has become non-empty.
+     */
+    using ReadyHandler = Function<void()>;
+    
+    /**
+     * Construct the ring, initially empty.
+     * 
+     * @param ready_handler Callback function called when a datagram is queued
+     *        into an empty ring (may be null). It is called from the receive
+     *        path and should only schedule processing.
+     */
+    inline UdpRecvRing (ReadyHandler ready_handler) :
+        m_ready_handler(ready_handler),
+        m_start(0),
+        m_count(0),
+        m_full_drops(0),
+        m_too_large_drops(0),
+        m_bad_checksum_drops(0)
+    {}
+    
+    /**
+     * Destruct the ring, releasing any queued datagrams.
+     */
+    inline ~UdpRecvRing ()
+    {
+        clear();
+    }
+    
+    /**
+     * Return the handler which queues datagrams into this ring, to be passed
+     * to the constructor of @ref UdpListener or @ref UdpAssociation.
+     * 
+     * The handler accepts all datagrams (@ref UdpRecvResult::AcceptStop),
+     * including those which are dropped due to the ring being full.
+     * 
+     * @return The receive handler.
+     */
+    inline typename UdpListener<Arg>::UdpIp4PacketHandler getHandler ()
+    {
+        return AIPSTACK_BIND_MEMBER_TN(&UdpRecvRing::recvDatagram, this);
+    }
+    
+    /**
+     * Queue a received datagram.
+     * 
+     * This is the function behind @ref getHandler and may also be called from a
+     * custom receive handler.
+     * 
+     * @param ip_info IP information of the datagram.
+     * @param udp_info UDP information of the datagram.
+     * @param udp_data The UDP payload.
+     * @return Always @ref UdpRecvResult::AcceptStop.
+     */
+    UdpRecvResult recvDatagram (IpRxInfoIp4<StackArg> const &ip_info,
+                                UdpRxInfo<Arg> const &udp_info, IpBufRef udp_data)
+    {
+        if (AIPSTACK_UNLIKELY(m_count == Size)) {
+            m_full_drops++;
+            return UdpRecvResult::AcceptStop;
+        }
+        
+        Entry &entry = m_entries[(m_start + m_count) % Size];
+        
+        if (ip_info.rx_buf != nullptr) {
+            ip_info.rx_buf->retain();
+            entry.m_rx_buf = ip_info.rx_buf;
+            entry.data = udp_data;
+        } else {
+            if (AIPSTACK_UNLIKELY(udp_data.tot_len > CopyBufSize)) {
+                m_too_large_drops++;
+                return UdpRecvResult::AcceptStop;
+            }
+            
+            entry.m_copy_node = IpBufNode{entry.m_copy_buf, udp_data.tot_len, nullptr};
+            IpBufRef copy_ref = IpBufRef{&entry.m_copy_node, 0, udp_data.tot_len};
+            
+            // Copy the data, verifying any pending checksum at the same time.
+            if (!UdpApi<Arg>::copyVerifyUdpData(udp_info, udp_data, copy_ref)) {
+                m_bad_checksum_drops++;
+                return UdpRecvResult::AcceptStop;
+            }
+            
+            entry.m_rx_buf = nullptr;
+            entry.data = copy_ref;
+        }
+        
+        entry.src_addr = ip_info.src_addr;
+        entry.dst_addr = ip_info.dst_addr;
+        entry.udp_info = udp_info;
+        if (entry.m_rx_buf == nullptr) {
+            entry.udp_info.checksum_pending = false;
+        }
+        
+        m_count++;
+        
+        if (m_count == 1 && m_ready_handler) {
+            m_ready_handler();
+        }
+        
+        return UdpRecvResult::AcceptStop;
+    }
+    
+    /**
+     * Return the number of queued datagrams.
+     * 
+     * @return Number of queued datagrams.
+     */
+    inline std::size_t getCount () const
+    {
+        return m_count;
+    }
+    
+    /**
+     * Return the oldest queued datagram.
+     * 
+     * @return The oldest entry. The ring must not be empty.
+     */
+    inline Entry const & front () const
+    {
+        AIPSTACK_ASSERT(m_count > 0);
+        
+        return m_entries[m_start];
+    }
+    
+    /**
+     * Remove the oldest queued datagram, releasing its buffer.
+     * 
+     * The ring must not be empty.
+     */
+    void pop ()
+    {
+        AIPSTACK_ASSERT(m_count > 0);
+        
+        Entry &entry = m_entries[m_start];
+        if (entry.m_rx_buf != nullptr) {
+            entry.m_rx_buf->release();
+        }
+        
+        m_start = (m_start + 1) % Size;
+        m_count--;
+    }
+    
+    /**
+     * Process and remove up to max_count queued datagrams, oldest first.
+     * 
+     * @param max_count Maximum number of datagrams to process.
+     * @param func Function called for each datagram before it is removed. It
+     *        must not modify the ring.
+     * @return Number of datagrams processed.
+     */
+    std::size_t drain (std::size_t max_count, Function<void(Entry const &)> func)
+    {
+        std::size_t num = 0;
+        while (num < max_count && m_count > 0) {
+            func(m_entries[m_start]);
+            pop();
+            num++;
+        }
+        return num;
+    }
+    
+    /**
+     * Remove all queued datagrams.
+     */
+    void clear ()
+    {
+        while (m_count > 0) {
+            pop();
+        }
+    }
+    
+    /**
+     * Return the number of datagrams dropped because the ring was full.
+     * 
+     * The counter wraps around on overflow.
+     * 
+     * @return Number of dropped datagrams.
+     */
+    inline std::uint32_t getFullDrops () const
+    {
+        return m_full_drops;
+    }
+    
+    /**
+     * Return the number of datagrams dropped because they were not in a
+     * retainable buffer and did not fit into the copy buffer.
+     * 
+     * The counter wraps around on overflow.
+     * 
+     * @return Number of dropped datagrams.
+     */
+    inline std::uint32_t getTooLargeDrops () const
+    {
+        return m_too_large_drops;
+    }
+    
+    /**
+     * Return the number of copied datagrams dropped because their checksum
+     * (verified during copying) was bad.
+     * 
+     * The counter wraps around on overflow.
+     * 
+     * @return Number of dropped datagrams.
+     */
+    inline std::uint32_t getBadChecksumDrops () const
+    {
+        return m_bad_checksum_drops;
+    }
+    
+private:
+    ReadyHandler m_ready_handler;
+    std::size_t m_start;
+    std::size_t m_count;
+    std::uint32_t m_full_drops;
+    std::uint32_t m_too_large_drops;
+    std::uint32_t m_bad_checksum_drops;
+    Entry m_entries[Size];
+};
+
+}
+
+#endif
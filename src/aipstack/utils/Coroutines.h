@@ -0,0 +1,1340 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_COROUTINES_H
+#define AIPSTACK_COROUTINES_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "aipstack/utils/Coroutines.h requires C++20 coroutine support"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <coroutine>
+#include <exception>
+#include <new>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/udp/IpUdpProto.h>
+#include <aipstack/utils/TcpRingBufferUtils.h>
+
+namespace AIpStack {
+
+/**
+ * @defgroup coroutines Coroutine Adapters
+ * @brief C++20 coroutine adapters for TCP connections and UDP listeners.
+ * 
+ * This facility is optional and requires compiling with C++20 (the rest of
+ * %AIpStack only requires C++17). It allows writing protocol handlers as coroutines
+ * (returning @ref CoroTask) which `co_await` operations such as @ref
+ * CoroTcpConnection::read, instead of state machines driven by the callbacks of @ref
+ * TcpConnection.
+ * 
+ * Coroutines are resumed directly from the callbacks of the stack, so they run in the
+ * context of the event loop which drives the stack. Coroutine frames are allocated from
+ * a @ref CoroFramePool, which should be used only by coroutines of the same event loop
+ * and which recycles frames, so that once the pool has warmed up (or after @ref
+ * CoroFramePool::reserve) there is no dynamic memory allocation. The awaited operations
+ * themselves never allocate memory.
+ * 
+ * @{
+ */
+
+/**
+ * Pool of memory for coroutine frames.
+ * 
+ * Frames are allocated in power-of-two size classes from @ref MinFrameSize up to
+ * @ref MaxFrameSize. Released frames are kept in a free list per size class and reused.
+ * Larger frames are allocated and released directly with `operator new` and `operator
+ * delete`.
+ * 
+ * The pool is used by coroutines returning @ref CoroTask. It is not thread-safe.
+ */
+class CoroFramePool :
+    private NonCopyable<CoroFramePool>
+{
+    struct alignas(std::max_align_t) FrameHeader {
+        CoroFramePool *pool;
+        std::size_t size_class;
+    };
+
+    struct FreeFrame {
+        FreeFrame *next;
+    };
+
+public:
+    /**
+     * Size of the smallest size class (including internal overhead).
+     */
+    inline static constexpr std::size_t MinFrameSize = 128;
+
+    /**
+     * Number of size classes.
+     */
+    inline static constexpr std::size_t NumSizeClasses = 8;
+
+    /**
+     * Size of the largest size class (including internal overhead).
+     */
+    inline static constexpr std::size_t MaxFrameSize =
+        MinFrameSize << (NumSizeClasses - 1);
+
+    /**
+     * Construct the pool, initially without any memory.
+     */
+    CoroFramePool () :
+        m_free{},
+        m_num_allocated(0)
+    {}
+
+    /**
+     * Destruct the pool, releasing cached memory.
+     * 
+     * All frames allocated from the pool must have been released.
+     */
+    ~CoroFramePool ()
+    {
+        AIPSTACK_ASSERT(m_num_allocated == 0);
+
+        for (FreeFrame *&list : m_free) {
+            while (FreeFrame *frame = list) {
+                list = frame->next;
+                ::operator delete(frame);
+            }
+        }
+    }
+
+    /**
+     * Preallocate memory for frames.
+     * 
+     * @param frame_size Size of the frames as requested by the compiler (this is not
+     *        known in advance but can be determined using @ref getLastFrameSize).
+     * @param count Number of frames to add to the free list of the size class which
+     *        is used for this frame size. Nothing is done for frames which are larger
+     *        than the largest size class.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    void reserve (std::size_t frame_size, std::size_t count)
+    {
+        std::size_t size_class = size_class_for(frame_size);
+        if (size_class == NumSizeClasses) {
+            return;
+        }
+
+        for (std::size_t i = 0; i < count; i++) {
+            void *mem = ::operator new(MinFrameSize << size_class);
+            m_free[size_class] = new(mem) FreeFrame{m_free[size_class]};
+        }
+    }
+
+    /**
+     * Get the size of the most recently allocated frame.
+     * 
+     * @return Size as requested by the compiler, zero if none was allocated yet.
+     */
+    inline std::size_t getLastFrameSize () const
+    {
+        return m_last_frame_size;
+    }
+
+    /**
+     * Get the number of frames which are currently allocated.
+     * 
+     * @return Number of frames allocated and not yet released.
+     */
+    inline std::size_t getNumAllocated () const
+    {
+        return m_num_allocated;
+    }
+
+    /**
+     * Allocate memory for a frame.
+     * 
+     * @param size Size of the frame.
+     * @return Pointer to memory suitably aligned for any fundamental type.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    void * allocate (std::size_t size)
+    {
+        std::size_t size_class = size_class_for(size);
+
+        void *mem;
+        if (size_class == NumSizeClasses) {
+            mem = ::operator new(sizeof(FrameHeader) + size);
+        }
+        else if (FreeFrame *frame = m_free[size_class]) {
+            m_free[size_class] = frame->next;
+            mem = frame;
+        }
+        else {
+            mem = ::operator new(MinFrameSize << size_class);
+        }
+
+        FrameHeader *header = new(mem) FrameHeader{this, size_class};
+        m_num_allocated++;
+        m_last_frame_size = size;
+
+        return header + 1;
+    }
+
+    /**
+     * Release memory of a frame to the pool which it was allocated from.
+     * 
+     * @param ptr Pointer returned by @ref allocate.
+     */
+    static void deallocate (void *ptr)
+    {
+        FrameHeader *header = static_cast<FrameHeader *>(ptr) - 1;
+        CoroFramePool *pool = header->pool;
+        std::size_t size_class = header->size_class;
+
+        AIPSTACK_ASSERT(pool->m_num_allocated > 0);
+        pool->m_num_allocated--;
+
+        if (size_class == NumSizeClasses) {
+            ::operator delete(header);
+        } else {
+            pool->m_free[size_class] = new(header) FreeFrame{pool->m_free[size_class]};
+        }
+    }
+
+private:
+    static std::size_t size_class_for (std::size_t size)
+    {
+        std::size_t size_class = 0;
+        while (size_class < NumSizeClasses &&
+               (MinFrameSize << size_class) - sizeof(FrameHeader) < size)
+        {
+            size_class++;
+        }
+        return size_class;
+    }
+
+private:
+    FreeFrame *m_free[NumSizeClasses];
+    std::size_t m_num_allocated;
+    std::size_t m_last_frame_size = 0;
+};
+
+/**
+ * Return type of coroutines using the coroutine adapters.
+ * 
+ * A coroutine returning @ref CoroTask starts running immediately when it is called and
+ * runs until its first suspension, and the @ref CoroTask object which is returned owns
+ * the coroutine frame. Destructing or assigning to the @ref CoroTask destroys the
+ * coroutine if it still exists, even if it is suspended (which destructs its local
+ * variables, for example a @ref CoroTcpConnection, which resets the connection). A
+ * coroutine can instead be detached using @ref detach, after which it destroys itself
+ * when it finishes.
+ * 
+ * The frame is allocated from a @ref CoroFramePool, which must be passed as the first
+ * parameter of the coroutine (`CoroFramePool &`), or as the first parameter after the
+ * implicit object parameter for member functions and lambdas. Exceptions must not
+ * propagate out of the coroutine, `std::terminate` is called if this happens.
+ */
+class CoroTask :
+    private NonCopyable<CoroTask>
+{
+public:
+    #ifndef IN_DOXYGEN
+    class promise_type {
+        friend class CoroTask;
+
+        struct FinalAwaiter {
+            bool await_ready () const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend (std::coroutine_handle<promise_type> handle) noexcept
+            {
+                if (handle.promise().m_detached) {
+                    handle.destroy();
+                }
+            }
+
+            void await_resume () const noexcept {}
+        };
+
+    public:
+        template<typename ...Args>
+        static void * operator new (
+            std::size_t size, CoroFramePool &pool, Args const & ...)
+        {
+            return pool.allocate(size);
+        }
+
+        template<typename Self, typename ...Args>
+        static void * operator new (
+            std::size_t size, Self const &, CoroFramePool &pool, Args const & ...)
+        {
+            return pool.allocate(size);
+        }
+
+        static void operator delete (void *ptr) noexcept
+        {
+            CoroFramePool::deallocate(ptr);
+        }
+
+        CoroTask get_return_object ()
+        {
+            return CoroTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_never initial_suspend () const noexcept
+        {
+            return {};
+        }
+
+        FinalAwaiter final_suspend () const noexcept
+        {
+            return {};
+        }
+
+        void return_void () const {}
+
+        void unhandled_exception () const
+        {
+            std::terminate();
+        }
+
+    private:
+        bool m_detached = false;
+    };
+    #endif
+
+    /**
+     * Construct an empty task object, not associated with a coroutine.
+     */
+    CoroTask () = default;
+
+    /**
+     * Move constructor, takes over the coroutine of another task object.
+     * 
+     * @param other Task object which is left empty.
+     */
+    CoroTask (CoroTask &&other) :
+        m_handle(other.m_handle)
+    {
+        other.m_handle = nullptr;
+    }
+
+    /**
+     * Move assignment, destroys the current coroutine if any and takes over the
+     * coroutine of another task object.
+     * 
+     * @param other Task object which is left empty.
+     * @return `*this`
+     */
+    CoroTask & operator= (CoroTask &&other)
+    {
+        if (&other != this) {
+            destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    /**
+     * Destructor, destroys the coroutine if any.
+     */
+    ~CoroTask ()
+    {
+        destroy();
+    }
+
+    /**
+     * Check if the task object is associated with a coroutine.
+     * 
+     * @return True if there is a coroutine (finished or not), false if empty.
+     */
+    inline bool hasCoroutine () const
+    {
+        return bool(m_handle);
+    }
+
+    /**
+     * Check if the coroutine has finished.
+     * 
+     * @return True if the coroutine has finished or there is no coroutine.
+     */
+    inline bool isDone () const
+    {
+        return !m_handle || m_handle.done();
+    }
+
+    /**
+     * Detach the coroutine, so that it destroys itself when it finishes.
+     * 
+     * If the coroutine has already finished, it is destroyed immediately. Afterward
+     * the task object is empty.
+     */
+    void detach ()
+    {
+        if (m_handle) {
+            if (m_handle.done()) {
+                m_handle.destroy();
+            } else {
+                m_handle.promise().m_detached = true;
+            }
+            m_handle = nullptr;
+        }
+    }
+
+private:
+    explicit CoroTask (std::coroutine_handle<promise_type> handle) :
+        m_handle(handle)
+    {}
+
+    void destroy ()
+    {
+        if (m_handle) {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template<typename> class CoroTcpListener;
+
+/**
+ * TCP connection with awaitable operations.
+ * 
+ * The connection uses a receive and a send ring buffer which are provided by the user
+ * (see @ref RecvRingBuffer and @ref SendRingBuffer). A connection is established using
+ * @ref accept or @ref connect, after which data is transferred using @ref read and
+ * @ref write. Reading and writing may be done concurrently by two coroutines, but at
+ * most one coroutine may be waiting in each kind of operation at a time.
+ * 
+ * Waiting coroutines are resumed from the callbacks of the underlying @ref
+ * TcpConnection and from @ref reset. A resumed coroutine may destruct the connection.
+ * A connection must not be destructed while a coroutine other than the one destructing
+ * it is waiting for one of its operations.
+ * 
+ * @tparam Arg Template parameter of @ref TcpConnection.
+ */
+template<typename Arg>
+class CoroTcpConnection final :
+    private TcpConnection<Arg>
+{
+    template<typename> friend class CoroTcpListener;
+
+    using TcpCon = TcpConnection<Arg>;
+
+public:
+    class AcceptAwaiter;
+    class ConnectAwaiter;
+    class ReadAwaiter;
+    class WriteAwaiter;
+    class ShutdownAwaiter;
+
+private:
+    #ifndef IN_DOXYGEN
+    struct AcceptListAccessor;
+    using AcceptLinkModel = PointerLinkModel<AcceptAwaiter>;
+    using AcceptList = LinkedList<AcceptListAccessor, AcceptLinkModel, true>;
+    #endif
+
+public:
+    /**
+     * Divisor for the proportional window update threshold (see @ref
+     * TcpConnection::setProportionalWindowUpdateThreshold).
+     */
+    inline static constexpr int WindowUpdateThresDiv = 8;
+
+    /**
+     * Construct the connection object in INIT state.
+     * 
+     * @param rx_buf Memory for the receive ring buffer; it must outlive the object.
+     * @param rx_buf_size Size of the receive buffer (must be positive). This is also
+     *        used as the receive window for @ref connect.
+     * @param tx_buf Memory for the send ring buffer; it must outlive the object.
+     * @param tx_buf_size Size of the send buffer (must be positive).
+     */
+    CoroTcpConnection (char *rx_buf, std::size_t rx_buf_size,
+                       char *tx_buf, std::size_t tx_buf_size) :
+        m_rx_buf(rx_buf),
+        m_tx_buf(tx_buf),
+        m_rx_buf_size(rx_buf_size),
+        m_tx_buf_size(tx_buf_size),
+        m_reader(nullptr),
+        m_writer(nullptr),
+        m_connecter(nullptr),
+        m_closer(nullptr),
+        m_destroyed_flag(nullptr),
+        m_established(false)
+    {
+        AIPSTACK_ASSERT(rx_buf != nullptr && rx_buf_size > 0);
+        AIPSTACK_ASSERT(tx_buf != nullptr && tx_buf_size > 0);
+    }
+
+    /**
+     * Destruct the connection object, resetting the connection (see @ref reset).
+     */
+    ~CoroTcpConnection ()
+    {
+        AIPSTACK_ASSERT(m_reader == nullptr);
+        AIPSTACK_ASSERT(m_writer == nullptr);
+        AIPSTACK_ASSERT(m_connecter == nullptr);
+        AIPSTACK_ASSERT(m_closer == nullptr);
+
+        if (m_destroyed_flag != nullptr) {
+            *m_destroyed_flag = true;
+        }
+
+        TcpCon::reset(has_unread_data());
+    }
+
+    using TcpCon::isInit;
+    using TcpCon::isConnected;
+    using TcpCon::getLocalPort;
+    using TcpCon::getRemotePort;
+    using TcpCon::getLocalIp4Addr;
+    using TcpCon::getRemoteIp4Addr;
+    using TcpCon::getStats;
+    using TcpCon::setKeepalive;
+    using TcpCon::setSendMode;
+    using TcpCon::getSendMode;
+    using TcpCon::wasEndReceived;
+    using TcpCon::wasSendingClosed;
+    using TcpCon::wasEndSent;
+    using TcpCon::closeSending;
+
+    /**
+     * Reset the connection, bringing the object to INIT state.
+     * 
+     * If there is unread received data, the connection is reset with RST (see @ref
+     * TcpConnection::reset). Coroutines waiting in @ref read, @ref write or @ref
+     * shutdown are resumed from within this call.
+     */
+    void reset ()
+    {
+        TcpCon::reset(has_unread_data());
+        m_established = false;
+
+        resume_waiters();
+    }
+
+    /**
+     * Wait for a connection on a listener and accept it.
+     * 
+     * May only be called in INIT state. The initial receive window of the listener
+     * (see @ref TcpListener::setInitialReceiveWindow) must not exceed the size of the
+     * receive buffer.
+     * 
+     * @param lis Listener; it must not be destructed while waiting.
+     * @return Awaitable with result type @ref IpErr, which is the result of
+     *         @ref TcpConnection::acceptConnection.
+     */
+    AcceptAwaiter accept (CoroTcpListener<Arg> &lis)
+    {
+        AIPSTACK_ASSERT(TcpCon::isInit());
+
+        return AcceptAwaiter(*this, lis);
+    }
+
+    /**
+     * Start a connection and wait until it is established or aborted.
+     * 
+     * May only be called in INIT state.
+     * 
+     * @param api TCP API.
+     * @param args Connection parameters. The receive window (`rcv_wnd`) is ignored
+     *        and the size of the receive buffer is used instead, and the initial send
+     *        buffer (`snd_buf`) must be empty.
+     * @return Awaitable with result type @ref IpErr, which is the error of @ref
+     *         TcpConnection::startConnection if it failed, @ref
+     *         IpErr::ConnectionAborted if the connection was aborted before it was
+     *         established and otherwise @ref IpErr::Success.
+     */
+    ConnectAwaiter connect (TcpApi<Arg> &api, TcpStartConnectionArgs<Arg> const &args)
+    {
+        AIPSTACK_ASSERT(TcpCon::isInit());
+        AIPSTACK_ASSERT(args.snd_buf.tot_len == 0);
+
+        return ConnectAwaiter(*this, api, args);
+    }
+
+    /**
+     * Wait for received data and copy it out of the receive buffer.
+     * 
+     * This completes as soon as any data is available and copies as much as fits.
+     * 
+     * @param dst Where to copy data to (`tot_len` must be positive).
+     * @return Awaitable with result type `std::size_t`, the number of bytes copied.
+     *         Zero means that no more data will be received because the end of data
+     *         was received or the connection is not connected (see @ref
+     *         wasEndReceived and @ref isConnected).
+     */
+    ReadAwaiter read (IpBufRef dst)
+    {
+        AIPSTACK_ASSERT(dst.tot_len > 0);
+        AIPSTACK_ASSERT(m_reader == nullptr);
+
+        return ReadAwaiter(*this, dst);
+    }
+
+    /**
+     * Copy data into the send buffer, waiting for space as needed.
+     * 
+     * The data is pushed (see @ref TcpConnection::sendPush) but it is not waited until
+     * it has been sent or acknowledged.
+     * 
+     * @param src Data to send; it must remain valid until the operation completes.
+     * @return Awaitable with result type `bool`, which is true if all data was copied
+     *         and false if the connection was aborted or reset, or sending was closed
+     *         (in which case some data may have been copied).
+     */
+    WriteAwaiter write (IpBufRef src)
+    {
+        AIPSTACK_ASSERT(m_writer == nullptr);
+
+        return WriteAwaiter(*this, src);
+    }
+
+    /**
+     * Close sending and wait until all data including the FIN has been acknowledged.
+     * 
+     * Destructing or resetting the connection while there is unsent data would abort
+     * it with RST, so this should be used before doing that after a graceful
+     * exchange. Sending is only closed if it is not closed already.
+     * 
+     * @return Awaitable with result type `bool`, which is true if the FIN was
+     *         acknowledged and false if the connection was aborted or reset.
+     */
+    ShutdownAwaiter shutdown ()
+    {
+        AIPSTACK_ASSERT(m_closer == nullptr);
+
+        return ShutdownAwaiter(*this);
+    }
+
+    /**
+     * Awaitable returned by @ref accept.
+     */
+    class AcceptAwaiter :
+        private NonCopyable<AcceptAwaiter>
+    {
+        friend class CoroTcpConnection;
+        friend class CoroTcpListener<Arg>;
+
+    public:
+        #ifndef IN_DOXYGEN
+        ~AcceptAwaiter ()
+        {
+            if (m_waiting) {
+                m_listener.m_waiters.remove(*this);
+            }
+        }
+
+        bool await_ready () const
+        {
+            return false;
+        }
+
+        void await_suspend (std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_listener.m_waiters.append(*this);
+            m_waiting = true;
+        }
+
+        IpErr await_resume () const
+        {
+            return m_result;
+        }
+        #endif
+
+    private:
+        AcceptAwaiter (CoroTcpConnection &con, CoroTcpListener<Arg> &lis) :
+            m_con(con),
+            m_listener(lis),
+            m_result(IpErr::Success),
+            m_waiting(false)
+        {}
+
+        LinkedListNode<AcceptLinkModel> m_list_node;
+        CoroTcpConnection &m_con;
+        CoroTcpListener<Arg> &m_listener;
+        std::coroutine_handle<> m_handle;
+        IpErr m_result;
+        bool m_waiting;
+    };
+
+    /**
+     * Awaitable returned by @ref connect.
+     */
+    class ConnectAwaiter :
+        private NonCopyable<ConnectAwaiter>
+    {
+        friend class CoroTcpConnection;
+
+    public:
+        #ifndef IN_DOXYGEN
+        ~ConnectAwaiter ()
+        {
+            if (m_con.m_connecter == this) {
+                m_con.m_connecter = nullptr;
+            }
+        }
+
+        bool await_ready ()
+        {
+            m_result = m_con.start_connection(m_api, m_args);
+
+            return m_result != IpErr::Success || m_con.connect_ready();
+        }
+
+        void await_suspend (std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_con.m_connecter = this;
+        }
+
+        IpErr await_resume () const
+        {
+            if (m_result != IpErr::Success) {
+                return m_result;
+            }
+            return m_con.isConnected() ? IpErr::Success : IpErr::ConnectionAborted;
+        }
+        #endif
+
+    private:
+        ConnectAwaiter (CoroTcpConnection &con, TcpApi<Arg> &api,
+                        TcpStartConnectionArgs<Arg> const &args) :
+            m_con(con),
+            m_api(api),
+            m_args(args),
+            m_result(IpErr::Success)
+        {}
+
+        CoroTcpConnection &m_con;
+        TcpApi<Arg> &m_api;
+        TcpStartConnectionArgs<Arg> m_args;
+        std::coroutine_handle<> m_handle;
+        IpErr m_result;
+    };
+
+    /**
+     * Awaitable returned by @ref read.
+     */
+    class ReadAwaiter :
+        private NonCopyable<ReadAwaiter>
+    {
+        friend class CoroTcpConnection;
+
+    public:
+        #ifndef IN_DOXYGEN
+        ~ReadAwaiter ()
+        {
+            if (m_con.m_reader == this) {
+                m_con.m_reader = nullptr;
+            }
+        }
+
+        bool await_ready () const
+        {
+            return m_con.read_ready();
+        }
+
+        void await_suspend (std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_con.m_reader = this;
+        }
+
+        std::size_t await_resume () const
+        {
+            return m_con.read_some(m_dst);
+        }
+        #endif
+
+    private:
+        ReadAwaiter (CoroTcpConnection &con, IpBufRef dst) :
+            m_con(con),
+            m_dst(dst)
+        {}
+
+        CoroTcpConnection &m_con;
+        IpBufRef m_dst;
+        std::coroutine_handle<> m_handle;
+    };
+
+    /**
+     * Awaitable returned by @ref write.
+     */
+    class WriteAwaiter :
+        private NonCopyable<WriteAwaiter>
+    {
+        friend class CoroTcpConnection;
+
+    public:
+        #ifndef IN_DOXYGEN
+        ~WriteAwaiter ()
+        {
+            if (m_con.m_writer == this) {
+                m_con.m_writer = nullptr;
+            }
+        }
+
+        bool await_ready ()
+        {
+            m_con.write_some(m_src);
+
+            return m_src.tot_len == 0 || !m_con.writable();
+        }
+
+        void await_suspend (std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_con.m_writer = this;
+        }
+
+        bool await_resume () const
+        {
+            return m_src.tot_len == 0;
+        }
+        #endif
+
+    private:
+        WriteAwaiter (CoroTcpConnection &con, IpBufRef src) :
+            m_con(con),
+            m_src(src)
+        {}
+
+        CoroTcpConnection &m_con;
+        IpBufRef m_src;
+        std::coroutine_handle<> m_handle;
+    };
+
+    /**
+     * Awaitable returned by @ref shutdown.
+     */
+    class ShutdownAwaiter :
+        private NonCopyable<ShutdownAwaiter>
+    {
+        friend class CoroTcpConnection;
+
+    public:
+        #ifndef IN_DOXYGEN
+        ~ShutdownAwaiter ()
+        {
+            if (m_con.m_closer == this) {
+                m_con.m_closer = nullptr;
+            }
+        }
+
+        bool await_ready ()
+        {
+            if (m_con.writable()) {
+                m_con.closeSending();
+            }
+
+            return m_con.shutdown_ready();
+        }
+
+        void await_suspend (std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_con.m_closer = this;
+        }
+
+        bool await_resume () const
+        {
+            return m_con.isConnected();
+        }
+        #endif
+
+    private:
+        ShutdownAwaiter (CoroTcpConnection &con) :
+            m_con(con)
+        {}
+
+        CoroTcpConnection &m_con;
+        std::coroutine_handle<> m_handle;
+    };
+
+private:
+    #ifndef IN_DOXYGEN
+    struct AcceptListAccessor : public MemberAccessor<
+        AcceptAwaiter, LinkedListNode<AcceptLinkModel>, &AcceptAwaiter::m_list_node> {};
+    #endif
+
+    void setup_buffers ()
+    {
+        m_rx_ring.setup(*this, m_rx_buf, m_rx_buf_size, WindowUpdateThresDiv);
+        m_tx_ring.setup(*this, m_tx_buf, m_tx_buf_size);
+    }
+
+    IpErr accept_from (TcpListener<Arg> &lis)
+    {
+        IpErr err = TcpCon::acceptConnection(lis);
+        if (err == IpErr::Success) {
+            AIPSTACK_ASSERT(TcpCon::getAnnouncedRcvWnd() <= m_rx_buf_size);
+            m_established = true;
+            setup_buffers();
+        }
+        return err;
+    }
+
+    IpErr start_connection (TcpApi<Arg> &api, TcpStartConnectionArgs<Arg> args)
+    {
+        args.rcv_wnd = m_rx_buf_size;
+
+        IpErr err = TcpCon::startConnection(api, args);
+        if (err == IpErr::Success) {
+            m_established = false;
+            setup_buffers();
+        }
+        return err;
+    }
+
+    bool has_unread_data ()
+    {
+        return TcpCon::isConnected() && m_rx_ring.getReadRange(*this).tot_len > 0;
+    }
+
+    bool connect_ready () const
+    {
+        return !TcpCon::isConnected() || m_established;
+    }
+
+    bool read_ready ()
+    {
+        return !TcpCon::isConnected() || TcpCon::wasEndReceived() ||
+            m_rx_ring.getReadRange(*this).tot_len > 0;
+    }
+
+    std::size_t read_some (IpBufRef dst)
+    {
+        if (!TcpCon::isConnected()) {
+            return 0;
+        }
+
+        IpBufRef data = m_rx_ring.getReadRange(*this);
+        std::size_t amount = MinValue(data.tot_len, dst.tot_len);
+
+        if (amount > 0) {
+            ipBufGiveBuf(dst, data.subTo(amount));
+            m_rx_ring.consumeData(*this, amount);
+        }
+
+        return amount;
+    }
+
+    bool shutdown_ready () const
+    {
+        return !TcpCon::isConnected() || TcpCon::wasEndSent();
+    }
+
+    bool writable () const
+    {
+        return TcpCon::isConnected() && !TcpCon::wasSendingClosed();
+    }
+
+    void write_some (IpBufRef &src)
+    {
+        if (!writable()) {
+            return;
+        }
+
+        IpBufRef space = m_tx_ring.getWriteRange(*this);
+        std::size_t amount = MinValue(space.tot_len, src.tot_len);
+
+        if (amount > 0) {
+            ipBufGiveBuf(space, src.subTo(amount));
+            src = ipBufSkipBytes(src, amount);
+            m_tx_ring.provideData(*this, amount);
+            TcpCon::sendPush();
+        }
+    }
+
+    // Resume coroutines whose operations can complete. A resumed coroutine may destruct
+    // this object, which is detected using m_destroyed_flag.
+    void resume_waiters ()
+    {
+        bool destroyed = false;
+        bool *prev_destroyed_flag = m_destroyed_flag;
+        m_destroyed_flag = &destroyed;
+
+        auto resume = [&](std::coroutine_handle<> handle) {
+            handle.resume();
+            if (destroyed && prev_destroyed_flag != nullptr) {
+                *prev_destroyed_flag = true;
+            }
+            return !destroyed;
+        };
+
+        if (m_connecter != nullptr && connect_ready()) {
+            std::coroutine_handle<> handle = m_connecter->m_handle;
+            m_connecter = nullptr;
+            if (!resume(handle)) {
+                return;
+            }
+        }
+
+        if (m_reader != nullptr && read_ready()) {
+            std::coroutine_handle<> handle = m_reader->m_handle;
+            m_reader = nullptr;
+            if (!resume(handle)) {
+                return;
+            }
+        }
+
+        if (m_writer != nullptr) {
+            write_some(m_writer->m_src);
+
+            if (m_writer->m_src.tot_len == 0 || !writable()) {
+                std::coroutine_handle<> handle = m_writer->m_handle;
+                m_writer = nullptr;
+                if (!resume(handle)) {
+                    return;
+                }
+            }
+        }
+
+        if (m_closer != nullptr && shutdown_ready()) {
+            std::coroutine_handle<> handle = m_closer->m_handle;
+            m_closer = nullptr;
+            if (!resume(handle)) {
+                return;
+            }
+        }
+
+        m_destroyed_flag = prev_destroyed_flag;
+    }
+
+    void connectionAborted () override final
+    {
+        resume_waiters();
+    }
+
+    void connectionEstablished () override final
+    {
+        m_established = true;
+
+        resume_waiters();
+    }
+
+    void dataReceived ([[maybe_unused]] std::size_t amount) override final
+    {
+        resume_waiters();
+    }
+
+    void dataSent ([[maybe_unused]] std::size_t amount) override final
+    {
+        resume_waiters();
+    }
+
+private:
+    RecvRingBuffer<Arg> m_rx_ring;
+    SendRingBuffer<Arg> m_tx_ring;
+    char *m_rx_buf;
+    char *m_tx_buf;
+    std::size_t m_rx_buf_size;
+    std::size_t m_tx_buf_size;
+    ReadAwaiter *m_reader;
+    WriteAwaiter *m_writer;
+    ConnectAwaiter *m_connecter;
+    ShutdownAwaiter *m_closer;
+    bool *m_destroyed_flag;
+    bool m_established;
+};
+
+/**
+ * TCP listener for accepting connections using @ref CoroTcpConnection::accept.
+ * 
+ * Each established connection is accepted by the coroutine which has waited in
+ * @ref CoroTcpConnection::accept the longest. If no coroutine is waiting, the
+ * connection is aborted, so a server should always have a coroutine waiting (the
+ * listener can be limited to a number of pending connections using
+ * @ref TcpListenParams::max_pcbs).
+ * 
+ * @tparam Arg Template parameter of @ref TcpListener.
+ */
+template<typename Arg>
+class CoroTcpListener :
+    private NonCopyable<CoroTcpListener<Arg>>
+{
+    friend class CoroTcpConnection<Arg>;
+
+    using AcceptAwaiter = typename CoroTcpConnection<Arg>::AcceptAwaiter;
+
+public:
+    /**
+     * Construct the listener in not-listening state.
+     */
+    CoroTcpListener () :
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&CoroTcpListener::connectionEstablished, this))
+    {}
+
+    /**
+     * Destruct the listener.
+     * 
+     * No coroutine may be waiting to accept a connection.
+     */
+    ~CoroTcpListener ()
+    {
+        AIPSTACK_ASSERT(m_waiters.isEmpty());
+    }
+
+    /**
+     * Get the underlying listener, to start listening and configure it.
+     * 
+     * @return Reference to the @ref TcpListener.
+     */
+    inline TcpListener<Arg> & getListener ()
+    {
+        return m_listener;
+    }
+
+private:
+    void connectionEstablished ()
+    {
+        AcceptAwaiter *waiter = m_waiters.first();
+        if (waiter == nullptr) {
+            return;
+        }
+
+        m_waiters.removeFirst();
+        waiter->m_waiting = false;
+
+        // The connection must be accepted from within this callback.
+        waiter->m_result = waiter->m_con.accept_from(m_listener);
+
+        waiter->m_handle.resume();
+    }
+
+private:
+    TcpListener<Arg> m_listener;
+    StructureRaiiWrapper<typename CoroTcpConnection<Arg>::AcceptList> m_waiters;
+};
+
+/**
+ * Information about a datagram received using @ref CoroUdpSocket::recv.
+ */
+struct CoroUdpRecvInfo {
+    /**
+     * Number of bytes copied (the datagram is truncated if it does not fit).
+     */
+    std::size_t len;
+
+    /**
+     * Length of the datagram data.
+     */
+    std::size_t dgram_len;
+
+    /**
+     * Addresses, where the local address is the destination address of the datagram
+     * (suitable for @ref UdpApi::sendUdpIp4Packet to reply).
+     */
+    Ip4AddrPair addrs;
+
+    /**
+     * Local (destination) port.
+     */
+    std::uint16_t local_port;
+
+    /**
+     * Remote (source) port.
+     */
+    std::uint16_t remote_port;
+};
+
+/**
+ * UDP listener with an awaitable receive operation.
+ * 
+ * Datagrams which arrive while no coroutine is waiting in @ref recv are dropped
+ * (see @ref getNumDropped). Listening must not be started with
+ * `UdpListenParams::defer_checksum`. Datagrams are sent directly using @ref
+ * UdpApi::sendUdpIp4Packet, since that does not need to wait.
+ * 
+ * @tparam Arg Template parameter of @ref UdpListener.
+ */
+template<typename Arg>
+class CoroUdpSocket :
+    private NonCopyable<CoroUdpSocket<Arg>>
+{
+    using StackArg = typename Arg::StackArg;
+
+public:
+    class RecvAwaiter;
+
+    /**
+     * Construct the object in not-listening state.
+     */
+    CoroUdpSocket () :
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&CoroUdpSocket::udpPacket, this)),
+        m_receiver(nullptr),
+        m_num_dropped(0)
+    {}
+
+    /**
+     * Destruct the object.
+     * 
+     * No coroutine other than the one destructing the object may be waiting in
+     * @ref recv.
+     */
+    ~CoroUdpSocket ()
+    {
+        AIPSTACK_ASSERT(m_receiver == nullptr);
+    }
+
+    /**
+     * Get the underlying listener, to start listening.
+     * 
+     * @return Reference to the @ref UdpListener.
+     */
+    inline UdpListener<Arg> & getListener ()
+    {
+        return m_listener;
+    }
+
+    /**
+     * Get the number of datagrams which were dropped because no coroutine was waiting.
+     * 
+     * @return Number of dropped datagrams.
+     */
+    inline std::uint64_t getNumDropped () const
+    {
+        return m_num_dropped;
+    }
+
+    /**
+     * Wait for a datagram and copy its data.
+     * 
+     * At most one coroutine may be waiting at a time.
+     * 
+     * @param dst Where to copy the data to.
+     * @return Awaitable with result type @ref CoroUdpRecvInfo.
+     */
+    RecvAwaiter recv (IpBufRef dst)
+    {
+        AIPSTACK_ASSERT(m_receiver == nullptr);
+
+        return RecvAwaiter(*this, dst);
+    }
+
+    /**
+     * Awaitable returned by @ref recv.
+     */
+    class RecvAwaiter :
+        private NonCopyable<RecvAwaiter>
+    {
+        friend class CoroUdpSocket;
+
+    public:
+        #ifndef IN_DOXYGEN
+        ~RecvAwaiter ()
+        {
+            if (m_sock.m_receiver == this) {
+                m_sock.m_receiver = nullptr;
+            }
+        }
+
+        bool await_ready () const
+        {
+            return false;
+        }
+
+        void await_suspend (std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_sock.m_receiver = this;
+        }
+
+        CoroUdpRecvInfo await_resume () const
+        {
+            return m_info;
+        }
+        #endif
+
+    private:
+        RecvAwaiter (CoroUdpSocket &sock, IpBufRef dst) :
+            m_sock(sock),
+            m_dst(dst)
+        {}
+
+        CoroUdpSocket &m_sock;
+        IpBufRef m_dst;
+        std::coroutine_handle<> m_handle;
+        CoroUdpRecvInfo m_info;
+    };
+
+private:
+    UdpRecvResult udpPacket (IpRxInfoIp4<StackArg> const &ip_info,
+                             UdpRxInfo<Arg> const &udp_info, IpBufRef udp_data)
+    {
+        AIPSTACK_ASSERT(!udp_info.checksum_pending);
+
+        RecvAwaiter *receiver = m_receiver;
+        if (receiver == nullptr) {
+            m_num_dropped++;
+            return UdpRecvResult::AcceptStop;
+        }
+
+        m_receiver = nullptr;
+
+        std::size_t len = MinValue(udp_data.tot_len, receiver->m_dst.tot_len);
+        ipBufGiveBuf(receiver->m_dst, udp_data.subTo(len));
+
+        receiver->m_info = CoroUdpRecvInfo{
+            len, udp_data.tot_len, Ip4AddrPair{ip_info.dst_addr, ip_info.src_addr},
+            udp_info.dst_port, udp_info.src_port};
+
+        receiver->m_handle.resume();
+
+        return UdpRecvResult::AcceptStop;
+    }
+
+private:
+    UdpListener<Arg> m_listener;
+    RecvAwaiter *m_receiver;
+    std::uint64_t m_num_dropped;
+};
+
+/** @} */
+
+}
+
+#endif
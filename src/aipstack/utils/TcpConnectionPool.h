@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIPSTACK_TCP_CONNECTION_POOL_H
+#define AIPSTACK_TCP_CONNECTION_POOL_H
+
+#include <cstddef>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/ResourceArray.h>
+
+namespace AIpStack {
+
+/**
+ * Fixed-size pool of pre-constructed connection objects.
+ * 
+ * All objects (typically application classes deriving from @ref TcpConnection
+ * and embedding their send and receive buffers) are constructed together with
+ * the pool, and @ref allocate and @ref release only move them to and from a
+ * free list. This avoids dynamic allocation when accepting connections, see
+ * @ref TcpListenQueue::QueuedListener::hasReadyConnection for accepting
+ * connections in batches.
+ * 
+ * An object must be returned to its initial state (e.g. with @ref
+ * TcpConnection::reset) before it is released.
+ * 
+ * @tparam Object Type of the objects.
+ * @tparam PoolSize Number of objects, must be greater than zero.
+ */
+template<typename Object, std::size_t PoolSize>
+class TcpConnectionPool :
+    private NonCopyable<TcpConnectionPool<Object, PoolSize>>
+{
+    static_assert(PoolSize > 0);
+    
+public:
+    /**
+     * Construct the pool, constructing all objects with the same arguments.
+     * 
+     * @param args Arguments passed to the constructor of each object.
+     */
+    template<typename ...Args>
+    TcpConnectionPool (Args const & ... args) :
+        m_objects(ResourceArrayInitSame(), args...),
+        m_num_free(PoolSize)
+    {
+        // Objects are handed out from the end of the free stack, starting with
+        // the first object.
+        for (std::size_t i = 0; i < PoolSize; i++) {
+            m_free[i] = &m_objects[PoolSize - 1 - i];
+        }
+    }
+    
+    /**
+     * Take an object from the pool.
+     * 
+     * @return A free object, or null if all objects are in use.
+     */
+    inline Object * allocate ()
+    {
+        if (m_num_free == 0) {
+            return nullptr;
+        }
+        return m_free[--m_num_free];
+    }
+    
+    /**
+     * Return an object to the pool.
+     * 
+     * @param obj An object of this pool which is in use.
+     */
+    inline void release (Object *obj)
+    {
+        AIPSTACK_ASSERT(obj >= m_objects.data() && obj < m_objects.data() + PoolSize);
+        AIPSTACK_ASSERT(m_num_free < PoolSize);
+        
+        m_free[m_num_free++] = obj;
+    }
+    
+    /**
+     * Return the number of free objects.
+     * 
+     * @return Number of objects which can be allocated.
+     */
+    inline std::size_t numFree () const
+    {
+        return m_num_free;
+    }
+    
+private:
+    ResourceArray<Object, PoolSize> m_objects;
+    Object *m_free[PoolSize];
+    std::size_t m_num_free;
+};
+
+}
+
+#endif
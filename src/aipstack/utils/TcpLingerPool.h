@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_TCP_LINGER_POOL_H
+#define AIPSTACK_TCP_LINGER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/StructureRaiiWrapper.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * Finishes the delivery of data of closed connections from its own buffers.
+ *
+ * Resetting a @ref TcpConnection while it has unacknowledged data aborts the
+ * connection, because the stack cannot retransmit from the buffers of the
+ * application once they are released. With @ref LingerPool::closeConnection
+ * the remaining data is instead copied into a buffer of the pool and the
+ * connection is moved there (see @ref TcpConnection::moveConnection), so the
+ * connection object and its buffers can be reused right away while the data
+ * and the FIN are delivered. Once everything has been acknowledged, the
+ * connection is abandoned as with @ref TcpConnection::reset.
+ *
+ * Data received on a lingering connection is discarded and causes the
+ * connection to be reset, as with a close of a socket with unread data. A
+ * connection which has not delivered its data within the linger timeout is
+ * also reset.
+ *
+ * The memory for lingering data is limited to the entries, which are
+ * provided by the application, each holding up to BufferSize bytes. One pool
+ * is normally used for all connections of a stack.
+ *
+ * @tparam PlatformImpl Platform implementation class.
+ * @tparam TcpArg Template parameter of @ref TcpConnection.
+ * @tparam BufferSize Size of the buffer of each entry, the maximum amount of
+ *         unacknowledged data of a connection that can linger.
+ */
+template<
+    typename PlatformImpl,
+    typename TcpArg,
+    std::size_t BufferSize
+>
+class TcpLingerPool {
+    using Platform = PlatformFacade<PlatformImpl>;
+    AIPSTACK_USE_TYPES(Platform, (TimeType))
+
+    using Connection = TcpConnection<TcpArg>;
+
+    static_assert(BufferSize > 0);
+
+    // Size of the buffer which receives data to be discarded.
+    inline static constexpr std::size_t DiscardBufferSize = 64;
+
+public:
+    class LingerPool;
+    class LingerEntry;
+
+private:
+    using EntryLinkModel = PointerLinkModel<LingerEntry>;
+    struct EntryListAccessor;
+    using EntryList = LinkedList<EntryListAccessor, EntryLinkModel, true>;
+
+public:
+    class LingerEntry :
+        private Connection
+    {
+        friend class LingerPool;
+        friend struct EntryListAccessor;
+
+    private:
+        void init (LingerPool *pool)
+        {
+            m_pool = pool;
+            m_buf_node = IpBufNode{m_buf, BufferSize, nullptr};
+            m_lingering = false;
+        }
+
+        void deinit ()
+        {
+            Connection::reset();
+        }
+
+        void linger_from (Connection &src_con)
+        {
+            AIPSTACK_ASSERT(!m_lingering);
+            AIPSTACK_ASSERT(Connection::isInit());
+
+            // Copy the data which has not been acknowledged yet.
+            IpBufRef snd_buf = src_con.getSendBuf();
+            std::size_t snd_len = snd_buf.tot_len;
+            AIPSTACK_ASSERT(snd_len > 0 && snd_len <= BufferSize);
+            ipBufTakeBytes(snd_buf, snd_len, m_buf);
+
+            Connection::moveConnection(&src_con);
+
+            // Replace the buffers of the application. The receive buffer of
+            // the same size only takes data to be discarded, so it wraps around
+            // in the small shared discard buffer.
+            Connection::relocateSendBuf(IpBufRef{&m_buf_node, 0, snd_len});
+            Connection::setRecvBuf(IpBufRef{
+                &m_pool->m_discard_node, 0, Connection::getRecvBuf().tot_len});
+            Connection::setRecvZeroCopy(false);
+            Connection::setRecvBufAutoTuning(0, 0);
+
+            // Closing sending also sends any data held back by the send mode.
+            if (!Connection::wasSendingClosed()) {
+                Connection::closeSending();
+            }
+
+            m_time = Connection::getApi().platform().getEventTime();
+            m_lingering = true;
+
+            // The event time does not decrease, so the queue stays ordered
+            // by m_time.
+            m_pool->m_free_list.remove(*this);
+            m_pool->m_queue.append(*this);
+            m_pool->m_num_lingering++;
+
+            // Added a lingering connection -> update timeout.
+            m_pool->update_timeout();
+        }
+
+        void reset_connection (bool have_unprocessed_data)
+        {
+            AIPSTACK_ASSERT(m_lingering);
+
+            Connection::reset(have_unprocessed_data);
+            m_lingering = false;
+
+            m_pool->m_queue.remove(*this);
+            m_pool->m_free_list.prepend(*this);
+            m_pool->m_num_lingering--;
+
+            // Removed a lingering connection -> update timeout.
+            m_pool->update_timeout();
+        }
+
+    private:
+        void connectionAborted () override final
+        {
+            AIPSTACK_ASSERT(m_lingering);
+
+            m_pool->m_stats.aborted++;
+            reset_connection(false);
+        }
+
+        void dataReceived (std::size_t amount) override final
+        {
+            AIPSTACK_ASSERT(m_lingering);
+
+            if (amount > 0) {
+                m_pool->m_stats.aborted++;
+                reset_connection(true);
+            }
+        }
+
+        void dataSent (std::size_t) override final
+        {
+            AIPSTACK_ASSERT(m_lingering);
+
+            // When all data has been acknowledged the buffer is no longer
+            // needed, the abandoned connection completes sending the FIN.
+            if (Connection::getSendBuf().tot_len == 0) {
+                m_pool->m_stats.completed++;
+                reset_connection(false);
+            }
+        }
+
+    private:
+        LingerPool *m_pool;
+        TimeType m_time;
+        LinkedListNode<EntryLinkModel> m_list_node;
+        IpBufNode m_buf_node;
+        bool m_lingering;
+        char m_buf[BufferSize];
+    };
+
+private:
+    struct EntryListAccessor : public MemberAccessor<
+        LingerEntry, LinkedListNode<EntryLinkModel>, &LingerEntry::m_list_node> {};
+
+public:
+    struct LingerPoolParams {
+        // Entries for lingering connections.
+        int num_entries = 0;
+        LingerEntry *entries = nullptr;
+
+        // Time after which a connection which still has data to deliver is
+        // reset.
+        TimeType linger_timeout = 0;
+    };
+
+    // Statistics of the pool. The counters wrap around on overflow.
+    struct LingerPoolStats {
+        // Connections moved into the pool.
+        std::uint32_t lingered = 0;
+
+        // Calls of closeConnection which could not take the connection
+        // because its data did not fit or no entry was free.
+        std::uint32_t rejected = 0;
+
+        // Lingering connections which delivered all data.
+        std::uint32_t completed = 0;
+
+        // Lingering connections which were aborted or reset because data was
+        // received.
+        std::uint32_t aborted = 0;
+
+        // Lingering connections reset because of linger_timeout.
+        std::uint32_t timed_out = 0;
+    };
+
+public:
+    class LingerPool :
+        private NonCopyable<LingerPool>
+    {
+        friend class LingerEntry;
+
+    public:
+        LingerPool (PlatformFacade<PlatformImpl> platform) :
+            m_timeout_timer(platform,
+                AIPSTACK_BIND_MEMBER_TN(&LingerPool::timeoutTimerHandler, this)),
+            m_discard_node{m_discard_buf, DiscardBufferSize, &m_discard_node},
+            m_num_entries(0),
+            m_num_lingering(0)
+        {}
+
+        ~LingerPool ()
+        {
+            deinit_entries();
+        }
+
+        void reset ()
+        {
+            deinit_entries();
+            m_timeout_timer.unset();
+            m_free_list.init();
+            m_queue.init();
+            m_num_entries = 0;
+            m_num_lingering = 0;
+        }
+
+        // Start using the entries, which must not be used by another pool.
+        void start (LingerPoolParams const &params)
+        {
+            AIPSTACK_ASSERT(m_num_entries == 0);
+            AIPSTACK_ASSERT(params.num_entries > 0 && params.entries != nullptr);
+
+            m_params = params;
+            m_num_entries = params.num_entries;
+            m_stats = LingerPoolStats();
+
+            for (int i = 0; i < m_num_entries; i++) {
+                LingerEntry &entry = m_params.entries[i];
+                entry.init(this);
+                m_free_list.append(entry);
+            }
+        }
+
+        // Return the statistics of the pool. They are reset by start.
+        LingerPoolStats getStats () const
+        {
+            return m_stats;
+        }
+
+        // Return the number of lingering connections.
+        int numLingering () const
+        {
+            return m_num_lingering;
+        }
+
+        // Close a connection and bring con to INIT state, without aborting it
+        // if it has unacknowledged data. This is like TcpConnection::reset,
+        // except that if data remains to be delivered, it is copied into an
+        // entry together with the connection, which then closes sending
+        // (unless that was done already) and completes delivery on its own.
+        //
+        // Returns false if the data does not fit into an entry or no entry is
+        // free. Then con is not affected, and the application may keep it
+        // until the data has been acknowledged or reset it (which aborts it).
+        //
+        // This may be called from callbacks of con. The application does not
+        // get any more callbacks for the connection, in particular send
+        // regions of a TcpSendRegionQueue are not reported as sent.
+        bool closeConnection (Connection &con, bool have_unprocessed_data = false)
+        {
+            AIPSTACK_ASSERT(m_num_entries > 0);
+
+            if (!con.isConnected() || con.getSendBuf().tot_len == 0 ||
+                have_unprocessed_data)
+            {
+                con.reset(have_unprocessed_data);
+                return true;
+            }
+
+            if (m_free_list.isEmpty() || con.getSendBuf().tot_len > BufferSize) {
+                m_stats.rejected++;
+                return false;
+            }
+
+            LingerEntry &entry = *m_free_list.first();
+            entry.linger_from(con);
+            m_stats.lingered++;
+
+            return true;
+        }
+
+    private:
+        void timeoutTimerHandler ()
+        {
+            // The timeout is kept updated to expire for the oldest lingering
+            // connection, which is the first in the queue, reset it.
+            AIPSTACK_ASSERT(!m_queue.isEmpty());
+
+            m_stats.timed_out++;
+            (*m_queue.first()).reset_connection(false);
+        }
+
+        void update_timeout ()
+        {
+            if (!m_queue.isEmpty()) {
+                LingerEntry &entry = *m_queue.first();
+                m_timeout_timer.setAt(entry.m_time + m_params.linger_timeout);
+            } else {
+                m_timeout_timer.unset();
+            }
+        }
+
+        void deinit_entries ()
+        {
+            for (int i = 0; i < m_num_entries; i++) {
+                m_params.entries[i].deinit();
+            }
+        }
+
+    private:
+        typename Platform::Timer m_timeout_timer;
+        IpBufNode m_discard_node;
+        LingerPoolParams m_params;
+        StructureRaiiWrapper<EntryList> m_free_list;
+        StructureRaiiWrapper<EntryList> m_queue;
+        int m_num_entries;
+        int m_num_lingering;
+        LingerPoolStats m_stats;
+        char m_discard_buf[DiscardBufferSize];
+    };
+};
+
+}
+
+#endif
@@ -26,9 +26,11 @@
 #define AIPSTACK_TCP_LISTEN_QUEUE_H
 
 #include <cstddef>
+#include <cstdint>
 
 #include <aipstack/misc/Use.h>
 #include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
 #include <aipstack/misc/NonCopyable.h>
 #include <aipstack/misc/Function.h>
 #include <aipstack/infra/Buf.h>
@@ -36,6 +38,7 @@
 #include <aipstack/tcp/TcpApi.h>
 #include <aipstack/tcp/TcpConnection.h>
 #include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpStats.h>
 #include <aipstack/platform/PlatformFacade.h>
 
 namespace AIpStack {
@@ -85,9 +88,11 @@ public:
             
             Connection::setRecvBuf(IpBufRef{&m_rx_buf_node, 0, RxBufferSize});
             
-            m_time = Connection::getApi().platform().getTime();
+            m_time = Connection::getApi().platform().getEventTime();
             m_ready = false;
             
+            m_listener->m_stats.queued++;
+            
             // Added a not-ready connection -> update timeout.
             m_listener->update_timeout();
         }
@@ -139,8 +144,10 @@ public:
                 // Non-ready connection changed to ready -> update timeout.
                 m_listener->update_timeout();
                 
-                // Try to hand over ready connections.
-                m_listener->dispatch_connections();
+                // Hand over ready connections from the event loop, so that all
+                // connections which become ready together are dispatched in one
+                // batch.
+                m_listener->m_dequeue_timer.setNow();
             }
         }
         
@@ -162,6 +169,27 @@ public:
         int queue_size = 0;
         TimeType queue_timeout = 0;
         ListenQueueEntry *queue_entries = nullptr;
+        std::uint8_t defer_accept = 0;
+    };
+    
+    // Statistics of the queue (not maintained if queue_size is zero). The
+    // counters wrap around on overflow.
+    struct ListenQueueStats {
+        // Connections taken into the queue.
+        std::uint32_t queued = 0;
+        
+        // Connections aborted because all queue entries were in use.
+        std::uint32_t queue_full = 0;
+        
+        // Queued connections reset because no data was received before
+        // queue_timeout.
+        std::uint32_t timed_out = 0;
+        
+        // Queued connections accepted by the application.
+        std::uint32_t dispatched = 0;
+        
+        // Time that dispatched connections spent in the queue.
+        TcpTimeHistogram wait_time;
     };
     
 public:
@@ -215,6 +243,7 @@ public:
             m_queue_size = q_params.queue_size;
             m_queue_timeout = q_params.queue_timeout;
             m_queued_to_accept = nullptr;
+            m_stats = ListenQueueStats();
             
             // Init queue entries.
             for (int i = 0; i < m_queue_size; i++) {
@@ -225,6 +254,9 @@ public:
             std::size_t initial_rx_window = (m_queue_size == 0) ? q_params.min_rcv_buf_size : RxBufferSize;
             m_listener.setInitialReceiveWindow(initial_rx_window);
             
+            // Set deferred accept (see TcpListener::setDeferAccept).
+            m_listener.setDeferAccept(q_params.defer_accept);
+            
             return true;
         }
         
@@ -237,6 +269,34 @@ public:
             }
         }
         
+        // Return the statistics of the underlying listener (see
+        // TcpListener::getStats).
+        TcpListenerStats getListenerStats () const
+        {
+            return m_listener.getStats();
+        }
+        
+        // Return the statistics of the queue. They are reset by startListening.
+        ListenQueueStats getQueueStats () const
+        {
+            return m_stats;
+        }
+        
+        // Return whether acceptConnection can be called. In the established
+        // handler with m_queue_size>0, this allows accepting all ready
+        // connections in one batch by calling acceptConnection while this
+        // returns true (e.g. with objects from a TcpConnectionPool).
+        bool hasReadyConnection () const
+        {
+            AIPSTACK_ASSERT(m_listener.isListening());
+            
+            if (m_queue_size == 0) {
+                return m_listener.hasAcceptPending();
+            } else {
+                return m_queued_to_accept != nullptr;
+            }
+        }
+        
         // NOTE: If m_queue_size>0, there are complications that you
         // must deal with:
         // - Any initial data which has already been received will be returned
@@ -264,10 +324,19 @@ public:
                 AIPSTACK_ASSERT(m_queued_to_accept->m_ready);
                 
                 ListenQueueEntry *entry = m_queued_to_accept;
-                m_queued_to_accept = nullptr;
+                
+                TimeType now = entry->Connection::getApi().platform().getEventTime();
+                m_stats.dispatched++;
+                m_stats.wait_time.add(std::uint32_t(MinValue(
+                    double(TimeType(now - entry->m_time)) * (1e3 / Platform::TimeFreq),
+                    double(TypeMax<std::uint32_t>))));
                 
                 initial_rx_data = entry->get_received_data();
                 dst_con.moveConnection(entry);
+                
+                // Publish the next oldest ready connection, if any.
+                m_queued_to_accept = find_oldest(true);
+                
                 return IpErr::Success;
             }
         }
@@ -283,13 +352,19 @@ public:
                 m_established_handler();
             } else {
                 // Try to accept the connection into the queue.
+                bool found_entry = false;
                 for (int i = 0; i < m_queue_size; i++) {
                     ListenQueueEntry &entry = m_queue[i];
                     if (entry.Connection::isInit()) {
                         entry.accept_connection();
+                        found_entry = true;
                         break;
                     }
                 }
+                
+                if (!found_entry) {
+                    m_stats.queue_full++;
+                }
             }
             
             // If the connection was not accepted, it will be aborted.
@@ -306,7 +381,8 @@ public:
             AIPSTACK_ASSERT(m_queue_size > 0);
             AIPSTACK_ASSERT(m_queued_to_accept == nullptr);
             
-            // Try to dispatch the oldest ready connections.
+            // Try to dispatch the oldest ready connections. The accept handler
+            // may accept any number of them while hasReadyConnection is true.
             while (ListenQueueEntry *entry = find_oldest(true)) {
                 AIPSTACK_ASSERT(!entry->Connection::isInit());
                 AIPSTACK_ASSERT(entry->m_ready);
@@ -314,10 +390,11 @@ public:
                 // Call the accept handler, while publishing the connection.
                 m_queued_to_accept = entry;
                 m_established_handler();
-                m_queued_to_accept = nullptr;
                 
-                // If the connection was not taken, stop trying.
-                if (!entry->Connection::isInit()) {
+                // If a connection was not taken, stop trying.
+                bool not_taken = m_queued_to_accept != nullptr;
+                m_queued_to_accept = nullptr;
+                if (not_taken) {
                     break;
                 }
             }
@@ -352,6 +429,7 @@ public:
             AIPSTACK_ASSERT(!entry->m_ready);
             
             // Reset the oldest non-ready connection.
+            m_stats.timed_out++;
             entry->reset_connection();
         }
         
@@ -390,6 +468,7 @@ public:
         int m_queue_size;
         TimeType m_queue_timeout;
         ListenQueueEntry *m_queued_to_accept;
+        ListenQueueStats m_stats;
     };
 };
 
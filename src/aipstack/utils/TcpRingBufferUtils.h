@@ -44,21 +44,16 @@ class SendRingBuffer {
 public:
     void setup (TcpConnection<TcpArg> &con, char *buf, std::size_t buf_size)
     {
-        AIPSTACK_ASSERT(buf != nullptr);
-        AIPSTACK_ASSERT(buf_size > 0);
-        AIPSTACK_ASSERT(buf_size >= con.getSendBuf().tot_len);
-        
-        m_buf_node = IpBufNode{buf, buf_size, &m_buf_node};
-        
-        IpBufRef old_send_buf = con.getSendBuf();
-
-        IpBufRef send_buf = IpBufRef{&m_buf_node, std::size_t(0), old_send_buf.tot_len};
-
-        if (old_send_buf.tot_len > 0) {
-            ipBufGiveBuf(send_buf, old_send_buf);
-        }
-
-        con.setSendBuf(send_buf);
+        setup_common(con, buf, buf_size, false);
+    }
+    
+    // Setup with a buffer which is mapped twice back to back, so that buf[i] and
+    // buf[buf_size + i] refer to the same memory (see MirroredRingMemory). The
+    // ranges returned by getWriteRange and the data sent by the stack are then
+    // always contiguous.
+    void setupMirrored (TcpConnection<TcpArg> &con, char *buf, std::size_t buf_size)
+    {
+        setup_common(con, buf, buf_size, true);
     }
     
     inline IpBufRef getWriteRange (TcpConnection<TcpArg> &con) const
@@ -68,11 +63,12 @@ public:
         // Assert that the range is valid for the circular buffer. The less in the second
         // assertion is due to guaranteed eager advancement to subsequent buffer nodes.
         AIPSTACK_ASSERT(send_buf.tot_len <= getModulo().modulus());
-        AIPSTACK_ASSERT(send_buf.offset < getModulo().modulus());
+        AIPSTACK_ASSERT(send_buf.offset < m_buf_node.len);
 
         // The range of free space for writing data is the complement of the range of
         // buffered outgoing data.
-        std::size_t write_offset = getModulo().add(send_buf.offset, send_buf.tot_len);
+        std::size_t write_offset =
+            getModulo().add(normalizeOffset(send_buf.offset), send_buf.tot_len);
         std::size_t free_len = getModulo().modulusComplement(send_buf.tot_len);
         
         return IpBufRef{&m_buf_node, write_offset, free_len};
@@ -82,17 +78,56 @@ public:
     {
         AIPSTACK_ASSERT(amount <= getWriteRange(con).tot_len);
         
-        con.extendSendBuf(amount);
+        IpBufRef send_buf = con.getSendBuf();
+        
+        // With a mirrored buffer, move the send buffer back into the first copy once
+        // it has advanced into the second, so that it never extends past the end.
+        if (m_mirrored && send_buf.offset >= getModulo().modulus()) {
+            send_buf.offset -= getModulo().modulus();
+            send_buf.tot_len += amount;
+            con.setSendBuf(send_buf);
+        } else {
+            con.extendSendBuf(amount);
+        }
     }
     
 private:
+    void setup_common (TcpConnection<TcpArg> &con, char *buf, std::size_t buf_size,
+                       bool mirrored)
+    {
+        AIPSTACK_ASSERT(buf != nullptr);
+        AIPSTACK_ASSERT(buf_size > 0);
+        AIPSTACK_ASSERT(!mirrored || buf_size <= TypeMax<std::size_t> / 2);
+        AIPSTACK_ASSERT(buf_size >= con.getSendBuf().tot_len);
+        
+        m_buf_node = IpBufNode{buf, mirrored ? 2 * buf_size : buf_size, &m_buf_node};
+        m_mirrored = mirrored;
+        
+        IpBufRef old_send_buf = con.getSendBuf();
+        
+        IpBufRef send_buf = IpBufRef{&m_buf_node, std::size_t(0), old_send_buf.tot_len};
+        
+        if (old_send_buf.tot_len > 0) {
+            ipBufGiveBuf(send_buf, old_send_buf);
+        }
+        
+        con.setSendBuf(send_buf);
+    }
+    
     inline Modulo getModulo () const
     {
-        return Modulo(m_buf_node.len);
+        return Modulo(m_mirrored ? m_buf_node.len / 2 : m_buf_node.len);
+    }
+    
+    inline std::size_t normalizeOffset (std::size_t offset) const
+    {
+        std::size_t size = getModulo().modulus();
+        return (offset >= size) ? (offset - size) : offset;
     }
     
 private:
     IpBufNode m_buf_node;
+    bool m_mirrored;
 };
 
 template<typename TcpArg>
@@ -104,30 +139,17 @@ public:
     void setup (TcpConnection<TcpArg> &con, char *buf, std::size_t buf_size, int wnd_upd_div,
                 IpBufRef initial_rx_data = IpBufRef{})
     {
-        AIPSTACK_ASSERT(buf != nullptr);
-        AIPSTACK_ASSERT(buf_size > 0);
-        AIPSTACK_ASSERT(wnd_upd_div >= 2);
-        AIPSTACK_ASSERT(initial_rx_data.tot_len <= buf_size);
-        AIPSTACK_ASSERT(buf_size - initial_rx_data.tot_len >= con.getRecvBuf().tot_len);
-        
-        m_buf_node = IpBufNode{buf, buf_size, &m_buf_node};
-        
-        con.setProportionalWindowUpdateThreshold(buf_size, wnd_upd_div);
-        
-        IpBufRef old_recv_buf = con.getRecvBuf();
-
-        IpBufRef recv_buf = IpBufRef{&m_buf_node, std::size_t(0), buf_size};
-        
-        if (initial_rx_data.tot_len > 0) {
-            recv_buf = ipBufGiveBuf(recv_buf, initial_rx_data);
-        }
-        
-        if (old_recv_buf.tot_len > 0) {
-            ipBufGiveBuf(recv_buf, old_recv_buf);
-            // recv_buf not assigned here, this is right
-        }
-        
-        con.setRecvBuf(recv_buf);
+        setup_common(con, buf, buf_size, wnd_upd_div, initial_rx_data, false);
+    }
+    
+    // Setup with a buffer which is mapped twice back to back, so that buf[i] and
+    // buf[buf_size + i] refer to the same memory (see MirroredRingMemory). The
+    // ranges returned by getReadRange are then always contiguous and
+    // updateMirrorAfterReceived is not needed.
+    void setupMirrored (TcpConnection<TcpArg> &con, char *buf, std::size_t buf_size,
+                        int wnd_upd_div, IpBufRef initial_rx_data = IpBufRef{})
+    {
+        setup_common(con, buf, buf_size, wnd_upd_div, initial_rx_data, true);
     }
     
     inline IpBufRef getReadRange (TcpConnection<TcpArg> &con)
@@ -137,11 +159,12 @@ public:
         // Assert that the range is valid for the circular buffer. The less in the second
         // assertion is due to guaranteed eager advancement to subsequent buffer nodes.
         AIPSTACK_ASSERT(recv_buf.tot_len <= getModulo().modulus());
-        AIPSTACK_ASSERT(recv_buf.offset < getModulo().modulus());
+        AIPSTACK_ASSERT(recv_buf.offset < m_buf_node.len);
         
         // The range of used space with received data is the complement of the range of
         // available space for received data.
-        std::size_t read_offset = getModulo().add(recv_buf.offset, recv_buf.tot_len);
+        std::size_t read_offset =
+            getModulo().add(normalizeOffset(recv_buf.offset), recv_buf.tot_len);
         std::size_t used_len = getModulo().modulusComplement(recv_buf.tot_len);
         
         return IpBufRef{&m_buf_node, read_offset, used_len};
@@ -151,12 +174,23 @@ public:
     {
         AIPSTACK_ASSERT(amount <= getReadRange(con).tot_len);
         
-        con.extendRecvBuf(amount);
+        IpBufRef recv_buf = con.getRecvBuf();
+        
+        // With a mirrored buffer, move the receive buffer back into the first copy
+        // once it has advanced into the second, so that it never extends past the end.
+        if (m_mirrored && recv_buf.offset >= getModulo().modulus()) {
+            recv_buf.offset -= getModulo().modulus();
+            recv_buf.tot_len += amount;
+            con.setRecvBuf(recv_buf);
+        } else {
+            con.extendRecvBuf(amount);
+        }
     }
     
     void updateMirrorAfterReceived (
         TcpConnection<TcpArg> &con, std::size_t mirror_size, std::size_t amount)
     {
+        AIPSTACK_ASSERT(!m_mirrored);
         AIPSTACK_ASSERT(mirror_size >= 0);
         AIPSTACK_ASSERT(mirror_size <= getModulo().modulus());
         
@@ -193,13 +227,51 @@ public:
     }
     
 private:
+    void setup_common (TcpConnection<TcpArg> &con, char *buf, std::size_t buf_size,
+                       int wnd_upd_div, IpBufRef initial_rx_data, bool mirrored)
+    {
+        AIPSTACK_ASSERT(buf != nullptr);
+        AIPSTACK_ASSERT(buf_size > 0);
+        AIPSTACK_ASSERT(!mirrored || buf_size <= TypeMax<std::size_t> / 2);
+        AIPSTACK_ASSERT(wnd_upd_div >= 2);
+        AIPSTACK_ASSERT(initial_rx_data.tot_len <= buf_size);
+        AIPSTACK_ASSERT(buf_size - initial_rx_data.tot_len >= con.getRecvBuf().tot_len);
+        
+        m_buf_node = IpBufNode{buf, mirrored ? 2 * buf_size : buf_size, &m_buf_node};
+        m_mirrored = mirrored;
+        
+        con.setProportionalWindowUpdateThreshold(buf_size, wnd_upd_div);
+        
+        IpBufRef old_recv_buf = con.getRecvBuf();
+        
+        IpBufRef recv_buf = IpBufRef{&m_buf_node, std::size_t(0), buf_size};
+        
+        if (initial_rx_data.tot_len > 0) {
+            recv_buf = ipBufGiveBuf(recv_buf, initial_rx_data);
+        }
+        
+        if (old_recv_buf.tot_len > 0) {
+            ipBufGiveBuf(recv_buf, old_recv_buf);
+            // recv_buf not assigned here, this is right
+        }
+        
+        con.setRecvBuf(recv_buf);
+    }
+    
     inline Modulo getModulo () const
     {
-        return Modulo(m_buf_node.len);
+        return Modulo(m_mirrored ? m_buf_node.len / 2 : m_buf_node.len);
+    }
+    
+    inline std::size_t normalizeOffset (std::size_t offset) const
+    {
+        std::size_t size = getModulo().modulus();
+        return (offset >= size) ? (offset - size) : offset;
     }
     
 private:
     IpBufNode m_buf_node;
+    bool m_mirrored;
 };
 
 }
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_TCP_SEND_REGION_QUEUE_H
+#define AIPSTACK_TCP_SEND_REGION_QUEUE_H
+
+#include <cstddef>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+namespace AIpStack {
+
+/**
+ * Sends data directly from application-owned memory regions.
+ * 
+ * Each queued @ref Region references external memory (e.g. a memory-mapped
+ * file or a cached object) which is linked into the send buffer of the
+ * connection without copying. The memory must remain valid and unchanged
+ * until the region is completed, that is until all of its data has been
+ * acknowledged, at which point the handler of the region is called.
+ * 
+ * The queue must be the only user of the send buffer of the connection, and
+ * the application must forward its @ref TcpConnection::dataSent callbacks
+ * to @ref dataSent. The send buffer must be empty when the first region is
+ * queued.
+ */
+template<typename TcpArg>
+class TcpSendRegionQueue :
+    private NonCopyable<TcpSendRegionQueue<TcpArg>>
+{
+public:
+    /**
+     * A region of memory queued for sending.
+     * 
+     * The region object must not be destructed or moved while it is queued.
+     * It may be destructed or queued again from its completion handler.
+     */
+    class Region :
+        private NonCopyable<Region>
+    {
+        friend TcpSendRegionQueue;
+    
+    public:
+        /**
+         * Type of callback used to report that all data of the region has
+         * been acknowledged.
+         */
+        using CompletedHandler = Function<void()>;
+        
+        /**
+         * Construct the region object, initially not queued.
+         * 
+         * @param handler Callback function (must not be null).
+         */
+        inline Region (CompletedHandler handler) :
+            m_handler(handler),
+            m_queued(false)
+        {}
+        
+        /**
+         * Return whether the region is queued.
+         * 
+         * @return Whether the region is queued.
+         */
+        inline bool isQueued () const
+        {
+            return m_queued;
+        }
+    
+    private:
+        IpBufNode m_node;
+        Region *m_next;
+        std::size_t m_rem_len;
+        CompletedHandler m_handler;
+        bool m_queued;
+    };
+    
+    inline TcpSendRegionQueue () :
+        m_end_node{nullptr, 0, nullptr},
+        m_first(nullptr),
+        m_last(nullptr)
+    {}
+    
+    /**
+     * Queue a memory region for sending.
+     * 
+     * The memory is only read by the stack, it may be in read-only memory.
+     * 
+     * @param con The connection, which must be in a state where the send
+     *        buffer can be extended (see @ref TcpConnection::setSendBuf).
+     * @param region The region object, which must not be queued.
+     * @param ptr Start of the memory.
+     * @param len Length of the memory, must be greater than zero.
+     */
+    void queueRegion (TcpConnection<TcpArg> &con, Region &region,
+                      char const *ptr, std::size_t len)
+    {
+        AIPSTACK_ASSERT(!region.m_queued);
+        AIPSTACK_ASSERT(ptr != nullptr);
+        AIPSTACK_ASSERT(len > 0);
+        
+        // The region is followed by the zero-length end node, so that the stack
+        // eagerly moves past the region when its data has been sent or acked.
+        region.m_node = IpBufNode{const_cast<char *>(ptr), len, &m_end_node};
+        region.m_next = nullptr;
+        region.m_rem_len = len;
+        region.m_queued = true;
+        
+        IpBufRef snd_buf = con.getSendBuf();
+        
+        if (m_first == nullptr) {
+            AIPSTACK_ASSERT(snd_buf.tot_len == 0);
+            
+            m_first = &region;
+            snd_buf = IpBufRef{&region.m_node, 0, len};
+        } else {
+            AIPSTACK_ASSERT(snd_buf.tot_len > 0);
+            AIPSTACK_ASSERT(len <= TypeMax<std::size_t> - snd_buf.tot_len);
+            
+            m_last->m_next = &region;
+            m_last->m_node.next = &region.m_node;
+            snd_buf.tot_len += len;
+        }
+        
+        m_last = &region;
+        
+        // Use setSendBuf rather than extendSendBuf because the current send
+        // position may be at the end node, which is not followed by the new
+        // region.
+        con.setSendBuf(snd_buf);
+    }
+    
+    /**
+     * Process acknowledged data, to be called from the
+     * @ref TcpConnection::dataSent callback of the connection.
+     * 
+     * This calls the handlers of regions which have been completed.
+     * 
+     * @param amount The amount passed to @ref TcpConnection::dataSent.
+     */
+    void dataSent (std::size_t amount)
+    {
+        while (amount > 0) {
+            Region *region = m_first;
+            AIPSTACK_ASSERT(region != nullptr);
+            
+            std::size_t region_amount = MinValue(amount, region->m_rem_len);
+            region->m_rem_len -= region_amount;
+            amount -= region_amount;
+            
+            if (region->m_rem_len == 0) {
+                // Dequeue the region before calling the handler, which may queue
+                // another region or destruct this one.
+                m_first = region->m_next;
+                if (m_first == nullptr) {
+                    m_last = nullptr;
+                }
+                region->m_queued = false;
+                
+                region->m_handler();
+            }
+        }
+    }
+    
+    /**
+     * Dequeue all regions without calling their handlers.
+     * 
+     * This must be used when the connection is reset, and may only be used
+     * when the send buffer of the connection will no longer be used.
+     */
+    void reset ()
+    {
+        for (Region *region = m_first; region != nullptr; region = region->m_next) {
+            region->m_queued = false;
+        }
+        
+        m_first = nullptr;
+        m_last = nullptr;
+    }
+    
+private:
+    IpBufNode m_end_node;
+    Region *m_first;
+    Region *m_last;
+};
+
+}
+
+#endif
@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_TCP_UPSTREAM_POOL_H
+#define AIPSTACK_TCP_UPSTREAM_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <aipstack/misc/Use.h>
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/platform/PlatformFacade.h>
+
+namespace AIpStack {
+
+/**
+ * Keeps established outbound connections to an upstream server for reuse.
+ *
+ * An @ref UpstreamPool maintains a number of warm connections to one address
+ * and port, which the application takes (@ref UpstreamPool::takeConnection)
+ * for a request instead of starting a new connection, and returns (@ref
+ * UpstreamPool::returnConnection) after the response has been received. This
+ * saves the handshake RTT, the slow start and the PCB setup for each request.
+ * Use one pool per upstream address.
+ *
+ * Connections are handed over with @ref TcpConnection::moveConnection, like
+ * with @ref TcpListenQueue. Idle connections in the pool have keepalive
+ * enabled if configured and are reset if the peer sends anything or closes
+ * them, or after they have been idle for too long, and the pool starts new
+ * connections to keep the configured number. By default the congestion window
+ * is preserved while a connection is idle (see @ref
+ * TcpConnection::setIdleCwndRestart).
+ *
+ * @tparam PlatformImpl Platform implementation class.
+ * @tparam TcpArg Template parameter of @ref TcpConnection.
+ * @tparam RxBufferSize Size of the receive buffer of each pool entry, which is
+ *         also the size of the receive window of the connections. The receive
+ *         buffer of the application for a taken connection must have this
+ *         size.
+ */
+template<
+    typename PlatformImpl,
+    typename TcpArg,
+    std::size_t RxBufferSize
+>
+class TcpUpstreamPool {
+    using Platform = PlatformFacade<PlatformImpl>;
+    AIPSTACK_USE_TYPES(Platform, (TimeType))
+
+    using Connection = TcpConnection<TcpArg>;
+
+    static_assert(RxBufferSize > 0);
+
+public:
+    class UpstreamPool;
+
+    class PoolEntry :
+        private Connection
+    {
+        friend class UpstreamPool;
+
+        enum class State : std::uint8_t {Free, Connecting, Idle};
+
+    private:
+        void init (UpstreamPool *pool)
+        {
+            m_pool = pool;
+            m_rx_buf_node = IpBufNode{m_rx_buf, RxBufferSize, nullptr};
+            m_state = State::Free;
+        }
+
+        void deinit ()
+        {
+            Connection::reset();
+        }
+
+        IpErr start_connection ()
+        {
+            AIPSTACK_ASSERT(m_state == State::Free);
+            AIPSTACK_ASSERT(Connection::isInit());
+
+            UpstreamPoolParams const &params = m_pool->m_params;
+
+            TcpStartConnectionArgs<TcpArg> args;
+            args.addr = params.addr;
+            args.port = params.port;
+            args.rcv_wnd = RxBufferSize;
+            args.dscp = params.dscp;
+
+            IpErr err = Connection::startConnection(*m_pool->m_tcp, args);
+            if (err != IpErr::Success) {
+                return err;
+            }
+
+            Connection::setRecvBuf(IpBufRef{&m_rx_buf_node, 0, RxBufferSize});
+            setup_pooled();
+
+            m_state = State::Connecting;
+
+            return IpErr::Success;
+        }
+
+        // Set the pool's settings for an idle connection.
+        void setup_pooled ()
+        {
+            UpstreamPoolParams const &params = m_pool->m_params;
+
+            Connection::setKeepalive(
+                params.ka_idle_secs, params.ka_interval_secs, params.ka_count);
+            Connection::setIdleCwndRestart(!params.preserve_cwnd);
+        }
+
+        void make_idle ()
+        {
+            m_time = Connection::getApi().platform().getEventTime();
+            m_state = State::Idle;
+
+            // Added an idle connection -> update timeout.
+            m_pool->update_timeout();
+        }
+
+        void reset_connection (bool have_unprocessed_data)
+        {
+            AIPSTACK_ASSERT(m_state != State::Free);
+
+            bool was_idle = m_state == State::Idle;
+
+            Connection::reset(have_unprocessed_data);
+            m_state = State::Free;
+
+            if (was_idle) {
+                // Removed an idle connection -> update timeout.
+                m_pool->update_timeout();
+            }
+        }
+
+        void take_into (Connection &dst_con)
+        {
+            AIPSTACK_ASSERT(m_state == State::Idle);
+
+            dst_con.moveConnection(this);
+            m_state = State::Free;
+        }
+
+        void return_from (Connection &src_con)
+        {
+            AIPSTACK_ASSERT(m_state == State::Free);
+
+            // The data in the receive buffer of the application must be copied
+            // before it is replaced, because out-of-sequence data may be stored
+            // there.
+            IpBufRef rcv_buf = src_con.getRecvBuf();
+            AIPSTACK_ASSERT(rcv_buf.tot_len <= RxBufferSize);
+            ipBufTakeBytes(rcv_buf, rcv_buf.tot_len, m_rx_buf);
+
+            Connection::moveConnection(&src_con);
+            Connection::setRecvBuf(IpBufRef{&m_rx_buf_node, 0, RxBufferSize});
+            // The send buffer is empty but must not reference the application's
+            // buffer any more.
+            Connection::setSendBuf(IpBufRef{&m_rx_buf_node, 0, 0});
+            Connection::setSendMode(TcpSendMode::Immediate);
+            setup_pooled();
+
+            make_idle();
+        }
+
+    private:
+        void connectionAborted () override final
+        {
+            AIPSTACK_ASSERT(m_state != State::Free);
+
+            State state = m_state;
+            reset_connection(false);
+
+            m_pool->entry_lost(state == State::Connecting);
+        }
+
+        void connectionEstablished () override final
+        {
+            AIPSTACK_ASSERT(m_state == State::Connecting);
+
+            m_pool->m_stats.established++;
+            make_idle();
+
+            // Let the application know from the event loop, so that it does not
+            // take the connection from within this callback.
+            if (m_pool->m_notify_needed) {
+                m_pool->m_notify_timer.setNow();
+            }
+        }
+
+        void dataReceived (std::size_t amount) override final
+        {
+            AIPSTACK_ASSERT(m_state != State::Free);
+
+            // The peer is not expected to send anything to an idle connection;
+            // a FIN would typically be an idle timeout of the server. Either
+            // way the connection is not usable for a request.
+            State state = m_state;
+            reset_connection(amount > 0);
+
+            m_pool->entry_lost(state == State::Connecting);
+        }
+
+        void dataSent (std::size_t) override final
+        {
+            AIPSTACK_ASSERT(false); // nothing is sent while in the pool
+        }
+
+    private:
+        UpstreamPool *m_pool;
+        TimeType m_time;
+        IpBufNode m_rx_buf_node;
+        State m_state;
+        char m_rx_buf[RxBufferSize];
+    };
+
+    struct UpstreamPoolParams {
+        // Address and port of the upstream server.
+        Ip4Addr addr = Ip4Addr::ZeroAddr();
+        std::uint16_t port = 0;
+
+        // Number of connections to keep (connecting or idle in the pool), at
+        // most num_entries.
+        int num_idle = 0;
+
+        // Entries for the connections in the pool, each holds one connection
+        // which is connecting or idle.
+        int num_entries = 0;
+        PoolEntry *entries = nullptr;
+
+        // Delay before starting connections again after a connection attempt
+        // failed.
+        TimeType retry_time = 0;
+
+        // Idle connections older than this are reset and replaced, so that they
+        // are not used just as the server closes them. Zero means no limit.
+        TimeType max_idle_time = 0;
+
+        // Keepalive settings for idle connections, see
+        // TcpConnection::setKeepalive. Taken connections keep these settings.
+        std::uint16_t ka_idle_secs = 0;
+        std::uint16_t ka_interval_secs = 0;
+        std::uint8_t ka_count = 0;
+
+        // Whether to keep the congestion window of idle connections, see
+        // TcpConnection::setIdleCwndRestart. Taken connections keep this
+        // setting.
+        bool preserve_cwnd = true;
+
+        // DSCP value for the connections, see TcpStartConnectionArgs.
+        std::uint8_t dscp = 0;
+    };
+
+    // Statistics of the pool. The counters wrap around on overflow.
+    struct UpstreamPoolStats {
+        // Connections started by the pool.
+        std::uint32_t started = 0;
+
+        // Connections which were established.
+        std::uint32_t established = 0;
+
+        // Connections which failed to start or to be established.
+        std::uint32_t connect_failed = 0;
+
+        // Idle connections which were aborted, closed or written to by the
+        // peer, or reset because of max_idle_time.
+        std::uint32_t dropped = 0;
+
+        // Connections taken by the application.
+        std::uint32_t taken = 0;
+
+        // Calls of takeConnection when no idle connection was available.
+        std::uint32_t misses = 0;
+
+        // Connections returned to the pool by the application.
+        std::uint32_t returned = 0;
+
+        // Calls of returnConnection which did not take the connection.
+        std::uint32_t not_returned = 0;
+    };
+
+public:
+    class UpstreamPool :
+        private NonCopyable<UpstreamPool>
+    {
+        friend class PoolEntry;
+
+    public:
+        using AvailableHandler = Function<void()>;
+
+        UpstreamPool (
+            PlatformFacade<PlatformImpl> platform, AvailableHandler available_handler)
+        :
+            m_available_handler(available_handler),
+            m_refill_timer(platform,
+                AIPSTACK_BIND_MEMBER_TN(&UpstreamPool::refillTimerHandler, this)),
+            m_notify_timer(platform,
+                AIPSTACK_BIND_MEMBER_TN(&UpstreamPool::notifyTimerHandler, this)),
+            m_timeout_timer(platform,
+                AIPSTACK_BIND_MEMBER_TN(&UpstreamPool::timeoutTimerHandler, this)),
+            m_tcp(nullptr)
+        {}
+
+        ~UpstreamPool ()
+        {
+            deinit_entries();
+        }
+
+        void reset ()
+        {
+            deinit_entries();
+            m_refill_timer.unset();
+            m_notify_timer.unset();
+            m_timeout_timer.unset();
+            m_tcp = nullptr;
+        }
+
+        // Start the pool, which starts connecting. The entries must not be
+        // used by another pool.
+        void start (TcpApi<TcpArg> &tcp, UpstreamPoolParams const &params)
+        {
+            AIPSTACK_ASSERT(m_tcp == nullptr);
+            AIPSTACK_ASSERT(params.num_entries > 0 && params.entries != nullptr);
+            AIPSTACK_ASSERT(params.num_idle >= 0 && params.num_idle <= params.num_entries);
+            AIPSTACK_ASSERT(params.ka_idle_secs == 0 || params.ka_interval_secs > 0);
+
+            m_tcp = &tcp;
+            m_params = params;
+            m_stats = UpstreamPoolStats();
+            m_notify_needed = false;
+
+            for (int i = 0; i < m_params.num_entries; i++) {
+                m_params.entries[i].init(this);
+            }
+
+            m_refill_timer.setNow();
+        }
+
+        bool isStarted () const
+        {
+            return m_tcp != nullptr;
+        }
+
+        // Return the statistics of the pool. They are reset by start.
+        UpstreamPoolStats getStats () const
+        {
+            return m_stats;
+        }
+
+        // Return whether takeConnection would succeed.
+        bool hasIdleConnection () const
+        {
+            AIPSTACK_ASSERT(isStarted());
+
+            return find_newest_idle() != nullptr;
+        }
+
+        // Take an idle connection into dst_con, which must be in INIT state.
+        // The most recently used connection is taken, which is the one least
+        // likely to have been closed by the server.
+        //
+        // On success, the application must immediately copy the contents of
+        // the receive buffer (getRecvBuf) to its own receive buffer of
+        // RxBufferSize bytes and set that with setRecvBuf (out-of-sequence
+        // data may be stored there), and set its send buffer. The connection
+        // is established and nothing has been received on it.
+        //
+        // If no connection is available, IpErr::NoPcbAvailable is returned and
+        // the AvailableHandler will be called (from the event loop) when a new
+        // connection has been established. The application may instead start
+        // a connection by itself.
+        IpErr takeConnection (TcpConnection<TcpArg> &dst_con)
+        {
+            AIPSTACK_ASSERT(isStarted());
+            AIPSTACK_ASSERT(dst_con.isInit());
+
+            PoolEntry *entry = find_newest_idle();
+            if (entry == nullptr) {
+                m_stats.misses++;
+                m_notify_needed = true;
+                return IpErr::NoPcbAvailable;
+            }
+
+            entry->take_into(dst_con);
+            m_stats.taken++;
+
+            // Removed an idle connection -> update timeout, start a replacement.
+            update_timeout();
+            m_refill_timer.setNow();
+
+            return IpErr::Success;
+        }
+
+        // Give a connection back to the pool after a request has completed.
+        // This succeeds if the connection is usable for another request: all
+        // sent data has been acknowledged, sending was not closed, no FIN has
+        // been received, all received data has been consumed so that the free
+        // receive buffer is at most RxBufferSize bytes, and a pool entry is
+        // free. The connection must have been taken from this pool (or at
+        // least be established to the same upstream).
+        //
+        // On success, src_con is in INIT state. Otherwise it is not affected
+        // and the application should reset it.
+        bool returnConnection (TcpConnection<TcpArg> &src_con)
+        {
+            AIPSTACK_ASSERT(isStarted());
+
+            PoolEntry *entry = find_free();
+
+            if (entry == nullptr || !src_con.isConnected() || src_con.wasEndReceived() ||
+                src_con.wasSendingClosed() || src_con.getSendBuf().tot_len != 0 ||
+                src_con.getRecvBuf().tot_len > RxBufferSize ||
+                src_con.getRemoteIp4Addr() != m_params.addr ||
+                src_con.getRemotePort() != m_params.port)
+            {
+                m_stats.not_returned++;
+                return false;
+            }
+
+            entry->return_from(src_con);
+            m_stats.returned++;
+
+            return true;
+        }
+
+    private:
+        void refillTimerHandler ()
+        {
+            AIPSTACK_ASSERT(isStarted());
+
+            // Start connections until there are num_idle connections in the
+            // pool (connecting or idle). Returned connections may exceed that.
+            int count = 0;
+            for (int i = 0; i < m_params.num_entries; i++) {
+                if (m_params.entries[i].m_state != PoolEntry::State::Free) {
+                    count++;
+                }
+            }
+
+            for (int i = 0; i < m_params.num_entries && count < m_params.num_idle; i++) {
+                PoolEntry &entry = m_params.entries[i];
+                if (entry.m_state != PoolEntry::State::Free) {
+                    continue;
+                }
+
+                if (entry.start_connection() != IpErr::Success) {
+                    m_stats.connect_failed++;
+                    m_refill_timer.setAfter(m_params.retry_time);
+                    return;
+                }
+
+                m_stats.started++;
+                count++;
+            }
+        }
+
+        void notifyTimerHandler ()
+        {
+            AIPSTACK_ASSERT(isStarted());
+
+            if (m_notify_needed && find_newest_idle() != nullptr) {
+                m_notify_needed = false;
+                m_available_handler();
+            }
+        }
+
+        void timeoutTimerHandler ()
+        {
+            AIPSTACK_ASSERT(isStarted());
+            AIPSTACK_ASSERT(m_params.max_idle_time != 0);
+
+            // The timeout is kept updated to expire for the oldest idle
+            // connection, reset it.
+            PoolEntry *entry = find_oldest_idle();
+            AIPSTACK_ASSERT(entry != nullptr);
+
+            entry->reset_connection(false);
+            entry_lost(false);
+        }
+
+        // Called after a pool entry lost its connection.
+        void entry_lost (bool connecting)
+        {
+            if (connecting) {
+                // Do not hammer a server which is down or refuses connections.
+                m_stats.connect_failed++;
+                if (!m_refill_timer.isSet()) {
+                    m_refill_timer.setAfter(m_params.retry_time);
+                }
+            } else {
+                m_stats.dropped++;
+                m_refill_timer.setNow();
+            }
+        }
+
+        void update_timeout ()
+        {
+            if (m_params.max_idle_time == 0) {
+                return;
+            }
+
+            PoolEntry *entry = find_oldest_idle();
+
+            if (entry != nullptr) {
+                m_timeout_timer.setAt(entry->m_time + m_params.max_idle_time);
+            } else {
+                m_timeout_timer.unset();
+            }
+        }
+
+        void deinit_entries ()
+        {
+            if (isStarted()) {
+                for (int i = 0; i < m_params.num_entries; i++) {
+                    m_params.entries[i].deinit();
+                }
+            }
+        }
+
+        PoolEntry * find_free () const
+        {
+            for (int i = 0; i < m_params.num_entries; i++) {
+                PoolEntry &entry = m_params.entries[i];
+                if (entry.m_state == PoolEntry::State::Free) {
+                    return &entry;
+                }
+            }
+            return nullptr;
+        }
+
+        PoolEntry * find_newest_idle () const
+        {
+            PoolEntry *newest_entry = nullptr;
+
+            for (int i = 0; i < m_params.num_entries; i++) {
+                PoolEntry &entry = m_params.entries[i];
+                if (entry.m_state == PoolEntry::State::Idle &&
+                    (newest_entry == nullptr ||
+                     Platform::timeGreaterOrEqual(entry.m_time, newest_entry->m_time)))
+                {
+                    newest_entry = &entry;
+                }
+            }
+
+            return newest_entry;
+        }
+
+        PoolEntry * find_oldest_idle () const
+        {
+            PoolEntry *oldest_entry = nullptr;
+
+            for (int i = 0; i < m_params.num_entries; i++) {
+                PoolEntry &entry = m_params.entries[i];
+                if (entry.m_state == PoolEntry::State::Idle &&
+                    (oldest_entry == nullptr ||
+                     !Platform::timeGreaterOrEqual(entry.m_time, oldest_entry->m_time)))
+                {
+                    oldest_entry = &entry;
+                }
+            }
+
+            return oldest_entry;
+        }
+
+    private:
+        AvailableHandler m_available_handler;
+        typename Platform::Timer m_refill_timer;
+        typename Platform::Timer m_notify_timer;
+        typename Platform::Timer m_timeout_timer;
+        TcpApi<TcpArg> *m_tcp;
+        UpstreamPoolParams m_params;
+        UpstreamPoolStats m_stats;
+        bool m_notify_needed;
+    };
+};
+
+}
+
+#endif
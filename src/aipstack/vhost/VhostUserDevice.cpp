@@ -0,0 +1,978 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/vhost/VhostUserDevice.h>
+
+namespace AIpStack {
+
+namespace {
+
+// Message types of the vhost-user protocol (front-end to back-end).
+enum : std::uint32_t {
+    MsgGetFeatures         = 1,
+    MsgSetFeatures         = 2,
+    MsgSetOwner            = 3,
+    MsgResetOwner          = 4,
+    MsgSetMemTable         = 5,
+    MsgSetVringNum         = 8,
+    MsgSetVringAddr        = 9,
+    MsgSetVringBase        = 10,
+    MsgGetVringBase        = 11,
+    MsgSetVringKick        = 12,
+    MsgSetVringCall        = 13,
+    MsgSetVringErr         = 14,
+    MsgGetProtocolFeatures = 15,
+    MsgSetProtocolFeatures = 16,
+    MsgGetQueueNum         = 17,
+    MsgSetVringEnable      = 18,
+};
+
+// Flags in the message header.
+constexpr std::uint32_t MsgVersion = 0x1;
+constexpr std::uint32_t MsgVersionMask = 0x3;
+constexpr std::uint32_t MsgFlagReply = 0x4;
+constexpr std::uint32_t MsgFlagNeedReply = 0x8;
+
+// Payload of SET_VRING_KICK/CALL/ERR.
+constexpr std::uint64_t VringIndexMask = 0xFF;
+constexpr std::uint64_t VringNoFdFlag = 0x100;
+
+// Feature bits of virtio-net and vhost-user which are offered.
+constexpr std::uint64_t FeatureMrgRxbuf = std::uint64_t(1) << 15;
+constexpr std::uint64_t FeatureProtocolFeatures = std::uint64_t(1) << 30;
+constexpr std::uint64_t FeatureVersion1 = std::uint64_t(1) << 32;
+constexpr std::uint64_t OfferedFeatures =
+    FeatureMrgRxbuf | FeatureProtocolFeatures | FeatureVersion1;
+
+constexpr std::uint64_t ProtocolFeatureReplyAck = std::uint64_t(1) << 3;
+constexpr std::uint64_t OfferedProtocolFeatures = ProtocolFeatureReplyAck;
+
+// Size of the virtio-net header preceding each frame, with num_buffers
+// (VERSION_1 or MRG_RXBUF) and without.
+constexpr std::size_t NetHdrSize = 12;
+constexpr std::size_t NetHdrSizeLegacy = 10;
+constexpr std::size_t NetHdrNumBuffersOffset = 10;
+
+// Split virtqueue layout (virtio 1.x section 2.7), in little endian.
+struct VringDesc {
+    std::uint64_t addr;
+    std::uint32_t len;
+    std::uint16_t flags;
+    std::uint16_t next;
+};
+
+struct VringUsedElem {
+    std::uint32_t id;
+    std::uint32_t len;
+};
+
+constexpr std::uint16_t DescFlagNext = 1;
+constexpr std::uint16_t DescFlagWrite = 2;
+constexpr std::uint16_t DescFlagIndirect = 4;
+constexpr std::uint16_t AvailFlagNoInterrupt = 1;
+
+// The avail and used rings both start with a flags and an index field.
+constexpr std::size_t RingFlagsOffset = 0;
+constexpr std::size_t RingIdxOffset = 2;
+constexpr std::size_t RingEntriesOffset = 4;
+
+constexpr std::uint32_t MaxQueueSize = 32768;
+
+struct MsgHeader {
+    std::uint32_t request;
+    std::uint32_t flags;
+    std::uint32_t size;
+};
+
+struct MsgMemRegion {
+    std::uint64_t guest_phys_addr;
+    std::uint64_t memory_size;
+    std::uint64_t userspace_addr;
+    std::uint64_t mmap_offset;
+};
+
+struct MsgVringState {
+    std::uint32_t index;
+    std::uint32_t num;
+};
+
+struct MsgVringAddr {
+    std::uint32_t index;
+    std::uint32_t flags;
+    std::uint64_t desc_user_addr;
+    std::uint64_t used_user_addr;
+    std::uint64_t avail_user_addr;
+    std::uint64_t log_guest_addr;
+};
+
+// Accesses to the indices of the rings, which are shared with the guest.
+inline std::uint16_t loadAcquire (char const *ptr)
+{
+    return __atomic_load_n(reinterpret_cast<std::uint16_t const *>(ptr), __ATOMIC_ACQUIRE);
+}
+
+inline void storeRelease (char *ptr, std::uint16_t value)
+{
+    __atomic_store_n(reinterpret_cast<std::uint16_t *>(ptr), value, __ATOMIC_RELEASE);
+}
+
+inline std::uint16_t loadU16 (char const *ptr)
+{
+    std::uint16_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+inline bool isAligned (char const *ptr, std::size_t align)
+{
+    return reinterpret_cast<std::uintptr_t>(ptr) % align == 0;
+}
+
+}
+
+struct VhostUserDevice::Message {
+    MsgHeader hdr;
+    union {
+        std::uint64_t u64;
+        MsgVringState state;
+        MsgVringAddr addr;
+        struct {
+            std::uint32_t num_regions;
+            std::uint32_t padding;
+            MsgMemRegion regions[MaxMemRegions];
+        } mem;
+    } payload;
+    std::size_t num_fds;
+    AIpStack::FileDescriptorWrapper fds[MaxMemRegions];
+    bool replied;
+};
+
+VhostUserDevice::VhostUserDevice (
+    AIpStack::EventLoop &loop, std::string const &socket_path,
+    FrameReceivedHandler handler, VhostUserDeviceParams const &params)
+:
+    m_handler(handler),
+    m_params(params),
+    m_socket_path(socket_path),
+    m_features(0),
+    m_protocol_features(0),
+    m_hdr_size(NetHdrSizeLegacy),
+    m_num_regions(0),
+    m_listen_watcher(loop,
+        AIPSTACK_BIND_MEMBER(&VhostUserDevice::handleListenEvents, this)),
+    m_conn_watcher(loop,
+        AIPSTACK_BIND_MEMBER(&VhostUserDevice::handleConnEvents, this)),
+    m_tx_kick_watcher(loop,
+        AIPSTACK_BIND_MEMBER(&VhostUserDevice::handleTxKick, this)),
+    m_tx_deferred(loop, AIPSTACK_BIND_MEMBER(&VhostUserDevice::processTxQueue, this))
+{
+    AIPSTACK_ASSERT(handler);
+    AIPSTACK_ASSERT(params.frame_mtu > 0);
+    AIPSTACK_ASSERT(params.rx_budget > 0);
+    
+    for (Queue &queue : m_queues) {
+        queue.num = 0;
+        resetQueue(queue);
+    }
+    
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("VhostUserDevice: Socket path is too long.");
+    }
+    std::memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+    
+    m_listen_fd = AIpStack::FileDescriptorWrapper(
+        ::socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0));
+    if (!m_listen_fd) {
+        throw std::runtime_error(formatString(
+            "VhostUserDevice: socket failed, err=%d", errno));
+    }
+    
+    ::unlink(socket_path.c_str());
+    
+    if (::bind(*m_listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+               sizeof(addr)) < 0)
+    {
+        throw std::runtime_error(formatString(
+            "VhostUserDevice: bind failed, err=%d", errno));
+    }
+    
+    if (::listen(*m_listen_fd, 1) < 0) {
+        throw std::runtime_error(formatString(
+            "VhostUserDevice: listen failed, err=%d", errno));
+    }
+    
+    m_listen_watcher.initFd(*m_listen_fd, AIpStack::EventLoopFdEvents::Read);
+}
+
+VhostUserDevice::~VhostUserDevice ()
+{
+    unmapMemory();
+    
+    if (m_listen_fd) {
+        ::unlink(m_socket_path.c_str());
+    }
+}
+
+std::size_t VhostUserDevice::getMtu () const
+{
+    return m_params.frame_mtu;
+}
+
+bool VhostUserDevice::isReady () const
+{
+    return m_conn_fd && queueReady(m_queues[RxQueueIndex]);
+}
+
+AIpStack::IpErr VhostUserDevice::sendFrame (AIpStack::IpBufRef frame)
+{
+    if (!isReady()) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    else if (frame.tot_len > m_params.frame_mtu) {
+        return AIpStack::IpErr::PacketTooLarge;
+    }
+    
+    Queue &queue = m_queues[RxQueueIndex];
+    bool mrg = (m_features & FeatureMrgRxbuf) != 0;
+    std::size_t len = m_hdr_size + frame.tot_len;
+    
+    // Take available buffers until the header and frame fit. Without MRG_RXBUF,
+    // the frame must fit into a single buffer.
+    std::uint16_t avail_idx = loadAcquire(queue.avail + RingIdxOffset);
+    std::uint16_t idx = queue.last_avail_idx;
+    std::size_t num_chains = 0;
+    std::size_t num_nodes = 0;
+    std::size_t capacity = 0;
+    
+    while (capacity < len) {
+        if (idx == avail_idx) {
+            return AIpStack::IpErr::OutputBufferFull;
+        }
+        if (num_chains > 0 && !mrg) {
+            return AIpStack::IpErr::PacketTooLarge;
+        }
+        
+        std::uint16_t head = loadU16(queue.avail + RingEntriesOffset +
+            sizeof(std::uint16_t) * std::size_t(idx & (queue.num - 1)));
+        
+        std::size_t chain_len = 0;
+        if (!readChain(queue, head, true, num_nodes, chain_len)) {
+            std::fprintf(stderr,
+                "VhostUserDevice: Invalid RX descriptor chain. Disconnecting.\n");
+            disconnect();
+            return AIpStack::IpErr::HardwareError;
+        }
+        
+        m_rx_heads[num_chains] = head;
+        m_rx_lens[num_chains] = std::uint32_t(MinValueU(chain_len, len - capacity));
+        num_chains++;
+        capacity += chain_len;
+        idx++;
+    }
+    
+    linkNodes(queue, num_nodes);
+    
+    // Write the virtio-net header (all zero since no offloads are used, except
+    // num_buffers) followed by the frame.
+    char hdr[NetHdrSize] = {};
+    if (m_hdr_size == NetHdrSize) {
+        std::uint16_t num_buffers = std::uint16_t(num_chains);
+        std::memcpy(hdr + NetHdrNumBuffersOffset, &num_buffers, sizeof(num_buffers));
+    }
+    
+    AIpStack::IpBufRef dst{&queue.nodes[0], 0, len};
+    dst = AIpStack::ipBufGiveBytes(dst, AIpStack::MemRef(hdr, m_hdr_size));
+    AIpStack::ipBufGiveBuf(dst, frame);
+    
+    for (std::size_t i = 0; i < num_chains; i++) {
+        VringUsedElem elem = {m_rx_heads[i], m_rx_lens[i]};
+        std::memcpy(queue.used + RingEntriesOffset +
+            sizeof(VringUsedElem) * std::size_t(queue.last_used_idx & (queue.num - 1)),
+            &elem, sizeof(elem));
+        queue.last_used_idx++;
+    }
+    
+    queue.last_avail_idx = idx;
+    storeRelease(queue.used + RingIdxOffset, queue.last_used_idx);
+    
+    notifyGuest(queue);
+    
+    return AIpStack::IpErr::Success;
+}
+
+void VhostUserDevice::handleListenEvents (AIpStack::EventLoopFdEvents)
+{
+    AIPSTACK_ASSERT(!m_conn_fd);
+    
+    AIpStack::FileDescriptorWrapper fd(
+        ::accept4(*m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC));
+    if (!fd) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "VhostUserDevice: accept failed, err=%d\n", err);
+        }
+        return;
+    }
+    
+    // The connection socket is blocking, so that the payload of a message and
+    // replies are transferred completely. Only one connection is served at a time.
+    m_conn_fd = std::move(fd);
+    m_conn_watcher.initFd(*m_conn_fd, AIpStack::EventLoopFdEvents::Read);
+    m_listen_watcher.updateEvents(AIpStack::EventLoopFdEvents());
+}
+
+void VhostUserDevice::handleConnEvents (AIpStack::EventLoopFdEvents events)
+{
+    if ((events & AIpStack::EventLoopFdEvents::Error) != AIpStack::Enum0) {
+        std::fprintf(stderr, "VhostUserDevice: Error event. Disconnecting.\n");
+        disconnect();
+        return;
+    }
+    
+    Message msg;
+    if (!receiveMessage(msg) || !handleMessage(msg)) {
+        disconnect();
+        return;
+    }
+    
+    // With REPLY_ACK, the front-end may request a reply to any message.
+    if ((m_protocol_features & ProtocolFeatureReplyAck) != 0 &&
+        (msg.hdr.flags & MsgFlagNeedReply) != 0 && !msg.replied)
+    {
+        msg.payload.u64 = 0;
+        if (!sendReply(msg, sizeof(msg.payload.u64))) {
+            disconnect();
+        }
+    }
+}
+
+void VhostUserDevice::handleTxKick (AIpStack::EventLoopFdEvents)
+{
+    Queue &queue = m_queues[TxQueueIndex];
+    
+    std::uint64_t value;
+    if (::read(*queue.kick_fd, &value, sizeof(value)) < 0) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "VhostUserDevice: read from kick fd failed, err=%d\n",
+                err);
+        }
+    }
+    
+    processTxQueue();
+}
+
+bool VhostUserDevice::receiveMessage (Message &msg)
+{
+    msg.num_fds = 0;
+    msg.replied = false;
+    
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * MaxMemRegions)];
+    } control;
+    
+    struct iovec iov;
+    iov.iov_base = &msg.hdr;
+    iov.iov_len = sizeof(msg.hdr);
+    
+    struct msghdr mh;
+    std::memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    
+    auto res = ::recvmsg(*m_conn_fd, &mh, MSG_CMSG_CLOEXEC|MSG_WAITALL);
+    if (res <= 0) {
+        if (res < 0) {
+            std::fprintf(stderr, "VhostUserDevice: recvmsg failed, err=%d\n", errno);
+        }
+        return false;
+    }
+    
+    // Take ownership of the received file descriptors first so they are closed
+    // in any case.
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&mh, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (std::size_t i = 0; i < count; i++) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (msg.num_fds < MaxMemRegions) {
+                msg.fds[msg.num_fds++] = AIpStack::FileDescriptorWrapper(fd);
+            } else {
+                ::close(fd);
+            }
+        }
+    }
+    
+    if (std::size_t(res) != sizeof(msg.hdr) || (mh.msg_flags & MSG_CTRUNC) != 0) {
+        std::fprintf(stderr, "VhostUserDevice: Truncated message.\n");
+        return false;
+    }
+    
+    if ((msg.hdr.flags & MsgVersionMask) != MsgVersion) {
+        std::fprintf(stderr, "VhostUserDevice: Unsupported protocol version.\n");
+        return false;
+    }
+    
+    if (msg.hdr.size > sizeof(msg.payload)) {
+        std::fprintf(stderr, "VhostUserDevice: Message payload is too large.\n");
+        return false;
+    }
+    
+    std::memset(&msg.payload, 0, sizeof(msg.payload));
+    
+    if (msg.hdr.size > 0) {
+        auto pres = ::recv(*m_conn_fd, &msg.payload, msg.hdr.size, MSG_WAITALL);
+        if (pres != ssize_t(msg.hdr.size)) {
+            std::fprintf(stderr, "VhostUserDevice: Failed to receive payload.\n");
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool VhostUserDevice::handleMessage (Message &msg)
+{
+    switch (msg.hdr.request) {
+        case MsgGetFeatures: {
+            msg.payload.u64 = OfferedFeatures;
+            return sendReply(msg, sizeof(msg.payload.u64));
+        }
+        
+        case MsgSetFeatures: {
+            std::uint64_t features = msg.payload.u64;
+            if ((features & ~OfferedFeatures) != 0) {
+                std::fprintf(stderr, "VhostUserDevice: Unsupported features.\n");
+                return false;
+            }
+            m_features = features;
+            m_hdr_size = ((features & (FeatureVersion1|FeatureMrgRxbuf)) != 0) ?
+                NetHdrSize : NetHdrSizeLegacy;
+            return true;
+        }
+        
+        case MsgGetProtocolFeatures: {
+            msg.payload.u64 = OfferedProtocolFeatures;
+            return sendReply(msg, sizeof(msg.payload.u64));
+        }
+        
+        case MsgSetProtocolFeatures: {
+            m_protocol_features = msg.payload.u64 & OfferedProtocolFeatures;
+            return true;
+        }
+        
+        case MsgGetQueueNum: {
+            msg.payload.u64 = 1;
+            return sendReply(msg, sizeof(msg.payload.u64));
+        }
+        
+        case MsgSetOwner: {
+            return true;
+        }
+        
+        case MsgResetOwner: {
+            for (Queue &queue : m_queues) {
+                resetQueue(queue);
+            }
+            unmapMemory();
+            m_features = 0;
+            return true;
+        }
+        
+        case MsgSetMemTable: {
+            return setMemTable(msg);
+        }
+        
+        case MsgSetVringNum: {
+            std::uint32_t index = msg.payload.state.index;
+            std::uint32_t num = msg.payload.state.num;
+            if (index > TxQueueIndex || num == 0 || num > MaxQueueSize ||
+                (num & (num - 1)) != 0)
+            {
+                std::fprintf(stderr, "VhostUserDevice: Invalid SET_VRING_NUM.\n");
+                return false;
+            }
+            Queue &queue = m_queues[index];
+            queue.num = std::uint16_t(num);
+            queue.nodes.resize(num);
+            if (index == RxQueueIndex) {
+                m_rx_heads.resize(num);
+                m_rx_lens.resize(num);
+            }
+            return translateRings(queue);
+        }
+        
+        case MsgSetVringAddr: {
+            std::uint32_t index = msg.payload.addr.index;
+            if (index > TxQueueIndex) {
+                std::fprintf(stderr, "VhostUserDevice: Invalid SET_VRING_ADDR.\n");
+                return false;
+            }
+            Queue &queue = m_queues[index];
+            queue.desc_user_addr = msg.payload.addr.desc_user_addr;
+            queue.avail_user_addr = msg.payload.addr.avail_user_addr;
+            queue.used_user_addr = msg.payload.addr.used_user_addr;
+            return translateRings(queue);
+        }
+        
+        case MsgSetVringBase: {
+            std::uint32_t index = msg.payload.state.index;
+            if (index > TxQueueIndex) {
+                std::fprintf(stderr, "VhostUserDevice: Invalid SET_VRING_BASE.\n");
+                return false;
+            }
+            Queue &queue = m_queues[index];
+            queue.last_avail_idx = std::uint16_t(msg.payload.state.num);
+            queue.last_used_idx = queue.last_avail_idx;
+            return true;
+        }
+        
+        case MsgGetVringBase: {
+            // This stops the queue, and the front-end learns where to continue.
+            std::uint32_t index = msg.payload.state.index;
+            if (index > TxQueueIndex) {
+                std::fprintf(stderr, "VhostUserDevice: Invalid GET_VRING_BASE.\n");
+                return false;
+            }
+            Queue &queue = m_queues[index];
+            if (index == TxQueueIndex) {
+                m_tx_kick_watcher.reset();
+                m_tx_deferred.cancel();
+            }
+            queue.started = false;
+            queue.kick_fd = AIpStack::FileDescriptorWrapper();
+            msg.payload.state.num = queue.last_avail_idx;
+            return sendReply(msg, sizeof(msg.payload.state));
+        }
+        
+        case MsgSetVringKick:
+        case MsgSetVringCall:
+        case MsgSetVringErr: {
+            std::uint32_t index = std::uint32_t(msg.payload.u64 & VringIndexMask);
+            bool no_fd = (msg.payload.u64 & VringNoFdFlag) != 0;
+            if (index > TxQueueIndex || (!no_fd && msg.num_fds != 1)) {
+                std::fprintf(stderr, "VhostUserDevice: Invalid SET_VRING_KICK/CALL/ERR.\n");
+                return false;
+            }
+            Queue &queue = m_queues[index];
+            AIpStack::FileDescriptorWrapper fd;
+            if (!no_fd) {
+                fd = std::move(msg.fds[0]);
+            }
+            if (msg.hdr.request == MsgSetVringCall) {
+                queue.call_fd = std::move(fd);
+            }
+            else if (msg.hdr.request == MsgSetVringKick) {
+                // Polling the queue without kicks is not supported.
+                if (no_fd) {
+                    std::fprintf(stderr, "VhostUserDevice: Polling mode not supported.\n");
+                    return false;
+                }
+                if (index == TxQueueIndex) {
+                    m_tx_kick_watcher.reset();
+                }
+                queue.kick_fd = std::move(fd);
+                return startQueue(index);
+            }
+            return true;
+        }
+        
+        case MsgSetVringEnable: {
+            std::uint32_t index = msg.payload.state.index;
+            if (index > TxQueueIndex) {
+                std::fprintf(stderr, "VhostUserDevice: Invalid SET_VRING_ENABLE.\n");
+                return false;
+            }
+            m_queues[index].enabled = msg.payload.state.num != 0;
+            if (index == TxQueueIndex && queueReady(m_queues[index])) {
+                m_tx_deferred.schedule();
+            }
+            return true;
+        }
+        
+        default: {
+            std::fprintf(stderr, "VhostUserDevice: Unsupported request %u.\n",
+                unsigned(msg.hdr.request));
+            return false;
+        }
+    }
+}
+
+bool VhostUserDevice::sendReply (Message &msg, std::size_t size)
+{
+    msg.hdr.flags = MsgVersion | MsgFlagReply;
+    msg.hdr.size = std::uint32_t(size);
+    msg.replied = true;
+    
+    struct iovec iov[2];
+    iov[0].iov_base = &msg.hdr;
+    iov[0].iov_len = sizeof(msg.hdr);
+    iov[1].iov_base = &msg.payload;
+    iov[1].iov_len = size;
+    
+    std::size_t len = sizeof(msg.hdr) + size;
+    auto res = ::writev(*m_conn_fd, iov, 2);
+    if (res < 0 || std::size_t(res) != len) {
+        std::fprintf(stderr, "VhostUserDevice: Failed to send reply.\n");
+        return false;
+    }
+    
+    return true;
+}
+
+bool VhostUserDevice::setMemTable (Message &msg)
+{
+    std::size_t num_regions = msg.payload.mem.num_regions;
+    if (num_regions > MaxMemRegions || msg.num_fds != num_regions) {
+        std::fprintf(stderr, "VhostUserDevice: Invalid SET_MEM_TABLE.\n");
+        return false;
+    }
+    
+    // The rings are translated again below.
+    for (Queue &queue : m_queues) {
+        queue.desc = nullptr;
+        queue.avail = nullptr;
+        queue.used = nullptr;
+    }
+    unmapMemory();
+    
+    for (std::size_t i = 0; i < num_regions; i++) {
+        MsgMemRegion const &src = msg.payload.mem.regions[i];
+        
+        std::uint64_t map_size = src.memory_size + src.mmap_offset;
+        if (src.memory_size == 0 || map_size < src.mmap_offset ||
+            map_size > std::uint64_t(TypeMax<std::size_t>))
+        {
+            std::fprintf(stderr, "VhostUserDevice: Invalid memory region.\n");
+            return false;
+        }
+        
+        void *map_ptr = ::mmap(nullptr, std::size_t(map_size), PROT_READ|PROT_WRITE,
+                               MAP_SHARED, *msg.fds[i], 0);
+        if (map_ptr == MAP_FAILED) {
+            std::fprintf(stderr, "VhostUserDevice: mmap failed, err=%d\n", errno);
+            return false;
+        }
+        
+        MemRegion &region = m_regions[m_num_regions++];
+        region.guest_addr = src.guest_phys_addr;
+        region.user_addr = src.userspace_addr;
+        region.size = src.memory_size;
+        region.ptr = static_cast<char *>(map_ptr) + src.mmap_offset;
+        region.map_ptr = map_ptr;
+        region.map_size = std::size_t(map_size);
+    }
+    
+    for (Queue &queue : m_queues) {
+        if (!translateRings(queue)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool VhostUserDevice::startQueue (std::uint32_t index)
+{
+    Queue &queue = m_queues[index];
+    
+    // Without PROTOCOL_FEATURES, a queue is enabled when it is started, otherwise
+    // it is enabled by SET_VRING_ENABLE.
+    queue.started = true;
+    if ((m_features & FeatureProtocolFeatures) == 0) {
+        queue.enabled = true;
+    }
+    
+    // Frames sent by the guest before the queue was started are processed once
+    // the kick fd is reported, since the guest has notified through it.
+    if (index == TxQueueIndex) {
+        m_tx_kick_watcher.initFd(*queue.kick_fd, AIpStack::EventLoopFdEvents::Read);
+    }
+    
+    return true;
+}
+
+void VhostUserDevice::resetQueue (Queue &queue)
+{
+    queue.last_avail_idx = 0;
+    queue.last_used_idx = 0;
+    queue.started = false;
+    queue.enabled = false;
+    queue.desc_user_addr = 0;
+    queue.avail_user_addr = 0;
+    queue.used_user_addr = 0;
+    queue.desc = nullptr;
+    queue.avail = nullptr;
+    queue.used = nullptr;
+    
+    if (&queue == &m_queues[TxQueueIndex]) {
+        m_tx_kick_watcher.reset();
+        m_tx_deferred.cancel();
+    }
+    
+    queue.kick_fd = AIpStack::FileDescriptorWrapper();
+    queue.call_fd = AIpStack::FileDescriptorWrapper();
+}
+
+void VhostUserDevice::unmapMemory ()
+{
+    for (std::size_t i = 0; i < m_num_regions; i++) {
+        ::munmap(m_regions[i].map_ptr, m_regions[i].map_size);
+    }
+    m_num_regions = 0;
+}
+
+void VhostUserDevice::disconnect ()
+{
+    for (Queue &queue : m_queues) {
+        resetQueue(queue);
+    }
+    unmapMemory();
+    
+    m_features = 0;
+    m_protocol_features = 0;
+    m_hdr_size = NetHdrSizeLegacy;
+    
+    m_conn_watcher.reset();
+    m_conn_fd = AIpStack::FileDescriptorWrapper();
+    
+    // Wait for the next front-end.
+    m_listen_watcher.updateEvents(AIpStack::EventLoopFdEvents::Read);
+}
+
+bool VhostUserDevice::translateRings (Queue &queue)
+{
+    // The rings can only be translated once the size, the addresses and the
+    // memory table are known, which may come in any order.
+    if (queue.num == 0 || queue.desc_user_addr == 0 || m_num_regions == 0) {
+        return true;
+    }
+    
+    std::uint64_t num = queue.num;
+    queue.desc = translateUserAddr(queue.desc_user_addr, num * sizeof(VringDesc));
+    queue.avail = translateUserAddr(queue.avail_user_addr,
+        RingEntriesOffset + num * sizeof(std::uint16_t));
+    queue.used = translateUserAddr(queue.used_user_addr,
+        RingEntriesOffset + num * sizeof(VringUsedElem));
+    
+    if (queue.desc == nullptr || queue.avail == nullptr || queue.used == nullptr ||
+        !isAligned(queue.desc, 16) || !isAligned(queue.avail, 2) ||
+        !isAligned(queue.used, 4))
+    {
+        std::fprintf(stderr, "VhostUserDevice: Invalid ring addresses.\n");
+        queue.desc = nullptr;
+        queue.avail = nullptr;
+        queue.used = nullptr;
+        return false;
+    }
+    
+    return true;
+}
+
+char * VhostUserDevice::translateUserAddr (std::uint64_t addr, std::uint64_t len) const
+{
+    for (std::size_t i = 0; i < m_num_regions; i++) {
+        MemRegion const &region = m_regions[i];
+        if (addr >= region.user_addr && addr - region.user_addr <= region.size &&
+            len <= region.size - (addr - region.user_addr))
+        {
+            return region.ptr + (addr - region.user_addr);
+        }
+    }
+    return nullptr;
+}
+
+char * VhostUserDevice::translateGuestAddr (std::uint64_t addr, std::uint64_t len) const
+{
+    for (std::size_t i = 0; i < m_num_regions; i++) {
+        MemRegion const &region = m_regions[i];
+        if (addr >= region.guest_addr && addr - region.guest_addr <= region.size &&
+            len <= region.size - (addr - region.guest_addr))
+        {
+            return region.ptr + (addr - region.guest_addr);
+        }
+    }
+    return nullptr;
+}
+
+bool VhostUserDevice::queueReady (Queue const &queue) const
+{
+    return queue.started && queue.enabled && queue.desc != nullptr;
+}
+
+bool VhostUserDevice::readChain (Queue &queue, std::uint16_t head, bool writable,
+                                 std::size_t &num_nodes, std::size_t &chain_len)
+{
+    // Each descriptor is copied before it is checked, since the guest could
+    // modify it concurrently. The number of nodes is limited to the queue size,
+    // which also stops loops in the chain.
+    std::uint16_t idx = head;
+    while (true) {
+        if (idx >= queue.num || num_nodes >= queue.nodes.size()) {
+            return false;
+        }
+        
+        VringDesc desc;
+        std::memcpy(&desc, queue.desc + sizeof(VringDesc) * idx, sizeof(desc));
+        
+        if ((desc.flags & DescFlagIndirect) != 0 ||
+            ((desc.flags & DescFlagWrite) != 0) != writable)
+        {
+            return false;
+        }
+        
+        char *ptr = translateGuestAddr(desc.addr, desc.len);
+        if (ptr == nullptr) {
+            return false;
+        }
+        
+        queue.nodes[num_nodes++] = AIpStack::IpBufNode{ptr, desc.len, nullptr};
+        chain_len += desc.len;
+        
+        if ((desc.flags & DescFlagNext) == 0) {
+            return true;
+        }
+        idx = desc.next;
+    }
+}
+
+void VhostUserDevice::linkNodes (Queue &queue, std::size_t num_nodes)
+{
+    for (std::size_t i = 0; i + 1 < num_nodes; i++) {
+        queue.nodes[i].next = &queue.nodes[i + 1];
+    }
+}
+
+void VhostUserDevice::processTxQueue ()
+{
+    Queue &queue = m_queues[TxQueueIndex];
+    if (!queueReady(queue)) {
+        return;
+    }
+    
+    std::uint16_t avail_idx = loadAcquire(queue.avail + RingIdxOffset);
+    std::size_t count = 0;
+    
+    while (queue.last_avail_idx != avail_idx && count < m_params.rx_budget) {
+        std::uint16_t head = loadU16(queue.avail + RingEntriesOffset +
+            sizeof(std::uint16_t) * std::size_t(queue.last_avail_idx & (queue.num - 1)));
+        
+        std::size_t num_nodes = 0;
+        std::size_t chain_len = 0;
+        if (!readChain(queue, head, false, num_nodes, chain_len)) {
+            std::fprintf(stderr,
+                "VhostUserDevice: Invalid TX descriptor chain. Disconnecting.\n");
+            disconnect();
+            return;
+        }
+        
+        linkNodes(queue, num_nodes);
+        
+        // The frame is passed referencing the memory of the guest, which gets the
+        // buffers back once the handler has returned.
+        if (chain_len > m_hdr_size) {
+            AIpStack::IpBufRef frame{&queue.nodes[0], 0, chain_len};
+            m_handler(AIpStack::ipBufSkipBytes(frame, m_hdr_size));
+        }
+        
+        VringUsedElem elem = {head, 0};
+        std::memcpy(queue.used + RingEntriesOffset +
+            sizeof(VringUsedElem) * std::size_t(queue.last_used_idx & (queue.num - 1)),
+            &elem, sizeof(elem));
+        queue.last_used_idx++;
+        queue.last_avail_idx++;
+        count++;
+    }
+    
+    if (count == 0) {
+        return;
+    }
+    
+    storeRelease(queue.used + RingIdxOffset, queue.last_used_idx);
+    
+    notifyGuest(queue);
+    
+    // If the budget was exhausted there may be more frames, for which the guest
+    // does not notify again, so continue after other events.
+    if (queue.last_avail_idx != avail_idx) {
+        m_tx_deferred.schedule();
+    }
+}
+
+void VhostUserDevice::notifyGuest (Queue &queue)
+{
+    if (!queue.call_fd) {
+        return;
+    }
+    
+    // The used index must be visible before the flags are checked, so that the
+    // guest does not miss the notification if it is just enabling it.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    if ((loadU16(queue.avail + RingFlagsOffset) & AvailFlagNoInterrupt) != 0) {
+        return;
+    }
+    
+    std::uint64_t value = 1;
+    if (::write(*queue.call_fd, &value, sizeof(value)) < 0) {
+        int err = errno;
+        if (!AIpStack::FileDescriptorWrapper::errIsEAGAINorEWOULDBLOCK(err)) {
+            std::fprintf(stderr, "VhostUserDevice: write to call fd failed, err=%d\n",
+                err);
+        }
+    }
+}
+
+}
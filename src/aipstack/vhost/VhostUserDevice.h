@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_VHOST_USER_DEVICE_H
+#define AIPSTACK_VHOST_USER_DEVICE_H
+
+#if !defined(__linux__)
+#error "VhostUserDevice is only supported on Linux"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/event_loop/EventLoop.h>
+
+namespace AIpStack {
+
+/**
+ * @defgroup vhost vhost-user Network Device
+ * @brief Provides packet I/O with a virtual machine as a vhost-user back-end.
+ * 
+ * See the @ref VhostUserDevice documentation.
+ * 
+ * @{
+ */
+
+/**
+ * Configuration parameters for @ref VhostUserDevice.
+ */
+struct VhostUserDeviceParams {
+    /**
+     * Maximum frame size including the 14-byte Ethernet header, as returned by
+     * @ref VhostUserDevice::getMtu. This should correspond to the MTU configured
+     * in the guest.
+     */
+    std::size_t frame_mtu = 1514;
+
+    /**
+     * Maximum number of frames received for one notification from the guest,
+     * for fairness with respect to other event sources.
+     */
+    std::size_t rx_budget = 64;
+};
+
+/**
+ * Provides packet I/O with a virtual machine as a vhost-user back-end of a
+ * virtio-net device (Linux only).
+ * 
+ * This facility relies on the @ref event-loop implementation in %AIpStack and has
+ * the same interface as @ref TapDevice, so it can be connected to an
+ * @ref EthIpIface in the same way.
+ * 
+ * The device listens on a Unix socket, to which the vhost-user front-end (e.g.
+ * QEMU with `-chardev socket,path=...` and `-netdev vhost-user`) connects. The
+ * front-end shares the memory of the guest and the virtqueues of the device
+ * with the back-end, so packets are exchanged with the guest with no kernel in
+ * the data path:
+ * - Frames sent by the guest are passed to the @ref FrameReceivedHandler as
+ *   @ref IpBufNode chains referencing the descriptors of the guest directly,
+ *   without copying.
+ * - Frames passed to @ref sendFrame are copied from their buffers directly
+ *   into the buffers which the guest has made available, since the guest owns
+ *   these buffers.
+ * 
+ * Notifications in both directions use the eventfds passed by the front-end.
+ * Only one front-end can be connected at a time; when it disconnects, the
+ * device waits for a new connection. The front-end is expected to send each
+ * message in one piece, as QEMU does.
+ * 
+ * The split virtqueue layout with one queue pair is supported, without
+ * offloads, indirect descriptors or dirty page logging (so no live
+ * migration). With `VIRTIO_NET_F_MRG_RXBUF`, a frame may be spread over
+ * several buffers of the guest. The host must be little-endian.
+ */
+class VhostUserDevice :
+    private AIpStack::NonCopyable<VhostUserDevice>
+{
+    struct Message;
+
+public:
+    /**
+     * Type of callback used to deliver received frames.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef), starting with the
+     *        14-byte Ethernet header. The referenced buffers are in the memory of
+     *        the guest and must not be used outside of the callback function.
+     */
+    using FrameReceivedHandler = Function<void(AIpStack::IpBufRef frame)>;
+
+    /**
+     * Constructor, starts listening on the socket.
+     * 
+     * Any existing file at the socket path is removed first.
+     * 
+     * @param loop Event loop; it must outlive the VhostUserDevice object.
+     * @param socket_path Path of the Unix socket.
+     * @param handler Callback function used to deliver received Ethernet frames
+     *        (must not be null).
+     * @param params Configuration parameters.
+     * @throw std::runtime_error If creating the socket fails.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    VhostUserDevice (AIpStack::EventLoop &loop, std::string const &socket_path,
+                     FrameReceivedHandler handler,
+                     VhostUserDeviceParams const &params = VhostUserDeviceParams());
+
+    /**
+     * Destructor, disconnects any front-end and removes the socket.
+     */
+    ~VhostUserDevice ();
+
+    /**
+     * Get the maximum frame size.
+     * 
+     * @return The maximum frame size from @ref VhostUserDeviceParams::frame_mtu.
+     */
+    std::size_t getMtu () const;
+
+    /**
+     * Check whether frames can currently be sent to the guest.
+     * 
+     * @return True if a front-end is connected and the receive queue of the
+     *         guest is started and enabled.
+     */
+    bool isReady () const;
+
+    /**
+     * Send an Ethernet frame to the guest.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef), starting with the
+     *        14-byte Ethernet header.
+     * @return Success or error code (@ref IpErr::OutputBufferFull if the guest
+     *         has not made enough buffers available, @ref IpErr::HardwareError if
+     *         the device is not ready, see @ref isReady).
+     */
+    AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame);
+
+private:
+    // Maximum number of memory regions in VHOST_USER_SET_MEM_TABLE.
+    static constexpr std::size_t MaxMemRegions = 8;
+
+    // Index of the receive and transmit queue (from the guest's point of view).
+    static constexpr std::uint32_t RxQueueIndex = 0;
+    static constexpr std::uint32_t TxQueueIndex = 1;
+
+    // Memory region of the guest mapped from a file descriptor.
+    struct MemRegion {
+        std::uint64_t guest_addr;
+        std::uint64_t user_addr;
+        std::uint64_t size;
+        char *ptr;
+        void *map_ptr;
+        std::size_t map_size;
+    };
+
+    // State of a virtqueue. The ring pointers are valid if desc is not null.
+    struct Queue {
+        std::uint16_t num;
+        std::uint16_t last_avail_idx;
+        std::uint16_t last_used_idx;
+        bool started;
+        bool enabled;
+        std::uint64_t desc_user_addr;
+        std::uint64_t avail_user_addr;
+        std::uint64_t used_user_addr;
+        char *desc;
+        char *avail;
+        char *used;
+        AIpStack::FileDescriptorWrapper kick_fd;
+        AIpStack::FileDescriptorWrapper call_fd;
+        std::vector<AIpStack::IpBufNode> nodes;
+    };
+
+    void handleListenEvents (AIpStack::EventLoopFdEvents events);
+
+    void handleConnEvents (AIpStack::EventLoopFdEvents events);
+
+    void handleTxKick (AIpStack::EventLoopFdEvents events);
+
+    bool receiveMessage (Message &msg);
+
+    bool handleMessage (Message &msg);
+
+    bool sendReply (Message &msg, std::size_t size);
+
+    bool setMemTable (Message &msg);
+
+    bool startQueue (std::uint32_t index);
+
+    void resetQueue (Queue &queue);
+
+    void unmapMemory ();
+
+    void disconnect ();
+
+    bool translateRings (Queue &queue);
+
+    char * translateUserAddr (std::uint64_t addr, std::uint64_t len) const;
+
+    char * translateGuestAddr (std::uint64_t addr, std::uint64_t len) const;
+
+    bool queueReady (Queue const &queue) const;
+
+    bool readChain (Queue &queue, std::uint16_t head, bool writable,
+                    std::size_t &num_nodes, std::size_t &chain_len);
+
+    void linkNodes (Queue &queue, std::size_t num_nodes);
+
+    void processTxQueue ();
+
+    void notifyGuest (Queue &queue);
+
+private:
+    FrameReceivedHandler m_handler;
+    VhostUserDeviceParams m_params;
+    std::string m_socket_path;
+    std::uint64_t m_features;
+    std::uint64_t m_protocol_features;
+    std::size_t m_hdr_size;
+    std::size_t m_num_regions;
+    MemRegion m_regions[MaxMemRegions];
+    Queue m_queues[2];
+    std::vector<std::uint16_t> m_rx_heads;
+    std::vector<std::uint32_t> m_rx_lens;
+    // First fds then watchers for proper destruction order.
+    AIpStack::FileDescriptorWrapper m_listen_fd;
+    AIpStack::FileDescriptorWrapper m_conn_fd;
+    AIpStack::EventLoopFdWatcher m_listen_watcher;
+    AIpStack::EventLoopFdWatcher m_conn_watcher;
+    AIpStack::EventLoopFdWatcher m_tx_kick_watcher;
+    AIpStack::EventLoopDeferred m_tx_deferred;
+};
+
+/** @} */
+
+}
+
+#endif
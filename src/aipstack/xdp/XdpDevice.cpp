@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/event_loop/FormatString.h>
+#include <aipstack/xdp/XdpDevice.h>
+
+namespace AIpStack {
+
+namespace {
+
+// Accesses to the producer and consumer indices of rings, which are shared with
+// the kernel.
+inline std::uint32_t loadAcquire (std::uint32_t const *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+inline void storeRelease (std::uint32_t *ptr, std::uint32_t value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+inline long bpfSyscall (int cmd, union bpf_attr &attr)
+{
+    return ::syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+}
+
+XdpDevice::Mapping::Mapping () :
+    m_ptr(MAP_FAILED),
+    m_size(0)
+{}
+
+XdpDevice::Mapping::~Mapping ()
+{
+    if (m_ptr != MAP_FAILED) {
+        ::munmap(m_ptr, m_size);
+    }
+}
+
+void XdpDevice::Mapping::map (
+    std::size_t size, int prot, int flags, int fd, std::uint64_t offset)
+{
+    AIPSTACK_ASSERT(m_ptr == MAP_FAILED);
+    
+    m_ptr = ::mmap(nullptr, size, prot, flags, fd, off_t(offset));
+    if (m_ptr == MAP_FAILED) {
+        throw std::runtime_error("XdpDevice: mmap failed.");
+    }
+    m_size = size;
+}
+
+char * XdpDevice::Mapping::ptr () const
+{
+    return static_cast<char *>(m_ptr);
+}
+
+XdpDevice::XdpDevice (
+    AIpStack::EventLoop &loop, std::string const &device_id, FrameReceivedHandler handler,
+    XdpDeviceParams const &params)
+:
+    m_handler(handler),
+    m_params(params),
+    m_zero_copy(false),
+    m_chunk_mask(~std::uint64_t(params.frame_size - 1)),
+    m_tx_pending(0),
+    m_fd_watcher(loop, AIPSTACK_BIND_MEMBER(&XdpDevice::handleFdEvents, this)),
+    m_active(true)
+{
+    AIPSTACK_ASSERT(params.frame_size == 2048 || params.frame_size == 4096);
+    AIPSTACK_ASSERT(params.ring_size > 0 &&
+                    (params.ring_size & (params.ring_size - 1)) == 0);
+    AIPSTACK_ASSERT(params.num_frames >= 2);
+    AIPSTACK_ASSERT(params.rx_budget > 0);
+    
+    unsigned int ifindex = ::if_nametoindex(device_id.c_str());
+    if (ifindex == 0) {
+        throw std::runtime_error("XdpDevice: Network interface not found.");
+    }
+    
+    {
+        AIpStack::FileDescriptorWrapper sock{::socket(AF_INET, SOCK_DGRAM, 0)};
+        if (!sock) {
+            throw std::runtime_error("XdpDevice: socket(AF_INET, SOCK_DGRAM) failed.");
+        }
+        
+        struct ifreq ifr;
+        std::memset(&ifr, 0, sizeof(ifr));
+        std::snprintf(ifr.ifr_name, IFNAMSIZ, "%s", device_id.c_str());
+        
+        if (::ioctl(*sock, SIOCGIFMTU, reinterpret_cast<void *>(&ifr)) < 0) {
+            throw std::runtime_error("XdpDevice: ioctl(SIOCGIFMTU) failed.");
+        }
+        
+        // Received frames are placed after XDP_PACKET_HEADROOM in a UMEM frame.
+        m_frame_mtu = MinValueU(std::size_t(ifr.ifr_mtu) + AIpStack::EthHeader::Size,
+                                params.frame_size - XDP_PACKET_HEADROOM);
+    }
+    
+    // Allocate the UMEM.
+    std::size_t umem_size = std::size_t(params.num_frames) * params.frame_size;
+    m_umem.map(umem_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    
+    m_fd = AIpStack::FileDescriptorWrapper{::socket(AF_XDP, SOCK_RAW|SOCK_CLOEXEC, 0)};
+    if (!m_fd) {
+        throw std::runtime_error("XdpDevice: socket(AF_XDP) failed.");
+    }
+    
+    {
+        struct xdp_umem_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.addr = std::uint64_t(reinterpret_cast<std::uintptr_t>(m_umem.ptr()));
+        reg.len = umem_size;
+        reg.chunk_size = params.frame_size;
+        reg.headroom = 0;
+        
+        if (::setsockopt(*m_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+            throw std::runtime_error("XdpDevice: setsockopt(XDP_UMEM_REG) failed.");
+        }
+    }
+    
+    // Set up the rings.
+    {
+        struct xdp_mmap_offsets off;
+        socklen_t off_len = sizeof(off);
+        
+        // The rings sizes must be set before the offsets can be queried.
+        int ring_size = int(params.ring_size);
+        for (int sockopt : {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING,
+                            XDP_RX_RING, XDP_TX_RING})
+        {
+            if (::setsockopt(*m_fd, SOL_XDP, sockopt, &ring_size, sizeof(ring_size)) < 0) {
+                throw std::runtime_error("XdpDevice: setsockopt(ring size) failed.");
+            }
+        }
+        
+        if (::getsockopt(*m_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) < 0) {
+            throw std::runtime_error("XdpDevice: getsockopt(XDP_MMAP_OFFSETS) failed.");
+        }
+        
+        setupRing(m_fill_ring, m_fill_map, XDP_UMEM_PGOFF_FILL_RING, sizeof(std::uint64_t),
+            off.fr.producer, off.fr.consumer, off.fr.desc, off.fr.flags);
+        setupRing(m_comp_ring, m_comp_map, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(std::uint64_t),
+            off.cr.producer, off.cr.consumer, off.cr.desc, off.cr.flags);
+        setupRing(m_rx_ring, m_rx_map, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc),
+            off.rx.producer, off.rx.consumer, off.rx.desc, off.rx.flags);
+        setupRing(m_tx_ring, m_tx_map, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc),
+            off.tx.producer, off.tx.consumer, off.tx.desc, off.tx.flags);
+    }
+    
+    // Give the receive frames to the kernel via the fill ring and keep the
+    // remaining frames for sending.
+    {
+        std::uint32_t num_rx_frames = MinValue(params.num_frames / 2, params.ring_size);
+        
+        auto *fill_descs = reinterpret_cast<std::uint64_t *>(m_fill_ring.descs);
+        std::uint32_t prod = *m_fill_ring.producer;
+        for (std::uint32_t i = 0; i < num_rx_frames; i++) {
+            fill_descs[(prod + i) & m_fill_ring.mask] =
+                std::uint64_t(i) * params.frame_size;
+        }
+        storeRelease(m_fill_ring.producer, prod + num_rx_frames);
+        
+        m_tx_free.reserve(params.num_frames - num_rx_frames);
+        for (std::uint32_t i = params.num_frames; i > num_rx_frames; i--) {
+            m_tx_free.push_back(std::uint64_t(i - 1) * params.frame_size);
+        }
+    }
+    
+    {
+        struct sockaddr_xdp addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sxdp_family = AF_XDP;
+        addr.sxdp_ifindex = ifindex;
+        addr.sxdp_queue_id = params.queue_id;
+        addr.sxdp_flags = XDP_USE_NEED_WAKEUP;
+        if ((params.flags & XdpDeviceFlags::ZeroCopy) != Enum0) {
+            addr.sxdp_flags |= XDP_ZEROCOPY;
+        }
+        else if ((params.flags & XdpDeviceFlags::Copy) != Enum0) {
+            addr.sxdp_flags |= XDP_COPY;
+        }
+        
+        // Bind after the program is attached in generic mode, since binding
+        // determines the mode based on the currently attached program.
+        if (params.xsk_map_fd < 0) {
+            attachProgram(ifindex);
+        }
+        
+        if (::bind(*m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+            throw std::runtime_error(formatString(
+                "XdpDevice: bind failed, err=%d", errno));
+        }
+    }
+    
+    {
+        struct xdp_options opts;
+        socklen_t opts_len = sizeof(opts);
+        if (::getsockopt(*m_fd, SOL_XDP, XDP_OPTIONS, &opts, &opts_len) == 0) {
+            m_zero_copy = (opts.flags & XDP_OPTIONS_ZEROCOPY) != 0;
+        }
+    }
+    
+    // Insert the socket into the map so that the program redirects frames to it.
+    {
+        int map_fd = (params.xsk_map_fd >= 0) ? params.xsk_map_fd : *m_xsk_map;
+        std::uint32_t key = params.queue_id;
+        std::uint32_t value = std::uint32_t(*m_fd);
+        
+        union bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.map_fd = std::uint32_t(map_fd);
+        attr.key = std::uint64_t(reinterpret_cast<std::uintptr_t>(&key));
+        attr.value = std::uint64_t(reinterpret_cast<std::uintptr_t>(&value));
+        attr.flags = BPF_ANY;
+        
+        if (bpfSyscall(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+            throw std::runtime_error("XdpDevice: bpf(BPF_MAP_UPDATE_ELEM) failed.");
+        }
+    }
+    
+    m_fd_watcher.initFd(*m_fd, AIpStack::EventLoopFdEvents::Read);
+    
+    if (params.rx_scheduler != nullptr) {
+        m_rx_source = std::make_unique<AIpStack::EventLoopRxSource>(*params.rx_scheduler,
+            AIPSTACK_BIND_MEMBER(&XdpDevice::pollRxSource, this),
+            AIPSTACK_BIND_MEMBER(&XdpDevice::armRxSource, this));
+    }
+}
+
+XdpDevice::~XdpDevice ()
+{}
+
+std::size_t XdpDevice::getMtu () const
+{
+    return m_frame_mtu;
+}
+
+bool XdpDevice::isZeroCopy () const
+{
+    return m_zero_copy;
+}
+
+AIpStack::IpErr XdpDevice::sendFrame (AIpStack::IpBufRef frame)
+{
+    if (!m_active) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    
+    if (frame.tot_len < AIpStack::EthHeader::Size) {
+        return AIpStack::IpErr::HardwareError;
+    }
+    else if (frame.tot_len > m_frame_mtu) {
+        return AIpStack::IpErr::PacketTooLarge;
+    }
+    
+    // Get a free UMEM frame, reclaiming frames whose transmission was completed
+    // if needed.
+    if (m_tx_free.empty()) {
+        reclaimTxFrames();
+        if (m_tx_free.empty()) {
+            kickTx();
+            return AIpStack::IpErr::OutputBufferFull;
+        }
+    }
+    
+    // The TX ring has room for another descriptor if the kernel has consumed
+    // enough of them.
+    std::uint32_t prod = *m_tx_ring.producer;
+    if (prod - loadAcquire(m_tx_ring.consumer) > m_tx_ring.mask) {
+        kickTx();
+        return AIpStack::IpErr::OutputBufferFull;
+    }
+    
+    std::uint64_t addr = m_tx_free.back();
+    m_tx_free.pop_back();
+    
+    std::size_t len = frame.tot_len;
+    ipBufTakeBytes(frame, len, m_umem.ptr() + addr);
+    
+    auto *tx_descs = reinterpret_cast<struct xdp_desc *>(m_tx_ring.descs);
+    struct xdp_desc &desc = tx_descs[prod & m_tx_ring.mask];
+    desc.addr = addr;
+    desc.len = std::uint32_t(len);
+    desc.options = 0;
+    
+    storeRelease(m_tx_ring.producer, prod + 1);
+    m_tx_pending++;
+    
+    if ((m_params.flags & XdpDeviceFlags::DeferTxKick) == Enum0) {
+        kickTx();
+    }
+    
+    return AIpStack::IpErr::Success;
+}
+
+void XdpDevice::flushFrames ()
+{
+    if (m_active) {
+        kickTx();
+    }
+}
+
+void XdpDevice::setupRing (
+    Ring &ring, Mapping &mapping, std::uint64_t pgoff,
+    std::size_t desc_size, std::uint64_t off_producer, std::uint64_t off_consumer,
+    std::uint64_t off_desc, std::uint64_t off_flags)
+{
+    std::size_t size = std::size_t(off_desc) + m_params.ring_size * desc_size;
+    mapping.map(size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, *m_fd, pgoff);
+    
+    char *base = mapping.ptr();
+    ring.producer = reinterpret_cast<std::uint32_t *>(base + off_producer);
+    ring.consumer = reinterpret_cast<std::uint32_t *>(base + off_consumer);
+    ring.flags = reinterpret_cast<std::uint32_t *>(base + off_flags);
+    ring.descs = base + off_desc;
+    ring.mask = m_params.ring_size - 1;
+}
+
+void XdpDevice::attachProgram (std::uint32_t ifindex)
+{
+    // Create the map of sockets, indexed by queue.
+    {
+        union bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(std::uint32_t);
+        attr.value_size = sizeof(std::uint32_t);
+        attr.max_entries = m_params.queue_id + 1;
+        
+        m_xsk_map = AIpStack::FileDescriptorWrapper{int(bpfSyscall(BPF_MAP_CREATE, attr))};
+        if (!m_xsk_map) {
+            throw std::runtime_error("XdpDevice: bpf(BPF_MAP_CREATE) failed.");
+        }
+    }
+    
+    // Load the program:
+    //   return bpf_redirect_map(&xsk_map, ctx->rx_queue_index, XDP_PASS);
+    // Frames from queues without a socket are passed to the kernel stack.
+    {
+        struct bpf_insn insns[] = {
+            // r2 = ctx->rx_queue_index
+            {BPF_LDX|BPF_MEM|BPF_W, BPF_REG_2, BPF_REG_1,
+                std::int16_t(offsetof(struct xdp_md, rx_queue_index)), 0},
+            // r1 = xsk_map (two instructions)
+            {BPF_LD|BPF_DW|BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, *m_xsk_map},
+            {0, 0, 0, 0, 0},
+            // r3 = XDP_PASS
+            {BPF_ALU64|BPF_MOV|BPF_K, BPF_REG_3, 0, 0, XDP_PASS},
+            // r0 = bpf_redirect_map(r1, r2, r3)
+            {BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map},
+            // return r0
+            {BPF_JMP|BPF_EXIT, 0, 0, 0, 0},
+        };
+        
+        static char const license[] = "Dual BSD/GPL";
+        
+        union bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = std::uint64_t(reinterpret_cast<std::uintptr_t>(insns));
+        attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+        attr.license = std::uint64_t(reinterpret_cast<std::uintptr_t>(license));
+        
+        m_prog = AIpStack::FileDescriptorWrapper{int(bpfSyscall(BPF_PROG_LOAD, attr))};
+        if (!m_prog) {
+            throw std::runtime_error("XdpDevice: bpf(BPF_PROG_LOAD) failed.");
+        }
+    }
+    
+    // Attach the program using a BPF link, which detaches it when closed.
+    {
+        union bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = std::uint32_t(*m_prog);
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        if ((m_params.flags & XdpDeviceFlags::GenericXdp) != Enum0) {
+            attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+        }
+        
+        m_link = AIpStack::FileDescriptorWrapper{int(bpfSyscall(BPF_LINK_CREATE, attr))};
+        if (!m_link) {
+            throw std::runtime_error(formatString(
+                "XdpDevice: bpf(BPF_LINK_CREATE) failed, err=%d", errno));
+        }
+    }
+}
+
+void XdpDevice::reclaimTxFrames ()
+{
+    auto *comp_descs = reinterpret_cast<std::uint64_t const *>(m_comp_ring.descs);
+    std::uint32_t cons = *m_comp_ring.consumer;
+    std::uint32_t prod = loadAcquire(m_comp_ring.producer);
+    
+    for (; cons != prod; cons++) {
+        m_tx_free.push_back(comp_descs[cons & m_comp_ring.mask] & m_chunk_mask);
+    }
+    
+    storeRelease(m_comp_ring.consumer, cons);
+}
+
+void XdpDevice::kickTx ()
+{
+    if (m_tx_pending == 0) {
+        return;
+    }
+    
+    // The kernel only needs to be woken up if it has requested so.
+    if ((loadAcquire(m_tx_ring.flags) & XDP_RING_NEED_WAKEUP) == 0) {
+        m_tx_pending = 0;
+        return;
+    }
+    
+    // In copy mode, the kernel sends a limited number of frames for each call and
+    // fails with EAGAIN if more are left, so call it again in that case, but give
+    // up after a number of calls as the error may also mean that the
+    // transmission queue is full.
+    for (std::uint32_t i = 0; i <= m_tx_pending / TxKickBatch; i++) {
+        if (::sendto(*m_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) == 0) {
+            m_tx_pending = 0;
+            return;
+        }
+        
+        int err = errno;
+        if (err != EAGAIN) {
+            // EBUSY and ENOBUFS are transient and resolve themselves.
+            if (err != EBUSY && err != ENOBUFS && err != ENETDOWN) {
+                std::fprintf(stderr, "XdpDevice: sendto failed, err=%d\n", err);
+            }
+            return;
+        }
+    }
+}
+
+void XdpDevice::handleFdEvents (AIpStack::EventLoopFdEvents events)
+{
+    AIPSTACK_ASSERT(m_active);
+    
+    if ((events & AIpStack::EventLoopFdEvents::Error) != AIpStack::Enum0) {
+        std::fprintf(stderr, "XdpDevice: Error event. Stopping.\n");
+        m_fd_watcher.reset();
+        m_active = false;
+        return;
+    }
+    
+    if (m_rx_source != nullptr) {
+        // Stop monitoring the socket and let the scheduler poll for frames until
+        // the source returns to interrupt mode.
+        m_fd_watcher.updateEvents(AIpStack::EventLoopFdEvents());
+        m_rx_source->schedule();
+        return;
+    }
+    
+    receiveFrames(m_params.rx_budget);
+}
+
+std::size_t XdpDevice::receiveFrames (std::size_t budget)
+{
+    auto *rx_descs = reinterpret_cast<struct xdp_desc const *>(m_rx_ring.descs);
+    auto *fill_descs = reinterpret_cast<std::uint64_t *>(m_fill_ring.descs);
+    
+    std::uint32_t rx_cons = *m_rx_ring.consumer;
+    std::uint32_t rx_prod = loadAcquire(m_rx_ring.producer);
+    std::uint32_t count = std::uint32_t(MinValueU(rx_prod - rx_cons, budget));
+    
+    // Each received frame is returned to the fill ring after it was processed.
+    // The fill ring always has room since it can hold all receive frames.
+    std::uint32_t fill_prod = *m_fill_ring.producer;
+    
+    for (std::uint32_t i = 0; i < count; i++) {
+        struct xdp_desc const &desc = rx_descs[(rx_cons + i) & m_rx_ring.mask];
+        
+        AIpStack::IpBufNode node{m_umem.ptr() + desc.addr, desc.len, nullptr};
+        m_handler(AIpStack::IpBufRef{&node, 0, desc.len});
+        
+        fill_descs[(fill_prod + i) & m_fill_ring.mask] = desc.addr & m_chunk_mask;
+    }
+    
+    storeRelease(m_rx_ring.consumer, rx_cons + count);
+    storeRelease(m_fill_ring.producer, fill_prod + count);
+    
+    // In zero-copy mode the driver may need to be woken up to continue receiving
+    // after the fill ring was empty.
+    if ((loadAcquire(m_fill_ring.flags) & XDP_RING_NEED_WAKEUP) != 0) {
+        ::recvfrom(*m_fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    }
+    
+    // Reclaim sent frames and send any frames which are still pending.
+    reclaimTxFrames();
+    kickTx();
+    
+    return count;
+}
+
+std::size_t XdpDevice::pollRxSource (std::size_t budget)
+{
+    if (!m_active) {
+        return 0;
+    }
+    
+    return receiveFrames(budget);
+}
+
+void XdpDevice::armRxSource ()
+{
+    if (m_active) {
+        m_fd_watcher.updateEvents(AIpStack::EventLoopFdEvents::Read);
+    }
+}
+
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2018 Ambroz Bizjak
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIPSTACK_XDP_DEVICE_H
+#define AIPSTACK_XDP_DEVICE_H
+
+#if !defined(__linux__)
+#error "XdpDevice is only supported on Linux"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/EnumBitfieldUtils.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/event_loop/EventLoopRxScheduler.h>
+
+namespace AIpStack {
+
+/**
+ * @defgroup xdp AF_XDP Network Device
+ * @brief Provides packet I/O on a network interface using Linux AF_XDP sockets.
+ * 
+ * See the @ref XdpDevice documentation.
+ * 
+ * @{
+ */
+
+/**
+ * Flags for @ref XdpDeviceParams::flags.
+ * 
+ * Operators provided by @ref AIPSTACK_ENUM_BITFIELD are available.
+ */
+enum class XdpDeviceFlags : std::uint8_t {
+    /**
+     * Require zero-copy mode (`XDP_ZEROCOPY`), construction fails if the network
+     * driver does not support it. By default zero-copy mode is used if supported.
+     */
+    ZeroCopy = std::uint8_t(1) << 0,
+
+    /**
+     * Force copy mode (`XDP_COPY`).
+     */
+    Copy = std::uint8_t(1) << 1,
+
+    /**
+     * Attach the XDP program in generic mode (`XDP_FLAGS_SKB_MODE`), which works
+     * with any network driver but only supports copy mode. By default the mode is
+     * chosen by the kernel. Not applicable with @ref XdpDeviceParams::xsk_map_fd.
+     */
+    GenericXdp = std::uint8_t(1) << 2,
+
+    /**
+     * Do not notify the kernel of frames sent using @ref XdpDevice::sendFrame
+     * immediately but only in @ref XdpDevice::flushFrames, which must then be
+     * called (e.g. via @ref EthIfaceDriverParams::flush_frames).
+     */
+    DeferTxKick = std::uint8_t(1) << 3,
+};
+#ifndef IN_DOXYGEN
+AIPSTACK_ENUM_BITFIELD(XdpDeviceFlags)
+#endif
+
+/**
+ * Configuration parameters for @ref XdpDevice.
+ */
+struct XdpDeviceParams {
+    /**
+     * Index of the queue of the network interface to attach to.
+     */
+    std::uint32_t queue_id = 0;
+
+    /**
+     * Number of frames in the UMEM (the packet buffer memory shared with the
+     * kernel). Half of the frames are used for receiving (but no more than
+     * @ref ring_size) and the rest for sending.
+     */
+    std::uint32_t num_frames = 4096;
+
+    /**
+     * Size of each UMEM frame, must be 2048 or 4096. The maximum size of received
+     * frames is 256 bytes less (`XDP_PACKET_HEADROOM`).
+     */
+    std::uint32_t frame_size = 2048;
+
+    /**
+     * Number of entries in each of the fill, completion, RX and TX rings, must be
+     * a power of two.
+     */
+    std::uint32_t ring_size = 2048;
+
+    /**
+     * Maximum number of frames received for one readiness event of the socket,
+     * for fairness with respect to other event sources.
+     */
+    std::size_t rx_budget = 64;
+
+    /**
+     * Scheduler which receives frames in its polls, or null.
+     * 
+     * If not null, a readiness event of the socket only puts the device's
+     * @ref EventLoopRxSource into polling mode and frames are received in polls of
+     * the scheduler, with its adaptive budget instead of @ref rx_budget (see
+     * @ref EventLoopRxScheduler). The scheduler must outlive the @ref XdpDevice.
+     */
+    EventLoopRxScheduler *rx_scheduler = nullptr;
+
+    /**
+     * File descriptor of an existing `BPF_MAP_TYPE_XSKMAP` into which the socket is
+     * inserted at index @ref queue_id, or -1.
+     * 
+     * If -1, an XDP program which redirects frames from each queue to the socket in
+     * the corresponding entry of its own map is attached to the interface for the
+     * lifetime of the @ref XdpDevice. Since only one program can be attached to an
+     * interface, using multiple queues requires a program and map managed by the
+     * application, passed here. The file descriptor is not closed by
+     * @ref XdpDevice.
+     */
+    int xsk_map_fd = -1;
+
+    /**
+     * Flags, see @ref XdpDeviceFlags.
+     */
+    XdpDeviceFlags flags = XdpDeviceFlags();
+};
+
+/**
+ * Provides access to a queue of a network interface using a Linux AF_XDP socket.
+ * 
+ * This facility relies on the @ref event-loop implementation in %AIpStack and has
+ * the same interface as @ref TapDevice, so it can be connected to an
+ * @ref EthIpIface in the same way.
+ * 
+ * Frames are received directly in the UMEM, a memory area registered with the
+ * kernel, and are passed to the @ref FrameReceivedHandler without copying. In
+ * zero-copy mode, the network controller also receives into and sends from the
+ * UMEM. Frames passed to @ref sendFrame are copied into a UMEM frame, since the
+ * stack does not allocate its buffers from the UMEM.
+ * 
+ * Only frames which fit into a single UMEM frame are supported, and the interface
+ * must be configured accordingly (MTU, no receive coalescing).
+ */
+class XdpDevice :
+    private AIpStack::NonCopyable<XdpDevice>
+{
+public:
+    /**
+     * Type of callback used to deliver received frames.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef), starting with the
+     *        14-byte Ethernet header. The referenced buffers must not be used
+     *        outside of the callback function.
+     */
+    using FrameReceivedHandler = Function<void(AIpStack::IpBufRef frame)>;
+
+    /**
+     * Constructor, creates the AF_XDP socket and related resources.
+     * 
+     * @param loop Event loop; it must outlive the XdpDevice object.
+     * @param device_id Name of the network interface.
+     * @param handler Callback function used to deliver received Ethernet frames
+     *        (must not be null).
+     * @param params Configuration parameters.
+     * @throw std::runtime_error If creating or configuring the socket fails.
+     * @throw std::bad_alloc If a memory allocation error occurs.
+     */
+    XdpDevice (AIpStack::EventLoop &loop, std::string const &device_id,
+               FrameReceivedHandler handler,
+               XdpDeviceParams const &params = XdpDeviceParams());
+
+    /**
+     * Destructor, releases the socket and detaches any XDP program.
+     */
+    ~XdpDevice ();
+
+    /**
+     * Get the maximum frame size.
+     * 
+     * @return The maximum frame size including the 14-byte Ethernet header, based
+     *         on the interface MTU and the UMEM frame size.
+     */
+    std::size_t getMtu () const;
+
+    /**
+     * Check whether the socket is in zero-copy mode.
+     * 
+     * @return True if in zero-copy mode, false if in copy mode.
+     */
+    bool isZeroCopy () const;
+
+    /**
+     * Send an Ethernet frame through the network interface.
+     * 
+     * @param frame Frame data (referenced using @ref IpBufRef), starting with the
+     *        14-byte Ethernet header.
+     * @return Success or error code (@ref IpErr::OutputBufferFull if there is no
+     *         free UMEM frame or TX ring entry).
+     */
+    AIpStack::IpErr sendFrame (AIpStack::IpBufRef frame);
+
+    /**
+     * Notify the kernel of frames sent using @ref sendFrame, if needed.
+     * 
+     * This only needs to be called with @ref XdpDeviceFlags::DeferTxKick.
+     */
+    void flushFrames ();
+
+private:
+    // Number of frames the kernel sends for one sendto() call in copy mode
+    // (TX_BATCH_SIZE in the kernel).
+    static constexpr std::uint32_t TxKickBatch = 32;
+    
+    // Memory mapping which is unmapped in the destructor.
+    class Mapping :
+        private AIpStack::NonCopyable<Mapping>
+    {
+    public:
+        Mapping ();
+        ~Mapping ();
+        void map (std::size_t size, int prot, int flags, int fd, std::uint64_t offset);
+        char * ptr () const;
+
+    private:
+        void *m_ptr;
+        std::size_t m_size;
+    };
+
+    // One of the four rings shared with the kernel.
+    struct Ring {
+        std::uint32_t *producer;
+        std::uint32_t *consumer;
+        std::uint32_t *flags;
+        char *descs;
+        std::uint32_t mask;
+    };
+
+    void setupRing (Ring &ring, Mapping &mapping, std::uint64_t pgoff,
+                    std::size_t desc_size, std::uint64_t off_producer,
+                    std::uint64_t off_consumer, std::uint64_t off_desc,
+                    std::uint64_t off_flags);
+
+    void attachProgram (std::uint32_t ifindex);
+
+    void reclaimTxFrames ();
+
+    void kickTx ();
+
+    void handleFdEvents (AIpStack::EventLoopFdEvents events);
+
+    // Receive up to budget frames, returns the number received.
+    std::size_t receiveFrames (std::size_t budget);
+
+    std::size_t pollRxSource (std::size_t budget);
+
+    void armRxSource ();
+
+private:
+    FrameReceivedHandler m_handler;
+    XdpDeviceParams m_params;
+    std::size_t m_frame_mtu;
+    bool m_zero_copy;
+    std::uint64_t m_chunk_mask;
+    std::uint32_t m_tx_pending;
+    Mapping m_umem;
+    AIpStack::FileDescriptorWrapper m_fd;
+    Mapping m_fill_map;
+    Mapping m_comp_map;
+    Mapping m_rx_map;
+    Mapping m_tx_map;
+    Ring m_fill_ring;
+    Ring m_comp_ring;
+    Ring m_rx_ring;
+    Ring m_tx_ring;
+    std::vector<std::uint64_t> m_tx_free;
+    AIpStack::FileDescriptorWrapper m_xsk_map;
+    AIpStack::FileDescriptorWrapper m_prog;
+    AIpStack::FileDescriptorWrapper m_link;
+    AIpStack::EventLoopFdWatcher m_fd_watcher;
+    std::unique_ptr<AIpStack::EventLoopRxSource> m_rx_source;
+    bool m_active;
+};
+
+/** @} */
+
+}
+
+#endif
@@ -0,0 +1,254 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/udp/IpUdpProto.h>
+
+#include "alloc_guard.h"
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test that the TCP and UDP data paths do not allocate memory.
+ *
+ * Two stacks are connected back to back (TcpFixture::Host) with buffers for
+ * packets in flight reserved in advance, so that the test itself does not
+ * allocate after setup. After a warm-up,
+ * dynamic allocation is forbidden (alloc_guard.h) while the stacks:
+ * - transfer bulk data over TCP in both directions,
+ * - do TCP request/response transactions,
+ * - exchange UDP request/response datagrams.
+ * Any allocation (operator new or malloc) aborts the test.
+ */
+
+namespace aipstack_alloc_free_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::NumTcpPcbs::Is<4>
+    >,
+    IpUdpProtoService<
+        IpUdpProtoOptions::UdpIndexService::Is<AvlTreeIndexService>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+using UdpArg = MyIpStack::template GetProtoArg<UdpApi>;
+
+constexpr Ip4Addr ClientAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr ServerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr std::uint16_t TcpPort = 80;
+constexpr std::uint16_t UdpServerPort = 5000;
+constexpr std::uint16_t UdpClientPort = 5001;
+constexpr std::size_t MaxPackets = 256;
+constexpr std::size_t BufferSize = 64 * 1024;
+constexpr std::size_t WarmupBytes = 1024 * 1024;
+constexpr std::size_t BulkBytes = 8 * 1024 * 1024;
+constexpr std::size_t RrMsgSize = 100;
+constexpr std::size_t RrTransactions = 1000;
+constexpr std::size_t UdpDataSize = 64;
+constexpr std::size_t UdpTransactions = 1000;
+
+using Host = TcpFixture::Host<IpStackArg>;
+using TestConnection = TcpFixture::TestConnection<TcpArg>;
+
+class Setup
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_client_host(m_platform, ClientAddr),
+        m_server_host(m_platform, ServerAddr),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_udp_server(AIPSTACK_BIND_MEMBER_TN(&Setup::udpServerReceived, this)),
+        m_udp_client(AIPSTACK_BIND_MEMBER_TN(&Setup::udpClientReceived, this)),
+        m_client(BufferSize),
+        m_server(BufferSize)
+    {
+        m_client_host.setPeer(&m_server_host);
+        m_server_host.setPeer(&m_client_host);
+        m_client_host.reserveBuffers(MaxPackets);
+        m_server_host.reserveBuffers(MaxPackets);
+
+        bool listen_res = m_listener.startListening(m_server_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ TcpPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+
+        UdpListenParams<UdpArg> server_params;
+        server_params.port = UdpServerPort;
+        IpErr err = m_udp_server.startListening(udp(m_server_host), server_params);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+
+        UdpListenParams<UdpArg> client_params;
+        client_params.port = UdpClientPort;
+        err = m_udp_client.startListening(udp(m_client_host), client_params);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    void connect ()
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = ServerAddr;
+        args.port = TcpPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(m_client_host.tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+    }
+
+    void bulk (std::size_t amount)
+    {
+        std::size_t client_target = m_client.getReceived() + amount;
+        std::size_t server_target = m_server.getReceived() + amount;
+        m_client.send(amount);
+        m_server.send(amount);
+        TcpFixture::runWhile(m_sim, [&] {
+            return m_client.getReceived() < client_target ||
+                   m_server.getReceived() < server_target;
+        });
+    }
+
+    void requestResponse (std::size_t transactions)
+    {
+        for (std::size_t i = 0; i < transactions; i++) {
+            std::size_t server_target = m_server.getReceived() + RrMsgSize;
+            m_client.send(RrMsgSize);
+            TcpFixture::runWhile(m_sim, [&] { return m_server.getReceived() < server_target; });
+
+            std::size_t client_target = m_client.getReceived() + RrMsgSize;
+            m_server.send(RrMsgSize);
+            TcpFixture::runWhile(m_sim, [&] { return m_client.getReceived() < client_target; });
+        }
+    }
+
+    void udpRequestResponse (std::size_t transactions)
+    {
+        for (std::size_t i = 0; i < transactions; i++) {
+            std::size_t target = m_udp_responses + 1;
+            sendUdp(m_client_host, ServerAddr, UdpClientPort, UdpServerPort);
+            TcpFixture::runWhile(m_sim, [&] { return m_udp_responses < target; });
+        }
+    }
+
+private:
+    static UdpApi<UdpArg> & udp (Host &host)
+    {
+        return host.stack().template getProtoApi<UdpApi>();
+    }
+
+    static void sendUdp (Host &host, Ip4Addr dst_addr, std::uint16_t src_port,
+                         std::uint16_t dst_port)
+    {
+        char buf[Ip4Header::Size + Udp4Header::Size + UdpDataSize] = {};
+        IpBufNode node{buf, sizeof(buf), nullptr};
+        IpBufRef udp_data{&node, Ip4Header::Size + Udp4Header::Size, UdpDataSize};
+        UdpTxInfo<UdpArg> udp_info{src_port, dst_port};
+        Ip4Addr src_addr = host.iface().getIp4Addr().addr;
+        IpErr err = udp(host).sendUdpIp4Packet(Ip4AddrPair{src_addr, dst_addr},
+            udp_info, udp_data, &host.iface(), nullptr, IpSendFlags());
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+    }
+
+    void connectionEstablished ()
+    {
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+    UdpRecvResult udpServerReceived (IpRxInfoIp4<IpStackArg> const &ip_info,
+                                     UdpRxInfo<UdpArg> const &udp_info, IpBufRef data)
+    {
+        AIPSTACK_ASSERT_FORCE(data.tot_len == UdpDataSize);
+        sendUdp(m_server_host, ip_info.src_addr, udp_info.dst_port, udp_info.src_port);
+        return UdpRecvResult::AcceptStop;
+    }
+
+    UdpRecvResult udpClientReceived (IpRxInfoIp4<IpStackArg> const &,
+                                     UdpRxInfo<UdpArg> const &, IpBufRef data)
+    {
+        AIPSTACK_ASSERT_FORCE(data.tot_len == UdpDataSize);
+        m_udp_responses++;
+        return UdpRecvResult::AcceptStop;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_client_host;
+    Host m_server_host;
+    TcpListener<TcpArg> m_listener;
+    UdpListener<UdpArg> m_udp_server;
+    UdpListener<UdpArg> m_udp_client;
+    TestConnection m_client;
+    TestConnection m_server;
+    bool m_server_accepted = false;
+    std::size_t m_udp_responses = 0;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_alloc_free_test;
+
+    auto *setup = new Setup();
+
+    // Warm-up, during which allocation is allowed.
+    setup->connect();
+    setup->bulk(WarmupBytes);
+    setup->requestResponse(10);
+    setup->udpRequestResponse(10);
+
+    {
+        AllocGuard::Scope no_alloc;
+
+        setup->bulk(BulkBytes);
+        setup->requestResponse(RrTransactions);
+        setup->udpRequestResponse(UdpTransactions);
+    }
+
+    std::printf("alloc free: bulk, %zu TCP and %zu UDP transactions\n",
+                RrTransactions, UdpTransactions);
+
+    delete setup;
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+#ifndef AIPSTACK_TESTS_ALLOC_GUARD_H
+#define AIPSTACK_TESTS_ALLOC_GUARD_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include <unistd.h>
+
+/*
+ * Detection of dynamic memory allocation in tests and benchmarks.
+ *
+ * Including this header replaces the global operator new and delete
+ * (including the aligned ones), and on glibc also malloc, calloc, realloc,
+ * aligned_alloc, memalign and posix_memalign, with versions which check whether
+ * allocation is currently forbidden (AllocGuard::Scope). An allocation while
+ * forbidden prints a message and aborts, so that a debugger shows where it
+ * happened.
+ *
+ * This must be included in only one translation unit of a program.
+ */
+
+namespace AllocGuard {
+
+inline bool forbidden = false;
+
+inline void check ()
+{
+    if (forbidden) {
+        forbidden = false;
+        char const msg[] = "AllocGuard: dynamic allocation while forbidden.\n";
+        (void)!::write(2, msg, sizeof(msg) - 1);
+        std::abort();
+    }
+}
+
+// Forbids allocation for the lifetime of the object.
+class Scope
+{
+public:
+    Scope ()
+    {
+        forbidden = true;
+    }
+
+    ~Scope ()
+    {
+        forbidden = false;
+    }
+
+    Scope (Scope const &) = delete;
+    Scope & operator= (Scope const &) = delete;
+};
+
+}
+
+#ifdef __GLIBC__
+
+extern "C" {
+
+void * __libc_malloc (std::size_t size);
+void * __libc_calloc (std::size_t num, std::size_t size);
+void * __libc_realloc (void *ptr, std::size_t size);
+void * __libc_memalign (std::size_t alignment, std::size_t size);
+void __libc_free (void *ptr);
+
+void * malloc (std::size_t size)
+{
+    AllocGuard::check();
+    return __libc_malloc(size);
+}
+
+void * calloc (std::size_t num, std::size_t size)
+{
+    AllocGuard::check();
+    return __libc_calloc(num, size);
+}
+
+void * realloc (void *ptr, std::size_t size)
+{
+    AllocGuard::check();
+    return __libc_realloc(ptr, size);
+}
+
+void * aligned_alloc (std::size_t alignment, std::size_t size)
+{
+    AllocGuard::check();
+    return __libc_memalign(alignment, size);
+}
+
+void * memalign (std::size_t alignment, std::size_t size)
+{
+    AllocGuard::check();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign (void **out_ptr, std::size_t alignment, std::size_t size)
+{
+    AllocGuard::check();
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr == nullptr) {
+        return ENOMEM;
+    }
+    *out_ptr = ptr;
+    return 0;
+}
+
+}
+
+#endif
+
+namespace AllocGuard {
+
+// Allocation functions used by the replaced operator new and delete. With
+// glibc these are the internal functions which the replaced malloc and
+// friends also use, otherwise the standard functions.
+
+inline void * raw_alloc (std::size_t size, std::size_t alignment)
+{
+    check();
+#ifdef __GLIBC__
+    return alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__ ?
+        __libc_malloc(size) : __libc_memalign(alignment, size);
+#else
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return std::malloc(size);
+    }
+    // The size must be a multiple of the alignment for aligned_alloc.
+    return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+}
+
+// GCC warns about free being called on memory from operator new when the
+// operators are inlined, but here that is how they are implemented.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+inline void raw_free (void *ptr)
+{
+#ifdef __GLIBC__
+    __libc_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+inline void * checked_new (std::size_t size, std::size_t alignment)
+{
+    void *ptr = raw_alloc(size == 0 ? 1 : size, alignment);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+}
+
+void * operator new (std::size_t size)
+{
+    return AllocGuard::checked_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void * operator new[] (std::size_t size)
+{
+    return AllocGuard::checked_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void * operator new (std::size_t size, std::align_val_t alignment)
+{
+    return AllocGuard::checked_new(size, std::size_t(alignment));
+}
+
+void * operator new[] (std::size_t size, std::align_val_t alignment)
+{
+    return AllocGuard::checked_new(size, std::size_t(alignment));
+}
+
+void operator delete (void *ptr) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+void operator delete[] (void *ptr) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+void operator delete (void *ptr, std::size_t) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+void operator delete[] (void *ptr, std::size_t) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+void operator delete (void *ptr, std::align_val_t) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+void operator delete[] (void *ptr, std::align_val_t) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+void operator delete (void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+void operator delete[] (void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    AllocGuard::raw_free(ptr);
+}
+
+#endif
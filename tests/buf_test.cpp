@@ -1,5 +1,6 @@
 
 #include <cstddef>
+#include <cstring>
 
 #include <aipstack/misc/Assert.h>
 #include <aipstack/misc/Modulo.h>
@@ -82,6 +83,53 @@ void test_with_offset(std::size_t off)
     AIPSTACK_ASSERT_FORCE(ipBufStartsWith(all, AIpStack::MemRef(), rem7) == true);
     AIPSTACK_ASSERT_FORCE(rem7.offset == all.offset);
     AIPSTACK_ASSERT_FORCE(rem7.tot_len == all.tot_len);
+    
+    // toScatterGather tests
+    
+    MemRef entries[3];
+    std::size_t num_entries;
+    auto setEntry = makeTypedFunction([](MemRef &entry, char *ptr, std::size_t len) {
+        entry = MemRef(ptr, len);
+    });
+    
+    AIPSTACK_ASSERT_FORCE(ipBufToScatterGather(all, entries, 3, num_entries, setEntry));
+    AIPSTACK_ASSERT_FORCE(num_entries == (off == 0 ? 1 : 2));
+    AIPSTACK_ASSERT_FORCE(entries[0].ptr == buffer + off);
+    AIPSTACK_ASSERT_FORCE(entries[0].len == Mod.modulus() - off);
+    if (off != 0) {
+        AIPSTACK_ASSERT_FORCE(entries[1].ptr == buffer);
+        AIPSTACK_ASSERT_FORCE(entries[1].len == off);
+    }
+    
+    AIPSTACK_ASSERT_FORCE(ipBufToScatterGather(all, entries, 1, num_entries, setEntry) ==
+                          (off == 0));
+    
+    AIPSTACK_ASSERT_FORCE(ipBufToScatterGather(
+        all.subTo(0), entries, 0, num_entries, setEntry));
+    AIPSTACK_ASSERT_FORCE(num_entries == 0);
+    
+    // IpBufCursor tests
+    
+    IpBufCursor cur1(all);
+    AIPSTACK_ASSERT_FORCE(cur1.takeByte() == '0');
+    char cur_data[4];
+    cur1.takeBytes(4, cur_data);
+    AIPSTACK_ASSERT_FORCE(std::memcmp(cur_data, "1234", 4) == 0);
+    cur1.skipBytes(3);
+    AIPSTACK_ASSERT_FORCE(cur1.getRemaining() == 2);
+    AIPSTACK_ASSERT_FORCE(cur1.getBufRef().tot_len == 2);
+    AIPSTACK_ASSERT_FORCE(cur1.takeByte() == '8');
+    AIPSTACK_ASSERT_FORCE(cur1.takeByte() == '9');
+    AIPSTACK_ASSERT_FORCE(cur1.getRemaining() == 0);
+    
+    IpBufCursor cur2(ipBufSkipBytes(all, 2));
+    char *contig = cur2.getContiguous(1);
+    AIPSTACK_ASSERT_FORCE(contig != nullptr && *contig == '2');
+    AIPSTACK_ASSERT_FORCE(
+        (cur2.getContiguous(Mod.modulus() - 2) != nullptr) == (off == 0 || off >= 8));
+    cur2.giveBytes(MemRef("ABCDEFGH", 8));
+    AIPSTACK_ASSERT_FORCE(buffer[Mod.add(off, 2)] == 'A');
+    AIPSTACK_ASSERT_FORCE(buffer[Mod.add(off, 9)] == 'H');
 }
 
 }
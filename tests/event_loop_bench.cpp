@@ -0,0 +1,416 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <deque>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/event_loop/EventLoop.h>
+
+#if AIPSTACK_EVENT_LOOP_HAS_FD
+#include <unistd.h>
+#include <aipstack/misc/platform_specific/FileDescriptorWrapper.h>
+#endif
+
+using namespace AIpStack;
+
+/*
+ * Benchmark of the EventLoop itself.
+ *
+ * Timers: for each number of timers, the following operations are measured in
+ * sequence:
+ * - arm: all timers are started with random expiration times in the future.
+ * - rearm: all timers are started again with other random times.
+ * - disarm: all timers are stopped.
+ * - fire: all timers are started with random expiration times in the past
+ *   and the event loop is run until all have been dispatched.
+ * The timer implementation ("heap" or "wheel") is reported, so that builds with
+ * and without AIPSTACK_EVENT_LOOP_USE_TIMER_WHEEL can be compared.
+ *
+ * Async-signals: another thread signals an EventLoopAsyncSignal.
+ * - pingpong: the thread waits for each signal to be dispatched before the next
+ *   one, giving the cross-thread wakeup latency as ns per round trip.
+ * - flood: the thread signals continuously, giving the cost of signal() and the
+ *   number of signals per dispatch.
+ *
+ * Fd-watchers (where AIPSTACK_EVENT_LOOP_HAS_FD): for each number of pipes
+ * being watched for reading, the ns per dispatched event are measured with all
+ * pipes readable ("all_active") and with only one of them readable
+ * ("one_active"). Events are level-triggered and never consumed, so each wait
+ * reports the same events again.
+ *
+ * Output is JSON on stdout, an array with one object per case. Build with
+ * -DAIPSTACK_EVENT_LOOP_USE_IO_URING or -DAIPSTACK_EVENT_LOOP_USE_TIMER_WHEEL to
+ * measure the respective implementations ("provider" and "timers" are included
+ * in each object).
+ *
+ * Optional arguments are the numbers of timers to test (default 1000, 10000,
+ * 100000 and 1000000). A single argument of 0 selects a quick run for
+ * testing.
+ *
+ * This needs to be linked with EventLoopAmalgamation.cpp.
+ */
+
+namespace aipstack_event_loop_bench {
+
+using Clock = std::chrono::steady_clock;
+
+std::size_t const default_timer_counts[] = {1000, 10000, 100000, 1000000};
+std::size_t const quick_timer_counts[] = {1000};
+
+std::size_t const default_fd_counts[] = {16, 256, 4096};
+std::size_t const quick_fd_counts[] = {16};
+
+#if AIPSTACK_EVENT_LOOP_HAS_URING
+char const *const provider_name = "io_uring";
+#elif AIPSTACK_EVENT_LOOP_HAS_KQUEUE
+char const *const provider_name = "kqueue";
+#elif AIPSTACK_EVENT_LOOP_HAS_IOCP
+char const *const provider_name = "iocp";
+#else
+char const *const provider_name = "epoll";
+#endif
+
+#if AIPSTACK_EVENT_LOOP_HAS_TIMER_WHEEL
+char const *const timers_name = "wheel";
+#else
+char const *const timers_name = "heap";
+#endif
+
+std::mt19937_64 rng(1);
+
+bool quick = false;
+bool first_case = true;
+
+double ns_since (Clock::time_point start, std::size_t num_ops)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count();
+    return double(ns) / double(MaxValue(std::size_t(1), num_ops));
+}
+
+void begin_case (char const *bench)
+{
+    std::printf("%s\n  {\"bench\": \"%s\", \"provider\": \"%s\", \"timers\": \"%s\"",
+                first_case ? "[" : ",", bench, provider_name, timers_name);
+    first_case = false;
+}
+
+class TimerBench {
+public:
+    TimerBench (std::size_t count) :
+        m_count(count)
+    {
+        for (std::size_t i = 0; i < m_count; i++) {
+            m_timers.emplace_back(m_loop,
+                AIPSTACK_BIND_MEMBER(&TimerBench::timerHandler, this));
+        }
+    }
+
+    void run ()
+    {
+        std::uniform_int_distribution<std::int64_t> future_dist(
+            std::chrono::nanoseconds(std::chrono::seconds(10)).count(),
+            std::chrono::nanoseconds(std::chrono::seconds(20)).count());
+
+        // Random times are generated up front so that only the timer operations
+        // are measured.
+        std::vector<EventLoopTime> times(m_count);
+        auto gen_future = [&]() {
+            EventLoopTime base = m_loop.getEventTime();
+            for (EventLoopTime &time : times) {
+                time = base + std::chrono::duration_cast<EventLoopDuration>(
+                    std::chrono::nanoseconds(future_dist(rng)));
+            }
+        };
+
+        gen_future();
+        auto start = Clock::now();
+        for (std::size_t i = 0; i < m_count; i++) {
+            m_timers[i].setAt(times[i]);
+        }
+        double arm_ns = ns_since(start, m_count);
+
+        gen_future();
+        start = Clock::now();
+        for (std::size_t i = 0; i < m_count; i++) {
+            m_timers[i].setAt(times[i]);
+        }
+        double rearm_ns = ns_since(start, m_count);
+
+        start = Clock::now();
+        for (EventLoopTimer &timer : m_timers) {
+            timer.unset();
+        }
+        double disarm_ns = ns_since(start, m_count);
+
+        for (EventLoopTimer const &timer : m_timers) {
+            AIPSTACK_ASSERT_FORCE(!timer.isSet());
+        }
+
+        // Expired times spread over one second in the past.
+        std::uniform_int_distribution<std::int64_t> past_dist(
+            std::chrono::nanoseconds(std::chrono::seconds(1)).count(),
+            std::chrono::nanoseconds(std::chrono::seconds(2)).count());
+        EventLoopTime now = EventLoop::getTime();
+        for (EventLoopTime &time : times) {
+            time = now - std::chrono::duration_cast<EventLoopDuration>(
+                std::chrono::nanoseconds(past_dist(rng)));
+        }
+
+        start = Clock::now();
+        for (std::size_t i = 0; i < m_count; i++) {
+            m_timers[i].setAt(times[i]);
+        }
+        m_loop.run();
+        double fire_ns = ns_since(start, m_count);
+
+        AIPSTACK_ASSERT_FORCE(m_fired == m_count);
+
+        begin_case("timers");
+        std::printf(", \"count\": %zu, \"arm_ns\": %.1f, \"rearm_ns\": %.1f, "
+                    "\"disarm_ns\": %.1f, \"fire_ns\": %.1f}",
+                    m_count, arm_ns, rearm_ns, disarm_ns, fire_ns);
+    }
+
+private:
+    void timerHandler ()
+    {
+        m_fired++;
+        if (m_fired == m_count) {
+            m_loop.stop();
+        }
+    }
+
+private:
+    std::size_t m_count;
+    EventLoop m_loop;
+    std::deque<EventLoopTimer> m_timers;
+    std::size_t m_fired = 0;
+};
+
+class AsyncSignalBench {
+public:
+    AsyncSignalBench () :
+        m_signal(m_loop, AIPSTACK_BIND_MEMBER(&AsyncSignalBench::signalHandler, this))
+    {}
+
+    void runPingPong (std::size_t rounds)
+    {
+        m_mode = Mode::PingPong;
+        m_target = rounds;
+
+        auto start = Clock::now();
+        std::thread thread([&]() {
+            for (std::size_t i = 0; i < rounds; i++) {
+                m_signal.signal();
+                while (m_acked.load(std::memory_order_acquire) != i + 1) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        m_loop.run();
+        thread.join();
+        double round_trip_ns = ns_since(start, rounds);
+
+        AIPSTACK_ASSERT_FORCE(m_dispatches == rounds);
+
+        begin_case("async_signal_pingpong");
+        std::printf(", \"rounds\": %zu, \"round_trip_ns\": %.1f}", rounds, round_trip_ns);
+    }
+
+    void runFlood (std::size_t signals)
+    {
+        m_mode = Mode::Flood;
+        m_dispatches = 0;
+        m_done.store(false, std::memory_order_relaxed);
+
+        double signal_ns = 0.0;
+        auto start = Clock::now();
+        std::thread thread([&]() {
+            auto thread_start = Clock::now();
+            for (std::size_t i = 0; i < signals; i++) {
+                m_signal.signal();
+            }
+            signal_ns = ns_since(thread_start, signals);
+
+            // The last signal may have been dispatched already, so a final one
+            // is needed to notice that the flood is done.
+            m_done.store(true, std::memory_order_release);
+            m_signal.signal();
+        });
+        m_loop.run();
+        thread.join();
+        double total_ns = ns_since(start, signals);
+
+        begin_case("async_signal_flood");
+        std::printf(", \"signals\": %zu, \"signal_ns\": %.1f, \"ns_per_signal\": %.1f, "
+                    "\"signals_per_dispatch\": %.1f}", signals, signal_ns, total_ns,
+                    double(signals) / double(MaxValue(std::size_t(1), m_dispatches)));
+    }
+
+private:
+    enum class Mode {PingPong, Flood};
+
+    void signalHandler ()
+    {
+        m_dispatches++;
+
+        if (m_mode == Mode::PingPong) {
+            m_acked.store(m_dispatches, std::memory_order_release);
+            if (m_dispatches == m_target) {
+                m_loop.stop();
+            }
+        } else {
+            if (m_done.load(std::memory_order_acquire)) {
+                m_loop.stop();
+            }
+        }
+    }
+
+private:
+    EventLoop m_loop;
+    EventLoopAsyncSignal m_signal;
+    Mode m_mode = Mode::PingPong;
+    std::size_t m_target = 0;
+    std::size_t m_dispatches = 0;
+    std::atomic<std::size_t> m_acked{0};
+    std::atomic<bool> m_done{false};
+};
+
+#if AIPSTACK_EVENT_LOOP_HAS_FD
+
+class FdBench {
+    struct Pipe {
+        FileDescriptorWrapper read_fd;
+        FileDescriptorWrapper write_fd;
+        EventLoopFdWatcher watcher;
+
+        Pipe (EventLoop &loop, FdBench *bench) :
+            watcher(loop, AIPSTACK_BIND_MEMBER(&FdBench::fdHandler, bench))
+        {}
+    };
+
+public:
+    FdBench (std::size_t count) :
+        m_count(count)
+    {
+        for (std::size_t i = 0; i < m_count; i++) {
+            Pipe &pipe = m_pipes.emplace_back(m_loop, this);
+            int fds[2];
+            AIPSTACK_ASSERT_FORCE(::pipe(fds) == 0);
+            pipe.read_fd = FileDescriptorWrapper(fds[0]);
+            pipe.write_fd = FileDescriptorWrapper(fds[1]);
+            pipe.watcher.initFd(*pipe.read_fd, EventLoopFdEvents::Read);
+        }
+    }
+
+    void run (std::size_t num_events)
+    {
+        // One pipe is made readable first.
+        makeReadable(0);
+        double one_ns = measure(num_events);
+
+        for (std::size_t i = 1; i < m_count; i++) {
+            makeReadable(i);
+        }
+        double all_ns = measure(num_events);
+
+        begin_case("fd_dispatch");
+        std::printf(", \"fds\": %zu, \"one_active_ns\": %.1f, \"all_active_ns\": %.1f}",
+                    m_count, one_ns, all_ns);
+    }
+
+private:
+    void makeReadable (std::size_t index)
+    {
+        char byte = 0;
+        AIPSTACK_ASSERT_FORCE(::write(*m_pipes[index].write_fd, &byte, 1) == 1);
+    }
+
+    double measure (std::size_t num_events)
+    {
+        m_events = 0;
+        m_target = num_events;
+
+        auto start = Clock::now();
+        m_loop.run();
+        return ns_since(start, m_events);
+    }
+
+    void fdHandler (EventLoopFdEvents events)
+    {
+        AIPSTACK_ASSERT_FORCE((events & EventLoopFdEvents::Read) != Enum0);
+
+        m_events++;
+        if (m_events == m_target) {
+            m_loop.stop();
+        }
+    }
+
+private:
+    std::size_t m_count;
+    EventLoop m_loop;
+    // Destructed before the loop and with each watcher before its descriptors.
+    std::deque<Pipe> m_pipes;
+    std::size_t m_events = 0;
+    std::size_t m_target = 0;
+};
+
+#endif
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_event_loop_bench;
+
+    std::vector<std::size_t> timer_counts(
+        std::begin(default_timer_counts), std::end(default_timer_counts));
+    std::vector<std::size_t> fd_counts(
+        std::begin(default_fd_counts), std::end(default_fd_counts));
+
+    if (argc == 2 && std::strtoull(argv[1], nullptr, 10) == 0) {
+        quick = true;
+        timer_counts.assign(
+            std::begin(quick_timer_counts), std::end(quick_timer_counts));
+        fd_counts.assign(std::begin(quick_fd_counts), std::end(quick_fd_counts));
+    }
+    else if (argc > 1) {
+        timer_counts.clear();
+        for (int i = 1; i < argc; i++) {
+            std::size_t count = std::strtoull(argv[i], nullptr, 10);
+            AIPSTACK_ASSERT_FORCE(count > 0);
+            timer_counts.push_back(count);
+        }
+    }
+
+    for (std::size_t count : timer_counts) {
+        TimerBench bench(count);
+        bench.run();
+    }
+
+    {
+        AsyncSignalBench bench;
+        bench.runPingPong(quick ? 1000 : 100000);
+        bench.runFlood(quick ? 100000 : 10000000);
+    }
+
+#if AIPSTACK_EVENT_LOOP_HAS_FD
+    for (std::size_t count : fd_counts) {
+        FdBench bench(count);
+        bench.run(quick ? 10000 : MaxValue(std::size_t(1000000), 100 * count));
+    }
+#endif
+
+    std::printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/structure/minimum/ArrayHeap.h>
+
+using namespace AIpStack;
+
+/*
+ * Benchmark of the heap ("minimum" family) data structures with a timer-like
+ * workload.
+ *
+ * For each heap service and number of entries, entries with random times and
+ * a size similar to a TCP PCB are created and the following operations are
+ * measured in sequence:
+ * - insert: all entries are inserted in a random order.
+ * - reschedule: the minimum entry is repeatedly given a later time and fixed
+ *   up, as when the earliest timer expires and is restarted.
+ * - remove: all entries are removed in a random order.
+ *
+ * The order of minimum entries, findAllLesserOrEqual and the
+ * findFirstLesserOrEqual/findNextLesserOrEqual iteration are checked, as well
+ * as the heap invariants after each phase.
+ *
+ * Output is JSON on stdout, an array with one object per case, containing the
+ * size of the heap object in bytes ("heap_bytes") and the CPU time in ns per
+ * operation for each phase.
+ *
+ * Optional arguments are the numbers of entries to test (default 1000, 100000
+ * and 1000000), at most MaxEntries.
+ */
+
+namespace aipstack_heap_bench {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t MaxEntries = std::size_t(1) << 20;
+
+// Makes entries about as large as a TCP PCB so that they are spread in memory.
+constexpr std::size_t EntryPayloadSize = 192;
+
+// Minimum number of reschedule operations to measure.
+constexpr std::size_t MinReschedules = 1000000;
+
+std::size_t const default_counts[] = {1000, 100000, 1000000};
+
+std::mt19937_64 rng(1);
+
+bool first_case = true;
+
+std::vector<std::size_t> random_order (std::size_t count)
+{
+    std::vector<std::size_t> order(count);
+    for (std::size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    return order;
+}
+
+double ns_since (Clock::time_point start, std::size_t num_ops)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count();
+    return double(ns) / double(MaxValue(std::size_t(1), num_ops));
+}
+
+template<typename HeapService>
+class HeapBench {
+    struct Entry;
+
+    using LinkModel = PointerLinkModel<Entry>;
+    using State = typename LinkModel::State;
+    using Ref = typename LinkModel::Ref;
+    using HeapNode = typename HeapService::template Node<LinkModel>;
+
+    struct Entry {
+        std::uint64_t time;
+        HeapNode hook;
+        char payload[EntryPayloadSize];
+    };
+
+    struct HookAccessor : public MemberAccessor<Entry, HeapNode, &Entry::hook> {};
+
+    struct Compare {
+        inline static int compareEntries (State, Ref ref1, Ref ref2)
+        {
+            return compareTimes((*ref1).time, (*ref2).time);
+        }
+
+        inline static int compareKeyEntry (State, std::uint64_t time1, Ref ref2)
+        {
+            return compareTimes(time1, (*ref2).time);
+        }
+
+        inline static int compareTimes (std::uint64_t time1, std::uint64_t time2)
+        {
+            return (time1 > time2) - (time1 < time2);
+        }
+    };
+
+    using Heap = typename HeapService::template Structure<
+        HookAccessor, Compare, LinkModel>;
+
+public:
+    static void run (char const *name, std::size_t count)
+    {
+        std::uint64_t const time_range = 4 * std::uint64_t(count);
+
+        std::unique_ptr<Entry[]> entries(new Entry[count]);
+        for (std::size_t i = 0; i < count; i++) {
+            entries[i].time = rng() % time_range;
+        }
+
+        auto heap = std::make_unique<Heap>();
+        heap->init();
+
+        // Insert.
+        std::vector<std::size_t> order = random_order(count);
+        auto start = Clock::now();
+        for (std::size_t i : order) {
+            heap->insert(Ref(entries[i]));
+        }
+        double insert_ns = ns_since(start, count);
+
+        heap->verifyHeap();
+        check(*heap, entries.get(), count, time_range / 2);
+
+        // Reschedule the minimum entry. Times are increasing so the sequence
+        // of minimum times must not decrease.
+        std::size_t reschedules = MaxValue(count, MinReschedules);
+        std::vector<std::uint64_t> delays(reschedules);
+        for (std::uint64_t &delay : delays) {
+            delay = 1 + rng() % time_range;
+        }
+        std::uint64_t prev_time = 0;
+        bool ordered = true;
+        start = Clock::now();
+        for (std::uint64_t delay : delays) {
+            Ref e = heap->first();
+            ordered &= (*e).time >= prev_time;
+            prev_time = (*e).time;
+            (*e).time += delay;
+            heap->fixup(e);
+        }
+        double reschedule_ns = ns_since(start, reschedules);
+        AIPSTACK_ASSERT_FORCE(ordered);
+
+        heap->verifyHeap();
+        check(*heap, entries.get(), count, prev_time + time_range / 2);
+
+        // Remove half of the entries and check, then remove the rest.
+        order = random_order(count);
+        std::size_t half = count / 2;
+        start = Clock::now();
+        for (std::size_t j = 0; j < half; j++) {
+            heap->remove(Ref(entries[order[j]]));
+        }
+        auto remove_ns = Clock::now() - start;
+
+        heap->verifyHeap();
+        for (std::size_t j = 0; j < half; j++) {
+            entries[order[j]].time = std::uint64_t(-1);
+        }
+        check(*heap, entries.get(), count, prev_time + time_range / 2);
+
+        start = Clock::now();
+        for (std::size_t j = half; j < count; j++) {
+            heap->remove(Ref(entries[order[j]]));
+        }
+        remove_ns += Clock::now() - start;
+        AIPSTACK_ASSERT_FORCE(heap->isEmpty());
+        AIPSTACK_ASSERT_FORCE(heap->first().isNull());
+
+        std::printf("%s\n  {\"heap\": \"%s\", \"entries\": %zu, \"heap_bytes\": %zu, "
+            "\"insert_ns\": %.1f, \"reschedule_ns\": %.1f, \"remove_ns\": %.1f}",
+            first_case ? "" : ",", name, count, sizeof(Heap), insert_ns,
+            reschedule_ns,
+            double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                remove_ns).count()) / double(count));
+        first_case = false;
+    }
+
+private:
+    // Checks that both ways of finding entries with times lesser than or equal
+    // to the key find the expected number of entries. Removed entries have
+    // the maximum time so they are not counted.
+    static void check (Heap &heap, Entry *entries, std::size_t count,
+                       std::uint64_t key)
+    {
+        std::size_t expected = 0;
+        for (std::size_t i = 0; i < count; i++) {
+            expected += entries[i].time <= key;
+        }
+
+        std::size_t found_all = 0;
+        heap.findAllLesserOrEqual(key, [&](Ref e) {
+            AIPSTACK_ASSERT_FORCE((*e).time <= key);
+            found_all++;
+        });
+        AIPSTACK_ASSERT_FORCE(found_all == expected);
+
+        std::size_t found_iter = 0;
+        for (Ref e = heap.findFirstLesserOrEqual(key); !e.isNull();
+             e = heap.findNextLesserOrEqual(key, e))
+        {
+            AIPSTACK_ASSERT_FORCE((*e).time <= key);
+            found_iter++;
+        }
+        AIPSTACK_ASSERT_FORCE(found_iter == expected);
+    }
+};
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_heap_bench;
+
+    std::vector<std::size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        long count = std::atol(argv[i]);
+        AIPSTACK_ASSERT_FORCE(count > 0 && std::size_t(count) <= MaxEntries);
+        counts.push_back(std::size_t(count));
+    }
+    if (counts.empty()) {
+        counts.assign(std::begin(default_counts), std::end(default_counts));
+    }
+
+    std::printf("[");
+
+    for (std::size_t count : counts) {
+        HeapBench<LinkedHeapService>::run("linked_heap", count);
+        HeapBench<ArrayHeapService<MaxEntries, 2>>::run("array_heap_2", count);
+        HeapBench<ArrayHeapService<MaxEntries, 4>>::run("array_heap_4", count);
+        HeapBench<ArrayHeapService<MaxEntries, 8>>::run("array_heap_8", count);
+    }
+
+    std::printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/platform_specific/HugePageMemory.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpLoopbackIface.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of HugePageMemory and HugePageObject.
+ *
+ * A stack with many PCBs and a loopback interface are constructed in memory
+ * bound to the NUMA node of the current core. The memory must be aligned to
+ * the huge page size and zero-filled, and the stack must work normally in it:
+ * a connection through the loopback interface must get established.
+ */
+
+namespace aipstack_huge_page_memory_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using MyIpStackService = IpStackService<
+    IpStackOptions::HeaderBeforeIp::Is<0>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<16>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<>
+    >
+>;
+
+using MyTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4096>
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, MakeTypeList<MyTcpService>> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+class LoopbackArg : public IpLoopbackIfaceService<>::template Compose<
+    PlatformImpl, IpStackArg> {};
+using MyLoopbackIface = IpLoopbackIface<LoopbackArg>;
+
+constexpr std::uint16_t ServerPort = 80;
+
+class TestConnection :
+    public TcpConnection<TcpArg>
+{
+private:
+    void connectionAborted () override final
+    {
+        AIPSTACK_ASSERT_FORCE(false);
+    }
+
+    void dataReceived (std::size_t) override final
+    {}
+
+    void dataSent (std::size_t) override final
+    {}
+};
+
+class TestServer
+{
+public:
+    TestServer () :
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&TestServer::connectionEstablished, this))
+    {}
+
+    ~TestServer ()
+    {
+        m_con.reset();
+    }
+
+    void listen (TcpApi<TcpArg> &tcp)
+    {
+        bool listen_res = m_listener.startListening(tcp, {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+    }
+
+    bool isAccepted () const
+    {
+        return m_accepted;
+    }
+
+private:
+    void connectionEstablished ()
+    {
+        IpErr err = m_con.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_accepted = true;
+    }
+
+private:
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_con;
+    bool m_accepted = false;
+};
+
+// The stack with its interface, allocated in huge page memory as a whole.
+struct Host {
+    Host (Platform platform) :
+        stack(platform),
+        loopback(platform, &stack)
+    {}
+
+    MyIpStack stack;
+    MyLoopbackIface loopback;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_huge_page_memory_test;
+
+    // Checks of the memory itself.
+    {
+        HugePageMemory mem(3 * HugePageMemory::HugePageSize + 1);
+        AIPSTACK_ASSERT_FORCE(mem.size() == 4 * HugePageMemory::HugePageSize);
+        AIPSTACK_ASSERT_FORCE(
+            reinterpret_cast<std::uintptr_t>(mem.ptr()) % HugePageMemory::HugePageSize == 0);
+        for (std::size_t i = 0; i < mem.size(); i++) {
+            AIPSTACK_ASSERT_FORCE(mem.ptr()[i] == 0);
+        }
+    }
+
+    SimPlatformImpl sim;
+    Platform platform{PlatformRef<PlatformImpl>{&sim}};
+
+    HugePageMemoryParams params;
+    params.numa_node = HugePageMemory::currentNumaNode();
+
+    auto host = std::make_unique<HugePageObject<Host>>(params, platform);
+    AIPSTACK_ASSERT_FORCE(host->memory().size() >= sizeof(Host));
+    AIPSTACK_ASSERT_FORCE(static_cast<void *>(host->get()) == host->memory().ptr());
+
+    std::printf("node %d, %zu bytes, huge pages %d\n", params.numa_node,
+                host->memory().size(), int(host->memory().usesHugePages()));
+
+    TcpApi<TcpArg> &tcp = (*host)->stack.getProtoApi<TcpApi>();
+
+    auto server = std::make_unique<TestServer>();
+    server->listen(tcp);
+
+    TestConnection client;
+    TcpStartConnectionArgs<TcpArg> args;
+    args.addr = Ip4Addr(127, 0, 0, 1);
+    args.port = ServerPort;
+    IpErr err = client.startConnection(tcp, args);
+    AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+
+    while (!server->isAccepted()) {
+        bool dispatched = sim.runOne();
+        AIPSTACK_ASSERT_FORCE(dispatched);
+    }
+
+    client.reset();
+    server.reset();
+
+    return 0;
+}
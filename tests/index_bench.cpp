@@ -0,0 +1,381 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/index/BTreeIndex.h>
+#include <aipstack/structure/index/HashTableIndex.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/tcp/TcpPcbKey.h>
+
+using namespace AIpStack;
+
+/*
+ * Benchmark of the index data structures with TCP PCB keys.
+ *
+ * For each index service and number of entries, entries with random keys and
+ * a size similar to a TCP PCB are created and the following operations are
+ * measured in sequence:
+ * - insert: all entries are added in a random order.
+ * - lookup: all entries are looked up in another random order (repeated for
+ *   small numbers of entries).
+ * - walk: all entries are visited using first/next.
+ * - remove: all entries are removed in a random order.
+ *
+ * The results of lookups and walks are checked, and the B-tree index is
+ * additionally checked with duplicate keys and an array link model.
+ *
+ * Output is JSON on stdout, an array with one object per case, containing the
+ * size of the index object in bytes ("index_bytes") and the CPU time in ns per
+ * operation for each phase.
+ *
+ * Optional arguments are the numbers of entries to test (default 1000, 100000
+ * and 1000000), at most MaxEntries.
+ */
+
+namespace aipstack_index_bench {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t MaxEntries = std::size_t(1) << 20;
+
+// Makes entries about as large as a TCP PCB so that they are spread in memory.
+constexpr std::size_t EntryPayloadSize = 192;
+
+// Minimum number of lookups to measure.
+constexpr std::size_t MinLookups = 1000000;
+
+std::size_t const default_counts[] = {1000, 100000, 1000000};
+
+std::mt19937 rng(1);
+
+// Prevents the compiler from optimizing away lookups and walks.
+std::uintptr_t volatile sink;
+
+bool first_case = true;
+
+std::vector<std::size_t> random_order (std::size_t count)
+{
+    std::vector<std::size_t> order(count);
+    for (std::size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    return order;
+}
+
+// Unique keys of connections from many clients. Multiplying by an odd number
+// is a bijection which scatters the remote addresses. All keys have a nonzero
+// local port, so a key with a zero local port is never found.
+std::vector<TcpPcbKey> make_keys (std::size_t count)
+{
+    std::vector<TcpPcbKey> keys;
+    keys.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        std::uint32_t client = std::uint32_t(i / 60000) * 0x9E3779B1u;
+        keys.push_back(TcpPcbKey(Ip4Addr(10, 0, 0, 1), Ip4Addr(client),
+            PortNum(5001), PortNum(1024 + i % 60000)));
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    return keys;
+}
+
+double ns_since (Clock::time_point start, std::size_t num_ops)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count();
+    return double(ns) / double(MaxValue(std::size_t(1), num_ops));
+}
+
+template<typename IndexService, bool Ordered>
+class IndexBench {
+    struct Entry;
+    struct HookAccessor;
+
+    struct KeyFuncs : public TcpPcbKeyCompare {
+        inline static TcpPcbKey const & GetKeyOfEntry (Entry const &entry)
+        {
+            return entry.key;
+        }
+    };
+
+    using LinkModel = PointerLinkModel<Entry>;
+    using Ref = typename LinkModel::Ref;
+
+    AIPSTACK_MAKE_INSTANCE(TheIndex, (IndexService::template Index<
+        HookAccessor, TcpPcbKey const &, KeyFuncs, LinkModel, /*Duplicates=*/false>))
+
+    struct Entry {
+        TcpPcbKey key;
+        typename TheIndex::Node hook;
+        char payload[EntryPayloadSize];
+    };
+
+    struct HookAccessor : public MemberAccessor<
+        Entry, typename TheIndex::Node, &Entry::hook> {};
+
+public:
+    static void run (char const *name, std::vector<TcpPcbKey> const &keys)
+    {
+        std::size_t count = keys.size();
+
+        std::unique_ptr<Entry[]> entries(new Entry[count]);
+        for (std::size_t i = 0; i < count; i++) {
+            entries[i].key = keys[i];
+        }
+
+        auto index = std::make_unique<typename TheIndex::Index>();
+        index->init();
+
+        // Insert.
+        std::vector<std::size_t> order = random_order(count);
+        auto start = Clock::now();
+        for (std::size_t i : order) {
+            index->addEntry(Ref(entries[i]));
+        }
+        double insert_ns = ns_since(start, count);
+
+        check(*index, entries.get(), count);
+
+        // Lookup.
+        order = random_order(count);
+        std::size_t rounds = MaxValue(std::size_t(1), MinLookups / count);
+        std::uintptr_t acc = 0;
+        start = Clock::now();
+        for (std::size_t r = 0; r < rounds; r++) {
+            for (std::size_t i : order) {
+                acc += std::uintptr_t(static_cast<Entry *>(
+                    index->findEntry(entries[i].key)));
+            }
+        }
+        double lookup_ns = ns_since(start, rounds * count);
+        sink = acc;
+
+        // Walk.
+        acc = 0;
+        start = Clock::now();
+        for (Ref e = index->first(); !e.isNull(); e = index->next(e)) {
+            acc += std::uintptr_t(static_cast<Entry *>(e));
+        }
+        double walk_ns = ns_since(start, count);
+        sink = acc;
+
+        // Remove half of the entries and check, then remove the rest.
+        order = random_order(count);
+        std::size_t half = count / 2;
+        start = Clock::now();
+        for (std::size_t j = 0; j < half; j++) {
+            index->removeEntry(Ref(entries[order[j]]));
+        }
+        auto remove_ns = Clock::now() - start;
+
+        for (std::size_t j = 0; j < count; j++) {
+            Ref found = index->findEntry(entries[order[j]].key);
+            AIPSTACK_ASSERT_FORCE(j < half ? found.isNull() :
+                                  found == Ref(entries[order[j]]));
+        }
+
+        start = Clock::now();
+        for (std::size_t j = half; j < count; j++) {
+            index->removeEntry(Ref(entries[order[j]]));
+        }
+        remove_ns += Clock::now() - start;
+        AIPSTACK_ASSERT_FORCE(index->isEmpty());
+
+        std::printf("%s\n  {\"index\": \"%s\", \"entries\": %zu, \"index_bytes\": %zu, "
+            "\"insert_ns\": %.1f, \"lookup_ns\": %.1f, \"walk_ns\": %.1f, "
+            "\"remove_ns\": %.1f}",
+            first_case ? "" : ",", name, count, sizeof(typename TheIndex::Index),
+            insert_ns, lookup_ns, walk_ns,
+            double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                remove_ns).count()) / double(count));
+        first_case = false;
+    }
+
+private:
+    static void check (typename TheIndex::Index const &index, Entry *entries,
+                       std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            AIPSTACK_ASSERT_FORCE(index.findEntry(entries[i].key) == Ref(entries[i]));
+
+            TcpPcbKey missing_key = entries[i].key;
+            missing_key.local_port = 0;
+            AIPSTACK_ASSERT_FORCE(index.findEntry(missing_key).isNull());
+        }
+
+        std::size_t num_walked = 0;
+        Ref prev = Ref::null();
+        for (Ref e = index.first(); !e.isNull(); e = index.next(e)) {
+            AIPSTACK_ASSERT_FORCE(!Ordered || prev.isNull() ||
+                TcpPcbKeyCompare::CompareKeys((*prev).key, (*e).key) < 0);
+            prev = e;
+            num_walked++;
+        }
+        AIPSTACK_ASSERT_FORCE(num_walked == count);
+    }
+};
+
+// Checks the B-tree index with many duplicate keys and an array link model,
+// against a count of entries with each key.
+template<std::size_t NodeCapacity>
+class BTreeDuplicatesTest {
+    static constexpr std::size_t NumEntries = 20000;
+    static constexpr std::uint32_t NumKeys = 100;
+
+    struct Entry;
+    struct HookAccessor;
+
+    struct KeyFuncs {
+        inline static std::uint32_t GetKeyOfEntry (Entry const &entry)
+        {
+            return entry.key;
+        }
+
+        inline static int CompareKeys (std::uint32_t op1, std::uint32_t op2)
+        {
+            return (op1 < op2) ? -1 : (op1 > op2) ? 1 : 0;
+        }
+
+        inline static bool KeysAreEqual (std::uint32_t op1, std::uint32_t op2)
+        {
+            return op1 == op2;
+        }
+    };
+
+    struct ArrayState {
+        Entry *base;
+
+        inline Entry & getEntryAt (std::size_t index)
+        {
+            return base[index];
+        }
+
+        inline std::size_t getEntryIndex (Entry &entry)
+        {
+            return std::size_t(&entry - base);
+        }
+    };
+
+    using LinkModel = ArrayLinkModel<Entry, std::uint32_t, TypeMax<std::uint32_t>,
+                                     ArrayState>;
+    using Ref = typename LinkModel::Ref;
+
+    AIPSTACK_MAKE_INSTANCE(TheIndex, (BTreeIndexService<NumEntries, NodeCapacity>::
+        template Index<HookAccessor, std::uint32_t, KeyFuncs, LinkModel,
+                       /*Duplicates=*/true>))
+
+    struct Entry {
+        std::uint32_t key;
+        bool present;
+        typename TheIndex::Node hook;
+    };
+
+    struct HookAccessor : public MemberAccessor<
+        Entry, typename TheIndex::Node, &Entry::hook> {};
+
+public:
+    static void run ()
+    {
+        std::unique_ptr<Entry[]> entries(new Entry[NumEntries]);
+        ArrayState st{entries.get()};
+        for (std::size_t i = 0; i < NumEntries; i++) {
+            entries[i].key = std::uint32_t(rng() % NumKeys);
+            entries[i].present = false;
+        }
+
+        auto index = std::make_unique<typename TheIndex::Index>();
+        index->init();
+
+        // Alternately add and remove random subsets of the entries.
+        for (int round = 0; round < 6; round++) {
+            bool add = (round % 2) == 0;
+            for (std::size_t i : random_order(NumEntries)) {
+                if (entries[i].present != add && rng() % 4 != 0) {
+                    if (add) {
+                        index->addEntry(Ref(entries[i], st), st);
+                    } else {
+                        index->removeEntry(Ref(entries[i], st), st);
+                    }
+                    entries[i].present = add;
+                }
+            }
+            check(*index, entries.get(), st);
+        }
+
+        for (std::size_t i = 0; i < NumEntries; i++) {
+            if (entries[i].present) {
+                index->removeEntry(Ref(entries[i], st), st);
+            }
+        }
+        AIPSTACK_ASSERT_FORCE(index->isEmpty());
+    }
+
+private:
+    static void check (typename TheIndex::Index const &index, Entry *entries,
+                       ArrayState st)
+    {
+        std::size_t expected[NumKeys + 1] = {};
+        for (std::size_t i = 0; i < NumEntries; i++) {
+            if (entries[i].present) {
+                expected[entries[i].key]++;
+            }
+        }
+
+        for (std::uint32_t key = 0; key <= NumKeys; key++) {
+            std::size_t found = 0;
+            for (Ref e = index.findFirst(key, st); !e.isNull();
+                 e = index.findNext(key, e, st))
+            {
+                AIPSTACK_ASSERT_FORCE((*e).key == key && (*e).present);
+                found++;
+            }
+            AIPSTACK_ASSERT_FORCE(found == expected[key]);
+        }
+    }
+};
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_index_bench;
+
+    std::vector<std::size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        long count = std::atol(argv[i]);
+        AIPSTACK_ASSERT_FORCE(count > 0 && std::size_t(count) <= MaxEntries);
+        counts.push_back(std::size_t(count));
+    }
+    if (counts.empty()) {
+        counts.assign(std::begin(default_counts), std::end(default_counts));
+    }
+
+    BTreeDuplicatesTest<4>::run();
+    BTreeDuplicatesTest<16>::run();
+
+    std::printf("[");
+
+    for (std::size_t count : counts) {
+        std::vector<TcpPcbKey> keys = make_keys(count);
+
+        IndexBench<AvlTreeIndexService, true>::run("avl_tree", keys);
+        IndexBench<BTreeIndexService<MaxEntries>, true>::run("btree_16", keys);
+        IndexBench<BTreeIndexService<MaxEntries, 32>, true>::run("btree_32", keys);
+        IndexBench<HashTableIndexService<MaxEntries>, false>::run("hash_table", keys);
+    }
+
+    std::printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <limits>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define AIPSTACK_BENCH_HAVE_TSC 1
+#else
+#define AIPSTACK_BENCH_HAVE_TSC 0
+#endif
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Chksum.h>
+
+using namespace AIpStack;
+
+/*
+ * Benchmark for the IP checksum functions.
+ * 
+ * Output is CSV on stdout, one line per case after a header line:
+ *   func,size,align,chunk,iters,ns_per_iter,gbps,cycles_per_byte
+ * 
+ * - func: which function is measured (see the run_* functions below).
+ * - align: offset of the data from a 64-byte aligned address.
+ * - chunk: size of the IpBufNode chunks (0 for a single chunk).
+ * - cycles_per_byte is based on the time stamp counter where available,
+ *   otherwise it is empty.
+ * 
+ * An optional argument specifies the number of bytes to process per case
+ * in MiB (default 64). Lower values give quicker but noisier results.
+ */
+
+namespace aipstack_ip_chksum_bench {
+
+using random_bytes_engine = std::independent_bits_engine<
+    std::mt19937, std::numeric_limits<unsigned char>::digits, unsigned char>;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t MaxSize = 65536;
+constexpr std::size_t MaxAlign = 64;
+
+std::size_t const bench_sizes[] = {
+    20, 40, 64, 128, 256, 512, 576, 1024, 1460, 1500, 4096, 9000, 16384, 65536};
+
+std::size_t const bench_aligns[] = {0, 1, 2, 3, 8};
+
+// Chunk sizes for multi-chunk chains; 0 means a single chunk. Odd sizes
+// exercise the byte swapping in the accumulator.
+std::size_t const bench_chunks[] = {0, 64, 511, 1460};
+
+// Prevents the compiler from optimizing away the checksum computation.
+std::uint16_t volatile sink;
+
+std::uint64_t read_cycles ()
+{
+#if AIPSTACK_BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct Chain {
+    std::vector<IpBufNode> nodes;
+    
+    Chain (char *data, std::size_t size, std::size_t chunk)
+    {
+        std::size_t chunk_size = (chunk == 0) ? size : chunk;
+        std::size_t pos = 0;
+        do {
+            std::size_t len = std::min(chunk_size, size - pos);
+            nodes.push_back(IpBufNode{data + pos, len, nullptr});
+            pos += len;
+        } while (pos < size);
+        
+        for (std::size_t i = 0; i + 1 < nodes.size(); i++) {
+            nodes[i].next = &nodes[i + 1];
+        }
+    }
+    
+    IpBufRef ref (std::size_t size) const
+    {
+        return IpBufRef{&nodes[0], 0, size};
+    }
+};
+
+// Flat checksum of contiguous data.
+std::uint16_t run_inverted (char *data, std::size_t size, Chain const &, char *)
+{
+    return IpChksumInverted(data, size);
+}
+
+// Checksum of an IpBufNode chain.
+std::uint16_t run_bufref (char *, std::size_t size, Chain const &chain, char *)
+{
+    return IpChksum(chain.ref(size));
+}
+
+// Accumulator fed chunk by chunk, as done by protocol code which sums
+// headers and data separately. Only used with even chunk sizes.
+std::uint16_t run_accum (char *, std::size_t, Chain const &chain, char *)
+{
+    IpChksumAccumulator accum;
+    for (IpBufNode const &node : chain.nodes) {
+        accum.addEvenBytes(node.ptr, node.len);
+    }
+    return accum.getChksum();
+}
+
+// Combined copy and checksum from an IpBufNode chain.
+std::uint16_t run_copy (char *, std::size_t size, Chain const &chain, char *dst)
+{
+    IpBufNode dst_node = {dst, size, nullptr};
+    IpChksumAccumulator::State state = ipBufCopyAndChksum(
+        IpBufRef{&dst_node, 0, size}, chain.ref(size), IpChksumAccumulator().getState());
+    return IpChksumAccumulator(state).getChksum();
+}
+
+using RunFunc = std::uint16_t (*) (char *, std::size_t, Chain const &, char *);
+
+struct BenchFunc {
+    char const *name;
+    RunFunc func;
+    bool uses_chain;
+    bool even_chunks_only;
+};
+
+BenchFunc const bench_funcs[] = {
+    {"inverted", run_inverted, false, false},
+    {"bufref",   run_bufref,   true,  false},
+    {"accum",    run_accum,    true,  true},
+    {"copy",     run_copy,     true,  false},
+};
+
+void run_case (BenchFunc const &bf, char *data, std::size_t size, std::size_t align,
+               std::size_t chunk, char *dst, std::uint64_t bytes_per_case)
+{
+    Chain chain(data, size, chunk);
+    
+    std::uint64_t iters = std::max<std::uint64_t>(1, bytes_per_case / size);
+    
+    // Warm up caches and branch predictors.
+    for (std::uint64_t i = 0; i < std::min<std::uint64_t>(iters, 1000); i++) {
+        sink = bf.func(data, size, chain, dst);
+    }
+    
+    auto start_time = Clock::now();
+    std::uint64_t start_cycles = read_cycles();
+    
+    for (std::uint64_t i = 0; i < iters; i++) {
+        sink = bf.func(data, size, chain, dst);
+    }
+    
+    std::uint64_t cycles = read_cycles() - start_cycles;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start_time).count();
+    
+    double total_bytes = double(iters) * double(size);
+    double gbps = (ns > 0) ? total_bytes / double(ns) : 0.0;
+    
+    std::printf("%s,%zu,%zu,%zu,%llu,%.2f,%.3f,", bf.name, size, align, chunk,
+                static_cast<unsigned long long>(iters), double(ns) / double(iters), gbps);
+    if (AIPSTACK_BENCH_HAVE_TSC) {
+        std::printf("%.4f", double(cycles) / total_bytes);
+    }
+    std::printf("\n");
+}
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_ip_chksum_bench;
+    
+    std::uint64_t bytes_per_case = std::uint64_t(64) << 20;
+    if (argc > 1) {
+        long mib = std::atol(argv[1]);
+        AIPSTACK_ASSERT_FORCE(mib > 0);
+        bytes_per_case = std::uint64_t(mib) << 20;
+    }
+    
+    std::random_device rd;
+    random_bytes_engine rbe(rd());
+    
+    // Over-allocate so that the data can be placed at each alignment relative
+    // to a 64-byte boundary.
+    std::vector<char> src_buf(MaxSize + 2 * MaxAlign);
+    std::vector<char> dst_buf(MaxSize + 2 * MaxAlign);
+    std::generate(src_buf.begin(), src_buf.end(), std::ref(rbe));
+    
+    char *src_base = src_buf.data() +
+        (MaxAlign - std::uintptr_t(src_buf.data()) % MaxAlign);
+    char *dst_base = dst_buf.data() +
+        (MaxAlign - std::uintptr_t(dst_buf.data()) % MaxAlign);
+    
+    std::printf("func,size,align,chunk,iters,ns_per_iter,gbps,cycles_per_byte\n");
+    
+    for (BenchFunc const &bf : bench_funcs) {
+        for (std::size_t size : bench_sizes) {
+            for (std::size_t align : bench_aligns) {
+                for (std::size_t chunk : bench_chunks) {
+                    if (chunk != 0 && (!bf.uses_chain || chunk >= size ||
+                                       (bf.even_chunks_only && chunk % 2 != 0))) {
+                        continue;
+                    }
+                    run_case(bf, src_base + align, size, align, chunk, dst_base,
+                             bytes_per_case);
+                }
+            }
+        }
+    }
+    
+    return 0;
+}
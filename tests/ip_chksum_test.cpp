@@ -21,6 +21,21 @@ using random_bytes_engine = std::independent_bits_engine<
 constexpr std::size_t BufSize = 101;
 constexpr int Iterations = 10000000;
 
+constexpr std::size_t KernelMaxLen = 1600;
+constexpr std::size_t KernelMaxOffset = 8;
+
+// Straightforward implementation used as reference for the optimized kernels.
+std::uint16_t reference_chksum_inverted (char const *data, std::size_t len)
+{
+    std::uint32_t sum = 0;
+    for (std::size_t i = 0; i < len; i++) {
+        std::uint32_t byte = static_cast<unsigned char>(data[i]);
+        sum += (i % 2 == 0) ? (byte << 8) : byte;
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return static_cast<std::uint16_t>(sum);
+}
+
 }
 
 int main ()
@@ -61,6 +76,108 @@ int main ()
         AIPSTACK_ASSERT_FORCE(chksum == 0xFF);
     }
     
+    // Compare the optimized kernels against the reference for all lengths and
+    // alignments up to a limit. This covers the alignment prologue, SIMD blocks
+    // and all cases of the epilogue.
+    {
+        std::vector<char> data(KernelMaxLen + KernelMaxOffset);
+        
+        for (int fill = 0; fill < 2; fill++) {
+            if (fill == 0) {
+                std::generate(data.begin(), data.end(), std::ref(rbe));
+            } else {
+                std::fill(data.begin(), data.end(), static_cast<char>(0xFF));
+            }
+            
+            for (std::size_t offset = 0; offset < KernelMaxOffset; offset++) {
+                for (std::size_t len = 0; len <= KernelMaxLen; len++) {
+                    char const *ptr = data.data() + offset;
+                    std::uint16_t sum = IpChksumInverted(ptr, len);
+                    std::uint16_t good_sum = reference_chksum_inverted(ptr, len);
+                    // 0x0000 and 0xFFFF are equivalent in ones-complement.
+                    AIPSTACK_ASSERT_FORCE(sum == good_sum ||
+                        (sum == 0xFFFF && good_sum == 0) ||
+                        (sum == 0 && good_sum == 0xFFFF));
+                }
+            }
+        }
+    }
+    
+    // Check ipBufCopyAndChksum with different source and destination chunking,
+    // continuing from a partial checksum of an even-length prefix.
+    {
+        std::vector<char> src_data(KernelMaxLen);
+        std::vector<char> dst_data(KernelMaxLen + 1);
+        std::generate(src_data.begin(), src_data.end(), std::ref(rbe));
+        
+        char prefix[6];
+        std::generate(prefix, prefix + sizeof(prefix), std::ref(rbe));
+        
+        std::size_t const src_poss[] = {0, 1, 7, 64, 333, 1000};
+        std::size_t const dst_poss[] = {0, 3, 100, 129, 1001};
+        
+        for (std::size_t src_break : src_poss) {
+            for (std::size_t dst_break : dst_poss) {
+                std::fill(dst_data.begin(), dst_data.end(), 0);
+                
+                IpBufNode src_node[2];
+                src_node[0] = {src_data.data(), src_break, &src_node[1]};
+                src_node[1] = {src_data.data() + src_break, KernelMaxLen - src_break, nullptr};
+                
+                IpBufNode dst_node[2];
+                dst_node[0] = {dst_data.data(), dst_break + 1, &dst_node[1]};
+                dst_node[1] = {dst_data.data() + dst_break + 1,
+                               KernelMaxLen - dst_break, nullptr};
+                
+                IpChksumAccumulator accum;
+                accum.addEvenBytes(prefix, sizeof(prefix));
+                
+                // Use an offset of 1 into the destination.
+                IpChksumAccumulator::State state = ipBufCopyAndChksum(
+                    IpBufRef{&dst_node[0], 1, KernelMaxLen},
+                    IpBufRef{&src_node[0], 0, KernelMaxLen}, accum.getState());
+                std::uint16_t chksum = IpChksumAccumulator(state).getChksum();
+                
+                std::vector<char> joined(sizeof(prefix) + KernelMaxLen);
+                std::memcpy(joined.data(), prefix, sizeof(prefix));
+                std::memcpy(joined.data() + sizeof(prefix), src_data.data(), KernelMaxLen);
+                std::uint16_t good_chksum = IpChksum(joined.data(), joined.size());
+                
+                AIPSTACK_ASSERT_FORCE(chksum == good_chksum);
+                AIPSTACK_ASSERT_FORCE(std::memcmp(dst_data.data() + 1, src_data.data(),
+                                                  KernelMaxLen) == 0);
+            }
+        }
+    }
+    
+    // Check that incremental checksum updates match recalculation.
+    {
+        char header[20];
+        
+        for (int iter = 0; iter < 100000; iter++) {
+            std::generate(header, header + sizeof(header), std::ref(rbe));
+            WriteSingleField<std::uint16_t>(header + 10, 0);
+            std::uint16_t chksum = IpChksum(header, sizeof(header));
+            
+            std::uint16_t old_word16 = ReadSingleField<std::uint16_t>(header + 2);
+            std::uint16_t new_word16 = static_cast<std::uint16_t>(rbe() << 8 | rbe());
+            WriteSingleField<std::uint16_t>(header + 2, new_word16);
+            chksum = IpChksumUpdate(chksum, WrapType<std::uint16_t>(),
+                                    old_word16, new_word16);
+            
+            std::uint32_t old_word32 = ReadSingleField<std::uint32_t>(header + 12);
+            std::uint32_t new_word32 = static_cast<std::uint32_t>(iter) * 2654435761u;
+            WriteSingleField<std::uint32_t>(header + 12, new_word32);
+            chksum = IpChksumUpdate(chksum, WrapType<std::uint32_t>(),
+                                    old_word32, new_word32);
+            
+            std::uint16_t good_chksum = IpChksum(header, sizeof(header));
+            AIPSTACK_ASSERT_FORCE(chksum == good_chksum ||
+                (chksum == 0xFFFF && good_chksum == 0) ||
+                (chksum == 0 && good_chksum == 0xFFFF));
+        }
+    }
+    
     char buf[BufSize];
     
     for (int iter = 0; iter < Iterations; iter++) {
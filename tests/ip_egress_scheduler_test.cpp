@@ -0,0 +1,288 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/SendRetry.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/ip/IpEgressScheduler.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of IpEgressScheduler.
+ *
+ * Checks that a small flow which starts sending while a bulk flow has a
+ * backlog is transmitted right away, that two bulk flows share transmission
+ * equally, that the per-flow limit rejects packets of the bulk flow only and
+ * notifies the sender when it has room, that a packet refused by the driver is
+ * transmitted next, and that pacing spaces out transmission at the given rate.
+ *
+ * Priority classes are tested with datagrams sent through an IpStack whose
+ * interface driver enqueues into the scheduler: a datagram sent with a high
+ * DSCP is transmitted before the backlog of bulk flows and carries the DSCP in
+ * its IP header.
+ */
+
+namespace aipstack_ip_egress_scheduler_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+constexpr std::size_t BulkSize = 1000;
+constexpr std::size_t SmallSize = 100;
+
+using MySchedulerService = IpEgressSchedulerService<
+    IpEgressSchedulerOptions::NumFlows::Is<16>,
+    IpEgressSchedulerOptions::NumSlots::Is<64>,
+    IpEgressSchedulerOptions::SlotSize::Is<1500>,
+    IpEgressSchedulerOptions::QueueBytes::Is<32000>,
+    IpEgressSchedulerOptions::FlowQueueBytes::Is<10 * BulkSize>,
+    IpEgressSchedulerOptions::QuantumBytes::Is<BulkSize>,
+    IpEgressSchedulerOptions::NumPriorities::Is<2>
+>;
+class SchedulerArg : public MySchedulerService::template Compose<PlatformImpl> {};
+using MyScheduler = IpEgressScheduler<SchedulerArg>;
+
+using MyIpStackService = IpStackService<
+    IpStackOptions::HeaderBeforeIp::Is<0>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<4>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<>
+    >
+>;
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, MakeTypeList<>> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr PeerAddr = Ip4Addr(10, 0, 0, 2);
+
+// Build a UDP packet from the given source port, with the port also written
+// as the first payload byte to identify the flow.
+std::vector<char> make_packet (std::uint16_t src_port, std::size_t size)
+{
+    std::vector<char> pkt(size);
+
+    auto ip4_header = Ip4Header::MakeRef(pkt.data());
+    ip4_header.set(Ip4Header::VersionIhlDscpEcn(), std::uint16_t(0x45) << 8);
+    ip4_header.set(Ip4Header::TotalLen(),          std::uint16_t(size));
+    ip4_header.set(Ip4Header::FlagsOffset(),       Ip4Flags::DF);
+    ip4_header.set(Ip4Header::Ttl(),               64);
+    ip4_header.set(Ip4Header::Proto(),             Ip4Protocol::Udp);
+    ip4_header.set(Ip4Header::SrcAddr(),           LocalAddr);
+    ip4_header.set(Ip4Header::DstAddr(),           PeerAddr);
+
+    auto udp_header = Udp4Header::MakeRef(pkt.data() + Ip4Header::Size);
+    udp_header.set(Udp4Header::SrcPort(), src_port);
+    udp_header.set(Udp4Header::DstPort(), 5000);
+
+    pkt[Ip4Header::Size + Udp4Header::Size] = char(src_port);
+    return pkt;
+}
+
+IpErr enqueue (MyScheduler &sched, std::uint16_t src_port, std::size_t size,
+               IpSendRetryRequest *retryReq = nullptr)
+{
+    std::vector<char> pkt = make_packet(src_port, size);
+    IpBufNode node = {pkt.data(), pkt.size(), nullptr};
+    return sched.enqueuePacket(IpBufRef{&node, 0, pkt.size()}, PeerAddr, retryReq);
+}
+
+// Send a UDP datagram through the stack with the port written as for
+// make_packet and the given DSCP.
+IpErr send_dgram (MyIpStack &stack, std::uint16_t src_port, std::size_t size,
+                  std::uint8_t dscp)
+{
+    std::vector<char> buf(size);
+    auto udp_header = Udp4Header::MakeRef(buf.data() + Ip4Header::Size);
+    udp_header.set(Udp4Header::SrcPort(), src_port);
+    udp_header.set(Udp4Header::DstPort(), 5000);
+    buf[Ip4Header::Size + Udp4Header::Size] = char(src_port);
+
+    Ip4AddrPair addrs = {LocalAddr, PeerAddr};
+    IpBufNode node = {buf.data(), buf.size(), nullptr};
+    return stack.sendIp4Dgram(
+        IpBufRef{&node, Ip4Header::Size, size - Ip4Header::Size}, nullptr, nullptr,
+        Ip4CommonSendParams{addrs, 64, Ip4Protocol::Udp, IpSendFlagsDscp(dscp)});
+}
+
+IpIfaceDriverState driver_get_state ()
+{
+    IpIfaceDriverState state = {};
+    state.link_up = true;
+    return state;
+}
+
+// Transmit up to max_packets packets and return the source ports in order.
+std::vector<int> transmit (MyScheduler &sched, std::size_t max_packets = 1000)
+{
+    std::vector<int> ports;
+    sched.transmitPackets([&](IpBufRef pkt, Ip4Addr) {
+        char data[Ip4Header::Size + Udp4Header::Size + 1];
+        ipBufTakeBytes(pkt, sizeof(data), data);
+        ports.push_back(data[sizeof(data) - 1]);
+        return IpErr::Success;
+    }, max_packets);
+    return ports;
+}
+
+class TestRetryRequest :
+    public IpSendRetryRequest
+{
+public:
+    int notified = 0;
+
+private:
+    void retrySending () override final
+    {
+        notified++;
+    }
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_ip_egress_scheduler_test;
+
+    SimPlatformImpl sim;
+    Platform platform{PlatformRef<PlatformImpl>{&sim}};
+
+    int tx_ready = 0;
+    MyScheduler sched(platform, [&] { tx_ready++; });
+
+    // A small flow is not delayed by the backlog of a bulk flow.
+    for (int i = 0; i < 8; i++) {
+        AIPSTACK_ASSERT_FORCE(enqueue(sched, 1, BulkSize) == IpErr::Success);
+    }
+    AIPSTACK_ASSERT_FORCE(transmit(sched, 2) == std::vector<int>({1, 1}));
+    AIPSTACK_ASSERT_FORCE(enqueue(sched, 2, SmallSize) == IpErr::Success);
+    std::vector<int> order = transmit(sched, 2);
+    AIPSTACK_ASSERT_FORCE(order[0] == 2 || order[1] == 2);
+    transmit(sched);
+    AIPSTACK_ASSERT_FORCE(sched.getNumQueuedPackets() == 0);
+    AIPSTACK_ASSERT_FORCE(sched.getQueuedBytes() == 0);
+
+    // The TX-ready handler is called from the timer after enqueueing.
+    AIPSTACK_ASSERT_FORCE(tx_ready == 0);
+    AIPSTACK_ASSERT_FORCE(enqueue(sched, 1, BulkSize) == IpErr::Success);
+    while (sim.runOne()) {}
+    AIPSTACK_ASSERT_FORCE(tx_ready == 1);
+    transmit(sched);
+
+    // Two bulk flows alternate.
+    for (int i = 0; i < 6; i++) {
+        AIPSTACK_ASSERT_FORCE(enqueue(sched, 3, BulkSize) == IpErr::Success);
+        AIPSTACK_ASSERT_FORCE(enqueue(sched, 4, BulkSize) == IpErr::Success);
+    }
+    order = transmit(sched);
+    AIPSTACK_ASSERT_FORCE(order.size() == 12);
+    for (std::size_t i = 2; i < order.size(); i += 2) {
+        AIPSTACK_ASSERT_FORCE(order[i] != order[i + 1]);
+    }
+
+    // The per-flow limit rejects only the bulk flow, and its sender is
+    // notified after a packet of the flow has been transmitted.
+    TestRetryRequest retry_req;
+    for (int i = 0; i < 10; i++) {
+        AIPSTACK_ASSERT_FORCE(enqueue(sched, 1, BulkSize) == IpErr::Success);
+    }
+    AIPSTACK_ASSERT_FORCE(enqueue(sched, 1, BulkSize, &retry_req) ==
+                          IpErr::OutputBufferFull);
+    AIPSTACK_ASSERT_FORCE(enqueue(sched, 2, SmallSize) == IpErr::Success);
+    AIPSTACK_ASSERT_FORCE(retry_req.notified == 0);
+    transmit(sched, 1);
+    AIPSTACK_ASSERT_FORCE(retry_req.notified == 1);
+    AIPSTACK_ASSERT_FORCE(enqueue(sched, 1, BulkSize) == IpErr::Success);
+
+    // A packet refused by the driver stays queued and is transmitted next.
+    std::size_t queued = sched.getNumQueuedPackets();
+    std::size_t count = sched.transmitPackets([](IpBufRef, Ip4Addr) {
+        return IpErr::OutputBufferFull;
+    });
+    AIPSTACK_ASSERT_FORCE(count == 0 && sched.getNumQueuedPackets() == queued);
+    order = transmit(sched);
+    AIPSTACK_ASSERT_FORCE(order.size() == queued);
+
+    // Pacing at 1 MB/s allows one 1000-byte packet per millisecond.
+    sched.setPacingRate(1000000);
+    for (int i = 0; i < 5; i++) {
+        AIPSTACK_ASSERT_FORCE(enqueue(sched, 1, BulkSize) == IpErr::Success);
+    }
+    std::vector<PlatformImpl::TimeType> tx_times;
+    tx_ready = 0;
+    auto paced_transmit = [&](IpBufRef, Ip4Addr) {
+        tx_times.push_back(sim.getTime());
+        return IpErr::Success;
+    };
+    while (sched.getNumQueuedPackets() > 0) {
+        sched.transmitPackets(paced_transmit);
+        if (sched.getNumQueuedPackets() > 0) {
+            int prev_tx_ready = tx_ready;
+            while (tx_ready == prev_tx_ready) {
+                AIPSTACK_ASSERT_FORCE(sim.runOne());
+            }
+        }
+    }
+    AIPSTACK_ASSERT_FORCE(tx_times.size() == 5);
+    for (std::size_t i = 1; i < tx_times.size(); i++) {
+        AIPSTACK_ASSERT_FORCE(tx_times[i] - tx_times[i - 1] == 1000000);
+    }
+
+    // A datagram with a high DSCP is transmitted before the bulk backlog and
+    // has the DSCP in its header.
+    sched.setPacingRate(0);
+    MyIpStack stack(platform);
+    IpIfaceDriverParams params;
+    params.ip_mtu = 1500;
+    params.send_ip4_packet = AIPSTACK_BIND_MEMBER_TN(&MyScheduler::enqueuePacket, &sched);
+    params.get_state = driver_get_state;
+    IpDriverIface<IpStackArg> iface(&stack, params);
+    iface.iface().setIp4Addr(IpIfaceIp4AddrSetting(24, LocalAddr));
+
+    for (int i = 0; i < 4; i++) {
+        AIPSTACK_ASSERT_FORCE(send_dgram(stack, 1, BulkSize, 0) == IpErr::Success);
+        AIPSTACK_ASSERT_FORCE(send_dgram(stack, 3, BulkSize, 0) == IpErr::Success);
+    }
+    AIPSTACK_ASSERT_FORCE(transmit(sched, 1).size() == 1);
+    AIPSTACK_ASSERT_FORCE(
+        send_dgram(stack, 2, SmallSize, Ip4DscpCs6) == IpErr::Success);
+    std::uint8_t tos = 0;
+    std::size_t prio_count = sched.transmitPackets([&](IpBufRef pkt, Ip4Addr) {
+        auto ip4_header = Ip4Header::MakeRef(pkt.getChunkPtr());
+        tos = std::uint8_t(ip4_header.get(Ip4Header::VersionIhlDscpEcn()));
+        return IpErr::Success;
+    }, 1);
+    AIPSTACK_ASSERT_FORCE(prio_count == 1);
+    AIPSTACK_ASSERT_FORCE(tos == (Ip4DscpCs6 << Ip4DscpShift));
+    order = transmit(sched);
+    AIPSTACK_ASSERT_FORCE(order.size() == 7);
+    for (int port : order) {
+        AIPSTACK_ASSERT_FORCE(port != 2);
+    }
+
+    std::printf("IpEgressScheduler test passed.\n");
+
+    return 0;
+}
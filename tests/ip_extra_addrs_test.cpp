@@ -0,0 +1,253 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Chksum.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Icmp4Proto.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpAddrHashSet.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of additional interface addresses (IpIface::addIp4ExtraAddr).
+ *
+ * First IpAddrHashSet is checked against std::set with random insertions and
+ * removals. Then an interface is given additional addresses, and it is checked
+ * that ICMP echo requests to them are answered from the same address, that
+ * requests to other addresses are not, that the additional addresses are
+ * accepted as source addresses and that the capacity limit is enforced.
+ */
+
+namespace aipstack_ip_extra_addrs_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+constexpr std::size_t NumExtraAddrs = 4;
+
+using MyIpStackService = IpStackService<
+    IpStackOptions::HeaderBeforeIp::Is<0>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<4>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<>
+    >,
+    IpStackOptions::NumIfaceExtraAddrs::Is<NumExtraAddrs>
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, MakeTypeList<>> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr PeerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr Ip4Addr ExtraAddr1 = Ip4Addr(10, 0, 1, 5);
+constexpr Ip4Addr ExtraAddr2 = Ip4Addr(192, 168, 7, 7);
+constexpr std::size_t EchoDataSize = 16;
+
+std::vector<std::vector<char>> sent_packets;
+
+IpErr driver_send (IpBufRef pkt, Ip4Addr, IpSendRetryRequest *)
+{
+    std::vector<char> data(pkt.tot_len);
+    ipBufTakeBytes(pkt, pkt.tot_len, data.data());
+    sent_packets.push_back(std::move(data));
+    return IpErr::Success;
+}
+
+IpIfaceDriverState driver_get_state ()
+{
+    IpIfaceDriverState state = {};
+    state.link_up = true;
+    return state;
+}
+
+void check_hash_set ()
+{
+    IpAddrHashSet<64> set;
+    std::set<std::uint32_t> ref;
+
+    std::srand(1);
+    for (int i = 0; i < 100000; i++) {
+        // Use a small range of addresses so that removals often hit.
+        Ip4Addr addr = Ip4Addr(10, 0, std::uint8_t(std::rand() % 2),
+                               std::uint8_t(1 + std::rand() % 100));
+        if (std::rand() % 2 == 0) {
+            bool res = set.insert(addr);
+            bool expected = ref.size() < 64 || ref.count(addr.value()) > 0;
+            AIPSTACK_ASSERT_FORCE(res == expected);
+            if (res) {
+                ref.insert(addr.value());
+            }
+        } else {
+            bool res = set.remove(addr);
+            AIPSTACK_ASSERT_FORCE(res == (ref.erase(addr.value()) > 0));
+        }
+
+        AIPSTACK_ASSERT_FORCE(set.size() == ref.size());
+        AIPSTACK_ASSERT_FORCE(set.contains(addr) == (ref.count(addr.value()) > 0));
+    }
+
+    std::size_t count = 0;
+    set.forEach([&](Ip4Addr addr) {
+        AIPSTACK_ASSERT_FORCE(ref.count(addr.value()) > 0);
+        count++;
+    });
+    AIPSTACK_ASSERT_FORCE(count == ref.size());
+    AIPSTACK_ASSERT_FORCE(!set.contains(Ip4Addr::ZeroAddr()));
+
+    IpAddrHashSet<0> empty_set;
+    AIPSTACK_ASSERT_FORCE(!empty_set.insert(LocalAddr));
+    AIPSTACK_ASSERT_FORCE(!empty_set.contains(LocalAddr));
+}
+
+IpErr send_from (MyIpStack &stack, IpIface<IpStackArg> *iface, Ip4Addr src_addr)
+{
+    char buf[Ip4Header::Size + 8] = {};
+    IpBufNode node = {buf, sizeof(buf), nullptr};
+    IpBufRef dgram = IpBufRef{&node, Ip4Header::Size, 8};
+
+    Ip4AddrPair addrs = {src_addr, PeerAddr};
+    return stack.sendIp4Dgram(dgram, iface, nullptr,
+        {addrs, 64, Ip4Protocol::Udp, IpSendFlags()});
+}
+
+// Build an ICMP echo request from the peer to the given address.
+std::vector<char> make_echo_request (Ip4Addr dst_addr)
+{
+    std::size_t icmp_len = Icmp4Header::Size + EchoDataSize;
+    std::vector<char> pkt(Ip4Header::Size + icmp_len);
+
+    auto icmp_header = Icmp4Header::MakeRef(pkt.data() + Ip4Header::Size);
+    icmp_header.set(Icmp4Header::Type(),   Icmp4Type::EchoRequest);
+    icmp_header.set(Icmp4Header::Code(),   Icmp4Code::Zero);
+    icmp_header.set(Icmp4Header::Chksum(), 0);
+    icmp_header.set(Icmp4Header::Rest(),   Icmp4RestType{1, 2, 3, 4});
+    for (std::size_t i = 0; i < EchoDataSize; i++) {
+        pkt[Ip4Header::Size + Icmp4Header::Size + i] = char(i);
+    }
+    icmp_header.set(Icmp4Header::Chksum(),
+                    IpChksum(pkt.data() + Ip4Header::Size, icmp_len));
+
+    auto ip_header = Ip4Header::MakeRef(pkt.data());
+    ip_header.set(Ip4Header::VersionIhlDscpEcn(),
+        std::uint16_t((4 << Ip4VersionShift | Ip4Header::Size / 4) << 8));
+    ip_header.set(Ip4Header::TotalLen(),     std::uint16_t(pkt.size()));
+    ip_header.set(Ip4Header::Ident(),        0);
+    ip_header.set(Ip4Header::FlagsOffset(),  Ip4Flags());
+    ip_header.set(Ip4Header::Ttl(),          64);
+    ip_header.set(Ip4Header::Proto(),        Ip4Protocol::Icmp);
+    ip_header.set(Ip4Header::HeaderChksum(), 0);
+    ip_header.set(Ip4Header::SrcAddr(),      PeerAddr);
+    ip_header.set(Ip4Header::DstAddr(),      dst_addr);
+    ip_header.set(Ip4Header::HeaderChksum(), IpChksum(pkt.data(), Ip4Header::Size));
+
+    return pkt;
+}
+
+// Inject an echo request and return whether a reply was sent from dst_addr.
+bool ping (IpDriverIface<IpStackArg> &iface, Ip4Addr dst_addr)
+{
+    std::vector<char> pkt = make_echo_request(dst_addr);
+    IpBufNode node = {pkt.data(), pkt.size(), nullptr};
+
+    sent_packets.clear();
+    iface.recvIp4Packet(IpBufRef{&node, 0, pkt.size()});
+    if (sent_packets.empty()) {
+        return false;
+    }
+
+    AIPSTACK_ASSERT_FORCE(sent_packets.size() == 1);
+    std::vector<char> &reply = sent_packets[0];
+    AIPSTACK_ASSERT_FORCE(reply.size() == pkt.size());
+    auto ip_header = Ip4Header::MakeRef(reply.data());
+    AIPSTACK_ASSERT_FORCE(ip_header.get(Ip4Header::SrcAddr()) == dst_addr);
+    AIPSTACK_ASSERT_FORCE(ip_header.get(Ip4Header::DstAddr()) == PeerAddr);
+    auto icmp_header = Icmp4Header::MakeRef(reply.data() + Ip4Header::Size);
+    AIPSTACK_ASSERT_FORCE(icmp_header.get(Icmp4Header::Type()) == Icmp4Type::EchoReply);
+    return true;
+}
+
+
+}
+
+int main ()
+{
+    using namespace aipstack_ip_extra_addrs_test;
+
+    check_hash_set();
+
+    SimPlatformImpl sim;
+    Platform platform{PlatformRef<PlatformImpl>{&sim}};
+
+    MyIpStack stack(platform);
+
+    IpIfaceDriverParams params;
+    params.ip_mtu = 1500;
+    params.send_ip4_packet = driver_send;
+    params.get_state = driver_get_state;
+
+    IpDriverIface<IpStackArg> driver_iface(&stack, params);
+    IpIface<IpStackArg> &iface = driver_iface.iface();
+    iface.setIp4Addr(IpIfaceIp4AddrSetting(24, LocalAddr));
+
+    // Without additional addresses only the interface address responds.
+    AIPSTACK_ASSERT_FORCE(ping(driver_iface, LocalAddr));
+    AIPSTACK_ASSERT_FORCE(!ping(driver_iface, ExtraAddr1));
+    AIPSTACK_ASSERT_FORCE(send_from(stack, &iface, ExtraAddr1) == IpErr::NonLocalSrc);
+
+    AIPSTACK_ASSERT_FORCE(iface.addIp4ExtraAddr(ExtraAddr1));
+    AIPSTACK_ASSERT_FORCE(iface.addIp4ExtraAddr(ExtraAddr2));
+    AIPSTACK_ASSERT_FORCE(iface.addIp4ExtraAddr(ExtraAddr2));
+    AIPSTACK_ASSERT_FORCE(iface.getNumIp4ExtraAddrs() == 2);
+
+    // Requests to the additional addresses are answered from them.
+    AIPSTACK_ASSERT_FORCE(ping(driver_iface, LocalAddr));
+    AIPSTACK_ASSERT_FORCE(ping(driver_iface, ExtraAddr1));
+    AIPSTACK_ASSERT_FORCE(ping(driver_iface, ExtraAddr2));
+    AIPSTACK_ASSERT_FORCE(!ping(driver_iface, Ip4Addr(10, 0, 1, 6)));
+
+    // The additional addresses can be used as source addresses.
+    AIPSTACK_ASSERT_FORCE(send_from(stack, &iface, ExtraAddr1) == IpErr::Success);
+    AIPSTACK_ASSERT_FORCE(send_from(stack, &iface, ExtraAddr2) == IpErr::Success);
+    AIPSTACK_ASSERT_FORCE(
+        send_from(stack, &iface, Ip4Addr(10, 0, 1, 6)) == IpErr::NonLocalSrc);
+
+    // The number of additional addresses is limited.
+    for (std::uint8_t i = 0; i < NumExtraAddrs - 2; i++) {
+        AIPSTACK_ASSERT_FORCE(iface.addIp4ExtraAddr(Ip4Addr(172, 16, 0, i + 1)));
+    }
+    AIPSTACK_ASSERT_FORCE(!iface.addIp4ExtraAddr(Ip4Addr(172, 16, 1, 1)));
+    AIPSTACK_ASSERT_FORCE(iface.getNumIp4ExtraAddrs() == NumExtraAddrs);
+
+    // Removed addresses are no longer local.
+    AIPSTACK_ASSERT_FORCE(iface.removeIp4ExtraAddr(ExtraAddr1));
+    AIPSTACK_ASSERT_FORCE(!iface.removeIp4ExtraAddr(ExtraAddr1));
+    AIPSTACK_ASSERT_FORCE(!ping(driver_iface, ExtraAddr1));
+    AIPSTACK_ASSERT_FORCE(ping(driver_iface, ExtraAddr2));
+    AIPSTACK_ASSERT_FORCE(send_from(stack, &iface, ExtraAddr1) == IpErr::NonLocalSrc);
+
+    std::printf("additional interface addresses test passed.\n");
+
+    return 0;
+}
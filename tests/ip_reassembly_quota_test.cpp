@@ -0,0 +1,175 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStackStats.h>
+#include <aipstack/ip/IpReassembly.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of the per-source quotas and early hole drop of IpReassembly.
+ *
+ * A flooding source sends first fragments of many datagrams which are never
+ * completed. With the entry quota, a datagram of another source which is in
+ * progress during the flood must still be reassembled. Exceeding the byte
+ * quota must drop older datagrams of the source first and then the datagram
+ * of the fragment. A datagram with more holes than MaxReassHoles must be
+ * dropped by the fragment which creates them.
+ */
+
+namespace aipstack_ip_reassembly_quota_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using MyReassemblyService = IpReassemblyService<
+    IpReassemblyOptions::MaxReassEntrys::Is<4>,
+    IpReassemblyOptions::MaxReassSize::Is<4000>,
+    IpReassemblyOptions::MaxReassHoles::Is<3>,
+    IpReassemblyOptions::MaxReassEntrysPerSource::Is<2>,
+    IpReassemblyOptions::MaxReassBytesPerSource::Is<3000>
+>;
+
+AIPSTACK_MAKE_INSTANCE(Reassembly, (
+    MyReassemblyService::template Compose<PlatformImpl, true>))
+
+Ip4Addr const FloodAddr = Ip4Addr(10, 0, 0, 66);
+Ip4Addr const GoodAddr = Ip4Addr(10, 0, 0, 2);
+Ip4Addr const HolesAddr = Ip4Addr(10, 0, 0, 3);
+Ip4Addr const LocalAddr = Ip4Addr(10, 0, 0, 1);
+
+class Test
+{
+public:
+    Test () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_reass(m_platform)
+    {}
+
+    void run ()
+    {
+        testFlood();
+        testBytes();
+        testHoles();
+
+        IpStackStats stats = m_reass.getStats();
+        std::printf("fails %llu, quota drops %llu, hole drops %llu\n",
+                    static_cast<unsigned long long>(stats.reasm_fails),
+                    static_cast<unsigned long long>(stats.reasm_quota_drops),
+                    static_cast<unsigned long long>(stats.reasm_hole_drops));
+    }
+
+private:
+    void testFlood ()
+    {
+        AIPSTACK_ASSERT_FORCE(!fragment(GoodAddr, 1, 0, 1000, true));
+
+        // Each new datagram beyond the quota displaces one of the flood.
+        for (std::uint16_t ident = 100; ident < 120; ident++) {
+            AIPSTACK_ASSERT_FORCE(!fragment(FloodAddr, ident, 0, 8, true));
+        }
+        AIPSTACK_ASSERT_FORCE(m_reass.getStats().reasm_quota_drops == 18);
+        AIPSTACK_ASSERT_FORCE(m_reass.getMemoryUsage().used == 3);
+
+        // The datagram of the other source is completed.
+        AIPSTACK_ASSERT_FORCE(fragment(GoodAddr, 1, 1000, 500, false));
+        AIPSTACK_ASSERT_FORCE(m_dgram.tot_len == 1500);
+        checkData(0, 1500);
+        m_reass.releaseReassembled();
+    }
+
+    void testBytes ()
+    {
+        std::uint32_t quota_drops = m_reass.getStats().reasm_quota_drops;
+
+        // 3000 bytes for one datagram fit only after dropping the two
+        // remaining datagrams of the flood (16 bytes).
+        for (std::uint16_t offset = 0; offset < 3000; offset += 1000) {
+            AIPSTACK_ASSERT_FORCE(!fragment(FloodAddr, 200, offset, 1000, true));
+        }
+        AIPSTACK_ASSERT_FORCE(m_reass.getStats().reasm_quota_drops == quota_drops + 2);
+        AIPSTACK_ASSERT_FORCE(m_reass.getMemoryUsage().used == 1);
+
+        // Another fragment does not fit and the datagram is dropped.
+        AIPSTACK_ASSERT_FORCE(!fragment(FloodAddr, 200, 3000, 8, false));
+        AIPSTACK_ASSERT_FORCE(m_reass.getStats().reasm_quota_drops == quota_drops + 3);
+        AIPSTACK_ASSERT_FORCE(m_reass.getMemoryUsage().used == 0);
+
+        // Within the quota, a datagram of the source is reassembled.
+        AIPSTACK_ASSERT_FORCE(!fragment(FloodAddr, 201, 0, 2000, true));
+        AIPSTACK_ASSERT_FORCE(fragment(FloodAddr, 201, 2000, 800, false));
+        AIPSTACK_ASSERT_FORCE(m_dgram.tot_len == 2800);
+        checkData(0, 2800);
+        m_reass.releaseReassembled();
+    }
+
+    void testHoles ()
+    {
+        std::uint32_t fails = m_reass.getStats().reasm_fails;
+
+        // The fragments leave holes at 8, 24, 40 and to the end; the fourth
+        // hole must cause the datagram to be dropped.
+        for (std::uint16_t offset = 0; offset < 48; offset += 16) {
+            AIPSTACK_ASSERT_FORCE(!fragment(HolesAddr, 300, offset, 8, true));
+        }
+        AIPSTACK_ASSERT_FORCE(m_reass.getStats().reasm_hole_drops == 0);
+        AIPSTACK_ASSERT_FORCE(!fragment(HolesAddr, 300, 48, 8, true));
+        AIPSTACK_ASSERT_FORCE(m_reass.getStats().reasm_hole_drops == 1);
+        AIPSTACK_ASSERT_FORCE(m_reass.getStats().reasm_fails == fails + 1);
+        AIPSTACK_ASSERT_FORCE(m_reass.getMemoryUsage().used == 0);
+    }
+
+    // Pass a fragment whose bytes are the low bytes of their datagram offsets.
+    bool fragment (Ip4Addr src_addr, std::uint16_t ident, std::uint16_t offset,
+                   std::uint16_t len, bool more_fragments)
+    {
+        m_data.resize(len);
+        for (std::size_t i = 0; i < len; i++) {
+            m_data[i] = char(std::uint8_t(offset + i));
+        }
+
+        m_node = IpBufNode{m_data.data(), len, nullptr};
+        m_dgram = IpBufRef{&m_node, 0, len};
+
+        return m_reass.reassembleIp4(ident, src_addr, LocalAddr, 64, Ip4Protocol::Udp,
+                                     more_fragments, offset, nullptr, m_dgram);
+    }
+
+    void checkData (std::size_t offset, std::size_t len)
+    {
+        IpBufRef buf = m_dgram;
+        for (std::size_t i = 0; i < len; i++) {
+            AIPSTACK_ASSERT_FORCE(ipBufTakeByteMut(buf) == char(std::uint8_t(offset + i)));
+        }
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Reassembly m_reass;
+    std::vector<char> m_data;
+    IpBufNode m_node;
+    IpBufRef m_dgram;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_ip_reassembly_quota_test;
+
+    Test test;
+    test.run();
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpRoute.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of the SingleIface option of IpStack.
+ *
+ * A stack with SingleIface and a regular stack get an interface with the
+ * same settings, and for a set of destination addresses it is checked that
+ * routeIp4, routeIp4ForceIface and selectLocalIp4Address give the same
+ * results. This is repeated with and without an address and a gateway, and
+ * with an additional route (which disables the direct routing).
+ */
+
+namespace aipstack_ip_single_iface_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+template<bool SingleIface>
+using MyIpStackService = IpStackService<
+    IpStackOptions::HeaderBeforeIp::Is<0>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<4>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<>
+    >,
+    IpStackOptions::SingleIface::Is<SingleIface>
+>;
+
+class SingleStackArg : public MyIpStackService<true>::template Compose<
+    PlatformImpl, MakeTypeList<>> {};
+class MultiStackArg : public MyIpStackService<false>::template Compose<
+    PlatformImpl, MakeTypeList<>> {};
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr GatewayAddr = Ip4Addr(10, 0, 0, 254);
+
+constexpr Ip4Addr DstAddrs[] = {
+    Ip4Addr(10, 0, 0, 1),
+    Ip4Addr(10, 0, 0, 2),
+    Ip4Addr(10, 0, 0, 255),
+    Ip4Addr(10, 0, 1, 2),
+    Ip4Addr(192, 168, 1, 1),
+    Ip4Addr(224, 0, 0, 1),
+    Ip4Addr(255, 255, 255, 255),
+    Ip4Addr(0, 0, 0, 0),
+};
+
+IpErr driver_send (IpBufRef, Ip4Addr, IpSendRetryRequest *)
+{
+    return IpErr::Success;
+}
+
+IpIfaceDriverState driver_get_state ()
+{
+    IpIfaceDriverState state = {};
+    state.link_up = true;
+    return state;
+}
+
+template<typename StackArg>
+class Setup
+{
+public:
+    Setup (Platform platform) :
+        m_stack(platform),
+        m_driver_iface(&m_stack, make_params())
+    {}
+
+    IpStack<StackArg> & stack ()
+    {
+        return m_stack;
+    }
+
+    IpIface<StackArg> & iface ()
+    {
+        return m_driver_iface.iface();
+    }
+
+private:
+    static IpIfaceDriverParams make_params ()
+    {
+        IpIfaceDriverParams params;
+        params.ip_mtu = 1500;
+        params.send_ip4_packet = driver_send;
+        params.get_state = driver_get_state;
+        return params;
+    }
+
+private:
+    IpStack<StackArg> m_stack;
+    IpDriverIface<StackArg> m_driver_iface;
+};
+
+struct RouteResult {
+    bool ok;
+    bool have_iface;
+    Ip4Addr addr;
+
+    bool operator== (RouteResult const &other) const
+    {
+        return ok == other.ok && (!ok ||
+            (have_iface == other.have_iface && addr == other.addr));
+    }
+};
+
+template<typename StackArg>
+RouteResult route (Setup<StackArg> &setup, Ip4Addr dst_addr, int method)
+{
+    IpRouteInfoIp4<StackArg> route_info;
+    RouteResult res = {};
+
+    if (method == 0) {
+        res.ok = setup.stack().routeIp4(dst_addr, route_info);
+    } else if (method == 1) {
+        res.ok = setup.stack().routeIp4ForceIface(dst_addr, &setup.iface(), route_info);
+    } else {
+        IpIface<StackArg> *iface = nullptr;
+        Ip4Addr local_addr = Ip4Addr::ZeroAddr();
+        res.ok = setup.stack().selectLocalIp4Address(dst_addr, iface, local_addr)
+            == IpErr::Success;
+        if (res.ok) {
+            route_info.iface = iface;
+            route_info.addr = local_addr;
+        }
+    }
+
+    if (res.ok) {
+        res.have_iface = route_info.iface == &setup.iface();
+        res.addr = route_info.addr;
+    }
+    return res;
+}
+
+int compare_routes (Setup<SingleStackArg> &single, Setup<MultiStackArg> &multi)
+{
+    int num_ok = 0;
+    for (Ip4Addr dst_addr : DstAddrs) {
+        for (int method = 0; method < 3; method++) {
+            RouteResult single_res = route(single, dst_addr, method);
+            RouteResult multi_res = route(multi, dst_addr, method);
+            AIPSTACK_ASSERT_FORCE(single_res == multi_res);
+            num_ok += single_res.ok;
+        }
+    }
+    return num_ok;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_ip_single_iface_test;
+
+    SimPlatformImpl sim;
+    Platform platform{PlatformRef<PlatformImpl>{&sim}};
+
+    Setup<SingleStackArg> single(platform);
+    Setup<MultiStackArg> multi(platform);
+
+    auto set_addr = [&](IpIfaceIp4AddrSetting setting) {
+        single.iface().setIp4Addr(setting);
+        multi.iface().setIp4Addr(setting);
+    };
+    auto set_gateway = [&](IpIfaceIp4GatewaySetting setting) {
+        single.iface().setIp4Gateway(setting);
+        multi.iface().setIp4Gateway(setting);
+    };
+
+    // Nothing is routed without an address or gateway, except that forcing
+    // the interface works for broadcast and multicast.
+    int num_none = compare_routes(single, multi);
+
+    set_addr(IpIfaceIp4AddrSetting(24, LocalAddr));
+    int num_addr = compare_routes(single, multi);
+
+    set_gateway(IpIfaceIp4GatewaySetting(GatewayAddr));
+    int num_both = compare_routes(single, multi);
+
+    // With another route, the routing table is used.
+    IpRoute<SingleStackArg> single_route;
+    IpRoute<MultiStackArg> multi_route;
+    IpRouteIp4Params route_params;
+    route_params.dst_addr = Ip4Addr(192, 168, 0, 0);
+    route_params.prefix = 16;
+    route_params.gateway = IpIfaceIp4GatewaySetting(Ip4Addr(10, 0, 0, 253));
+    single_route.setRoute(&single.iface(), route_params);
+    multi_route.setRoute(&multi.iface(), route_params);
+    int num_route = compare_routes(single, multi);
+
+    single_route.reset();
+    multi_route.reset();
+    set_addr(IpIfaceIp4AddrSetting());
+    int num_gateway = compare_routes(single, multi);
+
+    std::printf("routed: none %d, addr %d, addr+gateway %d, route %d, gateway %d\n",
+                num_none, num_addr, num_both, num_route, num_gateway);
+
+    AIPSTACK_ASSERT_FORCE(num_none < num_addr && num_addr < num_both);
+    AIPSTACK_ASSERT_FORCE(num_route == num_both);
+
+    return 0;
+}
@@ -0,0 +1,248 @@
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/HostedPlatformImpl.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/eth/EthIpIface.h>
+#include <aipstack/eth/MacAddr.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/proto/ArpProto.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Tcp4Proto.h>
+
+using namespace AIpStack;
+
+/*
+ * Test that large interface MTUs (jumbo frames and 64 KiB virtual interfaces)
+ * result in correspondingly large TCP MSS values.
+ *
+ * An EthIpIface is created with a fake driver which records sent frames, the
+ * MAC address of the peer is provided by an injected ARP reply, and the MSS
+ * option in the SYN of an outgoing connection is checked.
+ *
+ * This needs to be linked with EventLoopAmalgamation.cpp.
+ */
+
+namespace aipstack_jumbo_mtu_test {
+
+using PlatformImpl = HostedPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using MyIpStackService = IpStackService<
+    IpStackOptions::HeaderBeforeIp::Is<EthHeader::Size>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<16>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<>
+    >
+>;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>
+    >
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using MyEthIpIfaceService = EthIpIfaceService<
+    EthIpIfaceOptions::TimersStructureService::Is<LinkedHeapService>
+>;
+class EthIpIfaceArg : public MyEthIpIfaceService::template Compose<
+    PlatformImpl, IpStackArg> {};
+using MyEthIpIface = EthIpIface<EthIpIfaceArg>;
+
+using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr MacAddr LocalMac = MacAddr(0x02, 0, 0, 0, 0, 1);
+constexpr MacAddr PeerMac = MacAddr(0x02, 0, 0, 0, 0, 2);
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr PeerAddr = Ip4Addr(10, 0, 0, 2);
+
+std::vector<std::vector<char>> sent_frames;
+
+IpErr send_frame (IpBufRef frame)
+{
+    std::vector<char> data(frame.tot_len);
+    ipBufTakeBytes(frame, frame.tot_len, data.data());
+    sent_frames.push_back(std::move(data));
+    return IpErr::Success;
+}
+
+EthIfaceState get_eth_state ()
+{
+    EthIfaceState state = {};
+    state.link_up = true;
+    return state;
+}
+
+void inject_arp_reply (MyEthIpIface &eth)
+{
+    char buf[EthHeader::Size + ArpIp4Header::Size];
+
+    auto eth_header = EthHeader::MakeRef(buf);
+    eth_header.set(EthHeader::DstMac(),  LocalMac);
+    eth_header.set(EthHeader::SrcMac(),  PeerMac);
+    eth_header.set(EthHeader::EthType(), EthType::Arp);
+
+    auto arp_header = ArpIp4Header::MakeRef(buf + EthHeader::Size);
+    arp_header.set(ArpIp4Header::HwType(),       ArpHwType::Eth);
+    arp_header.set(ArpIp4Header::ProtoType(),    EthType::Ipv4);
+    arp_header.set(ArpIp4Header::HwAddrLen(),    MacAddr::Size);
+    arp_header.set(ArpIp4Header::ProtoAddrLen(), Ip4Addr::Size);
+    arp_header.set(ArpIp4Header::OpType(),       ArpOpType::Reply);
+    arp_header.set(ArpIp4Header::SrcHwAddr(),    PeerMac);
+    arp_header.set(ArpIp4Header::SrcProtoAddr(), PeerAddr);
+    arp_header.set(ArpIp4Header::DstHwAddr(),    LocalMac);
+    arp_header.set(ArpIp4Header::DstProtoAddr(), LocalAddr);
+
+    IpBufNode node = {buf, sizeof(buf), nullptr};
+    eth.recvFrame(IpBufRef{&node, 0, sizeof(buf)});
+}
+
+// Find the MSS option in a TCP SYN frame, returning 0 if there is none.
+std::uint16_t get_syn_mss (std::vector<char> &frame)
+{
+    AIPSTACK_ASSERT_FORCE(frame.size() >= EthHeader::Size + Ip4Header::Size);
+
+    auto eth_header = EthHeader::MakeRef(frame.data());
+    AIPSTACK_ASSERT_FORCE(eth_header.get(EthHeader::EthType()) == EthType::Ipv4);
+
+    char *ip_data = frame.data() + EthHeader::Size;
+    auto ip_header = Ip4Header::MakeRef(ip_data);
+    AIPSTACK_ASSERT_FORCE(ip_header.get(Ip4Header::Proto()) == Ip4Protocol::Tcp);
+
+    std::size_t ip_header_len =
+        std::size_t((ip_header.get(Ip4Header::VersionIhlDscpEcn()) >> 8) & 0xF) * 4;
+    char *tcp_data = ip_data + ip_header_len;
+    auto tcp_header = Tcp4Header::MakeRef(tcp_data);
+
+    Tcp4Flags offset_flags = tcp_header.get(Tcp4Header::OffsetFlags());
+    AIPSTACK_ASSERT_FORCE((offset_flags & Tcp4Flags::Syn) != Enum0);
+    std::size_t tcp_header_len =
+        std::size_t(AsUnderlying(offset_flags) >> TcpOffsetShift) * 4;
+
+    std::size_t pos = Tcp4Header::Size;
+    while (pos < tcp_header_len) {
+        std::uint8_t kind = std::uint8_t(tcp_data[pos]);
+        if (kind == 0) {
+            break;
+        }
+        if (kind == 1) {
+            pos++;
+            continue;
+        }
+        std::uint8_t len = std::uint8_t(tcp_data[pos + 1]);
+        AIPSTACK_ASSERT_FORCE(len >= 2 && pos + len <= tcp_header_len);
+        if (kind == 2 && len == 4) {
+            return std::uint16_t((std::uint16_t(std::uint8_t(tcp_data[pos + 2])) << 8) |
+                                 std::uint8_t(tcp_data[pos + 3]));
+        }
+        pos += len;
+    }
+
+    return 0;
+}
+
+class TestConnection : public TcpConnection<TcpArg>
+{
+public:
+    void connectionAborted () override final {}
+    void dataReceived (std::size_t) override final {}
+    void dataSent (std::size_t) override final {}
+};
+
+// Connect over an interface with the given Ethernet MTU and return the MSS
+// which is advertised in the SYN.
+std::uint16_t test_mtu (Platform platform, std::size_t eth_mtu,
+                        std::uint16_t expected_ip_mtu)
+{
+    auto stack = std::make_unique<MyIpStack>(platform);
+
+    EthIfaceDriverParams params;
+    params.eth_mtu = eth_mtu;
+    params.mac_addr = &LocalMac;
+    params.send_frame = send_frame;
+    params.get_eth_state = get_eth_state;
+
+    auto eth = std::make_unique<MyEthIpIface>(platform, stack.get(), params);
+    eth->iface().setIp4Addr(IpIfaceIp4AddrSetting(24, LocalAddr));
+
+    AIPSTACK_ASSERT_FORCE(eth->iface().getMtu() == expected_ip_mtu);
+
+    inject_arp_reply(*eth);
+
+    sent_frames.clear();
+
+    TestConnection con;
+    TcpStartConnectionArgs<TcpArg> args;
+    args.addr = PeerAddr;
+    args.port = 80;
+    args.rcv_wnd = 65535;
+    IpErr err = con.startConnection(
+        stack->template getProtoApi<TcpApi>(), args);
+    AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+
+    AIPSTACK_ASSERT_FORCE(sent_frames.size() == 1);
+    std::uint16_t mss = get_syn_mss(sent_frames[0]);
+
+    con.reset();
+    eth.reset();
+    stack.reset();
+
+    return mss;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_jumbo_mtu_test;
+
+    EventLoop loop;
+    PlatformImpl platform_impl(loop);
+    Platform platform{PlatformRef<PlatformImpl>{&platform_impl}};
+
+    // Standard Ethernet.
+    std::uint16_t std_mss = test_mtu(platform, 1514, 1500);
+    std::printf("MTU 1500: MSS %u\n", unsigned(std_mss));
+    AIPSTACK_ASSERT_FORCE(std_mss == 1460);
+
+    // Jumbo frames.
+    std::uint16_t jumbo_mss = test_mtu(platform, 9014, 9000);
+    std::printf("MTU 9000: MSS %u\n", unsigned(jumbo_mss));
+    AIPSTACK_ASSERT_FORCE(jumbo_mss == 8960);
+
+    std::uint16_t jumbo_max_mss = test_mtu(platform, 9216 + EthHeader::Size, 9216);
+    std::printf("MTU 9216: MSS %u\n", unsigned(jumbo_max_mss));
+    AIPSTACK_ASSERT_FORCE(jumbo_max_mss == 9176);
+
+    // A 64 KiB MTU of a virtual interface is reduced to the maximum IP MTU.
+    std::uint16_t virt_mss = test_mtu(platform, 65536 + EthHeader::Size, MyIpStack::MaxMTU);
+    std::printf("MTU 65536: MSS %u\n", unsigned(virt_mss));
+    AIPSTACK_ASSERT_FORCE(virt_mss == MyIpStack::MaxMTU - Ip4Header::Size - Tcp4Header::Size);
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpLatencyTrace.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of latency tracing (IpStackOptions::LatencyTraceInterval).
+ *
+ * A client sends messages to an echo server over a simulated link, and the
+ * driver holds each received packet for 10ms in its receive queue, passing
+ * the time of arrival as the receive timestamp. One of every 4 packets is
+ * sampled. The queue delay must be recorded for the first stage (IpRx), and
+ * since the simulated processing takes no time, the stages after it must be
+ * recorded as zero. The echo is sent from the receive callback, so the
+ * transmit stages must be reached too, but not the Ethernet stages since no
+ * EthIpIface is used.
+ */
+
+namespace aipstack_latency_trace_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+constexpr std::uint32_t SampleInterval = 4;
+
+using MyIpStackService = TcpFixture::StackService<
+    IpStackOptions::LatencyTraceInterval::Is<SampleInterval>
+>;
+
+using MyTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, MakeTypeList<MyTcpService>> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr TimeType LinkDelay = Platform::TimeFreq / 1000;
+constexpr TimeType RxQueueDelay = 10 * Platform::TimeFreq / 1000;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t MessageSize = 100;
+constexpr int NumMessages = 50;
+constexpr std::size_t BufferSize = 4096;
+
+using Host = TcpFixture::Host<IpStackArg>;
+
+// Connection which optionally echoes received data.
+class TestConnection :
+    public TcpFixture::TestConnection<TcpArg>
+{
+    using Base = TcpFixture::TestConnection<TcpArg>;
+
+public:
+    TestConnection (bool echo) :
+        Base(BufferSize),
+        m_echo(echo)
+    {}
+
+private:
+    void dataReceived (std::size_t amount) override final
+    {
+        Base::dataReceived(amount);
+        if (m_echo) {
+            send(amount);
+        }
+    }
+
+private:
+    bool m_echo;
+};
+
+class Setup
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_host(m_platform, LocalAddr, 1500, /*use_batches=*/false),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_client(false),
+        m_server(true)
+    {
+        // The packets go back to the same interface, with the time of arrival
+        // as the receive timestamp. Receive batches are not used, since the
+        // echo would then be sent at the end of the batch outside of the
+        // sampled packet.
+        m_host.setPeer(&m_host);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = LinkDelay;
+        rx_params.queue_delay = RxQueueDelay;
+        rx_params.timestamps = true;
+        m_host.setRxParams(rx_params);
+
+        bool listen_res = m_listener.startListening(m_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    void run ()
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = LocalAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(m_host.tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+
+        std::uint64_t expected = 0;
+        for (int i = 0; i < NumMessages; i++) {
+            m_client.send(MessageSize);
+            expected += MessageSize;
+            TcpFixture::runWhile(m_sim, [&] {
+                return m_client.getReceived() < expected || !m_client.allSent();
+            });
+        }
+    }
+
+    IpLatencyStats getLatencyStats ()
+    {
+        return m_host.stack().getLatencyStats();
+    }
+
+    std::uint64_t getNumDelivered () const
+    {
+        return m_host.getNumReceived();
+    }
+
+private:
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_server_accepted);
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_host;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_client;
+    TestConnection m_server;
+    bool m_server_accepted = false;
+};
+
+IpLatencyHistogram const & stage_hist (IpLatencyStats const &stats, IpLatencyStage stage)
+{
+    return stats.stages[std::size_t(stage)];
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_latency_trace_test;
+
+    auto setup = std::make_unique<Setup>();
+    setup->run();
+
+    IpLatencyStats stats = setup->getLatencyStats();
+
+    std::printf("%llu packets, %llu samples\n",
+                static_cast<unsigned long long>(setup->getNumDelivered()),
+                static_cast<unsigned long long>(stats.samples));
+    for (std::size_t i = 0; i < IpLatencyNumStages; i++) {
+        IpLatencyHistogram const &hist = stats.stages[i];
+        std::printf("stage %zu: count %llu, max %lluus\n", i,
+                    static_cast<unsigned long long>(hist.count),
+                    static_cast<unsigned long long>(hist.max_us));
+    }
+
+    AIPSTACK_ASSERT_FORCE(stats.samples == setup->getNumDelivered() / SampleInterval);
+
+    // The receive queue delay is recorded for the first stage for each sample.
+    IpLatencyHistogram const &ip_rx = stage_hist(stats, IpLatencyStage::IpRx);
+    AIPSTACK_ASSERT_FORCE(ip_rx.count == stats.samples);
+    AIPSTACK_ASSERT_FORCE(ip_rx.max_us == 10000);
+    AIPSTACK_ASSERT_FORCE(ip_rx.buckets[14] == stats.samples);
+
+    // All packets are TCP and all but possibly the SYN have a PCB.
+    AIPSTACK_ASSERT_FORCE(
+        stage_hist(stats, IpLatencyStage::ProtoDemux).count == stats.samples);
+    AIPSTACK_ASSERT_FORCE(
+        stage_hist(stats, IpLatencyStage::TcpInput).count + 1 >= stats.samples);
+
+    // Data and echoes pass through the application and the transmit path.
+    for (IpLatencyStage stage : {IpLatencyStage::AppCallback, IpLatencyStage::TcpOutput,
+                                 IpLatencyStage::IpTx})
+    {
+        AIPSTACK_ASSERT_FORCE(stage_hist(stats, stage).count > 0);
+    }
+
+    // Processing takes no time in the simulation.
+    for (std::size_t i = std::size_t(IpLatencyStage::ProtoDemux);
+         i < IpLatencyNumStages; i++)
+    {
+        AIPSTACK_ASSERT_FORCE(stats.stages[i].max_us == 0);
+    }
+
+    // Ethernet stages are not reached without EthIpIface.
+    AIPSTACK_ASSERT_FORCE(stage_hist(stats, IpLatencyStage::EthRx).count == 0);
+    AIPSTACK_ASSERT_FORCE(stage_hist(stats, IpLatencyStage::EthTx).count == 0);
+
+    return 0;
+}
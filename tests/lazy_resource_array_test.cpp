@@ -0,0 +1,84 @@
+#include <cstddef>
+#include <cstdio>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/LazyResourceArray.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of LazyResourceArray.
+ *
+ * Elements must be constructed only by constructNext, in order of their
+ * indices, iteration must cover only the constructed elements, and the
+ * destructor must destruct exactly the constructed elements in reverse order.
+ */
+
+namespace aipstack_lazy_resource_array_test {
+
+int num_live = 0;
+int last_destructed = -1;
+
+struct Elem {
+    Elem (int value_) :
+        value(value_)
+    {
+        num_live++;
+    }
+
+    ~Elem ()
+    {
+        AIPSTACK_ASSERT_FORCE(last_destructed == -1 || value == last_destructed - 1);
+        last_destructed = value;
+        num_live--;
+    }
+
+    int value;
+};
+
+constexpr std::size_t Size = 8;
+
+}
+
+int main ()
+{
+    using namespace aipstack_lazy_resource_array_test;
+
+    {
+        LazyResourceArray<Elem, Size> arr;
+
+        AIPSTACK_ASSERT_FORCE(num_live == 0);
+        AIPSTACK_ASSERT_FORCE(arr.numConstructed() == 0);
+        AIPSTACK_ASSERT_FORCE(arr.begin() == arr.end());
+        AIPSTACK_ASSERT_FORCE(arr.size() == Size);
+
+        for (int i = 0; i < 5; i++) {
+            Elem &elem = arr.constructNext(i);
+            AIPSTACK_ASSERT_FORCE(&elem == &arr[std::size_t(i)]);
+            AIPSTACK_ASSERT_FORCE(elem.value == i);
+        }
+
+        AIPSTACK_ASSERT_FORCE(num_live == 5);
+        AIPSTACK_ASSERT_FORCE(arr.numConstructed() == 5);
+        AIPSTACK_ASSERT_FORCE(!arr.allConstructed());
+
+        int sum = 0;
+        for (Elem &elem : arr) {
+            sum += elem.value;
+        }
+        AIPSTACK_ASSERT_FORCE(sum == 0 + 1 + 2 + 3 + 4);
+
+        while (!arr.allConstructed()) {
+            arr.constructNext(int(arr.numConstructed()));
+        }
+        AIPSTACK_ASSERT_FORCE(num_live == int(Size));
+        AIPSTACK_ASSERT_FORCE(std::size_t(arr.end() - arr.begin()) == Size);
+    }
+
+    AIPSTACK_ASSERT_FORCE(num_live == 0);
+    AIPSTACK_ASSERT_FORCE(last_destructed == 0);
+
+    std::printf("lazy resource array test passed\n");
+
+    return 0;
+}
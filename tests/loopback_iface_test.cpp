@@ -0,0 +1,192 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpLoopbackIface.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of the loopback interface (IpLoopbackIface).
+ *
+ * A TCP transfer is done within a single stack, once to 127.0.0.1 and once
+ * to the address of another interface, which must also go through the
+ * loopback interface and not the driver of that interface. A small queue is
+ * used so that sending has to wait for the queue to drain. The data segments
+ * and the pure ACKs are expected to be handled by header prediction. The
+ * connections use statically dispatched callbacks (TcpConnectionT).
+ */
+
+namespace aipstack_loopback_iface_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+class TestConnection;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::EnableStats::Is<true>,
+        IpTcpProtoOptions::StaticConnectionClass::Is<TestConnection>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using MyLoopbackService = IpLoopbackIfaceService<
+    IpLoopbackIfaceOptions::QueueBytes::Is<3 * 65536>
+>;
+class LoopbackArg : public MyLoopbackService::template Compose<
+    PlatformImpl, IpStackArg> {};
+using MyLoopbackIface = IpLoopbackIface<LoopbackArg>;
+
+using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr Ip4Addr EthAddr = Ip4Addr(10, 0, 0, 1);
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t TransferBytes = 1000000;
+constexpr std::size_t BufferSize = 200000;
+
+std::size_t driver_packets = 0;
+
+IpErr driver_send (IpBufRef, Ip4Addr, IpSendRetryRequest *)
+{
+    driver_packets++;
+    return IpErr::Success;
+}
+
+// Connection which checks the received byte pattern, with statically
+// dispatched callbacks.
+class TestConnection :
+    public TcpFixture::TestConnectionBase<TcpConnectionT<TcpArg, TestConnection>>
+{
+public:
+    TestConnection () :
+        TestConnectionBase(BufferSize, /*check_data=*/true)
+    {}
+};
+
+class Setup
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_stack(m_platform),
+        m_eth_iface(&m_stack, make_params()),
+        m_loopback(m_platform, &m_stack),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this))
+    {
+        m_eth_iface.iface().setIp4Addr(IpIfaceIp4AddrSetting(24, EthAddr));
+
+        bool listen_res = m_listener.startListening(tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 4
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    void transfer (Ip4Addr addr)
+    {
+        m_client.reset();
+        m_server.reset();
+        m_server_ready = false;
+
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = addr;
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_ready; });
+
+        m_client.send(TransferBytes);
+        TcpFixture::runWhile(m_sim, [&] { return m_server.getReceived() < TransferBytes; });
+        AIPSTACK_ASSERT_FORCE(m_server.getReceived() == TransferBytes);
+
+        AIPSTACK_ASSERT_FORCE(m_server.getStats().counters.predicted_segs > 0);
+        AIPSTACK_ASSERT_FORCE(m_client.getStats().counters.predicted_segs > 0);
+    }
+
+private:
+    IpIfaceDriverParams make_params ()
+    {
+        IpIfaceDriverParams params;
+        params.ip_mtu = 1500;
+        params.send_ip4_packet = driver_send;
+        params.get_state = TcpFixture::linkUpState;
+        return params;
+    }
+
+    TcpApi<TcpArg> & tcp ()
+    {
+        return m_stack.template getProtoApi<TcpApi>();
+    }
+
+    void connectionEstablished ()
+    {
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_ready = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    MyIpStack m_stack;
+    IpDriverIface<IpStackArg> m_eth_iface;
+    MyLoopbackIface m_loopback;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_client;
+    TestConnection m_server;
+    bool m_server_ready = false;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_loopback_iface_test;
+
+    auto setup = std::make_unique<Setup>();
+
+    setup->transfer(Ip4Addr(127, 0, 0, 1));
+    std::printf("127.0.0.1: transferred %zu bytes\n", TransferBytes);
+
+    setup->transfer(EthAddr);
+    std::printf("interface address: transferred %zu bytes\n", TransferBytes);
+
+    AIPSTACK_ASSERT_FORCE(driver_packets == 0);
+
+    return 0;
+}
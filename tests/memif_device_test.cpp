@@ -0,0 +1,220 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MemRef.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/memif/MemifDevice.h>
+#include <aipstack/memif/MemifClient.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of MemifDevice and MemifClient.
+ *
+ * A child process connects using MemifClient and sends frames of varying
+ * lengths, writing them directly into the shared ring, while the event loop in
+ * the parent process receives each frame and sends it back. The rings are
+ * small compared to the number of frames, so both rings wrap around many
+ * times and the client has to wait for its doorbell, both for space and for
+ * the returned frames.
+ *
+ * This needs to be linked with MemifDevice.cpp, MemifClient.cpp and
+ * EventLoopAmalgamation.cpp.
+ */
+
+namespace aipstack_memif_device_test {
+
+constexpr char const SocketPath[] = "/tmp/aipstack_memif_device_test.sock";
+
+constexpr std::size_t FrameMtu = 1500;
+constexpr std::size_t RingSize = 8;
+constexpr std::size_t NumFrames = 2000;
+
+std::size_t frame_len (std::size_t index)
+{
+    return 20 + (index * 37) % (FrameMtu - 20 + 1);
+}
+
+char frame_byte (std::size_t index, std::size_t pos)
+{
+    return char(index * 13 + pos);
+}
+
+void wait_readable (int fd)
+{
+    struct pollfd pfd = {};
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    AIPSTACK_ASSERT_FORCE(::poll(&pfd, 1, 5000) == 1);
+}
+
+std::unique_ptr<MemifClient> connect_client ()
+{
+    // The parent may not be listening yet.
+    for (int attempt = 0; ; attempt++) {
+        try {
+            return std::make_unique<MemifClient>(SocketPath);
+        } catch (std::runtime_error const &) {
+            AIPSTACK_ASSERT_FORCE(attempt < 500);
+            ::usleep(10000);
+        }
+    }
+}
+
+void run_client ()
+{
+    std::unique_ptr<MemifClient> client = connect_client();
+    AIPSTACK_ASSERT_FORCE(client->getMode() == MemifMode::Ip);
+    AIPSTACK_ASSERT_FORCE(client->getMtu() == FrameMtu);
+
+    std::size_t sent = 0;
+    std::size_t received = 0;
+
+    while (received < NumFrames) {
+        // Send while there is space, keeping no more frames outstanding than
+        // fit into the ring back to us.
+        std::size_t space = client->txSpace();
+        std::size_t count = 0;
+        while (count < space && sent + count < NumFrames &&
+               sent + count - received < RingSize)
+        {
+            std::size_t index = sent + count;
+            std::size_t len = frame_len(index);
+            char *buf = client->txBuffer(count);
+            for (std::size_t i = 0; i < len; i++) {
+                buf[i] = frame_byte(index, i);
+            }
+            client->txSetLength(count, len);
+            count++;
+        }
+        client->txCommit(count);
+        sent += count;
+
+        std::size_t avail = client->rxAvailable();
+        for (std::size_t j = 0; j < avail; j++) {
+            std::size_t index = received + j;
+            MemRef frame = client->rxFrame(j);
+            AIPSTACK_ASSERT_FORCE(frame.len == frame_len(index));
+            for (std::size_t i = 0; i < frame.len; i++) {
+                AIPSTACK_ASSERT_FORCE(frame.ptr[i] == frame_byte(index, i));
+            }
+        }
+        client->rxRelease(avail);
+        received += avail;
+
+        if (count == 0 && avail == 0) {
+            wait_readable(client->getDoorbellFd());
+            client->clearDoorbell();
+        }
+    }
+}
+
+class Test
+{
+public:
+    explicit Test (int done_fd) :
+        m_done_fd(done_fd),
+        m_device(m_loop, SocketPath,
+                 AIPSTACK_BIND_MEMBER(&Test::frameReceived, this), make_params()),
+        m_done_watcher(m_loop, AIPSTACK_BIND_MEMBER(&Test::doneEvent, this))
+    {}
+
+    void run ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_device.isConnected());
+        AIPSTACK_ASSERT_FORCE(m_device.sendFrame(IpBufRef{}) == IpErr::HardwareError);
+
+        // The child closes its end of the pipe when it exits.
+        m_done_watcher.initFd(m_done_fd, EventLoopFdEvents::Read);
+        m_loop.run();
+
+        AIPSTACK_ASSERT_FORCE(m_frames_received == NumFrames);
+    }
+
+private:
+    static MemifDeviceParams make_params ()
+    {
+        MemifDeviceParams params;
+        params.mode = MemifMode::Ip;
+        params.frame_mtu = FrameMtu;
+        params.ring_size = RingSize;
+        params.rx_budget = 3;
+        return params;
+    }
+
+    void frameReceived (IpBufRef frame)
+    {
+        std::size_t index = m_frames_received;
+        AIPSTACK_ASSERT_FORCE(frame.tot_len == frame_len(index));
+
+        IpBufRef data = frame;
+        for (std::size_t i = 0; i < frame.tot_len; i++) {
+            AIPSTACK_ASSERT_FORCE(ipBufTakeByteMut(data) == frame_byte(index, i));
+        }
+        m_frames_received++;
+
+        // Send the frame back while it still references the shared memory.
+        AIPSTACK_ASSERT_FORCE(m_device.sendFrame(frame) == IpErr::Success);
+    }
+
+    void doneEvent (EventLoopFdEvents)
+    {
+        m_done_watcher.reset();
+        m_loop.stop();
+    }
+
+private:
+    int m_done_fd;
+    EventLoop m_loop;
+    MemifDevice m_device;
+    EventLoopFdWatcher m_done_watcher;
+    std::size_t m_frames_received = 0;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_memif_device_test;
+
+    int done_pipe[2];
+    AIPSTACK_ASSERT_FORCE(::pipe(done_pipe) == 0);
+
+    pid_t pid = ::fork();
+    AIPSTACK_ASSERT_FORCE(pid >= 0);
+
+    if (pid == 0) {
+        ::close(done_pipe[0]);
+        run_client();
+        ::_exit(0);
+    }
+
+    ::close(done_pipe[1]);
+
+    {
+        Test test(done_pipe[0]);
+        test.run();
+    }
+
+    int status;
+    AIPSTACK_ASSERT_FORCE(::waitpid(pid, &status, 0) == pid);
+    AIPSTACK_ASSERT_FORCE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    ::close(done_pipe[0]);
+
+    std::printf("memif: exchanged %zu frames\n", NumFrames);
+
+    return 0;
+}
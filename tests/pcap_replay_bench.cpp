@@ -0,0 +1,454 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Chksum.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/eth/EthIpIface.h>
+#include <aipstack/eth/MacAddr.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+#include <aipstack/proto/Tcp4Proto.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/udp/IpUdpProto.h>
+#include <aipstack/capture/PcapReplay.h>
+
+#include "alloc_guard.h"
+
+using namespace AIpStack;
+
+/*
+ * Receive path benchmark which replays a pcap file into the stack.
+ *
+ * The frames are passed through EthIpIface::recvFrames using PcapReplayer.
+ * Received UDP datagrams are accepted by a listener for any port and TCP
+ * segments go through PCB lookup. Without a file, a synthetic file is written
+ * with UDP datagrams and TCP RST segments to a closed port, so that the stack
+ * sends nothing.
+ *
+ * The time per layer is determined by replaying the same packets at different
+ * entry points, each phase taking the best of the iterations:
+ * - eth: all frames through EthIpIface::recvFrames.
+ * - ip: the IPv4 packets (without the Ethernet header) through
+ *   IpDriverIface::recvIp4Packets of an interface with the same address.
+ * - ip_hdr: like ip but with a receive filter rule which drops all packets,
+ *   so that only the IPv4 header is processed.
+ * From these, "eth_layer_ns" is eth - ip, "ip_layer_ns" is ip_hdr and
+ * "transport_layer_ns" is ip - ip_hdr, all per IPv4 packet.
+ *
+ * Output is JSON on stdout. Arguments (all optional): the pcap file or "-" for
+ * the synthetic file, the number of iterations (default 20), a speed factor
+ * which, if nonzero, enables an additional "timed" phase replaying the file at
+ * the recorded timing, and 1 to check that the stack does not allocate memory.
+ * Allocation is then forbidden (alloc_guard.h) in the eth, ip and ip_hdr
+ * phases, after one warm-up replay at each entry point.
+ *
+ * This needs to be linked with PcapReplay.cpp.
+ */
+
+namespace aipstack_pcap_replay_bench {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using Clock = std::chrono::steady_clock;
+
+using MyIpStackService = IpStackService<
+    IpStackOptions::HeaderBeforeIp::Is<EthHeader::Size>,
+    IpStackOptions::NumRxFilterRules::Is<1>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<16>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<>
+    >
+>;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>
+    >,
+    IpUdpProtoService<
+        IpUdpProtoOptions::UdpIndexService::Is<AvlTreeIndexService>
+    >
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using MyEthIpIfaceService = EthIpIfaceService<
+    EthIpIfaceOptions::TimersStructureService::Is<LinkedHeapService>
+>;
+class EthIpIfaceArg : public MyEthIpIfaceService::template Compose<
+    PlatformImpl, IpStackArg> {};
+using MyEthIpIface = EthIpIface<EthIpIfaceArg>;
+
+using UdpArg = typename MyIpStack::template GetProtoArg<UdpApi>;
+
+constexpr MacAddr SynthLocalMac = MacAddr(0x02, 0, 0, 0, 0, 1);
+constexpr MacAddr SynthPeerMac = MacAddr(0x02, 0, 0, 0, 0, 2);
+constexpr Ip4Addr SynthLocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr SynthPeerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr std::size_t SynthNumFrames = 100000;
+constexpr std::size_t SynthUdpPayload = 64;
+constexpr std::uint16_t SynthUdpPort = 5001;
+constexpr std::uint16_t SynthTcpPort = 81;
+constexpr std::uint32_t SynthFrameIntervalUs = 10;
+constexpr char const *SynthPath = "/tmp/aipstack_pcap_replay_bench.pcap";
+
+constexpr std::size_t BatchSize = 32;
+
+std::size_t tx_frames = 0;
+std::size_t udp_datagrams = 0;
+
+void put32 (std::vector<char> &out, std::uint32_t value)
+{
+    char const *bytes = reinterpret_cast<char const *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+// Build an Ethernet frame with an IPv4 packet, with the given transport header
+// and payload lengths, and fill in the IPv4 header and the transport checksum.
+std::vector<char> make_ip4_frame (Ip4Protocol proto, std::size_t l4_len,
+                                  std::uint16_t ident)
+{
+    std::vector<char> frame(EthHeader::Size + Ip4Header::Size + l4_len);
+
+    auto eth_header = EthHeader::MakeRef(frame.data());
+    eth_header.set(EthHeader::DstMac(),  SynthLocalMac);
+    eth_header.set(EthHeader::SrcMac(),  SynthPeerMac);
+    eth_header.set(EthHeader::EthType(), EthType::Ipv4);
+
+    char *ip_data = frame.data() + EthHeader::Size;
+    auto ip4_header = Ip4Header::MakeRef(ip_data);
+    ip4_header.set(Ip4Header::VersionIhlDscpEcn(), std::uint16_t(0x45) << 8);
+    ip4_header.set(Ip4Header::TotalLen(),     std::uint16_t(Ip4Header::Size + l4_len));
+    ip4_header.set(Ip4Header::Ident(),        ident);
+    ip4_header.set(Ip4Header::FlagsOffset(),  Ip4Flags::DF);
+    ip4_header.set(Ip4Header::Ttl(),          64);
+    ip4_header.set(Ip4Header::Proto(),        proto);
+    ip4_header.set(Ip4Header::HeaderChksum(), 0);
+    ip4_header.set(Ip4Header::SrcAddr(),      SynthPeerAddr);
+    ip4_header.set(Ip4Header::DstAddr(),      SynthLocalAddr);
+    ip4_header.set(Ip4Header::HeaderChksum(), IpChksum(ip_data, Ip4Header::Size));
+
+    return frame;
+}
+
+std::uint16_t transport_chksum (std::vector<char> const &frame, Ip4Protocol proto)
+{
+    std::size_t l4_offset = EthHeader::Size + Ip4Header::Size;
+    std::size_t l4_len = frame.size() - l4_offset;
+    AIPSTACK_ASSERT_FORCE(l4_len % 2 == 0);
+
+    IpChksumAccumulator chksum;
+    chksum.addWord(WrapType<std::uint32_t>(), SynthPeerAddr.value());
+    chksum.addWord(WrapType<std::uint32_t>(), SynthLocalAddr.value());
+    chksum.addWordOctets(0, AsUnderlying(proto));
+    chksum.addWord(WrapType<std::uint16_t>(), std::uint16_t(l4_len));
+    chksum.addEvenBytes(frame.data() + l4_offset, l4_len);
+    return chksum.getChksum();
+}
+
+std::vector<char> make_udp_frame (std::uint16_t ident)
+{
+    std::size_t l4_len = Udp4Header::Size + SynthUdpPayload;
+    std::vector<char> frame = make_ip4_frame(Ip4Protocol::Udp, l4_len, ident);
+
+    auto udp_header = Udp4Header::MakeRef(frame.data() + EthHeader::Size +
+                                          Ip4Header::Size);
+    udp_header.set(Udp4Header::SrcPort(),  40000);
+    udp_header.set(Udp4Header::DstPort(),  SynthUdpPort);
+    udp_header.set(Udp4Header::Length(),   std::uint16_t(l4_len));
+    udp_header.set(Udp4Header::Checksum(), 0);
+
+    std::uint16_t chksum = transport_chksum(frame, Ip4Protocol::Udp);
+    udp_header.set(Udp4Header::Checksum(), (chksum == 0) ? 0xFFFF : chksum);
+    return frame;
+}
+
+std::vector<char> make_tcp_rst_frame (std::uint16_t ident)
+{
+    std::vector<char> frame = make_ip4_frame(Ip4Protocol::Tcp, Tcp4Header::Size, ident);
+
+    auto tcp_header = Tcp4Header::MakeRef(frame.data() + EthHeader::Size +
+                                          Ip4Header::Size);
+    tcp_header.set(Tcp4Header::SrcPort(),     40001);
+    tcp_header.set(Tcp4Header::DstPort(),     SynthTcpPort);
+    tcp_header.set(Tcp4Header::SeqNum(),      TcpSeqNum(ident));
+    tcp_header.set(Tcp4Header::AckNum(),      TcpSeqNum(0));
+    tcp_header.set(Tcp4Header::OffsetFlags(),
+                   Tcp4EncodeOffset(Tcp4Header::Size / 4) | Tcp4Flags::Rst);
+    tcp_header.set(Tcp4Header::WindowSize(),  0);
+    tcp_header.set(Tcp4Header::Checksum(),    0);
+    tcp_header.set(Tcp4Header::UrgentPtr(),   0);
+
+    tcp_header.set(Tcp4Header::Checksum(), transport_chksum(frame, Ip4Protocol::Tcp));
+    return frame;
+}
+
+// Write the synthetic pcap file, alternating UDP and TCP frames.
+void write_synthetic_file (char const *path)
+{
+    std::vector<char> out;
+    put32(out, 0xA1B2C3D4);
+    put32(out, 2 | (std::uint32_t(4) << 16));
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, 65535);
+    put32(out, 1);
+
+    for (std::size_t i = 0; i < SynthNumFrames; i++) {
+        std::uint16_t ident = std::uint16_t(i);
+        std::vector<char> frame = (i % 2 == 0) ?
+            make_udp_frame(ident) : make_tcp_rst_frame(ident);
+
+        std::uint64_t time_us = std::uint64_t(i) * SynthFrameIntervalUs;
+        put32(out, std::uint32_t(time_us / 1000000));
+        put32(out, std::uint32_t(time_us % 1000000));
+        put32(out, std::uint32_t(frame.size()));
+        put32(out, std::uint32_t(frame.size()));
+        out.insert(out.end(), frame.begin(), frame.end());
+    }
+
+    std::FILE *file = std::fopen(path, "wb");
+    AIPSTACK_ASSERT_FORCE(file != nullptr);
+    AIPSTACK_ASSERT_FORCE(std::fwrite(out.data(), 1, out.size(), file) == out.size());
+    std::fclose(file);
+}
+
+IpErr eth_send_frame (IpBufRef)
+{
+    tx_frames++;
+    return IpErr::Success;
+}
+
+EthIfaceState eth_get_state ()
+{
+    EthIfaceState state = {};
+    state.link_up = true;
+    return state;
+}
+
+IpErr ip_send_packet (IpBufRef, Ip4Addr, IpSendRetryRequest *)
+{
+    tx_frames++;
+    return IpErr::Success;
+}
+
+IpIfaceDriverState ip_get_state ()
+{
+    IpIfaceDriverState state = {};
+    state.link_up = true;
+    return state;
+}
+
+UdpRecvResult udp_handler (IpRxInfoIp4<IpStackArg> const &, UdpRxInfo<UdpArg> const &,
+                           IpBufRef)
+{
+    udp_datagrams++;
+    return UdpRecvResult::AcceptStop;
+}
+
+// Return the IPv4 header of a frame, or null if it is not an IPv4 frame.
+char * get_ip4_packet (PcapFrame const &frame)
+{
+    if (frame.cap_len < EthHeader::Size + Ip4Header::Size) {
+        return nullptr;
+    }
+    auto eth_header = EthHeader::MakeRef(frame.data);
+    if (eth_header.get(EthHeader::EthType()) != EthType::Ipv4) {
+        return nullptr;
+    }
+    return frame.data + EthHeader::Size;
+}
+
+template<typename Func>
+std::uint64_t best_time_ns (int iterations, Func func)
+{
+    std::uint64_t best = std::uint64_t(-1);
+    for (int i = 0; i < iterations; i++) {
+        Clock::time_point start = Clock::now();
+        func();
+        std::uint64_t time_ns = std::uint64_t(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - start).count());
+        if (time_ns < best) {
+            best = time_ns;
+        }
+    }
+    return best;
+}
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_pcap_replay_bench;
+
+    char const *path = (argc > 1) ? argv[1] : "-";
+    int iterations = (argc > 2) ? std::atoi(argv[2]) : 20;
+    double speed = (argc > 3) ? std::atof(argv[3]) : 0.0;
+    bool check_alloc = (argc > 4) && std::atoi(argv[4]) == 1;
+    AIPSTACK_ASSERT_FORCE(iterations > 0);
+
+    bool synthetic = (std::strcmp(path, "-") == 0);
+    if (synthetic) {
+        write_synthetic_file(SynthPath);
+        path = SynthPath;
+    }
+
+    PcapFile file(path);
+    AIPSTACK_ASSERT_FORCE(file.getNumFrames() > 0);
+
+    // Collect the IPv4 packets, and take the local addresses from the first.
+    std::vector<IpBufNode> ip_nodes;
+    ip_nodes.reserve(file.getNumFrames());
+    std::vector<IpRxBatchEntry> ip_entries;
+    MacAddr local_mac = SynthLocalMac;
+    Ip4Addr local_addr = SynthLocalAddr;
+
+    for (std::size_t i = 0; i < file.getNumFrames(); i++) {
+        PcapFrame const &frame = file.getFrame(i);
+        char *ip_data = get_ip4_packet(frame);
+        if (ip_data == nullptr) {
+            continue;
+        }
+        if (ip_entries.empty()) {
+            local_mac = EthHeader::MakeRef(frame.data).get(EthHeader::DstMac());
+            local_addr = Ip4Header::MakeRef(ip_data).get(Ip4Header::DstAddr());
+        }
+        std::size_t len = frame.cap_len - EthHeader::Size;
+        ip_nodes.push_back(IpBufNode{ip_data, len, nullptr});
+        IpRxBatchEntry entry;
+        entry.buf = IpBufRef{&ip_nodes.back(), 0, len};
+        ip_entries.push_back(entry);
+    }
+    AIPSTACK_ASSERT_FORCE(!ip_entries.empty());
+
+    SimPlatformImpl sim;
+    Platform platform{PlatformRef<PlatformImpl>{&sim}};
+
+    MyIpStack stack(platform);
+
+    EthIfaceDriverParams eth_params;
+    eth_params.eth_mtu = 1514;
+    eth_params.mac_addr = &local_mac;
+    eth_params.send_frame = eth_send_frame;
+    eth_params.get_eth_state = eth_get_state;
+    MyEthIpIface eth(platform, &stack, eth_params);
+    eth.iface().setIp4Addr(IpIfaceIp4AddrSetting(24, local_addr));
+
+    IpIfaceDriverParams ip_params;
+    ip_params.ip_mtu = 1500;
+    ip_params.send_ip4_packet = ip_send_packet;
+    ip_params.get_state = ip_get_state;
+    IpDriverIface<IpStackArg> ip_iface(&stack, ip_params);
+    ip_iface.iface().setIp4Addr(IpIfaceIp4AddrSetting(24, local_addr));
+
+    UdpListener<UdpArg> udp_listener(udp_handler);
+    UdpListenParams<UdpArg> listen_params;
+    IpErr listen_err = udp_listener.startListening(
+        stack.template getProtoApi<UdpApi>(), listen_params);
+    AIPSTACK_ASSERT_FORCE(listen_err == IpErr::Success);
+
+    PcapReplayParams replay_params;
+    replay_params.batch_size = BatchSize;
+    PcapReplayer replayer(file, AIPSTACK_BIND_MEMBER_TN(&MyEthIpIface::recvFrames, &eth),
+                          replay_params);
+
+    auto replay_ip = [&] {
+        for (std::size_t pos = 0; pos < ip_entries.size(); pos += BatchSize) {
+            std::size_t count = MinValue(BatchSize, ip_entries.size() - pos);
+            ip_iface.recvIp4Packets(&ip_entries[pos], count);
+        }
+    };
+
+    std::optional<AllocGuard::Scope> no_alloc;
+    if (check_alloc) {
+        replayer.replay();
+        replay_ip();
+        udp_datagrams = 0;
+        tx_frames = 0;
+        no_alloc.emplace();
+    }
+
+    std::uint64_t eth_ns = best_time_ns(iterations, [&] { replayer.replay(); });
+
+    std::size_t udp_per_replay = udp_datagrams / std::size_t(iterations);
+    std::uint64_t ip_ns = best_time_ns(iterations, replay_ip);
+
+    IpRxFilterRule drop_all;
+    stack.setRxFilterRule(0, drop_all);
+    std::uint64_t ip_hdr_ns = best_time_ns(iterations, replay_ip);
+    stack.clearRxFilterRule(0);
+
+    no_alloc.reset();
+
+    double num_frames = double(file.getNumFrames());
+    double num_ip = double(ip_entries.size());
+    double eth_per_frame = double(eth_ns) / num_frames;
+    double ip_per_packet = double(ip_ns) / num_ip;
+    double ip_hdr_per_packet = double(ip_hdr_ns) / num_ip;
+
+    std::printf("{\"file\": \"%s\", \"frames\": %zu, \"ip4_packets\": %zu"
+                ", \"truncated\": %zu, \"udp_datagrams\": %zu, \"iterations\": %d",
+                synthetic ? "synthetic" : path, file.getNumFrames(), ip_entries.size(),
+                file.getNumTruncated(), udp_per_replay, iterations);
+    std::printf(", \"eth_pps\": %.0f, \"eth_ns_per_frame\": %.1f"
+                ", \"ip_ns_per_packet\": %.1f, \"ip_hdr_ns_per_packet\": %.1f",
+                num_frames * 1e9 / double(eth_ns), eth_per_frame,
+                ip_per_packet, ip_hdr_per_packet);
+    std::printf(", \"eth_layer_ns\": %.1f, \"ip_layer_ns\": %.1f"
+                ", \"transport_layer_ns\": %.1f",
+                eth_per_frame - ip_per_packet, ip_hdr_per_packet,
+                ip_per_packet - ip_hdr_per_packet);
+
+    if (speed > 0.0) {
+        PcapReplayParams timed_params = replay_params;
+        timed_params.recorded_timing = true;
+        timed_params.speed = speed;
+        PcapReplayer timed_replayer(
+            file, AIPSTACK_BIND_MEMBER_TN(&MyEthIpIface::recvFrames, &eth), timed_params);
+        PcapReplayResult result = timed_replayer.replay();
+        std::printf(", \"timed_speed\": %.2f, \"timed_elapsed_ns\": %llu"
+                    ", \"timed_pps\": %.0f, \"timed_busy_ns_per_frame\": %.1f",
+                    speed, static_cast<unsigned long long>(result.elapsed_ns),
+                    double(result.frames) * 1e9 / double(result.elapsed_ns),
+                    double(result.busy_ns) / double(result.frames));
+    }
+
+    std::printf(", \"tx_frames\": %zu}\n", tx_frames);
+
+    if (synthetic) {
+        AIPSTACK_ASSERT_FORCE(udp_per_replay == SynthNumFrames / 2);
+        AIPSTACK_ASSERT_FORCE(tx_frames == 0);
+        std::remove(SynthPath);
+    }
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/eth/EthIpIface.h>
+#include <aipstack/eth/MacAddr.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/proto/ArpProto.h>
+#include <aipstack/capture/PcapngCapture.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of packet capture at an EthIpIface into a PcapngCaptureRing.
+ *
+ * ARP requests are injected into an interface with capture enabled, and the
+ * pcapng stream obtained through a PcapngCaptureReader is checked to contain
+ * the requests and the replies, truncated to the snapshot length. Also
+ * checks that nothing is captured when the handler is unset and that the
+ * reader skips data which was overwritten before it was read.
+ *
+ * This needs to be linked with PcapngCapture.cpp.
+ */
+
+namespace aipstack_pcapng_capture_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using MyIpStackService = IpStackService<
+    IpStackOptions::HeaderBeforeIp::Is<EthHeader::Size>,
+    IpStackOptions::PathMtuCacheService::Is<
+        IpPathMtuCacheService<
+            IpPathMtuCacheOptions::NumMtuEntries::Is<4>,
+            IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+        >
+    >,
+    IpStackOptions::ReassemblyService::Is<
+        IpReassemblyService<>
+    >
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, MakeTypeList<>> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using MyEthIpIfaceService = EthIpIfaceService<
+    EthIpIfaceOptions::TimersStructureService::Is<LinkedHeapService>,
+    EthIpIfaceOptions::EnableCapture::Is<true>
+>;
+class EthIpIfaceArg : public MyEthIpIfaceService::template Compose<
+    PlatformImpl, IpStackArg> {};
+using MyEthIpIface = EthIpIface<EthIpIfaceArg>;
+
+constexpr MacAddr LocalMac = MacAddr(0x02, 0, 0, 0, 0, 1);
+constexpr MacAddr PeerMac = MacAddr(0x02, 0, 0, 0, 0, 2);
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr PeerAddr = Ip4Addr(10, 0, 0, 2);
+
+constexpr char const *RingPath = "/tmp/aipstack_pcapng_capture_test.ring";
+constexpr std::uint32_t SnapLen = 32;
+constexpr std::size_t ArpFrameSize = EthHeader::Size + ArpIp4Header::Size;
+
+std::vector<char> last_sent_frame;
+
+IpErr send_frame (IpBufRef frame)
+{
+    last_sent_frame.resize(frame.tot_len);
+    ipBufTakeBytes(frame, frame.tot_len, last_sent_frame.data());
+    return IpErr::Success;
+}
+
+EthIfaceState get_eth_state ()
+{
+    EthIfaceState state = {};
+    state.link_up = true;
+    return state;
+}
+
+void make_arp_request (char *buf)
+{
+    auto eth_header = EthHeader::MakeRef(buf);
+    eth_header.set(EthHeader::DstMac(),  MacAddr::BroadcastAddr());
+    eth_header.set(EthHeader::SrcMac(),  PeerMac);
+    eth_header.set(EthHeader::EthType(), EthType::Arp);
+
+    auto arp_header = ArpIp4Header::MakeRef(buf + EthHeader::Size);
+    arp_header.set(ArpIp4Header::HwType(),       ArpHwType::Eth);
+    arp_header.set(ArpIp4Header::ProtoType(),    EthType::Ipv4);
+    arp_header.set(ArpIp4Header::HwAddrLen(),    MacAddr::Size);
+    arp_header.set(ArpIp4Header::ProtoAddrLen(), Ip4Addr::Size);
+    arp_header.set(ArpIp4Header::OpType(),       ArpOpType::Request);
+    arp_header.set(ArpIp4Header::SrcHwAddr(),    PeerMac);
+    arp_header.set(ArpIp4Header::SrcProtoAddr(), PeerAddr);
+    arp_header.set(ArpIp4Header::DstHwAddr(),    MacAddr::ZeroAddr());
+    arp_header.set(ArpIp4Header::DstProtoAddr(), LocalAddr);
+}
+
+std::uint32_t get32 (std::vector<char> const &data, std::size_t pos)
+{
+    AIPSTACK_ASSERT_FORCE(pos + 4 <= data.size());
+    std::uint32_t value;
+    std::memcpy(&value, data.data() + pos, sizeof(value));
+    return value;
+}
+
+struct Block {
+    std::uint32_t type;
+    std::size_t pos;
+    std::size_t len;
+};
+
+// Split a pcapng stream into blocks, checking the block lengths.
+std::vector<Block> parse_blocks (std::vector<char> const &data)
+{
+    std::vector<Block> blocks;
+    std::size_t pos = 0;
+    while (pos < data.size()) {
+        std::uint32_t type = get32(data, pos);
+        std::uint32_t len = get32(data, pos + 4);
+        AIPSTACK_ASSERT_FORCE(len >= 12 && len % 4 == 0 && pos + len <= data.size());
+        AIPSTACK_ASSERT_FORCE(get32(data, pos + len - 4) == len);
+        blocks.push_back(Block{type, pos, len});
+        pos += len;
+    }
+    return blocks;
+}
+
+// Check an Enhanced Packet Block of an ARP frame.
+void check_epb (std::vector<char> const &data, Block const &block,
+                std::uint32_t expected_flags)
+{
+    AIPSTACK_ASSERT_FORCE(block.type == 6);
+    AIPSTACK_ASSERT_FORCE(get32(data, block.pos + 8) == 0);
+    AIPSTACK_ASSERT_FORCE(get32(data, block.pos + 20) == SnapLen);
+    AIPSTACK_ASSERT_FORCE(get32(data, block.pos + 24) == ArpFrameSize);
+    std::size_t opt_pos = block.pos + 28 + SnapLen;
+    AIPSTACK_ASSERT_FORCE(get32(data, opt_pos + 4) == expected_flags);
+
+    // EtherType ARP in network byte order.
+    char const *frame = data.data() + block.pos + 28;
+    AIPSTACK_ASSERT_FORCE(frame[12] == 0x08 && frame[13] == 0x06);
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_pcapng_capture_test;
+
+    SimPlatformImpl sim;
+    Platform platform{PlatformRef<PlatformImpl>{&sim}};
+
+    MyIpStack stack(platform);
+
+    EthIfaceDriverParams params;
+    params.eth_mtu = 1514;
+    params.mac_addr = &LocalMac;
+    params.send_frame = send_frame;
+    params.get_eth_state = get_eth_state;
+
+    MyEthIpIface eth(platform, &stack, params);
+    eth.iface().setIp4Addr(IpIfaceIp4AddrSetting(24, LocalAddr));
+
+    char arp_request[ArpFrameSize];
+    make_arp_request(arp_request);
+    IpBufNode arp_node = {arp_request, ArpFrameSize, nullptr};
+    auto inject_arp_request = [&] {
+        eth.recvFrame(IpBufRef{&arp_node, 0, ArpFrameSize});
+    };
+
+    PcapngCaptureRing ring(RingPath, 65536);
+    PcapngCaptureReader reader(RingPath);
+    PcapngCaptureIface capture_iface(ring, "eth0", SnapLen);
+
+    auto handler = AIPSTACK_BIND_MEMBER_TN(
+        &PcapngCaptureIface::captureFrame, &capture_iface);
+    eth.setCaptureHandler(handler);
+
+    // The request and the reply are captured.
+    inject_arp_request();
+    AIPSTACK_ASSERT_FORCE(last_sent_frame.size() == ArpFrameSize);
+
+    std::vector<char> data;
+    reader.read(data);
+    std::vector<Block> blocks = parse_blocks(data);
+    AIPSTACK_ASSERT_FORCE(blocks.size() == 4);
+    AIPSTACK_ASSERT_FORCE(blocks[0].type == 0x0A0D0D0A);
+    AIPSTACK_ASSERT_FORCE(get32(data, blocks[0].pos + 8) == 0x1A2B3C4D);
+    AIPSTACK_ASSERT_FORCE(blocks[1].type == 1);
+    AIPSTACK_ASSERT_FORCE(get32(data, blocks[1].pos + 12) == SnapLen);
+    check_epb(data, blocks[2], 1);
+    check_epb(data, blocks[3], 2);
+    AIPSTACK_ASSERT_FORCE(std::memcmp(data.data() + blocks[3].pos + 28,
+                                      last_sent_frame.data(), SnapLen) == 0);
+
+    // Nothing is captured without a handler.
+    eth.setCaptureHandler(nullptr);
+    inject_arp_request();
+    std::vector<char> more;
+    reader.read(more);
+    AIPSTACK_ASSERT_FORCE(more.empty());
+
+    // Data which was overwritten is skipped, and reading continues after.
+    eth.setCaptureHandler(handler);
+    for (int i = 0; i < 1000; i++) {
+        inject_arp_request();
+    }
+    reader.read(more);
+    AIPSTACK_ASSERT_FORCE(more.empty());
+    AIPSTACK_ASSERT_FORCE(reader.getLostBytes() > 0);
+
+    inject_arp_request();
+    reader.read(more);
+    blocks = parse_blocks(more);
+    AIPSTACK_ASSERT_FORCE(blocks.size() == 2);
+    check_epb(more, blocks[0], 1);
+    check_epb(more, blocks[1], 2);
+
+    AIPSTACK_ASSERT_FORCE(ring.getNumDropped() == 0);
+
+    std::printf("captured %zu bytes, lost %llu bytes\n", data.size() + more.size(),
+                static_cast<unsigned long long>(reader.getLostBytes()));
+
+    std::remove(RingPath);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <cstddef>
+#include <cstdio>
+
+#include <aipstack/meta/TypeListUtils.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpStackPresets.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/udp/IpUdpProto.h>
+#include <aipstack/eth/EthIpIface.h>
+
+using namespace AIpStack;
+
+/*
+ * Memory footprint report of the configuration presets in IpStackPresets.h.
+ *
+ * For each preset an IpStack with TCP and UDP and an EthIpIface are
+ * instantiated using the preset alone, and their sizes (which include all
+ * statically allocated PCBs, caches and indices) are printed. Nothing is
+ * constructed, all values are known at compile time.
+ *
+ * Output is JSON on stdout, an array with one object per preset containing
+ * "stack_bytes" (the IpStack including protocol handlers), "eth_iface_bytes"
+ * (one EthIpIface) and "total_bytes".
+ */
+
+namespace aipstack_preset_footprint {
+
+using PlatformImpl = SimPlatformImpl;
+
+template<typename Preset>
+struct Footprint
+{
+    using ProtocolServicesList = MakeTypeList<
+        IpTcpProtoService<Preset>,
+        IpUdpProtoService<Preset>
+    >;
+
+    class IpStackArg : public IpStackService<Preset>::template Compose<
+        PlatformImpl, ProtocolServicesList> {};
+
+    class EthIpIfaceArg : public EthIpIfaceService<Preset>::template Compose<
+        PlatformImpl, IpStackArg> {};
+
+    inline static constexpr std::size_t StackBytes = sizeof(IpStack<IpStackArg>);
+    inline static constexpr std::size_t EthIfaceBytes = sizeof(EthIpIface<EthIpIfaceArg>);
+};
+
+bool first_case = true;
+
+template<typename Preset>
+void report (char const *name)
+{
+    using F = Footprint<Preset>;
+
+    std::printf("%s  {\"preset\": \"%s\", \"stack_bytes\": %zu, \"eth_iface_bytes\": %zu"
+                ", \"total_bytes\": %zu}",
+                first_case ? "" : ",\n", name, F::StackBytes, F::EthIfaceBytes,
+                F::StackBytes + F::EthIfaceBytes);
+    first_case = false;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_preset_footprint;
+
+    std::printf("[\n");
+    report<EmbeddedProfile>("embedded");
+    report<LowLatencyProfile>("low_latency");
+    report<ServerProfile>("server");
+    std::printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/udp/IpUdpProto.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of reuse-port groups (TcpListenParams::reuse_port and
+ * UdpListenParams::reuse_port).
+ *
+ * Several TCP listeners share a port and a client makes many connections to
+ * it from different ephemeral ports. Every connection must be reported by
+ * exactly one listener and all listeners must get some. After the first
+ * listener (the head of the group) is reset, the remaining listeners must
+ * get all new connections. A listener without reuse_port must not be able
+ * to join the group.
+ *
+ * The same is done for UDP listeners, where each datagram must be given to
+ * exactly one member of the group.
+ */
+
+namespace aipstack_reuse_port_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::NumTcpPcbs::Is<4>
+    >,
+    IpUdpProtoService<
+        IpUdpProtoOptions::UdpIndexService::Is<AvlTreeIndexService>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+using UdpArg = MyIpStack::template GetProtoArg<UdpApi>;
+
+constexpr double LinkDelaySec = 1e-3;
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::uint16_t UdpPort = 5000;
+constexpr int NumListeners = 4;
+constexpr int NumRequests = 64;
+constexpr std::size_t UdpDataSize = 16;
+
+using Host = TcpFixture::Host<IpStackArg>;
+
+class ClientConnection :
+    public TcpConnection<TcpArg>
+{
+private:
+    void connectionAborted () override final
+    {}
+
+    void dataReceived (std::size_t) override final
+    {}
+
+    void dataSent (std::size_t) override final
+    {}
+};
+
+// TCP listener which counts reported connections (without accepting them)
+// and UDP listener which counts received datagrams.
+class ServerListeners
+{
+public:
+    ServerListeners () :
+        m_tcp_listener(AIPSTACK_BIND_MEMBER_TN(&ServerListeners::connectionEstablished, this)),
+        m_udp_listener(AIPSTACK_BIND_MEMBER_TN(&ServerListeners::udpReceived, this))
+    {}
+
+    TcpListener<TcpArg> m_tcp_listener;
+    UdpListener<UdpArg> m_udp_listener;
+    int m_tcp_count = 0;
+    int m_udp_count = 0;
+
+private:
+    void connectionEstablished ()
+    {
+        m_tcp_count++;
+    }
+
+    UdpRecvResult udpReceived (IpRxInfoIp4<IpStackArg> const &, UdpRxInfo<UdpArg> const &,
+                               IpBufRef)
+    {
+        m_udp_count++;
+        return UdpRecvResult::AcceptStop;
+    }
+};
+
+class Setup
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_host(m_platform, LocalAddr)
+    {
+        // The packets go back to the same interface after the link delay.
+        m_host.setPeer(&m_host);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = TimeType(LinkDelaySec * Platform::TimeFreq);
+        m_host.setRxParams(rx_params);
+
+        for (ServerListeners &lis : m_listeners) {
+            bool listen_res = lis.m_tcp_listener.startListening(tcp(), {
+                /*addr=*/ Ip4Addr::ZeroAddr(),
+                /*port=*/ ServerPort,
+                /*max_pcbs=*/ 1,
+                /*reuse_port=*/ true
+            });
+            AIPSTACK_ASSERT_FORCE(listen_res);
+
+            UdpListenParams<UdpArg> udp_params;
+            udp_params.port = UdpPort;
+            udp_params.reuse_port = true;
+            IpErr udp_res = lis.m_udp_listener.startListening(udp(), udp_params);
+            AIPSTACK_ASSERT_FORCE(udp_res == IpErr::Success);
+        }
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+    }
+
+    // Make connections one at a time, returning how many were reported.
+    int runTcp (int num_connections)
+    {
+        int total_before = tcpTotal();
+
+        for (int i = 0; i < num_connections; i++) {
+            int expected = tcpTotal() + 1;
+
+            TcpStartConnectionArgs<TcpArg> args;
+            args.addr = LocalAddr;
+            args.port = ServerPort;
+            args.rcv_wnd = 1024;
+            IpErr err = m_client.startConnection(tcp(), args);
+            AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+
+            TcpFixture::runWhile(m_sim, [&] { return tcpTotal() < expected; });
+
+            // The listener did not accept the connection so it was aborted,
+            // also reset the client and let the link go idle.
+            m_client.reset();
+            TcpFixture::runWhile(m_sim, [&] { return !m_host.isLinkIdle(); });
+        }
+
+        return tcpTotal() - total_before;
+    }
+
+    // Send datagrams from different source ports, returning how many were
+    // received.
+    int runUdp (int num_datagrams)
+    {
+        int total_before = udpTotal();
+
+        for (int i = 0; i < num_datagrams; i++) {
+            char buf[Ip4Header::Size + Udp4Header::Size + UdpDataSize] = {};
+            IpBufNode node{buf, sizeof(buf), nullptr};
+            IpBufRef udp_data{&node, Ip4Header::Size + Udp4Header::Size, UdpDataSize};
+
+            UdpTxInfo<UdpArg> udp_info{std::uint16_t(40000 + i), UdpPort};
+            IpErr err = udp().sendUdpIp4Packet(Ip4AddrPair{LocalAddr, LocalAddr}, udp_info,
+                udp_data, &m_host.iface(), nullptr, IpSendFlags());
+            AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+
+            TcpFixture::runWhile(m_sim, [&] { return !m_host.isLinkIdle(); });
+        }
+
+        return udpTotal() - total_before;
+    }
+
+    ServerListeners & listener (int i)
+    {
+        return m_listeners[i];
+    }
+
+    TcpApi<TcpArg> & tcp ()
+    {
+        return m_host.tcp();
+    }
+
+    UdpApi<UdpArg> & udp ()
+    {
+        return m_host.stack().template getProtoApi<UdpApi>();
+    }
+
+private:
+    int tcpTotal () const
+    {
+        int total = 0;
+        for (ServerListeners const &lis : m_listeners) {
+            total += lis.m_tcp_count;
+        }
+        return total;
+    }
+
+    int udpTotal () const
+    {
+        int total = 0;
+        for (ServerListeners const &lis : m_listeners) {
+            total += lis.m_udp_count;
+        }
+        return total;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_host;
+    ServerListeners m_listeners[NumListeners];
+    ClientConnection m_client;
+};
+
+void print_counts (char const *name, Setup &setup)
+{
+    std::printf("%s: tcp", name);
+    for (int i = 0; i < NumListeners; i++) {
+        std::printf(" %d", setup.listener(i).m_tcp_count);
+    }
+    std::printf(", udp");
+    for (int i = 0; i < NumListeners; i++) {
+        std::printf(" %d", setup.listener(i).m_udp_count);
+    }
+    std::printf("\n");
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_reuse_port_test;
+
+    auto setup = std::make_unique<Setup>();
+
+    // A listener without reuse_port cannot join the group.
+    TcpListener<TcpArg> other_listener(TcpListener<TcpArg>::EstablishedHandler{});
+    bool other_res = other_listener.startListening(setup->tcp(), {
+        /*addr=*/ Ip4Addr::ZeroAddr(),
+        /*port=*/ ServerPort,
+        /*max_pcbs=*/ 1
+    });
+    AIPSTACK_ASSERT_FORCE(!other_res);
+
+    // All members get some of the connections and datagrams.
+    AIPSTACK_ASSERT_FORCE(setup->runTcp(NumRequests) == NumRequests);
+    AIPSTACK_ASSERT_FORCE(setup->runUdp(NumRequests) == NumRequests);
+    print_counts("all listeners", *setup);
+    for (int i = 0; i < NumListeners; i++) {
+        AIPSTACK_ASSERT_FORCE(setup->listener(i).m_tcp_count > 0);
+        AIPSTACK_ASSERT_FORCE(setup->listener(i).m_udp_count > 0);
+    }
+
+    // Reset the group heads, the remaining members get everything.
+    ServerListeners &head = setup->listener(0);
+    head.m_tcp_listener.reset();
+    head.m_udp_listener.reset();
+    int head_tcp_count = head.m_tcp_count;
+    int head_udp_count = head.m_udp_count;
+
+    AIPSTACK_ASSERT_FORCE(setup->runTcp(NumRequests) == NumRequests);
+    AIPSTACK_ASSERT_FORCE(setup->runUdp(NumRequests) == NumRequests);
+    print_counts("without first", *setup);
+    AIPSTACK_ASSERT_FORCE(head.m_tcp_count == head_tcp_count);
+    AIPSTACK_ASSERT_FORCE(head.m_udp_count == head_udp_count);
+
+    return 0;
+}
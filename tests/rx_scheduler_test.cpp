@@ -0,0 +1,245 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/event_loop/EventLoopRxScheduler.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of EventLoopRxScheduler.
+ *
+ * Simulated sources have a count of pending frames and are armed (in interrupt
+ * mode) or not, like a driver with a file descriptor. A heavy source with many
+ * pending frames and a light source which gets a few frames from a timer share
+ * the scheduler. The light source and the timer must be served while the heavy
+ * source is still busy, the budget of the heavy source must grow to the maximum
+ * and shrink again once it only gets occasional frames, and all sources must
+ * return to interrupt mode when idle. Destructing a source from its own poll
+ * handler is also checked.
+ *
+ * This needs to be linked with EventLoopAmalgamation.cpp.
+ */
+
+namespace aipstack_rx_scheduler_test {
+
+class SimSource
+{
+public:
+    SimSource (EventLoopRxScheduler &scheduler) :
+        m_scheduler(scheduler),
+        m_source(scheduler, AIPSTACK_BIND_MEMBER(&SimSource::poll, this),
+                 AIPSTACK_BIND_MEMBER(&SimSource::arm, this))
+    {}
+
+    // Frames arrive; if armed this is the wakeup, which disarms.
+    void arrive (std::size_t count)
+    {
+        m_pending += count;
+        if (m_armed) {
+            m_armed = false;
+            m_wakeups++;
+            m_source.schedule();
+        }
+    }
+
+    EventLoopRxSource & source () { return m_source; }
+    std::size_t pending () const { return m_pending; }
+    std::size_t processed () const { return m_processed; }
+    std::size_t polls () const { return m_polls; }
+    std::size_t wakeups () const { return m_wakeups; }
+    std::size_t maxBudget () const { return m_max_budget; }
+    std::uint64_t framesBeforeFirstPoll () const { return m_frames_before_first_poll; }
+    bool armed () const { return m_armed; }
+
+private:
+    std::size_t poll (std::size_t budget)
+    {
+        AIPSTACK_ASSERT_FORCE(!m_armed);
+        AIPSTACK_ASSERT_FORCE(m_source.isPolling());
+
+        if (m_polls == 0) {
+            m_frames_before_first_poll = m_scheduler.getStats().num_frames;
+        }
+        m_polls++;
+        m_max_budget = MaxValue(m_max_budget, budget);
+
+        std::size_t count = MinValue(m_pending, budget);
+        m_pending -= count;
+        m_processed += count;
+        return count;
+    }
+
+    void arm ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_armed);
+        AIPSTACK_ASSERT_FORCE(!m_source.isPolling());
+
+        m_armed = true;
+
+        // Frames which arrived while polling cause an immediate wakeup, like a
+        // level-triggered file descriptor.
+        if (m_pending > 0) {
+            arrive(0);
+        }
+    }
+
+private:
+    EventLoopRxScheduler &m_scheduler;
+    EventLoopRxSource m_source;
+    std::size_t m_pending = 0;
+    std::size_t m_processed = 0;
+    std::size_t m_polls = 0;
+    std::size_t m_wakeups = 0;
+    std::size_t m_max_budget = 0;
+    std::uint64_t m_frames_before_first_poll = 0;
+    bool m_armed = true;
+};
+
+constexpr std::size_t HeavyFrames = 100000;
+constexpr std::size_t HeavySingles = 20;
+
+class Test
+{
+public:
+    Test () :
+        m_scheduler(m_loop, make_params()),
+        m_heavy(m_scheduler),
+        m_light(m_scheduler),
+        m_doomed(std::make_unique<EventLoopRxSource>(m_scheduler,
+            AIPSTACK_BIND_MEMBER(&Test::doomedPoll, this),
+            AIPSTACK_BIND_MEMBER(&Test::doomedArm, this))),
+        m_timer(m_loop, AIPSTACK_BIND_MEMBER(&Test::timerHandler, this)),
+        m_check_timer(m_loop, AIPSTACK_BIND_MEMBER(&Test::checkTimerHandler, this))
+    {}
+
+    void run ()
+    {
+        EventLoopRxSchedulerParams params = make_params();
+
+        m_heavy.arrive(HeavyFrames);
+        m_doomed->schedule();
+        m_light.arrive(3);
+        m_timer.setAfter(EventLoopDuration::zero());
+
+        m_loop.run();
+
+        AIPSTACK_ASSERT_FORCE(m_doomed == nullptr);
+
+        AIPSTACK_ASSERT_FORCE(m_heavy.processed() == HeavyFrames + HeavySingles);
+        AIPSTACK_ASSERT_FORCE(m_light.processed() == 3 + 2 * m_bursts);
+
+        // The light source was served and the timer dispatched early on, while the
+        // heavy source was still busy.
+        AIPSTACK_ASSERT_FORCE(m_light.framesBeforeFirstPoll() < HeavyFrames / 10);
+        AIPSTACK_ASSERT_FORCE(m_heavy_at_first_timer < HeavyFrames / 10);
+
+        // The heavy source reached the maximum budget and stayed in polling mode
+        // while busy, and its budget shrank when it only got occasional frames.
+        AIPSTACK_ASSERT_FORCE(m_heavy.maxBudget() == params.max_budget);
+        AIPSTACK_ASSERT_FORCE(m_heavy.wakeups() == 1 + HeavySingles);
+        AIPSTACK_ASSERT_FORCE(m_heavy.source().getBudget() == params.min_budget);
+
+        // Both sources returned to interrupt mode.
+        AIPSTACK_ASSERT_FORCE(m_heavy.armed() && !m_heavy.source().isPolling());
+        AIPSTACK_ASSERT_FORCE(m_light.armed() && !m_light.source().isPolling());
+
+        EventLoopRxSchedulerStats const &stats = m_scheduler.getStats();
+        AIPSTACK_ASSERT_FORCE(
+            stats.num_frames == m_heavy.processed() + m_light.processed());
+        AIPSTACK_ASSERT_FORCE(stats.num_polls == m_heavy.polls() + m_light.polls() + 1);
+        AIPSTACK_ASSERT_FORCE(
+            stats.num_wakeups == m_heavy.wakeups() + m_light.wakeups() + 1);
+        AIPSTACK_ASSERT_FORCE(stats.num_rearms + 1 == stats.num_wakeups);
+        AIPSTACK_ASSERT_FORCE(stats.num_budget_exhausted > 0);
+
+        std::printf("rounds %llu, polls %llu, frames %llu, exhausted %llu\n",
+                    static_cast<unsigned long long>(stats.num_rounds),
+                    static_cast<unsigned long long>(stats.num_polls),
+                    static_cast<unsigned long long>(stats.num_frames),
+                    static_cast<unsigned long long>(stats.num_budget_exhausted));
+    }
+
+private:
+    static EventLoopRxSchedulerParams make_params ()
+    {
+        EventLoopRxSchedulerParams params;
+        params.min_budget = 4;
+        params.max_budget = 128;
+        params.initial_budget = 16;
+        params.idle_polls = 2;
+        return params;
+    }
+
+    std::size_t doomedPoll (std::size_t)
+    {
+        m_doomed.reset();
+        return 0;
+    }
+
+    void doomedArm ()
+    {
+        AIPSTACK_ASSERT_FORCE(false);
+    }
+
+    void timerHandler ()
+    {
+        if (m_bursts == 0) {
+            m_heavy_at_first_timer = m_heavy.processed();
+        }
+
+        m_light.arrive(2);
+        m_bursts++;
+
+        // Once the heavy source has been drained, it gets single frames.
+        if (m_heavy.processed() >= HeavyFrames && !m_heavy.source().isPolling()) {
+            m_heavy.arrive(1);
+            m_heavy_singles++;
+        }
+
+        if (m_heavy_singles < HeavySingles) {
+            m_timer.setAfter(std::chrono::microseconds(200));
+        } else {
+            m_check_timer.setAfter(std::chrono::milliseconds(1));
+        }
+    }
+
+    void checkTimerHandler ()
+    {
+        if (m_heavy.source().isPolling() || m_light.source().isPolling()) {
+            m_check_timer.setAfter(std::chrono::milliseconds(1));
+            return;
+        }
+        m_loop.stop();
+    }
+
+private:
+    EventLoop m_loop;
+    EventLoopRxScheduler m_scheduler;
+    SimSource m_heavy;
+    SimSource m_light;
+    std::unique_ptr<EventLoopRxSource> m_doomed;
+    EventLoopTimer m_timer;
+    EventLoopTimer m_check_timer;
+    std::size_t m_bursts = 0;
+    std::size_t m_heavy_singles = 0;
+    std::size_t m_heavy_at_first_timer = HeavyFrames;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_rx_scheduler_test;
+
+    Test test;
+    test.run();
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/udp/IpUdpProto.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of receive and transmit timestamps (IpRxTimestamp,
+ * IpDriverIface::reportTxTimestamp).
+ *
+ * A simulated link delivers packets back to the interface after 1ms, and the
+ * driver then holds each packet for another 10ms in its receive queue before
+ * passing it to the stack, with the time of arrival as the receive timestamp
+ * if enabled. UDP must see the arrival time in IpRxInfoIp4::rx_time. For TCP,
+ * the receive queue delay of the ACKs must be excluded from the RTT: with
+ * timestamps the client measures about 12ms (the 2ms of the link plus the
+ * queue delay of the data segment at the server), without them about 22ms.
+ * The driver also reports the transmit time of each packet, which must reach
+ * the callback set with IpStack::setTxTimestampHandler.
+ */
+
+namespace aipstack_rx_timestamp_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::NumTcpPcbs::Is<4>
+    >,
+    IpUdpProtoService<
+        IpUdpProtoOptions::UdpIndexService::Is<AvlTreeIndexService>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+using UdpArg = MyIpStack::template GetProtoArg<UdpApi>;
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr TimeType LinkDelay = Platform::TimeFreq / 1000;
+constexpr TimeType RxQueueDelay = 10 * Platform::TimeFreq / 1000;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::uint16_t UdpServerPort = 5000;
+constexpr std::uint16_t UdpClientPort = 5001;
+constexpr std::size_t MessageSize = 100;
+constexpr int NumMessages = 20;
+constexpr std::size_t BufferSize = 4096;
+
+using Host = TcpFixture::Host<IpStackArg>;
+using TestConnection = TcpFixture::TestConnection<TcpArg>;
+
+class Setup
+{
+public:
+    Setup (bool use_rx_timestamps) :
+        m_use_rx_timestamps(use_rx_timestamps),
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_host(m_platform, LocalAddr),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_udp_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::udpReceived, this)),
+        m_client(BufferSize),
+        m_server(BufferSize)
+    {
+        // The packets go back to the same interface, which reports their
+        // transmit time when they are delivered.
+        m_host.setPeer(&m_host);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = LinkDelay;
+        rx_params.queue_delay = RxQueueDelay;
+        rx_params.timestamps = use_rx_timestamps;
+        m_host.setRxParams(rx_params);
+
+        m_host.stack().setTxTimestampHandler(
+            AIPSTACK_BIND_MEMBER_TN(&Setup::txTimestampReported, this));
+
+        bool listen_res = m_listener.startListening(m_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+
+        UdpListenParams<UdpArg> udp_params;
+        udp_params.port = UdpServerPort;
+        IpErr err = m_udp_listener.startListening(udp(), udp_params);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    void testUdp ()
+    {
+        char buf[Ip4Header::Size + Udp4Header::Size + MessageSize] = {};
+        IpBufNode node{buf, sizeof(buf), nullptr};
+        IpBufRef udp_data{&node, Ip4Header::Size + Udp4Header::Size, MessageSize};
+        UdpTxInfo<UdpArg> udp_info{UdpClientPort, UdpServerPort};
+
+        TimeType tx_time = m_platform.getTime();
+        IpErr err = udp().sendUdpIp4Packet(Ip4AddrPair{LocalAddr, LocalAddr}, udp_info,
+            udp_data, &m_host.iface(), nullptr, IpSendFlags());
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_udp_received; });
+
+        AIPSTACK_ASSERT_FORCE(m_udp_rx_time.valid == m_use_rx_timestamps);
+        if (m_use_rx_timestamps) {
+            AIPSTACK_ASSERT_FORCE(m_udp_rx_time.time == tx_time + LinkDelay);
+        }
+    }
+
+    // Returns the smoothed RTT measured by the client in microseconds.
+    std::uint32_t testTcp ()
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = LocalAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(m_host.tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+
+        // Exchange messages one at a time to measure the RTT.
+        std::uint64_t expected = 0;
+        for (int i = 0; i < NumMessages; i++) {
+            m_client.send(MessageSize);
+            expected += MessageSize;
+            TcpFixture::runWhile(m_sim, [&] {
+                return m_server.getReceived() < expected || !m_client.allSent();
+            });
+        }
+
+        TcpConnectionStats stats = m_client.getStats();
+        AIPSTACK_ASSERT_FORCE(stats.rtt_valid);
+        return stats.srtt_us;
+    }
+
+    std::uint64_t getNumDelivered () const
+    {
+        return m_host.getNumReceived();
+    }
+
+    std::uint64_t getNumTxTimestamps () const
+    {
+        return m_num_tx_timestamps;
+    }
+
+private:
+    UdpApi<UdpArg> & udp ()
+    {
+        return m_host.stack().getProtoApi<UdpApi>();
+    }
+
+    void txTimestampReported (IpIface<IpStackArg> *iface, IpBufRef pkt,
+                              std::uint64_t time)
+    {
+        AIPSTACK_ASSERT_FORCE(iface == &m_host.iface());
+        AIPSTACK_ASSERT_FORCE(pkt.tot_len >= Ip4Header::Size);
+        AIPSTACK_ASSERT_FORCE(time + LinkDelay + RxQueueDelay == m_platform.getTime());
+        m_num_tx_timestamps++;
+    }
+
+    UdpRecvResult udpReceived (IpRxInfoIp4<IpStackArg> const &ip_info,
+                               UdpRxInfo<UdpArg> const &, IpBufRef data)
+    {
+        AIPSTACK_ASSERT_FORCE(data.tot_len == MessageSize);
+        m_udp_rx_time = ip_info.rx_time;
+        m_udp_received = true;
+        return UdpRecvResult::AcceptStop;
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_server_accepted);
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+private:
+    bool m_use_rx_timestamps;
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_host;
+    TcpListener<TcpArg> m_listener;
+    UdpListener<UdpArg> m_udp_listener;
+    TestConnection m_client;
+    TestConnection m_server;
+    bool m_server_accepted = false;
+    bool m_udp_received = false;
+    IpRxTimestamp m_udp_rx_time;
+    std::uint64_t m_num_tx_timestamps = 0;
+};
+
+std::uint32_t test_config (bool use_rx_timestamps)
+{
+    auto setup = std::make_unique<Setup>(use_rx_timestamps);
+    setup->testUdp();
+    std::uint32_t srtt_us = setup->testTcp();
+
+    AIPSTACK_ASSERT_FORCE(setup->getNumTxTimestamps() == setup->getNumDelivered());
+
+    std::printf("rx timestamps %s: srtt %uus\n", use_rx_timestamps ? "on" : "off",
+                unsigned(srtt_us));
+    return srtt_us;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_rx_timestamp_test;
+
+    std::uint32_t srtt_without = test_config(false);
+    AIPSTACK_ASSERT_FORCE(srtt_without >= 19000 && srtt_without <= 25000);
+
+    std::uint32_t srtt_with = test_config(true);
+    AIPSTACK_ASSERT_FORCE(srtt_with >= 9000 && srtt_with <= 15000);
+
+    return 0;
+}
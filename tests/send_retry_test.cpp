@@ -0,0 +1,156 @@
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/SendRetry.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of IpSendRetryList and IpSendRetryTxQueue.
+ *
+ * Checks that requests are notified in order of association, that a budget
+ * limits the number of notified requests, that requests re-added from the
+ * callback wait for the next dispatch, and that the transmit queue wakes
+ * senders only below the low watermark and only as many as fit.
+ */
+
+namespace aipstack_send_retry_test {
+
+std::vector<int> notified;
+
+class TestRequest :
+    public IpSendRetryRequest
+{
+public:
+    TestRequest (int id = 0) :
+        m_id(id),
+        m_readd_list(nullptr)
+    {}
+
+    void setId (int id)
+    {
+        m_id = id;
+    }
+
+    void setReaddList (IpSendRetryList *list)
+    {
+        m_readd_list = list;
+    }
+
+private:
+    void retrySending () override final
+    {
+        AIPSTACK_ASSERT_FORCE(!isActive());
+        notified.push_back(m_id);
+        if (m_readd_list != nullptr) {
+            m_readd_list->addRequest(this);
+        }
+    }
+
+private:
+    int m_id;
+    IpSendRetryList *m_readd_list;
+};
+
+void check_notified (std::vector<int> const &expected)
+{
+    AIPSTACK_ASSERT_FORCE(notified == expected);
+    notified.clear();
+}
+
+void test_list ()
+{
+    IpSendRetryList list;
+    TestRequest r1(1), r2(2), r3(3), r4(4);
+
+    list.addRequest(&r1);
+    list.addRequest(&r2);
+    list.addRequest(&r3);
+    list.addRequest(&r4);
+    list.addRequest(nullptr);
+    AIPSTACK_ASSERT_FORCE(list.numRequests() == 4);
+
+    // Re-adding moves the request to the end.
+    list.addRequest(&r1);
+    AIPSTACK_ASSERT_FORCE(list.numRequests() == 4);
+
+    // Resetting a request removes it.
+    r3.reset();
+    AIPSTACK_ASSERT_FORCE(!r3.isActive());
+    AIPSTACK_ASSERT_FORCE(list.numRequests() == 3);
+
+    AIPSTACK_ASSERT_FORCE(list.dispatchRequests(2) == 2);
+    check_notified({2, 4});
+    AIPSTACK_ASSERT_FORCE(list.numRequests() == 1);
+
+    // A request which fails again goes after the others.
+    r2.setReaddList(&list);
+    list.addRequest(&r2);
+    list.dispatchRequests();
+    check_notified({1, 2});
+    AIPSTACK_ASSERT_FORCE(r2.isActive() && list.numRequests() == 1);
+
+    list.reset();
+    AIPSTACK_ASSERT_FORCE(!r2.isActive() && !list.hasRequests());
+    AIPSTACK_ASSERT_FORCE(list.dispatchRequests(5) == 0);
+    check_notified({});
+}
+
+void test_tx_queue ()
+{
+    constexpr std::size_t Capacity = 8;
+
+    IpSendRetryTxQueue queue(Capacity, 2, 6);
+
+    std::vector<bool> events;
+    auto handler = [&](bool stopped) { events.push_back(stopped); };
+    queue.setWatermarkHandler(IpSendRetryTxQueue::WatermarkHandler(handler));
+
+    TestRequest reqs[10];
+    for (int i = 0; i < 10; i++) {
+        reqs[i].setId(i);
+    }
+
+    queue.packetsQueued(5);
+    AIPSTACK_ASSERT_FORCE(!queue.isStopped() && events.empty());
+    queue.packetsQueued(1);
+    AIPSTACK_ASSERT_FORCE(queue.isStopped());
+    AIPSTACK_ASSERT_FORCE(events == std::vector<bool>({true}));
+
+    for (int i = 0; i < 10; i++) {
+        queue.addRequest(&reqs[i]);
+    }
+
+    // No notification until the low watermark is reached.
+    queue.packetsCompleted(3);
+    AIPSTACK_ASSERT_FORCE(queue.isStopped());
+    check_notified({});
+
+    // Occupancy drops to 2, so 6 places are free.
+    queue.packetsCompleted(1);
+    AIPSTACK_ASSERT_FORCE(!queue.isStopped());
+    AIPSTACK_ASSERT_FORCE(events == std::vector<bool>({true, false}));
+    check_notified({0, 1, 2, 3, 4, 5});
+
+    // The remaining requests are notified in order as places free up.
+    queue.packetsCompleted(1);
+    check_notified({6, 7, 8, 9});
+    AIPSTACK_ASSERT_FORCE(queue.getOccupancy() == 1);
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_send_retry_test;
+
+    test_list();
+    test_tx_queue();
+
+    std::printf("All send-retry tests passed.\n");
+
+    return 0;
+}
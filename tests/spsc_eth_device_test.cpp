@@ -0,0 +1,206 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/RxBufPool.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/proto/EthernetProto.h>
+#include <aipstack/ip/IpStackTypes.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/spsc/SpscEthDevice.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of SpscEthDevice.
+ *
+ * A driver thread receives numbered frames into buffers from the fill ring and
+ * passes them to the event loop, which checks that they arrive in order and
+ * sends each back through the transmit ring. Some buffers are retained for a
+ * while so that the fill ring has to be refilled with buffers released later.
+ * The pool asserts on destruction that all buffers have been returned.
+ *
+ * This needs to be linked with EventLoopAmalgamation.cpp.
+ */
+
+namespace aipstack_spsc_eth_device_test {
+
+constexpr std::size_t FrameSize = 64;
+constexpr std::uint32_t NumFrames = 200000;
+constexpr std::size_t MaxRetained = 8;
+
+AIPSTACK_MAKE_INSTANCE(TheRxBufPool, (IpRxBufPoolService<
+    IpRxBufPoolOptions::NumBuffers::Is<64 + MaxRetained>,
+    IpRxBufPoolOptions::BufferSize::Is<FrameSize>
+>))
+
+using Device = SpscEthDevice<TheRxBufPool>;
+
+std::uint32_t get_seq (char const *frame)
+{
+    std::uint32_t seq;
+    std::memcpy(&seq, frame + EthHeader::Size, sizeof(seq));
+    return seq;
+}
+
+class Test
+{
+public:
+    Test () :
+        m_device(m_loop, m_pool,
+                 AIPSTACK_BIND_MEMBER_TN(&Test::framesReceived, this), make_params()),
+        m_stop(false),
+        m_rx_next_seq(0),
+        m_num_batches(0),
+        m_tx_full(0),
+        m_tx_received(0),
+        m_tx_next_seq(0)
+    {}
+
+    ~Test ()
+    {
+        for (IpRxBuf *buf : m_retained) {
+            buf->release();
+        }
+    }
+
+    void run ()
+    {
+        std::thread driver([this] { driverMain(); });
+        m_loop.run();
+        driver.join();
+
+        // The driver thread is gone, so take over its role for the remaining
+        // frames to be sent.
+        driverProcessTx();
+
+        std::printf("frames=%u batches=%zu tx_full=%zu\n",
+            unsigned(m_rx_next_seq), m_num_batches, m_tx_full);
+
+        AIPSTACK_ASSERT_FORCE(m_rx_next_seq == NumFrames);
+        AIPSTACK_ASSERT_FORCE(m_tx_received + m_tx_full == NumFrames);
+    }
+
+private:
+    static SpscEthDeviceParams make_params ()
+    {
+        SpscEthDeviceParams params;
+        params.ring_size = 64;
+        params.tx_frame_size = FrameSize;
+        params.rx_budget = 16;
+        return params;
+    }
+
+    void framesReceived (IpRxBatchEntry const *frames, std::size_t count)
+    {
+        AIPSTACK_ASSERT_FORCE(count >= 1 && count <= 16);
+        m_num_batches++;
+
+        for (std::size_t i = 0; i < count; i++) {
+            IpBufRef frame = frames[i].buf;
+            AIPSTACK_ASSERT_FORCE(frame.tot_len == FrameSize);
+            AIPSTACK_ASSERT_FORCE(frames[i].rx_buf != nullptr);
+
+            std::uint32_t seq = get_seq(frame.getChunkPtr());
+            AIPSTACK_ASSERT_FORCE(seq == m_rx_next_seq);
+            m_rx_next_seq++;
+
+            // Retain some buffers, releasing the oldest when there are too many.
+            if (seq % 7 == 0) {
+                if (m_retained.size() == MaxRetained) {
+                    m_retained.front()->release();
+                    m_retained.erase(m_retained.begin());
+                }
+                frames[i].rx_buf->retain();
+                m_retained.push_back(frames[i].rx_buf);
+            }
+
+            IpErr err = m_device.sendFrame(frame);
+            if (err == IpErr::OutputBufferFull) {
+                m_tx_full++;
+            } else {
+                AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+            }
+        }
+
+        if (m_rx_next_seq == NumFrames) {
+            m_stop.store(true);
+            m_loop.stop();
+        }
+    }
+
+    void driverMain ()
+    {
+        std::uint32_t seq = 0;
+
+        while (!m_stop.load()) {
+            driverProcessTx();
+
+            while (seq < NumFrames) {
+                std::size_t capacity;
+                char *data = m_device.driverRxBuffer(capacity);
+                if (data == nullptr) {
+                    break;
+                }
+                AIPSTACK_ASSERT_FORCE(capacity >= FrameSize);
+                std::memset(data, 0, FrameSize);
+                std::memcpy(data + EthHeader::Size, &seq, sizeof(seq));
+                m_device.driverRxFrame(FrameSize);
+                seq++;
+            }
+            m_device.driverRxFlush();
+
+            std::this_thread::yield();
+        }
+    }
+
+    void driverProcessTx ()
+    {
+        std::size_t count = m_device.driverTxAvailable();
+        for (std::size_t i = 0; i < count; i++) {
+            MemRef frame = m_device.driverTxFrame(i);
+            AIPSTACK_ASSERT_FORCE(frame.len == FrameSize);
+            std::uint32_t seq = get_seq(frame.ptr);
+            AIPSTACK_ASSERT_FORCE(seq >= m_tx_next_seq);
+            m_tx_next_seq = seq + 1;
+            m_tx_received++;
+        }
+        m_device.driverTxRelease(count);
+    }
+
+private:
+    EventLoop m_loop;
+    TheRxBufPool m_pool;
+    Device m_device;
+    std::atomic<bool> m_stop;
+    std::vector<IpRxBuf *> m_retained;
+    std::uint32_t m_rx_next_seq;
+    std::size_t m_num_batches;
+    std::size_t m_tx_full;
+    std::size_t m_tx_received;
+    std::uint32_t m_tx_next_seq;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_spsc_eth_device_test;
+
+    auto test = std::make_unique<Test>();
+    test->run();
+
+    std::printf("SpscEthDevice test passed.\n");
+
+    return 0;
+}
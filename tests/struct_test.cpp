@@ -102,5 +102,17 @@ int main ()
         bar_ref.ref(HeaderBar::FieldFoo()).get(HeaderFoo::FieldA()),
         foo_copy.get(HeaderFoo::FieldA()));
     
+    // Decode all fields at once into a HeaderBar::Native, modify
+    // it and encode it back.
+    HeaderBar::Native bar_native = HeaderBar::Decode(bar_mem);
+    bar_native.set(HeaderBar::FieldD(), bar_native.get(HeaderBar::FieldD()) + 1);
+    HeaderBar::Encode(bar_mem, bar_native);
+    
+    print(bar_mem, HeaderBar::Size);
+    
+    std::printf("%" PRIu32 " %" PRIi64 "\n",
+        bar_ref.get(HeaderBar::FieldD()),
+        bar_native.get(HeaderBar::FieldFoo()).get(HeaderFoo::FieldB()));
+    
     return 0;
 }
@@ -0,0 +1,592 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Instance.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/LinkedList.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/index/BTreeIndex.h>
+#include <aipstack/structure/index/HashTableIndex.h>
+#include <aipstack/structure/index/MruListIndex.h>
+#include <aipstack/structure/minimum/ArrayHeap.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+#include <aipstack/structure/minimum/SortedList.h>
+
+using namespace AIpStack;
+
+/*
+ * Micro-benchmark of the intrusive data structures, with both the pointer and
+ * the array link model.
+ *
+ * Entries have unique random 32-bit keys. For each structure, link model and
+ * number of entries, the following phases are measured, repeated for small
+ * numbers of entries so that each phase covers at least MinOps operations:
+ * - insert: all entries are inserted in a random order.
+ * - find: all entries are looked up by key in another random order. For the
+ *   "minimum" family structures there is no lookup by key and this is null.
+ * - iterate: all entries are visited in order, using first/next for indexes
+ *   and the linked list and findAllLesserOrEqual for the "minimum" family
+ *   structures. This is null for the hash table and MRU list indexes, which do
+ *   not maintain an order (and iterating the hash table visits all buckets).
+ * - remove: all entries are removed in a random order.
+ *
+ * Structures with linear-time lookup or insertion (MRU list index, linked list
+ * and sorted list) are only measured up to MaxLinearEntries entries.
+ *
+ * Output is JSON on stdout, an array with one object per case, containing the
+ * time in ns per operation ("<phase>_ns") and the number of hardware cache
+ * misses per operation ("<phase>_misses") for each phase. The cache misses are
+ * read from a perf_event counter of the process and are null if that is not
+ * available (e.g. due to kernel.perf_event_paranoid or in a VM).
+ *
+ * Optional arguments are the numbers of entries to test (default 16, 256,
+ * 4096, 65536 and 1048576), at most MaxEntries.
+ */
+
+namespace aipstack_structure_bench {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t MaxEntries = std::size_t(1) << 20;
+
+constexpr std::size_t MaxLinearEntries = 4096;
+
+// Minimum number of operations to measure in each phase.
+constexpr std::size_t MinOps = 200000;
+
+// Size of the data in an entry other than the key and the hook.
+constexpr std::size_t EntryPayloadSize = 48;
+
+std::size_t const default_counts[] = {16, 256, 4096, 65536, 1048576};
+
+std::mt19937 rng(1);
+
+// Prevents the compiler from optimizing away lookups and walks.
+std::uintptr_t volatile sink;
+
+bool first_case = true;
+
+// Counter of hardware cache misses of this process.
+class CacheMissCounter {
+public:
+    CacheMissCounter ()
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        m_fd = int(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    ~CacheMissCounter ()
+    {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    CacheMissCounter (CacheMissCounter const &) = delete;
+    CacheMissCounter & operator= (CacheMissCounter const &) = delete;
+
+    inline bool isAvailable () const
+    {
+        return m_fd >= 0;
+    }
+
+    void start ()
+    {
+        if (m_fd >= 0) {
+            ::ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    std::uint64_t stop ()
+    {
+        std::uint64_t count = 0;
+        if (m_fd >= 0) {
+            ::ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (::read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+
+private:
+    int m_fd;
+};
+
+CacheMissCounter *cache_misses;
+
+// Accumulated measurements of one phase.
+struct Phase {
+    Clock::duration time = Clock::duration::zero();
+    std::uint64_t misses = 0;
+    std::size_t ops = 0;
+
+    template<typename Func>
+    void measure (std::size_t num_ops, Func func)
+    {
+        cache_misses->start();
+        auto start = Clock::now();
+        func();
+        time += Clock::now() - start;
+        misses += cache_misses->stop();
+        ops += num_ops;
+    }
+
+    void print (char const *name) const
+    {
+        if (ops == 0) {
+            std::printf(", \"%s_ns\": null, \"%s_misses\": null", name, name);
+            return;
+        }
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+        std::printf(", \"%s_ns\": %.1f", name, double(ns) / double(ops));
+
+        if (cache_misses->isAvailable()) {
+            std::printf(", \"%s_misses\": %.2f", name, double(misses) / double(ops));
+        } else {
+            std::printf(", \"%s_misses\": null", name);
+        }
+    }
+};
+
+struct Phases {
+    Phase insert;
+    Phase find;
+    Phase iterate;
+    Phase remove;
+};
+
+void print_case (char const *structure, bool array_links, std::size_t count,
+                 Phases const &phases)
+{
+    std::printf("%s\n  {\"structure\": \"%s\", \"link_model\": \"%s\", \"entries\": %zu",
+        first_case ? "" : ",", structure, array_links ? "array" : "pointer", count);
+    phases.insert.print("insert");
+    phases.find.print("find");
+    phases.iterate.print("iterate");
+    phases.remove.print("remove");
+    std::printf("}");
+    first_case = false;
+}
+
+std::size_t num_rounds (std::size_t count)
+{
+    return MaxValue(std::size_t(1), MinOps / count);
+}
+
+std::vector<std::size_t> random_order (std::size_t count)
+{
+    std::vector<std::size_t> order(count);
+    for (std::size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    return order;
+}
+
+// Unique keys in a random order. Multiplying by an odd number is a bijection.
+std::vector<std::uint32_t> make_keys (std::size_t count)
+{
+    std::uint32_t offset = std::uint32_t(rng());
+    std::vector<std::uint32_t> keys(count);
+    for (std::size_t i = 0; i < count; i++) {
+        keys[i] = (std::uint32_t(i) + offset) * 0x9E3779B1u;
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    return keys;
+}
+
+// State of the array link model, the array of all entries.
+template<typename Entry>
+struct ArrayState {
+    Entry *base;
+
+    inline Entry & getEntryAt (std::size_t index)
+    {
+        return base[index];
+    }
+
+    inline std::size_t getEntryIndex (Entry &entry)
+    {
+        return std::size_t(&entry - base);
+    }
+};
+
+template<typename Entry, bool ArrayLinks>
+using BenchLinkModel = std::conditional_t<ArrayLinks,
+    ArrayLinkModel<Entry, std::uint32_t, TypeMax<std::uint32_t>, ArrayState<Entry>>,
+    PointerLinkModel<Entry>>;
+
+// Creates the State of the link model for an array of entries.
+template<typename LinkModel, typename Entry>
+typename LinkModel::State make_state (Entry *entries)
+{
+    if constexpr (std::is_same_v<LinkModel, PointerLinkModel<Entry>>) {
+        return typename LinkModel::State();
+    } else {
+        return typename LinkModel::State{entries};
+    }
+}
+
+struct U32KeyFuncs {
+    inline static int CompareKeys (std::uint32_t op1, std::uint32_t op2)
+    {
+        return (op1 < op2) ? -1 : (op1 > op2) ? 1 : 0;
+    }
+
+    inline static bool KeysAreEqual (std::uint32_t op1, std::uint32_t op2)
+    {
+        return op1 == op2;
+    }
+
+    inline static std::size_t HashKey (std::uint32_t key)
+    {
+        return std::size_t(key);
+    }
+};
+
+// Benchmark of an "index" family structure.
+template<typename IndexService, bool ArrayLinks, bool Ordered>
+class IndexBench {
+    struct Entry;
+    struct HookAccessor;
+
+    struct KeyFuncs : public U32KeyFuncs {
+        inline static std::uint32_t GetKeyOfEntry (Entry const &entry)
+        {
+            return entry.key;
+        }
+    };
+
+    using LinkModel = BenchLinkModel<Entry, ArrayLinks>;
+    using State = typename LinkModel::State;
+    using Ref = typename LinkModel::Ref;
+
+    AIPSTACK_MAKE_INSTANCE(TheIndex, (IndexService::template Index<
+        HookAccessor, std::uint32_t, KeyFuncs, LinkModel, /*Duplicates=*/false>))
+
+    struct Entry {
+        std::uint32_t key;
+        typename TheIndex::Node hook;
+        char payload[EntryPayloadSize];
+    };
+
+    struct HookAccessor : public MemberAccessor<
+        Entry, typename TheIndex::Node, &Entry::hook> {};
+
+public:
+    static void run (char const *name, std::vector<std::uint32_t> const &keys)
+    {
+        std::size_t count = keys.size();
+
+        std::unique_ptr<Entry[]> entries(new Entry[count]);
+        for (std::size_t i = 0; i < count; i++) {
+            entries[i].key = keys[i];
+        }
+        State st = make_state<LinkModel>(entries.get());
+
+        auto index = std::make_unique<typename TheIndex::Index>();
+        index->init();
+
+        Phases phases;
+
+        for (std::size_t round = 0; round < num_rounds(count); round++) {
+            std::vector<std::size_t> order = random_order(count);
+            phases.insert.measure(count, [&] {
+                for (std::size_t i : order) {
+                    index->addEntry(Ref(entries[i], st), st);
+                }
+            });
+
+            order = random_order(count);
+            std::size_t num_found = 0;
+            phases.find.measure(count, [&] {
+                for (std::size_t i : order) {
+                    Ref e = index->findEntry(entries[i].key, st);
+                    num_found += !e.isNull() && &*e == &entries[i];
+                }
+            });
+            AIPSTACK_ASSERT_FORCE(num_found == count);
+
+            std::uintptr_t acc = 0;
+            std::size_t num_walked = 0;
+            Ref prev = Ref::null();
+            bool ordered = true;
+            auto walk = [&] {
+                for (Ref e = index->first(st); !e.isNull(); e = index->next(e, st)) {
+                    if (Ordered && !prev.isNull()) {
+                        ordered &= (*prev).key < (*e).key;
+                    }
+                    acc += (*e).key;
+                    prev = e;
+                    num_walked++;
+                }
+            };
+            if (Ordered) {
+                phases.iterate.measure(count, walk);
+            } else if (round == 0) {
+                walk();
+            } else {
+                num_walked = count;
+            }
+            AIPSTACK_ASSERT_FORCE(num_walked == count && ordered);
+            sink = acc;
+
+            order = random_order(count);
+            phases.remove.measure(count, [&] {
+                for (std::size_t i : order) {
+                    index->removeEntry(Ref(entries[i], st), st);
+                }
+            });
+            AIPSTACK_ASSERT_FORCE(index->isEmpty());
+        }
+
+        print_case(name, ArrayLinks, count, phases);
+    }
+};
+
+// Benchmark of a "minimum" family structure.
+template<typename MinimumService, bool ArrayLinks>
+class MinimumBench {
+    struct Entry;
+
+    using LinkModel = BenchLinkModel<Entry, ArrayLinks>;
+    using State = typename LinkModel::State;
+    using Ref = typename LinkModel::Ref;
+    using Node = typename MinimumService::template Node<LinkModel>;
+
+    struct Entry {
+        std::uint32_t key;
+        Node hook;
+        char payload[EntryPayloadSize];
+    };
+
+    struct HookAccessor : public MemberAccessor<Entry, Node, &Entry::hook> {};
+
+    struct Compare {
+        inline static int compareEntries (State, Ref ref1, Ref ref2)
+        {
+            return U32KeyFuncs::CompareKeys((*ref1).key, (*ref2).key);
+        }
+
+        inline static int compareKeyEntry (State, std::uint32_t key1, Ref ref2)
+        {
+            return U32KeyFuncs::CompareKeys(key1, (*ref2).key);
+        }
+    };
+
+    using Structure = typename MinimumService::template Structure<
+        HookAccessor, Compare, LinkModel>;
+
+public:
+    static void run (char const *name, std::vector<std::uint32_t> const &keys)
+    {
+        std::size_t count = keys.size();
+
+        std::unique_ptr<Entry[]> entries(new Entry[count]);
+        for (std::size_t i = 0; i < count; i++) {
+            entries[i].key = keys[i];
+        }
+        State st = make_state<LinkModel>(entries.get());
+
+        auto structure = std::make_unique<Structure>();
+        structure->init();
+
+        Phases phases;
+
+        for (std::size_t round = 0; round < num_rounds(count); round++) {
+            std::vector<std::size_t> order = random_order(count);
+            phases.insert.measure(count, [&] {
+                for (std::size_t i : order) {
+                    structure->insert(Ref(entries[i], st), st);
+                }
+            });
+
+            std::size_t num_found = 0;
+            std::uintptr_t acc = 0;
+            phases.iterate.measure(count, [&] {
+                structure->findAllLesserOrEqual(TypeMax<std::uint32_t>, [&](Ref e) {
+                    acc += (*e).key;
+                    num_found++;
+                }, st);
+            });
+            AIPSTACK_ASSERT_FORCE(num_found == count);
+            sink = acc;
+
+            order = random_order(count);
+            phases.remove.measure(count, [&] {
+                for (std::size_t i : order) {
+                    structure->remove(Ref(entries[i], st), st);
+                }
+            });
+            AIPSTACK_ASSERT_FORCE(structure->isEmpty());
+        }
+
+        print_case(name, ArrayLinks, count, phases);
+    }
+};
+
+// Benchmark of LinkedList, with a linear search to find entries.
+template<bool ArrayLinks>
+class LinkedListBench {
+    struct Entry;
+    struct HookAccessor;
+
+    using LinkModel = BenchLinkModel<Entry, ArrayLinks>;
+    using State = typename LinkModel::State;
+    using Ref = typename LinkModel::Ref;
+    using List = LinkedList<HookAccessor, LinkModel, true>;
+
+    struct Entry {
+        std::uint32_t key;
+        LinkedListNode<LinkModel> hook;
+        char payload[EntryPayloadSize];
+    };
+
+    struct HookAccessor : public MemberAccessor<
+        Entry, LinkedListNode<LinkModel>, &Entry::hook> {};
+
+public:
+    static void run (char const *name, std::vector<std::uint32_t> const &keys)
+    {
+        std::size_t count = keys.size();
+
+        std::unique_ptr<Entry[]> entries(new Entry[count]);
+        for (std::size_t i = 0; i < count; i++) {
+            entries[i].key = keys[i];
+        }
+        State st = make_state<LinkModel>(entries.get());
+
+        List list;
+        list.init();
+
+        Phases phases;
+
+        for (std::size_t round = 0; round < num_rounds(count); round++) {
+            std::vector<std::size_t> order = random_order(count);
+            phases.insert.measure(count, [&] {
+                for (std::size_t i : order) {
+                    list.append(Ref(entries[i], st), st);
+                }
+            });
+
+            order = random_order(count);
+            std::size_t num_found = 0;
+            phases.find.measure(count, [&] {
+                for (std::size_t i : order) {
+                    std::uint32_t key = entries[i].key;
+                    for (Ref e = list.first(st); !e.isNull(); e = List::next(e, st)) {
+                        if ((*e).key == key) {
+                            num_found++;
+                            break;
+                        }
+                    }
+                }
+            });
+            AIPSTACK_ASSERT_FORCE(num_found == count);
+
+            std::size_t num_walked = 0;
+            std::uintptr_t acc = 0;
+            phases.iterate.measure(count, [&] {
+                for (Ref e = list.first(st); !e.isNull(); e = List::next(e, st)) {
+                    acc += (*e).key;
+                    num_walked++;
+                }
+            });
+            AIPSTACK_ASSERT_FORCE(num_walked == count);
+            sink = acc;
+
+            order = random_order(count);
+            phases.remove.measure(count, [&] {
+                for (std::size_t i : order) {
+                    list.remove(Ref(entries[i], st), st);
+                }
+            });
+            AIPSTACK_ASSERT_FORCE(list.isEmpty());
+        }
+
+        print_case(name, ArrayLinks, count, phases);
+    }
+};
+
+template<bool ArrayLinks>
+void run_all (std::vector<std::uint32_t> const &keys)
+{
+    std::size_t count = keys.size();
+    bool linear = count <= MaxLinearEntries;
+
+    IndexBench<AvlTreeIndexService, ArrayLinks, true>::run("avl_tree", keys);
+    IndexBench<BTreeIndexService<MaxEntries>, ArrayLinks, true>::run("btree", keys);
+    IndexBench<HashTableIndexService<MaxEntries>, ArrayLinks, false>::run(
+        "hash_table", keys);
+    if (linear) {
+        IndexBench<MruListIndexService, ArrayLinks, false>::run("mru_list", keys);
+    }
+
+    MinimumBench<LinkedHeapService, ArrayLinks>::run("linked_heap", keys);
+    MinimumBench<ArrayHeapService<MaxEntries>, ArrayLinks>::run("array_heap", keys);
+    if (linear) {
+        MinimumBench<SortedListService, ArrayLinks>::run("sorted_list", keys);
+        LinkedListBench<ArrayLinks>::run("linked_list", keys);
+    }
+}
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_structure_bench;
+
+    std::vector<std::size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        long count = std::atol(argv[i]);
+        AIPSTACK_ASSERT_FORCE(count > 0 && std::size_t(count) <= MaxEntries);
+        counts.push_back(std::size_t(count));
+    }
+    if (counts.empty()) {
+        counts.assign(std::begin(default_counts), std::end(default_counts));
+    }
+
+    CacheMissCounter counter;
+    cache_misses = &counter;
+
+    std::printf("[");
+
+    for (std::size_t count : counts) {
+        std::vector<std::uint32_t> keys = make_keys(count);
+
+        run_all<false>(keys);
+        run_all<true>(keys);
+    }
+
+    std::printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of the RST sent when a connection with unacknowledged data is reset
+ * (TcpConnection::reset), which must abort the connection of the peer:
+ * - zero window: the client does not read, so the server probes the zero
+ *   window with data beyond the window before it resets the connection.
+ * - in flight: the server resets the connection while data segments are
+ *   still on the way to the client, so the client has received more than
+ *   the server knows when the RST arrives.
+ */
+
+namespace aipstack_tcp_abort_rst_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::NumTcpPcbs::Is<4>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+using Host = TcpFixture::Host<IpStackArg>;
+using TestConnection = TcpFixture::TestConnection<TcpArg>;
+
+constexpr Ip4Addr ClientAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr ServerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t BufferSize = 65536;
+constexpr std::size_t ClientRcvBufSize = 4096;
+constexpr PlatformImpl::TimeType ProbeTime = 5 * PlatformImpl::TicksPerSecond;
+constexpr PlatformImpl::TimeType AbortTimeout = 1 * PlatformImpl::TicksPerSecond;
+
+// Client connection which may leave received data unread, and which records
+// being aborted.
+class ClientConnection :
+    public TcpFixture::TestConnection<TcpArg>
+{
+    using Base = TcpFixture::TestConnection<TcpArg>;
+
+public:
+    ClientConnection (bool reading) :
+        Base(BufferSize),
+        m_reading(reading)
+    {}
+
+    std::size_t getUnread () const
+    {
+        return m_unread;
+    }
+
+    bool wasAborted () const
+    {
+        return m_aborted;
+    }
+
+private:
+    void connectionAborted () override final
+    {
+        m_aborted = true;
+    }
+
+    void dataReceived (std::size_t amount) override final
+    {
+        if (m_reading) {
+            Base::dataReceived(amount);
+        } else {
+            m_unread += amount;
+        }
+    }
+
+private:
+    bool m_reading;
+    bool m_aborted = false;
+    std::size_t m_unread = 0;
+};
+
+class Setup :
+    private NonCopyable<Setup>
+{
+public:
+    Setup (bool client_reading) :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_client_host(m_platform, ClientAddr),
+        m_server_host(m_platform, ServerAddr),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_client(client_reading),
+        m_server(BufferSize)
+    {
+        m_client_host.setPeer(&m_server_host);
+        m_server_host.setPeer(&m_client_host);
+
+        bool listen_res = m_listener.startListening(m_server_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = ServerAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = ClientRcvBufSize;
+        IpErr err = m_client.startConnection(m_client_host.tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers(ClientRcvBufSize);
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    void testZeroWindow ()
+    {
+        m_server.send(4 * ClientRcvBufSize);
+        m_sim.runFor(ProbeTime);
+        AIPSTACK_ASSERT_FORCE(m_client.getUnread() == ClientRcvBufSize);
+        AIPSTACK_ASSERT_FORCE(!m_client.wasAborted());
+
+        m_server.reset();
+        waitClientAborted();
+    }
+
+    void testInFlight ()
+    {
+        // Reset right after the data segments have been sent, before the client
+        // has received them.
+        std::uint64_t num_sent = m_server_host.getNumSent();
+        m_server.send(4 * ClientRcvBufSize);
+        TcpFixture::runWhile(m_sim, [&] { return m_server_host.getNumSent() == num_sent; });
+        AIPSTACK_ASSERT_FORCE(m_client.getReceived() == 0);
+
+        m_server.reset();
+        waitClientAborted();
+        AIPSTACK_ASSERT_FORCE(m_client.getReceived() == ClientRcvBufSize);
+    }
+
+private:
+    void waitClientAborted ()
+    {
+        PlatformImpl::TimeType end_time = m_sim.getTime() + AbortTimeout;
+        TcpFixture::runWhile(m_sim, [&] {
+            return !m_client.wasAborted() && m_sim.getTime() < end_time;
+        });
+        AIPSTACK_ASSERT_FORCE(m_client.wasAborted());
+    }
+
+    void connectionEstablished ()
+    {
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_client_host;
+    Host m_server_host;
+    TcpListener<TcpArg> m_listener;
+    ClientConnection m_client;
+    TestConnection m_server;
+    bool m_server_accepted = false;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_abort_rst_test;
+
+    {
+        auto setup = std::make_unique<Setup>(/*client_reading=*/false);
+        setup->testZeroWindow();
+        std::printf("zero window: client aborted\n");
+    }
+
+    {
+        auto setup = std::make_unique<Setup>(/*client_reading=*/true);
+        setup->testInFlight();
+        std::printf("in flight: client aborted\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,448 @@
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/index/MruListIndex.h>
+#include <aipstack/structure/index/HashTableIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Connection scaling benchmark of the TCP implementation.
+ *
+ * Two stacks with MaxConnections PCBs each are connected back to back like in
+ * tcp_loopback_bench.cpp, with time simulated using SimPlatformImpl. For each
+ * PCB index service and number of connections, the following phases are
+ * measured in sequence:
+ * - connect: all connections are established at once.
+ * - lookup: one byte is sent on each connection in a random order, so that
+ *   each received packet requires a PCB lookup in a large index.
+ * - idle: 60 seconds of simulated time pass with all connections idle.
+ * - close: all connections are closed gracefully and the objects are reset.
+ * - timewait: simulated time passes until TIME-WAIT PCBs have expired.
+ *
+ * Output is JSON on stdout, an array with one object per case, containing
+ * sizes in bytes ("stack_bytes", "stack_bytes_per_pcb" which includes the
+ * fixed part of the stack, and "connection_bytes"), "connects_per_sec" (wall
+ * time), and for each phase the CPU time in ns per connection or per packet
+ * and the number of packets and/or timers dispatched.
+ *
+ * Optional arguments are the numbers of connections to test (default 1000,
+ * 10000 and 50000), at most MaxConnections.
+ */
+
+namespace aipstack_tcp_churn_bench {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int MaxConnections = 100000;
+
+// Connections per listening port, limited by the number of ephemeral ports.
+constexpr std::size_t ConnectionsPerPort = 60000;
+
+constexpr Ip4Addr ClientAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr ServerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr std::uint16_t ServerPortBase = 5001;
+constexpr std::size_t MaxServerPorts =
+    (std::size_t(MaxConnections) + ConnectionsPerPort - 1) / ConnectionsPerPort;
+
+constexpr std::size_t BufferSize = 256;
+
+constexpr SimPlatformImpl::TimeType IdleTime = 60 * SimPlatformImpl::TicksPerSecond;
+constexpr SimPlatformImpl::TimeType TimeWaitWait = 130 * SimPlatformImpl::TicksPerSecond;
+
+std::size_t const default_counts[] = {1000, 10000, 50000};
+
+bool first_case = true;
+
+std::uint64_t cpu_time_ns ()
+{
+    return std::uint64_t(std::clock()) * (1000000000 / CLOCKS_PER_SEC);
+}
+
+// Measures CPU time as well as packets and timers of a phase.
+template<typename Setup>
+class PhaseMeter
+{
+public:
+    PhaseMeter (Setup &setup) :
+        m_setup(setup),
+        m_start_cpu(cpu_time_ns()),
+        m_start_wall(Clock::now()),
+        m_start_packets(setup.getNumPackets()),
+        m_start_timers(setup.getNumDispatched())
+    {}
+
+    void print (char const *name, std::size_t num_connections)
+    {
+        std::uint64_t cpu_ns = cpu_time_ns() - m_start_cpu;
+        std::uint64_t packets = m_setup.getNumPackets() - m_start_packets;
+        std::uint64_t timers = m_setup.getNumDispatched() - m_start_timers;
+
+        std::printf(", \"%s_packets\": %llu, \"%s_timers\": %llu"
+                    ", \"%s_cpu_ns_per_connection\": %.1f",
+                    name, static_cast<unsigned long long>(packets),
+                    name, static_cast<unsigned long long>(timers),
+                    name, double(cpu_ns) / double(num_connections));
+        if (packets > 0) {
+            std::printf(", \"%s_cpu_ns_per_packet\": %.1f",
+                        name, double(cpu_ns) / double(packets));
+        }
+    }
+
+    double wallSeconds () const
+    {
+        return std::chrono::duration<double>(Clock::now() - m_start_wall).count();
+    }
+
+private:
+    Setup &m_setup;
+    std::uint64_t m_start_cpu;
+    Clock::time_point m_start_wall;
+    std::uint64_t m_start_packets;
+    std::uint64_t m_start_timers;
+};
+
+template<typename IndexService>
+class ChurnBench
+{
+    using ProtocolServicesList = MakeTypeList<
+        IpTcpProtoService<
+            IpTcpProtoOptions::NumTcpPcbs::Is<MaxConnections>,
+            IpTcpProtoOptions::PcbIndexService::Is<IndexService>,
+            IpTcpProtoOptions::EphemeralPortFirst::Is<1024>,
+            IpTcpProtoOptions::EphemeralPortBitmap::Is<true>
+        >
+    >;
+
+    class IpStackArg : public TcpFixture::StackService<>::template Compose<
+        PlatformImpl, ProtocolServicesList> {};
+    using MyIpStack = IpStack<IpStackArg>;
+
+    using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+    using Host = TcpFixture::Host<IpStackArg>;
+
+    // Connection which counts events and consumes received data right away.
+    class BenchConnection :
+        public TcpFixture::TestConnection<TcpArg>
+    {
+        using Base = TcpFixture::TestConnection<TcpArg>;
+
+    public:
+        BenchConnection (std::size_t *counter, bool const *closing) :
+            Base(BufferSize),
+            m_counter(counter),
+            m_closing(closing)
+        {}
+
+    private:
+        // This is also called after a graceful close, when the PCB enters the
+        // TIME-WAIT or CLOSED state.
+        void connectionAborted () override final
+        {
+            if (!*m_closing) {
+                Base::connectionAborted();
+            }
+        }
+
+        void connectionEstablished () override final
+        {
+            (*m_counter)++;
+        }
+
+        void dataReceived (std::size_t amount) override final
+        {
+            Base::dataReceived(amount);
+            (*m_counter)++;
+        }
+
+        void dataSent (std::size_t amount) override final
+        {
+            if (amount == 0) {
+                (*m_counter)++;
+            }
+        }
+
+    private:
+        std::size_t *m_counter;
+        bool const *m_closing;
+    };
+
+public:
+    // Both stacks, the listeners and the connections between them.
+    class Setup :
+        private NonCopyable<Setup>
+    {
+    public:
+        Setup () :
+            m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+            m_client(std::make_unique<Host>(m_platform, ClientAddr)),
+            m_server(std::make_unique<Host>(m_platform, ServerAddr)),
+            m_client_events(0),
+            m_server_events(0),
+            m_closing(false)
+        {
+            m_client->setPeer(&*m_server);
+            m_server->setPeer(&*m_client);
+
+            for (std::size_t i = 0; i < MaxServerPorts; i++) {
+                auto lis = std::make_unique<TcpListener<TcpArg>>(
+                    AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this));
+                bool listen_res = lis->startListening(m_server->tcp(), {
+                    /*addr=*/ Ip4Addr::ZeroAddr(),
+                    /*port=*/ std::uint16_t(ServerPortBase + i),
+                    /*max_pcbs=*/ MaxConnections
+                });
+                AIPSTACK_ASSERT_FORCE(listen_res);
+                lis->setInitialReceiveWindow(BufferSize);
+                m_listeners.push_back(std::move(lis));
+            }
+        }
+
+        ~Setup ()
+        {
+            resetConnections();
+        }
+
+        void connect (std::size_t num_connections)
+        {
+            for (std::size_t i = 0; i < num_connections; i++) {
+                auto con = std::make_unique<BenchConnection>(&m_client_events, &m_closing);
+
+                TcpStartConnectionArgs<TcpArg> args;
+                args.addr = ServerAddr;
+                args.port = std::uint16_t(ServerPortBase + i / ConnectionsPerPort);
+                args.rcv_wnd = BufferSize;
+                IpErr err = con->startConnection(m_client->tcp(), args);
+                AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+                con->setupBuffers();
+
+                m_client_cons.push_back(std::move(con));
+            }
+
+            TcpFixture::runWhile(m_sim, [&] {
+                return m_client_events < num_connections ||
+                       m_server_cons.size() < num_connections;
+            });
+        }
+
+        void lookup (std::uint64_t seed)
+        {
+            std::size_t num_connections = m_client_cons.size();
+
+            // Visit connections in a pseudo-random order (a full-period LCG
+            // modulo the next power of two, skipping indices out of range).
+            std::size_t mask = 1;
+            while (mask < num_connections) {
+                mask *= 2;
+            }
+            mask--;
+
+            m_server_events = 0;
+            std::size_t index = std::size_t(seed) & mask;
+            for (std::size_t i = 0; i <= mask; i++) {
+                index = (index * 5 + 1) & mask;
+                if (index < num_connections) {
+                    m_client_cons[index]->send(1);
+                }
+            }
+
+            TcpFixture::runWhile(m_sim, [&] { return m_server_events < num_connections; });
+        }
+
+        void idle (SimPlatformImpl::TimeType duration)
+        {
+            m_sim.runFor(duration);
+        }
+
+        void close ()
+        {
+            std::size_t num_connections = m_client_cons.size();
+
+            // Each side counts receiving the FIN and getting its own FIN acked.
+            m_client_events = 0;
+            m_server_events = 0;
+            m_closing = true;
+            for (auto &con : m_client_cons) {
+                con->closeSending();
+            }
+            for (auto &con : m_server_cons) {
+                con->closeSending();
+            }
+
+            TcpFixture::runWhile(m_sim, [&] {
+                return m_client_events < 2 * num_connections ||
+                       m_server_events < 2 * num_connections;
+            });
+
+            resetConnections();
+            m_closing = false;
+        }
+
+        std::uint64_t getNumPackets () const
+        {
+            return m_client->getNumSent() + m_server->getNumSent();
+        }
+
+        std::uint64_t getNumDispatched () const
+        {
+            return m_sim.getNumDispatched();
+        }
+
+        TcpMemoryStats getServerTcpMemory ()
+        {
+            return m_server->tcp().getMemoryStats();
+        }
+
+    private:
+        void resetConnections ()
+        {
+            for (auto &con : m_client_cons) {
+                con->reset();
+            }
+            for (auto &con : m_server_cons) {
+                con->reset();
+            }
+            m_client_cons.clear();
+            m_server_cons.clear();
+        }
+
+        void connectionEstablished ()
+        {
+            // Find the listener with a ready connection.
+            for (auto &lis : m_listeners) {
+                if (lis->hasAcceptPending()) {
+                    auto con = std::make_unique<BenchConnection>(&m_server_events, &m_closing);
+                    IpErr err = con->acceptConnection(*lis);
+                    AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+                    con->setupBuffers();
+                    m_server_cons.push_back(std::move(con));
+                    return;
+                }
+            }
+            AIPSTACK_ASSERT_FORCE(false);
+        }
+
+    private:
+        SimPlatformImpl m_sim;
+        Platform m_platform;
+        std::unique_ptr<Host> m_client;
+        std::unique_ptr<Host> m_server;
+        std::vector<std::unique_ptr<TcpListener<TcpArg>>> m_listeners;
+        std::vector<std::unique_ptr<BenchConnection>> m_client_cons;
+        std::vector<std::unique_ptr<BenchConnection>> m_server_cons;
+        std::size_t m_client_events;
+        std::size_t m_server_events;
+        bool m_closing;
+    };
+
+    static void run (char const *index_name, std::size_t num_connections)
+    {
+        Setup setup;
+
+        std::printf("%s\n  {\"index\": \"%s\", \"connections\": %zu"
+                    ", \"stack_bytes\": %zu, \"stack_bytes_per_pcb\": %.1f"
+                    ", \"connection_bytes\": %zu",
+                    first_case ? "" : ",", index_name, num_connections,
+                    sizeof(MyIpStack), double(sizeof(MyIpStack)) / MaxConnections,
+                    sizeof(TcpConnection<TcpArg>));
+        first_case = false;
+
+        {
+            PhaseMeter<Setup> meter(setup);
+            setup.connect(num_connections);
+            double wall = meter.wallSeconds();
+            meter.print("connect", num_connections);
+            std::printf(", \"connects_per_sec\": %.0f",
+                        (wall > 0.0) ? double(num_connections) / wall : 0.0);
+            std::printf(", \"server_pcbs_used\": %zu",
+                        setup.getServerTcpMemory().pcbs.used);
+        }
+
+        {
+            PhaseMeter<Setup> meter(setup);
+            setup.lookup(num_connections);
+            meter.print("lookup", num_connections);
+        }
+
+        {
+            PhaseMeter<Setup> meter(setup);
+            setup.idle(IdleTime);
+            meter.print("idle", num_connections);
+        }
+
+        {
+            PhaseMeter<Setup> meter(setup);
+            setup.close();
+            meter.print("close", num_connections);
+        }
+
+        {
+            PhaseMeter<Setup> meter(setup);
+            setup.idle(TimeWaitWait);
+            meter.print("timewait", num_connections);
+        }
+
+        std::printf(", \"server_pcbs_used_end\": %zu",
+                    setup.getServerTcpMemory().pcbs.used);
+
+        std::printf("}");
+        std::fflush(stdout);
+    }
+};
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_tcp_churn_bench;
+
+    std::vector<std::size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        long count = std::atol(argv[i]);
+        AIPSTACK_ASSERT_FORCE(count > 0 && count <= MaxConnections);
+        counts.push_back(std::size_t(count));
+    }
+    if (counts.empty()) {
+        counts.assign(std::begin(default_counts), std::end(default_counts));
+    }
+
+    std::printf("[");
+
+    for (std::size_t count : counts) {
+        ChurnBench<AvlTreeIndexService>::run("avl_tree", count);
+        ChurnBench<HashTableIndexService<65536>>::run("hash_table", count);
+        ChurnBench<MruListIndexService>::run("mru_list", count);
+    }
+
+    std::printf("\n]\n");
+
+    return 0;
+}
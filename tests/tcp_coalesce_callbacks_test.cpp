@@ -0,0 +1,218 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of coalescing of dataSent/dataReceived callbacks within receive
+ * batches (the CoalesceDataCallbacks option of IpTcpProtoService).
+ *
+ * Two stacks are connected back to back. The server receives packets one by
+ * one so it acknowledges each data segment separately, while the client
+ * receives packets in batches. Data is transferred in both directions, and
+ * the client is expected to get at most one dataSent and one dataReceived
+ * callback per receive batch, although the batches contain many ACKs and
+ * data segments.
+ */
+
+namespace aipstack_tcp_coalesce_callbacks_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::CoalesceDataCallbacks::Is<true>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr Ip4Addr ClientAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr ServerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr std::uint16_t ServerPort = 5001;
+constexpr std::size_t TransferBytes = 2000000;
+constexpr std::size_t BufferSize = 65536;
+
+using Host = TcpFixture::Host<IpStackArg>;
+
+// Connection which counts the data callbacks.
+class TestConnection :
+    public TcpFixture::TestConnection<TcpArg>
+{
+    using Base = TcpFixture::TestConnection<TcpArg>;
+
+public:
+    TestConnection () :
+        Base(BufferSize)
+    {}
+
+    void resetCounters ()
+    {
+        m_num_sent_callbacks = 0;
+        m_num_received_callbacks = 0;
+    }
+
+    std::size_t getSent () const { return m_sent; }
+    std::size_t getNumSentCallbacks () const { return m_num_sent_callbacks; }
+    std::size_t getNumReceivedCallbacks () const { return m_num_received_callbacks; }
+
+private:
+    void dataReceived (std::size_t amount) override final
+    {
+        AIPSTACK_ASSERT_FORCE(amount > 0);
+        m_num_received_callbacks++;
+        Base::dataReceived(amount);
+    }
+
+    void dataSent (std::size_t amount) override final
+    {
+        AIPSTACK_ASSERT_FORCE(amount > 0);
+        m_num_sent_callbacks++;
+        m_sent += amount;
+        Base::dataSent(amount);
+    }
+
+private:
+    std::size_t m_sent = 0;
+    std::size_t m_num_sent_callbacks = 0;
+    std::size_t m_num_received_callbacks = 0;
+};
+
+class Setup :
+    private NonCopyable<Setup>
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_client(m_platform, ClientAddr, 1500, /*use_batches=*/true),
+        m_server(m_platform, ServerAddr, 1500, /*use_batches=*/false),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_server_ready(false)
+    {
+        m_client.setPeer(&m_server);
+        m_server.setPeer(&m_client);
+
+        bool listen_res = m_listener.startListening(m_server.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = ServerAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client_con.startConnection(m_client.tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client_con.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_ready; });
+    }
+
+    ~Setup ()
+    {
+        m_client_con.reset();
+        m_server_con.reset();
+    }
+
+    // The client sends, so it receives batches of ACKs.
+    void testSend ()
+    {
+        m_client_con.resetCounters();
+        std::size_t start_batches = m_client.getNumBatches();
+        std::size_t start_packets = m_client.getNumReceived();
+
+        m_client_con.send(TransferBytes);
+        TcpFixture::runWhile(m_sim, [&] { return m_client_con.getSent() < TransferBytes; });
+        AIPSTACK_ASSERT_FORCE(m_server_con.getReceived() == TransferBytes);
+
+        std::size_t batches = m_client.getNumBatches() - start_batches;
+        std::size_t packets = m_client.getNumReceived() - start_packets;
+        std::size_t callbacks = m_client_con.getNumSentCallbacks();
+        std::printf("send: %zu ACKs in %zu batches, %zu dataSent callbacks\n",
+                    packets, batches, callbacks);
+
+        AIPSTACK_ASSERT_FORCE(callbacks <= batches);
+        AIPSTACK_ASSERT_FORCE(callbacks < packets / 2);
+    }
+
+    // The server sends, so the client receives batches of data segments.
+    void testReceive ()
+    {
+        m_client_con.resetCounters();
+        std::size_t start_batches = m_client.getNumBatches();
+        std::size_t start_packets = m_client.getNumReceived();
+
+        m_server_con.send(TransferBytes);
+        TcpFixture::runWhile(m_sim, [&] { return m_client_con.getReceived() < TransferBytes; });
+        AIPSTACK_ASSERT_FORCE(m_client_con.getReceived() == TransferBytes);
+
+        std::size_t batches = m_client.getNumBatches() - start_batches;
+        std::size_t packets = m_client.getNumReceived() - start_packets;
+        std::size_t callbacks = m_client_con.getNumReceivedCallbacks();
+        std::printf("receive: %zu segments in %zu batches, "
+                    "%zu dataReceived callbacks\n", packets, batches, callbacks);
+
+        AIPSTACK_ASSERT_FORCE(callbacks <= batches);
+        AIPSTACK_ASSERT_FORCE(callbacks < packets / 2);
+    }
+
+private:
+    void connectionEstablished ()
+    {
+        IpErr err = m_server_con.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server_con.setupBuffers();
+        m_server_ready = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_client;
+    Host m_server;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_client_con;
+    TestConnection m_server_con;
+    bool m_server_ready;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_coalesce_callbacks_test;
+
+    auto setup = std::make_unique<Setup>();
+
+    setup->testSend();
+    setup->testReceive();
+
+    return 0;
+}
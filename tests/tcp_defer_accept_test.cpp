@@ -0,0 +1,252 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of deferred accept (TcpListener::setDeferAccept).
+ *
+ * A client connects to a listener with deferred accept and either sends a
+ * request after some delay or sends nothing:
+ * - With a request, the listener must report the connection only when the
+ *   request arrives, and the request must be delivered right after the
+ *   connection is accepted.
+ * - Without a request, the listener must report the connection after the
+ *   configured number of SYN-ACK retransmissions, or never if that is not
+ *   reached before the SYN_RCVD timeout.
+ * - Without deferred accept, the connection is reported right away.
+ */
+
+namespace aipstack_tcp_defer_accept_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using MyTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>,
+    IpTcpProtoOptions::EnableStats::Is<true>
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, MakeTypeList<MyTcpService>> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr double LinkDelaySec = 1e-3;
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t BufferSize = 4096;
+constexpr std::size_t RequestSize = 100;
+constexpr double TestTimeSec = 30.0;
+
+using Host = TcpFixture::Host<IpStackArg>;
+
+// Connection which reports received data, for which being aborted is not an
+// error.
+class TestConnection :
+    public TcpFixture::TestConnection<TcpArg>
+{
+    using Base = TcpFixture::TestConnection<TcpArg>;
+
+public:
+    using ReceivedHandler = Function<void()>;
+
+    TestConnection (ReceivedHandler received_handler) :
+        Base(BufferSize),
+        m_received_handler(received_handler)
+    {}
+
+private:
+    void connectionAborted () override final
+    {}
+
+    void dataReceived (std::size_t amount) override final
+    {
+        Base::dataReceived(amount);
+        m_received_handler();
+    }
+
+private:
+    ReceivedHandler m_received_handler;
+};
+
+struct Result {
+    bool accepted;
+    double accept_time;
+    double data_time;
+    TcpListenerStats lis_stats;
+};
+
+class Setup
+{
+public:
+    // A negative request_delay means that the client sends nothing.
+    Setup (std::uint8_t defer_accept, double request_delay) :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_host(m_platform, LocalAddr),
+        m_request_timer(m_platform,
+                        AIPSTACK_BIND_MEMBER_TN(&Setup::requestTimerHandler, this)),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_client(AIPSTACK_BIND_MEMBER_TN(&Setup::dataReceived, this)),
+        m_server(AIPSTACK_BIND_MEMBER_TN(&Setup::dataReceived, this)),
+        m_request_delay(request_delay)
+    {
+        // The packets go back to the same interface after the link delay.
+        m_host.setPeer(&m_host);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = TimeType(LinkDelaySec * Platform::TimeFreq);
+        m_host.setRxParams(rx_params);
+
+        bool listen_res = m_listener.startListening(m_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+        m_listener.setDeferAccept(defer_accept);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    Result run ()
+    {
+        m_start_time = m_platform.getTime();
+
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = LocalAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(m_host.tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        if (m_request_delay >= 0) {
+            m_request_timer.setAfter(TimeType(m_request_delay * Platform::TimeFreq));
+        }
+
+        TimeType end_time = m_start_time + TimeType(TestTimeSec * Platform::TimeFreq);
+        while (m_server.getReceived() < RequestSize &&
+               !Platform::timeGreaterOrEqual(m_platform.getTime(), end_time))
+        {
+            if (!m_sim.runOne()) {
+                break;
+            }
+        }
+
+        return Result{m_server_accepted, m_accept_time, m_data_time, m_listener.getStats()};
+    }
+
+private:
+    double elapsed ()
+    {
+        return double(m_platform.getTime() - m_start_time) / Platform::TimeFreq;
+    }
+
+    void requestTimerHandler ()
+    {
+        m_client.send(RequestSize);
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_server_accepted);
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+        m_accept_time = elapsed();
+    }
+
+    void dataReceived ()
+    {
+        m_data_time = elapsed();
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_host;
+    Platform::Timer m_request_timer;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_client;
+    TestConnection m_server;
+    double m_request_delay;
+    TimeType m_start_time = 0;
+    bool m_server_accepted = false;
+    double m_accept_time = -1;
+    double m_data_time = -1;
+};
+
+Result test_config (char const *name, std::uint8_t defer_accept, double request_delay)
+{
+    auto setup = std::make_unique<Setup>(defer_accept, request_delay);
+    Result res = setup->run();
+
+    if (res.accepted) {
+        std::printf("%s: accepted at %.3fs, deferred ACKs %u\n", name, res.accept_time,
+                    unsigned(res.lis_stats.deferred_acks));
+    } else {
+        std::printf("%s: not accepted, deferred ACKs %u\n", name,
+                    unsigned(res.lis_stats.deferred_acks));
+    }
+    return res;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_defer_accept_test;
+
+    Result res;
+
+    // Without deferred accept the connection is reported after one RTT.
+    res = test_config("no defer", 0, 2.0);
+    AIPSTACK_ASSERT_FORCE(res.accepted && res.accept_time < 0.01);
+    AIPSTACK_ASSERT_FORCE(res.data_time >= 2.0);
+    AIPSTACK_ASSERT_FORCE(res.lis_stats.deferred_acks == 0);
+
+    // With a request, the connection is reported with the request.
+    res = test_config("defer, request after 2s", 5, 2.0);
+    AIPSTACK_ASSERT_FORCE(res.accepted && res.accept_time >= 2.0);
+    AIPSTACK_ASSERT_FORCE(res.data_time == res.accept_time);
+    AIPSTACK_ASSERT_FORCE(res.lis_stats.deferred_acks >= 1);
+
+    // Without a request, the connection is reported after two SYN-ACK
+    // retransmissions (after 1s and 3s).
+    res = test_config("defer 2, no request", 2, -1);
+    AIPSTACK_ASSERT_FORCE(res.accepted && res.accept_time >= 3.0 && res.accept_time < 4.0);
+    AIPSTACK_ASSERT_FORCE(res.lis_stats.deferred_acks == 2);
+
+    // Without a request and more retransmissions than fit into the SYN_RCVD
+    // timeout, the connection is never reported.
+    res = test_config("defer 10, no request", 10, -1);
+    AIPSTACK_ASSERT_FORCE(!res.accepted);
+    AIPSTACK_ASSERT_FORCE(res.lis_stats.established == 0);
+
+    return 0;
+}
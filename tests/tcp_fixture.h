@@ -0,0 +1,444 @@
+#ifndef AIPSTACK_TESTS_TCP_FIXTURE_H
+#define AIPSTACK_TESTS_TCP_FIXTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+/*
+ * Common parts of the TCP tests and benchmarks, which run stacks on
+ * SimPlatformImpl:
+ * - StackService: the IpStackService used by the tests, to which a test can
+ *   add options.
+ * - Host: a stack with an interface which is connected back to back to the
+ *   interface of another Host, or to itself, optionally with a delay.
+ * - TestConnection: a connection with circular buffers which consumes
+ *   received data and sends a byte pattern.
+ * - runWhile and linkUpState.
+ */
+
+namespace TcpFixture {
+
+using Platform = AIpStack::PlatformFacade<AIpStack::SimPlatformImpl>;
+using TimeType = Platform::TimeType;
+
+template<typename... Options>
+using StackService = AIpStack::IpStackService<
+    AIpStack::IpStackOptions::HeaderBeforeIp::Is<0>,
+    AIpStack::IpStackOptions::PathMtuCacheService::Is<
+        AIpStack::IpPathMtuCacheService<
+            AIpStack::IpPathMtuCacheOptions::NumMtuEntries::Is<16>,
+            AIpStack::IpPathMtuCacheOptions::MtuIndexService::Is<
+                AIpStack::AvlTreeIndexService>
+        >
+    >,
+    AIpStack::IpStackOptions::ReassemblyService::Is<
+        AIpStack::IpReassemblyService<>
+    >,
+    Options...
+>;
+
+// Dispatch events of the simulation while cond() is true. There must always
+// be an event to dispatch, otherwise the test would hang.
+template<typename Cond>
+void runWhile (AIpStack::SimPlatformImpl &sim, Cond cond)
+{
+    while (cond()) {
+        bool dispatched = sim.runOne();
+        AIPSTACK_ASSERT_FORCE(dispatched);
+    }
+}
+
+// Driver state for IpIfaceDriverParams::get_state, the link is always up.
+inline AIpStack::IpIfaceDriverState linkUpState ()
+{
+    AIpStack::IpIfaceDriverState state = {};
+    state.link_up = true;
+    return state;
+}
+
+// Parameters of the delivery of packets to a Host, see Host::setRxParams.
+struct RxParams {
+    // Time from sending a packet until it arrives.
+    TimeType link_delay = 0;
+
+    // Time for which an arrived packet is held before it is passed to the
+    // stack, like in the receive queue of a driver.
+    TimeType queue_delay = 0;
+
+    // Whether the time of arrival is passed to the stack as the receive
+    // timestamp.
+    bool timestamps = false;
+};
+
+// A stack with an interface to another Host (see setPeer), which may also be
+// the host itself. Sent packets are copied into the receive queue of the
+// other host, from which they are delivered from a timer when they are due
+// according to its RxParams, in a receive batch unless use_batches is false.
+// The transmit time of each delivered packet is reported to the stack of the
+// peer. Packet buffers go back to the sending host when they have been
+// delivered, so that they are reused.
+template<typename IpStackArg>
+class Host :
+    private AIpStack::NonCopyable<Host<IpStackArg>>
+{
+    using Stack = AIpStack::IpStack<IpStackArg>;
+
+    struct Packet {
+        TimeType tx_time;
+        std::vector<char> data;
+    };
+
+public:
+    // Decides whether a sent packet is delivered (true) or lost (false).
+    using SendFilter = AIpStack::Function<bool(std::vector<char> const &pkt)>;
+
+    Host (Platform platform, AIpStack::Ip4Addr addr, std::size_t ip_mtu = 1500,
+          bool use_batches = true) :
+        m_stack(platform),
+        m_iface(&m_stack, make_params(ip_mtu)),
+        m_rx_timer(platform, AIPSTACK_BIND_MEMBER_TN(&Host::rxTimerHandler, this)),
+        m_ip_mtu(ip_mtu),
+        m_use_batches(use_batches)
+    {
+        m_iface.iface().setIp4Addr(AIpStack::IpIfaceIp4AddrSetting(24, addr));
+    }
+
+    // Packets sent while there is no peer are lost.
+    void setPeer (Host *peer)
+    {
+        m_peer = peer;
+    }
+
+    void setRxParams (RxParams const &params)
+    {
+        m_rx_params = params;
+    }
+
+    void setSendFilter (SendFilter filter)
+    {
+        m_send_filter = filter;
+    }
+
+    // Whether no packets are on the way to this host or to its peer.
+    bool isLinkIdle () const
+    {
+        return m_rx_queue.empty() && (m_peer == nullptr || m_peer->m_rx_queue.empty());
+    }
+
+    Stack & stack ()
+    {
+        return m_stack;
+    }
+
+    AIpStack::IpIface<IpStackArg> & iface ()
+    {
+        return m_iface.iface();
+    }
+
+    auto & tcp ()
+    {
+        return m_stack.template getProtoApi<AIpStack::TcpApi>();
+    }
+
+    std::uint64_t getNumSent () const
+    {
+        return m_num_sent;
+    }
+
+    std::uint64_t getNumReceived () const
+    {
+        return m_num_received;
+    }
+
+    std::uint64_t getNumBatches () const
+    {
+        return m_num_batches;
+    }
+
+    // Make sure that up to max_packets packets sent by this host can be in
+    // flight without allocating memory.
+    void reserveBuffers (std::size_t max_packets)
+    {
+        m_peer->m_rx_queue.reserve(max_packets);
+        m_peer->m_rx_processing.reserve(max_packets);
+
+        m_packet_pool.reserve(m_packet_pool.size() + max_packets);
+        for (std::size_t i = 0; i < max_packets; i++) {
+            std::vector<char> data;
+            data.reserve(m_ip_mtu);
+            m_packet_pool.push_back(std::move(data));
+        }
+    }
+
+private:
+    AIpStack::IpIfaceDriverParams make_params (std::size_t ip_mtu)
+    {
+        AIpStack::IpIfaceDriverParams params;
+        params.ip_mtu = ip_mtu;
+        params.send_ip4_packet = AIPSTACK_BIND_MEMBER_TN(&Host::sendPacket, this);
+        params.get_state = linkUpState;
+        return params;
+    }
+
+    AIpStack::IpErr sendPacket (
+        AIpStack::IpBufRef pkt, AIpStack::Ip4Addr, AIpStack::IpSendRetryRequest *)
+    {
+        m_num_sent++;
+        if (m_peer == nullptr) {
+            return AIpStack::IpErr::Success;
+        }
+
+        std::vector<char> data;
+        if (!m_packet_pool.empty()) {
+            data = std::move(m_packet_pool.back());
+            m_packet_pool.pop_back();
+        }
+        // Reserve for the largest packet so that a reused buffer is never
+        // reallocated.
+        data.reserve(m_ip_mtu);
+        data.resize(pkt.tot_len);
+        AIpStack::ipBufTakeBytes(pkt, pkt.tot_len, data.data());
+
+        if (m_send_filter && !m_send_filter(data)) {
+            m_packet_pool.push_back(std::move(data));
+            return AIpStack::IpErr::Success;
+        }
+
+        // The timer is set for the first packet in the queue. Packets arrive
+        // in the order they were sent since the delay is the same for all.
+        std::vector<Packet> &queue = m_peer->m_rx_queue;
+        queue.push_back(Packet{m_rx_timer.platform().getTime(), std::move(data)});
+        if (queue.size() == 1) {
+            m_peer->m_rx_timer.setAt(m_peer->deliver_time(queue.front()));
+        }
+
+        return AIpStack::IpErr::Success;
+    }
+
+    TimeType deliver_time (Packet const &packet) const
+    {
+        return packet.tx_time + m_rx_params.link_delay + m_rx_params.queue_delay;
+    }
+
+    void rxTimerHandler ()
+    {
+        // Take the packets which are due. Packets sent while processing go to
+        // the queue of the peer (which may be this host), they are due later.
+        TimeType now = m_rx_timer.platform().getTime();
+        auto due_end = m_rx_queue.begin();
+        while (due_end != m_rx_queue.end() &&
+               Platform::timeGreaterOrEqual(now, deliver_time(*due_end)))
+        {
+            m_rx_processing.push_back(std::move(*due_end));
+            ++due_end;
+        }
+        m_rx_queue.erase(m_rx_queue.begin(), due_end);
+
+        if (!m_rx_queue.empty()) {
+            m_rx_timer.setAt(deliver_time(m_rx_queue.front()));
+        }
+
+        if (m_use_batches) {
+            m_iface.beginRecvBatch();
+            m_num_batches++;
+        }
+        for (Packet &packet : m_rx_processing) {
+            AIpStack::IpBufNode node = {packet.data.data(), packet.data.size(), nullptr};
+            AIpStack::IpBufRef pkt = {&node, 0, packet.data.size()};
+
+            if (m_peer != nullptr) {
+                m_peer->m_iface.reportTxTimestamp(pkt, packet.tx_time);
+            }
+
+            AIpStack::IpRxTimestamp rx_time;
+            rx_time.valid = m_rx_params.timestamps;
+            rx_time.time = packet.tx_time + m_rx_params.link_delay;
+            m_iface.recvIp4Packet(pkt, AIpStack::IpChksumOffloadFlags(), nullptr, rx_time);
+            m_num_received++;
+        }
+        if (m_use_batches) {
+            m_iface.endRecvBatch();
+        }
+
+        // The buffers of packets from a host which is gone are freed.
+        if (m_peer != nullptr) {
+            for (Packet &packet : m_rx_processing) {
+                m_peer->m_packet_pool.push_back(std::move(packet.data));
+            }
+        }
+        m_rx_processing.clear();
+    }
+
+private:
+    Stack m_stack;
+    AIpStack::IpDriverIface<IpStackArg> m_iface;
+    typename Platform::Timer m_rx_timer;
+    std::size_t m_ip_mtu;
+    bool m_use_batches;
+    Host *m_peer = nullptr;
+    RxParams m_rx_params;
+    SendFilter m_send_filter;
+    std::vector<Packet> m_rx_queue;
+    std::vector<Packet> m_rx_processing;
+    std::vector<std::vector<char>> m_packet_pool;
+    std::uint64_t m_num_sent = 0;
+    std::uint64_t m_num_received = 0;
+    std::uint64_t m_num_batches = 0;
+};
+
+// Connection with a circular receive and send buffer of buf_size bytes each.
+// Received data is consumed right away and data to send is generated as the
+// send buffer frees up, up to the amount given to send. The send buffer holds
+// the byte pattern char(i % 251); with check_data, received data is checked
+// against this pattern, which requires that the peer uses the same buffer
+// size. Unexpected aborts terminate the program.
+//
+// Base is TcpConnection<TcpArg>, or TcpConnectionT<TcpArg, Derived> for
+// statically dispatched callbacks. Derived classes may override the callbacks
+// and call those of this class for the common handling.
+template<typename Base>
+class TestConnectionBase :
+    public Base
+{
+    friend Base;
+
+public:
+    TestConnectionBase (std::size_t buf_size, bool check_data = false) :
+        m_rx_buf(buf_size),
+        m_tx_buf(buf_size),
+        m_rx_node{m_rx_buf.data(), buf_size, &m_rx_node},
+        m_tx_node{m_tx_buf.data(), buf_size, &m_tx_node},
+        m_check_data(check_data)
+    {
+        for (std::size_t i = 0; i < buf_size; i++) {
+            m_tx_buf[i] = char(i % 251);
+        }
+    }
+
+    // Set the buffers after the connection has been started or accepted. The
+    // receive buffer may be limited to a smaller size.
+    void setupBuffers (std::size_t rcv_buf_size = std::size_t(-1))
+    {
+        m_rx_node.len = AIpStack::MinValue(rcv_buf_size, m_rx_buf.size());
+        m_rx_pos = 0;
+        m_received = 0;
+        m_eof = false;
+        m_send_remaining = 0;
+        m_close = false;
+        this->setRecvBuf(AIpStack::IpBufRef{&m_rx_node, 0, m_rx_node.len});
+        this->setSendBuf(AIpStack::IpBufRef{&m_tx_node, 0, 0});
+    }
+
+    // Send amount more bytes, then close sending if close is true.
+    void send (std::uint64_t amount, bool close = false)
+    {
+        m_send_remaining += amount;
+        m_close = close;
+        fill_send_buf();
+    }
+
+    std::uint64_t getReceived () const
+    {
+        return m_received;
+    }
+
+    bool getEof () const
+    {
+        return m_eof;
+    }
+
+    // Whether everything given to send has been sent and acknowledged.
+    bool allSent () const
+    {
+        return m_send_remaining == 0 && this->getSendBuf().tot_len == 0;
+    }
+
+protected:
+    void connectionAborted () override
+    {
+        std::fprintf(stderr, "Connection aborted.\n");
+        std::abort();
+    }
+
+    void dataReceived (std::size_t amount) override
+    {
+        if (amount == 0) {
+            m_eof = true;
+            return;
+        }
+
+        if (m_check_data) {
+            // The sender sends the pattern from the start of its circular
+            // buffer, which has the same size as ours, so positions correspond.
+            for (std::size_t i = 0; i < amount; i++) {
+                AIPSTACK_ASSERT_FORCE(m_rx_buf[m_rx_pos] == char(m_rx_pos % 251));
+                m_rx_pos = (m_rx_pos + 1) % m_rx_node.len;
+            }
+        }
+
+        m_received += amount;
+        this->extendRecvBuf(amount);
+    }
+
+    void dataSent (std::size_t) override
+    {
+        fill_send_buf();
+    }
+
+private:
+    void fill_send_buf ()
+    {
+        std::size_t space = m_tx_buf.size() - this->getSendBuf().tot_len;
+        std::size_t amount = std::size_t(
+            AIpStack::MinValue(m_send_remaining, std::uint64_t(space)));
+        if (amount > 0) {
+            this->extendSendBuf(amount);
+            m_send_remaining -= amount;
+            this->sendPush();
+        }
+        if (m_send_remaining == 0 && m_close && !this->wasSendingClosed()) {
+            this->closeSending();
+        }
+    }
+
+private:
+    std::vector<char> m_rx_buf;
+    std::vector<char> m_tx_buf;
+    AIpStack::IpBufNode m_rx_node;
+    AIpStack::IpBufNode m_tx_node;
+    bool m_check_data;
+    bool m_eof = false;
+    bool m_close = false;
+    std::size_t m_rx_pos = 0;
+    std::uint64_t m_received = 0;
+    std::uint64_t m_send_remaining = 0;
+};
+
+template<typename TcpArg>
+using TestConnection = TestConnectionBase<AIpStack::TcpConnection<TcpArg>>;
+
+}
+
+#endif
@@ -0,0 +1,236 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Tcp4Proto.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of connection handoff (TcpConnection::exportConnection and
+ * importConnection).
+ *
+ * A client and a server stack exchange data in both directions. In the middle
+ * of the transfer the server exports its connection and its stack is
+ * destroyed, packets to the server are dropped while it is absent. Then a new
+ * server stack is created which imports the connection, continuing with the
+ * same application buffers. The client must not notice anything except for
+ * retransmissions: the connection must not be aborted, no further SYN may be
+ * exchanged and all data must arrive intact in both directions.
+ */
+
+namespace aipstack_tcp_handoff_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using MyTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>,
+    IpTcpProtoOptions::EnableStats::Is<true>
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, MakeTypeList<MyTcpService>> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr double LinkDelaySec = 1e-3;
+constexpr Ip4Addr ClientAddr = Ip4Addr(10, 0, 0, 2);
+constexpr Ip4Addr ServerAddr = Ip4Addr(10, 0, 0, 1);
+constexpr double DowntimeSec = 50e-3;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t BufferSize = 64 * 1024;
+constexpr std::size_t TransferSize = 1024 * 1024;
+
+using Host = TcpFixture::Host<IpStackArg>;
+
+// The connections check the pattern of the received data.
+class TestConnection :
+    public TcpFixture::TestConnection<TcpArg>
+{
+public:
+    TestConnection () :
+        TcpFixture::TestConnection<TcpArg>(BufferSize, /*check_data=*/true)
+    {}
+};
+
+class Setup
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this))
+    {
+        m_client_host = make_host(ClientAddr);
+        start_server_host();
+
+        bool listen_res = m_listener.startListening(m_server_host->tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+        m_other.reset();
+        m_listener.reset();
+    }
+
+    void run ()
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = ServerAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(m_client_host->tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+
+        m_client.send(TransferSize);
+        m_server.send(TransferSize);
+
+        TcpFixture::runWhile(m_sim, [&] {
+            return m_server.getReceived() < TransferSize / 3;
+        });
+
+        // Export the server connection and remember its buffers.
+        TcpConnectionState state;
+        bool export_res = m_server.exportConnection(state);
+        AIPSTACK_ASSERT_FORCE(export_res);
+        AIPSTACK_ASSERT_FORCE(state.snd_wnd > 0 && state.rcv_ann_wnd > 0);
+        IpBufRef snd_buf = m_server.getSendBuf();
+        IpBufRef rcv_buf = m_server.getRecvBuf();
+        AIPSTACK_ASSERT_FORCE(rcv_buf.tot_len >= state.rcv_ann_wnd);
+
+        // A second export is not possible since the PCB is gone.
+        TcpConnectionState state2;
+        AIPSTACK_ASSERT_FORCE(!m_server.exportConnection(state2));
+        m_server.reset();
+
+        // Destroy the server stack and bring up a new one after a while.
+        // Packets to the server are lost while it is absent.
+        m_listener.reset();
+        m_client_host->setPeer(nullptr);
+        m_server_host.reset();
+        runFor(DowntimeSec);
+        start_server_host();
+
+        // Import the connection into the new stack.
+        err = m_server.importConnection(m_server_host->tcp(), state, snd_buf);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setRecvBuf(rcv_buf);
+
+        // Importing the same connection again must fail.
+        err = m_other.importConnection(m_server_host->tcp(), state, IpBufRef{});
+        AIPSTACK_ASSERT_FORCE(err == IpErr::AddrInUse);
+        AIPSTACK_ASSERT_FORCE(m_other.isInit());
+
+        TcpFixture::runWhile(m_sim, [&] {
+            return m_server.getReceived() < TransferSize ||
+                   m_client.getReceived() < TransferSize;
+        });
+
+        std::printf("handoff: transfer complete at %.3fs, %zu SYNs\n",
+                    double(m_platform.getTime()) / Platform::TimeFreq, m_num_syns);
+        AIPSTACK_ASSERT_FORCE(m_num_syns == 2);
+    }
+
+private:
+    std::unique_ptr<Host> make_host (Ip4Addr addr)
+    {
+        auto host = std::make_unique<Host>(m_platform, addr);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = TimeType(LinkDelaySec * Platform::TimeFreq);
+        host->setRxParams(rx_params);
+        host->setSendFilter(AIPSTACK_BIND_MEMBER_TN(&Setup::countSyns, this));
+        return host;
+    }
+
+    void start_server_host ()
+    {
+        m_server_host = make_host(ServerAddr);
+        m_server_host->setPeer(m_client_host.get());
+        m_client_host->setPeer(m_server_host.get());
+    }
+
+    void runFor (double secs)
+    {
+        TimeType end_time = m_platform.getTime() + TimeType(secs * Platform::TimeFreq);
+        TcpFixture::runWhile(m_sim, [&] {
+            return !Platform::timeGreaterOrEqual(m_platform.getTime(), end_time);
+        });
+    }
+
+    bool countSyns (std::vector<char> const &pkt)
+    {
+        std::size_t ihl = std::size_t(
+            (Ip4Header::get(pkt.data(), Ip4Header::VersionIhlDscpEcn()) >> 8) &
+            Ip4IhlMask) * 4;
+        std::uint16_t offset_flags = std::uint16_t(
+            Tcp4Header::get(pkt.data() + ihl, Tcp4Header::OffsetFlags()));
+        if ((offset_flags & std::uint16_t(Tcp4Flags::Syn)) != 0) {
+            m_num_syns++;
+        }
+        return true;
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_server_accepted);
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    std::unique_ptr<Host> m_client_host;
+    std::unique_ptr<Host> m_server_host;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_client;
+    TestConnection m_server;
+    TestConnection m_other;
+    bool m_server_accepted = false;
+    std::size_t m_num_syns = 0;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_handoff_test;
+
+    auto setup = std::make_unique<Setup>();
+    setup->run();
+
+    return 0;
+}
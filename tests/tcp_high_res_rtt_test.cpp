@@ -0,0 +1,216 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Tcp4Proto.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of high-resolution RTT measurement (HighResRtt) with a configurable
+ * minimum RTO (MinRtxTimeUs).
+ *
+ * A simulated link delivers packets back to the interface after 25us, so the
+ * RTT is about 50us. After a few exchanges to measure the RTT, a data segment
+ * with nothing after it is dropped so that only the retransmission timer can
+ * recover it. With the default configuration this takes at least the 250ms
+ * minimum RTO; with HighResRtt and a 500us minimum RTO it must take no more
+ * than a few milliseconds.
+ */
+
+namespace aipstack_tcp_high_res_rtt_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using DefaultTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>
+>;
+
+using DatacenterTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>,
+    IpTcpProtoOptions::HighResRtt::Is<true>,
+    IpTcpProtoOptions::MinRtxTimeUs::Is<500>,
+    IpTcpProtoOptions::InitialRtxTimeUs::Is<10000>,
+    IpTcpProtoOptions::TimeWaitTimeMs::Is<1000>
+>;
+
+constexpr double LinkDelaySec = 25e-6;
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t MessageSize = 100;
+constexpr int NumWarmupMessages = 20;
+constexpr std::size_t BufferSize = 4096;
+
+template<typename TcpService>
+class Setup
+{
+    class IpStackArg : public TcpFixture::StackService<>::template Compose<
+        PlatformImpl, MakeTypeList<TcpService>> {};
+    using MyIpStack = IpStack<IpStackArg>;
+    using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+    using Host = TcpFixture::Host<IpStackArg>;
+    using TestConnection = TcpFixture::TestConnection<TcpArg>;
+
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_host(m_platform, LocalAddr),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_client(BufferSize),
+        m_server(BufferSize)
+    {
+        // The packets go back to the same interface after the link delay.
+        m_host.setPeer(&m_host);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = TimeType(LinkDelaySec * Platform::TimeFreq);
+        m_host.setRxParams(rx_params);
+        m_host.setSendFilter(AIPSTACK_BIND_MEMBER_TN(&Setup::filterPacket, this));
+
+        bool listen_res = m_listener.startListening(m_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    // Returns the time in seconds to recover from the tail loss.
+    double run ()
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = LocalAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(m_host.tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+
+        // Exchange messages one at a time to measure the RTT.
+        std::uint64_t expected = 0;
+        for (int i = 0; i < NumWarmupMessages; i++) {
+            m_client.send(MessageSize);
+            expected += MessageSize;
+            TcpFixture::runWhile(m_sim, [&] {
+                return m_server.getReceived() < expected || !m_client.allSent();
+            });
+        }
+
+        // Drop the next message so that only the RTO can recover it.
+        m_drop_next_data = true;
+        TimeType start = m_platform.getTime();
+        m_client.send(MessageSize);
+        expected += MessageSize;
+        TcpFixture::runWhile(m_sim, [&] { return m_server.getReceived() < expected; });
+        AIPSTACK_ASSERT_FORCE(!m_drop_next_data);
+
+        return double(m_platform.getTime() - start) / Platform::TimeFreq;
+    }
+
+    TcpConnectionStats getClientStats () const
+    {
+        return m_client.getStats();
+    }
+
+private:
+    bool filterPacket (std::vector<char> const &pkt)
+    {
+        if (m_drop_next_data && has_tcp_data(pkt)) {
+            m_drop_next_data = false;
+            return false;
+        }
+        return true;
+    }
+
+    static bool has_tcp_data (std::vector<char> const &pkt)
+    {
+        std::size_t ihl = std::size_t(
+            (Ip4Header::get(pkt.data(), Ip4Header::VersionIhlDscpEcn()) >> 8) &
+            Ip4IhlMask) * 4;
+        std::size_t tcp_hdr_len = std::size_t(std::uint16_t(
+            Tcp4Header::get(pkt.data() + ihl, Tcp4Header::OffsetFlags())) >>
+            TcpOffsetShift) * 4;
+        return pkt.size() > ihl + tcp_hdr_len;
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_server_accepted);
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_host;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_client;
+    TestConnection m_server;
+    bool m_server_accepted = false;
+    bool m_drop_next_data = false;
+};
+
+template<typename TcpService>
+double test_config (char const *name, TcpConnectionStats &out_stats)
+{
+    auto setup = std::make_unique<Setup<TcpService>>();
+    double recovery = setup->run();
+    out_stats = setup->getClientStats();
+
+    std::printf("%s: srtt %uus, rto %uus, tail loss recovered in %.3fms\n", name,
+                unsigned(out_stats.srtt_us), unsigned(out_stats.rto_us), recovery * 1e3);
+    return recovery;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_high_res_rtt_test;
+
+    TcpConnectionStats stats;
+
+    double default_recovery = test_config<DefaultTcpService>("default", stats);
+    AIPSTACK_ASSERT_FORCE(default_recovery >= 0.25);
+
+    double dc_recovery = test_config<DatacenterTcpService>("high-res", stats);
+    AIPSTACK_ASSERT_FORCE(stats.rtt_valid);
+    AIPSTACK_ASSERT_FORCE(stats.srtt_us >= 40 && stats.srtt_us <= 200);
+    AIPSTACK_ASSERT_FORCE(stats.rto_us >= 480 && stats.rto_us <= 1000);
+    AIPSTACK_ASSERT_FORCE(dc_recovery < 0.005);
+
+    return 0;
+}
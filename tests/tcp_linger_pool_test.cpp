@@ -0,0 +1,422 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/utils/TcpLingerPool.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of TcpLingerPool.
+ *
+ * A server (in the same stack as the clients, over a link with a delay)
+ * answers a request with a response larger than the receive window of the
+ * client and closes the connection through the linger pool right away,
+ * overwriting its send buffer:
+ * - The client receives the whole response and the FIN, even though some
+ *   segments are dropped and retransmitted from the buffer of the pool.
+ * - A response larger than the buffer of an entry is rejected, and so is a
+ *   connection when all entries are in use.
+ * - Connections whose client stops reading are reset after the linger
+ *   timeout.
+ */
+
+namespace aipstack_tcp_linger_pool_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using MyIpStackService = TcpFixture::StackService<>;
+
+using MyTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<16>
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, MakeTypeList<MyTcpService>> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr std::size_t Mtu = 1500;
+constexpr double LinkDelaySec = 1e-3;
+constexpr double LingerTimeoutSec = 2.0;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t ClientBufferSize = 4096;
+constexpr std::size_t ServerBufferSize = 256;
+constexpr std::size_t LingerBufferSize = 65536;
+constexpr std::size_t ResponseSize = 60000;
+constexpr std::size_t LargeResponseSize = 100000;
+constexpr int NumEntries = 2;
+
+using LingerPoolTypes = TcpLingerPool<PlatformImpl, TcpArg, LingerBufferSize>;
+using LingerPool = LingerPoolTypes::LingerPool;
+using LingerEntry = LingerPoolTypes::LingerEntry;
+using LingerPoolParams = LingerPoolTypes::LingerPoolParams;
+
+char response_byte (std::size_t pos)
+{
+    return char(std::uint8_t(pos % 251));
+}
+
+// Server side: answers the request with a response and closes the
+// connection through the linger pool. If the pool rejects the connection,
+// it closes sending and waits until the response has been delivered.
+class ServerConnection :
+    public TcpConnection<TcpArg>
+{
+public:
+    ServerConnection (LingerPool &pool, std::size_t response_size) :
+        m_pool(pool),
+        m_response_size(response_size),
+        m_tx_buf(response_size),
+        m_rx_node{m_rx_buf, ServerBufferSize, &m_rx_node},
+        m_tx_node{m_tx_buf.data(), response_size, nullptr}
+    {}
+
+    void setupBuffers ()
+    {
+        setRecvBuf(IpBufRef{&m_rx_node, 0, ServerBufferSize});
+    }
+
+    bool wasLingered () const
+    {
+        return m_lingered;
+    }
+
+private:
+    void connectionAborted () override final
+    {}
+
+    void dataReceived (std::size_t amount) override final
+    {
+        if (amount == 0 || m_responded) {
+            return;
+        }
+        m_responded = true;
+
+        for (std::size_t i = 0; i < m_response_size; i++) {
+            m_tx_buf[i] = response_byte(i);
+        }
+        setSendBuf(IpBufRef{&m_tx_node, 0, m_response_size});
+
+        if (m_pool.closeConnection(*this)) {
+            AIPSTACK_ASSERT_FORCE(isInit());
+            m_lingered = true;
+
+            // The buffers are free for reuse right away.
+            std::memset(m_tx_buf.data(), 0xEE, m_response_size);
+        } else {
+            closeSending();
+        }
+    }
+
+    void dataSent (std::size_t) override final
+    {
+        if (getSendBuf().tot_len == 0 && wasSendingClosed()) {
+            reset();
+        }
+    }
+
+private:
+    LingerPool &m_pool;
+    std::size_t m_response_size;
+    bool m_responded = false;
+    bool m_lingered = false;
+    std::vector<char> m_tx_buf;
+    char m_rx_buf[ServerBufferSize];
+    IpBufNode m_rx_node;
+    IpBufNode m_tx_node;
+};
+
+// Client side: sends a request and checks the response, or stops reading
+// after the first data.
+class ClientConnection :
+    public TcpConnection<TcpArg>
+{
+public:
+    ClientConnection (bool reading) :
+        m_reading(reading),
+        m_rx_node{m_rx_buf, ClientBufferSize, &m_rx_node},
+        m_tx_node{m_tx_buf, 1, nullptr}
+    {}
+
+    void start (TcpApi<TcpArg> &tcp)
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = LocalAddr;
+        args.port = ServerPort;
+        args.rcv_wnd = ClientBufferSize;
+        args.snd_buf = IpBufRef{&m_tx_node, 0, 1};
+
+        IpErr err = startConnection(tcp, args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        setRecvBuf(IpBufRef{&m_rx_node, 0, ClientBufferSize});
+    }
+
+    std::size_t received () const
+    {
+        return m_received;
+    }
+
+    bool endReceived () const
+    {
+        return m_end_received;
+    }
+
+    bool wasAborted () const
+    {
+        return m_aborted;
+    }
+
+private:
+    void connectionAborted () override final
+    {
+        m_aborted = true;
+    }
+
+    void dataReceived (std::size_t amount) override final
+    {
+        if (amount == 0) {
+            m_end_received = true;
+            return;
+        }
+
+        for (std::size_t i = 0; i < amount; i++) {
+            std::size_t pos = m_received + i;
+            char ch = m_rx_buf[pos % ClientBufferSize];
+            AIPSTACK_ASSERT_FORCE(ch == response_byte(pos));
+        }
+        m_received += amount;
+
+        if (m_reading) {
+            extendRecvBuf(amount);
+        }
+    }
+
+    void dataSent (std::size_t) override final
+    {}
+
+private:
+    bool m_reading;
+    std::size_t m_received = 0;
+    bool m_end_received = false;
+    bool m_aborted = false;
+    char m_rx_buf[ClientBufferSize];
+    char m_tx_buf[1] = {'R'};
+    IpBufNode m_rx_node;
+    IpBufNode m_tx_node;
+};
+
+using Host = TcpFixture::Host<IpStackArg>;
+
+class Setup
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_host(m_platform, LocalAddr, Mtu),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_pool(m_platform)
+    {
+        // The packets go back to the same interface after the link delay.
+        m_host.setPeer(&m_host);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = TimeType(LinkDelaySec * Platform::TimeFreq);
+        m_host.setRxParams(rx_params);
+        m_host.setSendFilter(AIPSTACK_BIND_MEMBER_TN(&Setup::filterPacket, this));
+
+        bool listen_res = m_listener.startListening(m_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 8
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(ServerBufferSize);
+
+        LingerPoolParams params;
+        params.num_entries = NumEntries;
+        params.entries = m_entries;
+        params.linger_timeout = TimeType(LingerTimeoutSec * Platform::TimeFreq);
+        m_pool.start(params);
+    }
+
+    ~Setup ()
+    {
+        m_clients.clear();
+        m_servers.clear();
+        m_pool.reset();
+    }
+
+    LingerPool & pool ()
+    {
+        return m_pool;
+    }
+
+    ServerConnection & server (std::size_t index)
+    {
+        return *m_servers.at(index);
+    }
+
+    // Drop one of every 20 segments with data, up to the given number.
+    void setDrops (int num_drops)
+    {
+        m_drops_left = num_drops;
+    }
+
+    int numDropped () const
+    {
+        return m_num_dropped;
+    }
+
+    ClientConnection & startClient (bool reading, std::size_t response_size)
+    {
+        m_response_size = response_size;
+        m_clients.push_back(std::make_unique<ClientConnection>(reading));
+        m_clients.back()->start(m_host.tcp());
+        return *m_clients.back();
+    }
+
+    void runFor (double seconds)
+    {
+        TimeType end_time = m_platform.getTime() + TimeType(seconds * Platform::TimeFreq);
+        while (!Platform::timeGreaterOrEqual(m_platform.getTime(), end_time)) {
+            if (!m_sim.runOne()) {
+                break;
+            }
+        }
+    }
+
+private:
+    bool filterPacket (std::vector<char> const &pkt)
+    {
+        // Only the responses fill segments.
+        if (m_drops_left > 0 && pkt.size() > Mtu / 2 && ++m_data_count % 20 == 0) {
+            m_drops_left--;
+            m_num_dropped++;
+            return false;
+        }
+        return true;
+    }
+
+    void connectionEstablished ()
+    {
+        auto server = std::make_unique<ServerConnection>(m_pool, m_response_size);
+        IpErr err = server->acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        server->setupBuffers();
+        m_servers.push_back(std::move(server));
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_host;
+    TcpListener<TcpArg> m_listener;
+    LingerEntry m_entries[NumEntries];
+    LingerPool m_pool;
+    std::vector<std::unique_ptr<ServerConnection>> m_servers;
+    std::vector<std::unique_ptr<ClientConnection>> m_clients;
+    std::size_t m_response_size = 0;
+    int m_drops_left = 0;
+    int m_num_dropped = 0;
+    std::size_t m_data_count = 0;
+};
+
+void test_delivery ()
+{
+    auto setup = std::make_unique<Setup>();
+    setup->setDrops(5);
+
+    // The response is delivered from the pool, including retransmissions.
+    ClientConnection &client = setup->startClient(true, ResponseSize);
+    setup->runFor(5.0);
+    AIPSTACK_ASSERT_FORCE(setup->server(0).wasLingered());
+    AIPSTACK_ASSERT_FORCE(setup->numDropped() > 0);
+    AIPSTACK_ASSERT_FORCE(client.received() == ResponseSize);
+    AIPSTACK_ASSERT_FORCE(client.endReceived() && !client.wasAborted());
+
+    auto stats = setup->pool().getStats();
+    AIPSTACK_ASSERT_FORCE(stats.lingered == 1 && stats.completed == 1);
+    AIPSTACK_ASSERT_FORCE(setup->pool().numLingering() == 0);
+
+    // A response which does not fit into an entry is rejected and delivered
+    // by the server itself.
+    ClientConnection &large_client = setup->startClient(true, LargeResponseSize);
+    setup->runFor(5.0);
+    AIPSTACK_ASSERT_FORCE(!setup->server(1).wasLingered());
+    AIPSTACK_ASSERT_FORCE(large_client.received() == LargeResponseSize);
+    AIPSTACK_ASSERT_FORCE(large_client.endReceived());
+
+    stats = setup->pool().getStats();
+    AIPSTACK_ASSERT_FORCE(stats.rejected == 1 && stats.lingered == 1);
+
+    std::printf("delivery: dropped %d, lingered %u, completed %u, rejected %u\n",
+                setup->numDropped(), unsigned(stats.lingered),
+                unsigned(stats.completed), unsigned(stats.rejected));
+}
+
+void test_timeout ()
+{
+    auto setup = std::make_unique<Setup>();
+
+    // The clients stop reading, so the responses remain in the entries until
+    // they are reset. The third connection finds no free entry.
+    ClientConnection *clients[NumEntries + 1];
+    for (int i = 0; i < NumEntries + 1; i++) {
+        clients[i] = &setup->startClient(false, ResponseSize);
+        setup->runFor(0.1);
+    }
+
+    auto stats = setup->pool().getStats();
+    AIPSTACK_ASSERT_FORCE(stats.lingered == NumEntries && stats.rejected == 1);
+    AIPSTACK_ASSERT_FORCE(setup->pool().numLingering() == NumEntries);
+
+    setup->runFor(LingerTimeoutSec);
+    stats = setup->pool().getStats();
+    AIPSTACK_ASSERT_FORCE(stats.timed_out == NumEntries && stats.completed == 0);
+    AIPSTACK_ASSERT_FORCE(setup->pool().numLingering() == 0);
+
+    for (int i = 0; i < NumEntries; i++) {
+        AIPSTACK_ASSERT_FORCE(clients[i]->wasAborted());
+        AIPSTACK_ASSERT_FORCE(clients[i]->received() == ClientBufferSize);
+    }
+    AIPSTACK_ASSERT_FORCE(!clients[NumEntries]->wasAborted());
+
+    std::printf("timeout: lingered %u, timed out %u, rejected %u\n",
+                unsigned(stats.lingered), unsigned(stats.timed_out),
+                unsigned(stats.rejected));
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_linger_pool_test;
+
+    test_delivery();
+    test_timeout();
+
+    return 0;
+}
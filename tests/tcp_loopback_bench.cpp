@@ -0,0 +1,378 @@
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "alloc_guard.h"
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Throughput and latency benchmark of the TCP implementation.
+ *
+ * Two stacks are connected back to back (TcpFixture::Host in tcp_fixture.h),
+ * sent packets are copied into a queue of the other stack, from which they are
+ * delivered in a receive batch from a timer. Time is simulated using
+ * SimPlatformImpl, so the results reflect only the CPU cost of the stacks
+ * (and of copying packets), not of any I/O or event loop.
+ *
+ * For each combination of MSS, receive window and send buffer size, two tests
+ * are run:
+ * - bulk: the given number of connections transfer the given amount of data
+ *   in total, in one direction.
+ * - rr: a single connection does request/response transactions of RrMsgSize
+ *   bytes each way, one at a time.
+ *
+ * Output is JSON on stdout, an array with one object per case:
+ * - bulk: "bytes", "packets", "wall_ns", "gbps" (based on wall time) and
+ *   "cpu_ns_per_byte" (based on process CPU time).
+ * - rr: "transactions", "p50_ns", "p99_ns" and "mean_ns" (wall time of
+ *   transactions) and "cpu_ns_per_transaction".
+ *
+ * Optional arguments are the number of MiB transferred per bulk case (default
+ * 64), the number of bulk connections (default 4) and, if the third argument
+ * is 1, checking that the stacks do not allocate memory. Allocation is then
+ * forbidden (alloc_guard.h) after a warm-up in each case: the first quarter of
+ * the data in bulk cases and the first 100 transactions in rr cases.
+ */
+
+namespace aipstack_tcp_loopback_bench {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::NumTcpPcbs::Is<64>,
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+using Host = TcpFixture::Host<IpStackArg>;
+using BenchConnection = TcpFixture::TestConnection<TcpArg>;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr Ip4Addr ClientAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr ServerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr std::uint16_t ServerPort = 5001;
+
+// IP and TCP header size without options, the MTU is MSS plus this.
+constexpr std::size_t IpTcpHeaderSize = 40;
+
+constexpr std::size_t RrMsgSize = 64;
+constexpr std::size_t RrTransactions = 10000;
+constexpr std::size_t RrWarmupTransactions = 100;
+
+std::size_t const bench_msss[] = {536, 1460, 8960};
+
+std::size_t const bench_windows[] = {16384, 65536, 262144};
+
+std::size_t const bench_buffers[] = {16384, 65536, 262144};
+
+struct BenchParams {
+    std::size_t mss;
+    std::size_t window;
+    std::size_t buffer;
+};
+
+// Whether to forbid allocation after the warm-up of each case.
+bool check_alloc = false;
+
+std::uint64_t cpu_time_ns ()
+{
+    return std::uint64_t(std::clock()) * (1000000000 / CLOCKS_PER_SEC);
+}
+
+// Both stacks and the connections between them.
+class Setup :
+    private NonCopyable<Setup>
+{
+public:
+    Setup (BenchParams const &params, std::size_t num_connections) :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_client(m_platform, ClientAddr, params.mss + IpTcpHeaderSize),
+        m_server(m_platform, ServerAddr, params.mss + IpTcpHeaderSize),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_params(params)
+    {
+        m_client.setPeer(&m_server);
+        m_server.setPeer(&m_client);
+
+        if (check_alloc) {
+            // Each connection has at most a window of data segments and as
+            // many ACKs in flight, the window grows up to the buffer size.
+            std::size_t max_window = std::max(params.window, params.buffer);
+            std::size_t max_packets = num_connections *
+                (2 * (max_window / params.mss + 1) + 8);
+            m_client.reserveBuffers(max_packets);
+            m_server.reserveBuffers(max_packets);
+        }
+
+        bool listen_res = m_listener.startListening(m_server.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ int(num_connections)
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(params.window);
+
+        for (std::size_t i = 0; i < num_connections; i++) {
+            auto con = std::make_unique<BenchConnection>(params.buffer);
+
+            TcpStartConnectionArgs<TcpArg> args;
+            args.addr = ServerAddr;
+            args.port = ServerPort;
+            args.rcv_wnd = params.window;
+            IpErr err = con->startConnection(m_client.tcp(), args);
+            AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+            con->setupBuffers();
+
+            m_client_cons.push_back(std::move(con));
+        }
+
+        runWhile([&] { return m_server_cons.size() < num_connections; });
+    }
+
+    ~Setup ()
+    {
+        for (auto &con : m_client_cons) {
+            con->reset();
+        }
+        for (auto &con : m_server_cons) {
+            con->reset();
+        }
+    }
+
+    template<typename Cond>
+    void runWhile (Cond cond)
+    {
+        TcpFixture::runWhile(m_sim, cond);
+    }
+
+    std::uint64_t getNumPackets () const
+    {
+        return m_client.getNumSent() + m_server.getNumSent();
+    }
+
+    BenchConnection & clientCon (std::size_t i)
+    {
+        return *m_client_cons[i];
+    }
+
+    BenchConnection & serverCon (std::size_t i)
+    {
+        return *m_server_cons[i];
+    }
+
+private:
+    void connectionEstablished ()
+    {
+        auto con = std::make_unique<BenchConnection>(m_params.buffer);
+        IpErr err = con->acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        con->setupBuffers();
+        m_server_cons.push_back(std::move(con));
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_client;
+    Host m_server;
+    TcpListener<TcpArg> m_listener;
+    BenchParams m_params;
+    std::vector<std::unique_ptr<BenchConnection>> m_client_cons;
+    std::vector<std::unique_ptr<BenchConnection>> m_server_cons;
+};
+
+bool first_case = true;
+
+void print_case_start (char const *test, BenchParams const &params)
+{
+    std::printf("%s\n  {\"test\": \"%s\", \"mss\": %zu, \"window\": %zu, \"buffer\": %zu",
+                first_case ? "" : ",", test, params.mss, params.window, params.buffer);
+    first_case = false;
+}
+
+void run_bulk (BenchParams const &params, std::size_t num_connections,
+               std::uint64_t total_bytes)
+{
+    Setup setup(params, num_connections);
+
+    std::uint64_t per_con = total_bytes / num_connections;
+    std::uint64_t start_packets = setup.getNumPackets();
+
+    auto start_time = Clock::now();
+    std::uint64_t start_cpu = cpu_time_ns();
+
+    for (std::size_t i = 0; i < num_connections; i++) {
+        setup.clientCon(i).send(per_con, /*close=*/true);
+    }
+
+    std::optional<AllocGuard::Scope> no_alloc;
+    if (check_alloc) {
+        setup.runWhile([&] {
+            for (std::size_t i = 0; i < num_connections; i++) {
+                if (setup.serverCon(i).getReceived() < per_con / 4) {
+                    return true;
+                }
+            }
+            return false;
+        });
+        no_alloc.emplace();
+    }
+
+    setup.runWhile([&] {
+        for (std::size_t i = 0; i < num_connections; i++) {
+            if (!setup.serverCon(i).getEof()) {
+                return true;
+            }
+        }
+        return false;
+    });
+
+    no_alloc.reset();
+
+    std::uint64_t cpu_ns = cpu_time_ns() - start_cpu;
+    auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start_time).count();
+
+    std::uint64_t bytes = 0;
+    for (std::size_t i = 0; i < num_connections; i++) {
+        bytes += setup.serverCon(i).getReceived();
+    }
+    AIPSTACK_ASSERT_FORCE(bytes == per_con * num_connections);
+
+    print_case_start("bulk", params);
+    std::printf(", \"connections\": %zu, \"bytes\": %llu, \"packets\": %llu"
+                ", \"wall_ns\": %lld, \"gbps\": %.3f, \"cpu_ns_per_byte\": %.4f}",
+                num_connections, static_cast<unsigned long long>(bytes),
+                static_cast<unsigned long long>(setup.getNumPackets() - start_packets),
+                static_cast<long long>(wall_ns),
+                (wall_ns > 0) ? double(bytes) * 8.0 / double(wall_ns) : 0.0,
+                double(cpu_ns) / double(bytes));
+}
+
+void run_rr (BenchParams const &params)
+{
+    Setup setup(params, 1);
+
+    BenchConnection &client = setup.clientCon(0);
+    BenchConnection &server = setup.serverCon(0);
+
+    std::vector<std::uint64_t> latencies;
+    latencies.reserve(RrTransactions);
+
+    std::uint64_t start_cpu = cpu_time_ns();
+
+    std::optional<AllocGuard::Scope> no_alloc;
+
+    for (std::size_t i = 0; i < RrTransactions; i++) {
+        if (check_alloc && i == RrWarmupTransactions) {
+            no_alloc.emplace();
+        }
+
+        std::uint64_t expected = std::uint64_t(i + 1) * RrMsgSize;
+
+        auto start_time = Clock::now();
+
+        client.send(RrMsgSize, /*close=*/false);
+        setup.runWhile([&] { return server.getReceived() < expected; });
+        server.send(RrMsgSize, /*close=*/false);
+        setup.runWhile([&] { return client.getReceived() < expected; });
+
+        latencies.push_back(std::uint64_t(std::chrono::duration_cast<
+            std::chrono::nanoseconds>(Clock::now() - start_time).count()));
+    }
+
+    no_alloc.reset();
+
+    std::uint64_t cpu_ns = cpu_time_ns() - start_cpu;
+
+    std::uint64_t sum = 0;
+    for (std::uint64_t latency : latencies) {
+        sum += latency;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    print_case_start("rr", params);
+    std::printf(", \"transactions\": %zu, \"p50_ns\": %llu, \"p99_ns\": %llu"
+                ", \"mean_ns\": %.1f, \"cpu_ns_per_transaction\": %.1f}",
+                RrTransactions,
+                static_cast<unsigned long long>(latencies[RrTransactions / 2]),
+                static_cast<unsigned long long>(latencies[RrTransactions * 99 / 100]),
+                double(sum) / double(RrTransactions),
+                double(cpu_ns) / double(RrTransactions));
+}
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_tcp_loopback_bench;
+
+    std::uint64_t bytes_per_case = std::uint64_t(64) << 20;
+    if (argc > 1) {
+        long mib = std::atol(argv[1]);
+        AIPSTACK_ASSERT_FORCE(mib > 0);
+        bytes_per_case = std::uint64_t(mib) << 20;
+    }
+
+    std::size_t num_connections = 4;
+    if (argc > 2) {
+        long num = std::atol(argv[2]);
+        AIPSTACK_ASSERT_FORCE(num > 0 && num <= 32);
+        num_connections = std::size_t(num);
+    }
+
+    if (argc > 3) {
+        check_alloc = std::atoi(argv[3]) == 1;
+    }
+
+    std::printf("[");
+
+    for (std::size_t mss : bench_msss) {
+        for (std::size_t window : bench_windows) {
+            for (std::size_t buffer : bench_buffers) {
+                BenchParams params = {mss, window, buffer};
+                run_bulk(params, num_connections, bytes_per_case);
+                run_rr(params);
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    std::printf("\n]\n");
+
+    return 0;
+}
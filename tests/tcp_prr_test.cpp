@@ -0,0 +1,318 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Tcp4Proto.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of Proportional Rate Reduction (EnablePrr) in fast recovery.
+ *
+ * A client sends bulk data to a server over a simulated bottleneck link.
+ * Several data segments from one window are dropped, so that the client goes
+ * through fast recovery with multiple partial ACKs. For every packet delivered
+ * to the client while it is in recovery, the number of data segments which
+ * the client sends in response is recorded. Without PRR, cwnd is first
+ * inflated from ssthresh, so the client stops sending for about half a window
+ * of ACKs. With PRR (with and without SACK) sending must stay ACK-clocked:
+ * no long runs of ACKs without sending and no bursts, and recovery must
+ * complete without a retransmission timeout.
+ */
+
+namespace aipstack_tcp_prr_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using ClassicTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>,
+    IpTcpProtoOptions::EnableStats::Is<true>
+>;
+
+using PrrTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>,
+    IpTcpProtoOptions::EnableStats::Is<true>,
+    IpTcpProtoOptions::EnablePrr::Is<true>
+>;
+
+using PrrNoSackTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>,
+    IpTcpProtoOptions::EnableStats::Is<true>,
+    IpTcpProtoOptions::EnablePrr::Is<true>,
+    IpTcpProtoOptions::NumSackBlocks::Is<0>
+>;
+
+constexpr std::size_t Mtu = 1500;
+constexpr double LinkDelaySec = 1e-3;
+constexpr double LinkBytesPerSec = 12.5e6;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t BufferSize = 1024 * 1024;
+constexpr std::size_t TransferSize = 4 * 1024 * 1024;
+
+// Indices of data segments sent by the client which are dropped.
+constexpr std::size_t DropSegs[] = {100, 103, 106, 109};
+
+template<typename TcpService>
+class Setup
+{
+    class IpStackArg : public TcpFixture::StackService<>::template Compose<
+        PlatformImpl, MakeTypeList<TcpService>> {};
+    using MyIpStack = IpStack<IpStackArg>;
+    using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+    using TestConnection = TcpFixture::TestConnection<TcpArg>;
+
+public:
+    struct Result {
+        double time;
+        std::size_t max_burst;
+        std::size_t max_idle_acks;
+        TcpConnectionCounters counters;
+    };
+
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_stack(m_platform),
+        m_driver_iface(&m_stack, make_params()),
+        m_link_timer(m_platform, AIPSTACK_BIND_MEMBER_TN(&Setup::linkTimerHandler, this)),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_client(BufferSize),
+        m_server(BufferSize)
+    {
+        m_driver_iface.iface().setIp4Addr(
+            IpIfaceIp4AddrSetting(24, Ip4Addr(10, 0, 0, 1)));
+
+        bool listen_res = m_listener.startListening(tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    Result run ()
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = Ip4Addr(10, 0, 0, 1);
+        args.port = ServerPort;
+        args.rcv_wnd = BufferSize;
+        IpErr err = m_client.startConnection(tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+
+        TimeType start = m_platform.getTime();
+        m_client.send(TransferSize);
+        TcpFixture::runWhile(m_sim, [&] { return m_server.getReceived() < TransferSize; });
+
+        Result res;
+        res.time = double(m_platform.getTime() - start) / Platform::TimeFreq;
+        res.max_burst = m_max_burst;
+        res.max_idle_acks = m_max_idle_acks;
+        res.counters = m_client.getStats().counters;
+        return res;
+    }
+
+private:
+    TcpApi<TcpArg> & tcp ()
+    {
+        return m_stack.template getProtoApi<TcpApi>();
+    }
+
+    IpIfaceDriverParams make_params ()
+    {
+        IpIfaceDriverParams params;
+        params.ip_mtu = Mtu;
+        params.send_ip4_packet = AIPSTACK_BIND_MEMBER_TN(&Setup::driverSendIp4Packet, this);
+        params.get_state = TcpFixture::linkUpState;
+        return params;
+    }
+
+    IpErr driverSendIp4Packet (IpBufRef pkt, Ip4Addr, IpSendRetryRequest *)
+    {
+        std::vector<char> data(pkt.tot_len);
+        ipBufTakeBytes(pkt, pkt.tot_len, data.data());
+
+        TimeType now = m_platform.getTime();
+        TimeType time;
+
+        if (is_client_data(data)) {
+            std::size_t index = m_client_data_segs++;
+            m_burst++;
+
+            for (std::size_t drop_index : DropSegs) {
+                if (index == drop_index) {
+                    return IpErr::Success;
+                }
+            }
+
+            // Data from the client goes through the bottleneck.
+            TimeType tx_time = TimeType(data.size() / LinkBytesPerSec * Platform::TimeFreq);
+            if (Platform::timeGreaterOrEqual(now, m_bottleneck_free)) {
+                m_bottleneck_free = now;
+            }
+            m_bottleneck_free += tx_time;
+            time = m_bottleneck_free;
+        } else {
+            time = now;
+        }
+        time += TimeType(LinkDelaySec * Platform::TimeFreq);
+
+        m_link_queue.emplace(time, std::move(data));
+        m_link_timer.setAt(m_link_queue.begin()->first);
+        return IpErr::Success;
+    }
+
+    static std::size_t ip_header_len (std::vector<char> &pkt)
+    {
+        auto ip4_header = Ip4Header::MakeRef(pkt.data());
+        return std::size_t(
+            (ip4_header.get(Ip4Header::VersionIhlDscpEcn()) >> 8) & Ip4IhlMask) * 4;
+    }
+
+    static bool is_to_server (std::vector<char> &pkt)
+    {
+        auto tcp_header = Tcp4Header::MakeRef(pkt.data() + ip_header_len(pkt));
+        return tcp_header.get(Tcp4Header::DstPort()) == ServerPort;
+    }
+
+    static bool is_client_data (std::vector<char> &pkt)
+    {
+        std::size_t ihl = ip_header_len(pkt);
+        auto tcp_header = Tcp4Header::MakeRef(pkt.data() + ihl);
+        std::size_t tcp_hdr_len = std::size_t(
+            std::uint16_t(tcp_header.get(Tcp4Header::OffsetFlags())) >> TcpOffsetShift) * 4;
+        return is_to_server(pkt) && pkt.size() > ihl + tcp_hdr_len;
+    }
+
+    void linkTimerHandler ()
+    {
+        TimeType now = m_platform.getTime();
+        while (!m_link_queue.empty() &&
+               Platform::timeGreaterOrEqual(now, m_link_queue.begin()->first))
+        {
+            std::vector<char> data = std::move(m_link_queue.begin()->second);
+            m_link_queue.erase(m_link_queue.begin());
+
+            // Count the client data segments sent in response to this packet
+            // if it is for the client and the client is in recovery.
+            bool in_recovery = !is_to_server(data) && m_server_accepted &&
+                m_client.getStats().in_recovery;
+            m_burst = 0;
+
+            IpBufNode node = {data.data(), data.size(), nullptr};
+            m_driver_iface.recvIp4Packet(IpBufRef{&node, 0, data.size()});
+
+            if (in_recovery) {
+                m_max_burst = MaxValue(m_max_burst, m_burst);
+                m_idle_acks = (m_burst == 0) ? m_idle_acks + 1 : 0;
+                m_max_idle_acks = MaxValue(m_max_idle_acks, m_idle_acks);
+            }
+        }
+
+        if (!m_link_queue.empty()) {
+            m_link_timer.setAt(m_link_queue.begin()->first);
+        }
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_server_accepted);
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    MyIpStack m_stack;
+    IpDriverIface<IpStackArg> m_driver_iface;
+    typename Platform::Timer m_link_timer;
+    std::multimap<TimeType, std::vector<char>> m_link_queue;
+    TimeType m_bottleneck_free = 0;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_client;
+    TestConnection m_server;
+    bool m_server_accepted = false;
+    std::size_t m_client_data_segs = 0;
+    std::size_t m_burst = 0;
+    std::size_t m_max_burst = 0;
+    std::size_t m_idle_acks = 0;
+    std::size_t m_max_idle_acks = 0;
+};
+
+template<typename TcpService>
+typename Setup<TcpService>::Result test_config (char const *name)
+{
+    auto setup = std::make_unique<Setup<TcpService>>();
+    auto res = setup->run();
+
+    std::printf("%s: %.3fms, fast recoveries %u, rtos %u, rtx segs %u, "
+                "in recovery: max segments per ACK %u, max ACKs without sending %u\n",
+                name, res.time * 1e3, unsigned(res.counters.fast_recoveries),
+                unsigned(res.counters.rto_expired), unsigned(res.counters.rtx_segs),
+                unsigned(res.max_burst), unsigned(res.max_idle_acks));
+
+    AIPSTACK_ASSERT_FORCE(res.counters.fast_recoveries >= 1);
+    return res;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_prr_test;
+
+    auto classic = test_config<ClassicTcpService>("classic");
+
+    auto prr = test_config<PrrTcpService>("prr");
+    AIPSTACK_ASSERT_FORCE(prr.counters.rto_expired == 0);
+    AIPSTACK_ASSERT_FORCE(prr.max_burst <= 2);
+    AIPSTACK_ASSERT_FORCE(prr.max_idle_acks <= 2);
+    AIPSTACK_ASSERT_FORCE(prr.max_idle_acks < classic.max_idle_acks);
+
+    auto prr_no_sack = test_config<PrrNoSackTcpService>("prr without SACK");
+    AIPSTACK_ASSERT_FORCE(prr_no_sack.counters.rto_expired == 0);
+    AIPSTACK_ASSERT_FORCE(prr_no_sack.max_burst <= 2);
+    AIPSTACK_ASSERT_FORCE(prr_no_sack.max_idle_acks <= 2);
+
+    return 0;
+}
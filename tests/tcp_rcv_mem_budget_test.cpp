@@ -0,0 +1,227 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpLoopbackIface.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of the stack-wide receive memory budget (RcvMemBudget).
+ *
+ * Several connections over the loopback interface transfer data at the same
+ * time to server connections whose receive buffers together are much larger
+ * than the budget. The sum of the announced receive windows must not exceed
+ * the budget (apart from the windows of SYN segments), the pressure callback must report entering and leaving pressure,
+ * and all transfers must still complete.
+ */
+
+namespace aipstack_tcp_rcv_mem_budget_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+constexpr std::size_t RcvMemBudget = 65536;
+constexpr std::uint8_t RcvMemPressurePercent = 75;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::NumTcpPcbs::Is<32>,
+        IpTcpProtoOptions::RcvMemBudget::Is<RcvMemBudget>,
+        IpTcpProtoOptions::RcvMemPressurePercent::Is<RcvMemPressurePercent>
+    >
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using MyLoopbackService = IpLoopbackIfaceService<
+    IpLoopbackIfaceOptions::QueueBytes::Is<3 * 65536>
+>;
+class LoopbackArg : public MyLoopbackService::template Compose<
+    PlatformImpl, IpStackArg> {};
+using MyLoopbackIface = IpLoopbackIface<LoopbackArg>;
+
+using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t NumConnections = 8;
+constexpr std::size_t TransferBytes = 300000;
+constexpr std::size_t BufferSize = 65536;
+constexpr std::size_t ClientBufferSize = 1024;
+constexpr std::size_t ListenerRcvWnd = 2048;
+constexpr std::size_t SynWindowsBytes = NumConnections * ListenerRcvWnd;
+
+// Connection which checks the received byte pattern. The receive buffers of
+// the clients are limited to ClientBufferSize, they only send.
+class TestConnection :
+    public TcpFixture::TestConnection<TcpArg>
+{
+public:
+    TestConnection () :
+        TcpFixture::TestConnection<TcpArg>(BufferSize, /*check_data=*/true)
+    {}
+};
+
+class Setup
+{
+public:
+    Setup () :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_stack(m_platform),
+        m_loopback(m_platform, &m_stack),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this))
+    {
+        bool listen_res = m_listener.startListening(tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ int(NumConnections)
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(ListenerRcvWnd);
+
+        tcp().setRcvMemPressureHandler(
+            AIPSTACK_BIND_MEMBER_TN(&Setup::pressureChanged, this));
+    }
+
+    ~Setup ()
+    {
+        for (std::size_t i = 0; i < NumConnections; i++) {
+            m_clients[i].reset();
+            m_servers[i].reset();
+        }
+    }
+
+    void run ()
+    {
+        for (std::size_t i = 0; i < NumConnections; i++) {
+            TcpStartConnectionArgs<TcpArg> args;
+            args.addr = Ip4Addr(127, 0, 0, 1);
+            args.port = ServerPort;
+            args.rcv_wnd = ClientBufferSize;
+            IpErr err = m_clients[i].startConnection(tcp(), args);
+            AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+            m_clients[i].setupBuffers(ClientBufferSize);
+        }
+
+        runWhile([&] { return m_num_servers < NumConnections; });
+
+        for (TestConnection &client : m_clients) {
+            client.send(TransferBytes);
+        }
+        runWhile([&] {
+            for (TestConnection &server : m_servers) {
+                if (server.getReceived() < TransferBytes) {
+                    return true;
+                }
+            }
+            return false;
+        });
+
+        // Without the budget, the windows of the servers alone would have
+        // grown to NumConnections * BufferSize. The windows of SYN
+        // segments are announced regardless of the budget.
+        AIPSTACK_ASSERT_FORCE(m_peak_usage <= RcvMemBudget + SynWindowsBytes);
+        AIPSTACK_ASSERT_FORCE(m_peak_usage >= RcvMemBudget / 100 * RcvMemPressurePercent);
+        AIPSTACK_ASSERT_FORCE(m_pressure_events >= 1);
+        AIPSTACK_ASSERT_FORCE(m_pressure);
+
+        // Closing the connections releases their windows and ends the pressure.
+        for (std::size_t i = 0; i < NumConnections; i++) {
+            m_clients[i].reset();
+            m_servers[i].reset();
+        }
+        AIPSTACK_ASSERT_FORCE(tcp().getRcvMemUsage() == 0);
+        runWhile([&] { return m_pressure; });
+        AIPSTACK_ASSERT_FORCE(!tcp().isRcvMemPressure());
+    }
+
+    std::size_t getPeakUsage () const
+    {
+        return m_peak_usage;
+    }
+
+private:
+    TcpApi<TcpArg> & tcp ()
+    {
+        return m_stack.template getProtoApi<TcpApi>();
+    }
+
+    template<typename Cond>
+    void runWhile (Cond cond)
+    {
+        while (cond()) {
+            bool dispatched = m_sim.runOne();
+            AIPSTACK_ASSERT_FORCE(dispatched);
+
+            std::size_t usage = tcp().getRcvMemUsage();
+            if (usage > m_peak_usage) {
+                m_peak_usage = usage;
+            }
+        }
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(m_num_servers < NumConnections);
+        TestConnection &server = m_servers[m_num_servers++];
+        IpErr err = server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        server.setupBuffers();
+    }
+
+    void pressureChanged (bool pressure)
+    {
+        AIPSTACK_ASSERT_FORCE(pressure != m_pressure);
+        AIPSTACK_ASSERT_FORCE(pressure == tcp().isRcvMemPressure());
+        m_pressure = pressure;
+        if (pressure) {
+            m_pressure_events++;
+        }
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    MyIpStack m_stack;
+    MyLoopbackIface m_loopback;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_clients[NumConnections];
+    TestConnection m_servers[NumConnections];
+    std::size_t m_num_servers = 0;
+    std::size_t m_peak_usage = 0;
+    std::size_t m_pressure_events = 0;
+    bool m_pressure = false;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_rcv_mem_budget_test;
+
+    auto setup = std::make_unique<Setup>();
+    setup->run();
+
+    std::printf("%zu connections transferred %zu bytes each, peak window sum %zu\n",
+                NumConnections, TransferBytes, setup->getPeakUsage());
+
+    return 0;
+}
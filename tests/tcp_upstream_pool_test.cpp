@@ -0,0 +1,419 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+#include <aipstack/utils/TcpUpstreamPool.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of TcpUpstreamPool.
+ *
+ * A pool keeps connections to a server (in the same stack, over a link with
+ * a delay) which answers each request with a short response:
+ * - Connections are established before they are needed, and a request on a
+ *   taken connection is answered after one RTT. Returned connections are
+ *   reused without connecting again.
+ * - A large request after the connection has been idle for longer than the
+ *   RTO completes faster with preserve_cwnd than without, because the
+ *   congestion window learned by the previous request is kept.
+ * - Idle connections which the server closes or which exceed max_idle_time
+ *   are dropped and replaced, and a connection which received a FIN is not
+ *   taken back.
+ */
+
+namespace aipstack_tcp_upstream_pool_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using MyIpStackService = TcpFixture::StackService<>;
+
+using MyTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<16>,
+    IpTcpProtoOptions::EnableKeepalive::Is<true>
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, MakeTypeList<MyTcpService>> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr double LinkDelaySec = 1e-3;
+constexpr double RttSec = 2 * LinkDelaySec;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t RxBufferSize = 4096;
+constexpr std::size_t TxBufferSize = 65536;
+constexpr std::size_t ServerBufferSize = 65535;
+constexpr std::size_t ResponseSize = 100;
+constexpr std::size_t SmallRequestSize = 100;
+constexpr std::size_t LargeRequestSize = 48000;
+constexpr int NumIdle = 2;
+constexpr int NumEntries = 4;
+
+using UpstreamPoolTypes = TcpUpstreamPool<PlatformImpl, TcpArg, RxBufferSize>;
+using UpstreamPool = UpstreamPoolTypes::UpstreamPool;
+using PoolEntry = UpstreamPoolTypes::PoolEntry;
+using UpstreamPoolParams = UpstreamPoolTypes::UpstreamPoolParams;
+
+// Server side: answers each request of request_size bytes with a response.
+class ServerConnection :
+    public TcpConnection<TcpArg>
+{
+public:
+    ServerConnection (std::size_t const &request_size) :
+        m_request_size(request_size),
+        m_rx_node{m_rx_buf, ServerBufferSize, &m_rx_node},
+        m_tx_node{m_tx_buf, ResponseSize, &m_tx_node}
+    {}
+
+    void setupBuffers ()
+    {
+        setRecvBuf(IpBufRef{&m_rx_node, 0, ServerBufferSize});
+        setSendBuf(IpBufRef{&m_tx_node, 0, 0});
+    }
+
+private:
+    void connectionAborted () override final
+    {}
+
+    void dataReceived (std::size_t amount) override final
+    {
+        if (amount == 0) {
+            // The pool does not close connections, it resets them.
+            return;
+        }
+
+        extendRecvBuf(amount);
+        m_received += amount;
+        if (m_received >= m_request_size) {
+            AIPSTACK_ASSERT_FORCE(m_received == m_request_size);
+            m_received = 0;
+            extendSendBuf(ResponseSize);
+            sendPush();
+        }
+    }
+
+    void dataSent (std::size_t) override final
+    {}
+
+private:
+    std::size_t const &m_request_size;
+    std::size_t m_received = 0;
+    char m_rx_buf[ServerBufferSize];
+    char m_tx_buf[ResponseSize];
+    IpBufNode m_rx_node;
+    IpBufNode m_tx_node;
+};
+
+// Client side: a connection taken from the pool for one request.
+class ClientConnection :
+    public TcpConnection<TcpArg>
+{
+public:
+    ClientConnection () :
+        m_rx_node{m_rx_buf, RxBufferSize, &m_rx_node},
+        m_tx_node{m_tx_buf, TxBufferSize, &m_tx_node}
+    {}
+
+    void setupTaken ()
+    {
+        // Copy what the pool entry may have stored before replacing the buffer.
+        IpBufRef rcv_buf = getRecvBuf();
+        ipBufTakeBytes(rcv_buf, rcv_buf.tot_len, m_rx_buf);
+        setRecvBuf(IpBufRef{&m_rx_node, 0, RxBufferSize});
+        setSendBuf(IpBufRef{&m_tx_node, 0, 0});
+        m_received = 0;
+        m_end_received = false;
+    }
+
+    void sendRequest (std::size_t size)
+    {
+        extendSendBuf(size);
+        sendPush();
+    }
+
+    bool isDone () const
+    {
+        return m_received == ResponseSize && getSendBuf().tot_len == 0;
+    }
+
+    bool endReceived () const
+    {
+        return m_end_received;
+    }
+
+private:
+    void connectionAborted () override final
+    {
+        AIPSTACK_ASSERT_FORCE(false);
+    }
+
+    void dataReceived (std::size_t amount) override final
+    {
+        if (amount == 0) {
+            m_end_received = true;
+            return;
+        }
+        extendRecvBuf(amount);
+        m_received += amount;
+    }
+
+    void dataSent (std::size_t) override final
+    {}
+
+private:
+    std::size_t m_received = 0;
+    bool m_end_received = false;
+    char m_rx_buf[RxBufferSize];
+    char m_tx_buf[TxBufferSize];
+    IpBufNode m_rx_node;
+    IpBufNode m_tx_node;
+};
+
+using Host = TcpFixture::Host<IpStackArg>;
+
+class Setup
+{
+public:
+    Setup (bool preserve_cwnd) :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_host(m_platform, LocalAddr, 1500, /*use_batches=*/false),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_pool(m_platform, AIPSTACK_BIND_MEMBER_TN(&Setup::poolAvailable, this))
+    {
+        // The packets go back to the same interface after the link delay, one
+        // at a time so that each data segment is acknowledged as it arrives.
+        m_host.setPeer(&m_host);
+        TcpFixture::RxParams rx_params;
+        rx_params.link_delay = TimeType(LinkDelaySec * Platform::TimeFreq);
+        m_host.setRxParams(rx_params);
+
+        bool listen_res = m_listener.startListening(m_host.tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 8
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(ServerBufferSize);
+
+        UpstreamPoolParams params;
+        params.addr = LocalAddr;
+        params.port = ServerPort;
+        params.num_idle = NumIdle;
+        params.num_entries = NumEntries;
+        params.entries = m_entries;
+        params.retry_time = TimeType(1.0 * Platform::TimeFreq);
+        params.max_idle_time = TimeType(30.0 * Platform::TimeFreq);
+        params.ka_idle_secs = 10;
+        params.ka_interval_secs = 1;
+        params.ka_count = 3;
+        params.preserve_cwnd = preserve_cwnd;
+        m_pool.start(m_host.tcp(), params);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_pool.reset();
+        m_servers.clear();
+    }
+
+    UpstreamPool & pool ()
+    {
+        return m_pool;
+    }
+
+    std::size_t numAccepted () const
+    {
+        return m_servers.size();
+    }
+
+    void runFor (double seconds)
+    {
+        TimeType end_time = m_platform.getTime() + TimeType(seconds * Platform::TimeFreq);
+        while (!Platform::timeGreaterOrEqual(m_platform.getTime(), end_time)) {
+            if (!m_sim.runOne()) {
+                break;
+            }
+        }
+    }
+
+    // Perform a request on a connection from the pool and return it, giving
+    // the time in seconds from sending the request to the response.
+    double request (std::size_t size)
+    {
+        m_request_size = size;
+
+        IpErr err = m_pool.takeConnection(m_client);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupTaken();
+
+        TimeType start_time = m_platform.getTime();
+        m_client.sendRequest(size);
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_client.isDone(); });
+        double time = double(m_platform.getTime() - start_time) / Platform::TimeFreq;
+
+        AIPSTACK_ASSERT_FORCE(m_pool.returnConnection(m_client));
+        AIPSTACK_ASSERT_FORCE(m_client.isInit());
+
+        return time;
+    }
+
+    // Take a connection, let the server close all its connections and check
+    // that the taken connection is not taken back.
+    void closeServers ()
+    {
+        IpErr err = m_pool.takeConnection(m_client);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupTaken();
+
+        for (auto &server : m_servers) {
+            if (server->isConnected()) {
+                server->closeSending();
+            }
+        }
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_client.endReceived(); });
+
+        AIPSTACK_ASSERT_FORCE(!m_pool.returnConnection(m_client));
+        m_client.reset();
+    }
+
+    std::size_t availableCalls () const
+    {
+        return m_available_calls;
+    }
+
+private:
+    void connectionEstablished ()
+    {
+        auto server = std::make_unique<ServerConnection>(m_request_size);
+        IpErr err = server->acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        server->setupBuffers();
+        m_servers.push_back(std::move(server));
+    }
+
+    void poolAvailable ()
+    {
+        m_available_calls++;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    Host m_host;
+    TcpListener<TcpArg> m_listener;
+    std::vector<std::unique_ptr<ServerConnection>> m_servers;
+    PoolEntry m_entries[NumEntries];
+    UpstreamPool m_pool;
+    ClientConnection m_client;
+    std::size_t m_request_size = SmallRequestSize;
+    std::size_t m_available_calls = 0;
+};
+
+void test_reuse ()
+{
+    auto setup = std::make_unique<Setup>(true);
+
+    // The pool connects right away.
+    setup->runFor(0.1);
+    AIPSTACK_ASSERT_FORCE(setup->pool().getStats().established == NumIdle);
+    AIPSTACK_ASSERT_FORCE(setup->numAccepted() == NumIdle);
+
+    // Each request is answered after one RTT and the returned connection is
+    // reused for the next request.
+    for (int i = 0; i < 20; i++) {
+        double time = setup->request(SmallRequestSize);
+        AIPSTACK_ASSERT_FORCE(time < 1.5 * RttSec);
+    }
+
+    // One replacement was started for the first take, afterwards the
+    // returned connection kept the pool full.
+    auto stats = setup->pool().getStats();
+    AIPSTACK_ASSERT_FORCE(stats.taken == 20 && stats.returned == 20);
+    AIPSTACK_ASSERT_FORCE(stats.established == NumIdle + 1);
+    AIPSTACK_ASSERT_FORCE(setup->numAccepted() == NumIdle + 1);
+
+    // Nothing is taken with none idle, and the application is told when a
+    // connection becomes available.
+    setup->closeServers();
+    setup->runFor(0.1);
+    stats = setup->pool().getStats();
+    AIPSTACK_ASSERT_FORCE(stats.not_returned == 1);
+    AIPSTACK_ASSERT_FORCE(stats.dropped == NumIdle);
+    AIPSTACK_ASSERT_FORCE(setup->pool().hasIdleConnection());
+    AIPSTACK_ASSERT_FORCE(setup->availableCalls() == 0);
+
+    // Idle connections are replaced after max_idle_time, while keepalive
+    // probes are answered.
+    std::uint32_t dropped = stats.dropped;
+    setup->runFor(35.0);
+    stats = setup->pool().getStats();
+    AIPSTACK_ASSERT_FORCE(stats.dropped == dropped + NumIdle);
+    AIPSTACK_ASSERT_FORCE(setup->pool().hasIdleConnection());
+
+    double time = setup->request(SmallRequestSize);
+    AIPSTACK_ASSERT_FORCE(time < 1.5 * RttSec);
+
+    std::printf("reuse: established %u, taken %u, returned %u, dropped %u\n",
+                unsigned(stats.established), unsigned(stats.taken),
+                unsigned(stats.returned), unsigned(stats.dropped));
+}
+
+double test_idle_request (bool preserve_cwnd)
+{
+    auto setup = std::make_unique<Setup>(preserve_cwnd);
+    setup->runFor(0.1);
+
+    // The first large request grows the congestion window, then the
+    // connection is idle for longer than the RTO.
+    double first_time = setup->request(LargeRequestSize);
+    setup->runFor(5.0);
+    double second_time = setup->request(LargeRequestSize);
+
+    std::printf("preserve_cwnd=%d: first %.1fms, after idle %.1fms\n",
+                int(preserve_cwnd), first_time * 1e3, second_time * 1e3);
+
+    AIPSTACK_ASSERT_FORCE(second_time <= first_time);
+    return second_time;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_upstream_pool_test;
+
+    test_reuse();
+
+    double preserved = test_idle_request(true);
+    double restarted = test_idle_request(false);
+    AIPSTACK_ASSERT_FORCE(preserved + RttSec <= restarted);
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of per-connection window scale negotiation.
+ *
+ * A client sends data to a server over a simulated link. The window scale
+ * factor is chosen from the maximum receive buffer given with
+ * TcpStartConnectionArgs::max_rcv_buf and TcpListener::setMaxReceiveBuffer:
+ * - With no maximum given the old fixed scale factor 2^6 is used, which
+ *   limits the window to about 4 MiB even with a 16 MiB buffer.
+ * - With a 16 MiB maximum a scale factor is chosen which allows the whole
+ *   buffer to be announced.
+ * - With an 8 KiB maximum no scaling is used, so the window is announced
+ *   with byte granularity.
+ */
+
+namespace aipstack_tcp_wnd_scale_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+using TimeType = Platform::TimeType;
+
+using MyTcpService = IpTcpProtoService<
+    IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+    IpTcpProtoOptions::NumTcpPcbs::Is<4>
+>;
+
+class IpStackArg : public TcpFixture::StackService<>::template Compose<
+    PlatformImpl, MakeTypeList<MyTcpService>> {};
+using MyIpStack = IpStack<IpStackArg>;
+using TcpArg = MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr std::size_t Mtu = 1500;
+constexpr double LinkDelaySec = 100e-6;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t LargeBuffer = std::size_t(16) << 20;
+constexpr std::size_t SmallBuffer = 8192;
+constexpr std::size_t OldMaxWindow = std::size_t(0xFFFF) << 6;
+
+using TestConnection = TcpFixture::TestConnection<TcpArg>;
+
+struct Result {
+    TcpConnectionStats client;
+    TcpConnectionStats server;
+};
+
+class Setup
+{
+    struct DelayedPacket {
+        TimeType time;
+        std::vector<char> data;
+    };
+
+public:
+    Setup (std::size_t buf_size, std::size_t max_rcv_buf) :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_stack(m_platform),
+        m_driver_iface(&m_stack, make_params()),
+        m_link_timer(m_platform, AIPSTACK_BIND_MEMBER_TN(&Setup::linkTimerHandler, this)),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this)),
+        m_buf_size(buf_size),
+        m_max_rcv_buf(max_rcv_buf),
+        m_client(buf_size),
+        m_server(buf_size)
+    {
+        m_driver_iface.iface().setIp4Addr(
+            IpIfaceIp4AddrSetting(24, Ip4Addr(10, 0, 0, 1)));
+
+        bool listen_res = m_listener.startListening(tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ 1
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(buf_size);
+        m_listener.setMaxReceiveBuffer(max_rcv_buf);
+    }
+
+    ~Setup ()
+    {
+        m_client.reset();
+        m_server.reset();
+    }
+
+    Result run (std::size_t amount)
+    {
+        TcpStartConnectionArgs<TcpArg> args;
+        args.addr = Ip4Addr(10, 0, 0, 1);
+        args.port = ServerPort;
+        args.rcv_wnd = m_buf_size;
+        args.max_rcv_buf = m_max_rcv_buf;
+        IpErr err = m_client.startConnection(tcp(), args);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_client.setupBuffers();
+
+        TcpFixture::runWhile(m_sim, [&] { return !m_server_accepted; });
+
+        m_client.send(amount);
+        TcpFixture::runWhile(m_sim, [&] {
+            return m_server.getReceived() < amount || !m_client.allSent();
+        });
+
+        return Result{m_client.getStats(), m_server.getStats()};
+    }
+
+private:
+    TcpApi<TcpArg> & tcp ()
+    {
+        return m_stack.template getProtoApi<TcpApi>();
+    }
+
+    IpIfaceDriverParams make_params ()
+    {
+        IpIfaceDriverParams params;
+        params.ip_mtu = Mtu;
+        params.send_ip4_packet = AIPSTACK_BIND_MEMBER_TN(&Setup::driverSendIp4Packet, this);
+        params.get_state = TcpFixture::linkUpState;
+        return params;
+    }
+
+    IpErr driverSendIp4Packet (IpBufRef pkt, Ip4Addr, IpSendRetryRequest *)
+    {
+        DelayedPacket delayed;
+        delayed.time = m_platform.getTime() + TimeType(LinkDelaySec * Platform::TimeFreq);
+        delayed.data.resize(pkt.tot_len);
+        ipBufTakeBytes(pkt, pkt.tot_len, delayed.data.data());
+
+        m_link_queue.push_back(std::move(delayed));
+        if (!m_link_timer.isSet()) {
+            m_link_timer.setAt(m_link_queue.front().time);
+        }
+        return IpErr::Success;
+    }
+
+    void linkTimerHandler ()
+    {
+        TimeType now = m_platform.getTime();
+        while (!m_link_queue.empty() &&
+               Platform::timeGreaterOrEqual(now, m_link_queue.front().time))
+        {
+            DelayedPacket delayed = std::move(m_link_queue.front());
+            m_link_queue.pop_front();
+            IpBufNode node = {delayed.data.data(), delayed.data.size(), nullptr};
+            m_driver_iface.recvIp4Packet(IpBufRef{&node, 0, delayed.data.size()});
+        }
+
+        if (!m_link_queue.empty()) {
+            m_link_timer.setAt(m_link_queue.front().time);
+        }
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_server_accepted);
+        IpErr err = m_server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        m_server.setupBuffers();
+        m_server_accepted = true;
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    MyIpStack m_stack;
+    IpDriverIface<IpStackArg> m_driver_iface;
+    Platform::Timer m_link_timer;
+    std::deque<DelayedPacket> m_link_queue;
+    TcpListener<TcpArg> m_listener;
+    std::size_t m_buf_size;
+    std::size_t m_max_rcv_buf;
+    TestConnection m_client;
+    TestConnection m_server;
+    bool m_server_accepted = false;
+};
+
+Result test_config (char const *name, std::size_t buf_size, std::size_t max_rcv_buf,
+                    std::size_t amount)
+{
+    auto setup = std::make_unique<Setup>(buf_size, max_rcv_buf);
+    Result res = setup->run(amount);
+
+    std::printf("%s: server rcv_wnd_shift %u, rcv_wnd %u, client snd_wnd %u\n", name,
+                unsigned(res.server.rcv_wnd_shift), unsigned(res.server.rcv_wnd),
+                unsigned(res.client.snd_wnd));
+
+    // Both sides must agree on the scale factors.
+    AIPSTACK_ASSERT_FORCE(res.client.snd_wnd_shift == res.server.rcv_wnd_shift);
+    AIPSTACK_ASSERT_FORCE(res.client.rcv_wnd_shift == res.server.snd_wnd_shift);
+    return res;
+}
+
+}
+
+int main ()
+{
+    using namespace aipstack_tcp_wnd_scale_test;
+
+    Result res;
+
+    res = test_config("default", LargeBuffer, 0, 2 * LargeBuffer);
+    AIPSTACK_ASSERT_FORCE(res.server.rcv_wnd_shift == 6);
+    AIPSTACK_ASSERT_FORCE(res.server.rcv_wnd <= OldMaxWindow);
+
+    res = test_config("large", LargeBuffer, LargeBuffer, 2 * LargeBuffer);
+    AIPSTACK_ASSERT_FORCE(res.server.rcv_wnd_shift == 9);
+    AIPSTACK_ASSERT_FORCE(res.server.rcv_wnd > OldMaxWindow);
+    AIPSTACK_ASSERT_FORCE(res.client.snd_wnd > OldMaxWindow);
+
+    res = test_config("small", SmallBuffer, SmallBuffer, 16 * SmallBuffer);
+    AIPSTACK_ASSERT_FORCE(res.server.rcv_wnd_shift == 0);
+    AIPSTACK_ASSERT_FORCE(res.server.rcv_wnd == SmallBuffer);
+
+    return 0;
+}
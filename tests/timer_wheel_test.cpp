@@ -0,0 +1,178 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/structure/Accessor.h>
+#include <aipstack/structure/LinkModel.h>
+#include <aipstack/structure/TimerQueue.h>
+#include <aipstack/structure/TimerWheel.h>
+#include <aipstack/structure/HierarchicalTimerWheel.h>
+#include <aipstack/structure/minimum/LinkedHeap.h>
+
+using namespace AIpStack;
+
+/*
+ * Randomized test of the timer queue implementations against a model.
+ *
+ * A 16-bit time type is used so that the time wraps around many times. In each
+ * round the time advances (sometimes exactly to the time reported by
+ * getFirstTime, and occasionally jumping into the past), expired timers are
+ * removed, and random timers are started, restarted or stopped. It is checked
+ * that timers are never dispatched early or more than one tick late, that a
+ * backward clock jump dispatches all timers, and that getFirstTime does not
+ * report a time after the first timer could expire.
+ */
+
+namespace aipstack_timer_wheel_test {
+
+using TimeType = std::uint16_t;
+
+constexpr int TickShift = 3;
+constexpr std::uint64_t TickSize = std::uint64_t(1) << TickShift;
+
+constexpr std::size_t NumEntries = 200;
+constexpr int NumRounds = 100000;
+
+// Maximum timeout, below TimeMaxFutureInterval of the 16-bit time type.
+constexpr std::uint64_t MaxTimeout = 20000;
+
+struct NodeUserData {};
+
+template<typename QueueService>
+class TimerQueueTest {
+    struct Entry;
+
+    using LinkModel = PointerLinkModel<Entry>;
+    using Ref = typename LinkModel::Ref;
+    using Node = typename QueueService::template Node<LinkModel, TimeType, NodeUserData>;
+
+    struct Entry {
+        Node node;
+        std::uint64_t deadline;
+        bool active;
+    };
+
+    struct NodeAccessor : public MemberAccessor<Entry, Node, &Entry::node> {};
+
+    using Queue = typename QueueService::template Queue<
+        LinkModel, NodeAccessor, TimeType, NodeUserData>;
+
+public:
+    static void run (char const *name, bool exact)
+    {
+        std::mt19937 rng(1);
+
+        std::vector<Entry> entries(NumEntries);
+        for (Entry &e : entries) {
+            e.active = false;
+        }
+
+        Queue queue;
+        queue.init();
+
+        // The model time never wraps around. It starts near the wrap-around
+        // of the 16-bit time.
+        std::uint64_t now = 65000;
+        queue.updateReferenceTime(TimeType(now));
+
+        std::uint64_t wake_time = now;
+        bool have_wake_time = false;
+        std::size_t num_dispatched = 0;
+
+        for (int round = 0; round < NumRounds; round++) {
+            bool jump = rng() % 1000 == 0;
+            if (jump) {
+                now -= 1 + rng() % 1000;
+            } else if (have_wake_time && rng() % 2 == 0) {
+                now = wake_time;
+            } else {
+                now += rng() % (4 * TickSize);
+            }
+
+            queue.prepareForRemovingExpired(TimeType(now));
+
+            while (true) {
+                Ref ref = queue.removeExpired();
+                if (ref.isNull()) {
+                    break;
+                }
+                Entry &e = *ref;
+                AIPSTACK_ASSERT_FORCE(e.active);
+                AIPSTACK_ASSERT_FORCE(jump || e.deadline <= now);
+                e.active = false;
+                num_dispatched++;
+            }
+
+            std::uint64_t max_late = exact ? 0 : TickSize - 1;
+            for (Entry &e : entries) {
+                AIPSTACK_ASSERT_FORCE(!e.active || (!jump && e.deadline + max_late >= now));
+            }
+
+            for (int i = 0; i < 4; i++) {
+                Entry &e = entries[rng() % NumEntries];
+                if (e.active && rng() % 3 == 0) {
+                    queue.remove(Ref(e));
+                    e.active = false;
+                } else {
+                    if (e.active) {
+                        queue.remove(Ref(e));
+                    }
+                    std::uint64_t timeout = (rng() % 4 == 0) ?
+                        rng() % (4 * TickSize) : rng() % MaxTimeout;
+                    e.deadline = now + timeout;
+                    e.active = true;
+                    queue.insert(Ref(e), TimeType(e.deadline));
+                }
+            }
+
+            bool any_active = false;
+            std::uint64_t min_deadline = 0;
+            for (Entry &e : entries) {
+                if (e.active && (!any_active || e.deadline < min_deadline)) {
+                    min_deadline = e.deadline;
+                    any_active = true;
+                }
+            }
+
+            TimeType first_time;
+            have_wake_time = queue.getFirstTime(first_time);
+            AIPSTACK_ASSERT_FORCE(have_wake_time == any_active);
+
+            if (have_wake_time) {
+                wake_time = now + TimeType(first_time - TimeType(now));
+                AIPSTACK_ASSERT_FORCE(wake_time <= min_deadline + (exact ? 0 : TickSize));
+            }
+        }
+
+        for (Entry &e : entries) {
+            if (e.active) {
+                queue.remove(Ref(e));
+            }
+        }
+        TimeType first_time;
+        AIPSTACK_ASSERT_FORCE(!queue.getFirstTime(first_time));
+
+        std::printf("%s: %zu timers dispatched\n", name, num_dispatched);
+    }
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_timer_wheel_test;
+
+    TimerQueueTest<TimerQueueService<LinkedHeapService>>::run(
+        "linked_heap", true);
+    TimerQueueTest<TimerQueueService<TimerWheelService<64, TickShift>>>::run(
+        "timer_wheel", false);
+    TimerQueueTest<TimerQueueService<HierarchicalTimerWheelService<TickShift>>>::run(
+        "hierarchical_timer_wheel", false);
+    TimerQueueTest<TimerQueueService<HierarchicalTimerWheelService<TickShift, 2>>>::run(
+        "hierarchical_timer_wheel_2", false);
+
+    return 0;
+}
@@ -0,0 +1,326 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/SendRetry.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpEgressScheduler.h>
+#include <aipstack/tcp/IpTcpProto.h>
+#include <aipstack/tcp/TcpApi.h>
+#include <aipstack/tcp/TcpListener.h>
+#include <aipstack/tcp/TcpConnection.h>
+
+#include "tcp_fixture.h"
+
+using namespace AIpStack;
+
+/*
+ * Test of transmit queue flow control (IpIfaceDriverParams::tx_queue and
+ * IpEgressScheduler::setTxQueue).
+ *
+ * A simulated driver has a small transmit ring which drains a few packets per
+ * millisecond, delivering them back to the same interface. TCP connections to
+ * the address of the interface transfer data through the ring. Without flow
+ * control the driver has to reject packets when the ring is full; with the
+ * ring given to the interface, or to an egress scheduler in front of the
+ * ring, senders must be held back at the high watermark so that the driver
+ * never rejects a packet.
+ */
+
+namespace aipstack_tx_queue_flow_control_test {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using MyIpStackService = TcpFixture::StackService<
+    IpStackOptions::EnableStats::Is<true>
+>;
+
+using ProtocolServicesList = MakeTypeList<
+    IpTcpProtoService<
+        IpTcpProtoOptions::PcbIndexService::Is<AvlTreeIndexService>,
+        IpTcpProtoOptions::NumTcpPcbs::Is<8>
+    >
+>;
+
+class IpStackArg : public MyIpStackService::template Compose<
+    PlatformImpl, ProtocolServicesList> {};
+using MyIpStack = IpStack<IpStackArg>;
+
+using MySchedulerService = IpEgressSchedulerService<
+    IpEgressSchedulerOptions::NumFlows::Is<16>,
+    IpEgressSchedulerOptions::NumSlots::Is<64>,
+    IpEgressSchedulerOptions::SlotSize::Is<1500>,
+    IpEgressSchedulerOptions::QueueBytes::Is<64 * 1500>,
+    IpEgressSchedulerOptions::FlowQueueBytes::Is<32 * 1500>
+>;
+class SchedulerArg : public MySchedulerService::template Compose<PlatformImpl> {};
+using MyScheduler = IpEgressScheduler<SchedulerArg>;
+
+using TcpArg = typename MyIpStack::template GetProtoArg<TcpApi>;
+
+constexpr std::size_t Mtu = 1500;
+constexpr std::size_t RingCapacity = 32;
+constexpr std::size_t RingLowWatermark = 8;
+constexpr std::size_t RingHighWatermark = 24;
+constexpr std::size_t DrainPerTick = 4;
+constexpr std::uint16_t ServerPort = 80;
+constexpr std::size_t NumConnections = 2;
+constexpr std::size_t TransferBytes = 200000;
+constexpr std::size_t BufferSize = 65536;
+
+enum class Mode {None, Iface, Scheduler};
+
+// Connection which checks the received byte pattern.
+class TestConnection :
+    public TcpFixture::TestConnection<TcpArg>
+{
+public:
+    TestConnection () :
+        TcpFixture::TestConnection<TcpArg>(BufferSize, /*check_data=*/true)
+    {}
+};
+
+// Driver with a transmit ring which drains DrainPerTick packets per
+// millisecond, delivering them back to the interface.
+class RingDriver
+{
+public:
+    RingDriver (Platform platform, MyIpStack *stack, Mode mode) :
+        m_tx_queue(RingCapacity, RingLowWatermark, RingHighWatermark),
+        m_scheduler(platform, AIPSTACK_BIND_MEMBER_TN(&RingDriver::txReady, this)),
+        m_driver_iface(stack, make_params(mode)),
+        m_timer(platform, AIPSTACK_BIND_MEMBER_TN(&RingDriver::timerHandler, this))
+    {
+        if (mode == Mode::Scheduler) {
+            m_scheduler.setTxQueue(&m_tx_queue);
+        }
+        m_driver_iface.iface().setIp4Addr(
+            IpIfaceIp4AddrSetting(24, Ip4Addr(10, 0, 0, 1)));
+    }
+
+    IpIface<IpStackArg> & iface ()
+    {
+        return m_driver_iface.iface();
+    }
+
+    std::size_t getNumRejected () const
+    {
+        return m_num_rejected;
+    }
+
+    std::size_t getPeakOccupancy () const
+    {
+        return m_peak_occupancy;
+    }
+
+private:
+    struct Slot {
+        std::size_t len;
+        char data[Mtu];
+    };
+
+    IpIfaceDriverParams make_params (Mode mode)
+    {
+        IpIfaceDriverParams params;
+        params.ip_mtu = Mtu;
+        if (mode == Mode::Scheduler) {
+            params.send_ip4_packet =
+                AIPSTACK_BIND_MEMBER_TN(&MyScheduler::enqueuePacket, &m_scheduler);
+        } else {
+            params.send_ip4_packet =
+                AIPSTACK_BIND_MEMBER_TN(&RingDriver::driverSendIp4Packet, this);
+        }
+        params.get_state = TcpFixture::linkUpState;
+        if (mode == Mode::Iface) {
+            params.tx_queue = &m_tx_queue;
+        }
+        return params;
+    }
+
+    IpErr driverSendIp4Packet (IpBufRef pkt, Ip4Addr, IpSendRetryRequest *retryReq)
+    {
+        std::size_t occupancy = m_tx_queue.getOccupancy();
+        if (occupancy == RingCapacity) {
+            m_num_rejected++;
+            m_tx_queue.addRequest(retryReq);
+            return IpErr::OutputBufferFull;
+        }
+
+        Slot &slot = m_ring[(m_ring_start + occupancy) % RingCapacity];
+        slot.len = pkt.tot_len;
+        ipBufTakeBytes(pkt, pkt.tot_len, slot.data);
+        m_tx_queue.packetsQueued();
+
+        if (occupancy + 1 > m_peak_occupancy) {
+            m_peak_occupancy = occupancy + 1;
+        }
+        if (!m_timer.isSet()) {
+            m_timer.setAfter(Platform::TimeType(PlatformImpl::TimeFreq / 1000));
+        }
+        return IpErr::Success;
+    }
+
+    void txReady ()
+    {
+        m_scheduler.transmitPackets([&](IpBufRef pkt, Ip4Addr addr) {
+            return driverSendIp4Packet(pkt, addr, nullptr);
+        });
+    }
+
+    void timerHandler ()
+    {
+        for (std::size_t i = 0; i < DrainPerTick && m_tx_queue.getOccupancy() > 0; i++) {
+            // The slot stays occupied while the packet is delivered, so it is
+            // not overwritten by packets sent in response.
+            Slot &slot = m_ring[m_ring_start];
+            IpBufNode node = {slot.data, slot.len, nullptr};
+            m_driver_iface.recvIp4Packet(IpBufRef{&node, 0, slot.len});
+            m_ring_start = (m_ring_start + 1) % RingCapacity;
+            m_tx_queue.packetsCompleted();
+        }
+
+        if (m_tx_queue.getOccupancy() > 0 && !m_timer.isSet()) {
+            m_timer.setAfter(Platform::TimeType(PlatformImpl::TimeFreq / 1000));
+        }
+    }
+
+private:
+    IpSendRetryTxQueue m_tx_queue;
+    MyScheduler m_scheduler;
+    IpDriverIface<IpStackArg> m_driver_iface;
+    typename Platform::Timer m_timer;
+    Slot m_ring[RingCapacity];
+    std::size_t m_ring_start = 0;
+    std::size_t m_num_rejected = 0;
+    std::size_t m_peak_occupancy = 0;
+};
+
+class Setup
+{
+public:
+    Setup (Mode mode) :
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_stack(m_platform),
+        m_driver(m_platform, &m_stack, mode),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&Setup::connectionEstablished, this))
+    {
+        bool listen_res = m_listener.startListening(tcp(), {
+            /*addr=*/ Ip4Addr::ZeroAddr(),
+            /*port=*/ ServerPort,
+            /*max_pcbs=*/ int(NumConnections)
+        });
+        AIPSTACK_ASSERT_FORCE(listen_res);
+        m_listener.setInitialReceiveWindow(BufferSize);
+    }
+
+    ~Setup ()
+    {
+        for (std::size_t i = 0; i < NumConnections; i++) {
+            m_clients[i].reset();
+            m_servers[i].reset();
+        }
+    }
+
+    void run ()
+    {
+        for (TestConnection &client : m_clients) {
+            TcpStartConnectionArgs<TcpArg> args;
+            args.addr = Ip4Addr(10, 0, 0, 1);
+            args.port = ServerPort;
+            args.rcv_wnd = BufferSize;
+            IpErr err = client.startConnection(tcp(), args);
+            AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+            client.setupBuffers();
+        }
+
+        TcpFixture::runWhile(m_sim, [&] { return m_num_servers < NumConnections; });
+
+        for (TestConnection &client : m_clients) {
+            client.send(TransferBytes);
+        }
+        TcpFixture::runWhile(m_sim, [&] {
+            for (TestConnection &server : m_servers) {
+                if (server.getReceived() < TransferBytes) {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    RingDriver & driver ()
+    {
+        return m_driver;
+    }
+
+private:
+    TcpApi<TcpArg> & tcp ()
+    {
+        return m_stack.template getProtoApi<TcpApi>();
+    }
+
+    void connectionEstablished ()
+    {
+        AIPSTACK_ASSERT_FORCE(m_num_servers < NumConnections);
+        TestConnection &server = m_servers[m_num_servers++];
+        IpErr err = server.acceptConnection(m_listener);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+        server.setupBuffers();
+    }
+
+private:
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    MyIpStack m_stack;
+    RingDriver m_driver;
+    TcpListener<TcpArg> m_listener;
+    TestConnection m_clients[NumConnections];
+    TestConnection m_servers[NumConnections];
+    std::size_t m_num_servers = 0;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_tx_queue_flow_control_test;
+
+    static char const *const mode_names[] = {"none", "iface", "scheduler"};
+
+    for (Mode mode : {Mode::None, Mode::Iface, Mode::Scheduler}) {
+        auto setup = std::make_unique<Setup>(mode);
+        setup->run();
+
+        std::size_t rejected = setup->driver().getNumRejected();
+        std::size_t peak = setup->driver().getPeakOccupancy();
+        std::size_t throttled = setup->driver().iface().getStats().out_throttled;
+
+        std::printf("%s: rejected %zu, throttled %zu, peak occupancy %zu\n",
+                    mode_names[int(mode)], rejected, throttled, peak);
+
+        if (mode == Mode::None) {
+            // Otherwise the test would not show anything.
+            AIPSTACK_ASSERT_FORCE(rejected > 0);
+        } else {
+            AIPSTACK_ASSERT_FORCE(rejected == 0);
+            AIPSTACK_ASSERT_FORCE(peak < RingCapacity);
+        }
+        if (mode == Mode::Iface) {
+            AIPSTACK_ASSERT_FORCE(throttled > 0);
+        }
+    }
+
+    return 0;
+}
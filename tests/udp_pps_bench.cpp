@@ -0,0 +1,417 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/NonCopyable.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/misc/MinMax.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/infra/Chksum.h>
+#include <aipstack/structure/index/AvlTreeIndex.h>
+#include <aipstack/structure/index/HashTableIndex.h>
+#include <aipstack/platform/PlatformFacade.h>
+#include <aipstack/platform/SimPlatformImpl.h>
+#include <aipstack/proto/Ip4Proto.h>
+#include <aipstack/proto/Udp4Proto.h>
+#include <aipstack/ip/IpAddr.h>
+#include <aipstack/ip/IpStack.h>
+#include <aipstack/ip/IpDriverIface.h>
+#include <aipstack/ip/IpPathMtuCache.h>
+#include <aipstack/ip/IpReassembly.h>
+#include <aipstack/udp/IpUdpProto.h>
+
+using namespace AIpStack;
+
+/*
+ * Packets-per-second benchmark of the UDP implementation.
+ *
+ * A single stack has an interface with an in-memory driver, which copies
+ * each sent packet to a scratch buffer (like a driver copying to a ring)
+ * and receives packets prepared in memory. For each association index
+ * service, the following cases are measured:
+ * - send: UdpApi::sendUdpIp4Packet for each datagram.
+ * - send_batch: UdpApi::sendUdpIp4Packets with batches of BatchSize.
+ * - recv_listener: datagrams through IpDriverIface::recvIp4Packet (and so
+ *   IpUdpProto::recvIp4Dgram) to a listener, with a number of additional
+ *   listeners for other ports which are in the same lists of listeners
+ *   (NumListenerBuckets buckets by port) and are scanned before the target
+ *   listener, since it was started first.
+ * - recv_association: datagrams to a number of associations, each datagram
+ *   for the next association, so that the association index is looked up.
+ * The send cases and recv_listener with no additional listeners are done for
+ * each payload size, the listener and association sweeps with the smallest
+ * payload size. Received datagrams have a checksum which is verified in
+ * software.
+ *
+ * Output is JSON on stdout, an array with one object per case with the best
+ * "ns_per_packet" and "mpps" (wall time) of Iterations runs.
+ *
+ * The optional argument is the number of packets per run (default 200000).
+ */
+
+namespace aipstack_udp_pps_bench {
+
+using PlatformImpl = SimPlatformImpl;
+using Platform = PlatformFacade<PlatformImpl>;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr Ip4Addr LocalAddr = Ip4Addr(10, 0, 0, 1);
+constexpr Ip4Addr PeerAddr = Ip4Addr(10, 0, 0, 2);
+constexpr std::uint16_t LocalPort = 5001;
+constexpr std::uint16_t PeerPort = 40000;
+constexpr std::uint16_t OtherPortBase = 10000;
+
+constexpr std::size_t IpMtu = 1500;
+constexpr std::size_t BatchSize = 32;
+constexpr int Iterations = 3;
+
+std::size_t const payload_sizes[] = {64, 256, 512, 1472};
+std::size_t const sweep_counts[] = {16, 256, 4096};
+
+bool first_case = true;
+
+// Build an IPv4 packet with a UDP datagram from the peer to the local address
+// and fill in the checksums.
+std::vector<char> make_udp_packet (std::uint16_t src_port, std::size_t payload_size)
+{
+    std::size_t udp_len = Udp4Header::Size + payload_size;
+    std::vector<char> pkt(Ip4Header::Size + udp_len);
+
+    char *payload = pkt.data() + Ip4Header::Size + Udp4Header::Size;
+    for (std::size_t i = 0; i < payload_size; i++) {
+        payload[i] = char(i);
+    }
+
+    auto ip4_header = Ip4Header::MakeRef(pkt.data());
+    ip4_header.set(Ip4Header::VersionIhlDscpEcn(), std::uint16_t(0x45) << 8);
+    ip4_header.set(Ip4Header::TotalLen(),     std::uint16_t(pkt.size()));
+    ip4_header.set(Ip4Header::Ident(),        0);
+    ip4_header.set(Ip4Header::FlagsOffset(),  Ip4Flags::DF);
+    ip4_header.set(Ip4Header::Ttl(),          64);
+    ip4_header.set(Ip4Header::Proto(),        Ip4Protocol::Udp);
+    ip4_header.set(Ip4Header::HeaderChksum(), 0);
+    ip4_header.set(Ip4Header::SrcAddr(),      PeerAddr);
+    ip4_header.set(Ip4Header::DstAddr(),      LocalAddr);
+    ip4_header.set(Ip4Header::HeaderChksum(), IpChksum(pkt.data(), Ip4Header::Size));
+
+    char *udp_data = pkt.data() + Ip4Header::Size;
+    auto udp_header = Udp4Header::MakeRef(udp_data);
+    udp_header.set(Udp4Header::SrcPort(),  src_port);
+    udp_header.set(Udp4Header::DstPort(),  LocalPort);
+    udp_header.set(Udp4Header::Length(),   std::uint16_t(udp_len));
+    udp_header.set(Udp4Header::Checksum(), 0);
+
+    IpChksumAccumulator chksum;
+    chksum.addWord(WrapType<std::uint32_t>(), PeerAddr.value());
+    chksum.addWord(WrapType<std::uint32_t>(), LocalAddr.value());
+    chksum.addWordOctets(0, AsUnderlying(Ip4Protocol::Udp));
+    chksum.addWord(WrapType<std::uint16_t>(), std::uint16_t(udp_len));
+    chksum.addEvenBytes(udp_data, udp_len);
+    std::uint16_t chksum_value = chksum.getChksum();
+    udp_header.set(Udp4Header::Checksum(), (chksum_value == 0) ? 0xFFFF : chksum_value);
+
+    return pkt;
+}
+
+template<typename IndexService>
+class PpsBench :
+    private NonCopyable<PpsBench<IndexService>>
+{
+    using MyIpStackService = IpStackService<
+        IpStackOptions::HeaderBeforeIp::Is<0>,
+        IpStackOptions::PathMtuCacheService::Is<
+            IpPathMtuCacheService<
+                IpPathMtuCacheOptions::NumMtuEntries::Is<16>,
+                IpPathMtuCacheOptions::MtuIndexService::Is<AvlTreeIndexService>
+            >
+        >,
+        IpStackOptions::ReassemblyService::Is<
+            IpReassemblyService<>
+        >
+    >;
+
+    using ProtocolServicesList = MakeTypeList<
+        IpUdpProtoService<
+            IpUdpProtoOptions::UdpIndexService::Is<IndexService>
+        >
+    >;
+
+    class IpStackArg : public MyIpStackService::template Compose<
+        PlatformImpl, ProtocolServicesList> {};
+    using MyIpStack = IpStack<IpStackArg>;
+
+    using UdpArg = typename MyIpStack::template GetProtoArg<UdpApi>;
+    using Listener = UdpListener<UdpArg>;
+    using Association = UdpAssociation<UdpArg>;
+
+public:
+    PpsBench (char const *index_name, std::size_t num_packets) :
+        m_index_name(index_name),
+        m_num_packets(num_packets),
+        m_platform{PlatformRef<PlatformImpl>{&m_sim}},
+        m_stack(m_platform),
+        m_iface(&m_stack, make_params()),
+        m_listener(AIPSTACK_BIND_MEMBER_TN(&PpsBench::received, this)),
+        m_tx_scratch(IpMtu),
+        m_tx_packets(0),
+        m_rx_datagrams(0)
+    {
+        m_iface.iface().setIp4Addr(IpIfaceIp4AddrSetting(24, LocalAddr));
+
+        UdpListenParams<UdpArg> params;
+        params.port = LocalPort;
+        IpErr err = m_listener.startListening(udp(), params);
+        AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+    }
+
+    ~PpsBench ()
+    {
+        m_listener.reset();
+    }
+
+    void run ()
+    {
+        for (std::size_t payload_size : payload_sizes) {
+            runSend(payload_size, false);
+            runSend(payload_size, true);
+            runRecvListener(payload_size, 0);
+        }
+
+        for (std::size_t count : sweep_counts) {
+            runRecvListener(payload_sizes[0], count);
+        }
+
+        for (std::size_t count : sweep_counts) {
+            runRecvAssociation(payload_sizes[0], count);
+        }
+    }
+
+private:
+    IpIfaceDriverParams make_params ()
+    {
+        IpIfaceDriverParams params;
+        params.ip_mtu = IpMtu;
+        params.send_ip4_packet = AIPSTACK_BIND_MEMBER_TN(&PpsBench::sendPacket, this);
+        params.get_state = AIPSTACK_BIND_MEMBER_TN(&PpsBench::getState, this);
+        return params;
+    }
+
+    UdpApi<UdpArg> & udp ()
+    {
+        return m_stack.template getProtoApi<UdpApi>();
+    }
+
+    IpErr sendPacket (IpBufRef pkt, Ip4Addr, IpSendRetryRequest *)
+    {
+        AIPSTACK_ASSERT_FORCE(pkt.tot_len <= m_tx_scratch.size());
+        ipBufTakeBytes(pkt, pkt.tot_len, m_tx_scratch.data());
+        m_tx_packets++;
+        return IpErr::Success;
+    }
+
+    IpIfaceDriverState getState ()
+    {
+        IpIfaceDriverState state = {};
+        state.link_up = true;
+        return state;
+    }
+
+    UdpRecvResult received (IpRxInfoIp4<IpStackArg> const &,
+                            UdpRxInfo<UdpArg> const &, IpBufRef)
+    {
+        m_rx_datagrams++;
+        return UdpRecvResult::AcceptStop;
+    }
+
+    // Run the function which processes the given number of packets Iterations
+    // times and print the best time.
+    template<typename Func>
+    void measure (char const *path, std::size_t payload_size, char const *count_name,
+                  std::size_t count, Func func)
+    {
+        double best_ns = 0.0;
+        for (int i = 0; i < Iterations; i++) {
+            Clock::time_point start = Clock::now();
+            func();
+            std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+            double ns = elapsed.count() / double(m_num_packets);
+            if (i == 0 || ns < best_ns) {
+                best_ns = ns;
+            }
+        }
+
+        std::printf("%s\n  {\"index\": \"%s\", \"path\": \"%s\", \"payload\": %zu",
+                    first_case ? "" : ",", m_index_name, path, payload_size);
+        if (count_name != nullptr) {
+            std::printf(", \"%s\": %zu", count_name, count);
+        }
+        std::printf(", \"ns_per_packet\": %.1f, \"mpps\": %.3f}",
+                    best_ns, (best_ns > 0.0) ? 1e3 / best_ns : 0.0);
+        std::fflush(stdout);
+        first_case = false;
+    }
+
+    void runSend (std::size_t payload_size, bool batch)
+    {
+        std::vector<char> buf(UdpApi<UdpArg>::HeaderBeforeUdpData + payload_size);
+        IpBufNode node{buf.data(), buf.size(), nullptr};
+        IpBufRef udp_data{&node, UdpApi<UdpArg>::HeaderBeforeUdpData, payload_size};
+        Ip4AddrPair addrs{LocalAddr, PeerAddr};
+        UdpTxInfo<UdpArg> udp_info{LocalPort, PeerPort};
+
+        UdpTxEntry<UdpArg> entries[BatchSize];
+        for (auto &entry : entries) {
+            entry = UdpTxEntry<UdpArg>{addrs, udp_info, udp_data};
+        }
+
+        measure(batch ? "send_batch" : "send", payload_size, nullptr, 0, [&] {
+            m_tx_packets = 0;
+
+            if (!batch) {
+                for (std::size_t i = 0; i < m_num_packets; i++) {
+                    IpErr err = udp().sendUdpIp4Packet(addrs, udp_info, udp_data,
+                        nullptr, nullptr, IpSendFlags());
+                    AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+                }
+            } else {
+                for (std::size_t i = 0; i < m_num_packets; i += BatchSize) {
+                    std::size_t count = MinValue(BatchSize, m_num_packets - i);
+                    std::size_t num_sent;
+                    IpErr err = udp().sendUdpIp4Packets(entries, count, num_sent,
+                        nullptr, nullptr, IpSendFlags());
+                    AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+                }
+            }
+
+            AIPSTACK_ASSERT_FORCE(m_tx_packets == m_num_packets);
+        });
+    }
+
+    // Pass the packets (cycling through them) in receive batches of BatchSize.
+    void recvPackets (std::vector<std::vector<char>> &packets)
+    {
+        m_rx_datagrams = 0;
+
+        std::size_t index = 0;
+        for (std::size_t i = 0; i < m_num_packets; i += BatchSize) {
+            std::size_t count = MinValue(BatchSize, m_num_packets - i);
+
+            m_iface.beginRecvBatch();
+            for (std::size_t j = 0; j < count; j++) {
+                std::vector<char> &pkt = packets[index];
+                index = (index + 1 == packets.size()) ? 0 : index + 1;
+
+                IpBufNode node{pkt.data(), pkt.size(), nullptr};
+                m_iface.recvIp4Packet(IpBufRef{&node, 0, pkt.size()});
+            }
+            m_iface.endRecvBatch();
+        }
+
+        AIPSTACK_ASSERT_FORCE(m_rx_datagrams == m_num_packets);
+    }
+
+    void runRecvListener (std::size_t payload_size, std::size_t num_other)
+    {
+        // Start the other listeners, later than the target listener.
+        std::vector<std::unique_ptr<Listener>> others;
+        for (std::size_t i = 0; i < num_other; i++) {
+            auto lis = std::make_unique<Listener>(
+                AIPSTACK_BIND_MEMBER_TN(&PpsBench::received, this));
+            UdpListenParams<UdpArg> params;
+            params.port = std::uint16_t(OtherPortBase + i);
+            IpErr err = lis->startListening(udp(), params);
+            AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+            others.push_back(std::move(lis));
+        }
+
+        std::vector<std::vector<char>> packets;
+        packets.push_back(make_udp_packet(PeerPort, payload_size));
+
+        measure("recv_listener", payload_size, "other_listeners", num_other, [&] {
+            recvPackets(packets);
+        });
+
+        for (auto &lis : others) {
+            lis->reset();
+        }
+    }
+
+    void runRecvAssociation (std::size_t payload_size, std::size_t num_assocs)
+    {
+        std::vector<std::unique_ptr<Association>> assocs;
+        std::vector<std::vector<char>> packets;
+
+        for (std::size_t i = 0; i < num_assocs; i++) {
+            std::uint16_t peer_port = std::uint16_t(PeerPort + i);
+
+            auto assoc = std::make_unique<Association>(
+                AIPSTACK_BIND_MEMBER_TN(&PpsBench::received, this));
+            UdpAssociationParams<UdpArg> params;
+            params.key = UdpAssociationKey{LocalAddr, PeerAddr, LocalPort, peer_port};
+            IpErr err = assoc->associate(udp(), params);
+            AIPSTACK_ASSERT_FORCE(err == IpErr::Success);
+            assocs.push_back(std::move(assoc));
+
+            packets.push_back(make_udp_packet(peer_port, payload_size));
+        }
+
+        measure("recv_association", payload_size, "associations", num_assocs, [&] {
+            recvPackets(packets);
+        });
+
+        for (auto &assoc : assocs) {
+            assoc->reset();
+        }
+    }
+
+private:
+    char const *m_index_name;
+    std::size_t m_num_packets;
+    SimPlatformImpl m_sim;
+    Platform m_platform;
+    MyIpStack m_stack;
+    IpDriverIface<IpStackArg> m_iface;
+    Listener m_listener;
+    std::vector<char> m_tx_scratch;
+    std::size_t m_tx_packets;
+    std::size_t m_rx_datagrams;
+};
+
+}
+
+int main (int argc, char *argv[])
+{
+    using namespace aipstack_udp_pps_bench;
+
+    std::size_t num_packets = 200000;
+    if (argc > 1) {
+        long value = std::atol(argv[1]);
+        AIPSTACK_ASSERT_FORCE(value > 0);
+        num_packets = std::size_t(value);
+    }
+
+    std::printf("[");
+
+    {
+        auto bench = std::make_unique<PpsBench<AvlTreeIndexService>>(
+            "avl_tree", num_packets);
+        bench->run();
+    }
+    {
+        auto bench = std::make_unique<PpsBench<HashTableIndexService<4096>>>(
+            "hash_table", num_packets);
+        bench->run();
+    }
+
+    std::printf("\n]\n");
+
+    return 0;
+}
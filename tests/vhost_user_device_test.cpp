@@ -0,0 +1,389 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <aipstack/misc/Assert.h>
+#include <aipstack/misc/Function.h>
+#include <aipstack/infra/Buf.h>
+#include <aipstack/infra/BufUtils.h>
+#include <aipstack/infra/Err.h>
+#include <aipstack/event_loop/EventLoop.h>
+#include <aipstack/vhost/VhostUserDevice.h>
+
+using namespace AIpStack;
+
+/*
+ * Test of VhostUserDevice.
+ *
+ * A front-end thread plays the part of QEMU and the guest: it negotiates
+ * features, shares a memfd as the guest memory and sets up both virtqueues.
+ * The guest then sends a frame split over several descriptors, which the event
+ * loop receives and sends back. The frame is returned in two small receive
+ * buffers of the guest, using MRG_RXBUF. Replies to messages requested with
+ * REPLY_ACK are checked as well.
+ *
+ * This needs to be linked with VhostUserDevice.cpp and EventLoopAmalgamation.cpp.
+ */
+
+namespace aipstack_vhost_user_device_test {
+
+constexpr char const SocketPath[] = "/tmp/aipstack_vhost_user_device_test.sock";
+
+constexpr std::size_t GuestMemSize = 1 << 20;
+// Address of the guest memory in the front-end process, which differs from
+// the guest-physical address (zero) to check translation.
+constexpr std::uint64_t FrontendAddr = 0x7f0000000000;
+constexpr std::uint16_t QueueSize = 8;
+constexpr std::size_t NetHdrSize = 12;
+constexpr std::size_t FrameLen = 100;
+constexpr std::size_t RxBufSize = 64;
+constexpr std::size_t NumRxBufs = 4;
+
+constexpr std::uint64_t FeatureMrgRxbuf = std::uint64_t(1) << 15;
+constexpr std::uint64_t FeatureProtocolFeatures = std::uint64_t(1) << 30;
+constexpr std::uint64_t FeatureVersion1 = std::uint64_t(1) << 32;
+constexpr std::uint64_t ProtocolFeatureReplyAck = std::uint64_t(1) << 3;
+
+struct VringDesc {
+    std::uint64_t addr;
+    std::uint32_t len;
+    std::uint16_t flags;
+    std::uint16_t next;
+};
+
+struct VringUsedElem {
+    std::uint32_t id;
+    std::uint32_t len;
+};
+
+// Offsets of the rings of each queue and of the buffers in guest memory.
+constexpr std::uint64_t queue_desc (int q) { return 0x0000 + 0x3000 * std::uint64_t(q); }
+constexpr std::uint64_t queue_avail (int q) { return 0x1000 + 0x3000 * std::uint64_t(q); }
+constexpr std::uint64_t queue_used (int q) { return 0x2000 + 0x3000 * std::uint64_t(q); }
+constexpr std::uint64_t TxBufAddr = 0x10000;
+constexpr std::uint64_t RxBufAddr = 0x20000;
+
+char frame_byte (std::size_t i)
+{
+    return char(i * 7 + 3);
+}
+
+class Frontend
+{
+public:
+    Frontend () :
+        m_mem_fd(::memfd_create("guest", 0))
+    {
+        AIPSTACK_ASSERT_FORCE(m_mem_fd >= 0);
+        AIPSTACK_ASSERT_FORCE(::ftruncate(m_mem_fd, GuestMemSize) == 0);
+        void *mem = ::mmap(nullptr, GuestMemSize, PROT_READ|PROT_WRITE, MAP_SHARED,
+                           m_mem_fd, 0);
+        AIPSTACK_ASSERT_FORCE(mem != MAP_FAILED);
+        m_mem = static_cast<char *>(mem);
+
+        for (int q = 0; q < 2; q++) {
+            m_kick_fd[q] = ::eventfd(0, EFD_CLOEXEC);
+            m_call_fd[q] = ::eventfd(0, EFD_CLOEXEC);
+            AIPSTACK_ASSERT_FORCE(m_kick_fd[q] >= 0 && m_call_fd[q] >= 0);
+        }
+    }
+
+    ~Frontend ()
+    {
+        for (int q = 0; q < 2; q++) {
+            ::close(m_kick_fd[q]);
+            ::close(m_call_fd[q]);
+        }
+        ::munmap(m_mem, GuestMemSize);
+        ::close(m_mem_fd);
+    }
+
+    void run ()
+    {
+        m_sock = ::socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+        AIPSTACK_ASSERT_FORCE(m_sock >= 0);
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, SocketPath);
+        AIPSTACK_ASSERT_FORCE(::connect(m_sock,
+            reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0);
+
+        std::uint64_t features = request_u64(1);
+        AIPSTACK_ASSERT_FORCE((features & FeatureVersion1) != 0);
+        AIPSTACK_ASSERT_FORCE((features & FeatureMrgRxbuf) != 0);
+        send_u64(2, FeatureVersion1|FeatureMrgRxbuf|FeatureProtocolFeatures);
+
+        std::uint64_t protocol_features = request_u64(15);
+        AIPSTACK_ASSERT_FORCE((protocol_features & ProtocolFeatureReplyAck) != 0);
+        send_u64(16, ProtocolFeatureReplyAck);
+
+        // From now on, each message is acknowledged on request.
+        send_msg(3, true, nullptr, 0, -1);
+
+        struct {
+            std::uint32_t num_regions;
+            std::uint32_t padding;
+            std::uint64_t guest_phys_addr;
+            std::uint64_t memory_size;
+            std::uint64_t userspace_addr;
+            std::uint64_t mmap_offset;
+        } mem_table = {1, 0, 0, GuestMemSize, FrontendAddr, 0};
+        send_msg(5, true, &mem_table, sizeof(mem_table), m_mem_fd);
+
+        for (int q = 0; q < 2; q++) {
+            std::uint32_t state[2] = {std::uint32_t(q), QueueSize};
+            send_msg(8, true, state, sizeof(state), -1);
+            state[1] = 0;
+            send_msg(10, true, state, sizeof(state), -1);
+
+            struct {
+                std::uint32_t index;
+                std::uint32_t flags;
+                std::uint64_t desc;
+                std::uint64_t used;
+                std::uint64_t avail;
+                std::uint64_t log;
+            } vring_addr = {std::uint32_t(q), 0, FrontendAddr + queue_desc(q),
+                FrontendAddr + queue_used(q), FrontendAddr + queue_avail(q), 0};
+            send_msg(9, true, &vring_addr, sizeof(vring_addr), -1);
+
+            std::uint64_t index = std::uint64_t(q);
+            send_msg(13, true, &index, sizeof(index), m_call_fd[q]);
+            send_msg(12, true, &index, sizeof(index), m_kick_fd[q]);
+
+            state[1] = 1;
+            send_msg(18, true, state, sizeof(state), -1);
+        }
+
+        // Make small receive buffers available.
+        for (std::uint16_t i = 0; i < NumRxBufs; i++) {
+            VringDesc desc = {RxBufAddr + i * RxBufSize, RxBufSize, 2, 0};
+            std::memcpy(m_mem + queue_desc(0) + sizeof(desc) * i, &desc, sizeof(desc));
+            std::memcpy(m_mem + queue_avail(0) + 4 + 2 * i, &i, 2);
+        }
+        store_idx(queue_avail(0) + 2, NumRxBufs);
+
+        // Send a frame in a chain of three descriptors, the first one only
+        // containing the virtio-net header.
+        char *tx_buf = m_mem + TxBufAddr;
+        std::memset(tx_buf, 0, NetHdrSize);
+        for (std::size_t i = 0; i < FrameLen; i++) {
+            tx_buf[NetHdrSize + i] = frame_byte(i);
+        }
+        VringDesc tx_descs[3] = {
+            {TxBufAddr, NetHdrSize, 1, 1},
+            {TxBufAddr + NetHdrSize, 30, 1, 2},
+            {TxBufAddr + NetHdrSize + 30, FrameLen - 30, 0, 0},
+        };
+        std::memcpy(m_mem + queue_desc(1), tx_descs, sizeof(tx_descs));
+        std::uint16_t head = 0;
+        std::memcpy(m_mem + queue_avail(1) + 4, &head, 2);
+        store_idx(queue_avail(1) + 2, 1);
+        signal_fd(m_kick_fd[1]);
+
+        // The frame comes back in the receive queue, and the transmit buffers
+        // are returned.
+        wait_fd(m_call_fd[1]);
+        AIPSTACK_ASSERT_FORCE(load_idx(queue_used(1) + 2) == 1);
+        VringUsedElem tx_used;
+        std::memcpy(&tx_used, m_mem + queue_used(1) + 4, sizeof(tx_used));
+        AIPSTACK_ASSERT_FORCE(tx_used.id == 0);
+
+        wait_fd(m_call_fd[0]);
+        AIPSTACK_ASSERT_FORCE(load_idx(queue_used(0) + 2) == 2);
+        VringUsedElem rx_used[2];
+        std::memcpy(rx_used, m_mem + queue_used(0) + 4, sizeof(rx_used));
+        AIPSTACK_ASSERT_FORCE(rx_used[0].id == 0 && rx_used[0].len == RxBufSize);
+        AIPSTACK_ASSERT_FORCE(rx_used[1].id == 1 &&
+                              rx_used[1].len == NetHdrSize + FrameLen - RxBufSize);
+
+        char *rx_buf = m_mem + RxBufAddr;
+        std::uint16_t num_buffers;
+        std::memcpy(&num_buffers, rx_buf + 10, 2);
+        AIPSTACK_ASSERT_FORCE(num_buffers == 2);
+        for (std::size_t i = 0; i < FrameLen; i++) {
+            AIPSTACK_ASSERT_FORCE(rx_buf[NetHdrSize + i] == frame_byte(i));
+        }
+
+        // Stopping a queue returns the index where to continue.
+        std::uint32_t state[2] = {1, 0};
+        send_msg(11, false, state, sizeof(state), -1);
+        recv_reply(11, state, sizeof(state));
+        AIPSTACK_ASSERT_FORCE(state[1] == 1);
+
+        ::close(m_sock);
+    }
+
+private:
+    void send_msg (std::uint32_t request, bool need_reply, void const *payload,
+                   std::size_t size, int fd)
+    {
+        std::uint32_t hdr[3] = {request, need_reply ? 0x9u : 0x1u, std::uint32_t(size)};
+
+        struct iovec iov[2];
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = const_cast<void *>(payload);
+        iov[1].iov_len = size;
+
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+
+        struct msghdr mh = {};
+        mh.msg_iov = iov;
+        mh.msg_iovlen = 2;
+        if (fd >= 0) {
+            mh.msg_control = control.buf;
+            mh.msg_controllen = sizeof(control.buf);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        auto res = ::sendmsg(m_sock, &mh, 0);
+        AIPSTACK_ASSERT_FORCE(res == ssize_t(sizeof(hdr) + size));
+
+        if (need_reply) {
+            std::uint64_t ack;
+            recv_reply(request, &ack, sizeof(ack));
+            AIPSTACK_ASSERT_FORCE(ack == 0);
+        }
+    }
+
+    void recv_reply (std::uint32_t request, void *payload, std::size_t size)
+    {
+        std::uint32_t hdr[3];
+        AIPSTACK_ASSERT_FORCE(::recv(m_sock, hdr, sizeof(hdr), MSG_WAITALL) ==
+                              ssize_t(sizeof(hdr)));
+        AIPSTACK_ASSERT_FORCE(hdr[0] == request);
+        AIPSTACK_ASSERT_FORCE(hdr[1] == (0x1 | 0x4));
+        AIPSTACK_ASSERT_FORCE(hdr[2] == size);
+        AIPSTACK_ASSERT_FORCE(::recv(m_sock, payload, size, MSG_WAITALL) ==
+                              ssize_t(size));
+    }
+
+    std::uint64_t request_u64 (std::uint32_t request)
+    {
+        send_msg(request, false, nullptr, 0, -1);
+        std::uint64_t value;
+        recv_reply(request, &value, sizeof(value));
+        return value;
+    }
+
+    void send_u64 (std::uint32_t request, std::uint64_t value)
+    {
+        send_msg(request, false, &value, sizeof(value), -1);
+    }
+
+    void store_idx (std::uint64_t offset, std::uint16_t value)
+    {
+        __atomic_store_n(reinterpret_cast<std::uint16_t *>(m_mem + offset), value,
+                         __ATOMIC_RELEASE);
+    }
+
+    std::uint16_t load_idx (std::uint64_t offset)
+    {
+        return __atomic_load_n(reinterpret_cast<std::uint16_t *>(m_mem + offset),
+                               __ATOMIC_ACQUIRE);
+    }
+
+    static void signal_fd (int fd)
+    {
+        std::uint64_t value = 1;
+        AIPSTACK_ASSERT_FORCE(::write(fd, &value, sizeof(value)) == sizeof(value));
+    }
+
+    static void wait_fd (int fd)
+    {
+        std::uint64_t value;
+        AIPSTACK_ASSERT_FORCE(::read(fd, &value, sizeof(value)) == sizeof(value));
+    }
+
+private:
+    int m_mem_fd;
+    char *m_mem;
+    int m_sock = -1;
+    int m_kick_fd[2];
+    int m_call_fd[2];
+};
+
+class Test
+{
+public:
+    Test () :
+        m_device(m_loop, SocketPath,
+                 AIPSTACK_BIND_MEMBER(&Test::frameReceived, this)),
+        m_done_signal(m_loop, AIPSTACK_BIND_MEMBER(&Test::doneSignaled, this))
+    {}
+
+    void run ()
+    {
+        AIPSTACK_ASSERT_FORCE(!m_device.isReady());
+
+        std::thread frontend_thread([this] {
+            m_frontend.run();
+            m_done_signal.signal();
+        });
+        m_loop.run();
+        frontend_thread.join();
+
+        AIPSTACK_ASSERT_FORCE(m_frames_received == 1);
+    }
+
+private:
+    void frameReceived (IpBufRef frame)
+    {
+        AIPSTACK_ASSERT_FORCE(frame.tot_len == FrameLen);
+
+        char data[FrameLen];
+        ipBufTakeBytes(frame, FrameLen, data);
+        for (std::size_t i = 0; i < FrameLen; i++) {
+            AIPSTACK_ASSERT_FORCE(data[i] == frame_byte(i));
+        }
+        m_frames_received++;
+
+        // Send the frame back while it still references the guest memory.
+        AIPSTACK_ASSERT_FORCE(m_device.isReady());
+        AIPSTACK_ASSERT_FORCE(m_device.sendFrame(frame) == IpErr::Success);
+    }
+
+    void doneSignaled ()
+    {
+        m_loop.stop();
+    }
+
+private:
+    EventLoop m_loop;
+    Frontend m_frontend;
+    VhostUserDevice m_device;
+    EventLoopAsyncSignal m_done_signal;
+    std::size_t m_frames_received = 0;
+};
+
+}
+
+int main ()
+{
+    using namespace aipstack_vhost_user_device_test;
+
+    Test test;
+    test.run();
+
+    std::printf("vhost-user frame exchange OK\n");
+
+    return 0;
+}